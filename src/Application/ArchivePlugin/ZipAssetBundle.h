@@ -4,11 +4,23 @@
 
 #include "AssetAPI.h"
 #include "IAssetBundle.h"
-#include "ZipWorker.h"
+
+#include <QHash>
+#include <QMutex>
 
 struct zzip_dir;
 
+/// A file in a zip archive.
+struct ZipArchiveFile
+{
+    QString relativePath;
+    uint compressedSize;
+    uint uncompressedSize;
+};
+
 /// Provides zip packed asset bundle support.
+/** The central directory of the archive is read when the bundle is loaded, and the archive is kept open. The sub assets are
+    unpacked into memory on demand, in the worker threads of AssetAPI, so nothing is extracted to the disk. */
 class ZipAssetBundle : public IAssetBundle
 {
     Q_OBJECT
@@ -25,10 +37,7 @@ public:
     virtual bool RequiresDiskSource() { return true; }
 
     /// IAssetBundle override.
-    /** Our current zziplib implementation requires disk source for processing.
-        So we fail DeserializeFromData and try our best here to.
-        This function unpacks the archive content to asset cache to normal cache files
-        and provides the sub asset data via GetSubAssetData and GetSubAssetDiskSource. */
+    /** Opens the archive from the disk source and reads its central directory. */
     virtual bool DeserializeFromDiskSource();
 
     /// IAssetBundle override.
@@ -42,32 +51,33 @@ public:
     virtual int SubAssetCount() const { return fileCount_; }
 
     /// IAssetBundle override.
+    /** Unpacks the sub asset from the archive. Thread-safe, the unpacks of the sub assets of one archive are serialized. */
     virtual std::vector<u8> GetSubAssetData(const QString &subAssetName);
 
     /// IAssetBundle override.
+    /** The sub assets are not extracted to the disk, so this returns an empty string. */
     virtual QString GetSubAssetDiskSource(const QString &subAssetName);
-    
-private slots:
-    /// Returns full asset reference for a sub asset.
-    QString GetFullAssetReference(const QString &subAssetName);
-    
-    /// Handler for asynch loading completion.
-    void OnAsynchLoadCompleted(bool successful);
-    
+
+    /// IAssetBundle override.
+    virtual bool IsSubAssetDataThreadSafe() const { return true; }
+
 private:
     /// IAssetBundle override.
     virtual void DoUnload();
 
-    /// Closes zip file.
+    /// Closes zip file. Call with mutex_ locked.
     void Close();
-    
-    /// Zziplib ptr to the zip file.
+
+    /// Guards archive_ and files_, which GetSubAssetData uses in worker threads.
+    QMutex mutex_;
+
+    /// Zziplib ptr to the zip file, open while the bundle is loaded.
     zzip_dir *archive_;
     
-    /// Zip sub assets.
-    ZipFileList files_;
+    /// Zip sub assets by lower case relative path.
+    QHash<QString, ZipArchiveFile> files_;
 
-    /// Count of files inside this zip.
+    /// Count of files inside this zip, or -1 if the bundle is not loaded.
     int fileCount_;
 };
 
@@ -9,6 +9,7 @@
 #include "LoggingFunctions.h"
 #include "Math/float3.h"
 #include "Geometry/Circle.h"
+#include "Geometry/LineSegment.h"
 
 #include "SceneAPI.h"
 #include "Scene.h"
@@ -50,14 +51,22 @@
 #include <QMenu>
 #include <QAction>
 
+#include <algorithm>
+
 AssetInterestPlugin::AssetInterestPlugin() :
     IModule("AssetInterestPlugin"),
     // Internal variables
     processTick_(0.0f),
     shouldLoad_(true),
+    hasCameraPos_(false),
+    lastCameraPos_(float3::zero),
+    cameraVelocity_(float3::zero),
     widget_(0),
     // QObject properties
     interestRadius(100.0f),
+    predictionTime(2.0),
+    unloadHysteresis(0.25),
+    reloadDelay(5.0),
     enabled(false),
     processTextures(true),
     processMeshes(false),
@@ -137,6 +146,21 @@ int CountSize(Ogre::MapIterator<T> iter)
     return count;
 }
 
+namespace
+{
+    /// Camera speed in units per second over which the camera is considered to have teleported.
+    const float cMaxCameraSpeed = 500.0f;
+    /// How much of the velocity of a new process tick is blended into the smoothed camera velocity.
+    const float cVelocitySmoothing = 0.3f;
+
+    /// Returns the load priority of an asset by its distance to the predicted camera path,
+    /// in the same scale as the distance priority of AssetAPI. Assets needed right now get one more.
+    float LoadPriority(float predictedDistance, bool neededNow)
+    {
+        return 1.0f / (1.0f + predictedDistance * 0.1f) + (neededNow ? 1.0f : 0.0f);
+    }
+}
+
 void AssetInterestPlugin::Update(f64 frametime)
 {
     // Initial checks
@@ -161,7 +185,16 @@ void AssetInterestPlugin::Update(f64 frametime)
             EC_Placeable *d_placeable = dynamic_cast<EC_Placeable*>(d_cameraEnt->GetComponent(EC_Placeable::TypeNameStatic()).get());
             OgreWorld *d_ogreWorld = d_cameraEnt->ParentScene()->GetWorld<OgreWorld>().get();
             if (d_placeable && d_ogreWorld)
+            {
                 d_ogreWorld->DebugDrawSphere(d_placeable->WorldPosition(), interestRadius, 8748, 1, 0, 0, true);
+                // The predicted camera position and the prefetch path to it.
+                float3 d_prediction = cameraVelocity_ * (float)(predictionTime > 0 ? predictionTime : 0);
+                if (d_prediction.LengthSq() > 1.0f)
+                {
+                    d_ogreWorld->DebugDrawSphere(d_placeable->WorldPosition() + d_prediction, interestRadius, 8748, 0, 1, 0, true);
+                    d_ogreWorld->DebugDrawLine(d_placeable->WorldPosition(), d_placeable->WorldPosition() + d_prediction, 0, 1, 0, true);
+                }
+            }
         }
     }
 
@@ -179,8 +212,19 @@ void AssetInterestPlugin::Update(f64 frametime)
     processTick_ += frametime;
     if (processTick_ < 0.1)
         return;
+    const float tickTime = processTick_;
     processTick_ = 0.0;
 
+    // Count down the reload delays of the recently unloaded assets.
+    for(QHash<QString, float>::iterator delayIter = recentlyUnloaded_.begin(); delayIter != recentlyUnloaded_.end();)
+    {
+        delayIter.value() -= tickTime;
+        if (delayIter.value() <= 0.0f)
+            delayIter = recentlyUnloaded_.erase(delayIter);
+        else
+            ++delayIter;
+    }
+
     // These lists will have all asset refs inside our radius.
     // With this we can skip unloading refs that are both 
     // in and outside of our interest radius!
@@ -197,8 +241,22 @@ void AssetInterestPlugin::Update(f64 frametime)
         EC_Camera *camera = dynamic_cast<EC_Camera*>(cameraEnt->GetComponent(EC_Camera::TypeNameStatic()).get());
         EC_Placeable *placeable = dynamic_cast<EC_Placeable*>(cameraEnt->GetComponent(EC_Placeable::TypeNameStatic()).get());
         if (!camera || !placeable)
+        {
+            hasCameraPos_ = false;
             return;
+        }
         float3 cameraPos = placeable->WorldPosition();
+        UpdateCameraVelocity(cameraPos, tickTime);
+
+        // Assets are interesting if they are close to the path from the camera to its predicted position.
+        // They are unloaded only once they are past the hysteresis band outside of the interest radius.
+        const bool predict = predictionTime > 0 && !cameraVelocity_.IsZero();
+        const LineSegment heading(cameraPos, cameraPos + cameraVelocity_ * (float)(predict ? predictionTime : 0));
+        const float unloadRadius = (float)(interestRadius * (1.0 + (unloadHysteresis > 0 ? unloadHysteresis : 0)));
+
+        // Pending loads are collected again with the priorities of this tick.
+        matsPendingLoad_.clear();
+        meshPendingLoad_.clear();
 
         PROFILE(AssetInterestPlugin_Update_Iter_Scene);
 
@@ -221,8 +279,13 @@ void AssetInterestPlugin::Update(f64 frametime)
             // Check if internal Ogre::Entity* has been created.
             if (entM->HasMesh())
             {
-                // Distance from the camera.
-                float distance = cameraPos.Distance(entP->WorldPosition());
+                // Distance from the camera and from the predicted camera path.
+                const float3 entPos = entP->WorldPosition();
+                const float distance = cameraPos.Distance(entPos);
+                const float predictedDistance = predict ? heading.Distance(entPos) : distance;
+                const bool neededNow = distance <= interestRadius;
+                const bool interesting = predictedDistance <= interestRadius;
+                const float priority = LoadPriority(predictedDistance, neededNow);
 
                 // Materials and textures
                 if (processTextures)
@@ -238,15 +301,15 @@ void AssetInterestPlugin::Update(f64 frametime)
                         if (!matAsset)
                             continue;
 
-                        if (distance > interestRadius)
+                        if (predictedDistance > unloadRadius)
                         {
                             if (matAsset->IsLoaded() && !matsPendingUnload_.contains(ref))
                                 matsPendingUnload_ << ref;
                         }
                         else
                         {
-                            if (!matAsset->IsLoaded() && !matsPendingLoad_.contains(ref))
-                                matsPendingLoad_ << ref;
+                            if (interesting && !matAsset->IsLoaded() && (neededNow || !recentlyUnloaded_.contains(ref)))
+                                AddPendingLoad(matsPendingLoad_, ref, priority);
                             if (!matsInRadius.contains(ref))
                                 matsInRadius << ref;
                         }
@@ -262,15 +325,15 @@ void AssetInterestPlugin::Update(f64 frametime)
                         OgreMeshAsset *meshAsset = dynamic_cast<OgreMeshAsset*>(GetFramework()->Asset()->GetAsset(ref).get());
                         if (meshAsset)
                         {
-                            if (distance > interestRadius)
+                            if (predictedDistance > unloadRadius)
                             {
                                 if (meshAsset->IsLoaded() && !meshPendingUnload_.contains(ref))
                                     meshPendingUnload_ << ref;
                             }
                             else
                             {
-                                if (!meshAsset->IsLoaded() && !meshPendingLoad_.contains(ref))
-                                    meshPendingLoad_ << ref;
+                                if (interesting && !meshAsset->IsLoaded() && (neededNow || !recentlyUnloaded_.contains(ref)))
+                                    AddPendingLoad(meshPendingLoad_, ref, priority);
                                 if (!meshesInRadius.contains(ref))
                                     meshesInRadius << ref;
                             }
@@ -318,6 +381,8 @@ void AssetInterestPlugin::Update(f64 frametime)
                 }
                 if (matAsset->DiskSourceType() == IAsset::Programmatic)
                     framework_->Asset()->ForgetAsset(matUnloadRef, false);
+                if (reloadDelay > 0)
+                    recentlyUnloaded_[matUnloadRef] = (float)reloadDelay;
 
                 if (widget_ && widget_->isVisible())
                     ui_.unloadMaterial->setText(QString::number(texUnloaded) + " textures + " + matUnloadRef);
@@ -343,6 +408,8 @@ void AssetInterestPlugin::Update(f64 frametime)
                 meshAsset->Unload();
                 if (meshAsset->DiskSourceType() == IAsset::Programmatic)
                     framework_->Asset()->ForgetAsset(meshUnloadRef, false);
+                if (reloadDelay > 0)
+                    recentlyUnloaded_[meshUnloadRef] = (float)reloadDelay;
 
                 if (widget_ && widget_->isVisible())
                     ui_.unloadMesh->setText(meshUnloadRef);
@@ -367,23 +434,9 @@ void AssetInterestPlugin::Update(f64 frametime)
     // Process next material load
     if (shouldLoad_ && !matsPendingLoad_.isEmpty())
     {
-        QSet<QString>::iterator loadIter = matsPendingLoad_.begin();
-        if (loadIter != matsPendingLoad_.end())
-        {
-            QString matLoadRef = *loadIter;
-            AssetTransferPtr tranfer = GetFramework()->Asset()->RequestAsset(matLoadRef);
-            if (tranfer.get())
-            {
-                if (connect(tranfer.get(), SIGNAL(Succeeded(AssetPtr)), SLOT(TransferDone()), Qt::UniqueConnection) &&
-                    connect(tranfer.get(), SIGNAL(Failed(IAssetTransfer*, QString)), SLOT(TransferDone()), Qt::UniqueConnection))
-                {
-                    shouldLoad_ = false;
-                    if (widget_ && widget_->isVisible())
-                        ui_.loadMaterial->setText("Textures of " + matLoadRef);
-                }
-            }
-            matsPendingLoad_.erase(loadIter);
-        }
+        QString matLoadRef = RequestNextLoad(matsPendingLoad_);
+        if (!shouldLoad_ && widget_ && widget_->isVisible())
+            ui_.loadMaterial->setText("Textures of " + matLoadRef);
     }
     else if (widget_ && widget_->isVisible() && shouldLoad_ && matsPendingLoad_.isEmpty() && ui_.loadMaterial->text() != "none")
         ui_.loadMaterial->setText("none");
@@ -391,23 +444,9 @@ void AssetInterestPlugin::Update(f64 frametime)
     // Process next mesh load
     if (shouldLoad_ && !meshPendingLoad_.isEmpty())
     {
-        QSet<QString>::iterator loadIter = meshPendingLoad_.begin();
-        if (loadIter != meshPendingLoad_.end())
-        {
-            QString meshLoadRef = *loadIter;
-            AssetTransferPtr tranfer = GetFramework()->Asset()->RequestAsset(meshLoadRef);
-            if (tranfer.get())
-            {
-                if (connect(tranfer.get(), SIGNAL(Succeeded(AssetPtr)), SLOT(TransferDone()), Qt::UniqueConnection) &&
-                    connect(tranfer.get(), SIGNAL(Failed(IAssetTransfer*, QString)), SLOT(TransferDone()), Qt::UniqueConnection))
-                {
-                    shouldLoad_ = false;
-                    if (widget_ && widget_->isVisible())
-                        ui_.loadMesh->setText(meshLoadRef);
-                }
-            }
-            meshPendingLoad_.erase(loadIter);
-        }
+        QString meshLoadRef = RequestNextLoad(meshPendingLoad_);
+        if (!shouldLoad_ && widget_ && widget_->isVisible())
+            ui_.loadMesh->setText(meshLoadRef);
     } 
     else if (widget_ && widget_->isVisible() && shouldLoad_ && meshPendingLoad_.isEmpty() && ui_.loadMesh->text() != "none")
         ui_.loadMesh->setText("none");
@@ -442,9 +481,17 @@ void AssetInterestPlugin::OnSceneAdded(const QString &name)
             this, SLOT(OnComponentRemoved(Entity*, IComponent*, AttributeChange::Type)), Qt::UniqueConnection);
         connect(scene.get(), SIGNAL(EntityRemoved(Entity*, AttributeChange::Type)), 
             this, SLOT(OnEntityRemoved(Entity*, AttributeChange::Type)), Qt::UniqueConnection);
+        connect(scene.get(), SIGNAL(EntitiesRemoved(const EntityList &, AttributeChange::Type)), 
+            this, SLOT(OnEntitiesRemoved(const EntityList &, AttributeChange::Type)), Qt::UniqueConnection);
     }
 }
 
+void AssetInterestPlugin::OnEntitiesRemoved(const EntityList &entities, AttributeChange::Type change)
+{
+    for(EntityList::const_iterator it = entities.begin(); it != entities.end(); ++it)
+        OnEntityRemoved(it->get(), change);
+}
+
 void AssetInterestPlugin::OnEntityRemoved(Entity *entity, AttributeChange::Type change)
 {
     if (inspectRemovedEntities && entity)
@@ -537,6 +584,58 @@ Entity *AssetInterestPlugin::MainCamera()
     return 0;
 }
 
+void AssetInterestPlugin::UpdateCameraVelocity(const float3 &cameraPos, float timeStep)
+{
+    if (hasCameraPos_ && timeStep > 0.0f)
+    {
+        float3 velocity = (cameraPos - lastCameraPos_) / timeStep;
+        // Do not predict from a camera switch or a teleport.
+        if (velocity.LengthSq() > cMaxCameraSpeed * cMaxCameraSpeed)
+            cameraVelocity_ = float3::zero;
+        else
+            cameraVelocity_ = cameraVelocity_.Lerp(velocity, cVelocitySmoothing);
+    }
+    else
+        cameraVelocity_ = float3::zero;
+    lastCameraPos_ = cameraPos;
+    hasCameraPos_ = true;
+}
+
+void AssetInterestPlugin::AddPendingLoad(QHash<QString, float> &pending, const QString &ref, float priority)
+{
+    QHash<QString, float>::iterator iter = pending.find(ref);
+    if (iter == pending.end())
+        pending.insert(ref, priority);
+    else if (iter.value() < priority)
+        iter.value() = priority;
+}
+
+QString AssetInterestPlugin::RequestNextLoad(QHash<QString, float> &pending)
+{
+    QHash<QString, float>::iterator loadIter = pending.begin();
+    for(QHash<QString, float>::iterator iter = pending.begin(); iter != pending.end(); ++iter)
+        if (iter.value() > loadIter.value())
+            loadIter = iter;
+    if (loadIter == pending.end())
+        return "";
+
+    QString loadRef = loadIter.key();
+    float priority = loadIter.value();
+    pending.erase(loadIter);
+
+    AssetTransferPtr tranfer = GetFramework()->Asset()->RequestAsset(loadRef);
+    if (tranfer.get())
+    {
+        // The priority carries over to the dependencies, eg. the textures of a material.
+        // Do not lower the priority if someone else requested the asset already.
+        tranfer->SetPriority(std::max(tranfer->Priority(), priority));
+        if (connect(tranfer.get(), SIGNAL(Succeeded(AssetPtr)), SLOT(TransferDone()), Qt::UniqueConnection) &&
+            connect(tranfer.get(), SIGNAL(Failed(IAssetTransfer*, QString)), SLOT(TransferDone()), Qt::UniqueConnection))
+            shouldLoad_ = false;
+    }
+    return loadRef;
+}
+
 void AssetInterestPlugin::SetEnabled(bool enabled_)
 {
     enabled = enabled_;
@@ -606,8 +705,27 @@ void AssetInterestPlugin::SetWaitAfterLoad(int intervalMsec)
     }
 }
 
+void AssetInterestPlugin::SetPredictionTime(double seconds)
+{
+    predictionTime = seconds;
+}
+
+void AssetInterestPlugin::SetUnloadHysteresis(double fraction)
+{
+    unloadHysteresis = fraction < 0 ? 0 : fraction;
+}
+
+void AssetInterestPlugin::SetReloadDelay(double seconds)
+{
+    reloadDelay = seconds < 0 ? 0 : seconds;
+    if (reloadDelay <= 0)
+        recentlyUnloaded_.clear();
+}
+
 void AssetInterestPlugin::LoadEverythingBack()
 {
+    recentlyUnloaded_.clear();
+    hasCameraPos_ = false;
     if (!Connected())
         return;
 
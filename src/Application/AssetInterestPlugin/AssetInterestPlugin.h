@@ -11,6 +11,7 @@
 #include "AssetFwd.h"
 #include "OgreModuleFwd.h"
 #include "Math/MathFwd.h"
+#include "Math/float3.h"
 #include "AttributeChangeType.h"
 
 #include <OgreTextureManager.h>
@@ -20,6 +21,7 @@
 
 #include <QString>
 #include <QSet>
+#include <QHash>
 #include <QTimer>
 #include <QPointer>
 
@@ -39,6 +41,13 @@ class Entity;
     are outside of our interest (there for we never get the asset references) this
     plugin is one way to implement something quickly and to prototype. This plugin
     does not try to be a end-all-be-all solution for the client side scalability problem!
+
+    The camera velocity is tracked to predict where the camera will be after 'predictionTime'
+    seconds. Assets along the heading between the current and the predicted position are 
+    prefetched before the camera gets to them, the ones needed right now and nearest to the 
+    predicted path first, and the priority is given to AssetAPI with the transfer. Assets are 
+    only unloaded further out than the interest radius ('unloadHysteresis'), and an asset that 
+    was just unloaded is not prefetched again until 'reloadDelay' seconds have passed.
 */
 class AssetInterestPlugin : public IModule
 {
@@ -74,6 +83,18 @@ Q_PROPERTY(int waitAfterLoad READ WaitAfterLoad WRITE SetWaitAfterLoad)
 /// Debug draw radius. Can be useful when finding good radius limits for your scene. Default value is false.
 Q_PROPERTY(bool drawDebug READ DragDebug WRITE SetDrawDebug)
 
+/// How many seconds ahead the camera position is predicted from its velocity, to prefetch assets along the heading.
+/// Having this <= 0 disables the prediction. Default value is 2.0.
+Q_PROPERTY(double predictionTime READ PredictionTime WRITE SetPredictionTime)
+
+/// Fraction of the interest radius that assets also have to be past before they are unloaded, 
+/// so that assets at the edge of the radius are not unloaded and loaded back over and over. Default value is 0.25.
+Q_PROPERTY(double unloadHysteresis READ UnloadHysteresis WRITE SetUnloadHysteresis)
+
+/// Time in seconds an unloaded asset is not prefetched back. Assets that come inside the 
+/// interest radius of the current camera position are still loaded right away. Default value is 5.0.
+Q_PROPERTY(double reloadDelay READ ReloadDelay WRITE SetReloadDelay)
+
 public:
     AssetInterestPlugin();
     virtual ~AssetInterestPlugin();
@@ -83,6 +104,9 @@ public:
     void Update(f64 frametime);
 
     double interestRadius;
+    double predictionTime;
+    double unloadHysteresis;
+    double reloadDelay;
     int waitAfterLoad;
 
     bool enabled;
@@ -99,6 +123,9 @@ public slots:
     bool DragDebug()                            { return drawDebug; }
     double InterestRadius()                     { return interestRadius; }
     int WaitAfterLoad()                         { return waitAfterLoad; }
+    double PredictionTime()                     { return predictionTime; }
+    double UnloadHysteresis()                   { return unloadHysteresis; }
+    double ReloadDelay()                        { return reloadDelay; }
 
     void SetEnabled(bool enabled_);
     void SetProcessTextures(bool process);
@@ -107,6 +134,9 @@ public slots:
     void SetDrawDebug(bool draw);
     void SetInterestRadius(double radius);
     void SetWaitAfterLoad(int intervalMsec);
+    void SetPredictionTime(double seconds);
+    void SetUnloadHysteresis(double fraction);
+    void SetReloadDelay(double seconds);
 
     void UiToggleSettings();
 
@@ -118,6 +148,7 @@ private slots:
 
     void OnSceneAdded(const QString &name);
     void OnEntityRemoved(Entity *entity, AttributeChange::Type change);
+    void OnEntitiesRemoved(const EntityList &entities, AttributeChange::Type change);
     void OnComponentRemoved(Entity *entity, IComponent *component, AttributeChange::Type change);
 
 private:
@@ -137,6 +168,15 @@ private:
     /// Get scenes main camera parent entity.
     Entity *MainCamera();
 
+    /// Updates the smoothed camera velocity from the camera position of this process tick.
+    void UpdateCameraVelocity(const float3 &cameraPos, float timeStep);
+
+    /// Adds the reference to the pending loads, keeping the highest priority it has been given this tick.
+    void AddPendingLoad(QHash<QString, float> &pending, const QString &ref, float priority);
+
+    /// Requests the highest priority pending load, passing the priority to the transfer. Returns the requested reference.
+    QString RequestNextLoad(QHash<QString, float> &pending);
+
     /// Boolean for tracking if we should load
     bool shouldLoad_;
 
@@ -146,12 +186,20 @@ private:
     /// Timer to do the load wait delay.
     QTimer loadWaitTimer_;
 
-    // Lists for handling asset references
-    QSet<QString> matsPendingLoad_;
+    // Camera tracking for the position prediction
+    bool hasCameraPos_;
+    float3 lastCameraPos_;
+    float3 cameraVelocity_;
+
+    // Lists for handling asset references. The pending loads map to their load priority.
+    QHash<QString, float> matsPendingLoad_;
     QSet<QString> matsPendingUnload_;
-    QSet<QString> meshPendingLoad_;
+    QHash<QString, float> meshPendingLoad_;
     QSet<QString> meshPendingUnload_;
 
+    /// Recently unloaded asset references, mapped to the seconds left until they can be prefetched again.
+    QHash<QString, float> recentlyUnloaded_;
+
     // User interface
     QPointer<QWidget> widget_;
     Ui::AssetInterestSettings ui_;
@@ -0,0 +1,747 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#include "StableHeaders.h"
+#define MATH_OGRE_INTEROP
+#include "DebugOperatorNew.h"
+
+#include "AvatarMeshMerger.h"
+#include "AvatarDescAsset.h"
+#include "TextureAsset.h"
+#include "Framework.h"
+#include "FrameAPI.h"
+#include "AssetAPI.h"
+#include "LoggingFunctions.h"
+#include "Profiler.h"
+
+#include <Ogre.h>
+
+#include <QCryptographicHash>
+#include <QPainter>
+#include <QRunnable>
+#include <QAtomicInt>
+#include <QRectF>
+
+#include <algorithm>
+#include <map>
+#include <set>
+
+#include "MemoryLeakCheck.h"
+
+namespace
+{
+/// Largest width and height of the atlases.
+const int cMaxAtlasSize = 2048;
+/// Pixels between the textures in an atlas, filled with their edge pixels so that the mip levels do not bleed.
+const int cAtlasPadding = 4;
+/// Slack of the texture coordinates that are still taken to be within [0, 1].
+const float cUvEpsilon = 0.001f;
+
+/// Reads the float vertex element of the semantic as four components, the missing ones as 0, 0, 0, 1.
+/** Returns false if the vertex data does not have the element, or if it is not of a float type. */
+bool ReadElement(const Ogre::VertexData *vertexData, Ogre::VertexElementSemantic semantic, std::vector<Ogre::Vector4> &out)
+{
+    const Ogre::VertexElement *elem = vertexData->vertexDeclaration->findElementBySemantic(semantic);
+    if (!elem || Ogre::VertexElement::getBaseType(elem->getType()) != Ogre::VET_FLOAT1)
+        return false;
+    const unsigned short numComponents = Ogre::VertexElement::getTypeCount(elem->getType());
+
+    Ogre::HardwareVertexBufferSharedPtr buffer = vertexData->vertexBufferBinding->getBuffer(elem->getSource());
+    const size_t vertexSize = buffer->getVertexSize();
+    unsigned char *data = static_cast<unsigned char*>(buffer->lock(Ogre::HardwareBuffer::HBL_READ_ONLY));
+    data += vertexData->vertexStart * vertexSize;
+    out.resize(vertexData->vertexCount);
+    for(size_t i = 0; i < vertexData->vertexCount; ++i)
+    {
+        float *f = 0;
+        elem->baseVertexPointerToElement(data + i * vertexSize, &f);
+        out[i] = Ogre::Vector4(f[0], numComponents > 1 ? f[1] : 0.f, numComponents > 2 ? f[2] : 0.f, numComponents > 3 ? f[3] : 1.f);
+    }
+    buffer->unlock();
+    return true;
+}
+
+/// Returns the handles of the bones of the mesh skeleton mapped to the bones of the same name in the avatar skeleton.
+/** Bones that are not in the avatar skeleton map to its root bone. Empty if the skeletons are the same. */
+std::vector<unsigned short> MapBones(const Ogre::SkeletonPtr &meshSkeleton, const Ogre::SkeletonPtr &skeleton, unsigned short rootBone)
+{
+    std::vector<unsigned short> map;
+    if (meshSkeleton.isNull() || meshSkeleton == skeleton)
+        return map;
+    map.resize(meshSkeleton->getNumBones(), rootBone);
+    for(unsigned short i = 0; i < meshSkeleton->getNumBones(); ++i)
+    {
+        const Ogre::String &name = meshSkeleton->getBone(i)->getName();
+        if (skeleton->hasBone(name))
+            map[i] = skeleton->getBone(name)->getHandle();
+    }
+    return map;
+}
+
+/// Returns the transform of the bone in the binding pose of its skeleton.
+Ogre::Matrix4 BindingPose(Ogre::Bone *bone)
+{
+    // Ogre stores the inverse of the binding pose as the negated position, the inverse scale and the inverse orientation.
+    Ogre::Matrix4 m;
+    m.makeTransform(-bone->_getBindingPoseInversePosition(), Ogre::Vector3::UNIT_SCALE / bone->_getBindingPoseInverseScale(),
+        bone->_getBindingPoseInverseOrientation().Inverse());
+    return m;
+}
+
+/// Returns the key of the shader setup of the material, if it can be drawn from an atlas, or an empty string if not.
+/** The material must have a single technique with a single pass, with a single untransformed 2D texture on the first
+    texture coordinate set. The materials with the same key are drawn with the first of them, with the texture replaced
+    by the atlas. */
+std::string AtlasKey(const Ogre::MaterialPtr &material, Ogre::TexturePtr &texture)
+{
+    if (material.isNull() || material->getNumTechniques() != 1)
+        return std::string();
+    Ogre::Technique *tech = material->getTechnique(0);
+    if (tech->getNumPasses() != 1)
+        return std::string();
+    Ogre::Pass *pass = tech->getPass(0);
+    if (pass->getNumTextureUnitStates() != 1)
+        return std::string();
+    Ogre::TextureUnitState *tus = pass->getTextureUnitState(0);
+    if (tus->getTextureType() != Ogre::TEX_TYPE_2D || tus->getTextureCoordSet() != 0 || tus->getNumFrames() != 1 ||
+        !tus->getEffects().empty() || tus->getTextureTransform() != Ogre::Matrix4::IDENTITY)
+        return std::string();
+
+    texture = Ogre::TextureManager::getSingleton().getByName(tus->getTextureName());
+    if (texture.isNull() || !texture->isLoaded())
+        return std::string();
+    // Only the formats that TextureAsset::ToQImage can read back.
+    const Ogre::PixelFormat format = texture->getFormat();
+    if (format != Ogre::PF_X8R8G8B8 && format != Ogre::PF_A8R8G8B8 && format != Ogre::PF_R5G6B5 && format != Ogre::PF_R8G8B8)
+        return std::string();
+
+    Ogre::StringStream key;
+    key << (pass->hasVertexProgram() ? pass->getVertexProgramName() : Ogre::String()) << "|"
+        << (pass->hasFragmentProgram() ? pass->getFragmentProgramName() : Ogre::String()) << "|"
+        << pass->getLightingEnabled() << pass->getAmbient() << pass->getDiffuse() << pass->getSpecular() << pass->getSelfIllumination()
+        << pass->getShininess() << "|" << pass->getSourceBlendFactor() << pass->getDestBlendFactor() << pass->getDepthWriteEnabled()
+        << pass->getCullingMode() << pass->getAlphaRejectFunction() << pass->getAlphaRejectValue() << "|"
+        << material->getReceiveShadows() << material->getTransparencyCastsShadows();
+    return key.str();
+}
+}
+
+/// The geometry of a submesh, transformed to the binding space of the merged mesh.
+struct AvatarMeshMerger::Source
+{
+    std::vector<Ogre::Vector3> positions;
+    std::vector<Ogre::Vector3> normals;
+    std::vector<Ogre::Vector4> tangents; ///< Empty if the submesh has no tangents.
+    std::vector<Ogre::Vector2> uvs;
+    std::vector<u32> indices;
+    /// Bone assignments, with the handles of the avatar skeleton.
+    std::vector<Ogre::VertexBoneAssignment> boneAssignments;
+    std::string material;
+    int atlas; ///< Index of the atlas, or -1 if drawn with the material.
+    int atlasImage; ///< Index of the texture in the atlas.
+};
+
+/// A merge of an avatar description. Assembles the merged geometry and packs the atlases in a worker thread.
+struct AvatarMeshMerger::Job : public QRunnable
+{
+    /// The textures drawn from one atlas, and the material that draws them.
+    struct Atlas
+    {
+        std::string templateMaterial;
+        std::vector<std::string> textureNames;
+        std::vector<QImage> images;
+        QImage image; ///< The packed atlas, null if the textures did not fit.
+        std::vector<QRectF> rects; ///< The texture coordinate rectangles of the textures in the atlas.
+    };
+
+    /// A submesh of the merged mesh.
+    struct Group
+    {
+        std::string material;
+        int atlas;
+        Source geometry;
+    };
+
+    explicit Job(const QString &hash_) : hash(hash_), hasTangents(false)
+    {
+        setAutoDelete(false);
+    }
+
+    void run()
+    {
+        for(size_t i = 0; i < atlases.size(); ++i)
+            PackAtlas(atlases[i]);
+        Assemble();
+        finished.fetchAndStoreRelease(1);
+    }
+
+    bool IsFinished() { return finished.fetchAndAddAcquire(0) != 0; }
+
+    /// Packs the images of the atlas into rows, halving them until they fit.
+    void PackAtlas(Atlas &atlas)
+    {
+        std::vector<QImage> images = atlas.images;
+        for(int attempt = 0; attempt < 4; ++attempt)
+        {
+            std::vector<size_t> order(images.size());
+            for(size_t i = 0; i < order.size(); ++i)
+                order[i] = i;
+            std::sort(order.begin(), order.end(), HeightGreater(images));
+
+            std::vector<QPoint> positions(images.size());
+            int x = cAtlasPadding, y = cAtlasPadding, rowHeight = 0, width = 0;
+            for(size_t i = 0; i < order.size(); ++i)
+            {
+                const QImage &img = images[order[i]];
+                if (x + img.width() + cAtlasPadding > cMaxAtlasSize)
+                {
+                    x = cAtlasPadding;
+                    y += rowHeight + cAtlasPadding;
+                    rowHeight = 0;
+                }
+                positions[order[i]] = QPoint(x, y);
+                x += img.width() + cAtlasPadding;
+                rowHeight = std::max(rowHeight, img.height());
+                width = std::max(width, x);
+            }
+            const int height = y + rowHeight + cAtlasPadding;
+            if (width > cMaxAtlasSize || height > cMaxAtlasSize)
+            {
+                for(size_t i = 0; i < images.size(); ++i)
+                    images[i] = images[i].scaled(std::max(1, images[i].width() / 2), std::max(1, images[i].height() / 2), Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
+                continue;
+            }
+
+            int atlasWidth = 1, atlasHeight = 1;
+            while(atlasWidth < width)
+                atlasWidth <<= 1;
+            while(atlasHeight < height)
+                atlasHeight <<= 1;
+            atlas.image = QImage(atlasWidth, atlasHeight, QImage::Format_ARGB32);
+            atlas.image.fill(0);
+            atlas.rects.resize(images.size());
+            QPainter painter(&atlas.image);
+            painter.setCompositionMode(QPainter::CompositionMode_Source);
+            for(size_t i = 0; i < images.size(); ++i)
+            {
+                const QImage &img = images[i];
+                const QPoint &p = positions[i];
+                const int w = img.width(), h = img.height(), pad = cAtlasPadding;
+                // Extend the edges into the padding.
+                painter.drawImage(QRect(p.x() - pad, p.y(), pad, h), img, QRect(0, 0, 1, h));
+                painter.drawImage(QRect(p.x() + w, p.y(), pad, h), img, QRect(w - 1, 0, 1, h));
+                painter.drawImage(QRect(p.x(), p.y() - pad, w, pad), img, QRect(0, 0, w, 1));
+                painter.drawImage(QRect(p.x(), p.y() + h, w, pad), img, QRect(0, h - 1, w, 1));
+                painter.drawImage(p, img);
+                atlas.rects[i] = QRectF((qreal)p.x() / atlasWidth, (qreal)p.y() / atlasHeight, (qreal)w / atlasWidth, (qreal)h / atlasHeight);
+            }
+            return;
+        }
+    }
+
+    /// Appends the sources to the groups of their material or atlas.
+    void Assemble()
+    {
+        std::map<std::string, size_t> groupIndices;
+        for(size_t i = 0; i < sources.size(); ++i)
+        {
+            Source &src = sources[i];
+            // The atlas could not be packed: draw the submesh with its own material.
+            if (src.atlas >= 0 && atlases[src.atlas].image.isNull())
+                src.atlas = -1;
+
+            const std::string key = src.atlas >= 0 ? "atlas" + Ogre::StringConverter::toString(src.atlas) : "material" + src.material;
+            std::map<std::string, size_t>::iterator iter = groupIndices.find(key);
+            if (iter == groupIndices.end())
+            {
+                iter = groupIndices.insert(std::make_pair(key, groups.size())).first;
+                groups.push_back(Group());
+                groups.back().material = src.material;
+                groups.back().atlas = src.atlas;
+            }
+
+            Source &dst = groups[iter->second].geometry;
+            const u32 base = (u32)dst.positions.size();
+            dst.positions.insert(dst.positions.end(), src.positions.begin(), src.positions.end());
+            dst.normals.insert(dst.normals.end(), src.normals.begin(), src.normals.end());
+            if (hasTangents)
+            {
+                if (src.tangents.empty())
+                    dst.tangents.resize(dst.positions.size(), Ogre::Vector4(1.f, 0.f, 0.f, 1.f));
+                else
+                    dst.tangents.insert(dst.tangents.end(), src.tangents.begin(), src.tangents.end());
+            }
+            if (src.atlas >= 0)
+            {
+                const QRectF &rect = atlases[src.atlas].rects[src.atlasImage];
+                for(size_t j = 0; j < src.uvs.size(); ++j)
+                    dst.uvs.push_back(Ogre::Vector2((float)(rect.x() + src.uvs[j].x * rect.width()), (float)(rect.y() + src.uvs[j].y * rect.height())));
+            }
+            else
+                dst.uvs.insert(dst.uvs.end(), src.uvs.begin(), src.uvs.end());
+            for(size_t j = 0; j < src.indices.size(); ++j)
+                dst.indices.push_back(base + src.indices[j]);
+            for(size_t j = 0; j < src.boneAssignments.size(); ++j)
+            {
+                Ogre::VertexBoneAssignment vba = src.boneAssignments[j];
+                vba.vertexIndex += base;
+                dst.boneAssignments.push_back(vba);
+            }
+            // Free the copy of the source as soon as it is merged.
+            src = Source();
+        }
+    }
+
+    struct HeightGreater
+    {
+        explicit HeightGreater(const std::vector<QImage> &images_) : images(images_) {}
+        bool operator()(size_t a, size_t b) const { return images[a].height() > images[b].height(); }
+        const std::vector<QImage> &images;
+    };
+
+    QString hash;
+    std::string skeletonName;
+    bool hasTangents;
+    Ogre::AxisAlignedBox bounds;
+    std::vector<Source> sources;
+    std::vector<Atlas> atlases;
+    std::vector<Group> groups; ///< The result.
+    QAtomicInt finished;
+};
+
+MergedAvatarMesh::~MergedAvatarMesh()
+{
+    // The entities and materials that still use the resources keep them alive until they are done with them.
+    if (Ogre::MeshManager::getSingletonPtr() && !meshName.empty())
+        Ogre::MeshManager::getSingleton().remove(meshName);
+    if (Ogre::MaterialManager::getSingletonPtr())
+        for(size_t i = 0; i < atlasMaterials.size(); ++i)
+            Ogre::MaterialManager::getSingleton().remove(atlasMaterials[i]);
+    if (Ogre::TextureManager::getSingletonPtr())
+        for(size_t i = 0; i < atlasTextures.size(); ++i)
+            Ogre::TextureManager::getSingleton().remove(atlasTextures[i]);
+}
+
+AvatarMeshMerger::AvatarMeshMerger(Framework *framework) :
+    framework_(framework),
+    uniqueId_(0)
+{
+    connect(framework_->Frame(), SIGNAL(Updated(float)), SLOT(OnUpdated(float)));
+}
+
+AvatarMeshMerger::~AvatarMeshMerger()
+{
+    threadPool_.waitForDone();
+}
+
+std::string AvatarMeshMerger::ResourceName(AvatarDescAsset *desc, const QString &ref) const
+{
+    return AssetAPI::SanitateAssetRef(framework_->Asset()->ResolveAssetRef(desc->Name(), ref)).toStdString();
+}
+
+QString AvatarMeshMerger::AppearanceHash(AvatarDescAsset *desc) const
+{
+    QStringList parts;
+    parts << QString::fromStdString(ResourceName(desc, desc->mesh_)) << (desc->skeleton_.isEmpty() ? QString() : QString::fromStdString(ResourceName(desc, desc->skeleton_)));
+    for(size_t i = 0; i < desc->materials_.size(); ++i)
+        parts << QString::fromStdString(ResourceName(desc, desc->materials_[i]));
+    for(size_t i = 0; i < desc->attachments_.size(); ++i)
+    {
+        const AvatarAttachment &a = desc->attachments_[i];
+        parts << QString::fromStdString(ResourceName(desc, a.mesh_)) << a.bone_name_ << QString::number(a.link_skeleton_);
+        for(size_t j = 0; j < a.materials_.size(); ++j)
+            parts << QString::fromStdString(ResourceName(desc, a.materials_[j]));
+        parts << a.transform_.position_.toString() << a.transform_.orientation_.toString() << a.transform_.scale_.toString();
+        for(size_t j = 0; j < a.vertices_to_hide_.size(); ++j)
+            parts << QString::number(a.vertices_to_hide_[j]);
+    }
+    parts << QString::number(!desc->morphModifiers_.empty());
+    return QString::fromLatin1(QCryptographicHash::hash(parts.join("|").toUtf8(), QCryptographicHash::Sha1).toHex());
+}
+
+MergedAvatarMeshPtr AvatarMeshMerger::Merge(AvatarDescAsset *desc)
+{
+    if (!desc)
+        return MergedAvatarMeshPtr();
+    const QString hash = AppearanceHash(desc);
+    MergedAvatarMeshPtr merged = cache_.value(hash).lock();
+    if (merged || failed_.contains(hash))
+        return merged;
+    for(std::list<shared_ptr<Job> >::const_iterator iter = jobs_.begin(); iter != jobs_.end(); ++iter)
+        if ((*iter)->hash == hash)
+            return merged;
+
+    shared_ptr<Job> job;
+    try
+    {
+        job = PrepareJob(desc, hash);
+    }
+    catch(const Ogre::Exception &e)
+    {
+        LogWarning("AvatarMeshMerger: Could not read the meshes of avatar " + desc->Name() + ": " + e.what());
+    }
+    if (!job)
+    {
+        failed_[hash] = true;
+        return merged;
+    }
+    jobs_.push_back(job);
+    threadPool_.start(job.get());
+    return merged;
+}
+
+shared_ptr<AvatarMeshMerger::Job> AvatarMeshMerger::PrepareJob(AvatarDescAsset *desc, const QString &hash)
+{
+    PROFILE(AvatarMeshMerger_PrepareJob);
+
+    Ogre::MeshPtr baseMesh = Ogre::MeshManager::getSingleton().getByName(ResourceName(desc, desc->mesh_));
+    if (baseMesh.isNull() || !baseMesh->isLoaded())
+        return shared_ptr<Job>();
+    Ogre::SkeletonPtr skeleton = desc->skeleton_.isEmpty() ? baseMesh->getSkeleton() :
+        Ogre::SkeletonManager::getSingleton().getByName(ResourceName(desc, desc->skeleton_));
+    if (skeleton.isNull() || !skeleton->isLoaded() || skeleton->getNumBones() == 0)
+    {
+        LogDebug("AvatarMeshMerger: Avatar " + desc->Name() + " has no skeleton to skin the merged mesh with.");
+        return shared_ptr<Job>();
+    }
+    const unsigned short rootBone = skeleton->getRootBone()->getHandle();
+
+    shared_ptr<Job> job = MAKE_SHARED(Job, hash);
+    job->skeletonName = skeleton->getName();
+
+    std::set<uint> verticesToHide;
+    for(size_t i = 0; i < desc->attachments_.size(); ++i)
+        verticesToHide.insert(desc->attachments_[i].vertices_to_hide_.begin(), desc->attachments_[i].vertices_to_hide_.end());
+
+    std::map<std::string, size_t> atlasIndices;
+
+    // The base mesh first, then the attachments.
+    for(size_t m = 0; m <= desc->attachments_.size(); ++m)
+    {
+        const AvatarAttachment *attachment = m > 0 ? &desc->attachments_[m - 1] : 0;
+        Ogre::MeshPtr mesh = attachment ? Ogre::MeshManager::getSingleton().getByName(ResourceName(desc, attachment->mesh_)) : baseMesh;
+        if (mesh.isNull() || !mesh->isLoaded())
+            return shared_ptr<Job>();
+        if (mesh->getPoseCount() > 0 && !desc->morphModifiers_.empty())
+        {
+            LogDebug("AvatarMeshMerger: Avatar " + desc->Name() + " has morphs, which are not merged.");
+            return shared_ptr<Job>();
+        }
+        const std::vector<QString> &materialRefs = attachment ? attachment->materials_ : desc->materials_;
+
+        // The transform to the binding space, and the bone that the vertices are skinned to, if not by their own assignments.
+        Ogre::Matrix4 transform = Ogre::Matrix4::IDENTITY;
+        int fixedBone = -1;
+        if (attachment)
+        {
+            transform.makeTransform(attachment->transform_.position_, attachment->transform_.scale_, attachment->transform_.orientation_);
+            const std::string boneName = attachment->bone_name_.toStdString();
+            if (!boneName.empty() && skeleton->hasBone(boneName))
+            {
+                Ogre::Bone *bone = skeleton->getBone(boneName);
+                transform = BindingPose(bone) * transform;
+                fixedBone = bone->getHandle();
+            }
+            else if (!attachment->link_skeleton_ || !mesh->hasSkeleton())
+                fixedBone = rootBone;
+        }
+        Ogre::Matrix3 rotation;
+        transform.extract3x3Matrix(rotation);
+        const Ogre::Matrix3 normalMatrix = rotation.Inverse().Transpose();
+        const std::vector<unsigned short> boneMap = fixedBone < 0 ? MapBones(mesh->getSkeleton(), skeleton, rootBone) : std::vector<unsigned short>();
+
+        for(unsigned short s = 0; s < mesh->getNumSubMeshes(); ++s)
+        {
+            Ogre::SubMesh *sub = mesh->getSubMesh(s);
+            const Ogre::VertexData *vertexData = sub->useSharedVertices ? mesh->sharedVertexData : sub->vertexData;
+            if (!vertexData || !sub->indexData || sub->indexData->indexCount == 0)
+                continue;
+            if (sub->operationType != Ogre::RenderOperation::OT_TRIANGLE_LIST)
+                return shared_ptr<Job>();
+
+            std::vector<Ogre::Vector4> positions, normals, tangents, uvs;
+            if (!ReadElement(vertexData, Ogre::VES_POSITION, positions))
+                return shared_ptr<Job>();
+            ReadElement(vertexData, Ogre::VES_NORMAL, normals);
+            ReadElement(vertexData, Ogre::VES_TANGENT, tangents);
+            ReadElement(vertexData, Ogre::VES_TEXTURE_COORDINATES, uvs);
+
+            // Read the triangles, leaving out the hidden ones of the base mesh, and keep the vertices they use.
+            Ogre::HardwareIndexBufferSharedPtr ibuf = sub->indexData->indexBuffer;
+            const bool use32bit = ibuf->getType() == Ogre::HardwareIndexBuffer::IT_32BIT;
+            const void *indexPtr = ibuf->lock(Ogre::HardwareBuffer::HBL_READ_ONLY);
+            std::vector<u32> indices(sub->indexData->indexCount);
+            for(size_t i = 0; i < indices.size(); ++i)
+                indices[i] = use32bit ? static_cast<const u32*>(indexPtr)[sub->indexData->indexStart + i] : static_cast<const u16*>(indexPtr)[sub->indexData->indexStart + i];
+            ibuf->unlock();
+
+            Source src;
+            std::vector<int> remap(vertexData->vertexCount, -1);
+            const bool hideVertices = !attachment && s == 0 && !verticesToHide.empty();
+            for(size_t i = 0; i + 2 < indices.size(); i += 3)
+            {
+                if (indices[i] >= remap.size() || indices[i + 1] >= remap.size() || indices[i + 2] >= remap.size())
+                    continue;
+                if (hideVertices && (verticesToHide.count(indices[i]) || verticesToHide.count(indices[i + 1]) || verticesToHide.count(indices[i + 2])))
+                    continue;
+                for(size_t j = i; j < i + 3; ++j)
+                {
+                    if (remap[indices[j]] < 0)
+                    {
+                        remap[indices[j]] = (int)src.positions.size();
+                        const Ogre::Vector4 &p = positions[indices[j]];
+                        src.positions.push_back(transform * Ogre::Vector3(p.x, p.y, p.z));
+                        job->bounds.merge(src.positions.back());
+                        const Ogre::Vector4 n = normals.empty() ? Ogre::Vector4(0.f, 1.f, 0.f, 0.f) : normals[indices[j]];
+                        src.normals.push_back((normalMatrix * Ogre::Vector3(n.x, n.y, n.z)).normalisedCopy());
+                        if (!tangents.empty())
+                        {
+                            const Ogre::Vector4 &t = tangents[indices[j]];
+                            const Ogre::Vector3 dir = (rotation * Ogre::Vector3(t.x, t.y, t.z)).normalisedCopy();
+                            src.tangents.push_back(Ogre::Vector4(dir.x, dir.y, dir.z, t.w));
+                        }
+                        src.uvs.push_back(uvs.empty() ? Ogre::Vector2::ZERO : Ogre::Vector2(uvs[indices[j]].x, uvs[indices[j]].y));
+                    }
+                    src.indices.push_back((u32)remap[indices[j]]);
+                }
+            }
+            if (src.indices.empty())
+                continue;
+            if (!src.tangents.empty())
+                job->hasTangents = true;
+
+            // Skin the vertices to the fixed bone, or by their own assignments.
+            if (fixedBone >= 0)
+            {
+                for(size_t i = 0; i < src.positions.size(); ++i)
+                {
+                    Ogre::VertexBoneAssignment vba;
+                    vba.vertexIndex = (unsigned int)i;
+                    vba.boneIndex = (unsigned short)fixedBone;
+                    vba.weight = 1.f;
+                    src.boneAssignments.push_back(vba);
+                }
+            }
+            else
+            {
+                const Ogre::Mesh::VertexBoneAssignmentList &assignments = sub->useSharedVertices ? mesh->getBoneAssignments() : sub->getBoneAssignments();
+                std::vector<bool> assigned(src.positions.size(), false);
+                for(Ogre::Mesh::VertexBoneAssignmentList::const_iterator iter = assignments.begin(); iter != assignments.end(); ++iter)
+                {
+                    Ogre::VertexBoneAssignment vba = iter->second;
+                    if (vba.vertexIndex >= remap.size() || remap[vba.vertexIndex] < 0)
+                        continue;
+                    vba.vertexIndex = (unsigned int)remap[vba.vertexIndex];
+                    if (!boneMap.empty())
+                        vba.boneIndex = vba.boneIndex < boneMap.size() ? boneMap[vba.boneIndex] : rootBone;
+                    assigned[vba.vertexIndex] = true;
+                    src.boneAssignments.push_back(vba);
+                }
+                // Vertices without assignments would collapse when skinned.
+                for(size_t i = 0; i < assigned.size(); ++i)
+                    if (!assigned[i])
+                    {
+                        Ogre::VertexBoneAssignment vba;
+                        vba.vertexIndex = (unsigned int)i;
+                        vba.boneIndex = rootBone;
+                        vba.weight = 1.f;
+                        src.boneAssignments.push_back(vba);
+                    }
+            }
+
+            // The material, and the atlas if the texture coordinates allow it.
+            src.material = s < materialRefs.size() && !materialRefs[s].trimmed().isEmpty() ? ResourceName(desc, materialRefs[s]) : sub->getMaterialName();
+            src.atlas = -1;
+            src.atlasImage = -1;
+            bool uvsInRange = !uvs.empty();
+            for(size_t i = 0; i < src.uvs.size() && uvsInRange; ++i)
+                uvsInRange = src.uvs[i].x >= -cUvEpsilon && src.uvs[i].x <= 1.f + cUvEpsilon && src.uvs[i].y >= -cUvEpsilon && src.uvs[i].y <= 1.f + cUvEpsilon;
+            Ogre::MaterialPtr material = Ogre::MaterialManager::getSingleton().getByName(src.material);
+            Ogre::TexturePtr texture;
+            const std::string atlasKey = uvsInRange ? AtlasKey(material, texture) : std::string();
+            if (!atlasKey.empty())
+            {
+                std::map<std::string, size_t>::iterator iter = atlasIndices.find(atlasKey);
+                if (iter == atlasIndices.end())
+                {
+                    iter = atlasIndices.insert(std::make_pair(atlasKey, job->atlases.size())).first;
+                    job->atlases.push_back(Job::Atlas());
+                    job->atlases.back().templateMaterial = src.material;
+                }
+                Job::Atlas &atlas = job->atlases[iter->second];
+                std::vector<std::string>::iterator name = std::find(atlas.textureNames.begin(), atlas.textureNames.end(), texture->getName());
+                if (name != atlas.textureNames.end())
+                {
+                    src.atlas = (int)iter->second;
+                    src.atlasImage = (int)(name - atlas.textureNames.begin());
+                }
+                else
+                {
+                    QImage image = TextureAsset::ToQImage(texture.get());
+                    if (!image.isNull())
+                    {
+                        atlas.textureNames.push_back(texture->getName());
+                        atlas.images.push_back(image.convertToFormat(QImage::Format_ARGB32));
+                        src.atlas = (int)iter->second;
+                        src.atlasImage = (int)atlas.images.size() - 1;
+                    }
+                }
+            }
+
+            job->sources.push_back(src);
+        }
+    }
+
+    if (job->sources.empty())
+        return shared_ptr<Job>();
+    return job;
+}
+
+MergedAvatarMeshPtr AvatarMeshMerger::CreateMesh(Job *job)
+{
+    PROFILE(AvatarMeshMerger_CreateMesh);
+
+    Ogre::SkeletonPtr skeleton = Ogre::SkeletonManager::getSingleton().getByName(job->skeletonName);
+    if (skeleton.isNull() || job->groups.empty())
+        return MergedAvatarMeshPtr();
+
+    MergedAvatarMeshPtr merged = MAKE_SHARED(MergedAvatarMesh);
+    const std::string prefix = "AvatarMerged_" + Ogre::StringConverter::toString(++uniqueId_);
+    const std::string &group = Ogre::ResourceGroupManager::DEFAULT_RESOURCE_GROUP_NAME;
+    try
+    {
+        std::vector<std::string> atlasMaterials(job->atlases.size());
+        for(size_t i = 0; i < job->atlases.size(); ++i)
+        {
+            Job::Atlas &atlas = job->atlases[i];
+            Ogre::MaterialPtr templateMaterial = Ogre::MaterialManager::getSingleton().getByName(atlas.templateMaterial);
+            if (atlas.image.isNull() || templateMaterial.isNull())
+                continue;
+            const std::string textureName = prefix + "_atlas" + Ogre::StringConverter::toString(i);
+            Ogre::Image image;
+            image.loadDynamicImage(atlas.image.bits(), atlas.image.width(), atlas.image.height(), 1, Ogre::PF_A8R8G8B8);
+            Ogre::TextureManager::getSingleton().loadImage(textureName, group, image);
+            merged->atlasTextures.push_back(textureName);
+
+            const std::string materialName = textureName + "_material";
+            Ogre::MaterialPtr material = templateMaterial->clone(materialName);
+            Ogre::TextureUnitState *tus = material->getTechnique(0)->getPass(0)->getTextureUnitState(0);
+            tus->setTextureName(textureName);
+            tus->setTextureAddressingMode(Ogre::TextureUnitState::TAM_CLAMP);
+            merged->atlasMaterials.push_back(materialName);
+            atlasMaterials[i] = materialName;
+        }
+
+        merged->meshName = prefix;
+        Ogre::MeshPtr mesh = Ogre::MeshManager::getSingleton().createManual(merged->meshName, group);
+        for(size_t i = 0; i < job->groups.size(); ++i)
+        {
+            Job::Group &g = job->groups[i];
+            const Source &geom = g.geometry;
+            Ogre::SubMesh *sub = mesh->createSubMesh();
+            sub->useSharedVertices = false;
+            sub->operationType = Ogre::RenderOperation::OT_TRIANGLE_LIST;
+
+#include "DisableMemoryLeakCheck.h"
+            sub->vertexData = OGRE_NEW Ogre::VertexData();
+#include "EnableMemoryLeakCheck.h"
+            sub->vertexData->vertexStart = 0;
+            sub->vertexData->vertexCount = geom.positions.size();
+            Ogre::VertexDeclaration *decl = sub->vertexData->vertexDeclaration;
+            size_t offset = 0;
+            offset += decl->addElement(0, offset, Ogre::VET_FLOAT3, Ogre::VES_POSITION).getSize();
+            offset += decl->addElement(0, offset, Ogre::VET_FLOAT3, Ogre::VES_NORMAL).getSize();
+            offset += decl->addElement(0, offset, Ogre::VET_FLOAT2, Ogre::VES_TEXTURE_COORDINATES, 0).getSize();
+            if (job->hasTangents)
+                offset += decl->addElement(0, offset, Ogre::VET_FLOAT4, Ogre::VES_TANGENT).getSize();
+
+            std::vector<float> vertices;
+            vertices.reserve(geom.positions.size() * offset / sizeof(float));
+            for(size_t v = 0; v < geom.positions.size(); ++v)
+            {
+                vertices.push_back(geom.positions[v].x); vertices.push_back(geom.positions[v].y); vertices.push_back(geom.positions[v].z);
+                vertices.push_back(geom.normals[v].x); vertices.push_back(geom.normals[v].y); vertices.push_back(geom.normals[v].z);
+                vertices.push_back(geom.uvs[v].x); vertices.push_back(geom.uvs[v].y);
+                if (job->hasTangents)
+                {
+                    vertices.push_back(geom.tangents[v].x); vertices.push_back(geom.tangents[v].y);
+                    vertices.push_back(geom.tangents[v].z); vertices.push_back(geom.tangents[v].w);
+                }
+            }
+            Ogre::HardwareVertexBufferSharedPtr vbuf = Ogre::HardwareBufferManager::getSingleton().createVertexBuffer(offset, geom.positions.size(),
+                Ogre::HardwareBuffer::HBU_STATIC_WRITE_ONLY);
+            vbuf->writeData(0, vbuf->getSizeInBytes(), &vertices[0], true);
+            sub->vertexData->vertexBufferBinding->setBinding(0, vbuf);
+
+            const bool use32bit = geom.positions.size() > 0xFFFF;
+            Ogre::HardwareIndexBufferSharedPtr ibuf = Ogre::HardwareBufferManager::getSingleton().createIndexBuffer(use32bit ?
+                Ogre::HardwareIndexBuffer::IT_32BIT : Ogre::HardwareIndexBuffer::IT_16BIT, geom.indices.size(), Ogre::HardwareBuffer::HBU_STATIC_WRITE_ONLY);
+            if (use32bit)
+                ibuf->writeData(0, ibuf->getSizeInBytes(), &geom.indices[0], true);
+            else
+            {
+                std::vector<u16> indices(geom.indices.begin(), geom.indices.end());
+                ibuf->writeData(0, ibuf->getSizeInBytes(), &indices[0], true);
+            }
+            sub->indexData->indexBuffer = ibuf;
+            sub->indexData->indexStart = 0;
+            sub->indexData->indexCount = geom.indices.size();
+
+            for(size_t j = 0; j < geom.boneAssignments.size(); ++j)
+                sub->addBoneAssignment(geom.boneAssignments[j]);
+
+            const std::string material = g.atlas >= 0 && !atlasMaterials[g.atlas].empty() ? atlasMaterials[g.atlas] : g.material;
+            sub->setMaterialName(material);
+            merged->materialNames.push_back(material);
+        }
+
+        mesh->_notifySkeleton(skeleton);
+        mesh->_compileBoneAssignments();
+        // The skinned vertices move away from the binding pose, so leave room for the animations.
+        Ogre::AxisAlignedBox bounds = job->bounds;
+        const Ogre::Vector3 padding = bounds.getSize() * 0.25f;
+        bounds.setExtents(bounds.getMinimum() - padding, bounds.getMaximum() + padding);
+        mesh->_setBounds(bounds);
+        mesh->_setBoundingSphereRadius(bounds.getHalfSize().length());
+        mesh->load();
+    }
+    catch(const Ogre::Exception &e)
+    {
+        LogWarning("AvatarMeshMerger: Could not create the merged mesh " + prefix + ": " + e.what());
+        return MergedAvatarMeshPtr();
+    }
+    return merged;
+}
+
+void AvatarMeshMerger::OnUpdated(float /*frameTime*/)
+{
+    std::list<shared_ptr<Job> >::iterator iter = jobs_.begin();
+    while(iter != jobs_.end())
+    {
+        shared_ptr<Job> job = *iter;
+        if (!job->IsFinished())
+        {
+            ++iter;
+            continue;
+        }
+        iter = jobs_.erase(iter);
+
+        // Kept alive while the avatars pick it up.
+        MergedAvatarMeshPtr merged = CreateMesh(job.get());
+        if (!merged)
+        {
+            failed_[job->hash] = true;
+            continue;
+        }
+        cache_[job->hash] = merged;
+        emit Merged(job->hash);
+    }
+
+    // Forget the merged meshes that no avatar uses anymore.
+    for(QMap<QString, weak_ptr<MergedAvatarMesh> >::iterator c = cache_.begin(); c != cache_.end();)
+    {
+        if (c.value().expired())
+            c = cache_.erase(c);
+        else
+            ++c;
+    }
+}
@@ -0,0 +1,95 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#pragma once
+
+#include "CoreTypes.h"
+#include "AvatarModuleApi.h"
+
+#include <QObject>
+#include <QMap>
+#include <QString>
+#include <QThreadPool>
+
+#include <vector>
+#include <list>
+
+class Framework;
+class AvatarDescAsset;
+
+/// The merged mesh of an avatar description: the base mesh and its attachments baked into one skinned Ogre mesh.
+/** Shared by the avatars that use the same description. The Ogre mesh, materials and atlas textures are removed when the
+    last avatar releases it. */
+class AV_MODULE_API MergedAvatarMesh
+{
+public:
+    ~MergedAvatarMesh();
+
+    /// Name of the merged Ogre mesh.
+    std::string meshName;
+    /// Names of the Ogre materials of the submeshes of the merged mesh, in order.
+    std::vector<std::string> materialNames;
+    /// Names of the Ogre materials and textures created for the atlases.
+    std::vector<std::string> atlasMaterials;
+    std::vector<std::string> atlasTextures;
+};
+typedef shared_ptr<MergedAvatarMesh> MergedAvatarMeshPtr;
+
+/// Bakes the base mesh and the attachment meshes of avatar descriptions into single meshes, with their textures in atlases.
+/** Used by EC_Avatar when its mergeMeshes attribute is set. Each merged avatar is drawn in one skinned draw call per
+    material group, instead of one per submesh of the base mesh and each attachment.
+
+    The geometry, bone assignments and textures are read from the loaded Ogre resources in the main thread, assembled and
+    packed into the atlases in a worker thread, and created as Ogre resources in the main thread when finished. The results
+    are cached by a hash of the appearance of the description, so that the avatars that share a description share the
+    merged mesh.
+
+    Attachments on a bone are skinned to the bone with full weight, linked attachments keep their bone assignments mapped to
+    the bones of the avatar skeleton by name, and the other attachments follow the root bone. The submeshes whose material has
+    a single pass with a single texture and whose texture coordinates stay within [0, 1] are merged into an atlas, one per
+    distinct shader setup, and the rest are grouped by their material. Descriptions with morph modifiers on meshes with poses
+    are not merged, as the poses are not carried over. */
+class AV_MODULE_API AvatarMeshMerger : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit AvatarMeshMerger(Framework *framework);
+    /// Waits for the merges in progress to finish.
+    ~AvatarMeshMerger();
+
+    /// Returns the merged mesh of the description, or null if it is not ready yet or can not be merged.
+    /** If the merge has not been started, it is started, and Merged is emitted with the hash when it is finished. */
+    MergedAvatarMeshPtr Merge(AvatarDescAsset *desc);
+
+    /// Returns the hash of the appearance of the description that the merged meshes are cached by.
+    QString AppearanceHash(AvatarDescAsset *desc) const;
+
+signals:
+    /// A merged mesh has been finished. Merge returns it for the descriptions with the hash.
+    void Merged(const QString &hash);
+
+private slots:
+    void OnUpdated(float frameTime);
+
+private:
+    struct Source;
+    struct Job;
+    friend struct Job;
+
+    /// Reads the geometry and textures of the description from the loaded Ogre resources. Returns null if not mergeable.
+    shared_ptr<Job> PrepareJob(AvatarDescAsset *desc, const QString &hash);
+    /// Creates the Ogre mesh, materials and textures of a finished job.
+    MergedAvatarMeshPtr CreateMesh(Job *job);
+    /// Resolves an asset reference of the description to an Ogre resource name.
+    std::string ResourceName(AvatarDescAsset *desc, const QString &ref) const;
+
+    Framework *framework_;
+    QThreadPool threadPool_;
+    /// Merged meshes by the appearance hash. Expire when no avatar uses them.
+    QMap<QString, weak_ptr<MergedAvatarMesh> > cache_;
+    /// Merges in progress.
+    std::list<shared_ptr<Job> > jobs_;
+    /// Hashes that could not be merged, so that they are not retried.
+    QMap<QString, bool> failed_;
+    int uniqueId_;
+};
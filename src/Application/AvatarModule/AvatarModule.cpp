@@ -6,6 +6,7 @@
 #include "AvatarModule.h"
 #include "AvatarEditor.h"
 #include "AvatarDescAsset.h"
+#include "AvatarMeshMerger.h"
 #include "EC_Avatar.h"
 
 #include "Framework.h"
@@ -54,6 +55,9 @@ void AvatarModule::Initialize()
         "Edits the avatar in a specific entity. Usage: editAvatar(entityname)",
         this, SLOT(EditAvatarConsole(const QString &)));
 
+    if (!framework_->IsHeadless())
+        meshMerger = MAKE_SHARED(AvatarMeshMerger, framework_);
+
     JavascriptModule *javascriptModule = framework_->GetModule<JavascriptModule>();
     if (javascriptModule)
         connect(javascriptModule, SIGNAL(ScriptEngineCreated(QScriptEngine*)), SLOT(OnScriptEngineCreated(QScriptEngine*)));
@@ -61,6 +65,11 @@ void AvatarModule::Initialize()
         LogWarning("AvatarModule: JavascriptModule not present, AvatarModule usage from scripts will be limited!");
 }
 
+void AvatarModule::Uninitialize()
+{
+    meshMerger.reset();
+}
+
 AvatarEditor* AvatarModule::GetAvatarEditor() const
 {
     return avatarEditor.data();
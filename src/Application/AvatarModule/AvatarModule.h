@@ -9,6 +9,7 @@
 #include <QScriptEngine>
 
 class AvatarEditor;
+class AvatarMeshMerger;
 
 /// Provides EC_Avatar.
 class AV_MODULE_API AvatarModule : public IModule
@@ -21,6 +22,10 @@ public:
 
     void Load();
     void Initialize();
+    void Uninitialize();
+
+    /// Returns the merger of the avatar meshes, or null if headless.
+    AvatarMeshMerger *MeshMerger() const { return meshMerger.get(); }
 
 public slots:
     AvatarEditor* GetAvatarEditor() const;
@@ -36,6 +41,7 @@ public slots:
 
 private:
     QPointer<AvatarEditor> avatarEditor;
+    shared_ptr<AvatarMeshMerger> meshMerger;
 
 private slots:
     /// Registers avatar module variable types for QScript.
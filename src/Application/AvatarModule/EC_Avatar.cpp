@@ -9,6 +9,9 @@
 #include "AssetAPI.h"
 #include "IAssetTransfer.h"
 #include "AvatarDescAsset.h"
+#include "AvatarMeshMerger.h"
+#include "AvatarModule.h"
+#include "Framework.h"
 #include "Entity.h"
 #include "Profiler.h"
 #include <Ogre.h>
@@ -29,7 +32,8 @@ static const float FIXED_HEIGHT_OFFSET = -0.87f;
 
 EC_Avatar::EC_Avatar(Scene* scene) :
     IComponent(scene),
-    INIT_ATTRIBUTE_VALUE(appearanceRef, "Appearance ref", AssetReference("", "Avatar"))
+    INIT_ATTRIBUTE_VALUE(appearanceRef, "Appearance ref", AssetReference("", "Avatar")),
+    INIT_ATTRIBUTE_VALUE(mergeMeshes, "Merge meshes", false)
 {
     avatarAssetListener_ = MAKE_SHARED(AssetRefListener);
     connect(avatarAssetListener_.get(), SIGNAL(Loaded(AssetPtr)), this, SLOT(OnAvatarAppearanceLoaded(AssetPtr)), Qt::UniqueConnection);
@@ -94,6 +98,8 @@ void EC_Avatar::AttributesChanged()
         
         avatarAssetListener_->HandleAssetRefChange(&appearanceRef, "Avatar");
     }
+    if (mergeMeshes.ValueChanged())
+        SetupAppearance();
 }
 
 void EC_Avatar::SetupAppearance()
@@ -114,11 +120,65 @@ void EC_Avatar::SetupAppearance()
         return;
     
     // Setup appearance
+    pendingMergeHash_.clear();
+    if (mergeMeshes.Get() && SetupMergedMesh())
+    {
+        SetupDynamicAppearance();
+        return;
+    }
+    mergedMesh_.reset();
     SetupMeshAndMaterials();
     SetupDynamicAppearance();
     SetupAttachments();
 }
 
+bool EC_Avatar::SetupMergedMesh()
+{
+    AvatarModule *avatarModule = framework->GetModule<AvatarModule>();
+    AvatarMeshMerger *merger = avatarModule ? avatarModule->MeshMerger() : 0;
+    Entity* entity = ParentEntity();
+    AvatarDescAssetPtr desc = AvatarDesc();
+    if (!merger || !desc || !entity)
+        return false;
+    EC_Mesh* mesh = entity->GetComponent<EC_Mesh>().get();
+    if (!mesh)
+        return false;
+
+    shared_ptr<MergedAvatarMesh> merged = merger->Merge(desc.get());
+    if (!merged)
+    {
+        // Shown unmerged until the merged mesh is built, if it can be.
+        pendingMergeHash_ = merger->AppearanceHash(desc.get());
+        connect(merger, SIGNAL(Merged(const QString &)), this, SLOT(OnMeshMerged(const QString &)), Qt::UniqueConnection);
+        return false;
+    }
+    if (merged == mergedMesh_ && mesh->OgreEntity() && mesh->OgreEntity()->getMesh()->getName() == merged->meshName)
+        return true;
+
+    mesh->RemoveAllAttachments();
+    bool success;
+    if (desc->skeleton_.length())
+        success = mesh->SetMeshWithSkeleton(merged->meshName, LookupAsset(desc->skeleton_).toStdString());
+    else
+        success = mesh->SetMesh(QString::fromStdString(merged->meshName));
+    if (!success)
+        return false;
+    // The merged materials are not assets, so do not signal them to the mesh material attribute.
+    for (uint i = 0; i < merged->materialNames.size(); ++i)
+        mesh->SetMaterial(i, QString::fromStdString(merged->materialNames[i]), AttributeChange::Disconnected);
+
+    mesh->SetAdjustPosition(float3(0.0f, FIXED_HEIGHT_OFFSET, 0.0f));
+    mesh->castShadows.Set(true, AttributeChange::Default);
+    mergedMesh_ = merged;
+    return true;
+}
+
+void EC_Avatar::OnMeshMerged(const QString &hash)
+{
+    if (!pendingMergeHash_.isEmpty() && hash == pendingMergeHash_ && mergeMeshes.Get())
+        SetupAppearance();
+}
+
 void EC_Avatar::SetupDynamicAppearance()
 {
     Entity* entity = ParentEntity();
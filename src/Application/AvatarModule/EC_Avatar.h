@@ -10,6 +10,7 @@
 struct BoneModifier;
 class AvatarDescAsset;
 typedef shared_ptr<AvatarDescAsset> AvatarDescAssetPtr;
+class MergedAvatarMesh;
 
 /// Avatar component.
 /** <table class="header">
@@ -28,6 +29,8 @@ typedef shared_ptr<AvatarDescAsset> AvatarDescAssetPtr;
     <ul>
     <li>AssetReference: appearanceRef
     <div> @copydoc appearanceRef</div>
+    <li>bool: mergeMeshes
+    <div> @copydoc mergeMeshes</div>
     </ul>
 
     <b>Exposes the following scriptable functions:</b>
@@ -58,6 +61,12 @@ public:
     Q_PROPERTY(AssetReference appearanceRef READ getappearanceRef WRITE setappearanceRef);
     DEFINE_QPROPERTY_ATTRIBUTE(AssetReference, appearanceRef);
 
+    /// Whether the base mesh and the attachments are baked into one mesh with a texture atlas, to draw in fewer batches.
+    /** The avatar is shown unmerged until the merged mesh of its description has been built in the background.
+        @see AvatarMeshMerger */
+    Q_PROPERTY(bool mergeMeshes READ getmergeMeshes WRITE setmergeMeshes);
+    DEFINE_QPROPERTY_ATTRIBUTE(bool, mergeMeshes);
+
 public slots:
     /// Refresh appearance completely
     void SetupAppearance();
@@ -73,6 +82,8 @@ private slots:
     void OnAvatarAppearanceLoaded(AssetPtr asset);
     /// Avatar asset failed to load.
     void OnAvatarAppearanceFailed(IAssetTransfer* transfer, QString reason);
+    /// A merged mesh has been built. Applies it if it is of this avatar.
+    void OnMeshMerged(const QString &hash);
 
 private:
     /// Called when some of the attributes has been changed.
@@ -87,6 +98,8 @@ private:
     void SetupBoneModifiers();
     /// Rebuild attachment meshes
     void SetupAttachments();
+    /// Set the merged mesh of the avatar desc asset, if built. Starts building it if not, and returns false.
+    bool SetupMergedMesh();
     /// Lookup absolute asset reference
     QString LookupAsset(const QString& ref);
 
@@ -94,4 +107,8 @@ private:
     AssetRefListenerPtr avatarAssetListener_;
     /// Last set avatar asset
     weak_ptr<AvatarDescAsset> avatarAsset_;
+    /// The merged mesh in use, if any
+    shared_ptr<MergedAvatarMesh> mergedMesh_;
+    /// Appearance hash of the merged mesh being built
+    QString pendingMergeHash_;
 };
@@ -0,0 +1,963 @@
+/**
+    For conditions of distribution and use, see copyright notice in LICENSE
+
+    @file   BenchmarkModule.cpp
+    @brief  Repeatable benchmarks of the core hot paths, with the results written as JSON. */
+
+#include "StableHeaders.h"
+#include "BenchmarkModule.h"
+
+#include "Framework.h"
+#include "Application.h"
+#include "FrameAPI.h"
+#include "ConsoleAPI.h"
+#include "AssetAPI.h"
+#include "AssetCache.h"
+#include "SceneAPI.h"
+#include "Scene/Scene.h"
+#include "Entity.h"
+#include "EC_Name.h"
+#include "IAttribute.h"
+#include "Transform.h"
+#include "EC_Placeable.h"
+#include "TundraLogicModule.h"
+#include "Server.h"
+#include "SyncManager.h"
+#include "UserConnection.h"
+#include "HighPerfClock.h"
+#include "CoreJsonUtils.h"
+#include "LoggingFunctions.h"
+#include "Algorithm/Random/LCG.h"
+#include "Geometry/AABB.h"
+#include "Geometry/Frustum.h"
+#include "Geometry/OBB.h"
+#include "Geometry/Capsule.h"
+#include "Geometry/GJK.h"
+#include "Geometry/TriangleMesh.h"
+#include "Geometry/Ray.h"
+
+#include <kNet/DataSerializer.h>
+#include <kNet/DataDeserializer.h>
+
+#include <QFile>
+#include <QDir>
+#include <QDateTime>
+#include <QVariantMap>
+
+#include <algorithm>
+
+#include "MemoryLeakCheck.h"
+
+namespace
+{
+const u32 cSeed = 0x5EED;
+const int cNumMathItems = 1024; ///< Power of two, so that the benchmarks can wrap the index with a mask.
+const int cNumTriangles = 1000;
+const int cNumRays = 256; ///< Power of two.
+const int cNumSceneEntities = 5000;
+const int cNumAttributeEntities = 500; ///< Number of the entities whose attributes are serialized.
+const size_t cSerializeBufferSize = 1024 * 1024;
+const int cNumCachedAssets = 256;
+const int cCachedAssetSize = 4096;
+const int cNumSyncEntities = 1000;
+const int cNumMovedSyncEntities = 100; ///< Entities moved before each sync tick.
+const int cNumInitialSyncTicks = 5; ///< Untimed ticks that send the initial state of the scene to the synthetic users.
+
+float3 RandomPos(LCG &lcg, float extent)
+{
+    return float3::RandomBox(lcg, -extent, extent, -extent, extent, -extent, extent);
+}
+} // ~unnamed namespace
+
+/// Connection of a synthetic user of the sync tick benchmark, which only counts what it is sent.
+class BenchmarkUserConnection : public UserConnection
+{
+public:
+    BenchmarkUserConnection() : numMessages(0), numBytes(0) {}
+
+    virtual QString ConnectionType() const { return "benchmark"; }
+
+    /// Called by the sync threads too, but only for one user at a time.
+    virtual void Send(kNet::message_id_t /*id*/, const char * /*data*/, size_t numBytes_, bool /*reliable*/, bool /*inOrder*/,
+        unsigned long /*priority*/ = 100, unsigned long /*contentID*/ = 0)
+    {
+        ++numMessages;
+        numBytes += numBytes_;
+    }
+
+    virtual void Disconnect() {}
+    virtual void Close() {}
+
+    u64 numMessages;
+    u64 numBytes;
+};
+
+BenchmarkModule::BenchmarkModule() :
+    IModule("BenchmarkModule"),
+    outputFile_("benchmarks.json"),
+    repetitions_(7),
+    numSyncUsers_(50),
+    sink_(0.f),
+    mesh_(0),
+    meshCpp_(0),
+    cache_(0)
+{
+}
+
+BenchmarkModule::~BenchmarkModule()
+{
+    delete mesh_;
+    delete meshCpp_;
+}
+
+void BenchmarkModule::Initialize()
+{
+    QStringList param = framework_->CommandLineParameters("--benchmarkFilter");
+    if (!param.isEmpty())
+        filter_ = param.first();
+    param = framework_->CommandLineParameters("--benchmarkOutput");
+    if (!param.isEmpty())
+        outputFile_ = param.first();
+    param = framework_->CommandLineParameters("--benchmarkRepetitions");
+    if (!param.isEmpty())
+    {
+        bool ok = false;
+        const int repetitions = param.first().toInt(&ok);
+        if (ok && repetitions > 0)
+            repetitions_ = repetitions;
+        else
+            LogWarning("BenchmarkModule: Invalid --benchmarkRepetitions " + param.first() + ", using " + QString::number(repetitions_) + ".");
+    }
+    param = framework_->CommandLineParameters("--benchmarkUsers");
+    if (!param.isEmpty())
+    {
+        bool ok = false;
+        const int users = param.first().toInt(&ok);
+        if (ok && users > 0)
+            numSyncUsers_ = users;
+        else
+            LogWarning("BenchmarkModule: Invalid --benchmarkUsers " + param.first() + ", using " + QString::number(numSyncUsers_) + ".");
+    }
+
+    framework_->Console()->RegisterCommand("runBenchmarks",
+        "Runs the benchmarks and writes the results as JSON. Usage: runBenchmarks(filter). The filter is optional.",
+        this, SLOT(RunBenchmarks(const QString &)), SLOT(RunBenchmarks()));
+
+    // Wait for the startup to settle, f.ex. the server to start and its scene to be created.
+    if (framework_->HasCommandLineParameter("--runBenchmarks"))
+        framework_->Frame()->DelayedExecute(1.f, this, SLOT(RunFromCommandLine()));
+}
+
+void BenchmarkModule::RunFromCommandLine()
+{
+    RunBenchmarks(filter_);
+    framework_->Exit();
+}
+
+bool BenchmarkModule::RunBenchmarks(const QString &filter)
+{
+    filter_ = filter;
+    results_.clear();
+    LogInfo(QString("BenchmarkModule: Running the benchmarks%1, %2 repetitions each.")
+        .arg(filter_.isEmpty() ? QString() : " matching \"" + filter_ + "\"").arg(repetitions_));
+
+    const Benchmark mathBenchmarks[] =
+    {
+        { "Math.float3x4.Mul", &BenchmarkModule::Float3x4Mul, 100000 },
+        { "Math.float3x4.Inverse", &BenchmarkModule::Float3x4Inverse, 100000 },
+        { "Math.float3x4.TransformPos", &BenchmarkModule::Float3x4TransformPos, 100000 },
+        { "Math.float3x4.BatchTransformPos", &BenchmarkModule::Float3x4BatchTransformPos, 1000 },
+        { "Math.float3x4.BatchTransformPosSoA", &BenchmarkModule::Float3x4BatchTransformPosSoA, 1000 },
+        { "Math.AABB.TransformAsAABB", &BenchmarkModule::AABBTransformAsAABB, 100000 },
+        { "Math.Frustum.BatchIntersects", &BenchmarkModule::FrustumBatchIntersects, 1000 },
+        { "Math.GJK.Intersect", &BenchmarkModule::GJKIntersects, 100000 },
+        { "Math.EPA.Penetration", &BenchmarkModule::EPAPenetrations, 10000 },
+        { "Math.Quat.Mul", &BenchmarkModule::QuatMul, 100000 },
+        { "Math.Quat.Slerp", &BenchmarkModule::QuatSlerp, 100000 },
+        { "Math.Quat.Transform", &BenchmarkModule::QuatTransform, 100000 },
+        { "Math.TriangleMesh.IntersectRay", &BenchmarkModule::TriangleMeshIntersectRay, 1000 },
+        { "Math.TriangleMesh.IntersectRayCpp", &BenchmarkModule::TriangleMeshIntersectRayCpp, 1000 },
+        { "Math.TriangleMesh.IntersectRays", &BenchmarkModule::TriangleMeshIntersectRays, 1024 },
+    };
+    if (AnySelected(mathBenchmarks, sizeof(mathBenchmarks) / sizeof(mathBenchmarks[0])))
+    {
+        SetUpMath();
+        for(size_t i = 0; i < sizeof(mathBenchmarks) / sizeof(mathBenchmarks[0]); ++i)
+            Measure(mathBenchmarks[i]);
+    }
+
+    const Benchmark sceneBenchmarks[] =
+    {
+        { "Attribute.ToBinary", &BenchmarkModule::AttributeToBinary, 100000 },
+        { "Attribute.FromBinary", &BenchmarkModule::AttributeFromBinary, 100000 },
+        { "Scene.CreateRemoveEntity", &BenchmarkModule::SceneCreateRemoveEntity, 1000 },
+        { "Scene.EntityById", &BenchmarkModule::SceneEntityById, 100000 },
+        { "Scene.EntityByName", &BenchmarkModule::SceneEntityByName, 100000 },
+        { "Scene.EntitiesWithComponent", &BenchmarkModule::SceneEntitiesWithComponent, 20 },
+        { "Scene.LoadBinary", &BenchmarkModule::SceneLoadBinary, 2 },
+        { "Scene.LoadXml", &BenchmarkModule::SceneLoadXml, 2 },
+    };
+    const Benchmark cacheBenchmarks[] =
+    {
+        { "AssetCache.FindHit", &BenchmarkModule::AssetCacheFindHit, 1000 },
+        { "AssetCache.FindMiss", &BenchmarkModule::AssetCacheFindMiss, 1000 },
+    };
+    const size_t numSceneBenchmarks = sizeof(sceneBenchmarks) / sizeof(sceneBenchmarks[0]);
+    const size_t numCacheBenchmarks = sizeof(cacheBenchmarks) / sizeof(cacheBenchmarks[0]);
+    if (AnySelected(sceneBenchmarks, numSceneBenchmarks) || AnySelected(cacheBenchmarks, numCacheBenchmarks))
+    {
+        SetUpScene();
+        for(size_t i = 0; i < numSceneBenchmarks; ++i)
+            Measure(sceneBenchmarks[i]);
+        for(size_t i = 0; i < numCacheBenchmarks; ++i)
+            if (cache_)
+                Measure(cacheBenchmarks[i]);
+            else
+                Skip(cacheBenchmarks[i].name, "The asset cache is disabled");
+        TearDownScene();
+    }
+
+    const Benchmark syncBenchmark = { "Sync.Tick", &BenchmarkModule::SyncTick, 10 };
+    if (AnySelected(&syncBenchmark, 1))
+    {
+        QString reason;
+        if (SetUpSync(reason))
+            Measure(syncBenchmark);
+        else
+            Skip(syncBenchmark.name, reason);
+        TearDownSync();
+    }
+
+    QVariantMap root;
+    root["version"] = Application::FullIdentifier();
+    root["platform"] = Application::Platform();
+    root["simd"] = SIMDCapabilityToString(ActiveSIMDCapability());
+    root["date"] = QDateTime::currentDateTime().toString(Qt::ISODate);
+    root["repetitions"] = repetitions_;
+    root["benchmarks"] = results_;
+
+    QFile file(outputFile_);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+    {
+        LogError("BenchmarkModule: Failed to open " + outputFile_ + " for writing the results.");
+        return false;
+    }
+    file.write(TundraJson::Serialize(root, TundraJson::IndentFull));
+    file.close();
+    LogInfo(QString("BenchmarkModule: Wrote the results of %1 benchmarks to %2.").arg(results_.size()).arg(outputFile_));
+    return true;
+}
+
+bool BenchmarkModule::Selected(const QString &name) const
+{
+    return filter_.isEmpty() || name.contains(filter_, Qt::CaseInsensitive);
+}
+
+bool BenchmarkModule::AnySelected(const Benchmark *benchmarks, size_t count) const
+{
+    for(size_t i = 0; i < count; ++i)
+        if (Selected(benchmarks[i].name))
+            return true;
+    return false;
+}
+
+void BenchmarkModule::Measure(const Benchmark &benchmark)
+{
+    if (!Selected(benchmark.name))
+        return;
+
+    // The warm-up repetition fills the caches and lets the lazily initialized state settle.
+    (this->*benchmark.function)(benchmark.iterations);
+
+    const double nsPerTick = 1e9 / (double)GetCurrentClockFreq();
+    std::vector<double> nsPerOp;
+    double total = 0.0;
+    for(int i = 0; i < repetitions_; ++i)
+    {
+        nsPerOp.push_back((this->*benchmark.function)(benchmark.iterations) * nsPerTick / benchmark.iterations);
+        total += nsPerOp.back();
+    }
+    std::sort(nsPerOp.begin(), nsPerOp.end());
+    const double median = nsPerOp[nsPerOp.size() / 2];
+
+    LogInfo(QString("%1 %2 ns/op (min %3, max %4)").arg(QString(benchmark.name), -36).arg(median, 12, 'f', 1)
+        .arg(nsPerOp.front(), 0, 'f', 1).arg(nsPerOp.back(), 0, 'f', 1));
+
+    QVariantMap result;
+    result["name"] = QString(benchmark.name);
+    result["iterations"] = benchmark.iterations;
+    result["minNs"] = nsPerOp.front();
+    result["medianNs"] = median;
+    result["meanNs"] = total / nsPerOp.size();
+    result["maxNs"] = nsPerOp.back();
+    results_ << result;
+}
+
+void BenchmarkModule::Skip(const QString &name, const QString &reason)
+{
+    if (!Selected(name))
+        return;
+    LogInfo(QString("%1 skipped: %2").arg(name, -36).arg(reason));
+    QVariantMap result;
+    result["name"] = name;
+    result["skipped"] = reason;
+    results_ << result;
+}
+
+void BenchmarkModule::SetUpMath()
+{
+    LCG lcg(cSeed);
+    matrices_.clear();
+    quats_.clear();
+    vectors_.clear();
+    for(int i = 0; i < cNumMathItems; ++i)
+    {
+        const Quat rotation = Quat::RandomRotation(lcg);
+        matrices_.push_back(float3x4::FromTRS(RandomPos(lcg, 100.f), rotation, float3(lcg.Float(0.5f, 2.f), lcg.Float(0.5f, 2.f), lcg.Float(0.5f, 2.f))));
+        quats_.push_back(Quat::RandomRotation(lcg));
+        vectors_.push_back(RandomPos(lcg, 100.f));
+    }
+    batch_ = vectors_;
+    batchX_.resize(cNumMathItems);
+    batchY_.resize(cNumMathItems);
+    batchZ_.resize(cNumMathItems);
+    for(int i = 0; i < cNumMathItems; ++i)
+    {
+        batchX_[i] = vectors_[i].x;
+        batchY_[i] = vectors_[i].y;
+        batchZ_[i] = vectors_[i].z;
+    }
+    boxes_.clear();
+    for(int i = 0; i < cNumMathItems; ++i)
+        boxes_.push_back(AABB(vectors_[i], vectors_[i] + float3(lcg.Float(0.5f, 5.f), lcg.Float(0.5f, 5.f), lcg.Float(0.5f, 5.f))));
+
+    // Random triangles in a box, and rays that aim at the box from around it, so that some hit and some miss.
+    triangles_.clear();
+    for(int i = 0; i < cNumTriangles * 3; ++i)
+    {
+        const float3 vertex = RandomPos(lcg, 10.f);
+        triangles_.push_back(vertex.x);
+        triangles_.push_back(vertex.y);
+        triangles_.push_back(vertex.z);
+    }
+    rayOrigins_.clear();
+    rayDirections_.clear();
+    for(int i = 0; i < cNumRays; ++i)
+    {
+        rayOrigins_.push_back(RandomPos(lcg, 30.f));
+        rayDirections_.push_back((RandomPos(lcg, 10.f) - rayOrigins_.back()).Normalized());
+    }
+    rays_.clear();
+    for(int i = 0; i < cNumRays; ++i)
+        rays_.push_back(Ray(rayOrigins_[i], rayDirections_[i]));
+
+    if (!mesh_)
+        mesh_ = new TriangleMesh();
+    if (!meshCpp_)
+        meshCpp_ = new TriangleMesh();
+    mesh_->Set(&triangles_[0], cNumTriangles);
+    meshCpp_->SetAoS(&triangles_[0], cNumTriangles);
+}
+
+u64 BenchmarkModule::Float3x4Mul(int iterations)
+{
+    const int mask = cNumMathItems - 1;
+    float sum = 0.f;
+    const tick_t start = GetCurrentClockTime();
+    for(int i = 0; i < iterations; ++i)
+        sum += (matrices_[i & mask] * matrices_[(i + 1) & mask]).At(0, 3);
+    const tick_t end = GetCurrentClockTime();
+    sink_ += sum;
+    return end - start;
+}
+
+u64 BenchmarkModule::Float3x4Inverse(int iterations)
+{
+    const int mask = cNumMathItems - 1;
+    float sum = 0.f;
+    const tick_t start = GetCurrentClockTime();
+    for(int i = 0; i < iterations; ++i)
+    {
+        float3x4 m = matrices_[i & mask];
+        m.Inverse();
+        sum += m.At(0, 3);
+    }
+    const tick_t end = GetCurrentClockTime();
+    sink_ += sum;
+    return end - start;
+}
+
+u64 BenchmarkModule::Float3x4TransformPos(int iterations)
+{
+    const int mask = cNumMathItems - 1;
+    float sum = 0.f;
+    const tick_t start = GetCurrentClockTime();
+    for(int i = 0; i < iterations; ++i)
+        sum += matrices_[i & mask].TransformPos(vectors_[(i + 1) & mask]).x;
+    const tick_t end = GetCurrentClockTime();
+    sink_ += sum;
+    return end - start;
+}
+
+u64 BenchmarkModule::Float3x4BatchTransformPos(int iterations)
+{
+    // Transforms all the points per iteration, alternating with the inverse so that they stay in range.
+    const float3x4 m = matrices_[0];
+    const float3x4 inverse = m.Inverted();
+    const tick_t start = GetCurrentClockTime();
+    for(int i = 0; i < iterations; ++i)
+        (i & 1 ? inverse : m).BatchTransformPos(&batch_[0], cNumMathItems);
+    const tick_t end = GetCurrentClockTime();
+    sink_ += batch_[0].x;
+    return end - start;
+}
+
+u64 BenchmarkModule::Float3x4BatchTransformPosSoA(int iterations)
+{
+    const float3x4 m = matrices_[0];
+    const float3x4 inverse = m.Inverted();
+    const tick_t start = GetCurrentClockTime();
+    for(int i = 0; i < iterations; ++i)
+        (i & 1 ? inverse : m).BatchTransformPos(&batchX_[0], &batchY_[0], &batchZ_[0], cNumMathItems);
+    const tick_t end = GetCurrentClockTime();
+    sink_ += batchX_[0];
+    return end - start;
+}
+
+u64 BenchmarkModule::AABBTransformAsAABB(int iterations)
+{
+    const int mask = cNumMathItems - 1;
+    float sum = 0.f;
+    const tick_t start = GetCurrentClockTime();
+    for(int i = 0; i < iterations; ++i)
+    {
+        AABB box(vectors_[i & mask], vectors_[i & mask] + float3(1.f, 2.f, 3.f));
+        box.TransformAsAABB(matrices_[(i + 1) & mask]);
+        sum += box.maxPoint.x;
+    }
+    const tick_t end = GetCurrentClockTime();
+    sink_ += sum;
+    return end - start;
+}
+
+u64 BenchmarkModule::FrustumBatchIntersects(int iterations)
+{
+    // A camera in the middle of the boxes, so that some of them are in the view and some not.
+    Frustum frustum;
+    frustum.type = PerspectiveFrustum;
+    frustum.pos = float3::zero;
+    frustum.front = float3::unitZ;
+    frustum.up = float3::unitY;
+    frustum.nearPlaneDistance = 0.1f;
+    frustum.farPlaneDistance = 100.f;
+    frustum.horizontalFov = pi / 2.f;
+    frustum.verticalFov = pi / 3.f;
+    std::vector<u32> visible((cNumMathItems + 31) / 32);
+    u32 sum = 0;
+    const tick_t start = GetCurrentClockTime();
+    for(int i = 0; i < iterations; ++i)
+    {
+        frustum.BatchIntersects(&boxes_[0], cNumMathItems, &visible[0]);
+        sum += visible[i & (visible.size() - 1)];
+    }
+    const tick_t end = GetCurrentClockTime();
+    sink_ += (float)sum;
+    return end - start;
+}
+
+u64 BenchmarkModule::GJKIntersects(int iterations)
+{
+    // Rotated boxes against capsules around their corners, so that some of the pairs intersect and some not.
+    const int mask = cNumMathItems - 1;
+    std::vector<OBB> boxes;
+    std::vector<Capsule> capsules;
+    for(int i = 0; i < cNumMathItems; ++i)
+    {
+        OBB box(boxes_[i]);
+        box.Transform(quats_[i]);
+        boxes.push_back(box);
+        const float3 center = box.pos + (vectors_[i] - box.pos).ScaledToLength(box.r.Length());
+        capsules.push_back(Capsule(center - quats_[(i + 1) & mask].Transform(float3::unitX), center + quats_[(i + 1) & mask].Transform(float3::unitX), 0.5f));
+    }
+    int sum = 0;
+    const tick_t start = GetCurrentClockTime();
+    for(int i = 0; i < iterations; ++i)
+        sum += GJKIntersect(boxes[i & mask], capsules[i & mask]) ? 1 : 0;
+    const tick_t end = GetCurrentClockTime();
+    sink_ += (float)sum;
+    return end - start;
+}
+
+u64 BenchmarkModule::EPAPenetrations(int iterations)
+{
+    // Boxes against boxes of other sizes moved around their centers, so that all of the pairs intersect. The
+    // penetration depth of two boxes is the least distance along an axis that moves one past the other, which checks
+    // the results of EPA.
+    const int mask = cNumMathItems - 1;
+    std::vector<AABB> others;
+    std::vector<float> depths;
+    for(int i = 0; i < cNumMathItems; ++i)
+    {
+        const AABB &box = boxes_[i];
+        const float3 halfSize = 0.5f * (box.Size() + boxes_[(i + 1) & mask].Size());
+        const float3 offset = 0.9f * float3(quats_[i].x, quats_[i].y, quats_[i].z).Mul(halfSize);
+        others.push_back(AABB::FromCenterAndSize(box.CenterPoint() + offset, boxes_[(i + 1) & mask].Size()));
+        const float3 overlap = (box.maxPoint - others[i].minPoint).Min(others[i].maxPoint - box.minPoint);
+        depths.push_back(overlap.MinElement());
+    }
+    int failures = 0;
+    for(int i = 0; i < cNumMathItems; ++i)
+    {
+        float3 normal;
+        float depth;
+        if (!EPAPenetration(boxes_[i], others[i], normal, depth) || Abs(depth - depths[i]) > 1e-3f * Max(1.f, depths[i]))
+            ++failures;
+    }
+    if (failures > 0)
+        LogWarning("BenchmarkModule: EPAPenetration got the wrong depth for " + QString::number(failures) + " of " +
+            QString::number(cNumMathItems) + " boxes.");
+
+    float sum = 0.f;
+    const tick_t start = GetCurrentClockTime();
+    for(int i = 0; i < iterations; ++i)
+    {
+        float3 normal;
+        float depth = 0.f;
+        EPAPenetration(boxes_[i & mask], others[i & mask], normal, depth);
+        sum += depth;
+    }
+    const tick_t end = GetCurrentClockTime();
+    sink_ += sum;
+    return end - start;
+}
+
+u64 BenchmarkModule::QuatMul(int iterations)
+{
+    const int mask = cNumMathItems - 1;
+    float sum = 0.f;
+    const tick_t start = GetCurrentClockTime();
+    for(int i = 0; i < iterations; ++i)
+        sum += (quats_[i & mask] * quats_[(i + 1) & mask]).w;
+    const tick_t end = GetCurrentClockTime();
+    sink_ += sum;
+    return end - start;
+}
+
+u64 BenchmarkModule::QuatSlerp(int iterations)
+{
+    const int mask = cNumMathItems - 1;
+    float sum = 0.f;
+    const tick_t start = GetCurrentClockTime();
+    for(int i = 0; i < iterations; ++i)
+        sum += quats_[i & mask].Slerp(quats_[(i + 1) & mask], 0.3f).w;
+    const tick_t end = GetCurrentClockTime();
+    sink_ += sum;
+    return end - start;
+}
+
+u64 BenchmarkModule::QuatTransform(int iterations)
+{
+    const int mask = cNumMathItems - 1;
+    float sum = 0.f;
+    const tick_t start = GetCurrentClockTime();
+    for(int i = 0; i < iterations; ++i)
+        sum += quats_[i & mask].Transform(vectors_[(i + 1) & mask]).x;
+    const tick_t end = GetCurrentClockTime();
+    sink_ += sum;
+    return end - start;
+}
+
+u64 BenchmarkModule::TriangleMeshIntersectRay(int iterations)
+{
+    const int mask = cNumRays - 1;
+    int sum = 0;
+    int triangleIndex;
+    float u, v;
+    const tick_t start = GetCurrentClockTime();
+    for(int i = 0; i < iterations; ++i)
+    {
+        mesh_->IntersectRay_TriangleIndex_UV(Ray(rayOrigins_[i & mask], rayDirections_[i & mask]), triangleIndex, u, v);
+        sum += triangleIndex;
+    }
+    const tick_t end = GetCurrentClockTime();
+    sink_ += (float)sum;
+    return end - start;
+}
+
+u64 BenchmarkModule::TriangleMeshIntersectRayCpp(int iterations)
+{
+    const int mask = cNumRays - 1;
+    int sum = 0;
+    int triangleIndex;
+    float u, v;
+    const tick_t start = GetCurrentClockTime();
+    for(int i = 0; i < iterations; ++i)
+    {
+        meshCpp_->IntersectRay_TriangleIndex_UV_CPP(Ray(rayOrigins_[i & mask], rayDirections_[i & mask]), triangleIndex, u, v);
+        sum += triangleIndex;
+    }
+    const tick_t end = GetCurrentClockTime();
+    sink_ += (float)sum;
+    return end - start;
+}
+
+u64 BenchmarkModule::TriangleMeshIntersectRays(int iterations)
+{
+    // One operation is one ray, as in the single ray benchmarks.
+    std::vector<float> distances(cNumRays);
+    std::vector<int> triangleIndices(cNumRays);
+    int sum = 0;
+    const tick_t start = GetCurrentClockTime();
+    for(int i = 0; i < iterations; i += cNumRays)
+    {
+        const int count = (iterations - i < cNumRays ? iterations - i : cNumRays);
+        mesh_->IntersectRays(&rays_[0], count, &distances[0], &triangleIndices[0]);
+        sum += triangleIndices[0];
+    }
+    const tick_t end = GetCurrentClockTime();
+    sink_ += (float)sum;
+    return end - start;
+}
+
+void BenchmarkModule::SetUpScene()
+{
+    scene_ = framework_->Scene()->CreateScene("BenchmarkScene", false, true, AttributeChange::Disconnected);
+    loadScene_ = framework_->Scene()->CreateScene("BenchmarkLoadScene", false, true, AttributeChange::Disconnected);
+
+    LCG lcg(cSeed);
+    const QStringList components = QStringList() << EC_Name::TypeNameStatic() << EC_Placeable::TypeNameStatic();
+    entityIds_.clear();
+    entityNames_.clear();
+    for(int i = 0; i < cNumSceneEntities; ++i)
+    {
+        EntityPtr entity = scene_->CreateEntity(0, components, AttributeChange::Disconnected);
+        const QString name = QString("BenchmarkEntity%1").arg(i);
+        entity->SetName(name);
+        shared_ptr<EC_Placeable> placeable = entity->Component<EC_Placeable>();
+        if (placeable)
+            placeable->transform.Set(Transform(RandomPos(lcg, 1000.f), float3(0.f, lcg.Float(0.f, 360.f), 0.f), float3::one), AttributeChange::Disconnected);
+        entityIds_.push_back(entity->Id());
+        entityNames_ << name;
+    }
+
+    attributes_.clear();
+    serializeBuffer_.resize(cSerializeBufferSize);
+    attributeData_.clear();
+    attributeOffsets_.clear();
+    for(int i = 0; i < cNumAttributeEntities && i < (int)entityIds_.size(); ++i)
+    {
+        const Entity::ComponentMap &entityComponents = scene_->EntityById(entityIds_[i])->Components();
+        for(Entity::ComponentMap::const_iterator it = entityComponents.begin(); it != entityComponents.end(); ++it)
+        {
+            const AttributeVector &attributes = it->second->Attributes();
+            for(size_t j = 0; j < attributes.size(); ++j)
+                if (attributes[j])
+                {
+                    kNet::DataSerializer ds(&serializeBuffer_[0], serializeBuffer_.size());
+                    attributes[j]->ToBinary(ds);
+                    attributes_.push_back(attributes[j]);
+                    attributeOffsets_.push_back(attributeData_.size());
+                    attributeData_.insert(attributeData_.end(), serializeBuffer_.begin(), serializeBuffer_.begin() + ds.BytesFilled());
+                }
+        }
+    }
+    attributeOffsets_.push_back(attributeData_.size());
+
+    // SaveSceneBinary has no in-memory variant, so go through a temporary file.
+    const QString binaryFile = QDir::tempPath() + "/TundraBenchmarkScene.tbin";
+    binaryScene_.clear();
+    if (scene_->SaveSceneBinary(binaryFile, true, true))
+    {
+        QFile file(binaryFile);
+        if (file.open(QIODevice::ReadOnly))
+            binaryScene_ = file.readAll();
+        file.close();
+        QFile::remove(binaryFile);
+    }
+    if (binaryScene_.isEmpty())
+        LogWarning("BenchmarkModule: Failed to save the binary scene to " + binaryFile + ".");
+    xmlScene_ = QString::fromUtf8(scene_->SerializeToXmlString(true, true));
+
+    cache_ = framework_->Asset()->Cache();
+    cachedRefs_.clear();
+    missingRefs_.clear();
+    if (cache_)
+    {
+        std::vector<u8> data(cCachedAssetSize);
+        for(size_t i = 0; i < data.size(); ++i)
+            data[i] = (u8)lcg.Int();
+        for(int i = 0; i < cNumCachedAssets; ++i)
+        {
+            const QString ref = QString("http://benchmark.invalid/asset%1.bin").arg(i);
+            if (!cache_->StoreAsset(&data[0], data.size(), ref).isEmpty())
+                cachedRefs_ << ref;
+            missingRefs_ << QString("http://benchmark.invalid/missing%1.bin").arg(i);
+        }
+        if (cachedRefs_.isEmpty())
+            cache_ = 0;
+    }
+}
+
+void BenchmarkModule::TearDownScene()
+{
+    if (cache_)
+        foreach(const QString &ref, cachedRefs_)
+            cache_->DeleteAsset(ref);
+    cachedRefs_.clear();
+    missingRefs_.clear();
+    cache_ = 0;
+
+    attributes_.clear();
+    attributeData_.clear();
+    attributeOffsets_.clear();
+    serializeBuffer_.clear();
+    binaryScene_.clear();
+    xmlScene_.clear();
+    entityIds_.clear();
+    entityNames_.clear();
+    scene_.reset();
+    loadScene_.reset();
+    framework_->Scene()->RemoveScene("BenchmarkScene", AttributeChange::Disconnected);
+    framework_->Scene()->RemoveScene("BenchmarkLoadScene", AttributeChange::Disconnected);
+}
+
+u64 BenchmarkModule::AttributeToBinary(int iterations)
+{
+    if (attributes_.empty())
+        return 0;
+    const size_t count = attributes_.size();
+    size_t sum = 0;
+    const tick_t start = GetCurrentClockTime();
+    for(int i = 0; i < iterations; ++i)
+    {
+        kNet::DataSerializer ds(&serializeBuffer_[0], serializeBuffer_.size());
+        attributes_[i % count]->ToBinary(ds);
+        sum += ds.BytesFilled();
+    }
+    const tick_t end = GetCurrentClockTime();
+    sink_ += (float)sum;
+    return end - start;
+}
+
+u64 BenchmarkModule::AttributeFromBinary(int iterations)
+{
+    if (attributes_.empty())
+        return 0;
+    const size_t count = attributes_.size();
+    const tick_t start = GetCurrentClockTime();
+    for(int i = 0; i < iterations; ++i)
+    {
+        const size_t index = i % count;
+        kNet::DataDeserializer dd(&attributeData_[attributeOffsets_[index]], attributeOffsets_[index + 1] - attributeOffsets_[index]);
+        attributes_[index]->FromBinary(dd, AttributeChange::Disconnected);
+    }
+    return GetCurrentClockTime() - start;
+}
+
+u64 BenchmarkModule::SceneCreateRemoveEntity(int iterations)
+{
+    const QStringList components = QStringList() << EC_Name::TypeNameStatic() << EC_Placeable::TypeNameStatic();
+    const tick_t start = GetCurrentClockTime();
+    for(int i = 0; i < iterations; ++i)
+    {
+        EntityPtr entity = scene_->CreateEntity(0, components, AttributeChange::Disconnected);
+        scene_->RemoveEntity(entity->Id(), AttributeChange::Disconnected);
+    }
+    return GetCurrentClockTime() - start;
+}
+
+u64 BenchmarkModule::SceneEntityById(int iterations)
+{
+    const size_t count = entityIds_.size();
+    size_t found = 0;
+    const tick_t start = GetCurrentClockTime();
+    for(int i = 0; i < iterations; ++i)
+        if (scene_->EntityById(entityIds_[i % count]))
+            ++found;
+    const tick_t end = GetCurrentClockTime();
+    sink_ += (float)found;
+    return end - start;
+}
+
+u64 BenchmarkModule::SceneEntityByName(int iterations)
+{
+    const int count = entityNames_.size();
+    size_t found = 0;
+    const tick_t start = GetCurrentClockTime();
+    for(int i = 0; i < iterations; ++i)
+        if (scene_->EntityByName(entityNames_[i % count]))
+            ++found;
+    const tick_t end = GetCurrentClockTime();
+    sink_ += (float)found;
+    return end - start;
+}
+
+u64 BenchmarkModule::SceneEntitiesWithComponent(int iterations)
+{
+    size_t found = 0;
+    const tick_t start = GetCurrentClockTime();
+    for(int i = 0; i < iterations; ++i)
+        found += scene_->EntitiesWithComponent(EC_Placeable::ComponentTypeId).size();
+    const tick_t end = GetCurrentClockTime();
+    sink_ += (float)found;
+    return end - start;
+}
+
+u64 BenchmarkModule::SceneLoadBinary(int iterations)
+{
+    u64 ticks = 0;
+    for(int i = 0; i < iterations; ++i)
+    {
+        loadScene_->RemoveAllEntities(false, AttributeChange::Disconnected);
+        const tick_t start = GetCurrentClockTime();
+        loadScene_->CreateContentFromBinary(binaryScene_.constData(), binaryScene_.size(), true, AttributeChange::Disconnected);
+        ticks += GetCurrentClockTime() - start;
+    }
+    loadScene_->RemoveAllEntities(false, AttributeChange::Disconnected);
+    return ticks;
+}
+
+u64 BenchmarkModule::SceneLoadXml(int iterations)
+{
+    u64 ticks = 0;
+    for(int i = 0; i < iterations; ++i)
+    {
+        loadScene_->RemoveAllEntities(false, AttributeChange::Disconnected);
+        const tick_t start = GetCurrentClockTime();
+        loadScene_->CreateContentFromXml(xmlScene_, true, AttributeChange::Disconnected);
+        ticks += GetCurrentClockTime() - start;
+    }
+    loadScene_->RemoveAllEntities(false, AttributeChange::Disconnected);
+    return ticks;
+}
+
+u64 BenchmarkModule::AssetCacheFindHit(int iterations)
+{
+    const int count = cachedRefs_.size();
+    int found = 0;
+    const tick_t start = GetCurrentClockTime();
+    for(int i = 0; i < iterations; ++i)
+        if (!cache_->FindInCache(cachedRefs_[i % count]).isEmpty())
+            ++found;
+    const tick_t end = GetCurrentClockTime();
+    sink_ += (float)found;
+    return end - start;
+}
+
+u64 BenchmarkModule::AssetCacheFindMiss(int iterations)
+{
+    const int count = missingRefs_.size();
+    int found = 0;
+    const tick_t start = GetCurrentClockTime();
+    for(int i = 0; i < iterations; ++i)
+        if (!cache_->FindInCache(missingRefs_[i % count]).isEmpty())
+            ++found;
+    const tick_t end = GetCurrentClockTime();
+    sink_ += (float)found;
+    return end - start;
+}
+
+bool BenchmarkModule::SetUpSync(QString &reason)
+{
+    TundraLogicModule *logic = framework_->Module<TundraLogicModule>();
+    if (!logic || !logic->IsServer())
+    {
+        reason = "The sync tick is benchmarked only in a server, run with --server";
+        return false;
+    }
+    ScenePtr scene = logic->GetSyncManager()->GetRegisteredScene();
+    if (!scene)
+    {
+        reason = "The server has no scene";
+        return false;
+    }
+
+    LCG lcg(cSeed);
+    const QStringList components = QStringList() << EC_Name::TypeNameStatic() << EC_Placeable::TypeNameStatic();
+    syncEntityIds_.clear();
+    for(int i = 0; i < cNumSyncEntities; ++i)
+    {
+        EntityPtr entity = scene->CreateEntity(0, components, AttributeChange::Replicate);
+        entity->SetName(QString("BenchmarkSyncEntity%1").arg(i));
+        shared_ptr<EC_Placeable> placeable = entity->Component<EC_Placeable>();
+        if (placeable)
+            placeable->transform.Set(Transform(RandomPos(lcg, 500.f), float3::zero, float3::one), AttributeChange::Replicate);
+        syncEntityIds_.push_back(entity->Id());
+    }
+
+    for(int i = 0; i < numSyncUsers_; ++i)
+    {
+        shared_ptr<BenchmarkUserConnection> user = MAKE_SHARED(BenchmarkUserConnection);
+        if (!logic->GetServer()->AddExternalUser(user))
+        {
+            reason = "The server did not accept the synthetic users";
+            return false;
+        }
+        syncUsers_.push_back(user);
+    }
+    // The server admits the logged in users to the scene a few per frame, admit them all before timing.
+    while(logic->GetServer()->LoginQueueLength() > 0)
+        logic->GetServer()->Update(0.0);
+
+    // Send the initial state of the scene before timing the ticks, which then send only the moved entities.
+    SyncManager *sync = logic->GetSyncManager().get();
+    for(int i = 0; i < cNumInitialSyncTicks; ++i)
+        sync->Update(sync->GetUpdatePeriod());
+    return true;
+}
+
+void BenchmarkModule::TearDownSync()
+{
+    TundraLogicModule *logic = framework_->Module<TundraLogicModule>();
+    if (logic && logic->GetServer())
+        for(size_t i = 0; i < syncUsers_.size(); ++i)
+            logic->GetServer()->RemoveExternalUser(syncUsers_[i]);
+    syncUsers_.clear();
+
+    ScenePtr scene = (logic && logic->GetSyncManager() ? logic->GetSyncManager()->GetRegisteredScene() : ScenePtr());
+    if (scene)
+        for(size_t i = 0; i < syncEntityIds_.size(); ++i)
+            scene->RemoveEntity(syncEntityIds_[i], AttributeChange::Replicate);
+    syncEntityIds_.clear();
+}
+
+u64 BenchmarkModule::SyncTick(int iterations)
+{
+    TundraLogicModule *logic = framework_->Module<TundraLogicModule>();
+    SyncManager *sync = logic->GetSyncManager().get();
+    ScenePtr scene = sync->GetRegisteredScene();
+    if (!scene)
+        return 0;
+
+    LCG lcg(cSeed);
+    u64 ticks = 0;
+    for(int i = 0; i < iterations; ++i)
+    {
+        // Moving the entities is not timed, only the tick that replicates the moves.
+        for(int j = 0; j < cNumMovedSyncEntities; ++j)
+        {
+            EntityPtr entity = scene->EntityById(syncEntityIds_[lcg.Int(0, (int)syncEntityIds_.size() - 1)]);
+            shared_ptr<EC_Placeable> placeable = entity ? entity->Component<EC_Placeable>() : shared_ptr<EC_Placeable>();
+            if (placeable)
+                placeable->transform.Set(Transform(RandomPos(lcg, 500.f), float3::zero, float3::one), AttributeChange::Replicate);
+        }
+        const tick_t start = GetCurrentClockTime();
+        sync->Update(sync->GetUpdatePeriod());
+        ticks += GetCurrentClockTime() - start;
+    }
+
+    u64 bytes = 0;
+    for(size_t i = 0; i < syncUsers_.size(); ++i)
+        bytes += syncUsers_[i]->numBytes;
+    sink_ += (float)bytes;
+    return ticks;
+}
+
+extern "C"
+{
+    DLLEXPORT void TundraPluginMain(Framework *fw)
+    {
+        Framework::SetInstance(fw); // Inside this DLL, remember the pointer to the global framework object.
+        fw->RegisterModule(new BenchmarkModule());
+    }
+}
@@ -0,0 +1,179 @@
+/**
+    For conditions of distribution and use, see copyright notice in LICENSE
+
+    @file   BenchmarkModule.h
+    @brief  Repeatable benchmarks of the core hot paths, with the results written as JSON. */
+
+#pragma once
+
+#if defined (_WINDOWS)
+#if defined(BENCHMARKMODULE_EXPORTS)
+#define BENCHMARKMODULE_API __declspec(dllexport)
+#else
+#define BENCHMARKMODULE_API __declspec(dllimport)
+#endif
+#else
+#define BENCHMARKMODULE_API
+#endif
+
+#include "IModule.h"
+#include "CoreTypes.h"
+#include "SceneFwd.h"
+#include "Math/float3x4.h"
+#include "Math/Quat.h"
+#include "Math/float3.h"
+#include "Geometry/AABB.h"
+#include "Geometry/Ray.h"
+#include "Math/MathFwd.h"
+
+#include <QString>
+#include <QStringList>
+#include <QByteArray>
+#include <QVariantList>
+
+#include <vector>
+
+class IAttribute;
+class AssetCache;
+class BenchmarkUserConnection;
+
+/// Repeatable benchmarks of the core hot paths, with the results written as JSON for trend tracking.
+/** Each benchmark runs its operation a fixed number of times per repetition, after one warm-up repetition, and reports
+    the minimum, median, mean and maximum time per operation over the repetitions. The random inputs come from a
+    fixed-seed LCG, so the runs are comparable with each other. Run in the headless mode, on an otherwise idle machine:
+    @code
+    Tundra --headless --server --plugin BenchmarkModule --runBenchmarks --benchmarkOutput results.json
+    @endcode
+
+    The benchmarks cover the Math kernels (float3x4, Quat, AABB, and the SSE/AVX-dispatched batch transforms, frustum culling and TriangleMesh
+    ray intersection, the latter also against the plain C++ one and with ray packets), IAttribute::ToBinary and FromBinary, creating, removing and querying entities
+    in a scene, loading a scene from the binary and the XML format, AssetCache lookups, and, when the process is a server,
+    a sync tick of SyncManager with synthetic users that sees a number of moved entities. The benchmarks that can not run
+    in the process, e.g. the sync tick in a client, are listed as skipped.
+
+    Command line parameters:
+    <ul>
+    <li>--runBenchmarks: Runs the benchmarks once the startup is over, writes the results and exits.
+        Without it, run with the "runBenchmarks" console command.
+    <li>--benchmarkFilter <substring>: Runs only the benchmarks whose name contains the substring.
+    <li>--benchmarkOutput <file>: File of the JSON results, benchmarks.json by default.
+    <li>--benchmarkRepetitions <n>: Number of the timed repetitions of each benchmark, 7 by default.
+    <li>--benchmarkUsers <n>: Number of the synthetic users of the sync tick benchmark, 50 by default.
+    </ul> */
+class BENCHMARKMODULE_API BenchmarkModule : public IModule
+{
+    Q_OBJECT
+
+public:
+    BenchmarkModule();
+    ~BenchmarkModule();
+
+    void Initialize();
+
+public slots:
+    /// Runs the benchmarks of which the name contains the filter, or all of them, and writes the results.
+    /** @return Whether the results were written. */
+    bool RunBenchmarks(const QString &filter = QString());
+
+private slots:
+    /// Runs the benchmarks given on the command line and exits.
+    void RunFromCommandLine();
+
+private:
+    /// Runs the operation of a benchmark the given number of times, and returns the clock ticks the timed part took.
+    typedef u64 (BenchmarkModule::*BenchmarkFunction)(int iterations);
+
+    struct Benchmark
+    {
+        const char *name;
+        BenchmarkFunction function;
+        int iterations; ///< Number of the operations per repetition.
+    };
+
+    /// Returns whether the name of the benchmark contains the filter.
+    bool Selected(const QString &name) const;
+
+    /// Returns whether any of the benchmarks passes the filter, so that their fixture is needed.
+    bool AnySelected(const Benchmark *benchmarks, size_t count) const;
+
+    /// Runs a benchmark, if it passes the filter, and adds its results.
+    void Measure(const Benchmark &benchmark);
+
+    /// Adds a benchmark that can not be run in this process to the results.
+    void Skip(const QString &name, const QString &reason);
+
+    // The fixtures of the benchmark groups.
+    void SetUpMath();
+    void SetUpScene();
+    void TearDownScene();
+    bool SetUpSync(QString &reason);
+    void TearDownSync();
+
+    // The benchmarks.
+    u64 Float3x4Mul(int iterations);
+    u64 Float3x4Inverse(int iterations);
+    u64 Float3x4TransformPos(int iterations);
+    u64 Float3x4BatchTransformPos(int iterations);
+    u64 Float3x4BatchTransformPosSoA(int iterations);
+    u64 AABBTransformAsAABB(int iterations);
+    u64 FrustumBatchIntersects(int iterations);
+    u64 GJKIntersects(int iterations);
+    u64 EPAPenetrations(int iterations);
+    u64 QuatMul(int iterations);
+    u64 QuatSlerp(int iterations);
+    u64 QuatTransform(int iterations);
+    u64 TriangleMeshIntersectRay(int iterations);
+    u64 TriangleMeshIntersectRayCpp(int iterations);
+    u64 TriangleMeshIntersectRays(int iterations);
+    u64 AttributeToBinary(int iterations);
+    u64 AttributeFromBinary(int iterations);
+    u64 SceneCreateRemoveEntity(int iterations);
+    u64 SceneEntityById(int iterations);
+    u64 SceneEntityByName(int iterations);
+    u64 SceneEntitiesWithComponent(int iterations);
+    u64 SceneLoadBinary(int iterations);
+    u64 SceneLoadXml(int iterations);
+    u64 AssetCacheFindHit(int iterations);
+    u64 AssetCacheFindMiss(int iterations);
+    u64 SyncTick(int iterations);
+
+    QString filter_;
+    QString outputFile_;
+    int repetitions_;
+    int numSyncUsers_;
+    QVariantList results_;
+    volatile float sink_; ///< Accumulates the results of the operations, so that the compiler can not drop them.
+
+    // Math fixture.
+    std::vector<float3x4> matrices_;
+    std::vector<Quat> quats_;
+    std::vector<float3> vectors_;
+    std::vector<float3> batch_; ///< Transformed in place by the batch benchmark.
+    std::vector<float> batchX_, batchY_, batchZ_; ///< batch_ as separate coordinate arrays.
+    std::vector<float> triangles_; ///< Vertices of the ray intersection mesh.
+    std::vector<float3> rayOrigins_;
+    std::vector<float3> rayDirections_;
+    std::vector<Ray> rays_; ///< rayOrigins_ and rayDirections_ as rays, for the packet benchmark.
+    std::vector<AABB> boxes_; ///< Culled by the frustum culling benchmark.
+    TriangleMesh *mesh_; ///< Laid out for the SIMD path the CPU supports.
+    TriangleMesh *meshCpp_; ///< Laid out for the plain C++ path.
+
+    // Scene fixture.
+    ScenePtr scene_; ///< Populated benchmark scene.
+    ScenePtr loadScene_; ///< Empty scene the load benchmarks load to.
+    std::vector<entity_id_t> entityIds_;
+    QStringList entityNames_;
+    std::vector<IAttribute*> attributes_; ///< Attributes of the populated scene for the serialization benchmarks.
+    std::vector<char> attributeData_; ///< The attributes serialized.
+    std::vector<size_t> attributeOffsets_; ///< Offsets of the attributes in attributeData_, and its size.
+    std::vector<char> serializeBuffer_; ///< Destination of the serialization benchmark.
+    QByteArray binaryScene_;
+    QString xmlScene_;
+    AssetCache *cache_;
+    QStringList cachedRefs_;
+    QStringList missingRefs_;
+
+    // Sync fixture.
+    std::vector<shared_ptr<BenchmarkUserConnection> > syncUsers_;
+    std::vector<entity_id_t> syncEntityIds_;
+};
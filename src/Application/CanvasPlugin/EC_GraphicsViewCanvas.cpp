@@ -44,9 +44,11 @@ EC_GraphicsViewCanvas::EC_GraphicsViewCanvas(Scene *scene) :
     INIT_ATTRIBUTE(width, "Texture width"),
     INIT_ATTRIBUTE(height, "Texture height"),
     INIT_ATTRIBUTE_VALUE(submesh, "Submesh", (unsigned)0),
+    INIT_ATTRIBUTE_VALUE(updateRate, "Update rate", (unsigned)25),
     graphicsScene(0),
     graphicsView(0),
     paintTarget(0),
+    updateTimer(0),
     isActivated(false)
 {
     graphicsView = new QGraphicsView();
@@ -54,6 +56,7 @@ EC_GraphicsViewCanvas::EC_GraphicsViewCanvas(Scene *scene) :
     graphicsView->setScene(graphicsScene);
     paintTarget = new RedirectedPaintWidget();
     paintTarget->setAttribute(Qt::WA_DontShowOnScreen, true);
+    paintTarget->installEventFilter(this);
     graphicsView->setViewport(paintTarget); // graphicsView takes ownership of the paintTarget viewport widget.
     graphicsView->setAttribute(Qt::WA_DontShowOnScreen, true);
     graphicsView->show();
@@ -64,6 +67,10 @@ EC_GraphicsViewCanvas::EC_GraphicsViewCanvas(Scene *scene) :
     graphicsView->setVerticalScrollBarPolicy(Qt::ScrollBarAlwaysOff);
     graphicsView->setLineWidth(0);
 
+    updateTimer = new QTimer(this);
+    updateTimer->setSingleShot(true);
+    connect(updateTimer, SIGNAL(timeout()), this, SLOT(OnUpdateTimer()));
+
     connect(this, SIGNAL(ParentEntitySet()), this, SLOT(UpdateSignals()));
 }
 
@@ -108,9 +115,35 @@ void EC_GraphicsViewCanvas::UpdateSignals()
     }
 }
 
-void EC_GraphicsViewCanvas::OnGraphicsSceneChanged(const QList<QRectF> &)
+void EC_GraphicsViewCanvas::OnGraphicsSceneChanged(const QList<QRectF> &rects)
+{
+    QRegion region;
+    foreach(const QRectF &rect, rects)
+        region += graphicsView->mapFromScene(rect).boundingRect().adjusted(-1, -1, 1, 1);
+    MarkDirty(region);
+}
+
+bool EC_GraphicsViewCanvas::eventFilter(QObject *obj, QEvent *e)
+{
+    // The paint event is filtered before the view paints, so the upload is scheduled for after it.
+    if (obj == paintTarget && e->type() == QEvent::Paint)
+        MarkDirty(static_cast<QPaintEvent*>(e)->region());
+    return false;
+}
+
+void EC_GraphicsViewCanvas::MarkDirty(const QRegion &region)
 {
-    UpdateTexture();
+    if (region.isEmpty())
+        return;
+    dirtyRegion += region;
+    if (!updateTimer->isActive())
+        updateTimer->start(updateRate.Get() > 0 ? 1000 / updateRate.Get() : 0);
+}
+
+void EC_GraphicsViewCanvas::OnUpdateTimer()
+{
+    if (!dirtyRegion.isEmpty())
+        UpdateTexture();
 }
 
 void EC_GraphicsViewCanvas::AttributesChanged()
@@ -130,6 +163,7 @@ void EC_GraphicsViewCanvas::AttributesChanged()
         graphicsView->resize(width.Get(), height.Get());
         paintTarget->target = QImage(width.Get(), height.Get(), QImage::Format_ARGB32);
         paintTarget->target.fill(0);
+        dirtyRegion = QRegion();
     }
 }
 
@@ -470,6 +504,7 @@ void EC_GraphicsViewCanvas::UpdateTexture()
     }
 
     // Allocate GPU memory for the texture if one didn't exist. Also make sure the texture is without mipmaps.
+    bool fullUpload = dirtyRegion.isEmpty();
     if (textureAsset->ogreTexture.isNull() || !QString(textureAsset->ogreTexture->getName().c_str()).contains("Tex_NoMipMaps"))
     {
         // Re-create texture without mipmaps.
@@ -481,6 +516,7 @@ void EC_GraphicsViewCanvas::UpdateTexture()
         if (texture.isNull())
             return;
         textureAsset->ogreTexture = texture;
+        fullUpload = true;
     }
 
     // Apply the texture onto the material. The material may change at runtime, so re-apply to retain the binding at all times.
@@ -492,6 +528,18 @@ void EC_GraphicsViewCanvas::UpdateTexture()
         material->getTechnique(0)->getPass(0)->getTextureUnitState(0)->setTextureName(textureAsset->ogreTexture->getName());
     }
 
-    textureAsset->SetContents(paintTarget->target.width(), paintTarget->target.height(), (const u8*)paintTarget->target.bits(),
-        paintTarget->target.width() * paintTarget->target.height() * 4, Ogre::PF_A8R8G8B8, false, true, false);
+    // Upload only the repainted parts, unless the texture has to be filled or resized.
+    const QImage &target = paintTarget->target;
+    if (!fullUpload && (int)textureAsset->ogreTexture->getWidth() == target.width() && (int)textureAsset->ogreTexture->getHeight() == target.height())
+    {
+        QVector<QRect> rects = dirtyRegion.rects();
+        for(int i = 0; i < rects.size() && !fullUpload; ++i)
+            fullUpload = !textureAsset->SetContentsRect(rects[i], target.bits(), target.bytesPerLine(), Ogre::PF_A8R8G8B8);
+    }
+    else
+        fullUpload = true;
+    dirtyRegion = QRegion();
+
+    if (fullUpload)
+        textureAsset->SetContents(target.width(), target.height(), target.bits(), target.width() * target.height() * 4, Ogre::PF_A8R8G8B8, false, true, false);
 }
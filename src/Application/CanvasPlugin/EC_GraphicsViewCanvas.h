@@ -11,6 +11,7 @@
 #include "OgreModuleFwd.h"
 
 #include <QEvent>
+#include <QRegion>
 
 class QGraphicsScene;
 class QGraphicsView;
@@ -20,6 +21,7 @@ class QDragLeaveEvent;
 class QDropEvent;
 class float2;
 class RedirectedPaintWidget;
+class QTimer;
 
 /// Makes possible to to embed arbitrary Qt UI elements into a 3D model.
 /** <table class="header">
@@ -41,6 +43,8 @@ class RedirectedPaintWidget;
     <div> @copydoc height
     <li> uint : submesh
     <div> @copydoc submesh
+    <li> uint : updateRate
+    <div> @copydoc updateRate
     </ul>
 
     <b>Exposes the following scriptable functions:</b>
@@ -53,6 +57,9 @@ class RedirectedPaintWidget;
     The material at the EC_Mesh at index which @c submesh points to is cloned for the usage of this component.
     Only material with single texture unit supported.
 
+    The regions of the view that are repainted are collected from the paint events, and only they are uploaded
+    to the texture, at most @c updateRate times a second.
+
     </table> */
 class EC_GraphicsViewCanvas : public IComponent
 {
@@ -83,6 +90,13 @@ public:
     Q_PROPERTY(uint submesh READ getsubmesh WRITE setsubmesh);
     DEFINE_QPROPERTY_ATTRIBUTE(uint, submesh);
 
+    /// Specifies the maximum number of texture updates per second, or 0 to update on every change.
+    Q_PROPERTY(uint updateRate READ getupdateRate WRITE setupdateRate);
+    DEFINE_QPROPERTY_ATTRIBUTE(uint, updateRate);
+
+    /// QObject override. Collects the repainted regions of the view.
+    bool eventFilter(QObject *obj, QEvent *e);
+
 public slots:
     /// Returns the graphics scene in which content can be added.
     /** @note Do not store the pointer, but access it through this each time you need it. */
@@ -105,6 +119,7 @@ private slots:
     void OnDropEvent(QDropEvent *e);
     void OnMaterialChanged(uint, const QString &);
     void UpdateTexture();
+    void OnUpdateTimer();
 
 private:
     void AttributesChanged();
@@ -115,11 +130,15 @@ private:
     bool IsMouseOnTopOfMainUI() const;
     bool IsMouseOnTopOfCanvas(QPoint & mousePos, float2 & uv) const;
     QPointF GetPointOnView(QPoint & mousePos);
-
+    /// Adds the region of the view to the region uploaded on the next update, and schedules the update.
+    void MarkDirty(const QRegion &region);
 
     QGraphicsScene *graphicsScene;
     QGraphicsView *graphicsView;
     RedirectedPaintWidget *paintTarget;
+    QTimer *updateTimer;
+    /// The region of paintTarget changed since the last upload.
+    QRegion dirtyRegion;
     InputContextPtr inputContext;
     bool isActivated;
 
@@ -10,6 +10,7 @@
 
 #include "DebugStats.h"
 #include "TimeProfilerWindow.h"
+#include "RemoteProfiler.h"
 
 #include "Framework.h"
 #include "UiAPI.h"
@@ -40,7 +41,8 @@ void DumpProfilerToLog(ProfilerNodeTree* node, int indent, int elapsedFrames);
 
 DebugStatsModule::DebugStatsModule() :
     IModule("DebugStats"),
-    profilerWindow_(0)
+    profilerWindow_(0),
+    remoteProfiler_(0)
 {
 }
 
@@ -61,6 +63,15 @@ void DebugStatsModule::Initialize()
     framework_->Console()->RegisterCommand("exec", "Invokes an Entity Action on an entity (debugging).",
         this, SLOT(Exec(const QStringList &)));
 
+    remoteProfiler_ = new RemoteProfiler(framework_, this);
+    framework_->Console()->RegisterCommand("profRemote", "Shows the profiling blocks of the server in the profiling window. The server needs to be started with --remoteProfiler <password>. "
+        "Usage: profRemote(password, intervalMs). The interval defaults to 1000 ms.",
+        remoteProfiler_, SLOT(Attach(const QString &, int)), SLOT(Attach(const QString &)));
+    framework_->Console()->RegisterCommand("profRemoteStop", "Stops showing the profiling blocks of the server.",
+        remoteProfiler_, SLOT(Detach()));
+    framework_->Console()->RegisterCommand("profRemoteStats", "Prints the frame times, and the scene sync and asset statistics of the latest profiler snapshot of the server.",
+        remoteProfiler_, SLOT(PrintStatistics()));
+
     inputContext = framework_->Input()->RegisterInputContext("DebugStatsInput", 90);
     connect(inputContext.get(), SIGNAL(KeyPressed(KeyEvent *)), this, SLOT(HandleKeyPressed(KeyEvent *)));
 }
@@ -112,6 +123,8 @@ void DebugStatsModule::Update(f64 frametime)
     double timeSpent = ProfilerBlock::ElapsedTimeSeconds(lastCallTime, now);
     lastCallTime = now;
 
+    remoteProfiler_->Update(frametime);
+
 #ifdef PROFILING
     if (enableProfilerLogDump)
     {
@@ -17,6 +17,7 @@
 #include "HighPerfClock.h"
 
 class TimeProfilerWindow;
+class RemoteProfiler;
 
 /// Shows information about internal core data structures in separate windows.
 /** Useful for verifying and understanding the internal state of the application. */
@@ -39,6 +40,10 @@ public slots:
     /** @return Current profiler window or null if not open */
     TimeProfilerWindow *ProfilerWindow() const;
 
+public:
+    /// Returns the streaming of the profiler snapshots to and from the other end of the connection.
+    RemoteProfiler *Remote() const { return remoteProfiler_; }
+
 private slots:
     /// Starts profiling if the profiler widget is visible.
     /** @param bool visible Visibility. */
@@ -52,6 +57,7 @@ private slots:
 private:
     std::vector<std::pair<u64, double> > frameTimes; ///< A history of estimated frame times.
     QPointer<TimeProfilerWindow> profilerWindow_; /// Profiler window
+    RemoteProfiler *remoteProfiler_; ///< Remote profiling, owned as a child of the module.
     shared_ptr<InputContext> inputContext; ///< InputContext for Shift-P - Profiler window shortcut.
     tick_t lastCallTime;
     tick_t lastProfilerDumpTime;
@@ -0,0 +1,443 @@
+/**
+ *  For conditions of distribution and use, see copyright notice in LICENSE
+ *
+ *  @file   RemoteProfiler.cpp
+ *  @brief  Streams the profiler snapshots of a server to the clients that attach to it.
+ */
+
+#include "StableHeaders.h"
+#include "DebugOperatorNew.h"
+
+#include "RemoteProfiler.h"
+
+#include "Framework.h"
+#include "AssetAPI.h"
+#include "LoggingFunctions.h"
+#include "TundraLogicModule.h"
+#include "Client.h"
+#include "Server.h"
+#include "SyncManager.h"
+#include "UserConnection.h"
+#include "TundraMessages.h"
+
+#include <kNet/DataSerializer.h>
+#include <kNet/DataDeserializer.h>
+
+#include <algorithm>
+
+#include "MemoryLeakCheck.h"
+
+namespace
+{
+
+void AddString(kNet::DataSerializer &ds, const QByteArray &str)
+{
+    ds.AddVLE<kNet::VLE8_16_32>((u32)str.size());
+    if (!str.isEmpty())
+        ds.AddArray<u8>((const u8*)str.data(), (u32)str.size());
+}
+
+/// Reads a string written with AddString. Returns false if the data ends before it.
+bool ReadString(kNet::DataDeserializer &dd, std::string &str)
+{
+    if (dd.BytesLeft() == 0)
+        return false;
+    const u32 length = dd.ReadVLE<kNet::VLE8_16_32>();
+    if (length > dd.BytesLeft())
+        return false;
+    str.resize(length);
+    if (length > 0)
+        dd.ReadArray<u8>((u8*)&str[0], length);
+    return true;
+}
+
+/// Bytes of a string written with AddString, at most.
+size_t StringSize(size_t length)
+{
+    return length + 4;
+}
+
+/// Sets the custom counters of the nodes under the node to zero.
+void ClearCounters(ProfilerNodeTree *node)
+{
+    const ProfilerNodeTree::NodeList &children = node->GetChildren();
+    for(ProfilerNodeTree::NodeList::const_iterator iter = children.begin(); iter != children.end(); ++iter)
+    {
+        const ProfilerNode *timings = dynamic_cast<const ProfilerNode*>(iter->get());
+        if (timings)
+        {
+            timings->num_called_custom_ = 0;
+            timings->total_custom_ = 0;
+            timings->custom_elapsed_min_ = 1e9;
+            timings->custom_elapsed_max_ = 0;
+        }
+        ClearCounters(iter->get());
+    }
+}
+
+} // ~unnamed namespace
+
+RemoteProfiler::RemoteProfiler(Framework *framework, QObject *parent) :
+    QObject(parent),
+    framework_(framework),
+    connected_(false),
+    lastSnapshotTime_(GetCurrentClockTime()),
+    frames_(0),
+    frameTimeTotal_(0),
+    frameTimeMax_(0),
+    attached_(false),
+    received_(false),
+    numFrames_(1),
+    snapshotMsecs_(0),
+    root_("Root")
+{
+    const QStringList passwordParam = framework_->CommandLineParameters("--remoteProfiler");
+    if (!passwordParam.isEmpty())
+    {
+        password_ = passwordParam.first();
+        if (password_.isEmpty())
+            LogWarning("RemoteProfiler: --remoteProfiler needs a password. The profiler snapshots are not available.");
+#ifndef PROFILING
+        LogWarning("RemoteProfiler: --remoteProfiler has no effect, as profiling is not enabled in this build.");
+        password_.clear();
+#endif
+    }
+}
+
+RemoteProfiler::~RemoteProfiler()
+{
+}
+
+void RemoteProfiler::Update(f64 frametime)
+{
+    if (!connected_)
+    {
+        TundraLogicModule *tundra = framework_->Module<TundraLogicModule>();
+        if (!tundra || !tundra->GetServer() || !tundra->GetClient())
+            return;
+        connect(tundra->GetServer().get(), SIGNAL(MessageReceived(UserConnection *, kNet::packet_id_t, kNet::message_id_t, const char *, size_t)),
+            this, SLOT(HandleServerMessage(UserConnection *, kNet::packet_id_t, kNet::message_id_t, const char *, size_t)));
+        connect(tundra->GetClient().get(), SIGNAL(NetworkMessageReceived(kNet::packet_id_t, kNet::message_id_t, const char *, size_t)),
+            this, SLOT(HandleClientMessage(kNet::packet_id_t, kNet::message_id_t, const char *, size_t)));
+        connected_ = true;
+    }
+
+    if (subscribers_.empty())
+        return;
+
+    ++frames_;
+    frameTimeTotal_ += frametime;
+    frameTimeMax_ = std::max(frameTimeMax_, (double)frametime);
+
+    int intervalMsecs = subscribers_.begin()->second;
+    for(std::map<u32, int>::const_iterator iter = subscribers_.begin(); iter != subscribers_.end(); ++iter)
+        intervalMsecs = std::min(intervalMsecs, iter->second);
+    const tick_t now = GetCurrentClockTime();
+    if ((double)(now - lastSnapshotTime_) * 1000.0 / (double)GetCurrentClockFreq() >= intervalMsecs)
+        SendSnapshot(now);
+}
+
+ProfilerNodeTree *RemoteProfiler::Root()
+{
+    // The profiler window resets the counters as it shows them, so they are set anew on each call.
+    ClearCounters(&root_);
+    std::vector<ProfilerNodeTree*> parents(1, &root_);
+    for(size_t i = 0; i < blocks_.size(); ++i)
+    {
+        const Block &block = blocks_[i];
+        if (block.depth >= parents.size() || block.name == parents[block.depth]->Name())
+            continue; // Malformed, or the same name as the parent, which the nodes can not have.
+        parents.resize(block.depth + 1);
+        ProfilerNodeTree *parent = parents.back();
+        ProfilerNodeTree *node = parent->GetChild(block.name);
+        if (!node)
+        {
+            node = block.timings ? new ProfilerNode(block.name) : new ProfilerNodeTree(block.name);
+            parent->AddChild(shared_ptr<ProfilerNodeTree>(node));
+        }
+        const ProfilerNode *timings = dynamic_cast<const ProfilerNode*>(node);
+        if (timings && block.timings)
+        {
+            timings->num_called_custom_ = block.calls;
+            timings->total_custom_ = block.total;
+            timings->custom_elapsed_min_ = block.calls > 0 ? block.min : 1e9;
+            timings->custom_elapsed_max_ = block.max;
+        }
+        parents.push_back(node);
+    }
+    return &root_;
+}
+
+void RemoteProfiler::Attach(const QString &password, int intervalMsecs)
+{
+    TundraLogicModule *tundra = framework_->Module<TundraLogicModule>();
+    UserConnectionPtr server = (tundra && tundra->GetClient() && tundra->GetClient()->IsConnected()) ?
+        tundra->GetClient()->ServerUserConnection() : UserConnectionPtr();
+    if (!server)
+    {
+        LogError("RemoteProfiler::Attach: Not connected to a server.");
+        return;
+    }
+
+    const QByteArray passwordUtf8 = password.toUtf8();
+    std::vector<char> buffer(StringSize(passwordUtf8.size()) + 4);
+    kNet::DataSerializer ds(&buffer[0], buffer.size());
+    AddString(ds, passwordUtf8);
+    ds.AddVLE<kNet::VLE8_16_32>((u32)std::max(intervalMsecs, cMinIntervalMsecs));
+    server->Send(cProfilerSubscribeMessage, ds.GetData(), ds.BytesFilled(), true, true);
+
+    attached_ = true;
+    received_ = false;
+    LogInfo("RemoteProfiler: Asked the server for profiler snapshots. The profiler window shows them once they arrive.");
+}
+
+void RemoteProfiler::Attach(const QString &password)
+{
+    Attach(password, 1000);
+}
+
+void RemoteProfiler::Detach()
+{
+    if (!attached_)
+        return;
+    attached_ = false;
+    received_ = false;
+    blocks_.clear();
+    statistics_.clear();
+
+    TundraLogicModule *tundra = framework_->Module<TundraLogicModule>();
+    UserConnectionPtr server = (tundra && tundra->GetClient() && tundra->GetClient()->IsConnected()) ?
+        tundra->GetClient()->ServerUserConnection() : UserConnectionPtr();
+    if (!server)
+        return;
+    // An empty password with a zero interval unsubscribes.
+    char buffer[8];
+    kNet::DataSerializer ds(buffer, sizeof(buffer));
+    AddString(ds, QByteArray());
+    ds.AddVLE<kNet::VLE8_16_32>(0);
+    server->Send(cProfilerSubscribeMessage, ds.GetData(), ds.BytesFilled(), true, true);
+}
+
+void RemoteProfiler::PrintStatistics()
+{
+    if (!HasSnapshot())
+    {
+        LogInfo("RemoteProfiler: No snapshot received from a server.");
+        return;
+    }
+    for(size_t i = 0; i < statistics_.size(); ++i)
+        LogInfo(QString("%1: %2").arg(statistics_[i].first).arg(statistics_[i].second));
+}
+
+void RemoteProfiler::HandleServerMessage(UserConnection *connection, kNet::packet_id_t /*packetId*/, kNet::message_id_t messageId, const char *data, size_t numBytes)
+{
+    if (messageId != cProfilerSubscribeMessage || !connection)
+        return;
+
+    kNet::DataDeserializer dd(data, numBytes);
+    std::string password;
+    if (!ReadString(dd, password) || dd.BytesLeft() == 0)
+    {
+        LogWarning("RemoteProfiler: Received a malformed profiler subscription from connection " + QString::number(connection->ConnectionId()) + ".");
+        return;
+    }
+    const u32 intervalMsecs = dd.ReadVLE<kNet::VLE8_16_32>();
+    if (intervalMsecs == 0)
+    {
+        subscribers_.erase(connection->ConnectionId());
+        return;
+    }
+    if (password_.isEmpty() || QString::fromUtf8(password.c_str(), (int)password.size()) != password_)
+    {
+        LogWarning("RemoteProfiler: Refused the profiler subscription of connection " + QString::number(connection->ConnectionId()) + ", as the password does not match.");
+        return;
+    }
+
+    if (subscribers_.empty())
+    {
+        // Start the first snapshot from now on, without the time nobody was subscribed.
+        lastSnapshotTime_ = GetCurrentClockTime();
+        frames_ = 0;
+        frameTimeTotal_ = 0;
+        frameTimeMax_ = 0;
+    }
+    subscribers_[connection->ConnectionId()] = std::max((int)intervalMsecs, cMinIntervalMsecs);
+    LogInfo("RemoteProfiler: Streaming profiler snapshots to connection " + QString::number(connection->ConnectionId()) + ".");
+}
+
+void RemoteProfiler::HandleClientMessage(kNet::packet_id_t /*packetId*/, kNet::message_id_t messageId, const char *data, size_t numBytes)
+{
+    if (messageId == cProfilerSnapshotMessage && attached_)
+        ReadSnapshot(data, numBytes);
+}
+
+void RemoteProfiler::CollectBlocks(ProfilerNodeTree *node, u32 depth, std::vector<std::pair<ProfilerNodeTree*, u32> > &dst)
+{
+    const ProfilerNodeTree::NodeList &children = node->GetChildren();
+    for(ProfilerNodeTree::NodeList::const_iterator iter = children.begin(); iter != children.end(); ++iter)
+    {
+        dst.push_back(std::make_pair(iter->get(), depth));
+        CollectBlocks(iter->get(), depth + 1, dst);
+    }
+}
+
+void RemoteProfiler::SendSnapshot(tick_t now)
+{
+#ifdef PROFILING
+    PROFILE(RemoteProfiler_SendSnapshot);
+    TundraLogicModule *tundra = framework_->Module<TundraLogicModule>();
+    if (!tundra || !tundra->GetServer())
+        return;
+
+    std::vector<std::pair<QByteArray, double> > stats;
+    const double msecs = (double)(now - lastSnapshotTime_) * 1000.0 / (double)GetCurrentClockFreq();
+    stats.push_back(std::make_pair(QByteArray("frames"), (double)frames_));
+    stats.push_back(std::make_pair(QByteArray("snapshotMsecs"), msecs));
+    stats.push_back(std::make_pair(QByteArray("frameAverageMsecs"), frames_ > 0 ? frameTimeTotal_ * 1000.0 / frames_ : 0.0));
+    stats.push_back(std::make_pair(QByteArray("frameMaxMsecs"), frameTimeMax_ * 1000.0));
+    stats.push_back(std::make_pair(QByteArray("users"), (double)tundra->GetServer()->AuthenticatedUsers().size()));
+    if (tundra->GetSyncManager())
+    {
+        // The totals since the start of the server, or the last reset of the statistics.
+        double counters[4] = { 0, 0, 0, 0 };
+        const QVariantList messages = tundra->GetSyncManager()->MessageStatistics();
+        foreach(const QVariant &entry, messages)
+        {
+            const QVariantMap map = entry.toMap();
+            counters[0] += map["sentMessages"].toDouble();
+            counters[1] += map["sentBytes"].toDouble();
+            counters[2] += map["receivedMessages"].toDouble();
+            counters[3] += map["receivedBytes"].toDouble();
+        }
+        stats.push_back(std::make_pair(QByteArray("syncSentMessages"), counters[0]));
+        stats.push_back(std::make_pair(QByteArray("syncSentBytes"), counters[1]));
+        stats.push_back(std::make_pair(QByteArray("syncReceivedMessages"), counters[2]));
+        stats.push_back(std::make_pair(QByteArray("syncReceivedBytes"), counters[3]));
+    }
+    stats.push_back(std::make_pair(QByteArray("assetTransfers"), (double)framework_->Asset()->NumCurrentTransfers()));
+    stats.push_back(std::make_pair(QByteArray("assetPendingTransfers"), (double)framework_->Asset()->PendingTransfers().size()));
+
+    std::vector<std::pair<ProfilerNodeTree*, u32> > nodes;
+    CollectBlocks(framework_->GetProfiler()->GetRoot(), 0, nodes);
+
+    size_t size = 8;
+    for(size_t i = 0; i < stats.size(); ++i)
+        size += StringSize(stats[i].first.size()) + sizeof(double);
+    for(size_t i = 0; i < nodes.size(); ++i)
+        size += 4 + StringSize(nodes[i].first->Name().size()) + 1 + 4 + 3 * sizeof(float);
+
+    std::vector<char> buffer(size);
+    kNet::DataSerializer ds(&buffer[0], buffer.size());
+    ds.AddVLE<kNet::VLE8_16_32>((u32)stats.size());
+    for(size_t i = 0; i < stats.size(); ++i)
+    {
+        AddString(ds, stats[i].first);
+        ds.Add<double>(stats[i].second);
+    }
+    ds.AddVLE<kNet::VLE8_16_32>((u32)nodes.size());
+    for(size_t i = 0; i < nodes.size(); ++i)
+    {
+        ds.AddVLE<kNet::VLE8_16_32>(nodes[i].second);
+        AddString(ds, QByteArray(nodes[i].first->Name().c_str(), (int)nodes[i].first->Name().size()));
+        const ProfilerNode *timings = dynamic_cast<const ProfilerNode*>(nodes[i].first);
+        ds.Add<u8>(timings ? 1 : 0);
+        if (!timings)
+            continue;
+        ds.AddVLE<kNet::VLE8_16_32>((u32)timings->num_called_custom_);
+        ds.Add<float>((float)timings->total_custom_);
+        ds.Add<float>((float)timings->custom_elapsed_min_);
+        ds.Add<float>((float)timings->custom_elapsed_max_);
+
+        timings->num_called_custom_ = 0;
+        timings->total_custom_ = 0;
+        timings->custom_elapsed_min_ = 1e9;
+        timings->custom_elapsed_max_ = 0;
+    }
+
+    for(std::map<u32, int>::iterator iter = subscribers_.begin(); iter != subscribers_.end();)
+    {
+        UserConnectionPtr connection = tundra->GetServer()->GetUserConnection(iter->first);
+        if (!connection)
+        {
+            subscribers_.erase(iter++);
+            continue;
+        }
+        connection->Send(cProfilerSnapshotMessage, ds.GetData(), ds.BytesFilled(), true, true, 50);
+        ++iter;
+    }
+
+    lastSnapshotTime_ = now;
+    frames_ = 0;
+    frameTimeTotal_ = 0;
+    frameTimeMax_ = 0;
+#else
+    UNREFERENCED_PARAM(now)
+#endif
+}
+
+void RemoteProfiler::ReadSnapshot(const char *data, size_t numBytes)
+{
+    kNet::DataDeserializer dd(data, numBytes);
+    std::vector<std::pair<QString, double> > stats;
+    std::vector<Block> blocks;
+
+    const u32 numStats = dd.BytesLeft() > 0 ? dd.ReadVLE<kNet::VLE8_16_32>() : 0;
+    for(u32 i = 0; i < numStats; ++i)
+    {
+        std::string name;
+        if (!ReadString(dd, name) || dd.BytesLeft() < sizeof(double))
+        {
+            LogWarning("RemoteProfiler: Received a malformed profiler snapshot.");
+            return;
+        }
+        stats.push_back(std::make_pair(QString::fromUtf8(name.c_str(), (int)name.size()), dd.Read<double>()));
+    }
+
+    const u32 numBlocks = dd.BytesLeft() > 0 ? dd.ReadVLE<kNet::VLE8_16_32>() : 0;
+    if (numBlocks > dd.BytesLeft() / 3) // Each block takes at least the depth, name length and timings flag bytes.
+    {
+        LogWarning("RemoteProfiler: Received a malformed profiler snapshot.");
+        return;
+    }
+    blocks.resize(numBlocks);
+    for(u32 i = 0; i < numBlocks; ++i)
+    {
+        Block &block = blocks[i];
+        block.depth = dd.BytesLeft() > 0 ? dd.ReadVLE<kNet::VLE8_16_32>() : 0;
+        if (!ReadString(dd, block.name) || dd.BytesLeft() == 0)
+        {
+            LogWarning("RemoteProfiler: Received a malformed profiler snapshot.");
+            return;
+        }
+        block.timings = dd.Read<u8>() != 0;
+        block.calls = 0;
+        block.total = block.min = block.max = 0.f;
+        if (!block.timings)
+            continue;
+        if (dd.BytesLeft() < 1 + 3 * sizeof(float))
+        {
+            LogWarning("RemoteProfiler: Received a malformed profiler snapshot.");
+            return;
+        }
+        block.calls = dd.ReadVLE<kNet::VLE8_16_32>();
+        if (dd.BytesLeft() < 3 * sizeof(float))
+        {
+            LogWarning("RemoteProfiler: Received a malformed profiler snapshot.");
+            return;
+        }
+        block.total = dd.Read<float>();
+        block.min = dd.Read<float>();
+        block.max = dd.Read<float>();
+    }
+
+    statistics_.swap(stats);
+    blocks_.swap(blocks);
+    numFrames_ = 1;
+    snapshotMsecs_ = 0;
+    for(size_t i = 0; i < statistics_.size(); ++i)
+        if (statistics_[i].first == "frames")
+            numFrames_ = std::max((int)statistics_[i].second, 1);
+        else if (statistics_[i].first == "snapshotMsecs")
+            snapshotMsecs_ = (float)statistics_[i].second;
+    received_ = true;
+}
@@ -0,0 +1,120 @@
+/**
+ *  For conditions of distribution and use, see copyright notice in LICENSE
+ *
+ *  @file   RemoteProfiler.h
+ *  @brief  Streams the profiler snapshots of a server to the clients that attach to it.
+ */
+
+#pragma once
+
+#include "DebugStatsModuleApi.h"
+#include "CoreTypes.h"
+#include "HighPerfClock.h"
+#include "Profiler.h"
+#include "kNetFwd.h"
+#include "kNet/Types.h"
+#include "TundraProtocolModuleFwd.h"
+
+#include <QObject>
+#include <QString>
+
+#include <map>
+#include <vector>
+#include <utility>
+
+class Framework;
+
+/// Streams the profiler snapshots of a server, such as a headless TundraConsole, to the clients that attach to it.
+/** On a server started with '--remoteProfiler <password>', a client that sends the password in a cProfilerSubscribeMessage
+    gets a cProfilerSnapshotMessage on the interval it asked for: the block tree with the timings since the previous
+    snapshot, the frame times, and the SyncManager and asset statistics. The snapshots are sent over the UserConnection of
+    the client, so the clients of the kNet and the WebSocket servers can attach alike. The snapshot is built once per
+    interval for all the clients, of the shortest interval asked for, and reads and resets the custom counters of the
+    profiler nodes, like the profiler window does locally.
+
+    On a client, Attach sends the subscription to the server the client is connected to. The profiler window then shows
+    the blocks of the server instead of the local ones, until Detach. Both ends need a build with profiling enabled. */
+class DEBUGSTATS_MODULE_API RemoteProfiler : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit RemoteProfiler(Framework *framework, QObject *parent = 0);
+    ~RemoteProfiler();
+
+    /// Sends the snapshots that are due, and connects to the server and the client once they exist.
+    void Update(f64 frametime);
+
+    /// Returns whether the client is attached to a server and has received a snapshot from it.
+    bool HasSnapshot() const { return attached_ && received_; }
+
+    /// Returns the blocks of the server as a tree of profiler nodes, with the custom counters set from the latest snapshot.
+    /** The nodes are kept between the snapshots, so that the profiler window can keep its items. */
+    ProfilerNodeTree *Root();
+
+    /// Returns the number of frames the latest snapshot spans.
+    int NumFrames() const { return numFrames_; }
+
+    /// Returns the time in milliseconds the latest snapshot spans.
+    float SnapshotMsecs() const { return snapshotMsecs_; }
+
+    /// Returns the statistics of the latest snapshot as name-value pairs.
+    const std::vector<std::pair<QString, double> > &Statistics() const { return statistics_; }
+
+    /// Minimum interval of the snapshots in milliseconds.
+    static const int cMinIntervalMsecs = 100;
+
+public slots:
+    /// Asks the server the client is connected to for a snapshot every given milliseconds.
+    void Attach(const QString &password, int intervalMsecs);
+    void Attach(const QString &password); ///< @overload Asks for a snapshot every second.
+
+    /// Stops the snapshots of the server.
+    void Detach();
+
+    /// Prints the statistics of the latest snapshot.
+    void PrintStatistics();
+
+private slots:
+    void HandleServerMessage(UserConnection *connection, kNet::packet_id_t packetId, kNet::message_id_t messageId, const char *data, size_t numBytes);
+    void HandleClientMessage(kNet::packet_id_t packetId, kNet::message_id_t messageId, const char *data, size_t numBytes);
+
+private:
+    /// A block of a received snapshot.
+    struct Block
+    {
+        u32 depth;
+        std::string name;
+        bool timings;
+        u32 calls;
+        float total;
+        float min;
+        float max;
+    };
+
+    /// Appends the nodes under the node to the list in pre-order, with their depths.
+    static void CollectBlocks(ProfilerNodeTree *node, u32 depth, std::vector<std::pair<ProfilerNodeTree*, u32> > &dst);
+
+    void SendSnapshot(tick_t now);
+    void ReadSnapshot(const char *data, size_t numBytes);
+
+    Framework *framework_;
+    QString password_; ///< The password of --remoteProfiler; empty if the snapshots of this server are not available.
+    bool connected_; ///< Whether the signals of the server and client have been connected.
+
+    // Server.
+    std::map<u32, int> subscribers_; ///< The interval in milliseconds by connection ID.
+    tick_t lastSnapshotTime_;
+    u32 frames_; ///< Number of frames since the previous snapshot.
+    double frameTimeTotal_;
+    double frameTimeMax_;
+
+    // Client.
+    bool attached_;
+    bool received_;
+    std::vector<Block> blocks_;
+    std::vector<std::pair<QString, double> > statistics_;
+    int numFrames_;
+    float snapshotMsecs_;
+    ProfilerNodeTree root_;
+};
@@ -4,6 +4,8 @@
 #include "DebugOperatorNew.h"
 
 #include "TimeProfilerWindow.h"
+#include "DebugStats.h"
+#include "RemoteProfiler.h"
 
 #include "Profiler.h"
 #include "HighPerfClock.h"
@@ -33,12 +35,17 @@
 #include "IAssetBundle.h"
 #include "ConfigAPI.h"
 #include "TreeWidgetUtils.h"
+#include "TundraLogicModule.h"
+#include "SyncManager.h"
+#include "FrameTimeStatistics.h"
 #ifdef EC_Script_ENABLED
 #include "IScriptInstance.h"
 #include "EC_Script.h"
 #endif
 
 #include <utility>
+#include <algorithm>
+#include <vector>
 
 #include <QVBoxLayout>
 #include <QTreeWidget>
@@ -53,6 +60,8 @@
 #include <QMenu>
 #include <QDesktopServices>
 #include <QString>
+#include <QSet>
+#include <QStyledItemDelegate>
 
 #include <btBulletDynamicsCommon.h>
 #include <OgreFontManager.h>
@@ -79,6 +88,41 @@ namespace
         if (item)
             QApplication::clipboard()->setText(item->text(0));
     }
+
+    /// Paints the stages of an asset transfer as coloured segments on the time span of the shown transfers.
+    /** The item data of Qt::UserRole is a list of the span start and end times followed by the IAssetTransfer time points. */
+    class AssetWaterfallDelegate : public QStyledItemDelegate
+    {
+    public:
+        explicit AssetWaterfallDelegate(QObject *parent) : QStyledItemDelegate(parent) {}
+
+        void paint(QPainter *painter, const QStyleOptionViewItem &option, const QModelIndex &index) const
+        {
+            QStyledItemDelegate::paint(painter, option, index);
+            const QVariantList data = index.data(Qt::UserRole).toList();
+            if (data.size() < 2 + IAssetTransfer::NumTimingPoints)
+                return;
+            const qint64 spanStart = data[0].toLongLong();
+            const qint64 span = std::max<qint64>(1, data[1].toLongLong() - spanStart);
+            const QRect rect = option.rect.adjusted(2, 3, -2, -3);
+            static const QColor colors[IAssetTransfer::NumTimingPoints] = { Qt::gray, Qt::lightGray, Qt::yellow, Qt::green,
+                Qt::cyan, Qt::blue, Qt::magenta, Qt::red };
+
+            painter->save();
+            qint64 previous = data[2 + IAssetTransfer::TimeRequested].toLongLong();
+            for(int i = IAssetTransfer::TimeStarted; i < IAssetTransfer::NumTimingPoints; ++i)
+            {
+                const qint64 time = data[2 + i].toLongLong();
+                if (time < 0 || previous < 0)
+                    continue;
+                const int x0 = rect.left() + (int)((previous - spanStart) * rect.width() / span);
+                const int x1 = rect.left() + (int)((time - spanStart) * rect.width() / span);
+                painter->fillRect(QRect(x0, rect.top(), std::max(1, x1 - x0), rect.height()), colors[i]);
+                previous = time;
+            }
+            painter->restore();
+        }
+    };
 }
 
 TimeProfilerWindow::TimeProfilerWindow(Framework *fw, QWidget *parent) :
@@ -117,6 +161,41 @@ TimeProfilerWindow::TimeProfilerWindow(Framework *fw, QWidget *parent) :
     connect(ui_.tabWidget, SIGNAL(currentChanged(int)), this, SLOT(RefreshProfilerTabWidget(int)));
     connect(ui_.ogreTabWidget, SIGNAL(currentChanged(int)), this, SLOT(RefreshOgreTabWidget(int)));
 
+    // Replication page, see SyncManager::SetStatisticsEnabled.
+    replicationTree_ = new QTreeWidget(this);
+    replicationTree_->setHeaderLabels(QStringList() << tr("Name") << tr("Sent") << tr("Sent bytes") << tr("Received") << tr("Received bytes"));
+    replicationTree_->header()->resizeSection(0, 300);
+    ui_.tabWidget->insertTab(ui_.tabWidget->count(), replicationTree_, tr("Replication"));
+
+    // Memory page, see Scene::ComponentMemoryStatistics.
+    memoryTree_ = new QTreeWidget(this);
+    memoryTree_->setHeaderLabels(QStringList() << tr("Name") << tr("Count") << tr("Memory") << tr("Attributes")
+        << tr("Dynamic properties") << tr("Sync states") << tr("Assets") << tr("Asset size"));
+    memoryTree_->header()->resizeSection(0, 300);
+    ui_.tabWidget->insertTab(ui_.tabWidget->count(), memoryTree_, tr("Memory"));
+
+    // Asset pipeline page, see AssetAPI::TransferStatistics.
+    assetPipelineTree_ = new QTreeWidget(this);
+    QStringList assetPipelineLabels;
+    assetPipelineLabels << tr("Name") << tr("Count") << tr("Failed");
+    for(int i = IAssetTransfer::TimeStarted; i < IAssetTransfer::NumTimingPoints; ++i)
+        assetPipelineLabels << QString(IAssetTransfer::StageName((IAssetTransfer::TimingPoint)i)) + " ms";
+    assetPipelineLabels << tr("Total ms") << tr("Waterfall");
+    assetPipelineTree_->setHeaderLabels(assetPipelineLabels);
+    assetPipelineTree_->header()->resizeSection(0, 300);
+    assetPipelineTree_->header()->resizeSection(assetPipelineLabels.size() - 1, 300);
+    assetPipelineTree_->setItemDelegateForColumn(assetPipelineLabels.size() - 1, new AssetWaterfallDelegate(assetPipelineTree_));
+    ui_.tabWidget->insertTab(ui_.tabWidget->count(), assetPipelineTree_, tr("Asset pipeline"));
+
+    // Frame times page, see FrameTimeStatistics.
+    frameTimesTree_ = new QTreeWidget(this);
+    frameTimesTree_->setHeaderLabels(QStringList() << tr("Name") << tr("Count") << tr("p50 ms") << tr("p95 ms") << tr("p99 ms") << tr("Max ms")
+        << tr("Allocs/frame") << tr("Alloc KB/frame"));
+    frameTimesTree_->header()->resizeSection(0, 300);
+    frameTimesTree_->setColumnHidden(6, !AllocationTracker::IsEnabled());
+    frameTimesTree_->setColumnHidden(7, !AllocationTracker::IsEnabled());
+    ui_.tabWidget->insertTab(ui_.tabWidget->count(), frameTimesTree_, tr("Frame times"));
+
     // Inject kNet's NetworkDialog to the UI as Network page if applicable.
 #ifdef KNET_USE_QT
     ui_.tabWidget->insertTab(ui_.tabWidget->count(), new kNet::NetworkDialog(this, framework_->Module<KristalliProtocolModule>()->GetNetwork()), tr("Network"));
@@ -128,6 +207,9 @@ TimeProfilerWindow::TimeProfilerWindow(Framework *fw, QWidget *parent) :
     ui_.treeProfilingData->header()->resizeSection(2, 50);
     ui_.treeProfilingData->header()->resizeSection(3, 50);
     ui_.treeProfilingData->header()->resizeSection(4, 50);
+    // The allocation columns, see AllocationTracker.
+    ui_.treeProfilingData->setColumnHidden(13, !AllocationTracker::IsEnabled());
+    ui_.treeProfilingData->setColumnHidden(14, !AllocationTracker::IsEnabled());
 
     ui_.treeAssetCache->header()->resizeSection(1, 90);
 
@@ -649,6 +731,30 @@ void TimeProfilerWindow::RefreshProfilerTabWidget(int pageIndex)
             RefreshAssetsPage();
             break;
         }
+        // Replication
+        case 6:
+        {
+            RefreshReplicationPage();
+            break;
+        }
+        // Memory
+        case 7:
+        {
+            RefreshMemoryPage();
+            break;
+        }
+        // Asset pipeline
+        case 8:
+        {
+            RefreshAssetPipelinePage();
+            break;
+        }
+        // Frame times
+        case 9:
+        {
+            RefreshFrameTimesPage();
+            break;
+        }
     }
 }
 
@@ -844,6 +950,10 @@ void TimeProfilerWindow::FillProfileTimingWindow(QTreeWidgetItem *qtNode, const
                 item->setText(11, str);
                 sprintf(str, "%.2fms", timeSpentInThisExclusive * 1000.f);
                 item->setText(12, str);
+                sprintf(str, "%.1f", (float)timings_node->num_allocations_custom_ / numFrames);
+                item->setText(13, str);
+                sprintf(str, "%.2f", (float)timings_node->allocated_bytes_custom_ / 1024.f / numFrames);
+                item->setText(14, str);
             }
             else
             {
@@ -856,6 +966,8 @@ void TimeProfilerWindow::FillProfileTimingWindow(QTreeWidgetItem *qtNode, const
                 item->setText(10, "-");
                 item->setText(11, "-");
                 item->setText(12, "-");
+                item->setText(13, "-");
+                item->setText(14, "-");
             }
             ColorTreeWidgetItemByTime(item, timings_node->total_custom_ * 1000.f / numFrames);
         }
@@ -868,6 +980,8 @@ void TimeProfilerWindow::FillProfileTimingWindow(QTreeWidgetItem *qtNode, const
             timings_node->total_custom_ = 0;
             timings_node->custom_elapsed_min_ = 1e9;
             timings_node->custom_elapsed_max_ = 0;
+            timings_node->num_allocations_custom_ = 0;
+            timings_node->allocated_bytes_custom_ = 0;
         }
     }
 }
@@ -1436,7 +1550,20 @@ void TimeProfilerWindow::RefreshTimingPage()
 
     // We use this node to estimate FPS for display.
     ProfilerNode *processFrameNode = dynamic_cast<ProfilerNode*>(profiler.FindBlockByName("Framework_ProcessOneFrame"));
-    if (processFrameNode)
+    RemoteProfiler *remote = AttachedRemoteProfiler();
+    if (remote)
+    {
+        // The blocks of the server span the interval of its snapshot instead.
+        msecsOccurred = std::max(remote->SnapshotMsecs(), 1.f);
+        const int numFrames = remote->NumFrames();
+        ui_.labelTimings->setText(QString("Server: %1 FPS").arg(QString::number((double)(numFrames * 1000.f / msecsOccurred), 'f', 2)));
+        ui_.labelTimings2->setText(QString("(%1 msecs/frame)").arg(QString::number((double)(msecsOccurred / numFrames), 'f', 2)));
+        QStringList stats;
+        for(size_t i = 0; i < remote->Statistics().size(); ++i)
+            stats << remote->Statistics()[i].first + ": " + QString::number(remote->Statistics()[i].second);
+        ui_.labelTimings2->setToolTip(stats.join("\n"));
+    }
+    else if (processFrameNode)
     {
         int numFrames = std::max<int>(processFrameNode->num_called_custom_, 1);
         ui_.labelTimings->setText(QString("%1 FPS").arg(QString::number((double)(numFrames * 1000.f / msecsOccurred), 'f', 2)));
@@ -1447,6 +1574,8 @@ void TimeProfilerWindow::RefreshTimingPage()
         ui_.labelTimings->setText("- FPS");
         ui_.labelTimings2->setText("");
     }
+    if (!remote)
+        ui_.labelTimings2->setToolTip("");
     
     profiler.Release();
 
@@ -1466,12 +1595,8 @@ void TimeProfilerWindow::RefreshProfilingDataTree(float msecsOccurred)
 #ifdef PROFILING
     Profiler &profiler = *framework_->GetProfiler();
     profiler.Lock();
-    ProfilerNodeTree *node = profiler.GetRoot();
-
     int numFrames = 1;
-    ProfilerNode *processFrameNode = dynamic_cast<ProfilerNode*>(profiler.FindBlockByName("Framework_ProcessOneFrame")); // We use this node to estimate FPS for display.
-    if (processFrameNode)
-        numFrames = std::max<int>(processFrameNode->num_called_custom_, 1);
+    ProfilerNodeTree *node = TimingRoot(numFrames);
 
     const ProfilerNodeTree::NodeList &children = node->GetChildren();
     for(ProfilerNodeTree::NodeList::const_iterator iter = children.begin(); iter != children.end(); ++iter)
@@ -1528,6 +1653,10 @@ void TimeProfilerWindow::RefreshProfilingDataTree(float msecsOccurred)
                 item->setText(11, str);
                 sprintf(str, "%.2fms", timeSpentInThisExclusive * 1000.f);
                 item->setText(12, str);
+                sprintf(str, "%.1f", (float)timings_node->num_allocations_custom_ / numFrames);
+                item->setText(13, str);
+                sprintf(str, "%.2f", (float)timings_node->allocated_bytes_custom_ / 1024.f / numFrames);
+                item->setText(14, str);
             }
             else
             {
@@ -1540,6 +1669,8 @@ void TimeProfilerWindow::RefreshProfilingDataTree(float msecsOccurred)
                 item->setText(10, "-");
                 item->setText(11, "-");
                 item->setText(12, "-");
+                item->setText(13, "-");
+                item->setText(14, "-");
             }
 
             ColorTreeWidgetItemByTime(item, timings_node->total_custom_ * 1000.f / numFrames);
@@ -1548,12 +1679,17 @@ void TimeProfilerWindow::RefreshProfilingDataTree(float msecsOccurred)
             timings_node->total_custom_ = 0;
             timings_node->custom_elapsed_min_ = 1e9;
             timings_node->custom_elapsed_max_ = 0;
+            timings_node->num_allocations_custom_ = 0;
+            timings_node->allocated_bytes_custom_ = 0;
         }
+        else if (profilingBlockName == "Renderer_GPU")
+            item->setToolTip(0, tr("GPU times of the render phases, measured with timestamp queries and read back a few frames later."));
 
         FillProfileTimingWindow(item, node, numFrames, msecsOccurred / 1000.f);
     }
     
-    UpdateBulletProfilingData(ui_.treeProfilingData->invisibleRootItem(), numFrames);
+    if (!AttachedRemoteProfiler())
+        UpdateBulletProfilingData(ui_.treeProfilingData->invisibleRootItem(), numFrames);
     profiler.Release();
     
     // Filter
@@ -1565,6 +1701,34 @@ void TimeProfilerWindow::RefreshProfilingDataTree(float msecsOccurred)
 #endif
 }
 
+RemoteProfiler *TimeProfilerWindow::AttachedRemoteProfiler() const
+{
+    DebugStatsModule *module = framework_->Module<DebugStatsModule>();
+    RemoteProfiler *remote = module ? module->Remote() : 0;
+    return (remote && remote->HasSnapshot()) ? remote : 0;
+}
+
+ProfilerNodeTree *TimeProfilerWindow::TimingRoot(int &numFrames)
+{
+    RemoteProfiler *remote = AttachedRemoteProfiler();
+    if (remote)
+    {
+        numFrames = remote->NumFrames();
+        return remote->Root();
+    }
+
+    numFrames = 1;
+#ifdef PROFILING
+    Profiler &profiler = *framework_->GetProfiler();
+    ProfilerNode *processFrameNode = dynamic_cast<ProfilerNode*>(profiler.FindBlockByName("Framework_ProcessOneFrame")); // We use this node to estimate FPS for display.
+    if (processFrameNode)
+        numFrames = std::max<int>(processFrameNode->num_called_custom_, 1);
+    return profiler.GetRoot();
+#else
+    return 0;
+#endif
+}
+
 void TimeProfilerWindow::CollectProfilerNodes(ProfilerNodeTree *node, std::vector<const ProfilerNode *> &dst)
 {
     const ProfilerNodeTree::NodeList &children = node->GetChildren();
@@ -1620,7 +1784,8 @@ void TimeProfilerWindow::RefreshProfilingDataList(float msecsOccurred)
     Profiler &profiler = *framework_->GetProfiler();
     profiler.Lock();
 
-    ProfilerNodeTree *root = profiler.GetRoot();
+    int numFrames = 1;
+    ProfilerNodeTree *root = TimingRoot(numFrames);
     std::vector<const ProfilerNode *> nodes;
     CollectProfilerNodes(root, nodes);
     std::sort(nodes.begin(), nodes.end(), ProfilingNodeLessThan);
@@ -1630,11 +1795,6 @@ void TimeProfilerWindow::RefreshProfilingDataList(float msecsOccurred)
     bool showUnused = ui_.checkBoxShowUnused->isChecked();
     QStringList filters = TimingFilters();
 
-    int numFrames = 1;
-    ProfilerNode *processFrameNode = dynamic_cast<ProfilerNode*>(profiler.FindBlockByName("Framework_ProcessOneFrame")); // We use this node to estimate FPS for display.
-    if (processFrameNode)
-        numFrames = std::max<int>(processFrameNode->num_called_custom_, 1);
-
     for(std::vector<const ProfilerNode *>::iterator iter = nodes.begin(); iter != nodes.end(); ++iter)
     {
         const ProfilerNode *timings_node = *iter;
@@ -1771,7 +1931,7 @@ void TimeProfilerWindow::RefreshAssetsPage()
     QHash<QString, ProfilerAssetTypeInfo> assetsPerType;
 
     // Iterate all loaded assets.
-    AssetMap assets = framework_->Asset()->Assets();
+    const AssetMap &assets = framework_->Asset()->AllAssets();
     for (AssetMap::const_iterator iter = assets.begin(); iter != assets.end(); ++iter)
     {
         AssetPtr asset = iter->second;
@@ -1811,7 +1971,7 @@ void TimeProfilerWindow::RefreshAssetsPage()
     }
 
     // Iterate loaded bundles
-    AssetBundleMap bundles = framework_->Asset()->AssetBundles();
+    const AssetBundleMap &bundles = framework_->Asset()->AllAssetBundles();
     for (AssetBundleMap::const_iterator iter = bundles.begin(); iter != bundles.end(); ++iter)
     {
         AssetBundlePtr bundle = iter->second;
@@ -1866,6 +2026,265 @@ void TimeProfilerWindow::RefreshAssetsPage()
     QTimer::singleShot(500, this, SLOT(RefreshAssetsPage()));
 }
 
+/// Adds a replication statistics row with the sent and received counts of a ReplicationStatistics entry.
+static void AddReplicationStatsItem(QTreeWidgetItem *parent, const QString &name, const QVariantMap &entry, const QString &countName)
+{
+    QTreeWidgetItem *item = new QTreeWidgetItem(parent);
+    item->setText(0, name);
+    item->setText(1, entry["sent" + countName].toString());
+    item->setText(2, QString::fromStdString(kNet::FormatBytes(entry["sentBytes"].toULongLong())));
+    item->setText(3, entry["received" + countName].toString());
+    item->setText(4, QString::fromStdString(kNet::FormatBytes(entry["receivedBytes"].toULongLong())));
+}
+
+void TimeProfilerWindow::RefreshReplicationPage()
+{
+    if (!visibility_ || ui_.tabWidget->currentWidget() != replicationTree_)
+        return;
+
+    TundraLogic::TundraLogicModule *tundraLogic = framework_->Module<TundraLogic::TundraLogicModule>();
+    TundraLogic::SyncManager *syncManager = tundraLogic ? tundraLogic->GetSyncManager().get() : 0;
+
+    // Remember which groups were expanded, as the tree is rebuilt on every refresh.
+    QSet<QString> expanded;
+    for(int i = 0; i < replicationTree_->topLevelItemCount(); ++i)
+        if (replicationTree_->topLevelItem(i)->isExpanded())
+            expanded.insert(replicationTree_->topLevelItem(i)->text(0));
+    replicationTree_->clear();
+
+    if (!syncManager || !syncManager->StatisticsEnabled())
+    {
+        new QTreeWidgetItem(replicationTree_, QStringList(tr("Replication statistics are disabled. Enable with --syncStatistics or SyncManager.statisticsEnabled.")));
+        QTimer::singleShot(500, this, SLOT(RefreshReplicationPage()));
+        return;
+    }
+
+    QTreeWidgetItem *components = new QTreeWidgetItem(replicationTree_, QStringList(tr("Components")));
+    foreach(const QVariant &v, syncManager->ComponentStatistics())
+    {
+        const QVariantMap entry = v.toMap();
+        AddReplicationStatsItem(components, entry["typeName"].toString(), entry, "Updates");
+    }
+
+    QTreeWidgetItem *attributes = new QTreeWidgetItem(replicationTree_, QStringList(tr("Attributes")));
+    foreach(const QVariant &v, syncManager->AttributeStatistics())
+    {
+        const QVariantMap entry = v.toMap();
+        AddReplicationStatsItem(attributes, entry["typeName"].toString() + " #" + entry["attributeIndex"].toString(), entry, "Updates");
+    }
+
+    QTreeWidgetItem *messages = new QTreeWidgetItem(replicationTree_, QStringList(tr("Messages")));
+    foreach(const QVariant &v, syncManager->MessageStatistics())
+    {
+        const QVariantMap entry = v.toMap();
+        AddReplicationStatsItem(messages, tr("Connection %1, message %2").arg(entry["connectionId"].toString()).arg(entry["messageId"].toString()), entry, "Messages");
+    }
+
+    for(int i = 0; i < replicationTree_->topLevelItemCount(); ++i)
+        replicationTree_->topLevelItem(i)->setExpanded(expanded.contains(replicationTree_->topLevelItem(i)->text(0)));
+
+    QTimer::singleShot(500, this, SLOT(RefreshReplicationPage()));
+}
+
+void TimeProfilerWindow::RefreshMemoryPage()
+{
+    if (!visibility_ || ui_.tabWidget->currentWidget() != memoryTree_)
+        return;
+
+    QSet<QString> expanded;
+    for(int i = 0; i < memoryTree_->topLevelItemCount(); ++i)
+        if (memoryTree_->topLevelItem(i)->isExpanded())
+            expanded.insert(memoryTree_->topLevelItem(i)->text(0));
+    memoryTree_->clear();
+
+    Scene *scene = framework_->Scene()->MainCameraScene();
+    if (!scene)
+    {
+        new QTreeWidgetItem(memoryTree_, QStringList(tr("There is no active scene.")));
+        QTimer::singleShot(2000, this, SLOT(RefreshMemoryPage()));
+        return;
+    }
+
+    TundraLogic::TundraLogicModule *tundraLogic = framework_->Module<TundraLogic::TundraLogicModule>();
+    TundraLogic::SyncManager *syncManager = tundraLogic ? tundraLogic->GetSyncManager().get() : 0;
+    QMap<QString, QVariantMap> syncStates;
+    if (syncManager)
+        foreach(const QVariant &v, syncManager->SyncStateMemoryStatistics())
+        {
+            const QVariantMap entry = v.toMap();
+            syncStates[entry["typeName"].toString()] = entry;
+        }
+
+    QTreeWidgetItem *components = new QTreeWidgetItem(memoryTree_, QStringList(tr("Component types")));
+    qulonglong totalBytes = 0;
+    qulonglong totalSyncBytes = syncStates["Entity"]["bytes"].toULongLong();
+    foreach(const QVariant &v, scene->ComponentMemoryStatistics())
+    {
+        const QVariantMap entry = v.toMap();
+        const qulonglong syncBytes = syncStates[entry["typeName"].toString()]["bytes"].toULongLong();
+        totalBytes += entry["bytes"].toULongLong();
+        totalSyncBytes += syncBytes;
+        QTreeWidgetItem *item = new QTreeWidgetItem(components);
+        item->setText(0, entry["typeName"].toString());
+        item->setText(1, entry["count"].toString());
+        item->setText(2, QString::fromStdString(kNet::FormatBytes(entry["bytes"].toULongLong())));
+        item->setText(3, QString::fromStdString(kNet::FormatBytes(entry["attributeBytes"].toULongLong())));
+        item->setText(4, QString::fromStdString(kNet::FormatBytes(entry["dynamicPropertyBytes"].toULongLong())));
+        item->setText(5, QString::fromStdString(kNet::FormatBytes(syncBytes)));
+        item->setText(6, entry["assets"].toString());
+        item->setText(7, QString::fromStdString(kNet::FormatBytes(entry["assetBytes"].toULongLong())));
+    }
+    components->setText(2, QString::fromStdString(kNet::FormatBytes(totalBytes)));
+    components->setText(5, QString::fromStdString(kNet::FormatBytes(totalSyncBytes)));
+
+    QTreeWidgetItem *entities = new QTreeWidgetItem(memoryTree_, QStringList(tr("Largest entities")));
+    foreach(const QVariant &v, scene->EntityMemoryStatistics(50))
+    {
+        const QVariantMap entry = v.toMap();
+        QTreeWidgetItem *item = new QTreeWidgetItem(entities);
+        item->setText(0, QString("%1 (%2)").arg(entry["name"].toString()).arg(entry["id"].toUInt()));
+        item->setText(1, entry["components"].toString());
+        item->setText(2, QString::fromStdString(kNet::FormatBytes(entry["bytes"].toULongLong())));
+    }
+
+    for(int i = 0; i < memoryTree_->topLevelItemCount(); ++i)
+        memoryTree_->topLevelItem(i)->setExpanded(expanded.contains(memoryTree_->topLevelItem(i)->text(0)));
+
+    // Traversing the whole scene is not free, so refresh less often than the other pages.
+    QTimer::singleShot(2000, this, SLOT(RefreshMemoryPage()));
+}
+
+/// Sets the count and average stage duration columns of an asset pipeline row from a TransferStatistics entry.
+static void SetAssetPipelineStatsItem(QTreeWidgetItem *item, const QVariantMap &entry)
+{
+    item->setText(0, entry["name"].toString().isEmpty() ? QString("(none)") : entry["name"].toString());
+    item->setText(1, entry["count"].toString());
+    item->setText(2, entry["failed"].toString());
+    int column = 3;
+    for(int i = IAssetTransfer::TimeStarted; i < IAssetTransfer::NumTimingPoints; ++i)
+        item->setText(column++, QString::number(entry[IAssetTransfer::StageName((IAssetTransfer::TimingPoint)i)].toDouble(), 'f', 1));
+    item->setText(column, QString::number(entry["total"].toDouble(), 'f', 1));
+}
+
+void TimeProfilerWindow::RefreshAssetPipelinePage()
+{
+    if (!visibility_ || ui_.tabWidget->currentWidget() != assetPipelineTree_)
+        return;
+
+    QSet<QString> expanded;
+    for(int i = 0; i < assetPipelineTree_->topLevelItemCount(); ++i)
+        if (assetPipelineTree_->topLevelItem(i)->isExpanded())
+            expanded.insert(assetPipelineTree_->topLevelItem(i)->text(0));
+    assetPipelineTree_->clear();
+
+    AssetAPI *asset = framework_->Asset();
+    QTreeWidgetItem *providers = new QTreeWidgetItem(assetPipelineTree_, QStringList(tr("Providers")));
+    QTreeWidgetItem *types = new QTreeWidgetItem(assetPipelineTree_, QStringList(tr("Asset types")));
+    foreach(const QVariant &v, asset->TransferStatistics())
+    {
+        const QVariantMap entry = v.toMap();
+        SetAssetPipelineStatsItem(new QTreeWidgetItem(entry["group"].toString() == "provider" ? providers : types), entry);
+    }
+
+    // Show the latest transfers on a shared time axis, newest first.
+    const int cMaxShownTransfers = 50;
+    QVariantList recent = asset->RecentTransferTimings();
+    recent = recent.mid(std::max(0, recent.size() - cMaxShownTransfers));
+    qint64 spanStart = -1;
+    qint64 spanEnd = -1;
+    foreach(const QVariant &v, recent)
+    {
+        const QVariantList times = v.toMap()["times"].toList();
+        foreach(const QVariant &t, times)
+        {
+            const qint64 time = t.toLongLong();
+            if (time < 0)
+                continue;
+            if (spanStart < 0 || time < spanStart)
+                spanStart = time;
+            spanEnd = std::max(spanEnd, time);
+        }
+    }
+
+    QTreeWidgetItem *transfers = new QTreeWidgetItem(assetPipelineTree_, QStringList(tr("Recent transfers")));
+    const int waterfallColumn = assetPipelineTree_->columnCount() - 1;
+    for(int i = recent.size() - 1; i >= 0; --i)
+    {
+        const QVariantMap entry = recent[i].toMap();
+        const QVariantList times = entry["times"].toList();
+        QTreeWidgetItem *item = new QTreeWidgetItem(transfers);
+        item->setText(0, entry["ref"].toString());
+        item->setToolTip(0, entry["provider"].toString() + " " + entry["type"].toString());
+        item->setText(2, entry["succeeded"].toBool() ? "" : "x");
+        // Stage durations from the previous recorded time point, like IAssetTransfer::StageDuration.
+        qint64 total = 0;
+        qint64 previous = times.isEmpty() ? -1 : times[0].toLongLong();
+        for(int j = IAssetTransfer::TimeStarted; j < times.size(); ++j)
+        {
+            const qint64 time = times[j].toLongLong();
+            if (time < 0 || previous < 0)
+                continue;
+            total += std::max<qint64>(0, time - previous);
+            item->setText(2 + j, QString::number(std::max<qint64>(0, time - previous)));
+            previous = time;
+        }
+        item->setText(waterfallColumn - 1, QString::number(total));
+        QVariantList waterfall;
+        waterfall << spanStart << spanEnd << times;
+        item->setData(waterfallColumn, Qt::UserRole, waterfall);
+    }
+
+    for(int i = 0; i < assetPipelineTree_->topLevelItemCount(); ++i)
+        assetPipelineTree_->topLevelItem(i)->setExpanded(expanded.contains(assetPipelineTree_->topLevelItem(i)->text(0)));
+
+    QTimer::singleShot(500, this, SLOT(RefreshAssetPipelinePage()));
+}
+
+void TimeProfilerWindow::RefreshFrameTimesPage()
+{
+    if (!visibility_ || ui_.tabWidget->currentWidget() != frameTimesTree_)
+        return;
+
+    QSet<QString> collapsed;
+    for(int i = 0; i < frameTimesTree_->topLevelItemCount(); ++i)
+        if (!frameTimesTree_->topLevelItem(i)->isExpanded())
+            collapsed.insert(frameTimesTree_->topLevelItem(i)->text(0));
+    frameTimesTree_->clear();
+
+    // The frames first, then the modules by p99 of the window, slowest first.
+    const int windows[] = { FrameTimeStatistics::cShortWindow, FrameTimeStatistics::cLongWindow };
+    for(size_t w = 0; w < sizeof(windows) / sizeof(windows[0]); ++w)
+    {
+        QTreeWidgetItem *window = new QTreeWidgetItem(frameTimesTree_, QStringList(tr("Last %1 seconds").arg(windows[w])));
+        const QVariantList entries = framework_->FrameTimes()->Statistics(windows[w]);
+        std::vector<std::pair<double, int> > order;
+        for(int i = 1; i < entries.size(); ++i)
+            order.push_back(std::make_pair(-entries[i].toMap()["p99"].toDouble(), i));
+        std::stable_sort(order.begin(), order.end());
+        if (!entries.isEmpty())
+            order.insert(order.begin(), std::make_pair(0.0, 0));
+        for(size_t i = 0; i < order.size(); ++i)
+        {
+            const QVariantMap entry = entries[order[i].second].toMap();
+            QTreeWidgetItem *item = new QTreeWidgetItem(window);
+            item->setText(0, entry["name"].toString());
+            item->setText(1, entry["count"].toString());
+            item->setText(2, QString::number(entry["p50"].toDouble(), 'f', 2));
+            item->setText(3, QString::number(entry["p95"].toDouble(), 'f', 2));
+            item->setText(4, QString::number(entry["p99"].toDouble(), 'f', 2));
+            item->setText(5, QString::number(entry["max"].toDouble(), 'f', 2));
+            if (entry.contains("allocations"))
+            {
+                item->setText(6, QString::number(entry["allocations"].toDouble(), 'f', 1));
+                item->setText(7, QString::number(entry["allocatedBytes"].toDouble() / 1024.0, 'f', 2));
+            }
+        }
+        window->setExpanded(!collapsed.contains(window->text(0)));
+    }
+
+    QTimer::singleShot(1000, this, SLOT(RefreshFrameTimesPage()));
+}
+
 void TimeProfilerWindow::RefreshOgreSceneComplexityPage()
 {
     if (!visibility_ || ui_.ogreTabWidget->currentIndex() != 1)
@@ -2556,9 +2975,9 @@ void TimeProfilerWindow::RefreshBulletPage()
         return;
 
     PhysicsWorldPtr physics = scene->Subsystem<PhysicsWorld>();
-    const std::set<std::pair<const btCollisionObject*, const btCollisionObject*> > &collisions = physics->PreviousFrameCollisions();
+    const QSet<PhysicsWorld::CollisionPair> &collisions = physics->PreviousFrameCollisions();
 
-    for(std::set<std::pair<const btCollisionObject*, const btCollisionObject*> >::const_iterator iter = collisions.begin(); iter != collisions.end(); ++iter)
+    for(QSet<PhysicsWorld::CollisionPair>::const_iterator iter = collisions.begin(); iter != collisions.end(); ++iter)
     {
         const btCollisionObject* objectA = iter->first;
         const btCollisionObject* objectB = iter->second;
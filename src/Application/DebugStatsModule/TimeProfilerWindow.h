@@ -16,6 +16,7 @@
 class Framework;
 class ProfilerNodeTree;
 class ProfilerNode;
+class RemoteProfiler;
 
 /// Provides various profiling data, performance statistics and tools.
 class TimeProfilerWindow : public QWidget
@@ -53,6 +54,10 @@ private slots:
     void RefreshBulletPage();
     void RefreshScriptsPage();
     void RefreshAssetsPage();
+    void RefreshReplicationPage();
+    void RefreshMemoryPage();
+    void RefreshAssetPipelinePage();
+    void RefreshFrameTimesPage();
 
     // Ogre pages.
     void RefreshOgreOverviewPage();
@@ -106,6 +111,13 @@ private:
     void FillThresholdLogger(QTextStream& out, const ProfilerNodeTree *profilerNode);
     void FillProfileTimingWindow(QTreeWidgetItem *qtNode, const ProfilerNodeTree *profilerNode, int numFrames, float frameTotalTimeSecs);
 
+    /// Returns the remote profiler if it is attached to a server and has a snapshot of its blocks to show, otherwise null.
+    RemoteProfiler *AttachedRemoteProfiler() const;
+
+    /// Returns the root of the blocks to show, those of the server if the remote profiler is attached, otherwise the local ones.
+    /** @param numFrames [out] Number of the frames the timings of the blocks span. */
+    ProfilerNodeTree *TimingRoot(int &numFrames);
+
     void CollectProfilerNodes(ProfilerNodeTree *node, std::vector<const ProfilerNode *> &dst);
     void RefreshProfilingDataTree(float msecsOccurred);
     void RefreshProfilingDataList(float msecsOccurred);
@@ -132,6 +144,18 @@ private:
     // Right click context menu.
     QMenu *contextMenu_;
 
+    // Replication statistics page.
+    QTreeWidget *replicationTree_;
+
+    // Scene memory usage page.
+    QTreeWidget *memoryTree_;
+
+    // Asset transfer timing page.
+    QTreeWidget *assetPipelineTree_;
+
+    // Frame and module update time percentile page.
+    QTreeWidget *frameTimesTree_;
+
     // Main update timer.
     QTimer updateTimer_;
 
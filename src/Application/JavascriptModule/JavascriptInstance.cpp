@@ -12,6 +12,7 @@
 #include "JavascriptModule.h"
 #include "ScriptMetaTypeDefines.h"
 #include "ScriptCoreTypeDefines.h"
+#include "ScriptWorker.h"
 #include "EC_Script.h"
 #include "ScriptAsset.h"
 #include "AssetAPI.h"
@@ -20,8 +21,6 @@
 #include "LoggingFunctions.h"
 #include "Profiler.h"
 
-#include <QDir>
-#include <QFile>
 #include <sstream>
 
 #include <QScriptClass>
@@ -35,6 +34,7 @@ Q_DECLARE_METATYPE(QScriptClass*)
 
 JavascriptInstance::JavascriptInstance(const QString &fileName, JavascriptModule *module) :
     engine_(0),
+    sharedEngine_(false),
     sourceFile(fileName),
     module_(module),
     evaluated(false)
@@ -45,6 +45,7 @@ JavascriptInstance::JavascriptInstance(const QString &fileName, JavascriptModule
 
 JavascriptInstance::JavascriptInstance(ScriptAssetPtr scriptRef, JavascriptModule *module) :
     engine_(0),
+    sharedEngine_(false),
     module_(module),
     evaluated(false)
 {
@@ -58,6 +59,7 @@ JavascriptInstance::JavascriptInstance(ScriptAssetPtr scriptRef, JavascriptModul
 
 JavascriptInstance::JavascriptInstance(const std::vector<ScriptAssetPtr>& scriptRefs, JavascriptModule *module) :
     engine_(0),
+    sharedEngine_(false),
     module_(module),
     evaluated(false)
 {
@@ -92,7 +94,7 @@ QMap<QString, uint> JavascriptInstance::DumpEngineInformation()
     uint qobjCount = 0;
     uint qobjMethodCount = 0;   
 
-    GetObjectInformation(engine_->globalObject(), ids, valueCount, objectCount, nullCount, numberCount, boolCount, stringCount, arrayCount, funcCount, qobjCount, qobjMethodCount);
+    GetObjectInformation(globalObject_, ids, valueCount, objectCount, nullCount, numberCount, boolCount, stringCount, arrayCount, funcCount, qobjCount, qobjMethodCount);
 
     QMap<QString, uint> dump;
     dump["QScriptValues"] = valueCount;
@@ -189,17 +191,22 @@ void JavascriptInstance::Load()
         // the client to load a script into local cache, he could use this code path to automatically load that unsafe script from cache, and make it trusted. -jj.
     }
 
+    // A trusted instance of a pooled engine may have imported the unsafe classes already
+    if (sharedEngine_ && !trusted_)
+        HideUnsafeClasses();
+
     // Check the validity of the syntax in the input.
     for (size_t i = 0; i < numScripts; ++i)
     {
         QString scriptSourceFilename = (useAssetAPI ? scriptRefs_[i]->Name() : sourceFile);
         QString &scriptContent = (useAssetAPI ? scriptRefs_[i]->scriptContent : program_);
 
-        QScriptSyntaxCheckResult syntaxResult = engine_->checkSyntax(scriptContent);
-        if (syntaxResult.state() != QScriptSyntaxCheckResult::Valid)
+        // The program cache checks the syntax once per script content
+        ScriptProgramCache::Program program = module_->ProgramCache().GetProgram(scriptSourceFilename, scriptContent);
+        if (!program.valid)
         {
-            LogError("Syntax error in script " + scriptSourceFilename + "," + QString::number(syntaxResult.errorLineNumber()) +
-                ": " + syntaxResult.errorMessage());
+            LogError("Syntax error in script " + scriptSourceFilename + "," + QString::number(program.errorLineNumber) +
+                ": " + program.errorMessage);
 
             // Delete our loaded script content (if any exists).
             program_ == "";
@@ -224,30 +231,15 @@ QString JavascriptInstance::LoadScript(const QString &fileName)
     /// As you cannot use !rel: ref in startup scripts (loaded without EC_Script) so you cannot use local:// refs either. 
     /// You have to do engine.IncludeFile("lib/class.js") etc. and this below code needs to find the file whatever the working dir is, a plain QFile::open() wont cut it!
 
-    // Otherwise, treat fileName as a local file to load up.
-    // Check install dir and the clean rel path.
-    QString pathToFile = "";
-    QDir jsPluginDir(QDir::fromNativeSeparators(Application::InstallationDirectory()) + "jsmodules");
-    if (jsPluginDir.exists(filename))
-        pathToFile = jsPluginDir.filePath(filename);
-    else if (QFile::exists(filename))
-        pathToFile = filename;
+    // Otherwise, treat fileName as a local file to load up. The program cache remembers where the file was found, and its content until it changes.
+    QString pathToFile;
+    QString result = module_ ? module_->ProgramCache().IncludeFileContent(filename, pathToFile) : QString();
     if (pathToFile.isEmpty())
     {
         LogError("JavascriptInstance::LoadScript: Failed to load script from file " + filename + "!");
         return "";
     }
 
-    QFile scriptFile(pathToFile);
-    if (!scriptFile.open(QIODevice::ReadOnly))
-    {
-        LogError("JavascriptInstance::LoadScript: Failed to load script from file " + filename + "!");
-        return "";
-    }
-
-    QString result = scriptFile.readAll();
-    scriptFile.close();
-
     QString trimmedResult = result.trimmed();
     if (trimmedResult.isEmpty())
     {
@@ -297,6 +289,7 @@ void JavascriptInstance::Run()
     bool useAssets = !scriptRefs_.empty();
     size_t numScripts = useAssets ? scriptRefs_.size() : 1;
     includedFiles.clear();
+    evaluatedContents_.resize(numScripts);
     
     for (size_t i = 0; i < numScripts; ++i)
     {
@@ -304,14 +297,94 @@ void JavascriptInstance::Run()
         QString scriptSourceFilename = (useAssets ? scriptRefs_[i]->Name() : sourceFile);
         QString &scriptContent = (useAssets ? scriptRefs_[i]->scriptContent : program_);
 
-        QScriptValue result = engine_->evaluate(scriptContent, scriptSourceFilename);
+        QScriptValue result = Evaluate(module_->ProgramCache().GetProgram(scriptSourceFilename, scriptContent).program);
         CheckAndPrintException("In run/evaluate: ", result);
+        evaluatedContents_[i] = scriptContent;
     }
     
     evaluated = true;
     emit ScriptEvaluated();
 }
 
+bool JavascriptInstance::HotReload(const std::vector<ScriptAssetPtr> &scriptRefs)
+{
+    PROFILE(JSInstance_HotReload);
+    if (!engine_ || !evaluated || scriptRefs.empty() || scriptRefs.size() != scriptRefs_.size() || evaluatedContents_.size() != scriptRefs.size())
+        return false;
+
+    bool trusted = true;
+    for(size_t i = 0; i < scriptRefs.size(); ++i)
+    {
+        if (scriptRefs[i]->Name() != scriptRefs_[i]->Name())
+            return false;
+        trusted = trusted && scriptRefs[i]->IsTrusted();
+    }
+    // Hiding the unsafe classes cannot be undone, and exposing them needs a new engine for the other instances of a pooled one.
+    if (trusted != trusted_)
+        return false;
+
+    std::vector<size_t> changed;
+    for(size_t i = 0; i < scriptRefs.size(); ++i)
+        if (scriptRefs[i]->scriptContent != evaluatedContents_[i])
+        {
+            ScriptProgramCache::Program program = module_->ProgramCache().GetProgram(scriptRefs[i]->Name(), scriptRefs[i]->scriptContent);
+            if (!program.valid)
+            {
+                LogError("JavascriptInstance::HotReload: Syntax error in script " + scriptRefs[i]->Name() + "," + QString::number(program.errorLineNumber) +
+                    ": " + program.errorMessage + ". Keeping the previous version running.");
+                return true;
+            }
+            changed.push_back(i);
+        }
+    scriptRefs_ = scriptRefs;
+    if (changed.empty())
+        return true;
+
+    emit ScriptUnloading();
+
+    QScriptValue::ResolveFlags resolve = sharedEngine_ ? QScriptValue::ResolveLocal : QScriptValue::ResolvePrototype;
+    QScriptValue handler = globalObject_.property("OnScriptReloading", resolve);
+    if (!handler.isFunction())
+        handler = globalObject_.property("OnScriptDestroyed", resolve);
+    if (handler.isFunction())
+    {
+        QScriptValue result = handler.call(globalObject_);
+        CheckAndPrintException("In script reload handler: ", result);
+    }
+
+    for(size_t i = 0; i < changed.size(); ++i)
+    {
+        const ScriptAssetPtr &script = scriptRefs_[changed[i]];
+        LogInfo("JavascriptInstance::HotReload: Re-evaluating " + script->Name());
+        QScriptValue result = Evaluate(module_->ProgramCache().GetProgram(script->Name(), script->scriptContent).program);
+        CheckAndPrintException("In hot reload: ", result);
+        evaluatedContents_[changed[i]] = script->scriptContent;
+    }
+
+    emit ScriptEvaluated();
+    return true;
+}
+
+QScriptValue JavascriptInstance::PersistentState()
+{
+    if (!persistentState_.isObject() && engine_)
+        persistentState_ = engine_->newObject();
+    return persistentState_;
+}
+
+QScriptValue JavascriptInstance::Evaluate(const QScriptProgram &program)
+{
+    if (!sharedEngine_)
+        return engine_->evaluate(program);
+
+    QScriptContext *context = engine_->pushContext();
+    context->setActivationObject(globalObject_);
+    context->setThisObject(globalObject_);
+    QScriptValue result = engine_->evaluate(program);
+    engine_->popContext();
+    return result;
+}
+
 bool JavascriptInstance::RegisterService(QObject *serviceObject, const QString &name)
 {
     if (!engine_)
@@ -326,7 +399,7 @@ bool JavascriptInstance::RegisterService(QObject *serviceObject, const QString &
     }
 
     QScriptValue scriptValue = engine_->newQObject(serviceObject);
-    engine_->globalObject().setProperty(name, scriptValue);
+    globalObject_.setProperty(name, scriptValue);
     return true;
 }
 
@@ -359,15 +432,15 @@ void JavascriptInstance::IncludeFile(const QString &path)
     context->setActivationObject(context->parentContext()->activationObject());
     context->setThisObject(context->parentContext()->thisObject());
 
-    QScriptSyntaxCheckResult syntaxResult = engine_->checkSyntax(script);
-    if(syntaxResult.state() != QScriptSyntaxCheckResult::Valid)
+    ScriptProgramCache::Program program = module_->ProgramCache().GetProgram(path, script);
+    if (!program.valid)
     {
-        LogError("JavascriptInstance::IncludeFile: Syntax error in " + path + ". " + syntaxResult.errorMessage() +
-            " In line:" + QString::number(syntaxResult.errorLineNumber()));
+        LogError("JavascriptInstance::IncludeFile: Syntax error in " + path + ". " + program.errorMessage +
+            " In line:" + QString::number(program.errorLineNumber));
         return;
     }
 
-    QScriptValue result = engine_->evaluate(script, path);
+    QScriptValue result = engine_->evaluate(program.program);
 
     includedFiles.push_back(path);
     
@@ -375,6 +448,15 @@ void JavascriptInstance::IncludeFile(const QString &path)
         LogError(result.toString());
 }
 
+ScriptWorker *JavascriptInstance::CreateWorker(const QString &file)
+{
+    PROFILE(JSInstance_CreateWorker);
+    QString script = LoadScript(file);
+    if (script.isEmpty())
+        return 0;
+    return new ScriptWorker(file, script, this);
+}
+
 bool JavascriptInstance::ImportExtension(const QString &scriptExtensionName)
 {
     // Currently QtScriptGenerator extensions are not supported on Android. Attempting to import is a fatal error for the script engine,
@@ -392,23 +474,10 @@ bool JavascriptInstance::ImportExtension(const QString &scriptExtensionName)
     }
 
     QStringList qt_extension_whitelist;
-    QStringList qt_class_blacklist;
 
     /// Allowed extension imports
     qt_extension_whitelist << "qt.core" << "qt.gui" << "qt.xml" << "qt.xmlpatterns" << "qt.opengl" << "qt.webkit";
 
-    /// qt.core and qt.gui: Classes that may be harmful to your system from untrusted scripts
-    qt_class_blacklist << "QLibrary" << "QPluginLoader" << "QProcess"               // process and library access
-                       << "QFile" << "QDir" << "QFileSystemModel" << "QDirModel"    // file system access
-                       << "QFileDialog" << "QFileSystemWatcher" << "QFileInfo" 
-                       << "QFileOpenEvent" << "QFileSystemModel"
-                       << "QClipboard" << "QDesktopServices";                       // "system" access
-    
-    /// qt.webkit: Initial blacklist, enabling some of these can be discussed. 
-    /// Availble classes: QWebView, QGraphicsWebView, QWebPage, QWebFrame
-    qt_class_blacklist << "QWebDatabase" << "QWebElement" << "QWebElementCollection" << "QWebHistory" << "QWebHistoryInterface" << "QWebHistoryItem"
-                       << "QWebHitTestResult" << "QWebInspector" << "QWebPluginFactory" << "QWebSecurityOrigin" << "QWebSettings"; 
-
     if (!trusted_ && !qt_extension_whitelist.contains(scriptExtensionName, Qt::CaseInsensitive))
     {
         LogWarning("JavascriptInstance::ImportExtension: refusing to load a QtScript plugin for an untrusted instance: " + scriptExtensionName);
@@ -425,20 +494,43 @@ bool JavascriptInstance::ImportExtension(const QString &scriptExtensionName)
     }
 
     if (!trusted_)
+        HideUnsafeClasses();
+
+    return ret;
+}
+
+void JavascriptInstance::HideUnsafeClasses()
+{
+    QStringList qt_class_blacklist;
+
+    /// qt.core and qt.gui: Classes that may be harmful to your system from untrusted scripts
+    qt_class_blacklist << "QLibrary" << "QPluginLoader" << "QProcess"               // process and library access
+                       << "QFile" << "QDir" << "QFileSystemModel" << "QDirModel"    // file system access
+                       << "QFileDialog" << "QFileSystemWatcher" << "QFileInfo" 
+                       << "QFileOpenEvent" << "QFileSystemModel"
+                       << "QClipboard" << "QDesktopServices";                       // "system" access
+    
+    /// qt.webkit: Initial blacklist, enabling some of these can be discussed. 
+    /// Availble classes: QWebView, QGraphicsWebView, QWebPage, QWebFrame
+    qt_class_blacklist << "QWebDatabase" << "QWebElement" << "QWebElementCollection" << "QWebHistory" << "QWebHistoryInterface" << "QWebHistoryItem"
+                       << "QWebHitTestResult" << "QWebInspector" << "QWebPluginFactory" << "QWebSecurityOrigin" << "QWebSettings"; 
+
+    QScriptValue exposed;
+    foreach (const QString &blacktype, qt_class_blacklist)
     {
-        QScriptValue exposed;
-        foreach (const QString &blacktype, qt_class_blacklist)
+        // The global object of a pooled engine is shared with the trusted instances, so only shadow the types in this instance
+        if (sharedEngine_)
         {
-            exposed = engine_->globalObject().property(blacktype);
-            if (exposed.isValid())
-            {
-                engine_->globalObject().setProperty(blacktype, QScriptValue()); //passing an invalid val removes the property, http://doc.qt.nokia.com/4.6/qscriptvalue.html#setProperty
-                //LogInfo("JavascriptInstance::ImportExtension: removed a type from the untrusted context: " + blacktype);
-            }
+            globalObject_.setProperty(blacktype, engine_->undefinedValue());
+            continue;
+        }
+        exposed = engine_->globalObject().property(blacktype);
+        if (exposed.isValid())
+        {
+            engine_->globalObject().setProperty(blacktype, QScriptValue()); //passing an invalid val removes the property, http://doc.qt.nokia.com/4.6/qscriptvalue.html#setProperty
+            //LogInfo("JavascriptInstance::ImportExtension: removed a type from the untrusted context: " + blacktype);
         }
     }
-
-    return ret;
 }
 
 bool JavascriptInstance::CheckAndPrintException(const QString& message, const QScriptValue& result)
@@ -459,17 +551,33 @@ void JavascriptInstance::CreateEngine()
 {
     if (engine_)
         DeleteEngine();
-    engine_ = new QScriptEngine;
-    connect(engine_, SIGNAL(signalHandlerException(const QScriptValue &)), SLOT(OnSignalHandlerException(const QScriptValue &)));
+
+    sharedEngine_ = module_ && module_->HasSharedEngines();
+    if (sharedEngine_)
+    {
+        // The core types and the framework services are registered to the pooled engine already.
+        // The declarations of the scripts of this instance go to a global object of its own.
+        engine_ = module_->AcquireSharedEngine();
+        globalObject_ = engine_->newObject();
+        globalObject_.setPrototype(engine_->globalObject());
+    }
+    else
+    {
+        engine_ = new QScriptEngine;
+        connect(engine_, SIGNAL(signalHandlerException(const QScriptValue &)), SLOT(OnSignalHandlerException(const QScriptValue &)));
 //#ifndef QT_NO_SCRIPTTOOLS
 //    debugger_ = new QScriptEngineDebugger();
 //    debugger.attachTo(engine_);
 ////  debugger_->action(QScriptEngineDebugger::InterruptAction)->trigger();
 //#endif
 
-    ExposeQtMetaTypes(engine_);
-    ExposeCoreTypes(engine_);
-    ExposeCoreApiMetaTypes(engine_);
+        ExposeQtMetaTypes(engine_);
+        ExposeCoreTypes(engine_);
+        ExposeCoreApiMetaTypes(engine_);
+        globalObject_ = engine_->globalObject();
+        if (module_)
+            module_->Sampler().AddEngine(engine_, scriptRefs_.empty() ? sourceFile : scriptRefs_.front()->Name());
+    }
 
     EC_Script *ec = dynamic_cast<EC_Script *>(owner_.lock().get());
     module_->PrepareScriptInstance(this, ec);
@@ -482,22 +590,41 @@ void JavascriptInstance::DeleteEngine()
         return;
 
     program_ = "";
-    engine_->abortEvaluation();
+    // Aborting would also abort the evaluation of the other instances of a pooled engine
+    if (!sharedEngine_)
+        engine_->abortEvaluation();
 
     // As a convention, we call a function 'OnScriptDestroyed' for each JS script
     // so that they can clean up their data before the script is removed from the object,
     // or when the system is unloading.
     
     emit ScriptUnloading();
+
+    // The workers would outlive the handlers connected to them.
+    qDeleteAll(findChildren<ScriptWorker*>());
     
-    QScriptValue destructor = engine_->globalObject().property("OnScriptDestroyed");
+    // In a pooled engine, do not pick up the destructor of another instance through the prototype
+    QScriptValue destructor = globalObject_.property("OnScriptDestroyed", sharedEngine_ ? QScriptValue::ResolveLocal : QScriptValue::ResolvePrototype);
     if (!destructor.isUndefined())
     {
-        QScriptValue result = destructor.call();
+        QScriptValue result = destructor.call(globalObject_);
         CheckAndPrintException("In script destructor: ", result);
     }
     
-    SAFE_DELETE(engine_);
+    globalObject_ = QScriptValue();
+    persistentState_ = QScriptValue();
+    evaluatedContents_.clear();
+    if (sharedEngine_)
+    {
+        module_->ReleaseSharedEngine(engine_);
+        engine_ = 0;
+    }
+    else
+    {
+        if (module_)
+            module_->Sampler().RemoveEngine(engine_);
+        SAFE_DELETE(engine_);
+    }
     //SAFE_DELETE(debugger_);
 }
 
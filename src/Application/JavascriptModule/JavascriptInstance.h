@@ -12,14 +12,31 @@
 #include "AssetFwd.h"
 #include "JavascriptFwd.h"
 
+#include <QScriptValue>
+#include <QScriptProgram>
+
 //#include <QtScript>
 //#ifndef QT_NO_SCRIPTTOOLS
 //#include <QScriptEngineDebugger>
 //#endif
 
 class JavascriptModule;
+class ScriptWorker;
 
 /// Javascript script instance used wit EC_Script.
+/** With the --sharedScriptEngines command line parameter, the instance runs in a pooled engine of JavascriptModule
+    instead of an engine of its own. The instance then has a global object of its own, which has the global object of
+    the engine as its prototype, and its scripts are evaluated with it as the activation and this object. The declarations
+    of a script thus stay in its instance, but assignments to undeclared variables go to the engine and are seen by the
+    other instances. The signal handlers connected by a script stay connected after the instance is unloaded, so the
+    scripts should disconnect them in OnScriptDestroyed.
+
+    With the --hotReloadScripts command line parameter, a changed script asset of an instance that has been run is
+    re-evaluated in the existing engine with HotReload, instead of the instance being replaced. The included files are
+    not evaluated again, and the other global state of the instance stays as it was. Before re-evaluating, the instance
+    calls the OnScriptReloading function of the scripts, or OnScriptDestroyed if there is none, which should disconnect
+    the signal handlers that the re-evaluated code connects again. State that should survive the reload can be kept in
+    the object returned by engine.PersistentState(). */
 class JavascriptInstance : public IScriptInstance
 {
     Q_OBJECT
@@ -52,6 +69,13 @@ public:
     /// IScriptInstance override.
     void Run();
 
+    /// Re-evaluates the scripts whose content has changed since they were run, in the existing engine.
+    /** A script with a syntax error is not evaluated, and the previous code of the instance keeps running.
+        @param scriptRefs The new script assets, which must have the same names as the current ones.
+        @return False if the instance cannot be hot-reloaded, because it has not been run or the scripts or their trust differ,
+        in which case it should be replaced with a new instance. */
+    bool HotReload(const std::vector<ScriptAssetPtr> &scriptRefs);
+
     /// Register new service to java script engine.
     /** @return Returns if the registration was successful. */
     bool RegisterService(QObject *serviceObject, const QString &name);
@@ -59,6 +83,12 @@ public:
     //void SetPrototype(QScriptable *prototype, );
     QScriptEngine* Engine() const { return engine_; }
 
+    /// Returns the global object of this instance: that of the engine, or the instance's own in a pooled engine.
+    QScriptValue GlobalObject() const { return globalObject_; }
+
+    /// Returns whether this instance runs in a pooled engine shared with other instances.
+    bool HasSharedEngine() const { return sharedEngine_; }
+
     /// Sets owner (EC_Script) component.
     /** @param owner Owner component. */
     void SetOwner(const ComponentPtr &owner) { owner_ = owner; }
@@ -72,12 +102,21 @@ public slots:
         @param path is relative path from bin/ to file. Example jsmodules/apitest/myscript.js */
     void IncludeFile(const QString &file);
 
+    /// Starts a script on a worker thread, for computations that would stall the main thread. See ScriptWorker.
+    /** The worker is deleted when this instance is unloaded.
+        @param file Script asset ref or relative path of the worker script, as with IncludeFile.
+        @return The worker, or null if the script could not be loaded. */
+    ScriptWorker *CreateWorker(const QString &file);
+
     /// Imports the given QtScript extension plugin into the current script instance. Returns true if successful.
     bool ImportExtension(const QString &scriptExtensionName);
 
     /// Return whether has been evaluated
     virtual bool IsEvaluated() const { return evaluated; }
 
+    /// Returns an object of this instance that is kept across hot reloads, for the script state that should survive them.
+    QScriptValue PersistentState();
+
     /// Dumps engine information into a string. Used for debugging/profiling.
     virtual QMap<QString, uint> DumpEngineInformation();
     
@@ -98,12 +137,20 @@ private:
     /// Deletes script context/engine.
     void DeleteEngine();
 
+    /// Evaluates a program with the global object of this instance.
+    QScriptValue Evaluate(const QScriptProgram &program);
+
+    /// Hides the Qt classes that may be harmful to the system from an untrusted instance.
+    void HideUnsafeClasses();
+
     QString LoadScript(const QString &fileName);
     
     void GetObjectInformation(const QScriptValue &object, QSet<qint64> &ids, uint &valueCount, uint &objectCount, uint &nullCount, uint &numberCount, 
         uint &boolCount, uint &stringCount, uint &arrayCount, uint &funcCount, uint &qobjCount, uint &qobjMethodCount);
         
     QScriptEngine *engine_; ///< Qt script engine.
+    QScriptValue globalObject_; ///< Global object of this instance.
+    bool sharedEngine_; ///< Whether engine_ is a pooled engine of the module.
 
     // The script content for a JavascriptInstance is loaded either using the Asset API or 
     // using an absolute path name from the local file system.
@@ -128,6 +175,11 @@ private:
     /// Already included files for preventing multi-inclusion
     std::vector<QString> includedFiles;
 
+    /// The content of each script when it was last evaluated, for HotReload to find the changed scripts.
+    std::vector<QString> evaluatedContents_;
+
+    QScriptValue persistentState_; ///< Returned by PersistentState, created on the first call after the engine.
+
 private slots:
     void OnSignalHandlerException(const QScriptValue& exception);
 };
@@ -11,6 +11,7 @@
 #include "ScriptMetaTypeDefines.h"
 #include "JavascriptInstance.h"
 #include "ScriptCoreTypeDefines.h"
+#include "ScriptSceneQueries.h"
 
 #include "Profiler.h"
 #include "Application.h"
@@ -35,18 +36,30 @@
 #include <QtScript>
 #include <QDomElement>
 
+#include <algorithm>
+
 #include "StaticPluginRegistry.h"
 
 #include "MemoryLeakCheck.h"
 
 JavascriptModule::JavascriptModule() :
     IModule("Javascript"),
-    engine(new QScriptEngine(this))
+    engine(new QScriptEngine(this)),
+    sharedEngines_(false),
+    hotReloadScripts_(false),
+    numFrames_(0),
+    scriptBudget_(5.f)
 {
 }
 
 JavascriptModule::~JavascriptModule()
 {
+    for(size_t i = 0; i < sharedEnginePool_.size(); ++i)
+    {
+        sampler_.RemoveEngine(sharedEnginePool_[i].engine);
+        delete sharedEnginePool_[i].engine;
+    }
+    sampler_.RemoveEngine(engine);
     SAFE_DELETE(engine);
 }
 
@@ -72,6 +85,9 @@ void JavascriptModule::Initialize()
 
     RegisterCoreMetaTypes();
 
+    sharedEngines_ = framework_->HasCommandLineParameter("--sharedScriptEngines");
+    hotReloadScripts_ = framework_->HasCommandLineParameter("--hotReloadScripts");
+
     framework_->Console()->RegisterCommand(
         "jsExec", "Execute given code in the embedded Javascript interpreter. Usage: jsExec(mycodestring)",
         this, SLOT(RunString(const QString &)));
@@ -88,6 +104,37 @@ void JavascriptModule::Initialize()
         "jsDumpInfo", "Dumps all EC_Script information to console",
         this, SLOT(DumpScriptInfo()));
 
+    framework_->Console()->RegisterCommand(
+        "jsSampleStart", "Starts sampling the call stacks of the scripts, optionally every given milliseconds of script execution. Usage: jsSampleStart(intervalMs)",
+        this, SLOT(StartScriptSampling(float)), SLOT(StartScriptSampling()));
+
+    framework_->Console()->RegisterCommand(
+        "jsSampleStop", "Stops sampling the call stacks of the scripts.",
+        this, SLOT(StopScriptSampling()));
+
+    framework_->Console()->RegisterCommand(
+        "jsSampleSave", "Saves the sampled script call stacks, as a Chrome trace if the file name ends with .json, and as collapsed stacks for flame graphs otherwise. Usage: jsSampleSave(fileName)",
+        this, SLOT(SaveScriptSamples(const QString &)));
+
+    framework_->Console()->RegisterCommand(
+        "jsFrameTimes", "Prints the time the scripts have taken per frame since the previous call, the slowest first.",
+        this, SLOT(DumpScriptFrameTimes()));
+
+    const QStringList budgetParam = framework_->CommandLineParameters("--scriptBudget");
+    if (!budgetParam.isEmpty())
+    {
+        bool ok;
+        float budget = budgetParam.first().toFloat(&ok);
+        if (ok && budget >= 0.f)
+            scriptBudget_ = budget;
+        else
+            LogWarning("Erroneous script budget given with --scriptBudget: " + budgetParam.first() + ". Ignoring.");
+    }
+
+    sampler_.AddEngine(engine, "(console)");
+    if (framework_->HasCommandLineParameter("--jsSample"))
+        StartScriptSampling();
+
     // Initialize startup scripts
     LoadStartupScripts();
 
@@ -117,6 +164,90 @@ void JavascriptModule::RunString(const QString &codestr, const QVariantMap &cont
     engine->evaluate(codestr);
 }
 
+void JavascriptModule::Update(f64 /*frametime*/)
+{
+    if (!sampler_.IsAccounting())
+        return;
+
+    PROFILE(JSModule_AccountScriptTimes);
+    std::vector<ScriptSampler::ScriptTime> times;
+    sampler_.EndFrame(times);
+    ++numFrames_;
+    if (times.empty())
+        return;
+
+    const float now = framework_->Frame()->WallClockTime();
+    for(size_t i = 0; i < times.size(); ++i)
+    {
+        const ScriptSampler::ScriptTime &time = times[i];
+#ifdef PROFILING
+        framework_->GetProfiler()->AddTiming("Scripts", time.name.toStdString(), time.msecs / 1000.0);
+#endif
+        ScriptFrameStats &stats = scriptFrameStats_[time.name];
+        stats.totalMsecs += time.msecs;
+        stats.maxMsecs = std::max(stats.maxMsecs, time.msecs);
+        ++stats.frames;
+        if (scriptBudget_ > 0.f && time.msecs > scriptBudget_)
+        {
+            ++stats.framesOverBudget;
+            // Warn at most every five seconds per script, so that a slow script does not flood the log.
+            if (now - stats.lastWarningTime >= 5.f)
+            {
+                LogWarning("Script " + time.name + " took " + QString::number(time.msecs, 'f', 2) + " ms in " + QString::number(time.calls) +
+                    " calls this frame, over the script budget of " + QString::number(scriptBudget_) + " ms. Consider frame.ScheduleLowPriorityUpdate for work that can be spread across frames.");
+                stats.lastWarningTime = now;
+            }
+        }
+    }
+}
+
+void JavascriptModule::DumpScriptFrameTimes()
+{
+    if (!sampler_.IsAccounting())
+    {
+        LogInfo("Script time accounting is disabled.");
+        return;
+    }
+    if (scriptFrameStats_.isEmpty() || numFrames_ == 0)
+    {
+        LogInfo("No script time accounted.");
+        return;
+    }
+
+    std::vector<std::pair<float, QString> > order;
+    for(QHash<QString, ScriptFrameStats>::const_iterator iter = scriptFrameStats_.begin(); iter != scriptFrameStats_.end(); ++iter)
+        order.push_back(std::make_pair(-iter.value().totalMsecs, iter.key()));
+    std::sort(order.begin(), order.end());
+
+    LogInfo("Script times per frame over " + QString::number(numFrames_) + " frames (average ms, max ms, frames over budget):");
+    for(size_t i = 0; i < order.size(); ++i)
+    {
+        const ScriptFrameStats &stats = scriptFrameStats_[order[i].second];
+        LogInfo(QString("  %1 %2 %3 %4").arg(stats.totalMsecs / numFrames_, 8, 'f', 3).arg(stats.maxMsecs, 8, 'f', 3)
+            .arg(stats.framesOverBudget, 6).arg(order[i].second));
+    }
+    scriptFrameStats_.clear();
+    numFrames_ = 0;
+}
+
+void JavascriptModule::StartScriptSampling(float intervalMs)
+{
+    sampler_.Start(intervalMs);
+    LogInfo("Sampling the script call stacks every " + QString::number(intervalMs) + " ms of script execution.");
+}
+
+void JavascriptModule::StopScriptSampling()
+{
+    sampler_.Stop();
+    LogInfo("Stopped sampling the script call stacks, " + QString::number(sampler_.NumSamples()) + " samples.");
+}
+
+void JavascriptModule::SaveScriptSamples(const QString &fileName)
+{
+    if (sampler_.Save(fileName.trimmed()))
+        LogInfo("Saved " + QString::number(sampler_.NumSamples()) + " script call stack samples to " + fileName.trimmed() + ".");
+}
+
 void JavascriptModule::DumpScriptInfo()
 {
     Scene *scene = framework_->Scene()->MainCameraScene();
@@ -187,9 +318,14 @@ void JavascriptModule::ScriptAssetsChanged(const std::vector<ScriptAssetPtr>& ne
         return;
     }
 
+    // With hot reloading, a changed script asset is re-evaluated in the running instance when possible.
+    JavascriptInstance *current = dynamic_cast<JavascriptInstance*>(sender->ScriptInstance());
+    if (current && hotReloadScripts_ && current->HotReload(newScripts))
+        return;
+
     // First clean up any previous running script from EC_Script, if any exists.
 
-    if (dynamic_cast<JavascriptInstance*>(sender->ScriptInstance()))
+    if (current)
         sender->SetScriptInstance(0);
 
     if (newScripts[0]->Name().endsWith(".js")) // We're positively using QtScript.
@@ -370,7 +506,7 @@ void JavascriptModule::CreateScriptObject(EC_Script* app, EC_Script* instance, c
         return;
     
     QScriptEngine* appEngine = jsInstance->Engine();
-    QScriptValue globalObject = appEngine->globalObject();
+    QScriptValue globalObject = jsInstance->GlobalObject();
    
     // Get the object container that holds the created script class instances from this application
     QScriptValue objectContainer = globalObject.property("scriptObjects");
@@ -384,7 +520,7 @@ void JavascriptModule::CreateScriptObject(EC_Script* app, EC_Script* instance, c
         return;
     
     const QString& appAndClassName = instance->className.Get();
-    QScriptValue constructor = appEngine->globalObject().property(className);
+    QScriptValue constructor = globalObject.property(className);
     QScriptValue object;
     if (constructor.isFunction())
     {
@@ -425,7 +561,7 @@ void JavascriptModule::RemoveScriptObject(EC_Script* instance)
         return;
     
     QScriptEngine* appEngine = jsInstance->Engine();
-    QScriptValue globalObject = appEngine->globalObject();
+    QScriptValue globalObject = jsInstance->GlobalObject();
    
     // Get the object container that holds the created script class instances from this application
     QScriptValue objectContainer = globalObject.property("scriptObjects");
@@ -493,7 +629,7 @@ void JavascriptModule::RemoveScriptObjects(JavascriptInstance* jsInstance)
     if (!appEngine)
         return;
     
-    QScriptValue globalObject = appEngine->globalObject();
+    QScriptValue globalObject = jsInstance->GlobalObject();
     
     // Get the object container that holds the created script class instances from this application
     QScriptValue objectContainer = globalObject.property("scriptObjects");
@@ -683,6 +819,26 @@ void JavascriptModule::UnloadStartupScripts()
 void JavascriptModule::PrepareScriptInstance(JavascriptInstance* instance, EC_Script *comp)
 {
     PROFILE(JSModule_PrepareScriptInstance);
+
+    // A pooled engine has the framework services registered already
+    if (!instance->HasSharedEngine())
+        RegisterFrameworkServices(instance->Engine(), instance->GlobalObject());
+
+    instance->RegisterService(instance, "engine");
+
+    if (comp)
+    {
+        // Set entity and scene that own the EC_Script component.
+        instance->RegisterService(comp->ParentEntity(), "me");
+        instance->RegisterService(comp->ParentScene(), "scene");
+    }
+
+    if (!instance->HasSharedEngine())
+        emit ScriptEngineCreated(instance->Engine());
+}
+
+void JavascriptModule::RegisterFrameworkServices(QScriptEngine *engine, QScriptValue object)
+{
     static std::set<QObject*> checked;
     
     // Register framework's dynamic properties (service objects) and the framework itself to the script engine
@@ -691,34 +847,74 @@ void JavascriptModule::PrepareScriptInstance(JavascriptInstance* instance, EC_Sc
     {
         QString name = properties[i];
         QObject* serviceobject = framework_->property(name.toStdString().c_str()).value<QObject*>();
-        if (instance->RegisterService(serviceobject, name))
+        if (!serviceobject)
+            continue;
+        object.setProperty(name, engine->newQObject(serviceobject));
+        if (checked.find(serviceobject) == checked.end())
         {
-            if (checked.find(serviceobject) == checked.end())
-            {
-                // Check if the service object has an OnScriptEngineCreated() slot, and give it a chance to perform further actions
-                const QMetaObject* meta = serviceobject->metaObject();
-                if (meta->indexOfSlot("OnScriptEngineCreated(QScriptEngine*)") != -1)
-                    QObject::connect(this, SIGNAL(ScriptEngineCreated(QScriptEngine*)), serviceobject, SLOT(OnScriptEngineCreated(QScriptEngine*)));
-                
-                checked.insert(serviceobject);
-            }
+            // Check if the service object has an OnScriptEngineCreated() slot, and give it a chance to perform further actions
+            const QMetaObject* meta = serviceobject->metaObject();
+            if (meta->indexOfSlot("OnScriptEngineCreated(QScriptEngine*)") != -1)
+                QObject::connect(this, SIGNAL(ScriptEngineCreated(QScriptEngine*)), serviceobject, SLOT(OnScriptEngineCreated(QScriptEngine*)));
+            
+            checked.insert(serviceobject);
         }
     }
 
-    instance->RegisterService(framework_, "framework");
-    instance->RegisterService(instance, "engine");
-    
-    for(uint i = 0; i < (uint)properties.size(); ++i)
-        instance->RegisterService(framework_->property(properties[i]).value<QObject*>(), properties[i]);
+    object.setProperty("framework", engine->newQObject(framework_));
+    ExposeSceneQueries(engine, object, framework_);
+}
 
-    if (comp)
-    {
-        // Set entity and scene that own the EC_Script component.
-        instance->RegisterService(comp->ParentEntity(), "me");
-        instance->RegisterService(comp->ParentScene(), "scene");
-    }
+QScriptEngine *JavascriptModule::AcquireSharedEngine()
+{
+    for(size_t i = 0; i < sharedEnginePool_.size(); ++i)
+        if (sharedEnginePool_[i].numInstances < cMaxInstancesPerSharedEngine)
+        {
+            ++sharedEnginePool_[i].numInstances;
+            return sharedEnginePool_[i].engine;
+        }
 
-    emit ScriptEngineCreated(instance->Engine());
+    PROFILE(JSModule_CreateSharedEngine);
+    SharedEngine shared;
+    shared.engine = new QScriptEngine;
+    shared.numInstances = 1;
+    connect(shared.engine, SIGNAL(signalHandlerException(const QScriptValue &)), SLOT(OnSharedEngineException(const QScriptValue &)));
+
+    ExposeQtMetaTypes(shared.engine);
+    ExposeCoreTypes(shared.engine);
+    ExposeCoreApiMetaTypes(shared.engine);
+    RegisterFrameworkServices(shared.engine, shared.engine->globalObject());
+    emit ScriptEngineCreated(shared.engine);
+
+    sharedEnginePool_.push_back(shared);
+    sampler_.AddEngine(shared.engine);
+    return shared.engine;
+}
+
+void JavascriptModule::ReleaseSharedEngine(QScriptEngine *engine)
+{
+    for(size_t i = 0; i < sharedEnginePool_.size(); ++i)
+        if (sharedEnginePool_[i].engine == engine)
+        {
+            if (--sharedEnginePool_[i].numInstances <= 0)
+            {
+                sampler_.RemoveEngine(engine);
+                delete engine;
+                sharedEnginePool_.erase(sharedEnginePool_.begin() + i);
+            }
+            return;
+        }
+}
+
+void JavascriptModule::OnSharedEngineException(const QScriptValue &exception)
+{
+    QScriptEngine *sharedEngine = qobject_cast<QScriptEngine*>(sender());
+    LogError(exception.toString());
+    if (!sharedEngine)
+        return;
+    foreach(const QString &error, sharedEngine->uncaughtExceptionBacktrace())
+        LogError(error);
+    LogError("Line " + QString::number(sharedEngine->uncaughtExceptionLineNumber()) + ".");
 }
 
 extern "C"
@@ -12,8 +12,13 @@
 #include "AssetFwd.h"
 #include "SceneFwd.h"
 #include "JavascriptFwd.h"
+#include "ScriptProgramCache.h"
+#include "ScriptSampler.h"
 
 #include <QVariant>
+#include <QHash>
+
+#include <vector>
 
 class JavascriptInstance;
 
@@ -30,12 +35,35 @@ public:
     void Initialize();
     void Uninitialize();
 
+    /// Collects the script execution times of the frame, and reports the scripts over the script budget.
+    void Update(f64 frametime);
+
     /// Prepares script instance by registering all needed services to it.
     /** If script is part of the scene, i.e. EC_Script component is present, we add some special services.
         @param instance Script istance.
         @param comp Script component, null by default. */
     void PrepareScriptInstance(JavascriptInstance* instance, EC_Script *comp = 0);
 
+    /// Returns whether the script instances share pooled engines, enabled with the --sharedScriptEngines command line parameter.
+    bool HasSharedEngines() const { return sharedEngines_; }
+
+    /// Returns a pooled script engine for a script instance, creating one if all are full.
+    /** The core types and the framework services are registered to a pooled engine once, when it is created.
+        Release the engine with ReleaseSharedEngine when the instance is done with it. */
+    QScriptEngine *AcquireSharedEngine();
+
+    /// Releases a pooled script engine acquired with AcquireSharedEngine. The engine is deleted when its last instance releases it.
+    void ReleaseSharedEngine(QScriptEngine *engine);
+
+    /// Returns the cache of the compiled script programs, shared by the script instances.
+    ScriptProgramCache &ProgramCache() { return programCache_; }
+
+    /// Returns the sampling profiler of the script engines.
+    ScriptSampler &Sampler() { return sampler_; }
+
+    /// Maximum number of script instances in one pooled engine.
+    static const int cMaxInstancesPerSharedEngine = 256;
+
 public slots:
     void DumpScriptInfo();
     
@@ -45,6 +73,18 @@ public slots:
     /// Executes and arbitrary js code string.
     void RunString(const QString &codeString, const QVariantMap &context = QVariantMap());
 
+    /// Starts sampling the script call stacks every intervalMs of script execution time, discarding the previous samples.
+    void StartScriptSampling(float intervalMs = ScriptSampler::cDefaultIntervalMs);
+
+    /// Stops sampling the script call stacks.
+    void StopScriptSampling();
+
+    /// Saves the script call stack samples, as a Chrome trace if the file name ends with .json, and as collapsed stacks otherwise.
+    void SaveScriptSamples(const QString &fileName);
+
+    /// Prints the script execution time of the scripts per frame since the previous call, the slowest first.
+    void DumpScriptFrameTimes();
+
 signals:
     /// A script engine has been created
     /** The purpose of this is to allow dynamic service objects (registered with Framework::RegisterDynamicObject)
@@ -82,9 +122,50 @@ private:
     /// Remove script class instances for all EC_Scripts depending on this script application
     void RemoveScriptObjects(JavascriptInstance* jsInstance);
 
+    /// Registers the framework and its service objects to a script object of the engine.
+    void RegisterFrameworkServices(QScriptEngine *engine, QScriptValue object);
+
     /// Default engine for console & commandline script execution
     QScriptEngine *engine;
 
+    /// Pooled script engine and the number of script instances using it.
+    struct SharedEngine
+    {
+        QScriptEngine *engine;
+        int numInstances;
+    };
+    /// Pooled script engines, used with --sharedScriptEngines.
+    std::vector<SharedEngine> sharedEnginePool_;
+
+    /// Whether the script instances use pooled engines.
+    bool sharedEngines_;
+
+    /// Whether a changed script asset is re-evaluated in the engine of its instance, set with --hotReloadScripts.
+    bool hotReloadScripts_;
+
+    /// Compiled script programs and resolved include files.
+    ScriptProgramCache programCache_;
+
+    /// Sampling profiler of the script engines.
+    ScriptSampler sampler_;
+
+    /// Script execution time of a script over the frames since the last DumpScriptFrameTimes.
+    struct ScriptFrameStats
+    {
+        ScriptFrameStats() : totalMsecs(0.f), maxMsecs(0.f), frames(0), framesOverBudget(0), lastWarningTime(-1e9f) {}
+
+        float totalMsecs;
+        float maxMsecs;
+        int frames; ///< Number of frames the script was run in.
+        int framesOverBudget;
+        float lastWarningTime; ///< Wall clock time of the last warning of going over the budget.
+    };
+    QHash<QString, ScriptFrameStats> scriptFrameStats_;
+    int numFrames_; ///< Number of frames since the last DumpScriptFrameTimes.
+
+    /// Time a script may take each frame before it is reported, in milliseconds. Set with --scriptBudget; 0 disables the reporting.
+    float scriptBudget_;
+
     /// Engines for executing startup (possibly persistent) scripts
     std::vector<JavascriptInstance *> startupScripts_;
 
@@ -100,4 +181,6 @@ private slots:
     void ScriptAssetsChanged(const std::vector<ScriptAssetPtr>& newScripts);
     void ScriptAppNameChanged(const QString& newAppName);
     void ScriptClassNameChanged(const QString& newClassName);
+    /// Prints an exception thrown from a signal handler of a pooled engine.
+    void OnSharedEngineException(const QScriptValue &exception);
 };
@@ -0,0 +1,325 @@
+/**
+    For conditions of distribution and use, see copyright notice in LICENSE
+
+    @file   ScriptMathFastPaths.cpp
+    @brief  Allocation-free and bulk functions for the math classes exposed to QtScript. */
+
+#include "StableHeaders.h"
+#include "DebugOperatorNew.h"
+
+#include "ScriptMathFastPaths.h"
+#include "QtScriptBindingsHelpers.h"
+
+#include <QScriptEngine>
+
+#include <vector>
+
+#include "MemoryLeakCheck.h"
+
+// Defined in the generated bindings.
+void ToExistingScriptValue_float3(QScriptEngine *engine, const float3 &value, QScriptValue obj);
+void ToExistingScriptValue_Quat(QScriptEngine *engine, const Quat &value, QScriptValue obj);
+
+namespace
+{
+
+const QScriptValue::PropertyFlags cFunctionFlags = QScriptValue::Undeletable | QScriptValue::ReadOnly;
+
+/// Reads the float3 argument, or the number argument as a vector with all elements set to it.
+float3 VectorOrScalar(const QScriptValue &value)
+{
+    if (value.isNumber())
+        return float3::FromScalar((float)value.toNumber());
+    return qscriptvalue_cast<float3>(value);
+}
+
+/// Writes the vector to this object of the call and returns it, for chaining the in-place functions.
+QScriptValue ReturnThis(QScriptContext *context, QScriptEngine *engine, const float3 &value)
+{
+    QScriptValue This = context->thisObject();
+    ToExistingScriptValue_float3(engine, value, This);
+    return This;
+}
+
+QScriptValue float3_AddInPlace(QScriptContext *context, QScriptEngine *engine)
+{
+    if (context->argumentCount() != 1)
+        return context->throwError(QScriptContext::TypeError, "float3.AddInPlace(): expected a float3 or a number.");
+    return ReturnThis(context, engine, qscriptvalue_cast<float3>(context->thisObject()) + VectorOrScalar(context->argument(0)));
+}
+
+QScriptValue float3_SubInPlace(QScriptContext *context, QScriptEngine *engine)
+{
+    if (context->argumentCount() != 1)
+        return context->throwError(QScriptContext::TypeError, "float3.SubInPlace(): expected a float3 or a number.");
+    return ReturnThis(context, engine, qscriptvalue_cast<float3>(context->thisObject()) - VectorOrScalar(context->argument(0)));
+}
+
+QScriptValue float3_MulInPlace(QScriptContext *context, QScriptEngine *engine)
+{
+    if (context->argumentCount() != 1)
+        return context->throwError(QScriptContext::TypeError, "float3.MulInPlace(): expected a float3 or a number.");
+    return ReturnThis(context, engine, qscriptvalue_cast<float3>(context->thisObject()).Mul(VectorOrScalar(context->argument(0))));
+}
+
+QScriptValue float3_DivInPlace(QScriptContext *context, QScriptEngine *engine)
+{
+    if (context->argumentCount() != 1)
+        return context->throwError(QScriptContext::TypeError, "float3.DivInPlace(): expected a float3 or a number.");
+    return ReturnThis(context, engine, qscriptvalue_cast<float3>(context->thisObject()).Div(VectorOrScalar(context->argument(0))));
+}
+
+QScriptValue float3_NegateInPlace(QScriptContext *context, QScriptEngine *engine)
+{
+    return ReturnThis(context, engine, -qscriptvalue_cast<float3>(context->thisObject()));
+}
+
+QScriptValue float3_CrossInPlace(QScriptContext *context, QScriptEngine *engine)
+{
+    if (context->argumentCount() != 1 || !QSVIsOfType<float3>(context->argument(0)))
+        return context->throwError(QScriptContext::TypeError, "float3.CrossInPlace(): expected a float3.");
+    return ReturnThis(context, engine, qscriptvalue_cast<float3>(context->thisObject()).Cross(qscriptvalue_cast<float3>(context->argument(0))));
+}
+
+QScriptValue float3_LerpInPlace(QScriptContext *context, QScriptEngine *engine)
+{
+    if (context->argumentCount() != 2 || !QSVIsOfType<float3>(context->argument(0)) || !context->argument(1).isNumber())
+        return context->throwError(QScriptContext::TypeError, "float3.LerpInPlace(): expected a float3 and a number.");
+    float3 This = qscriptvalue_cast<float3>(context->thisObject());
+    return ReturnThis(context, engine, This.Lerp(qscriptvalue_cast<float3>(context->argument(0)), (float)context->argument(1).toNumber()));
+}
+
+QScriptValue float3_Assign(QScriptContext *context, QScriptEngine *engine)
+{
+    if (context->argumentCount() != 1)
+        return context->throwError(QScriptContext::TypeError, "float3.Assign(): expected a float3 or a number.");
+    return ReturnThis(context, engine, VectorOrScalar(context->argument(0)));
+}
+
+QScriptValue Quat_MulInPlace(QScriptContext *context, QScriptEngine *engine)
+{
+    if (context->argumentCount() != 1 || !QSVIsOfType<Quat>(context->argument(0)))
+        return context->throwError(QScriptContext::TypeError, "Quat.MulInPlace(): expected a Quat.");
+    QScriptValue This = context->thisObject();
+    ToExistingScriptValue_Quat(engine, qscriptvalue_cast<Quat>(This) * qscriptvalue_cast<Quat>(context->argument(0)), This);
+    return This;
+}
+
+/// Checks the arguments (float3 v, out) of the TransformTo functions.
+bool IsTransformToCall(QScriptContext *context)
+{
+    return context->argumentCount() == 2 && QSVIsOfType<float3>(context->argument(0)) && context->argument(1).isObject();
+}
+
+QScriptValue Quat_TransformTo(QScriptContext *context, QScriptEngine *engine)
+{
+    if (!IsTransformToCall(context))
+        return context->throwError(QScriptContext::TypeError, "Quat.TransformTo(): expected a float3 and the float3 to write the result to.");
+    QScriptValue out = context->argument(1);
+    ToExistingScriptValue_float3(engine, qscriptvalue_cast<Quat>(context->thisObject()).Transform(qscriptvalue_cast<float3>(context->argument(0))), out);
+    return out;
+}
+
+QScriptValue float3x4_TransformPosTo(QScriptContext *context, QScriptEngine *engine)
+{
+    if (!IsTransformToCall(context))
+        return context->throwError(QScriptContext::TypeError, "float3x4.TransformPosTo(): expected a float3 and the float3 to write the result to.");
+    QScriptValue out = context->argument(1);
+    ToExistingScriptValue_float3(engine, qscriptvalue_cast<float3x4>(context->thisObject()).TransformPos(qscriptvalue_cast<float3>(context->argument(0))), out);
+    return out;
+}
+
+QScriptValue float3x4_TransformDirTo(QScriptContext *context, QScriptEngine *engine)
+{
+    if (!IsTransformToCall(context))
+        return context->throwError(QScriptContext::TypeError, "float3x4.TransformDirTo(): expected a float3 and the float3 to write the result to.");
+    QScriptValue out = context->argument(1);
+    ToExistingScriptValue_float3(engine, qscriptvalue_cast<float3x4>(context->thisObject()).TransformDir(qscriptvalue_cast<float3>(context->argument(0))), out);
+    return out;
+}
+
+/// Returns the next object of the ring of scratch objects in the data of the called function.
+QScriptValue math_Scratch(QScriptContext *context, QScriptEngine * /*engine*/)
+{
+    QScriptValue pool = context->callee().data();
+    quint32 next = pool.property("next").toUInt32();
+    pool.setProperty("next", QScriptValue((next + 1) % cNumScratchObjects));
+    return pool.property(next);
+}
+
+template<typename T>
+QScriptValue NewScratchFunction(QScriptEngine *engine, const T &initialValue)
+{
+    QScriptValue pool = engine->newArray(cNumScratchObjects);
+    for(int i = 0; i < cNumScratchObjects; ++i)
+        pool.setProperty((quint32)i, qScriptValueFromValue(engine, initialValue));
+    pool.setProperty("next", QScriptValue(0));
+
+    QScriptValue function = engine->newFunction(math_Scratch, 0);
+    function.setData(pool);
+    return function;
+}
+
+/// Reads the packed source array of a bulk function from argument 1, and takes the destination array from argument 2,
+/// or creates it. The destination array is resized to hold outputsPerPoint numbers per point. Returns an error message on failure.
+QString PackedArrays(QScriptContext *context, QScriptEngine *engine, const char *name, quint32 outputsPerPoint, std::vector<float3> &points, QScriptValue &dst)
+{
+    QScriptValue src = context->argument(1);
+    if (!src.isArray())
+        return QString("%1(): argument 1 is not an array of numbers.").arg(name);
+    const quint32 length = src.property("length").toUInt32();
+    if (length % 3 != 0)
+        return QString("%1(): the length of the array is %2, which is not a multiple of 3.").arg(name).arg(length);
+
+    points.resize(length / 3);
+    for(quint32 i = 0; i < points.size(); ++i)
+        points[i] = float3((float)src.property(3 * i).toNumber(), (float)src.property(3 * i + 1).toNumber(), (float)src.property(3 * i + 2).toNumber());
+
+    const quint32 dstLength = (quint32)points.size() * outputsPerPoint;
+    if (context->argumentCount() > 2 && !context->argument(2).isUndefined() && !context->argument(2).isNull())
+    {
+        dst = context->argument(2);
+        if (!dst.isArray())
+            return QString("%1(): argument 2 is not an array.").arg(name);
+        if (dst.property("length").toUInt32() != dstLength)
+            dst.setProperty("length", QScriptValue(dstLength));
+    }
+    else
+        dst = engine->newArray(dstLength);
+    return QString();
+}
+
+void WritePoints(QScriptValue &dst, const std::vector<float3> &points)
+{
+    for(quint32 i = 0; i < points.size(); ++i)
+    {
+        dst.setProperty(3 * i, QScriptValue((qsreal)points[i].x));
+        dst.setProperty(3 * i + 1, QScriptValue((qsreal)points[i].y));
+        dst.setProperty(3 * i + 2, QScriptValue((qsreal)points[i].z));
+    }
+}
+
+QScriptValue BulkTransform(QScriptContext *context, QScriptEngine *engine, const char *name, bool positions)
+{
+    if (context->argumentCount() < 2 || !QSVIsOfType<float3x4>(context->argument(0)))
+        return context->throwError(QScriptContext::TypeError, QString("%1(): expected a float3x4 and an array of numbers.").arg(name));
+    std::vector<float3> points;
+    QScriptValue dst;
+    QString error = PackedArrays(context, engine, name, 3, points, dst);
+    if (!error.isEmpty())
+        return context->throwError(QScriptContext::TypeError, error);
+
+    if (!points.empty())
+    {
+        float3x4 m = qscriptvalue_cast<float3x4>(context->argument(0));
+        if (positions)
+            m.BatchTransformPos(&points[0], (int)points.size());
+        else
+            m.BatchTransformDir(&points[0], (int)points.size());
+    }
+    WritePoints(dst, points);
+    return dst;
+}
+
+QScriptValue math_TransformPositions(QScriptContext *context, QScriptEngine *engine)
+{
+    return BulkTransform(context, engine, "math.TransformPositions", true);
+}
+
+QScriptValue math_TransformDirections(QScriptContext *context, QScriptEngine *engine)
+{
+    return BulkTransform(context, engine, "math.TransformDirections", false);
+}
+
+QScriptValue math_RotateVectors(QScriptContext *context, QScriptEngine *engine)
+{
+    if (context->argumentCount() < 2 || !QSVIsOfType<Quat>(context->argument(0)))
+        return context->throwError(QScriptContext::TypeError, "math.RotateVectors(): expected a Quat and an array of numbers.");
+    std::vector<float3> points;
+    QScriptValue dst;
+    QString error = PackedArrays(context, engine, "math.RotateVectors", 3, points, dst);
+    if (!error.isEmpty())
+        return context->throwError(QScriptContext::TypeError, error);
+
+    const Quat q = qscriptvalue_cast<Quat>(context->argument(0));
+    for(size_t i = 0; i < points.size(); ++i)
+        points[i] = q.Transform(points[i]);
+    WritePoints(dst, points);
+    return dst;
+}
+
+QScriptValue math_Translate(QScriptContext *context, QScriptEngine *engine)
+{
+    if (context->argumentCount() < 2 || !QSVIsOfType<float3>(context->argument(0)))
+        return context->throwError(QScriptContext::TypeError, "math.Translate(): expected a float3 and an array of numbers.");
+    std::vector<float3> points;
+    QScriptValue dst;
+    QString error = PackedArrays(context, engine, "math.Translate", 3, points, dst);
+    if (!error.isEmpty())
+        return context->throwError(QScriptContext::TypeError, error);
+
+    const float3 offset = qscriptvalue_cast<float3>(context->argument(0));
+    for(size_t i = 0; i < points.size(); ++i)
+        points[i] += offset;
+    WritePoints(dst, points);
+    return dst;
+}
+
+QScriptValue BulkDistances(QScriptContext *context, QScriptEngine *engine, const char *name, bool squared)
+{
+    if (context->argumentCount() < 2 || !QSVIsOfType<float3>(context->argument(0)))
+        return context->throwError(QScriptContext::TypeError, QString("%1(): expected a float3 and an array of numbers.").arg(name));
+    std::vector<float3> points;
+    QScriptValue dst;
+    QString error = PackedArrays(context, engine, name, 1, points, dst);
+    if (!error.isEmpty())
+        return context->throwError(QScriptContext::TypeError, error);
+
+    const float3 point = qscriptvalue_cast<float3>(context->argument(0));
+    for(quint32 i = 0; i < points.size(); ++i)
+        dst.setProperty(i, QScriptValue((qsreal)(squared ? point.DistanceSq(points[i]) : point.Distance(points[i]))));
+    return dst;
+}
+
+QScriptValue math_Distances(QScriptContext *context, QScriptEngine *engine)
+{
+    return BulkDistances(context, engine, "math.Distances", false);
+}
+
+QScriptValue math_DistancesSq(QScriptContext *context, QScriptEngine *engine)
+{
+    return BulkDistances(context, engine, "math.DistancesSq", true);
+}
+
+} // ~unnamed namespace
+
+void ExposeMathFastPaths(QScriptEngine *engine)
+{
+    QScriptValue float3Proto = engine->defaultPrototype(qMetaTypeId<float3>());
+    float3Proto.setProperty("AddInPlace", engine->newFunction(float3_AddInPlace, 1), cFunctionFlags);
+    float3Proto.setProperty("SubInPlace", engine->newFunction(float3_SubInPlace, 1), cFunctionFlags);
+    float3Proto.setProperty("MulInPlace", engine->newFunction(float3_MulInPlace, 1), cFunctionFlags);
+    float3Proto.setProperty("DivInPlace", engine->newFunction(float3_DivInPlace, 1), cFunctionFlags);
+    float3Proto.setProperty("NegateInPlace", engine->newFunction(float3_NegateInPlace, 0), cFunctionFlags);
+    float3Proto.setProperty("CrossInPlace", engine->newFunction(float3_CrossInPlace, 1), cFunctionFlags);
+    float3Proto.setProperty("LerpInPlace", engine->newFunction(float3_LerpInPlace, 2), cFunctionFlags);
+    float3Proto.setProperty("Assign", engine->newFunction(float3_Assign, 1), cFunctionFlags);
+
+    QScriptValue quatProto = engine->defaultPrototype(qMetaTypeId<Quat>());
+    quatProto.setProperty("MulInPlace", engine->newFunction(Quat_MulInPlace, 1), cFunctionFlags);
+    quatProto.setProperty("TransformTo", engine->newFunction(Quat_TransformTo, 2), cFunctionFlags);
+
+    QScriptValue float3x4Proto = engine->defaultPrototype(qMetaTypeId<float3x4>());
+    float3x4Proto.setProperty("TransformPosTo", engine->newFunction(float3x4_TransformPosTo, 2), cFunctionFlags);
+    float3x4Proto.setProperty("TransformDirTo", engine->newFunction(float3x4_TransformDirTo, 2), cFunctionFlags);
+
+    QScriptValue mathNamespace = engine->globalObject().property("math");
+    mathNamespace.setProperty("ScratchFloat3", NewScratchFunction(engine, float3::zero), cFunctionFlags);
+    mathNamespace.setProperty("ScratchQuat", NewScratchFunction(engine, Quat::identity), cFunctionFlags);
+    mathNamespace.setProperty("TransformPositions", engine->newFunction(math_TransformPositions, 3), cFunctionFlags);
+    mathNamespace.setProperty("TransformDirections", engine->newFunction(math_TransformDirections, 3), cFunctionFlags);
+    mathNamespace.setProperty("RotateVectors", engine->newFunction(math_RotateVectors, 3), cFunctionFlags);
+    mathNamespace.setProperty("Translate", engine->newFunction(math_Translate, 3), cFunctionFlags);
+    mathNamespace.setProperty("Distances", engine->newFunction(math_Distances, 3), cFunctionFlags);
+    mathNamespace.setProperty("DistancesSq", engine->newFunction(math_DistancesSq, 3), cFunctionFlags);
+}
@@ -0,0 +1,33 @@
+/**
+    For conditions of distribution and use, see copyright notice in LICENSE
+
+    @file   ScriptMathFastPaths.h
+    @brief  Allocation-free and bulk functions for the math classes exposed to QtScript. */
+
+#pragma once
+
+class QScriptEngine;
+
+/// Adds the in-place and out-parameter functions to the prototypes of float3, Quat and float3x4, and the scratch pools
+/// and bulk functions to the math namespace.
+/** The generated bindings return a new script object from each call, which the script engine has to allocate and later
+    collect. These functions write the result to an object the script already has instead:
+    - float3: AddInPlace, SubInPlace, MulInPlace, DivInPlace, NegateInPlace, CrossInPlace, LerpInPlace and Assign,
+      which modify the vector itself and return it.
+    - Quat: MulInPlace, and TransformTo(v, out), which writes the rotated vector to out (which can be v).
+    - float3x4: TransformPosTo(v, out) and TransformDirTo(v, out).
+    - math.ScratchFloat3() and math.ScratchQuat() return the next object of a ring of cNumScratchObjects preallocated
+      objects, for temporaries which are used right away. The object is reused after cNumScratchObjects more calls.
+
+    The bulk functions take the points as packed arrays of numbers [x0, y0, z0, x1, y1, z1, ...] and transform them in
+    one native call. The result is written to the optional destination array, which can be the source array, or else
+    to a new array, and is returned:
+    - math.TransformPositions(float3x4 m, src, [dst]) and math.TransformDirections(float3x4 m, src, [dst]).
+    - math.RotateVectors(Quat q, src, [dst]).
+    - math.Translate(float3 offset, src, [dst]).
+    - math.Distances(float3 point, src, [dst]) and math.DistancesSq(float3 point, src, [dst]), which give one number per point.
+    Must be called after ExposeCoreApiMetaTypes has registered the math classes and created the math namespace. */
+void ExposeMathFastPaths(QScriptEngine *engine);
+
+/// Number of objects in the rings of math.ScratchFloat3 and math.ScratchQuat.
+static const int cNumScratchObjects = 64;
@@ -8,6 +8,9 @@
 #include "DebugOperatorNew.h"
 
 #include "ScriptMetaTypeDefines.h"
+#include "ScriptMathFastPaths.h"
+#include "ScriptWorker.h"
+#include "QtScriptBindingsHelpers.h"
 
 #include "Framework.h"
 #include "SceneAPI.h"
@@ -25,6 +28,7 @@
 #include "FrameAPI.h"
 #include "ConsoleAPI.h"
 #include "Scene/Scene.h"
+#include "ScenePersistence.h"
 #include "AudioAPI.h"
 #include "SoundChannel.h"
 #include "InputContext.h"
@@ -77,6 +81,7 @@ Q_SCRIPT_DECLARE_QMETAOBJECT(UiProxyWidget, QWidget*)
 // Scene API defines.
 Q_DECLARE_METATYPE(SceneAPI*);
 Q_DECLARE_METATYPE(Scene*);
+Q_DECLARE_METATYPE(ScenePersistence*);
 Q_DECLARE_METATYPE(Entity*);
 Q_DECLARE_METATYPE(EntityAction*);
 Q_DECLARE_METATYPE(EntityAction::ExecType);
@@ -93,6 +98,8 @@ Q_DECLARE_METATYPE(FrameAPI*);
 Q_DECLARE_METATYPE(ConsoleAPI*);
 Q_DECLARE_METATYPE(ConsoleCommand*);
 Q_DECLARE_METATYPE(DelayedSignal*);
+Q_DECLARE_METATYPE(LowPriorityUpdate*);
+Q_DECLARE_METATYPE(ScriptWorker*);
 Q_DECLARE_METATYPE(ConfigAPI*);
 Q_DECLARE_METATYPE(RaycastResult*);
 
@@ -259,6 +266,45 @@ QScriptValue register_TranslateOp_prototype(QScriptEngine *engine);
 QScriptValue register_Transform_prototype(QScriptEngine *engine);
 QScriptValue register_Triangle_prototype(QScriptEngine *engine);
 
+/// Signature of the generated functions which register the prototype, the conversions and the constructor of a math class.
+typedef QScriptValue (*RegisterPrototypeFunc)(QScriptEngine *engine);
+
+/// Conversion of a lazily registered class from C++: registers the class, which replaces this conversion, and converts with it.
+template<typename T, RegisterPrototypeFunc Register>
+QScriptValue LazyToScriptValue(QScriptEngine *engine, const T &value)
+{
+    Register(engine);
+    return qScriptValueFromValue(engine, value);
+}
+
+/// Conversion of a lazily registered class to C++: registers the class, which replaces this conversion, and converts with it.
+template<typename T, RegisterPrototypeFunc Register>
+void LazyFromScriptValue(const QScriptValue &obj, T &value)
+{
+    if (obj.engine())
+        Register(obj.engine());
+    value = qscriptvalue_cast<T>(obj);
+}
+
+/// Getter of the constructor of a lazily registered class. Registering the class replaces the getter with the constructor.
+template<typename T, RegisterPrototypeFunc Register>
+QScriptValue LazyConstructorGetter(QScriptContext * /*context*/, QScriptEngine *engine)
+{
+    return Register(engine);
+}
+
+/// Exposes a math class so that its prototype is created only when the script first uses the constructor, or a value of
+/// the class is converted between C++ and script.
+/** Creating the prototypes of all the classes dominates the creation time of an engine, while most scripts use only
+    the vectors, matrices and quaternions. The conversions are stubs until then, as the generated bindings convert the
+    return values of the functions through the metatype system. */
+template<typename T, RegisterPrototypeFunc Register>
+void RegisterLazily(QScriptEngine *engine, const char *name)
+{
+    qScriptRegisterMetaType<T>(engine, LazyToScriptValue<T, Register>, LazyFromScriptValue<T, Register>);
+    engine->globalObject().setProperty(name, engine->newFunction(LazyConstructorGetter<T, Register>), QScriptValue::PropertyGetter);
+}
+
 static QScriptValue math_SetMathBreakOnAssume(QScriptContext *context, QScriptEngine * /*engine*/)
 {
     SetMathBreakOnAssume(qscriptvalue_cast<bool>(context->argument(0)));
@@ -296,33 +342,36 @@ void ExposeCoreApiMetaTypes(QScriptEngine *engine)
     qScriptRegisterMetaType(engine, toScriptS64<s64>, fromScriptLongLong<s64>);
     qScriptRegisterMetaType(engine, toScriptU64<u64>, fromScriptULongLong<u64>);
 
-    // Math
+    // Math. The vectors, matrices, quaternions and transforms are used by almost every script, and the generated bindings
+    // of the other classes convert them, and LineSegment, directly instead of through the metatype system.
     register_float2_prototype(engine);
     register_float3_prototype(engine);
     register_float3x3_prototype(engine);
     register_float3x4_prototype(engine);
     register_float4_prototype(engine);
     register_float4x4_prototype(engine);
-    register_AABB_prototype(engine);
-    register_Capsule_prototype(engine);
-    register_Circle_prototype(engine);
-    register_Frustum_prototype(engine);
-    register_LCG_prototype(engine);
-    register_Line_prototype(engine);
-    register_LineSegment_prototype(engine);
-    register_OBB_prototype(engine);
-    register_Plane_prototype(engine);
     register_Quat_prototype(engine);
-    register_Ray_prototype(engine);
-    register_ScaleOp_prototype(engine);
-    register_Sphere_prototype(engine);
-    register_TranslateOp_prototype(engine);
-    register_Triangle_prototype(engine);
     register_Transform_prototype(engine);
+    register_LineSegment_prototype(engine);
+    // The geometry classes are registered on first use.
+    RegisterLazily<AABB, register_AABB_prototype>(engine, "AABB");
+    RegisterLazily<Capsule, register_Capsule_prototype>(engine, "Capsule");
+    RegisterLazily<Circle, register_Circle_prototype>(engine, "Circle");
+    RegisterLazily<Frustum, register_Frustum_prototype>(engine, "Frustum");
+    RegisterLazily<LCG, register_LCG_prototype>(engine, "LCG");
+    RegisterLazily<Line, register_Line_prototype>(engine, "Line");
+    RegisterLazily<OBB, register_OBB_prototype>(engine, "OBB");
+    RegisterLazily<Plane, register_Plane_prototype>(engine, "Plane");
+    RegisterLazily<Ray, register_Ray_prototype>(engine, "Ray");
+    RegisterLazily<ScaleOp, register_ScaleOp_prototype>(engine, "ScaleOp");
+    RegisterLazily<Sphere, register_Sphere_prototype>(engine, "Sphere");
+    RegisterLazily<TranslateOp, register_TranslateOp_prototype>(engine, "TranslateOp");
+    RegisterLazily<Triangle, register_Triangle_prototype>(engine, "Triangle");
     QScriptValue mathNamespace = engine->newObject();
     mathNamespace.setProperty("SetMathBreakOnAssume", engine->newFunction(math_SetMathBreakOnAssume, 1), QScriptValue::Undeletable | QScriptValue::ReadOnly);
     mathNamespace.setProperty("MathBreakOnAssume", engine->newFunction(math_MathBreakOnAssume, 0), QScriptValue::Undeletable | QScriptValue::ReadOnly);
     engine->globalObject().setProperty("math", mathNamespace);
+    ExposeMathFastPaths(engine);
 
     // Input metatypes.
     qScriptRegisterQObjectMetaType<MouseEvent*>(engine);
@@ -341,6 +390,7 @@ void ExposeCoreApiMetaTypes(QScriptEngine *engine)
     // Scene metatypes.
     qScriptRegisterQObjectMetaType<SceneAPI*>(engine);
     qScriptRegisterQObjectMetaType<Scene*>(engine);
+    qScriptRegisterQObjectMetaType<ScenePersistence*>(engine);
     qScriptRegisterQObjectMetaType<Entity*>(engine);
     qScriptRegisterQObjectMetaType<EntityAction*>(engine);
     qScriptRegisterQObjectMetaType<AttributeChange*>(engine);
@@ -367,6 +417,8 @@ void ExposeCoreApiMetaTypes(QScriptEngine *engine)
     // Frame metatypes.
     qScriptRegisterQObjectMetaType<FrameAPI*>(engine);
     qScriptRegisterQObjectMetaType<DelayedSignal*>(engine);
+    qScriptRegisterQObjectMetaType<LowPriorityUpdate*>(engine);
+    qScriptRegisterQObjectMetaType<ScriptWorker*>(engine);
 
     // Config metatypes.
     qScriptRegisterQObjectMetaType<ConfigAPI*>(engine);
@@ -0,0 +1,117 @@
+/**
+    For conditions of distribution and use, see copyright notice in LICENSE
+
+    @file   ScriptProgramCache.cpp
+    @brief  Cache of the compiled script programs and the resolved include files, shared by the script instances. */
+
+#include "StableHeaders.h"
+#include "DebugOperatorNew.h"
+
+#include "ScriptProgramCache.h"
+#include "Application.h"
+#include "Profiler.h"
+
+#include <QScriptEngine>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+
+#include <algorithm>
+#include <vector>
+
+#include "MemoryLeakCheck.h"
+
+ScriptProgramCache::ScriptProgramCache() :
+    useCounter_(0)
+{
+}
+
+ScriptProgramCache::Program ScriptProgramCache::GetProgram(const QString &fileName, const QString &source)
+{
+    const ProgramKey key(fileName, qHash(source));
+    QHash<ProgramKey, Program>::iterator it = programs_.find(key);
+    if (it != programs_.end() && it->program.sourceCode() == source)
+    {
+        it->lastUsed = ++useCounter_;
+        return *it;
+    }
+
+    PROFILE(ScriptProgramCache_Compile);
+    if (it == programs_.end() && programs_.size() >= cMaxPrograms)
+        Trim();
+
+    Program program;
+    program.program = QScriptProgram(source, fileName);
+    QScriptSyntaxCheckResult syntaxResult = QScriptEngine::checkSyntax(source);
+    program.valid = syntaxResult.state() == QScriptSyntaxCheckResult::Valid;
+    program.errorLineNumber = syntaxResult.errorLineNumber();
+    program.errorMessage = syntaxResult.errorMessage();
+    program.lastUsed = ++useCounter_;
+    programs_.insert(key, program);
+    return program;
+}
+
+QString ScriptProgramCache::IncludeFileContent(const QString &fileName, QString &resolvedPath)
+{
+    QHash<QString, IncludeFile>::iterator it = includeFiles_.find(fileName);
+    if (it == includeFiles_.end())
+    {
+        // Check install dir and the clean rel path.
+        const QString filename = fileName.trimmed();
+        QString pathToFile;
+        QDir jsPluginDir(QDir::fromNativeSeparators(Application::InstallationDirectory()) + "jsmodules");
+        if (jsPluginDir.exists(filename))
+            pathToFile = jsPluginDir.filePath(filename);
+        else if (QFile::exists(filename))
+            pathToFile = filename;
+        if (pathToFile.isEmpty())
+        {
+            resolvedPath = "";
+            return "";
+        }
+        IncludeFile file;
+        file.path = pathToFile;
+        it = includeFiles_.insert(fileName, file);
+    }
+
+    resolvedPath = it->path;
+    const QDateTime lastModified = QFileInfo(it->path).lastModified();
+    if (!it->lastModified.isValid() || lastModified != it->lastModified)
+    {
+        QFile scriptFile(it->path);
+        if (!scriptFile.open(QIODevice::ReadOnly))
+        {
+            // The file has gone: resolve it again next time
+            includeFiles_.erase(it);
+            resolvedPath = "";
+            return "";
+        }
+        it->content = scriptFile.readAll();
+        it->lastModified = lastModified;
+    }
+    return it->content;
+}
+
+void ScriptProgramCache::Clear()
+{
+    programs_.clear();
+    includeFiles_.clear();
+}
+
+void ScriptProgramCache::Trim()
+{
+    std::vector<unsigned> uses;
+    uses.reserve(programs_.size());
+    for(QHash<ProgramKey, Program>::const_iterator it = programs_.begin(); it != programs_.end(); ++it)
+        uses.push_back(it->lastUsed);
+    std::nth_element(uses.begin(), uses.begin() + uses.size() / 2, uses.end());
+    const unsigned median = uses[uses.size() / 2];
+
+    for(QHash<ProgramKey, Program>::iterator it = programs_.begin(); it != programs_.end();)
+    {
+        if (it->lastUsed < median)
+            it = programs_.erase(it);
+        else
+            ++it;
+    }
+}
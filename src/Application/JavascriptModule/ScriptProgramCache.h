@@ -0,0 +1,68 @@
+/**
+    For conditions of distribution and use, see copyright notice in LICENSE
+
+    @file   ScriptProgramCache.h
+    @brief  Cache of the compiled script programs and the resolved include files, shared by the script instances. */
+
+#pragma once
+
+#include <QScriptProgram>
+#include <QHash>
+#include <QPair>
+#include <QDateTime>
+#include <QString>
+
+/// Cache of the compiled script programs and the resolved include files, shared by the script instances.
+/** A program is keyed by its file or asset name and the hash of its source, so the instances that run the same script
+    share one QScriptProgram, and the syntax of a script is checked once. A reloaded asset with new content gets a new entry.
+    QtScript keeps the compiled form of a program for the engine that last evaluated it, so the programs are compiled
+    once per engine: with --sharedScriptEngines, once per pooled engine.
+
+    The include files are resolved to their local files once, and their content is read again only when the file has changed.
+    The least recently used programs are dropped when there are more than cMaxPrograms of them. */
+class ScriptProgramCache
+{
+public:
+    ScriptProgramCache();
+
+    /// Compiled program and the result of its syntax check.
+    struct Program
+    {
+        QScriptProgram program;
+        bool valid; ///< Whether the syntax is valid.
+        int errorLineNumber; ///< Line of the syntax error, if not valid.
+        QString errorMessage; ///< The syntax error, if not valid.
+        unsigned lastUsed; ///< Use counter value when the program was last returned.
+    };
+
+    /// Returns the program of a script, syntax checking it if not cached yet.
+    Program GetProgram(const QString &fileName, const QString &source);
+
+    /// Returns the content of a local include file, or an empty string if not found. Reads the file only if it has changed since the last call.
+    /** @param fileName The include path as given to engine.IncludeFile, relative to the jsmodules directory or to the working directory.
+        @param[out] resolvedPath The local file the include path resolved to. */
+    QString IncludeFileContent(const QString &fileName, QString &resolvedPath);
+
+    /// Forgets all the programs and the include files.
+    void Clear();
+
+    /// Maximum number of programs kept.
+    static const int cMaxPrograms = 1024;
+
+private:
+    /// Drops the least recently used half of the programs.
+    void Trim();
+
+    typedef QPair<QString, uint> ProgramKey;
+    QHash<ProgramKey, Program> programs_;
+    unsigned useCounter_;
+
+    /// Content of a local include file.
+    struct IncludeFile
+    {
+        QString path; ///< Resolved local file.
+        QDateTime lastModified;
+        QString content;
+    };
+    QHash<QString, IncludeFile> includeFiles_; ///< By include path.
+};
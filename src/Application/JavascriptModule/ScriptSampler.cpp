@@ -0,0 +1,380 @@
+/**
+    For conditions of distribution and use, see copyright notice in LICENSE
+
+    @file   ScriptSampler.cpp
+    @brief  Sampling profiler for the script engines. */
+
+#include "StableHeaders.h"
+#include "DebugOperatorNew.h"
+
+#include "ScriptSampler.h"
+#include "LoggingFunctions.h"
+
+#include <QScriptEngine>
+#include <QScriptEngineAgent>
+#include <QScriptContext>
+#include <QScriptContextInfo>
+#include <QStringList>
+#include <QTextStream>
+#include <QFile>
+
+#include <algorithm>
+
+#include "MemoryLeakCheck.h"
+
+const float ScriptSampler::cDefaultIntervalMs = 1.f;
+
+/// Reads the clock on the function calls of an engine. Accounts the time of the calls from native code, and has the sampler
+/// record the stack once per sampling interval.
+class ScriptSamplerAgent : public QScriptEngineAgent
+{
+public:
+    ScriptSamplerAgent(QScriptEngine *engine, ScriptSampler *sampler, int index, const QString &name) :
+        QScriptEngineAgent(engine),
+        sampler_(sampler),
+        index_(index),
+        name_(name),
+        depth_(0),
+        entryTime_(0),
+        last_(0),
+        active_(0)
+    {
+    }
+
+    /// QScriptEngineAgent override. The current context is the called function, while the time since the last call belongs to its caller.
+    void functionEntry(qint64 /*scriptId*/)
+    {
+        if (depth_ == 0)
+        {
+            // A call into the scripts from native code.
+            entryTime_ = GetCurrentClockTime();
+            last_ = entryTime_;
+            if (!name_.isEmpty())
+                callName_ = name_;
+            else
+            {
+                QScriptContextInfo info(engine()->currentContext());
+                callName_ = info.fileName().isEmpty() ? QString("(engine %1)").arg(index_) : info.fileName();
+            }
+        }
+        else if (sampler_->running_)
+            Tick(true);
+        ++depth_;
+    }
+
+    /// QScriptEngineAgent override. The current context is the returning function.
+    void functionExit(qint64 /*scriptId*/, const QScriptValue & /*returnValue*/)
+    {
+        if (depth_ == 0)
+            return;
+        if (sampler_->running_)
+            Tick(false);
+        if (--depth_ == 0)
+            EndCall();
+    }
+
+    /// QScriptEngineAgent override. An exception without a handler unwinds the script functions to the native code.
+    void exceptionThrow(qint64 /*scriptId*/, const QScriptValue & /*exception*/, bool hasHandler)
+    {
+        if (!hasHandler && depth_ > 0)
+        {
+            depth_ = 0;
+            EndCall();
+        }
+    }
+
+private:
+    void Tick(bool entering)
+    {
+        // Only the time spent inside the scripts counts towards the interval.
+        tick_t now = GetCurrentClockTime();
+        active_ += now - last_;
+        last_ = now;
+        if (active_ >= sampler_->intervalTicks_)
+        {
+            QScriptContext *context = engine()->currentContext();
+            if (entering && context)
+                context = context->parentContext();
+            sampler_->Record(context, index_, active_);
+            active_ = 0;
+        }
+    }
+
+    void EndCall()
+    {
+        tick_t now = GetCurrentClockTime();
+        if (sampler_->running_)
+            active_ += now - last_;
+        if (sampler_->accounting_)
+            sampler_->Account(callName_, now - entryTime_);
+    }
+
+    ScriptSampler *sampler_;
+    int index_;
+    QString name_; ///< Name to account the time to, or empty to use the file of the called function.
+    QString callName_; ///< Name the current call is accounted to.
+    int depth_; ///< Number of script functions being run.
+    tick_t entryTime_; ///< Start time of the current call from native code.
+    tick_t last_;
+    tick_t active_; ///< Script execution time since the last sample.
+};
+
+namespace
+{
+
+QString EscapeJson(const QString &str)
+{
+    QString escaped;
+    escaped.reserve(str.length());
+    for(int i = 0; i < str.length(); ++i)
+    {
+        const QChar c = str[i];
+        if (c == '"' || c == '\\')
+            escaped += QChar('\\') + c;
+        else if (c.unicode() < 0x20)
+            escaped += QString("\\u%1").arg((int)c.unicode(), 4, 16, QChar('0'));
+        else
+            escaped += c;
+    }
+    return escaped;
+}
+
+} // ~unnamed namespace
+
+ScriptSampler::ScriptSampler() :
+    nextEngineIndex_(0),
+    running_(false),
+    accounting_(true),
+    full_(false),
+    intervalTicks_(0),
+    startTime_(0)
+{
+}
+
+ScriptSampler::~ScriptSampler()
+{
+    running_ = false;
+    accounting_ = false;
+    UpdateAgents();
+}
+
+void ScriptSampler::AddEngine(QScriptEngine *engine, const QString &name)
+{
+    if (!engine)
+        return;
+    for(size_t i = 0; i < engines_.size(); ++i)
+        if (engines_[i].engine == engine)
+            return;
+
+    EngineEntry entry;
+    entry.engine = engine;
+    entry.agent = 0;
+    entry.index = nextEngineIndex_++;
+    entry.name = name;
+    engines_.push_back(entry);
+    if (running_ || accounting_)
+        Attach((int)engines_.size() - 1);
+}
+
+void ScriptSampler::RemoveEngine(QScriptEngine *engine)
+{
+    for(size_t i = 0; i < engines_.size(); ++i)
+        if (engines_[i].engine == engine)
+        {
+            if (engines_[i].agent)
+            {
+                engine->setAgent(0);
+                delete engines_[i].agent;
+            }
+            engines_.erase(engines_.begin() + i);
+            return;
+        }
+}
+
+void ScriptSampler::Attach(int entryIndex)
+{
+    EngineEntry &entry = engines_[entryIndex];
+    if (entry.agent)
+        return;
+    if (entry.engine->agent())
+    {
+        LogWarning("ScriptSampler: A script engine has an agent already, not sampling it.");
+        return;
+    }
+    entry.agent = new ScriptSamplerAgent(entry.engine, this, entry.index, entry.name);
+    entry.engine->setAgent(entry.agent);
+}
+
+void ScriptSampler::UpdateAgents()
+{
+    for(size_t i = 0; i < engines_.size(); ++i)
+    {
+        if (running_ || accounting_)
+            Attach((int)i);
+        else if (engines_[i].agent)
+        {
+            engines_[i].engine->setAgent(0);
+            delete engines_[i].agent;
+            engines_[i].agent = 0;
+        }
+    }
+}
+
+void ScriptSampler::SetAccounting(bool enable)
+{
+    accounting_ = enable;
+    frameTimes_.clear();
+    UpdateAgents();
+}
+
+void ScriptSampler::Account(const QString &name, tick_t elapsed)
+{
+    ScriptTime &time = frameTimes_[name];
+    if (time.calls == 0)
+        time.name = name;
+    time.msecs += (float)((double)elapsed * 1000.0 / (double)GetCurrentClockFreq());
+    ++time.calls;
+}
+
+void ScriptSampler::EndFrame(std::vector<ScriptTime> &times)
+{
+    times.clear();
+    for(QHash<QString, ScriptTime>::const_iterator iter = frameTimes_.begin(); iter != frameTimes_.end(); ++iter)
+        times.push_back(iter.value());
+    frameTimes_.clear();
+}
+
+void ScriptSampler::Start(float intervalMs)
+{
+    frames_.clear();
+    frameIds_.clear();
+    samples_.clear();
+    full_ = false;
+    intervalTicks_ = (tick_t)(GetCurrentClockFreq() * (double)std::max(intervalMs, 0.01f) / 1000.0);
+    startTime_ = GetCurrentClockTime();
+    running_ = true;
+    UpdateAgents();
+}
+
+void ScriptSampler::Stop()
+{
+    running_ = false;
+    UpdateAgents();
+}
+
+int ScriptSampler::FrameId(int parent, const QString &name)
+{
+    QPair<int, QString> key(parent, name);
+    QHash<QPair<int, QString>, int>::const_iterator iter = frameIds_.find(key);
+    if (iter != frameIds_.end())
+        return iter.value();
+
+    Frame frame;
+    frame.name = name;
+    frame.parent = parent;
+    frames_.push_back(frame);
+    frameIds_[key] = (int)frames_.size() - 1;
+    return (int)frames_.size() - 1;
+}
+
+void ScriptSampler::Record(QScriptContext *context, int engine, tick_t weight)
+{
+    if (!context || full_)
+        return;
+    if (samples_.size() >= cMaxSamples)
+    {
+        LogWarning("ScriptSampler: Recorded " + QString::number(cMaxSamples) + " samples, no more samples will be recorded.");
+        full_ = true;
+        return;
+    }
+
+    // Gather the stack innermost first. The outermost context is the global context of the engine, which is left out.
+    QStringList stack;
+    QString root;
+    for(QScriptContext *c = context; c && c->parentContext(); c = c->parentContext())
+    {
+        QScriptContextInfo info(c);
+        if (info.functionType() == QScriptContextInfo::NativeFunction)
+            stack << (info.functionName().isEmpty() ? QString("(native)") : info.functionName() + " [native]");
+        else
+        {
+            QString name = info.functionName();
+            if (name.isEmpty())
+                name = (info.functionStartLineNumber() < 0 ? "(program)" : "(anonymous)");
+            stack << name + " (" + info.fileName() + ":" + QString::number(info.functionStartLineNumber()) + ")";
+            if (!info.fileName().isEmpty())
+                root = info.fileName();
+        }
+    }
+    if (stack.isEmpty())
+        return;
+
+    int frame = FrameId(-1, root.isEmpty() ? QString("(unknown)") : root);
+    for(int i = stack.size() - 1; i >= 0; --i)
+        frame = FrameId(frame, stack[i]);
+
+    Sample sample;
+    sample.time = GetCurrentClockTime();
+    sample.weight = weight;
+    sample.frame = frame;
+    sample.engine = engine;
+    samples_.push_back(sample);
+}
+
+void ScriptSampler::WriteCollapsed(QTextStream &out) const
+{
+    QHash<int, tick_t> weights;
+    for(size_t i = 0; i < samples_.size(); ++i)
+        weights[samples_[i].frame] += samples_[i].weight;
+
+    const double usecsPerTick = 1e6 / (double)GetCurrentClockFreq();
+    for(QHash<int, tick_t>::const_iterator iter = weights.begin(); iter != weights.end(); ++iter)
+    {
+        QStringList path;
+        for(int f = iter.key(); f >= 0; f = frames_[f].parent)
+            path.push_front(QString(frames_[f].name).replace(';', ':'));
+        out << path.join(";") << " " << (qint64)(iter.value() * usecsPerTick + 0.5) << "\n";
+    }
+}
+
+void ScriptSampler::WriteChromeTrace(QTextStream &out) const
+{
+    const double usecsPerTick = 1e6 / (double)GetCurrentClockFreq();
+
+    out << "{\"traceEvents\":[";
+    for(size_t i = 0; i < engines_.size(); ++i)
+        out << (i > 0 ? "," : "") << "{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":" << engines_[i].index
+            << ",\"args\":{\"name\":\"Script engine " << engines_[i].index << "\"}}";
+    out << "],\"displayTimeUnit\":\"ms\",\"stackFrames\":{";
+    for(size_t i = 0; i < frames_.size(); ++i)
+    {
+        out << (i > 0 ? "," : "") << "\"" << i << "\":{\"name\":\"" << EscapeJson(frames_[i].name) << "\"";
+        if (frames_[i].parent >= 0)
+            out << ",\"parent\":\"" << frames_[i].parent << "\"";
+        out << "}";
+    }
+    out << "},\"samples\":[";
+    for(size_t i = 0; i < samples_.size(); ++i)
+    {
+        const Sample &s = samples_[i];
+        out << (i > 0 ? "," : "") << "{\"cpu\":0,\"pid\":1,\"tid\":" << s.engine << ",\"ts\":" << (qint64)((s.time - startTime_) * usecsPerTick)
+            << ",\"name\":\"script\",\"sf\":\"" << s.frame << "\",\"weight\":" << (qint64)(s.weight * usecsPerTick + 0.5) << "}";
+    }
+    out << "]}\n";
+}
+
+bool ScriptSampler::Save(const QString &fileName) const
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Text))
+    {
+        LogError("ScriptSampler::Save: Could not open " + fileName + " for writing.");
+        return false;
+    }
+    QTextStream out(&file);
+    if (fileName.endsWith(".json", Qt::CaseInsensitive))
+        WriteChromeTrace(out);
+    else
+        WriteCollapsed(out);
+    return true;
+}
@@ -0,0 +1,143 @@
+/**
+    For conditions of distribution and use, see copyright notice in LICENSE
+
+    @file   ScriptSampler.h
+    @brief  Sampling profiler for the script engines. */
+
+#pragma once
+
+#include "HighPerfClock.h"
+
+#include <QString>
+#include <QHash>
+#include <QPair>
+
+#include <vector>
+
+class QScriptEngine;
+class QScriptContext;
+class QTextStream;
+class ScriptSamplerAgent;
+
+/// Sampling profiler for the script engines, which records the script call stacks periodically while the scripts run.
+/** Unlike the instrumenting jsprofiler, the sampler only reads the clock on the function calls of the scripts, and walks
+    the call stack once per sampling interval of script execution time. The time between the samples is attributed to the
+    sampled stack. The root of each stack is the script asset ref (or file) of the outermost script function, so that the
+    time of the script instances can be told apart also when they share a pooled engine.
+
+    The engines register themselves with AddEngine when created and with RemoveEngine before they are deleted. Start attaches
+    a QScriptEngineAgent to each registered engine that has no agent of its own, and the engines that are added later while
+    sampling. The samples can be saved as collapsed stacks for flamegraph.pl and speedscope, or as a Chrome trace for
+    chrome://tracing, with the weights in microseconds.
+
+    The sampler also accounts the time of each call into the scripts from native code, such as the frame signals and the
+    delayed signals, when accounting is enabled. The time is accounted to the name the engine was added with, or for the
+    pooled engines to the script asset ref of the called function, and collected each frame with EndFrame. */
+class ScriptSampler
+{
+public:
+    ScriptSampler();
+    ~ScriptSampler();
+
+    /// Registers a script engine to be sampled while the sampler runs.
+    /** @param name Name to account the time of the engine to. If empty, the time is accounted to the script file of each called function. */
+    void AddEngine(QScriptEngine *engine, const QString &name = QString());
+
+    /// Unregisters a script engine. Call before deleting the engine.
+    void RemoveEngine(QScriptEngine *engine);
+
+    /// Clears the previous samples and starts sampling the registered engines every intervalMs of script execution time.
+    void Start(float intervalMs = cDefaultIntervalMs);
+
+    /// Stops sampling, keeping the samples.
+    void Stop();
+
+    bool IsRunning() const { return running_; }
+
+    /// Sets whether the time of the calls into the scripts is accounted. Enabled by default.
+    void SetAccounting(bool enable);
+    bool IsAccounting() const { return accounting_; }
+
+    /// Script execution time accounted to a name.
+    struct ScriptTime
+    {
+        ScriptTime() : msecs(0.f), calls(0) {}
+
+        QString name;
+        float msecs;
+        int calls; ///< Number of calls into the scripts.
+    };
+
+    /// Returns the script execution times accounted since the previous call.
+    void EndFrame(std::vector<ScriptTime> &times);
+
+    /// Returns the number of recorded samples.
+    size_t NumSamples() const { return samples_.size(); }
+
+    /// Writes the samples as collapsed stacks, one "root;caller;callee microseconds" line per distinct stack.
+    void WriteCollapsed(QTextStream &out) const;
+
+    /// Writes the samples in the Chrome trace event format, with a thread per engine.
+    void WriteChromeTrace(QTextStream &out) const;
+
+    /// Saves the samples to a file, as a Chrome trace if the file name ends with .json, and as collapsed stacks otherwise.
+    bool Save(const QString &fileName) const;
+
+    static const float cDefaultIntervalMs; ///< 1 ms.
+    static const size_t cMaxSamples = 1000000; ///< Sampling is stopped when this many samples have been recorded.
+
+private:
+    friend class ScriptSamplerAgent;
+
+    /// Node of the call tree of the samples.
+    struct Frame
+    {
+        QString name;
+        int parent; ///< -1 for the roots.
+    };
+
+    struct Sample
+    {
+        tick_t time;
+        tick_t weight;
+        int frame; ///< The innermost frame of the stack.
+        int engine; ///< Index of the engine.
+    };
+
+    /// Called by the agent of an engine. Records the call stack of the context and its callers, with the given weight in clock ticks.
+    void Record(QScriptContext *context, int engine, tick_t weight);
+
+    /// Called by the agent of an engine when a call into the scripts from native code returns.
+    void Account(const QString &name, tick_t elapsed);
+
+    /// Returns the index of the frame with the name and parent, adding it if new.
+    int FrameId(int parent, const QString &name);
+
+    /// Attaches an agent to the engine, unless it has one already.
+    void Attach(int entryIndex);
+
+    /// Attaches the agents to the engines when sampling or accounting, and detaches them otherwise.
+    void UpdateAgents();
+
+    struct EngineEntry
+    {
+        QScriptEngine *engine;
+        ScriptSamplerAgent *agent;
+        int index;
+        QString name;
+    };
+    std::vector<EngineEntry> engines_;
+    int nextEngineIndex_;
+
+    std::vector<Frame> frames_;
+    QHash<QPair<int, QString>, int> frameIds_;
+    std::vector<Sample> samples_;
+
+    QHash<QString, ScriptTime> frameTimes_; ///< The times accounted since the previous EndFrame.
+
+    bool running_;
+    bool accounting_;
+    bool full_; ///< Whether cMaxSamples has been reached.
+    tick_t intervalTicks_;
+    tick_t startTime_;
+};
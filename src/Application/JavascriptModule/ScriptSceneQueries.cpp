@@ -0,0 +1,294 @@
+/**
+    For conditions of distribution and use, see copyright notice in LICENSE
+
+    @file   ScriptSceneQueries.cpp
+    @brief  Native scene queries for QtScript, which return the results as packed arrays. */
+
+#include "StableHeaders.h"
+#include "DebugOperatorNew.h"
+
+#include "ScriptSceneQueries.h"
+#include "QtScriptBindingsHelpers.h"
+#include "Framework.h"
+#include "SceneAPI.h"
+#include "Scene/Scene.h"
+#include "Entity.h"
+#include "EC_Placeable.h"
+#include "TundraLogicModule.h"
+#include "SyncManager.h"
+#include "Profiler.h"
+
+#include <QScriptEngine>
+
+#include <vector>
+#include <algorithm>
+
+#include "MemoryLeakCheck.h"
+
+namespace
+{
+
+const QScriptValue::PropertyFlags cFunctionFlags = QScriptValue::Undeletable | QScriptValue::ReadOnly;
+
+/// An entity found by a query.
+struct Hit
+{
+    entity_id_t id;
+    float3 pos;
+};
+
+/// Accepts every position.
+struct AnyPosition
+{
+    bool Contains(const float3 &) const { return true; }
+};
+
+struct InsideSphere
+{
+    Sphere sphere;
+    bool Contains(const float3 &pos) const { return sphere.Contains(pos); }
+};
+
+struct InsideBox
+{
+    AABB box;
+    bool Contains(const float3 &pos) const { return box.Contains(pos); }
+};
+
+/// The optional trailing arguments of a query: the component type to filter by and the object to write the result to.
+struct Filter
+{
+    Filter() : typeId(0), hasType(false) {}
+
+    u32 typeId;
+    bool hasType;
+    QScriptValue out;
+};
+
+Scene *SceneArgument(QScriptContext *context)
+{
+    return qobject_cast<Scene*>(context->argument(0).toQObject());
+}
+
+/// Reads the arguments from the index on as a component type name and an out object, in this order, each of them optional.
+QString ReadFilter(QScriptContext *context, Framework *framework, const char *name, int first, Filter &filter)
+{
+    for(int i = first; i < context->argumentCount(); ++i)
+    {
+        QScriptValue arg = context->argument(i);
+        if (arg.isString() && !filter.hasType && !filter.out.isValid())
+        {
+            filter.hasType = true;
+            filter.typeId = framework->Scene()->GetComponentTypeId(arg.toString());
+        }
+        else if (arg.isObject() && !filter.out.isValid())
+            filter.out = arg;
+        else if (!arg.isUndefined() && !arg.isNull())
+            return QString("%1(): argument %2 is not a component type name or an object to write the result to.").arg(name).arg(i);
+    }
+    return QString();
+}
+
+/// Returns the placeable of the entity, if it passes the component type filter.
+EC_Placeable *FilteredPlaceable(Entity *entity, const Filter &filter)
+{
+    if (!entity || (filter.hasType && !entity->Component(filter.typeId)))
+        return 0;
+    return entity->Component<EC_Placeable>().get();
+}
+
+/// Returns the spatial index of the sync manager, if it has one for the scene.
+const EntitySpatialGrid *SpatialIndex(Framework *framework, const Scene *scene)
+{
+    TundraLogic::TundraLogicModule *tundra = framework->Module<TundraLogic::TundraLogicModule>();
+    if (!tundra || !tundra->GetSyncManager())
+        return 0;
+    return tundra->GetSyncManager()->SpatialIndex(scene);
+}
+
+/// Appends the entities with a placeable in the shape to the hits, walking the placeables in the component-type index.
+/** @param localOnly Whether to skip the replicated entities, which have been found from the spatial index already. */
+template<typename Shape>
+void ScanPlaceables(Scene *scene, const Shape &shape, const Filter &filter, bool localOnly, std::vector<Hit> &hits)
+{
+    const Entity::ComponentVector placeables = scene->Components(EC_Placeable::TypeIdStatic());
+    for(size_t i = 0; i < placeables.size(); ++i)
+    {
+        Entity *entity = placeables[i]->ParentEntity();
+        if (!entity || (localOnly && !entity->IsLocal()))
+            continue;
+        // Only the first placeable of an entity counts, the same way as in Entity::Component<EC_Placeable>().
+        EC_Placeable *placeable = FilteredPlaceable(entity, filter);
+        if (placeable != placeables[i].get())
+            continue;
+        Hit hit;
+        hit.id = entity->Id();
+        hit.pos = placeable->WorldPosition();
+        if (shape.Contains(hit.pos))
+            hits.push_back(hit);
+    }
+}
+
+/// Appends the entities with a placeable in the bounding sphere and the shape to the hits, in ascending id order.
+template<typename Shape>
+void FindInside(Framework *framework, Scene *scene, const Sphere &bounds, const Shape &shape, const Filter &filter, std::vector<Hit> &hits)
+{
+    const EntitySpatialGrid *index = SpatialIndex(framework, scene);
+    if (!index)
+    {
+        ScanPlaceables(scene, shape, filter, false, hits);
+        return;
+    }
+
+    std::vector<entity_id_t> candidates;
+    index->EntitiesNear(bounds.pos, bounds.r, candidates);
+    std::sort(candidates.begin(), candidates.end());
+    for(size_t i = 0; i < candidates.size(); ++i)
+    {
+        EntityPtr entity = scene->EntityById(candidates[i]);
+        EC_Placeable *placeable = FilteredPlaceable(entity.get(), filter);
+        if (!placeable)
+            continue;
+        Hit hit;
+        hit.id = candidates[i];
+        hit.pos = placeable->WorldPosition();
+        if (shape.Contains(hit.pos))
+            hits.push_back(hit);
+    }
+    // The local entities have the largest ids, so the order is kept.
+    ScanPlaceables(scene, shape, filter, true, hits);
+}
+
+/// Sizes the array property of the object to the length, creating the array if the object does not have one.
+QScriptValue ArrayProperty(QScriptEngine *engine, QScriptValue &object, const char *name, quint32 length)
+{
+    QScriptValue array = object.property(name);
+    if (!array.isArray())
+    {
+        array = engine->newArray(length);
+        object.setProperty(name, array);
+    }
+    else if (array.property("length").toUInt32() != length)
+        array.setProperty("length", QScriptValue(length));
+    return array;
+}
+
+QScriptValue WriteHits(QScriptEngine *engine, const Filter &filter, const std::vector<Hit> &hits)
+{
+    QScriptValue out = filter.out.isValid() ? filter.out : engine->newObject();
+    QScriptValue ids = ArrayProperty(engine, out, "ids", (quint32)hits.size());
+    QScriptValue positions = ArrayProperty(engine, out, "positions", 3 * (quint32)hits.size());
+    for(quint32 i = 0; i < hits.size(); ++i)
+    {
+        ids.setProperty(i, QScriptValue((uint)hits[i].id));
+        positions.setProperty(3 * i, QScriptValue((qsreal)hits[i].pos.x));
+        positions.setProperty(3 * i + 1, QScriptValue((qsreal)hits[i].pos.y));
+        positions.setProperty(3 * i + 2, QScriptValue((qsreal)hits[i].pos.z));
+    }
+    return out;
+}
+
+QScriptValue sceneQuery_EntitiesWithComponent(QScriptContext *context, QScriptEngine *engine, void *arg)
+{
+    PROFILE(sceneQuery_EntitiesWithComponent);
+    Framework *framework = static_cast<Framework*>(arg);
+    Scene *scene = SceneArgument(context);
+    if (!scene || !context->argument(1).isString())
+        return context->throwError(QScriptContext::TypeError, "sceneQuery.EntitiesWithComponent(): expected a scene and a component type name.");
+    QString name;
+    QScriptValue dst;
+    for(int i = 2; i < context->argumentCount(); ++i)
+    {
+        QScriptValue value = context->argument(i);
+        if (value.isString() && name.isEmpty() && !dst.isValid())
+            name = value.toString();
+        else if (value.isArray() && !dst.isValid())
+            dst = value;
+        else if (!value.isUndefined() && !value.isNull())
+            return context->throwError(QScriptContext::TypeError, QString("sceneQuery.EntitiesWithComponent(): argument %1 is not a component name or an array.").arg(i));
+    }
+
+    const Entity::ComponentVector components = scene->Components(framework->Scene()->GetComponentTypeId(context->argument(1).toString()), name);
+    std::vector<entity_id_t> ids;
+    ids.reserve(components.size());
+    for(size_t i = 0; i < components.size(); ++i)
+        if (components[i]->ParentEntity())
+            ids.push_back(components[i]->ParentEntity()->Id());
+    std::sort(ids.begin(), ids.end());
+    ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+
+    if (!dst.isValid())
+        dst = engine->newArray((quint32)ids.size());
+    else if (dst.property("length").toUInt32() != ids.size())
+        dst.setProperty("length", QScriptValue((quint32)ids.size()));
+    for(quint32 i = 0; i < ids.size(); ++i)
+        dst.setProperty(i, QScriptValue((uint)ids[i]));
+    return dst;
+}
+
+QScriptValue sceneQuery_EntityPositions(QScriptContext *context, QScriptEngine *engine, void *arg)
+{
+    PROFILE(sceneQuery_EntityPositions);
+    Framework *framework = static_cast<Framework*>(arg);
+    Scene *scene = SceneArgument(context);
+    if (!scene)
+        return context->throwError(QScriptContext::TypeError, "sceneQuery.EntityPositions(): expected a scene.");
+    Filter filter;
+    QString error = ReadFilter(context, framework, "sceneQuery.EntityPositions", 1, filter);
+    if (!error.isEmpty())
+        return context->throwError(QScriptContext::TypeError, error);
+
+    std::vector<Hit> hits;
+    ScanPlaceables(scene, AnyPosition(), filter, false, hits);
+    return WriteHits(engine, filter, hits);
+}
+
+QScriptValue sceneQuery_EntitiesInSphere(QScriptContext *context, QScriptEngine *engine, void *arg)
+{
+    PROFILE(sceneQuery_EntitiesInSphere);
+    Framework *framework = static_cast<Framework*>(arg);
+    Scene *scene = SceneArgument(context);
+    if (!scene || !QSVIsOfType<float3>(context->argument(1)) || !context->argument(2).isNumber())
+        return context->throwError(QScriptContext::TypeError, "sceneQuery.EntitiesInSphere(): expected a scene, a float3 and a number.");
+    Filter filter;
+    QString error = ReadFilter(context, framework, "sceneQuery.EntitiesInSphere", 3, filter);
+    if (!error.isEmpty())
+        return context->throwError(QScriptContext::TypeError, error);
+
+    InsideSphere shape;
+    shape.sphere = Sphere(qscriptvalue_cast<float3>(context->argument(1)), (float)context->argument(2).toNumber());
+    std::vector<Hit> hits;
+    FindInside(framework, scene, shape.sphere, shape, filter, hits);
+    return WriteHits(engine, filter, hits);
+}
+
+QScriptValue sceneQuery_EntitiesInBox(QScriptContext *context, QScriptEngine *engine, void *arg)
+{
+    PROFILE(sceneQuery_EntitiesInBox);
+    Framework *framework = static_cast<Framework*>(arg);
+    Scene *scene = SceneArgument(context);
+    if (!scene || !QSVIsOfType<AABB>(context->argument(1)))
+        return context->throwError(QScriptContext::TypeError, "sceneQuery.EntitiesInBox(): expected a scene and an AABB.");
+    Filter filter;
+    QString error = ReadFilter(context, framework, "sceneQuery.EntitiesInBox", 2, filter);
+    if (!error.isEmpty())
+        return context->throwError(QScriptContext::TypeError, error);
+
+    InsideBox shape;
+    shape.box = qscriptvalue_cast<AABB>(context->argument(1));
+    std::vector<Hit> hits;
+    FindInside(framework, scene, shape.box.MinimalEnclosingSphere(), shape, filter, hits);
+    return WriteHits(engine, filter, hits);
+}
+
+} // ~unnamed namespace
+
+void ExposeSceneQueries(QScriptEngine *engine, QScriptValue object, Framework *framework)
+{
+    QScriptValue sceneQuery = engine->newObject();
+    sceneQuery.setProperty("EntitiesWithComponent", engine->newFunction(sceneQuery_EntitiesWithComponent, framework), cFunctionFlags);
+    sceneQuery.setProperty("EntityPositions", engine->newFunction(sceneQuery_EntityPositions, framework), cFunctionFlags);
+    sceneQuery.setProperty("EntitiesInSphere", engine->newFunction(sceneQuery_EntitiesInSphere, framework), cFunctionFlags);
+    sceneQuery.setProperty("EntitiesInBox", engine->newFunction(sceneQuery_EntitiesInBox, framework), cFunctionFlags);
+    object.setProperty("sceneQuery", sceneQuery);
+}
@@ -0,0 +1,29 @@
+/**
+    For conditions of distribution and use, see copyright notice in LICENSE
+
+    @file   ScriptSceneQueries.h
+    @brief  Native scene queries for QtScript, which return the results as packed arrays. */
+
+#pragma once
+
+class QScriptEngine;
+class QScriptValue;
+class Framework;
+
+/// Adds the sceneQuery object, which runs component and spatial queries on a scene natively, to the object.
+/** Scanning the scene from a script with scene.EntitiesWithComponent and reading the placeable of each entity creates
+    a script object per entity and crosses to native code for each attribute read. These queries walk the component-type
+    index of the scene natively, and write only the entity ids and the world positions to packed arrays of numbers:
+    - sceneQuery.EntitiesWithComponent(scene, typeName, [name], [dst]) returns the ids of the entities which have
+      a component of the type (and name), in ascending order, in the dst array or a new array.
+    - sceneQuery.EntityPositions(scene, [typeName], [out]) returns the entities which have a placeable (and a component
+      of the type).
+    - sceneQuery.EntitiesInSphere(scene, float3 center, radius, [typeName], [out]) and
+      sceneQuery.EntitiesInBox(scene, AABB box, [typeName], [out]) return the entities whose placeable world position is
+      inside the sphere or the box.
+    The latter three return the out object, or a new object, with the arrays "ids" [id0, id1, ...] and
+    "positions" [x0, y0, z0, x1, y1, z1, ...], which are reused when out has them already.
+
+    On a server with the interest management enabled, the spatial queries use the spatial index of the sync manager for
+    the replicated entities, and the component-type index only for the local entities. */
+void ExposeSceneQueries(QScriptEngine *engine, QScriptValue object, Framework *framework);
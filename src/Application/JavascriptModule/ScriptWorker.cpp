@@ -0,0 +1,251 @@
+/**
+    For conditions of distribution and use, see copyright notice in LICENSE
+
+    @file   ScriptWorker.cpp
+    @brief  Script engine running on a worker thread, for pure computation off the main thread. */
+
+#include "StableHeaders.h"
+#include "DebugOperatorNew.h"
+
+#include "ScriptWorker.h"
+#include "LoggingFunctions.h"
+
+#include <QThread>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QWaitCondition>
+#include <QScriptEngine>
+#include <QScriptContext>
+#include <QStringList>
+
+#include <deque>
+
+#include "MemoryLeakCheck.h"
+
+namespace
+{
+
+/// Returns a copy of the value with the QObjects replaced with null, as they must not be touched by the other thread.
+QVariant PlainValue(const QVariant &value)
+{
+    switch(value.type())
+    {
+    case QVariant::List:
+    {
+        QVariantList list = value.toList();
+        for(int i = 0; i < list.size(); ++i)
+            list[i] = PlainValue(list[i]);
+        return list;
+    }
+    case QVariant::Map:
+    {
+        QVariantMap map = value.toMap();
+        for(QVariantMap::iterator iter = map.begin(); iter != map.end(); ++iter)
+            iter.value() = PlainValue(iter.value());
+        return map;
+    }
+    case QVariant::Bool:
+    case QVariant::Int:
+    case QVariant::UInt:
+    case QVariant::LongLong:
+    case QVariant::ULongLong:
+    case QVariant::Double:
+    case QVariant::String:
+    case QVariant::StringList:
+    case QVariant::DateTime:
+    case QVariant::Date:
+    case QVariant::Time:
+    case QVariant::RegExp:
+        return value;
+    default:
+        return QVariant();
+    }
+}
+
+} // ~unnamed namespace
+
+/// The thread of a ScriptWorker, which owns the worker engine.
+class ScriptWorkerThread : public QThread
+{
+public:
+    ScriptWorkerThread(ScriptWorker *worker, const QString &name, const QString &program) :
+        worker_(worker),
+        name_(name),
+        program_(program),
+        engine_(0),
+        stopping_(false),
+        running_(true)
+    {
+    }
+
+    void Post(const QVariant &message)
+    {
+        QMutexLocker lock(&mutex_);
+        if (stopping_)
+            return;
+        queue_.push_back(PlainValue(message));
+        wake_.wakeOne();
+    }
+
+    void Stop(bool abort)
+    {
+        QMutexLocker lock(&mutex_);
+        stopping_ = true;
+        queue_.clear();
+        if (abort && engine_)
+            engine_->abortEvaluation();
+        wake_.wakeOne();
+    }
+
+    bool IsRunning() const
+    {
+        QMutexLocker lock(&mutex_);
+        return running_;
+    }
+
+protected:
+    /// QThread override.
+    void run()
+    {
+        QScriptEngine engine;
+        QScriptValue global = engine.globalObject();
+        global.setProperty("postMessage", engine.newFunction(PostMessage, this));
+        global.setProperty("print", engine.newFunction(Print, this));
+        global.setProperty("close", engine.newFunction(Close, this));
+        {
+            QMutexLocker lock(&mutex_);
+            engine_ = &engine;
+        }
+
+        engine.evaluate(program_, name_);
+        bool ok = CheckException(engine);
+        program_.clear();
+
+        while(ok)
+        {
+            QVariant message;
+            {
+                QMutexLocker lock(&mutex_);
+                while(queue_.empty() && !stopping_)
+                    wake_.wait(&mutex_);
+                if (stopping_)
+                    break;
+                message = queue_.front();
+                queue_.pop_front();
+            }
+
+            QScriptValue handler = global.property("onmessage");
+            if (!handler.isFunction())
+                continue;
+            QScriptValueList args;
+            args << engine.toScriptValue(message);
+            handler.call(global, args);
+            CheckException(engine);
+        }
+
+        QMutexLocker lock(&mutex_);
+        engine_ = 0;
+        running_ = false;
+    }
+
+private:
+    /// Reports an uncaught exception of the engine to the main thread. Returns false if there was one.
+    bool CheckException(QScriptEngine &engine)
+    {
+        if (!engine.hasUncaughtException())
+            return true;
+        QScriptValue exception = engine.uncaughtException();
+        const QString message = exception.toString() + " (" + name_ + ":" + QString::number(engine.uncaughtExceptionLineNumber()) + ")";
+        engine.clearExceptions();
+        // An aborted evaluation is not an error of the script.
+        bool aborted;
+        {
+            QMutexLocker lock(&mutex_);
+            aborted = stopping_;
+        }
+        if (!aborted)
+            QMetaObject::invokeMethod(worker_, "OnError", Qt::QueuedConnection, Q_ARG(QString, message));
+        return false;
+    }
+
+    static QScriptValue PostMessage(QScriptContext *context, QScriptEngine * /*engine*/, void *arg)
+    {
+        ScriptWorkerThread *thread = static_cast<ScriptWorkerThread*>(arg);
+        QVariant message = PlainValue(context->argument(0).toVariant());
+        QMetaObject::invokeMethod(thread->worker_, "OnMessage", Qt::QueuedConnection, Q_ARG(QVariant, message));
+        return QScriptValue();
+    }
+
+    static QScriptValue Print(QScriptContext *context, QScriptEngine * /*engine*/, void *arg)
+    {
+        ScriptWorkerThread *thread = static_cast<ScriptWorkerThread*>(arg);
+        QStringList parts;
+        for(int i = 0; i < context->argumentCount(); ++i)
+            parts << context->argument(i).toString();
+        QMetaObject::invokeMethod(thread->worker_, "OnPrint", Qt::QueuedConnection, Q_ARG(QString, parts.join(" ")));
+        return QScriptValue();
+    }
+
+    static QScriptValue Close(QScriptContext * /*context*/, QScriptEngine * /*engine*/, void *arg)
+    {
+        static_cast<ScriptWorkerThread*>(arg)->Stop(false);
+        return QScriptValue();
+    }
+
+    ScriptWorker *worker_; ///< Only used for queueing calls to the main thread.
+    QString name_;
+    QString program_;
+
+    mutable QMutex mutex_; ///< Guards the members below.
+    QWaitCondition wake_;
+    std::deque<QVariant> queue_;
+    QScriptEngine *engine_; ///< The engine of the thread while it runs.
+    bool stopping_;
+    bool running_;
+};
+
+ScriptWorker::ScriptWorker(const QString &name, const QString &program, QObject *parent) :
+    QObject(parent),
+    name_(name),
+    thread_(new ScriptWorkerThread(this, name, program))
+{
+    thread_->start(QThread::LowPriority);
+}
+
+ScriptWorker::~ScriptWorker()
+{
+    Terminate();
+    thread_->wait();
+    delete thread_;
+}
+
+void ScriptWorker::Post(const QVariant &message)
+{
+    thread_->Post(message);
+}
+
+void ScriptWorker::Terminate()
+{
+    thread_->Stop(true);
+}
+
+bool ScriptWorker::IsRunning() const
+{
+    return thread_->IsRunning();
+}
+
+void ScriptWorker::OnMessage(const QVariant &message)
+{
+    emit Message(message);
+}
+
+void ScriptWorker::OnError(const QString &message)
+{
+    LogError("ScriptWorker " + name_ + ": " + message);
+    emit Error(message);
+}
+
+void ScriptWorker::OnPrint(const QString &message)
+{
+    LogInfo("ScriptWorker " + name_ + ": " + message);
+}
@@ -0,0 +1,69 @@
+/**
+    For conditions of distribution and use, see copyright notice in LICENSE
+
+    @file   ScriptWorker.h
+    @brief  Script engine running on a worker thread, for pure computation off the main thread. */
+
+#pragma once
+
+#include <QObject>
+#include <QVariant>
+#include <QString>
+
+class ScriptWorkerThread;
+
+/// Runs a script in a QScriptEngine of its own on a worker thread, and passes messages between it and the main thread.
+/** Created from a script with engine.CreateWorker(scriptRef), and deleted with the script instance that created it.
+    The worker engine has only the ECMAScript built-in objects and the following global functions:
+    - postMessage(value) sends a value to the main thread, where the Message signal of the worker is emitted with it.
+    - onmessage(value), if defined by the worker script, is called with each value sent with Post.
+    - print(...) writes a line to the log of the main thread.
+    - close() stops the worker after the current message.
+    None of the framework APIs, scenes or the math classes are available in the worker, as they are not thread-safe.
+
+    The messages are copied as QVariants: numbers, strings, booleans, arrays and plain objects, and the combinations of
+    them. Objects of the main thread, such as entities, are passed as null. The worker processes the messages in order,
+    one at a time, so a long computation delays the messages after it but not the main thread. */
+class ScriptWorker : public QObject
+{
+    Q_OBJECT
+    Q_PROPERTY(QString name READ Name)
+    Q_PROPERTY(bool running READ IsRunning)
+
+public:
+    /// Starts the thread, which evaluates the script and then waits for messages.
+    /** @param name Name of the script for the log messages.
+        @param program Content of the script. */
+    ScriptWorker(const QString &name, const QString &program, QObject *parent = 0);
+
+    /// Stops the worker and waits for its thread to finish.
+    ~ScriptWorker();
+
+    const QString &Name() const { return name_; }
+
+public slots:
+    /// Sends a value to the onmessage function of the worker script.
+    void Post(const QVariant &message);
+
+    /// Stops the worker, aborting the script that is being run. The messages not yet processed are discarded.
+    void Terminate();
+
+    /// Returns false once the worker has stopped, after close(), Terminate or an error in evaluating the script.
+    bool IsRunning() const;
+
+signals:
+    /// The worker script has called postMessage.
+    void Message(const QVariant &message);
+
+    /// The worker script threw an uncaught exception.
+    void Error(const QString &message);
+
+private slots:
+    void OnMessage(const QVariant &message);
+    void OnError(const QString &message);
+    void OnPrint(const QString &message);
+
+private:
+    QString name_;
+    ScriptWorkerThread *thread_;
+};
@@ -4,6 +4,7 @@
 #include "MumblePlugin.h"
 #include "MumbleData.h"
 #include "CeltCodec.h"
+#include "OpusCodec.h"
 #include "celt/celt.h"
 
 #include "Framework.h"
@@ -11,18 +12,54 @@
 #include "AudioAPI.h"
 #include "CoreDefines.h"
 #include "LoggingFunctions.h"
+#include "Math/MathBuildConfig.h"
 
 #include <QMutexLocker>
 
+#ifdef MATH_SSE2
+#include <emmintrin.h>
+#endif
+
 namespace MumbleAudio
 {
+    // Returns the sum of the squares of the 16-bit samples, for the VAD level.
+    static float SumOfSquares(const short *samples, int count)
+    {
+        int i = 0;
+        float sum = 0.0f;
+#ifdef MATH_SSE2
+        __m128 sum4 = _mm_setzero_ps();
+        for (; i + 8 <= count; i += 8)
+        {
+            // Sign extend the samples to 32 bits, as the squares of two of them overflow the 32-bit sums of _mm_madd_epi16.
+            __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(samples + i));
+            __m128 lo = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(s, s), 16));
+            __m128 hi = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(s, s), 16));
+            sum4 = _mm_add_ps(sum4, _mm_add_ps(_mm_mul_ps(lo, lo), _mm_mul_ps(hi, hi)));
+        }
+        float sums[4];
+        _mm_storeu_ps(sums, sum4);
+        sum = (sums[0] + sums[1]) + (sums[2] + sums[3]);
+#endif
+        for (; i < count; ++i)
+        {
+            int value = samples[i];
+            sum += static_cast<float>(value * value);
+        }
+        return sum;
+    }
+
     AudioProcessor::AudioProcessor(Framework *framework_, MumbleAudio::AudioSettings settings) :
         LC("[MumbleAudioProcessor]: "),
         framework(framework_),
         codec(new CeltCodec()),
+        opusCodec(new OpusCodec()),
+        pendingOpusSpeech(false),
         speexPreProcessor(0),
+        listenerPosition(float3::zero),
         outputPreProcessed(false),
         preProcessorReset(true),
+        opusEncoding(false),
         isSpeech(false),
         wasPreviousSpeech(false),
         holdFrames(0),
@@ -109,6 +146,7 @@ namespace MumbleAudio
         {
             QMutexLocker lockInput(&mutexInput);
             inputAudioStates.clear();
+            SAFE_DELETE(opusCodec);
             framework = 0;
         }
 
@@ -124,13 +162,17 @@ namespace MumbleAudio
         // This function processed queued PCM frames with speexdsp and celt at ~60fps and adds them to
         // a pending encoded frames list to be sent out to the network from the main thread.
         // Mutex mutexOutputPCM and mutexOutputEncoded are the main locks for queuing the frames back and forth.
-        if (!codec)
+        if (!codec || !opusCodec)
             return;
 
+        ProcessInputAudio();
+
         int localGain = 0;
         
         mutexAudioSettings.lockForRead();
         int localQualityBitrate = qualityBitrate;
+        int localFramesPerPacket = qualityFramesPerPacket;
+        bool localOpus = opusEncoding;
         int localSuppress = audioSettings.suppression;
         bool detectVAD = audioSettings.transmitMode == TransmitVoiceActivity;
         bool localPreProcess = outputPreProcessed;
@@ -164,13 +206,7 @@ namespace MumbleAudio
 
                 if (detectVAD)
                 {
-                    float sum = 1.0f;
-                    short *data = (short*)&pcmFrame.data[0];
-                    for (int index=0; index<MUMBLE_AUDIO_SAMPLES_IN_FRAME; index++)
-                    {
-                        int value = data[index];
-                        sum += static_cast<float>(value * value);
-                    }
+                    float sum = 1.0f + SumOfSquares((const short*)&pcmFrame.data[0], MUMBLE_AUDIO_SAMPLES_IN_FRAME);
 
                     levelPeakMic = qMax(20.0f * log10f(sqrtf(sum / static_cast<float>(MUMBLE_AUDIO_SAMPLES_IN_FRAME)) / 32768.0f), -96.0f);
                     levelPeakMic = qMax(levelPeakMic - localGain, -96.0f);
@@ -198,38 +234,36 @@ namespace MumbleAudio
             }
 
             // Encode
-            unsigned char compressedBuffer[512];
-            int bytesWritten = codec->Encode(pcmFrame, compressedBuffer, localQualityBitrate);
-            if (bytesWritten > 0)
+            bool speech = isSpeech || wasPreviousSpeech;
+            if (localOpus)
             {
-                QByteArray encodedFrame(reinterpret_cast<const char*>(compressedBuffer), bytesWritten);
-
-                // If speech, add to encoded frames. But first
-                // append any 'prediction' buffered frames so start of sentences
-                // can get to the outgoing buffer safely.
-                if (isSpeech || wasPreviousSpeech)
-                {    
-                    if (detectVAD && pendingVADPreBuffer.size() > 0)
-                    {
-                        encodedFrames.append(pendingVADPreBuffer);
-                        pendingVADPreBuffer.clear();
-                    }
-                    encodedFrames.push_back(encodedFrame);
-                }
-                // If voice activity detection is enabled but this is 
-                // not speech, add the frame to the VAD 'prediction' buffer.
-                else if (detectVAD && !isSpeech && !wasPreviousSpeech)
+                // Opus encodes the frames of a whole packet at once, 20-60 ms by the frames per packet.
+                pendingOpusPCM.data.insert(pendingOpusPCM.data.end(), pcmFrame.data.begin(), pcmFrame.data.end());
+                pendingOpusSpeech = pendingOpusSpeech || speech;
+                uint packetBytes = OpusCodec::FramesPerPacket(localFramesPerPacket) * MUMBLE_AUDIO_SAMPLES_IN_FRAME * MUMBLE_AUDIO_SAMPLE_WIDTH / 8;
+                while (pendingOpusPCM.data.size() >= packetBytes)
                 {
-                    while(pendingVADPreBuffer.size() >= 5)
-                    {
-                        if (!pendingVADPreBuffer.isEmpty())
-                            pendingVADPreBuffer.removeFirst();
-                        else
-                            break;
-                    }
-                    pendingVADPreBuffer.push_back(encodedFrame);
+                    SoundBuffer packetPCM;
+                    packetPCM.data.assign(pendingOpusPCM.data.begin(), pendingOpusPCM.data.begin() + packetBytes);
+                    pendingOpusPCM.data.erase(pendingOpusPCM.data.begin(), pendingOpusPCM.data.begin() + packetBytes);
+
+                    unsigned char compressedBuffer[MUMBLE_OPUS_MAX_PACKET_SIZE];
+                    int bytesWritten = opusCodec->Encode(packetPCM, compressedBuffer, MUMBLE_OPUS_MAX_PACKET_SIZE, localQualityBitrate);
+                    // DTX leaves out the packets of silence.
+                    if (bytesWritten > MUMBLE_OPUS_DTX_PACKET_SIZE)
+                        QueueEncodedFrame(QByteArray(reinterpret_cast<const char*>(compressedBuffer), bytesWritten), pendingOpusSpeech, detectVAD, encodedFrames);
+                    else if (bytesWritten < 0)
+                        LogError(LC + "opus encoding error: " + QString(opus_strerror(bytesWritten)));
+                    pendingOpusSpeech = false;
                 }
             }
+            else
+            {
+                unsigned char compressedBuffer[512];
+                int bytesWritten = codec->Encode(pcmFrame, compressedBuffer, localQualityBitrate);
+                if (bytesWritten > 0)
+                    QueueEncodedFrame(QByteArray(reinterpret_cast<const char*>(compressedBuffer), bytesWritten), speech, detectVAD, encodedFrames);
+            }
             wasPreviousSpeech = isSpeech;
         }
         pendingPCMFrames.clear();
@@ -242,6 +276,35 @@ namespace MumbleAudio
         mutexOutputEncoded.unlock();
     }
 
+    void AudioProcessor::QueueEncodedFrame(const QByteArray &encodedFrame, bool speech, bool detectVAD, QList<QByteArray> &encodedFrames)
+    {
+        // If speech, add to encoded frames. But first
+        // append any 'prediction' buffered frames so start of sentences
+        // can get to the outgoing buffer safely.
+        if (speech)
+        {    
+            if (detectVAD && pendingVADPreBuffer.size() > 0)
+            {
+                encodedFrames.append(pendingVADPreBuffer);
+                pendingVADPreBuffer.clear();
+            }
+            encodedFrames.push_back(encodedFrame);
+        }
+        // If voice activity detection is enabled but this is 
+        // not speech, add the frame to the VAD 'prediction' buffer.
+        else if (detectVAD)
+        {
+            while(pendingVADPreBuffer.size() >= 5)
+            {
+                if (!pendingVADPreBuffer.isEmpty())
+                    pendingVADPreBuffer.removeFirst();
+                else
+                    break;
+            }
+            pendingVADPreBuffer.push_back(encodedFrame);
+        }
+    }
+
     void AudioProcessor::GetLevels(float &peakMic, bool &speaking)
     {
         // The peak mic level and is speaking are written in a mutexOutputPCM lock.
@@ -423,11 +486,11 @@ namespace MumbleAudio
         return threadSettings;
     }
 
-    ByteArrayVector AudioProcessor::ProcessOutputAudio()
+    MumbleNetwork::VoicePacketInfo AudioProcessor::ProcessOutputAudio()
     {
         // This function is called in the main thread
         if (!framework)
-            return ByteArrayVector();
+            return MumbleNetwork::VoicePacketInfo(ByteArrayVector());
 
         // Get recorded PCM frames from AudioAPI.
         PROFILE(Mumble_ProcessOutputAudio_Queue_Encoding)
@@ -459,12 +522,16 @@ namespace MumbleAudio
 
         // No queued encoded frames for network.
         if (pendingEncodedFrames.size() == 0)
-            return ByteArrayVector();
+            return MumbleNetwork::VoicePacketInfo(ByteArrayVector());
 
         // Get packet count per frame.
         mutexAudioSettings.lockForRead();
         int framesPerPacket = qualityFramesPerPacket;
+        bool localOpus = opusEncoding;
         mutexAudioSettings.unlock();
+
+        // Each encoded Opus frame is a whole packet of 'framesPerPacket' frames.
+        int maxPendingFrames = localOpus ? 10 : framesPerPacket * 10;
         
          /** Ensure we are not buffing faster than what is sent to network. Increasing the frames per packet (automatically) is not a good thing. 
             This happens when our main thread gets blocked and our encoded frames gets filled.
@@ -480,14 +547,14 @@ namespace MumbleAudio
             @todo Remove OpenAL usage for input microphone and 3D positional playback. Thread microphone by using WASAPI on windows and something on linux/mac. 
             Research our options for threaded recording/playback without using Framework or AudioAPI pointers in this audio processing thread.
         */
-        if (pendingEncodedFrames.size() > framesPerPacket * 10)
+        if (pendingEncodedFrames.size() > maxPendingFrames)
         {
             // Do some helpful info logs if we are auto increasing frames per packet count.
             if (framesPerPacket > 8)
-                LogInfo(LC + QString("Output buffer full with %1/%2 frames, frames/packet is %3").arg(pendingEncodedFrames.size()).arg(framesPerPacket*10).arg(framesPerPacket));
+                LogInfo(LC + QString("Output buffer full with %1/%2 frames, frames/packet is %3").arg(pendingEncodedFrames.size()).arg(maxPendingFrames).arg(framesPerPacket));
                 
             // Remove oldest frames to get the buffer to a acceptable size.
-            while(pendingEncodedFrames.size() > framesPerPacket * 10)
+            while(pendingEncodedFrames.size() > maxPendingFrames)
             {
                 if (!pendingEncodedFrames.isEmpty())
                     pendingEncodedFrames.removeFirst();
@@ -499,7 +566,7 @@ namespace MumbleAudio
             bufferFullFrames++;
             if (bufferFullFrames >= 5 && qualityFramesPerPacket <= 8)
             {
-                LogInfo(LC + QString("Output buffer full with %1/%2 frames, auto increasing frames/packet to %3 due to potential main thread blockage.").arg(pendingEncodedFrames.size()).arg(framesPerPacket*10).arg(framesPerPacket+2));
+                LogInfo(LC + QString("Output buffer full with %1/%2 frames, auto increasing frames/packet to %3 due to potential main thread blockage.").arg(pendingEncodedFrames.size()).arg(maxPendingFrames).arg(framesPerPacket+2));
                 
                 bufferFullFrames = 0;
                 qualityFramesPerPacket += 2;
@@ -513,6 +580,8 @@ namespace MumbleAudio
         
         // If we are speaking send out full 'framesPerPacket' frames. If we are not speaking send whatever is left in the buffer but max is still 'framesPerPacket'.
         int framesToPacket = (isSpeech || wasPreviousSpeech) ? framesPerPacket : qMin(framesPerPacket, pendingEncodedFrames.size());
+        if (localOpus)
+            framesToPacket = 1;
 
         // Enough encoded frames in the ready queue
         if (pendingEncodedFrames.size() >= framesToPacket)
@@ -525,10 +594,20 @@ namespace MumbleAudio
                 else
                     break;
             }
-            return sendOutNow;
+            MumbleNetwork::VoicePacketInfo packetInfo(sendOutNow);
+            if (localOpus)
+            {
+                const QByteArray &packet = sendOutNow.front();
+                int samples = opus_packet_get_nb_samples(reinterpret_cast<const unsigned char*>(packet.constData()), packet.size(), MUMBLE_AUDIO_SAMPLE_RATE);
+                packetInfo.isOpus = true;
+                packetInfo.numFrames = qMax(samples / MUMBLE_AUDIO_SAMPLES_IN_FRAME, 1);
+                // The last packet of speech tells the others that we stopped talking.
+                packetInfo.isTerminator = !isSpeech && !wasPreviousSpeech && pendingEncodedFrames.isEmpty();
+            }
+            return packetInfo;
         }
         else
-            return ByteArrayVector();
+            return MumbleNetwork::VoicePacketInfo(ByteArrayVector());
     }
 
     void AudioProcessor::PlayInputAudio(MumblePlugin *mumble)
@@ -551,6 +630,8 @@ namespace MumbleAudio
             LogDebug(LC + "PlayInputAudio tryLock(15) failed to acquire lock!");
             return;
         }
+        if (allowReceivingPositional)
+            listenerPosition = framework->Audio()->ListenerPosition();
         if (inputAudioStates.empty())
         {
             mutexInput.unlock();
@@ -636,64 +717,69 @@ namespace MumbleAudio
                 }
             }
             
-            // Iterate audio frames for user
-            AudioFrameDeque::iterator frameEnd = userAudioState.frames.end();
-            for (AudioFrameDeque::iterator frameIter = userAudioState.frames.begin(); frameIter != frameEnd; ++frameIter)
+            // Play all the pending frames of the user in one buffer, as each OpenAL buffer and AudioAsset has a cost
+            // in the main thread. The frames are all of the same format, see MumbleDefines.h.
+            SoundBuffer frame = userAudioState.frames.front();
+            if (userAudioState.frames.size() > 1)
             {
-                const SoundBuffer &frame = (*frameIter);
-                if (userAudioState.soundChannel.get())
+                size_t frameBytes = 0;
+                for (AudioFrameDeque::const_iterator frameIter = userAudioState.frames.begin(); frameIter != userAudioState.frames.end(); ++frameIter)
+                    frameBytes += frameIter->data.size();
+                frame.data.reserve(frameBytes);
+                for (AudioFrameDeque::const_iterator frameIter = userAudioState.frames.begin() + 1; frameIter != userAudioState.frames.end(); ++frameIter)
+                    frame.data.insert(frame.data.end(), frameIter->data.begin(), frameIter->data.end());
+            }
+
+            if (userAudioState.soundChannel.get())
+            {
+                // Create new AudioAsset to be added to the sound channels playback buffer.
+                AudioAssetPtr audioAsset = framework->Audio()->CreateAudioAssetFromSoundBuffer(frame);
+                if (audioAsset.get())
                 {
-                    // Create new AudioAsset to be added to the sound channels playback buffer.
-                    AudioAssetPtr audioAsset = framework->Audio()->CreateAudioAssetFromSoundBuffer(frame);
-                    if (audioAsset.get())
-                    {
-                        // Update user speaking state and add buffer to the sound channel.
-                        user->SetAndEmitSpeaking(true); // Only emits on change.
-                        userAudioState.soundChannel->AddBuffer(audioAsset);
-                    }
-                    else
-                    {
-                        LogDebug(LC + QString("Failed to create new sound buffer for user id %1, clearing all his input frames").arg(userId));
-                        
-                        // Something went wrong, eg. out of memory, release "broken" SoundChannel and its data.
-                        // Bail out as otherwise the next buffer creation will most likely fail the same way.
-                        user->SetAndEmitSpeaking(false); // Only emits on change.
-                        userAudioState.soundChannel->Stop();
-                        userAudioState.soundChannel.reset();
-                        break;
-                    }
+                    // Update user speaking state and add buffer to the sound channel.
+                    user->SetAndEmitSpeaking(true); // Only emits on change.
+                    userAudioState.soundChannel->AddBuffer(audioAsset);
                 }
                 else
                 {
-                    // Create sound channel with initial audio frame. We should get here only once per this for loop.
-                    userAudioState.soundChannel = framework->Audio()->PlaySoundBuffer(frame, SoundChannel::Voice);
-                    if (userAudioState.soundChannel.get())
+                    LogDebug(LC + QString("Failed to create new sound buffer for user id %1, clearing all his input frames").arg(userId));
+                    
+                    // Something went wrong, eg. out of memory, release "broken" SoundChannel and its data.
+                    user->SetAndEmitSpeaking(false); // Only emits on change.
+                    userAudioState.soundChannel->Stop();
+                    userAudioState.soundChannel.reset();
+                }
+            }
+            else
+            {
+                // Create sound channel with the initial audio.
+                userAudioState.soundChannel = framework->Audio()->PlaySoundBuffer(frame, SoundChannel::Voice);
+                if (userAudioState.soundChannel.get())
+                {
+                    // Set positional if available and our local settings allows it
+                    if (allowReceivingPositional && userAudioState.isPositional)
                     {
-                        // Set positional if available and our local settings allows it
-                        if (allowReceivingPositional && userAudioState.isPositional)
+                        userAudioState.soundChannel->SetPositional(true);
+                        userAudioState.soundChannel->SetRange(static_cast<float>(positionalInnerRange), static_cast<float>(positionalOuterRange), 1.0f);
+                        userAudioState.soundChannel->SetPosition(userAudioState.pos);
+                        if (!user->isMe)
                         {
-                            userAudioState.soundChannel->SetPositional(true);
-                            userAudioState.soundChannel->SetRange(static_cast<float>(positionalInnerRange), static_cast<float>(positionalOuterRange), 1.0f);
-                            userAudioState.soundChannel->SetPosition(userAudioState.pos);
-                            if (!user->isMe)
-                            {
-                                user->pos = userAudioState.pos;
-                                user->SetAndEmitPositional(true);
-                            }
+                            user->pos = userAudioState.pos;
+                            user->SetAndEmitPositional(true);
                         }
-                        else
+                    }
+                    else
+                    {
+                        userAudioState.soundChannel->SetPositional(false);
+                        if (!user->isMe && user->isPositional)
                         {
-                            userAudioState.soundChannel->SetPositional(false);
-                            if (!user->isMe && user->isPositional)
-                            {
-                                user->pos = float3::zero;
-                                user->SetAndEmitPositional(false);
-                            }
+                            user->pos = float3::zero;
+                            user->SetAndEmitPositional(false);
                         }
-
-                        // Update user speaking state. Only emits on change.
-                        user->SetAndEmitSpeaking(true); 
                     }
+
+                    // Update user speaking state. Only emits on change.
+                    user->SetAndEmitSpeaking(true); 
                 }
             }
 
@@ -710,6 +796,8 @@ namespace MumbleAudio
         QMutexLocker lock(&mutexInput);
         if (inputAudioStates.size() > 0)
             inputAudioStates.clear();
+        if (opusCodec)
+            opusCodec->RemoveDecoders();
     }
 
     void AudioProcessor::ClearInputAudio(uint userId)
@@ -727,6 +815,8 @@ namespace MumbleAudio
             userState.soundChannel.reset();
             inputAudioStates.erase(userStateIter);
         }
+        if (opusCodec)
+            opusCodec->RemoveDecoder(userId);
     }
 
     void AudioProcessor::ClearOutputAudio()
@@ -794,9 +884,26 @@ namespace MumbleAudio
         }
     }
 
-    void AudioProcessor::OnAudioReceived(uint userId, uint seq, ByteArrayVector frames, bool isPositional, float3 pos)
+    void AudioProcessor::SetOpusEncoding(bool enabled)
     {
-        if (!codec)
+        mutexAudioSettings.lockForWrite();
+        bool changed = opusEncoding != enabled;
+        opusEncoding = enabled;
+        mutexAudioSettings.unlock();
+
+        if (!changed)
+            return;
+        LogInfo(LC + (enabled ? "Server selected the Opus codec for outgoing audio." : "Server selected the CELT codec for outgoing audio."));
+
+        // Frames encoded with the other codec can not be sent anymore.
+        pendingOpusPCM.data.clear();
+        pendingOpusSpeech = false;
+        ClearOutputAudio();
+    }
+
+    void AudioProcessor::OnAudioReceived(uint userId, uint seq, ByteArrayVector frames, bool isOpus, bool isPositional, float3 pos)
+    {
+        if (!codec || !opusCodec)
             return;
 
         // This function is called in the audio thread
@@ -815,38 +922,110 @@ namespace MumbleAudio
         }
         mutexAudioMute.unlock();
 
+        mutexAudioSettings.lockForRead();
+        bool allowReceivingPositional = audioSettings.allowReceivingPositional;
+        float positionalOuterRange = static_cast<float>(audioSettings.outerRange);
+        mutexAudioSettings.unlock();
+
+        qint64 nowMs = static_cast<qint64>(inputClock.elapsed() / 1000);
+
         QMutexLocker lockBuffers(&mutexInput);
+
+        // Positional speakers beyond the outer range would be played silent, don't even buffer their frames for decoding.
+        // Once the speaker comes back in range the jitter buffer starts a new talk spurt.
+        if (isPositional && allowReceivingPositional && positionalOuterRange > 0.0f && 
+            pos.DistanceSq(listenerPosition) > positionalOuterRange * positionalOuterRange)
+        {
+            AudioStateMap::iterator userStateIter = inputAudioStates.find(userId);
+            if (userStateIter != inputAudioStates.end())
+                userStateIter->second.pos = pos;
+            return;
+        }
+
         UserAudioState &userAudioState = inputAudioStates[userId]; // Creates a new one if does not exist already.
         
         // If you change audio output settings in Mumble or various other things, sequence will reset to 0.
-        // If this is received we need to reset our tracking sequence number as well.
+        // If this is received we need to restart the playout as well.
         if (seq == 0)
-            userAudioState.lastSeq = 0;
-
-        // If this sequence is older than what has been previously received, ignore the frames
-        if (userAudioState.lastSeq > seq)
-            return;
+            userAudioState.jitterBuffer.Reset();
 
         // Update the users audio state struct
-        userAudioState.lastSeq = seq;
         userAudioState.isPositional = isPositional;
         if (userAudioState.isPositional)
             userAudioState.pos = pos;
 
-        for (ByteArrayVector::const_iterator frameIter = frames.begin(); frameIter != frames.end(); ++frameIter)
+        // The jitter buffer puts the packets back to order and decides when they are decoded in ProcessInputAudio.
+        // A CELT packet carries one 10 ms frame per encoded frame, an Opus packet any number of them.
+        for (uint frameIndex = 0; frameIndex < frames.size(); ++frameIndex)
         {
-            const QByteArray &inputFrame = (*frameIter);
-            SoundBuffer soundFrame;
-
-            int celtResult = codec->Decode(inputFrame.data(), inputFrame.size(), soundFrame);
-            if (celtResult == CELT_OK)
-                userAudioState.frames.push_back(soundFrame);
+            JitterPacket packet;
+            packet.isOpus = isOpus;
+            packet.data = frames[frameIndex];
+            if (isOpus)
+            {
+                int samples = opus_packet_get_nb_samples(reinterpret_cast<const unsigned char*>(packet.data.constData()), packet.data.size(), MUMBLE_AUDIO_SAMPLE_RATE);
+                if (samples < MUMBLE_AUDIO_SAMPLES_IN_FRAME)
+                {
+                    if (samples < 0)
+                        LogError(LC + "opus decoding error: " + QString(opus_strerror(samples)));
+                    continue;
+                }
+                packet.seq = seq;
+                packet.numFrames = samples / MUMBLE_AUDIO_SAMPLES_IN_FRAME;
+            }
             else
+                packet.seq = seq + frameIndex;
+            userAudioState.jitterBuffer.Put(packet, nowMs);
+        }
+    }
+
+    void AudioProcessor::ProcessInputAudio()
+    {
+        // This function is called in the audio thread
+        qint64 nowMs = static_cast<qint64>(inputClock.elapsed() / 1000);
+
+        QMutexLocker lockBuffers(&mutexInput);
+        for (AudioStateMap::iterator iter = inputAudioStates.begin(); iter != inputAudioStates.end(); ++iter)
+        {
+            uint userId = iter->first;
+            UserAudioState &userAudioState = iter->second;
+
+            JitterPacket packet;
+            for (;;)
             {
-                PrintCeltError(celtResult, true);
-                userAudioState.frames.clear();
-                return;
-            }            
+                JitterBuffer::Result result = userAudioState.jitterBuffer.Next(nowMs, packet);
+                if (result == JitterBuffer::Idle)
+                    break;
+
+                SoundBuffer soundFrame;
+                if (result == JitterBuffer::Lost)
+                {
+                    if (userAudioState.jitterBuffer.IsOpus())
+                    {
+                        if (opusCodec->Conceal(userId, soundFrame) > 0)
+                            userAudioState.frames.push_back(soundFrame);
+                    }
+                    else if (codec->Conceal(soundFrame) == CELT_OK)
+                        userAudioState.frames.push_back(soundFrame);
+                    continue;
+                }
+
+                if (packet.isOpus)
+                {
+                    int samples = opusCodec->Decode(userId, packet.data.data(), packet.data.size(), soundFrame);
+                    if (samples > 0)
+                        userAudioState.frames.push_back(soundFrame);
+                    else if (samples < 0)
+                        LogError(LC + "opus decoding error: " + QString(opus_strerror(samples)));
+                    continue;
+                }
+
+                int celtResult = codec->Decode(packet.data.data(), packet.data.size(), soundFrame);
+                if (celtResult == CELT_OK)
+                    userAudioState.frames.push_back(soundFrame);
+                else
+                    PrintCeltError(celtResult, true);
+            }
         }
     }
     
@@ -8,6 +8,8 @@
 
 #include "SoundBuffer.h"
 #include "SoundChannel.h"
+#include "JitterBuffer.h"
+#include "mumble/Timer.h"
 
 #include "speex/speex_preprocess.h"
 
@@ -27,16 +29,15 @@ namespace MumbleAudio
     {
         UserAudioState ()
         {
-            lastSeq = 0;
             isPositional = false;
             pos = float3::zero;
             frames.clear();
             soundChannel.reset();
         }
 
-        uint lastSeq;
         bool isPositional;
         float3 pos;
+        JitterBuffer jitterBuffer;
         AudioFrameDeque frames;
         SoundChannelPtr soundChannel;
     };
@@ -63,7 +64,7 @@ namespace MumbleAudio
         void timerEvent(QTimerEvent *event);
 
     public slots:
-        ByteArrayVector ProcessOutputAudio();
+        MumbleNetwork::VoicePacketInfo ProcessOutputAudio();
         void SetOutputAudioMuted(bool outputAudioMuted_);
 
         /// Plays all input audio frames from other users. 
@@ -85,8 +86,12 @@ namespace MumbleAudio
         // Calling it is safe but -1 will be returned.
         int CodecBitStreamVersion();
 
+        // Selects Opus or CELT for the outgoing audio, as told by the server. Incoming
+        // audio is decoded with the codec of each packet.
+        void SetOpusEncoding(bool enabled);
+
     private slots:
-        void OnAudioReceived(uint userId, uint seq, ByteArrayVector frames, bool isPositional, float3 pos);
+        void OnAudioReceived(uint userId, uint seq, ByteArrayVector frames, bool isOpus, bool isPositional, float3 pos);
         void OnResetFramesPerPacket();
         
     private:
@@ -95,6 +100,13 @@ namespace MumbleAudio
 
         void PrintCeltError(int celtError, bool decoding);
 
+        // Decodes the frames that are due from the jitter buffers into the users' playback frames,
+        // concealing the lost ones. Called in the audio thread.
+        void ProcessInputAudio();
+
+        // Adds an encoded frame to the frames to send if speech, otherwise to the VAD prebuffer.
+        void QueueEncodedFrame(const QByteArray &encodedFrame, bool speech, bool detectVAD, QList<QByteArray> &encodedFrames);
+
         // Below floats and booleans need mutexOutputPCM lock for reading. Use the GetLevels function.
         float levelPeakMic;
         float levelMic;
@@ -107,6 +119,13 @@ namespace MumbleAudio
         // Used in audio thread without locks.
         CeltCodec *codec;
 
+        // Used in audio thread, the decoders with mutexInput.
+        OpusCodec *opusCodec;
+
+        // Used in audio thread without locks. The PCM frames and speech state of the next Opus packet.
+        SoundBuffer pendingOpusPCM;
+        bool pendingOpusSpeech;
+
         // Used in audio thread without locks.
         SpeexPreprocessState *speexPreProcessor;
         
@@ -116,6 +135,13 @@ namespace MumbleAudio
         // Used in both main and audio thread with mutexInput.
         AudioStateMap inputAudioStates;
 
+        // Used in both main and audio thread with mutexInput. Set from the main thread for dropping
+        // the frames of positional speakers out of range.
+        float3 listenerPosition;
+
+        // Used in audio thread without locks. Playout clock of the jitter buffers.
+        Mumble::Timer inputClock;
+
         // Used in both main and audio thread with mutexOutputEncoded.
         QList<QByteArray> pendingEncodedFrames;
         
@@ -137,6 +163,9 @@ namespace MumbleAudio
         // Used in main thread without locks.
         bool preProcessorReset;
 
+        // Used in both main and audio thread with mutexAudioSettings.
+        bool opusEncoding;
+
         // Various mutexes for sharing data between audio and main thread.
         QMutex mutexInput;
         QMutex mutexOutputPCM;
@@ -58,6 +58,12 @@ namespace MumbleAudio
         return celt_decode(Decoder(), (const unsigned char*)data, dataLength, (celt_int16*)&soundFrame.data[0], MUMBLE_AUDIO_SAMPLES_IN_FRAME);
     }
 
+    int CeltCodec::Conceal(SoundBuffer &soundFrame)
+    {
+        // A null packet makes celt_decode conceal the loss.
+        return Decode(0, 0, soundFrame);
+    }
+
     CELTEncoder *CeltCodec::Encoder()
     {
         if (!encoder)
@@ -29,6 +29,9 @@ namespace MumbleAudio
         int Encode(const SoundBuffer &pcmFrame, unsigned char *compressed, int bitrate);
         int Decode(const char *data, int dataLength, SoundBuffer &soundFrame);
 
+        // Conceals a lost frame, continuing from the previous decoded frames.
+        int Conceal(SoundBuffer &soundFrame);
+
     private:
         CELTMode *celtMode;
         CELTEncoder *encoder;
@@ -0,0 +1,157 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#include "JitterBuffer.h"
+
+#include <cmath>
+
+namespace MumbleAudio
+{
+    static const int cFrameMs = 10;
+
+    // Limits of the adaptive playout delay.
+    static const int cMinDelayMs = 20;
+    static const int cMaxDelayMs = 300;
+
+    // Buffered audio beyond the target delay after which the buffer skips ahead.
+    static const int cMaxExcessMs = 100;
+
+    // Frames concealed after the last buffered packet before the talk spurt is considered to have ended.
+    static const int cMaxConcealedFrames = 3;
+
+    // Largest gap in the sequence numbers that is concealed as lost packets. A larger one, f.ex. when the sender
+    // was silent, starts a new talk spurt without concealment.
+    static const uint cMaxLostFrames = 12;
+
+    // Packets this far behind the playout are taken as a reset of the sender's sequence numbers.
+    static const uint cSequenceResetFrames = 1000;
+
+    // Playback that has fallen this far behind, f.ex. when the thread was blocked, catches up at once.
+    static const qint64 cMaxPlayoutLagMs = 200;
+
+    static const size_t cMaxPackets = 100;
+
+    JitterBuffer::JitterBuffer() :
+        playing(false),
+        playSeq(0),
+        playClockMs(0),
+        waitStartMs(0),
+        concealedInRow(0),
+        lastIsOpus(false),
+        hasTransit(false),
+        lastTransitMs(0),
+        jitterMs(0.f)
+    {
+    }
+
+    void JitterBuffer::Reset()
+    {
+        packets.clear();
+        playing = false;
+        concealedInRow = 0;
+        hasTransit = false;
+    }
+
+    int JitterBuffer::TargetDelayMs() const
+    {
+        int delay = cMinDelayMs + static_cast<int>(3.f * jitterMs + 0.5f);
+        return qBound(cMinDelayMs, delay, cMaxDelayMs);
+    }
+
+    int JitterBuffer::BufferedFrames() const
+    {
+        int frames = 0;
+        for (PacketMap::const_iterator iter = packets.begin(); iter != packets.end(); ++iter)
+            frames += iter->second.numFrames;
+        return frames;
+    }
+
+    void JitterBuffer::Put(const JitterPacket &packet, qint64 nowMs)
+    {
+        if (playing && packet.seq + packet.numFrames <= playSeq)
+        {
+            if (playSeq - packet.seq < cSequenceResetFrames)
+                return; // Late
+            Reset();
+        }
+
+        // The transit time has an unknown constant offset, only its variation matters.
+        qint64 transitMs = nowMs - static_cast<qint64>(packet.seq) * cFrameMs;
+        if (hasTransit)
+        {
+            float d = static_cast<float>(qAbs(transitMs - lastTransitMs));
+            jitterMs += (d - jitterMs) / 16.f;
+        }
+        lastTransitMs = transitMs;
+        hasTransit = true;
+
+        if (!playing && packets.empty())
+            waitStartMs = nowMs;
+        packets.insert(std::make_pair(packet.seq, packet));
+        while (packets.size() > cMaxPackets)
+            packets.erase(packets.begin());
+    }
+
+    JitterBuffer::Result JitterBuffer::Next(qint64 nowMs, JitterPacket &packet)
+    {
+        if (!playing)
+        {
+            if (packets.empty())
+                return Idle;
+            // Start the talk spurt once the buffered audio covers the target delay, or the first packet has waited that long.
+            int targetMs = TargetDelayMs();
+            if (BufferedFrames() * cFrameMs < targetMs && nowMs - waitStartMs < targetMs)
+                return Idle;
+            playing = true;
+            playSeq = packets.begin()->first;
+            playClockMs = nowMs;
+            concealedInRow = 0;
+        }
+
+        if (playClockMs > nowMs)
+            return Idle;
+        if (nowMs - playClockMs > cMaxPlayoutLagMs)
+            playClockMs = nowMs;
+
+        // Drop the packets whose frames have all been played.
+        while (!packets.empty() && packets.begin()->first + packets.begin()->second.numFrames <= playSeq)
+            packets.erase(packets.begin());
+
+        // Shrink the delay by skipping a packet when much more than the target is buffered.
+        if (packets.size() > 1 && BufferedFrames() * cFrameMs > TargetDelayMs() + cMaxExcessMs)
+        {
+            packets.erase(packets.begin());
+            playSeq = packets.begin()->first;
+        }
+
+        if (packets.empty() || packets.begin()->first > playSeq)
+        {
+            if (!packets.empty() && packets.begin()->first - playSeq > cMaxLostFrames)
+            {
+                // The sender was silent in between, continue from its next packet.
+                playSeq = packets.begin()->first;
+                concealedInRow = 0;
+            }
+            else
+            {
+                if (packets.empty() && concealedInRow >= cMaxConcealedFrames)
+                {
+                    // The talk spurt has ended.
+                    playing = false;
+                    return Idle;
+                }
+                ++concealedInRow;
+                ++playSeq;
+                playClockMs += cFrameMs;
+                return Lost;
+            }
+        }
+
+        packet = packets.begin()->second;
+        packets.erase(packets.begin());
+        playSeq = qMax(playSeq, packet.seq + static_cast<uint>(packet.numFrames));
+        playClockMs += packet.numFrames * cFrameMs;
+        concealedInRow = 0;
+        lastIsOpus = packet.isOpus;
+        return Packet;
+    }
+}
@@ -0,0 +1,74 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#pragma once
+
+#include <QByteArray>
+#include <QtGlobal>
+
+#include <map>
+
+/// @cond PRIVATE
+namespace MumbleAudio
+{
+    // A received encoded voice packet. The sequence numbers count 10 ms frames, as in the Mumble protocol.
+    struct JitterPacket
+    {
+        JitterPacket() : seq(0), numFrames(1), isOpus(false) {}
+
+        uint seq;
+        int numFrames;
+        bool isOpus;
+        QByteArray data;
+    };
+
+    // Adaptive jitter buffer of the voice packets of one user.
+    // Packets are put in as they arrive and taken out when their 10 ms frames are due for playback. The playout
+    // delay follows the measured jitter of arrival: each talk spurt starts once the buffer covers the target delay,
+    // and the buffer skips ahead when it holds much more. Frames that have not arrived in time are to be concealed.
+    class JitterBuffer
+    {
+    public:
+        enum Result
+        {
+            Idle,       // Nothing is due yet.
+            Packet,     // The next packet is due, decode it.
+            Lost        // The next frame is due but missing, conceal one frame.
+        };
+
+        JitterBuffer();
+
+        // Adds a packet that arrived at nowMs. Duplicates and packets whose frames have already been played are dropped.
+        void Put(const JitterPacket &packet, qint64 nowMs);
+
+        // Returns what to play next at nowMs. Call until it returns Idle.
+        Result Next(qint64 nowMs, JitterPacket &packet);
+
+        // Drops the buffered packets and restarts the playout, f.ex. when the sender's sequence numbers reset.
+        void Reset();
+
+        // Returns the current target playout delay in milliseconds.
+        int TargetDelayMs() const;
+
+        // Returns whether the last packet, and so the frames to conceal, is Opus.
+        bool IsOpus() const { return lastIsOpus; }
+
+    private:
+        int BufferedFrames() const;
+
+        typedef std::map<uint, JitterPacket> PacketMap;
+        PacketMap packets;
+
+        bool playing;
+        uint playSeq; // Sequence number of the next frame to play.
+        qint64 playClockMs; // Time when the playSeq frame is due.
+        qint64 waitStartMs; // Arrival of the first packet of a talk spurt that has not started yet.
+        int concealedInRow;
+        bool lastIsOpus;
+
+        // Interarrival jitter estimate as in RFC 3550.
+        bool hasTransit;
+        qint64 lastTransitMs;
+        float jitterMs;
+    };
+}
+/// @endcond
@@ -164,6 +164,9 @@ namespace MumbleAudio
     static int MUMBLE_AUDIO_FRAMES_PER_PACKET_LOW = 6; // mumble original 6
     static int MUMBLE_AUDIO_FRAMES_PER_PACKET_BALANCED = 4; // mumble original 2
     static int MUMBLE_AUDIO_FRAMES_PER_PACKET_ULTRA = 2; // mumble original 1
+
+    static int MUMBLE_OPUS_DTX_PACKET_SIZE = 2; // Opus packets of this size or less are silence with DTX, and are not sent
+    static const int MUMBLE_OPUS_MAX_PACKET_SIZE = 960; // Fits a 60 ms packet of MUMBLE_AUDIO_QUALITY_ULTRA, and fits in a voice packet
 }
 
 #ifdef Q_OS_WIN
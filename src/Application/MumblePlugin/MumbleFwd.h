@@ -11,4 +11,5 @@ namespace MumbleAudio
 {
     class AudioProcessor;
     class CeltCodec;
+    class OpusCodec;
 }
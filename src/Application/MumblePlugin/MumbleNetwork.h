@@ -286,6 +286,9 @@ namespace MumbleNetwork
         {
             isLoopBack = false;
             isPositional = false;
+            isOpus = false;
+            isTerminator = false;
+            numFrames = 1;
             encodedFrames = encodedFrames_;
             pos = float3::zero;
         }
@@ -294,6 +297,12 @@ namespace MumbleNetwork
         bool isPositional;
         float3 pos;
 
+        // Opus packets hold one encoded packet of numFrames 10 ms frames, by which the sequence number advances.
+        // The terminator flag tells the other clients that the user stopped talking.
+        bool isOpus;
+        bool isTerminator;
+        int numFrames;
+
         std::vector<QByteArray> encodedFrames;
     };
 
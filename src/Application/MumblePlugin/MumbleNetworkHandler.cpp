@@ -325,7 +325,7 @@ void MumbleNetworkHandler::OnConnected()
     messageAuth.set_username(utf8(connectionInfo.username));
     messageAuth.set_password(utf8(connectionInfo.password));
     messageAuth.add_celt_versions(codecBitStreamVersion);
-    messageAuth.set_opus(false);
+    messageAuth.set_opus(true);
     SendTCP(Authenticate, messageAuth);
 
     InitUDP();
@@ -448,13 +448,14 @@ void MumbleNetworkHandler::OnUDPSocketRead()
         {
             case UDPVoiceCELTAlpha:
             case UDPVoiceCELTBeta:
+            case UDPVoiceOpus:
             {
                 uint userId = 0;
                 uint seq = 0;
                 stream >> userId;
                 stream >> seq;
 
-                HandleVoicePacket(userId, seq, stream);
+                HandleVoicePacket(userId, seq, stream, messageType == UDPVoiceOpus);
                 break;
             }
             case UDPPing:
@@ -462,10 +463,9 @@ void MumbleNetworkHandler::OnUDPSocketRead()
                 // No op?
                 break;
             }
-            case UDPVoiceOpus:
             case UDPVoiceSpeex:
             {
-                // No op in Tundra, we only support celt audio
+                // No op in Tundra, we only support celt and opus audio
                 break;
             }
             default:
@@ -572,13 +572,13 @@ void MumbleNetworkHandler::SendVoicePacket(VoicePacketInfo &packetInfo)
     int messageFlags = 0;
     if (packetInfo.isLoopBack)
         messageFlags = 0x1f;
-    messageFlags |= (UDPVoiceCELTAlpha << 5);
+    messageFlags |= ((packetInfo.isOpus ? UDPVoiceOpus : UDPVoiceCELTAlpha) << 5);
 
     char data[1024];
     data[0] = static_cast<unsigned char>(messageFlags);
 
     Mumble::PacketDataStream stream(data + 1, 1023);
-    PrepareVoicePacket(packetInfo.encodedFrames, stream);
+    PrepareVoicePacket(packetInfo, stream);
 
     if (packetInfo.isPositional)
     {
@@ -598,13 +598,29 @@ void MumbleNetworkHandler::SendVoicePacket(VoicePacketInfo &packetInfo)
         SendTCP(UDPTunnel, data, stream.size() + 1);
 }
 
-void MumbleNetworkHandler::PrepareVoicePacket(ByteArrayVector &encodedFrames, Mumble::PacketDataStream &stream)
+void MumbleNetworkHandler::PrepareVoicePacket(VoicePacketInfo &packetInfo, Mumble::PacketDataStream &stream)
 {
     // Sequence number
     stream << frameOutSequenceNumber;
-    frameOutSequenceNumber++;
 
+    ByteArrayVector &encodedFrames = packetInfo.encodedFrames;
+    if (packetInfo.isOpus)
+    {
+        // One Opus packet with a varint header of its size and the terminator bit.
+        // Like Mumble, advance the sequence number by the 10 ms frames in the packet.
+        frameOutSequenceNumber += packetInfo.numFrames;
+        const QByteArray &qba = encodedFrames.front();
+        quint64 header = static_cast<quint64>(qba.size());
+        if (packetInfo.isTerminator)
+            header |= 0x2000;
+        stream << header;
+        stream.append(qba.constData(), qba.size());
+        return;
+    }
+
+    // CELT frames are 10 ms each, the sequence number advances by one for each of them as in Mumble.
     int frameCount = encodedFrames.size();
+    frameOutSequenceNumber += frameCount;
     for(int i=0; i<frameCount; ++i)
     {
         const QByteArray &qba = encodedFrames.at(i);
@@ -713,14 +729,14 @@ void MumbleNetworkHandler::HandleMessage(const TCPMessageType id, QByteArray &bu
             Mumble::PacketDataStream stream(buffer.constData(), buffer.length());
             u8 firstByte = stream.next8();
             UDPMessageType messageType = static_cast<UDPMessageType>((firstByte >> 5) & 0x07);
-            if (messageType == UDPVoiceCELTAlpha || messageType == UDPVoiceCELTBeta)
+            if (messageType == UDPVoiceCELTAlpha || messageType == UDPVoiceCELTBeta || messageType == UDPVoiceOpus)
             {
                 uint userId = 0;
                 uint seq = 0;
                 stream >> userId;
                 stream >> seq;
 
-                HandleVoicePacket(userId, seq, stream);
+                HandleVoicePacket(userId, seq, stream, messageType == UDPVoiceOpus);
             }
             break;
         }
@@ -823,8 +839,11 @@ void MumbleNetworkHandler::HandleMessage(const TCPMessageType id, QByteArray &bu
         }
         case MumbleNetwork::CodecVersion:
         {
-            // Ignored because we only have one version of celt codec in Tundra.
+            // The server picks Opus when all clients support it, otherwise the CELT versions are ignored
+            // because we only have one version of celt codec in Tundra.
             // You must have >= 1.2.2 murmur server to have proper codecs for VOIP to work.
+            MumbleProto::CodecVersion msg = ParseMessage<MumbleProto::CodecVersion>(buffer);
+            emit CodecChanged(msg.has_opus() && msg.opus());
             break;
         }
         default:
@@ -835,11 +854,22 @@ void MumbleNetworkHandler::HandleMessage(const TCPMessageType id, QByteArray &bu
     }
 }
 
-void MumbleNetworkHandler::HandleVoicePacket(uint userId, uint seq, Mumble::PacketDataStream &stream)
+void MumbleNetworkHandler::HandleVoicePacket(uint userId, uint seq, Mumble::PacketDataStream &stream, bool isOpus)
 {
     // Read audio frames
     ByteArrayVector frames;
     bool lastFrame = false;
+    if (isOpus)
+    {
+        // One packet after a varint header of its size and the terminator bit.
+        quint64 header = 0;
+        stream >> header;
+        uint frameSize = static_cast<uint>(header & 0x1fff);
+        if (frameSize > 0 && frameSize <= stream.left())
+            frames.push_back(QByteArray(stream.charPtr(), frameSize));
+        stream.skip(frameSize);
+        lastFrame = true;
+    }
     while(!lastFrame && stream.isValid())
     {
         u8 header = stream.next8();
@@ -863,7 +893,7 @@ void MumbleNetworkHandler::HandleVoicePacket(uint userId, uint seq, Mumble::Pack
     }
 
     if (frames.size() > 0)
-        emit AudioReceived(userId, seq, frames, isPositional, pos);
+        emit AudioReceived(userId, seq, frames, isOpus, isPositional, pos);
 }
 
 bool MumbleNetworkHandler::TCPAlive()
@@ -75,7 +75,10 @@ signals:
     void UserUpdate(MumbleNetwork::MumbleUserState userState);
     void UserLeft(uint id, uint actorId, bool banned, bool kicked, QString reason);
     
-    void AudioReceived(uint userId, uint seq, ByteArrayVector frames, bool isPositional, float3 pos);
+    void AudioReceived(uint userId, uint seq, ByteArrayVector frames, bool isOpus, bool isPositional, float3 pos);
+
+    // Emitted when the server tells which codec the clients should send with, Opus or CELT.
+    void CodecChanged(bool opus);
 
 private slots:
     void OnConnected();
@@ -96,10 +99,10 @@ private:
     // Handle incoming voice data stream from user. Handles both TCP and
     // UDP voice traffic after initial header information is parsed out
     // in their respective handlers.
-    void HandleVoicePacket(uint userId, uint seq, Mumble::PacketDataStream &stream);
+    void HandleVoicePacket(uint userId, uint seq, Mumble::PacketDataStream &stream, bool isOpus);
 
     // Prepares encoded packets into a PacketDataStream.
-    void PrepareVoicePacket(ByteArrayVector &encodedFrames, Mumble::PacketDataStream &stream);
+    void PrepareVoicePacket(MumbleNetwork::VoicePacketInfo &packetInfo, Mumble::PacketDataStream &stream);
 
     QSslSocket *tcp;
     QUdpSocket *udp;
@@ -238,7 +238,8 @@ void MumblePlugin::Connect(QString address, int port, QString username, QString
     connect(network_, SIGNAL(UserUpdate(MumbleNetwork::MumbleUserState)), SLOT(OnUserUpdate(MumbleNetwork::MumbleUserState)), Qt::QueuedConnection);
 
     // Handle audio signals from network thread to audio thread.
-    connect(network_, SIGNAL(AudioReceived(uint, uint, ByteArrayVector, bool, float3)), audio_, SLOT(OnAudioReceived(uint, uint, ByteArrayVector, bool, float3)), Qt::QueuedConnection);
+    connect(network_, SIGNAL(AudioReceived(uint, uint, ByteArrayVector, bool, bool, float3)), audio_, SLOT(OnAudioReceived(uint, uint, ByteArrayVector, bool, bool, float3)), Qt::QueuedConnection);
+    connect(network_, SIGNAL(CodecChanged(bool)), audio_, SLOT(SetOpusEncoding(bool)), Qt::QueuedConnection);
     
     audio_->start(QThread::HighPriority);
     network_->start(QThread::HighPriority);
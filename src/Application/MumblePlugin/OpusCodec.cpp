@@ -0,0 +1,121 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#include "OpusCodec.h"
+#include "CoreTypes.h"
+
+#include "SoundBuffer.h"
+
+namespace MumbleAudio
+{
+    OpusCodec::OpusCodec() :
+        encoder(0),
+        encoderBitrate(0)
+    {
+    }
+
+    OpusCodec::~OpusCodec()
+    {
+        if (encoder)
+        {
+            opus_encoder_destroy(encoder);
+            encoder = 0;
+        }
+        RemoveDecoders();
+    }
+
+    int OpusCodec::FramesPerPacket(int framesPerPacket)
+    {
+        if (framesPerPacket >= 6)
+            return 6;
+        if (framesPerPacket >= 4)
+            return 4;
+        if (framesPerPacket >= 2)
+            return 2;
+        return 1;
+    }
+
+    int OpusCodec::Encode(const SoundBuffer &pcmFrames, unsigned char *compressed, int maxBytes, int bitrate)
+    {
+        OpusEncoder *enc = Encoder();
+        if (!enc)
+            return OPUS_ALLOC_FAIL;
+
+        if (bitrate != encoderBitrate)
+        {
+            opus_encoder_ctl(enc, OPUS_SET_BITRATE(bitrate));
+            encoderBitrate = bitrate;
+        }
+
+        int samples = static_cast<int>(pcmFrames.data.size()) / (MUMBLE_AUDIO_SAMPLE_WIDTH / 8);
+        return opus_encode(enc, (const opus_int16*)&pcmFrames.data[0], samples, compressed, maxBytes);
+    }
+
+    int OpusCodec::Decode(uint userId, const char *data, int dataLength, SoundBuffer &soundFrame)
+    {
+        OpusDecoder *&decoder = decoders[userId];
+        if (!decoder)
+        {
+            int error = OPUS_OK;
+            decoder = opus_decoder_create(MUMBLE_AUDIO_SAMPLE_RATE, 1, &error);
+            if (error != OPUS_OK)
+            {
+                decoders.erase(userId);
+                return error;
+            }
+        }
+
+        // A packet holds at most 120 milliseconds.
+        const int maxSamples = MUMBLE_AUDIO_SAMPLE_RATE / 1000 * 120;
+        soundFrame.data.resize(maxSamples * MUMBLE_AUDIO_SAMPLE_WIDTH / 8);
+        soundFrame.frequency = MUMBLE_AUDIO_SAMPLE_RATE;
+        soundFrame.is16Bit = true;
+        soundFrame.stereo = false;
+
+        // A null packet makes opus_decode conceal the loss for the given number of samples.
+        int samples = opus_decode(decoder, (const unsigned char*)data, dataLength, (opus_int16*)&soundFrame.data[0], data ? maxSamples : MUMBLE_AUDIO_SAMPLES_IN_FRAME, 0);
+        soundFrame.data.resize(samples > 0 ? samples * MUMBLE_AUDIO_SAMPLE_WIDTH / 8 : 0);
+        return samples;
+    }
+
+    int OpusCodec::Conceal(uint userId, SoundBuffer &soundFrame)
+    {
+        return Decode(userId, 0, 0, soundFrame);
+    }
+
+    void OpusCodec::RemoveDecoder(uint userId)
+    {
+        std::map<uint, OpusDecoder*>::iterator iter = decoders.find(userId);
+        if (iter != decoders.end())
+        {
+            opus_decoder_destroy(iter->second);
+            decoders.erase(iter);
+        }
+    }
+
+    void OpusCodec::RemoveDecoders()
+    {
+        for (std::map<uint, OpusDecoder*>::iterator iter = decoders.begin(); iter != decoders.end(); ++iter)
+            opus_decoder_destroy(iter->second);
+        decoders.clear();
+    }
+
+    OpusEncoder *OpusCodec::Encoder()
+    {
+        if (!encoder)
+        {
+            int error = OPUS_OK;
+            encoder = opus_encoder_create(MUMBLE_AUDIO_SAMPLE_RATE, 1, OPUS_APPLICATION_VOIP, &error);
+            if (error != OPUS_OK)
+            {
+                encoder = 0;
+                return 0;
+            }
+            // Variable bitrate for speech, and discontinuous transmission to send next to nothing during silence.
+            opus_encoder_ctl(encoder, OPUS_SET_VBR(1));
+            opus_encoder_ctl(encoder, OPUS_SET_SIGNAL(OPUS_SIGNAL_VOICE));
+            opus_encoder_ctl(encoder, OPUS_SET_DTX(1));
+            encoderBitrate = 0;
+        }
+        return encoder;
+    }
+}
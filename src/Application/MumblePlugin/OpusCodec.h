@@ -0,0 +1,54 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#pragma once
+
+#include "MumbleFwd.h"
+#include "MumbleDefines.h"
+
+#include <QObject>
+#include <opus/opus.h>
+
+#include <map>
+
+class SoundBuffer;
+
+/// @cond PRIVATE
+namespace MumbleAudio
+{
+    class OpusCodec : public QObject
+    {
+    Q_OBJECT
+
+    public:
+        OpusCodec();
+        ~OpusCodec();
+
+        // Returns the number of frames of MUMBLE_AUDIO_SAMPLES_IN_FRAME samples that is a valid Opus frame size
+        // closest to framesPerPacket without exceeding it: 1, 2, 4 or 6.
+        static int FramesPerPacket(int framesPerPacket);
+
+        // Encodes the PCM of 1, 2, 4 or 6 frames to one packet with variable bitrate.
+        // Returns the size of the packet, or a negative Opus error code. With DTX a packet of
+        // MUMBLE_OPUS_DTX_PACKET_SIZE bytes or less is silence that need not be sent.
+        int Encode(const SoundBuffer &pcmFrames, unsigned char *compressed, int maxBytes, int bitrate);
+
+        // Decodes a packet from the user. Each user has an own decoder, as Opus decoding depends on the previous packets.
+        // Returns the number of samples decoded, or a negative Opus error code.
+        int Decode(uint userId, const char *data, int dataLength, SoundBuffer &soundFrame);
+
+        // Conceals a lost frame of MUMBLE_AUDIO_SAMPLES_IN_FRAME samples from the user.
+        int Conceal(uint userId, SoundBuffer &soundFrame);
+
+        // Frees the decoder of the user, or of all users.
+        void RemoveDecoder(uint userId);
+        void RemoveDecoders();
+
+    private:
+        OpusEncoder *Encoder();
+
+        OpusEncoder *encoder;
+        std::map<uint, OpusDecoder*> decoders;
+        int encoderBitrate;
+    };
+}
+/// @endcond
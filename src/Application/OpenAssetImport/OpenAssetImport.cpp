@@ -14,13 +14,18 @@ Licensed under the MIT license:
 #include "OgreMaterialAsset.h"
 #include "LoggingFunctions.h"
 #include "Math/MathFunc.h"
+#include "Math/float3x4.h"
 #include "AssetAPI.h"
+#include "AssetCache.h"
 #include "IAssetTransfer.h"
 #include "IAsset.h"
+#include "JobSystem.h"
 
 #include <Ogre.h>
+#include <QDataStream>
+#include <QFile>
+#include <QPointer>
 
-#include <assimp/DefaultLogger.hpp>
 #include <assimp/Importer.hpp>
 #include <assimp/cimport.h>
 #include <assimp/scene.h>
@@ -30,6 +35,58 @@ Licensed under the MIT license:
 
 int OpenAssetConverter::msBoneCount = 0;
 
+namespace
+{
+    /// Version of the converted mesh data stored to the cache. Increment when the conversion or the data layout changes.
+    const quint32 cConvertedMeshVersion = 1;
+}
+
+/// Reads and post-processes a file with Assimp in a worker thread, and converts the scene to the Ogre mesh in the main thread.
+struct OpenAssetImport::ImportJob : public IJob
+{
+    ImportJob(OpenAssetConverter *converter_, OgreMeshAsset *asset_, const u8 *data, size_t numBytes) :
+        IJob("OpenAssetImport_Import"),
+        converter(converter_),
+        asset(asset_->shared_from_this()),
+        mesh(asset_->ogreMesh),
+        fileData(reinterpret_cast<const char *>(data), (int)numBytes),
+        fileName(asset_->Name()),
+        diskSource(asset_->DiskSource()),
+        importedScene(0)
+    {
+    }
+
+    void Run()
+    {
+        importedScene = OpenAssetConverter::ReadScene(importer, reinterpret_cast<const u8 *>(fileData.constData()), fileData.size(), fileName, diskSource, errorMessage);
+    }
+
+    void Finished()
+    {
+        shared_ptr<OgreMeshAsset> meshAsset = dynamic_pointer_cast<OgreMeshAsset>(asset.lock());
+        if (!converter || !meshAsset || meshAsset->ogreMesh != mesh)
+        {
+            // Unloaded or loaded again meanwhile.
+            if (converter)
+                converter->deleteLater();
+            return;
+        }
+        if (!errorMessage.isEmpty())
+            LogInfo(errorMessage);
+        converter->Convert(importedScene, fileName, diskSource, mesh);
+    }
+
+    QPointer<OpenAssetConverter> converter;
+    AssetWeakPtr asset;
+    Ogre::MeshPtr mesh;
+    QByteArray fileData;
+    QString fileName;
+    QString diskSource;
+    Assimp::Importer importer;
+    const aiScene *importedScene; ///< Owned by importer.
+    QString errorMessage;
+};
+
 OpenAssetImport::OpenAssetImport() :
     IModule("OpenAssetImport")
 {
@@ -55,11 +112,83 @@ void OpenAssetImport::OnAssetCreated(AssetPtr asset)
 }
 
 
+QString OpenAssetImport::ConvertedMeshCacheRef(const QString &contentHash)
+{
+    return "assimpmesh-" + contentHash + ".bin";
+}
+
 void OpenAssetImport::OnConversionRequest(OgreMeshAsset *asset, const u8 *data, size_t len)
 {
     OpenAssetConverter *converter = new OpenAssetConverter(GetFramework());
+    converter->setParent(this);
+    connect(converter, SIGNAL(destroyed(QObject *)), SLOT(OnConverterDestroyed(QObject *)));
+    // Store the converted mesh before the asset generates its LOD levels to it.
+    connect(converter, SIGNAL(ConversionDone(bool)), SLOT(OnConversionDone(bool)));
     connect(converter, SIGNAL(ConversionDone(bool)), asset, SLOT(OnAssimpConversionDone(bool)), Qt::UniqueConnection);
-    converter->Convert(data, len, asset->Name(), asset->DiskSource(), asset->ogreMesh);
+
+    PendingConversion conversion;
+    conversion.asset = asset->shared_from_this();
+    conversions[converter] = conversion;
+
+    // Restore the result of an earlier conversion of the same data from the cache if there is one.
+    AssetCache *cache = assetAPI->Cache();
+    if (cache && data && len > 0)
+    {
+        const QString contentHash = AssetCache::ComputeContentHash(data, len);
+        const QString cachedFile = cache->FindInCache(ConvertedMeshCacheRef(contentHash));
+        QFile file(cachedFile);
+        if (!cachedFile.isEmpty() && file.open(QIODevice::ReadOnly))
+        {
+            const QByteArray cachedData = file.readAll();
+            file.close();
+            // The content hash is left empty meanwhile, as the result is in the cache already.
+            if (converter->ConvertFromCache(cachedData, asset->ogreMesh))
+                return;
+            LogWarning("OpenAssetImport: Discarding invalid cached conversion of " + asset->Name() + ".");
+        }
+        conversions[converter].contentHash = contentHash;
+    }
+
+    // Read the file in a worker thread if there are any, as Assimp's post-processing of a large file can take seconds.
+    // Assimp runs the post-processing steps of a file in one thread, so the conversions of different files run in parallel.
+    JobSystem *jobs = GetFramework()->Jobs();
+    if (jobs && jobs->NumWorkers() > 0 && data && len > 0)
+    {
+        jobs->Schedule(MAKE_SHARED(ImportJob, converter, asset, data, len), true);
+        return;
+    }
+
+    Assimp::Importer importer;
+    QString errorMessage;
+    const aiScene *importedScene = OpenAssetConverter::ReadScene(importer, data, len, asset->Name(), asset->DiskSource(), errorMessage);
+    if (!errorMessage.isEmpty())
+        LogInfo(errorMessage);
+    converter->Convert(importedScene, asset->Name(), asset->DiskSource(), asset->ogreMesh);
+}
+
+void OpenAssetImport::OnConverterDestroyed(QObject *converter)
+{
+    conversions.remove(static_cast<OpenAssetConverter *>(converter));
+}
+
+void OpenAssetImport::OnConversionDone(bool success)
+{
+    OpenAssetConverter *converter = qobject_cast<OpenAssetConverter *>(sender());
+    if (!converter || !conversions.contains(converter))
+        return;
+    PendingConversion conversion = conversions.take(converter);
+    converter->deleteLater();
+
+    shared_ptr<OgreMeshAsset> meshAsset = dynamic_pointer_cast<OgreMeshAsset>(conversion.asset.lock());
+    AssetCache *cache = assetAPI->Cache();
+    if (!success || !meshAsset || conversion.contentHash.isEmpty() || !cache)
+        return;
+
+    std::vector<u8> meshData;
+    if (!meshAsset->SerializeTo(meshData, "") || meshData.empty())
+        return;
+    const QByteArray cachedData = converter->SerializeForCache(meshData);
+    cache->StoreAsset(reinterpret_cast<const u8 *>(cachedData.constData()), cachedData.size(), ConvertedMeshCacheRef(conversion.contentHash));
 }
 
 OpenAssetConverter::OpenAssetConverter(Framework *fw) :
@@ -414,13 +543,9 @@ void GetBasePose(const aiScene * sc, const aiNode * nd)
     }
 }
 
-void OpenAssetConverter::Convert(const u8 *data_, size_t numBytes, const QString &fileName, const QString &diskSource, Ogre::MeshPtr mesh)
+const aiScene *OpenAssetConverter::ReadScene(Assimp::Importer &importer, const u8 *data_, size_t numBytes, const QString &fileName, const QString &diskSource, QString &errorMessage)
 {
-    meshCreated = false;
-    LogInfo("AssImp importer: Converting file:" +fileName.toStdString());
-    Assimp::DefaultLogger::create("asslogger.log",Assimp::Logger::VERBOSE);
-    mAnimationSpeedModifier = 1.0f;
-    Assimp::Importer importer;
+    // Note: no Assimp::DefaultLogger here, as it is global and this is called in several worker threads at once.
 //    bool searchFromIndex = false;
 
     /// NOTICE!!!
@@ -464,25 +589,36 @@ void OpenAssetConverter::Convert(const u8 *data_, size_t numBytes, const QString
 
     //assimp importer looks for a loader to support the file extension specified by hint 
     QString hint = fileName.right(fileName.length() - fileName.lastIndexOf('.')-1);
-    scene = importer.ReadFileFromMemory(reinterpret_cast<const void*>(data_), numBytes, pFlags, hint.toStdString().c_str());
+    const aiScene *importedScene = 0;
+    if (data_ && numBytes > 0)
+        importedScene = importer.ReadFileFromMemory(reinterpret_cast<const void*>(data_), numBytes, pFlags, hint.toStdString().c_str());
 
-    if(!scene)
+    if(!importedScene)
     {
-        LogInfo("AssImp importer::convert: Failed to read file:" +fileName.toStdString()+ " from memory: ");
-        LogInfo(importer.GetErrorString());
-        LogInfo("AssImp importer::convert: Trying to load data from file:" +fileName.toStdString());
-		
+        errorMessage = "AssImp importer::convert: Failed to read file:" + fileName + " from memory: " + QString(importer.GetErrorString()) +
+            "\nAssImp importer::convert: Trying to load data from file:" + fileName;
+
         // If the importer failed to read the file from memory,
         // try to read the file again.
-        scene = importer.ReadFile(diskSource.toStdString(), pFlags);
+        if (!diskSource.isEmpty())
+            importedScene = importer.ReadFile(diskSource.toStdString(), pFlags);
+    }
+    return importedScene;
+}
 
-        if(!scene)
-        {
-            LogError("AssImp importer::convert: conversion failed, importer unable to load data from file:" +fileName.toStdString());
-            emit ConversionDone(false);
-            return;
-        }
+void OpenAssetConverter::Convert(const aiScene *importedScene, const QString &fileName, const QString &diskSource, Ogre::MeshPtr mesh)
+{
+    meshCreated = false;
+    mAnimationSpeedModifier = 1.0f;
+    generatedMaterials.clear();
+    scene = importedScene;
+    if(!scene)
+    {
+        LogError("AssImp importer::convert: conversion failed, importer unable to load data from file:" +fileName.toStdString());
+        emit ConversionDone(false);
+        return;
     }
+    LogInfo("AssImp importer: Converting file:" +fileName.toStdString());
 
     if (scene->HasAnimations())
         GetBasePose(scene, scene->mRootNode);
@@ -522,7 +658,6 @@ void OpenAssetConverter::Convert(const u8 *data_, size_t numBytes, const QString
     LoadDataFromNode(scene, scene->mRootNode, diskSource, fileName, mesh);
 
     Ogre::LogManager::getSingleton().logMessage("*** Finished loading ass file ***");
-    Assimp::DefaultLogger::kill();
 
 #ifdef SKELETON_ENABLED
 
@@ -594,6 +729,103 @@ void OpenAssetConverter::Convert(const u8 *data_, size_t numBytes, const QString
         emit ConversionDone(true);
 }
 
+namespace
+{
+    void WriteColour(QDataStream &stream, const Ogre::ColourValue &colour)
+    {
+        stream << colour.r << colour.g << colour.b << colour.a;
+    }
+
+    void ReadColour(QDataStream &stream, Ogre::ColourValue &colour)
+    {
+        stream >> colour.r >> colour.g >> colour.b >> colour.a;
+    }
+}
+
+QByteArray OpenAssetConverter::SerializeForCache(const std::vector<u8> &meshData) const
+{
+    QByteArray cachedData;
+    QDataStream stream(&cachedData, QIODevice::WriteOnly);
+    stream.setVersion(QDataStream::Qt_4_6);
+    stream << cConvertedMeshVersion << (quint32)generatedMaterials.size();
+    for (size_t i = 0; i < generatedMaterials.size(); ++i)
+    {
+        const GeneratedMaterial &desc = generatedMaterials[i];
+        stream << QByteArray(desc.name.c_str(), (int)desc.name.size()) << desc.vertexColor;
+        WriteColour(stream, desc.ambient);
+        WriteColour(stream, desc.diffuse);
+        WriteColour(stream, desc.specular);
+        WriteColour(stream, desc.emissive);
+        stream << desc.shininess << desc.twoSided << desc.hasTexture << desc.texturePath;
+    }
+    stream << QByteArray::fromRawData(reinterpret_cast<const char *>(&meshData[0]), (int)meshData.size());
+    return cachedData;
+}
+
+bool OpenAssetConverter::ConvertFromCache(const QByteArray &cachedData, Ogre::MeshPtr mesh)
+{
+    meshCreated = false;
+    generatedMaterials.clear();
+    if (mesh.isNull())
+        return false;
+
+    QDataStream stream(cachedData);
+    stream.setVersion(QDataStream::Qt_4_6);
+    quint32 version = 0, numMaterials = 0;
+    stream >> version >> numMaterials;
+    if (version != cConvertedMeshVersion)
+        return false;
+
+    std::vector<GeneratedMaterial> materials;
+    for (quint32 i = 0; i < numMaterials && stream.status() == QDataStream::Ok; ++i)
+    {
+        GeneratedMaterial desc;
+        QByteArray name;
+        stream >> name >> desc.vertexColor;
+        desc.name = Ogre::String(name.constData(), name.size());
+        ReadColour(stream, desc.ambient);
+        ReadColour(stream, desc.diffuse);
+        ReadColour(stream, desc.specular);
+        ReadColour(stream, desc.emissive);
+        stream >> desc.shininess >> desc.twoSided >> desc.hasTexture >> desc.texturePath;
+        materials.push_back(desc);
+    }
+    QByteArray meshData;
+    stream >> meshData;
+    if (stream.status() != QDataStream::Ok || meshData.isEmpty())
+        return false;
+
+    try
+    {
+#include "DisableMemoryLeakCheck.h"
+        Ogre::DataStreamPtr meshStream(new Ogre::MemoryDataStream((void*)meshData.constData(), meshData.size(), false));
+#include "EnableMemoryLeakCheck.h"
+        Ogre::MeshSerializer serializer;
+        serializer.importMesh(meshStream, mesh.getPointer());
+    }
+    catch(const Ogre::Exception &e)
+    {
+        LogError("AssImp importer: Failed to load the cached conversion of " + mesh->getName() + ": " + e.what());
+        mesh->unload();
+        return false;
+    }
+
+    LogInfo("AssImp importer: Loaded the cached conversion of " + mesh->getName());
+    generatedMaterials = materials;
+    for (size_t i = 0; i < generatedMaterials.size(); ++i)
+    {
+        const GeneratedMaterial &desc = generatedMaterials[i];
+        if (!desc.vertexColor && !Ogre::MaterialManager::getSingleton().getByName(desc.name, Ogre::ResourceGroupManager::DEFAULT_RESOURCE_GROUP_NAME).isNull())
+            continue; // Generated already by an earlier conversion of the same file.
+        CreateMaterialAsset(CreateMaterial(desc));
+    }
+
+    meshCreated = true;
+    if(PendingTextures())
+        emit ConversionDone(true);
+    return true;
+}
+
 void OpenAssetConverter::ParseAnimation (const aiScene* mScene, int index, aiAnimation* anim)
 {
     UNREFERENCED_PARAM(mScene);
@@ -884,10 +1116,22 @@ Ogre::MaterialPtr OpenAssetConverter::CreateVertexColorMaterial()
     return ogreMaterial;
 }
 
-Ogre::MaterialPtr OpenAssetConverter::CreateMaterial(Ogre::String& matName, const aiMaterial* mat, const QString &meshFileDiskSource, const QString &meshFileName)
+OpenAssetConverter::GeneratedMaterial::GeneratedMaterial() :
+    vertexColor(false),
+    ambient(Ogre::ColourValue::White),
+    diffuse(Ogre::ColourValue::White),
+    specular(Ogre::ColourValue::Black),
+    emissive(Ogre::ColourValue::Black),
+    shininess(0.f),
+    twoSided(false),
+    hasTexture(false)
 {
-    std::ostringstream matname;
-    Ogre::MaterialManager* ogreMaterialMgr =  Ogre::MaterialManager::getSingletonPtr();
+}
+
+OpenAssetConverter::GeneratedMaterial OpenAssetConverter::DescribeMaterial(const Ogre::String& matName, const aiMaterial* mat, const QString &meshFileDiskSource, const QString &meshFileName)
+{
+    GeneratedMaterial desc;
+    desc.name = matName;
     enum aiTextureType Type = aiTextureType_DIFFUSE;
     aiString path;
 //    aiTextureMapping mapping = aiTextureMapping_UV;       // the mapping (should be uv for now)
@@ -905,56 +1149,80 @@ Ogre::MaterialPtr OpenAssetConverter::CreateMaterial(Ogre::String& matName, cons
         //LogInfo("File: " + meshFileName.toStdString() + ". Texture " + Ogre::String(szPath.data) + " for channel " + Ogre::StringConverter::toString(uvindex));
     }
 
-    Ogre::MaterialPtr ogreMaterial = ogreMaterialMgr->create(matName, Ogre::ResourceGroupManager::DEFAULT_RESOURCE_GROUP_NAME, true);
-
     // ambient
     aiColor4D clr(1.0f, 1.0f, 1.0f, 1.0f);
     //Ambient is usually way too low! FIX ME!
     if (mat->GetTexture(Type, 0, &path) != AI_SUCCESS)
         aiGetMaterialColor(mat, AI_MATKEY_COLOR_AMBIENT, &clr);
 
-    ogreMaterial->setAmbient(clr.r, clr.g, clr.b);
+    desc.ambient = Ogre::ColourValue(clr.r, clr.g, clr.b);
 
     // diffuse
     clr = aiColor4D(1.0f, 1.0f, 1.0f, 1.0f);
     if(AI_SUCCESS == aiGetMaterialColor(mat, AI_MATKEY_COLOR_DIFFUSE, &clr))
     {
-        ogreMaterial->setDiffuse(clr.r, clr.g, clr.b, clr.a);
+        desc.diffuse = Ogre::ColourValue(clr.r, clr.g, clr.b, clr.a);
     }
 
     // specular
     clr = aiColor4D(1.0f, 1.0f, 1.0f, 1.0f);
     if(AI_SUCCESS == aiGetMaterialColor(mat, AI_MATKEY_COLOR_SPECULAR, &clr))
     {
-        ogreMaterial->setSpecular(clr.r, clr.g, clr.b, clr.a);
+        desc.specular = Ogre::ColourValue(clr.r, clr.g, clr.b, clr.a);
     }
 
     // emissive
     clr = aiColor4D(1.0f, 1.0f, 1.0f, 1.0f);
     if(AI_SUCCESS == aiGetMaterialColor(mat, AI_MATKEY_COLOR_EMISSIVE, &clr))
     {
-        ogreMaterial->setSelfIllumination(clr.r, clr.g, clr.b);
+        desc.emissive = Ogre::ColourValue(clr.r, clr.g, clr.b);
     }
 
     float fShininess;
     if(AI_SUCCESS == aiGetMaterialFloat(mat, AI_MATKEY_SHININESS, &fShininess))
     {
-        ogreMaterial->setShininess(Ogre::Real(fShininess));
+        desc.shininess = fShininess;
     }
 
-    int two_sided;
+    int two_sided = 0;
     aiGetMaterialInteger(mat, AI_MATKEY_TWOSIDED, &two_sided);
-
-    if (two_sided != 0)
-        ogreMaterial->setCullingMode(Ogre::CULL_NONE);
+    desc.twoSided = (two_sided != 0);
 
     if (mat->GetTexture(Type, 0, &path) == AI_SUCCESS)
     {
+        desc.hasTexture = true;
         //If the assimp scene contains textures they are loaded into the Ogre resource system
         if (!scene->HasTextures())
         {
             QString tex = QString::fromStdString(szPath.data);
-            QString texPath = GetPathToTexture(meshFileName, meshFileDiskSource, tex);
+            desc.texturePath = GetPathToTexture(meshFileName, meshFileDiskSource, tex);
+        }
+    }
+
+    return desc;
+}
+
+Ogre::MaterialPtr OpenAssetConverter::CreateMaterial(const GeneratedMaterial &desc)
+{
+    if (desc.vertexColor)
+        return CreateVertexColorMaterial();
+
+    Ogre::MaterialManager* ogreMaterialMgr =  Ogre::MaterialManager::getSingletonPtr();
+    Ogre::MaterialPtr ogreMaterial = ogreMaterialMgr->create(desc.name, Ogre::ResourceGroupManager::DEFAULT_RESOURCE_GROUP_NAME, true);
+
+    ogreMaterial->setAmbient(desc.ambient.r, desc.ambient.g, desc.ambient.b);
+    ogreMaterial->setDiffuse(desc.diffuse.r, desc.diffuse.g, desc.diffuse.b, desc.diffuse.a);
+    ogreMaterial->setSpecular(desc.specular.r, desc.specular.g, desc.specular.b, desc.specular.a);
+    ogreMaterial->setSelfIllumination(desc.emissive.r, desc.emissive.g, desc.emissive.b);
+    ogreMaterial->setShininess(Ogre::Real(desc.shininess));
+    if (desc.twoSided)
+        ogreMaterial->setCullingMode(Ogre::CULL_NONE);
+
+    if (desc.hasTexture)
+    {
+        if (!desc.texturePath.isEmpty())
+        {
+            QString texPath = desc.texturePath;
             texMatMap.insert(TexMatPair(texPath, ogreMaterial));
             LoadTextureFile(texPath);
         }
@@ -965,6 +1233,17 @@ Ogre::MaterialPtr OpenAssetConverter::CreateMaterial(Ogre::String& matName, cons
     return ogreMaterial;
 }
 
+void OpenAssetConverter::CreateMaterialAsset(const Ogre::MaterialPtr &material)
+{
+    //we must create an OgreMaterialAsset through assetAPI and put the just created
+    //ogre material pointer to it
+    //GenerateTemporaryNonexistingAssetFilename() is used to prevent the "Asset Storage contains ambiguous assets in two different subdirectories!" warning 
+    QString matname = assetAPI->GenerateTemporaryNonexistingAssetFilename(QString::fromStdString(material->getName()));
+    AssetPtr assetPtr = assetAPI->CreateNewAsset("OgreMaterial", matname);
+    OgreMaterialAsset *mat = static_cast<OgreMaterialAsset *>(assetPtr.get());
+    mat->ogreMaterial = material;
+}
+
 bool OpenAssetConverter::CreateVertexData(const Ogre::String& name, const aiNode* pNode, const aiMesh *mesh, Ogre::SubMesh* submesh, Ogre::AxisAlignedBox& mAAB)
 {
     // if animated all submeshes must have bone weights
@@ -1033,42 +1312,43 @@ bool OpenAssetConverter::CreateVertexData(const Ogre::String& name, const aiNode
             );
     Ogre::Real *vbData = static_cast<Ogre::Real*>(vbuf->lock(Ogre::HardwareBuffer::HBL_NORMAL));
 
-    aiMatrix4x4 aiM = mNodeDerivedTransformByName.find(pNode->mName.data)->second;
-
     offset = 0;
-    aiVector3D vect;
     for (unsigned int n=0 ; n<data->vertexCount ; ++n)
     {
         if (mesh->mVertices != NULL)
         {
-            vect.x = mesh->mVertices[n].x;
-            vect.y = mesh->mVertices[n].y;
-            vect.z = mesh->mVertices[n].z;
-#ifndef SKELETONS_ENABLED
-            vect *= aiM;
-#endif
-
-            Ogre::Vector3 position( vect.x, vect.y, vect.z );
-            vbData[offset++] = vect.x;
-            vbData[offset++] = vect.y;
-            vbData[offset++] = vect.z;
-
-            mAAB.merge(position);
+            vbData[offset++] = mesh->mVertices[n].x;
+            vbData[offset++] = mesh->mVertices[n].y;
+            vbData[offset++] = mesh->mVertices[n].z;
         }
-
         if (mesh->mNormals != NULL)
         {
-            vect.x = mesh->mNormals[n].x;
-            vect.y = mesh->mNormals[n].y;
-            vect.z = mesh->mNormals[n].z;
+            vbData[offset++] = mesh->mNormals[n].x;
+            vbData[offset++] = mesh->mNormals[n].y;
+            vbData[offset++] = mesh->mNormals[n].z;
+        }
+    }
+
+    // Transform the interleaved positions and normals to the space of the node at once, with the batch kernels.
+    const int vertexStride = ((mesh->mVertices != NULL ? 3 : 0) + (mesh->mNormals != NULL ? 3 : 0)) * sizeof(float);
+    float3 *positions = (mesh->mVertices != NULL ? reinterpret_cast<float3*>(vbData) : 0);
+    float3 *normals = (mesh->mNormals != NULL ? reinterpret_cast<float3*>(vbData + (positions ? 3 : 0)) : 0);
 #ifndef SKELETONS_ENABLED
-            vect *= aiM;
+    const aiMatrix4x4 &aiM = mNodeDerivedTransformByName.find(pNode->mName.data)->second;
+    const float3x4 nodeTransform(aiM.a1, aiM.a2, aiM.a3, aiM.a4,
+                                 aiM.b1, aiM.b2, aiM.b3, aiM.b4,
+                                 aiM.c1, aiM.c2, aiM.c3, aiM.c4);
+    if (positions)
+        nodeTransform.BatchTransformPos(positions, (int)data->vertexCount, vertexStride);
+    if (normals)
+        nodeTransform.BatchTransformDir(normals, (int)data->vertexCount, vertexStride);
 #endif
-            vbData[offset++] = vect.x;
-            vbData[offset++] = vect.y;
-            vbData[offset++] = vect.z;
+    if (positions)
+        for (unsigned int n=0 ; n<data->vertexCount ; ++n)
+        {
+            const float3 &position = *reinterpret_cast<const float3*>(reinterpret_cast<const u8*>(positions) + vertexStride * n);
+            mAAB.merge(Ogre::Vector3(position.x, position.y, position.z));
         }
-    }
 
     vbuf->unlock();
     data->vertexBufferBinding->setBinding(0, vbuf);
@@ -1224,20 +1504,29 @@ void OpenAssetConverter::LoadDataFromNode(const aiScene* mScene,  const aiNode *
             //checks if the material already exist, it might have been generated before to another submesh.
             matptr = Ogre::MaterialManager::getSingleton().getByName(matName, Ogre::ResourceGroupManager::DEFAULT_RESOURCE_GROUP_NAME);
 
-            if(matptr.isNull())
+            // Record every material the mesh uses, also the ones that exist already, so that they can be restored
+            // when the conversion is loaded from the cache.
+            bool recorded = false;
+            for (size_t i = 0; i < generatedMaterials.size() && !recorded; ++i)
+                recorded = (generatedMaterials[i].name == matName);
+            if (!recorded || matptr.isNull())
             {
-                if(pAIMesh->HasVertexColors(0))
-                    matptr = CreateVertexColorMaterial();
+                GeneratedMaterial desc;
+                if (pAIMesh->HasVertexColors(0))
+                {
+                    desc.name = matName;
+                    desc.vertexColor = true;
+                }
                 else
-                   matptr = CreateMaterial(matName, pAIMaterial, meshFileDiskSource, meshFileName);
-
-                //we must create an OgreMaterialAsset through assetAPI and put the just created
-                //ogre material pointer to it
-                //GenerateTemporaryNonexistingAssetFilename() is used to prevent the "Asset Storage contains ambiguous assets in two different subdirectories!" warning 
-                QString matname = assetAPI->GenerateTemporaryNonexistingAssetFilename(QString::fromStdString(matptr->getName()));
-                AssetPtr assetPtr = assetAPI->CreateNewAsset("OgreMaterial", matname);
-                OgreMaterialAsset *mat = static_cast<OgreMaterialAsset *>(assetPtr.get());
-                mat->ogreMaterial = matptr;
+                    desc = DescribeMaterial(matName, pAIMaterial, meshFileDiskSource, meshFileName);
+
+                if (!recorded)
+                    generatedMaterials.push_back(desc);
+                if (matptr.isNull())
+                {
+                    matptr = CreateMaterial(desc);
+                    CreateMaterialAsset(matptr);
+                }
             }
 
             Ogre::SubMesh* submesh = mesh->createSubMesh(pNode->mName.data + Ogre::StringConverter::toString(idx));
@@ -15,14 +15,18 @@ Licensed under the MIT license:
 #include "OgreMeshAsset.h"
 
 #include <OgreMesh.h>
+#include <OgreColourValue.h>
 #include <OgreMeshSerializer.h>
 
 #include <assimp/vector3.h>
 #include <assimp/matrix4x4.h>
 
 #include <map>
+#include <vector>
 #include <QString>
 #include <QObject>
+#include <QMap>
+#include <QByteArray>
 
 struct aiNode;
 struct aiBone;
@@ -31,6 +35,10 @@ struct aiMaterial;
 struct aiScene;
 struct aiAnimation;
 
+namespace Assimp { class Importer; }
+
+class OpenAssetConverter;
+
 struct boneNode
 {
     aiNode* node;
@@ -58,7 +66,22 @@ public:
 private slots:
     void OnAssetCreated(AssetPtr asset);
     void OnConversionRequest(OgreMeshAsset *asset, const u8 *data, size_t len);
+    /// Stores the result of a finished conversion to the asset cache, and deletes the converter.
+    void OnConversionDone(bool success);
+    void OnConverterDestroyed(QObject *converter);
 private:
+    struct ImportJob;
+
+    /// Returns the asset cache ref of the converted mesh of the source data with the content hash.
+    static QString ConvertedMeshCacheRef(const QString &contentHash);
+
+    struct PendingConversion
+    {
+        AssetWeakPtr asset;
+        QString contentHash; ///< Content hash of the source data, empty if the result is not stored to the cache.
+    };
+    QMap<OpenAssetConverter *, PendingConversion> conversions;
+
     AssetAPI *assetAPI;
 };
 
@@ -68,8 +91,23 @@ class OpenAssetConverter : public QObject
 public:
     OpenAssetConverter(Framework *fw);
     ~OpenAssetConverter();
-    /// Converts collada files to ogre meshes, also parses and generates ogre materials.
-    void Convert(const u8 *data_, size_t numBytes, const QString &fileName, const QString &diskSource, Ogre::MeshPtr mesh);
+
+    /// Reads and post-processes a file with Assimp. Does not touch Ogre or Qt signals, so can be called in a worker thread.
+    /** @param importer The importer that owns the returned scene.
+        @param errorMessage Set to the reason if the read fails.
+        @return The scene, or null if the file couldn't be read. */
+    static const aiScene *ReadScene(Assimp::Importer &importer, const u8 *data_, size_t numBytes, const QString &fileName, const QString &diskSource, QString &errorMessage);
+
+    /// Converts a scene read with ReadScene to ogre meshes, also parses and generates ogre materials.
+    /** @param importedScene The scene, or null if reading the file failed. */
+    void Convert(const aiScene *importedScene, const QString &fileName, const QString &diskSource, Ogre::MeshPtr mesh);
+
+    /// Returns the generated materials and the serialized converted mesh as data to store to the asset cache.
+    QByteArray SerializeForCache(const std::vector<u8> &meshData) const;
+
+    /// Restores a conversion result from data returned by SerializeForCache. Emits ConversionDone once the textures are loaded.
+    /** @return False if the data is not valid, in which case the mesh is left empty and ConversionDone is not emitted. */
+    bool ConvertFromCache(const QByteArray &cachedData, Ogre::MeshPtr mesh);
 
 signals:
     /// This signal is emitted when the ogre mesh is created and generated materials are ready.
@@ -87,7 +125,11 @@ private:
     /// Creates vertex data to submeshes.
     bool CreateVertexData(const Ogre::String& name, const aiNode* pNode, const aiMesh *mesh, Ogre::SubMesh* submesh, Ogre::AxisAlignedBox& mAAB);
     /// Generates the ogre materials.
-    Ogre::MaterialPtr CreateMaterial(Ogre::String& matName, const aiMaterial* mat, const QString &meshFileDiskSource, const QString &meshFileName);
+    struct GeneratedMaterial;
+    /// Reads the properties of a material of the scene.
+    GeneratedMaterial DescribeMaterial(const Ogre::String& matName, const aiMaterial* mat, const QString &meshFileDiskSource, const QString &meshFileName);
+    /// Creates an Ogre material, and starts loading its texture if it has one.
+    Ogre::MaterialPtr CreateMaterial(const GeneratedMaterial &desc);
     Ogre::MaterialPtr CreateVertexColorMaterial();
     Ogre::MaterialPtr CreateMaterialByScript(int index, const aiMaterial* mat);
     void GrabNodeNamesFromNode(const aiScene* mScene,  const aiNode* pNode);
@@ -100,6 +142,26 @@ private:
     void FlagNodeAsNeeded(const char* name);
     bool IsNodeNeeded(const char* name);
     void ParseAnimation (const aiScene* mScene, int index, aiAnimation* anim);
+    /// Creates an OgreMaterialAsset for a generated material.
+    void CreateMaterialAsset(const Ogre::MaterialPtr &material);
+
+    /// The properties of a generated material, recorded also for restoring the conversion from the cache.
+    struct GeneratedMaterial
+    {
+        GeneratedMaterial();
+
+        Ogre::String name;
+        bool vertexColor; ///< If true, the material is the shared vertex color material and the rest are not used.
+        Ogre::ColourValue ambient;
+        Ogre::ColourValue diffuse;
+        Ogre::ColourValue specular;
+        Ogre::ColourValue emissive;
+        float shininess;
+        bool twoSided;
+        bool hasTexture;
+        QString texturePath; ///< Path of the texture to load, or empty if the texture is embedded in the scene.
+    };
+    std::vector<GeneratedMaterial> generatedMaterials;
 
     const aiScene *scene;
     int mLoaderParams;
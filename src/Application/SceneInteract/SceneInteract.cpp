@@ -17,13 +17,25 @@
 #include "Renderer.h"
 #include "OgreWorld.h"
 
+#include <Ogre.h>
+
+/// Interval in seconds of refreshing the raycast while the mouse and the camera stay still, for the entities moving under the mouse.
+static const f64 cRaycastRefreshInterval = 0.1;
+
 SceneInteract::SceneInteract() :
     IModule("SceneInteract"),
     lastX(-1),
     lastY(-1),
     itemUnderMouse(false),
     frameRaycasted(false),
-    lastRaycast(0)
+    lastRaycast(0),
+    raycastX(-1),
+    raycastY(-1),
+    raycastItemUnderMouse(false),
+    raycastWidth(0),
+    raycastHeight(0),
+    raycastViewProj(float4x4::nan),
+    raycastAge(0.0)
 {
 }
 
@@ -39,12 +51,13 @@ void SceneInteract::Initialize()
     framework_->RegisterDynamicObject("sceneinteract", this);
 }
 
-void SceneInteract::Update(f64 /*frameTime*/)
+void SceneInteract::Update(f64 frameTime)
 {
     if (!framework_->IsHeadless())
     {
         PROFILE(SceneInteract_Update);
 
+        raycastAge += frameTime;
         ExecuteRaycast();
         if (lastHitEntity.lock())
             lastHitEntity.lock()->Exec(EntityAction::Local, "MouseHover");
@@ -58,6 +71,18 @@ RaycastResult* SceneInteract::CurrentMouseRaycastResult() const
     return lastRaycast;
 }
 
+bool SceneInteract::IsRaycastValid(const float4x4 &viewProj, int width, int height) const
+{
+    if (!lastRaycast || raycastAge >= cRaycastRefreshInterval)
+        return false;
+    if (lastX != raycastX || lastY != raycastY || itemUnderMouse != raycastItemUnderMouse || width != raycastWidth || height != raycastHeight)
+        return false;
+    // The hit entity may have been removed meanwhile.
+    if (lastRaycast->entity && raycastEntity.expired())
+        return false;
+    return viewProj.Equals(raycastViewProj, 1e-5f);
+}
+
 RaycastResult* SceneInteract::ExecuteRaycast()
 {
     // Return the cached result if already executed this frame.
@@ -65,13 +90,47 @@ RaycastResult* SceneInteract::ExecuteRaycast()
         return lastRaycast;
     frameRaycasted = true;
 
-    OgreWorldPtr world = framework_->GetModule<OgreRenderer::OgreRenderingModule>()->GetRenderer()->GetActiveOgreWorld();
+    OgreRenderer::RendererPtr renderer = framework_->GetModule<OgreRenderer::OgreRenderingModule>()->GetRenderer();
+    OgreWorldPtr world = renderer->GetActiveOgreWorld();
     if (!world)
+    {
+        lastRaycast = 0;
         return 0;
+    }
 
-    lastRaycast = world->Raycast(lastX, lastY);
-    if (!lastRaycast)
+    // Reuse the previous result if nothing that affects it has changed.
+    Ogre::Camera *camera = renderer->MainOgreCamera();
+    const float4x4 viewProj = camera ? float4x4(camera->getProjectionMatrix() * camera->getViewMatrix()) : float4x4::nan;
+    const int width = renderer->WindowWidth();
+    const int height = renderer->WindowHeight();
+    if (camera && IsRaycastValid(viewProj, width, height))
+        return lastRaycast;
+
+    RaycastResult *result = world->Raycast(lastX, lastY);
+    if (!result)
+    {
+        lastRaycast = 0;
         return 0;
+    }
+    raycastResult.entity = result->entity;
+    raycastResult.component = result->component;
+    raycastResult.pos = result->pos;
+    raycastResult.normal = result->normal;
+    raycastResult.submesh = result->submesh;
+    raycastResult.index = result->index;
+    raycastResult.u = result->u;
+    raycastResult.v = result->v;
+    raycastResult.t = result->t;
+    lastRaycast = &raycastResult;
+    raycastEntity = result->entity ? result->entity->shared_from_this() : EntityPtr();
+
+    raycastX = lastX;
+    raycastY = lastY;
+    raycastItemUnderMouse = itemUnderMouse;
+    raycastWidth = width;
+    raycastHeight = height;
+    raycastViewProj = viewProj;
+    raycastAge = 0.0;
     if (!lastRaycast->entity || itemUnderMouse)
     {
         if (!lastHitEntity.expired())
@@ -112,6 +171,12 @@ void SceneInteract::HandleMouseEvent(MouseEvent *e)
     lastY = e->y;
     itemUnderMouse = (e->ItemUnderMouse() != 0);
 
+    // Moves and scrolls only emit signals, so raycast for them only if something listens. Update raycasts once per frame anyway.
+    if (e->eventType == MouseEvent::MouseMove && receivers(SIGNAL(EntityMouseMove(Entity *, Qt::MouseButton, RaycastResult *))) == 0)
+        return;
+    if (e->eventType == MouseEvent::MouseScroll && receivers(SIGNAL(EntityMouseScroll(Entity *, int, RaycastResult *))) == 0)
+        return;
+
     RaycastResult *raycastResult = ExecuteRaycast();
 
     Entity *hitEntity = lastHitEntity.lock().get();
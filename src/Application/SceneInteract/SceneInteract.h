@@ -20,11 +20,16 @@
 #include "SceneFwd.h"
 #include "InputFwd.h"
 #include "CoreDefines.h"
+#include "IRenderer.h"
+#include "Math/float4x4.h"
 
 #include <QObject>
 
 /// Transforms generic mouse and keyboard input events on scene entities to input-related entity actions and signals.
-/** Performs a raycast to the mouse position each frame and executes entity actions depending current input.
+/** Performs a raycast to the mouse position and executes entity actions depending current input. The raycast is done at
+    most once per frame, and its result is reused while the mouse position, the camera and the window size stay the same,
+    except that it is refreshed periodically for the entities moving under the mouse. A mouse move or scroll
+    event does not raycast if nothing is connected to the corresponding signal.
 
     <b>Local</b> entity actions executed to the hit entity:
     <ul>
@@ -92,8 +97,12 @@ signals:
 
 private:
     /// Performs raycast to last known mouse cursor position in the currently active scene.
-    /** This function will only perform the raycast once per Tundra mainloop frame. */
+    /** This function will only perform the raycast once per Tundra mainloop frame, and returns the previous result
+        if the mouse position, the camera and the window size have not changed since. */
     RaycastResult* ExecuteRaycast();
+
+    /// Returns whether the previous raycast result can be returned for the camera with the view-projection matrix.
+    bool IsRaycastValid(const float4x4 &viewProj, int width, int height) const;
     
     int lastX; ///< Last known mouse cursor's x position.
     int lastY; ///< Last known mouse cursor's y position.
@@ -103,7 +112,18 @@ private:
     
     InputContextPtr input; ///< Input Context
     EntityWeakPtr lastHitEntity; ///< Last entity raycast has hit.
-    RaycastResult *lastRaycast; ///< Last raycast result.
+    RaycastResult *lastRaycast; ///< Last raycast result, points to raycastResult or is null.
+
+    /// Copy of the last raycast result, as the renderer reuses its result objects for the next raycast of anyone.
+    RaycastResult raycastResult;
+    EntityWeakPtr raycastEntity; ///< Entity the last raycast has hit, for detecting its removal.
+    int raycastX; ///< Mouse cursor's x position of the last raycast.
+    int raycastY; ///< Mouse cursor's y position of the last raycast.
+    bool raycastItemUnderMouse; ///< Was there widget under mouse at the last raycast.
+    int raycastWidth; ///< Window width at the last raycast.
+    int raycastHeight; ///< Window height at the last raycast.
+    float4x4 raycastViewProj; ///< View-projection matrix of the camera at the last raycast.
+    f64 raycastAge; ///< Seconds since the last raycast.
     
 private slots:
     void HandleKeyEvent(KeyEvent *e);
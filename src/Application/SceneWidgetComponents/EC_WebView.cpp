@@ -411,6 +411,9 @@ void EC_WebView::RenderWindowResized()
 #if defined(DIRECTX_ENABLED) && defined(WIN32)
     // Rendering goes black on the texture when 
     // windows is resized only on directx
+    EC_WidgetCanvas *sceneCanvas = GetSceneCanvasComponent();
+    if (sceneCanvas)
+        sceneCanvas->Invalidate();
     if (!resizeRenderTimer_->isActive())
         resizeRenderTimer_->start(500);
 #endif
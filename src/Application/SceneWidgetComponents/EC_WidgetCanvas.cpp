@@ -9,6 +9,7 @@
 #include "IRenderer.h"
 #include "Entity.h"
 #include "LoggingFunctions.h"
+#include "Profiler.h"
 
 #include "OgreMaterialUtils.h"
 #include "EC_Mesh.h"
@@ -22,8 +23,12 @@
 #include <QTimer>
 #include <QWidget>
 #include <QPainter>
+#include <QPaintEvent>
 #include <QDebug>
 
+#include <algorithm>
+#include <cstring>
+
 #if defined(DIRECTX_ENABLED) && defined(WIN32)
 #ifdef SAFE_DELETE
 #undef SAFE_DELETE
@@ -38,10 +43,43 @@
 
 #include "MemoryLeakCheck.h"
 
+namespace
+{
+/// Width and height in pixels of the tiles that are compared to find the changed parts of a fully rendered widget.
+const int cTileSize = 64;
+/// Maximum number of rectangles uploaded separately per update, beyond which their bounding rectangle is uploaded instead.
+const int cMaxDirtyRects = 32;
+
+/// Returns the tiles that differ between the two images of the same size and format.
+QRegion ChangedTiles(const QImage &a, const QImage &b)
+{
+    QRegion changed;
+    const int bytesPerPixel = 4;
+    for(int ty = 0; ty < a.height(); ty += cTileSize)
+    {
+        const int th = std::min(cTileSize, a.height() - ty);
+        for(int tx = 0; tx < a.width(); tx += cTileSize)
+        {
+            const int tw = std::min(cTileSize, a.width() - tx);
+            for(int y = ty; y < ty + th; ++y)
+                if (memcmp(a.constScanLine(y) + tx * bytesPerPixel, b.constScanLine(y) + tx * bytesPerPixel, tw * bytesPerPixel) != 0)
+                {
+                    changed += QRect(tx, ty, tw, th);
+                    break;
+                }
+        }
+    }
+    return changed;
+}
+
+}
+
 EC_WidgetCanvas::EC_WidgetCanvas(Scene *scene) :
     IComponent(scene),
     widget_(0),
     update_internals_(false),
+    full_update_(true),
+    rendering_(false),
     mesh_hooked_(false),
     refresh_timer_(0),
     update_interval_msec_(0),
@@ -187,12 +225,37 @@ void EC_WidgetCanvas::SetWidget(QWidget *widget)
 
     if (widget_ != widget)
     {
+        if (widget_)
+            widget_->removeEventFilter(this);
         widget_ = widget;
         if (widget_)
+        {
             connect(widget_, SIGNAL(destroyed(QObject*)), SLOT(WidgetDestroyed(QObject *)), Qt::UniqueConnection);
+            widget_->installEventFilter(this);
+        }
+        Invalidate();
     }
 }
 
+void EC_WidgetCanvas::MarkDirty(const QRect &rect)
+{
+    dirty_region_ += rect;
+}
+
+void EC_WidgetCanvas::Invalidate()
+{
+    full_update_ = true;
+    dirty_region_ = QRegion();
+}
+
+bool EC_WidgetCanvas::eventFilter(QObject *obj, QEvent *e)
+{
+    // The paint events sent by our own rendering of the widget are not changes.
+    if (obj == widget_.data() && e->type() == QEvent::Paint && !rendering_)
+        dirty_region_ += static_cast<QPaintEvent*>(e)->region();
+    return false;
+}
+
 void EC_WidgetCanvas::SetRefreshRate(int refresh_per_second)
 {
     if (framework->IsHeadless())
@@ -298,6 +361,8 @@ void EC_WidgetCanvas::Update(QImage buffer)
         }
 
         Blit(buffer, texture);
+        // The texture no longer holds the widget contents.
+        Invalidate();
     }
     catch (Ogre::Exception &e) // inherits std::exception
     {
@@ -326,13 +391,13 @@ void EC_WidgetCanvas::Update()
             return;
 
         if (buffer_.size() != widget_->size())
+        {
             buffer_ = QImage(widget_->size(), QImage::Format_ARGB32_Premultiplied);
+            Invalidate();
+        }
         if (buffer_.width() <= 0 || buffer_.height() <= 0)
             return;
 
-        QPainter painter(&buffer_);
-        widget_->render(&painter);
-
         // Set texture to material
         if (update_internals_ && !material_name_.empty())
         {
@@ -351,9 +416,39 @@ void EC_WidgetCanvas::Update()
             texture->setWidth(buffer_.width());
             texture->setHeight(buffer_.height());
             texture->createInternalResources();
+            Invalidate();
+        }
+
+        QRegion changed;
+        if (full_update_)
+        {
+            changed = QRegion(buffer_.rect());
+            RenderWidget(buffer_, changed);
         }
+        else if (!dirty_region_.isEmpty())
+        {
+            changed = dirty_region_ & QRegion(buffer_.rect());
+            RenderWidget(buffer_, changed);
+        }
+        else
+        {
+            // No paint events seen, e.g. the widget is not shown: render it in full and find what changed since the last update.
+            if (back_buffer_.size() != buffer_.size())
+                back_buffer_ = QImage(buffer_.size(), QImage::Format_ARGB32_Premultiplied);
+            RenderWidget(back_buffer_, QRegion(back_buffer_.rect()));
+            changed = ChangedTiles(buffer_, back_buffer_);
+            qSwap(buffer_, back_buffer_);
+        }
+        full_update_ = false;
+        dirty_region_ = QRegion();
 
-        Blit(buffer_, texture);
+        PROFILE(EC_WidgetCanvas_Upload);
+        QVector<QRect> rects = changed.rects();
+        if (rects.size() > cMaxDirtyRects)
+            Blit(buffer_, texture, changed.boundingRect());
+        else
+            for(int i = 0; i < rects.size(); ++i)
+                Blit(buffer_, texture, rects[i]);
     }
     catch (Ogre::Exception &e) // inherits std::exception
     {
@@ -365,8 +460,28 @@ void EC_WidgetCanvas::Update()
     }
 }
 
-bool EC_WidgetCanvas::Blit(const QImage &source, Ogre::TexturePtr destination)
+void EC_WidgetCanvas::RenderWidget(QImage &target, const QRegion &region)
 {
+    PROFILE(EC_WidgetCanvas_RenderWidget);
+    QPainter painter(&target);
+    painter.setCompositionMode(QPainter::CompositionMode_Source);
+    QVector<QRect> rects = region.rects();
+    for(int i = 0; i < rects.size(); ++i)
+        painter.fillRect(rects[i], Qt::transparent);
+    painter.setCompositionMode(QPainter::CompositionMode_SourceOver);
+
+    rendering_ = true;
+    widget_->render(&painter, region.boundingRect().topLeft(), region);
+    rendering_ = false;
+}
+
+bool EC_WidgetCanvas::Blit(const QImage &source, Ogre::TexturePtr destination, const QRect &rect)
+{
+    const QRect r = (rect.isNull() ? source.rect() : rect & source.rect());
+    if (r.isEmpty())
+        return true;
+    const int bytesPerPixel = 4; ///\todo Count from Ogre::PixelFormat!
+
 #if defined(DIRECTX_ENABLED) && defined(WIN32)
     Ogre::HardwarePixelBufferSharedPtr pb = destination->getBuffer();
     Ogre::D3D9HardwarePixelBuffer *pixelBuffer = dynamic_cast<Ogre::D3D9HardwarePixelBuffer*>(pb.get());
@@ -381,16 +496,16 @@ bool EC_WidgetCanvas::Blit(const QImage &source, Ogre::TexturePtr destination)
         if (SUCCEEDED(hr))
         {
             D3DLOCKED_RECT lock;
-            HRESULT hr = surface->LockRect(&lock, 0, 0);
+            RECT lockRect = { r.left(), r.top(), r.right() + 1, r.bottom() + 1 };
+            HRESULT hr = surface->LockRect(&lock, &lockRect, 0);
             if (SUCCEEDED(hr))
             {
-                const int bytesPerPixel = 4; ///\todo Count from Ogre::PixelFormat!
-                const int sourceStride = bytesPerPixel * source.width();
-                if (lock.Pitch == sourceStride)
-                    memcpy(lock.pBits, source.bits(), sourceStride * source.height());
+                const int rowBytes = bytesPerPixel * r.width();
+                if (r == source.rect() && lock.Pitch == source.bytesPerLine())
+                    memcpy(lock.pBits, source.bits(), rowBytes * source.height());
                 else
-                    for(int y = 0; y < source.height(); ++y)
-                        memcpy((u8*)lock.pBits + lock.Pitch * y, source.bits() + sourceStride * y, sourceStride);
+                    for(int y = 0; y < r.height(); ++y)
+                        memcpy((u8*)lock.pBits + lock.Pitch * y, source.constScanLine(r.top() + y) + bytesPerPixel * r.left(), rowBytes);
                 surface->UnlockRect();
             }
         }
@@ -398,8 +513,11 @@ bool EC_WidgetCanvas::Blit(const QImage &source, Ogre::TexturePtr destination)
 #else
     if (!destination->getBuffer().isNull())
     {
-        Ogre::Box update_box(0, 0, source.width(), source.height());
+        // The pixel box addresses the rectangle within the whole source image.
+        Ogre::Box update_box(r.left(), r.top(), r.right() + 1, r.bottom() + 1);
         Ogre::PixelBox pixel_box(update_box, Ogre::PF_A8R8G8B8, (void*)source.bits());
+        pixel_box.rowPitch = source.bytesPerLine() / bytesPerPixel;
+        pixel_box.slicePitch = pixel_box.rowPitch * source.height();
         destination->getBuffer()->blitFromMemory(pixel_box, update_box);
     }
 #endif
@@ -7,6 +7,7 @@
 
 #include <QMap>
 #include <QImage>
+#include <QRegion>
 #include <QPointer>
 #include <QWidget>
 #include <QString>
@@ -30,6 +31,10 @@ they need QWidget painting done to a 3D object.
 Paints UI widgets on to a 3D object surface via EC_Mesh and a submesh index.
 So a EC_Mesh needs to be present on the entity this component is used.
 
+Only the changed parts of the widget are uploaded to the texture. The regions of the paint events of the
+widget, and those given to MarkDirty, are rendered and uploaded as sub-rectangles. When the widget is not
+painted on screen, it is rendered in full and the tiles that differ from the last update are uploaded.
+
 Registered by SceneWidgetComponents plugin.
 
 <b>No Attributes</b>
@@ -40,6 +45,8 @@ Registered by SceneWidgetComponents plugin.
 <li>"Update":
 <li>"Setup":
 <li>"SetWidget":
+<li>"MarkDirty":
+<li>"Invalidate":
 <li>"SetRefreshRate":
 <li>"SetSubmesh":
 <li>"SetSubmeshes":
@@ -76,6 +83,11 @@ public slots:
     void Setup(QWidget *widget, const QList<uint> &submeshes, int refresh_per_second);
     void RestoreOriginalMeshMaterials();
 
+    /// Marks a rectangle of the widget changed, so that the next Update renders and uploads it.
+    void MarkDirty(const QRect &rect);
+    /// Makes the next Update render and upload the whole widget, e.g. after the texture contents were lost.
+    void Invalidate();
+
     void SetWidget(QWidget *widget);
     void SetRefreshRate(int refresh_per_second);
     void SetSubmesh(uint submesh);
@@ -89,8 +101,12 @@ public slots:
     QString GetMaterialName() const  { return QString::fromStdString(material_name_); }
     void UpdateSubmeshes();
 
+    /// QObject override. Collects the regions of the paint events of the widget.
+    bool eventFilter(QObject *obj, QEvent *e);
+
 private slots:
-    bool Blit(const QImage &source, Ogre::TexturePtr destination);
+    /// Uploads the rectangle of the source image to the same place in the destination texture. A null rectangle uploads the whole image.
+    bool Blit(const QImage &source, Ogre::TexturePtr destination, const QRect &rect = QRect());
     void WidgetDestroyed(QObject *obj);
     void MeshMaterialsUpdated(uint index, const QString &material_name);
 
@@ -101,6 +117,9 @@ private slots:
     void ComponentRemoved(IComponent *component, AttributeChange::Type change);
 
 private:
+    /// Renders the region of the widget to the target image, clearing it first.
+    void RenderWidget(QImage &target, const QRegion &region);
+
     QPointer<QWidget> widget_;
     QList<uint> submeshes_;
     QTimer *refresh_timer_;
@@ -113,5 +132,11 @@ private:
     bool update_internals_;
 
     QImage buffer_;
+    /// The image the widget is rendered to when the changes are found by comparing to buffer_.
+    QImage back_buffer_;
+    /// The region changed since the last update, from the paint events and MarkDirty.
+    QRegion dirty_region_;
+    bool full_update_;
+    bool rendering_;
     bool mesh_hooked_;
 };
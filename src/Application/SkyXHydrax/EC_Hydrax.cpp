@@ -294,7 +294,10 @@ void EC_Hydrax::Update(float frameTime)
         }
 #endif
         if (impl->hydrax->isCreated())
+        {
+            PROFILE(EC_Hydrax_UpdateWater);
             impl->hydrax->update(frameTime);
+        }
     }
 }
 
@@ -324,18 +327,15 @@ void EC_Hydrax::ConfigLoadSucceeded(AssetPtr asset)
     try
     {
         // Update the noise module
+        std::string noiseName;
         if (configData.contains("noise=fft", Qt::CaseInsensitive))
         {
             /// \note Using the FFT noise plugin seems to crash somewhere after we leave this function.
             /// FFT looks better so would be nice to investigate further!
-            if (impl->module->getNoise()->getName() != "FFT")
-                impl->module->setNoise(new Hydrax::Noise::FFT());
+            noiseName = "FFT";
         }
         else if (configData.contains("noise=perlin", Qt::CaseInsensitive))
-        {
-            if (impl->module->getNoise()->getName() != "Perlin")
-                impl->module->setNoise(new Hydrax::Noise::Perlin());
-        }
+            noiseName = "Perlin";
         else
         {
             LogError("EC_Hydrax: Unknown noise param in loaded config, acceptable = FFT/Perlin.");
@@ -343,6 +343,26 @@ void EC_Hydrax::ConfigLoadSucceeded(AssetPtr asset)
             return;
         }
 
+        // The ProjectedGridRtt module computes the water normals on the GPU into a normal map, ProjectedGridVertex
+        // on the CPU for each vertex of the grid each frame. The normal mode can only be chosen when creating the module.
+        Hydrax::MaterialManager::NormalMode normalMode = configData.contains("module=projectedgridrtt", Qt::CaseInsensitive) ?
+            Hydrax::MaterialManager::NM_RTT : Hydrax::MaterialManager::NM_VERTEX;
+        if (impl->module->getNormalMode() != normalMode)
+        {
+            Hydrax::Noise::Noise *noise = noiseName == "FFT" ? (Hydrax::Noise::Noise *)new Hydrax::Noise::FFT() : new Hydrax::Noise::Perlin();
+            Hydrax::Module::ProjectedGrid *module = new Hydrax::Module::ProjectedGrid(impl->hydrax, noise,
+                Ogre::Plane(Ogre::Vector3::UNIT_Y, Ogre::Vector3::ZERO), normalMode);
+            impl->hydrax->setModule(module);
+            impl->module = module;
+        }
+        else if (impl->module->getNoise()->getName() != noiseName)
+        {
+            if (noiseName == "FFT")
+                impl->module->setNoise(new Hydrax::Noise::FFT());
+            else
+                impl->module->setNoise(new Hydrax::Noise::Perlin());
+        }
+
         // Load config from the asset data string.
         impl->hydrax->remove();
         impl->hydrax->loadCfgString(configData.toStdString());
@@ -57,7 +57,8 @@ public:
     /// Config file asset reference (.hdx).
     /** Hydrax contains a vast amount of configurable options. The easiest way is to configure these options is to use
         the config file. You can edit the config file with a text editor of your choice. See /bin/media/Hydrax/Hydrax.hdx
-        for the example config file. */
+        for the example config file. The module of the config chooses the normals mode: ProjectedGridRtt computes
+        the water normals on the GPU and is much cheaper for the CPU than ProjectedGridVertex. */
     DEFINE_QPROPERTY_ATTRIBUTE(AssetReference, configRef);
     Q_PROPERTY(AssetReference configRef READ getconfigRef WRITE setconfigRef);
 
@@ -29,7 +29,7 @@
 #include "MemoryLeakCheck.h"
 
 /// @cond PRIVATE
-struct EC_SkyX::Impl
+struct EC_SkyX::Impl : public Ogre::FrameListener
 {
     Impl() :
         skyX(0),
@@ -41,7 +41,9 @@ struct EC_SkyX::Impl
         sunPosition(0.0f),
         sunDirection(0.0f),
         moonPosition(0.0f),
-        moonDirection(0.0f)
+        moonDirection(0.0f),
+        updateInterval(0.0f),
+        timeSinceUpdate(0.0f)
     {
         controller = new SkyX::BasicController(true);
     }
@@ -83,6 +85,18 @@ struct EC_SkyX::Impl
         cloudLayerTop = 0;
     }
 
+    /// Ogre::FrameListener override. Updates SkyX once updateInterval has passed since the previous update.
+    bool frameStarted(const Ogre::FrameEvent &e)
+    {
+        timeSinceUpdate += e.timeSinceLastFrame;
+        if (!skyX || timeSinceUpdate < updateInterval)
+            return true;
+        PROFILE(EC_SkyX_UpdateSky);
+        skyX->update(timeSinceUpdate);
+        timeSinceUpdate = 0.0f;
+        return true;
+    }
+
     /// @todo Consider merging UpdateLightPositions and UpdateLights?
     void UpdateLightPositions(Ogre::Camera *camera)
     {
@@ -122,6 +136,9 @@ struct EC_SkyX::Impl
 
     float3 sunDirection;
     float3 moonDirection;
+
+    float updateInterval; ///< Seconds between SkyX updates at least.
+    float timeSinceUpdate; ///< Seconds since the previous SkyX update.
 };
 /// @endcond
 
@@ -145,9 +162,10 @@ EC_SkyX::EC_SkyX(Scene* scene) :
     INIT_ATTRIBUTE_VALUE(moonlightDiffuseColor, "Moonlight color", Color(0.639f,0.639f,0.639f, 0.25f)), /**< @todo Nicer color for moonlight */
     INIT_ATTRIBUTE(moonlightSpecularColor, "Moonlight specular color"), // defaults to black
     INIT_ATTRIBUTE_VALUE(ambientLightColor, "Ambient light color", OgreWorld::DefaultSceneAmbientLightColor()), // Ambient and sun diffuse color copied from EC_EnvironmentLight
+    INIT_ATTRIBUTE_VALUE(updateRate, "Update rate", 0.0f),
     impl(0)
 {
-    static AttributeMetadata cloudTypeMd, cloudHeightMd, timeMd, zeroToHundredMd, mediumStepMd, smallStepMd;
+    static AttributeMetadata cloudTypeMd, cloudHeightMd, timeMd, zeroToHundredMd, mediumStepMd, smallStepMd, updateRateMd;
     static bool metadataInitialized = false;
     if (!metadataInitialized)
     {
@@ -165,6 +183,8 @@ EC_SkyX::EC_SkyX(Scene* scene) :
         cloudHeightMd.step = "10.0";
         mediumStepMd.step = "0.1";
         smallStepMd.step = "0.01";
+        updateRateMd.minimum = "0.0";
+        updateRateMd.step = "5.0";
         metadataInitialized = true;
     }
     cloudType.SetMetadata(&cloudTypeMd);
@@ -178,6 +198,7 @@ EC_SkyX::EC_SkyX(Scene* scene) :
     timeMultiplier.SetMetadata(&smallStepMd);
     sunInnerRadius.SetMetadata(&mediumStepMd);
     sunOuterRadius.SetMetadata(&mediumStepMd);
+    updateRate.SetMetadata(&updateRateMd);
 
     connect(this, SIGNAL(ParentEntitySet()), SLOT(Create()));
 }
@@ -268,6 +289,7 @@ void EC_SkyX::Create()
         UpdateAttribute(&cloudType, AttributeChange::Disconnected);
         UpdateAttribute(&timeMultiplier, AttributeChange::Disconnected);
         UpdateAttribute(&time, AttributeChange::Disconnected);
+        UpdateAttribute(&updateRate, AttributeChange::Disconnected);
 
         connect(framework->Frame(), SIGNAL(Updated(float)), SLOT(Update(float)), Qt::UniqueConnection);
         connect(this, SIGNAL(AttributeChanged(IAttribute*, AttributeChange::Type)), SLOT(UpdateAttribute(IAttribute*, AttributeChange::Type)), Qt::UniqueConnection);
@@ -575,6 +597,10 @@ void EC_SkyX::UpdateAttribute(IAttribute *attr, AttributeChange::Type change)
     {
         impl->skyX->getSceneManager()->setAmbientLight(ambientLightColor.Get());
     }
+    else if (attr == &updateRate)
+    {
+        impl->updateInterval = updateRate.Get() > 0.0f ? 1.0f / updateRate.Get() : 0.0f;
+    }
 }
 
 void EC_SkyX::Update(float frameTime)
@@ -602,7 +628,8 @@ void EC_SkyX::RegisterListeners()
     // Register SkyX listeners. This is the proper way to do rendering.
     // If we do our own calls to impl->skyX->update() and impl->skyX->notifyCameraRender()
     // with FrameAPI::Updated() there will be rendering artifact when camera is being moved!
-    Ogre::Root::getSingleton().addFrameListener(impl->skyX);
+    // The frame listener is Impl, which calls SkyX's update at the update rate in the same place of the Ogre frame.
+    Ogre::Root::getSingleton().addFrameListener(impl);
 
     OgreRenderer::OgreRenderingModule *ogreRenderingModule = GetFramework()->Module<OgreRenderer::OgreRenderingModule>();
     OgreRenderer::Renderer *renderer = ogreRenderingModule != 0 ? ogreRenderingModule->Renderer().get() : 0;
@@ -620,7 +647,7 @@ void EC_SkyX::UnregisterListeners()
     if (!impl || !impl->skyX)
         return;
 
-    Ogre::Root::getSingleton().removeFrameListener(impl->skyX);
+    Ogre::Root::getSingleton().removeFrameListener(impl);
 
     // Cant use OgreWorld from parent scene as it would fail in the dtor.
     OgreRenderer::OgreRenderingModule *ogreRenderingModule = GetFramework()->Module<OgreRenderer::OgreRenderingModule>();
@@ -113,6 +113,12 @@ public:
     DEFINE_QPROPERTY_ATTRIBUTE(Color, ambientLightColor);
     Q_PROPERTY(Color ambientLightColor READ getambientLightColor WRITE setambientLightColor);
 
+    /// Times per second the atmosphere and clouds are updated at most, 0 for every frame.
+    /** The sky changes slowly, so a rate of 10-20 saves the CPU time of the cloud and atmosphere updates on most frames.
+        The time since the previous update is passed on, so the sky keeps up with the time of day and the wind regardless of the rate. */
+    DEFINE_QPROPERTY_ATTRIBUTE(float, updateRate);
+    Q_PROPERTY(float updateRate READ getupdateRate WRITE setupdateRate);
+
 public slots:
     /// Returns whether or not the sun is visible (above horizon).
     bool IsSunVisible() const;
@@ -0,0 +1,605 @@
+/**
+    For conditions of distribution and use, see copyright notice in LICENSE
+
+    @file   SyncLoadTestModule.cpp
+    @brief  Headless synthetic client load generator for benchmarking scene replication. */
+
+#include "StableHeaders.h"
+#include "SyncLoadTestModule.h"
+
+#include "Framework.h"
+#include "Profiler.h"
+#include "LoggingFunctions.h"
+#include "CoreStringUtils.h"
+#include "IAttribute.h"
+#include "Transform.h"
+#include "EntityAction.h"
+#include "EC_Placeable.h"
+#include "TundraLogicModule.h"
+#include "Server.h"
+#include "UserConnection.h"
+#include "TundraMessages.h"
+#include "MsgLogin.h"
+#include "MsgLoginReply.h"
+#include "MsgEntityAction.h"
+#include "Math/float2.h"
+
+#include <kNet.h>
+#include <kNet/UDPMessageConnection.h>
+
+#include <QByteArray>
+#include <QStringList>
+
+#include <algorithm>
+#include <cmath>
+
+#include "MemoryLeakCheck.h"
+
+namespace
+{
+const int cConnectionsPerFrame = 10; ///< Simulated connections opened per frame while ramping up.
+const char * const cProbeActionName = "LoadTestPing";
+
+/// Returns the value at the given percentile [0, 1] of sorted values, or 0 if there are none.
+float Percentile(const std::vector<float> &sorted, float p)
+{
+    if (sorted.empty())
+        return 0.f;
+    size_t index = std::min((size_t)(p * (sorted.size() - 1) + 0.5f), sorted.size() - 1);
+    return sorted[index];
+}
+
+QString PercentileString(std::vector<float> &values)
+{
+    if (values.empty())
+        return "-";
+    std::sort(values.begin(), values.end());
+    return QString("p50 %1 p90 %2 p99 %3 max %4 ms").arg(Percentile(values, 0.5f), 0, 'f', 1).arg(Percentile(values, 0.9f), 0, 'f', 1)
+        .arg(Percentile(values, 0.99f), 0, 'f', 1).arg(values.back(), 0, 'f', 1);
+}
+}
+
+SyncLoadTestModule::SimulatedClient::SimulatedClient() :
+    loginSent(false),
+    loggedIn(false),
+    protocolVersion(ProtocolOriginal),
+    pathRadius(0.f),
+    pathSpeed(0.f),
+    pathAngle(0.f),
+    observerAcc(0.f),
+    actionAcc(0.f),
+    editAcc(0.f)
+{
+}
+
+SyncLoadTestModule::SyncLoadTestModule() :
+    IModule("SyncLoadTestModule"),
+    numClients_(0),
+    serverAddress_("127.0.0.1"),
+    serverPort_(2345),
+    transport_(kNet::SocketOverUDP),
+    targetEntityId_(0),
+    targetEntityFixed_(false),
+    targetComponentId_(0),
+    observerRate_(10.f),
+    actionRate_(1.f),
+    editRate_(1.f),
+    reportInterval_(5.f),
+    reportAcc_(0.f),
+    serverReport_(false),
+    numActionsSent_(0),
+    numEditsSent_(0),
+    numProbesReceived_(0)
+{
+}
+
+SyncLoadTestModule::~SyncLoadTestModule()
+{
+}
+
+void SyncLoadTestModule::Initialize()
+{
+    QStringList clientsArg = framework_->CommandLineParameters("--loadTestClients");
+    if (!clientsArg.isEmpty())
+        numClients_ = std::max(clientsArg.first().toInt(), 0);
+
+    QStringList serverArg = framework_->CommandLineParameters("--loadTestServer");
+    if (!serverArg.isEmpty())
+    {
+        QStringList parts = serverArg.first().split(':');
+        serverAddress_ = parts[0].toStdString();
+        if (parts.size() > 1)
+            serverPort_ = parts[1].toUShort();
+    }
+
+    QStringList protocolArg = framework_->CommandLineParameters("--loadTestProtocol");
+    if (!protocolArg.isEmpty())
+    {
+        kNet::SocketTransportLayer transport = kNet::StringToSocketTransportLayer(protocolArg.first().trimmed().toStdString().c_str());
+        if (transport != kNet::InvalidTransportLayer)
+            transport_ = transport;
+        else
+            LogError("SyncLoadTestModule: Invalid --loadTestProtocol \"" + protocolArg.first() + "\", using udp.");
+    }
+
+    QStringList entityArg = framework_->CommandLineParameters("--loadTestEntity");
+    if (!entityArg.isEmpty())
+    {
+        targetEntityId_ = entityArg.first().toUInt();
+        targetEntityFixed_ = targetEntityId_ != 0;
+    }
+
+    QStringList ratesArg = framework_->CommandLineParameters("--loadTestRates");
+    if (!ratesArg.isEmpty())
+    {
+        QStringList rates = ratesArg.first().split(',');
+        if (rates.size() > 0)
+            observerRate_ = std::max(rates[0].toFloat(), 0.f);
+        if (rates.size() > 1)
+            actionRate_ = std::max(rates[1].toFloat(), 0.f);
+        if (rates.size() > 2)
+            editRate_ = std::max(rates[2].toFloat(), 0.f);
+    }
+
+    QStringList reportArg = framework_->CommandLineParameters("--loadTestReport");
+    if (!reportArg.isEmpty())
+    {
+        reportInterval_ = std::max(reportArg.first().toFloat(), 0.1f);
+        serverReport_ = true;
+    }
+
+    if (numClients_ > 0)
+        LogInfo(QString("SyncLoadTestModule: Simulating %1 clients connecting to %2:%3 (%4), rates %5 observer, %6 action, %7 edit updates per second.")
+            .arg(numClients_).arg(serverAddress_.c_str()).arg(serverPort_).arg(kNet::SocketTransportLayerToString(transport_).c_str())
+            .arg(observerRate_).arg(actionRate_).arg(editRate_));
+}
+
+void SyncLoadTestModule::Uninitialize()
+{
+    for(size_t i = 0; i < clients_.size(); ++i)
+        if (clients_[i].connection)
+            clients_[i].connection->Disconnect(0);
+    clients_.clear();
+    clientIndices_.clear();
+}
+
+void SyncLoadTestModule::Update(f64 frametime)
+{
+    PROFILE(SyncLoadTestModule_Update);
+
+    if (numClients_ > 0)
+    {
+        ConnectClients();
+        for(size_t i = 0; i < clients_.size(); ++i)
+        {
+            SimulatedClient &client = clients_[i];
+            if (!client.connection)
+                continue;
+            // Pulls the inbound messages of the connection and calls HandleMessage for each of them.
+            client.connection->Process();
+            if (client.connection->GetConnectionState() == kNet::ConnectionClosed)
+            {
+                LogWarning("SyncLoadTestModule: Simulated client " + QString::number(i) + " disconnected.");
+                clientIndices_.erase(client.connection.ptr());
+                client.connection = 0;
+                client.loggedIn = false;
+                continue;
+            }
+            UpdateClient(client, (float)frametime);
+        }
+    }
+    else if (!serverReport_)
+        return;
+
+    SampleServer();
+
+    reportAcc_ += (float)frametime;
+    if (reportAcc_ >= reportInterval_)
+    {
+        Report();
+        reportAcc_ = 0.f;
+    }
+}
+
+void SyncLoadTestModule::ConnectClients()
+{
+    for(int i = 0; i < cConnectionsPerFrame && (int)clients_.size() < numClients_; ++i)
+    {
+        const int index = (int)clients_.size();
+        clients_.push_back(SimulatedClient());
+        SimulatedClient &client = clients_.back();
+
+        // Spread the observers on rings around the origin, moving at different speeds and directions.
+        client.pathRadius = 10.f + 10.f * (index % 20);
+        client.pathSpeed = (index % 2 ? 0.2f : -0.2f) * (1.f + 0.1f * (index % 7));
+        client.pathAngle = index * 2.39996f; // Golden angle, so that the clients on a ring do not overlap.
+        // Stagger the first messages of the clients over their update intervals.
+        client.actionAcc = actionRate_ > 0.f ? (float)(index % 100) / (100.f * actionRate_) : 0.f;
+        client.editAcc = editRate_ > 0.f ? (float)(index % 100) / (100.f * editRate_) : 0.f;
+
+        client.connection = network_.Connect(serverAddress_.c_str(), serverPort_, transport_, this);
+        if (!client.connection)
+        {
+            LogError(QString("SyncLoadTestModule: Unable to connect simulated client %1 to %2:%3.").arg(index).arg(serverAddress_.c_str()).arg(serverPort_));
+            continue;
+        }
+        clientIndices_[client.connection.ptr()] = index;
+        if (transport_ == kNet::SocketOverUDP)
+            dynamic_cast<kNet::UDPMessageConnection*>(client.connection.ptr())->SetDatagramSendRate(500);
+        if (client.connection->GetSocket() && client.connection->GetSocket()->TransportLayer() == kNet::SocketOverTCP)
+            client.connection->GetSocket()->SetNaglesAlgorithmEnabled(false);
+    }
+}
+
+void SyncLoadTestModule::UpdateClient(SimulatedClient &client, float frametime)
+{
+    if (!client.loginSent)
+    {
+        if (client.connection->GetConnectionState() == kNet::ConnectionOK)
+            SendLogin(client, (int)(&client - &clients_[0]));
+        return;
+    }
+    if (!client.loggedIn)
+        return;
+
+    client.pathAngle += client.pathSpeed * frametime;
+
+    if (observerRate_ > 0.f)
+    {
+        client.observerAcc += frametime;
+        if (client.observerAcc >= 1.f / observerRate_)
+        {
+            SendObserverPosition(client);
+            client.observerAcc = 0.f;
+        }
+    }
+
+    if (actionRate_ > 0.f && targetEntityId_)
+    {
+        client.actionAcc += frametime;
+        if (client.actionAcc >= 1.f / actionRate_)
+        {
+            SendProbeAction(client);
+            client.actionAcc -= 1.f / actionRate_;
+        }
+    }
+
+    if (editRate_ > 0.f && targetEntityId_ && targetComponentId_)
+    {
+        client.editAcc += frametime;
+        if (client.editAcc >= 1.f / editRate_)
+        {
+            SendTransformEdit(client);
+            client.editAcc -= 1.f / editRate_;
+        }
+    }
+}
+
+void SyncLoadTestModule::SendLogin(SimulatedClient &client, int index)
+{
+    MsgLogin msg;
+    msg.loginData = StringToBuffer(QString("<login><username value=\"loadtest%1\" /></login>").arg(index).toStdString());
+    kNet::DataSerializer ds(msg.Size() + 4);
+    msg.SerializeTo(ds);
+    // Add requested protocol version
+    ds.AddVLE<kNet::VLE8_16_32>(cHighestSupportedProtocolVersion);
+    client.connection->SendMessage(msg.messageID, msg.reliable, msg.inOrder, msg.priority, 0, ds.GetData(), ds.BytesFilled());
+    client.loginSent = true;
+}
+
+void SyncLoadTestModule::SendObserverPosition(SimulatedClient &client)
+{
+    const float3 pos(client.pathRadius * cos(client.pathAngle), 2.f, client.pathRadius * sin(client.pathAngle));
+
+    kNet::DataSerializer ds(64);
+    ds.AddVLE<kNet::VLE8_16_32>(0); ///\todo Dummy scene ID.
+    // Full precision position, and yaw only orientation, the same encoding as SyncManager uses.
+    ds.AddArithmeticEncoded(8, 2, 3, 1, 4);
+    ds.Add<float>(pos.x);
+    ds.Add<float>(pos.y);
+    ds.Add<float>(pos.z);
+    // The observer looks at the origin. The yaw is sent as the local +Z axis, which points away from the view direction.
+    float2 back(pos.x, pos.z);
+    back.Normalize();
+    ds.AddNormalizedVector2D(back.x, back.y, 8);
+    client.connection->SendMessage(cObserverPositionMessage, false, false, 100, 0, ds.GetData(), ds.BytesFilled());
+}
+
+void SyncLoadTestModule::SendProbeAction(SimulatedClient &client)
+{
+    MsgEntityAction msg;
+    msg.entityId = targetEntityId_;
+    msg.name = StringToBuffer(cProbeActionName);
+    msg.executionType = (u8)EntityAction::Peers;
+    MsgEntityAction::S_parameters param;
+    param.parameter = StringToBuffer(QString::number((qulonglong)kNet::Clock::Tick()).toStdString());
+    msg.parameters.push_back(param);
+
+    kNet::DataSerializer ds(msg.Size());
+    msg.SerializeTo(ds);
+    client.connection->SendMessage(msg.messageID, msg.reliable, msg.inOrder, msg.priority, 0, ds.GetData(), ds.BytesFilled());
+    ++numActionsSent_;
+}
+
+void SyncLoadTestModule::SendTransformEdit(SimulatedClient &client)
+{
+    const Transform transform(float3(client.pathRadius * cos(client.pathAngle), 0.f, client.pathRadius * sin(client.pathAngle)),
+        float3(0.f, RadToDeg(client.pathAngle), 0.f), float3::one);
+
+    // One attribute, indexed: the transform is the first attribute of EC_Placeable.
+    kNet::DataSerializer attrDs(64);
+    attrDs.Add<kNet::bit>(0);
+    attrDs.Add<u8>(1);
+    attrDs.Add<u8>(0);
+    Attribute<Transform>(0, "transform", transform).ToBinary(attrDs);
+
+    kNet::DataSerializer ds(128);
+    ds.AddVLE<kNet::VLE8_16_32>(0); ///\todo Dummy scene ID.
+    ds.AddVLE<kNet::VLE8_16_32>(targetEntityId_);
+    ds.AddVLE<kNet::VLE8_16_32>(targetComponentId_);
+    ds.AddVLE<kNet::VLE8_16_32>((u32)attrDs.BytesFilled());
+    ds.AddAlignedByteArray(attrDs.GetData(), (u32)attrDs.BytesFilled());
+    client.connection->SendMessage(cEditAttributesMessage, true, true, 100, 0, ds.GetData(), ds.BytesFilled());
+    ++numEditsSent_;
+}
+
+void SyncLoadTestModule::HandleMessage(kNet::MessageConnection *source, kNet::packet_id_t /*packetId*/, kNet::message_id_t messageId, const char *data, size_t numBytes)
+{
+    SimulatedClient *client = ClientForConnection(source);
+    if (!client)
+        return;
+
+    try
+    {
+        if (messageId == cLoginReplyMessage)
+        {
+            kNet::DataDeserializer dd(data, numBytes);
+            MsgLoginReply msg;
+            msg.DeserializeFrom(dd);
+            // Read optional protocol version
+            client->protocolVersion = dd.BytesLeft() ? dd.ReadVLE<kNet::VLE8_16_32>() : (u32)ProtocolOriginal;
+            client->loggedIn = msg.success != 0;
+            if (!client->loggedIn)
+                LogWarning("SyncLoadTestModule: Login of simulated client " + QString::number((int)(client - &clients_[0])) + " was refused.");
+        }
+        else if (messageId == cEntityActionMessage)
+            HandleProbeAction(MsgEntityAction(data, numBytes));
+        else if (messageId == cEntityActionBatchMessage)
+            HandleActionBatch(*client, data, numBytes);
+        else if (client == &clients_[0]) // All simulated clients receive the same scene: the first one is enough to find the target entity.
+            HandleSceneMessage(*client, messageId, data, numBytes);
+    }
+    catch(std::exception &e)
+    {
+        LogError("SyncLoadTestModule: Exception \"" + QString(e.what()) + "\" thrown when handling network message id " + QString::number(messageId) +
+            " size " + QString::number(numBytes) + ".");
+    }
+}
+
+void SyncLoadTestModule::HandleSceneMessage(SimulatedClient &client, kNet::message_id_t messageId, const char *data, size_t numBytes)
+{
+    kNet::DataDeserializer dd(data, numBytes);
+    switch(messageId)
+    {
+    case cSceneSyncBatchMessage:
+        while(dd.BytesLeft() > 0)
+        {
+            const kNet::message_id_t id = dd.ReadVLE<kNet::VLE8_16_32>();
+            const u32 size = dd.ReadVLE<kNet::VLE8_16_32>();
+            if (size > dd.BytesLeft())
+                return;
+            HandleSceneMessage(client, id, data + dd.BytePos(), size);
+            dd.SkipBytes(size);
+        }
+        break;
+    case cSceneSnapshotMessage:
+    {
+        dd.ReadVLE<kNet::VLE8_16_32>(); // Scene ID
+        dd.Read<u32>(); // Snapshot sequence number
+        QByteArray snapshot = qUncompress((const uchar*)data + dd.BytePos(), (int)dd.BytesLeft());
+        HandleSceneMessage(client, cSceneSyncBatchMessage, snapshot.constData(), snapshot.size());
+        break;
+    }
+    case cCompressedMessage:
+    {
+        const kNet::message_id_t id = dd.ReadVLE<kNet::VLE8_16_32>();
+        QByteArray uncompressed = qUncompress((const uchar*)data + dd.BytePos(), (int)dd.BytesLeft());
+        if (!uncompressed.isEmpty())
+            HandleSceneMessage(client, id, uncompressed.constData(), uncompressed.size());
+        break;
+    }
+    case cCreateEntityMessage:
+    {
+        dd.ReadVLE<kNet::VLE8_16_32>(); // Scene ID
+        const entity_id_t entityId = dd.ReadVLE<kNet::VLE8_16_32>();
+        const u8 flags = dd.Read<u8>(); // Temporary and prototype flags
+        if (client.protocolVersion >= ProtocolHierarchicScene)
+            dd.Read<u32>(); // Parent entity ID
+        const bool instance = client.protocolVersion >= ProtocolPrototypeEntities && (flags & 2) != 0;
+        if (instance)
+            dd.Read<u32>(); // Prototype entity ID
+        const uint numComponents = dd.ReadVLE<kNet::VLE8_16_32>();
+        ReadComponents(entityId, dd, numComponents, instance);
+        break;
+    }
+    case cCreateComponentsMessage:
+    {
+        dd.ReadVLE<kNet::VLE8_16_32>(); // Scene ID
+        const entity_id_t entityId = dd.ReadVLE<kNet::VLE8_16_32>();
+        ReadComponents(entityId, dd, 0xffffffff);
+        break;
+    }
+    case cRemoveEntityMessage:
+    {
+        dd.ReadVLE<kNet::VLE8_16_32>(); // Scene ID
+        const entity_id_t entityId = dd.ReadVLE<kNet::VLE8_16_32>();
+        if (entityId == targetEntityId_)
+        {
+            LogInfo("SyncLoadTestModule: Target entity " + QString::number(entityId) + " was removed.");
+            targetComponentId_ = 0;
+            if (!targetEntityFixed_)
+                targetEntityId_ = 0;
+        }
+        break;
+    }
+    }
+}
+
+void SyncLoadTestModule::ReadComponents(entity_id_t entityId, kNet::DataDeserializer &dd, uint numComponents, bool instance)
+{
+    if (targetComponentId_ || (targetEntityId_ && entityId != targetEntityId_))
+        return;
+
+    for(uint i = 0; i < numComponents && dd.BitsLeft() >= 8; ++i)
+    {
+        if (instance)
+            dd.Read<u8>(); // Overrides flag
+        const component_id_t compId = dd.ReadVLE<kNet::VLE8_16_32>();
+        const u32 typeId = dd.ReadVLE<kNet::VLE8_16_32>();
+        dd.ReadString(); // Component name
+        dd.SkipBytes(dd.ReadVLE<kNet::VLE8_16_32>()); // Attribute data
+        if (typeId == EC_Placeable::TypeIdStatic())
+        {
+            targetEntityId_ = entityId;
+            targetComponentId_ = compId;
+            LogInfo(QString("SyncLoadTestModule: Targeting entity %1, EC_Placeable component %2.").arg(entityId).arg(compId));
+            return;
+        }
+    }
+}
+
+void SyncLoadTestModule::HandleActionBatch(SimulatedClient &client, const char *data, size_t numBytes)
+{
+    // See SyncManager::SendQueuedActions for the format.
+    kNet::DataDeserializer dd(data, numBytes);
+    const uint numActions = dd.ReadVLE<kNet::VLE8_16_32>();
+    for(uint i = 0; i < numActions; ++i)
+    {
+        MsgEntityAction msg;
+        msg.entityId = dd.Read<u32>();
+        const u32 nameId = dd.ReadVLE<kNet::VLE8_16_32>();
+        if (nameId == 0 || nameId > client.actionNames.size())
+        {
+            msg.name.resize(dd.Read<u8>());
+            if (msg.name.size() > 0)
+                dd.ReadArray<s8>(&msg.name[0], msg.name.size());
+            if (nameId == client.actionNames.size() + 1)
+                client.actionNames.push_back(msg.name);
+        }
+        else
+            msg.name = client.actionNames[nameId - 1];
+        msg.parameters.resize(dd.Read<u8>());
+        for(size_t j = 0; j < msg.parameters.size(); ++j)
+            msg.parameters[j].DeserializeFrom(dd);
+        HandleProbeAction(msg);
+    }
+}
+
+void SyncLoadTestModule::HandleProbeAction(const MsgEntityAction &msg)
+{
+    if (BufferToString(msg.name) != cProbeActionName || msg.parameters.empty())
+        return;
+    // All simulated clients run in this process, so the send time is comparable to our clock.
+    const kNet::tick_t sent = (kNet::tick_t)QString(BufferToString(msg.parameters[0].parameter).c_str()).toULongLong();
+    latencies_.push_back((float)kNet::Clock::MillisecondsSinceD(sent));
+    ++numProbesReceived_;
+}
+
+SyncLoadTestModule::SimulatedClient *SyncLoadTestModule::ClientForConnection(kNet::MessageConnection *connection)
+{
+    std::map<kNet::MessageConnection*, size_t>::const_iterator it = clientIndices_.find(connection);
+    return it != clientIndices_.end() ? &clients_[it->second] : 0;
+}
+
+void SyncLoadTestModule::SampleServer()
+{
+#ifdef PROFILING
+    TundraLogic::TundraLogicModule *tundraLogic = framework_->Module<TundraLogic::TundraLogicModule>();
+    if (!serverReport_ || !tundraLogic || !tundraLogic->IsServer())
+        return;
+
+    // SyncManager_Update runs every frame, but does the sync tick only on its update period.
+    // The frames on which any of its child blocks ran are the ticks.
+    Profiler &profiler = *framework_->GetProfiler();
+    profiler.Lock();
+    ProfilerNode *updateNode = dynamic_cast<ProfilerNode*>(profiler.FindBlockByName("SyncManager_Update"));
+    if (updateNode)
+    {
+        const ProfilerNodeTree::NodeList &children = updateNode->GetChildren();
+        for(ProfilerNodeTree::NodeList::const_iterator it = children.begin(); it != children.end(); ++it)
+        {
+            ProfilerNode *child = dynamic_cast<ProfilerNode*>(it->get());
+            if (child && child->num_called_ > 0)
+            {
+                tickTimes_.push_back((float)(updateNode->elapsed_ * 1000.0));
+                break;
+            }
+        }
+    }
+    profiler.Release();
+#endif
+}
+
+void SyncLoadTestModule::Report()
+{
+    if (numClients_ > 0)
+    {
+        int numConnected = 0;
+        int numLoggedIn = 0;
+        float bytesIn = 0.f;
+        float bytesOut = 0.f;
+        for(size_t i = 0; i < clients_.size(); ++i)
+        {
+            const SimulatedClient &client = clients_[i];
+            if (!client.connection)
+                continue;
+            if (client.connection->GetConnectionState() == kNet::ConnectionOK)
+                ++numConnected;
+            if (client.loggedIn)
+                ++numLoggedIn;
+            bytesIn += client.connection->BytesInPerSec();
+            bytesOut += client.connection->BytesOutPerSec();
+        }
+
+        LogInfo(QString("SyncLoadTest clients: %1/%2 connected, %3 logged in, %4 actions, %5 edits sent, %6 probes received, in %7 KB/s, out %8 KB/s, latency %9")
+            .arg(numConnected).arg(numClients_).arg(numLoggedIn).arg(numActionsSent_).arg(numEditsSent_).arg(numProbesReceived_)
+            .arg(bytesIn / 1024.f, 0, 'f', 1).arg(bytesOut / 1024.f, 0, 'f', 1).arg(PercentileString(latencies_)));
+    }
+
+    TundraLogic::TundraLogicModule *tundraLogic = framework_->Module<TundraLogic::TundraLogicModule>();
+    if (serverReport_ && tundraLogic && tundraLogic->IsServer() && tundraLogic->GetServer())
+    {
+        int numUsers = 0;
+        float bytesOut = 0.f;
+        UserConnectionList &users = tundraLogic->GetServer()->UserConnections();
+        for(UserConnectionList::const_iterator it = users.begin(); it != users.end(); ++it)
+        {
+            ++numUsers;
+            KNetUserConnection *knetUser = dynamic_cast<KNetUserConnection*>(it->get());
+            if (knetUser && knetUser->connection)
+                bytesOut += knetUser->connection->BytesOutPerSec();
+        }
+
+        LogInfo(QString("SyncLoadTest server: %1 users, out %2 KB/s, sync tick %3")
+#ifdef PROFILING
+            .arg(numUsers).arg(bytesOut / 1024.f, 0, 'f', 1).arg(PercentileString(tickTimes_)));
+#else
+            .arg(numUsers).arg(bytesOut / 1024.f, 0, 'f', 1).arg("- (requires PROFILING)"));
+#endif
+    }
+
+    numActionsSent_ = 0;
+    numEditsSent_ = 0;
+    numProbesReceived_ = 0;
+    latencies_.clear();
+    tickTimes_.clear();
+}
+
+extern "C"
+{
+    DLLEXPORT void TundraPluginMain(Framework *fw)
+    {
+        Framework::SetInstance(fw); // Inside this DLL, remember the pointer to the global framework object.
+        fw->RegisterModule(new SyncLoadTestModule());
+    }
+}
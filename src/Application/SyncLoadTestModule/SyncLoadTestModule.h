@@ -0,0 +1,145 @@
+/**
+    For conditions of distribution and use, see copyright notice in LICENSE
+
+    @file   SyncLoadTestModule.h
+    @brief  Headless synthetic client load generator for benchmarking scene replication. */
+
+#pragma once
+
+#if defined (_WINDOWS)
+#if defined(SYNCLOADTESTMODULE_EXPORTS)
+#define SYNCLOADTESTMODULE_API __declspec(dllexport)
+#else
+#define SYNCLOADTESTMODULE_API __declspec(dllimport)
+#endif
+#else
+#define SYNCLOADTESTMODULE_API
+#endif
+
+#include "IModule.h"
+#include "CoreTypes.h"
+
+#include <kNet/IMessageHandler.h>
+#include <kNet/Network.h>
+
+#include <QString>
+
+#include <map>
+#include <vector>
+
+struct MsgEntityAction;
+
+/// Headless synthetic client load generator for benchmarking scene replication.
+/** Opens a number of simulated client connections to a Tundra server from a single process. Every simulated client
+    logs in, moves its observer along a circular path around the scene origin and, at configurable rates, sends
+    latency probe entity actions and EC_Placeable transform edits to a target entity. The simulated clients only
+    parse the scene sync messages needed to find the target entity; they do not create a local scene.
+
+    Latency is measured from the probe actions, which are sent with the Peers execution type: the server forwards
+    each probe to the other simulated clients on its next sync tick, and the receiving client compares the send time
+    carried in the action to the process clock. The figures therefore include the server's sync tick delay.
+
+    When loaded into a server instead, the module reports the server's sync tick time (requires a build with PROFILING),
+    the number of users and the total outbound bandwidth.
+
+    Command line parameters:
+    <ul>
+    <li>--loadTestClients <n>: Number of simulated clients to connect. If omitted, no clients are simulated.
+    <li>--loadTestServer <address:port>: Server to connect to, 127.0.0.1:2345 by default.
+    <li>--loadTestProtocol <udp|tcp>: Transport of the simulated connections, udp by default.
+    <li>--loadTestEntity <id>: ID of the entity the probe actions and transform edits target. By default the first
+        replicated entity with an EC_Placeable.
+    <li>--loadTestRates <observerHz,actionHz,editHz>: Per-client rates of observer position updates, probe actions
+        and transform edits, "10,1,1" by default. A zero rate disables the message type.
+    <li>--loadTestReport <seconds>: Interval of the statistics report printed to the log, 5 seconds by default.
+        On a server, the report is printed only when this parameter is given.
+    </ul> */
+class SYNCLOADTESTMODULE_API SyncLoadTestModule : public IModule, public kNet::IMessageHandler
+{
+    Q_OBJECT
+
+public:
+    SyncLoadTestModule();
+    ~SyncLoadTestModule();
+
+    void Initialize();
+    void Uninitialize();
+    void Update(f64 frametime);
+
+    /// Invoked by the Network library for each message received by a simulated client.
+    void HandleMessage(kNet::MessageConnection *source, kNet::packet_id_t packetId, kNet::message_id_t messageId, const char *data, size_t numBytes);
+
+private:
+    /// State of one simulated client connection.
+    struct SimulatedClient
+    {
+        SimulatedClient();
+
+        Ptr(kNet::MessageConnection) connection;
+        bool loginSent;
+        bool loggedIn;
+        u32 protocolVersion; ///< Protocol version of the connection, as acknowledged by the server.
+        float pathRadius; ///< Radius of the observer path around the scene origin.
+        float pathSpeed; ///< Angular speed of the observer along the path, in radians per second.
+        float pathAngle; ///< Current angle of the observer on the path.
+        float observerAcc; ///< Time accumulated towards the next observer position update.
+        float actionAcc; ///< Time accumulated towards the next probe action.
+        float editAcc; ///< Time accumulated towards the next transform edit.
+        std::vector<std::vector<s8> > actionNames; ///< Entity action names interned by the server's EntityActionBatch messages.
+    };
+
+    /// Opens new simulated connections, ramping up at a fixed number of connections per frame.
+    void ConnectClients();
+    /// Sends the login, observer position, probe action and transform edit messages of a simulated client as they become due.
+    void UpdateClient(SimulatedClient &client, float frametime);
+
+    void SendLogin(SimulatedClient &client, int index);
+    void SendObserverPosition(SimulatedClient &client);
+    void SendProbeAction(SimulatedClient &client);
+    void SendTransformEdit(SimulatedClient &client);
+
+    /// Handles a scene sync message, unpacking SceneSyncBatch, SceneSnapshot and CompressedMessage containers.
+    void HandleSceneMessage(SimulatedClient &client, kNet::message_id_t messageId, const char *data, size_t numBytes);
+    /// Reads the components of a CreateEntity or CreateComponents message, looking for the target entity's EC_Placeable.
+    /** @param instance Whether the message creates an instance of a prototype entity, in which each component is preceded by the overrides flag. */
+    void ReadComponents(entity_id_t entityId, kNet::DataDeserializer &dd, uint numComponents, bool instance = false);
+    void HandleProbeAction(const MsgEntityAction &msg);
+    /// Reads the actions of an EntityActionBatch message, looking for probe actions.
+    void HandleActionBatch(SimulatedClient &client, const char *data, size_t numBytes);
+
+    /// Returns the simulated client of the connection, or null if not found.
+    SimulatedClient *ClientForConnection(kNet::MessageConnection *connection);
+
+    /// Samples the server's sync tick time and bandwidth, when running in a server.
+    void SampleServer();
+
+    /// Prints the statistics report of the last interval and resets the interval counters.
+    void Report();
+
+    kNet::Network network_; ///< Network for the simulated connections.
+    std::vector<SimulatedClient> clients_;
+    std::map<kNet::MessageConnection*, size_t> clientIndices_; ///< Index of the simulated client of each connection.
+    int numClients_; ///< Number of simulated clients to connect.
+    std::string serverAddress_;
+    unsigned short serverPort_;
+    kNet::SocketTransportLayer transport_;
+
+    entity_id_t targetEntityId_; ///< Entity targeted by probe actions and transform edits, 0 if not known yet.
+    bool targetEntityFixed_; ///< Whether the target entity was given on the command line.
+    component_id_t targetComponentId_; ///< ID of the target entity's EC_Placeable, 0 if not known yet.
+
+    float observerRate_; ///< Observer position updates per second per client.
+    float actionRate_; ///< Probe actions per second per client.
+    float editRate_; ///< Transform edits per second per client.
+
+    float reportInterval_; ///< Seconds between statistics reports.
+    float reportAcc_;
+    bool serverReport_; ///< Whether to report server statistics when running in a server.
+
+    // Counters of the current report interval.
+    uint numActionsSent_;
+    uint numEditsSent_;
+    uint numProbesReceived_;
+    std::vector<float> latencies_; ///< Probe latencies in milliseconds.
+    std::vector<float> tickTimes_; ///< Server sync tick times in milliseconds.
+};
@@ -18,9 +18,11 @@ namespace WebSocket
     class Server;
     class Handler;
     class UserConnection;
+    class MessagePool;
     
     typedef shared_ptr<UserConnection> UserConnectionPtr;
     typedef std::vector<UserConnectionPtr> UserConnectionList;
+    typedef shared_ptr<MessagePool> MessagePoolPtr;
 }
 
 class Framework;
@@ -0,0 +1,97 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#include "WebSocketMessagePool.h"
+
+#include <websocketpp/frame.hpp>
+
+#include <cstring>
+
+namespace
+{
+/// Largest number of pooled messages. When all are queued to connections, new messages are allocated without pooling them.
+const size_t cMaxPooledMessages = 1024;
+/// Largest payload size in bytes of a pooled message, so that pooled messages do not hold on to the memory of rare large messages.
+const size_t cMaxPooledPayloadSize = 64 * 1024;
+
+typedef websocketpp::config::asio::message_type Message;
+}
+
+namespace WebSocket
+{
+
+MessagePool::MessagePool() :
+    nextIndex_(0)
+{
+}
+
+MessagePtr MessagePool::Prepare(kNet::message_id_t id, const char *data, size_t numBytes)
+{
+    // The message ID is written as a little-endian u16, the same as kNet::DataSerializer::Add<u16> does.
+    const char idBytes[2] = { (char)(id & 0xFF), (char)((id >> 8) & 0xFF) };
+    return Prepare(idBytes, sizeof(idBytes), data, numBytes);
+}
+
+MessagePtr MessagePool::Prepare(const char *data, size_t numBytes)
+{
+    return Prepare(0, 0, data, numBytes);
+}
+
+MessagePtr MessagePool::Prepare(const char *prefix, size_t prefixSize, const char *data, size_t numBytes)
+{
+    const size_t payloadSize = prefixSize + numBytes;
+
+    if (lastMessage_)
+    {
+        const std::string &payload = lastMessage_->get_payload();
+        if (payload.size() == payloadSize && (prefixSize == 0 || memcmp(payload.data(), prefix, prefixSize) == 0) &&
+            (numBytes == 0 || memcmp(payload.data() + prefixSize, data, numBytes) == 0))
+            return lastMessage_;
+    }
+
+    MessagePtr message = Acquire(payloadSize);
+    std::string &payload = message->get_raw_payload();
+    payload.resize(payloadSize);
+    if (prefixSize)
+        memcpy(&payload[0], prefix, prefixSize);
+    if (numBytes)
+        memcpy(&payload[prefixSize], data, numBytes);
+
+    message->set_opcode(websocketpp::frame::opcode::binary);
+    message->set_header(websocketpp::frame::prepare_header(websocketpp::frame::basic_header(websocketpp::frame::opcode::binary, payloadSize),
+        websocketpp::frame::extended_header(payloadSize)));
+    message->set_prepared(true);
+
+    lastMessage_ = message;
+    return message;
+}
+
+void MessagePool::Clear()
+{
+    messages_.clear();
+    nextIndex_ = 0;
+    lastMessage_.reset();
+}
+
+MessagePtr MessagePool::Acquire(size_t payloadSize)
+{
+    if (payloadSize <= cMaxPooledPayloadSize)
+    {
+        // Messages are released roughly in the order they were sent, so start from the one after the last reused.
+        for(size_t i = 0; i < messages_.size(); ++i)
+        {
+            size_t index = (nextIndex_ + i) % messages_.size();
+            if (messages_[index].unique())
+            {
+                nextIndex_ = index + 1;
+                return messages_[index];
+            }
+        }
+    }
+
+    MessagePtr message(new Message(Message::con_msg_man_ptr(), websocketpp::frame::opcode::binary, payloadSize));
+    if (payloadSize <= cMaxPooledPayloadSize && messages_.size() < cMaxPooledMessages)
+        messages_.push_back(message);
+    return message;
+}
+
+}
@@ -0,0 +1,52 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#pragma once
+
+#include "WebSocketServerModuleApi.h"
+#include "WebSocketFwd.h"
+
+#include "WebSocketServer.h"
+
+#include <kNet/Types.h>
+
+#include <vector>
+
+namespace WebSocket
+{
+    /// Pool of outbound websocketpp messages that Tundra network messages are framed into directly.
+    /** A message is prepared once: the WebSocket frame header is written to the message header and the message ID and
+        data to its payload, so websocketpp sends it as is without allocating or copying it into a frame of its own.
+        Messages are refcounted, so the same prepared message can be queued to any number of connections. A message is
+        reused when websocketpp has released it from the send queues of all connections it was queued to.
+
+        The last prepared message is remembered, and preparing an identical message again returns it instead of a new
+        one. This shares the message when the same payload is sent to many connections in a row, as happens when
+        e.g. an entity action is forwarded to all peers.
+
+        Prepared messages use RFC 6455 framing, see UserConnection::SupportsPreparedMessages. Call only from the main thread. */
+    class WEBSOCKET_SERVER_MODULE_API MessagePool
+    {
+    public:
+        MessagePool();
+
+        /// Returns a prepared binary message of the message ID followed by the data.
+        MessagePtr Prepare(kNet::message_id_t id, const char *data, size_t numBytes);
+
+        /// Returns a prepared binary message of the data, e.g. a frame of coalesced messages.
+        MessagePtr Prepare(const char *data, size_t numBytes);
+
+        /// Releases the pooled messages. Messages still queued to connections are freed when websocketpp releases them.
+        void Clear();
+
+    private:
+        /// Returns a prepared binary message of the prefix followed by the data.
+        MessagePtr Prepare(const char *prefix, size_t prefixSize, const char *data, size_t numBytes);
+
+        /// Returns a pooled message that is not queued to any connection, or a new message if all are.
+        MessagePtr Acquire(size_t payloadSize);
+
+        std::vector<MessagePtr> messages_;
+        size_t nextIndex_; ///< Index the search for a free pooled message starts from.
+        MessagePtr lastMessage_; ///< Last prepared message.
+    };
+}
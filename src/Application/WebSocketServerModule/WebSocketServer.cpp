@@ -1,15 +1,18 @@
 
 #include "WebSocketServer.h"
 #include "WebSocketUserConnection.h"
+#include "WebSocketMessagePool.h"
 #include "WebSocketScriptTypeDefines.h"
 
 #include "Framework.h"
+#include "Application.h"
 #include "CoreDefines.h"
 #include "CoreJsonUtils.h"
 #include "CoreStringUtils.h"
 #include "LoggingFunctions.h"
 #include "Profiler.h"
 #include "UniqueIdGenerator.h"
+#include "MetricsRegistry.h"
 #include "OgreMaterialUtils.h"
 #include "WebSocketScriptTypeDefines.h"
 #include "TundraMessages.h"
@@ -38,6 +41,7 @@
 #include <QDebug>
 
 #include <algorithm>
+#include <set>
 
 #ifdef Q_WS_WIN
 #include "Win.h"
@@ -59,6 +63,8 @@ void ServerThread::run()
 {
     if (!server_)
         return;
+
+    ThreadProfiler::SetThreadName("WebSocketServer");
     
     try
     {
@@ -83,7 +89,9 @@ void ServerThread::run()
 Server::Server(Framework *framework) :
     LC("[WebSocketServer]: "),
     framework_(framework),
-    port_(2345)
+    port_(2345),
+    numThreads_(1),
+    messagePool_(new WebSocket::MessagePool())
 {
     // Port
     QStringList portParam = framework->CommandLineParameters("--port");
@@ -98,12 +106,25 @@ Server::Server(Framework *framework) :
         }
     }
     
+    // I/O threads
+    QStringList threadsParam = framework->CommandLineParameters("--websocketThreads");
+    if (!threadsParam.isEmpty())
+    {
+        bool ok = false;
+        numThreads_ = threadsParam.last().toInt(&ok);
+        if (!ok)
+            numThreads_ = QThread::idealThreadCount();
+        if (numThreads_ < 1)
+            numThreads_ = 1;
+    }
+
     qRegisterMetaType<MsgEntityAction>("MsgEntityAction");
 }
 
 Server::~Server()
 {
     Reset();
+    qDeleteAll(threads_);
 }
 
 void Server::Update(float frametime)
@@ -140,13 +161,21 @@ void Server::Update(float frametime)
     }
     
     QList<SocketEvent*> processEvents;
+    events_.TakeAll(processEvents);
+
+    // Drop the events of connections that connected or disconnected again later, which the I/O threads may have queued
+    // before the main thread got to process them.
+    std::set<websocketpp::server<websocketpp::config::asio>::connection_type*> reconnected;
+    for(int i = processEvents.size() - 1; i >= 0; --i)
     {
-        QMutexLocker lockEvents(&mutexEvents_);
-        if (events_.size() == 0)
-            return;
-        // Make copy of current event queue for processing
-        processEvents = events_;
-        events_.clear();
+        SocketEvent *event = processEvents[i];
+        if (!event)
+            continue;
+        websocketpp::server<websocketpp::config::asio>::connection_type *connection = event->connection.get();
+        if (reconnected.find(connection) != reconnected.end())
+            SAFE_DELETE(processEvents[i]);
+        else if (event->type == SocketEvent::Connected || event->type == SocketEvent::Disconnected)
+            reconnected.insert(connection);
     }
 
     // Process events pushed from the websocket thread(s)
@@ -161,7 +190,7 @@ void Server::Update(float frametime)
         {
             if (!UserConnection(event->connection))
             {
-                WebSocket::UserConnectionPtr userConnection(new WebSocket::UserConnection(event->connection));
+                WebSocket::UserConnectionPtr userConnection(new WebSocket::UserConnection(event->connection, messagePool_));
                 connections_.push_back(userConnection);
 
                 // The connection does not yet have an ID assigned. Tundra server will assign on login
@@ -241,6 +270,11 @@ void Server::Update(float frametime)
         
         SAFE_DELETE(event);
     }
+
+    // Send out the messages connections have coalesced outside SyncManager's update ticks, e.g. login replies.
+    for(UserConnectionList::iterator iter = connections_.begin(); iter != connections_.end(); ++iter)
+        if (*iter)
+            (*iter)->Flush();
 }
 
 WebSocket::UserConnectionPtr Server::UserConnection(uint connectionId)
@@ -279,6 +313,7 @@ bool Server::Start()
         server_->set_close_handler(boost::bind(&Server::OnDisconnected, this, ::_1));
         server_->set_message_handler(boost::bind(&Server::OnMessage, this, ::_1, ::_2));
         server_->set_socket_init_handler(boost::bind(&Server::OnSocketInit, this, ::_1, ::_2));
+        server_->set_http_handler(boost::bind(&Server::OnHttpRequest, this, ::_1));
 
         // Setup logging
         server_->get_alog().clear_channels(websocketpp::log::alevel::all);
@@ -291,9 +326,14 @@ bool Server::Start()
         // Start the server accept loop
         server_->start_accept();
 
-        // Start the server polling thread
-        thread_.server_ = server_;
-        thread_.start();
+        // Start the I/O threads, which all run the same asio io_service
+        for(int i = 0; i < numThreads_; ++i)
+        {
+            ServerThread *thread = new ServerThread();
+            thread->server_ = server_;
+            threads_ << thread;
+            thread->start();
+        }
 
     } 
     catch (std::exception &e) 
@@ -302,8 +342,8 @@ bool Server::Start()
         return false;
     }
     
-    qDebug() << QString(LC + "Started to port %1 with %2 listeners threads in main thread")
-        .arg(port_).arg(QThread::idealThreadCount() > 0 ? QThread::idealThreadCount() : 1).toStdString().c_str() 
+    qDebug() << QString(LC + "Started to port %1 with %2 I/O threads in main thread")
+        .arg(port_).arg(threads_.size()).toStdString().c_str() 
         << QThread::currentThreadId();
 
     emit ServerStarted();
@@ -318,7 +358,10 @@ void Server::Stop()
         if (server_)
         {
             server_->stop();
-            thread_.wait();
+            foreach(ServerThread *thread, threads_)
+                thread->wait();
+            qDeleteAll(threads_);
+            threads_.clear();
             emit ServerStopped();
         }
     }
@@ -336,77 +379,28 @@ void Server::Stop()
 void Server::Reset()
 {
     connections_.clear();
+    messagePool_->Clear();
+    events_.Clear();
 
     server_.reset();
 }
 
 void Server::OnConnected(ConnectionHandle connection)
 {
-    QMutexLocker lock(&mutexEvents_);
-
-    ConnectionPtr connectionPtr = server_->get_con_from_hdl(connection);
-
-    // Find existing events and remove them if we got duplicates 
-    // that were not synced to main thread yet.
-    QList<SocketEvent*> removeItems;
-    for (int i=0; i<events_.size(); ++i)
-    {
-        // Remove any and all messages from this connection, 
-        // if there are any data messages for this connection.
-        // Which is not possible in theory.
-        SocketEvent *existing = events_[i];
-        if (existing->connection == connectionPtr)
-            removeItems << existing;
-    }
-    if (!removeItems.isEmpty())
-    {
-        foreach(SocketEvent *existing, removeItems)
-        {
-            events_.removeAll(existing);
-            SAFE_DELETE(existing);
-        }
-        removeItems.clear();
-    }
-
-    events_ << new SocketEvent(connectionPtr, SocketEvent::Connected);
-        
-    mutexEvents_.unlock();
+    // Events of a connection that were queued before this one are dropped in Update().
+    events_.Push(new SocketEvent(server_->get_con_from_hdl(connection), SocketEvent::Connected));
+    framework_->App()->Wake();
 }
 
 void Server::OnDisconnected(ConnectionHandle connection)
 {
-    QMutexLocker lock(&mutexEvents_);
-
-    ConnectionPtr connectionPtr = server_->get_con_from_hdl(connection);
-
-    // Find existing events and remove them if we got duplicates 
-    // that were not synced to main thread yet.
-    QList<SocketEvent*> removeItems;
-    for (int i=0; i<events_.size(); ++i)
-    {
-        // Remove any and all messages from this connection, 
-        // no need to process he is disconnecting
-        SocketEvent *existing = events_[i];
-        if (existing->connection == connectionPtr)
-            removeItems << existing;
-    }
-    if (!removeItems.isEmpty())
-    {
-        foreach(SocketEvent *existing, removeItems)
-        {
-            events_.removeAll(existing);
-            SAFE_DELETE(existing);
-        }
-        removeItems.clear();
-    }
-
-    events_ << new SocketEvent(connectionPtr, SocketEvent::Disconnected);
+    // Events of a connection that were queued before this one are dropped in Update(), no need to process them as it is disconnecting.
+    events_.Push(new SocketEvent(server_->get_con_from_hdl(connection), SocketEvent::Disconnected));
+    framework_->App()->Wake();
 }
 
 void Server::OnMessage(ConnectionHandle connection, MessagePtr data)
 {   
-    QMutexLocker lock(&mutexEvents_);
-
     ConnectionPtr connectionPtr = server_->get_con_from_hdl(connection);
 
     if (data->get_opcode() == websocketpp::frame::opcode::TEXT)
@@ -426,7 +420,8 @@ void Server::OnMessage(ConnectionHandle connection, MessagePtr data)
         event->data = DataSerializerPtr(new kNet::DataSerializer(payload.size()));
         event->data->AddAlignedByteArray(&payload[0], payload.size());
 
-        events_ << event;
+        events_.Push(event);
+        framework_->App()->Wake();
     }
 }
 
@@ -436,24 +431,25 @@ void Server::OnScriptEngineCreated(QScriptEngine *engine)
 }
 
 
-/// \todo Implement actual registering of http handlers, for now disabled
-/*
-void Server::OnHttpRequest(WebSocket::ConnectionHandle connection)
+void Server::OnHttpRequest(ConnectionHandle connection)
 {
-    QByteArray resourcePath = QString::fromStdString(connection->get_resource()).toUtf8();
-
-    qDebug() << "OnHttpRequest" << resourcePath;
-        
-    QByteArray data("Hello World to " + resourcePath);
-    std::string payload;
-    payload.resize(data.size());
-    memcpy((void*)payload.data(), (void*)data.data(), data.size());
-    
-    connection->set_status(websocketpp::http::status_code::ok);
-    connection->set_body(payload);
-    connection->replace_header("Content-Length", QString::number(data.size()).toStdString());
+    // Called in the I/O threads. Serves the metrics of the MetricsRegistry, which are rendered in the main thread.
+    ConnectionPtr connectionPtr = server_->get_con_from_hdl(connection);
+    const std::string resource = connectionPtr->get_resource();
+    MetricsRegistry *metrics = framework_->Metrics();
+    if (metrics->IsEnabled() && (resource == "/metrics" || resource.compare(0, 9, "/metrics?") == 0))
+    {
+        const QByteArray data = metrics->Exposition();
+        connectionPtr->set_status(websocketpp::http::status_code::ok);
+        connectionPtr->replace_header("Content-Type", "text/plain; version=0.0.4; charset=utf-8");
+        connectionPtr->set_body(std::string(data.constData(), data.size()));
+    }
+    else
+    {
+        connectionPtr->set_status(websocketpp::http::status_code::not_found);
+        connectionPtr->set_body("Not found");
+    }
 }
-*/
 
 void Server::OnSocketInit(ConnectionHandle connection, boost::asio::ip::tcp::socket& s)
 {
@@ -20,7 +20,8 @@
 #include <QStringList>
 #include <QFileInfo>
 #include <QDateTime>
-#include <QMutex>
+#include <QAtomicPointer>
+#include <QList>
 
 #include <websocketpp/config/asio_no_tls.hpp>
 #include <websocketpp/server.hpp>
@@ -52,13 +53,60 @@ namespace WebSocket
         WebSocket::ConnectionPtr connection;
         DataSerializerPtr data;
         EventType type;
+        SocketEvent *next; ///< Next event in SocketEventQueue.
 
-        SocketEvent() : type(None) {}
-        SocketEvent(WebSocket::ConnectionPtr connection_, EventType type_) : connection(connection_), type(type_) {}
+        SocketEvent() : type(None), next(0) {}
+        SocketEvent(WebSocket::ConnectionPtr connection_, EventType type_) : connection(connection_), type(type_), next(0) {}
     };
 
-    /// Server run thread
-    class ServerThread : public QThread
+    /// Lock-free queue of socket events, pushed from the websocketpp I/O threads and taken by the main thread.
+    /** Events are pushed to an intrusive stack with compare-and-swap. The consumer takes the whole stack at once,
+        so there are no single pops and no ABA problem. */
+    class SocketEventQueue
+    {
+    public:
+        SocketEventQueue() : head_(0) {}
+        ~SocketEventQueue() { Clear(); }
+
+        /// Pushes an event to the queue, taking ownership of it. Can be called from any thread.
+        void Push(SocketEvent *event)
+        {
+            SocketEvent *head;
+            do
+            {
+                head = head_;
+                event->next = head;
+            } while(!head_.testAndSetRelease(head, event));
+        }
+
+        /// Takes all queued events, in the order they were pushed. The caller takes ownership of the events.
+        void TakeAll(QList<SocketEvent*> &events)
+        {
+            // The stack is linked newest first, so reverse it.
+            SocketEvent *event = head_.fetchAndStoreAcquire(0);
+            SocketEvent *oldest = 0;
+            while(event)
+            {
+                SocketEvent *next = event->next;
+                event->next = oldest;
+                oldest = event;
+                event = next;
+            }
+            for(; oldest; oldest = oldest->next)
+                events << oldest;
+        }
+
+        /// Deletes all queued events.
+        void Clear()
+        {
+            QList<SocketEvent*> events;
+            TakeAll(events);
+            qDeleteAll(events);
+        }
+
+    private:
+        QAtomicPointer<SocketEvent> head_;
+    };
     {
     public:
         virtual void run();
@@ -95,6 +143,9 @@ namespace WebSocket
 
         /// Returns all user connections
         WebSocket::UserConnectionList UserConnections() { return connections_; }
+
+        /// Returns the pool that outbound messages are prepared to. Use to prepare a message once for sending it to many connections.
+        WebSocket::MessagePoolPtr MessagePool() const { return messagePool_; }
         
     private slots:
         void OnScriptEngineCreated(QScriptEngine *engine);
@@ -129,9 +180,12 @@ namespace WebSocket
         // Websocket connections. Once login is finalized, they are also added to TundraProtocolModule's connection list
         WebSocket::UserConnectionList connections_;
 
-        ServerThread thread_;
+        WebSocket::MessagePoolPtr messagePool_;
+
+        /// Threads running the asio I/O service. websocketpp serializes the handlers of each connection with a per-connection strand.
+        QList<ServerThread*> threads_;
+        int numThreads_; ///< Number of I/O threads, set with --websocketThreads.
 
-        QMutex mutexEvents_;
-        QList<SocketEvent*> events_;
+        SocketEventQueue events_;
     };
 }
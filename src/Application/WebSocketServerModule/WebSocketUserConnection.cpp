@@ -1,5 +1,6 @@
 
 #include "WebSocketUserConnection.h"
+#include "WebSocketMessagePool.h"
 #include "LoggingFunctions.h"
 
 #include "kNet/DataDeserializer.h"
@@ -9,12 +10,25 @@
 
 #include <QTimer>
 
+#include <cstring>
+
+namespace
+{
+/// Coalesced frame size in bytes after which the frame is flushed before appending more messages.
+const size_t cMaxCoalescedFrameSize = 64 * 1024;
+}
+
 namespace WebSocket
 {
 
-UserConnection::UserConnection(ConnectionPtr connection_)
+UserConnection::UserConnection(ConnectionPtr connection_, MessagePoolPtr messagePool) :
+    messagePool_(messagePool),
+    supportsPreparedMessages_(false)
 {
     webSocketConnection = ConnectionWeakPtr(connection_);
+    // The legacy hixie-76 handshake does not have a version header. All later protocol versions share the RFC 6455 framing.
+    if (connection_)
+        supportsPreparedMessages_ = !connection_->get_request_header("Sec-WebSocket-Version").empty();
 }
 
 UserConnection::~UserConnection()
@@ -25,6 +39,21 @@ UserConnection::~UserConnection()
 
 void UserConnection::Send(kNet::message_id_t id, const char* data, size_t numBytes, bool reliable, bool inOrder, unsigned long priority, unsigned long contentID)
 {
+    if (protocolVersion >= ProtocolWebSocketCoalescedFrames)
+    {
+        // The message ID is written as a little-endian u16, the same as kNet::DataSerializer::Add<u16> does.
+        const char idBytes[2] = { (char)(id & 0xFF), (char)((id >> 8) & 0xFF) };
+        Coalesce(idBytes, sizeof(idBytes), data, numBytes);
+        return;
+    }
+
+    if (messagePool_ && supportsPreparedMessages_)
+    {
+        if (!webSocketConnection.expired())
+            Send(messagePool_->Prepare(id, data, numBytes));
+        return;
+    }
+
     kNet::DataSerializer ds(numBytes + 2);
     ds.Add<u16>(id);
     if (numBytes)
@@ -47,6 +76,66 @@ void UserConnection::Send(const kNet::DataSerializer &data)
     webSocketConnection.lock()->send(static_cast<void*>(data.GetData()), static_cast<uint64_t>(data.BytesFilled()));
 }
 
+void UserConnection::Send(MessagePtr message)
+{
+    if (!message)
+        return;
+    if (protocolVersion >= ProtocolWebSocketCoalescedFrames)
+    {
+        const std::string &payload = message->get_payload();
+        Coalesce(0, 0, payload.data(), payload.size());
+        return;
+    }
+    if (!supportsPreparedMessages_)
+        return;
+    ConnectionPtr connection = webSocketConnection.lock();
+    if (connection)
+        connection->send(message);
+}
+
+void UserConnection::Flush()
+{
+    if (coalescedFrame_.empty())
+        return;
+    SendFrame(&coalescedFrame_[0], coalescedFrame_.size());
+    coalescedFrame_.clear();
+}
+
+void UserConnection::Coalesce(const char *prefix, size_t prefixSize, const char *data, size_t numBytes)
+{
+    if (webSocketConnection.expired())
+        return;
+
+    const size_t messageSize = prefixSize + numBytes;
+    char sizeBytes[4];
+    kNet::DataSerializer sizeDs(sizeBytes, sizeof(sizeBytes));
+    sizeDs.AddVLE<kNet::VLE8_16_32>((u32)messageSize);
+
+    if (!coalescedFrame_.empty() && coalescedFrame_.size() + sizeDs.BytesFilled() + messageSize > cMaxCoalescedFrameSize)
+        Flush();
+
+    const size_t offset = coalescedFrame_.size();
+    coalescedFrame_.resize(offset + sizeDs.BytesFilled() + messageSize);
+    char *dst = &coalescedFrame_[offset];
+    memcpy(dst, sizeBytes, sizeDs.BytesFilled());
+    dst += sizeDs.BytesFilled();
+    if (prefixSize)
+        memcpy(dst, prefix, prefixSize);
+    if (numBytes)
+        memcpy(dst + prefixSize, data, numBytes);
+}
+
+void UserConnection::SendFrame(const char *data, size_t numBytes)
+{
+    ConnectionPtr connection = webSocketConnection.lock();
+    if (!connection || !numBytes)
+        return;
+    if (messagePool_ && supportsPreparedMessages_)
+        connection->send(messagePool_->Prepare(data, numBytes));
+    else
+        connection->send(static_cast<const void*>(data), static_cast<uint64_t>(numBytes));
+}
+
 void UserConnection::Disconnect()
 {
     if (!webSocketConnection.expired())
@@ -17,6 +17,8 @@
 #include <QString>
 #include <QVariant>
 
+#include <vector>
+
 namespace WebSocket
 {
     class WEBSOCKET_SERVER_MODULE_API UserConnection : public ::UserConnection
@@ -24,7 +26,8 @@ namespace WebSocket
         Q_OBJECT
 
     public:
-        UserConnection(ConnectionPtr connection_);
+        /// @param messagePool Pool that outbound messages are prepared to, null to frame each message by websocketpp.
+        UserConnection(ConnectionPtr connection_, MessagePoolPtr messagePool = MessagePoolPtr());
         ~UserConnection();
 
         virtual QString ConnectionType() const { return "websocket"; }
@@ -34,8 +37,23 @@ namespace WebSocket
         void Send(const kNet::DataSerializer &data);
 
         /// Queue a network message to be sent to the client. All implementations may not use the reliable, inOrder, priority and contentID parameters.
+        /** If the client has ProtocolWebSocketCoalescedFrames, the message is appended to the frame sent by Flush().
+            Otherwise, if the connection has a message pool and supports prepared messages, the message is framed directly into a pooled message. */
         virtual void Send(kNet::message_id_t id, const char* data, size_t numBytes, bool reliable, bool inOrder, unsigned long priority = 100, unsigned long contentID = 0);
 
+        /// Queue a message prepared with MessagePool::Prepare(id, data, numBytes) to be sent to the client. The same message can be sent to many connections.
+        /** If the client has ProtocolWebSocketCoalescedFrames, the message is appended to the frame sent by Flush().
+            Otherwise does nothing if the connection does not support prepared messages. */
+        void Send(MessagePtr message);
+
+        /// Sends the messages coalesced since the last flush as one frame.
+        /** The frame is a sequence of messages, each prefixed by its size in bytes, including the message ID, as a VLE8_16_32.
+            Called by SyncManager at the end of each network update tick, and by Server after processing the received messages. */
+        virtual void Flush();
+
+        /// Returns whether prepared messages can be sent to the client, i.e. whether the connection uses RFC 6455 framing.
+        bool SupportsPreparedMessages() const { return supportsPreparedMessages_; }
+
         ConnectionWeakPtr webSocketConnection;
 
     public slots:
@@ -43,7 +61,16 @@ namespace WebSocket
         virtual void Close();
 
         void DisconnectDelayed(int msec = 1000);
-        
-        
+
+    private:
+        /// Appends a message to the coalesced frame, flushing first if the frame would grow too large.
+        void Coalesce(const char *prefix, size_t prefixSize, const char *data, size_t numBytes);
+
+        /// Sends a frame of the data, prepared to a pooled message if possible.
+        void SendFrame(const char *data, size_t numBytes);
+
+        MessagePoolPtr messagePool_;
+        bool supportsPreparedMessages_;
+        std::vector<char> coalescedFrame_; ///< Messages coalesced since the last flush.
     };
 }
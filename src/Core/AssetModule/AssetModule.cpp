@@ -10,6 +10,8 @@
 #include "Profiler.h"
 #include "CoreException.h"
 #include "AssetAPI.h"
+#include "AssetCache.h"
+#include "IAsset.h"
 #include "LocalAssetStorage.h"
 #include "ConsoleAPI.h"
 #include "Application.h"
@@ -322,6 +324,7 @@ void AssetModule::HandleAssetDiscovery(kNet::MessageConnection* source, MsgAsset
 {
     QString assetRef = QString::fromStdString(BufferToString(msg.assetRef));
     QString assetType = QString::fromStdString(BufferToString(msg.assetType));
+    QString contentHash = QString::fromStdString(BufferToString(msg.contentHash));
     
     // Check for possible malicious discovery message and ignore it. Otherwise let AssetAPI handle
     if (!ShouldReplicateAssetDiscovery(assetRef))
@@ -339,7 +342,7 @@ void AssetModule::HandleAssetDiscovery(kNet::MessageConnection* source, MsgAsset
         }
 
     // Then let assetAPI handle locally
-    framework_->Asset()->HandleAssetDiscovery(assetRef, assetType);
+    framework_->Asset()->HandleAssetDiscovery(assetRef, assetType, contentHash);
 }
 
 void AssetModule::HandleAssetDeleted(kNet::MessageConnection* source, MsgAssetDeleted& msg)
@@ -377,6 +380,11 @@ void AssetModule::OnAssetUploaded(const QString& assetRef)
     MsgAssetDiscovery msg;
     msg.assetRef = StringToBuffer(assetRef.toStdString()); /// @bug Convert to UTF-8 instead!
     /// \todo Would preferably need the assettype as well
+    // Advertise the content hash, so that the receivers that already have the data cached need not download it
+    AssetPtr asset = framework_->Asset()->GetAsset(assetRef);
+    std::vector<u8> data;
+    if (asset && asset->SerializeTo(data) && !data.empty())
+        msg.contentHash = StringToBuffer(AssetCache::ComputeContentHash(&data[0], data.size()).toStdString());
     
     // If we are server, send to everyone
     if (tundra->IsServer())
@@ -456,7 +464,7 @@ void AssetModule::ConsoleDumpAssetTransfers()
 void AssetModule::ConsoleDumpAssets()
 {
     LogInfo("Current assets:");
-    const AssetMap& assets = framework_->Asset()->GetAllAssets();
+    const AssetMap& assets = framework_->Asset()->AllAssets();
     for(AssetMap::const_iterator i = assets.begin(); i != assets.end(); ++i)
     {
         QString name = i->first;
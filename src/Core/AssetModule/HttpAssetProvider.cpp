@@ -13,6 +13,7 @@
 #include "IAsset.h"
 #include "LoggingFunctions.h"
 #include "Profiler.h"
+#include "MetricsRegistry.h"
 
 #include <QAbstractNetworkCache>
 #include <QNetworkAccessManager>
@@ -21,6 +22,8 @@
 #include <QLocale>
 #include <QThreadPool>
 
+#include <algorithm>
+
 #include "MemoryLeakCheck.h"
 
 /** Uncomment to enable a --disable_http_ifmodifiedsince command line parameter.
@@ -31,6 +34,17 @@
     force smaller files be written in the main thread. */
 int HttpAssetProvider::AsyncCacheWriteThreshold = 0 * 1024;
 
+/** Same as the number of connections QNetworkAccessManager opens to a host, so that
+    a started request is sent right away instead of waiting in the queue of Qt. */
+int HttpAssetProvider::MaxRequestsPerHost = 6;
+
+int HttpAssetProvider::MinResumableSize = 64 * 1024;
+
+/** Keeps the memory use of a large upload at UploadPartSize * MaxParallelUploadParts. */
+int HttpAssetProvider::UploadPartSize = 8 * 1024 * 1024;
+
+int HttpAssetProvider::MaxParallelUploadParts = 4;
+
 HttpAssetProvider::HttpAssetProvider(Framework *framework_) :
     framework(framework_),
     networkAccessManager(0)
@@ -44,6 +58,18 @@ HttpAssetProvider::HttpAssetProvider(Framework *framework_) :
 
     enableRequestsOutsideStorages = (framework_->HasCommandLineParameter("--acceptUnknownHttpSources") ||
         framework_->HasCommandLineParameter("--accept_unknown_http_sources"));  /**< @todo Remove support for the deprecated underscore version at some point. */
+
+    pipelineAllRequests = framework_->HasCommandLineParameter("--httpPipelining");
+    QStringList maxRequestsParam = framework_->CommandLineParameters("--httpMaxRequestsPerHost");
+    if (!maxRequestsParam.isEmpty())
+    {
+        bool ok = false;
+        int maxRequests = maxRequestsParam.last().toInt(&ok);
+        if (ok && maxRequests > 0)
+            MaxRequestsPerHost = maxRequests;
+        else
+            LogWarning("HttpAssetProvider: Invalid --httpMaxRequestsPerHost value " + maxRequestsParam.last() + ", using " + QString::number(MaxRequestsPerHost) + ".");
+    }
 }
 
 HttpAssetProvider::~HttpAssetProvider()
@@ -65,6 +91,12 @@ void HttpAssetProvider::AboutToExit()
     if (!framework->IsExiting())
         return;
 
+    queuedRequests.clear();
+    activeRequestsPerHost.clear();
+    uploadParts.clear();
+    for(TransferMap::const_iterator iter = transfers.begin(); iter != transfers.end(); ++iter)
+        if (iter->first.data())
+            SavePartialDownload(iter->first.data(), iter->second);
     if (networkAccessManager)
         SAFE_DELETE(networkAccessManager);
 }
@@ -91,6 +123,8 @@ QByteArray HttpAssetProvider::CreateHttpDate(const QDateTime &dateTime)
 
 void HttpAssetProvider::Update(f64 /*frametime*/)
 {
+    StartQueuedRequests();
+
     if (!completedTransfers.isEmpty())
     {
         const int maxLoadMSecs = 16;
@@ -150,6 +184,20 @@ AssetTransferPtr HttpAssetProvider::RequestAsset(QString assetRef, QString asset
     transfer->storage = GetStorageForAssetRef(assetRef);
     transfer->diskSourceType = IAsset::Cached; // The asset's disk source will represent a cached version of the original on the http server
 
+    // If a server has advertised the content hash of the cached data during this run, the data is up to date
+    AssetCache *cache = framework->Asset()->Cache();
+    if (cache && cache->IsVerified(assetRef))
+    {
+        QString verifiedPath = cache->FindInCache(assetRef);
+        if (!verifiedPath.isEmpty())
+        {
+            framework->Metrics()->Add("tundra_asset_cache_requests_total", 1.0, "result=\"hit\"");
+            transfer->SetCachingBehavior(false, verifiedPath);
+            completedTransfers.push_back(transfer);
+            return transfer;
+        }
+    }
+
 #ifdef HTTPASSETPROVIDER_NO_HTTP_IF_MODIFIED_SINCE
     QString cachePath = framework->Asset()->GetAssetCache()->FindInCache(assetRef);
     if (framework->HasCommandLineParameter("--disable_http_ifmodifiedsince") && !cachePath.isEmpty())
@@ -170,18 +218,138 @@ AssetTransferPtr HttpAssetProvider::RequestAsset(QString assetRef, QString asset
         QDateTime cacheLastModified = framework->Asset()->GetAssetCache()->LastModified(assetRef);
         if (cacheLastModified.isValid())
             request.setRawHeader("If-Modified-Since", CreateHttpDate(cacheLastModified));
+        // Otherwise resume an interrupted download. If-Range makes the server send the whole asset if it has changed since.
+        else if (cache && cache->PartialSize(transfer->source.ref) > 0)
+        {
+            transfer->resumeOffset = cache->PartialSize(transfer->source.ref);
+            request.setRawHeader("Range", "bytes=" + QByteArray::number(transfer->resumeOffset) + "-");
+            request.setRawHeader("If-Range", cache->PartialValidator(transfer->source.ref).toUtf8());
+        }
         
-        QNetworkReply *reply = networkAccessManager->get(request);
-        transfers[QPointer<QNetworkReply>(reply)] = transfer;
+        // Started in Update, so that the requests made during the frame are started in the order of their priority
+        QueuedRequest queued;
+        queued.transfer = transfer;
+        queued.host = request.url().host().toLower();
+        HttpAssetStorage *storage = dynamic_cast<HttpAssetStorage *>(transfer->storage.lock().get());
+        queued.pipelined = pipelineAllRequests || (storage && storage->pipelining);
+        if (queued.pipelined)
+            request.setAttribute(QNetworkRequest::HttpPipeliningAllowedAttribute, true);
+        queued.request = request;
+        queuedRequests.push_back(queued);
     }
     return transfer;
 }
 
+void HttpAssetProvider::StartQueuedRequests()
+{
+    if (queuedRequests.empty() || !networkAccessManager)
+        return;
+
+    bool hasFreeSlots = false;
+    for(size_t i = 0; i < queuedRequests.size() && !hasFreeSlots; ++i)
+        hasFreeSlots = (activeRequestsPerHost[queuedRequests[i].host] < MaxRequests(queuedRequests[i]));
+    if (!hasFreeSlots)
+        return;
+
+    PROFILE(HttpAssetProvider_StartQueuedRequests);
+
+    // Sort by descending priority. The index keeps the request order of the requests of equal priority.
+    AssetAPI *assetAPI = framework->Asset();
+    std::vector<std::pair<float, size_t> > order;
+    order.reserve(queuedRequests.size());
+    for(size_t i = 0; i < queuedRequests.size(); ++i)
+        order.push_back(std::make_pair(-assetAPI->TransferPriority(queuedRequests[i].transfer.get()), i));
+    std::sort(order.begin(), order.end());
+
+    std::vector<bool> started(queuedRequests.size(), false);
+    for(size_t i = 0; i < order.size(); ++i)
+    {
+        QueuedRequest &queued = queuedRequests[order[i].second];
+        int &numActive = activeRequestsPerHost[queued.host];
+        if (numActive >= MaxRequests(queued))
+            continue;
+        ++numActive;
+        queued.transfer->requestHost = queued.host;
+        queued.transfer->RecordTime(IAssetTransfer::TimeStarted);
+        QNetworkReply *reply = networkAccessManager->get(queued.request);
+        connect(reply, SIGNAL(metaDataChanged()), SLOT(OnHttpReplyMetaDataChanged()), Qt::UniqueConnection);
+        transfers[QPointer<QNetworkReply>(reply)] = queued.transfer;
+        started[order[i].second] = true;
+    }
+
+    size_t numQueued = 0;
+    for(size_t i = 0; i < queuedRequests.size(); ++i)
+        if (!started[i])
+            queuedRequests[numQueued++] = queuedRequests[i];
+    queuedRequests.resize(numQueued);
+}
+
+int HttpAssetProvider::MaxRequests(const QueuedRequest &queued)
+{
+    return queued.pipelined ? MaxRequestsPerHost * PipelinedRequestsPerConnection : MaxRequestsPerHost;
+}
+
+void HttpAssetProvider::ReleaseRequestSlot(const HttpAssetTransferPtr &transfer)
+{
+    if (transfer->requestHost.isEmpty())
+        return;
+    std::map<QString, int>::iterator iter = activeRequestsPerHost.find(transfer->requestHost);
+    if (iter != activeRequestsPerHost.end() && --iter->second <= 0)
+        activeRequestsPerHost.erase(iter);
+    transfer->requestHost.clear();
+}
+
+bool HttpAssetProvider::ContinuesPartialData(QNetworkReply *reply, const HttpAssetTransferPtr &transfer) const
+{
+    // Content-Range: bytes <first>-<last>/<total>
+    QByteArray range = reply->rawHeader("Content-Range").trimmed();
+    if (!range.startsWith("bytes ") || range.indexOf('-') < 0)
+        return false;
+    bool ok = false;
+    qint64 first = range.mid(6, range.indexOf('-') - 6).trimmed().toLongLong(&ok);
+    AssetCache *cache = framework->Asset()->Cache();
+    return ok && first == transfer->resumeOffset && cache && cache->PartialSize(transfer->source.ref) == transfer->resumeOffset;
+}
+
+void HttpAssetProvider::SavePartialDownload(QNetworkReply *reply, const HttpAssetTransferPtr &transfer)
+{
+    AssetCache *cache = framework->Asset()->Cache();
+    int httpStatusCode = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    if (!cache || !transfer->CachingAllowed() || (httpStatusCode != 200 && httpStatusCode != 206))
+        return;
+    if (httpStatusCode == 206 && !ContinuesPartialData(reply, transfer))
+        return;
+
+    // If-Range needs a strong validator: a strong ETag, or the Last-Modified date.
+    QByteArray validator = reply->rawHeader("ETag");
+    if (validator.isEmpty() || validator.startsWith("W/"))
+        validator = reply->rawHeader("Last-Modified");
+    if (validator.isEmpty())
+        return;
+
+    qint64 offset = (httpStatusCode == 206 ? transfer->resumeOffset : 0);
+    QByteArray data = reply->readAll();
+    if (data.isEmpty() || offset + data.size() < MinResumableSize)
+        return;
+    if (cache->StorePartial(transfer->source.ref, offset, data, QString::fromUtf8(validator)))
+        LogDebug(QString("HttpAssetProvider: Stored %1 bytes of the interrupted download of %2 for resuming.").arg(offset + data.size()).arg(transfer->source.ref));
+}
+
 bool HttpAssetProvider::AbortTransfer(IAssetTransfer *transfer)
 {
     if (!transfer)
         return false;
 
+    // A queued transfer has no reply yet, so it is aborted right away.
+    for(size_t i = 0; i < queuedRequests.size(); ++i)
+        if (queuedRequests[i].transfer.get() == transfer)
+        {
+            HttpAssetTransferPtr queuedTransfer = queuedRequests[i].transfer;
+            queuedRequests.erase(queuedRequests.begin() + i);
+            framework->Asset()->AssetTransferAborted(queuedTransfer.get());
+            return true;
+        }
+
     for (TransferMap::iterator iter = transfers.begin(); iter != transfers.end(); ++iter)
     {
         AssetTransferPtr ongoingTransfer = iter->second;
@@ -192,6 +360,8 @@ bool HttpAssetProvider::AbortTransfer(IAssetTransfer *transfer)
             QPointer<QNetworkReply> reply = iter->first;
             if (reply.data())
             {    
+                // Aborting discards the data received so far, so store it first.
+                SavePartialDownload(reply.data(), iter->second);
                 reply->abort();
                 return true;
             }
@@ -219,10 +389,186 @@ AssetUploadTransferPtr HttpAssetProvider::UploadAssetFromFileInMemory(const u8 *
     transfer->destinationName = assetName;
 
     uploadTransfers[reply] = transfer;
+    connect(reply, SIGNAL(uploadProgress(qint64, qint64)), SLOT(OnHttpUploadProgress(qint64, qint64)));
 
     return transfer;
 }
 
+AssetUploadTransferPtr HttpAssetProvider::UploadAssetFromDevice(const shared_ptr<QIODevice> &device, AssetStoragePtr destination, const QString &assetName)
+{
+    // The size of a sequential device is not known before it has been read, so it cannot be streamed.
+    if (device->isSequential())
+        return IAssetProvider::UploadAssetFromDevice(device, destination, assetName);
+    const qint64 size = device->size() - device->pos();
+    if (size <= 0)
+        return AssetUploadTransferPtr();
+
+    if (!networkAccessManager)
+        CreateAccessManager();
+
+    AssetUploadTransferPtr transfer = MAKE_SHARED(IAssetUploadTransfer);
+    transfer->destinationStorage = destination;
+    transfer->destinationProvider = shared_from_this();
+    transfer->destinationName = assetName;
+    transfer->sourceDevice = device;
+    transfer->totalBytes = size;
+
+    const QString dstUrl = destination->GetFullAssetURL(assetName);
+    HttpAssetStorage *httpStorage = dynamic_cast<HttpAssetStorage*>(destination.get());
+    if (httpStorage && httpStorage->partialUpload && size > UploadPartSize)
+    {
+        PartedUploadPtr upload = MAKE_SHARED(PartedUpload);
+        upload->transfer = transfer;
+        upload->url = dstUrl;
+        upload->size = size;
+        upload->nextOffset = device->pos();
+        upload->bytesDone = 0;
+        upload->partsInFlight = 0;
+        upload->failed = false;
+        StartUploadParts(upload);
+        // If some parts were started, the failure is reported by the transfer when they are done.
+        if (upload->failed && upload->partsInFlight == 0)
+            return AssetUploadTransferPtr();
+        return transfer;
+    }
+
+    QNetworkRequest request;
+    request.setUrl(QUrl(dstUrl));
+    request.setRawHeader("User-Agent", "realXtend Tundra");
+    request.setHeader(QNetworkRequest::ContentLengthHeader, size);
+
+    // Qt reads the data from the device as it is sent.
+    QNetworkReply *reply = networkAccessManager->put(request, device.get());
+    uploadTransfers[reply] = transfer;
+    connect(reply, SIGNAL(uploadProgress(qint64, qint64)), SLOT(OnHttpUploadProgress(qint64, qint64)));
+
+    return transfer;
+}
+
+void HttpAssetProvider::StartUploadParts(const PartedUploadPtr &upload)
+{
+    const qint64 end = upload->transfer->sourceDevice->size();
+    while(!upload->failed && upload->partsInFlight < MaxParallelUploadParts && upload->nextOffset < end)
+    {
+        const qint64 length = std::min((qint64)UploadPartSize, end - upload->nextOffset);
+        if (!StartUploadPart(upload, upload->nextOffset, length, 0))
+        {
+            upload->failed = true;
+            break;
+        }
+        upload->nextOffset += length;
+    }
+}
+
+bool HttpAssetProvider::StartUploadPart(const PartedUploadPtr &upload, qint64 offset, qint64 length, int retries)
+{
+    QIODevice *device = upload->transfer->sourceDevice.get();
+    const qint64 end = device->size();
+    QByteArray data;
+    if (device->seek(offset))
+        data = device->read(length);
+    if (data.size() != length)
+    {
+        LogError(QString("HttpAssetProvider: Failed to read bytes %1-%2 of the upload to \"%3\".").arg(offset).arg(offset + length - 1).arg(upload->url));
+        return false;
+    }
+
+    // The range is relative to the start of the asset, which can be after the start of the device.
+    const qint64 start = offset - (end - upload->size);
+    QNetworkRequest request;
+    request.setUrl(QUrl(upload->url));
+    request.setRawHeader("User-Agent", "realXtend Tundra");
+    request.setRawHeader("Content-Range", QString("bytes %1-%2/%3").arg(start).arg(start + length - 1).arg(upload->size).toAscii());
+
+    QNetworkReply *reply = networkAccessManager->put(request, data);
+    UploadPart part;
+    part.upload = upload;
+    part.offset = offset;
+    part.length = length;
+    part.bytesSent = 0;
+    part.retries = retries;
+    uploadParts[reply] = part;
+    ++upload->partsInFlight;
+    connect(reply, SIGNAL(uploadProgress(qint64, qint64)), SLOT(OnHttpUploadProgress(qint64, qint64)));
+    return true;
+}
+
+void HttpAssetProvider::OnUploadPartFinished(QNetworkReply *reply)
+{
+    UploadPartMap::iterator iter = uploadParts.find(reply);
+    UploadPart part = iter->second;
+    uploadParts.erase(iter);
+    PartedUploadPtr upload = part.upload;
+    AssetUploadTransferPtr transfer = upload->transfer;
+    --upload->partsInFlight;
+
+    const QString replyUrl = reply->url().toString();
+    if (reply->error() == QNetworkReply::NoError)
+    {
+        upload->bytesDone += part.length;
+        transfer->SetProgress(upload->bytesDone, upload->size);
+    }
+    else if (!upload->failed && part.retries < MaxUploadPartRetries)
+    {
+        LogWarning(QString("Http upload of bytes %1-%2 to address \"%3\" failed with an error: %4. Sending the part again.")
+            .arg(part.offset).arg(part.offset + part.length - 1).arg(replyUrl).arg(reply->errorString()));
+        if (!StartUploadPart(upload, part.offset, part.length, part.retries + 1))
+            upload->failed = true;
+    }
+    else
+    {
+        if (!upload->failed)
+            LogError(QString("Http upload to address \"%1\" failed with an error: %2").arg(replyUrl).arg(reply->errorString()));
+        upload->failed = true;
+    }
+
+    if (upload->failed)
+    {
+        // Report the failure once the parts that are still being sent are done.
+        if (upload->partsInFlight == 0)
+        {
+            transfer->sourceDevice.reset();
+            transfer->EmitTransferFailed();
+        }
+        return;
+    }
+
+    if (upload->partsInFlight == 0 && upload->nextOffset >= transfer->sourceDevice->size())
+    {
+        LogDebug(QString("Http upload to address \"%1\" returned successfully.").arg(replyUrl));
+        transfer->replyData = reply->readAll();
+        foreach(const QNetworkReply::RawHeaderPair &header, reply->rawHeaderPairs())
+            transfer->replyHeaders[QString(header.first)] = QString(header.second);
+        transfer->sourceDevice.reset();
+        framework->Asset()->AssetUploadTransferCompleted(transfer.get());
+        AddAssetRefToStorages(replyUrl);
+    }
+    else
+        StartUploadParts(upload);
+}
+
+void HttpAssetProvider::OnHttpUploadProgress(qint64 bytesSent, qint64 bytesTotal)
+{
+    QNetworkReply *reply = qobject_cast<QNetworkReply*>(sender());
+    UploadPartMap::iterator partIter = uploadParts.find(reply);
+    if (partIter != uploadParts.end())
+    {
+        partIter->second.bytesSent = bytesSent;
+        // The progress of a parted upload is the parts done plus what has been sent of the parts in flight.
+        const PartedUploadPtr upload = partIter->second.upload;
+        qint64 sent = upload->bytesDone;
+        for(UploadPartMap::const_iterator iter = uploadParts.begin(); iter != uploadParts.end(); ++iter)
+            if (iter->second.upload == upload)
+                sent += iter->second.bytesSent;
+        upload->transfer->SetProgress(sent, upload->size);
+        return;
+    }
+
+    UploadTransferMap::iterator iter = uploadTransfers.find(reply);
+    if (iter != uploadTransfers.end())
+        iter->second->SetProgress(bytesSent, bytesTotal > 0 ? bytesTotal : iter->second->totalBytes);
+}
+
 void HttpAssetProvider::DeleteAssetFromStorage(QString assetRef)
 {
     if (!networkAccessManager)
@@ -295,6 +641,10 @@ AssetStoragePtr HttpAssetProvider::TryDeserializeStorageFromString(const QString
             newStorage->SetReplicated(ParseBool(s["replicated"]));
         if (s.contains("trusted"))
             newStorage->trustState = IAssetStorage::TrustStateFromString(s["trusted"]);
+        if (s.contains("pipelining"))
+            newStorage->pipelining = ParseBool(s["pipelining"]);
+        if (s.contains("partialupload"))
+            newStorage->partialUpload = ParseBool(s["partialupload"]);
     }
     
     return newStorage;
@@ -326,6 +676,8 @@ void HttpAssetProvider::OnHttpTransferFinished(QNetworkReply *reply)
             return;
         HttpAssetTransferPtr transfer = iter->second;
         transfer->rawAssetData.clear();
+        transfer->RecordTime(IAssetTransfer::TimeDownloaded);
+        bool redirected = false;
 
         // We have called abort() or close() on an ongoing transfer, for example in AbortTransfer.
         if (reply->error() == QNetworkReply::OperationCanceledError)
@@ -351,11 +703,26 @@ void HttpAssetProvider::OnHttpTransferFinished(QNetworkReply *reply)
 
                 QNetworkReply *redirectReply = networkAccessManager->get(redirectRequest);
                 transfers[QPointer<QNetworkReply>(redirectReply)] = transfer;
+                redirected = true; // The redirected request keeps the request slot of the original host.
             }
             else
                 framework->Asset()->AssetTransferFailed(transfer.get(), QString("Http GET for address \"%1\" returned %2 status code but the \"Location\" header is empty, cannot request asset from redirected URL.")
                     .arg(replyUrl).arg(httpStatusCode));
         }
+        // Handle '416 Range Not Satisfiable', and partial content that does not continue the partially downloaded data, by requesting the whole asset.
+        else if (transfer->resumeOffset > 0 && (httpStatusCode == 416 || (httpStatusCode == 206 && !ContinuesPartialData(reply, transfer))))
+        {
+            LogDebug("HttpAssetProvider: Cannot resume the download of " + replyUrl + ", downloading the whole asset.");
+            framework->Asset()->GetAssetCache()->DeletePartial(transfer->source.ref);
+            transfer->resumeOffset = 0;
+
+            QNetworkRequest retryRequest = reply->request();
+            retryRequest.setRawHeader("Range", QByteArray()); // A null value removes the header.
+            retryRequest.setRawHeader("If-Range", QByteArray());
+            QNetworkReply *retryReply = networkAccessManager->get(retryRequest);
+            transfers[QPointer<QNetworkReply>(retryReply)] = transfer;
+            redirected = true; // The retried request keeps the request slot.
+        }
         // No error, proceed
         else if (reply->error() == QNetworkReply::NoError)
         {            
@@ -368,19 +735,30 @@ void HttpAssetProvider::OnHttpTransferFinished(QNetworkReply *reply)
             {
                 // Read cache file to transfer asset data
                 if (!cache->FindInCache(sourceRef).isEmpty())
+                {
+                    framework->Metrics()->Add("tundra_asset_cache_requests_total", 1.0, "result=\"hit\"");
                     transfer->diskSourceType = IAsset::Cached;
+                }
                 else
                     error = QString("Http GET for address \"%1\" returned '304 Not Modified' but existing cache file could not be opened: \"%2\"").arg(replyUrl).arg(cache->GetDiskSourceByRef(sourceRef));
             }
-            // 200 OK
-            else if (httpStatusCode == 200)
+            // 200 OK, or 206 Partial Content with the rest of the partially downloaded data
+            else if (httpStatusCode == 200 || (httpStatusCode == 206 && transfer->resumeOffset > 0))
             {
                 // Setting original source type on the request here will allow later code
                 // to detect if this is a first or update download of this asset.
                 transfer->diskSourceType = IAsset::Original;
+                framework->Metrics()->Add("tundra_asset_cache_requests_total", 1.0, "result=\"miss\"");
 
                 // Read body to transfer asset data
                 QByteArray bodyData = reply->readAll();
+                if (transfer->resumeOffset > 0)
+                {
+                    if (httpStatusCode == 206)
+                        bodyData.prepend(cache->ReadPartial(sourceRef));
+                    cache->DeletePartial(sourceRef);
+                    transfer->resumeOffset = 0;
+                }
                 if (transfer->CachingAllowed())
                 {
                     if (bodyData.size() > AsyncCacheWriteThreshold)
@@ -394,6 +772,7 @@ void HttpAssetProvider::OnHttpTransferFinished(QNetworkReply *reply)
                         QThreadPool::globalInstance()->start(cacheWriteOperation);
 
                         // Erase transfer from internal state and return.
+                        ReleaseRequestSlot(transfer);
                         transfers.erase(iter);
                         return;
                     }
@@ -401,6 +780,7 @@ void HttpAssetProvider::OnHttpTransferFinished(QNetworkReply *reply)
                     // The data size is below our threshold, write to cache on the main thread.
                     if (!cache->StoreAsset((u8*)bodyData.data(), bodyData.size(), sourceRef).isEmpty())
                     {
+                        transfer->RecordTime(IAssetTransfer::TimeCached);
                         QVariant lastModifiedVariant = reply->header(QNetworkRequest::LastModifiedHeader);
                         if (lastModifiedVariant.isValid())
                             cache->SetLastModified(sourceRef, lastModifiedVariant.toDateTime());
@@ -429,15 +809,26 @@ void HttpAssetProvider::OnHttpTransferFinished(QNetworkReply *reply)
                 framework->Asset()->AssetTransferFailed(transfer.get(), error);
         }
         else
+        {
+            SavePartialDownload(reply, transfer);
             framework->Asset()->AssetTransferFailed(transfer.get(), QString("Http GET for address \"%1\" returned an error: %2").arg(replyUrl).arg(reply->errorString()));
+        }
 
         // Erase the transfer from internal state.
+        if (!redirected)
+            ReleaseRequestSlot(transfer);
         transfers.erase(iter);
         break;
     }
     case QNetworkAccessManager::PutOperation:
     case QNetworkAccessManager::PostOperation:
     {
+        if (uploadParts.find(reply) != uploadParts.end())
+        {
+            OnUploadPartFinished(reply);
+            break;
+        }
+
         UploadTransferMap::iterator iter = uploadTransfers.find(reply);
         if (iter == uploadTransfers.end())
         {
@@ -472,6 +863,7 @@ void HttpAssetProvider::OnHttpTransferFinished(QNetworkReply *reply)
         }
 
         // Erase the transfer from internal state.
+        transfer->sourceDevice.reset();
         uploadTransfers.erase(iter);
         break;
     }
@@ -490,6 +882,13 @@ void HttpAssetProvider::OnHttpTransferFinished(QNetworkReply *reply)
     }
 }
 
+void HttpAssetProvider::OnHttpReplyMetaDataChanged()
+{
+    TransferMap::iterator iter = transfers.find(QPointer<QNetworkReply>(qobject_cast<QNetworkReply*>(sender())));
+    if (iter != transfers.end() && iter->second->Time(IAssetTransfer::TimeFirstByte) < iter->second->Time(IAssetTransfer::TimeStarted))
+        iter->second->RecordTime(IAssetTransfer::TimeFirstByte);
+}
+
 void HttpAssetProvider::OnCacheWriteCompleted(AssetTransferPtr transfer, bool cacheFileWritten)
 {
     if (!transfer.get())
@@ -498,6 +897,7 @@ void HttpAssetProvider::OnCacheWriteCompleted(AssetTransferPtr transfer, bool ca
     const QString sourceRef = transfer->source.ref;
     if (cacheFileWritten)
     {
+        transfer->RecordTime(IAssetTransfer::TimeCached);
         // Update the last modified for the cached file if available.
         QVariant lastModifiedVariant = transfer->property("LastModifiedHeader");
         if (lastModifiedVariant.isValid())
@@ -604,6 +1004,7 @@ TransferCacheWriteOperation::TransferCacheWriteOperation(AssetTransferPtr transf
 
 void TransferCacheWriteOperation::run()
 {
+    PROFILE_THREAD(HttpAssetProvider_CacheWrite);
     bool succeeded = false;
 
     // Write data to the transfer.
@@ -12,15 +12,29 @@
 #include <QByteArray>
 #include <QPointer>
 #include <QRunnable>
+#include <QNetworkRequest>
+
+#include <vector>
+#include <map>
 
 class QNetworkAccessManager;
-class QNetworkRequest;
 class QNetworkReply;
 
 class HttpAssetStorage;
 typedef shared_ptr<HttpAssetStorage> HttpAssetStoragePtr;
 
 /// Adds support for downloading assets over the web using the 'http://' specifier.
+/** The GET requests are queued and started in Update, at most MaxRequestsPerHost at a time to each host. The queued requests of
+    the highest AssetAPI::TransferPriority are started first, so a nearby mesh is downloaded before a far away texture requested
+    earlier. The priorities are evaluated again each time requests are started, so they follow the moving camera.
+
+    The requests to storages with pipelining enabled, or all requests if the --httpPipelining command line parameter is given,
+    are sent pipelined, PipelinedRequestsPerConnection of them on each connection, and that many times more of them are started
+    to each host. Qt 4 has no HTTP/2, so pipelining is the way to overlap the round trips of many small assets.
+
+    When a download of at least MinResumableSize bytes fails or is aborted, the received data is kept in the asset cache with
+    the ETag or Last-Modified validator of the reply, see AssetCache::StorePartial. The next request of the asset asks only
+    for the rest of the data with a Range request, conditional on the validator, and starts over if the asset has changed. */
 class ASSET_MODULE_API HttpAssetProvider : public QObject, public IAssetProvider, public enable_shared_from_this<HttpAssetProvider>
 {
     Q_OBJECT
@@ -62,6 +76,11 @@ public:
     /// Starts an asset upload from the given file in memory to the given storage.
     virtual AssetUploadTransferPtr UploadAssetFromFileInMemory(const u8 *data, size_t numBytes, AssetStoragePtr destination, const QString &assetName);
 
+    /// Starts an asset upload that streams the data from the given device to the given storage.
+    /** Devices larger than UploadPartSize are sent in parallel parts to the storages that support partial uploads,
+        otherwise the data is streamed in a single PUT. Sequential devices are read to memory first. */
+    virtual AssetUploadTransferPtr UploadAssetFromDevice(const shared_ptr<QIODevice> &device, AssetStoragePtr destination, const QString &assetName);
+
     /// Issues a http DELETE request for the given asset.
     virtual void DeleteAssetFromStorage(QString assetRef);
     
@@ -85,6 +104,28 @@ public:
     /// Threshold size for when to perform async cache write.
     static int AsyncCacheWriteThreshold;
 
+    /// Maximum number of concurrent GET requests to a host that are not pipelined. Further requests are queued.
+    /** Set with the --httpMaxRequestsPerHost command line parameter. The default is 6, the number of connections Qt opens to a host. */
+    static int MaxRequestsPerHost;
+
+    /// Smallest size in bytes of an interrupted download that is kept in the asset cache for resuming.
+    static int MinResumableSize;
+
+    /// Size in bytes of the parts that uploads to the storages that support partial uploads are sent in.
+    static int UploadPartSize;
+
+    /// Maximum number of the parts of an upload that are sent at the same time.
+    static int MaxParallelUploadParts;
+
+    /// Number of times a failed upload part is sent again before the upload fails.
+    static const int MaxUploadPartRetries = 3;
+
+    /// Number of pipelined GET requests Qt sends on each connection.
+    static const int PipelinedRequestsPerConnection = 3;
+
+    /// Returns the number of GET requests waiting for a free request slot of their host.
+    size_t NumQueuedRequests() const { return queuedRequests.size(); }
+
     // DEPRECATED
     QNetworkAccessManager* GetNetworkAccessManager() const { return NetworkAccessManager(); } /**< @deprecated Use NetworkAccessManager instead. */
 
@@ -92,6 +133,10 @@ private slots:
     void AboutToExit();
     void OnHttpTransferFinished(QNetworkReply *reply);
     void OnCacheWriteCompleted(AssetTransferPtr transfer, bool cacheFileWritten);
+    /// Records the time of the first response of a GET request.
+    void OnHttpReplyMetaDataChanged();
+    /// Updates the progress of the upload transfer of a PUT request.
+    void OnHttpUploadProgress(qint64 bytesSent, qint64 bytesTotal);
     
 private:
     Framework *framework;
@@ -104,6 +149,34 @@ private:
 
     /// Delete assetref from http storages after successful delete
     void DeleteAssetRefFromStorages(const QString& ref);
+
+    /// Starts the queued GET requests of the highest priority, for the hosts that have free request slots.
+    void StartQueuedRequests();
+
+    struct QueuedRequest;
+    /// Returns the maximum number of concurrent GET requests to the host of the request.
+    static int MaxRequests(const QueuedRequest &queued);
+
+    /// Frees the request slot the transfer holds, if any.
+    void ReleaseRequestSlot(const HttpAssetTransferPtr &transfer);
+
+    /// Returns whether the partial content of the reply continues the partially downloaded data in the cache that the transfer requested the rest of.
+    bool ContinuesPartialData(QNetworkReply *reply, const HttpAssetTransferPtr &transfer) const;
+
+    /// Stores the data received so far by an unfinished or failed GET to the asset cache, so that the download can be resumed.
+    void SavePartialDownload(QNetworkReply *reply, const HttpAssetTransferPtr &transfer);
+
+    struct PartedUpload;
+    typedef shared_ptr<PartedUpload> PartedUploadPtr;
+
+    /// Starts sending the next parts of the upload, up to MaxParallelUploadParts at a time.
+    void StartUploadParts(const PartedUploadPtr &upload);
+
+    /// Reads a part of the upload from its device and sends it. Returns false if the part could not be read.
+    bool StartUploadPart(const PartedUploadPtr &upload, qint64 offset, qint64 length, int retries);
+
+    /// Handles a finished PUT of an upload part, sending it again if it failed, and completing the upload when all the parts are done.
+    void OnUploadPartFinished(QNetworkReply *reply);
     
     /// Specifies the currently added list of HTTP asset storages.
     /// This array will never store null pointers.
@@ -120,12 +193,56 @@ private:
     typedef std::map<QNetworkReply*, AssetUploadTransferPtr> UploadTransferMap;
     UploadTransferMap uploadTransfers;
 
+    /// Upload that is sent in parts with Content-Range headers.
+    struct PartedUpload
+    {
+        AssetUploadTransferPtr transfer;
+        QString url;
+        qint64 size;
+        qint64 nextOffset; ///< Offset of the first byte not yet sent in a part.
+        qint64 bytesDone; ///< Bytes of the parts that have been sent successfully.
+        int partsInFlight;
+        bool failed;
+    };
+
+    /// A part of an upload being sent.
+    struct UploadPart
+    {
+        PartedUploadPtr upload;
+        qint64 offset;
+        qint64 length;
+        qint64 bytesSent;
+        int retries;
+    };
+
+    /// Maps the PUT requests of the upload parts to the parts.
+    typedef std::map<QNetworkReply*, UploadPart> UploadPartMap;
+    UploadPartMap uploadParts;
+
     /// Completed transfers to be sent to AssetAPI.
     QList<AssetTransferPtr> completedTransfers;
 
+    /// GET request waiting for a free request slot of its host.
+    struct QueuedRequest
+    {
+        HttpAssetTransferPtr transfer;
+        QNetworkRequest request;
+        QString host;
+        bool pipelined;
+    };
+
+    /// GET requests waiting for a free request slot, in request order.
+    std::vector<QueuedRequest> queuedRequests;
+
+    /// Numbers of ongoing GET requests by host.
+    std::map<QString, int> activeRequestsPerHost;
+
     /// If true, asset requests outside any registered storages are also accepted, and will appear as
     /// assets with no storage. If false, all requests to assets outside any registered storage will fail.
     bool enableRequestsOutsideStorages;
+
+    /// If true, all GET requests are pipelined regardless of their storage.
+    bool pipelineAllRequests;
 };
 
 /// Threaded file write operation. Used internally to store assets to cache asynchronously after a trasnfer has completed.
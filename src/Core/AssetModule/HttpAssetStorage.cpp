@@ -9,7 +9,9 @@
 #include <QBuffer>
 #include <QDomDocument>
 
-HttpAssetStorage::HttpAssetStorage()
+HttpAssetStorage::HttpAssetStorage() :
+    pipelining(false),
+    partialUpload(false)
 {
 }
 
@@ -64,7 +66,8 @@ QString HttpAssetStorage::SerializeToString(bool networkTransfer) const
 {
     QString str = "type=" + Type() + ";name=" + storageName +  ";src=" + baseAddress + ";readonly=" + BoolToString(!writable) +
         ";liveupdate=" + BoolToString(liveUpdate) + ";liveupload=" + BoolToString(liveUpload) + ";autodiscoverable=" + BoolToString(autoDiscoverable) + ";replicated=" +
-        BoolToString(isReplicated) + ";trusted=" + TrustStateToString(trustState);
+        BoolToString(isReplicated) + ";trusted=" + TrustStateToString(trustState) + ";pipelining=" + BoolToString(pipelining) +
+        ";partialupload=" + BoolToString(partialUpload);
     if (!networkTransfer)
         str = str + (localDir.isEmpty() ? QString() : ";localdir=" + localDir);
     return str;
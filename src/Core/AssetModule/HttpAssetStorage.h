@@ -26,6 +26,14 @@ public:
     /// the storage.
     QString localDir;
 
+    /// If true, the GET requests to this storage are sent pipelined on the HTTP connections, so that many small assets are not
+    /// limited by the round trip time of each request. Enable only for servers known to handle pipelining correctly.
+    bool pipelining;
+
+    /// If true, the server of this storage accepts PUT requests with a Content-Range header, so that large uploads are sent in
+    /// parallel parts and a failed part is sent again instead of the whole asset.
+    bool partialUpload;
+
 public slots:
     /// HttpAssetStorages are trusted if they point to a web server on the local system.
     virtual bool Trusted() const;
@@ -10,7 +10,13 @@ class HttpAssetTransfer : public IAssetTransfer
 Q_OBJECT
 
 public:
+    HttpAssetTransfer() : resumeOffset(0) {}
 
+    /// Host whose request slot the transfer holds while its GET is ongoing, or empty if it holds none. @sa HttpAssetProvider::MaxRequestsPerHost
+    QString requestHost;
+
+    /// Size of the partially downloaded data in the asset cache that the GET requests the rest of, or 0 if the whole asset is requested.
+    qint64 resumeOffset;
 };
 
 typedef shared_ptr<HttpAssetTransfer> HttpAssetTransferPtr;
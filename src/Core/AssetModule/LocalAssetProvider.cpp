@@ -33,6 +33,7 @@ LocalAssetProvider::LocalAssetProvider(Framework* framework_) :
 {
     enableRequestsOutsideStorages = (framework_->HasCommandLineParameter("--acceptUnknownLocalSources") ||
         framework_->HasCommandLineParameter("--accept_unknown_local_sources"));  /**< @todo Remove support for the deprecated underscore version at some point. */
+    useBakedAssets = !framework_->HasCommandLineParameter("--noBakedAssets");
 }
 
 LocalAssetProvider::~LocalAssetProvider()
@@ -318,6 +319,7 @@ void LocalAssetProvider::CompletePendingFileDownloads()
 
         AssetTransferPtr transfer = pendingDownloads.back();
         pendingDownloads.pop_back();
+        transfer->RecordTime(IAssetTransfer::TimeStarted);
             
         QString ref = transfer->source.ref;
 
@@ -355,10 +357,15 @@ void LocalAssetProvider::CompletePendingFileDownloads()
         }
         QString absoluteFilename = file.absoluteFilePath();
 
-        bool success = LoadFileToVector(absoluteFilename, transfer->rawAssetData);
+        // Load a baked file in place of the source, but keep the source as the disk source of the asset.
+        QString dataFilename = (storage && useBakedAssets) ? storage->BakedVariant(absoluteFilename) : QString();
+        if (dataFilename.isEmpty())
+            dataFilename = absoluteFilename;
+
+        bool success = LoadFileToVector(dataFilename, transfer->rawAssetData);
         if (!success)
         {
-            QString reason = "Failed to read asset data for asset \"" + ref + "\" from file \"" + absoluteFilename + "\"";
+            QString reason = "Failed to read asset data for asset \"" + ref + "\" from file \"" + dataFilename + "\"";
             framework->Asset()->AssetTransferFailed(transfer.get(), reason);
             // Also throttle asset loading here. This is needed in the case we have a lot of failed refs.
             if (GetCurrentClockTime() - startTime >= GetCurrentClockFreq() * maxLoadMSecs / 1000)
@@ -555,8 +562,12 @@ void LocalAssetProvider::CheckForPendingFileSystemChanges()
             {
                 // Tracked file was not found from the list of tracked files and it doesn't exist so 
                 // it must be deleted (info about new files is retrieved by directoryChanged signal).
-                LogInfo("File " + file + " not found from watch list. So it must be deleted.");
-                storage->EmitAssetChanged(file, IAssetStorage::AssetDelete);
+                // The deletion may have already been found when the directory was listed again.
+                if (storage->RemoveIndexedFile(file))
+                {
+                    LogInfo("File " + file + " not found from watch list. So it must be deleted.");
+                    storage->EmitAssetChanged(file, IAssetStorage::AssetDelete);
+                }
             }
             else
             {
@@ -615,120 +626,24 @@ void LocalAssetProvider::CheckForPendingFileSystemChanges()
                 else // 2: Was new directory added, an existing one renamed, or something else?
 */
                 {
-                    // Was new file added?
-                    QStringList oldFiles, currentFiles;
-                    currentFiles = DirectorySearch(path, false, QDir::Files | QDir::NoDotAndDotDot | QDir::NoSymLinks);
-                    const QStringList watchedFiles = storage->changeWatcher->files();
-                    foreach(const QString &file, watchedFiles)
-                        if (GuaranteeTrailingSlash(path) == GuaranteeTrailingSlash(QFileInfo(file).dir().path()))
-                            oldFiles.append(file);
-
-                    if (currentFiles.size() > oldFiles.size())
-                    {
-                        LogDebug("NumOldFiles for " + path + " " + QString::number(oldFiles.size()) + " NumCurFiles: " + QString::number(currentFiles.size()));
-                        LogDebug("Conclusion: new file added.");
-                        foreach(const QString &file, currentFiles)
-                        {
-                            QStringList::const_iterator it = qFind(oldFiles, file);
-                            if (it == oldFiles.end())
-                            {
-                                LogInfo("New file " + file + " added to storage " + storage->ToString());
-                                storage->changeWatcher->addPath(file);
-                                storage->EmitAssetChanged(file, IAssetStorage::AssetCreate);
-                                break;
-                            }
-                    }
-                    //else if(if (currentFiles.size() > oldFiles.size())
-                    //{
-                    //}
-/*
-                    // Check out the path's subdir count. Find all old watched dirs and replace them with the new dirs.
-                    QStringList curSubdirs = DirectorySearch(path, true, QDir::Dirs | QDir::NoDotAndDotDot | QDir::NoSymLinks);
-                    QStringList oldSubdirs;
-                    foreach(const QString &dir, watchedDirs)
-                        if (dir.contains(path, Qt::CaseInsensitive) && dir.compare(path, Qt::CaseInsensitive) != 0)
-                            oldSubdirs << dir;
-
-                    LogWarning("CURRENT DIRS " + curSubdirs.join("\n"));
-                    LogWarning("OLD DIRS " + oldSubdirs.join("\n"));
-                    LogInfo("NumOldSubdirs for " + path + ": " + QString::number(oldSubdirs.size()) + ", NumCurDirs: " + QString::number(curSubdirs.size()));
-                    if (!oldSubdirs.isEmpty() && !curSubdirs.isEmpty() && oldSubdirs.size() == curSubdirs.size())
-                    {
-                        // Folder rename occurred. Remove all subdirs and add them back.
-                        LogError("SOME FOLDER WAS RENAMED");
-                        LogInfo("Removing\n" + oldSubdirs.join("\n"));
-
-                        storage->changeWatcher->removePaths(oldSubdirs);
-
-                        LogInfo("Adding\n" + curSubdirs.join("\n"));
-                        foreach(const QString &d, curSubdirs) // for some odd reason addPaths() fails, so have to call addPath() for individual paths instead.
-                            if (!watchedDirs.contains(d), Qt::CaseInsensitive)
-                                storage->changeWatcher->addPath(d);
-
-                        // Add parent dir back to watch list.
-                        if (!watchedDirs.contains(path), Qt::CaseInsensitive)
-                            storage->changeWatcher->addPath(path);
-                    }
-                    else if (oldSubdirs.size() != curSubdirs.size())
+                    // List the directory again to find the added and removed files and subdirectories.
+                    QStringList addedFiles, removedFiles, addedDirs;
+                    storage->UpdateIndexForDirectory(path, addedFiles, removedFiles, addedDirs);
+#ifndef Q_WS_MAC
+                    if (!addedDirs.isEmpty())
+                        storage->changeWatcher->addPaths(addedDirs);
+                    if (!addedFiles.isEmpty() && storage->HasLiveUpdate())
+                        storage->changeWatcher->addPaths(addedFiles);
+#endif
+                    foreach(const QString &file, addedFiles)
                     {
-                        LogError("NEW DIRECTORY");
-                        LogInfo("New directory added to " + path);
-                        //LogInfo("Directory structure changed: number of old subdirs for " + path + " " + QString::number(oldSubdirs.size()) +
-                        //    ", number of current dirs " + QString::number(curSubdirs.size()));
-                        LogInfo("This means we got a new directory to watch.");
-                        if (!oldSubdirs.isEmpty())
-                        {
-                            LogInfo("Removing oldSubdirs:\n" + oldSubdirs.join("\n"));
-                            storage->changeWatcher->removePaths(oldSubdirs);
-                        }
-                        if (!curSubdirs.isEmpty())
-                        {
-                            LogInfo("Adding curSubdirs:\n" + curSubdirs.join("\n"));
-                            foreach(const QString &d, curSubdirs) // for some odd reason addPaths() fails, so have to call addPath() for individual paths instead.
-                                if (!watchedDirs.contains(d), Qt::CaseInsensitive)
-                                    storage->changeWatcher->addPath(d);
-                        }
-
-                        QString newDir = curSubdirs.size() == 1 ? curSubdirs.first() : "";
-                        foreach(const QString &curSubdir, curSubdirs)
-                            if (qFind(oldSubdirs, curSubdir) == oldSubdirs.end())
-                            {
-                                newDir = curSubdir;
-                                LogInfo("New dir's name is : " + newDir);
-                                if (storage->recursive)
-                                {
-                                    QStringList pathsToAdd = DirectorySearch(newDir, true, QDir::Files |QDir::Dirs | QDir::NoDotAndDotDot | QDir::NoSymLinks);
-                                    if (!pathsToAdd.isEmpty())
-                                    {
-                                        LogInfo("Adding paths to watch list: " + pathsToAdd.join("\n"));
-                                        LogInfo("******before " + QString::number(storage->changeWatcher->files().count()));
-                                        storage->changeWatcher->addPaths(pathsToAdd);
-                                        LogInfo("******after " + QString::number(storage->changeWatcher->files().count()));
-                                    }
-                                }
-                            }
-
-                        // Add parent dir back to watch list.
-                        if (!watchedDirs.contains(path), Qt::CaseInsensitive)
-                            storage->changeWatcher->addPath(path);
+                        LogInfo("New file " + file + " added to storage " + storage->ToString());
+                        storage->EmitAssetChanged(file, IAssetStorage::AssetCreate);
                     }
-                    else
+                    foreach(const QString &file, removedFiles)
                     {
-                        // We end up here after:
-                        // -removing subdir of a watched dir we get change notification for the watcher dir,
-                        // -Addition of new file to watched dir
-                        LogError("DIDN'T KNOW WHAT TO DO WITH CHANGED DIR");
-                        if (!watchedDirs.contains(path), Qt::CaseInsensitive)
-                            storage->changeWatcher->addPath(path);
-
-                        QStringList pathsToAdd = DirectorySearch(path, false, QDir::Files);
-                        if (!pathsToAdd.isEmpty())
-                        {
-                            LogInfo("Adding paths to watch list: " + pathsToAdd.join("\n"));
-                            foreach(const QString &p, pathsToAdd) // for some odd reason addPaths() fails, so have to call addPath() for individual paths instead.
-                                storage->changeWatcher->addPath(p);
-                        }
-*/
+                        LogInfo("File " + file + " removed from storage " + storage->ToString());
+                        storage->EmitAssetChanged(file, IAssetStorage::AssetDelete);
                     }
                 }
 
@@ -94,6 +94,9 @@ private:
     /// If true, assets outside any known local storages are allowed. Otherwise, requests to them will fail.
     bool enableRequestsOutsideStorages;
 
+    /// If true, the baked files of the storages are loaded in place of the source files. See LocalAssetStorage::BakedVariant.
+    bool useBakedAssets;
+
 private slots:
     void OnFileChanged(const QString &path);
     void OnDirectoryChanged(const QString &path);
@@ -13,13 +13,73 @@
 
 #include <QFileSystemWatcher>
 #include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QDateTime>
+#include <QTextStream>
+#include <QSet>
 #include <utility>
 
 #include "MemoryLeakCheck.h"
 
+namespace
+{
+
+typedef std::map<QString, QString, QStringLessThanNoCase> CachedFileMap;
+
+const char * const cIndexFileHeader = "LocalAssetStorageIndex 1";
+
+/// Name of the subdirectory the baked files are in. Keep in sync with tools/TextureTool.
+const char * const cBakedDirName = "_baked";
+const char * const cBakedManifestName = "manifest.txt";
+const char * const cBakedManifestHeader = "TundraBakedAssets 1";
+
+bool IsIgnoredPath(const QString &path)
+{
+    return path.contains(".git") || path.contains(".svn") || path.contains(".hg") || path.endsWith(QString("/") + cBakedDirName);
+}
+
+QString FileName(const QString &path)
+{
+    int lastSlash = path.lastIndexOf('/');
+    return lastSlash != -1 ? path.mid(lastSlash + 1) : path;
+}
+
+QString ParentPath(const QString &path)
+{
+    int lastSlash = path.lastIndexOf('/');
+    return lastSlash != -1 ? path.left(lastSlash) : QString();
+}
+
+qint64 ModificationTime(const QFileInfo &info)
+{
+    return info.lastModified().toMSecsSinceEpoch() / 1000;
+}
+
+/// Returns the modification time to store for a directory that is listed now.
+/** The modification times have a precision of a second, so a directory modified during the last seconds is marked to be listed again. */
+qint64 IndexedModificationTime(const QFileInfo &dir)
+{
+    qint64 lastModified = ModificationTime(dir);
+    return (QDateTime::currentMSecsSinceEpoch() / 1000 - lastModified < 2) ? 0 : lastModified;
+}
+
+/// Removes the file from the cached files, unless another file of the same name is cached.
+void RemoveCachedFile(CachedFileMap &cachedFiles, const QString &path)
+{
+    CachedFileMap::iterator iter = cachedFiles.find(FileName(path));
+    if (iter != cachedFiles.end() && iter->second == path)
+        cachedFiles.erase(iter);
+}
+
+} // ~unnamed namespace
+
 LocalAssetStorage::LocalAssetStorage(bool writable_, bool liveUpdate_, bool autoDiscoverable_) :
     recursive(true),
-    changeWatcher(0)
+    changeWatcher(0),
+    bakedManifestModified(0),
+    indexBuilt(false),
+    indexDirty(false)
 {
     // Override the parameters for the base class.
     writable = writable_;
@@ -29,61 +89,313 @@ LocalAssetStorage::LocalAssetStorage(bool writable_, bool liveUpdate_, bool auto
 
 LocalAssetStorage::~LocalAssetStorage()
 {
+    if (indexBuilt && indexDirty)
+        SaveIndex();
     RemoveWatcher();
 }
 
 void LocalAssetStorage::LoadAllAssetsOfType(AssetAPI *assetAPI, const QString &suffix, const QString &assetType)
 {
-    foreach(QString str, DirectorySearch(directory, recursive, QDir::Files | QDir::NoDotAndDotDot | QDir::NoSymLinks))
-        if ((suffix == "" || str.endsWith(suffix)) && !(str.contains(".git") || str.contains(".svn") || str.contains(".hg")))
-        {
-            int lastSlash = str.lastIndexOf('/');
-            if (lastSlash != -1)
-                str = str.right(str.length() - lastSlash - 1);
-            assetAPI->RequestAsset("local://" + str, assetType);
-        }
+    foreach(const QString &str, IndexedFiles())
+        if (suffix == "" || str.endsWith(suffix))
+            assetAPI->RequestAsset("local://" + FileName(str), assetType);
 }
 
 void LocalAssetStorage::RefreshAssetRefs()
 {
-    foreach(QString str, DirectorySearch(directory, recursive, QDir::Files | QDir::NoDotAndDotDot | QDir::NoSymLinks))
-        if (!(str.contains(".git") || str.contains(".svn") || str.contains(".hg")))
+    QSet<QString> knownRefs = assetRefs.toSet();
+    foreach(const QString &diskSource, IndexedFiles())
+    {
+        QString localName = FileName(diskSource);
+        QString ref = "local://" + localName;
+        if (!knownRefs.contains(ref))
         {
-            QString diskSource = str;
-            int lastSlash = str.lastIndexOf('/');
-            if (lastSlash != -1)
-                str = str.right(str.length() - lastSlash - 1);
-            QString localName = str;
-            str.prepend("local://");
-            if (!assetRefs.contains(str))
-            {
-                assetRefs.append(str);
-                emit AssetChanged(localName, diskSource, IAssetStorage::AssetCreate);
-            }
+            knownRefs.insert(ref);
+            assetRefs.append(ref);
+            emit AssetChanged(localName, diskSource, IAssetStorage::AssetCreate);
         }
+    }
 }
 
 void LocalAssetStorage::CacheStorageContents()
 {
+    PROFILE(LocalAssetStorage_CacheStorageContents);
     cachedFiles.clear();
+    indexedDirectories.clear();
+    indexBuilt = true;
+    IndexDirectory(QDir::cleanPath(QDir::fromNativeSeparators(directory)), 0, 0, 0);
+    SaveIndex();
+}
 
-    foreach(QString str, DirectorySearch(directory, recursive, QDir::Files | QDir::NoDotAndDotDot | QDir::NoSymLinks))
-        if (!(str.contains(".git") || str.contains(".svn") || str.contains(".hg")))
-        {
-            QString diskSource = str;
-            int lastSlash = str.lastIndexOf('/');
-            if (lastSlash != -1)
-                str = str.right(str.length() - lastSlash - 1);
-            QString localName = str;
+QString LocalAssetStorage::BakedVariant(const QString &sourcePath)
+{
+    RefreshBakedManifest();
+    if (bakedAssets.isEmpty())
+        return "";
+
+    QHash<QString, BakedAsset>::const_iterator iter = bakedAssets.find(QDir::cleanPath(QDir::fromNativeSeparators(sourcePath)).toLower());
+    if (iter == bakedAssets.end())
+        return "";
+    QFileInfo source(sourcePath);
+    QFileInfo baked(iter->path);
+    if (!baked.exists() || source.size() != iter->sourceSize || source.lastModified() > baked.lastModified())
+        return "";
+    return iter->path;
+}
+
+void LocalAssetStorage::RefreshBakedManifest()
+{
+    const QString bakedDir = QDir::cleanPath(QDir::fromNativeSeparators(directory)) + "/" + cBakedDirName + "/";
+    QFileInfo manifestInfo(bakedDir + cBakedManifestName);
+    const qint64 modified = manifestInfo.exists() ? manifestInfo.lastModified().toMSecsSinceEpoch() : 0;
+    if (modified == bakedManifestModified)
+        return;
+
+    bakedAssets.clear();
+    bakedManifestModified = modified;
+    if (!modified)
+        return;
+
+    QFile file(manifestInfo.absoluteFilePath());
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text))
+        return;
+    QTextStream in(&file);
+    in.setCodec("UTF-8");
+    if (in.readLine() != cBakedManifestHeader)
+    {
+        LogWarning("LocalAssetStorage::RefreshBakedManifest: Unknown format of " + manifestInfo.absoluteFilePath() + ", not using the baked assets of storage \"" + Name() + "\".");
+        return;
+    }
+
+    const QString root = QDir::cleanPath(QDir::fromNativeSeparators(directory)) + "/";
+    // Each line has the source path relative to the storage, its size when baked, and the baked path relative to the baked directory.
+    while(!in.atEnd())
+    {
+        QStringList fields = in.readLine().split('\t');
+        if (fields.size() != 3)
+            continue;
+        BakedAsset asset;
+        asset.sourceSize = fields[1].toLongLong();
+        asset.path = bakedDir + fields[2];
+        bakedAssets[QDir::cleanPath(root + fields[0]).toLower()] = asset;
+    }
+    LogDebug("LocalAssetStorage: Storage \"" + Name() + "\" has " + QString::number(bakedAssets.size()) + " baked assets.");
+}
+
+void LocalAssetStorage::EnsureIndex()
+{
+    if (indexBuilt)
+        return;
+
+    if (LoadIndex())
+    {
+        indexBuilt = true;
+        ValidateIndex();
+    }
+    else
+        CacheStorageContents();
+}
+
+void LocalAssetStorage::ValidateIndex()
+{
+    PROFILE(LocalAssetStorage_ValidateIndex);
+    const QString root = QDir::cleanPath(QDir::fromNativeSeparators(directory));
+    if (indexedDirectories.find(root) == indexedDirectories.end())
+        IndexDirectory(root, 0, 0, 0);
+
+    // Listing the directories again may add and remove directories, so go through a copy of the paths.
+    QStringList paths;
+    for(std::map<QString, IndexedDirectory>::const_iterator iter = indexedDirectories.begin(); iter != indexedDirectories.end(); ++iter)
+        paths << iter->first;
+    foreach(const QString &path, paths)
+    {
+        std::map<QString, IndexedDirectory>::const_iterator iter = indexedDirectories.find(path);
+        if (iter == indexedDirectories.end())
+            continue;
+        QFileInfo info(path);
+        if (!info.isDir())
+            RemoveIndexedDirectory(path, 0);
+        else if (ModificationTime(info) != iter->second.lastModified)
+            IndexDirectory(path, 0, 0, 0);
+    }
+
+    if (indexDirty)
+        SaveIndex();
+}
+
+void LocalAssetStorage::IndexDirectory(const QString &path, QStringList *addedFiles, QStringList *removedFiles, QStringList *addedDirs)
+{
+    QDir dir(path);
+    if (!dir.exists())
+    {
+        RemoveIndexedDirectory(path, removedFiles);
+        return;
+    }
+
+    const bool isNew = (indexedDirectories.find(path) == indexedDirectories.end());
+    IndexedDirectory &entry = indexedDirectories[path];
+    entry.lastModified = IndexedModificationTime(QFileInfo(path));
+    if (isNew && addedDirs)
+        addedDirs->append(path);
+    indexDirty = true;
 
+    QStringList files, subdirs;
+    foreach(const QFileInfo &info, dir.entryInfoList(QDir::Files | QDir::Dirs | QDir::NoDotAndDotDot | QDir::NoSymLinks))
+    {
+        QString entryPath = info.filePath();
+        if (IsIgnoredPath(entryPath))
+            continue;
+        if (!info.isDir())
+            files << entryPath;
+        else if (recursive)
+            subdirs << entryPath;
+    }
+
+    QSet<QString> oldFiles = entry.files.toSet();
+    foreach(const QString &file, files)
+    {
+        if (oldFiles.remove(file))
+            continue;
+        const QString localName = FileName(file);
 ///\todo This is an often-received error condition if the user is not aware, but also occurs naturally in built-in Ogre Media storages.
 /// Fix this check to occur somehow nicer (without additional constraints to asset load time) without a hardcoded check
 /// against the storage name.
-            if (Name() != "Ogre Media" && cachedFiles.find(localName) != cachedFiles.end())
-                LogWarning("Warning: Asset Storage \"" + Name() + "\" contains ambiguous assets \"" + cachedFiles[localName] + "\" and \"" + diskSource + "\" in two different subdirectories!");
+        CachedFileMap::const_iterator existing = cachedFiles.find(localName);
+        if (Name() != "Ogre Media" && existing != cachedFiles.end() && existing->second != file)
+            LogWarning("Warning: Asset Storage \"" + Name() + "\" contains ambiguous assets \"" + existing->second + "\" and \"" + file + "\" in two different subdirectories!");
+        cachedFiles[localName] = file;
+        if (addedFiles)
+            addedFiles->append(file);
+    }
+    foreach(const QString &file, oldFiles)
+    {
+        RemoveCachedFile(cachedFiles, file);
+        if (removedFiles)
+            removedFiles->append(file);
+    }
+    entry.files = files;
+
+    QStringList oldSubdirs = entry.subdirs;
+    entry.subdirs = subdirs;
+    foreach(const QString &subdir, oldSubdirs)
+        if (!subdirs.contains(subdir))
+            RemoveIndexedDirectory(subdir, removedFiles);
+    foreach(const QString &subdir, subdirs)
+        if (indexedDirectories.find(subdir) == indexedDirectories.end())
+            IndexDirectory(subdir, addedFiles, removedFiles, addedDirs);
+}
+
+void LocalAssetStorage::RemoveIndexedDirectory(const QString &path, QStringList *removedFiles)
+{
+    std::map<QString, IndexedDirectory>::iterator iter = indexedDirectories.find(path);
+    if (iter == indexedDirectories.end())
+        return;
+
+    IndexedDirectory entry = iter->second;
+    indexedDirectories.erase(iter);
+    indexDirty = true;
+    foreach(const QString &file, entry.files)
+    {
+        RemoveCachedFile(cachedFiles, file);
+        if (removedFiles)
+            removedFiles->append(file);
+    }
+    foreach(const QString &subdir, entry.subdirs)
+        RemoveIndexedDirectory(subdir, removedFiles);
+}
+
+void LocalAssetStorage::UpdateIndexForDirectory(const QString &path, QStringList &addedFiles, QStringList &removedFiles, QStringList &addedDirs)
+{
+    EnsureIndex();
+    IndexDirectory(QDir::cleanPath(QDir::fromNativeSeparators(path)), &addedFiles, &removedFiles, &addedDirs);
+}
 
-            cachedFiles[localName] = diskSource;
+bool LocalAssetStorage::RemoveIndexedFile(const QString &path)
+{
+    const QString file = QDir::cleanPath(QDir::fromNativeSeparators(path));
+    std::map<QString, IndexedDirectory>::iterator iter = indexedDirectories.find(ParentPath(file));
+    if (iter == indexedDirectories.end() || !iter->second.files.removeOne(file))
+        return false;
+    RemoveCachedFile(cachedFiles, file);
+    indexDirty = true;
+    return true;
+}
+
+QStringList LocalAssetStorage::IndexedFiles()
+{
+    EnsureIndex();
+    QStringList files;
+    for(std::map<QString, IndexedDirectory>::const_iterator iter = indexedDirectories.begin(); iter != indexedDirectories.end(); ++iter)
+        files << iter->second.files;
+    return files;
+}
+
+QString LocalAssetStorage::IndexFilePath() const
+{
+    return Application::UserDataDirectory() + "localstorageindex/" + AssetAPI::SanitateAssetRef(QDir(directory).absolutePath()) + ".txt";
+}
+
+bool LocalAssetStorage::LoadIndex()
+{
+    QFile file(IndexFilePath());
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text))
+        return false;
+
+    // The listed file and directory names are relative to the directory before them.
+    QTextStream in(&file);
+    in.setCodec("UTF-8");
+    if (in.readLine() != QString(cIndexFileHeader) + " recursive=" + BoolToString(recursive))
+        return false;
+
+    cachedFiles.clear();
+    indexedDirectories.clear();
+    QString currentPath;
+    IndexedDirectory *current = 0;
+    while(!in.atEnd())
+    {
+        QString line = in.readLine();
+        if (line.startsWith("D "))
+        {
+            currentPath = line.section(' ', 2);
+            current = &indexedDirectories[currentPath];
+            current->lastModified = line.section(' ', 1, 1).toLongLong();
+        }
+        else if (line.startsWith("F ") && current)
+        {
+            QString path = currentPath + "/" + line.mid(2);
+            current->files << path;
+            cachedFiles[line.mid(2)] = path;
         }
+        else if (line.startsWith("S ") && current)
+            current->subdirs << currentPath + "/" + line.mid(2);
+    }
+    indexDirty = false;
+    return !indexedDirectories.empty();
+}
+
+void LocalAssetStorage::SaveIndex()
+{
+    PROFILE(LocalAssetStorage_SaveIndex);
+    QDir().mkpath(Application::UserDataDirectory() + "localstorageindex");
+    QFile file(IndexFilePath());
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Text))
+    {
+        LogWarning("LocalAssetStorage: Failed to write the file index of " + ToString() + " to " + file.fileName());
+        return;
+    }
+
+    QTextStream out(&file);
+    out.setCodec("UTF-8");
+    out << cIndexFileHeader << " recursive=" << BoolToString(recursive) << "\n";
+    for(std::map<QString, IndexedDirectory>::const_iterator iter = indexedDirectories.begin(); iter != indexedDirectories.end(); ++iter)
+    {
+        out << "D " << iter->second.lastModified << " " << iter->first << "\n";
+        foreach(const QString &path, iter->second.files)
+            out << "F " << FileName(path) << "\n";
+        foreach(const QString &path, iter->second.subdirs)
+            out << "S " << FileName(path) << "\n";
+    }
+    indexDirty = false;
 }
 
 QString LocalAssetStorage::GetFullPathForAsset(const QString &assetname, bool recursiveLookup)
@@ -92,16 +404,19 @@ QString LocalAssetStorage::GetFullPathForAsset(const QString &assetname, bool re
     if (QFile::exists(dir.absolutePath()))
         return directory;
 
-    std::map<QString, QString, QStringLessThanNoCase>::iterator iter = cachedFiles.find(assetname);
+    CachedFileMap::iterator iter = cachedFiles.find(assetname);
     if (iter == cachedFiles.end())
     {
         if (!recursive || !recursiveLookup)
             return "";
-        else
-            CacheStorageContents();
+        // The index is kept up to date from the change notifications. Without them, see if the directories have changed.
+        if (!indexBuilt)
+            EnsureIndex();
+        else if (!changeWatcher || changeWatcher->directories().isEmpty())
+            ValidateIndex();
+        iter = cachedFiles.find(assetname);
     }
 
-    iter = cachedFiles.find(assetname);
     if (iter != cachedFiles.end())
     {
         QFileInfo file(iter->second);
@@ -156,21 +471,25 @@ void LocalAssetStorage::SetupWatcher()
 
     changeWatcher = new QFileSystemWatcher();
 
-    // Add directory contents to watch list.
+    // The directories are watched for the files that are added and removed. The files are watched only for live update.
     if (recursive)
     {
-        // Make a visible log message - we may hang here for several seconds, since this step involves recursive iteration. Try to make the path relative before printing.
+        // Make a visible log message - we may hang here for several seconds if the index needs to be built. Try to make the path relative before printing.
         QString installDir = QDir::toNativeSeparators(Application::InstallationDirectory());
         QString watchAbsPath = QDir::toNativeSeparators(QDir(directory).absolutePath());
         QString watchDirPath = (watchAbsPath.startsWith(installDir) ? QString(".%1%2").arg(QDir::separator()).arg(watchAbsPath.mid(installDir.length())) : watchAbsPath);
-        LogInfo("LocalAssetStorage: Recursively adding all files from " + watchDirPath + " to a watch list. This may take a while...");
+        LogInfo("LocalAssetStorage: Recursively adding " + watchDirPath + " to a watch list. This may take a while...");
     }
     else
         LogDebug("LocalAssetStorage: Adding " + directory + " recursive=" + BoolToString(recursive));
 
-    QStringList paths = DirectorySearch(directory, recursive, QDir::Dirs | QDir::Files | QDir::NoDotAndDotDot | QDir::NoSymLinks);
+    EnsureIndex();
+    QStringList paths;
+    for(std::map<QString, IndexedDirectory>::const_iterator iter = indexedDirectories.begin(); iter != indexedDirectories.end(); ++iter)
+        paths << iter->first;
+    if (liveUpdate)
+        paths << IndexedFiles();
 #ifndef Q_WS_MAC
-    changeWatcher->addPath(QDir::fromNativeSeparators(directory));
     changeWatcher->addPaths(paths);
 #endif
 
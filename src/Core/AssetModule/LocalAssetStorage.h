@@ -7,11 +7,21 @@
 #include "CoreStringUtils.h"
 
 #include <QMap>
+#include <QHash>
+#include <QStringList>
+
+#include <map>
 
 class QFileSystemWatcher;
 class AssetAPI;
 
 /// Represents a single (possibly recursive) directory on the local file system.
+/** The files of the storage are kept in an index, which is built once, saved in the user data directory between runs,
+    and kept up to date from the directory change notifications, so that the assets are looked up without searching the
+    directory tree. When the saved index is loaded, only the directories whose modification time has changed since are listed again.
+
+    The _baked subdirectory of the storage holds the files baked from the assets of the storage by TextureTool --bake, and is not
+    indexed. LocalAssetProvider loads the baked file of an asset in place of the source file if the source has not changed since. */
 class ASSET_MODULE_API LocalAssetStorage : public IAssetStorage
 {
     Q_OBJECT
@@ -85,12 +95,81 @@ public slots:
     void EmitAssetChanged(QString absoluteFilename, IAssetStorage::ChangeType change);
 
     /// Walks through this storage on disk and creates a cached index of all the filenames inside this storage.
+    /** The index is built on demand, so there is usually no need to call this, unless the directory has been changed without notification. */
     void CacheStorageContents();
 
 private:
     friend class LocalAssetProvider;
 
+    /// A directory in the file index.
+    struct IndexedDirectory
+    {
+        IndexedDirectory() : lastModified(0) {}
+        qint64 lastModified; ///< Modification time in seconds since the epoch when listed, or 0 to list again when the index is next validated.
+        QStringList files; ///< Full paths of the files.
+        QStringList subdirs; ///< Full paths of the subdirectories, if the storage is recursive.
+    };
+
+    /// Builds the file index if it is not built, from the saved index if there is one.
+    void EnsureIndex();
+
+    /// Lists again the indexed directories that have changed or been removed since they were listed. Saves the index if it changed.
+    void ValidateIndex();
+
+    /// Lists a directory, and the subdirectories that are new to the index if the storage is recursive, and updates the index.
+    /** @param addedFiles [out] If non-null, receives the files that were not in the index.
+        @param removedFiles [out] If non-null, receives the files of the directory that are no longer there.
+        @param addedDirs [out] If non-null, receives the directories that were not in the index. */
+    void IndexDirectory(const QString &path, QStringList *addedFiles, QStringList *removedFiles, QStringList *addedDirs);
+
+    /// Removes a directory and its subdirectories from the index.
+    void RemoveIndexedDirectory(const QString &path, QStringList *removedFiles);
+
+    /// Updates the index after a change notification of a directory of this storage. The out parameters are as in IndexDirectory.
+    void UpdateIndexForDirectory(const QString &path, QStringList &addedFiles, QStringList &removedFiles, QStringList &addedDirs);
+
+    /// Removes a file that has been deleted from the index. Returns whether the file was in the index.
+    bool RemoveIndexedFile(const QString &path);
+
+    /// Returns the files of the storage from the index.
+    QStringList IndexedFiles();
+
+    /// Returns the path of the file the index is saved in.
+    QString IndexFilePath() const;
+
+    /// Reads the index from the file. Returns false if there is no index saved for this storage.
+    bool LoadIndex();
+
+    /// Writes the index to the file.
+    void SaveIndex();
+
+    /// Returns the full path of the baked file of the given source file of this storage, or an empty string if it has none or it is out of date.
+    /** A baked file is out of date if the source file has a different size than when baked, or is newer than the baked file. */
+    QString BakedVariant(const QString &sourcePath);
+
+    /// Reads the manifest of the baked files, if it has changed since it was read.
+    void RefreshBakedManifest();
+
     /// Maps a file basename 'asset.mesh' to its full path 'c:\project\assets\asset.mesh'.
     /// Used to quickly lookup known assets by basename instead of having to do an expensive recursive directory search.
     std::map<QString, QString, QStringLessThanNoCase> cachedFiles;
+
+    /// The indexed directories by full path.
+    std::map<QString, IndexedDirectory> indexedDirectories;
+
+    /// A baked file in the manifest.
+    struct BakedAsset
+    {
+        BakedAsset() : sourceSize(0) {}
+        qint64 sourceSize; ///< Size of the source file when it was baked.
+        QString path; ///< Full path of the baked file.
+    };
+
+    /// The baked files by the lowercase full path of the source file.
+    QHash<QString, BakedAsset> bakedAssets;
+
+    qint64 bakedManifestModified; ///< Modification time of the baked manifest when read, or 0 if it has not been read.
+
+    bool indexBuilt; ///< Whether the index has been built or loaded.
+    bool indexDirty; ///< Whether the index has changed since it was saved.
 };
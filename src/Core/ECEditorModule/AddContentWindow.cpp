@@ -16,6 +16,7 @@
 #include "UiMainWindow.h"
 #include "Framework.h"
 #include "AssetAPI.h"
+#include "AssetCache.h"
 #include "IAsset.h"
 #include "IAssetStorage.h"
 #include "IAssetUploadTransfer.h"
@@ -26,6 +27,10 @@
 #include "LoggingFunctions.h"
 #include "CoreException.h"
 #include "ConfigAPI.h"
+#include "JobSystem.h"
+
+#include <QCryptographicHash>
+#include <QPointer>
 
 #include "MemoryLeakCheck.h"
 
@@ -135,6 +140,9 @@ public:
 };
 /// @endcond PRIVATE
 
+/// Maximum number of uploads in progress at once.
+const int cMaxConcurrentUploads = 8;
+
 /// A special case identifier for using the default storage.
 const char *cDefaultStorage = "DefaultStorage";
 /// A special case identifier for not altering asset refs when uploading assets.
@@ -197,15 +205,65 @@ void EntityAndAssetTreeWidget::ToggleCheckedState(bool checkAllInsteadOfToggle)
         (*i)->setCheckState(0, (checkAllInsteadOfToggle ? Qt::Checked : (Qt::CheckState)(Qt::Checked - (*i)->checkState(0))));
 }
 
+/// Computes the content hash of an asset to upload.
+struct AddContentWindow::HashJob : public IJob
+{
+    HashJob(AddContentWindow *window_, int importGeneration_, const AssetDesc &desc_) :
+        IJob("AddContentWindow_Hash"),
+        window(window_),
+        importGeneration(importGeneration_),
+        desc(desc_)
+    {
+    }
+
+    void Run()
+    {
+        if (desc.dataInMemory)
+        {
+            if (!desc.data.isEmpty())
+                contentHash = AssetCache::ComputeContentHash((const u8*)desc.data.constData(), desc.data.size());
+            return;
+        }
+
+        QFile file(desc.source);
+        if (!file.open(QIODevice::ReadOnly))
+            return;
+        // The same hash as AssetCache::ComputeContentHash, but without reading the whole file to memory.
+        QCryptographicHash hash(QCryptographicHash::Sha1);
+        while(!file.atEnd())
+        {
+            QByteArray chunk = file.read(64 * 1024);
+            if (chunk.isEmpty())
+                return;
+            hash.addData(chunk);
+        }
+        contentHash = QString::fromLatin1(hash.result().toHex());
+    }
+
+    void Finished()
+    {
+        if (window && window->importInProgress && window->importGeneration == importGeneration)
+            window->HandleAssetHashed(desc, contentHash);
+    }
+
+    QPointer<AddContentWindow> window; ///< Accessed only in the main thread, the window may be closed meanwhile.
+    int importGeneration;
+    AssetDesc desc;
+    QString contentHash;
+};
+
 AddContentWindow::AddContentWindow(const ScenePtr &dest, QWidget *parent) :
     QWidget(parent),
     framework(dest->GetFramework()),
     scene(dest),
     position(float3::zero),
-    uploadProgressStep(0),
     numFailedUploads(0),
     numSuccessfulUploads(0),
-    numTotalUploads(0)
+    numSkippedUploads(0),
+    numTotalUploads(0),
+    numPendingHashes(0),
+    importInProgress(false),
+    importGeneration(0)
 {
     setWindowModality(Qt::ApplicationModal/*Qt::WindowModal*/);
     setAttribute(Qt::WA_DeleteOnClose);
@@ -335,7 +393,7 @@ AddContentWindow::AddContentWindow(const ScenePtr &dest, QWidget *parent) :
     resize(800, 400);
 
     connect(addContentButton, SIGNAL(clicked()), SLOT(AddContent()));
-    connect(cancelButton, SIGNAL(clicked()), SLOT(close()));
+    connect(cancelButton, SIGNAL(clicked()), SLOT(CancelImportOrClose()));
     connect(selectAllEntitiesButton, SIGNAL(clicked()), SLOT(SelectAllEntities()));
     connect(deselectAllEntitiesButton, SIGNAL(clicked()), SLOT(DeselectAllEntities()));
     connect(selectAllAssetsButton, SIGNAL(clicked()), SLOT(SelectAllAssets()));
@@ -798,64 +856,54 @@ void AddContentWindow::UploadAssets()
         entityStatusLabel->setText(tr("Waiting for asset uploads to finish..."));
         LogDebug(QString("Starting uploading of %1 asset%2.").arg(filteredDesc.assets.size()).arg(filteredDesc.assets.size() == 1 ? "." : "s."));
     }
-    numTotalUploads = 0;
-    uploadProgressStep = 0;
+
+    ++importGeneration;
+    importInProgress = true;
+    numTotalUploads = filteredDesc.assets.size();
     numFailedUploads = 0;
     numSuccessfulUploads = 0;
+    numSkippedUploads = 0;
+    numPendingHashes = 0;
+    uploadQueue.clear();
+    activeUploads.clear();
+
+    assetItemsByDestination.clear();
+    QTreeWidgetItemIterator it(assetTreeWidget);
+    while(*it)
+    {
+        if (!(*it)->isDisabled())
+            assetItemsByDestination[(*it)->text(cColumnAssetDestName)] = *it;
+        ++it;
+    }
+
+    // Hash the asset files in the job threads, so that the assets that the storage already has can be skipped.
+    // The assets that are known to AssetAPI only by their ref are uploaded as they are.
+    JobSystem *jobs = framework->Jobs();
     foreach(const AssetDesc &ad, filteredDesc.assets)
     {
-        try
+        AssetAPI::AssetRefType refType = AssetAPI::ParseAssetRef(ad.source);
+        if (jobs && (ad.dataInMemory || refType == AssetAPI::AssetRefLocalPath || refType == AssetAPI::AssetRefRelativePath))
         {
-            AssetUploadTransferPtr transfer;
-            if (ad.dataInMemory)
-                transfer = framework->Asset()->UploadAssetFromFileInMemory((const u8*)ad.data.data(), ad.data.size(), dest, ad.destinationName);
-            else
-            {
-                AssetAPI::AssetRefType refType = AssetAPI::ParseAssetRef(ad.source);
-                if (refType == AssetAPI::AssetRefLocalPath || refType == AssetAPI::AssetRefRelativePath)
-                    transfer = framework->Asset()->UploadAssetFromFile(ad.source, dest, ad.destinationName);
-                else
-                {
-                    AssetPtr asset = framework->Asset()->GetAsset(ad.source);
-                    if (asset)
-                    {
-                        if (!asset->DiskSource().isEmpty() && QFile::exists(asset->DiskSource()))
-                            transfer = framework->Asset()->UploadAssetFromFile(asset->DiskSource(), dest, ad.destinationName);
-                        else
-                        {
-                            QByteArray data = asset->GetRawData();
-                            if (data.length() > 0)
-                                transfer = framework->Asset()->UploadAssetFromFileInMemory(data, dest->Name(), ad.destinationName);
-                            else
-                                LogError("Cannot upload asset '" + ad.source + "' from memory to destination '" + ad.destinationName + "'! The source asset serialized to 0 size!");
-                        }
-                    }
-                    else
-                        LogError("Cannot upload asset from source '" + ad.source + "' to destination '" + ad.destinationName + "'! The source asset location is unknown!");
-                }
-            }
-
-            if (transfer &&
-                connect(transfer.get(), SIGNAL(Completed(IAssetUploadTransfer *)),
-                    SLOT(HandleUploadCompleted(IAssetUploadTransfer *)), Qt::UniqueConnection) &&
-                connect(transfer.get(), SIGNAL(Failed(IAssetUploadTransfer *)),
-                    SLOT(HandleUploadFailed(IAssetUploadTransfer *)), Qt::UniqueConnection))
-            {
-                numTotalUploads++;
-            }
+            ++numPendingHashes;
+            jobs->Schedule(MAKE_SHARED(HashJob, this, importGeneration, ad), true);
         }
-        catch(const Exception &e)
+        else
         {
-            LogError(std::string(e.what()));
+            QueuedUpload upload;
+            upload.desc = ad;
+            uploadQueue.append(upload);
         }
     }
 
-    uploadProgressStep = numTotalUploads > 0 ? 100 / numTotalUploads : 100;
-
+    uploadProgressBar->setRange(0, qMax(numTotalUploads, 1));
+    uploadProgressBar->setValue(0);
     if (numTotalUploads > 0)
     {
         uploadStatusLabel->show();
         uploadProgressBar->show();
+        cancelButton->setText(tr("Cancel import"));
+        addContentButton->setEnabled(false);
+        storageComboBox->setEnabled(false);
     }
     else
     {
@@ -864,7 +912,126 @@ void AddContentWindow::UploadAssets()
         uploadProgressBar->hide();
     }
 
-//    QMessageBox::critical(this, tr("Uploading"), tr("Starting uploads failed"));
+    StartQueuedUploads();
+}
+
+void AddContentWindow::HandleAssetHashed(const AssetDesc &desc, const QString &contentHash)
+{
+    --numPendingHashes;
+
+    // If the asset cache has the same content for the destination ref, the storage has it already.
+    AssetCache *cache = framework->Asset()->Cache();
+    AssetStoragePtr dest = CurrentStorage();
+    if (!contentHash.isEmpty() && cache && dest)
+    {
+        QString destinationRef = desc.destinationName;
+        if (AssetAPI::ParseAssetRef(destinationRef) != AssetAPI::AssetRefExternalUrl)
+            destinationRef = dest->GetFullAssetURL(desc.destinationName);
+        if (cache->ContentHash(destinationRef) == contentHash)
+        {
+            ++numSuccessfulUploads;
+            ++numSkippedUploads;
+            SetAssetItemStatus(desc.destinationName, QColor(0, 0, 255, 50));
+            UpdateUploadProgress();
+            return;
+        }
+    }
+
+    QueuedUpload upload;
+    upload.desc = desc;
+    upload.contentHash = contentHash;
+    uploadQueue.append(upload);
+    StartQueuedUploads();
+}
+
+void AddContentWindow::StartQueuedUploads()
+{
+    AssetStoragePtr dest = CurrentStorage();
+    while(importInProgress && activeUploads.size() < cMaxConcurrentUploads && !uploadQueue.isEmpty())
+    {
+        QueuedUpload queued = uploadQueue.takeFirst();
+        AssetUploadTransferPtr transfer = dest ? StartUpload(queued.desc, dest) : AssetUploadTransferPtr();
+        if (transfer &&
+            connect(transfer.get(), SIGNAL(Completed(IAssetUploadTransfer *)),
+                SLOT(HandleUploadCompleted(IAssetUploadTransfer *)), Qt::UniqueConnection) &&
+            connect(transfer.get(), SIGNAL(Failed(IAssetUploadTransfer *)),
+                SLOT(HandleUploadFailed(IAssetUploadTransfer *)), Qt::UniqueConnection))
+        {
+            ActiveUpload &upload = activeUploads[transfer.get()];
+            upload.transfer = transfer;
+            upload.contentHash = queued.contentHash;
+        }
+        else
+        {
+            ++numFailedUploads;
+            SetAssetItemStatus(queued.desc.destinationName, QColor(255, 0, 0, 75));
+        }
+    }
+
+    UpdateUploadProgress();
+}
+
+AssetUploadTransferPtr AddContentWindow::StartUpload(const AssetDesc &ad, const AssetStoragePtr &dest)
+{
+    AssetUploadTransferPtr transfer;
+    try
+    {
+        if (ad.dataInMemory)
+            transfer = framework->Asset()->UploadAssetFromFileInMemory((const u8*)ad.data.data(), ad.data.size(), dest, ad.destinationName);
+        else
+        {
+            AssetAPI::AssetRefType refType = AssetAPI::ParseAssetRef(ad.source);
+            if (refType == AssetAPI::AssetRefLocalPath || refType == AssetAPI::AssetRefRelativePath)
+                transfer = framework->Asset()->UploadAssetFromFile(ad.source, dest, ad.destinationName);
+            else
+            {
+                AssetPtr asset = framework->Asset()->GetAsset(ad.source);
+                if (asset)
+                {
+                    if (!asset->DiskSource().isEmpty() && QFile::exists(asset->DiskSource()))
+                        transfer = framework->Asset()->UploadAssetFromFile(asset->DiskSource(), dest, ad.destinationName);
+                    else
+                    {
+                        QByteArray data = asset->GetRawData();
+                        if (data.length() > 0)
+                            transfer = framework->Asset()->UploadAssetFromFileInMemory(data, dest->Name(), ad.destinationName);
+                        else
+                            LogError("Cannot upload asset '" + ad.source + "' from memory to destination '" + ad.destinationName + "'! The source asset serialized to 0 size!");
+                    }
+                }
+                else
+                    LogError("Cannot upload asset from source '" + ad.source + "' to destination '" + ad.destinationName + "'! The source asset location is unknown!");
+            }
+        }
+    }
+    catch(const Exception &e)
+    {
+        LogError(std::string(e.what()));
+    }
+    return transfer;
+}
+
+void AddContentWindow::CancelImportOrClose()
+{
+    if (!importInProgress)
+    {
+        close();
+        return;
+    }
+
+    // The uploads in progress can't be aborted, but their results are no longer waited for.
+    importInProgress = false;
+    uploadQueue.clear();
+    foreach(const ActiveUpload &upload, activeUploads)
+        disconnect(upload.transfer.get(), 0, this, 0);
+    activeUploads.clear();
+    numPendingHashes = 0;
+
+    uploadStatusLabel->setText(QString(tr("Import cancelled, %1/%2 assets were uploaded")).arg(numSuccessfulUploads).arg(numTotalUploads));
+    entityStatusLabel->setText("");
+    cancelButton->setText(tr("Cancel"));
+    addContentButton->setEnabled(true);
+    storageComboBox->setEnabled(true);
 }
 
 bool AddContentWindow::CreateEntities()
@@ -1027,50 +1194,80 @@ void AddContentWindow::HandleUploadFailed(IAssetUploadTransfer *transfer)
 
 void AddContentWindow::HandleUploadProgress(bool successful, IAssetUploadTransfer *transfer)
 {
+    QMap<IAssetUploadTransfer *, ActiveUpload>::iterator iter = activeUploads.find(transfer);
+    if (iter == activeUploads.end())
+        return;
+    ActiveUpload upload = iter.value(); // Keep the transfer alive until the end.
+    activeUploads.erase(iter);
+
     if (successful)
+    {
         ++numSuccessfulUploads;
+        // The cache dropped its old copy of the uploaded ref. If the cache has the uploaded content under some other ref,
+        // map the ref to it, so that the next import of the same content is skipped.
+        AssetCache *cache = framework->Asset()->Cache();
+        if (cache && !upload.contentHash.isEmpty() && !cache->FindByContentHash(upload.contentHash).isEmpty())
+            cache->StoreAlias(transfer->AssetRef(), upload.contentHash);
+    }
     else
         ++numFailedUploads;
 
     uploadStatusLabel->setText(successful ? "Uploaded " : "Upload failed for " + transfer->AssetRef());
-    uploadProgressBar->setValue(successful ? uploadProgressBar->value() + uploadProgressStep : 0);
+    SetAssetItemStatus(transfer->AssetRef(), successful ? QColor(0, 255, 0, 75) :  QColor(255, 0, 0, 75));
 
-    const QColor statusColor = successful ? QColor(0, 255, 0, 75) :  QColor(255, 0, 0, 75);
+    StartQueuedUploads();
+}
 
-    QTreeWidgetItemIterator it(assetTreeWidget);
-    while(*it)
+void AddContentWindow::SetAssetItemStatus(const QString &destinationName, const QColor &statusColor)
+{
+    QMap<QString, QTreeWidgetItem *>::const_iterator iter = assetItemsByDestination.find(destinationName);
+    if (iter == assetItemsByDestination.end())
+        return;
+
+    QTreeWidgetItem *aitem = iter.value();
+    aitem->setBackgroundColor(cColumnAssetTypeName, statusColor);
+    aitem->setBackgroundColor(cColumnAssetSourceName, statusColor);
+    aitem->setBackgroundColor(cColumnAssetSubname, statusColor);
+    aitem->setBackgroundColor(cColumnAssetDestName, statusColor);
+}
+
+void AddContentWindow::UpdateUploadProgress()
+{
+    if (!importInProgress)
+        return;
+
+    int numHandled = numSuccessfulUploads + numFailedUploads;
+    uploadProgressBar->setValue(numHandled);
+    if (numPendingHashes > 0)
+        uploadStatusLabel->setText(QString(tr("Checking assets, %1 remaining")).arg(numPendingHashes));
+
+    if (numPendingHashes > 0 || !uploadQueue.isEmpty() || !activeUploads.isEmpty())
+        return;
+
+    importInProgress = false;
+    cancelButton->setText(tr("Cancel"));
+    addContentButton->setEnabled(true);
+    storageComboBox->setEnabled(true);
+
+    if (numSuccessfulUploads > 0)
     {
-        AssetWidgetItem *aitem = checked_static_cast<AssetWidgetItem *>(*it);
-        if (!aitem->isDisabled() && aitem->text(cColumnAssetDestName) == transfer->AssetRef())
-        {
-            aitem->setBackgroundColor(cColumnAssetTypeName, statusColor);
-            aitem->setBackgroundColor(cColumnAssetSourceName, statusColor);
-            aitem->setBackgroundColor(cColumnAssetSubname, statusColor);
-            aitem->setBackgroundColor(cColumnAssetDestName, statusColor);
-            break;
-        }
-        ++it;
+        QString msg = QString(tr("%1/%2 uploads completed successfully")).arg(numSuccessfulUploads).arg(numTotalUploads);
+        if (numSkippedUploads > 0)
+            msg += QString(tr(", %1 of them were already in the storage")).arg(numSkippedUploads);
+        uploadStatusLabel->setText(msg);
+        // Save most recently used storage to config.
+        ConfigData c(ConfigAPI::FILE_FRAMEWORK, cAddContentDialogSetting, cRecentStorageSetting, CurrentStorageName());
+        framework->Config()->Set(c);
+        // Emit AssetUploadCompleted which initiates CreateEntities
+        emit AssetUploadCompleted(CurrentStorage(), numSuccessfulUploads, numFailedUploads);
     }
-
-    if (numSuccessfulUploads + numFailedUploads == numTotalUploads)
+    if (numFailedUploads > 0)
     {
-        if (numSuccessfulUploads > 0)
+        QString existingNotification("");
+        if (numSuccessfulUploads > 0 && uploadStatusLabel->text().length() > 0)
         {
-            uploadStatusLabel->setText(QString(tr("%1/%2 uploads completed successfully")).arg(numSuccessfulUploads).arg(numTotalUploads));
-            // Save most recently used storage to config.
-            ConfigData c(ConfigAPI::FILE_FRAMEWORK, cAddContentDialogSetting, cRecentStorageSetting, CurrentStorageName());
-            framework->Config()->Set(c);
-            // Emit AssetUploadCompleted which initiates CreateEntities
-            emit AssetUploadCompleted(CurrentStorage(), numSuccessfulUploads, numFailedUploads);
-        }
-        if (numFailedUploads > 0)
-        {
-            QString existingNotification("");
-            if (uploadStatusLabel->text().length() > 0)
-            {
-                existingNotification += uploadStatusLabel->text() + "\n";
-            }
-            uploadStatusLabel->setText(existingNotification + QString(tr("%1/%2 uploads failed")).arg(numFailedUploads).arg(numTotalUploads));
+            existingNotification += uploadStatusLabel->text() + "\n";
         }
+        uploadStatusLabel->setText(existingNotification + QString(tr("%1/%2 uploads failed")).arg(numFailedUploads).arg(numTotalUploads));
     }
 }
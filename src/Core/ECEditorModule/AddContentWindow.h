@@ -8,6 +8,7 @@
 
 #include <QWidget>
 #include <QTreeWidget>
+#include <QMap>
 
 #include "ECEditorModuleApi.h"
 #include "SceneFwd.h"
@@ -109,6 +110,25 @@ private:
     /// Generates contents of asset storage combo box. Sets default storage selected as default.
     void GenerateStorageComboBoxContents();
 
+    struct HashJob;
+
+    /// Called when the content hash of an asset to upload has been computed. Skips the asset if the storage already has the same content.
+    /** @param contentHash Content hash of the asset data, or empty if the data couldn't be read. */
+    void HandleAssetHashed(const AssetDesc &desc, const QString &contentHash);
+
+    /// Starts uploads from the upload queue until the number of concurrent uploads reaches the limit.
+    void StartQueuedUploads();
+
+    /// Starts the upload of an asset.
+    /** @return The upload transfer, or null if the upload couldn't be started. */
+    AssetUploadTransferPtr StartUpload(const AssetDesc &desc, const AssetStoragePtr &dest);
+
+    /// Colors the tree widget item of the asset by the upload result.
+    void SetAssetItemStatus(const QString &destinationName, const QColor &statusColor);
+
+    /// Updates the upload progress and, when all of the assets have been handled, finishes the import.
+    void UpdateUploadProgress();
+
     QTreeWidget *entityTreeWidget;
     QTreeWidget *assetTreeWidget;
     Framework *framework;
@@ -122,10 +142,26 @@ private:
     // Uploading
     QLabel *uploadStatusLabel;
     QProgressBar *uploadProgressBar;
-    int uploadProgressStep;
     int numFailedUploads;
     int numSuccessfulUploads;
-    int numTotalUploads; ///< Number of uploads initiated, set at UploadAssets()
+    int numSkippedUploads; ///< Number of assets the storage already had with the same content, included in numSuccessfulUploads.
+    int numTotalUploads; ///< Number of assets to upload, set at UploadAssets()
+    int numPendingHashes; ///< Number of assets whose content hash is being computed.
+    bool importInProgress;
+    int importGeneration; ///< Incremented at each import, so that the hash jobs of a cancelled import are ignored.
+    struct QueuedUpload
+    {
+        AssetDesc desc;
+        QString contentHash; ///< Content hash of the asset data, or empty if not known.
+    };
+    QList<QueuedUpload> uploadQueue; ///< Assets waiting for a free upload slot.
+    struct ActiveUpload
+    {
+        AssetUploadTransferPtr transfer;
+        QString contentHash;
+    };
+    QMap<IAssetUploadTransfer *, ActiveUpload> activeUploads;
+    QMap<QString, QTreeWidgetItem *> assetItemsByDestination; ///< Asset tree widget items by their destination name, for the upload status.
 
     // Entities add
     QLabel *entityStatusLabel;
@@ -163,8 +199,13 @@ private slots:
     bool CheckForStorageValidity();
 
     /// Starts uploading of assets, if applicable.
+    /** The content hashes of the assets are computed in jobs, the assets that the storage already has are skipped,
+        and the rest are uploaded a few at a time. */
     void UploadAssets();
 
+    /// Cancels the ongoing import, or closes the window if there is none.
+    void CancelImportOrClose();
+
     /// Add entities to scene.
     bool CreateEntities();
 
@@ -13,6 +13,7 @@
 #include "SceneTreeWidgetItems.h"
 
 #include "Framework.h"
+#include "FrameAPI.h"
 #include "AssetAPI.h"
 #include "IAsset.h"
 #include "IAssetBundle.h"
@@ -90,6 +91,9 @@ void AssetsWindow::PopulateTreeWidget()
 {
     treeWidget->clear();
     alreadyAdded.clear();
+    assetItems.clear();
+    pendingAssets.clear();
+    pendingUpdates.clear();
 
     // Create "No provider" for assets without storage.
     SAFE_DELETE(noStorageItem);
@@ -102,42 +106,104 @@ void AssetsWindow::PopulateTreeWidget()
         CreateStorageItem(storage);
 
     // Iterate asset bundles
-    std::pair<QString, AssetBundlePtr> bundlePair;
-    foreach(bundlePair, framework->Asset()->AssetBundles())
-        AddBundle(bundlePair.second);
+    const AssetBundleMap &bundles = framework->Asset()->AllAssetBundles();
+    for(AssetBundleMap::const_iterator iter = bundles.begin(); iter != bundles.end(); ++iter)
+        AddBundle(iter->second);
 
     // Iterate assets
-    std::pair<QString, AssetPtr> pair;
-    foreach(pair, framework->Asset()->Assets())
-         AddAsset(pair.second);
+    const AssetMap &assets = framework->Asset()->AllAssets();
+    for(AssetMap::const_iterator iter = assets.begin(); iter != assets.end(); ++iter)
+        AddAssetItem(iter->second);
 
     // Add the no provider last and hide if no children.
     treeWidget->addTopLevelItem(noStorageItem);
     noStorageItem->setHidden(noStorageItem->childCount() == 0);
+
+    QString searchFilter = searchField->text().trimmed();
+    if (!searchFilter.isEmpty())
+        TreeWidgetSearch(treeWidget, 0, searchFilter);
 }
 
 void AssetsWindow::AddAsset(const AssetPtr &asset)
 {
-    if (alreadyAdded.find(asset) != alreadyAdded.end())
+    if (!AddAssetItem(asset))
         return;
+
+    noStorageItem->setHidden(noStorageItem->childCount() == 0);
+
+    // If we have an ongoing search, make sure that the new item is compared too.
+    QString searchFilter = searchField->text().trimmed();
+    if (!searchFilter.isEmpty())
+        TreeWidgetSearch(treeWidget, 0, searchFilter);
+}
+
+bool AssetsWindow::AddAssetItem(const AssetPtr &asset)
+{
+    if (alreadyAdded.find(asset) != alreadyAdded.end())
+        return false;
     if (!assetType.isEmpty() && assetType != asset->Type())
-        return;
+        return false;
 
     AssetItem *item = CreateAssetItem(asset);
     if (!item)
-        return;
+        return false;
     AddChildren(asset, item);
 
-    connect(asset.get(), SIGNAL(Loaded(AssetPtr)), SLOT(UpdateAssetItem(AssetPtr)), Qt::UniqueConnection);
-    connect(asset.get(), SIGNAL(Unloaded(IAsset *)), SLOT(UpdateAssetItem(IAsset *)), Qt::UniqueConnection);
-    connect(asset.get(), SIGNAL(PropertyStatusChanged(IAsset *)), SLOT(UpdateAssetItem(IAsset *)), Qt::UniqueConnection);
+    connect(asset.get(), SIGNAL(Loaded(AssetPtr)), SLOT(QueueAssetItemUpdate(AssetPtr)), Qt::UniqueConnection);
+    connect(asset.get(), SIGNAL(Unloaded(IAsset *)), SLOT(QueueAssetItemUpdate(IAsset *)), Qt::UniqueConnection);
+    connect(asset.get(), SIGNAL(PropertyStatusChanged(IAsset *)), SLOT(QueueAssetItemUpdate(IAsset *)), Qt::UniqueConnection);
+    return true;
+}
 
-    noStorageItem->setHidden(noStorageItem->childCount() == 0);
+void AssetsWindow::QueueAsset(AssetPtr asset)
+{
+    pendingAssets.push_back(asset);
+    SchedulePendingChanges();
+}
 
-    // If we have an ongoing search, make sure that the new item is compared too.
-    QString searchFilter = searchField->text().trimmed();
-    if (!searchFilter.isEmpty())
-        TreeWidgetSearch(treeWidget, 0, searchFilter);
+void AssetsWindow::QueueAssetItemUpdate(IAsset *asset)
+{
+    pendingUpdates.insert(asset);
+    SchedulePendingChanges();
+}
+
+void AssetsWindow::SchedulePendingChanges()
+{
+    connect(framework->Frame(), SIGNAL(PostFrameUpdate(float)), this, SLOT(ProcessPendingChanges()), Qt::UniqueConnection);
+}
+
+void AssetsWindow::ProcessPendingChanges()
+{
+    disconnect(framework->Frame(), SIGNAL(PostFrameUpdate(float)), this, SLOT(ProcessPendingChanges()));
+
+    if (!pendingAssets.empty())
+    {
+        std::vector<AssetWeakPtr> created;
+        created.swap(pendingAssets);
+        bool added = false;
+        for(size_t i = 0; i < created.size(); ++i)
+        {
+            // Skip the assets that were forgotten during the frame.
+            AssetPtr asset = created[i].lock();
+            if (asset && framework->Asset()->GetAsset(asset->Name()) == asset && AddAssetItem(asset))
+                added = true;
+        }
+
+        if (added)
+        {
+            noStorageItem->setHidden(noStorageItem->childCount() == 0);
+
+            // If we have an ongoing search, make sure that the new items are compared too.
+            QString searchFilter = searchField->text().trimmed();
+            if (!searchFilter.isEmpty())
+                TreeWidgetSearch(treeWidget, 0, searchFilter);
+        }
+    }
+
+    std::set<IAsset *> updated;
+    updated.swap(pendingUpdates);
+    for(std::set<IAsset *>::const_iterator iter = updated.begin(); iter != updated.end(); ++iter)
+        UpdateAssetItem(*iter);
 }
 
 void AssetsWindow::AddBundle(const AssetBundlePtr &bundle)
@@ -147,20 +213,41 @@ void AssetsWindow::AddBundle(const AssetBundlePtr &bundle)
 
 void AssetsWindow::RemoveAsset(AssetPtr asset)
 {
-    QTreeWidgetItemIterator it(treeWidget);
-    while(*it)
+    pendingUpdates.erase(asset.get());
+
+    // Deleting an item deletes its children, which may include other items of the same asset.
+    AssetItem *item = 0;
+    while((item = assetItems.value(asset.get())) != 0)
     {
-        AssetItem *item = dynamic_cast<AssetItem *>(*it);
-        if (item && item->Asset() && item->Asset() == asset)
-        {
-            QTreeWidgetItem *parent = item->parent();
+        UnregisterItemRecursive(item);
+        QTreeWidgetItem *parent = item->parent();
+        if (parent)
             parent->removeChild(item);
-            SAFE_DELETE(item);
-            alreadyAdded.erase(asset);
-        }
+        SAFE_DELETE(item);
+    }
+    alreadyAdded.erase(asset);
+}
 
-        ++it;
+void AssetsWindow::UnregisterItemRecursive(QTreeWidgetItem *item)
+{
+    AssetItem *assetItem = dynamic_cast<AssetItem *>(item);
+    if (assetItem)
+    {
+        AssetPtr asset = assetItem->Asset();
+        if (asset)
+            assetItems.remove(asset.get(), assetItem);
+        else
+        {
+            // The asset is gone already, find the item by value.
+            for(QMultiHash<IAsset *, AssetItem *>::iterator iter = assetItems.begin(); iter != assetItems.end(); )
+                if (iter.value() == assetItem)
+                    iter = assetItems.erase(iter);
+                else
+                    ++iter;
+        }
     }
+    for(int i = 0; i < item->childCount(); ++i)
+        UnregisterItemRecursive(item->child(i));
 }
 
 void AssetsWindow::Search(const QString &filter)
@@ -170,17 +257,9 @@ void AssetsWindow::Search(const QString &filter)
 
 void AssetsWindow::UpdateAssetItem(IAsset *asset)
 {
-    QTreeWidgetItemIterator it(treeWidget);
-    while(*it)
-    {
-        AssetItem *item = dynamic_cast<AssetItem *>(*it);
-        if (item && item->Asset().get() == asset)
-        {
+    foreach(AssetItem *item, assetItems.values(asset))
+        if (item->Asset().get() == asset)
             item->SetText(asset);
-            break;
-        }
-        ++it;
-    }
 }
 
 void AssetsWindow::Initialize()
@@ -214,7 +293,7 @@ void AssetsWindow::Initialize()
     connect(searchField, SIGNAL(textEdited(const QString &)), SLOT(Search(const QString &)));
     connect(expandAndCollapseButton, SIGNAL(clicked()), SLOT(ExpandOrCollapseAll()));
 
-    connect(framework->Asset(), SIGNAL(AssetCreated(AssetPtr)), SLOT(AddAsset(AssetPtr)));
+    connect(framework->Asset(), SIGNAL(AssetCreated(AssetPtr)), SLOT(QueueAsset(AssetPtr)));
     connect(framework->Asset(), SIGNAL(AssetAboutToBeRemoved(AssetPtr)), SLOT(RemoveAsset(AssetPtr)));
 
     connect(treeWidget, SIGNAL(itemCollapsed(QTreeWidgetItem*)), SLOT(CheckTreeExpandStatus(QTreeWidgetItem*)));
@@ -231,6 +310,7 @@ void AssetsWindow::AddChildren(const AssetPtr &asset, QTreeWidgetItem *parent)
         {
             AssetItem *item = new AssetItem(asset, parent);
             parent->addChild(item);
+            assetItems.insert(asset.get(), item);
             alreadyAdded.insert(asset);
 
             // Check for recursive dependencies.
@@ -361,13 +441,13 @@ AssetBundleItem *AssetsWindow::CreateBundleItem(const AssetBundlePtr &bundle)
 
 AssetItem *AssetsWindow::CreateAssetItem(const AssetPtr &asset)
 {
-    for (int i=0; i<treeWidget->topLevelItemCount(); ++i)
-        if (FindAssetItemRecursive(treeWidget->topLevelItem(i), asset))
-            return 0;
+    if (assetItems.contains(asset.get()))
+        return 0;
 
     QTreeWidgetItem *p = FindParentItem(asset);
     AssetItem *item = new AssetItem(asset, p);
     p->addChild(item);
+    assetItems.insert(asset.get(), item);
     return item;
 }
 
@@ -409,25 +489,6 @@ AssetBundleItem *AssetsWindow::FindBundleItemRecursive(QTreeWidgetItem *parent,
     return result;
 }
 
-AssetItem *AssetsWindow::FindAssetItemRecursive(QTreeWidgetItem *parent, const AssetPtr &asset)
-{
-    if (!parent || parent->childCount() == 0)
-        return false;
-
-    AssetItem *result = 0;
-    for (int i=0; i<parent->childCount(); ++i)
-    {
-        AssetItem *existing = dynamic_cast<AssetItem*>(parent->child(i));
-        if (existing && existing->Asset() == asset)
-            result = existing;
-        else
-            result = FindAssetItemRecursive(parent->child(i), asset);
-        if (result)
-            break;
-    }
-    return result;
-}
-
 template <typename T>
 QTreeWidgetItem *AssetsWindow::FindParentItem(const T &item)
 {
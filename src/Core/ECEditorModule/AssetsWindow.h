@@ -12,8 +12,10 @@
 #include <QWidget>
 #include <QLineEdit>
 #include <QPushButton>
+#include <QMultiHash>
 
 #include <set>
+#include <vector>
 
 class Framework;
 class QTreeWidgetItem;
@@ -86,6 +88,16 @@ private:
     /// Initializes the UI.
     void Initialize();
 
+    /// Creates the item of a new asset, with its references as children, and starts tracking its changes.
+    /** @return True if an item was created. */
+    bool AddAssetItem(const AssetPtr &asset);
+
+    /// Forgets an item and its descendants in the item lookup, before the item is deleted.
+    void UnregisterItemRecursive(QTreeWidgetItem *item);
+
+    /// Processes the pending changes on the next frame.
+    void SchedulePendingChanges();
+
     /// Creates a storage item as a top level item.
     AssetStorageItem *CreateStorageItem(const AssetStoragePtr &storage);
 
@@ -101,9 +113,6 @@ private:
     /// Finds a bundle item recursively with @c subAssetRef from the tree starting from @c parent.
     AssetBundleItem *FindBundleItemRecursive(QTreeWidgetItem *parent, const QString &subAssetRef);
 
-    /// Finds a @asset item recursively with from the tree starting from @c parent.
-    AssetItem *FindAssetItemRecursive(QTreeWidgetItem *parent, const AssetPtr &asset);
-
     /// Finds parent for @c item. T must implement `AssetStoragePtr AssetStorage()` and `QString Name()`.
     template <typename T>
     QTreeWidgetItem *FindParentItem(const T &item);
@@ -123,11 +132,24 @@ private:
     AssetTreeWidget *treeWidget; ///< Tree widget showing the assets.
     QTreeWidgetItem *noStorageItem; ///< "No Storage" parent item for assets without storage.
     std::set<AssetWeakPtr, AssetWeakPtrLessThan> alreadyAdded; ///< Set of already added assets.
+    QMultiHash<IAsset *, AssetItem *> assetItems; ///< Items of the assets, an asset can have several when referred by several others.
+    std::vector<AssetWeakPtr> pendingAssets; ///< Created assets whose items are added on the next frame.
+    std::set<IAsset *> pendingUpdates; ///< Assets whose items are updated on the next frame.
     QLineEdit *searchField;
     QPushButton *expandAndCollapseButton;
     QString assetType;
 
 private slots:
+    /// Queues a created asset to be added on the next frame, so that the assets created during a frame are added at once.
+    void QueueAsset(AssetPtr asset);
+
+    /// Queues the item of an asset to be updated on the next frame.
+    void QueueAssetItemUpdate(IAsset *asset);
+    void QueueAssetItemUpdate(AssetPtr asset) { QueueAssetItemUpdate(asset.get()); }
+
+    /// Adds the queued assets and updates the queued items.
+    void ProcessPendingChanges();
+
     /// Expands or collapses the whole tree view, depending on the previous action.
     void ExpandOrCollapseAll();
 
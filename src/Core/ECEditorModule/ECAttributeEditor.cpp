@@ -31,9 +31,15 @@
 #include <qtpropertymanager.h>
 #include <qtpropertybrowser.h>
 #include <qteditorfactory.h>
+#include <qttreepropertybrowser.h>
 
 #include "MemoryLeakCheck.h"
 
+int ECAttributeEditorBase::maxRefreshRate_ = 10;
+
+// Interval at which pending changes are retried while the browser is hidden.
+static const int cHiddenRefreshPollMs = 250;
+
 ECAttributeEditorBase::ECAttributeEditorBase(QtAbstractPropertyBrowser *owner, IAttribute *attribute, QObject *parent) :
     QObject(parent),
     owner_(owner),
@@ -44,8 +50,16 @@ ECAttributeEditorBase::ECAttributeEditorBase(QtAbstractPropertyBrowser *owner, I
     propertyMgr_(0),
     listenEditorChangedSignal_(false),
     useMultiEditor_(false),
-    metaDataFlag_(0)
+    metaDataFlag_(0),
+    refreshPending_(false)
 {
+    refreshTimer_.setSingleShot(true);
+    connect(&refreshTimer_, SIGNAL(timeout()), SLOT(RefreshIfPending()));
+    // Changes to collapsed properties are applied when they get expanded.
+    QtTreePropertyBrowser *treeBrowser = qobject_cast<QtTreePropertyBrowser *>(owner_);
+    if (treeBrowser)
+        connect(treeBrowser, SIGNAL(expanded(QtBrowserItem *)), SLOT(RefreshIfPending()));
+
     AddComponent(attribute->Owner()->shared_from_this());
 }
 
@@ -146,17 +160,80 @@ bool ECAttributeEditorBase::HasComponent(const ComponentPtr &component)
     return false;
 }
 
+void ECAttributeEditorBase::SetMaxRefreshRate(int refreshesPerSecond)
+{
+    maxRefreshRate_ = qMax(refreshesPerSecond, 0);
+}
+
 void ECAttributeEditorBase::AttributeChanged(IAttribute* attribute)
 {
     if (listenEditorChangedSignal_)
     {
         // Ensure that attribute's name matchs with the editor's name variable.
         // If they doesn't match, no need to update the ui.
-        if (attribute->Name() == this->name_)
+        if (attribute->Name() != this->name_)
+            return;
+
+        if (maxRefreshRate_ <= 0)
+        {
             UpdateEditorUI(attribute);
+            return;
+        }
+
+        // With multiple components the update compares all of their values, so coalesce the changes
+        // and update at most at the max refresh rate.
+        refreshPending_ = true;
+        int waitMs = lastRefreshTime_.isNull() ? 0 : 1000 / maxRefreshRate_ - lastRefreshTime_.elapsed();
+        if (waitMs <= 0)
+            RefreshIfPending();
+        else if (!refreshTimer_.isActive())
+            refreshTimer_.start(waitMs);
     }
 }
 
+void ECAttributeEditorBase::RefreshIfPending()
+{
+    if (!refreshPending_)
+        return;
+
+    if (!IsVisibleInBrowser())
+    {
+        // Collapsed properties are updated when expanded, a hidden browser is polled until it's shown.
+        if (owner_ && !owner_->isVisible() && !refreshTimer_.isActive())
+            refreshTimer_.start(cHiddenRefreshPollMs);
+        return;
+    }
+
+    refreshPending_ = false;
+    refreshTimer_.stop();
+    lastRefreshTime_.start();
+    // The changed attributes may belong to any of the components, update from all of them.
+    UpdateEditorUI();
+}
+
+bool ECAttributeEditorBase::IsVisibleInBrowser() const
+{
+    if (!owner_ || !owner_->isVisible())
+        return false;
+
+    QtTreePropertyBrowser *treeBrowser = qobject_cast<QtTreePropertyBrowser *>(owner_);
+    if (!treeBrowser || !rootProperty_)
+        return true;
+
+    QList<QtBrowserItem *> items = treeBrowser->items(rootProperty_);
+    if (items.isEmpty())
+        return true; // Not added to the browser yet.
+    foreach(QtBrowserItem *item, items)
+    {
+        bool expanded = true;
+        for(QtBrowserItem *parent = item->parent(); parent && expanded; parent = parent->parent())
+            expanded = treeBrowser->isExpanded(parent);
+        if (expanded)
+            return true;
+    }
+    return false;
+}
+
 void ECAttributeEditorBase::MultiEditValueSelected(const QString &value) 
 {
     ComponentWeakPtr comp;
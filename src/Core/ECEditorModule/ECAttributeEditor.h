@@ -17,6 +17,8 @@
 #include <QObject>
 #include <QVariant>
 #include <QPoint>
+#include <QTimer>
+#include <QTime>
 
 #include <map>
 
@@ -75,12 +77,23 @@ public:
         the editor begin to use multiedit mode and editor need to create new ui elements. */
     void UpdateEditorUI(IAttribute *attr = 0);
 
+    /// Sets the highest rate at which the editors update their UI on attribute changes.
+    /** Changes arriving faster, f.ex. from a moving entity, are coalesced into one update.
+        @param refreshesPerSecond Updates per second, or 0 for updating on every change. */
+    static void SetMaxRefreshRate(int refreshesPerSecond);
+
+    /// Returns the highest rate at which the editors update their UI on attribute changes, 0 if unlimited.
+    static int MaxRefreshRate() { return maxRefreshRate_; }
+
 public slots:
     void AddComponent(const ComponentPtr &component);
     void RemoveComponent(const ComponentPtr &component);
     bool HasComponent(const ComponentPtr &component);
     void AttributeChanged(IAttribute* attribute);
 
+    /// Updates the UI if attribute changes are waiting for the editor to become visible in the browser.
+    void RefreshIfPending();
+
 signals:
     /// Signal is emmitted when editor has been reinitialized.
     /** @param name Attribute name. */
@@ -133,6 +146,9 @@ protected:
 
     QList<ComponentWeakPtr>::iterator FindComponent(ComponentPtr component);
 
+    /// Returns if the editor's property is shown, i.e. the browser is visible and all the parent items of the property are expanded.
+    bool IsVisibleInBrowser() const;
+
     QtAbstractPropertyBrowser *owner_;
     QtAbstractPropertyManager *propertyMgr_;
     QtAbstractEditorFactoryBase *factory_;
@@ -146,6 +162,10 @@ protected:
     ComponentWeakPtrList components_;
     bool useMultiEditor_;
     MetaDataFlag metaDataFlag_;
+    bool refreshPending_; ///< Are there attribute changes that the UI hasn't been updated to.
+    QTimer refreshTimer_; ///< Delays the update of coalesced attribute changes.
+    QTime lastRefreshTime_; ///< Time of the last update caused by attribute changes.
+    static int maxRefreshRate_;
 };
 
 /// Implements attribute editor UI elements for attribute of type @c T and forwards attribute changes to IAttribute objects.
@@ -209,6 +209,10 @@ void ECBrowser::ExpandOrCollapseAll()
         treeWidget_->blockSignals(true);
         TreeWidgetExpandOrCollapseAll(treeWidget_);
         treeWidget_->blockSignals(false);
+
+        // The expanded signals were blocked, apply the changes to the attributes that became visible.
+        for(TreeItemToComponentGroup::iterator iter = itemToComponentGroups_.begin(); iter != itemToComponentGroups_.end(); ++iter)
+            (*iter)->editor_->RefreshPendingAttributes();
     }
 }
 
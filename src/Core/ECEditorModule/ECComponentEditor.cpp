@@ -246,6 +246,12 @@ void ECComponentEditor::UpdateUi()
         iter.value()->UpdateEditorUI();
 }
 
+void ECComponentEditor::RefreshPendingAttributes()
+{
+    for(AttributeEditorMap::iterator iter = attributeEditors_.begin(); iter != attributeEditors_.end(); ++iter)
+        iter.value()->RefreshIfPending();
+}
+
 QString ECComponentEditor::GetAttributeType(const QString &name) const
 {
     AttributeEditorMap::const_iterator iter = attributeEditors_.find(name);
@@ -50,6 +50,9 @@ public slots:
     /// Updates the UI.
     void UpdateUi();
 
+    /// Updates the attribute editors that have changes waiting for them to become visible.
+    void RefreshPendingAttributes();
+
     /// If ECAttributeEditor has been reinitialized ComponentEditor need to add new QProperty to it's GroupProperty.
     /// This ensures that newly createated attribute eidtor will get displayed on the ECBrowser.
     void OnEditorChanged(const QString &name);
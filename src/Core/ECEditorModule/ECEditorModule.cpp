@@ -5,6 +5,7 @@
 
 #include "ECEditorModule.h"
 #include "ECEditorWindow.h"
+#include "ECAttributeEditor.h"
 #include "EcXmlEditorWidget.h"
 #include "DoxygenDocReader.h"
 #include "TreeWidgetItemExpandMemory.h"
@@ -30,6 +31,7 @@ namespace
 {
     const ConfigData cGizmoConfig(ConfigAPI::FILE_FRAMEWORK, "ECEditor", "show editing gizmo", true);
     const ConfigData cHighlightConfig(ConfigAPI::FILE_FRAMEWORK, "ECEditor", "highlight selected entities", true);
+    const ConfigData cAttributeRefreshRateConfig(ConfigAPI::FILE_FRAMEWORK, "ECEditor", "attribute refresh rate", 10);
     const ConfigData cEditorPosConfig(ConfigAPI::FILE_FRAMEWORK, "ECEditor", "eceditor window pos", QPoint(50, 50));
 }
 
@@ -52,6 +54,7 @@ void ECEditorModule::Initialize()
     ConfigAPI &cfg = *framework_->Config();
     gizmoEnabled = cfg.DeclareSetting(cGizmoConfig).toBool();
     highlightingEnabled = cfg.DeclareSetting(cHighlightConfig).toBool();
+    ECAttributeEditorBase::SetMaxRefreshRate(cfg.DeclareSetting(cAttributeRefreshRateConfig).toInt());
 
     framework_->Console()->RegisterCommand("doc", "Prints the class documentation for the given symbol."
         "Usage example: 'doc(EC_Placeable::WorldPosition)'.", this, SLOT(ShowDocumentation(const QString &)));
@@ -69,6 +72,7 @@ void ECEditorModule::Uninitialize()
     ConfigAPI &cfg = *framework_->Config();
     cfg.Write(cGizmoConfig, cGizmoConfig.key, gizmoEnabled);
     cfg.Write(cHighlightConfig, cHighlightConfig.key, highlightingEnabled);
+    cfg.Write(cAttributeRefreshRateConfig, cAttributeRefreshRateConfig.key, ECAttributeEditorBase::MaxRefreshRate());
     if (commonEditor)
         cfg.Write(cEditorPosConfig, cEditorPosConfig.key, commonEditor->pos());
 
@@ -109,6 +113,16 @@ void ECEditorModule::SetHighlightingEnabled(bool enabled)
             editor->SetHighlightingEnabled(false);
 }
 
+void ECEditorModule::SetAttributeRefreshRate(int refreshesPerSecond)
+{
+    ECAttributeEditorBase::SetMaxRefreshRate(refreshesPerSecond);
+}
+
+int ECEditorModule::AttributeRefreshRate() const
+{
+    return ECAttributeEditorBase::MaxRefreshRate();
+}
+
 void ECEditorModule::ECEditorFocusChanged(ECEditorWindow *editor)
 {
     if (editor == activeEditor && !editor)
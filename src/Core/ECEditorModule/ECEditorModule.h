@@ -28,6 +28,7 @@ class ECEDITOR_MODULE_API ECEditorModule : public IModule
     Q_OBJECT
     Q_PROPERTY(bool gizmoEnabled READ IsGizmoEnabled WRITE SetGizmoEnabled)
     Q_PROPERTY(bool highlightingEnabled READ IsHighlightingEnabled WRITE SetHighlightingEnabled)
+    Q_PROPERTY(int attributeRefreshRate READ AttributeRefreshRate WRITE SetAttributeRefreshRate)
 
 public:
     ECEditorModule();
@@ -50,6 +51,12 @@ public:
     /// Is highlighting of selected entities enabled.
     bool IsHighlightingEnabled() const { return highlightingEnabled; }
 
+    /// Sets how many times per second at most the attribute editors update on attribute changes, 0 for every change.
+    void SetAttributeRefreshRate(int refreshesPerSecond);
+
+    /// Returns how many times per second at most the attribute editors update on attribute changes.
+    int AttributeRefreshRate() const;
+
 public slots:
     /// Shows the entity-component editor window.
     void ShowEditorWindow();
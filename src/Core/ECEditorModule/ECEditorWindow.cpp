@@ -105,13 +105,17 @@ ECEditorWindow::ECEditorWindow(Framework* fw, QWidget *parent) :
     ecBrowser->SetItemExpandMemory(ecEditorModule->ExpandMemory());
 
     entityList->setSelectionMode(QAbstractItemView::ExtendedSelection);
-    connect(entityList, SIGNAL(itemSelectionChanged()), this, SLOT(Refresh()));
+    // Dragging a selection over many entities changes it on every item, refresh once for all of the changes.
+    refreshTimer.setSingleShot(true);
+    connect(&refreshTimer, SIGNAL(timeout()), SLOT(Refresh()));
+    connect(entityList, SIGNAL(itemSelectionChanged()), this, SLOT(QueueRefresh()));
     connect(entityList, SIGNAL(customContextMenuRequested(const QPoint &)), this, SLOT(ShowEntityContextMenu(const QPoint &)));
 
     connect(toggleEntitiesButton, SIGNAL(pressed()), this, SLOT(ToggleEntityList()));
     connect(expandOrCollapseButton, SIGNAL(clicked()), ecBrowser, SLOT(ExpandOrCollapseAll()));
 
     connect(scene, SIGNAL(EntityRemoved(Entity*, AttributeChange::Type)), SLOT(RemoveEntity(Entity*)), Qt::UniqueConnection);
+    connect(scene, SIGNAL(EntitiesRemoved(const EntityList &, AttributeChange::Type)), SLOT(RemoveEntities(const EntityList &)), Qt::UniqueConnection);
     connect(scene, SIGNAL(ActionTriggered(Entity *, const QString &, const QStringList &, EntityAction::ExecTypeField)),
         SLOT(OnActionTriggered(Entity *, const QString &, const QStringList &)), Qt::UniqueConnection);
 
@@ -574,6 +578,7 @@ void ECEditorWindow::HighlightEntities(const QString &type, const QString &name)
 void ECEditorWindow::Refresh()
 {
     PROFILE(ECEditorWindow_Refresh);
+    refreshTimer.stop();
     if (!ecBrowser)
         return;
 
@@ -792,6 +797,12 @@ void ECEditorWindow::RemoveEntity(Entity* entity)
     }
 }
 
+void ECEditorWindow::RemoveEntities(const EntityList &entities)
+{
+    for(EntityList::const_iterator it = entities.begin(); it != entities.end(); ++it)
+        RemoveEntity(it->get());
+}
+
 void ECEditorWindow::SetFocus(bool focus)
 {
     hasFocus = focus;
@@ -1064,3 +1075,12 @@ void ECEditorWindow::OnSceneRemoved(Scene *removedScene)
         }
     }
 }
+
+void ECEditorWindow::QueueRefresh()
+{
+    if (refreshTimer.isActive())
+        return;
+    ECEditorModule *ecEditorModule = framework->Module<ECEditorModule>();
+    int refreshRate = ecEditorModule ? ecEditorModule->AttributeRefreshRate() : 0;
+    refreshTimer.start(refreshRate > 0 ? 1000 / refreshRate : 0);
+}
@@ -16,6 +16,7 @@
 #include <QSet>
 #include <QListWidgetItem>
 #include <QPointer>
+#include <QTimer>
 
 class QPoint;
 class QUndoStack;
@@ -120,6 +121,9 @@ public slots:
     /// Removes entity item from the editor's list.
     void RemoveEntity(Entity* entity);
 
+    /// Removes the items of the entities removed with Scene::RemoveEntities from the editor's list.
+    void RemoveEntities(const EntityList &entities);
+
     /// Set focus to this editor window.
     /** When window has focus it should accept entity select actions and add clicked entities from the scene.
         Also, when window is unfocused, its transform gizmo (if applicable) is hidden. */
@@ -225,6 +229,8 @@ private slots:
     void OnRedoChanged(bool canRedo);
     /// Clears the window if the scene of which entities are shown is cleared or removed.
     void OnSceneRemoved(Scene *);
+    /// Refreshes once for all the selection changes made since the last refresh.
+    void QueueRefresh();
 
 private:
     struct EntityComponentSelection
@@ -242,4 +248,5 @@ private:
     bool hasFocus; ///< To track if this editor has a focus.
     TransformEditor *transformEditor;
     UndoManager * undoManager_;
+    QTimer refreshTimer; ///< Coalesces the selection changes of the entity list into one refresh.
 };
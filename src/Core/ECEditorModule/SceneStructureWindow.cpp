@@ -23,9 +23,11 @@
 #include "ConfigAPI.h"
 #include "Profiler.h"
 #include "SceneAPI.h"
+#include "JobSystem.h"
 
 #include <QTreeWidgetItemIterator>
 #include <QToolButton>
+#include <QPointer>
 
 #include "MemoryLeakCheck.h"
 
@@ -35,6 +37,11 @@ namespace
     const ConfigData cShowComponentsSetting(ConfigAPI::FILE_FRAMEWORK, "Scene Structure Window", "Show Components", true);
     const ConfigData cAttributeVisibilitySetting(ConfigAPI::FILE_FRAMEWORK, "Scene Structure Window", "Attribute Visibility", SceneStructureWindow::ShowAssetReferences);
 
+    /// Time to collect the scene changes before adding them to the tree widget at once.
+    const int cPendingChangesDelayMs = 100;
+    /// Time after the last keystroke in the search field before the search starts.
+    const int cSearchDelayMs = 200;
+
     inline void SetTreeWidgetItemVisible(QTreeWidgetItem *item, bool visible)
     {
         item->setHidden(!visible);
@@ -42,6 +49,57 @@ namespace
     }
 }
 
+/// Matches the search filter against the texts of the entities and their components in a worker thread.
+/** The texts are copied in the main thread, and the matches are shown by SceneStructureWindow::ApplySearch in the main
+    thread, unless another search has started meanwhile. */
+struct SceneStructureWindow::SearchJob : public IJob
+{
+    SearchJob(SceneStructureWindow *window_, int generation_, const QString &filter_) :
+        IJob("SceneStructureWindow_Search"),
+        window(window_),
+        generation(generation_),
+        filter(filter_)
+    {
+    }
+
+    void Run()
+    {
+        QString text = filter;
+        if (text.startsWith('!'))
+            text = text.mid(1);
+
+        for(size_t i = 0; i < entityTexts.size(); ++i)
+            foreach(const QString &entityText, entityTexts[i].second)
+                if (entityText.contains(text, Qt::CaseInsensitive))
+                {
+                    matchedEntities.insert(entityTexts[i].first);
+                    break;
+                }
+
+        foreach(const QString &groupName, groupNames)
+            if (groupName.contains(text, Qt::CaseInsensitive))
+                matchedGroups.insert(groupName);
+    }
+
+    void Finished()
+    {
+        if (window && window->searchGeneration == generation)
+            window->ApplySearch(filter, matchedEntities, matchedGroups);
+    }
+
+    QPointer<SceneStructureWindow> window;
+    int generation;
+    QString filter;
+
+    /// The item text, component type names and component names of each entity.
+    std::vector<std::pair<entity_id_t, QStringList> > entityTexts;
+    QStringList groupNames;
+
+    // Results of Run.
+    QSet<entity_id_t> matchedEntities;
+    QSet<QString> matchedGroups;
+};
+
 SceneStructureWindow::SceneStructureWindow(Framework *fw, QWidget *parent) :
     QWidget(parent),
     framework(fw),
@@ -51,7 +109,8 @@ SceneStructureWindow::SceneStructureWindow(Framework *fw, QWidget *parent) :
     treeWidget(0),
     expandAndCollapseButton(0),
     searchField(0),
-    sortingCriteria(SortById)
+    sortingCriteria(SortById),
+    searchGeneration(0)
 {
     ConfigAPI &cfg = *framework->Config();
     showGroups = cfg.DeclareSetting(cShowGroupsSetting).toBool();
@@ -139,6 +198,12 @@ SceneStructureWindow::SceneStructureWindow(Framework *fw, QWidget *parent) :
     connect(expandAndCollapseButton, SIGNAL(clicked()), SLOT(ExpandOrCollapseAll()));
     connect(treeWidget, SIGNAL(itemCollapsed(QTreeWidgetItem*)), SLOT(CheckTreeExpandStatus(QTreeWidgetItem*)));
     connect(treeWidget, SIGNAL(itemExpanded(QTreeWidgetItem*)), SLOT(CheckTreeExpandStatus(QTreeWidgetItem*)));
+    connect(treeWidget, SIGNAL(itemExpanded(QTreeWidgetItem*)), SLOT(OnItemExpanded(QTreeWidgetItem*)));
+
+    pendingChangesTimer.setSingleShot(true);
+    connect(&pendingChangesTimer, SIGNAL(timeout()), SLOT(ProcessPendingChanges()));
+    searchTimer.setSingleShot(true);
+    connect(&searchTimer, SIGNAL(timeout()), SLOT(StartSearch()));
 
     connect(framework->Scene(), SIGNAL(SceneAboutToBeRemoved(Scene *, AttributeChange::Type)), SLOT(OnSceneRemoved(Scene *)));
 }
@@ -181,9 +246,11 @@ void SceneStructureWindow::SetShownScene(const ScenePtr &newScene)
 
         Scene* s = ShownScene().get();
         connect(s, SIGNAL(EntityAcked(Entity *, entity_id_t)), SLOT(AckEntity(Entity *, entity_id_t)));
-        connect(s, SIGNAL(EntityCreated(Entity *, AttributeChange::Type)), SLOT(AddEntity(Entity *)));
+        connect(s, SIGNAL(EntityCreated(Entity *, AttributeChange::Type)), SLOT(QueueEntity(Entity *)));
         connect(s, SIGNAL(EntityTemporaryStateToggled(Entity *, AttributeChange::Type)), SLOT(UpdateEntityTemporaryState(Entity *)));
         connect(s, SIGNAL(EntityRemoved(Entity *, AttributeChange::Type)), SLOT(RemoveEntity(Entity *)));
+        connect(s, SIGNAL(EntitiesCreated(const EntityList &, AttributeChange::Type)), SLOT(AddEntities(const EntityList &)));
+        connect(s, SIGNAL(EntitiesRemoved(const EntityList &, AttributeChange::Type)), SLOT(RemoveEntities(const EntityList &)));
         connect(s, SIGNAL(ComponentAdded(Entity *, IComponent *, AttributeChange::Type)), SLOT(AddComponent(Entity *, IComponent *)));
         connect(s, SIGNAL(ComponentRemoved(Entity *, IComponent *, AttributeChange::Type)), SLOT(RemoveComponent(Entity *, IComponent *)));
         connect(s, SIGNAL(SceneCleared(Scene*)), SLOT(Clear()));
@@ -422,6 +489,8 @@ void SceneStructureWindow::Clear()
     /// @todo 28.08.2013 Check memory leak report for this file!
 
     treeWidget->clear(); // This deletes all child items
+    pendingEntities.clear();
+    ++searchGeneration; // Ignore the results of an ongoing search.
 
     /*
     for(AttributeItemMap::const_iterator it = attributeItems.begin(); it != attributeItems.end(); ++it)
@@ -565,7 +634,14 @@ void SceneStructureWindow::Refresh()
 
     // If we have an ongoing search, make sure that changes are takeng into account.
     if (!searchField->text().isEmpty())
-        TreeWidgetSearch(treeWidget, 0, searchField->text());
+        StartSearch();
+}
+
+void SceneStructureWindow::ScheduleRefresh()
+{
+    // Not restarted if already active, so that a continuous stream of changes is still shown.
+    if (!pendingChangesTimer.isActive())
+        pendingChangesTimer.start(cPendingChangesDelayMs);
 }
 
 void SceneStructureWindow::AddEntity(Entity* entity, bool setParent)
@@ -593,16 +669,59 @@ void SceneStructureWindow::AddEntity(Entity* entity, bool setParent)
     else
         treeWidget->addTopLevelItem(entityItem);
 
-    //if (showComponents)
-    {
-        const Entity::ComponentMap &components = entity->Components();
-        for(Entity::ComponentMap::const_iterator i = components.begin(); i != components.end(); ++i)
-            AddComponent(entityItem, entity, i->second.get());
-    }
+    // The component items are created when the item is expanded, this only sets the name and the expand indicator.
+    const Entity::ComponentMap &components = entity->Components();
+    for(Entity::ComponentMap::const_iterator i = components.begin(); i != components.end(); ++i)
+        AddComponent(entityItem, entity, i->second.get());
 
     if (setParent)
         UpdateEntityParent(entity);
 
+    ScheduleRefresh();
+}
+
+void SceneStructureWindow::QueueEntity(Entity *entity)
+{
+    if (!entity || EntityItemOfEntity(entity))
+        return;
+
+    pendingEntities[entity] = entity->shared_from_this();
+    ScheduleRefresh();
+}
+
+void SceneStructureWindow::AddEntitiesNow(const EntityList &entities)
+{
+    PROFILE(SceneStructureWindow_AddEntitiesNow)
+
+    treeWidget->setSortingEnabled(false);
+
+    // First add entities without updating parents, as the order isn't guaranteed
+    for(EntityList::const_iterator it = entities.begin(); it != entities.end(); ++it)
+        AddEntity(it->get(), false);
+    for(EntityList::const_iterator it = entities.begin(); it != entities.end(); ++it)
+        if ((*it)->Parent())
+            UpdateEntityParent(it->get());
+
+    treeWidget->setSortingEnabled(true);
+}
+
+void SceneStructureWindow::ProcessPendingChanges()
+{
+    PROFILE(SceneStructureWindow_ProcessPendingChanges)
+
+    if (!pendingEntities.empty())
+    {
+        EntityList entities;
+        for(PendingEntityMap::const_iterator it = pendingEntities.begin(); it != pendingEntities.end(); ++it)
+        {
+            EntityPtr entity = it->second.lock();
+            if (entity)
+                entities.push_back(entity);
+        }
+        pendingEntities.clear();
+        AddEntitiesNow(entities);
+    }
+
     Refresh();
 }
 
@@ -630,11 +749,24 @@ void SceneStructureWindow::UpdateEntityTemporaryState(Entity *entity)
 
 void SceneStructureWindow::RemoveEntity(Entity* entity)
 {
+    pendingEntities.erase(entity);
     EntityItem *item = EntityItemOfEntity(entity);
     if (item)
         RemoveEntityItem(item);
 }
 
+void SceneStructureWindow::AddEntities(const EntityList &entities)
+{
+    for(EntityList::const_iterator it = entities.begin(); it != entities.end(); ++it)
+        QueueEntity(it->get());
+}
+
+void SceneStructureWindow::RemoveEntities(const EntityList &entities)
+{
+    for(EntityList::const_iterator it = entities.begin(); it != entities.end(); ++it)
+        RemoveEntity(it->get());
+}
+
 void SceneStructureWindow::RemoveEntityById(entity_id_t id)
 {
     EntityItem *item = EntityItemById(id);
@@ -666,7 +798,7 @@ void SceneStructureWindow::RemoveEntityItem(EntityItem* eItem)
     if (gItem && gItem->childCount() == 0)
         RemoveEntityGroupItem(gItem);
 
-    Refresh();
+    ScheduleRefresh();
 }
 
 void SceneStructureWindow::RemoveChildEntityItems(EntityItem* eItem)
@@ -703,6 +835,22 @@ void SceneStructureWindow::AddComponent(EntityItem *eItem, Entity *entity, IComp
     if (!eItem)
         return;
 
+    if (comp->TypeId() == EC_Name::ComponentTypeId)
+    {
+        // Retrieve entity's name from Name component. Also hook up change signal so that UI keeps synch with the name.
+        eItem->SetText(entity);
+
+        connect(comp, SIGNAL(AttributeChanged(IAttribute *, AttributeChange::Type)),
+            SLOT(UpdateEntityName(IAttribute *)), Qt::UniqueConnection);
+    }
+
+    // Keep the items of a collapsed entity uncreated, see CreateComponentItems.
+    if (!eItem->componentItemsCreated)
+    {
+        eItem->setChildIndicatorPolicy(QTreeWidgetItem::ShowIndicator);
+        return;
+    }
+
     if (ComponentItemOfComponent(comp))
         return;
 
@@ -714,15 +862,6 @@ void SceneStructureWindow::AddComponent(EntityItem *eItem, Entity *entity, IComp
 
     connect(comp, SIGNAL(ComponentNameChanged(const QString &, const QString &)), SLOT(UpdateComponentName()), Qt::UniqueConnection);
 
-    if (comp->TypeId() == EC_Name::ComponentTypeId)
-    {
-        // Retrieve entity's name from Name component. Also hook up change signal so that UI keeps synch with the name.
-        eItem->SetText(entity);
-
-        connect(comp, SIGNAL(AttributeChanged(IAttribute *, AttributeChange::Type)),
-            SLOT(UpdateEntityName(IAttribute *)), Qt::UniqueConnection);
-    }
-
     if (comp->SupportsDynamicAttributes())
     {
         // Hook to changes of dynamic attributes in order to keep the UI in sync (currently only DynamicComponent has these).
@@ -742,7 +881,30 @@ void SceneStructureWindow::AddComponent(EntityItem *eItem, Entity *entity, IComp
             CreateAttributesForItem(eItem);
     }
 
-    Refresh();
+    ScheduleRefresh();
+}
+
+void SceneStructureWindow::CreateComponentItems(EntityItem *eItem)
+{
+    if (!eItem || eItem->componentItemsCreated)
+        return;
+    EntityPtr entity = eItem->Entity();
+    if (!entity)
+        return;
+
+    PROFILE(SceneStructureWindow_CreateComponentItems)
+
+    eItem->componentItemsCreated = true;
+    eItem->setChildIndicatorPolicy(QTreeWidgetItem::DontShowIndicatorWhenChildless);
+
+    const Entity::ComponentMap &components = entity->Components();
+    for(Entity::ComponentMap::const_iterator it = components.begin(); it != components.end(); ++it)
+        AddComponent(eItem, entity.get(), it->second.get());
+}
+
+void SceneStructureWindow::OnItemExpanded(QTreeWidgetItem *item)
+{
+    CreateComponentItems(dynamic_cast<EntityItem *>(item));
 }
 
 void SceneStructureWindow::RemoveComponent(Entity* entity, IComponent* comp)
@@ -782,7 +944,7 @@ void SceneStructureWindow::CreateAttributesForItem(EntityItem *eItem)
 {
     PROFILE(SceneStructureWindow_CreateAttributesForItem_EntityItem)
 
-    if (eItem && eItem->Entity())
+    if (eItem && eItem->componentItemsCreated && eItem->Entity())
     {
         const Entity::ComponentMap &components = eItem->Entity()->Components();
         for(Entity::ComponentMap::const_iterator it = components.begin(); it != components.end(); ++it)
@@ -1010,15 +1172,113 @@ void SceneStructureWindow::SortBy(SortCriteria criteria, Qt::SortOrder order)
     treeWidget->sortItems((int)criteria, order);
 }
 
-void SceneStructureWindow::Search(const QString &filter)
+void SceneStructureWindow::Search(const QString & /*filter*/)
 {
-    TreeWidgetSearch(treeWidget, 0, filter);
+    searchTimer.start(cSearchDelayMs);
+}
+
+void SceneStructureWindow::StartSearch()
+{
+    PROFILE(SceneStructureWindow_StartSearch)
+
+    searchTimer.stop();
+    ++searchGeneration;
+
+    ScenePtr s = ShownScene();
+    const QString filter = searchField->text().trimmed();
+    if (!s || filter.isEmpty() || filter == "!")
+    {
+        TreeWidgetSearch(treeWidget, 0, QString()); // Show everything.
+        return;
+    }
+
+    shared_ptr<SearchJob> job = MAKE_SHARED(SearchJob, this, searchGeneration, filter);
+    job->entityTexts.reserve(entityItems.size());
+    for(EntityItemMap::const_iterator it = entityItems.begin(); it != entityItems.end(); ++it)
+    {
+        EntityPtr entity = it->second->Entity();
+        if (!entity)
+            continue;
+        QStringList texts;
+        texts << it->second->text(0);
+        const Entity::ComponentMap &components = entity->Components();
+        for(Entity::ComponentMap::const_iterator cit = components.begin(); cit != components.end(); ++cit)
+        {
+            texts << cit->second->TypeName();
+            if (!cit->second->Name().isEmpty())
+                texts << cit->second->Name();
+        }
+        job->entityTexts.push_back(std::make_pair(it->second->Id(), texts));
+    }
+    job->groupNames = entityGroupItems.keys();
+
+    framework->Jobs()->Schedule(job, true);
+}
+
+void SceneStructureWindow::ApplySearch(const QString &filter, const QSet<entity_id_t> &matchedEntities, const QSet<QString> &matchedGroups)
+{
+    PROFILE(SceneStructureWindow_ApplySearch)
+
+    // If the filter begins with '!', the matched items are hidden instead, as in TreeWidgetSearch.
+    const bool negation = filter.startsWith('!');
+
+    treeWidget->setUpdatesEnabled(false);
+    treeWidget->blockSignals(true);
+
+    for(EntityGroupItemMap::const_iterator it = entityGroupItems.begin(); it != entityGroupItems.end(); ++it)
+        if (!(*it)->isDisabled())
+            (*it)->setHidden(matchedGroups.contains((*it)->GroupName()) == negation);
+    for(EntityItemMap::const_iterator it = entityItems.begin(); it != entityItems.end(); ++it)
+        if (!it->second->isDisabled())
+            it->second->setHidden(matchedEntities.contains(it->second->Id()) == negation);
+
+    // Make sure that the parents of the matched entities are visible and expanded.
+    std::vector<EntityItem *> expandedItems;
+    if (!negation)
+    {
+        for(EntityItemMap::const_iterator it = entityItems.begin(); it != entityItems.end(); ++it)
+        {
+            if (!matchedEntities.contains(it->second->Id()))
+                continue;
+            for(QTreeWidgetItem *parent = it->second->parent(); parent; parent = parent->parent())
+            {
+                if (!parent->isDisabled())
+                    parent->setHidden(false);
+                if (!parent->isHidden() && !parent->isExpanded())
+                {
+                    parent->setExpanded(true);
+                    EntityItem *parentEntityItem = dynamic_cast<EntityItem *>(parent);
+                    if (parentEntityItem)
+                        expandedItems.push_back(parentEntityItem);
+                }
+            }
+        }
+    }
+
+    treeWidget->blockSignals(false);
+
+    for(size_t i = 0; i < expandedItems.size(); ++i)
+        CreateComponentItems(expandedItems[i]);
+
+    treeWidget->setUpdatesEnabled(true);
+    CheckTreeExpandStatus(0);
 }
 
 void SceneStructureWindow::ExpandOrCollapseAll()
 {
     treeWidget->blockSignals(true);
     bool treeExpanded = TreeWidgetExpandOrCollapseAll(treeWidget);
+    if (treeExpanded)
+    {
+        // Expanding all asks for every item, so create the component items of all the entities.
+        treeWidget->setSortingEnabled(false);
+        treeWidget->setUpdatesEnabled(false);
+        for(EntityItemMap::const_iterator it = entityItems.begin(); it != entityItems.end(); ++it)
+            CreateComponentItems(it->second);
+        treeWidget->expandAll();
+        treeWidget->setUpdatesEnabled(true);
+        treeWidget->setSortingEnabled(true);
+    }
     treeWidget->blockSignals(false);
     expandAndCollapseButton->setText(treeExpanded ? tr("Collapse All") : tr("Expand All"));
 }
@@ -11,6 +11,8 @@
 
 #include <QWidget>
 #include <QHash>
+#include <QSet>
+#include <QTimer>
 
 class SceneTreeWidget;
 class Framework;
@@ -27,7 +29,11 @@ class QToolButton;
 
 /// Window with tree view showing every entity in a scene.
 /** This class will only handle adding and removing of entities and components and updating
-    their names. The SceneTreeWidget implements most of the functionality. */
+    their names. The SceneTreeWidget implements most of the functionality.
+
+    To cope with large scenes, the component and attribute items of an entity are created only when its item is
+    expanded, the entities created in the scene are added to the tree in batches, and the search is matched
+    against the entities in a job of the JobSystem. */
 class SceneStructureWindow : public QWidget
 {
     Q_OBJECT
@@ -128,6 +134,18 @@ private:
     std::vector<AttributeItem *> AttributeItemOfAttribute(IAttribute *) const;
     void SetEntityItemSelected(EntityItem *item, bool selected);
 
+    /// Creates the component and attribute items of the entity item, if not created yet.
+    void CreateComponentItems(EntityItem *eItem);
+
+    /// Adds the passed entities to the tree widget at once, and their parents after that.
+    void AddEntitiesNow(const EntityList &entities);
+
+    /// Starts the pending changes timer, see ProcessPendingChanges.
+    void ScheduleRefresh();
+
+    /// Shows the items that matched the search, see SearchJob.
+    void ApplySearch(const QString &filter, const QSet<entity_id_t> &matchedEntities, const QSet<QString> &matchedGroups);
+
     void Refresh();
 
     Framework *framework;
@@ -156,6 +174,16 @@ private:
     ComponentItemMap componentItems;
     AttributeItemMap attributeItems;
 
+    /// Entities created in the scene that are added to the tree widget in ProcessPendingChanges.
+    typedef std::map<Entity *, EntityWeakPtr> PendingEntityMap;
+    PendingEntityMap pendingEntities;
+    QTimer pendingChangesTimer; ///< Single-shot timer that batches the scene changes.
+
+    /// Matches the search filter against the entities in a worker thread.
+    struct SearchJob;
+    QTimer searchTimer; ///< Single-shot timer that starts the search once the user stops typing.
+    int searchGeneration; ///< Incremented for each search, so that the results of an outdated search are ignored.
+
 private slots:
     /// Clears the whole tree widget.
     void Clear();
@@ -163,9 +191,21 @@ private slots:
     /// Adds the item represeting the @c entity to the tree widget.
     void AddEntity(Entity *entity, bool setParent = true);
 
+    /// Queues the item represeting the @c entity to be added to the tree widget with the other entities created meanwhile.
+    void QueueEntity(Entity *entity);
+
+    /// Adds the queued entities to the tree widget and refreshes the search.
+    void ProcessPendingChanges();
+
     /// Removes item representing @c entity from the tree widget.
     void RemoveEntity(Entity *entity);
 
+    /// Adds the items representing the entities created with Scene::CreateEntities to the tree widget.
+    void AddEntities(const EntityList &entities);
+
+    /// Removes the items representing the entities removed with Scene::RemoveEntities from the tree widget.
+    void RemoveEntities(const EntityList &entities);
+
     /// Readds entity on server ack.
     /** @param entity Entity to be readded.
         @param oldId Old entity id */
@@ -206,10 +246,17 @@ private slots:
     void Sort(int column);
 
     /// Searches for items containing @c text (case-insensitive) and toggles their visibility.
-    /** If match is found the item is set visible and expanded, otherwise it's hidden.
+    /** If match is found the item is set visible and its parents expanded, otherwise it's hidden.
+        The search starts once the user stops typing, see StartSearch.
         @param filter Text used as a filter. */
     void Search(const QString &filter);
 
+    /// Starts the search with the text of the search field.
+    void StartSearch();
+
+    /// Creates the component items of an entity item when it is expanded.
+    void OnItemExpanded(QTreeWidgetItem *item);
+
     /// Expands or collapses the whole tree view, depending on the previous action.
     void ExpandOrCollapseAll();
 
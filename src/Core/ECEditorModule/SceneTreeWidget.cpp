@@ -1453,48 +1453,38 @@ QSet<QString> SceneTreeWidget::GetAssetRefs(const EntityItem *eItem, bool includ
     assert(scene.lock());
     QSet<QString> assets;
 
+    // Read the components of the entity, as their items are created only when the entity item is expanded.
     EntityPtr entity = eItem->Entity();
     if (entity)
     {
-        int entityChildCount = eItem->childCount();
-        for(int j = 0; j < entityChildCount; ++j)
+        const Entity::ComponentMap &components = entity->Components();
+        for (Entity::ComponentMap::const_iterator i = components.begin(); i != components.end(); ++i)
         {
-            ComponentItem *cItem = dynamic_cast<ComponentItem *>(eItem->child(j));
-            if (!cItem)
-                continue;
-            ComponentPtr comp = cItem->Component();
-            if (!comp)
-                continue;
-
-            const Entity::ComponentMap &components = entity->Components();
-            for (Entity::ComponentMap::const_iterator i = components.begin(); i != components.end(); ++i)
+            foreach(IAttribute *attr, i->second->Attributes())
             {
-                foreach(IAttribute *attr, i->second->Attributes())
+                if (!attr)
+                    continue;
+                
+                if (attr->TypeId() == cAttributeAssetReference)
                 {
-                    if (!attr)
-                        continue;
-                    
-                    if (attr->TypeId() == cAttributeAssetReference)
+                    Attribute<AssetReference> *assetRef = static_cast<Attribute<AssetReference> *>(attr);
+                    if (assetRef)
                     {
-                        Attribute<AssetReference> *assetRef = static_cast<Attribute<AssetReference> *>(attr);
-                        if (assetRef)
-                        {
-                            if (!includeEmptyRefs && assetRef->Get().ref.trimmed().isEmpty())
-                                continue;
-                            assets.insert(assetRef->Get().ref);
-                        }
+                        if (!includeEmptyRefs && assetRef->Get().ref.trimmed().isEmpty())
+                            continue;
+                        assets.insert(assetRef->Get().ref);
                     }
-                    else if (attr->TypeId() == cAttributeAssetReferenceList)
+                }
+                else if (attr->TypeId() == cAttributeAssetReferenceList)
+                {
+                    Attribute<AssetReferenceList> *assetRefs = static_cast<Attribute<AssetReferenceList> *>(attr);
+                    if (assetRefs)
                     {
-                        Attribute<AssetReferenceList> *assetRefs = static_cast<Attribute<AssetReferenceList> *>(attr);
-                        if (assetRefs)
+                        for(int i = 0; i < assetRefs->Get().Size(); ++i)
                         {
-                            for(int i = 0; i < assetRefs->Get().Size(); ++i)
-                            {
-                                if (!includeEmptyRefs && assetRefs->Get()[i].ref.trimmed().isEmpty())
-                                    continue;
-                                assets.insert(assetRefs->Get()[i].ref);
-                            }
+                            if (!includeEmptyRefs && assetRefs->Get()[i].ref.trimmed().isEmpty())
+                                continue;
+                            assets.insert(assetRefs->Get()[i].ref);
                         }
                     }
                 }
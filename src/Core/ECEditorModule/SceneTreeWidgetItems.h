@@ -58,6 +58,10 @@ public:
     /** Uses SceneStructureWindow::SortingCriteria for the criteria, if applicable, otherwise treeWidget::sortColumn(). */
     bool operator <(const QTreeWidgetItem &rhs) const;
 
+    /// Whether the component and attribute items of the entity have been created.
+    /** SceneStructureWindow creates them only when the item is expanded for the first time. */
+    bool componentItemsCreated;
+
 private:
     Q_DISABLE_COPY(EntityItem)
     entity_id_t id; ///< Entity ID associated with this tree widget item.
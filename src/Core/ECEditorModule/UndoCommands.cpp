@@ -18,8 +18,41 @@
 #include "Transform.h"
 #include "EC_Placeable.h"
 
+#include <kNet/DataSerializer.h>
+#include <kNet/DataDeserializer.h>
+
 #include "MemoryLeakCheck.h"
 
+namespace
+{
+    /// Largest binary state recorded of one removed entity with its children.
+    const int cMaxEntityDataSize = 64 * 1024 * 1024;
+
+    /// Serializes the entity and its children in the binary scene format, as a scene of the one entity.
+    QByteArray SerializeEntityToBinary(const Entity *entity)
+    {
+        // The serializer has a fixed size buffer, so grow it until the entity fits.
+        for(int size = 64 * 1024; size <= cMaxEntityDataSize; size *= 4)
+        {
+            QByteArray bytes;
+            bytes.resize(size);
+            try
+            {
+                kNet::DataSerializer dest(bytes.data(), bytes.size());
+                dest.Add<u32>(1);
+                entity->SerializeToBinary(dest, true);
+                bytes.resize((int)dest.BytesFilled());
+                return bytes;
+            }
+            catch(...)
+            {
+            }
+        }
+        LogError("RemoveCommand: Failed to record entity " + entity->ToString() + ", it cannot be restored");
+        return QByteArray();
+    }
+}
+
 EditIAttributeCommand::EditIAttributeCommand(IAttribute *attr, QUndoCommand *parent) :
     IEditAttributeCommand(parent),
     undoValue(attr->ToString())
@@ -419,63 +452,63 @@ int RemoveCommand::id() const
 void RemoveCommand::undo()
 {
     ScenePtr scene = scene_.lock();
-    if (!scene.get())
+    if (!scene.get() || dataDiscarded_)
         return;
 
-    if (!entitiesDocument_.isNull())
+    foreach(const RemovedEntity &removed, removedEntities_)
     {
-        QDomElement sceneElement = entitiesDocument_.firstChildElement("scene");
-        QDomElement entityElement = sceneElement.firstChildElement("entity");
-        while (!entityElement.isNull())
-        {
-            entity_id_t id = entityElement.attribute("id").toUInt();
-            bool sync = ParseBool(entityElement.attribute("sync"));
+        if (removed.data.isEmpty())
+            continue;
 
-            entity_id_t newId = sync ? scene->NextFreeId() : scene->NextFreeIdLocal();
-            tracker_->TrackId(id, newId);
+        // The entity gets a new ID, its children keep theirs as before.
+        entity_id_t newId = removed.replicated ? scene->NextFreeId() : scene->NextFreeIdLocal();
+        tracker_->TrackId(removed.id, newId);
 
-            entityElement.setAttribute("id", QString::number((int)newId));
+        QByteArray data = removed.data;
+        kNet::DataSerializer idDest(data.data() + sizeof(u32), sizeof(u32));
+        idDest.Add<u32>(newId);
+        scene->CreateContentFromBinary(data.constData(), data.size(), true, AttributeChange::Default);
 
-            entityElement = entityElement.nextSiblingElement();
+        foreach(entity_id_t id, removed.temporaryEntities)
+        {
+            EntityPtr ent = scene->EntityById(id == removed.id ? newId : id);
+            if (ent.get())
+                ent->SetTemporary(true);
+        }
+        for(int i = 0; i < removed.temporaryComponents.size(); ++i)
+        {
+            const entity_id_t id = removed.temporaryComponents[i].first;
+            EntityPtr ent = scene->EntityById(id == removed.id ? newId : id);
+            ComponentPtr comp = ent.get() ? ent->Component(removed.temporaryComponents[i].second.first, removed.temporaryComponents[i].second.second) : ComponentPtr();
+            if (comp.get())
+                comp->SetTemporary(true);
         }
-
-        scene->CreateContentFromXml(entitiesDocument_, true, AttributeChange::Default);
     }
 
-    if (!componentsDocument_.isNull())
+    for(QMap<entity_id_t, QList<RemovedComponent> >::const_iterator iter = removedComponents_.begin(); iter != removedComponents_.end(); ++iter)
     {
-        QDomElement entityElement = componentsDocument_.firstChildElement("entity");
-        while (!entityElement.isNull())
+        EntityPtr ent = scene->EntityById(tracker_->RetrieveId(iter.key()));
+        if (!ent.get())
+            continue;
+
+        Framework *fw = scene->GetFramework();
+        foreach(const RemovedComponent &removed, iter.value())
         {
-            entity_id_t entityId = entityElement.attribute("id").toUInt();
-            EntityPtr ent = scene->EntityById(tracker_->RetrieveId(entityId));
-            if (ent.get())
+            ComponentPtr component = fw->Scene()->CreateComponentById(scene.get(), removed.typeId, removed.name);
+            if (!component.get())
+                continue;
+            component->SetReplicated(removed.replicated);
+            component->SetTemporary(removed.temporary);
+            ent->AddComponent(component);
+            try
             {
-                QDomElement compElement = entityElement.firstChildElement("component");
-                while (!compElement.isNull())
-                {
-                    ComponentPtr component;
-                    QString type = compElement.attribute("type");
-                    QString name = compElement.attribute("name");
-                    QString sync = compElement.attribute("sync");
-                    QString temp = compElement.attribute("temporary");
-
-                    Framework *fw = ent->ParentScene()->GetFramework();
-                    component = fw->Scene()->CreateComponentByName(ent->ParentScene(), type, name);
-
-                    if (!sync.isEmpty())
-                        component->SetReplicated(ParseBool(sync));
-                    if (!temp.isEmpty())
-                        component->SetTemporary(ParseBool(temp));
-
-                    ent->AddComponent(component);
-                    component->DeserializeFrom(compElement, AttributeChange::Default);
-
-                    compElement = compElement.nextSiblingElement("component");
-                }
+                kNet::DataDeserializer source(removed.data.constData(), removed.data.size());
+                component->DeserializeFromBinary(source, AttributeChange::Default);
+            }
+            catch(...)
+            {
+                LogError("RemoveCommand: Failed to restore the attributes of component " + component->TypeName() + " " + component->Name());
             }
-
-            entityElement = entityElement.nextSiblingElement("entity");
         }
     }
 }
@@ -483,29 +516,42 @@ void RemoveCommand::undo()
 void RemoveCommand::redo()
 {
     ScenePtr scene = scene_.lock();
-    if (!scene.get())
+    if (!scene.get() || dataDiscarded_)
         return;
 
     if (!componentMap_.isEmpty())
     {
-        componentsDocument_ = QDomDocument();
+        removedComponents_.clear();
+        // Assume 64KB max per component, as Entity::SerializeToBinary does.
+        std::vector<char> bytes(64 * 1024);
         EntityIdList keys = componentMap_.keys();
         foreach (entity_id_t key, keys)
         {
             EntityPtr ent = scene->EntityById(tracker_->RetrieveId(key));
             if (ent.get())
             {
-                QDomElement entityElem = componentsDocument_.createElement("entity");
-                componentsDocument_.appendChild(entityElem);
-                entityElem.setAttribute("id", ent->Id());
-                entityElem.setAttribute("name", ent->Name());
-
+                QList<RemovedComponent> &removedList = removedComponents_[key];
                 for (ComponentList::iterator i = componentMap_[key].begin(); i != componentMap_[key].end(); ++i)
                 {
                     ComponentPtr comp = ent->Component((*i).first, (*i).second);
                     if (comp.get())
                     {
-                        comp->SerializeTo(componentsDocument_, entityElem, true);
+                        RemovedComponent removed;
+                        removed.typeId = comp->TypeId();
+                        removed.name = comp->Name();
+                        removed.replicated = comp->IsReplicated();
+                        removed.temporary = comp->IsTemporary();
+                        try
+                        {
+                            kNet::DataSerializer dest(&bytes[0], bytes.size());
+                            comp->SerializeToBinary(dest);
+                            removed.data = QByteArray(&bytes[0], (int)dest.BytesFilled());
+                        }
+                        catch(...)
+                        {
+                            LogError("RemoveCommand: Failed to record the attributes of component " + comp->TypeName() + " " + comp->Name());
+                        }
+                        removedList << removed;
                         ent->RemoveComponent(comp, AttributeChange::Replicate);
                     }
                 }
@@ -515,24 +561,61 @@ void RemoveCommand::redo()
 
     if (!entityList_.isEmpty())
     {
-        entitiesDocument_ = QDomDocument();
-        QDomElement sceneElement = entitiesDocument_.createElement("scene");
-        entitiesDocument_.appendChild(sceneElement);
-
+        removedEntities_.clear();
         foreach(entity_id_t id, entityList_)
         {
             EntityPtr ent = scene->EntityById(tracker_->RetrieveId(id));
             if (ent.get())
             {
-                ent->SerializeToXML(entitiesDocument_, sceneElement, true);
+                RemovedEntity removed;
+                removed.id = ent->Id();
+                removed.replicated = ent->IsReplicated();
+                removed.data = SerializeEntityToBinary(ent.get());
+
+                EntityList hierarchy = ent->Children(true);
+                hierarchy.push_front(ent);
+                for(EntityList::const_iterator e = hierarchy.begin(); e != hierarchy.end(); ++e)
+                {
+                    if ((*e)->IsTemporary())
+                    {
+                        removed.temporaryEntities << (*e)->Id();
+                        continue;
+                    }
+                    const Entity::ComponentMap &components = (*e)->Components();
+                    for(Entity::ComponentMap::const_iterator c = components.begin(); c != components.end(); ++c)
+                        if (c->second->IsTemporary())
+                            removed.temporaryComponents << qMakePair((*e)->Id(), qMakePair(c->second->TypeId(), c->second->Name()));
+                }
+
+                removedEntities_ << removed;
                 scene->RemoveEntity(ent->Id(), AttributeChange::Replicate);
             }
         }
     }
 }
 
+size_t RemoveCommand::DataSize() const
+{
+    size_t size = 0;
+    foreach(const RemovedEntity &removed, removedEntities_)
+        size += removed.data.size();
+    for(QMap<entity_id_t, QList<RemovedComponent> >::const_iterator iter = removedComponents_.begin(); iter != removedComponents_.end(); ++iter)
+        foreach(const RemovedComponent &removed, iter.value())
+            size += removed.data.size();
+    return size;
+}
+
+void RemoveCommand::DiscardData()
+{
+    removedEntities_.clear();
+    removedComponents_.clear();
+    dataDiscarded_ = true;
+    setText(text() + " (cannot be undone)");
+}
+
 void RemoveCommand::Initialize(const QList<EntityWeakPtr> &entityList, const QList<ComponentWeakPtr> &componentList)
 {
+    dataDiscarded_ = false;
     QStringList componentTypes;
     bool componentMultiParented = false;
     
@@ -379,9 +379,39 @@ public:
     /// QUndoCommand override
     void redo();
 
+    /// Returns the number of bytes the recorded state of the removed entities and components takes.
+    size_t DataSize() const;
+
+    /// Frees the recorded state. After this undo and redo do nothing.
+    /** Used by UndoManager to cap the memory the undo stack takes. */
+    void DiscardData();
+
+    /// Returns whether the recorded state has been freed with DiscardData.
+    bool IsDataDiscarded() const { return dataDiscarded_; }
+
 private:
     void Initialize(const QList<EntityWeakPtr> &entities, const QList<ComponentWeakPtr> &components);
 
+    /// A removed entity and its children in the binary scene format.
+    struct RemovedEntity
+    {
+        entity_id_t id; ///< ID of the entity when it was removed
+        bool replicated; ///< Replicated state of the entity
+        QByteArray data; ///< A scene of the one entity, as in Scene::SaveSceneBinary
+        EntityIdList temporaryEntities; ///< The temporary ones of the entity and its children, which the binary format does not store
+        QList<QPair<entity_id_t, QPair<u32, QString> > > temporaryComponents; ///< Parent entity ID, type ID and name of the temporary components
+    };
+
+    /// A removed component with its attributes in the binary format.
+    struct RemovedComponent
+    {
+        u32 typeId; ///< Type ID of the component
+        QString name; ///< Name of the component
+        bool replicated; ///< Replicated state of the component
+        bool temporary; ///< Temporary state of the component
+        QByteArray data; ///< Attributes of the component, as in IComponent::SerializeToBinary
+    };
+
     EntityIdList entityList_; ///< Entity ID list of the entities being removed
     typedef QList<QPair<QString, QString> > ComponentList; ///< A typedef for QList containing QPair of component typenames and component names
     typedef QMap<entity_id_t, ComponentList> ParentEntityOfComponentMap; ///< A typedef for QMap with entity ID as key and a ComponentList as value
@@ -389,8 +419,9 @@ private:
 
     SceneWeakPtr scene_; ///< A weak pointer to the main camera scene
     EntityIdChangeTracker * tracker_; ///< Pointer to the tracker object, taken from an undo manager
-    QDomDocument entitiesDocument_; ///< XML document containing data about the entities to be removed
-    QDomDocument componentsDocument_; ///< XML document containing data about the components to be removed
+    QList<RemovedEntity> removedEntities_; ///< The state of the removed entities
+    QMap<entity_id_t, QList<RemovedComponent> > removedComponents_; ///< The state of the removed components by the parent entity IDs of componentMap_
+    bool dataDiscarded_; ///< Has the recorded state been freed with DiscardData
 };
 
 /// Represents a rename operation over an entity or a component
@@ -7,16 +7,20 @@
 #include "StableHeaders.h"
 #include "UndoManager.h"
 #include "EntityIdChangeTracker.h"
+#include "UndoCommands.h"
 
 #include <QUndoCommand>
 #include <QAction>
 
 #include "MemoryLeakCheck.h"
 
+static const size_t cDefaultMemoryLimit = 64 * 1024 * 1024;
+
 UndoManager::UndoManager(const ScenePtr &scene, QWidget *parent, QWidget *undoMenuParent, QWidget *redoMenuParent) :
     tracker_(new EntityIdChangeTracker(scene)),
     undoStack_(new QUndoStack()),
-    undoViewAction_(new QAction("View all", 0))
+    undoViewAction_(new QAction("View all", 0)),
+    memoryLimit_(cDefaultMemoryLimit)
 {
     Initialize(parent, undoMenuParent, redoMenuParent);
 }
@@ -118,9 +122,36 @@ void UndoManager::Redo()
 void UndoManager::Clear()
 {
     undoStack_->clear();
+    recordingCommands_.clear();
     tracker_->Clear();
 }
 
+void UndoManager::SetMemoryLimit(size_t bytes)
+{
+    memoryLimit_ = bytes;
+    EnforceMemoryLimit();
+}
+
+void UndoManager::EnforceMemoryLimit()
+{
+    if (memoryLimit_ == 0)
+        return;
+
+    size_t total = 0;
+    for(std::map<int, RemoveCommand *>::const_iterator i = recordingCommands_.begin(); i != recordingCommands_.end(); ++i)
+        total += i->second->DataSize();
+
+    for(std::map<int, RemoveCommand *>::iterator i = recordingCommands_.begin(); i != recordingCommands_.end() && total > memoryLimit_;)
+    {
+        total -= i->second->DataSize();
+        i->second->DiscardData();
+        for(std::list<QAction*>::iterator a = actions_.begin(); a != actions_.end(); ++a)
+            if ((*a)->property("index").toInt() == i->first)
+                (*a)->setText(i->second->text());
+        recordingCommands_.erase(i++);
+    }
+}
+
 void UndoManager::OnIndexChanged(int idx)
 {
     undoMenu_->clear();
@@ -175,11 +206,30 @@ void UndoManager::OnActionTriggered(QAction * action)
 
 void UndoManager::Push(QUndoCommand * command)
 {
-    actions_.resize(undoStack_->index());
+    // Pushing deletes the commands that have been undone.
+    const int index = undoStack_->index();
+    actions_.resize(index);
+    recordingCommands_.erase(recordingCommands_.lower_bound(index), recordingCommands_.end());
 
     QAction * action = new QAction(command->text(), 0);
-    action->setProperty("index", undoStack_->index());
-
+    action->setProperty("index", index);
     actions_.push_back(action);
+
+    RemoveCommand *removeCommand = dynamic_cast<RemoveCommand *>(command);
     undoStack_->push(command);
+
+    // A merged command, f.ex. a step of a transform drag, was deleted by the stack, and the previous action stands for it.
+    if (undoStack_->index() == index)
+    {
+        actions_.pop_back();
+        SAFE_DELETE(action);
+        OnIndexChanged(index);
+        return;
+    }
+
+    if (removeCommand)
+    {
+        recordingCommands_[index] = removeCommand;
+        EnforceMemoryLimit();
+    }
 }
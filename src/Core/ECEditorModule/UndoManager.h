@@ -12,7 +12,10 @@
 #include <QObject>
 #include <QPointer>
 
+#include <map>
+
 class EntityIdChangeTracker;
+class RemoveCommand;
 
 class QMenu;
 class QUndoStack;
@@ -39,8 +42,17 @@ public:
     ~UndoManager();
 
     /// Pushes new command to the undo stack
+    /** If the command is merged with the previous one, f.ex. the steps of a transform drag, the command is deleted. */
     void Push(QUndoCommand * command);
 
+    /// Sets the maximum number of bytes the recorded state of the commands in the undo stack may take.
+    /** When exceeded, the state of the oldest commands is freed and they can no longer be undone. 0 means no limit.
+        The default is 64 MB. */
+    void SetMemoryLimit(size_t bytes);
+
+    /// Returns the maximum number of bytes the recorded state of the commands in the undo stack may take.
+    size_t MemoryLimit() const { return memoryLimit_; }
+
     /// The menu containing actions that can be undone
     /** @note Prefer not to store the raw ptr. The menu may be destroyed before
         this UndoManager is destroyed due to QWidget parenting. */
@@ -97,7 +109,13 @@ private:
     // Initialize user interface, called from various types of ctors.
     void Initialize(QWidget *parent = 0, QWidget *undoMenuParent = 0, QWidget *redoMenuParent = 0);
 
+    // Frees the state of the oldest commands until the rest fit in the memory limit.
+    void EnforceMemoryLimit();
+
     std::list<QAction*> actions_;       ///< Action list
+    /// The commands in the undo stack that record scene state, by their stack index.
+    std::map<int, RemoveCommand *> recordingCommands_;
+    size_t memoryLimit_;                ///< Maximum bytes of recorded state, 0 for no limit
 
     // Always unparented.
     QAction *undoViewAction_;           ///< Undo view action
@@ -21,8 +21,15 @@
 #include "Profiler.h"
 #include "OgreRenderingModule.h"
 #include "OgreWorld.h"
+#include "Framework.h"
+#include "FrameAPI.h"
 
 #include <Ogre.h>
+
+#include <QRunnable>
+#include <QSemaphore>
+#include <QThreadPool>
+
 #include <utility>
 
 #include "MemoryLeakCheck.h"
@@ -30,6 +37,178 @@
 using namespace std;
 using namespace OgreRenderer;
 
+namespace
+{
+/// The number of LOD levels of a terrain patch mesh. Level n keeps every 2^n:th vertex inside the patch.
+const uint cNumPatchLods = 4;
+/// The camera distances at which the LOD levels 1, 2 and 3 of the patch meshes are used.
+const float cPatchLodDistances[cNumPatchLods-1] = { 64.f, 128.f, 256.f };
+/// The maximum number of finished patches to upload to the GPU per frame, to spread the uploads over frames.
+const size_t cMaxPatchUploadsPerFrame = 8;
+/// The number of floats per vertex in a patch mesh: position, normal, and the UV sets 0 and 1.
+const uint cPatchVertexFloats = 10;
+
+/// Returns the sampled vertex coordinates along one axis of a patch for the given step, always including the last vertex.
+std::vector<uint> PatchSamples(uint numVertices, uint step)
+{
+    std::vector<uint> samples;
+    for(uint i = 0; i + 1 < numVertices; i += step)
+        samples.push_back(i);
+    samples.push_back(numVertices - 1);
+    return samples;
+}
+
+}
+
+/// Builds the vertices and the LOD index lists of a terrain patch in a worker thread.
+struct EC_Terrain::PatchBuild
+{
+    /// Runs the build in a worker thread. Holds the build, so that the terrain can drop it while the build runs.
+    struct Task : public QRunnable
+    {
+        explicit Task(const shared_ptr<PatchBuild> &build_) : build(build_) {}
+        void run()
+        {
+            build->Build();
+            build->finished.release();
+        }
+        shared_ptr<PatchBuild> build;
+    };
+
+    PatchBuild() : patchX(0), patchY(0), width(0), height(0), mapWidth(0), mapHeight(0), uScale(0.f), vScale(0.f),
+        minHeight(0.f), maxHeight(0.f), superseded(false) {}
+
+    uint patchX; ///< X-coordinate of the patch on the grid of patches.
+    uint patchY; ///< Y-coordinate of the patch on the grid of patches.
+    uint width; ///< The number of vertices in the patch in the horizontal direction, 17 or 16 at the terrain edge.
+    uint height; ///< The number of vertices in the patch in the vertical direction, 17 or 16 at the terrain edge.
+    uint mapWidth; ///< The number of vertices in the whole terrain in the horizontal direction.
+    uint mapHeight; ///< The number of vertices in the whole terrain in the vertical direction.
+    float uScale;
+    float vScale;
+    std::vector<float> heights; ///< The (width+2)x(height+2) height values around the patch vertices, gathered in the main thread.
+    std::vector<float> vertices; ///< The built vertices, cPatchVertexFloats floats each.
+    std::vector<std::vector<u16> > lodIndices; ///< The built triangle lists of each LOD level.
+    float minHeight;
+    float maxHeight;
+    bool superseded; ///< Set when a newer build of the same patch has been started, so that this one is not uploaded.
+    QSemaphore finished; ///< Released by the worker thread when the build is done.
+
+    /// Returns the height of the vertex (x,y) of the patch, x and y in the range [-1, width] and [-1, height].
+    float Height(int x, int y) const { return heights[(y+1)*(width+2) + x+1]; }
+
+    void Build()
+    {
+        minHeight = std::numeric_limits<float>::max();
+        maxHeight = -std::numeric_limits<float>::max();
+        vertices.resize(width * height * cPatchVertexFloats);
+        for(uint y = 0; y < height; ++y)
+            for(uint x = 0; x < width; ++x)
+            {
+                const uint mapX = patchX * cPatchSize + x;
+                const uint mapY = patchY * cPatchSize + y;
+                const float h = Height(x, y);
+                minHeight = min(minHeight, h);
+                maxHeight = max(maxHeight, h);
+
+                // Same as CalculateNormal, from the height values gathered around the patch.
+                float xSlope = Height((int)x-1, y) - Height(x+1, y);
+                if (mapX == 0)
+                    xSlope *= 2;
+                float ySlope = Height(x, (int)y-1) - Height(x, y+1);
+                if (mapY == 0)
+                    ySlope *= 2;
+                const float3 normal = float3(xSlope, 2.f, ySlope).Normalized();
+
+                // These coordinates are directly generated to our Ogre coordinate system, i.e. heightmap X & Y correspond to X & Z world axes.
+                float *v = &vertices[(y * width + x) * cPatchVertexFloats];
+                v[0] = (float)x;
+                v[1] = h;
+                v[2] = (float)y;
+                v[3] = normal.x;
+                v[4] = normal.y;
+                v[5] = normal.z;
+                // The UV set 0 contains the diffuse texture UV map. Do a planar mapping with the given specified UV scale.
+                v[6] = (float)mapX * uScale;
+                v[7] = (float)mapY * vScale;
+                // The UV set 1 contains the terrain blend mask UV map, which stretches once across the whole terrain.
+                v[8] = (float)mapX / (mapWidth - 1);
+                v[9] = (float)mapY / (mapHeight - 1);
+            }
+
+        lodIndices.resize(cNumPatchLods);
+        for(uint i = 0; i < cNumPatchLods; ++i)
+            BuildLodIndices(1 << i, lodIndices[i]);
+    }
+
+    /// Builds the triangles of the patch for the vertices sampled with the given step.
+    /** The cells touching the patch border keep all the border vertices, and are fanned from a corner that is not on the border,
+        so that the patch edges match the adjacent patches in any LOD level without T-junctions. */
+    void BuildLodIndices(uint step, std::vector<u16> &indices) const
+    {
+        const std::vector<uint> xs = PatchSamples(width, step);
+        const std::vector<uint> ys = PatchSamples(height, step);
+        for(size_t j = 0; j + 1 < ys.size(); ++j)
+            for(size_t i = 0; i + 1 < xs.size(); ++i)
+            {
+                const uint x0 = xs[i], x1 = xs[i+1];
+                const uint y0 = ys[j], y1 = ys[j+1];
+                // The cell edges in perimeter order: bottom, right, top and left.
+                const bool border[4] = { y0 == 0, x1 + 1 == width, y1 + 1 == height, x0 == 0 };
+                if (step == 1 || (!border[0] && !border[1] && !border[2] && !border[3]))
+                {
+                    AddTriangle(indices, y1 * width + x0, y0 * width + x1, y0 * width + x0);
+                    AddTriangle(indices, y1 * width + x0, y1 * width + x1, y0 * width + x1);
+                    continue;
+                }
+
+                std::vector<uint> perimeter;
+                uint corners[4];
+                corners[0] = (uint)perimeter.size();
+                for(uint x = x0; x < x1; x += (border[0] ? 1 : x1 - x0))
+                    perimeter.push_back(y0 * width + x);
+                corners[1] = (uint)perimeter.size();
+                for(uint y = y0; y < y1; y += (border[1] ? 1 : y1 - y0))
+                    perimeter.push_back(y * width + x1);
+                corners[2] = (uint)perimeter.size();
+                for(uint x = x1; x > x0; x -= (border[2] ? 1 : x1 - x0))
+                    perimeter.push_back(y1 * width + x);
+                corners[3] = (uint)perimeter.size();
+                for(uint y = y1; y > y0; y -= (border[3] ? 1 : y1 - y0))
+                    perimeter.push_back(y * width + x0);
+
+                // Corner k is between the edges k-1 and k.
+                uint fan = 0;
+                for(uint k = 0; k < 4; ++k)
+                    if (!border[k] && !border[(k+3)%4])
+                    {
+                        fan = corners[k];
+                        break;
+                    }
+                const size_t n = perimeter.size();
+                for(size_t t = 1; t + 1 < n; ++t)
+                    AddTriangle(indices, perimeter[fan], perimeter[(fan+t)%n], perimeter[(fan+t+1)%n]);
+            }
+    }
+
+    /// Adds the triangle with the same winding as the full resolution triangles, or skips it if it is degenerate.
+    void AddTriangle(std::vector<u16> &indices, uint a, uint b, uint c) const
+    {
+        const int ax = a % width, ay = a / width;
+        const int bx = b % width, by = b / width;
+        const int cx = c % width, cy = c / width;
+        const int cross = (bx - ax) * (cy - ay) - (by - ay) * (cx - ax);
+        if (cross == 0)
+            return;
+        // Note: winding needs to be flipped when terrain X axis goes along world X axis and terrain Y axis along world Z
+        if (cross > 0)
+            std::swap(b, c);
+        indices.push_back((u16)a);
+        indices.push_back((u16)b);
+        indices.push_back((u16)c);
+    }
+};
+
 EC_Terrain::EC_Terrain(Scene* scene) :
     IComponent(scene),
     INIT_ATTRIBUTE(nodeTransformation, "Transform"),
@@ -76,6 +255,7 @@ void EC_Terrain::MakePatchFlat(uint x, uint y, float heightValue)
     patch.heightData.clear();
     patch.heightData.insert(patch.heightData.end(), cPatchSize*cPatchSize, heightValue);
     patch.patch_geometry_dirty = true;
+    patch.patch_height_dirty = true;
 }
 
 void EC_Terrain::MakeTerrainFlat(float heightValue)
@@ -121,6 +301,7 @@ void EC_Terrain::ResizeTerrain(uint newPatchWidth, uint newPatchHeight)
         for(uint x = 0; x < min(patchWidth, newPatchWidth); ++x)
             newPatches[y * newPatchWidth + x] = GetPatch(x, y);
     patches = newPatches;
+    patchBuilds.clear(); // The pending builds have the old patch sizes.
     uint oldPatchWidth = patchWidth;
     uint oldPatchHeight = patchHeight;
     patchWidth = newPatchWidth;
@@ -273,6 +454,9 @@ void EC_Terrain::DestroyPatch(uint x, uint y)
 
 void EC_Terrain::Destroy()
 {
+    // The running builds hold themselves, so they can be dropped without waiting.
+    patchBuilds.clear();
+
     for(uint y = 0; y < patchHeight; ++y)
         for(uint x = 0; x < patchWidth; ++x)
             DestroyPatch(x, y);
@@ -302,7 +486,9 @@ void EC_Terrain::SetPointHeight(uint x, uint y, float height)
     if (x >= cPatchSize * patchWidth || y >= cPatchSize * patchHeight)
         return; // Out of bounds signals are silently ignored.
 
-    GetPatch(x / cPatchSize, y / cPatchSize).heightData[(y % cPatchSize) * cPatchSize + (x % cPatchSize)] = height;
+    Patch &patch = GetPatch(x / cPatchSize, y / cPatchSize);
+    patch.heightData[(y % cPatchSize) * cPatchSize + (x % cPatchSize)] = height;
+    patch.patch_height_dirty = true;
 }
 
 float3 EC_Terrain::GetPointOnMap(const float3 &point) const 
@@ -624,6 +810,7 @@ bool EC_Terrain::LoadFromDataInMemory(const char *data, size_t numBytes)
     {
         newPatches[i].heightData.resize(cPatchSize*cPatchSize);
         newPatches[i].patch_geometry_dirty = true;
+        newPatches[i].patch_height_dirty = true;
         if (offset+cPatchSize*cPatchSize*sizeof(float) > numBytes)
             throw Exception("Not enough bytes to deserialize!");
 
@@ -1160,11 +1347,80 @@ void EC_Terrain::AttachTerrainRootNode()
     }
 }
 
-void EC_Terrain::GenerateTerrainGeometryForOnePatch(uint patchX, uint patchY)
+void EC_Terrain::StartPatchBuild(uint patchX, uint patchY)
+{
+    PROFILE(EC_Terrain_StartPatchBuild);
+
+    for(size_t i = 0; i < patchBuilds.size(); ++i)
+        if (patchBuilds[i]->patchX == patchX && patchBuilds[i]->patchY == patchY)
+            patchBuilds[i]->superseded = true;
+
+    shared_ptr<PatchBuild> build = MAKE_SHARED(PatchBuild);
+    build->patchX = patchX;
+    build->patchY = patchY;
+    // If we assume each patch is 16x16 vertices, then all the internal patches will get a 17x17 grid, since we need to connect seams.
+    // But, the outermost patch row and column at the terrain edge will not have this, since they do not need to connect to a next patch.
+    build->width = (patchX + 1 >= patchWidth) ? cPatchSize : cPatchSize + 1;
+    build->height = (patchY + 1 >= patchHeight) ? cPatchSize : cPatchSize + 1;
+    build->mapWidth = VerticesWidth();
+    build->mapHeight = VerticesHeight();
+    build->uScale = uScale.Get();
+    build->vScale = vScale.Get();
+
+    // Gather the height values of the patch vertices and their neighbors for the normals. GetPoint clamps the coordinates past the far edges.
+    build->heights.reserve((build->width + 2) * (build->height + 2));
+    for(int y = -1; y <= (int)build->height; ++y)
+        for(int x = -1; x <= (int)build->width; ++x)
+            build->heights.push_back(GetPoint((uint)max(0, (int)(patchX * cPatchSize) + x), (uint)max(0, (int)(patchY * cPatchSize) + y)));
+
+    patchBuilds.push_back(build);
+    GetPatch(patchX, patchY).patch_geometry_dirty = false;
+    QThreadPool::globalInstance()->start(new PatchBuild::Task(build));
+
+    connect(GetFramework()->Frame(), SIGNAL(Updated(float)), this, SLOT(OnFrameUpdated(float)), Qt::UniqueConnection);
+}
+
+void EC_Terrain::OnFrameUpdated(float /*frameTime*/)
+{
+    PROFILE(EC_Terrain_UploadPatches);
+
+    size_t numUploaded = 0;
+    for(size_t i = 0; i < patchBuilds.size();)
+    {
+        // The superseded builds can be dropped while they run, as the task holds them.
+        if (patchBuilds[i]->superseded)
+            patchBuilds.erase(patchBuilds.begin() + i);
+        else if (numUploaded < cMaxPatchUploadsPerFrame && patchBuilds[i]->finished.tryAcquire())
+        {
+            shared_ptr<PatchBuild> build = patchBuilds[i];
+            patchBuilds.erase(patchBuilds.begin() + i);
+            UploadPatchGeometry(*build);
+            ++numUploaded;
+        }
+        else
+            ++i;
+    }
+
+    if (patchBuilds.empty())
+    {
+        disconnect(GetFramework()->Frame(), SIGNAL(Updated(float)), this, SLOT(OnFrameUpdated(float)));
+
+        // All the new geometry we created will be visible for Ogre by default. If the EC_Placeable's visible attribute is false,
+        // we need to hide all newly created geometry.
+        AttachTerrainRootNode();
+
+        emit TerrainRegenerated();
+    }
+}
+
+void EC_Terrain::UploadPatchGeometry(PatchBuild &build)
 {
-    PROFILE(EC_Terrain_GenerateTerrainGeometryForOnePatch);
+    PROFILE(EC_Terrain_UploadPatchGeometry);
 
-    EC_Terrain::Patch &patch = GetPatch(patchX, patchY);
+    // The terrain may have been resized while the patch was built.
+    if (!PatchExists(build.patchX, build.patchY))
+        return;
+    EC_Terrain::Patch &patch = GetPatch(build.patchX, build.patchY);
 
     if (!ViewEnabled())
         return;
@@ -1174,116 +1430,18 @@ void EC_Terrain::GenerateTerrainGeometryForOnePatch(uint patchX, uint patchY)
     Ogre::SceneManager *sceneMgr = world->OgreSceneManager();
 
     Ogre::SceneNode *node = patch.node;
-    bool firstTimeFill = (node == 0);
-    UNREFERENCED_PARAM(firstTimeFill);
     if (!node)
     {
         CreateOgreTerrainPatchNode(node, patch.x, patch.y);
         patch.node = node;
     }
-    assert(node);
+    if (!node)
+        return;
 
     Ogre::MaterialPtr terrainMaterial = Ogre::MaterialManager::getSingleton().getByName(currentMaterial.toStdString().c_str());
     if (!terrainMaterial.get()) // If we could not find the material we were supposed to use, just use the default system terrain material.
         terrainMaterial = OgreRenderer::GetOrCreateLitTexturedMaterial("Rex/TerrainPCF");
 
-    Ogre::ManualObject *manual = sceneMgr->createManualObject(world->GetUniqueObjectName("EC_Terrain_manual"));
-    manual->setCastShadows(false);
-
-    manual->clear();
-    manual->estimateVertexCount((cPatchSize+1)*(cPatchSize+1));
-    manual->estimateIndexCount((cPatchSize+1)*(cPatchSize+1)*3*2);
-    manual->begin(terrainMaterial->getName(), Ogre::RenderOperation::OT_TRIANGLE_LIST);
-
-    const float vertexSpacingX = 1.f;
-    const float vertexSpacingY = 1.f;
-    const float patchSpacingX = cPatchSize * vertexSpacingX;
-    const float patchSpacingY = cPatchSize * vertexSpacingY;
-    const Ogre::Vector3 patchOrigin(patch.x * patchSpacingX, 0.f, patch.y * patchSpacingY);
-// Opensim:    const Ogre::Vector3 patchOrigin(patch.x * patchSpacingX, patch.y * patchSpacingY, 0.f);
-
-    int curIndex = 0;
-
-    const int cPatchVertexWidth = cPatchSize; // The number of vertices in the patch in horizontal direction. We use the fixed value of cPatchSize==16.
-    const int cPatchVertexHeight = cPatchSize; // The number of vertices in the patch in vertical  direction. We use the fixed value of cPatchSize==16.
-    // If we assume each patch is 16x16 vertices, then all the internal patches will get a 17x17 grid, since we need to connect seams.
-    // But, the outermost patch row and column at the terrain edge will not have this, since they do not need to connect to a next patch.
-    // This is the vertex stride for the terrain.
-    const int stride = (patch.x + 1 >= patchWidth) ? cPatchVertexWidth : (cPatchVertexWidth+1);
-
-    const float uScale = this->uScale.Get();
-    const float vScale = this->vScale.Get();
-
-    for(int y = 0; y <= cPatchVertexHeight; ++y)
-        for(int x = 0; x <= cPatchVertexWidth; ++x)
-        {
-            if ((patch.x + 1 >= patchWidth && x == cPatchVertexWidth) ||
-                (patch.y + 1 >= patchHeight && y == cPatchVertexHeight))
-                continue; // We are at the single corner-most vertex of the whole terrain. That is to be skipped.
-
-            // These coordinates are directly generated to our Ogre coordinate system, i.e. are cycled from OpenSim XYZ -> our YZX.
-            // see OpenSimToOgreCoordinateAxes.
-            Ogre::Vector3 pos;
-            pos.x = vertexSpacingX * x;
-            pos.z = vertexSpacingY * y;
-// Opensim:             pos.x = vertexSpacingX * x;
-// Opensim              pos.y = vertexSpacingY * y;
-
-            EC_Terrain::Patch *thisPatch;
-            int X = x;
-            int Y = y;
-            if (x < cPatchVertexWidth && y < cPatchVertexHeight)
-            {
-                thisPatch = &patch;
-
-                if ((patch.x + 1 < patchWidth || x+1 < cPatchVertexWidth) &&
-                    (patch.y + 1 < patchHeight || y+1 < cPatchVertexHeight))
-                {
-                    // Note: winding needs to be flipped when terrain X axis goes along world X axis and terrain Y axis along world Z
-                    manual->index(curIndex+stride);
-                    manual->index(curIndex+1);
-                    manual->index(curIndex);
-
-                    manual->index(curIndex+stride);
-                    manual->index(curIndex+stride+1);
-                    manual->index(curIndex+1);
-                }
-            }
-            else if (x == cPatchVertexWidth && y == cPatchVertexHeight)
-            {
-                thisPatch = &GetPatch(patch.x + 1, patch.y + 1);
-                X = 0;
-                Y = 0;
-            }
-            else if (x == cPatchVertexWidth)
-            {
-                thisPatch = &GetPatch(patch.x + 1, patch.y);
-                X = 0;
-            }
-            else // (y == patchHeight)
-            {
-                thisPatch = &GetPatch(patch.x, patch.y + 1);
-                Y = 0;
-            }
-
-            pos.y = thisPatch->heightData[Y*cPatchVertexWidth+X];
-// Opensim:            pos.z = thisPatch->heightData[Y*cPatchVertexWidth+X];
-
-            manual->position(pos);
-            manual->normal(CalculateNormal(thisPatch->x, thisPatch->y, X, Y));
-
-            // The UV set 0 contains the diffuse texture UV map. Do a planar mapping with the given specified UV scale.
-            manual->textureCoord((patchOrigin.x + pos.x) * uScale, (patchOrigin.z + pos.z) * vScale);
-// Opensim:             manual->textureCoord((patchOrigin.x + pos.x) * uScale, (patchOrigin.y + pos.y) * vScale);
-
-            // The UV set 1 contains the terrain blend mask UV map, which stretches once across the whole terrain.
-            manual->textureCoord((float)(patch.x*cPatchSize + x)/(VerticesWidth()-1), (float)(patch.y*cPatchSize + y)/(VerticesHeight()-1)); 
-
-            ++curIndex;
-        }
-
-    manual->end();
-
     // If there exists a previously generated GPU Mesh resource, delete it before creating a new one.
     if (patch.meshGeometryName.length() > 0)
     {
@@ -1295,11 +1453,53 @@ void EC_Terrain::GenerateTerrainGeometryForOnePatch(uint patchX, uint patchY)
     }
 
     patch.meshGeometryName = world->GetUniqueObjectName("EC_Terrain_patchmesh");
-    Ogre::MeshPtr terrainMesh = manual->convertToMesh(patch.meshGeometryName);
+    Ogre::MeshPtr terrainMesh = Ogre::MeshManager::getSingleton().createManual(patch.meshGeometryName, Ogre::ResourceGroupManager::DEFAULT_RESOURCE_GROUP_NAME);
+    Ogre::SubMesh *sub = terrainMesh->createSubMesh();
+    sub->useSharedVertices = false;
+    sub->setMaterialName(terrainMaterial->getName());
+
+    const size_t numVertices = build.vertices.size() / cPatchVertexFloats;
+    sub->vertexData = OGRE_NEW Ogre::VertexData();
+    sub->vertexData->vertexStart = 0;
+    sub->vertexData->vertexCount = numVertices;
+    Ogre::VertexDeclaration *decl = sub->vertexData->vertexDeclaration;
+    size_t offset = 0;
+    offset += decl->addElement(0, offset, Ogre::VET_FLOAT3, Ogre::VES_POSITION).getSize();
+    offset += decl->addElement(0, offset, Ogre::VET_FLOAT3, Ogre::VES_NORMAL).getSize();
+    offset += decl->addElement(0, offset, Ogre::VET_FLOAT2, Ogre::VES_TEXTURE_COORDINATES, 0).getSize();
+    offset += decl->addElement(0, offset, Ogre::VET_FLOAT2, Ogre::VES_TEXTURE_COORDINATES, 1).getSize();
+    Ogre::HardwareVertexBufferSharedPtr vertexBuffer = Ogre::HardwareBufferManager::getSingleton().createVertexBuffer(
+        offset, numVertices, Ogre::HardwareBuffer::HBU_STATIC_WRITE_ONLY);
+    vertexBuffer->writeData(0, vertexBuffer->getSizeInBytes(), &build.vertices[0], true);
+    sub->vertexData->vertexBufferBinding->setBinding(0, vertexBuffer);
+
+    // The full resolution triangles go to the submesh index data, and the coarser levels to its LOD face list.
+    Ogre::LodStrategy *lodStrategy = terrainMesh->getLodStrategy();
+    terrainMesh->_setLodInfo((unsigned short)cNumPatchLods, false);
+    for(uint i = 0; i < cNumPatchLods; ++i)
+    {
+        const std::vector<u16> &indices = build.lodIndices[i];
+        Ogre::IndexData *indexData = (i == 0) ? sub->indexData : OGRE_NEW Ogre::IndexData();
+        indexData->indexStart = 0;
+        indexData->indexCount = indices.size();
+        indexData->indexBuffer = Ogre::HardwareBufferManager::getSingleton().createIndexBuffer(
+            Ogre::HardwareIndexBuffer::IT_16BIT, indices.size(), Ogre::HardwareBuffer::HBU_STATIC_WRITE_ONLY);
+        indexData->indexBuffer->writeData(0, indexData->indexBuffer->getSizeInBytes(), &indices[0], true);
+        if (i == 0)
+            continue;
+
+        sub->mLodFaceList.push_back(indexData);
+        Ogre::MeshLodUsage usage;
+        usage.userValue = cPatchLodDistances[i-1];
+        usage.value = lodStrategy->transformUserValue(usage.userValue);
+        usage.edgeData = 0;
+        terrainMesh->_setLodUsage((unsigned short)i, usage);
+    }
 
-    // Odd: destroyManualObject seems to leave behind a memory leak if we don't call manualObject->clear first.
-    manual->clear();
-    sceneMgr->destroyManualObject(manual);
+    const Ogre::AxisAlignedBox bounds(0.f, build.minHeight, 0.f, (float)(build.width - 1), build.maxHeight, (float)(build.height - 1));
+    terrainMesh->_setBounds(bounds);
+    terrainMesh->_setBoundingSphereRadius(bounds.getHalfSize().length());
+    terrainMesh->load();
 
     patch.entity = sceneMgr->createEntity(world->GetUniqueObjectName("EC_Terrain_patchentity"), patch.meshGeometryName);
     patch.entity->setUserAny(Ogre::Any(static_cast<IComponent *>(this)));
@@ -1318,8 +1518,6 @@ void EC_Terrain::GenerateTerrainGeometryForOnePatch(uint patchX, uint patchY)
     node->detachAllObjects();
     // Now attach the new built terrain mesh.
     node->attachObject(patch.entity);
-
-    patch.patch_geometry_dirty = false;
 }
 
 void EC_Terrain::CreateRootNode()
@@ -1403,6 +1601,7 @@ void EC_Terrain::Resize(uint newWidth, uint newHeight, uint oldPatchStartX, uint
             newPatches[y * newWidth + x] = patches[(y + oldPatchStartY) * xPatches.Get() + x + oldPatchStartX];
 
     patches = newPatches;
+    patchBuilds.clear(); // The pending builds have the old patch sizes.
     xPatches.Set(newWidth, AttributeChange::Disconnected);
     yPatches.Set(newHeight, AttributeChange::Disconnected);
     patchWidth = newWidth;
@@ -1420,7 +1619,10 @@ void EC_Terrain::GetTerrainHeightRange(float &minHeight, float &maxHeight) const
 void EC_Terrain::DirtyAllTerrainPatches()
 {
     for(size_t i = 0; i < patches.size(); ++i)
+    {
         patches[i].patch_geometry_dirty = true;
+        patches[i].patch_height_dirty = true;
+    }
 }
 
 void EC_Terrain::RegenerateDirtyTerrainPatches()
@@ -1430,6 +1632,24 @@ void EC_Terrain::RegenerateDirtyTerrainPatches()
     Entity *parentEntity = ParentEntity();
     if (!parentEntity)
         return;
+
+    // Tell the range of the patches whose heights have changed, also when no geometry is built
+    uint minPatchX = patchWidth, minPatchY = patchHeight, maxPatchX = 0, maxPatchY = 0;
+    for(uint y = 0; y < patchHeight; ++y)
+        for(uint x = 0; x < patchWidth; ++x)
+        {
+            EC_Terrain::Patch &scenePatch = GetPatch(x, y);
+            if (!scenePatch.patch_height_dirty || scenePatch.heightData.size() == 0)
+                continue;
+            scenePatch.patch_height_dirty = false;
+            minPatchX = min(minPatchX, x);
+            minPatchY = min(minPatchY, y);
+            maxPatchX = max(maxPatchX, x);
+            maxPatchY = max(maxPatchY, y);
+        }
+    if (minPatchX <= maxPatchX)
+        emit HeightsChanged(minPatchX, minPatchY, maxPatchX, maxPatchY);
+
     EC_Placeable *position = parentEntity->GetComponent<EC_Placeable>().get();
     if (!GetFramework()->IsHeadless() && (!position || position->visible.Get())) // Only need to create GPU resources if the placeable itself is visible.
     {
@@ -1463,10 +1683,14 @@ void EC_Terrain::RegenerateDirtyTerrainPatches()
                 }
 
                 if (neighborsLoaded)
-                    GenerateTerrainGeometryForOnePatch(x, y);
+                    StartPatchBuild(x, y);
             }
     }
-    
+
+    // If patch builds were started, the root node is reattached and TerrainRegenerated emitted when they have been uploaded.
+    if (!patchBuilds.empty())
+        return;
+
     // All the new geometry we created will be visible for Ogre by default. If the EC_Placeable's visible attribute is false,
     // we need to hide all newly created geometry.
     AttachTerrainRootNode();
@@ -22,6 +22,10 @@ namespace Ogre { class Matrix4; }
     Adds a heightmap-based terrain to the scene. A Terrain is composed of a rectangular grid of adjacent "patches".
     Each patch is a fixed-size 16x16 height map.
 
+    The geometry of the dirty patches is built in worker threads, and a few of the finished patches are uploaded to the GPU
+    each frame. Each patch mesh has distance-based LOD levels that skip 1, 3 or 7 of every 8 vertices inside the patch. The
+    vertices on the patch borders are kept in every level, so that adjacent patches with different LOD levels do not crack.
+
     Registered by EnvironmentComponents plugin.
 
     <b>Attributes:</b>
@@ -104,7 +108,7 @@ public:
         - fully loaded. The GPU data is also loaded and the node, entity and meshGeometryName fields specify the used GPU resources. */
     struct Patch
     {
-        Patch():x(0),y(0), node(0), entity(0), patch_geometry_dirty(true) {}
+        Patch():x(0),y(0), node(0), entity(0), patch_geometry_dirty(true), patch_height_dirty(true) {}
 
         /// X-coordinate on the grid of patches. In the range [0, EC_Terrain::PatchWidth()].
         uint x;
@@ -130,6 +134,9 @@ public:
         /// in yet.
         bool patch_geometry_dirty;
 
+        /// If true, the height values have changed since the last HeightsChanged signal.
+        bool patch_height_dirty;
+
         /// Call only when you've checked that this patch has been loaded in.
         float GetHeightValue(uint x, uint y) const { return heightData[y*cPatchSize+x]; }
     };
@@ -367,6 +374,11 @@ signals:
     /// Emitted when the terrain data is regenerated.
     void TerrainRegenerated();
 
+    /// Emitted by RegenerateDirtyTerrainPatches when the height values of some loaded patches have changed, before TerrainRegenerated.
+    /** The changed patches are within the given inclusive range of patch coordinates. Lets users of the height data, like the physics
+        heightfield that reads the patches directly, refresh only the changed region. */
+    void HeightsChanged(uint minPatchX, uint minPatchY, uint maxPatchX, uint maxPatchY);
+
 private slots:
     /// Emitted when the parrent entity has been set.
     void UpdateSignals();
@@ -378,7 +390,12 @@ private slots:
     /** Additionally re-applies the visibility of each terrain patch that is currently attached to the terrain node. */
     void AttachTerrainRootNode();
 
+    /// Uploads the patches whose geometry has been built in the worker threads.
+    void OnFrameUpdated(float frameTime);
+
 private:
+    struct PatchBuild;
+
     void AttributesChanged();
 
     /// Creates the patch parent/root node if it does not exist.
@@ -403,9 +420,13 @@ private:
     /// @param textureName The Ogre texture resource name to set.
     void SetTerrainMaterialTexture(uint index, const QString &textureName);
 
-    /// Creates Ogre geometry data for the single given patch, or updates the geometry for an existing
+    /// Starts building the geometry of the single given patch in a worker thread.
+    /** The geometry is uploaded to the GPU in OnFrameUpdated when the build is done. A pending build of the same patch is superseded. */
+    void StartPatchBuild(uint patchX, uint patchY);
+
+    /// Creates Ogre geometry data for the patch from the finished build, or updates the geometry for an existing
     /// patch if the associated Ogre resources already exist.
-    void GenerateTerrainGeometryForOnePatch(uint patchX, uint patchY);
+    void UploadPatchGeometry(PatchBuild &build);
 
     shared_ptr<AssetRefListener> heightMapAsset;
 
@@ -424,6 +445,9 @@ private:
 
     /// Stores the actual height patches.
     std::vector<Patch> patches;
+
+    /// The patch geometry builds that have been started in the worker threads, in the order they were started.
+    std::vector<shared_ptr<PatchBuild> > patchBuilds;
     
     /// Ogre world for referring to the Ogre scene manager
     OgreWorldWeakPtr world_;
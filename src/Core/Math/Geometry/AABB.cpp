@@ -17,6 +17,7 @@
 	@brief Implementation for the Axis-Aligned Bounding Box (AABB) geometry object. */
 #include "Geometry/AABB.h"
 #include "Math/MathFunc.h"
+#include "Math/SIMDKernels.h"
 #ifdef MATH_ENABLE_STL_SUPPORT
 #include <iostream>
 #include <utility>
@@ -90,10 +91,7 @@ void AABB::SetFrom(const float3 *pointArray, int numPoints)
 {
 	assume(pointArray || numPoints == 0);
 	SetNegativeInfinity();
-	if (!pointArray)
-		return;
-	for(int i = 0; i < numPoints; ++i)
-		Enclose(pointArray[i]);
+	Enclose(pointArray, numPoints);
 }
 
 Polyhedron AABB::ToPolyhedron() const
@@ -455,7 +453,7 @@ void AABB::TransformAsAABB(const float3x4 &transform)
 	assume(transform.IsColOrthogonal());
 	assume(transform.HasUniformScale());
 
-	AABBTransformAsAABB(*this, transform);
+	ActiveSIMDKernels().transformAABB(transform.ptr(), minPoint.ptr(), maxPoint.ptr());
 }
 
 void AABB::TransformAsAABB(const float4x4 &transform)
@@ -464,7 +462,8 @@ void AABB::TransformAsAABB(const float4x4 &transform)
 	assume(transform.HasUniformScale());
 	assume(transform.Row(3).Equals(0,0,0,1));
 
-	AABBTransformAsAABB(*this, transform);
+	// The first three rows of a float4x4 are laid out as a float3x4.
+	ActiveSIMDKernels().transformAABB(transform.ptr(), minPoint.ptr(), maxPoint.ptr());
 }
 
 void AABB::TransformAsAABB(const Quat &transform)
@@ -971,8 +970,7 @@ void AABB::Enclose(const float3 *pointArray, int numPoints)
 	assume(pointArray || numPoints == 0);
 	if (!pointArray)
 		return;
-	for(int i = 0; i < numPoints; ++i)
-		Enclose(pointArray[i]);
+	ActiveSIMDKernels().enclosePoints(pointArray->ptr(), numPoints, sizeof(float3), minPoint.ptr(), maxPoint.ptr());
 }
 
 void AABB::Triangulate(int numFacesX, int numFacesY, int numFacesZ,
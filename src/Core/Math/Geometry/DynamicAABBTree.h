@@ -0,0 +1,239 @@
+/**
+    For conditions of distribution and use, see copyright notice in LICENSE
+
+    @file   DynamicAABBTree.h
+    @brief  A bounding volume hierarchy for moving objects, with incremental updates and SAH rebuilds. */
+
+#pragma once
+
+#include "Types.h"
+#include "AABB.h"
+#include "Ray.h"
+#include "Math/float3.h"
+#include "Math/MathConstants.h"
+#include "assume.h"
+
+#include <vector>
+#include <utility>
+
+MATH_BEGIN_NAMESPACE
+
+/// A node of DynamicAABBTree. A leaf refers to an object, an inner node has two children.
+struct DynamicAABBTreeNode
+{
+    DynamicAABBTreeNode() : parent(-1), left(-1), right(-1), object(-1), version(0) {}
+
+    bool IsLeaf() const { return left == -1; }
+
+    AABB box; ///< The grown bounds of the object of a leaf, or the union of the boxes of the children.
+    int parent; ///< The parent node, or -1 for the root. The next free node for a free node.
+    int left; ///< The left child, or -1 for a leaf.
+    int right; ///< The right child, or -1 for a leaf.
+    int object; ///< The object of a leaf, or -1.
+    u32 version; ///< The version of the object when the leaf was made, see DynamicAABBTree::EndRebuild.
+};
+
+/// A bounding volume hierarchy over the AABBs of moving objects.
+/** Unlike KdTree, which is built once over static geometry, the objects can be inserted, removed and moved at any time.
+    A leaf stores the bounds of its object grown by a margin, so that an object that moves within the grown bounds
+    costs only a bounds update, and only one that moves out of them is reinserted. An insertion descends to the sibling
+    whose surface area grows the least, but as the objects move the tree degrades, see SAHCost. Rebuild rebuilds it
+    with the binned surface area heuristic (SAH), and BeginRebuild and EndRebuild do the same with the build in a
+    background thread.
+
+    T is the user data of an object, f.ex. a pointer or an index. The objects are referred to by the ids Insert returns.
+    The ids of the removed objects are reused.
+
+    The queries call a callback for each object whose bounds pass the test. As in KdTree, the query stops when the
+    callback returns true. The callbacks can run nested queries, but must not change the tree. The queries of a tree
+    must not run in several threads at once. */
+template<typename T>
+class DynamicAABBTree
+{
+public:
+    /// Constructs an empty tree.
+    /** @param margin The amount the bounds of the objects are grown by in the leaves. */
+    explicit DynamicAABBTree(float margin = 0.f);
+
+    /// Inserts an object with the given bounds, and returns its id.
+    int Insert(const AABB &bounds, const T &userData);
+
+    /// Removes the object.
+    void Remove(int id);
+
+    /// Sets the bounds of the object. Returns true if the object moved out of its grown bounds and was reinserted.
+    bool Update(int id, const AABB &bounds);
+
+    /// Removes all the objects.
+    void Clear();
+
+    /// Returns true if the id refers to an object in the tree.
+    bool IsValid(int id) const { return id >= 0 && id < (int)objects.size() && objects[id].leaf != -2; }
+
+    /// Returns the user data of the object.
+    T &UserData(int id) { assume(IsValid(id)); return objects[id].userData; }
+    const T &UserData(int id) const { assume(IsValid(id)); return objects[id].userData; }
+
+    /// Returns the bounds of the object.
+    const AABB &Bounds(int id) const { assume(IsValid(id)); return objects[id].bounds; }
+
+    /// Returns the bounds of the object grown by the margin, as stored in its leaf.
+    const AABB &GrownBounds(int id) const { assume(IsValid(id)); return nodes[objects[id].leaf].box; }
+
+    /// Returns the number of the objects in the tree.
+    int NumObjects() const { return (int)(objects.size() - freeObjects.size()); }
+
+    /// Returns the number of the nodes in the tree, i.e. inner nodes + leaves.
+    int NumNodes() const { return root == -1 ? 0 : 2 * NumObjects() - 1; }
+
+    /// Returns the maximum height of the tree (the path from the root to the farthest leaf node).
+    /** Iterates over the whole tree. */
+    int TreeHeight() const;
+
+    /// Returns the sum of the surface areas of the inner nodes divided by that of the root, or 0 for an empty tree.
+    /** This is proportional to the expected cost of a query. Compare to the value after a rebuild to tell how much
+        the tree has degraded. Iterates over the whole tree. */
+    float SAHCost() const;
+
+    /// Returns an AABB that encloses the grown bounds of all the objects, or a negatively infinite AABB for an empty tree.
+    AABB BoundingAABB() const;
+
+    /// Returns the root node, or null for an empty tree.
+    const DynamicAABBTreeNode *Root() const { return root == -1 ? 0 : &nodes[root]; }
+
+    /// Returns a node by the given index.
+    const DynamicAABBTreeNode &Node(int index) const { return nodes[index]; }
+
+    /// The data of a rebuild in a background thread, see BeginRebuild.
+    class RebuildSnapshot
+    {
+    public:
+        RebuildSnapshot() : root(-1) {}
+
+        /// Builds the tree over the grown bounds of the objects with the binned SAH. Touches only the snapshot,
+        /// so can be called in any thread.
+        void Build();
+
+    private:
+        friend class DynamicAABBTree;
+
+        /// An object of the tree at BeginRebuild.
+        struct Item
+        {
+            AABB box;
+            float3 centroid;
+            int object;
+            u32 version;
+        };
+
+        /// A node of the build whose subtree is made of the items [begin, end).
+        struct Task
+        {
+            Task(int begin_, int end_, int node_) : begin(begin_), end(end_), node(node_) {}
+            int begin;
+            int end;
+            int node;
+        };
+
+        /// Tells whether an item falls in the bins [0, lastBin] along the axis.
+        struct InLeftBins
+        {
+            InLeftBins(int axis_, float min_, float scale_, int lastBin_) : axis(axis_), min(min_), scale(scale_), lastBin(lastBin_) {}
+            bool operator()(const Item &item) const;
+            int axis;
+            float min;
+            float scale;
+            int lastBin;
+        };
+
+        /// Partitions the items [begin, end) at the split of the least SAH cost, and returns the index of the first item on the right.
+        int Split(int begin, int end);
+
+        std::vector<Item> items;
+        std::vector<DynamicAABBTreeNode> nodes;
+        int root;
+    };
+
+    /// Copies the grown bounds of the objects to the snapshot, for building a new tree with RebuildSnapshot::Build.
+    /** The tree can be changed and queried while the snapshot is built. Call EndRebuild to replace the
+        tree with the one of the snapshot. Rebuild one snapshot at a time. */
+    void BeginRebuild(RebuildSnapshot &snapshot) const;
+
+    /// Replaces the tree with the newly built one of the snapshot, and applies the changes made after BeginRebuild.
+    /** The objects inserted, removed or reinserted after BeginRebuild are inserted into and removed from the new tree
+        incrementally. Clears the snapshot. */
+    void EndRebuild(RebuildSnapshot &snapshot);
+
+    /// Rebuilds the tree with the binned SAH in the calling thread.
+    void Rebuild();
+
+    /// Calls the given callback for each object whose bounds the ray hits, in the order of the distance to the bounds.
+    /** @param leafCallback A function or a function object of prototype
+            bool LeafCallbackFunction(DynamicAABBTree<T> &tree, int id, const Ray &ray, float tNear, float tFar);
+            where tNear and tFar are the distances along the ray where it enters and leaves the bounds of the object.
+            As the callbacks come in the order of tNear, a callback that has found a hit nearer than tNear can
+            return true to stop the query. */
+    template<typename Func>
+    inline void RayQuery(const Ray &ray, Func &leafCallback);
+
+    /// Calls the given callback for each object whose bounds intersect the AABB.
+    /** @param leafCallback A function or a function object of prototype
+            bool LeafCallbackFunction(DynamicAABBTree<T> &tree, int id, const AABB &aabb);
+            If the callback function returns true, the execution of the query is stopped. */
+    template<typename Func>
+    inline void AABBQuery(const AABB &aabb, Func &leafCallback);
+
+    /// Calls the given callback for each object whose bounds intersect the shape, for which AABB::Intersects must
+    /// be defined, f.ex. Sphere, OBB or Frustum.
+    /** @param leafCallback A function or a function object of prototype
+            bool LeafCallbackFunction(DynamicAABBTree<T> &tree, int id);
+            If the callback function returns true, the execution of the query is stopped. */
+    template<typename Shape, typename Func>
+    inline void IntersectionQuery(const Shape &shape, Func &leafCallback);
+
+    /// Calls the given callback for the objects in the order of the distance of their bounds to the point.
+    /** @param leafCallback A function or a function object of prototype
+            bool LeafCallbackFunction(DynamicAABBTree<T> &tree, const float3 &point, int id, float minDistance);
+            where minDistance is the distance from the point to the bounds of the object. Return true to stop the
+            query, f.ex. after enough objects or when minDistance is past the distance of interest. */
+    template<typename Func>
+    inline void NearestObjects(const float3 &point, Func &leafCallback);
+
+private:
+    /// An object in the tree.
+    struct Object
+    {
+        Object() : userData(), leaf(-2), version(0) {}
+
+        T userData;
+        AABB bounds;
+        int leaf; ///< The leaf of the object, -1 while it is reinserted, or -2 for a free id.
+        u32 version; ///< Incremented when the object gets a new leaf, so that EndRebuild can tell which leaves are stale.
+    };
+
+    /// A node or an object, by its distance, for the ordered queries. Objects are stored as -1 - id.
+    typedef std::pair<float, int> QueueEntry;
+
+    int AllocateNode();
+    void FreeNode(int index);
+    /// Makes a leaf for the object and inserts it into the tree.
+    void InsertLeaf(int id);
+    /// Removes the leaf from the tree and frees it and its parent. Does not touch the object of the leaf.
+    void RemoveLeaf(int leaf);
+    /// Recomputes the boxes of the inner nodes from the node to the root.
+    void RefitAncestors(int index);
+
+    float margin;
+    std::vector<DynamicAABBTreeNode> nodes;
+    int root; ///< The root node, or -1 if the tree is empty.
+    int freeNode; ///< The first free node, or -1.
+    std::vector<Object> objects;
+    std::vector<int> freeObjects;
+    /// Scratch memory of the queries. A nested query finds these empty and allocates its own.
+    std::vector<int> stack;
+    std::vector<QueueEntry> queue;
+};
+
+MATH_END_NAMESPACE
+
+#include "DynamicAABBTree.inl"
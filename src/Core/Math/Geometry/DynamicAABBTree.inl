@@ -0,0 +1,583 @@
+/**
+    For conditions of distribution and use, see copyright notice in LICENSE
+
+    @file   DynamicAABBTree.inl
+    @brief  Implementation of the DynamicAABBTree. */
+
+#pragma once
+
+#include <algorithm>
+#include <functional>
+
+MATH_BEGIN_NAMESPACE
+
+template<typename T>
+DynamicAABBTree<T>::DynamicAABBTree(float margin_)
+:margin(margin_), root(-1), freeNode(-1)
+{
+}
+
+template<typename T>
+int DynamicAABBTree<T>::Insert(const AABB &bounds, const T &userData)
+{
+    int id;
+    if (!freeObjects.empty())
+    {
+        id = freeObjects.back();
+        freeObjects.pop_back();
+    }
+    else
+    {
+        id = (int)objects.size();
+        objects.push_back(Object());
+    }
+    Object &object = objects[id];
+    object.userData = userData;
+    object.bounds = bounds;
+    InsertLeaf(id);
+    return id;
+}
+
+template<typename T>
+void DynamicAABBTree<T>::Remove(int id)
+{
+    assume(IsValid(id));
+    if (!IsValid(id))
+        return;
+    Object &object = objects[id];
+    RemoveLeaf(object.leaf);
+    object.leaf = -2;
+    object.userData = T();
+    ++object.version;
+    freeObjects.push_back(id);
+}
+
+template<typename T>
+bool DynamicAABBTree<T>::Update(int id, const AABB &bounds)
+{
+    assume(IsValid(id));
+    if (!IsValid(id))
+        return false;
+    Object &object = objects[id];
+    object.bounds = bounds;
+    if (nodes[object.leaf].box.Contains(bounds))
+        return false;
+    RemoveLeaf(object.leaf);
+    InsertLeaf(id);
+    return true;
+}
+
+template<typename T>
+void DynamicAABBTree<T>::Clear()
+{
+    nodes.clear();
+    root = -1;
+    freeNode = -1;
+    // The ids are freed instead of dropped, so that the versions keep growing for a snapshot taken before.
+    freeObjects.clear();
+    for(int id = (int)objects.size() - 1; id >= 0; --id)
+    {
+        if (objects[id].leaf != -2)
+        {
+            objects[id].leaf = -2;
+            objects[id].userData = T();
+            ++objects[id].version;
+        }
+        freeObjects.push_back(id);
+    }
+}
+
+template<typename T>
+int DynamicAABBTree<T>::TreeHeight() const
+{
+    if (root == -1)
+        return 0;
+    int height = 0;
+    std::vector<std::pair<int, int> > nodeStack; // The node and its depth.
+    nodeStack.push_back(std::make_pair(root, 1));
+    while(!nodeStack.empty())
+    {
+        const std::pair<int, int> entry = nodeStack.back();
+        nodeStack.pop_back();
+        height = std::max(height, entry.second);
+        const DynamicAABBTreeNode &node = nodes[entry.first];
+        if (!node.IsLeaf())
+        {
+            nodeStack.push_back(std::make_pair(node.left, entry.second + 1));
+            nodeStack.push_back(std::make_pair(node.right, entry.second + 1));
+        }
+    }
+    return height;
+}
+
+template<typename T>
+float DynamicAABBTree<T>::SAHCost() const
+{
+    if (root == -1)
+        return 0.f;
+    const float rootArea = nodes[root].box.SurfaceArea();
+    if (rootArea <= 0.f)
+        return 0.f;
+    // The free nodes are reset to leaves, so all the nodes can be summed.
+    float area = 0.f;
+    for(size_t i = 0; i < nodes.size(); ++i)
+        if (!nodes[i].IsLeaf())
+            area += nodes[i].box.SurfaceArea();
+    return area / rootArea;
+}
+
+template<typename T>
+AABB DynamicAABBTree<T>::BoundingAABB() const
+{
+    if (root == -1)
+        return AABB(float3::inf, -float3::inf);
+    return nodes[root].box;
+}
+
+template<typename T>
+void DynamicAABBTree<T>::BeginRebuild(RebuildSnapshot &snapshot) const
+{
+    snapshot.items.clear();
+    snapshot.nodes.clear();
+    snapshot.root = -1;
+    snapshot.items.reserve(NumObjects());
+    for(int id = 0; id < (int)objects.size(); ++id)
+        if (objects[id].leaf >= 0)
+        {
+            typename RebuildSnapshot::Item item;
+            item.box = nodes[objects[id].leaf].box;
+            item.centroid = item.box.CenterPoint();
+            item.object = id;
+            item.version = objects[id].version;
+            snapshot.items.push_back(item);
+        }
+}
+
+template<typename T>
+void DynamicAABBTree<T>::EndRebuild(RebuildSnapshot &snapshot)
+{
+    nodes.swap(snapshot.nodes);
+    root = snapshot.root;
+    freeNode = -1;
+    snapshot.items.clear();
+    snapshot.nodes.clear();
+    snapshot.root = -1;
+
+    // Adopt the leaves of the unchanged objects, and drop the leaves of the objects that were removed or reinserted
+    // after BeginRebuild. Then insert the objects left without a leaf, i.e. those and the newly inserted ones.
+    for(size_t i = 0; i < objects.size(); ++i)
+        if (objects[i].leaf != -2)
+            objects[i].leaf = -1;
+    std::vector<int> staleLeaves;
+    for(int i = 0; i < (int)nodes.size(); ++i)
+    {
+        const DynamicAABBTreeNode &node = nodes[i];
+        if (!node.IsLeaf())
+            continue;
+        if (IsValid(node.object) && objects[node.object].version == node.version)
+            objects[node.object].leaf = i;
+        else
+            staleLeaves.push_back(i);
+    }
+    for(size_t i = 0; i < staleLeaves.size(); ++i)
+        RemoveLeaf(staleLeaves[i]);
+    for(int id = 0; id < (int)objects.size(); ++id)
+        if (objects[id].leaf == -1)
+            InsertLeaf(id);
+}
+
+template<typename T>
+void DynamicAABBTree<T>::Rebuild()
+{
+    RebuildSnapshot snapshot;
+    BeginRebuild(snapshot);
+    snapshot.Build();
+    EndRebuild(snapshot);
+}
+
+template<typename T>
+void DynamicAABBTree<T>::RebuildSnapshot::Build()
+{
+    nodes.clear();
+    root = -1;
+    if (items.empty())
+        return;
+
+    // Top-down, with an explicit stack, as the SAH splits can make the tree deep. The children are always after
+    // their parent, so that the boxes can be computed bottom-up in one pass afterwards.
+    nodes.reserve(2 * items.size() - 1);
+    nodes.push_back(DynamicAABBTreeNode());
+    root = 0;
+    std::vector<Task> tasks;
+    tasks.push_back(Task(0, (int)items.size(), 0));
+    while(!tasks.empty())
+    {
+        const Task task = tasks.back();
+        tasks.pop_back();
+        if (task.end - task.begin == 1)
+        {
+            DynamicAABBTreeNode &leaf = nodes[task.node];
+            leaf.box = items[task.begin].box;
+            leaf.object = items[task.begin].object;
+            leaf.version = items[task.begin].version;
+            continue;
+        }
+
+        const int mid = Split(task.begin, task.end);
+        const int left = (int)nodes.size();
+        nodes.push_back(DynamicAABBTreeNode());
+        nodes.push_back(DynamicAABBTreeNode());
+        nodes[left].parent = task.node;
+        nodes[left + 1].parent = task.node;
+        nodes[task.node].left = left;
+        nodes[task.node].right = left + 1;
+        tasks.push_back(Task(mid, task.end, left + 1));
+        tasks.push_back(Task(task.begin, mid, left));
+    }
+    for(int i = (int)nodes.size() - 1; i >= 0; --i)
+        if (!nodes[i].IsLeaf())
+        {
+            nodes[i].box = nodes[nodes[i].left].box;
+            nodes[i].box.Enclose(nodes[nodes[i].right].box);
+        }
+}
+
+template<typename T>
+bool DynamicAABBTree<T>::RebuildSnapshot::InLeftBins::operator()(const Item &item) const
+{
+    const int bin = std::min((int)((item.centroid[axis] - min) * scale), lastBin + 1);
+    return bin <= lastBin;
+}
+
+template<typename T>
+int DynamicAABBTree<T>::RebuildSnapshot::Split(int begin, int end)
+{
+    const int cNumBins = 16;
+    const int count = end - begin;
+
+    // Bin the centroids along the longest axis of their bounds.
+    AABB centroidBounds(float3::inf, -float3::inf);
+    for(int i = begin; i < end; ++i)
+        centroidBounds.Enclose(items[i].centroid);
+    const float3 extent = centroidBounds.Size();
+    const int axis = (extent.x >= extent.y && extent.x >= extent.z) ? 0 : (extent.y >= extent.z ? 1 : 2);
+    if (!(extent[axis] > 0.f))
+        return begin + count / 2; // All the centroids are at the same point, so split by count.
+    const float min = centroidBounds.minPoint[axis];
+    const float scale = cNumBins / extent[axis];
+
+    int binCounts[cNumBins];
+    AABB binBoxes[cNumBins];
+    for(int b = 0; b < cNumBins; ++b)
+    {
+        binCounts[b] = 0;
+        binBoxes[b] = AABB(float3::inf, -float3::inf);
+    }
+    for(int i = begin; i < end; ++i)
+    {
+        const int b = std::min((int)((items[i].centroid[axis] - min) * scale), cNumBins - 1);
+        ++binCounts[b];
+        binBoxes[b].Enclose(items[i].box);
+    }
+
+    // The cost of a split after bin b is the surface area times the number of the items on each side.
+    float leftCosts[cNumBins - 1];
+    AABB box(float3::inf, -float3::inf);
+    int numLeft = 0;
+    for(int b = 0; b < cNumBins - 1; ++b)
+    {
+        numLeft += binCounts[b];
+        if (binCounts[b] > 0)
+            box.Enclose(binBoxes[b]);
+        leftCosts[b] = numLeft > 0 ? box.SurfaceArea() * numLeft : 0.f;
+    }
+    int bestBin = -1;
+    float bestCost = FLOAT_INF;
+    box = AABB(float3::inf, -float3::inf);
+    int numRight = 0;
+    for(int b = cNumBins - 1; b > 0; --b)
+    {
+        numRight += binCounts[b];
+        if (binCounts[b] > 0)
+            box.Enclose(binBoxes[b]);
+        const int left = count - numRight;
+        if (left == 0 || numRight == 0)
+            continue;
+        const float cost = leftCosts[b - 1] + box.SurfaceArea() * numRight;
+        if (cost < bestCost)
+        {
+            bestCost = cost;
+            bestBin = b - 1;
+        }
+    }
+    if (bestBin == -1)
+        return begin + count / 2;
+
+    typename std::vector<Item>::iterator mid = std::partition(items.begin() + begin, items.begin() + end, InLeftBins(axis, min, scale, bestBin));
+    const int midIndex = (int)(mid - items.begin());
+    if (midIndex == begin || midIndex == end)
+        return begin + count / 2;
+    return midIndex;
+}
+
+template<typename T>
+template<typename Func>
+void DynamicAABBTree<T>::RayQuery(const Ray &ray, Func &leafCallback)
+{
+    // Best-first by the entry distance. All under a node are at least as far as the node, so the objects come in order.
+    std::vector<QueueEntry> heap;
+    heap.swap(queue);
+    heap.clear();
+    float tNear, tFar;
+    if (root != -1 && nodes[root].box.Intersects(ray, tNear, tFar))
+        heap.push_back(QueueEntry(tNear, root));
+    while(!heap.empty())
+    {
+        std::pop_heap(heap.begin(), heap.end(), std::greater<QueueEntry>());
+        const QueueEntry entry = heap.back();
+        heap.pop_back();
+        if (entry.second < 0)
+        {
+            const int id = -1 - entry.second;
+            objects[id].bounds.Intersects(ray, tNear, tFar);
+            if (leafCallback(*this, id, ray, tNear, tFar))
+                break;
+            continue;
+        }
+
+        const DynamicAABBTreeNode &node = nodes[entry.second];
+        if (node.IsLeaf())
+        {
+            if (objects[node.object].bounds.Intersects(ray, tNear, tFar))
+            {
+                heap.push_back(QueueEntry(tNear, -1 - node.object));
+                std::push_heap(heap.begin(), heap.end(), std::greater<QueueEntry>());
+            }
+            continue;
+        }
+        const int children[2] = { node.left, node.right };
+        for(int i = 0; i < 2; ++i)
+            if (nodes[children[i]].box.Intersects(ray, tNear, tFar))
+            {
+                heap.push_back(QueueEntry(tNear, children[i]));
+                std::push_heap(heap.begin(), heap.end(), std::greater<QueueEntry>());
+            }
+    }
+    heap.clear();
+    queue.swap(heap);
+}
+
+template<typename T>
+template<typename Func>
+void DynamicAABBTree<T>::AABBQuery(const AABB &aabb, Func &leafCallback)
+{
+    std::vector<int> nodeStack;
+    nodeStack.swap(stack);
+    nodeStack.clear();
+    if (root != -1)
+        nodeStack.push_back(root);
+    while(!nodeStack.empty())
+    {
+        const DynamicAABBTreeNode &node = nodes[nodeStack.back()];
+        nodeStack.pop_back();
+        if (!node.box.Intersects(aabb))
+            continue;
+        if (!node.IsLeaf())
+        {
+            nodeStack.push_back(node.left);
+            nodeStack.push_back(node.right);
+        }
+        else if (objects[node.object].bounds.Intersects(aabb) && leafCallback(*this, node.object, aabb))
+            break;
+    }
+    nodeStack.clear();
+    stack.swap(nodeStack);
+}
+
+template<typename T>
+template<typename Shape, typename Func>
+void DynamicAABBTree<T>::IntersectionQuery(const Shape &shape, Func &leafCallback)
+{
+    std::vector<int> nodeStack;
+    nodeStack.swap(stack);
+    nodeStack.clear();
+    if (root != -1)
+        nodeStack.push_back(root);
+    while(!nodeStack.empty())
+    {
+        const DynamicAABBTreeNode &node = nodes[nodeStack.back()];
+        nodeStack.pop_back();
+        if (!node.box.Intersects(shape))
+            continue;
+        if (!node.IsLeaf())
+        {
+            nodeStack.push_back(node.left);
+            nodeStack.push_back(node.right);
+        }
+        else if (objects[node.object].bounds.Intersects(shape) && leafCallback(*this, node.object))
+            break;
+    }
+    nodeStack.clear();
+    stack.swap(nodeStack);
+}
+
+template<typename T>
+template<typename Func>
+void DynamicAABBTree<T>::NearestObjects(const float3 &point, Func &leafCallback)
+{
+    // Best-first by the distance. A box encloses everything under it, so an object popped is nearer than anything left.
+    std::vector<QueueEntry> heap;
+    heap.swap(queue);
+    heap.clear();
+    if (root != -1)
+        heap.push_back(QueueEntry(nodes[root].box.Distance(point), root));
+    while(!heap.empty())
+    {
+        std::pop_heap(heap.begin(), heap.end(), std::greater<QueueEntry>());
+        const QueueEntry entry = heap.back();
+        heap.pop_back();
+        if (entry.second < 0)
+        {
+            if (leafCallback(*this, point, -1 - entry.second, entry.first))
+                break;
+            continue;
+        }
+
+        const DynamicAABBTreeNode &node = nodes[entry.second];
+        if (node.IsLeaf())
+            heap.push_back(QueueEntry(objects[node.object].bounds.Distance(point), -1 - node.object));
+        else
+        {
+            const int left = node.left, right = node.right;
+            heap.push_back(QueueEntry(nodes[left].box.Distance(point), left));
+            std::push_heap(heap.begin(), heap.end(), std::greater<QueueEntry>());
+            heap.push_back(QueueEntry(nodes[right].box.Distance(point), right));
+        }
+        std::push_heap(heap.begin(), heap.end(), std::greater<QueueEntry>());
+    }
+    heap.clear();
+    queue.swap(heap);
+}
+
+template<typename T>
+int DynamicAABBTree<T>::AllocateNode()
+{
+    if (freeNode == -1)
+    {
+        nodes.push_back(DynamicAABBTreeNode());
+        return (int)nodes.size() - 1;
+    }
+    const int index = freeNode;
+    freeNode = nodes[index].parent;
+    nodes[index] = DynamicAABBTreeNode();
+    return index;
+}
+
+template<typename T>
+void DynamicAABBTree<T>::FreeNode(int index)
+{
+    nodes[index] = DynamicAABBTreeNode();
+    nodes[index].parent = freeNode;
+    freeNode = index;
+}
+
+template<typename T>
+void DynamicAABBTree<T>::InsertLeaf(int id)
+{
+    const int leaf = AllocateNode();
+    Object &object = objects[id];
+    ++object.version;
+    object.leaf = leaf;
+    nodes[leaf].object = id;
+    nodes[leaf].version = object.version;
+    nodes[leaf].box = AABB(object.bounds.minPoint - float3::FromScalar(margin), object.bounds.maxPoint + float3::FromScalar(margin));
+
+    if (root == -1)
+    {
+        root = leaf;
+        return;
+    }
+
+    // Descend to the sibling that grows the least in surface area when the leaf is added under it.
+    const AABB leafBox = nodes[leaf].box;
+    int sibling = root;
+    while(!nodes[sibling].IsLeaf())
+    {
+        const DynamicAABBTreeNode &node = nodes[sibling];
+        AABB combined = node.box;
+        combined.Enclose(leafBox);
+        const float combinedArea = combined.SurfaceArea();
+        // The cost of making a new parent for the node and the leaf here, and the cost pushed down to the children.
+        const float cost = 2.f * combinedArea;
+        const float inheritedCost = 2.f * (combinedArea - node.box.SurfaceArea());
+
+        AABB left = nodes[node.left].box;
+        left.Enclose(leafBox);
+        const float leftCost = left.SurfaceArea() + inheritedCost - (nodes[node.left].IsLeaf() ? 0.f : nodes[node.left].box.SurfaceArea());
+        AABB right = nodes[node.right].box;
+        right.Enclose(leafBox);
+        const float rightCost = right.SurfaceArea() + inheritedCost - (nodes[node.right].IsLeaf() ? 0.f : nodes[node.right].box.SurfaceArea());
+
+        if (cost < leftCost && cost < rightCost)
+            break;
+        sibling = leftCost < rightCost ? node.left : node.right;
+    }
+
+    const int oldParent = nodes[sibling].parent;
+    const int newParent = AllocateNode();
+    nodes[newParent].parent = oldParent;
+    nodes[newParent].left = sibling;
+    nodes[newParent].right = leaf;
+    nodes[sibling].parent = newParent;
+    nodes[leaf].parent = newParent;
+    if (oldParent == -1)
+        root = newParent;
+    else if (nodes[oldParent].left == sibling)
+        nodes[oldParent].left = newParent;
+    else
+        nodes[oldParent].right = newParent;
+    RefitAncestors(newParent);
+}
+
+template<typename T>
+void DynamicAABBTree<T>::RemoveLeaf(int leaf)
+{
+    if (leaf == root)
+    {
+        root = -1;
+        FreeNode(leaf);
+        return;
+    }
+
+    // Replace the parent with the sibling of the leaf.
+    const int parent = nodes[leaf].parent;
+    const int grandParent = nodes[parent].parent;
+    const int sibling = nodes[parent].left == leaf ? nodes[parent].right : nodes[parent].left;
+    nodes[sibling].parent = grandParent;
+    if (grandParent == -1)
+        root = sibling;
+    else
+    {
+        if (nodes[grandParent].left == parent)
+            nodes[grandParent].left = sibling;
+        else
+            nodes[grandParent].right = sibling;
+        RefitAncestors(grandParent);
+    }
+    FreeNode(parent);
+    FreeNode(leaf);
+}
+
+template<typename T>
+void DynamicAABBTree<T>::RefitAncestors(int index)
+{
+    while(index != -1)
+    {
+        DynamicAABBTreeNode &node = nodes[index];
+        node.box = nodes[node.left].box;
+        node.box.Enclose(nodes[node.right].box);
+        index = node.parent;
+    }
+}
+
+MATH_END_NAMESPACE
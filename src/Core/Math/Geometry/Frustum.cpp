@@ -34,6 +34,7 @@
 #include "Math/float4.h"
 #include "Math/Quat.h"
 #include "Algorithm/Random/LCG.h"
+#include "Math/SIMDKernels.h"
 
 #ifdef MATH_ENABLE_STL_SUPPORT
 #include <iostream>
@@ -627,6 +628,26 @@ bool Frustum::Intersects(const AABB &aabb) const
 	return this->ToPolyhedron().Intersects(aabb);
 }
 
+void Frustum::BatchIntersects(const AABB *aabbArray, int numAABBs, u32 *visibleMask) const
+{
+	assume(aabbArray || numAABBs == 0);
+	assume(visibleMask || numAABBs == 0);
+#ifndef MATH_ENABLE_INSECURE_OPTIMIZATIONS
+	if (!aabbArray || !visibleMask || numAABBs <= 0)
+		return;
+#endif
+	float planes[6*4];
+	for(int i = 0; i < 6; ++i)
+	{
+		const Plane plane = GetPlane(i);
+		planes[4*i] = plane.normal.x;
+		planes[4*i+1] = plane.normal.y;
+		planes[4*i+2] = plane.normal.z;
+		planes[4*i+3] = plane.d;
+	}
+	ActiveSIMDKernels().cullAABBs(planes, 6, aabbArray[0].minPoint.ptr(), numAABBs, sizeof(AABB), visibleMask);
+}
+
 bool Frustum::Intersects(const OBB &obb) const
 {
 	///@todo This is a naive test. Implement a faster version.
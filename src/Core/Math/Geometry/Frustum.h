@@ -411,6 +411,13 @@ public:
 	bool Intersects(const Frustum &frustum) const;
 	bool Intersects(const Polyhedron &polyhedron) const;
 
+	/// Tests an array of AABBs against the planes of this Frustum in a batch, with SSE or AVX where available.
+	/** Sets bit i%32 of visibleMask[i/32] if aabbArray[i] is not wholly outside any of the six planes, and clears the
+		rest of the bits of the (numAABBs+31)/32 words. Unlike Intersects(const AABB &), the test is conservative: a box
+		near an edge or a corner of this Frustum can pass even if it is outside, which is fine for culling.
+		@see Intersects(). */
+	void BatchIntersects(const AABB *aabbArray, int numAABBs, u32 *visibleMask) const;
+
 #if defined(MATH_TINYXML_INTEROP) && defined(MATH_CONTAINERLIB_SUPPORT)
 	void DeserializeFromXml(TiXmlElement *e);
 #endif
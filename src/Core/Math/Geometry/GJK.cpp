@@ -0,0 +1,531 @@
+/**
+    For conditions of distribution and use, see copyright notice in LICENSE
+
+    @file   GJK.cpp
+    @brief  GJK intersection and distance, and EPA penetration, between any two convex objects. */
+
+#include "Geometry/GJK.h"
+#include "Math/MathFunc.h"
+
+#include <vector>
+#include <utility>
+
+MATH_BEGIN_NAMESPACE
+
+namespace
+{
+
+/// A vertex of the Minkowski difference a - b, with the support points of a and b it came from.
+struct SupportPoint
+{
+    float3 w, a, b;
+};
+
+SupportPoint Support(const ConvexSupport &a, const ConvexSupport &b, const float3 &direction)
+{
+    // Near contact the directions get short, which f.ex. Sphere::ExtremePoint would take for zero.
+    const float3 unitDirection = direction / direction.Length();
+    SupportPoint p;
+    p.a = a.ExtremePoint(unitDirection);
+    p.b = b.ExtremePoint(-unitDirection);
+    p.w = p.a - p.b;
+    return p;
+}
+
+/// The GJK iterations are few when the support functions are exact, this only bounds the numerical stragglers.
+const int cMaxGJKIterations = 64;
+/// The relative improvement of the squared distance under which GJK has converged.
+const float cGJKRelativeEpsilon = 1e-6f;
+/// The squared distance, relative to the squared size of the simplex, under which the origin touches it.
+const float cGJKTouchEpsilon = 1e-10f;
+
+/// Simplex of 1-4 vertices, with the barycentric weights of the point of it closest to the origin.
+struct Simplex
+{
+    SupportPoint v[4];
+    float lambda[4];
+    int n;
+
+    /// Keeps the given vertices, with their weights.
+    void Keep1(int i)
+    {
+        v[0] = v[i];
+        lambda[0] = 1.f;
+        n = 1;
+    }
+
+    void Keep2(int i, int j, float li, float lj)
+    {
+        SupportPoint vi = v[i], vj = v[j];
+        v[0] = vi; v[1] = vj;
+        lambda[0] = li; lambda[1] = lj;
+        n = 2;
+    }
+
+    void Keep3(int i, int j, int k, float li, float lj, float lk)
+    {
+        SupportPoint vi = v[i], vj = v[j], vk = v[k];
+        v[0] = vi; v[1] = vj; v[2] = vk;
+        lambda[0] = li; lambda[1] = lj; lambda[2] = lk;
+        n = 3;
+    }
+
+    float3 ClosestPoint() const
+    {
+        float3 p = float3::zero;
+        for(int i = 0; i < n; ++i)
+            p += lambda[i] * v[i].w;
+        return p;
+    }
+
+    void ClosestPoints(float3 &outA, float3 &outB) const
+    {
+        outA = outB = float3::zero;
+        for(int i = 0; i < n; ++i)
+        {
+            outA += lambda[i] * v[i].a;
+            outB += lambda[i] * v[i].b;
+        }
+    }
+
+    float MaxLengthSq() const
+    {
+        float m = 0.f;
+        for(int i = 0; i < n; ++i)
+            m = Max(m, v[i].w.LengthSq());
+        return m;
+    }
+
+    bool Contains(const float3 &w) const
+    {
+        for(int i = 0; i < n; ++i)
+            if (v[i].w.x == w.x && v[i].w.y == w.y && v[i].w.z == w.z)
+                return true;
+        return false;
+    }
+};
+
+/// Reduces the segment v[i], v[j] to the smallest sub-simplex that holds its point closest to the origin.
+void ReduceSegment(Simplex &s, int i, int j)
+{
+    const float3 ab = s.v[j].w - s.v[i].w;
+    const float lengthSq = ab.LengthSq();
+    const float t = lengthSq > 0.f ? -Dot(s.v[i].w, ab) / lengthSq : 0.f;
+    if (t <= 0.f)
+        s.Keep1(i);
+    else if (t >= 1.f)
+        s.Keep1(j);
+    else
+        s.Keep2(i, j, 1.f - t, t);
+}
+
+/// Reduces the triangle v[i], v[j], v[k] the same way, with the Voronoi region tests of Christer Ericson's
+/// Real-Time Collision Detection, p. 141, for the point at the origin.
+void ReduceTriangle(Simplex &s, int i, int j, int k)
+{
+    const float3 a = s.v[i].w, b = s.v[j].w, c = s.v[k].w;
+    const float3 ab = b - a, ac = c - a;
+    const float d1 = -Dot(ab, a), d2 = -Dot(ac, a);
+    if (d1 <= 0.f && d2 <= 0.f)
+        return s.Keep1(i);
+    const float d3 = -Dot(ab, b), d4 = -Dot(ac, b);
+    if (d3 >= 0.f && d4 <= d3)
+        return s.Keep1(j);
+    const float vc = d1*d4 - d3*d2;
+    if (vc <= 0.f && d1 >= 0.f && d3 <= 0.f)
+    {
+        const float t = d1 / (d1 - d3);
+        return s.Keep2(i, j, 1.f - t, t);
+    }
+    const float d5 = -Dot(ab, c), d6 = -Dot(ac, c);
+    if (d6 >= 0.f && d5 <= d6)
+        return s.Keep1(k);
+    const float vb = d5*d2 - d1*d6;
+    if (vb <= 0.f && d2 >= 0.f && d6 <= 0.f)
+    {
+        const float t = d2 / (d2 - d6);
+        return s.Keep2(i, k, 1.f - t, t);
+    }
+    const float va = d3*d6 - d5*d4;
+    if (va <= 0.f && d4 - d3 >= 0.f && d5 - d6 >= 0.f)
+    {
+        const float t = (d4 - d3) / ((d4 - d3) + (d5 - d6));
+        return s.Keep2(j, k, 1.f - t, t);
+    }
+    const float sum = va + vb + vc;
+    if (!(sum > 0.f)) // A degenerate triangle, whose face region is empty.
+    {
+        Simplex best = s, edge = s;
+        ReduceSegment(best, i, j);
+        ReduceSegment(edge, j, k);
+        if (edge.ClosestPoint().LengthSq() < best.ClosestPoint().LengthSq())
+            best = edge;
+        edge = s;
+        ReduceSegment(edge, i, k);
+        if (edge.ClosestPoint().LengthSq() < best.ClosestPoint().LengthSq())
+            best = edge;
+        s = best;
+        return;
+    }
+    const float v = vb / sum, w = vc / sum;
+    s.Keep3(i, j, k, 1.f - v - w, v, w);
+}
+
+/// Reduces the tetrahedron of the simplex the same way, after Real-Time Collision Detection, p. 144.
+/// Returns false, and leaves the simplex as it is, if the origin is inside the tetrahedron.
+bool ReduceTetrahedron(Simplex &s)
+{
+    static const int faces[4][4] = { { 0, 1, 2, 3 }, { 0, 2, 3, 1 }, { 0, 3, 1, 2 }, { 1, 3, 2, 0 } }; // Face, and the vertex opposite.
+    Simplex best = s;
+    float bestDistSq = FLOAT_INF;
+    for(int f = 0; f < 4; ++f)
+    {
+        const float3 a = s.v[faces[f][0]].w;
+        const float3 normal = Cross(s.v[faces[f][1]].w - a, s.v[faces[f][2]].w - a);
+        const float signOrigin = -Dot(a, normal);
+        const float3 toOpposite = s.v[faces[f][3]].w - a;
+        const float signOpposite = Dot(toOpposite, normal);
+        // In a (nearly) flat tetrahedron the sides of the faces tell nothing, so all its faces are candidates.
+        const bool flat = Abs(signOpposite) <= 1e-4f * normal.Length() * toOpposite.Length();
+        if (!flat && signOrigin * signOpposite >= 0.f)
+            continue;
+        Simplex face = s;
+        ReduceTriangle(face, faces[f][0], faces[f][1], faces[f][2]);
+        const float distSq = face.ClosestPoint().LengthSq();
+        if (distSq < bestDistSq)
+        {
+            best = face;
+            bestDistSq = distSq;
+        }
+    }
+    if (bestDistSq == FLOAT_INF)
+        return false;
+    s = best;
+    return true;
+}
+
+enum GJKOutcome
+{
+    GJKSeparate,
+    GJKIntersecting
+};
+
+/// Runs GJK on a - b. With earlyOut, returns as soon as a separating axis is found, and the simplex is then not the
+/// closest one. Otherwise on separation the simplex holds the closest points, and on intersection it encloses or
+/// touches the origin.
+GJKOutcome RunGJK(const ConvexSupport &a, const ConvexSupport &b, bool earlyOut, Simplex &s)
+{
+    s.v[0] = Support(a, b, float3::unitX);
+    s.lambda[0] = 1.f;
+    s.n = 1;
+    float3 v = s.v[0].w;
+    for(int iter = 0; iter < cMaxGJKIterations; ++iter)
+    {
+        const float vLengthSq = v.LengthSq();
+        if (vLengthSq <= cGJKTouchEpsilon * s.MaxLengthSq())
+            return GJKIntersecting;
+        const SupportPoint w = Support(a, b, -v);
+        const float vw = Dot(v, w.w);
+        if (earlyOut && vw > 0.f)
+            return GJKSeparate; // -v is a separating axis.
+        if (vLengthSq - vw <= cGJKRelativeEpsilon * vLengthSq || s.Contains(w.w))
+            return GJKSeparate; // No more progress towards the origin.
+
+        const Simplex previous = s;
+        s.v[s.n++] = w;
+        if (s.n == 2)
+            ReduceSegment(s, 0, 1);
+        else if (s.n == 3)
+            ReduceTriangle(s, 0, 1, 2);
+        else if (!ReduceTetrahedron(s))
+            return GJKIntersecting;
+
+        const float3 newV = s.ClosestPoint();
+        if (newV.LengthSq() >= vLengthSq)
+        {
+            // Rounding stalled the descent, f.ex. in a nearly flat tetrahedron, so v is as close as it gets.
+            s = previous;
+            return GJKSeparate;
+        }
+        v = newV;
+    }
+    return GJKSeparate;
+}
+
+/// Polytopes converge in a few iterations, but a curved object like a Sphere takes more, and the rest are cut off.
+const int cMaxEPAIterations = 128;
+/// The relative distance of the next support point beyond the closest face under which EPA has converged.
+const float cEPARelativeEpsilon = 1e-4f;
+/// The distance of the new support point from the plane of a face, relative to the size of the polytope, under which
+/// the face counts as seen by the point. Removing the nearly coplanar faces keeps the point from forming a degenerate
+/// face with a horizon edge it is collinear with, as with the corners of boxes.
+const float cEPACoplanarEpsilon = 1e-5f;
+
+struct EPAFace
+{
+    int v[3];
+    float3 normal; ///< The outward unit normal.
+    float distance; ///< The distance of the plane of the face from the origin.
+};
+
+/// Makes the face of the vertices i, j and k, wound so that its normal points away from the interior point.
+/// Returns false for a degenerate face.
+bool MakeFace(const std::vector<SupportPoint> &vertices, int i, int j, int k, const float3 &interior, EPAFace &face)
+{
+    const float3 a = vertices[i].w;
+    float3 normal = Cross(vertices[j].w - a, vertices[k].w - a);
+    if (normal.Normalize() == 0.f)
+        return false;
+    face.v[0] = i;
+    if (Dot(normal, a - interior) < 0.f)
+    {
+        normal = -normal;
+        face.v[1] = k;
+        face.v[2] = j;
+    }
+    else
+    {
+        face.v[1] = j;
+        face.v[2] = k;
+    }
+    face.normal = normal;
+    face.distance = Dot(normal, a);
+    return true;
+}
+
+/// Grows the simplex GJK stopped with, whose hull holds the origin, to a tetrahedron that still holds it.
+/// Returns false if a - b is flat, and no such tetrahedron exists.
+bool BlowUpSimplex(const ConvexSupport &a, const ConvexSupport &b, Simplex &s)
+{
+    static const float3 axes[6] = { float3::unitX, -float3::unitX, float3::unitY, -float3::unitY, float3::unitZ, -float3::unitZ };
+    const float epsilonSq = 1e-10f * Max(1.f, s.MaxLengthSq());
+    if (s.n == 1)
+        for(int i = 0; i < 6 && s.n == 1; ++i)
+        {
+            const SupportPoint p = Support(a, b, axes[i]);
+            if ((p.w - s.v[0].w).LengthSq() > epsilonSq)
+                s.v[s.n++] = p;
+        }
+    if (s.n == 2)
+    {
+        // Try directions perpendicular to the segment, 60 degrees apart.
+        const float3 d = (s.v[1].w - s.v[0].w).Normalized();
+        const float3 perp = d.Perpendicular(), perp2 = Cross(d, perp);
+        for(int i = 0; i < 6 && s.n == 2; ++i)
+        {
+            const float angle = i * pi / 3.f;
+            const SupportPoint p = Support(a, b, Cos(angle) * perp + Sin(angle) * perp2);
+            if (Cross(p.w - s.v[0].w, d).LengthSq() > epsilonSq)
+                s.v[s.n++] = p;
+        }
+    }
+    if (s.n == 3)
+    {
+        float3 normal = Cross(s.v[1].w - s.v[0].w, s.v[2].w - s.v[0].w);
+        if (normal.Normalize() == 0.f)
+            return false;
+        SupportPoint p = Support(a, b, normal);
+        if (Abs(Dot(p.w - s.v[0].w, normal)) <= 1e-5f * Sqrt(Max(1.f, s.MaxLengthSq())))
+            p = Support(a, b, -normal);
+        if (Abs(Dot(p.w - s.v[0].w, normal)) <= 1e-5f * Sqrt(Max(1.f, s.MaxLengthSq())))
+            return false;
+        s.v[s.n++] = p;
+    }
+    return s.n == 4;
+}
+
+} // ~unnamed namespace
+
+bool GJKIntersect(const ConvexSupport &a, const ConvexSupport &b)
+{
+    Simplex s;
+    return RunGJK(a, b, true, s) == GJKIntersecting;
+}
+
+float GJKDistance(const ConvexSupport &a, const ConvexSupport &b, float3 *outClosestPointA, float3 *outClosestPointB)
+{
+    Simplex s;
+    if (RunGJK(a, b, false, s) == GJKIntersecting)
+        return 0.f;
+    float3 pointA, pointB;
+    s.ClosestPoints(pointA, pointB);
+    if (outClosestPointA)
+        *outClosestPointA = pointA;
+    if (outClosestPointB)
+        *outClosestPointB = pointB;
+    return pointA.Distance(pointB);
+}
+
+bool EPAPenetration(const ConvexSupport &a, const ConvexSupport &b, float3 &outNormal, float &outDepth, float3 *outPointA, float3 *outPointB)
+{
+    Simplex s;
+    if (RunGJK(a, b, true, s) != GJKIntersecting)
+        return false;
+
+    const Simplex touching = s;
+    if (!BlowUpSimplex(a, b, s))
+    {
+        // Flat, so the objects overlap only in a plane or a line, and separate with no movement.
+        float3 pointA, pointB;
+        touching.ClosestPoints(pointA, pointB);
+        outNormal = float3::unitX;
+        if (s.n == 3)
+        {
+            outNormal = Cross(s.v[1].w - s.v[0].w, s.v[2].w - s.v[0].w);
+            if (outNormal.Normalize() == 0.f)
+                outNormal = float3::unitX;
+        }
+        outDepth = 0.f;
+        if (outPointA)
+            *outPointA = pointA;
+        if (outPointB)
+            *outPointB = pointB;
+        return true;
+    }
+
+    std::vector<SupportPoint> vertices(s.v, s.v + 4);
+    const float3 interior = (s.v[0].w + s.v[1].w + s.v[2].w + s.v[3].w) * 0.25f;
+    std::vector<EPAFace> faces;
+    static const int tetraFaces[4][3] = { { 0, 1, 2 }, { 0, 2, 3 }, { 0, 3, 1 }, { 1, 3, 2 } };
+    for(int i = 0; i < 4; ++i)
+    {
+        EPAFace face;
+        if (!MakeFace(vertices, tetraFaces[i][0], tetraFaces[i][1], tetraFaces[i][2], interior, face))
+            return false; // BlowUpSimplex made sure the tetrahedron is not flat.
+        faces.push_back(face);
+    }
+
+    std::vector<std::pair<int, int> > horizon;
+    std::vector<size_t> removed;
+    std::vector<char> isRemoved;
+    EPAFace closest = faces[0];
+    bool converged = false;
+    // The support point of the face normals with the least support distance so far. As a - b lies behind the plane
+    // of the normal through the point, the distance is an upper bound of the depth, for when EPA does not converge.
+    SupportPoint bestSupport = s.v[0];
+    float3 bestNormal = closest.normal;
+    float bestDistance = FLOAT_INF;
+    float size = 0.f;
+    for(int i = 0; i < 4; ++i)
+        size = Max(size, vertices[i].w.Length());
+    for(int iter = 0; iter < cMaxEPAIterations; ++iter)
+    {
+        size_t closestIndex = 0;
+        for(size_t i = 1; i < faces.size(); ++i)
+            if (faces[i].distance < faces[closestIndex].distance)
+                closestIndex = i;
+        closest = faces[closestIndex];
+
+        const SupportPoint w = Support(a, b, closest.normal);
+        const float wDistance = Dot(w.w, closest.normal);
+        if (wDistance < bestDistance)
+        {
+            bestSupport = w;
+            bestNormal = closest.normal;
+            bestDistance = wDistance;
+        }
+        if (wDistance - closest.distance <= cEPARelativeEpsilon * Max(wDistance, 1e-3f))
+        {
+            converged = true;
+            break;
+        }
+
+        // Remove the faces the new vertex sees, and patch the hole with faces from its horizon to the vertex.
+        const int newVertex = (int)vertices.size();
+        vertices.push_back(w);
+        size = Max(size, w.w.Length());
+        const float coplanarEpsilon = cEPACoplanarEpsilon * size;
+        // Only the faces connected to the closest one through seen faces go, so that the hole stays a single patch
+        // even when a nearly coplanar face elsewhere on the polytope counts as seen.
+        removed.assign(1, closestIndex);
+        isRemoved.assign(faces.size(), 0);
+        isRemoved[closestIndex] = 1;
+        for(size_t r = 0; r < removed.size(); ++r)
+        {
+            const EPAFace &face = faces[removed[r]];
+            for(size_t i = 0; i < faces.size(); ++i)
+            {
+                if (isRemoved[i] || Dot(faces[i].normal, w.w - vertices[faces[i].v[0]].w) <= -coplanarEpsilon)
+                    continue;
+                bool adjacent = false;
+                for(int e = 0; e < 3 && !adjacent; ++e)
+                    for(int f = 0; f < 3 && !adjacent; ++f)
+                        adjacent = faces[i].v[e] == face.v[(f+1)%3] && faces[i].v[(e+1)%3] == face.v[f];
+                if (adjacent)
+                {
+                    isRemoved[i] = 1;
+                    removed.push_back(i);
+                }
+            }
+        }
+
+        horizon.clear();
+        for(size_t i = 0; i < removed.size(); ++i)
+        {
+            const EPAFace &face = faces[removed[i]];
+            for(int e = 0; e < 3; ++e)
+            {
+                const std::pair<int, int> edge(face.v[e], face.v[(e+1)%3]);
+                const std::pair<int, int> reverse(edge.second, edge.first);
+                size_t j = 0;
+                while(j < horizon.size() && horizon[j] != reverse)
+                    ++j;
+                if (j < horizon.size())
+                {
+                    horizon[j] = horizon.back();
+                    horizon.pop_back();
+                }
+                else
+                    horizon.push_back(edge);
+            }
+        }
+        size_t kept = 0;
+        for(size_t i = 0; i < faces.size(); ++i)
+            if (!isRemoved[i])
+                faces[kept++] = faces[i];
+        faces.resize(kept);
+
+        bool degenerate = false;
+        for(size_t i = 0; i < horizon.size(); ++i)
+        {
+            EPAFace face;
+            if (MakeFace(vertices, horizon[i].first, horizon[i].second, newVertex, interior, face))
+                faces.push_back(face);
+            else
+                degenerate = true;
+        }
+        if (degenerate || faces.size() < 4)
+            break; // Rounding broke the hull.
+    }
+
+    if (!converged)
+    {
+        // The closest face is not the answer, so separate along the normal of the least support distance found.
+        outNormal = bestNormal;
+        outDepth = Max(bestDistance, 0.f);
+        if (outPointA)
+            *outPointA = bestSupport.a;
+        if (outPointB)
+            *outPointB = bestSupport.a - outDepth * bestNormal;
+        return true;
+    }
+
+    // The point of the closest face nearest the origin, in barycentric coordinates of the face.
+    Simplex face;
+    for(int i = 0; i < 3; ++i)
+        face.v[i] = vertices[closest.v[i]];
+    face.n = 3;
+    ReduceTriangle(face, 0, 1, 2);
+    float3 pointA, pointB;
+    face.ClosestPoints(pointA, pointB);
+
+    outNormal = closest.normal;
+    outDepth = Max(closest.distance, 0.f);
+    if (outPointA)
+        *outPointA = pointA;
+    if (outPointB)
+        *outPointB = pointB;
+    return true;
+}
+
+MATH_END_NAMESPACE
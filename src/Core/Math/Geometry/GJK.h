@@ -0,0 +1,91 @@
+/**
+    For conditions of distribution and use, see copyright notice in LICENSE
+
+    @file   GJK.h
+    @brief  GJK intersection and distance, and EPA penetration, between any two convex objects. */
+
+#pragma once
+
+#include "Types.h"
+#include "Math/float3.h"
+#include "assume.h"
+
+MATH_BEGIN_NAMESPACE
+
+/// A convex object given by its support function, for the GJK and EPA queries.
+/** Converts implicitly from any object with a member float3 ExtremePoint(const float3 &direction) const, which returns
+    the point of the object that is farthest along the direction, not necessarily normalized. AABB, OBB, Sphere, Capsule,
+    LineSegment, Triangle, Polygon, Frustum and a convex Polyhedron all have one. Refers to the object without copying it,
+    so the object must outlive this. */
+class ConvexSupport
+{
+public:
+    typedef float3 (*SupportFunc)(const void *object, const float3 &direction);
+
+    template<typename T>
+    ConvexSupport(const T &object) : object_(&object), support_(&ExtremePointOf<T>) {}
+
+    ConvexSupport(const void *object, SupportFunc support) : object_(object), support_(support) {}
+
+    float3 ExtremePoint(const float3 &direction) const { return support_(object_, direction); }
+
+private:
+    template<typename T>
+    static float3 ExtremePointOf(const void *object, const float3 &direction)
+    {
+        return static_cast<const T*>(object)->ExtremePoint(direction);
+    }
+
+    const void *object_;
+    SupportFunc support_;
+};
+
+/// Tests whether the two convex objects intersect, touching included.
+/** Runs GJK over the Minkowski difference a - b, and stops as soon as it finds a separating axis, so separate objects
+    cost less than a distance query. The cost is linear in the cost of the support functions, f.ex. in the number of
+    vertices of a Polyhedron, and usually takes a handful of iterations.
+    @see GJKDistance(), EPAPenetration(). */
+bool GJKIntersect(const ConvexSupport &a, const ConvexSupport &b);
+
+/// Returns the distance between the two convex objects, or 0 if they intersect.
+/** @param outClosestPointA [out] If not null, receives the point of a closest to b. Not set if the objects intersect.
+    @param outClosestPointB [out] If not null, receives the point of b closest to a. Not set if the objects intersect.
+    @see GJKIntersect(), EPAPenetration(). */
+float GJKDistance(const ConvexSupport &a, const ConvexSupport &b, float3 *outClosestPointA = 0, float3 *outClosestPointB = 0);
+
+/// Computes the penetration of two intersecting convex objects with EPA, the expanding polytope algorithm.
+/** Returns false, and sets nothing, if the objects are separate.
+    @param outNormal [out] The unit direction, pointing from a towards b, along which b moves the least to separate from a.
+    @param outDepth [out] The distance b must move along outNormal to only touch a. Objects that are flat along the
+        normal, f.ex. two overlapping coplanar triangles, get a depth of 0.
+    @param outPointA [out] If not null, receives the point of a deepest inside b.
+    @param outPointB [out] If not null, receives the point of b deepest inside a, outPointA - outDepth*outNormal.
+    @see GJKIntersect(), GJKDistance(). */
+bool EPAPenetration(const ConvexSupport &a, const ConvexSupport &b, float3 &outNormal, float &outDepth, float3 *outPointA = 0, float3 *outPointB = 0);
+
+/// Tests the convex object a against each of an array of convex objects.
+/** Sets bit i%32 of intersectMask[i/32] if a intersects objects[i], as GJKIntersect does, and clears the rest of the
+    bits of the (numObjects+31)/32 words. */
+template<typename A, typename B>
+void GJKIntersect(const A &a, const B *objects, int numObjects, u32 *intersectMask)
+{
+    assume(objects || numObjects == 0);
+    const ConvexSupport supportA(a);
+    for(int i = 0; i < (numObjects + 31) / 32; ++i)
+        intersectMask[i] = 0;
+    for(int i = 0; i < numObjects; ++i)
+        if (GJKIntersect(supportA, objects[i]))
+            intersectMask[i >> 5] |= 1u << (i & 31);
+}
+
+/// Computes the distance of the convex object a to each of an array of convex objects, as GJKDistance does.
+template<typename A, typename B>
+void GJKDistance(const A &a, const B *objects, int numObjects, float *outDistances)
+{
+    assume(objects || numObjects == 0);
+    const ConvexSupport supportA(a);
+    for(int i = 0; i < numObjects; ++i)
+        outDistances[i] = GJKDistance(supportA, objects[i]);
+}
+
+MATH_END_NAMESPACE
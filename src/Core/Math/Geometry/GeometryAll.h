@@ -26,6 +26,7 @@
 #include "Capsule.h"
 #include "Circle.h"
 #include "Frustum.h"
+#include "GJK.h"
 #include "GeometryAll.h"
 #include "HitInfo.h"
 #include "KdTree.h"
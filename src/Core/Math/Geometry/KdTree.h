@@ -20,6 +20,7 @@
 #include "Types.h"
 #include "Triangle.h"
 #include "Math/MathConstants.h"
+#include "Math/SIMDKernels.h"
 #include "myassert.h"
 
 #ifdef MATH_CONTAINERLIB_SUPPORT
@@ -29,6 +30,9 @@
 #include "AABB.h"
 #include "Ray.h"
 
+#include <vector>
+#include <deque>
+
 MATH_BEGIN_NAMESPACE
 
 enum CardinalAxis
@@ -87,13 +91,43 @@ public:
 
 	/// Creates the kD-tree data structure based on all the objects added to the tree.
 	/// After Build() has been called, do *not* call AddObjects() again.
+	/** The splits are chosen with the binned surface area heuristic (SAH), which places them to cut off empty space
+		and to minimize the expected cost of a ray query. Equal to BeginBuild(1), RunBuildTask(0) and EndBuild(). */
 	void Build();
 
+	/// Starts a build that can be run in several threads at once. Builds the top levels of the tree in the calling
+	/// thread until there are numTasks subtrees left to build, or the whole tree is built.
+	/** Then call RunBuildTask for each index up to NumBuildTasks(), in any threads, and finally EndBuild(). */
+	void BeginBuild(int numTasks);
+
+	/// Returns the number of the subtrees left for RunBuildTask after BeginBuild.
+	int NumBuildTasks() const { return (int)buildTasks.size(); }
+
+	/// Builds a subtree of the build started with BeginBuild. Can be called for different indices in several threads
+	/// at once, as it only reads the objects and writes to the subtree. Do not call any other member meanwhile.
+	void RunBuildTask(int taskIndex);
+
+	/// Links the subtrees built in RunBuildTask to the top levels of the tree, copying them to the flat node array
+	/// depth-first, so that the nodes of a subtree stay next to each other in memory.
+	void EndBuild();
+
 	/// Empties the whole kD-tree of all objects.
 	/// Call this function if you want to reuse this structure for rebuilding another kD-tree, after first
 	/// having called AddObjects/Build to build a previous tree.
 	void Clear();
 
+	/// Exchanges the contents of this kD-tree with another one.
+	void Swap(KdTree &other);
+
+	/// Appends the objects and the built tree structure to the given byte array, so that the tree can be restored with
+	/// Deserialize() without calling Build() again. T must be copyable as raw bytes. The format is specific to the
+	/// platform and the compiler, so use it for local caching only.
+	void Serialize(std::vector<u8> &dst) const;
+
+	/// Replaces the contents of this kD-tree with a tree that was serialized with Serialize().
+	/// Returns false, and leaves this tree empty, if the data is truncated or was not produced on the same platform.
+	bool Deserialize(const u8 *data, size_t numBytes);
+
 	/// Returns an object bucket by the given bucket index.
 	/// An object bucket is a contiguous C array of object indices, terminated with a sentinel value BUCKET_SENTINEL.
 	/// To fetch the actual object based on an object index, call the Object() method.
@@ -145,6 +179,24 @@ public:
 	template<typename Func>
 	inline void RayQuery(const Ray &r, Func &leafCallback);
 
+	/// The maximum number of the rays of RayPacketQuery.
+	static const int maxRayPacketSize = 32;
+
+	/// Traverses a packet of rays through this kD-tree at once, and calls the given leafCallback function for each
+	/// nonempty leaf with the rays of the packet that pass through it.
+	/** The rays are grouped by the signs of their directions, and each group descends the tree together, so a node
+		is visited once for all the rays that reach it. Each ray sees its leaves in the front-to-back order, as in
+		RayQuery. The more coherent the rays, f.ex. the ones from one point into nearby directions, the fewer nodes
+		and leaves there are per ray.
+		@param rays The rays to query through this kD-tree, at most maxRayPacketSize of them.
+		@param leafCallback A function or a function object of prototype
+			u32 LeafCallbackFunction(KdTree<T> &tree, const KdTreeNode &leaf, const Ray *rays, u32 activeRays, const float *tNear, const float *tFar);
+			where bit i of activeRays is set for each ray i that passes through the leaf, and tNear[i] and tFar[i]
+			are the distances along the ray where it enters and leaves the leaf. Return the mask of the rays
+			that need not visit any farther leaves. The query stops when all of the rays are done. */
+	template<typename Func>
+	inline void RayPacketQuery(const Ray *rays, int numRays, Func &leafCallback);
+
 	/// Performs an AABB intersection query in this kD-tree, and calls the given leafCallback function for each leaf
 	/// of the tree which intersects the given AABB.
 	/** @param aabb The axis-aligned bounding box to query through this kD-tree.
@@ -187,13 +239,40 @@ private:
 	std::vector<T> objects;
 	std::vector<u32*> buckets;
 
-	int AllocateNodePair();
+	/// A subtree of a build in progress, see BeginBuild.
+	struct BuildTask
+	{
+		int node; ///< The leaf of the top levels the subtree replaces.
+		int depth; ///< The depth of the leaf.
+		AABB cell; ///< The region of the space of the leaf.
+		std::vector<u32> objects; ///< The objects that overlap the cell.
+		std::vector<KdTreeNode> nodes; ///< The nodes of the subtree, the root first and then in pairs.
+		std::vector<u32*> buckets; ///< The buckets of the subtree, with a null bucket at index 0.
+	};
+
+	std::deque<BuildTask> buildTasks;
+	std::vector<AABB> objectAABBs; ///< The bounding AABBs of the objects during a build.
+
+	static int AllocateNodePair(std::vector<KdTreeNode> &dstNodes);
 
 	void FreeBuckets();
 
 	AABB BoundingAABB(const u32 *bucket) const;
 
-	void SplitLeaf(int nodeIndex, const AABB &nodeAABB, int numObjectsInBucket, int leafDepth);
+	/// Finds the split of the cell of the least SAH cost. Returns false if a leaf costs less than any split.
+	bool FindSplit(const AABB &cell, const std::vector<u32> &cellObjects, int &splitAxis, float &splitPos) const;
+
+	/// Sorts the objects of a cell to the sides of the split, and shrinks the cells of the children to their objects.
+	void SplitObjects(const AABB &cell, const std::vector<u32> &cellObjects, int splitAxis, float splitPos,
+		std::vector<u32> &leftObjects, std::vector<u32> &rightObjects, AABB &leftCell, AABB &rightCell) const;
+
+	/// Turns the node to a leaf of the objects, adding a bucket for them. An empty leaf gets no bucket.
+	static void MakeLeaf(KdTreeNode &node, std::vector<u32*> &dstBuckets, const std::vector<u32> &leafObjects);
+
+	/// Builds the subtree of the cell to the given node, adding the nodes and buckets to the given arrays.
+	/// Consumes cellObjects. Only reads the members, so can run in several threads at once.
+	void BuildSubtree(std::vector<KdTreeNode> &dstNodes, std::vector<u32*> &dstBuckets, int nodeIndex, const AABB &cell,
+		std::vector<u32> &cellObjects, int depth) const;
 
 	///\todo Implement support for deep copying.
 	KdTree(const KdTree &);
@@ -225,6 +304,8 @@ struct TriangleKdTreeRayQueryNearestHitVisitor
 	}
 	bool operator()(KdTree<Triangle> &tree, const KdTreeNode &leaf, const Ray &ray, float tNear, float tFar)
 	{
+		if (leaf.IsEmptyLeaf())
+			return false;
 		u32 *bucket = tree.Bucket(leaf.bucketIndex);
 		assert(bucket);
 		while(*bucket != KdTree<Triangle>::BUCKET_SENTINEL)
@@ -246,6 +327,96 @@ struct TriangleKdTreeRayQueryNearestHitVisitor
 	}
 };
 
+/// Finds the nearest hits of a packet of rays to a KdTree<Triangle>, see KdTree::RayPacketQuery.
+/** Tests each triangle of a leaf against all the rays through the leaf at once with the SIMD kernel
+	SIMDKernels::intersectTriangleRays. */
+struct TriangleKdTreeRayPacketNearestHitVisitor
+{
+	static const int maxRays = KdTree<Triangle>::maxRayPacketSize;
+
+	int numRays;
+	float rayT[maxRays]; ///< The distance to the nearest hit of each ray, or FLOAT_INF.
+	u32 triangleIndex[maxRays]; ///< The triangle of the nearest hit of each ray, or BUCKET_SENTINEL.
+	float barycentricU[maxRays];
+	float barycentricV[maxRays];
+
+	/// Prepares the visitor for a query of the given rays, at most maxRays of them.
+	TriangleKdTreeRayPacketNearestHitVisitor(const Ray *rays, int numRays_)
+	:numRays(numRays_)
+	{
+		assert(numRays <= maxRays);
+		for(int i = 0; i < numRays; ++i)
+		{
+			rayT[i] = FLOAT_INF;
+			triangleIndex[i] = KdTree<Triangle>::BUCKET_SENTINEL;
+			barycentricU[i] = barycentricV[i] = FLOAT_NAN;
+			packet[i] = rays[i].pos.x;
+			packet[numRays + i] = rays[i].pos.y;
+			packet[2*numRays + i] = rays[i].pos.z;
+			packet[3*numRays + i] = rays[i].dir.x;
+			packet[4*numRays + i] = rays[i].dir.y;
+			packet[5*numRays + i] = rays[i].dir.z;
+		}
+	}
+
+	u32 operator()(KdTree<Triangle> &tree, const KdTreeNode &leaf, const Ray * /*rays*/, u32 activeRays, const float * /*tNear*/, const float *tFar)
+	{
+		// Gather the rays through the leaf to a packet of their own, so that the kernel tests only them. The packet is
+		// padded to a multiple of eight with rays of zero direction and distance, which never hit, so that the
+		// kernels need not handle partial groups.
+		int active[maxRays];
+		int numActive = 0;
+		for(int i = 0; i < numRays; ++i)
+			if (activeRays & (1u << i))
+				active[numActive++] = i;
+		const int numPacked = (numActive + 7) & ~7;
+		float activePacket[6 * maxRays], activeT[maxRays], activeU[maxRays], activeV[maxRays];
+		int activeTriangle[maxRays];
+		for(int i = 0; i < numPacked; ++i)
+		{
+			for(int j = 0; j < 6; ++j)
+				activePacket[j*numPacked + i] = (i < numActive ? packet[j*numRays + active[i]] : 0.f);
+			activeT[i] = (i < numActive ? rayT[active[i]] : 0.f);
+			activeTriangle[i] = -1;
+		}
+
+		const SIMDKernels &kernels = ActiveSIMDKernels();
+		const u32 *bucket = tree.Bucket(leaf.bucketIndex);
+		assert(bucket);
+		for(; *bucket != KdTree<Triangle>::BUCKET_SENTINEL; ++bucket)
+		{
+			const Triangle &tri = tree.Object(*bucket);
+			const float3 e1 = tri.b - tri.a;
+			const float3 e2 = tri.c - tri.a;
+			const float edges[9] = { tri.a.x, tri.a.y, tri.a.z, e1.x, e1.y, e1.z, e2.x, e2.y, e2.z };
+			u32 hits = kernels.intersectTriangleRays(edges, activePacket, numPacked, activeT, activeU, activeV);
+			for(int i = 0; hits; ++i, hits >>= 1)
+				if (hits & 1)
+					activeTriangle[i] = (int)*bucket;
+		}
+
+		// A ray with a hit before it leaves the leaf is done, as the farther leaves can only have farther hits.
+		u32 finished = 0;
+		for(int i = 0; i < numActive; ++i)
+		{
+			const int ray = active[i];
+			if (activeTriangle[i] != -1)
+			{
+				rayT[ray] = activeT[i];
+				triangleIndex[ray] = (u32)activeTriangle[i];
+				barycentricU[ray] = activeU[i];
+				barycentricV[ray] = activeV[i];
+			}
+			if (rayT[ray] <= tFar[ray])
+				finished |= 1u << ray;
+		}
+		return finished;
+	}
+
+private:
+	float packet[6 * maxRays]; ///< The positions and directions of the rays, laid out for intersectTriangleRays.
+};
+
 MATH_END_NAMESPACE
 
 #include "KdTree.inl"
@@ -21,17 +21,21 @@
 #include "Math/MathFunc.h"
 #include "assume.h"
 
+#include <string.h>
+#include <algorithm>
+
 MATH_BEGIN_NAMESPACE
 
 template<typename T>
-int KdTree<T>::AllocateNodePair()
+int KdTree<T>::AllocateNodePair(std::vector<KdTreeNode> &dstNodes)
 {
-	int index = (int)nodes.size();
+	int index = (int)dstNodes.size();
 	KdTreeNode n;
 	n.splitAxis = AxisNone; // The newly allocated nodes will be leaves.
+	n.childIndex = 0;
 	n.bucketIndex = 0;
-	nodes.push_back(n);
-	nodes.push_back(n);
+	dstNodes.push_back(n);
+	dstNodes.push_back(n);
 	return index;
 }
 
@@ -58,95 +62,158 @@ AABB KdTree<T>::BoundingAABB(const u32 *bucket) const
 }
 
 template<typename T>
-void KdTree<T>::SplitLeaf(int nodeIndex, const AABB &nodeAABB, int numObjectsInBucket, int leafDepth)
+bool KdTree<T>::FindSplit(const AABB &cell, const std::vector<u32> &cellObjects, int &splitAxis, float &splitPos) const
 {
-	if (leafDepth >= maxTreeDepth)
-		return; // Exceeded max depth - disallow splitting.
-
-	KdTreeNode *node = &nodes[nodeIndex];
-	assert(node->IsLeaf());
-	// Choose the longest axis for the split and convert the node from a leaf to an inner node.
-	int curBucketIndex = node->bucketIndex; // The existing objects.
-	assert(curBucketIndex != 0); // The leaf must contain some objects, otherwise this function should never be called!
-	CardinalAxis splitAxis = (CardinalAxis)nodeAABB.Size().MaxElementIndex();
-	float splitPos = nodeAABB.CenterPoint()[splitAxis];
+	const int cNumBins = 32;
+	const int cMinSplitObjects = 3; // Splitting smaller leaves costs more in traversal than it saves in intersections.
+	const float cTraversalCost = 1.f;
+	const float cIntersectionCost = 1.5f;
+	const float cEmptySpaceBonus = 0.8f; // Favor the splits that cut off empty space, which rays skip for free.
+
+	const int numObjects = (int)cellObjects.size();
+	if (numObjects < cMinSplitObjects)
+		return false;
 
-	// Compute the new bounding boxes for the left and right children.
-	AABB leftAABB = nodeAABB;
-	AABB rightAABB = nodeAABB;
-	leftAABB.maxPoint[splitAxis] = splitPos;
-	rightAABB.minPoint[splitAxis] = splitPos;
+	// The costs are in units of the surface area: the probability of a ray hitting a child is proportional to the
+	// ratio of its area to that of the cell, so the division by the area of the cell is left out.
+	const float3 size = cell.Size();
+	float bestCost = cIntersectionCost * numObjects * cell.SurfaceArea();
+	bool found = false;
+	for(int axis = 0; axis < 3; ++axis)
+	{
+		if (!(size[axis] > 0.f))
+			continue;
+
+		// Bin the min and max coordinates of the objects along the axis. A plane at the boundary k of the bins has
+		// the objects whose min is in the bins before k on the left, and those whose max is in the bins after on the right.
+		int minBins[cNumBins];
+		int maxBins[cNumBins];
+		for(int b = 0; b < cNumBins; ++b)
+			minBins[b] = maxBins[b] = 0;
+		const float cellMin = cell.minPoint[axis];
+		const float scale = cNumBins / size[axis];
+		for(int i = 0; i < numObjects; ++i)
+		{
+			const AABB &aabb = objectAABBs[cellObjects[i]];
+			// Clamped as floats, as an object can extend far out of a small cell.
+			++minBins[(int)Clamp((aabb.minPoint[axis] - cellMin) * scale, 0.f, cNumBins - 1.f)];
+			++maxBins[(int)Clamp((aabb.maxPoint[axis] - cellMin) * scale, 0.f, cNumBins - 1.f)];
+		}
 
-	// Sort all objects into the left and right children.
-	u32 *leftBucket = new u32[numObjectsInBucket+1];
-	u32 *rightBucket = new u32[numObjectsInBucket+1];
+		const int axis2 = (axis + 1) % 3;
+		const int axis3 = (axis + 2) % 3;
+		const float sideArea = size[axis2] * size[axis3];
+		const float sidePerimeter = size[axis2] + size[axis3];
+		int numLeft = 0;
+		int numRight = numObjects;
+		for(int k = 1; k < cNumBins; ++k)
+		{
+			numLeft += minBins[k-1];
+			numRight -= maxBins[k-1];
+			if (numLeft == numObjects && numRight == numObjects)
+				continue; // Both children would have all the objects.
+			const float leftWidth = k / scale;
+			const float leftArea = 2.f * (sideArea + leftWidth * sidePerimeter);
+			const float rightArea = 2.f * (sideArea + (size[axis] - leftWidth) * sidePerimeter);
+			float cost = cTraversalCost * cell.SurfaceArea() + cIntersectionCost * (leftArea * numLeft + rightArea * numRight);
+			if (numLeft == 0 || numRight == 0)
+				cost *= cEmptySpaceBonus;
+			if (cost < bestCost)
+			{
+				bestCost = cost;
+				splitAxis = axis;
+				splitPos = cellMin + leftWidth;
+				found = true;
+			}
+		}
+	}
+	return found;
+}
 
-	u32 *curObject = buckets[curBucketIndex];
-	u32 *l = leftBucket;
-	u32 *r = rightBucket;
-	int numObjectsLeft = 0;
-	int numObjectsRight = 0;
-	while(*curObject != BUCKET_SENTINEL)
+template<typename T>
+void KdTree<T>::SplitObjects(const AABB &cell, const std::vector<u32> &cellObjects, int splitAxis, float splitPos,
+	std::vector<u32> &leftObjects, std::vector<u32> &rightObjects, AABB &leftCell, AABB &rightCell) const
+{
+	AABB leftBounds;
+	AABB rightBounds;
+	leftBounds.SetNegativeInfinity();
+	rightBounds.SetNegativeInfinity();
+	for(size_t i = 0; i < cellObjects.size(); ++i)
 	{
-		AABB aabb = objects[*curObject].BoundingAABB();
-		bool left = leftAABB.Intersects(aabb);
-		bool right = rightAABB.Intersects(aabb);
-		if (!left && !right)
-			left = right = true; // Numerical precision issues: bounding box doesn't intersect either anymore, so place into both children.
-		if (left)
+		// An object that touches the split plane goes to both children, as in the traversal.
+		const AABB &aabb = objectAABBs[cellObjects[i]];
+		if (aabb.minPoint[splitAxis] <= splitPos)
 		{
-			*l++ = *curObject;
-			++numObjectsLeft;
+			leftObjects.push_back(cellObjects[i]);
+			leftBounds.Enclose(aabb);
 		}
-		if (right)
+		if (aabb.maxPoint[splitAxis] >= splitPos)
 		{
-			*r++ = *curObject;
-			++numObjectsRight;
+			rightObjects.push_back(cellObjects[i]);
+			rightBounds.Enclose(aabb);
 		}
-		++curObject;
 	}
-	*l = BUCKET_SENTINEL;
-	*r = BUCKET_SENTINEL;
 
-	// If we cannot split according to the given split axis, abort the whole process.
-	if (numObjectsLeft == numObjectsInBucket || numObjectsRight == numObjectsInBucket)
+	leftCell = cell;
+	rightCell = cell;
+	leftCell.maxPoint[splitAxis] = splitPos;
+	rightCell.minPoint[splitAxis] = splitPos;
+	// Shrink the cells to the objects in them, so that the splits below are placed where the objects are.
+	leftCell.minPoint = leftCell.minPoint.Max(leftBounds.minPoint);
+	leftCell.maxPoint = leftCell.maxPoint.Min(leftBounds.maxPoint);
+	rightCell.minPoint = rightCell.minPoint.Max(rightBounds.minPoint);
+	rightCell.maxPoint = rightCell.maxPoint.Min(rightBounds.maxPoint);
+}
+
+template<typename T>
+void KdTree<T>::MakeLeaf(KdTreeNode &node, std::vector<u32*> &dstBuckets, const std::vector<u32> &leafObjects)
+{
+	node.splitAxis = AxisNone;
+	node.childIndex = 0;
+	if (leafObjects.empty())
 	{
-		delete[] leftBucket;
-		delete[] rightBucket;
+		node.bucketIndex = 0;
 		return;
 	}
+	u32 *bucket = new u32[leafObjects.size()+1];
+	std::copy(leafObjects.begin(), leafObjects.end(), bucket);
+	bucket[leafObjects.size()] = BUCKET_SENTINEL;
+	node.bucketIndex = (u32)dstBuckets.size();
+	dstBuckets.push_back(bucket);
+}
 
-	// Ok to split. Turn this leaf node into an inner node.
-	node->splitAxis = splitAxis;
-	node->splitPos = splitPos;
-
-	// Allocate nodes for the children.
-	int childIndex = AllocateNodePair();
-	node = &nodes[nodeIndex]; // AllocateNodePair() above invalidates the 'node' pointer! Recompute it.
-	node->childIndex = childIndex;
-
-	// Recompute tighter AABB's for the children which have now been populated with objects.
-	leftAABB = BoundingAABB(leftBucket);
-	rightAABB = BoundingAABB(rightBucket);
-
-	// For the left child, reuse the bucket index the parent had. (free the bucket of the parent)
-	KdTreeNode *leftChild = &nodes[childIndex];
-	delete[] buckets[curBucketIndex];
-	buckets[curBucketIndex] = leftBucket;
-	leftChild->bucketIndex = curBucketIndex;
-
-	// For the right child, allocate a new bucket.
-	KdTreeNode *rightChild = &nodes[childIndex+1];
-	rightChild->bucketIndex = (u32)buckets.size();
-	buckets.push_back(rightBucket);
-
-	assert(numObjectsLeft < numObjectsInBucket && numObjectsRight < numObjectsInBucket);
+template<typename T>
+void KdTree<T>::BuildSubtree(std::vector<KdTreeNode> &dstNodes, std::vector<u32*> &dstBuckets, int nodeIndex, const AABB &cell,
+	std::vector<u32> &cellObjects, int depth) const
+{
+	int splitAxis;
+	float splitPos;
+	if (depth >= maxTreeDepth || !FindSplit(cell, cellObjects, splitAxis, splitPos))
+	{
+		MakeLeaf(dstNodes[nodeIndex], dstBuckets, cellObjects);
+		return;
+	}
 
-	// Recursively split children.
-	if (numObjectsLeft > 16)
-		SplitLeaf(childIndex, leftAABB, numObjectsLeft, leafDepth + 1);
-	if (numObjectsRight > 16)
-		SplitLeaf(childIndex+1, rightAABB, numObjectsRight, leafDepth + 1);
+	std::vector<u32> leftObjects;
+	std::vector<u32> rightObjects;
+	AABB leftCell;
+	AABB rightCell;
+	SplitObjects(cell, cellObjects, splitAxis, splitPos, leftObjects, rightObjects, leftCell, rightCell);
+	if (leftObjects.size() == cellObjects.size() && rightObjects.size() == cellObjects.size())
+	{
+		// The binning estimated the counts of a plane near an object boundary wrong. Give up rather than loop.
+		MakeLeaf(dstNodes[nodeIndex], dstBuckets, cellObjects);
+		return;
+	}
+	std::vector<u32>().swap(cellObjects); // Free the memory before recursing.
+
+	const int childIndex = AllocateNodePair(dstNodes);
+	KdTreeNode &node = dstNodes[nodeIndex]; // AllocateNodePair() above invalidates references to the nodes.
+	node.splitAxis = splitAxis;
+	node.splitPos = splitPos;
+	node.childIndex = childIndex;
+	BuildSubtree(dstNodes, dstBuckets, childIndex, leftCell, leftObjects, depth + 1);
+	BuildSubtree(dstNodes, dstBuckets, childIndex+1, rightCell, rightObjects, depth + 1);
 }
 
 template<typename T>
@@ -242,9 +309,19 @@ void KdTree<T>::AddObjects(const T *objects_, int numObjects)
 
 template<typename T>
 void KdTree<T>::Build()
+{
+	BeginBuild(1);
+	for(int i = 0; i < NumBuildTasks(); ++i)
+		RunBuildTask(i);
+	EndBuild();
+}
+
+template<typename T>
+void KdTree<T>::BeginBuild(int numTasks)
 {
 	nodes.clear();
 	FreeBuckets();
+	buildTasks.clear();
 
 	// Allocate a dummy node to be stored at index 0 (for safety).
 	KdTreeNode dummy;
@@ -252,29 +329,111 @@ void KdTree<T>::Build()
 	dummy.childIndex = 0;
 	dummy.bucketIndex = 0;
 	nodes.push_back(dummy); // Index 0 - dummy unused node, "null pointer".
+	nodes.push_back(dummy); // Index 1 - the root.
 
 	// Allocate a dummy bucket at index 0, to denote that a leaf is empty.
 	buckets.push_back(0);
 
-	// Add a root node for the tree.
-	KdTreeNode rootNode;
-	rootNode.splitAxis = AxisNone;
-	rootNode.childIndex = 0;
-	rootNode.bucketIndex = 1;
-	nodes.push_back(rootNode);
+	// The splits test the bounds of the objects many times, so compute them once.
+	objectAABBs.resize(objects.size());
+	rootAABB.SetNegativeInfinity();
+	for(size_t i = 0; i < objects.size(); ++i)
+	{
+		objectAABBs[i] = objects[i].BoundingAABB();
+		rootAABB.Enclose(objectAABBs[i]);
+	}
 
-	// Initially, add all objects to the root node.
-	u32 *rootBucket = new u32[objects.size()+1];
+	buildTasks.push_back(BuildTask());
+	BuildTask &rootTask = buildTasks.back();
+	rootTask.node = 1;
+	rootTask.depth = 1;
+	rootTask.cell = rootAABB;
+	rootTask.objects.resize(objects.size());
 	for(u32 i = 0; i < (u32)objects.size(); ++i)
-		rootBucket[i] = i;
-	rootBucket[objects.size()] = BUCKET_SENTINEL;
-	buckets.push_back(rootBucket);
+		rootTask.objects[i] = i;
+
+	// Split the top levels breadth-first, so that the subtrees left for the tasks are of about the same size.
+	while(!buildTasks.empty() && (int)buildTasks.size() < numTasks)
+	{
+		BuildTask &task = buildTasks.front();
+		const int nodeIndex = task.node;
+		const int depth = task.depth;
+		const AABB cell = task.cell;
+		std::vector<u32> cellObjects;
+		cellObjects.swap(task.objects);
+		buildTasks.pop_front();
+
+		int splitAxis;
+		float splitPos;
+		std::vector<u32> leftObjects;
+		std::vector<u32> rightObjects;
+		AABB leftCell;
+		AABB rightCell;
+		bool split = depth < maxTreeDepth && FindSplit(cell, cellObjects, splitAxis, splitPos);
+		if (split)
+		{
+			SplitObjects(cell, cellObjects, splitAxis, splitPos, leftObjects, rightObjects, leftCell, rightCell);
+			split = leftObjects.size() < cellObjects.size() || rightObjects.size() < cellObjects.size();
+		}
+		if (!split)
+		{
+			MakeLeaf(nodes[nodeIndex], buckets, cellObjects);
+			continue;
+		}
+
+		const int childIndex = AllocateNodePair(nodes);
+		nodes[nodeIndex].splitAxis = splitAxis;
+		nodes[nodeIndex].splitPos = splitPos;
+		nodes[nodeIndex].childIndex = childIndex;
+		for(int i = 0; i < 2; ++i)
+		{
+			buildTasks.push_back(BuildTask());
+			BuildTask &child = buildTasks.back();
+			child.node = childIndex + i;
+			child.depth = depth + 1;
+			child.cell = (i == 0 ? leftCell : rightCell);
+			child.objects.swap(i == 0 ? leftObjects : rightObjects);
+		}
+	}
+}
 
-	rootAABB = BoundingAABB(rootBucket);
+template<typename T>
+void KdTree<T>::RunBuildTask(int taskIndex)
+{
+	BuildTask &task = buildTasks[taskIndex];
+	task.nodes.clear();
+	task.buckets.clear();
+	task.nodes.push_back(nodes[task.node]); // The root, which the children follow in pairs.
+	task.buckets.push_back(0);
+	BuildSubtree(task.nodes, task.buckets, 0, task.cell, task.objects, task.depth);
+}
 
-	// We now have a single root leaf node which is unsplit and contains all the objects
-	// in the kD-tree. Now recursively subdivide until the whole tree is built.
-	SplitLeaf(1, rootAABB, (int)objects.size(), 1);
+template<typename T>
+void KdTree<T>::EndBuild()
+{
+	// The root of a subtree replaces its leaf, and the rest are appended with their child and bucket indices offset.
+	for(size_t t = 0; t < buildTasks.size(); ++t)
+	{
+		BuildTask &task = buildTasks[t];
+		assert(!task.nodes.empty());
+		const int nodeOffset = (int)nodes.size() - 1;
+		const int bucketOffset = (int)buckets.size() - 1;
+		for(size_t i = 0; i < task.nodes.size(); ++i)
+		{
+			KdTreeNode node = task.nodes[i];
+			if (!node.IsLeaf())
+				node.childIndex = node.childIndex + nodeOffset;
+			else if (!node.IsEmptyLeaf())
+				node.bucketIndex += bucketOffset;
+			if (i == 0)
+				nodes[task.node] = node;
+			else
+				nodes.push_back(node);
+		}
+		buckets.insert(buckets.end(), task.buckets.begin() + 1, task.buckets.end());
+	}
+	buildTasks.clear();
+	std::vector<AABB>().swap(objectAABBs);
 
 #ifdef _DEBUG
 	needsBuilding = false;
@@ -292,6 +451,114 @@ void KdTree<T>::Clear()
 #endif
 }
 
+template<typename T>
+void KdTree<T>::Swap(KdTree<T> &other)
+{
+	nodes.swap(other.nodes);
+	objects.swap(other.objects);
+	buckets.swap(other.buckets);
+	std::swap(rootAABB, other.rootAABB);
+#ifdef _DEBUG
+	std::swap(needsBuilding, other.needsBuilding);
+#endif
+}
+
+/// Magic number that begins a serialized kD-tree. Change it if the format or the builder changes, so that the cached trees are rebuilt.
+static const u32 cKdTreeMagic = 0x3254444B; // "KDT2"
+
+template<typename T>
+void KdTree<T>::Serialize(std::vector<u8> &dst) const
+{
+	u32 header[6] = { cKdTreeMagic, (u32)sizeof(T), (u32)sizeof(KdTreeNode), (u32)objects.size(), (u32)nodes.size(), (u32)buckets.size() };
+	const u8 *headerBytes = (const u8*)header;
+	dst.insert(dst.end(), headerBytes, headerBytes + sizeof(header));
+	const u8 *aabbBytes = (const u8*)&rootAABB;
+	dst.insert(dst.end(), aabbBytes, aabbBytes + sizeof(rootAABB));
+	if (!objects.empty())
+		dst.insert(dst.end(), (const u8*)&objects[0], (const u8*)&objects[0] + objects.size() * sizeof(T));
+	if (!nodes.empty())
+		dst.insert(dst.end(), (const u8*)&nodes[0], (const u8*)&nodes[0] + nodes.size() * sizeof(KdTreeNode));
+	// Each bucket as its length followed by the object indices. Bucket 0 is the null bucket of empty leaves.
+	for(size_t i = 1; i < buckets.size(); ++i)
+	{
+		u32 length = 0;
+		if (buckets[i])
+			while(buckets[i][length] != BUCKET_SENTINEL)
+				++length;
+		dst.insert(dst.end(), (const u8*)&length, (const u8*)&length + sizeof(length));
+		if (length > 0)
+			dst.insert(dst.end(), (const u8*)buckets[i], (const u8*)(buckets[i] + length));
+	}
+}
+
+template<typename T>
+bool KdTree<T>::Deserialize(const u8 *data, size_t numBytes)
+{
+	FreeBuckets();
+	Clear();
+
+	u32 header[6];
+	if (!data || numBytes < sizeof(header) + sizeof(rootAABB))
+		return false;
+	const u8 *end = data + numBytes;
+	memcpy(header, data, sizeof(header));
+	data += sizeof(header);
+	if (header[0] != cKdTreeMagic || header[1] != sizeof(T) || header[2] != sizeof(KdTreeNode) || header[5] == 0)
+		return false;
+	memcpy(&rootAABB, data, sizeof(rootAABB));
+	data += sizeof(rootAABB);
+
+	const size_t objectBytes = (size_t)header[3] * sizeof(T);
+	const size_t nodeBytes = (size_t)header[4] * sizeof(KdTreeNode);
+	if ((size_t)(end - data) < objectBytes + nodeBytes)
+		return false;
+	objects.resize(header[3]);
+	if (objectBytes > 0)
+		memcpy(&objects[0], data, objectBytes);
+	data += objectBytes;
+	nodes.resize(header[4]);
+	if (nodeBytes > 0)
+		memcpy(&nodes[0], data, nodeBytes);
+	data += nodeBytes;
+
+	buckets.push_back(0);
+	for(u32 i = 1; i < header[5]; ++i)
+	{
+		u32 length;
+		if ((size_t)(end - data) < sizeof(length))
+			break;
+		memcpy(&length, data, sizeof(length));
+		data += sizeof(length);
+		if (length > objects.size() || (size_t)(end - data) < length * sizeof(u32))
+			break;
+		u32 *bucket = new u32[length+1];
+		if (length > 0)
+			memcpy(bucket, data, length * sizeof(u32));
+		bucket[length] = BUCKET_SENTINEL;
+		data += length * sizeof(u32);
+		buckets.push_back(bucket);
+	}
+
+	// Reject the data if it is truncated, or refers to buckets or objects that do not exist.
+	bool valid = (buckets.size() == header[5]);
+	for(size_t i = 1; valid && i < nodes.size(); ++i)
+		if (nodes[i].IsLeaf() ? nodes[i].bucketIndex >= buckets.size() : nodes[i].childIndex + 1 >= nodes.size())
+			valid = false;
+	for(size_t i = 1; valid && i < buckets.size(); ++i)
+		for(const u32 *index = buckets[i]; *index != BUCKET_SENTINEL; ++index)
+			if (*index >= objects.size())
+			{
+				valid = false;
+				break;
+			}
+	if (!valid)
+	{
+		FreeBuckets();
+		Clear();
+	}
+	return valid;
+}
+
 template<typename T>
 KdTreeNode *KdTree<T>::Root() { return nodes.size() > 1 ? &nodes[1] : 0; }
 
@@ -446,6 +713,124 @@ inline void KdTree<T>::RayQuery(const Ray &r, Func &nodeProcessFunc)
 	}
 }
 
+template<typename T>
+template<typename Func>
+inline void KdTree<T>::RayPacketQuery(const Ray *rays, int numRays, Func &leafCallback)
+{
+	assume(numRays >= 0 && numRays <= maxRayPacketSize);
+	assume(rootAABB.IsFinite());
+	assume(!rootAABB.IsDegenerate());
+#ifdef _DEBUG
+	assume(!needsBuilding);
+#endif
+
+	// Clip the rays to the root, and group the rest by the signs of their directions, so that the rays of a group
+	// see the children of a node in the same order.
+	float tNear[maxRayPacketSize], tFar[maxRayPacketSize];
+	float3 invDir[maxRayPacketSize];
+	u32 octants[8] = { 0, 0, 0, 0, 0, 0, 0, 0 };
+	for(int i = 0; i < numRays; ++i)
+	{
+		tNear[i] = 0.f;
+		tFar[i] = FLOAT_INF;
+		if (!rootAABB.IntersectLineAABB(rays[i].pos, rays[i].dir, tNear[i], tFar[i]) || tFar[i] < 0.f)
+			continue;
+		tNear[i] = Max(tNear[i], 0.f);
+		invDir[i] = float3(1.f / rays[i].dir.x, 1.f / rays[i].dir.y, 1.f / rays[i].dir.z);
+		octants[(rays[i].dir.x < 0.f ? 1 : 0) | (rays[i].dir.y < 0.f ? 2 : 0) | (rays[i].dir.z < 0.f ? 4 : 0)] |= 1u << i;
+	}
+
+	struct StackElem
+	{
+		int node;
+		u32 activeRays;
+		float tNear[maxRayPacketSize];
+		float tFar[maxRayPacketSize];
+	};
+	const int cMaxStackItems = maxTreeDepth*2;
+	StackElem stack[cMaxStackItems];
+
+	u32 finishedRays = 0;
+	const int rootIndex = (int)(Root() - &nodes[0]);
+	for(int octant = 0; octant < 8; ++octant)
+	{
+		if (!octants[octant])
+			continue;
+		int stackSize = 1;
+		stack[0].node = rootIndex;
+		stack[0].activeRays = octants[octant];
+		for(int i = 0; i < numRays; ++i)
+		{
+			stack[0].tNear[i] = tNear[i];
+			stack[0].tFar[i] = tFar[i];
+		}
+
+		while(stackSize > 0)
+		{
+			StackElem &cur = stack[--stackSize];
+			u32 activeRays = cur.activeRays & ~finishedRays;
+			if (!activeRays)
+				continue;
+			int nodeIndex = cur.node;
+			float curNear[maxRayPacketSize], curFar[maxRayPacketSize];
+			for(int i = 0; i < numRays; ++i)
+			{
+				curNear[i] = cur.tNear[i];
+				curFar[i] = cur.tFar[i];
+			}
+
+			// Descend to the near children, pushing the far ones for the rays that reach them.
+			while(!nodes[nodeIndex].IsLeaf())
+			{
+				const KdTreeNode &node = nodes[nodeIndex];
+				const int axis = node.splitAxis;
+				const bool negative = (octant & (1 << axis)) != 0;
+				const int nearChild = negative ? node.RightChildIndex() : node.LeftChildIndex();
+				const int farChild = negative ? node.LeftChildIndex() : node.RightChildIndex();
+
+				StackElem &far = stack[stackSize];
+				u32 nearRays = 0, farRays = 0;
+				for(int i = 0; i < numRays; ++i)
+				{
+					if (!(activeRays & (1u << i)))
+						continue;
+					// NaN, for a ray that starts on and runs along the split plane, sends the ray to both children.
+					const float tSplit = (node.splitPos - rays[i].pos[axis]) * invDir[i][axis];
+					if (!(tSplit < curNear[i]))
+						nearRays |= 1u << i;
+					if (!(tSplit > curFar[i]))
+					{
+						farRays |= 1u << i;
+						far.tNear[i] = (tSplit > curNear[i] ? tSplit : curNear[i]);
+						far.tFar[i] = curFar[i];
+					}
+					if (tSplit < curFar[i])
+						curFar[i] = tSplit;
+				}
+				if (farRays)
+				{
+					assert(stackSize < cMaxStackItems);
+					far.node = farChild;
+					far.activeRays = farRays;
+					++stackSize;
+				}
+				if (!nearRays)
+					break;
+				nodeIndex = nearChild;
+				activeRays = nearRays;
+			}
+
+			const KdTreeNode &leaf = nodes[nodeIndex];
+			if (leaf.IsLeaf() && !leaf.IsEmptyLeaf())
+			{
+				finishedRays |= leafCallback(*this, leaf, rays, activeRays, curNear, curFar);
+				if ((finishedRays & octants[octant]) == octants[octant])
+					break;
+			}
+		}
+	}
+}
+
 template<typename T>
 template<typename Func>
 inline void KdTree<T>::AABBQuery(const AABB &aabb, Func &leafCallback)
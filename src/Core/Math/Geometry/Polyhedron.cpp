@@ -36,6 +36,7 @@
 #include "Geometry/Triangle.h"
 #include "Geometry/Sphere.h"
 #include "Geometry/Capsule.h"
+#include "Geometry/GJK.h"
 
 #ifdef MATH_GRAPHICSENGINE_INTEROP
 #include "VertexBuffer.h"
@@ -844,6 +845,21 @@ bool Polyhedron::IntersectsConvex(const LineSegment &lineSegment) const
 	return ClipLineSegmentToConvexPolyhedron(lineSegment.a, lineSegment.b - lineSegment.a, tFirst, tLast);
 }
 
+bool Polyhedron::IntersectsConvex(const Polyhedron &convexPolyhedron) const
+{
+	return GJKIntersect(*this, convexPolyhedron);
+}
+
+bool Polyhedron::IntersectsConvex(const Sphere &sphere) const
+{
+	return GJKIntersect(*this, sphere);
+}
+
+bool Polyhedron::IntersectsConvex(const Capsule &capsule) const
+{
+	return GJKIntersect(*this, capsule);
+}
+
 void Polyhedron::MergeConvex(const float3 &point)
 {
 //	LOGI("mergeconvex.");
@@ -323,10 +323,14 @@ public:
 		and uses a faster method of testing the intersection.
 		@return True if an intersection occurs or one of the objects is contained inside the other, false otherwise.
 		@see Contains(), ContainsConvex(), ClosestPoint(), ClosestPointConvex(), Distance(), Intersects().
+		The tests against the other convex objects use GJK, see GJKIntersect().
 		@todo Add Intersects(Circle/Disc). */
 	bool IntersectsConvex(const Line &line) const;
 	bool IntersectsConvex(const Ray &ray) const;
 	bool IntersectsConvex(const LineSegment &lineSegment) const;
+	bool IntersectsConvex(const Polyhedron &convexPolyhedron) const;
+	bool IntersectsConvex(const Sphere &sphere) const;
+	bool IntersectsConvex(const Capsule &capsule) const;
 
 	void MergeConvex(const float3 &point);
 
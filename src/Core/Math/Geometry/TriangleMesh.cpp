@@ -15,161 +15,46 @@
 /** @file TriangleMesh.cpp
 	@author Jukka Jylnki
 	@brief Implementation for the TriangleMesh geometry object. */
-#ifdef WIN32
 #include "TriangleMesh.h"
+#ifdef _MSC_VER
 #include <malloc.h>
+#else
+#include <stdlib.h>
+#endif
 #include <string.h>
 #include "Math/float3.h"
 #include "Geometry/Triangle.h"
 #include "Geometry/Ray.h"
 #include "Math/MathFwd.h"
 #include "Math/MathConstants.h"
+#include "Math/SIMDKernels.h"
 #include "myassert.h"
 
-#ifdef MATH_SSE
-#include <intrin.h>
-#include <emmintrin.h>
-#include <smmintrin.h>
-#include <xmmintrin.h>
-#endif
-
-// If defined, we preprocess our TriangleMesh data structure to contain (v0, v1-v0, v2-v0)
-// instead of (v0, v1, v2) triplets for faster ray-triangle mesh intersection.
-#define SOA_HAS_EDGES
-
 MATH_BEGIN_NAMESPACE
 
-enum SIMDCapability
-{
-	SIMD_NONE,
-	SIMD_SSE,
-	SIMD_SSE2,
-//	SIMD_SSE3,
-//	SIMD_SSSE3,
-//	SIMD_SSE4,
-	SIMD_SSE41,
-//	SIMD_SSE42,
-	SIMD_AVX
-};
-
-SIMDCapability DetectSIMDCapability()
+TriangleMesh::TriangleMesh()
+:data(0), numTriangles(0), simd(SIMD_NONE)
 {
-#ifdef MATH_SSE
-	int CPUInfo[4] = {-1};
-
-	unsigned    nIds;//, nExIds, i;
-	int nFeatureInfo = 0;
-//	bool    bSSE3Instructions = false;
-//	bool    bSupplementalSSE3 = false;
-//	bool    bCMPXCHG16B = false;
-#ifdef MATH_SSE41
-	bool    bSSE41Extensions = false;
-#endif
-//	bool    bSSE42Extensions = false;
-//	bool    bPOPCNT = false;
-
-//	bool    bLAHF_SAHFAvailable = false;
-//	bool    bCmpLegacy = false;
-//	bool    bLZCNT = false;
-//	bool    bSSE4A = false;
-//	bool    bMisalignedSSE = false;
-//	bool    bPREFETCH = false;
-//	bool    bMMXExtensions = false;
-//	bool    b3DNowExt = false;
-//	bool    b3DNow = false;
-//	bool    bFP128 = false;
-#ifdef MATH_AVX
-	bool    hasAVX = false;
-#endif
-//	bool    bMOVOptimization = false;
-
-	__cpuid(CPUInfo, 0);
-	nIds = CPUInfo[0];
-
-	// Get the information associated with each valid Id
-//	for (i=0; i<=nIds; ++i)
-	if (nIds >= 1)
-	{
-	//	__cpuid(CPUInfo, i);
-
-		__cpuid(CPUInfo, 1);
-		// Interpret CPU feature information.
-//		if  (i == 1)
-		{
-//			bSSE3Instructions = (CPUInfo[2] & 0x1) || false;
-//			bSupplementalSSE3 = (CPUInfo[2] & 0x200) || false;
-//			bCMPXCHG16B= (CPUInfo[2] & 0x2000) || false;
-//			bSSE41Extensions = (CPUInfo[2] & 0x80000) || false;
-//			bSSE42Extensions = (CPUInfo[2] & 0x100000) || false;
-//			bPOPCNT= (CPUInfo[2] & 0x800000) || false;
-#ifdef MATH_AVX
-			hasAVX = (CPUInfo[2] & 0x10000000) || false;
+#ifdef _DEBUG
+	vertexDataLayout = 0;
 #endif
-			nFeatureInfo = CPUInfo[3];
-		}
-	}
-
-//	const bool hasMMX = (nFeatureInfo & (1 << 23)) != 0;
-
-	// Calling __cpuid with 0x80000000 as the InfoType argument
-	// gets the number of valid extended IDs.
-//	__cpuid(CPUInfo, 0x80000000);
-//	nExIds = CPUInfo[0];
-/*
-	// Get the information associated with each extended ID.
-	for (i=0x80000000; i<=nExIds; ++i)
-	{
-		__cpuid(CPUInfo, i);
-
-		if  (i == 0x80000001)
-		{
-			bLAHF_SAHFAvailable = (CPUInfo[2] & 0x1) || false;
-			bCmpLegacy = (CPUInfo[2] & 0x2) || false;
-			bLZCNT = (CPUInfo[2] & 0x20) || false;
-			bSSE4A = (CPUInfo[2] & 0x40) || false;
-			bMisalignedSSE = (CPUInfo[2] & 0x80) || false;
-			bPREFETCH = (CPUInfo[2] & 0x100) || false;
-			bMMXExtensions = (CPUInfo[3] & 0x40000) || false;
-			b3DNowExt = (CPUInfo[3] & 0x40000000) || false;
-			b3DNow = (CPUInfo[3] & 0x80000000) || false;
-		}
+}
 
-		if  (i == 0x8000001A)
-		{
-			bFP128 = (CPUInfo[0] & 0x1) || false;
-			bMOVOptimization = (CPUInfo[0] & 0x2) || false;
-		}
-	}
-*/
-#ifdef MATH_AVX
-	if (hasAVX)
-		return SIMD_AVX;
-#endif
-#ifdef MATH_SSE41
-	if (bSSE41Extensions)
-		return SIMD_SSE41;
-#endif
-#ifdef MATH_SSE2
-	const bool hasSSE2 = (nFeatureInfo & (1 << 26)) != 0;
-	if (hasSSE2)
-		return SIMD_SSE2;
-#endif
-#ifdef MATH_SSE
-	const bool hasSSE = (nFeatureInfo & (1 << 25)) != 0;
-	if (hasSSE)
-		return SIMD_SSE;
+TriangleMesh::~TriangleMesh()
+{
+#ifdef _MSC_VER
+	_aligned_free(data);
+#else
+	free(data);
 #endif
-
-#endif // ~ MATH_SSE not defined.
-	return SIMD_NONE;
 }
 
-const int simdCapability = DetectSIMDCapability();
 void TriangleMesh::Set(const float *triangleMesh, int numTriangles)
 {
-	if (simdCapability == SIMD_AVX)
+	const SIMDCapability capability = ActiveSIMDCapability();
+	if (capability >= SIMD_AVX)
 		SetSoA8(triangleMesh, numTriangles);
-	if (simdCapability == SIMD_SSE41 || simdCapability == SIMD_SSE2)
+	else if (capability >= SIMD_SSE2)
 		SetSoA4(triangleMesh, numTriangles);
 	else
 		SetAoS(triangleMesh, numTriangles);
@@ -177,16 +62,16 @@ void TriangleMesh::Set(const float *triangleMesh, int numTriangles)
 
 float TriangleMesh::IntersectRay(const Ray &ray) const
 {
-#ifdef MATH_AVX
-	if (simdCapability == SIMD_AVX)
+#ifdef MATH_DISPATCH_AVX
+	if (simd == SIMD_AVX)
 		return IntersectRay_AVX(ray);
 #endif
-#ifdef MATH_SSE41
-	if (simdCapability == SIMD_SSE41)
+#ifdef MATH_DISPATCH_SSE41
+	if (simd == SIMD_SSE41)
 		return IntersectRay_SSE41(ray);
 #endif
-#ifdef MATH_SSE2
-	if (simdCapability == SIMD_SSE2)
+#ifdef MATH_DISPATCH_SSE2
+	if (simd == SIMD_SSE2)
 		return IntersectRay_SSE2(ray);
 #endif
 
@@ -197,16 +82,16 @@ float TriangleMesh::IntersectRay(const Ray &ray) const
 
 float TriangleMesh::IntersectRay_TriangleIndex(const Ray &ray, int &outTriangleIndex) const
 {
-#ifdef MATH_AVX
-	if (simdCapability == SIMD_AVX)
+#ifdef MATH_DISPATCH_AVX
+	if (simd == SIMD_AVX)
 		return IntersectRay_TriangleIndex_AVX(ray, outTriangleIndex);
 #endif
-#ifdef MATH_SSE41
-	if (simdCapability == SIMD_SSE41)
+#ifdef MATH_DISPATCH_SSE41
+	if (simd == SIMD_SSE41)
 		return IntersectRay_TriangleIndex_SSE41(ray, outTriangleIndex);
 #endif
-#ifdef MATH_SSE2
-	if (simdCapability == SIMD_SSE2)
+#ifdef MATH_DISPATCH_SSE2
+	if (simd == SIMD_SSE2)
 		return IntersectRay_TriangleIndex_SSE2(ray, outTriangleIndex);
 #endif
 
@@ -216,30 +101,108 @@ float TriangleMesh::IntersectRay_TriangleIndex(const Ray &ray, int &outTriangleI
 
 float TriangleMesh::IntersectRay_TriangleIndex_UV(const Ray &ray, int &outTriangleIndex, float &outU, float &outV) const
 {
-#ifdef MATH_AVX
-	if (simdCapability == SIMD_AVX)
+#ifdef MATH_DISPATCH_AVX
+	if (simd == SIMD_AVX)
 		return IntersectRay_TriangleIndex_UV_AVX(ray, outTriangleIndex, outU, outV);
 #endif
-#ifdef MATH_SSE41
-	if (simdCapability == SIMD_SSE41)
+#ifdef MATH_DISPATCH_SSE41
+	if (simd == SIMD_SSE41)
 		return IntersectRay_TriangleIndex_UV_SSE41(ray, outTriangleIndex, outU, outV);
 #endif
-#ifdef MATH_SSE2
-	if (simdCapability == SIMD_SSE2)
+#ifdef MATH_DISPATCH_SSE2
+	if (simd == SIMD_SSE2)
 		return IntersectRay_TriangleIndex_UV_SSE2(ray, outTriangleIndex, outU, outV);
 #endif
 
 	return IntersectRay_TriangleIndex_UV_CPP(ray, outTriangleIndex, outU, outV);
 }
 
+void TriangleMesh::IntersectRays(const Ray *rays, int numRays, float *outDistances, int *outTriangleIndices, float *outU, float *outV) const
+{
+	for(int i = 0; i < numRays; i += rayPacketSize)
+	{
+		const int count = (numRays - i < rayPacketSize ? numRays - i : rayPacketSize);
+		IntersectRayPacket(rays + i, count, outDistances + i, outTriangleIndices + i, outU ? outU + i : 0, outV ? outV + i : 0);
+	}
+}
+
+void TriangleMesh::IntersectRayPacket(const Ray *rays, int numRays, float *outDistances, int *outTriangleIndices, float *outU, float *outV) const
+{
+	assert(numRays <= rayPacketSize);
+	float packet[6 * rayPacketSize];
+	float u[rayPacketSize], v[rayPacketSize];
+	for(int i = 0; i < numRays; ++i)
+	{
+		packet[i] = rays[i].pos.x;
+		packet[numRays + i] = rays[i].pos.y;
+		packet[2*numRays + i] = rays[i].pos.z;
+		packet[3*numRays + i] = rays[i].dir.x;
+		packet[4*numRays + i] = rays[i].dir.y;
+		packet[5*numRays + i] = rays[i].dir.z;
+		outDistances[i] = FLOAT_INF;
+		outTriangleIndices[i] = -1;
+	}
+
+	// The padding triangles of the SoA layouts are degenerate, so they never hit.
+	const SIMDKernels &kernels = ActiveSIMDKernels();
+	float triangle[9];
+	for(int i = 0; i < numTriangles; ++i)
+	{
+		TriangleEdges(i, triangle);
+		u32 hits = kernels.intersectTriangleRays(triangle, packet, numRays, outDistances, u, v);
+		for(int j = 0; hits; ++j, hits >>= 1)
+			if (hits & 1)
+				outTriangleIndices[j] = i;
+	}
+
+	for(int i = 0; i < numRays; ++i)
+		if (outTriangleIndices[i] != -1)
+		{
+			if (outU)
+				outU[i] = u[i];
+			if (outV)
+				outV[i] = v[i];
+		}
+}
+
+void TriangleMesh::TriangleEdges(int triangleIndex, float *dst) const
+{
+	if (simd == SIMD_NONE)
+	{
+		const float *t = data + triangleIndex * 9;
+		for(int j = 0; j < 3; ++j)
+		{
+			dst[j] = t[j];
+			dst[3 + j] = t[3 + j] - t[j];
+			dst[6 + j] = t[6 + j] - t[j];
+		}
+		return;
+	}
+
+	// A group of width triangles is stored as the width x coordinates of their first vertices, then the y ones and so on.
+	const int width = (simd == SIMD_AVX ? 8 : 4);
+	const float *t = data + (triangleIndex / width) * 9 * width + triangleIndex % width;
+	for(int j = 0; j < 9; ++j)
+		dst[j] = t[j * width];
+#ifndef SOA_HAS_EDGES
+	for(int j = 0; j < 3; ++j)
+	{
+		dst[3 + j] -= dst[j];
+		dst[6 + j] -= dst[j];
+	}
+#endif
+}
+
 void TriangleMesh::ReallocVertexBuffer(int numTris)
 {
-#if defined(_MSC_VER) || defined(MATH_SSE)
+	// The SIMD kernels use aligned loads, 32 bytes for AVX.
+#ifdef _MSC_VER
 	_aligned_free(data);
 	data = (float*)_aligned_malloc(numTris*3*3*4, 32); // http://msdn.microsoft.com/en-us/library/8z34s9c6.aspx
 #else
 	free(data);
-	data = (float*)malloc(numTris*3*3*4); // http://msdn.microsoft.com/en-us/library/8z34s9c6.aspx
+	void *ptr = 0;
+	data = (posix_memalign(&ptr, 32, numTris*3*3*4) == 0 ? (float*)ptr : 0);
 #endif
 	numTriangles = numTris;
 }
@@ -250,84 +213,68 @@ void TriangleMesh::SetAoS(const float *vertexData, int numTriangles)
 #ifdef _DEBUG
 	vertexDataLayout = 0; // AoS
 #endif
+	simd = SIMD_NONE;
 
 	memcpy(data, vertexData, numTriangles*3*3*4);
 }
 
 void TriangleMesh::SetSoA4(const float *vertexData, int numTriangles)
 {
-	ReallocVertexBuffer(numTriangles);
+#if defined(MATH_DISPATCH_SSE41) || defined(MATH_DISPATCH_SSE2)
+	const SIMDCapability capability = ActiveSIMDCapability();
+	if (capability >= SIMD_SSE2)
+	{
+		SetSoA(vertexData, numTriangles, 4);
 #ifdef _DEBUG
-	vertexDataLayout = 1; // SoA4
+		vertexDataLayout = 1; // SoA4
 #endif
-
-	// From (xyz xyz xyz) (xyz xyz xyz) (xyz xyz xyz) (xyz xyz xyz)
-	// To xxxx yyyy zzzz xxxx yyyy zzzz xxxx yyyy zzzz
-
-	float *o = data;
-	for(int i = 0; i + 4 <= numTriangles; i += 4)
-	{
-		for(int j = 0; j < 9; ++j)
-		{
-			*o++ = vertexData[0];
-			*o++ = vertexData[9];
-			*o++ = vertexData[18];
-			*o++ = vertexData[27];
-			++vertexData;
-		}
-		vertexData += 9 * 3;
-	}
-
-#ifdef SOA_HAS_EDGES
-	o = data;
-	for(int i = 0; i + 4 <= numTriangles; i += 4)
-	{
-		for(int j = 12; j < 24; ++j)
-			o[j] -= o[j-12];
-		for(int j = 24; j < 36; ++j)
-			o[j] -= o[j-24];
-		o += 36;
+		simd = (capability >= SIMD_SSE41 ? SIMD_SSE41 : SIMD_SSE2);
+		return;
 	}
 #endif
+	SetAoS(vertexData, numTriangles);
 }
 
 void TriangleMesh::SetSoA8(const float *vertexData, int numTriangles)
 {
-	ReallocVertexBuffer(numTriangles);
+#ifdef MATH_DISPATCH_AVX
+	if (ActiveSIMDCapability() >= SIMD_AVX)
+	{
+		SetSoA(vertexData, numTriangles, 8);
 #ifdef _DEBUG
-	vertexDataLayout = 2; // SoA8
+		vertexDataLayout = 2; // SoA8
 #endif
+		simd = SIMD_AVX;
+		return;
+	}
+#endif
+	SetSoA4(vertexData, numTriangles);
+}
 
+void TriangleMesh::SetSoA(const float *vertexData, int numTris, int width)
+{
 	// From (xyz xyz xyz) (xyz xyz xyz) (xyz xyz xyz) (xyz xyz xyz)
-	// To xxxxxxxx yyyyyyyy zzzzzzzz xxxxxxxx yyyyyyyy zzzzzzzz xxxxxxxx yyyyyyyy zzzzzzzz
+	// To xxxx yyyy zzzz xxxx yyyy zzzz xxxx yyyy zzzz for the width 4.
+	// The last group is padded with zero triangles, which the kernels reject as degenerate, as they process full groups only.
+	const int paddedTris = (numTris + width - 1) / width * width;
+	ReallocVertexBuffer(paddedTris);
 
 	float *o = data;
-	for(int i = 0; i + 8 <= numTriangles; i += 8)
-	{
+	for(int i = 0; i < paddedTris; i += width)
 		for(int j = 0; j < 9; ++j)
-		{
-			*o++ = vertexData[0];
-			*o++ = vertexData[9];
-			*o++ = vertexData[18];
-			*o++ = vertexData[27];
-			*o++ = vertexData[36];
-			*o++ = vertexData[45];
-			*o++ = vertexData[54];
-			*o++ = vertexData[63];
-			++vertexData;
-		}
-		vertexData += 9 * 7;
-	}
+			for(int k = 0; k < width; ++k)
+				*o++ = (i + k < numTris ? vertexData[(i + k) * 9 + j] : 0.f);
 
 #ifdef SOA_HAS_EDGES
+	const int vertexSize = 3 * width;
 	o = data;
-	for(int i = 0; i + 8 <= numTriangles; i += 8)
+	for(int i = 0; i < paddedTris; i += width)
 	{
-		for(int j = 24; j < 48; ++j)
-			o[j] -= o[j-24];
-		for(int j = 48; j < 72; ++j)
-			o[j] -= o[j-48];
-		o += 72;
+		for(int j = vertexSize; j < 2 * vertexSize; ++j)
+			o[j] -= o[j - vertexSize];
+		for(int j = 2 * vertexSize; j < 3 * vertexSize; ++j)
+			o[j] -= o[j - 2 * vertexSize];
+		o += 3 * vertexSize;
 	}
 #endif
 }
@@ -361,47 +308,3 @@ float TriangleMesh::IntersectRay_TriangleIndex_UV_CPP(const Ray &ray, int &outTr
 }
 
 MATH_END_NAMESPACE
-
-#ifdef MATH_SSE2
-#define MATH_GEN_SSE2
-#include "TriangleMesh_IntersectRay_SSE.inl"
-
-#define MATH_GEN_SSE2
-#define MATH_GEN_TRIANGLEINDEX
-#include "TriangleMesh_IntersectRay_SSE.inl"
-
-#define MATH_GEN_SSE2
-#define MATH_GEN_TRIANGLEINDEX
-#define MATH_GEN_UV
-#include "TriangleMesh_IntersectRay_SSE.inl"
-#endif
-
-#ifdef MATH_SSE41
-#define MATH_GEN_SSE41
-#include "TriangleMesh_IntersectRay_SSE.inl"
-
-#define MATH_GEN_SSE41
-#define MATH_GEN_TRIANGLEINDEX
-#include "TriangleMesh_IntersectRay_SSE.inl"
-
-#define MATH_GEN_SSE41
-#define MATH_GEN_TRIANGLEINDEX
-#define MATH_GEN_UV
-#include "TriangleMesh_IntersectRay_SSE.inl"
-#endif
-
-#ifdef MATH_AVX
-#define MATH_GEN_AVX
-#include "TriangleMesh_IntersectRay_AVX.inl"
-
-#define MATH_GEN_AVX
-#define MATH_GEN_TRIANGLEINDEX
-#include "TriangleMesh_IntersectRay_AVX.inl"
-
-#define MATH_GEN_AVX
-#define MATH_GEN_TRIANGLEINDEX
-#define MATH_GEN_UV
-#include "TriangleMesh_IntersectRay_AVX.inl"
-#endif
-
-#endif
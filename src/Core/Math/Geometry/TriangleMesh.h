@@ -18,16 +18,26 @@
 #pragma once
 
 #include "Math/MathFwd.h"
+#include "Math/SIMDCapability.h"
+
+// If defined, we preprocess our TriangleMesh data structure to contain (v0, v1-v0, v2-v0)
+// instead of (v0, v1, v2) triplets for faster ray-triangle mesh intersection.
+#define SOA_HAS_EDGES
 
 MATH_BEGIN_NAMESPACE
 
 /// Represents an unindiced triangle mesh.
-/** This class stores a triangle mesh as flat array, optimized for ray intersections. */
+/** This class stores a triangle mesh as flat array, optimized for ray intersections.
+	Set lays the data out for the SIMD kernels of ActiveSIMDCapability, which the IntersectRay functions then use,
+	so one binary uses the AVX kernels on a CPU that has AVX and the SSE or C++ ones elsewhere. */
 class TriangleMesh
 {
 public:
+	TriangleMesh();
+	~TriangleMesh();
+
 	/// Specifies the vertex data of this triangle mesh. Replaces any old
-	/// specified geometry.
+	/// specified geometry. The layout follows ActiveSIMDCapability at the time of the call.
 	void Set(const float *triangleMesh, int numTriangles);
 	void Set(const float3 *triangleMesh, int numTriangles) { Set(reinterpret_cast<const float *>(triangleMesh), numTriangles); }
 	void Set(const Triangle *triangleMesh, int numTriangles) { Set(reinterpret_cast<const float *>(triangleMesh), numTriangles); }
@@ -36,25 +46,38 @@ public:
 	float IntersectRay_TriangleIndex(const Ray &ray, int &outTriangleIndex) const;
 	float IntersectRay_TriangleIndex_UV(const Ray &ray, int &outTriangleIndex, float &outU, float &outV) const;
 
+	/// Intersects each of the rays with the mesh as IntersectRay_TriangleIndex_UV, but tests the triangles against
+	/// packets of rays, one SIMD lane per ray, so that each triangle is loaded once per packet instead of once per ray.
+	/** Pays off for many rays at once, the more so the more coherent they are, f.ex. the rays of ambient occlusion
+		baking from a point. For a ray that misses, the distance is FLOAT_INF and the triangle index -1.
+		@param outU, outV May be null if the barycentric coordinates of the hits are not needed. */
+	void IntersectRays(const Ray *rays, int numRays, float *outDistances, int *outTriangleIndices, float *outU = 0, float *outV = 0) const;
+
+	/// The number of the rays IntersectRays tests at once.
+	static const int rayPacketSize = 32;
+
+	/// Lays the data out for the C++ kernel.
 	void SetAoS(const float *vertexData, int numTriangles);
+	/// Lays the data out for the SSE kernels, or as SetAoS if the CPU has no SSE2.
 	void SetSoA4(const float *vertexData, int numTriangles);
+	/// Lays the data out for the AVX kernels, or as SetSoA4 if the CPU has no AVX.
 	void SetSoA8(const float *vertexData, int numTriangles);
 
 	float IntersectRay_TriangleIndex_UV_CPP(const Ray &ray, int &outTriangleIndex, float &outU, float &outV) const;
 
-#ifdef MATH_SSE2
+#ifdef MATH_DISPATCH_SSE2
 	float IntersectRay_SSE2(const Ray &ray) const;
 	float IntersectRay_TriangleIndex_SSE2(const Ray &ray, int &outTriangleIndex) const;
 	float IntersectRay_TriangleIndex_UV_SSE2(const Ray &ray, int &outTriangleIndex, float &outU, float &outV) const;
 #endif
 
-#ifdef MATH_SSE41
+#ifdef MATH_DISPATCH_SSE41
 	float IntersectRay_SSE41(const Ray &ray) const;
 	float IntersectRay_TriangleIndex_SSE41(const Ray &ray, int &outTriangleIndex) const;
 	float IntersectRay_TriangleIndex_UV_SSE41(const Ray &ray, int &outTriangleIndex, float &outU, float &outV) const;
 #endif
 
-#ifdef MATH_AVX
+#ifdef MATH_DISPATCH_AVX
 	float IntersectRay_AVX(const Ray &ray) const;
 	float IntersectRay_TriangleIndex_AVX(const Ray &ray, int &outTriangleIndex) const;
 	float IntersectRay_TriangleIndex_UV_AVX(const Ray &ray, int &outTriangleIndex, float &outU, float &outV) const;
@@ -65,8 +88,18 @@ private:
 #ifdef _DEBUG
 	int vertexDataLayout; // 0 - AoS, 1 - SoA4, 2 - SoA8
 #endif
-	int numTriangles;
+	int numTriangles; ///< In the SoA layouts, rounded up to the SIMD width with degenerate triangles that never hit.
+	SIMDCapability simd; ///< The kernels the data is laid out for.
 	void ReallocVertexBuffer(int numTriangles);
+	void SetSoA(const float *vertexData, int numTriangles, int width);
+	/// Returns the first vertex of the triangle and its edges from it to the other two, from any of the layouts.
+	void TriangleEdges(int triangleIndex, float *dst) const;
+	/// Intersects at most rayPacketSize rays with the mesh.
+	void IntersectRayPacket(const Ray *rays, int numRays, float *outDistances, int *outTriangleIndices, float *outU, float *outV) const;
+
+	// Owns the vertex buffer, so noncopyable.
+	TriangleMesh(const TriangleMesh &);
+	void operator =(const TriangleMesh &);
 };
 
 MATH_END_NAMESPACE
@@ -0,0 +1,26 @@
+/**
+    For conditions of distribution and use, see copyright notice in LICENSE
+
+    @file   TriangleMesh_AVX.cpp
+    @brief  AVX ray intersection kernels of TriangleMesh. Compiled with the AVX flags, see Math/SIMDCapability.h. */
+
+#include "TriangleMesh.h"
+
+#ifdef MATH_DISPATCH_AVX
+
+#include "Geometry/Ray.h"
+#include "Math/MathConstants.h"
+#include "myassert.h"
+
+#include <immintrin.h>
+
+#include "TriangleMesh_IntersectRay_AVX.inl"
+
+#define MATH_GEN_TRIANGLEINDEX
+#include "TriangleMesh_IntersectRay_AVX.inl"
+
+#define MATH_GEN_TRIANGLEINDEX
+#define MATH_GEN_UV
+#include "TriangleMesh_IntersectRay_AVX.inl"
+
+#endif
@@ -0,0 +1,29 @@
+/**
+    For conditions of distribution and use, see copyright notice in LICENSE
+
+    @file   TriangleMesh_SSE41.cpp
+    @brief  SSE41 ray intersection kernels of TriangleMesh. Compiled with the SSE41 flags, see Math/SIMDCapability.h. */
+
+#include "TriangleMesh.h"
+
+#ifdef MATH_DISPATCH_SSE41
+
+#include "Geometry/Ray.h"
+#include "Math/MathConstants.h"
+#include "myassert.h"
+
+#include <smmintrin.h>
+
+#define MATH_GEN_SSE41
+#include "TriangleMesh_IntersectRay_SSE.inl"
+
+#define MATH_GEN_SSE41
+#define MATH_GEN_TRIANGLEINDEX
+#include "TriangleMesh_IntersectRay_SSE.inl"
+
+#define MATH_GEN_SSE41
+#define MATH_GEN_TRIANGLEINDEX
+#define MATH_GEN_UV
+#include "TriangleMesh_IntersectRay_SSE.inl"
+
+#endif
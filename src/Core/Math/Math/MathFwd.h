@@ -92,6 +92,7 @@ class TranslateOp;
 class Torus;
 class ScaleOp;
 class Triangle;
+class TriangleMesh;
 class LCG;
 
 MATH_END_NAMESPACE
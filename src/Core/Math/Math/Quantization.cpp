@@ -0,0 +1,181 @@
+/**
+    For conditions of distribution and use, see copyright notice in LICENSE
+
+    @file   Quantization.cpp
+    @brief  Lossy compact encodings of floats, unit vectors and rotations, for sending them over the network. */
+
+#include "Math/Quantization.h"
+#include "Math/float3.h"
+#include "Math/Quat.h"
+#include "assume.h"
+
+#include <math.h>
+#include <string.h>
+
+MATH_BEGIN_NAMESPACE
+
+namespace
+{
+
+inline u32 FloatBits(float value)
+{
+    u32 bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+inline float BitsFloat(u32 bits)
+{
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+inline u32 MaxCode(int numBits)
+{
+    return numBits >= 32 ? 0xFFFFFFFFu : (1u << numBits) - 1;
+}
+
+inline float SignNotZero(float value)
+{
+    return value < 0.f ? -1.f : 1.f;
+}
+
+/// The largest magnitude of the three smallest components of a unit quaternion.
+const float cSmallestThreeRange = 0.70710678118654752f;
+
+} // ~unnamed namespace
+
+u32 QuantizeRange(float value, float minValue, float maxValue, int numBits)
+{
+    assume(numBits >= 1 && numBits <= 32);
+    assume(minValue < maxValue);
+    if (!(value > minValue)) // Also catches NaN.
+        return 0;
+    if (value >= maxValue)
+        return MaxCode(numBits);
+    // In double, so that the 25-32 bit codes get their precision.
+    return (u32)((double)(value - minValue) / ((double)maxValue - minValue) * MaxCode(numBits) + 0.5);
+}
+
+float DequantizeRange(u32 quantized, float minValue, float maxValue, int numBits)
+{
+    assume(numBits >= 1 && numBits <= 32);
+    return (float)(minValue + (double)quantized * ((double)maxValue - minValue) / MaxCode(numBits));
+}
+
+u32 QuantizeOctahedral(const float3 &direction, int bitsPerAxis)
+{
+    assume(bitsPerAxis >= 1 && bitsPerAxis <= 16);
+    // Project to the octahedron |x| + |y| + |z| = 1, and fold its lower half over the upper one.
+    const float length = fabs(direction.x) + fabs(direction.y) + fabs(direction.z);
+    float x = 0.f, y = 0.f;
+    if (length > 0.f)
+    {
+        x = direction.x / length;
+        y = direction.y / length;
+        if (direction.z < 0.f)
+        {
+            const float foldedX = (1.f - fabs(y)) * SignNotZero(x);
+            y = (1.f - fabs(x)) * SignNotZero(y);
+            x = foldedX;
+        }
+    }
+    return (QuantizeRange(x, -1.f, 1.f, bitsPerAxis) << bitsPerAxis) | QuantizeRange(y, -1.f, 1.f, bitsPerAxis);
+}
+
+float3 DequantizeOctahedral(u32 quantized, int bitsPerAxis)
+{
+    assume(bitsPerAxis >= 1 && bitsPerAxis <= 16);
+    float x = DequantizeRange(quantized >> bitsPerAxis, -1.f, 1.f, bitsPerAxis);
+    float y = DequantizeRange(quantized & MaxCode(bitsPerAxis), -1.f, 1.f, bitsPerAxis);
+    const float z = 1.f - fabs(x) - fabs(y);
+    if (z < 0.f)
+    {
+        const float unfoldedX = (1.f - fabs(y)) * SignNotZero(x);
+        y = (1.f - fabs(x)) * SignNotZero(y);
+        x = unfoldedX;
+    }
+    float3 direction(x, y, z);
+    direction.Normalize();
+    return direction;
+}
+
+u64 QuantizeQuatSmallestThree(const Quat &rotation, int bitsPerComponent)
+{
+    assume(bitsPerComponent >= 2 && bitsPerComponent <= 20);
+    float q[4] = { rotation.x, rotation.y, rotation.z, rotation.w };
+    const float length = sqrtf(q[0]*q[0] + q[1]*q[1] + q[2]*q[2] + q[3]*q[3]);
+    int largest = 3;
+    for(int i = 0; i < 3; ++i)
+        if (fabs(q[i]) > fabs(q[largest]))
+            largest = i;
+    if (!(length > 0.f))
+        return (u64)3 << (3 * bitsPerComponent); // Identity for a zero or NaN quaternion.
+    const float scale = (q[largest] < 0.f ? -1.f : 1.f) / length;
+
+    u64 quantized = (u64)largest;
+    for(int i = 0; i < 4; ++i)
+        if (i != largest)
+            quantized = (quantized << bitsPerComponent) | QuantizeRange(q[i] * scale, -cSmallestThreeRange, cSmallestThreeRange, bitsPerComponent);
+    return quantized;
+}
+
+Quat DequantizeQuatSmallestThree(u64 quantized, int bitsPerComponent)
+{
+    assume(bitsPerComponent >= 2 && bitsPerComponent <= 20);
+    const int largest = (int)(quantized >> (3 * bitsPerComponent)) & 3;
+    float q[4];
+    float sumSq = 0.f;
+    int shift = 2 * bitsPerComponent;
+    for(int i = 0; i < 4; ++i)
+        if (i != largest)
+        {
+            q[i] = DequantizeRange((u32)(quantized >> shift) & MaxCode(bitsPerComponent), -cSmallestThreeRange, cSmallestThreeRange, bitsPerComponent);
+            sumSq += q[i] * q[i];
+            shift -= bitsPerComponent;
+        }
+    q[largest] = sqrtf(sumSq < 1.f ? 1.f - sumSq : 0.f);
+    Quat rotation(q[0], q[1], q[2], q[3]);
+    rotation.Normalize();
+    return rotation;
+}
+
+u16 FloatToHalf(float value)
+{
+    const u32 bits = FloatBits(value);
+    const u32 sign = (bits >> 16) & 0x8000;
+    const u32 magnitude = bits & 0x7FFFFFFF;
+
+    if (magnitude >= 0x7F800000) // Infinity or NaN, the latter kept quiet.
+        return (u16)(sign | 0x7C00 | (magnitude > 0x7F800000 ? 0x200 : 0));
+    if (magnitude >= 0x477FF000) // 65520 and above round to infinity.
+        return (u16)(sign | 0x7C00);
+    if (magnitude < 0x38800000) // Below the smallest normal half, 2^-14.
+    {
+        // Scale the denormal steps of 2^-24 to integers, and let adding 2^23 round them to the nearest even.
+        const float scaled = BitsFloat(magnitude) * 16777216.f;
+        return (u16)(sign | (FloatBits(scaled + 8388608.f) - 0x4B000000));
+    }
+
+    // Rebias the exponent from 127 to 15 and drop 13 bits of the mantissa, rounding to the nearest even.
+    u32 half = (magnitude - 0x38000000) >> 13;
+    const u32 rest = magnitude & 0x1FFF;
+    if (rest > 0x1000 || (rest == 0x1000 && (half & 1)))
+        ++half;
+    return (u16)(sign | half);
+}
+
+float HalfToFloat(u16 value)
+{
+    const u32 sign = (u32)(value & 0x8000) << 16;
+    const u32 exponent = (value >> 10) & 0x1F;
+    const u32 mantissa = value & 0x3FF;
+    if (exponent == 0) // Zero or denormal, in steps of 2^-24.
+        return BitsFloat(sign | FloatBits(mantissa * (1.f / 16777216.f)));
+    if (exponent == 31)
+        return BitsFloat(sign | 0x7F800000 | (mantissa << 13));
+    return BitsFloat(sign | ((exponent + 112) << 23) | (mantissa << 13));
+}
+
+MATH_END_NAMESPACE
@@ -0,0 +1,48 @@
+/**
+    For conditions of distribution and use, see copyright notice in LICENSE
+
+    @file   Quantization.h
+    @brief  Lossy compact encodings of floats, unit vectors and rotations, for sending them over the network. */
+
+#pragma once
+
+#include "Math/MathFwd.h"
+#include "Types.h"
+
+MATH_BEGIN_NAMESPACE
+
+/// Quantizes the value, clamped to [minValue, maxValue], to an integer of numBits bits, 1-32.
+/** Rounds to the nearest step, so that minValue and maxValue themselves encode exactly. A NaN encodes as minValue. */
+u32 QuantizeRange(float value, float minValue, float maxValue, int numBits);
+
+/// Returns the value of a code of QuantizeRange.
+float DequantizeRange(u32 quantized, float minValue, float maxValue, int numBits);
+
+/// Encodes a unit direction vector with the octahedral mapping to 2*bitsPerAxis bits, bitsPerAxis 1-16.
+/** The octahedral mapping spreads the error evenly over the sphere, unlike the yaw and pitch of
+    kNet::DataSerializer::AddNormalizedVector3D, which wastes precision at the poles. With 8 bits per axis the error
+    is below one degree. Direction need not be normalized. A zero vector encodes as +Z. */
+u32 QuantizeOctahedral(const float3 &direction, int bitsPerAxis);
+
+/// Returns the normalized direction of a code of QuantizeOctahedral.
+float3 DequantizeOctahedral(u32 quantized, int bitsPerAxis);
+
+/// Encodes a rotation with the smallest three method to 2 + 3*bitsPerComponent bits, bitsPerComponent 2-20.
+/** Two bits tell the largest component of the normalized quaternion, which is dropped, and the other three,
+    which lie in [-1/sqrt(2), 1/sqrt(2)], follow with bitsPerComponent bits each. The largest component is recovered
+    from the unit length. As q and -q are the same rotation, the sign is chosen so that the dropped one is positive.
+    With 10 bits per component the error is below a quarter of a degree.
+    The bits are, from high to low: the index of the dropped component, then the remaining components in the order x, y, z, w. */
+u64 QuantizeQuatSmallestThree(const Quat &rotation, int bitsPerComponent);
+
+/// Returns the normalized rotation of a code of QuantizeQuatSmallestThree.
+Quat DequantizeQuatSmallestThree(u64 quantized, int bitsPerComponent);
+
+/// Converts the value to the nearest IEEE 754 half-precision float, with the infinities and NaNs kept as such.
+/** Values of a magnitude of at least 65520 round to infinity (the ones up to that to 65504), and ones of at most 2^-25 to zero. */
+u16 FloatToHalf(float value);
+
+/// Converts an IEEE 754 half-precision float to a float, exactly.
+float HalfToFloat(u16 value);
+
+MATH_END_NAMESPACE
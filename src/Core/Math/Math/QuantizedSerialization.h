@@ -0,0 +1,92 @@
+/**
+    For conditions of distribution and use, see copyright notice in LICENSE
+
+    @file   QuantizedSerialization.h
+    @brief  Bit-packed writing and reading of the encodings of Quantization.h with kNet::DataSerializer and DataDeserializer. */
+
+#pragma once
+
+#include "Math/Quantization.h"
+#include "Math/float3.h"
+#include "Math/Quat.h"
+
+#include <kNet/DataSerializer.h>
+#include <kNet/DataDeserializer.h>
+
+MATH_BEGIN_NAMESPACE
+
+// Inline, so that the Math library itself does not depend on kNet. Each value takes exactly the bits of its encoding,
+// without byte alignment, so consecutive values pack tightly.
+
+/// Writes the value, clamped to [minValue, maxValue], with numBits bits. See QuantizeRange.
+inline void AddQuantizedRange(kNet::DataSerializer &ds, float value, float minValue, float maxValue, int numBits)
+{
+    ds.AppendBits(QuantizeRange(value, minValue, maxValue, numBits), numBits);
+}
+
+inline float ReadQuantizedRange(kNet::DataDeserializer &dd, float minValue, float maxValue, int numBits)
+{
+    return DequantizeRange(dd.ReadBits(numBits), minValue, maxValue, numBits);
+}
+
+/// Writes each coordinate, clamped to [minValue, maxValue], with numBits bits.
+inline void AddQuantizedFloat3(kNet::DataSerializer &ds, const float3 &value, float minValue, float maxValue, int numBits)
+{
+    AddQuantizedRange(ds, value.x, minValue, maxValue, numBits);
+    AddQuantizedRange(ds, value.y, minValue, maxValue, numBits);
+    AddQuantizedRange(ds, value.z, minValue, maxValue, numBits);
+}
+
+inline float3 ReadQuantizedFloat3(kNet::DataDeserializer &dd, float minValue, float maxValue, int numBits)
+{
+    float3 value;
+    value.x = ReadQuantizedRange(dd, minValue, maxValue, numBits);
+    value.y = ReadQuantizedRange(dd, minValue, maxValue, numBits);
+    value.z = ReadQuantizedRange(dd, minValue, maxValue, numBits);
+    return value;
+}
+
+/// Writes a unit direction vector with 2*bitsPerAxis bits. See QuantizeOctahedral.
+inline void AddOctahedral(kNet::DataSerializer &ds, const float3 &direction, int bitsPerAxis)
+{
+    ds.AppendBits(QuantizeOctahedral(direction, bitsPerAxis), 2 * bitsPerAxis);
+}
+
+inline float3 ReadOctahedral(kNet::DataDeserializer &dd, int bitsPerAxis)
+{
+    return DequantizeOctahedral(dd.ReadBits(2 * bitsPerAxis), bitsPerAxis);
+}
+
+/// Writes a rotation with 2 + 3*bitsPerComponent bits. See QuantizeQuatSmallestThree.
+inline void AddQuatSmallestThree(kNet::DataSerializer &ds, const Quat &rotation, int bitsPerComponent)
+{
+    // AppendBits takes at most 32 bits at a time.
+    const u64 quantized = QuantizeQuatSmallestThree(rotation, bitsPerComponent);
+    const int numBits = 2 + 3 * bitsPerComponent;
+    if (numBits > 32)
+        ds.AppendBits((u32)(quantized >> 32), numBits - 32);
+    ds.AppendBits((u32)quantized, numBits < 32 ? numBits : 32);
+}
+
+inline Quat ReadQuatSmallestThree(kNet::DataDeserializer &dd, int bitsPerComponent)
+{
+    const int numBits = 2 + 3 * bitsPerComponent;
+    u64 quantized = 0;
+    if (numBits > 32)
+        quantized = (u64)dd.ReadBits(numBits - 32) << 32;
+    quantized |= dd.ReadBits(numBits < 32 ? numBits : 32);
+    return DequantizeQuatSmallestThree(quantized, bitsPerComponent);
+}
+
+/// Writes the value as a half-precision float, with 16 bits. See FloatToHalf.
+inline void AddHalf(kNet::DataSerializer &ds, float value)
+{
+    ds.AppendBits(FloatToHalf(value), 16);
+}
+
+inline float ReadHalf(kNet::DataDeserializer &dd)
+{
+    return HalfToFloat((u16)dd.ReadBits(16));
+}
+
+MATH_END_NAMESPACE
@@ -0,0 +1,127 @@
+/**
+    For conditions of distribution and use, see copyright notice in LICENSE
+
+    @file   SIMDCapability.cpp
+    @brief  Runtime detection of the SIMD instruction sets of the CPU, for dispatching the batch kernels. */
+
+#include "Math/SIMDCapability.h"
+
+#include <string.h>
+
+#if defined(MATH_DISPATCH_SSE2)
+#ifdef _MSC_VER
+#include <intrin.h>
+#ifdef MATH_DISPATCH_AVX
+#include <immintrin.h>
+#endif
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+MATH_BEGIN_NAMESPACE
+
+namespace
+{
+
+const char * const simdCapabilityNames[] = { "none", "sse", "sse2", "sse41", "avx" };
+
+/// The active level, or -1 until it is detected. Racing threads detect the same level, so no lock is needed.
+volatile int activeCapability = -1;
+
+#if defined(MATH_DISPATCH_SSE2)
+/// Returns the ECX and EDX of CPUID leaf 1, or false if the leaf is not supported.
+bool CPUIDFeatures(unsigned int &ecx, unsigned int &edx)
+{
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 1)
+        return false;
+    __cpuid(info, 1);
+    ecx = (unsigned int)info[2];
+    edx = (unsigned int)info[3];
+    return true;
+#else
+    unsigned int eax, ebx;
+    return __get_cpuid(1, &eax, &ebx, &ecx, &edx) != 0;
+#endif
+}
+
+#ifdef MATH_DISPATCH_AVX
+/// Returns whether the OS saves the XMM and YMM registers, from the XCR0 register. Call only if CPUID reports OSXSAVE.
+bool OSSavesYMM()
+{
+#ifdef _MSC_VER
+    const unsigned __int64 xcr0 = _xgetbv(0);
+#else
+    unsigned int eax, edx;
+    // xgetbv, as bytes for the assemblers that do not know the mnemonic.
+    __asm__ __volatile__(".byte 0x0f, 0x01, 0xd0" : "=a"(eax), "=d"(edx) : "c"(0));
+    const unsigned long long xcr0 = ((unsigned long long)edx << 32) | eax;
+#endif
+    return (xcr0 & 6) == 6;
+}
+#endif
+#endif
+
+} // ~unnamed namespace
+
+SIMDCapability DetectSIMDCapability()
+{
+#if defined(MATH_DISPATCH_SSE2)
+    unsigned int ecx = 0, edx = 0;
+    if (!CPUIDFeatures(ecx, edx))
+        return SIMD_NONE;
+#ifdef MATH_DISPATCH_AVX
+    const bool hasOSXSAVE = (ecx & (1 << 27)) != 0;
+    const bool hasAVX = (ecx & (1 << 28)) != 0;
+    if (hasOSXSAVE && hasAVX && OSSavesYMM())
+        return SIMD_AVX;
+#endif
+    if ((ecx & (1 << 19)) != 0)
+        return SIMD_SSE41;
+    if ((edx & (1 << 26)) != 0)
+        return SIMD_SSE2;
+    if ((edx & (1 << 25)) != 0)
+        return SIMD_SSE;
+#endif
+    return SIMD_NONE;
+}
+
+SIMDCapability ActiveSIMDCapability()
+{
+    int capability = activeCapability;
+    if (capability < 0)
+    {
+        capability = DetectSIMDCapability();
+        activeCapability = capability;
+    }
+    return (SIMDCapability)capability;
+}
+
+void SetActiveSIMDCapability(SIMDCapability capability)
+{
+    const SIMDCapability detected = DetectSIMDCapability();
+    activeCapability = (capability < detected ? capability : detected);
+}
+
+const char *SIMDCapabilityToString(SIMDCapability capability)
+{
+    if (capability < SIMD_NONE || capability > SIMD_AVX)
+        return "unknown";
+    return simdCapabilityNames[capability];
+}
+
+bool SIMDCapabilityFromString(const char *name, SIMDCapability &outCapability)
+{
+    for(int i = SIMD_NONE; name && i <= SIMD_AVX; ++i)
+        if (!strcmp(name, simdCapabilityNames[i]))
+        {
+            outCapability = (SIMDCapability)i;
+            return true;
+        }
+    return false;
+}
+
+MATH_END_NAMESPACE
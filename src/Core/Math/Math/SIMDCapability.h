@@ -0,0 +1,53 @@
+/**
+    For conditions of distribution and use, see copyright notice in LICENSE
+
+    @file   SIMDCapability.h
+    @brief  Runtime detection of the SIMD instruction sets of the CPU, for dispatching the batch kernels. */
+
+#pragma once
+
+#include "Math/MathNamespace.h"
+
+// The kernels of these instruction sets are compiled into their own translation units, with the compiler flags of the
+// instruction set (see Math/CMakeLists.txt), and selected at runtime. Unlike MATH_SSE and the others in
+// MathBuildConfig.h, these do not change the layout of the math classes or let the compiler use the instructions elsewhere.
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+#define MATH_DISPATCH_SSE2
+#define MATH_DISPATCH_SSE41
+// The AVX intrinsics need Visual Studio 2010 SP1 or GCC 4.4.
+#if (defined(_MSC_FULL_VER) && _MSC_FULL_VER >= 160040219) || defined(__clang__) || \
+    (defined(__GNUC__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 4)))
+#define MATH_DISPATCH_AVX
+#endif
+#endif
+
+MATH_BEGIN_NAMESPACE
+
+/// SIMD instruction set levels, each of which implies the ones before it.
+enum SIMDCapability
+{
+    SIMD_NONE,
+    SIMD_SSE,
+    SIMD_SSE2,
+    SIMD_SSE41,
+    SIMD_AVX
+};
+
+/// Returns the best instruction set that both the CPU and the operating system support, and that the kernels are compiled for.
+/** AVX is reported only if the OS saves the YMM registers on context switches. */
+SIMDCapability DetectSIMDCapability();
+
+/// Returns the instruction set the batch kernels and the new TriangleMeshes use, DetectSIMDCapability by default. Thread-safe.
+SIMDCapability ActiveSIMDCapability();
+
+/// Limits the instruction set of the batch kernels and the new TriangleMeshes, f.ex. to compare the kernels with each other.
+/** The level is clamped to DetectSIMDCapability. Call when no other thread uses the kernels. */
+void SetActiveSIMDCapability(SIMDCapability capability);
+
+/// Returns the name of an instruction set level, f.ex. "sse41".
+const char *SIMDCapabilityToString(SIMDCapability capability);
+
+/// Parses a name returned by SIMDCapabilityToString. Returns false if the name is not known.
+bool SIMDCapabilityFromString(const char *name, SIMDCapability &outCapability);
+
+MATH_END_NAMESPACE
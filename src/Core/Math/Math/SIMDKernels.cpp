@@ -0,0 +1,217 @@
+/**
+    For conditions of distribution and use, see copyright notice in LICENSE
+
+    @file   SIMDKernels.cpp
+    @brief  The batch kernels of float3x4, float4x4, AABB and ray packets, selected at runtime for ActiveSIMDCapability. */
+
+#include "Math/SIMDKernels.h"
+#include "Types.h"
+
+#include <math.h>
+
+MATH_BEGIN_NAMESPACE
+
+namespace
+{
+
+SIMDKernels kernels;
+/// The capability the kernels were selected for, or -1. The selection is idempotent, so racing threads need no lock.
+volatile int kernelsCapability = -1;
+
+void SelectKernels(SIMDCapability capability)
+{
+    kernels.transformFloat3 = &TransformFloat3_CPP;
+    kernels.transformFloat3SoA = &TransformFloat3SoA_CPP;
+    kernels.transformFloat4 = &TransformFloat4_CPP;
+    kernels.transformAABB = &TransformAABB_CPP;
+    kernels.transformAABBs = &TransformAABBs_CPP;
+    kernels.enclosePoints = &EnclosePoints_CPP;
+    kernels.cullAABBs = &CullAABBs_CPP;
+    kernels.intersectTriangleRays = &IntersectTriangleRays_CPP;
+#ifdef MATH_DISPATCH_SSE2
+    if (capability >= SIMD_SSE2)
+    {
+        kernels.transformFloat3 = &TransformFloat3_SSE2;
+        kernels.transformFloat3SoA = &TransformFloat3SoA_SSE2;
+        kernels.transformFloat4 = &TransformFloat4_SSE2;
+        kernels.transformAABB = &TransformAABB_SSE2;
+        kernels.transformAABBs = &TransformAABBs_SSE2;
+        kernels.enclosePoints = &EnclosePoints_SSE2;
+        kernels.cullAABBs = &CullAABBs_SSE2;
+        kernels.intersectTriangleRays = &IntersectTriangleRays_SSE2;
+    }
+#endif
+#ifdef MATH_DISPATCH_AVX
+    // An AABB or a point of the AoS bounds does not fill the wider registers, so those stay on SSE2.
+    if (capability >= SIMD_AVX)
+    {
+        kernels.transformFloat3 = &TransformFloat3_AVX;
+        kernels.transformFloat3SoA = &TransformFloat3SoA_AVX;
+        kernels.transformFloat4 = &TransformFloat4_AVX;
+        kernels.cullAABBs = &CullAABBs_AVX;
+        kernels.intersectTriangleRays = &IntersectTriangleRays_AVX;
+    }
+#endif
+}
+
+} // ~unnamed namespace
+
+const SIMDKernels &ActiveSIMDKernels()
+{
+    const SIMDCapability capability = ActiveSIMDCapability();
+    if (kernelsCapability != (int)capability)
+    {
+        SelectKernels(capability);
+        kernelsCapability = capability;
+    }
+    return kernels;
+}
+
+void TransformFloat3_CPP(const float *m, float *points, int numPoints, int stride, float w)
+{
+    u8 *data = reinterpret_cast<u8*>(points);
+    for(int i = 0; i < numPoints; ++i)
+    {
+        float *p = reinterpret_cast<float*>(data + stride*i);
+        const float x = p[0], y = p[1], z = p[2];
+        p[0] = m[0]*x + m[1]*y + m[2]*z + m[3]*w;
+        p[1] = m[4]*x + m[5]*y + m[6]*z + m[7]*w;
+        p[2] = m[8]*x + m[9]*y + m[10]*z + m[11]*w;
+    }
+}
+
+void TransformFloat3SoA_CPP(const float *m, float *xs, float *ys, float *zs, int numPoints, float w)
+{
+    const float tx = m[3]*w, ty = m[7]*w, tz = m[11]*w;
+    for(int i = 0; i < numPoints; ++i)
+    {
+        const float x = xs[i], y = ys[i], z = zs[i];
+        xs[i] = m[0]*x + m[1]*y + m[2]*z + tx;
+        ys[i] = m[4]*x + m[5]*y + m[6]*z + ty;
+        zs[i] = m[8]*x + m[9]*y + m[10]*z + tz;
+    }
+}
+
+void TransformFloat4_CPP(const float *m, float *vectors, int numVectors, int stride)
+{
+    u8 *data = reinterpret_cast<u8*>(vectors);
+    for(int i = 0; i < numVectors; ++i)
+    {
+        float *v = reinterpret_cast<float*>(data + stride*i);
+        const float x = v[0], y = v[1], z = v[2], w = v[3];
+        v[0] = m[0]*x + m[1]*y + m[2]*z + m[3]*w;
+        v[1] = m[4]*x + m[5]*y + m[6]*z + m[7]*w;
+        v[2] = m[8]*x + m[9]*y + m[10]*z + m[11]*w;
+    }
+}
+
+void TransformAABB_CPP(const float *m, float *minPoint, float *maxPoint)
+{
+    float center[3], halfSize[3];
+    for(int i = 0; i < 3; ++i)
+    {
+        center[i] = (minPoint[i] + maxPoint[i]) * 0.5f;
+        halfSize[i] = (maxPoint[i] - minPoint[i]) * 0.5f;
+    }
+    for(int i = 0; i < 3; ++i)
+    {
+        const float *row = m + 4*i;
+        const float newCenter = row[0]*center[0] + row[1]*center[1] + row[2]*center[2] + row[3];
+        // Equal to taking the absolute value of the whole matrix.
+        const float newHalfSize = fabs(row[0])*halfSize[0] + fabs(row[1])*halfSize[1] + fabs(row[2])*halfSize[2];
+        minPoint[i] = newCenter - newHalfSize;
+        maxPoint[i] = newCenter + newHalfSize;
+    }
+}
+
+void TransformAABBs_CPP(const float *m, float *aabbs, int numAABBs, int stride)
+{
+    u8 *data = reinterpret_cast<u8*>(aabbs);
+    for(int i = 0; i < numAABBs; ++i)
+    {
+        float *aabb = reinterpret_cast<float*>(data + stride*i);
+        TransformAABB_CPP(m, aabb, aabb + 3);
+    }
+}
+
+void EnclosePoints_CPP(const float *points, int numPoints, int stride, float *minPoint, float *maxPoint)
+{
+    const u8 *data = reinterpret_cast<const u8*>(points);
+    for(int i = 0; i < numPoints; ++i)
+    {
+        const float *p = reinterpret_cast<const float*>(data + stride*i);
+        // As minps and maxps, and AABB::Enclose: a NaN coordinate propagates to the bounds.
+        for(int j = 0; j < 3; ++j)
+        {
+            minPoint[j] = (minPoint[j] < p[j] ? minPoint[j] : p[j]);
+            maxPoint[j] = (maxPoint[j] > p[j] ? maxPoint[j] : p[j]);
+        }
+    }
+}
+
+void CullAABBs_CPP(const float *planes, int numPlanes, const float *aabbs, int numAABBs, int stride, u32 *visibleMask)
+{
+    for(int i = 0; i < (numAABBs + 31) / 32; ++i)
+        visibleMask[i] = 0;
+    const u8 *data = reinterpret_cast<const u8*>(aabbs);
+    for(int i = 0; i < numAABBs; ++i)
+    {
+        const float *aabb = reinterpret_cast<const float*>(data + stride*i);
+        float center[3], halfSize[3];
+        for(int j = 0; j < 3; ++j)
+        {
+            center[j] = (aabb[j] + aabb[j+3]) * 0.5f;
+            halfSize[j] = (aabb[j+3] - aabb[j]) * 0.5f;
+        }
+        // The box is outside a plane if its center is farther out than the projection radius of the box on the normal.
+        bool outside = false;
+        for(int p = 0; p < numPlanes && !outside; ++p)
+        {
+            const float *plane = planes + 4*p;
+            const float distance = plane[0]*center[0] + plane[1]*center[1] + plane[2]*center[2] - plane[3];
+            const float radius = fabs(plane[0])*halfSize[0] + fabs(plane[1])*halfSize[1] + fabs(plane[2])*halfSize[2];
+            outside = distance > radius;
+        }
+        if (!outside)
+            visibleMask[i >> 5] |= 1u << (i & 31);
+    }
+}
+
+u32 IntersectTriangleRays_CPP(const float *tri, const float *rays, int numRays, float *tMax, float *outU, float *outV)
+{
+    const float epsilon = 1e-4f; // As in Triangle::IntersectLineTri, which this follows operation by operation.
+    const float *posX = rays, *posY = rays + numRays, *posZ = rays + 2*numRays;
+    const float *dirX = rays + 3*numRays, *dirY = rays + 4*numRays, *dirZ = rays + 5*numRays;
+    u32 hits = 0;
+    for(int i = 0; i < numRays; ++i)
+    {
+        const float px = dirY[i]*tri[8] - dirZ[i]*tri[7];
+        const float py = dirZ[i]*tri[6] - dirX[i]*tri[8];
+        const float pz = dirX[i]*tri[7] - dirY[i]*tri[6];
+        const float det = tri[3]*px + tri[4]*py + tri[5]*pz;
+        if (fabs(det) <= epsilon)
+            continue;
+        const float recipDet = 1.f / det;
+        const float tx = posX[i] - tri[0], ty = posY[i] - tri[1], tz = posZ[i] - tri[2];
+        const float u = (tx*px + ty*py + tz*pz) * recipDet;
+        if (!(u >= -epsilon && u <= 1.f + epsilon))
+            continue;
+        const float qx = ty*tri[5] - tz*tri[4];
+        const float qy = tz*tri[3] - tx*tri[5];
+        const float qz = tx*tri[4] - ty*tri[3];
+        const float v = (dirX[i]*qx + dirY[i]*qy + dirZ[i]*qz) * recipDet;
+        if (!(v >= -epsilon && u + v <= 1.f + epsilon))
+            continue;
+        const float t = (tri[6]*qx + tri[7]*qy + tri[8]*qz) * recipDet;
+        if (t >= 0.f && t < tMax[i])
+        {
+            tMax[i] = t;
+            outU[i] = u;
+            outV[i] = v;
+            hits |= 1u << i;
+        }
+    }
+    return hits;
+}
+
+MATH_END_NAMESPACE
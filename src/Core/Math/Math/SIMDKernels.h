@@ -0,0 +1,74 @@
+/**
+    For conditions of distribution and use, see copyright notice in LICENSE
+
+    @file   SIMDKernels.h
+    @brief  The batch kernels of float3x4, float4x4, AABB and ray packets, selected at runtime for ActiveSIMDCapability. */
+
+#pragma once
+
+#include "Math/SIMDCapability.h"
+#include "Types.h"
+
+MATH_BEGIN_NAMESPACE
+
+/// Function pointers to the best implementations of the batch kernels for ActiveSIMDCapability.
+/** The kernels take raw floats, so that the kernel translation units, which are compiled for their instruction set,
+    need not include the math classes. A matrix is the 12 floats of the first three rows of a row-major float3x4 or float4x4.
+    Each kernel has a CPP implementation, and SSE2 and AVX ones where they pay off. */
+struct SIMDKernels
+{
+    /// Transforms (x, y, z, w) of each point in place, with w 1 for positions and 0 for directions. stride is in bytes.
+    void (*transformFloat3)(const float *matrix, float *points, int numPoints, int stride, float w);
+    /// Transforms (x, y, z, w) of the points stored as separate x, y and z arrays in place.
+    void (*transformFloat3SoA)(const float *matrix, float *xs, float *ys, float *zs, int numPoints, float w);
+    /// Transforms each 4-vector in place, keeping its w. stride is in bytes.
+    void (*transformFloat4)(const float *matrix, float *vectors, int numVectors, int stride);
+    /// Transforms an AABB to the AABB that encloses the transformed box.
+    void (*transformAABB)(const float *matrix, float *minPoint, float *maxPoint);
+    /// Transforms each AABB, stored as its min and max points, in place as transformAABB. stride is in bytes.
+    void (*transformAABBs)(const float *matrix, float *aabbs, int numAABBs, int stride);
+    /// Grows minPoint and maxPoint to enclose the points. stride is in bytes.
+    void (*enclosePoints)(const float *points, int numPoints, int stride, float *minPoint, float *maxPoint);
+    /// Tests each AABB, stored as its min and max points, against the planes, stored as (normal, d) with the normals
+    /// pointing out of the volume. Sets bit i%32 of visibleMask[i/32] if AABB i is not wholly outside any of the planes,
+    /// and clears the rest of the (numAABBs+31)/32 words. stride is in bytes.
+    void (*cullAABBs)(const float *planes, int numPlanes, const float *aabbs, int numAABBs, int stride, u32 *visibleMask);
+    /// Intersects the rays with a triangle as Triangle::IntersectLineTri. The triangle is its first vertex and the edges
+    /// from it to the other two, and the rays are the arrays of their position x, y and z and direction x, y and z, of
+    /// numRays floats each, one after another. For each ray i that hits the triangle at a distance in [0, tMax[i]),
+    /// sets tMax[i], outU[i] and outV[i] to the hit, and sets bit i of the returned mask. numRays is at most 32.
+    u32 (*intersectTriangleRays)(const float *triangle, const float *rays, int numRays, float *tMax, float *outU, float *outV);
+};
+
+/// Returns the kernels for ActiveSIMDCapability, selecting them again when it has changed. Thread-safe.
+const SIMDKernels &ActiveSIMDKernels();
+
+void TransformFloat3_CPP(const float *matrix, float *points, int numPoints, int stride, float w);
+void TransformFloat3SoA_CPP(const float *matrix, float *xs, float *ys, float *zs, int numPoints, float w);
+void TransformFloat4_CPP(const float *matrix, float *vectors, int numVectors, int stride);
+void TransformAABB_CPP(const float *matrix, float *minPoint, float *maxPoint);
+void TransformAABBs_CPP(const float *matrix, float *aabbs, int numAABBs, int stride);
+void EnclosePoints_CPP(const float *points, int numPoints, int stride, float *minPoint, float *maxPoint);
+void CullAABBs_CPP(const float *planes, int numPlanes, const float *aabbs, int numAABBs, int stride, u32 *visibleMask);
+u32 IntersectTriangleRays_CPP(const float *triangle, const float *rays, int numRays, float *tMax, float *outU, float *outV);
+
+#ifdef MATH_DISPATCH_SSE2
+void TransformFloat3_SSE2(const float *matrix, float *points, int numPoints, int stride, float w);
+void TransformFloat3SoA_SSE2(const float *matrix, float *xs, float *ys, float *zs, int numPoints, float w);
+void TransformFloat4_SSE2(const float *matrix, float *vectors, int numVectors, int stride);
+void TransformAABB_SSE2(const float *matrix, float *minPoint, float *maxPoint);
+void TransformAABBs_SSE2(const float *matrix, float *aabbs, int numAABBs, int stride);
+void EnclosePoints_SSE2(const float *points, int numPoints, int stride, float *minPoint, float *maxPoint);
+void CullAABBs_SSE2(const float *planes, int numPlanes, const float *aabbs, int numAABBs, int stride, u32 *visibleMask);
+u32 IntersectTriangleRays_SSE2(const float *triangle, const float *rays, int numRays, float *tMax, float *outU, float *outV);
+#endif
+
+#ifdef MATH_DISPATCH_AVX
+void TransformFloat3_AVX(const float *matrix, float *points, int numPoints, int stride, float w);
+void TransformFloat3SoA_AVX(const float *matrix, float *xs, float *ys, float *zs, int numPoints, float w);
+void TransformFloat4_AVX(const float *matrix, float *vectors, int numVectors, int stride);
+void CullAABBs_AVX(const float *planes, int numPlanes, const float *aabbs, int numAABBs, int stride, u32 *visibleMask);
+u32 IntersectTriangleRays_AVX(const float *triangle, const float *rays, int numRays, float *tMax, float *outU, float *outV);
+#endif
+
+MATH_END_NAMESPACE
@@ -0,0 +1,283 @@
+/**
+    For conditions of distribution and use, see copyright notice in LICENSE
+
+    @file   SIMDKernels_AVX.cpp
+    @brief  AVX implementations of the batch kernels. Compiled with the AVX flags, see SIMDKernels.h. */
+
+#include "Math/SIMDKernels.h"
+
+#ifdef MATH_DISPATCH_AVX
+
+#include "Types.h"
+
+#include <immintrin.h>
+
+MATH_BEGIN_NAMESPACE
+
+// Use only intrinsics and the functions of this file here: an inline function of another header compiled in this
+// translation unit would contain AVX instructions, and the linker could pick it for the callers that run on any CPU.
+namespace
+{
+
+/// Loads (x, y, z, 0) without reading past the third float.
+inline __m128 Load3(const float *p)
+{
+    const __m128 xy = _mm_castpd_ps(_mm_load_sd(reinterpret_cast<const double*>(p)));
+    return _mm_movelh_ps(xy, _mm_load_ss(p + 2));
+}
+
+/// Stores x, y and z without writing past the third float.
+inline void Store3(float *p, __m128 v)
+{
+    _mm_storel_pi(reinterpret_cast<__m64*>(p), v);
+    _mm_store_ss(p + 2, _mm_permute_ps(v, _MM_SHUFFLE(2, 2, 2, 2)));
+}
+
+/// Returns v in both halves of a 256-bit register.
+inline __m256 Duplicate(__m128 v)
+{
+    return _mm256_insertf128_ps(_mm256_castps128_ps256(v), v, 1);
+}
+
+/// Returns lo and hi as the halves of a 256-bit register.
+inline __m256 Combine(__m128 lo, __m128 hi)
+{
+    return _mm256_insertf128_ps(_mm256_castps128_ps256(lo), hi, 1);
+}
+
+/// Loads the columns of the matrix to both halves of the registers, with 0 in w.
+inline void LoadColumns(const float *m, __m256 &c0, __m256 &c1, __m256 &c2, __m256 &c3)
+{
+    c0 = Duplicate(_mm_setr_ps(m[0], m[4], m[8], 0.f));
+    c1 = Duplicate(_mm_setr_ps(m[1], m[5], m[9], 0.f));
+    c2 = Duplicate(_mm_setr_ps(m[2], m[6], m[10], 0.f));
+    c3 = Duplicate(_mm_setr_ps(m[3], m[7], m[11], 0.f));
+}
+
+/// Returns c0*x + c1*y + c2*z + c3 for the two vectors in the halves of v.
+inline __m256 Transform(__m256 v, __m256 c0, __m256 c1, __m256 c2, __m256 c3)
+{
+    __m256 r = _mm256_add_ps(c3, _mm256_mul_ps(c0, _mm256_permute_ps(v, _MM_SHUFFLE(0, 0, 0, 0))));
+    r = _mm256_add_ps(r, _mm256_mul_ps(c1, _mm256_permute_ps(v, _MM_SHUFFLE(1, 1, 1, 1))));
+    return _mm256_add_ps(r, _mm256_mul_ps(c2, _mm256_permute_ps(v, _MM_SHUFFLE(2, 2, 2, 2))));
+}
+
+/// Loads four AABBs as the x, y and z of their centers and half sizes.
+inline void LoadAABBs4(const float *a0, const float *a1, const float *a2, const float *a3, __m128 *center, __m128 *halfSize)
+{
+    // (minX, minY, minZ, maxX) and (minZ, maxX, maxY, maxZ) of each, transposed to one coordinate of all four.
+    __m128 minX = _mm_loadu_ps(a0), minY = _mm_loadu_ps(a1), minZ = _mm_loadu_ps(a2), maxX = _mm_loadu_ps(a3);
+    _MM_TRANSPOSE4_PS(minX, minY, minZ, maxX);
+    __m128 minZ2 = _mm_loadu_ps(a0 + 2), maxX2 = _mm_loadu_ps(a1 + 2), maxY = _mm_loadu_ps(a2 + 2), maxZ = _mm_loadu_ps(a3 + 2);
+    _MM_TRANSPOSE4_PS(minZ2, maxX2, maxY, maxZ);
+    const __m128 half = _mm_set1_ps(0.5f);
+    center[0] = _mm_mul_ps(_mm_add_ps(minX, maxX), half);
+    center[1] = _mm_mul_ps(_mm_add_ps(minY, maxY), half);
+    center[2] = _mm_mul_ps(_mm_add_ps(minZ, maxZ), half);
+    halfSize[0] = _mm_mul_ps(_mm_sub_ps(maxX, minX), half);
+    halfSize[1] = _mm_mul_ps(_mm_sub_ps(maxY, minY), half);
+    halfSize[2] = _mm_mul_ps(_mm_sub_ps(maxZ, minZ), half);
+}
+
+/// Loads the eight floats at p, or the count < 8 of them there are and zeros for the rest.
+inline __m256 LoadLanes(const float *p, int count)
+{
+    if (count >= 8)
+        return _mm256_loadu_ps(p);
+    float lanes[8] = { 0.f, 0.f, 0.f, 0.f, 0.f, 0.f, 0.f, 0.f };
+    for(int i = 0; i < count; ++i)
+        lanes[i] = p[i];
+    return _mm256_loadu_ps(lanes);
+}
+
+} // ~unnamed namespace
+
+void TransformFloat3_AVX(const float *m, float *points, int numPoints, int stride, float w)
+{
+    __m256 c0, c1, c2, c3;
+    LoadColumns(m, c0, c1, c2, c3);
+    c3 = _mm256_mul_ps(c3, _mm256_set1_ps(w));
+
+    // Two points per iteration, one in each half.
+    u8 *data = reinterpret_cast<u8*>(points);
+    int i = 0;
+    for(; i + 2 <= numPoints; i += 2)
+    {
+        float *p0 = reinterpret_cast<float*>(data + stride*i);
+        float *p1 = reinterpret_cast<float*>(data + stride*(i + 1));
+        const __m256 r = Transform(Combine(Load3(p0), Load3(p1)), c0, c1, c2, c3);
+        Store3(p0, _mm256_castps256_ps128(r));
+        Store3(p1, _mm256_extractf128_ps(r, 1));
+    }
+    if (i < numPoints)
+    {
+        float *p = reinterpret_cast<float*>(data + stride*i);
+        Store3(p, _mm256_castps256_ps128(Transform(Duplicate(Load3(p)), c0, c1, c2, c3)));
+    }
+    _mm256_zeroupper();
+}
+
+void TransformFloat3SoA_AVX(const float *m, float *xs, float *ys, float *zs, int numPoints, float w)
+{
+    const __m256 m0 = _mm256_set1_ps(m[0]), m1 = _mm256_set1_ps(m[1]), m2 = _mm256_set1_ps(m[2]), tx = _mm256_set1_ps(m[3]*w);
+    const __m256 m4 = _mm256_set1_ps(m[4]), m5 = _mm256_set1_ps(m[5]), m6 = _mm256_set1_ps(m[6]), ty = _mm256_set1_ps(m[7]*w);
+    const __m256 m8 = _mm256_set1_ps(m[8]), m9 = _mm256_set1_ps(m[9]), m10 = _mm256_set1_ps(m[10]), tz = _mm256_set1_ps(m[11]*w);
+
+    // Eight points per iteration.
+    int i = 0;
+    for(; i + 8 <= numPoints; i += 8)
+    {
+        const __m256 x = _mm256_loadu_ps(xs + i);
+        const __m256 y = _mm256_loadu_ps(ys + i);
+        const __m256 z = _mm256_loadu_ps(zs + i);
+        _mm256_storeu_ps(xs + i, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(m0, x), _mm256_mul_ps(m1, y)), _mm256_add_ps(_mm256_mul_ps(m2, z), tx)));
+        _mm256_storeu_ps(ys + i, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(m4, x), _mm256_mul_ps(m5, y)), _mm256_add_ps(_mm256_mul_ps(m6, z), ty)));
+        _mm256_storeu_ps(zs + i, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(m8, x), _mm256_mul_ps(m9, y)), _mm256_add_ps(_mm256_mul_ps(m10, z), tz)));
+    }
+    _mm256_zeroupper();
+    TransformFloat3SoA_CPP(m, xs + i, ys + i, zs + i, numPoints - i, w);
+}
+
+void TransformFloat4_AVX(const float *m, float *vectors, int numVectors, int stride)
+{
+    __m256 c0, c1, c2, c3;
+    LoadColumns(m, c0, c1, c2, c3);
+    c3 = Duplicate(_mm_setr_ps(m[3], m[7], m[11], 1.f)); // Keeps w.
+
+    u8 *data = reinterpret_cast<u8*>(vectors);
+    int i = 0;
+    for(; i + 2 <= numVectors; i += 2)
+    {
+        float *p0 = reinterpret_cast<float*>(data + stride*i);
+        float *p1 = reinterpret_cast<float*>(data + stride*(i + 1));
+        // Consecutive 4-vectors are loaded and stored at once.
+        const __m256 v = (stride == 4*sizeof(float) ? _mm256_loadu_ps(p0) : Combine(_mm_loadu_ps(p0), _mm_loadu_ps(p1)));
+        const __m256 r = _mm256_add_ps(Transform(v, c0, c1, c2, _mm256_setzero_ps()), _mm256_mul_ps(c3, _mm256_permute_ps(v, _MM_SHUFFLE(3, 3, 3, 3))));
+        if (stride == 4*sizeof(float))
+            _mm256_storeu_ps(p0, r);
+        else
+        {
+            _mm_storeu_ps(p0, _mm256_castps256_ps128(r));
+            _mm_storeu_ps(p1, _mm256_extractf128_ps(r, 1));
+        }
+    }
+    if (i < numVectors)
+    {
+        float *p = reinterpret_cast<float*>(data + stride*i);
+        const __m256 v = Duplicate(_mm_loadu_ps(p));
+        const __m256 r = _mm256_add_ps(Transform(v, c0, c1, c2, _mm256_setzero_ps()), _mm256_mul_ps(c3, _mm256_permute_ps(v, _MM_SHUFFLE(3, 3, 3, 3))));
+        _mm_storeu_ps(p, _mm256_castps256_ps128(r));
+    }
+    _mm256_zeroupper();
+}
+
+void CullAABBs_AVX(const float *planes, int numPlanes, const float *aabbs, int numAABBs, int stride, u32 *visibleMask)
+{
+    for(int i = 0; i < (numAABBs + 31) / 32; ++i)
+        visibleMask[i] = 0;
+    const u8 *data = reinterpret_cast<const u8*>(aabbs);
+    const __m256 signMask = _mm256_set1_ps(-0.f);
+
+    // Eight boxes per iteration, loaded as two groups of four. The last iteration repeats the last box for the
+    // missing ones, and masks their bits off.
+    for(int i = 0; i < numAABBs; i += 8)
+    {
+        const float *a[8];
+        for(int j = 0; j < 8; ++j)
+            a[j] = reinterpret_cast<const float*>(data + stride*(i + j < numAABBs ? i + j : numAABBs - 1));
+        __m128 lowCenter[3], lowHalfSize[3], highCenter[3], highHalfSize[3];
+        LoadAABBs4(a[0], a[1], a[2], a[3], lowCenter, lowHalfSize);
+        LoadAABBs4(a[4], a[5], a[6], a[7], highCenter, highHalfSize);
+        __m256 center[3], halfSize[3];
+        for(int j = 0; j < 3; ++j)
+        {
+            center[j] = Combine(lowCenter[j], highCenter[j]);
+            halfSize[j] = Combine(lowHalfSize[j], highHalfSize[j]);
+        }
+
+        __m256 outside = _mm256_setzero_ps();
+        for(int p = 0; p < numPlanes; ++p)
+        {
+            const float *plane = planes + 4*p;
+            const __m256 nx = _mm256_set1_ps(plane[0]), ny = _mm256_set1_ps(plane[1]), nz = _mm256_set1_ps(plane[2]);
+            const __m256 distance = _mm256_sub_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(nx, center[0]), _mm256_mul_ps(ny, center[1])),
+                _mm256_mul_ps(nz, center[2])), _mm256_set1_ps(plane[3]));
+            const __m256 radius = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_andnot_ps(signMask, nx), halfSize[0]),
+                _mm256_mul_ps(_mm256_andnot_ps(signMask, ny), halfSize[1])), _mm256_mul_ps(_mm256_andnot_ps(signMask, nz), halfSize[2]));
+            outside = _mm256_or_ps(outside, _mm256_cmp_ps(distance, radius, _CMP_GT_OQ));
+        }
+        u32 visible = (u32)(~_mm256_movemask_ps(outside) & 0xFF);
+        if (numAABBs - i < 8)
+            visible &= (1u << (numAABBs - i)) - 1;
+        visibleMask[i >> 5] |= visible << (i & 31);
+    }
+    _mm256_zeroupper();
+}
+
+u32 IntersectTriangleRays_AVX(const float *tri, const float *rays, int numRays, float *tMax, float *outU, float *outV)
+{
+    // As IntersectTriangleRays_SSE2, eight rays at a time.
+    const __m256 v0x = _mm256_set1_ps(tri[0]), v0y = _mm256_set1_ps(tri[1]), v0z = _mm256_set1_ps(tri[2]);
+    const __m256 e1x = _mm256_set1_ps(tri[3]), e1y = _mm256_set1_ps(tri[4]), e1z = _mm256_set1_ps(tri[5]);
+    const __m256 e2x = _mm256_set1_ps(tri[6]), e2y = _mm256_set1_ps(tri[7]), e2z = _mm256_set1_ps(tri[8]);
+    const __m256 epsilon = _mm256_set1_ps(1e-4f);
+    const __m256 minUV = _mm256_set1_ps(-1e-4f);
+    const __m256 maxUV = _mm256_set1_ps(1.f + 1e-4f);
+    const __m256 one = _mm256_set1_ps(1.f);
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 signMask = _mm256_set1_ps(-0.f);
+
+    u32 hits = 0;
+    for(int i = 0; i < numRays; i += 8)
+    {
+        const int count = numRays - i;
+        const __m256 dX = LoadLanes(rays + 3*numRays + i, count);
+        const __m256 dY = LoadLanes(rays + 4*numRays + i, count);
+        const __m256 dZ = LoadLanes(rays + 5*numRays + i, count);
+        const __m256 px = _mm256_sub_ps(_mm256_mul_ps(dY, e2z), _mm256_mul_ps(dZ, e2y));
+        const __m256 py = _mm256_sub_ps(_mm256_mul_ps(dZ, e2x), _mm256_mul_ps(dX, e2z));
+        const __m256 pz = _mm256_sub_ps(_mm256_mul_ps(dX, e2y), _mm256_mul_ps(dY, e2x));
+        const __m256 det = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e1x, px), _mm256_mul_ps(e1y, py)), _mm256_mul_ps(e1z, pz));
+        __m256 hit = _mm256_cmp_ps(_mm256_andnot_ps(signMask, det), epsilon, _CMP_GT_OQ);
+        if (_mm256_movemask_ps(hit) == 0)
+            continue;
+        const __m256 recipDet = _mm256_div_ps(one, det);
+
+        const __m256 tx = _mm256_sub_ps(LoadLanes(rays + i, count), v0x);
+        const __m256 ty = _mm256_sub_ps(LoadLanes(rays + numRays + i, count), v0y);
+        const __m256 tz = _mm256_sub_ps(LoadLanes(rays + 2*numRays + i, count), v0z);
+        const __m256 u = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(tx, px), _mm256_mul_ps(ty, py)), _mm256_mul_ps(tz, pz)), recipDet);
+        hit = _mm256_and_ps(hit, _mm256_and_ps(_mm256_cmp_ps(u, minUV, _CMP_GE_OQ), _mm256_cmp_ps(u, maxUV, _CMP_LE_OQ)));
+
+        const __m256 qx = _mm256_sub_ps(_mm256_mul_ps(ty, e1z), _mm256_mul_ps(tz, e1y));
+        const __m256 qy = _mm256_sub_ps(_mm256_mul_ps(tz, e1x), _mm256_mul_ps(tx, e1z));
+        const __m256 qz = _mm256_sub_ps(_mm256_mul_ps(tx, e1y), _mm256_mul_ps(ty, e1x));
+        const __m256 v = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dX, qx), _mm256_mul_ps(dY, qy)), _mm256_mul_ps(dZ, qz)), recipDet);
+        hit = _mm256_and_ps(hit, _mm256_and_ps(_mm256_cmp_ps(v, minUV, _CMP_GE_OQ), _mm256_cmp_ps(_mm256_add_ps(u, v), maxUV, _CMP_LE_OQ)));
+
+        const __m256 t = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e2x, qx), _mm256_mul_ps(e2y, qy)), _mm256_mul_ps(e2z, qz)), recipDet);
+        hit = _mm256_and_ps(hit, _mm256_and_ps(_mm256_cmp_ps(t, zero, _CMP_GE_OQ), _mm256_cmp_ps(t, LoadLanes(tMax + i, count), _CMP_LT_OQ)));
+
+        int mask = _mm256_movemask_ps(hit);
+        if (mask == 0)
+            continue;
+        hits |= (u32)mask << i;
+        float ts[8], us[8], vs[8];
+        _mm256_storeu_ps(ts, t);
+        _mm256_storeu_ps(us, u);
+        _mm256_storeu_ps(vs, v);
+        for(int j = 0; mask; ++j, mask >>= 1)
+            if (mask & 1)
+            {
+                tMax[i + j] = ts[j];
+                outU[i + j] = us[j];
+                outV[i + j] = vs[j];
+            }
+    }
+    _mm256_zeroupper();
+    return hits;
+}
+
+MATH_END_NAMESPACE
+
+#endif
@@ -0,0 +1,289 @@
+/**
+    For conditions of distribution and use, see copyright notice in LICENSE
+
+    @file   SIMDKernels_SSE2.cpp
+    @brief  SSE2 implementations of the batch kernels. Compiled with the SSE2 flags, see SIMDKernels.h. */
+
+#include "Math/SIMDKernels.h"
+
+#ifdef MATH_DISPATCH_SSE2
+
+#include "Types.h"
+
+#include <emmintrin.h>
+
+MATH_BEGIN_NAMESPACE
+
+namespace
+{
+
+/// Loads (x, y, z, 0) without reading past the third float.
+inline __m128 Load3(const float *p)
+{
+    const __m128 xy = _mm_castpd_ps(_mm_load_sd(reinterpret_cast<const double*>(p)));
+    return _mm_movelh_ps(xy, _mm_load_ss(p + 2));
+}
+
+/// Stores x, y and z without writing past the third float.
+inline void Store3(float *p, __m128 v)
+{
+    _mm_storel_pi(reinterpret_cast<__m64*>(p), v);
+    _mm_store_ss(p + 2, _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 2, 2, 2)));
+}
+
+/// Loads the columns of the matrix, with 0 in w.
+inline void LoadColumns(const float *m, __m128 &c0, __m128 &c1, __m128 &c2, __m128 &c3)
+{
+    c0 = _mm_setr_ps(m[0], m[4], m[8], 0.f);
+    c1 = _mm_setr_ps(m[1], m[5], m[9], 0.f);
+    c2 = _mm_setr_ps(m[2], m[6], m[10], 0.f);
+    c3 = _mm_setr_ps(m[3], m[7], m[11], 0.f);
+}
+
+/// Transforms the AABB with the columns of the matrix, as TransformAABB_SSE2.
+inline void TransformAABB(__m128 c0, __m128 c1, __m128 c2, __m128 c3, float *minPoint, float *maxPoint)
+{
+    const __m128 minV = Load3(minPoint);
+    const __m128 maxV = Load3(maxPoint);
+    const __m128 half = _mm_set1_ps(0.5f);
+    const __m128 center = _mm_mul_ps(_mm_add_ps(minV, maxV), half);
+    const __m128 halfSize = _mm_mul_ps(_mm_sub_ps(maxV, minV), half);
+
+    __m128 newCenter = _mm_add_ps(c3, _mm_mul_ps(c0, _mm_shuffle_ps(center, center, _MM_SHUFFLE(0, 0, 0, 0))));
+    newCenter = _mm_add_ps(newCenter, _mm_mul_ps(c1, _mm_shuffle_ps(center, center, _MM_SHUFFLE(1, 1, 1, 1))));
+    newCenter = _mm_add_ps(newCenter, _mm_mul_ps(c2, _mm_shuffle_ps(center, center, _MM_SHUFFLE(2, 2, 2, 2))));
+
+    // Equal to taking the absolute value of the whole matrix.
+    const __m128 signMask = _mm_set1_ps(-0.f);
+    __m128 newHalfSize = _mm_mul_ps(_mm_andnot_ps(signMask, c0), _mm_shuffle_ps(halfSize, halfSize, _MM_SHUFFLE(0, 0, 0, 0)));
+    newHalfSize = _mm_add_ps(newHalfSize, _mm_mul_ps(_mm_andnot_ps(signMask, c1), _mm_shuffle_ps(halfSize, halfSize, _MM_SHUFFLE(1, 1, 1, 1))));
+    newHalfSize = _mm_add_ps(newHalfSize, _mm_mul_ps(_mm_andnot_ps(signMask, c2), _mm_shuffle_ps(halfSize, halfSize, _MM_SHUFFLE(2, 2, 2, 2))));
+
+    Store3(minPoint, _mm_sub_ps(newCenter, newHalfSize));
+    Store3(maxPoint, _mm_add_ps(newCenter, newHalfSize));
+}
+
+/// Loads four AABBs as the x, y and z of their centers and half sizes.
+inline void LoadAABBs4(const float *a0, const float *a1, const float *a2, const float *a3, __m128 *center, __m128 *halfSize)
+{
+    // (minX, minY, minZ, maxX) and (minZ, maxX, maxY, maxZ) of each, transposed to one coordinate of all four.
+    __m128 minX = _mm_loadu_ps(a0), minY = _mm_loadu_ps(a1), minZ = _mm_loadu_ps(a2), maxX = _mm_loadu_ps(a3);
+    _MM_TRANSPOSE4_PS(minX, minY, minZ, maxX);
+    __m128 minZ2 = _mm_loadu_ps(a0 + 2), maxX2 = _mm_loadu_ps(a1 + 2), maxY = _mm_loadu_ps(a2 + 2), maxZ = _mm_loadu_ps(a3 + 2);
+    _MM_TRANSPOSE4_PS(minZ2, maxX2, maxY, maxZ);
+    const __m128 half = _mm_set1_ps(0.5f);
+    center[0] = _mm_mul_ps(_mm_add_ps(minX, maxX), half);
+    center[1] = _mm_mul_ps(_mm_add_ps(minY, maxY), half);
+    center[2] = _mm_mul_ps(_mm_add_ps(minZ, maxZ), half);
+    halfSize[0] = _mm_mul_ps(_mm_sub_ps(maxX, minX), half);
+    halfSize[1] = _mm_mul_ps(_mm_sub_ps(maxY, minY), half);
+    halfSize[2] = _mm_mul_ps(_mm_sub_ps(maxZ, minZ), half);
+}
+
+/// Loads the four floats at p, or the count < 4 of them there are and zeros for the rest.
+inline __m128 LoadLanes(const float *p, int count)
+{
+    if (count >= 4)
+        return _mm_loadu_ps(p);
+    float lanes[4] = { 0.f, 0.f, 0.f, 0.f };
+    for(int i = 0; i < count; ++i)
+        lanes[i] = p[i];
+    return _mm_loadu_ps(lanes);
+}
+
+} // ~unnamed namespace
+
+void TransformFloat3_SSE2(const float *m, float *points, int numPoints, int stride, float w)
+{
+    __m128 c0, c1, c2, c3;
+    LoadColumns(m, c0, c1, c2, c3);
+    c3 = _mm_mul_ps(c3, _mm_set1_ps(w));
+
+    u8 *data = reinterpret_cast<u8*>(points);
+    for(int i = 0; i < numPoints; ++i)
+    {
+        float *p = reinterpret_cast<float*>(data + stride*i);
+        const __m128 v = Load3(p);
+        __m128 r = _mm_add_ps(c3, _mm_mul_ps(c0, _mm_shuffle_ps(v, v, _MM_SHUFFLE(0, 0, 0, 0))));
+        r = _mm_add_ps(r, _mm_mul_ps(c1, _mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 1, 1, 1))));
+        r = _mm_add_ps(r, _mm_mul_ps(c2, _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 2, 2, 2))));
+        Store3(p, r);
+    }
+}
+
+void TransformFloat4_SSE2(const float *m, float *vectors, int numVectors, int stride)
+{
+    __m128 c0, c1, c2, c3;
+    LoadColumns(m, c0, c1, c2, c3);
+    c3 = _mm_setr_ps(m[3], m[7], m[11], 1.f); // Keeps w.
+
+    u8 *data = reinterpret_cast<u8*>(vectors);
+    for(int i = 0; i < numVectors; ++i)
+    {
+        float *p = reinterpret_cast<float*>(data + stride*i);
+        const __m128 v = _mm_loadu_ps(p);
+        __m128 r = _mm_mul_ps(c0, _mm_shuffle_ps(v, v, _MM_SHUFFLE(0, 0, 0, 0)));
+        r = _mm_add_ps(r, _mm_mul_ps(c1, _mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 1, 1, 1))));
+        r = _mm_add_ps(r, _mm_mul_ps(c2, _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 2, 2, 2))));
+        r = _mm_add_ps(r, _mm_mul_ps(c3, _mm_shuffle_ps(v, v, _MM_SHUFFLE(3, 3, 3, 3))));
+        _mm_storeu_ps(p, r);
+    }
+}
+
+void TransformFloat3SoA_SSE2(const float *m, float *xs, float *ys, float *zs, int numPoints, float w)
+{
+    const __m128 m0 = _mm_set1_ps(m[0]), m1 = _mm_set1_ps(m[1]), m2 = _mm_set1_ps(m[2]), tx = _mm_set1_ps(m[3]*w);
+    const __m128 m4 = _mm_set1_ps(m[4]), m5 = _mm_set1_ps(m[5]), m6 = _mm_set1_ps(m[6]), ty = _mm_set1_ps(m[7]*w);
+    const __m128 m8 = _mm_set1_ps(m[8]), m9 = _mm_set1_ps(m[9]), m10 = _mm_set1_ps(m[10]), tz = _mm_set1_ps(m[11]*w);
+
+    // Four points per iteration.
+    int i = 0;
+    for(; i + 4 <= numPoints; i += 4)
+    {
+        const __m128 x = _mm_loadu_ps(xs + i);
+        const __m128 y = _mm_loadu_ps(ys + i);
+        const __m128 z = _mm_loadu_ps(zs + i);
+        _mm_storeu_ps(xs + i, _mm_add_ps(_mm_add_ps(_mm_mul_ps(m0, x), _mm_mul_ps(m1, y)), _mm_add_ps(_mm_mul_ps(m2, z), tx)));
+        _mm_storeu_ps(ys + i, _mm_add_ps(_mm_add_ps(_mm_mul_ps(m4, x), _mm_mul_ps(m5, y)), _mm_add_ps(_mm_mul_ps(m6, z), ty)));
+        _mm_storeu_ps(zs + i, _mm_add_ps(_mm_add_ps(_mm_mul_ps(m8, x), _mm_mul_ps(m9, y)), _mm_add_ps(_mm_mul_ps(m10, z), tz)));
+    }
+    TransformFloat3SoA_CPP(m, xs + i, ys + i, zs + i, numPoints - i, w);
+}
+
+void TransformAABB_SSE2(const float *m, float *minPoint, float *maxPoint)
+{
+    __m128 c0, c1, c2, c3;
+    LoadColumns(m, c0, c1, c2, c3);
+    TransformAABB(c0, c1, c2, c3, minPoint, maxPoint);
+}
+
+void TransformAABBs_SSE2(const float *m, float *aabbs, int numAABBs, int stride)
+{
+    __m128 c0, c1, c2, c3;
+    LoadColumns(m, c0, c1, c2, c3);
+    u8 *data = reinterpret_cast<u8*>(aabbs);
+    for(int i = 0; i < numAABBs; ++i)
+    {
+        float *aabb = reinterpret_cast<float*>(data + stride*i);
+        TransformAABB(c0, c1, c2, c3, aabb, aabb + 3);
+    }
+}
+
+void EnclosePoints_SSE2(const float *points, int numPoints, int stride, float *minPoint, float *maxPoint)
+{
+    __m128 minV = Load3(minPoint);
+    __m128 maxV = Load3(maxPoint);
+    const u8 *data = reinterpret_cast<const u8*>(points);
+    for(int i = 0; i < numPoints; ++i)
+    {
+        const __m128 p = Load3(reinterpret_cast<const float*>(data + stride*i));
+        minV = _mm_min_ps(minV, p);
+        maxV = _mm_max_ps(maxV, p);
+    }
+    Store3(minPoint, minV);
+    Store3(maxPoint, maxV);
+}
+
+void CullAABBs_SSE2(const float *planes, int numPlanes, const float *aabbs, int numAABBs, int stride, u32 *visibleMask)
+{
+    for(int i = 0; i < (numAABBs + 31) / 32; ++i)
+        visibleMask[i] = 0;
+    const u8 *data = reinterpret_cast<const u8*>(aabbs);
+    const __m128 signMask = _mm_set1_ps(-0.f);
+
+    // Four boxes per iteration, so that the four bits never straddle two words of the mask. The last iteration
+    // repeats the last box for the missing ones, and masks their bits off.
+    for(int i = 0; i < numAABBs; i += 4)
+    {
+        const float *a[4];
+        for(int j = 0; j < 4; ++j)
+            a[j] = reinterpret_cast<const float*>(data + stride*(i + j < numAABBs ? i + j : numAABBs - 1));
+        __m128 center[3], halfSize[3];
+        LoadAABBs4(a[0], a[1], a[2], a[3], center, halfSize);
+
+        __m128 outside = _mm_setzero_ps();
+        for(int p = 0; p < numPlanes; ++p)
+        {
+            const float *plane = planes + 4*p;
+            const __m128 nx = _mm_set1_ps(plane[0]), ny = _mm_set1_ps(plane[1]), nz = _mm_set1_ps(plane[2]);
+            const __m128 distance = _mm_sub_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, center[0]), _mm_mul_ps(ny, center[1])),
+                _mm_mul_ps(nz, center[2])), _mm_set1_ps(plane[3]));
+            const __m128 radius = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_andnot_ps(signMask, nx), halfSize[0]),
+                _mm_mul_ps(_mm_andnot_ps(signMask, ny), halfSize[1])), _mm_mul_ps(_mm_andnot_ps(signMask, nz), halfSize[2]));
+            outside = _mm_or_ps(outside, _mm_cmpgt_ps(distance, radius));
+        }
+        u32 visible = (u32)(~_mm_movemask_ps(outside) & 0xF);
+        if (numAABBs - i < 4)
+            visible &= (1u << (numAABBs - i)) - 1;
+        visibleMask[i >> 5] |= visible << (i & 31);
+    }
+}
+
+u32 IntersectTriangleRays_SSE2(const float *tri, const float *rays, int numRays, float *tMax, float *outU, float *outV)
+{
+    // The rays are in the lanes and the triangle is broadcast, with the operations in the order of
+    // IntersectTriangleRays_CPP so that the results are the same.
+    const __m128 v0x = _mm_set1_ps(tri[0]), v0y = _mm_set1_ps(tri[1]), v0z = _mm_set1_ps(tri[2]);
+    const __m128 e1x = _mm_set1_ps(tri[3]), e1y = _mm_set1_ps(tri[4]), e1z = _mm_set1_ps(tri[5]);
+    const __m128 e2x = _mm_set1_ps(tri[6]), e2y = _mm_set1_ps(tri[7]), e2z = _mm_set1_ps(tri[8]);
+    const __m128 epsilon = _mm_set1_ps(1e-4f);
+    const __m128 minUV = _mm_set1_ps(-1e-4f);
+    const __m128 maxUV = _mm_set1_ps(1.f + 1e-4f);
+    const __m128 one = _mm_set1_ps(1.f);
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 signMask = _mm_set1_ps(-0.f);
+
+    u32 hits = 0;
+    for(int i = 0; i < numRays; i += 4)
+    {
+        // The missing rays of the last group get zero directions and distances, so they never hit.
+        const int count = numRays - i;
+        const __m128 dX = LoadLanes(rays + 3*numRays + i, count);
+        const __m128 dY = LoadLanes(rays + 4*numRays + i, count);
+        const __m128 dZ = LoadLanes(rays + 5*numRays + i, count);
+        const __m128 px = _mm_sub_ps(_mm_mul_ps(dY, e2z), _mm_mul_ps(dZ, e2y));
+        const __m128 py = _mm_sub_ps(_mm_mul_ps(dZ, e2x), _mm_mul_ps(dX, e2z));
+        const __m128 pz = _mm_sub_ps(_mm_mul_ps(dX, e2y), _mm_mul_ps(dY, e2x));
+        const __m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, px), _mm_mul_ps(e1y, py)), _mm_mul_ps(e1z, pz));
+        __m128 hit = _mm_cmpgt_ps(_mm_andnot_ps(signMask, det), epsilon);
+        if (_mm_movemask_ps(hit) == 0)
+            continue;
+        const __m128 recipDet = _mm_div_ps(one, det);
+
+        const __m128 tx = _mm_sub_ps(LoadLanes(rays + i, count), v0x);
+        const __m128 ty = _mm_sub_ps(LoadLanes(rays + numRays + i, count), v0y);
+        const __m128 tz = _mm_sub_ps(LoadLanes(rays + 2*numRays + i, count), v0z);
+        const __m128 u = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(tx, px), _mm_mul_ps(ty, py)), _mm_mul_ps(tz, pz)), recipDet);
+        hit = _mm_and_ps(hit, _mm_and_ps(_mm_cmpge_ps(u, minUV), _mm_cmple_ps(u, maxUV)));
+
+        const __m128 qx = _mm_sub_ps(_mm_mul_ps(ty, e1z), _mm_mul_ps(tz, e1y));
+        const __m128 qy = _mm_sub_ps(_mm_mul_ps(tz, e1x), _mm_mul_ps(tx, e1z));
+        const __m128 qz = _mm_sub_ps(_mm_mul_ps(tx, e1y), _mm_mul_ps(ty, e1x));
+        const __m128 v = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dX, qx), _mm_mul_ps(dY, qy)), _mm_mul_ps(dZ, qz)), recipDet);
+        hit = _mm_and_ps(hit, _mm_and_ps(_mm_cmpge_ps(v, minUV), _mm_cmple_ps(_mm_add_ps(u, v), maxUV)));
+
+        const __m128 t = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)), recipDet);
+        hit = _mm_and_ps(hit, _mm_and_ps(_mm_cmpge_ps(t, zero), _mm_cmplt_ps(t, LoadLanes(tMax + i, count))));
+
+        int mask = _mm_movemask_ps(hit);
+        if (mask == 0)
+            continue;
+        hits |= (u32)mask << i;
+        float ts[4], us[4], vs[4];
+        _mm_storeu_ps(ts, t);
+        _mm_storeu_ps(us, u);
+        _mm_storeu_ps(vs, v);
+        for(int j = 0; mask; ++j, mask >>= 1)
+            if (mask & 1)
+            {
+                tMax[i + j] = ts[j];
+                outU[i + j] = us[j];
+                outV[i + j] = vs[j];
+            }
+    }
+    return hits;
+}
+
+MATH_END_NAMESPACE
+
+#endif
@@ -68,6 +68,16 @@ float3 TranslateOp::Offset() const
 	return float3(x, y, z);
 }
 
+void TranslateOp::BatchTransformPos(float3 *pointArray, int numPoints) const
+{
+	ToFloat3x4().BatchTransformPos(pointArray, numPoints);
+}
+
+void TranslateOp::BatchTransformPos(float *xArray, float *yArray, float *zArray, int numPoints) const
+{
+	ToFloat3x4().BatchTransformPos(xArray, yArray, zArray, numPoints);
+}
+
 float3x4 operator *(const TranslateOp &lhs, const float3x4 &rhs)
 {
 	float3x4 r = rhs;
@@ -258,4 +268,14 @@ float3 ScaleOp::Offset() const
 	return float3(x, y, z);
 }
 
+void ScaleOp::BatchTransformPos(float3 *pointArray, int numPoints) const
+{
+	ToFloat3x4().BatchTransformPos(pointArray, numPoints);
+}
+
+void ScaleOp::BatchTransformPos(float *xArray, float *yArray, float *zArray, int numPoints) const
+{
+	ToFloat3x4().BatchTransformPos(xArray, yArray, zArray, numPoints);
+}
+
 MATH_END_NAMESPACE
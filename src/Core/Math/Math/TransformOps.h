@@ -45,6 +45,11 @@ public:
 	/// Returns the translation offset (x, y, z).
 	float3 Offset() const;
 
+	/// Translates each point of the given array. @see float3x4::BatchTransformPos().
+	void BatchTransformPos(float3 *pointArray, int numPoints) const;
+	/// Translates the points given as separate x, y and z arrays.
+	void BatchTransformPos(float *xArray, float *yArray, float *zArray, int numPoints) const;
+
 	/// Converts this TranslateOp object to a matrix.
 	float3x4 ToFloat3x4() const;
 	/// Converts this TranslateOp object to a matrix.
@@ -84,6 +89,11 @@ public:
 	/// Returns the scale factors (x, y, z).
 	float3 Offset() const;
 
+	/// Scales each point of the given array. @see float3x4::BatchTransformPos().
+	void BatchTransformPos(float3 *pointArray, int numPoints) const;
+	/// Scales the points given as separate x, y and z arrays.
+	void BatchTransformPos(float *xArray, float *yArray, float *zArray, int numPoints) const;
+
 	/// Converts this ScaleOp to a matrix.
 	operator float3x3() const;
 	/// Converts this ScaleOp to a matrix.
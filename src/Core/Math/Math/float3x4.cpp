@@ -27,8 +27,10 @@
 #include "Math/Quat.h"
 #include "Algorithm/Random/LCG.h"
 #include "Geometry/Plane.h"
+#include "Geometry/AABB.h"
 #include "TransformOps.h"
 #include "SSEMath.h"
+#include "SIMDKernels.h"
 
 #ifdef MATH_ENABLE_STL_SUPPORT
 #include <iostream>
@@ -1120,13 +1122,7 @@ float4 float3x4::Transform(const float4 &vector) const
 
 void float3x4::BatchTransformPos(float3 *pointArray, int numPoints) const
 {
-	assume(pointArray);
-#ifndef MATH_ENABLE_INSECURE_OPTIMIZATIONS
-	if (!pointArray)
-		return;
-#endif
-	for(int i = 0; i < numPoints; ++i)
-		pointArray[i] = MulPos(pointArray[i]);
+	BatchTransformPos(pointArray, numPoints, sizeof(float3));
 }
 
 void float3x4::BatchTransformPos(float3 *pointArray, int numPoints, int stride) const
@@ -1137,23 +1133,12 @@ void float3x4::BatchTransformPos(float3 *pointArray, int numPoints, int stride)
 		return;
 #endif
 	assume(stride >= (int)sizeof(float3));
-	u8 *data = reinterpret_cast<u8*>(pointArray);
-	for(int i = 0; i < numPoints; ++i)
-	{
-		float3 *v = reinterpret_cast<float3*>(data + stride*i);
-		*v = MulPos(*v);
-	}
+	ActiveSIMDKernels().transformFloat3(ptr(), reinterpret_cast<float*>(pointArray), numPoints, stride, 1.f);
 }
 
 void float3x4::BatchTransformDir(float3 *dirArray, int numVectors) const
 {
-	assume(dirArray);
-#ifndef MATH_ENABLE_INSECURE_OPTIMIZATIONS
-	if (!dirArray)
-		return;
-#endif
-	for(int i = 0; i < numVectors; ++i)
-		dirArray[i] = MulPos(dirArray[i]);
+	BatchTransformDir(dirArray, numVectors, sizeof(float3));
 }
 
 void float3x4::BatchTransformDir(float3 *dirArray, int numVectors, int stride) const
@@ -1164,39 +1149,55 @@ void float3x4::BatchTransformDir(float3 *dirArray, int numVectors, int stride) c
 		return;
 #endif
 	assume(stride >= (int)sizeof(float3));
-	u8 *data = reinterpret_cast<u8*>(dirArray);
-	for(int i = 0; i < numVectors; ++i)
-	{
-		float3 *v = reinterpret_cast<float3*>(data + stride*i);
-		*v = MulDir(*v);
-	}
+	ActiveSIMDKernels().transformFloat3(ptr(), reinterpret_cast<float*>(dirArray), numVectors, stride, 0.f);
 }
 
 void float3x4::BatchTransform(float4 *vectorArray, int numVectors) const
+{
+	BatchTransform(vectorArray, numVectors, sizeof(float4));
+}
+
+void float3x4::BatchTransform(float4 *vectorArray, int numVectors, int stride) const
 {
 	assume(vectorArray);
 #ifndef MATH_ENABLE_INSECURE_OPTIMIZATIONS
 	if (!vectorArray)
 		return;
 #endif
-	for(int i = 0; i < numVectors; ++i)
-		vectorArray[i] = *this * vectorArray[i];
+	assume(stride >= (int)sizeof(float4));
+	ActiveSIMDKernels().transformFloat4(ptr(), reinterpret_cast<float*>(vectorArray), numVectors, stride);
 }
 
-void float3x4::BatchTransform(float4 *vectorArray, int numVectors, int stride) const
+void float3x4::BatchTransformPos(float *xArray, float *yArray, float *zArray, int numPoints) const
 {
-	assume(vectorArray);
+	assume(xArray && yArray && zArray);
 #ifndef MATH_ENABLE_INSECURE_OPTIMIZATIONS
-	if (!vectorArray)
+	if (!xArray || !yArray || !zArray)
 		return;
 #endif
-	assume(stride >= (int)sizeof(float4));
-	u8 *data = reinterpret_cast<u8*>(vectorArray);
-	for(int i = 0; i < numVectors; ++i)
-	{
-		float4 *v = reinterpret_cast<float4*>(data + stride*i);
-		*v = *this * *v;
-	}
+	ActiveSIMDKernels().transformFloat3SoA(ptr(), xArray, yArray, zArray, numPoints, 1.f);
+}
+
+void float3x4::BatchTransformDir(float *xArray, float *yArray, float *zArray, int numVectors) const
+{
+	assume(xArray && yArray && zArray);
+#ifndef MATH_ENABLE_INSECURE_OPTIMIZATIONS
+	if (!xArray || !yArray || !zArray)
+		return;
+#endif
+	ActiveSIMDKernels().transformFloat3SoA(ptr(), xArray, yArray, zArray, numVectors, 0.f);
+}
+
+void float3x4::BatchTransformAsAABB(AABB *aabbArray, int numAABBs) const
+{
+	assume(aabbArray);
+	assume(IsColOrthogonal());
+	assume(HasUniformScale());
+#ifndef MATH_ENABLE_INSECURE_OPTIMIZATIONS
+	if (!aabbArray)
+		return;
+#endif
+	ActiveSIMDKernels().transformAABBs(ptr(), aabbArray[0].minPoint.ptr(), numAABBs, sizeof(AABB));
 }
 
 float3x4 float3x4::operator *(const float3x3 &rhs) const
@@ -624,6 +624,16 @@ public:
 	/// Performs a batch transform of the given array.
 	void BatchTransform(float4 *vectorArray, int numVectors, int stride) const;
 
+	/// Performs a batch transform of the points given as separate x, y and z arrays.
+	/** The SoA layout fills the SIMD registers with one coordinate of consecutive points, so it is the fastest batch transform. */
+	void BatchTransformPos(float *xArray, float *yArray, float *zArray, int numPoints) const;
+
+	/// Performs a batch transform of the directions given as separate x, y and z arrays.
+	void BatchTransformDir(float *xArray, float *yArray, float *zArray, int numVectors) const;
+
+	/// Transforms each AABB of the given array as AABB::TransformAsAABB(const float3x4 &) does.
+	void BatchTransformAsAABB(AABB *aabbArray, int numAABBs) const;
+
 	/// Treats the float3x3 as a 4-by-4 matrix with the last row and column as identity, and multiplies the two matrices.
 	float3x4 operator *(const float3x3 &rhs) const;
 
@@ -27,8 +27,10 @@
 #include "Math/Quat.h"
 #include "TransformOps.h"
 #include "Geometry/Plane.h"
+#include "Geometry/AABB.h"
 #include "Algorithm/Random/LCG.h"
 #include "SSEMath.h"
+#include "SIMDKernels.h"
 
 #ifdef MATH_ENABLE_STL_SUPPORT
 #include <iostream>
@@ -1480,56 +1482,70 @@ float4 float4x4::Transform(const float4 &vector) const
 
 void float4x4::TransformPos(float3 *pointArray, int numPoints) const
 {
-	assume(pointArray);
-#ifndef MATH_ENABLE_INSECURE_OPTIMIZATIONS
-	if (!pointArray)
-		return;
-#endif
-	for(int i = 0; i < numPoints; ++i)
-		pointArray[i] = this->TransformPos(pointArray[i]);
+	TransformPos(pointArray, numPoints, sizeof(float3));
 }
 
 void float4x4::TransformPos(float3 *pointArray, int numPoints, int strideBytes) const
 {
 	assume(pointArray);
+	assume(!this->ContainsProjection()); // The kernel uses only the first three rows.
 #ifndef MATH_ENABLE_INSECURE_OPTIMIZATIONS
 	if (!pointArray)
 		return;
 #endif
-	u8 *data = reinterpret_cast<u8*>(pointArray);
-	for(int i = 0; i < numPoints; ++i)
-	{
-		float3 *v = reinterpret_cast<float3*>(data);
-		*v = this->TransformPos(*v);
-		data += strideBytes;
-	}
+	ActiveSIMDKernels().transformFloat3(ptr(), reinterpret_cast<float*>(pointArray), numPoints, strideBytes, 1.f);
 }
 
 void float4x4::TransformDir(float3 *dirArray, int numVectors) const
+{
+	TransformDir(dirArray, numVectors, sizeof(float3));
+}
+
+void float4x4::TransformDir(float3 *dirArray, int numVectors, int strideBytes) const
 {
 	assume(dirArray);
+	assume(!this->ContainsProjection()); // The kernel uses only the first three rows.
 #ifndef MATH_ENABLE_INSECURE_OPTIMIZATIONS
 	if (!dirArray)
 		return;
 #endif
-	for(int i = 0; i < numVectors; ++i)
-		dirArray[i] = this->TransformDir(dirArray[i]);
+	ActiveSIMDKernels().transformFloat3(ptr(), reinterpret_cast<float*>(dirArray), numVectors, strideBytes, 0.f);
 }
 
-void float4x4::TransformDir(float3 *dirArray, int numVectors, int strideBytes) const
+void float4x4::TransformPos(float *xArray, float *yArray, float *zArray, int numPoints) const
 {
-	assume(dirArray);
+	assume(xArray && yArray && zArray);
+	assume(!this->ContainsProjection()); // The kernel uses only the first three rows.
 #ifndef MATH_ENABLE_INSECURE_OPTIMIZATIONS
-	if (!dirArray)
+	if (!xArray || !yArray || !zArray)
 		return;
 #endif
-	u8 *data = reinterpret_cast<u8*>(dirArray);
-	for(int i = 0; i < numVectors; ++i)
-	{
-		float3 *v = reinterpret_cast<float3*>(data);
-		*v = this->TransformDir(*v);
-		data += strideBytes;
-	}
+	ActiveSIMDKernels().transformFloat3SoA(ptr(), xArray, yArray, zArray, numPoints, 1.f);
+}
+
+void float4x4::TransformDir(float *xArray, float *yArray, float *zArray, int numVectors) const
+{
+	assume(xArray && yArray && zArray);
+	assume(!this->ContainsProjection()); // The kernel uses only the first three rows.
+#ifndef MATH_ENABLE_INSECURE_OPTIMIZATIONS
+	if (!xArray || !yArray || !zArray)
+		return;
+#endif
+	ActiveSIMDKernels().transformFloat3SoA(ptr(), xArray, yArray, zArray, numVectors, 0.f);
+}
+
+void float4x4::BatchTransformAsAABB(AABB *aabbArray, int numAABBs) const
+{
+	assume(aabbArray);
+	assume(IsColOrthogonal3());
+	assume(HasUniformScale());
+	assume(Row(3).Equals(0,0,0,1));
+#ifndef MATH_ENABLE_INSECURE_OPTIMIZATIONS
+	if (!aabbArray)
+		return;
+#endif
+	// The first three rows of a float4x4 are laid out as a float3x4.
+	ActiveSIMDKernels().transformAABBs(ptr(), aabbArray[0].minPoint.ptr(), numAABBs, sizeof(AABB));
 }
 
 void float4x4::Transform(float4 *vectorArray, int numVectors) const
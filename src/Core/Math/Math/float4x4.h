@@ -732,6 +732,16 @@ public:
 	/// Performs a batch transform of the given direction vector array.
 	void TransformDir(float3 *dirArray, int numVectors, int strideBytes) const;
 
+	/// Performs a batch transform of the points given as separate x, y and z arrays.
+	/** Like the other batch transforms of points and directions, this matrix may not contain a projection. */
+	void TransformPos(float *xArray, float *yArray, float *zArray, int numPoints) const;
+
+	/// Performs a batch transform of the directions given as separate x, y and z arrays.
+	void TransformDir(float *xArray, float *yArray, float *zArray, int numVectors) const;
+
+	/// Transforms each AABB of the given array as AABB::TransformAsAABB(const float4x4 &) does.
+	void BatchTransformAsAABB(AABB *aabbArray, int numAABBs) const;
+
 	/// Performs a batch transform of the given float4 array.
 	void Transform(float4 *vectorArray, int numVectors) const;
 
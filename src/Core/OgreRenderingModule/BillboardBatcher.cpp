@@ -0,0 +1,211 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#include "StableHeaders.h"
+#define MATH_OGRE_INTEROP
+#include "DebugOperatorNew.h"
+
+#include "BillboardBatcher.h"
+#include "OgreWorld.h"
+#include "EC_Billboard.h"
+#include "EC_Placeable.h"
+#include "Scene/Scene.h"
+#include "Framework.h"
+#include "FrameAPI.h"
+#include "Profiler.h"
+#include "LoggingFunctions.h"
+#include "Math/float3x4.h"
+
+#include <OgreBillboardSet.h>
+#include <OgreBillboard.h>
+#include <OgreSceneManager.h>
+#include <OgreSceneNode.h>
+
+#include <algorithm>
+#include <cmath>
+
+#include "MemoryLeakCheck.h"
+
+namespace
+{
+/// Initial pool size of a billboard set. The pool doubles when it runs out.
+const unsigned int cInitialPoolSize = 16;
+}
+
+BillboardBatcher::BillboardBatcher(OgreWorld *world) :
+    world_(world)
+{
+    ScenePtr scene = world_->Scene();
+    if (scene)
+        connect(scene->GetFramework()->Frame(), SIGNAL(PostFrameUpdate(float)), SLOT(OnPostFrameUpdate(float)));
+}
+
+BillboardBatcher::~BillboardBatcher()
+{
+    Ogre::SceneManager *sceneManager = world_->OgreSceneManager();
+    for(QHash<QString, Batch>::iterator iter = batches_.begin(); iter != batches_.end(); ++iter)
+        sceneManager->destroyBillboardSet(iter->set);
+    batches_.clear();
+    members_.clear();
+}
+
+Ogre::Billboard *BillboardBatcher::Add(EC_Billboard *billboard, EC_Placeable *placeable, const QString &material)
+{
+    QHash<EC_Billboard*, Member>::iterator existing = members_.find(billboard);
+    if (existing != members_.end())
+    {
+        if (existing->material == material && existing->placeable == placeable)
+            return existing->billboard;
+        Remove(billboard);
+    }
+
+    QHash<QString, Batch>::iterator batchIter = batches_.find(material);
+    if (batchIter == batches_.end())
+    {
+        Ogre::SceneManager *sceneManager = world_->OgreSceneManager();
+        Batch batch;
+        batch.set = sceneManager->createBillboardSet(world_->GenerateUniqueObjectName("BillboardBatch"), cInitialPoolSize);
+        batch.set->setAutoextend(true);
+        // The billboards are spread over the scene, so cull them one by one instead of only by the bounds of the whole set.
+        batch.set->setCullIndividually(true);
+        if (!material.isEmpty())
+            batch.set->setMaterialName(material.toStdString());
+        sceneManager->getRootSceneNode()->attachObject(batch.set);
+        batch.numMembers = 0;
+        batch.maxSize = 0.f;
+        batch.boundsDirty = false;
+        batchIter = batches_.insert(material, batch);
+    }
+
+    Member member;
+    member.placeable = placeable;
+    member.material = material;
+    member.billboard = batchIter->set->createBillboard(Ogre::Vector3::ZERO);
+    member.worldPosition = float3::zero;
+    member.worldWidth = -1.f;
+    member.worldHeight = -1.f;
+    member.billboard->setRotation(Ogre::Radian(Ogre::Degree(billboard->rotation.Get())));
+    ++batchIter->numMembers;
+
+    Member &added = members_.insert(billboard, member).value();
+    WriteTransform(billboard, added);
+    return added.billboard;
+}
+
+void BillboardBatcher::Remove(EC_Billboard *billboard)
+{
+    QHash<EC_Billboard*, Member>::iterator iter = members_.find(billboard);
+    if (iter == members_.end())
+        return;
+
+    QHash<QString, Batch>::iterator batchIter = batches_.find(iter->material);
+    if (batchIter != batches_.end())
+    {
+        if (--batchIter->numMembers <= 0)
+        {
+            world_->OgreSceneManager()->destroyBillboardSet(batchIter->set);
+            batches_.erase(batchIter);
+        }
+        else
+        {
+            batchIter->set->removeBillboard(iter->billboard);
+            batchIter->boundsDirty = true;
+        }
+    }
+    members_.erase(iter);
+}
+
+void BillboardBatcher::Update(EC_Billboard *billboard)
+{
+    QHash<EC_Billboard*, Member>::iterator iter = members_.find(billboard);
+    if (iter == members_.end())
+        return;
+    iter->billboard->setRotation(Ogre::Radian(Ogre::Degree(billboard->rotation.Get())));
+    // Force the size to be rewritten, as the attributes may have changed without the world size changing in total.
+    iter->worldWidth = -1.f;
+    WriteTransform(billboard, iter.value());
+}
+
+Ogre::BillboardSet *BillboardBatcher::BillboardSetOf(EC_Billboard *billboard) const
+{
+    QHash<EC_Billboard*, Member>::const_iterator iter = members_.find(billboard);
+    if (iter == members_.end())
+        return 0;
+    QHash<QString, Batch>::const_iterator batchIter = batches_.find(iter->material);
+    return batchIter != batches_.end() ? batchIter->set : 0;
+}
+
+bool BillboardBatcher::IsBatch(const Ogre::MovableObject *object) const
+{
+    for(QHash<QString, Batch>::const_iterator iter = batches_.begin(); iter != batches_.end(); ++iter)
+        if (iter->set == object)
+            return true;
+    return false;
+}
+
+void BillboardBatcher::Members(const Ogre::BillboardSet *set, std::vector<std::pair<EC_Billboard*, Ogre::Billboard*> > &members) const
+{
+    members.clear();
+    QString material;
+    bool found = false;
+    for(QHash<QString, Batch>::const_iterator iter = batches_.begin(); iter != batches_.end(); ++iter)
+        if (iter->set == set)
+        {
+            material = iter.key();
+            found = true;
+            break;
+        }
+    if (!found)
+        return;
+
+    for(QHash<EC_Billboard*, Member>::const_iterator iter = members_.begin(); iter != members_.end(); ++iter)
+        if (iter->material == material)
+            members.push_back(std::make_pair(iter.key(), iter->billboard));
+}
+
+bool BillboardBatcher::WriteTransform(EC_Billboard *billboard, Member &member)
+{
+    const float3x4 localToWorld = member.placeable->LocalToWorld();
+    const float3 worldPosition = localToWorld.MulPos(billboard->position.Get());
+    // The billboards of a hidden placeable are shrunk to nothing, as they are not under its scene node to be hidden with it.
+    const bool visible = member.placeable->visible.Get();
+    const float worldWidth = visible ? billboard->width.Get() * localToWorld.Col(0).Length() : 0.f;
+    const float worldHeight = visible ? billboard->height.Get() * localToWorld.Col(1).Length() : 0.f;
+    if (worldPosition.Equals(member.worldPosition, 1e-5f) && worldWidth == member.worldWidth && worldHeight == member.worldHeight)
+        return false;
+
+    member.billboard->setPosition(worldPosition);
+    member.billboard->setDimensions(worldWidth, worldHeight);
+    member.worldPosition = worldPosition;
+    member.worldWidth = worldWidth;
+    member.worldHeight = worldHeight;
+
+    QHash<QString, Batch>::iterator batchIter = batches_.find(member.material);
+    if (batchIter != batches_.end())
+    {
+        batchIter->maxSize = std::max(batchIter->maxSize, std::max(worldWidth, worldHeight));
+        batchIter->boundsDirty = true;
+    }
+    return true;
+}
+
+void BillboardBatcher::OnPostFrameUpdate(float /*frameTime*/)
+{
+    if (members_.isEmpty())
+        return;
+
+    PROFILE(BillboardBatcher_Update);
+    // The world transforms of the placeables are cached, so the billboards that have not moved are cheap to check.
+    for(QHash<EC_Billboard*, Member>::iterator iter = members_.begin(); iter != members_.end(); ++iter)
+        WriteTransform(iter.key(), iter.value());
+
+    for(QHash<QString, Batch>::iterator iter = batches_.begin(); iter != batches_.end(); ++iter)
+    {
+        if (!iter->boundsDirty)
+            continue;
+        // Ogre pads the bounds of the positions by the larger default dimension, so make it cover half the diagonal of the largest billboard.
+        const float padding = iter->maxSize * 0.5f * std::sqrt(2.f);
+        iter->set->setDefaultDimensions(padding, padding);
+        iter->set->_updateBounds(); // Ogre::BillboardSet never updates its bounds by itself.
+        iter->boundsDirty = false;
+    }
+}
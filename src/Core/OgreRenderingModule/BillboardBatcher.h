@@ -0,0 +1,93 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#pragma once
+
+#include "CoreDefines.h"
+#include "OgreModuleApi.h"
+#include "OgreModuleFwd.h"
+#include "Math/float3.h"
+
+#include <QObject>
+#include <QHash>
+#include <QString>
+
+#include <vector>
+
+class OgreWorld;
+
+/// Renders the billboards of EC_Billboard in shared billboard sets, one per material, instead of a billboard set each.
+/** Created by OgreWorld when not headless, unless disabled with the --noBillboardBatching command line parameter.
+    EC_Billboard adds its billboard when it is shown and removes it when hidden. The billboard sets are attached to the
+    root scene node, so the billboards are in world space: after each frame update, the world positions and sizes of
+    the billboards whose placeables have moved are written to their billboards. The billboard sets resize their pools
+    as billboards are added, and build the vertex buffer of the billboards in view each frame, so that a material costs
+    a draw call however many billboards use it. A billboard set of a material is destroyed when its last billboard is removed.
+
+    The batched billboards are raycast by OgreWorld through Members. As the billboard sets do not belong to any entity,
+    the batched billboards do not make their entities visible for OgreWorld::VisibleEntities and the view tracking. */
+class OGRE_MODULE_API BillboardBatcher : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit BillboardBatcher(OgreWorld *world);
+    /// Destroys the billboard sets.
+    ~BillboardBatcher();
+
+    /// Adds the billboard to the set of the material, or moves it there if it is in the set of another material.
+    /** @param billboard Billboard component. Its size, rotation and world position are written to the batched billboard.
+        @param placeable Placeable the billboard is positioned relative to. Must outlive the billboard in the batch.
+        @param material Ogre material name, empty for the default material.
+        @return The batched Ogre billboard, which stays valid until the component is removed or moved to another material. */
+    Ogre::Billboard *Add(EC_Billboard *billboard, EC_Placeable *placeable, const QString &material);
+
+    /// Removes the billboard from its set. Does nothing if the component is not batched.
+    void Remove(EC_Billboard *billboard);
+
+    /// Writes the changed size and rotation of the component to its batched billboard, and its position on the next update.
+    void Update(EC_Billboard *billboard);
+
+    /// Returns the billboard set the component is batched in, or null if not batched.
+    Ogre::BillboardSet *BillboardSetOf(EC_Billboard *billboard) const;
+
+    /// Returns whether the billboard set is one of the batches.
+    bool IsBatch(const Ogre::MovableObject *object) const;
+
+    /// Returns the components and their Ogre billboards of a batch, for raycasting the billboards one by one.
+    void Members(const Ogre::BillboardSet *set, std::vector<std::pair<EC_Billboard*, Ogre::Billboard*> > &members) const;
+
+    /// Returns the number of batched billboards.
+    int NumBillboards() const { return members_.size(); }
+
+    /// Returns the number of billboard sets, i.e. the draw calls of the billboards.
+    int NumBatches() const { return batches_.size(); }
+
+private slots:
+    void OnPostFrameUpdate(float frameTime);
+
+private:
+    struct Member
+    {
+        EC_Placeable *placeable;
+        Ogre::Billboard *billboard;
+        QString material;
+        float3 worldPosition; ///< World position last written to the billboard.
+        float worldWidth; ///< World size last written to the billboard.
+        float worldHeight;
+    };
+
+    struct Batch
+    {
+        Ogre::BillboardSet *set;
+        int numMembers;
+        float maxSize; ///< Largest world width or height of the billboards of the set so far, which pads its bounds.
+        bool boundsDirty; ///< Have the billboards moved or been resized since the bounds of the set were updated.
+    };
+
+    /// Writes the world position and size of the member to its billboard if they have changed. Returns true if they had.
+    bool WriteTransform(EC_Billboard *billboard, Member &member);
+
+    OgreWorld *world_;
+    QHash<EC_Billboard*, Member> members_;
+    QHash<QString, Batch> batches_;
+};
@@ -12,13 +12,38 @@
 #include "Profiler.h"
 #include "Scene/Scene.h"
 #include "OgreWorld.h"
+#include "Renderer.h"
+#include "ScreenSize.h"
+#include "EC_Camera.h"
+#include "Math/MathFunc.h"
+#include "Geometry/AABB.h"
 
 #include <Ogre.h>
+#include <OgreInstancedEntity.h>
+#include <OgreInstanceBatch.h>
 
 #include "LoggingFunctions.h"
 
 #include "MemoryLeakCheck.h"
 
+namespace
+{
+/// Screen heights in pixels of the mesh below which the next animation LOD level is used.
+const float cLodScreenSizes[] = { 150.f, 60.f, 20.f };
+/// Seconds between the animation updates at each LOD level. The last level is for the meshes that are off screen.
+const float cLodUpdateIntervals[] = { 0.f, 1.f / 30.f, 1.f / 15.f, 1.f / 8.f, 0.5f };
+/// Maximum number of blended animation states at each LOD level, 0 for no limit.
+const size_t cLodMaxBlendedStates[] = { 0, 0, 2, 1, 1 };
+/// Number of the LOD levels.
+const int cNumLodLevels = sizeof(cLodUpdateIntervals) / sizeof(cLodUpdateIntervals[0]);
+
+/// Orders the animations by their blend weight, the heaviest first.
+struct AnimationWeightGreater
+{
+    template <typename T>
+    bool operator()(const T &a, const T &b) const { return a.first > b.first; }
+};
+}
 
 using namespace OgreRenderer;
 
@@ -26,11 +51,14 @@ EC_AnimationController::EC_AnimationController(Scene* scene) :
     IComponent(scene),
     INIT_ATTRIBUTE_VALUE(animationState, "Animation state", ""),
     INIT_ATTRIBUTE_VALUE(drawDebug, "Draw debug", false),
-    mesh(0)
+    INIT_ATTRIBUTE_VALUE(animationLod, "Animation LOD", true),
+    mesh(0),
+    lodLevel_(0),
+    lodTime_(0.f)
 {
     ResetState();
     
-    QObject::connect(framework->Frame(), SIGNAL(Updated(float)), this, SLOT(Update(float)));
+    QObject::connect(framework->Frame(), SIGNAL(Updated(float)), this, SLOT(OnFrameUpdated(float)));
     QObject::connect(this, SIGNAL(ParentEntitySet()), this, SLOT(UpdateSignals()));
 }
 
@@ -46,10 +74,7 @@ void EC_AnimationController::SetMeshEntity(EC_Mesh *new_mesh)
 QStringList EC_AnimationController::GetAvailableAnimations()
 {
     QStringList availableList;
-    Ogre::Entity* entity = GetEntity();
-    if (!entity) 
-        return availableList;
-    Ogre::AnimationStateSet* anims = entity->getAllAnimationStates();
+    Ogre::AnimationStateSet* anims = GetAnimationStates();
     if (!anims) 
         return availableList;
     Ogre::AnimationStateIterator i = anims->getAnimationStateIterator();
@@ -73,10 +98,65 @@ QStringList EC_AnimationController::GetActiveAnimations() const
     return activeList;
 }
 
+void EC_AnimationController::OnFrameUpdated(float frametime)
+{
+    lodTime_ += frametime;
+    if (animations_.empty())
+    {
+        lodTime_ = 0.f;
+        return;
+    }
+    lodLevel_ = animationLod.Get() ? ComputeLodLevel() : 0;
+    if (lodTime_ < cLodUpdateIntervals[lodLevel_])
+        return;
+    const float elapsed = lodTime_;
+    lodTime_ = 0.f;
+    Update(elapsed);
+}
+
+int EC_AnimationController::ComputeLodLevel() const
+{
+    Scene *scene = ParentScene();
+    OgreWorldPtr world = scene ? scene->Subsystem<OgreWorld>() : OgreWorldPtr();
+    Renderer *renderer = world ? world->Renderer() : 0;
+    EC_Camera *camera = renderer ? renderer->MainCameraComponent() : 0;
+    Ogre::Camera *ogreCamera = camera ? camera->OgreCamera() : 0;
+    if (!mesh || !ogreCamera || camera->ParentScene() != scene || renderer->WindowHeight() <= 0)
+        return 0;
+    const AABB box = mesh->WorldAABB();
+    if (!box.IsFinite())
+        return 0;
+    if (!ogreCamera->isVisible(static_cast<Ogre::AxisAlignedBox>(box)))
+        return cNumLodLevels - 1;
+
+    const float distance = std::max(box.Distance(ogreCamera->getDerivedPosition()), ogreCamera->getNearClipDistance());
+    const float screenSize = ScreenSizeInPixels(ogreCamera, box, distance);
+    int level = 0;
+    while(level < cNumLodLevels - 2 && screenSize < cLodScreenSizes[level])
+        ++level;
+    return level;
+}
+
+void EC_AnimationController::LimitBlendedStates(size_t maxStates)
+{
+    std::vector<std::pair<float, Ogre::AnimationState*> > states;
+    for(AnimationMap::iterator i = animations_.begin(); i != animations_.end(); ++i)
+    {
+        Ogre::AnimationState* animstate = GetAnimationState(i->first);
+        if (animstate && animstate->getEnabled())
+            states.push_back(std::make_pair(i->second.weight_ * i->second.weight_factor_, animstate));
+    }
+    if (states.size() <= maxStates)
+        return;
+    // The states are enabled again by the next update at a level that blends them.
+    std::sort(states.begin(), states.end(), AnimationWeightGreater());
+    for(size_t i = maxStates; i < states.size(); ++i)
+        states[i].second->setEnabled(false);
+}
+
 void EC_AnimationController::Update(float frametime)
 {
-    Ogre::Entity* entity = GetEntity();
-    if (!entity) 
+    if (!GetAnimationStates()) 
         return;
     
     PROFILE(EC_AnimationController_Update);
@@ -86,7 +166,7 @@ void EC_AnimationController::Update(float frametime)
     // Loop through all animations & update them as necessary
     for(AnimationMap::iterator i = animations_.begin(); i != animations_.end(); ++i)
     {
-        Ogre::AnimationState* animstate = GetAnimationState(entity, i->first);
+        Ogre::AnimationState* animstate = GetAnimationState(i->first);
         if (!animstate)
             continue;
             
@@ -217,14 +297,14 @@ void EC_AnimationController::Update(float frametime)
     {
         animations_.erase(erase_list[i]);
     }
+
+    if (cLodMaxBlendedStates[lodLevel_] > 0)
+        LimitBlendedStates(cLodMaxBlendedStates[lodLevel_]);
     
     // High-priority/low-priority blending code
-    if (entity->hasSkeleton())
+    Ogre::SkeletonInstance* skel = GetSkeleton();
+    if (skel)
     {
-        Ogre::SkeletonInstance* skel = entity->getSkeleton();
-        if (!skel)
-            return;
-            
         if (highpriority_mask_.size() != skel->getNumBones())
             highpriority_mask_.resize(skel->getNumBones());
         if (lowpriority_mask_.size() != skel->getNumBones())
@@ -239,7 +319,7 @@ void EC_AnimationController::Update(float frametime)
         // Loop through all high priority animations & update the lowpriority-blendmask based on their active tracks
         for(AnimationMap::iterator i = animations_.begin(); i != animations_.end(); ++i)
         {
-            Ogre::AnimationState* animstate = GetAnimationState(entity, i->first);
+            Ogre::AnimationState* animstate = GetAnimationState(i->first);
             if (!animstate)
                 continue;            
             // Create blend mask if animstate doesn't have it yet
@@ -274,7 +354,7 @@ void EC_AnimationController::Update(float frametime)
         // Now set the calculated blendmask on low-priority animations
         for(AnimationMap::iterator i = animations_.begin(); i != animations_.end(); ++i)
         {
-            Ogre::AnimationState* animstate = GetAnimationState(entity, i->first);
+            Ogre::AnimationState* animstate = GetAnimationState(i->first);
             if (!animstate)
                 continue;    
             if (i->second.high_priority_ == false)
@@ -346,6 +426,46 @@ Ogre::Entity* EC_AnimationController::GetEntity()
     return entity;
 }
 
+Ogre::InstancedEntity* EC_AnimationController::GetInstancedEntity()
+{
+    if (!mesh)
+        AutoSetMesh();
+
+    if (!mesh)
+        return 0;
+
+    Ogre::InstancedEntity* instance = mesh->OgreInstancedEntity();
+    if (!instance || !instance->hasSkeleton())
+        return 0;
+
+    const std::string &meshName = instance->_getOwner()->_getMeshRef()->getName();
+    if (meshName != mesh_name_)
+    {
+        mesh_name_ = meshName;
+        ResetState();
+    }
+
+    return instance;
+}
+
+Ogre::AnimationStateSet* EC_AnimationController::GetAnimationStates()
+{
+    Ogre::Entity* entity = GetEntity();
+    if (entity)
+        return entity->getAllAnimationStates();
+    Ogre::InstancedEntity* instance = GetInstancedEntity();
+    return instance ? instance->getAllAnimationStates() : 0;
+}
+
+Ogre::SkeletonInstance* EC_AnimationController::GetSkeleton()
+{
+    Ogre::Entity* entity = GetEntity();
+    if (entity)
+        return entity->hasSkeleton() ? entity->getSkeleton() : 0;
+    Ogre::InstancedEntity* instance = GetInstancedEntity();
+    return instance ? instance->getSkeleton() : 0;
+}
+
 void EC_AnimationController::ResetState()
 {
     animations_.clear();
@@ -369,12 +489,9 @@ Ogre::AnimationState *OgreAnimStateSetFindNoCase(Ogre::AnimationStateSet *set, c
     return 0;
 }
 
-Ogre::AnimationState* EC_AnimationController::GetAnimationState(Ogre::Entity* entity, const QString& name)
+Ogre::AnimationState* EC_AnimationController::GetAnimationState(const QString& name)
 {
-    if (!entity)
-        return 0;
-        
-    return OgreAnimStateSetFindNoCase(entity->getAllAnimationStates(), name);
+    return OgreAnimStateSetFindNoCase(GetAnimationStates(), name);
 }
 
 bool EC_AnimationController::EnableExclusiveAnimation(const QString& name, bool looped, float fadein, float fadeout, bool high_priority)
@@ -398,8 +515,7 @@ bool EC_AnimationController::EnableExclusiveAnimation(const QString& name, bool
 
 bool EC_AnimationController::EnableAnimation(const QString& name, bool looped, float fadein, bool high_priority)
 {
-    Ogre::Entity* entity = GetEntity();
-    Ogre::AnimationState* animstate = GetAnimationState(entity, name);
+    Ogre::AnimationState* animstate = GetAnimationState(name);
     if (!animstate) 
         return false;
 
@@ -438,8 +554,7 @@ bool EC_AnimationController::EnableAnimation(const QString& name, bool looped, f
 
 bool EC_AnimationController::HasAnimationFinished(const QString& name)
 {
-    Ogre::Entity* entity = GetEntity();
-    Ogre::AnimationState* animstate = GetAnimationState(entity, name);
+    Ogre::AnimationState* animstate = GetAnimationState(name);
     if (!animstate) 
         return false;
 
@@ -527,8 +642,7 @@ void EC_AnimationController::DisableAllAnimations(float fadeout)
 
 void EC_AnimationController::SetAnimationToEnd(const QString& name)
 {
-    Ogre::Entity* entity = GetEntity();
-    Ogre::AnimationState* animstate = GetAnimationState(entity, name);
+    Ogre::AnimationState* animstate = GetAnimationState(name);
     if (!animstate)
         return;
         
@@ -576,8 +690,7 @@ bool EC_AnimationController::SetAnimationPriority(const QString& name, bool high
 
 bool EC_AnimationController::SetAnimationTimePosition(const QString& name, float newPosition)
 {
-    Ogre::Entity* entity = GetEntity();
-    Ogre::AnimationState* animstate = GetAnimationState(entity, name);
+    Ogre::AnimationState* animstate = GetAnimationState(name);
     if (!animstate) 
         return false;
         
@@ -594,8 +707,7 @@ bool EC_AnimationController::SetAnimationTimePosition(const QString& name, float
 
 bool EC_AnimationController::SetAnimationRelativeTimePosition(const QString& name, float newPosition)
 {
-    Ogre::Entity* entity = GetEntity();
-    Ogre::AnimationState* animstate = GetAnimationState(entity, name);
+    Ogre::AnimationState* animstate = GetAnimationState(name);
     if (!animstate) 
         return false;
         
@@ -612,8 +724,7 @@ bool EC_AnimationController::SetAnimationRelativeTimePosition(const QString& nam
 
 float EC_AnimationController::GetAnimationLength(const QString& name)
 {
-    Ogre::Entity* entity = GetEntity();
-    Ogre::AnimationState* animstate = GetAnimationState(entity, name);
+    Ogre::AnimationState* animstate = GetAnimationState(name);
     if (!animstate)
         return 0.0f;
     else
@@ -622,8 +733,7 @@ float EC_AnimationController::GetAnimationLength(const QString& name)
 
 float EC_AnimationController::GetAnimationTimePosition(const QString& name)
 {
-    Ogre::Entity* entity = GetEntity();
-    Ogre::AnimationState* animstate = GetAnimationState(entity, name);
+    Ogre::AnimationState* animstate = GetAnimationState(name);
     if (!animstate)
         return 0.0f;
     
@@ -636,8 +746,7 @@ float EC_AnimationController::GetAnimationTimePosition(const QString& name)
 
 float EC_AnimationController::GetAnimationRelativeTimePosition(const QString& name)
 {
-    Ogre::Entity* entity = GetEntity();
-    Ogre::AnimationState* animstate = GetAnimationState(entity, name);
+    Ogre::AnimationState* animstate = GetAnimationState(name);
     if (!animstate)
         return 0.0f;
     
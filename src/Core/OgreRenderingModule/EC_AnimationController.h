@@ -23,6 +23,8 @@
     <ul>
     <li>QString: animationState
     <div> @copydoc animationState </div>
+    <li>bool: animationLod
+    <div> @copydoc animationLod </div>
     </ul>
 
     <b>Exposes the following scriptable functions:</b>
@@ -42,6 +44,7 @@
     <li>"SetAnimationNumLoops": @copydoc SetAnimationNumLoops
     <li>"GetAvailableAnimations": @copydoc GetAvailableAnimations
     <li>"GetActiveAnimations": @copydoc GetActiveAnimations
+    <li>"LodLevel": @copydoc LodLevel
     </ul>
 
     <b>Reacts on the following actions:</b>
@@ -82,6 +85,12 @@ public:
     Q_PROPERTY(bool drawDebug READ getdrawDebug WRITE setdrawDebug);
     DEFINE_QPROPERTY_ATTRIBUTE(bool, drawDebug);
 
+    /// Are the animations updated less often, and with fewer blended states, when the mesh is small on screen or off screen (default true).
+    /** The LOD level is chosen each frame by the screen height of the world bounding box of the mesh in the main camera. The meshes
+        that are off screen are updated only twice a second, so Ogre does not recompute their skeletons in between. */
+    Q_PROPERTY(bool animationLod READ getanimationLod WRITE setanimationLod);
+    DEFINE_QPROPERTY_ATTRIBUTE(bool, animationLod);
+
     /// Gets mesh entity component
     EC_Mesh *GetMeshEntity() const { return mesh; }
     
@@ -150,6 +159,9 @@ public slots:
     /// Updates animation(s) by elapsed time
     void Update(float frametime);
 
+    /// Returns the animation LOD level of the last frame, 0 being full rate, @see animationLod.
+    int LodLevel() const { return lodLevel_; }
+
     /// Draws the mesh skeleton
     void DrawSkeleton(float frametime);
     
@@ -281,6 +293,8 @@ signals:
     void AnimationCycled(const QString& animationName);
 
 private slots:
+    /// Updates the animations at the rate of the LOD level, accumulating the frame times in between.
+    void OnFrameUpdated(float frametime);
     /// Called when the parent entity has been set.
     void UpdateSignals();
     /// Called when component has been removed from the parent entity. Checks if the component removed was the mesh, and autodissociates it.
@@ -290,14 +304,28 @@ private:
     /// Gets Ogre entity from the mesh entity component and checks if it has changed; in that case resets internal state
     Ogre::Entity* GetEntity();
 
-    /// Gets animationstate from Ogre entity safely
-    /** @param entity Ogre entity
-        @param name Animation name
+    /// Gets the skinned Ogre instanced entity from the mesh entity component and checks if it has changed; in that case resets internal state
+    Ogre::InstancedEntity* GetInstancedEntity();
+
+    /// Gets the animation states of the Ogre entity, or of the instanced entity if the mesh is instanced
+    Ogre::AnimationStateSet* GetAnimationStates();
+
+    /// Gets the skeleton instance of the Ogre entity, or of the instanced entity if the mesh is instanced
+    Ogre::SkeletonInstance* GetSkeleton();
+
+    /// Gets animationstate from Ogre entity or instanced entity safely
+    /** @param name Animation name
         @return animationstate, or null if not found */
-    Ogre::AnimationState* GetAnimationState(Ogre::Entity* entity, const QString& name);
+    Ogre::AnimationState* GetAnimationState(const QString& name);
     
     /// Resets internal state
     void ResetState();
+
+    /// Returns the animation LOD level of the mesh by its screen size in the main camera.
+    int ComputeLodLevel() const;
+
+    /// Disables the Ogre animation states of all but the maximum number of the most heavily weighted animations.
+    void LimitBlendedStates(size_t maxStates);
     
     /// Mesh entity component 
     EC_Mesh *mesh;
@@ -313,4 +341,10 @@ private:
 
     /// Bone blend mask of low-priority animations
     Ogre::AnimationState::BoneBlendMask lowpriority_mask_;
+
+    /// Current animation LOD level
+    int lodLevel_;
+
+    /// Frame time accumulated since the last update
+    float lodTime_;
 };
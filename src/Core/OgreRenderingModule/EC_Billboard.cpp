@@ -13,6 +13,7 @@
 #include "EC_Placeable.h"
 #include "OgreMaterialAsset.h"
 #include "OgreWorld.h"
+#include "BillboardBatcher.h"
 
 #include "Entity.h"
 #include "Framework.h"
@@ -36,6 +37,7 @@ EC_Billboard::EC_Billboard(Scene* scene) :
     billboardSet_(0),
     billboard_(0),
     attached_(false),
+    batched_(false),
     INIT_ATTRIBUTE(materialRef, "Material ref"),
     INIT_ATTRIBUTE_VALUE(position, "Position", float3::zero),
     INIT_ATTRIBUTE_VALUE(width, "Size X", 1.0f),
@@ -101,6 +103,13 @@ void EC_Billboard::CreateBillboard()
     if (!scene)
         return;
 
+    // The batched billboard is created in the shared billboard set of its material when shown.
+    if (world->BillboardBatching())
+    {
+        batched_ = true;
+        return;
+    }
+
     if (!billboardSet_)
     {
         billboardSet_ = scene->createBillboardSet(world->GetUniqueObjectName("EC_Billboard"), 1);
@@ -121,6 +130,13 @@ void EC_Billboard::CreateBillboard()
 
 void EC_Billboard::UpdateBillboardProperties()
 {
+    if (batched_)
+    {
+        BillboardBatcher *batcher = Batcher();
+        if (batcher)
+            batcher->Update(this);
+        return;
+    }
     if (billboard_)
     {
         billboard_->setPosition(position.Get());
@@ -170,6 +186,16 @@ void EC_Billboard::Hide()
 
 void EC_Billboard::AttachBillboard()
 {
+    if (batched_)
+    {
+        BillboardBatcher *batcher = Batcher();
+        if (placeable_ && !attached_ && batcher)
+        {
+            billboard_ = batcher->Add(this, placeable_.get(), materialName_);
+            attached_ = true;
+        }
+        return;
+    }
     if (placeable_ && !attached_ && billboardSet_)
     {
         placeable_->GetSceneNode()->attachObject(billboardSet_);
@@ -179,6 +205,15 @@ void EC_Billboard::AttachBillboard()
 
 void EC_Billboard::DetachBillboard()
 {
+    if (batched_)
+    {
+        BillboardBatcher *batcher = Batcher();
+        if (attached_ && batcher)
+            batcher->Remove(this);
+        billboard_ = 0;
+        attached_ = false;
+        return;
+    }
     if (placeable_ && attached_ && billboardSet_)
     {
         placeable_->GetSceneNode()->detachObject(billboardSet_);
@@ -186,6 +221,22 @@ void EC_Billboard::DetachBillboard()
     }
 }
 
+Ogre::BillboardSet *EC_Billboard::OgreBillboardSet() const
+{
+    if (batched_)
+    {
+        BillboardBatcher *batcher = Batcher();
+        return batcher ? batcher->BillboardSetOf(const_cast<EC_Billboard*>(this)) : 0;
+    }
+    return billboardSet_;
+}
+
+BillboardBatcher *EC_Billboard::Batcher() const
+{
+    OgreWorldPtr world = world_.lock();
+    return (batched_ && world) ? world->BillboardBatching() : 0;
+}
+
 // Matches OgrePrerequisites.h:62 (OGRE_VERSION #define)
 #define OGRE_VER(major, minor, patch) (((major) << 16) | ((minor) << 8) | (patch))
 
@@ -214,6 +265,8 @@ void EC_Billboard::AttributesChanged()
             if (materialRef.Get().ref.isEmpty() && billboardSet_)
                 billboardSet_->setMaterial(Ogre::MaterialPtr());
 #endif
+            if (materialRef.Get().ref.isEmpty() && batched_)
+                SetBatchedMaterial("");
         }
         catch (Ogre::Exception &e)
         {
@@ -243,10 +296,23 @@ void EC_Billboard::OnMaterialAssetLoaded(AssetPtr asset)
     
     if (billboardSet_)
         billboardSet_->setMaterialName(material->getName());
+    else if (batched_)
+        SetBatchedMaterial(QString::fromStdString(material->getName()));
 }
 
 void EC_Billboard::OnMaterialAssetFailed(IAssetTransfer* transfer, QString reason)
 {
     if (billboardSet_)
         billboardSet_->setMaterialName("AssetLoadError");
+    else if (batched_)
+        SetBatchedMaterial("AssetLoadError");
+}
+
+void EC_Billboard::SetBatchedMaterial(const QString &materialName)
+{
+    materialName_ = materialName;
+    // Move the shown billboard to the set of the material.
+    BillboardBatcher *batcher = Batcher();
+    if (attached_ && placeable_ && batcher)
+        billboard_ = batcher->Add(this, placeable_.get(), materialName_);
 }
@@ -90,10 +90,13 @@ public:
     DEFINE_QPROPERTY_ATTRIBUTE(bool, show);
 
     /// Returns the Ogre Billboard.
+    /** When the billboards are batched, see BillboardBatcher, this is in world space, and null while the billboard is hidden. */
     Ogre::Billboard *OgreBillboard() const { return billboard_; }
 
     /// Returns the Ogre BillboardSet.
-    Ogre::BillboardSet *OgreBillboardSet() const { return billboardSet_; }
+    /** When the billboards are batched, see BillboardBatcher, this is shared by all the billboards of the same material,
+        and null while the billboard is hidden. */
+    Ogre::BillboardSet *OgreBillboardSet() const;
 
     // DEPRECATED
     Ogre::Billboard *GetBillBoard() const { return OgreBillboard(); } /**< @deprecated Use OgreBillBoard @todo Remove */
@@ -140,6 +143,12 @@ private:
 
     void AttributesChanged();
 
+    /// Sets the material of the batched billboard, moving it to the shared billboard set of the material if it is shown.
+    void SetBatchedMaterial(const QString &materialName);
+
+    /// Returns the billboard batcher of the world, or null if the billboard is not batched.
+    BillboardBatcher *Batcher() const;
+
     /// Ogre world ptr
     OgreWorldWeakPtr world_;
     
@@ -151,6 +160,12 @@ private:
     
     /// Attached flag
     bool attached_;
+
+    /// Is the billboard in a shared billboard set of BillboardBatcher instead of billboardSet_.
+    bool batched_;
+
+    /// Ogre material name of the billboard, empty for the default material. Used when batched.
+    QString materialName_;
     
     /// Placeable pointer
     shared_ptr<EC_Placeable> placeable_;
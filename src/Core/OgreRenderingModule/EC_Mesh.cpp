@@ -5,6 +5,7 @@
 #include "DebugOperatorNew.h"
 #include "OgreRenderingModule.h"
 #include "OgreWorld.h"
+#include "SpatialWorld.h"
 #include "Renderer.h"
 #include "Entity.h"
 #include "Scene/Scene.h"
@@ -43,8 +44,11 @@ EC_Mesh::EC_Mesh(Scene* scene) :
     INIT_ATTRIBUTE_VALUE(drawDistance, "Draw distance", 0.0f),
     INIT_ATTRIBUTE_VALUE(castShadows, "Cast shadows", false),
     INIT_ATTRIBUTE_VALUE(useInstancing, "Use instancing", false),
+    INIT_ATTRIBUTE_VALUE(lodBias, "LOD bias", 1.0f),
+    INIT_ATTRIBUTE_VALUE(maxLodLevel, "Max LOD level", -1),
     entity_(0),
     instancedEntity_(0),
+    autoInstanced_(false),
     adjustmentNode_(0),
     attached_(false)
 {
@@ -54,6 +58,11 @@ EC_Mesh::EC_Mesh(Scene* scene) :
     static AttributeMetadata drawDistanceData("", "0", "10000");
     drawDistance.SetMetadata(&drawDistanceData);
 
+    static AttributeMetadata lodBiasData("", "0.01", "100", "0.1");
+    lodBias.SetMetadata(&lodBiasData);
+    static AttributeMetadata maxLodLevelData("", "-1", "99");
+    maxLodLevel.SetMetadata(&maxLodLevelData);
+
     static AttributeMetadata materialMetadata;
     materialMetadata.elementType = "AssetReference";
     meshMaterial.SetMetadata(&materialMetadata);
@@ -83,6 +92,7 @@ EC_Mesh::~EC_Mesh()
         return;
     }
 
+    world_.lock()->SetAutoInstancingKey(this, "");
     RemoveMesh();
 
     if (adjustmentNode_)
@@ -270,7 +280,9 @@ bool EC_Mesh::SetMesh(const QString &meshResourceName, bool clone)
 
         entity_->setRenderingDistance(drawDistance.Get());
         entity_->setCastShadows(castShadows.Get());
+        ApplyLodBias(entity_);
         entity_->setUserAny(Ogre::Any(static_cast<IComponent *>(this)));
+        entity_->setQueryFlags(OgreWorld::SpatialRaycastQueryFlag);
         // Set UserAny also on subentities
         for(uint i = 0; i < entity_->getNumSubEntities(); ++i)
             entity_->getSubEntity(i)->setUserAny(entity_->getUserAny());
@@ -347,7 +359,9 @@ bool EC_Mesh::SetMeshWithSkeleton(const std::string& mesh_name, const std::strin
         
         entity_->setRenderingDistance(drawDistance.Get());
         entity_->setCastShadows(castShadows.Get());
+        ApplyLodBias(entity_);
         entity_->setUserAny(Ogre::Any(static_cast<IComponent *>(this)));
+        entity_->setQueryFlags(OgreWorld::SpatialRaycastQueryFlag);
         // Set UserAny also on subentities
         for(uint i = 0; i < entity_->getNumSubEntities(); ++i)
             entity_->getSubEntity(i)->setUserAny(entity_->getUserAny());
@@ -422,6 +436,10 @@ bool EC_Mesh::SetAttachmentMesh(uint index, const std::string& mesh_name, const
         return false;
     OgreWorldPtr world = world_.lock();
 
+    // Attachments need a non-instanced entity, stop the automatic instancing of this mesh.
+    if (!entity_ && autoInstanced_ && !useInstancing.Get())
+        SetAutoInstanced(false);
+
     if (!entity_)
     {
         LogError("EC_Mesh::SetAttachmentMesh: No mesh entity created yet, can not create attachments!");
@@ -483,6 +501,7 @@ bool EC_Mesh::SetAttachmentMesh(uint index, const std::string& mesh_name, const
 
         attachmentEntities_[index]->setRenderingDistance(drawDistance.Get());
         attachmentEntities_[index]->setCastShadows(castShadows.Get());
+        ApplyLodBias(attachmentEntities_[index]);
         attachmentEntities_[index]->setUserAny(entity_->getUserAny());
         // Set UserAny also on subentities
         for(uint i = 0; i < attachmentEntities_[index]->getNumSubEntities(); ++i)
@@ -519,6 +538,7 @@ bool EC_Mesh::SetAttachmentMesh(uint index, const std::string& mesh_name, const
         LogError("EC_Mesh::SetAttachmentMesh: Could not set attachment mesh " + mesh_name + ": " + std::string(e.what()));
         return false;
     }
+    UpdateStaticGeometry();
     return true;
 }
 
@@ -612,6 +632,7 @@ bool EC_Mesh::SetMaterial(uint index, const QString& material_name, AttributeCha
         return false;
     }
     
+    UpdateStaticGeometry();
     return true;
 }
 
@@ -741,6 +762,11 @@ void EC_Mesh::DetachEntity()
         return;
     
     EC_Placeable* placeable = checked_static_cast<EC_Placeable*>(placeable_.get());
+    disconnect(placeable, SIGNAL(AttributeChanged(IAttribute*, AttributeChange::Type)), this, SLOT(OnPlaceableAttributeChanged(IAttribute*, AttributeChange::Type)));
+    OgreWorldPtr world = world_.lock();
+    if (world)
+        world->SetStaticGeometryMember(this, false);
+
     Ogre::SceneNode* node = placeable->GetSceneNode();
     if (entity_)
         adjustmentNode_->detachObject(entity_);
@@ -756,6 +782,15 @@ void EC_Mesh::DetachEntity()
     attached_ = false;
 }
 
+void EC_Mesh::ApplyLodBias(Ogre::Entity *entity)
+{
+    if (!entity)
+        return;
+    // Ogre names the lowest detail level the "minimum detail index". 99 is Ogre's default meaning no limit.
+    const int maxLevel = maxLodLevel.Get();
+    entity->setMeshLodBias(Max(lodBias.Get(), 0.01f), 0, (Ogre::ushort)(maxLevel < 0 ? 99 : Min(maxLevel, 99)));
+}
+
 void EC_Mesh::AttachEntity()
 {
     if (attached_ || !placeable_ || (!entity_ && !instancedEntity_))
@@ -778,13 +813,39 @@ void EC_Mesh::AttachEntity()
     adjustmentNode_->setVisible(placeable->visible.Get());
 
     attached_ = true;
+
+    connect(placeable, SIGNAL(AttributeChanged(IAttribute*, AttributeChange::Type)), this, SLOT(OnPlaceableAttributeChanged(IAttribute*, AttributeChange::Type)), Qt::UniqueConnection);
+    UpdateStaticGeometry();
+}
+
+void EC_Mesh::UpdateStaticGeometry()
+{
+    OgreWorldPtr world = world_.lock();
+    if (!world)
+        return;
+
+    // Only plain, non-animated entities can be merged into the static geometry.
+    EC_Placeable *placeable = dynamic_cast<EC_Placeable*>(placeable_.get());
+    bool isStatic = entity_ && attached_ && placeable && placeable->staticGeometry.Get() && placeable->visible.Get() &&
+        !entity_->hasSkeleton() && !entity_->hasVertexAnimation();
+    for(uint i = 0; i < attachmentEntities_.size() && isStatic; ++i)
+        if (attachmentEntities_[i])
+            isStatic = false;
+    world->SetStaticGeometryMember(this, isStatic);
+}
+
+void EC_Mesh::OnPlaceableAttributeChanged(IAttribute *attribute, AttributeChange::Type /*change*/)
+{
+    EC_Placeable *placeable = dynamic_cast<EC_Placeable*>(placeable_.get());
+    if (placeable && (attribute == &placeable->staticGeometry || attribute == &placeable->visible || attribute == &placeable->transform))
+        UpdateStaticGeometry();
 }
 
 void EC_Mesh::CreateMesh(const AssetPtr &meshAsset)
 {
     // Redirect call if instancing is enabled.
 #ifndef NO_INSTANCING
-    if (useInstancing.Get())
+    if (IsInstanced())
     {
         LogWarning("EC_Mesh::CreateMesh: Called with instancing enabled, redirecting to CreateInstance().");
         CreateInstance(meshAsset);
@@ -839,7 +900,7 @@ void EC_Mesh::CreateInstance(const AssetPtr &meshAsset)
     return;
 #else
     // Redirect call if instancing is not enabled.
-    if (!useInstancing.Get())
+    if (!IsInstanced())
     {
         LogWarning("EC_Mesh::CreateInstance: Called with instancing disabled, redirecting to CreateMesh().");
         CreateMesh(meshAsset);
@@ -869,14 +930,41 @@ void EC_Mesh::CreateInstance(const AssetPtr &meshAsset)
             return;
     }
 
-    RemoveMesh();
+    // Skinned instances are created once the skeleton is loaded.
+    AssetPtr skeleton;
+    if (!skeletonRef.Get().ref.trimmed().isEmpty())
+    {
+        skeleton = skeletonAsset->Asset();
+        if (!skeleton.get() || !skeleton->IsLoaded())
+            return;
+    }
 
     if (world_.expired())
         return;
+    OgreWorldPtr world = world_.lock();
+    AssetPtr mesh = (meshAsset.get() != 0 ? meshAsset : this->meshAsset->Asset());
+
+    // Automatically instanced meshes that would not look the same instanced are left as they are.
+    const bool autoOnly = autoInstanced_ && !useInstancing.Get();
+    if (autoOnly && !world->CanAutoInstance(mesh, meshMaterial.Get(), skeleton))
+    {
+        autoInstanced_ = false;
+        CreateMesh(mesh);
+        return;
+    }
 
-    instancedEntity_ = world_.lock()->CreateInstance(this, meshAsset.get() != 0 ? meshAsset : this->meshAsset->Asset(), meshMaterial.Get(), drawDistance.Get(), castShadows.Get());
+    RemoveMesh();
+
+    instancedEntity_ = world->CreateInstance(this, mesh, meshMaterial.Get(), drawDistance.Get(), castShadows.Get(), skeleton);
     if (!instancedEntity_)
+    {
+        if (autoOnly)
+        {
+            autoInstanced_ = false;
+            CreateMesh(mesh);
+        }
         return;
+    }
 
     // Make sure adjustment node is up to date
     Transform newTransform = nodeTransformation.Get();
@@ -964,15 +1052,15 @@ void EC_Mesh::AttributesChanged()
     if (useInstancing.ValueChanged())
     {
         // Validate if we can use instancing.
-        if (useInstancing.Get() && !skeletonRef.Get().ref.isEmpty())
+        if (useInstancing.Get() && !skeletonRef.Get().ref.isEmpty() && (world_.expired() || !world_.lock()->IsSkinnedInstancingSupported()))
         {
-            LogWarning("EC_Mesh: Cannot use instancing when a skeleton reference is defined. Disable instancing or remove the skeleton!");
+            LogWarning("EC_Mesh: Cannot use instancing with a skeleton, the render system does not support vertex texture fetch. Disable instancing or remove the skeleton!");
             useInstancing.Set(false, AttributeChange::Disconnected);
         }
 
-        if (useInstancing.Get())
+        if (IsInstanced())
             CreateInstance();
-        else if (!useInstancing.Get())
+        else
             CreateMesh();
     }
 #endif
@@ -1010,6 +1098,12 @@ void EC_Mesh::AttributesChanged()
                 if (child) child->setCastShadows(castShadows.Get());
         }
     }
+    if (lodBias.ValueChanged() || maxLodLevel.ValueChanged())
+    {
+        ApplyLodBias(entity_);
+        for(uint i = 0; i < attachmentEntities_.size(); ++i)
+            ApplyLodBias(attachmentEntities_[i]);
+    }
     if (nodeTransformation.ValueChanged())
     {
         Transform newTransform = nodeTransformation.Get();
@@ -1020,6 +1114,12 @@ void EC_Mesh::AttributesChanged()
         newTransform.scale = Max(newTransform.scale, float3::FromScalar(0.0000001f));
         
         adjustmentNode_->setScale(newTransform.scale);
+
+        // The bounds of the placeable in the SpatialWorld enclose the mesh.
+        Scene *scene = ParentScene();
+        SpatialWorldPtr spatialWorld = scene ? scene->Subsystem<SpatialWorld>() : SpatialWorldPtr();
+        if (spatialWorld)
+            spatialWorld->MarkMoved(dynamic_cast<EC_Placeable*>(placeable_.get()));
     }
     if (meshRef.ValueChanged())
     {
@@ -1072,6 +1172,10 @@ void EC_Mesh::AttributesChanged()
         if (!skeletonRef.Get().ref.isEmpty())
             skeletonAsset->HandleAssetRefChange(&skeletonRef);
     }
+    if (meshRef.ValueChanged() || meshMaterial.ValueChanged() || skeletonRef.ValueChanged())
+        UpdateAutoInstancingKey();
+    if (nodeTransformation.ValueChanged() || castShadows.ValueChanged() || drawDistance.ValueChanged())
+        UpdateStaticGeometry();
 }
 
 void EC_Mesh::OnComponentRemoved(IComponent* component, AttributeChange::Type change)
@@ -1082,7 +1186,7 @@ void EC_Mesh::OnComponentRemoved(IComponent* component, AttributeChange::Type ch
 
 void EC_Mesh::OnMeshAssetLoaded(AssetPtr asset)
 {
-    if (useInstancing.Get())
+    if (IsInstanced())
         CreateInstance(asset);
     else
         CreateMesh(asset);
@@ -1106,6 +1210,13 @@ void EC_Mesh::OnSkeletonAssetLoaded(AssetPtr asset)
         return;
     }
 
+    // Skinned instances set the skeleton to the mesh when they are created.
+    if (IsInstanced())
+    {
+        CreateInstance();
+        return;
+    }
+
     if (!entity_)
         return;
 
@@ -1124,8 +1235,7 @@ void EC_Mesh::OnSkeletonAssetLoaded(AssetPtr asset)
     }
 
     // Now we have to recreate the entity to get proper animations etc.
-    if (!useInstancing.Get())
-        SetMesh(entity_->getMesh()->getName().c_str(), false);
+    SetMesh(entity_->getMesh()->getName().c_str(), false);
 }
 
 void EC_Mesh::OnMaterialAssetLoaded(AssetPtr asset)
@@ -1154,7 +1264,7 @@ void EC_Mesh::OnMaterialAssetLoaded(AssetPtr asset)
 
     // If we are using instancing CreateInstance() is
     // currently waiting for this material to load.
-    if (assetUsed && useInstancing.Get())
+    if (assetUsed && IsInstanced())
         CreateInstance();
 
     // This check & debug print is now in Debug mode only. Rapid changes in materials and the delay-loaded nature of assets makes it unavoidable in some cases.
@@ -1418,7 +1528,8 @@ OBB EC_Mesh::LocalOBB() const
 AABB EC_Mesh::WorldAABB() const
 {
     AABB aabb = LocalAABB();
-    aabb.Transform(LocalToWorld());
+    if (aabb.IsFinite()) // Keeps the negative infinity of a missing mesh.
+        aabb.TransformAsAABB(LocalToWorld());
     return aabb;
 }
 
@@ -1641,6 +1752,72 @@ Ogre::InstancedEntity* EC_Mesh::OgreInstancedEntity() const
     return instancedEntity_;
 }
 
+bool EC_Mesh::IsOccluded() const
+{
+    OgreWorldPtr world = world_.lock();
+    return world && entity_ && world->IsOccluded(entity_);
+}
+
+bool EC_Mesh::IsInstanced() const
+{
+#ifdef NO_INSTANCING
+    return false;
+#else
+    return useInstancing.Get() || autoInstanced_;
+#endif
+}
+
+void EC_Mesh::SetAutoInstanced(bool enabled)
+{
+#ifndef NO_INSTANCING
+    // Attachments can only be made to non-instanced entities.
+    for(uint i = 0; i < attachmentEntities_.size() && enabled; ++i)
+        if (attachmentEntities_[i])
+            enabled = false;
+    if (enabled == autoInstanced_)
+        return;
+
+    const bool wasInstanced = IsInstanced();
+    autoInstanced_ = enabled;
+    if (IsInstanced() == wasInstanced || !ViewEnabled())
+        return;
+
+    if (IsInstanced())
+        CreateInstance();
+    else
+        CreateMesh();
+#else
+    UNREFERENCED_PARAM(enabled);
+#endif
+}
+
+QString EC_Mesh::AutoInstancingKey() const
+{
+    const QString ref = meshRef.Get().ref.trimmed();
+    if (ref.isEmpty())
+        return "";
+
+    AssetAPI *assetAPI = framework->Asset();
+    QString key = AssetAPI::SanitateAssetRef(assetAPI->ResolveAssetRef("", ref));
+    const AssetReferenceList materials = meshMaterial.Get();
+    for(int i = 0; i < materials.Size(); ++i)
+    {
+        const QString materialRef = materials[i].ref.trimmed();
+        key += "|" + (materialRef.isEmpty() ? materialRef : assetAPI->ResolveAssetRef("", materialRef));
+    }
+    const QString skeleton = skeletonRef.Get().ref.trimmed();
+    if (!skeleton.isEmpty())
+        key += "|skeleton:" + assetAPI->ResolveAssetRef("", skeleton);
+    return key;
+}
+
+void EC_Mesh::UpdateAutoInstancingKey()
+{
+    OgreWorldPtr world = world_.lock();
+    if (world)
+        world->SetAutoInstancingKey(this, AutoInstancingKey());
+}
+
 Ogre::SceneNode* EC_Mesh::AdjustmentSceneNode() const
 {
     return adjustmentNode_;
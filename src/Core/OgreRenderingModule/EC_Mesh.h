@@ -39,6 +39,12 @@
     <div>@copydoc drawDistance</div>
     <li>bool: castShadows
     <div>@copydoc castShadows</div>
+    <li>bool: useInstancing
+    <div>@copydoc useInstancing</div>
+    <li>float: lodBias
+    <div>@copydoc lodBias</div>
+    <li>int: maxLodLevel
+    <div>@copydoc maxLodLevel</div>
     </ul>
 
     <b>Exposes the following scriptable functions:</b>
@@ -130,9 +136,21 @@ public:
     DEFINE_QPROPERTY_ATTRIBUTE(bool, castShadows);
 
     /// Should the mesh entity be created with instancing.
+    /** OgreWorld also instances the meshes automatically when enough of them share the same mesh, materials and skeleton,
+        see OgreWorld::autoInstancingThreshold. */
     Q_PROPERTY(bool useInstancing READ getuseInstancing WRITE setuseInstancing);
     DEFINE_QPROPERTY_ATTRIBUTE(bool, useInstancing);
 
+    /// Multiplier of the screen size of the mesh when choosing its level of detail, 1.0 (default) uses the levels as they are.
+    /** Values above 1.0 keep the higher detail levels further away, values below 1.0 switch to the lower ones sooner.
+        Has effect only on meshes that have LOD levels, see the --meshLod command line parameter. Not applied to instanced meshes. */
+    Q_PROPERTY(float lodBias READ getlodBias WRITE setlodBias);
+    DEFINE_QPROPERTY_ATTRIBUTE(float, lodBias);
+
+    /// Index of the lowest detail LOD level the mesh may use, 0 = always full detail, -1 = no limit (default).
+    Q_PROPERTY(int maxLodLevel READ getmaxLodLevel WRITE setmaxLodLevel);
+    DEFINE_QPROPERTY_ATTRIBUTE(int, maxLodLevel);
+
     /// Returns Ogre mesh entity.
     /** @return Ogre mesh entity, or null if 1) mesh not loaded 2) instancing is enabled @see OgreInstancedEntity. */ 
     Ogre::Entity* OgreEntity() const;
@@ -141,6 +159,16 @@ public:
     /** @return Instanced Ogre mesh entity, or null if 1) mesh not loaded 2) instancing is disabled @see OgreEntity. */
     Ogre::InstancedEntity* OgreInstancedEntity() const;
 
+    /// Returns if the mesh is created with instancing, either by useInstancing or automatically by OgreWorld.
+    bool IsInstanced() const;
+
+    /// Returns if the mesh was hidden from the main camera by the occlusion culling of OgreWorld in the last frame.
+    bool IsOccluded() const;
+
+    /// Sets if the mesh is instanced automatically. Called by OgreWorld when the population of the mesh changes.
+    /** Has no effect if useInstancing is set, or if the mesh has attachments. */
+    void SetAutoInstanced(bool enabled);
+
     /// Returns an Ogre bone safely, or null if not found.
     Ogre::Bone* OgreBone(const QString& boneName) const;
 
@@ -443,6 +471,9 @@ private slots:
     /// Called when loading a material asset failed
     void OnMaterialAssetFailed(IAssetTransfer* transfer, QString reason);
 
+    /// Called when an attribute of the placeable changes. Updates the static geometry membership on visibility and transform changes.
+    void OnPlaceableAttributeChanged(IAttribute *attribute, AttributeChange::Type change);
+
 private:
     /// Called when some of the attributes has been changed.
     void AttributesChanged();
@@ -471,6 +502,18 @@ private:
     /// Detaches entity from placeable
     void DetachEntity();
 
+    /// Applies lodBias and maxLodLevel to an Ogre entity.
+    void ApplyLodBias(Ogre::Entity *entity);
+
+    /// Returns the key of the population of meshes with the same mesh, materials and skeleton, or empty if there is no mesh.
+    QString AutoInstancingKey() const;
+
+    /// Tells OgreWorld the current automatic instancing population of the mesh.
+    void UpdateAutoInstancingKey();
+
+    /// Adds the mesh to the static geometry of OgreWorld, updates it there or removes it, by the staticGeometry attribute of the placeable.
+    void UpdateStaticGeometry();
+
     /// Placeable component 
     ComponentPtr placeable_;
 
@@ -483,6 +526,9 @@ private:
     /// Ogre instanced mesh entity.
     Ogre::InstancedEntity *instancedEntity_;
 
+    /// Is the mesh instanced automatically by OgreWorld.
+    bool autoInstanced_;
+
     /// Attachment entities
     std::vector<Ogre::Entity*> attachmentEntities_;
 
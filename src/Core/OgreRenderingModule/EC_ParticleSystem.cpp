@@ -7,6 +7,8 @@
 #include "EC_Placeable.h"
 #include "OgreParticleAsset.h"
 #include "OgreWorld.h"
+#include "Renderer.h"
+#include "ParticleBudget.h"
 
 #include "Entity.h"
 #include "Scene/Scene.h"
@@ -99,6 +101,8 @@ void EC_ParticleSystem::CreateParticleSystem(const QString &systemName)
                 particleSystems_[sanitatedSystemName] = system;
                 system->setCastShadows(castShadows.Get());
                 system->setRenderingDistance(renderingDistance.Get());
+                if (world->Renderer()->Particles())
+                    world->Renderer()->Particles()->Register(system);
                 return;
             }
         }
@@ -164,6 +168,8 @@ void EC_ParticleSystem::DeleteParticleSystem(const QString& systemName)
             if (node)
                 node->detachObject(i->second);
         }
+        if (world->Renderer()->Particles())
+            world->Renderer()->Particles()->Unregister(i->second);
         sceneMgr->destroyParticleSystem(i->second);
     }
     catch(Ogre::Exception& /*e*/)
@@ -47,6 +47,9 @@
 
     Does not emit any actions.
 
+    The emission of the particle systems is scaled by their screen size and the renderer-wide particle budget, and the
+    systems out of the view are paused, see ParticleBudget.
+
     <b>Depends on the component @ref EC_Placeable "Placeable".</b>
     </table> */
 class OGRE_MODULE_API EC_ParticleSystem : public IComponent
@@ -8,6 +8,7 @@
 #include "EC_Placeable.h"
 #include "OgreRenderingModule.h"
 #include "OgreWorld.h"
+#include "SpatialWorld.h"
 #include "Renderer.h"
 
 #include "AttributeMetadata.h"
@@ -23,6 +24,8 @@
 #include <OgreTagPoint.h>
 #include <OgreAnimationState.h>
 
+#include <algorithm>
+
 #include "MemoryLeakCheck.h"
 
 using namespace OgreRenderer;
@@ -181,15 +184,24 @@ EC_Placeable::EC_Placeable(Scene* scene) :
     parentPlaceable_(0),
     parentMesh_(0),
     attached_(false),
+    worldTransformDirty_(true),
+    spatialWorld_(0),
+    spatialProxy_(-1),
     INIT_ATTRIBUTE(transform, "Transform"),
     INIT_ATTRIBUTE_VALUE(drawDebug, "Show bounding box", false),
     INIT_ATTRIBUTE_VALUE(visible, "Visible", true),
     INIT_ATTRIBUTE_VALUE(selectionLayer, "Selection layer", 1),
     INIT_ATTRIBUTE_VALUE(parentRef, "Parent entity ref", EntityReference()),
-    INIT_ATTRIBUTE_VALUE(parentBone, "Parent bone name", "")
+    INIT_ATTRIBUTE_VALUE(parentBone, "Parent bone name", ""),
+    INIT_ATTRIBUTE_VALUE(staticGeometry, "Static geometry", false)
 {
     if (scene)
+    {
         world_ = scene->GetWorld<OgreWorld>();
+        SpatialWorldPtr spatialWorld = scene->Subsystem<SpatialWorld>();
+        if (spatialWorld)
+            spatialWorld->Add(this);
+    }
     
     // Enable network interpolation for the transform
     static AttributeMetadata transAttrData;
@@ -219,10 +231,14 @@ EC_Placeable::EC_Placeable(Scene* scene) :
 
 EC_Placeable::~EC_Placeable()
 {
+    if (spatialWorld_)
+        spatialWorld_->Remove(this);
+
     if (world_.expired())
     {
         if (sceneNode_)
             LogError("EC_Placeable: World has expired, skipping uninitialization!");
+        UnlinkPlaceableHierarchy();
         return;
     }
     
@@ -256,6 +272,9 @@ void EC_Placeable::AttachNode()
     }
     OgreWorldPtr world = world_.lock();
     
+    // The parent may change, so recompute the world transform on next access
+    MarkWorldTransformDirty();
+
     try
     {
         // If already attached, detach first
@@ -274,7 +293,10 @@ void EC_Placeable::AttachNode()
         Entity* ownEntity = ParentEntity();
         Scene* scene = ownEntity ? ownEntity->ParentScene() : 0;
         if (scene)
+        {
             scene->disconnect(this, SLOT(CheckParentEntityCreated(Entity*, AttributeChange::Type)));
+            scene->disconnect(this, SLOT(CheckParentEntitiesCreated(const EntityList &, AttributeChange::Type)));
+        }
         if (ownEntity)
             ownEntity->disconnect(this, SLOT(OnComponentAdded(IComponent*, AttributeChange::Type)));
         
@@ -321,6 +343,8 @@ void EC_Placeable::AttachNode()
                             // (in that case bones don't get automatically updated)
                             EC_Placeable* parentPlaceable = parentEntity->GetComponent<EC_Placeable>().get();
                             parentPlaceable_ = parentPlaceable;
+                            if (parentPlaceable_)
+                                parentPlaceable_->childPlaceables_.push_back(this);
                             connect(parentPlaceable_, SIGNAL(TransformChanged()), this, SLOT(OnParentPlaceableTransformChanged()), Qt::UniqueConnection);
 
                             parentBone_ = bone;
@@ -364,6 +388,7 @@ void EC_Placeable::AttachNode()
                     }
                     
                     parentPlaceable_ = parentPlaceable;
+                    parentPlaceable_->childPlaceables_.push_back(this);
                     parentPlaceable_->GetSceneNode()->addChild(sceneNode_);
                     
                     // Connect to destruction of the placeable to be able to detach gracefully
@@ -382,6 +407,7 @@ void EC_Placeable::AttachNode()
             {
                 // Could not find parent entity. Check for it later, when new entities are created into the scene
                 connect(scene, SIGNAL(EntityCreated(Entity*, AttributeChange::Type)), this, SLOT(CheckParentEntityCreated(Entity*, AttributeChange::Type)), Qt::UniqueConnection);
+                connect(scene, SIGNAL(EntitiesCreated(const EntityList &, AttributeChange::Type)), this, SLOT(CheckParentEntitiesCreated(const EntityList &, AttributeChange::Type)), Qt::UniqueConnection);
                 return;
             }
         }
@@ -417,6 +443,10 @@ void EC_Placeable::DetachNode()
         // 1) attached to scene root node
         // 2) attached to another scene node
         // 3) attached to a bone via manual tracking
+        if (parentPlaceable_)
+            parentPlaceable_->childPlaceables_.erase(std::remove(parentPlaceable_->childPlaceables_.begin(),
+                parentPlaceable_->childPlaceables_.end(), this), parentPlaceable_->childPlaceables_.end());
+
         if (parentBone_)
         {
             // Stop listening to parent placeable's transform changes for manual non-animating update
@@ -438,6 +468,7 @@ void EC_Placeable::DetachNode()
             root_node->removeChild(sceneNode_);
         
         attached_ = false;
+        MarkWorldTransformDirty();
     }
     catch (Ogre::Exception& e)
     {
@@ -716,6 +747,7 @@ void EC_Placeable::AttributesChanged()
 
         sceneNode_->setScale(scale);
 
+        MarkWorldTransformDirty();
         emit TransformChanged();
     }
     if (drawDebug.ValueChanged())
@@ -748,6 +780,12 @@ void EC_Placeable::CheckParentEntityCreated(Entity* entity, AttributeChange::Typ
     }
 }
 
+void EC_Placeable::CheckParentEntitiesCreated(const EntityList &entities, AttributeChange::Type change)
+{
+    for(EntityList::const_iterator it = entities.begin(); it != entities.end() && !attached_; ++it)
+        CheckParentEntityCreated(it->get(), change);
+}
+
 void EC_Placeable::OnParentMeshChanged()
 {
     if (!attached_ || !parentBone.Get().trimmed().isEmpty())
@@ -974,6 +1012,9 @@ float3 EC_Placeable::Scale() const
 
 float3x4 EC_Placeable::LocalToWorld() const
 {
+    if (!worldTransformDirty_)
+        return worldTransform_;
+
     // If we are parented to an Ogre bone, we can't (yet) compute the local-to-world matrix ourselves,
     // so query Ogre for the world matrix.
     if (!parentBone.Get().isEmpty() && sceneNode_)
@@ -984,6 +1025,14 @@ float3x4 EC_Placeable::LocalToWorld() const
     assert(parentPlaceable != this);
     float3x4 localToWorld = parentPlaceable ? (parentPlaceable->LocalToWorld() * LocalToParent()) : LocalToParent();
 
+    // Cache the result, unless the parent could not cache its own, i.e. it is attached to a bone.
+    // This keeps every cached placeable's parent cached too, which MarkWorldTransformDirty relies on.
+    if (!parentPlaceable || !parentPlaceable->worldTransformDirty_)
+    {
+        worldTransform_ = localToWorld;
+        worldTransformDirty_ = false;
+    }
+
 #ifdef _DEBUG
     // But confirm to detect oddities when/if these two don't match.
     if (sceneNode_)
@@ -1001,6 +1050,33 @@ float3x4 EC_Placeable::LocalToWorld() const
     return localToWorld;
 }
 
+void EC_Placeable::MarkWorldTransformDirty()
+{
+    // A cached placeable always has a cached parent, so the children of a dirty placeable are dirty already.
+    if (worldTransformDirty_)
+        return;
+    worldTransformDirty_ = true;
+    if (spatialWorld_)
+        spatialWorld_->MarkMoved(this);
+    for(size_t i = 0; i < childPlaceables_.size(); ++i)
+        childPlaceables_[i]->MarkWorldTransformDirty();
+}
+
+void EC_Placeable::UnlinkPlaceableHierarchy()
+{
+    if (parentPlaceable_)
+        parentPlaceable_->childPlaceables_.erase(std::remove(parentPlaceable_->childPlaceables_.begin(),
+            parentPlaceable_->childPlaceables_.end(), this), parentPlaceable_->childPlaceables_.end());
+    parentPlaceable_ = 0;
+
+    for(size_t i = 0; i < childPlaceables_.size(); ++i)
+    {
+        childPlaceables_[i]->MarkWorldTransformDirty();
+        childPlaceables_[i]->parentPlaceable_ = 0;
+    }
+    childPlaceables_.clear();
+}
+
 float3x4 EC_Placeable::WorldToLocal() const
 {
     float3x4 tm = LocalToWorld();
@@ -9,8 +9,11 @@
 #include "OgreModuleFwd.h"
 #include "Transform.h"
 #include "Math/float3.h"
+#include "Math/float3x4.h"
 #include "Math/MathFwd.h"
 
+#include <vector>
+
 /// Ogre placeable (scene node) component
 /** <table class="header">
     <tr>
@@ -32,6 +35,8 @@
     <div> @copydoc parentRef </div>
     <li>QString: parentBone
     <div> @copydoc parentBone </div>
+    <li>bool: staticGeometry
+    <div> @copydoc staticGeometry </div>
     </ul>
 
     <b>Exposes the following scriptable functions:</b>
@@ -119,6 +124,12 @@ public:
     Q_PROPERTY(QString parentBone READ getparentBone WRITE setparentBone)
     DEFINE_QPROPERTY_ATTRIBUTE(QString, parentBone);
 
+    /// Specifies whether the meshes attached to this placeable are merged into the static geometry batches of OgreWorld.
+    /** Use for objects that do not move, animate or change. Moving a static placeable or changing its meshes rebuilds
+        the batch it is in. Skeletal, instanced and attachment meshes are never batched. */
+    Q_PROPERTY(bool staticGeometry READ getstaticGeometry WRITE setstaticGeometry)
+    DEFINE_QPROPERTY_ATTRIBUTE(bool, staticGeometry);
+
     /// Returns the Ogre scene node for attaching geometry.
     /** Do not manipulate the pos/orientation/scale of this node directly, but instead use the Transform property. */
     Ogre::SceneNode* OgreSceneNode() const { return sceneNode_; }
@@ -214,6 +225,7 @@ public slots:
     float3 Scale() const;
 
     /// Returns the concatenated world transformation of this placeable.
+    /** @note Cached until the transform or the parent of this placeable or of one of its parents changes. */
     float3x4 LocalToWorld() const;
     /// Returns the matrix that transforms objects from world space into the local coordinate space of this placeable.
     float3x4 WorldToLocal() const;
@@ -307,6 +319,9 @@ private slots:
         
     /// Handle late creation of the parent entity, and try attaching to it
     void CheckParentEntityCreated(Entity* entity, AttributeChange::Type change);
+
+    /// Handle late creation of the parent entity with Scene::CreateEntities, and try attaching to it
+    void CheckParentEntitiesCreated(const EntityList &entities, AttributeChange::Type change);
     
     /// Handle change of the parent mesh
     void OnParentMeshChanged();
@@ -329,6 +344,13 @@ private:
     
     /// detaches scenenode from parent
     void DetachNode();
+
+    /// Invalidates the cached local-to-world transform of this placeable and its child placeables.
+    void MarkWorldTransformDirty();
+
+    /// Removes the placeable from the child placeables of its parent, and clears the parent of its own child placeables.
+    /** Used on destruction when the world has already expired, and DetachNode can not be used. */
+    void UnlinkPlaceableHierarchy();
     
     /// Ogre world ptr
     OgreWorldWeakPtr world_;
@@ -351,6 +373,26 @@ private:
     /// attached to scene hierarchy-flag
     bool attached_;
 
+    /// Placeables attached to this placeable, invalidated with it when its world transform changes.
+    std::vector<EC_Placeable*> childPlaceables_;
+
+    /// Cached local-to-world transform, valid if worldTransformDirty_ is false.
+    /** Computed from the Tundra scene structures only, so that it works also without Ogre scene nodes on a headless server.
+        Placeables attached to a bone, and their children, are never cached, as the bone can animate.
+        The cache is invalidated by signaled transform changes, so a transform set with AttributeChange::Disconnected
+        is seen by the world transform from its next signaled change on. */
+    mutable float3x4 worldTransform_;
+
+    /// Whether worldTransform_ must be recomputed.
+    mutable bool worldTransformDirty_;
+
+    /// Spatial world the placeable is in, or null.
+    SpatialWorld *spatialWorld_;
+
+    /// Index of the placeable in spatialWorld_.
+    int spatialProxy_;
+
     friend class BoneAttachmentListener;
     friend class CustomTagPoint;
+    friend class SpatialWorld;
 };
@@ -5,21 +5,64 @@
 
 #include "EC_RttTarget.h"
 #include "EC_Camera.h"
+#include "EC_Mesh.h"
 #include "OgreMaterialUtils.h"
+#include "OgreWorld.h"
+#include "Renderer.h"
+#include "ScreenSize.h"
 
 #include "Framework.h"
 #include "Scene/Scene.h"
 #include "FrameAPI.h"
 #include "Entity.h"
 #include "LoggingFunctions.h"
+#include "Profiler.h"
 
 #include "MemoryLeakCheck.h"
 
+namespace
+{
+/// Seconds between the scans for the EC_Mesh components that show the texture.
+const float cMeshScanInterval = 1.f;
+/// Minimum seconds between the resizes of the texture, as each resize recreates the render target.
+const float cResizeInterval = 1.f;
+
+/// Returns whether a texture unit of the material samples the texture.
+bool MaterialUsesTexture(const Ogre::MaterialPtr &material, const std::string &textureName)
+{
+    if (material.isNull())
+        return false;
+    Ogre::Material::TechniqueIterator techniques = material->getTechniqueIterator();
+    while(techniques.hasMoreElements())
+    {
+        Ogre::Technique::PassIterator passes = techniques.getNext()->getPassIterator();
+        while(passes.hasMoreElements())
+        {
+            Ogre::Pass::TextureUnitStateIterator units = passes.getNext()->getTextureUnitStateIterator();
+            while(units.hasMoreElements())
+                if (units.getNext()->getTextureName() == textureName)
+                    return true;
+        }
+    }
+    return false;
+}
+
+}
+
 EC_RttTarget::EC_RttTarget(Scene* scene) :
     IComponent(scene),
     INIT_ATTRIBUTE_VALUE(textureName, "Texture name", "RttTex"),
     INIT_ATTRIBUTE_VALUE(width, "Texture width", 400),
-    INIT_ATTRIBUTE_VALUE(height, "Texture height", 300)
+    INIT_ATTRIBUTE_VALUE(height, "Texture height", 300),
+    INIT_ATTRIBUTE_VALUE(updateInterval, "Update interval", 0.f),
+    INIT_ATTRIBUTE_VALUE(onlyWhenVisible, "Update only when visible", false),
+    INIT_ATTRIBUTE_VALUE(scaleByCoverage, "Scale by screen coverage", false),
+    renderTexture_(0),
+    autoUpdated_(false),
+    timeSinceUpdate_(0.f),
+    timeSinceMeshScan_(cMeshScanInterval),
+    timeSinceResize_(cResizeInterval),
+    resolutionScale_(1.f)
 {
     connect(this, SIGNAL(ParentEntitySet()), this, SLOT(PrepareRtt()));
 }
@@ -69,19 +112,17 @@ void EC_RttTarget::PrepareRtt()
             Ogre::PF_A8R8G8B8, Ogre::TU_RENDERTARGET);
     }
 
+    resolutionScale_ = 1.f;
     Ogre::RenderTexture *render_texture = tex->getBuffer()->getRenderTarget();
+    renderTexture_ = render_texture;
     if (render_texture)
     {
-        render_texture->removeAllViewports();
-        Ogre::Viewport *vp = 0;
-        vp = render_texture->addViewport(ec_camera->GetCamera());
-        // Exclude ui overlays
-        vp->setOverlaysEnabled(false);
-        // Exclude highlight mesh from rendering
-        vp->setVisibilityMask(0x2);
+        AddViewport(render_texture, ec_camera->GetCamera());
 
         render_texture->update(false);
+        // The texture is rendered by Ogre on the frames that OnFrameUpdated lets it, if auto-updated.
         tex->getBuffer()->getRenderTarget()->setAutoUpdated(false); 
+        connect(framework->Frame(), SIGNAL(Updated(float)), this, SLOT(OnFrameUpdated(float)), Qt::UniqueConnection);
     }
     else
         LogError("render target texture getting failed.");
@@ -113,7 +154,137 @@ void EC_RttTarget::SetAutoUpdated(bool val)
         return;
     }
 
-    tex->getBuffer()->getRenderTarget()->setAutoUpdated(val);
+    autoUpdated_ = val;
+    if (!val)
+        tex->getBuffer()->getRenderTarget()->setAutoUpdated(false);
+}
+
+void EC_RttTarget::AddViewport(Ogre::RenderTexture *renderTexture, Ogre::Camera *camera)
+{
+    renderTexture->removeAllViewports();
+    Ogre::Viewport *vp = renderTexture->addViewport(camera);
+    // Exclude ui overlays
+    vp->setOverlaysEnabled(false);
+    // Exclude highlight mesh from rendering
+    vp->setVisibilityMask(0x2);
+}
+
+void EC_RttTarget::AddDisplaySurface(Ogre::MovableObject *surface)
+{
+    if (surface && !displaySurfaces_.contains(surface))
+        displaySurfaces_.push_back(surface);
+}
+
+void EC_RttTarget::RemoveDisplaySurface(Ogre::MovableObject *surface)
+{
+    displaySurfaces_.removeAll(surface);
+}
+
+void EC_RttTarget::OnFrameUpdated(float frameTime)
+{
+    if (!renderTexture_ || !autoUpdated_)
+        return;
+
+    timeSinceUpdate_ += frameTime;
+    timeSinceMeshScan_ += frameTime;
+    timeSinceResize_ += frameTime;
+    if (!scaleByCoverage.Get() && resolutionScale_ != 1.f)
+        SetResolutionScale(1.f);
+
+    bool render = timeSinceUpdate_ >= updateInterval.Get();
+    if (render && (onlyWhenVisible.Get() || scaleByCoverage.Get()))
+    {
+        PROFILE(EC_RttTarget_CheckDisplaySurfaces);
+        const float screenSize = DisplayScreenSize();
+        if (onlyWhenVisible.Get() && screenSize <= 0.f)
+            render = false;
+        // Render at the smallest of the full, half or quarter size that still covers the screen size of the surfaces.
+        if (scaleByCoverage.Get() && screenSize > 0.f && timeSinceResize_ >= cResizeInterval)
+        {
+            const float wanted = screenSize / (float)std::max(1, height.Get());
+            SetResolutionScale(wanted > 0.5f ? 1.f : (wanted > 0.25f ? 0.5f : 0.25f));
+        }
+    }
+
+    renderTexture_->setAutoUpdated(render);
+    if (render)
+        timeSinceUpdate_ = 0.f;
+}
+
+float EC_RttTarget::DisplayScreenSize()
+{
+    OgreWorldPtr world = ParentScene() ? ParentScene()->Subsystem<OgreWorld>() : OgreWorldPtr();
+    Ogre::Camera *camera = world ? world->Renderer()->MainOgreCamera() : 0;
+    if (!camera || world->Renderer()->WindowHeight() <= 0)
+        return 0.f;
+
+    if (timeSinceMeshScan_ >= cMeshScanInterval)
+        FindDisplayMeshes();
+
+    QList<Ogre::MovableObject*> surfaces = displaySurfaces_;
+    for(size_t i = 0; i < displayMeshes_.size(); ++i)
+    {
+        shared_ptr<EC_Mesh> mesh = displayMeshes_[i].lock();
+        if (mesh && mesh->OgreEntity())
+            surfaces.push_back(mesh->OgreEntity());
+    }
+
+    const Ogre::Vector3 eye = camera->getDerivedPosition();
+    float screenSize = 0.f;
+    foreach(Ogre::MovableObject *surface, surfaces)
+    {
+        if (!surface->isInScene() || !surface->isVisible())
+            continue;
+        const Ogre::AxisAlignedBox &box = surface->getWorldBoundingBox(true);
+        if (!camera->isVisible(box))
+            continue;
+        const float distance = std::max(box.distance(eye), camera->getNearClipDistance());
+        screenSize = std::max(screenSize, OgreRenderer::ScreenSizeInPixels(camera, box, distance));
+    }
+    return screenSize;
+}
+
+void EC_RttTarget::FindDisplayMeshes()
+{
+    timeSinceMeshScan_ = 0.f;
+    displayMeshes_.clear();
+    const std::string name = textureName.Get().toStdString();
+    std::vector<shared_ptr<EC_Mesh> > meshes = ParentScene()->Components<EC_Mesh>();
+    for(size_t i = 0; i < meshes.size(); ++i)
+    {
+        Ogre::Entity *entity = meshes[i]->OgreEntity();
+        if (!entity)
+            continue;
+        for(uint j = 0; j < entity->getNumSubEntities(); ++j)
+            if (MaterialUsesTexture(entity->getSubEntity(j)->getMaterial(), name))
+            {
+                displayMeshes_.push_back(meshes[i]);
+                break;
+            }
+    }
+}
+
+void EC_RttTarget::SetResolutionScale(float scale)
+{
+    if (scale == resolutionScale_ || !renderTexture_)
+        return;
+
+    Ogre::TexturePtr tex = Ogre::TextureManager::getSingleton().getByName(textureName.Get().toStdString());
+    Ogre::Viewport *vp = (renderTexture_->getNumViewports() > 0 ? renderTexture_->getViewport(0) : 0);
+    if (tex.isNull() || !vp)
+        return;
+    Ogre::Camera *camera = vp->getCamera();
+
+    // Recreating the resources keeps the texture object, so that the materials sampling it need no changes.
+    timeSinceResize_ = 0.f;
+    resolutionScale_ = scale;
+    tex->freeInternalResources();
+    tex->setWidth(std::max(1, (int)(width.Get() * scale)));
+    tex->setHeight(std::max(1, (int)(height.Get() * scale)));
+    tex->createInternalResources();
+    renderTexture_ = tex->getBuffer()->getRenderTarget();
+    renderTexture_->setAutoUpdated(false);
+    AddViewport(renderTexture_, camera);
 }
 
 /*void EC_RttTarget::ScheduleRender()
@@ -4,6 +4,13 @@
 
 #include "IComponent.h"
 #include "OgreModuleApi.h"
+#include "OgreModuleFwd.h"
+
+#include <QList>
+
+#include <vector>
+
+class EC_Mesh;
 
 /// Ogre render-to-texture component
 /**
@@ -22,11 +29,20 @@ Registered by OgreRenderer::OgreRenderingModule.
 <div>Width of the texture.
 <li>int height
 <div>Height of the texture.
+<li>float updateInterval
+<div>@copydoc updateInterval</div>
+<li>bool onlyWhenVisible
+<div>@copydoc onlyWhenVisible</div>
+<li>bool scaleByCoverage
+<div>@copydoc scaleByCoverage</div>
 </ul>
 
+The display surfaces of the texture are the EC_Mesh components whose materials sample it, and the Ogre objects
+added with AddDisplaySurface. They are found in the view of the main camera to gate and scale the updates.
+
 <b>Exposes the following scriptable functions:</b>
 <ul>
-<li>...
+<li>"SetAutoUpdated": Sets whether the texture is rendered on every frame, within the limits of the attributes above.
 </ul>
 
 <b>Reacts on the following actions:</b>
@@ -65,16 +81,60 @@ public:
     Q_PROPERTY(int height READ getheight WRITE setheight);
     DEFINE_QPROPERTY_ATTRIBUTE(int, height);
 
+    /// Minimum time in seconds between the updates of the auto-updated texture. 0 updates on every frame.
+    Q_PROPERTY(float updateInterval READ getupdateInterval WRITE setupdateInterval);
+    DEFINE_QPROPERTY_ATTRIBUTE(float, updateInterval);
+
+    /// Whether the auto-updated texture is only rendered when one of its display surfaces is in the view of the main camera.
+    Q_PROPERTY(bool onlyWhenVisible READ getonlyWhenVisible WRITE setonlyWhenVisible);
+    DEFINE_QPROPERTY_ATTRIBUTE(bool, onlyWhenVisible);
+
+    /// Whether the texture is rendered at a half or a quarter of its size when its display surfaces cover only a small part of the screen.
+    Q_PROPERTY(bool scaleByCoverage READ getscaleByCoverage WRITE setscaleByCoverage);
+    DEFINE_QPROPERTY_ATTRIBUTE(bool, scaleByCoverage);
+
+    /// Adds an Ogre object that displays the texture, so that its visibility and screen coverage are taken into account.
+    /** The EC_Mesh components that show the texture are found automatically. Remove the object before it is destroyed. */
+    void AddDisplaySurface(Ogre::MovableObject *surface);
+
+    /// Removes an Ogre object added with AddDisplaySurface.
+    void RemoveDisplaySurface(Ogre::MovableObject *surface);
+
 public slots:
     void PrepareRtt();
     void SetAutoUpdated(bool val);
 
-//private slots:
-    //void UpdateRtt();
+    /// Returns the current scale of the texture size relative to the width and height attributes.
+    float ResolutionScale() const { return resolutionScale_; }
+
+private slots:
+    /// Decides whether the auto-updated texture is rendered on this frame.
+    void OnFrameUpdated(float frameTime);
 
 private:
     void AttributesChanged();
 
+    /// Adds a viewport of the camera to the render texture.
+    void AddViewport(Ogre::RenderTexture *renderTexture, Ogre::Camera *camera);
+
+    /// Returns the largest screen height in pixels of the display surfaces in the view of the main camera, or 0 if none is in view.
+    float DisplayScreenSize();
+
+    /// Finds the EC_Mesh components of the scene whose materials sample the texture.
+    void FindDisplayMeshes();
+
+    /// Resizes the texture to the given scale of the width and height attributes.
+    void SetResolutionScale(float scale);
+
     std::string material_name_;
-    //void ScheduleRender();
+    /// The render texture, or null if PrepareRtt has not succeeded.
+    Ogre::RenderTexture *renderTexture_;
+    /// Whether the texture should be rendered on every frame, set with SetAutoUpdated.
+    bool autoUpdated_;
+    float timeSinceUpdate_;
+    float timeSinceMeshScan_;
+    float timeSinceResize_;
+    float resolutionScale_;
+    QList<Ogre::MovableObject*> displaySurfaces_;
+    std::vector<weak_ptr<EC_Mesh> > displayMeshes_;
 };
@@ -0,0 +1,242 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#include "StableHeaders.h"
+#include "DebugOperatorNew.h"
+
+#include "FramePacer.h"
+#include "Renderer.h"
+#include "RenderWindow.h"
+#include "OgreWorld.h"
+#include "Framework.h"
+#include "FrameAPI.h"
+#include "Application.h"
+#include "LoggingFunctions.h"
+#include "Profiler.h"
+#include "Math/MathFunc.h"
+
+#include <OgreCompositorManager.h>
+#include <OgreCompositor.h>
+#include <OgreCompositionTechnique.h>
+#include <OgreCompositionTargetPass.h>
+#include <OgreCompositionPass.h>
+#include <OgreMaterialManager.h>
+#include <OgreTechnique.h>
+#include <OgrePass.h>
+#include <OgreRenderWindow.h>
+#include <OgreRenderSystem.h>
+#include <OgreRoot.h>
+#include <OgreStringConverter.h>
+#include <OgreViewport.h>
+
+#include <algorithm>
+
+#include "MemoryLeakCheck.h"
+
+namespace
+{
+/// Render resolution and shadow texture scales of the quality steps, from the full quality.
+struct QualityStep
+{
+    float resolution;
+    float shadows;
+};
+const QualityStep cSteps[] =
+{
+    { 1.f, 1.f },
+    { 0.85f, 1.f },
+    { 0.85f, 0.5f },
+    { 0.7f, 0.5f },
+    { 0.5f, 0.5f }
+};
+const int cNumSteps = sizeof(cSteps) / sizeof(cSteps[0]);
+/// Target FPS when the main loop is not limited.
+const double cDefaultTargetFps = 60.0;
+/// Weight of the last frame in the smoothed frame times.
+const double cSmoothing = 0.1;
+/// Seconds after a change of the quality step before the next one.
+const float cSettleTime = 1.f;
+/// Ratio of the frame time to the target above which the quality is stepped down.
+const double cStepDownRatio = 0.95;
+/// Ratio of the frame time to the target below which the quality is stepped back up.
+const double cStepUpRatio = 0.6;
+/// Name of the material that stretches the scaled render target to the viewport.
+const char * const cUpscaleMaterial = "FramePacer/Upscale";
+}
+
+FramePacer::FramePacer(Framework *framework, OgreRenderer::Renderer *renderer) :
+    framework_(framework),
+    renderer_(renderer),
+    level_(0),
+    renderMsecs_(0.0),
+    cpuMsecs_(0.0),
+    gpuMsecs_(0.0),
+    secondsSinceChange_(0.f),
+    viewport_(0)
+{
+    connect(framework_->Frame(), SIGNAL(Updated(float)), SLOT(OnUpdated(float)));
+}
+
+FramePacer::~FramePacer()
+{
+    RemoveScaleCompositor();
+}
+
+void FramePacer::RenderTimed(double submitMsecs, double presentMsecs)
+{
+    // With the vertical sync, the present waits for the sync, which would make every frame look bound by the GPU.
+    bool vsync = false;
+#if OGRE_VERSION_MAJOR > 1 || OGRE_VERSION_MINOR >= 8
+    if (renderer_->GetRenderWindow() && renderer_->GetRenderWindow()->OgreRenderWindow())
+        vsync = renderer_->GetRenderWindow()->OgreRenderWindow()->isVSyncEnabled();
+#else
+    Ogre::RenderSystem *renderSystem = Ogre::Root::getSingleton().getRenderSystem();
+    vsync = renderSystem && renderSystem->getWaitForVerticalBlank();
+#endif
+    renderMsecs_ = submitMsecs + (vsync ? 0.0 : presentMsecs);
+}
+
+float FramePacer::ResolutionScale() const
+{
+    return cSteps[level_].resolution;
+}
+
+void FramePacer::OnUpdated(float frameTime)
+{
+    Application *app = framework_->App();
+    if (!app || !app->AdaptiveFramePacing())
+    {
+        if (level_ != 0)
+            ApplyLevel(0);
+        return;
+    }
+
+    PROFILE(FramePacer_Update);
+    // The work time and the render time are both of the previous frame.
+    const double cpu = std::max(0.0, app->FrameWorkTime() - renderMsecs_);
+    cpuMsecs_ += (cpu - cpuMsecs_) * cSmoothing;
+    gpuMsecs_ += (renderMsecs_ - gpuMsecs_) * cSmoothing;
+
+    // The active world may change, so its shadows are kept at the step.
+    OgreWorldPtr world = renderer_->GetActiveOgreWorld();
+    if (world)
+        world->SetShadowResolutionScale(cSteps[level_].shadows);
+
+    secondsSinceChange_ += frameTime;
+    if (secondsSinceChange_ < cSettleTime)
+        return;
+
+    const double targetMsecs = 1000.0 / (app->TargetFpsLimit() > 1.0 ? app->TargetFpsLimit() : cDefaultTargetFps);
+    const double frameMsecs = cpuMsecs_ + gpuMsecs_;
+    if (frameMsecs > targetMsecs * cStepDownRatio && gpuMsecs_ >= cpuMsecs_ && level_ < cNumSteps - 1)
+        ApplyLevel(level_ + 1);
+    else if (frameMsecs < targetMsecs * cStepUpRatio && level_ > 0)
+        ApplyLevel(level_ - 1);
+}
+
+void FramePacer::ApplyLevel(int level)
+{
+    level_ = Clamp(level, 0, cNumSteps - 1);
+    secondsSinceChange_ = 0.f;
+    LogDebug(QString("FramePacer: Quality step %1 (resolution %2, shadows %3), CPU %4 ms, GPU %5 ms").arg(level_)
+        .arg(cSteps[level_].resolution).arg(cSteps[level_].shadows).arg(cpuMsecs_, 0, 'f', 1).arg(gpuMsecs_, 0, 'f', 1));
+
+    SetResolutionScale(cSteps[level_].resolution);
+    OgreWorldPtr world = renderer_->GetActiveOgreWorld();
+    if (world)
+        world->SetShadowResolutionScale(cSteps[level_].shadows);
+}
+
+void FramePacer::SetResolutionScale(float scale)
+{
+    Ogre::Viewport *viewport = renderer_->MainViewport();
+    if (scale >= 1.f || !viewport)
+    {
+        RemoveScaleCompositor();
+        return;
+    }
+
+    try
+    {
+        const std::string name = ScaleCompositor(scale);
+        if (viewport == viewport_ && name == compositor_)
+            return;
+        RemoveScaleCompositor();
+
+        // First in the chain, so that the scene is rendered at the scaled resolution, and any post-processing after it at the full.
+        Ogre::CompositorManager &manager = Ogre::CompositorManager::getSingleton();
+        if (!manager.addCompositor(viewport, name, 0))
+        {
+            LogWarning("FramePacer: Could not add the compositor " + name + " to the main viewport.");
+            return;
+        }
+        manager.setCompositorEnabled(viewport, name, true);
+        compositor_ = name;
+        viewport_ = viewport;
+    }
+    catch(const Ogre::Exception &e)
+    {
+        LogWarning("FramePacer: Failed to scale the render resolution: " + std::string(e.what()));
+    }
+}
+
+std::string FramePacer::ScaleCompositor(float scale)
+{
+    const std::string name = "FramePacer/Scale" + Ogre::StringConverter::toString((int)(scale * 100.f + 0.5f));
+    Ogre::CompositorManager &manager = Ogre::CompositorManager::getSingleton();
+    if (!manager.getByName(name).isNull())
+        return name;
+
+    Ogre::MaterialManager &materials = Ogre::MaterialManager::getSingleton();
+    if (materials.getByName(cUpscaleMaterial).isNull())
+    {
+        Ogre::MaterialPtr material = materials.create(cUpscaleMaterial, Ogre::ResourceGroupManager::INTERNAL_RESOURCE_GROUP_NAME);
+        Ogre::Pass *pass = material->getTechnique(0)->getPass(0);
+        pass->setLightingEnabled(false);
+        pass->setDepthCheckEnabled(false);
+        pass->setDepthWriteEnabled(false);
+        pass->setCullingMode(Ogre::CULL_NONE);
+        pass->setFog(true, Ogre::FOG_NONE);
+        // The compositor binds the scaled render target to the texture unit.
+        Ogre::TextureUnitState *tus = pass->createTextureUnitState();
+        tus->setTextureAddressingMode(Ogre::TextureUnitState::TAM_CLAMP);
+        tus->setTextureFiltering(Ogre::TFO_BILINEAR);
+    }
+
+    Ogre::CompositorPtr compositor = manager.create(name, Ogre::ResourceGroupManager::INTERNAL_RESOURCE_GROUP_NAME);
+    Ogre::CompositionTechnique *technique = compositor->createTechnique();
+    Ogre::CompositionTechnique::TextureDefinition *definition = technique->createTextureDefinition("scaled");
+    definition->width = 0; // Relative to the viewport size.
+    definition->height = 0;
+    definition->widthFactor = scale;
+    definition->heightFactor = scale;
+    definition->formatList.push_back(Ogre::PF_A8R8G8B8);
+
+    // The scene is rendered to the scaled render target, which is stretched to the viewport.
+    Ogre::CompositionTargetPass *scene = technique->createTargetPass();
+    scene->setInputMode(Ogre::CompositionTargetPass::IM_PREVIOUS);
+    scene->setOutputName("scaled");
+
+    Ogre::CompositionTargetPass *output = technique->getOutputTargetPass();
+    output->setInputMode(Ogre::CompositionTargetPass::IM_NONE);
+    Ogre::CompositionPass *pass = output->createPass();
+    pass->setType(Ogre::CompositionPass::PT_RENDERQUAD);
+    pass->setMaterialName(cUpscaleMaterial);
+    pass->setInput(0, "scaled");
+    return name;
+}
+
+void FramePacer::RemoveScaleCompositor()
+{
+    if (compositor_.empty() || !viewport_)
+        return;
+    try
+    {
+        Ogre::CompositorManager::getSingleton().removeCompositor(viewport_, compositor_);
+    }
+    catch(const Ogre::Exception &e)
+    {
+        LogWarning("FramePacer: Failed to remove the compositor " + compositor_ + ": " + std::string(e.what()));
+    }
+    compositor_.clear();
+    viewport_ = 0;
+}
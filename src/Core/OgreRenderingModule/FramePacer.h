@@ -0,0 +1,71 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#pragma once
+
+#include "CoreDefines.h"
+#include "OgreModuleApi.h"
+#include "OgreModuleFwd.h"
+
+#include <QObject>
+
+#include <string>
+
+class Framework;
+
+/// Trades the render resolution and shadow quality against the measured frame times in the adaptive frame pacing.
+/** Created by Renderer when not headless, and active while Application::AdaptiveFramePacing is set.
+
+    The CPU time of a frame is the time the main loop spent in processing it, less the rendering, and the GPU time is the
+    time spent submitting the frame to the render system and presenting it. When the render system waits for the vertical
+    sync, the present is left out of the GPU time, as it waits for the sync rather than for the GPU. The times are smoothed
+    over the frames, and compared to the frame time of the FPS limit of Application (60 FPS if not limited).
+
+    When the frames take longer than the target and the GPU time dominates, the quality is stepped down: first the main
+    viewport is rendered to a scaled down render target and stretched to the window, then the shadow textures are made
+    smaller, and then the render target is scaled down further. When the frames take well under the target, the quality is
+    stepped back up. The steps are taken at most once per settle time, so that the times measure the new quality. A frame
+    bound by the CPU is not helped by a lower render quality, and the main loop already stops waiting between the frames. */
+class OGRE_MODULE_API FramePacer : public QObject
+{
+    Q_OBJECT
+
+public:
+    FramePacer(Framework *framework, OgreRenderer::Renderer *renderer);
+    ~FramePacer();
+
+    /// Stores the milliseconds the renderer spent submitting a frame and presenting the last one. Called by Renderer.
+    void RenderTimed(double submitMsecs, double presentMsecs);
+
+public slots:
+    /// Returns the current quality step, 0 for the full quality.
+    int Level() const { return level_; }
+    /// Returns the scale of the render resolution of the main viewport.
+    float ResolutionScale() const;
+    /// Returns the smoothed CPU time of the frames in milliseconds.
+    double CpuFrameTime() const { return cpuMsecs_; }
+    /// Returns the smoothed GPU time of the frames in milliseconds.
+    double GpuFrameTime() const { return gpuMsecs_; }
+
+private slots:
+    void OnUpdated(float frameTime);
+
+private:
+    /// Applies the render resolution and shadow quality of the step.
+    void ApplyLevel(int level);
+    /// Renders the main viewport at the scale of the window size through a compositor, or directly when 1.
+    void SetResolutionScale(float scale);
+    /// Returns the name of the compositor that renders at the scale, creating it if needed.
+    std::string ScaleCompositor(float scale);
+    /// Removes the scaling compositor from the main viewport.
+    void RemoveScaleCompositor();
+
+    Framework *framework_;
+    OgreRenderer::Renderer *renderer_;
+    int level_;
+    double renderMsecs_; ///< GPU time of the last frame.
+    double cpuMsecs_; ///< Smoothed CPU time.
+    double gpuMsecs_; ///< Smoothed GPU time.
+    float secondsSinceChange_; ///< Seconds since the last change of the quality step.
+    std::string compositor_; ///< Name of the scaling compositor on the main viewport, empty if none.
+    Ogre::Viewport *viewport_; ///< The viewport the scaling compositor is on.
+};
@@ -0,0 +1,544 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#include "StableHeaders.h"
+#include "DebugOperatorNew.h"
+
+#include "GpuProfiler.h"
+#include "Renderer.h"
+#include "OgreWorld.h"
+#include "Profiler.h"
+#include "LoggingFunctions.h"
+
+#include <OgreRoot.h>
+#include <OgreRenderWindow.h>
+#include <OgreViewport.h>
+#include <OgreCompositorManager.h>
+#include <OgreCompositorChain.h>
+
+#include <cstring>
+#include <algorithm>
+
+#if defined(DIRECTX_ENABLED) && !defined(WIN32)
+#undef DIRECTX_ENABLED
+#endif
+
+#ifdef DIRECTX_ENABLED
+#undef SAFE_DELETE
+#undef SAFE_DELETE_ARRAY
+
+#include <d3d9.h>
+#include <OgreD3D9RenderSystem.h>
+#endif
+
+#if defined(WIN32) || (defined(UNIX) && !defined(__APPLE__) && !defined(ANDROID))
+#define GPU_PROFILER_GL
+#include <GL/gl.h>
+#endif
+
+#include "MemoryLeakCheck.h"
+
+#ifdef GPU_PROFILER_GL
+#ifndef WIN32
+// Declared here instead of including glx.h, as the X11 headers define macros that clash with Qt and Ogre.
+extern "C" void (*glXGetProcAddressARB(const GLubyte *procName))();
+#endif
+#ifndef APIENTRY
+#define APIENTRY
+#endif
+#endif
+
+namespace
+{
+/// Number of frames that can be waiting for their timestamps at a time.
+const size_t cNumFrames = 4;
+
+const char * const cGroupName = "Renderer_GPU";
+const char * const cPhaseNames[] =
+{
+    "Renderer_GPU_Frame",
+    "Renderer_GPU_MainWindow",
+    "Renderer_GPU_Compositors",
+    "Renderer_GPU_MainViewport",
+    "Renderer_GPU_Shadows"
+};
+
+/// Returns whether the viewport has an enabled compositor.
+bool HasEnabledCompositors(Ogre::Viewport *viewport)
+{
+    Ogre::CompositorManager &manager = Ogre::CompositorManager::getSingleton();
+    if (!viewport || !manager.hasCompositorChain(viewport))
+        return false;
+    Ogre::CompositorChain *chain = manager.getCompositorChain(viewport);
+    for(size_t i = 0; i < chain->getNumCompositors(); ++i)
+        if (chain->getCompositor(i)->getEnabled())
+            return true;
+    return false;
+}
+
+#ifdef DIRECTX_ENABLED
+/// Timestamp queries of Direct3D 9, with a disjoint and a frequency query per frame.
+class D3D9Queries : public GpuProfiler::Queries
+{
+public:
+    /// Returns the queries for the active device, or null if the device does not support them.
+    static D3D9Queries *Create()
+    {
+        IDirect3DDevice9 *device = Ogre::D3D9RenderSystem::getActiveD3D9Device();
+        // Creating a query to null tells whether the type is supported.
+        if (!device || FAILED(device->CreateQuery(D3DQUERYTYPE_TIMESTAMP, 0)) || FAILED(device->CreateQuery(D3DQUERYTYPE_TIMESTAMPDISJOINT, 0)) ||
+            FAILED(device->CreateQuery(D3DQUERYTYPE_TIMESTAMPFREQ, 0)))
+            return 0;
+        return new D3D9Queries(device);
+    }
+
+    ~D3D9Queries() { Release(); }
+
+    void BeginFrame(size_t slot)
+    {
+        // The queries belong to the device, so start over if Ogre has recreated it.
+        IDirect3DDevice9 *device = Ogre::D3D9RenderSystem::getActiveD3D9Device();
+        if (device != device_)
+        {
+            Release();
+            device_ = device;
+        }
+        Slot &s = slots_[slot];
+        if (!s.disjoint && device_)
+            device_->CreateQuery(D3DQUERYTYPE_TIMESTAMPDISJOINT, &s.disjoint);
+        if (s.disjoint)
+            s.disjoint->Issue(D3DISSUE_BEGIN);
+    }
+
+    void Issue(size_t slot, size_t index)
+    {
+        Slot &s = slots_[slot];
+        while(s.timestamps.size() <= index)
+        {
+            IDirect3DQuery9 *query = 0;
+            if (device_)
+                device_->CreateQuery(D3DQUERYTYPE_TIMESTAMP, &query);
+            s.timestamps.push_back(query);
+        }
+        if (s.timestamps[index])
+            s.timestamps[index]->Issue(D3DISSUE_END);
+    }
+
+    void EndFrame(size_t slot)
+    {
+        Slot &s = slots_[slot];
+        if (!s.frequency && device_)
+            device_->CreateQuery(D3DQUERYTYPE_TIMESTAMPFREQ, &s.frequency);
+        if (s.disjoint)
+            s.disjoint->Issue(D3DISSUE_END);
+        if (s.frequency)
+            s.frequency->Issue(D3DISSUE_END);
+    }
+
+    int Read(size_t slot, size_t numQueries, std::vector<u64> &timestamps, double &ticksPerSecond)
+    {
+        Slot &s = slots_[slot];
+        if (!s.disjoint || !s.frequency || numQueries > s.timestamps.size())
+            return -1;
+
+        BOOL disjoint = FALSE;
+        HRESULT hr = s.disjoint->GetData(&disjoint, sizeof(disjoint), 0);
+        if (hr == S_FALSE)
+            return 0;
+        UINT64 frequency = 0;
+        if (SUCCEEDED(hr))
+            hr = s.frequency->GetData(&frequency, sizeof(frequency), 0);
+        if (hr == S_FALSE)
+            return 0;
+        // The timestamps are unreliable if the GPU clock changed during the frame.
+        if (FAILED(hr) || disjoint || frequency == 0)
+            return -1;
+
+        timestamps.resize(numQueries);
+        for(size_t i = 0; i < numQueries; ++i)
+        {
+            if (!s.timestamps[i])
+                return -1;
+            UINT64 value = 0;
+            hr = s.timestamps[i]->GetData(&value, sizeof(value), 0);
+            if (hr == S_FALSE)
+                return 0;
+            if (FAILED(hr))
+                return -1;
+            timestamps[i] = value;
+        }
+        ticksPerSecond = (double)frequency;
+        return 1;
+    }
+
+private:
+    struct Slot
+    {
+        Slot() : disjoint(0), frequency(0) {}
+        IDirect3DQuery9 *disjoint;
+        IDirect3DQuery9 *frequency;
+        std::vector<IDirect3DQuery9*> timestamps;
+    };
+
+    explicit D3D9Queries(IDirect3DDevice9 *device) : device_(device), slots_(cNumFrames) {}
+
+    void Release()
+    {
+        for(size_t i = 0; i < slots_.size(); ++i)
+        {
+            Slot &s = slots_[i];
+            if (s.disjoint)
+                s.disjoint->Release();
+            if (s.frequency)
+                s.frequency->Release();
+            for(size_t j = 0; j < s.timestamps.size(); ++j)
+                if (s.timestamps[j])
+                    s.timestamps[j]->Release();
+            s = Slot();
+        }
+    }
+
+    IDirect3DDevice9 *device_;
+    std::vector<Slot> slots_;
+};
+#endif
+
+#ifdef GPU_PROFILER_GL
+/// Timestamp queries of GL_ARB_timer_query, whose timestamps are in nanoseconds.
+class GLQueries : public GpuProfiler::Queries
+{
+public:
+    /// Returns the queries for the current context, or null if it does not support them.
+    static GLQueries *Create()
+    {
+        const char *extensions = (const char *)glGetString(GL_EXTENSIONS);
+        if (!extensions || !strstr(extensions, "GL_ARB_timer_query"))
+            return 0;
+        GLQueries *queries = new GLQueries();
+        queries->genQueries = (GenQueriesFunc)ProcAddress("glGenQueries");
+        queries->deleteQueries = (DeleteQueriesFunc)ProcAddress("glDeleteQueries");
+        queries->queryCounter = (QueryCounterFunc)ProcAddress("glQueryCounter");
+        queries->getQueryObjectiv = (GetQueryObjectivFunc)ProcAddress("glGetQueryObjectiv");
+        queries->getQueryObjectui64v = (GetQueryObjectui64vFunc)ProcAddress("glGetQueryObjectui64v");
+        if (!queries->genQueries || !queries->deleteQueries || !queries->queryCounter || !queries->getQueryObjectiv || !queries->getQueryObjectui64v)
+        {
+            delete queries;
+            return 0;
+        }
+        return queries;
+    }
+
+    ~GLQueries()
+    {
+        for(size_t i = 0; i < slots_.size(); ++i)
+            if (!slots_[i].empty() && deleteQueries)
+                deleteQueries((GLsizei)slots_[i].size(), &slots_[i][0]);
+    }
+
+    void BeginFrame(size_t /*slot*/) {}
+
+    void Issue(size_t slot, size_t index)
+    {
+        std::vector<GLuint> &ids = slots_[slot];
+        if (index >= ids.size())
+        {
+            const size_t oldSize = ids.size();
+            ids.resize(index + 1);
+            genQueries((GLsizei)(ids.size() - oldSize), &ids[oldSize]);
+        }
+        queryCounter(ids[index], cTimestamp);
+    }
+
+    void EndFrame(size_t /*slot*/) {}
+
+    int Read(size_t slot, size_t numQueries, std::vector<u64> &timestamps, double &ticksPerSecond)
+    {
+        std::vector<GLuint> &ids = slots_[slot];
+        if (numQueries == 0 || numQueries > ids.size())
+            return -1;
+        // The queries finish in order, so the earlier ones are available when the last one is.
+        GLint available = 0;
+        getQueryObjectiv(ids[numQueries - 1], cQueryResultAvailable, &available);
+        if (!available)
+            return 0;
+        timestamps.resize(numQueries);
+        for(size_t i = 0; i < numQueries; ++i)
+            getQueryObjectui64v(ids[i], cQueryResult, &timestamps[i]);
+        ticksPerSecond = 1e9;
+        return 1;
+    }
+
+private:
+    typedef void (APIENTRY *GenQueriesFunc)(GLsizei n, GLuint *ids);
+    typedef void (APIENTRY *DeleteQueriesFunc)(GLsizei n, const GLuint *ids);
+    typedef void (APIENTRY *QueryCounterFunc)(GLuint id, GLenum target);
+    typedef void (APIENTRY *GetQueryObjectivFunc)(GLuint id, GLenum pname, GLint *params);
+    typedef void (APIENTRY *GetQueryObjectui64vFunc)(GLuint id, GLenum pname, u64 *params);
+
+    static const GLenum cTimestamp = 0x8E28; ///< GL_TIMESTAMP
+    static const GLenum cQueryResult = 0x8866; ///< GL_QUERY_RESULT
+    static const GLenum cQueryResultAvailable = 0x8867; ///< GL_QUERY_RESULT_AVAILABLE
+
+    GLQueries() : genQueries(0), deleteQueries(0), queryCounter(0), getQueryObjectiv(0), getQueryObjectui64v(0), slots_(cNumFrames) {}
+
+    static void *ProcAddress(const char *name)
+    {
+#ifdef WIN32
+        return (void *)wglGetProcAddress(name);
+#else
+        return (void *)glXGetProcAddressARB((const GLubyte *)name);
+#endif
+    }
+
+    GenQueriesFunc genQueries;
+    DeleteQueriesFunc deleteQueries;
+    QueryCounterFunc queryCounter;
+    GetQueryObjectivFunc getQueryObjectiv;
+    GetQueryObjectui64vFunc getQueryObjectui64v;
+    std::vector<std::vector<GLuint> > slots_;
+};
+#endif
+
+}
+
+GpuProfiler *GpuProfiler::Create(OgreRenderer::Renderer *renderer)
+{
+    Ogre::RenderSystem *renderSystem = Ogre::Root::getSingleton().getRenderSystem();
+    if (!renderSystem || !renderer->GetCurrentRenderWindow())
+        return 0;
+
+    Queries *queries = 0;
+#ifdef DIRECTX_ENABLED
+    if (renderSystem->getName() == "Direct3D9 Rendering Subsystem")
+        queries = D3D9Queries::Create();
+#endif
+#ifdef GPU_PROFILER_GL
+    if (renderSystem->getName() == "OpenGL Rendering Subsystem")
+        queries = GLQueries::Create();
+#endif
+    if (!queries)
+    {
+        LogInfo("GpuProfiler: The render system does not support timestamp queries, GPU times are not profiled.");
+        return 0;
+    }
+    return new GpuProfiler(renderer, queries);
+}
+
+GpuProfiler::GpuProfiler(OgreRenderer::Renderer *renderer, Queries *queries) :
+    renderer_(renderer),
+    queries_(queries),
+    frames_(cNumFrames),
+    current_(0),
+    recording_(false),
+    openCompositor_(-1),
+    mainWindow_(renderer->GetCurrentRenderWindow()),
+    sceneManager_(0)
+{
+    for(int i = 0; i < NumPhases; ++i)
+        open_[i] = false;
+    mainWindow_->addListener(this);
+}
+
+GpuProfiler::~GpuProfiler()
+{
+    mainWindow_->removeListener(this);
+    if (sceneManager_)
+        sceneManager_->removeListener(this);
+    delete queries_;
+}
+
+void GpuProfiler::BeginFrame()
+{
+    ReadBack();
+
+    // If the GPU is so far behind that the slot is still waiting, leave this frame out.
+    recording_ = !frames_[current_].pending;
+    if (!recording_)
+        return;
+
+    frames_[current_].timestamps.clear();
+    for(int i = 0; i < NumPhases; ++i)
+        open_[i] = false;
+    openCompositor_ = -1;
+    ListenToActiveWorld();
+
+    queries_->BeginFrame(current_);
+    Mark(PhaseFrame, true);
+}
+
+void GpuProfiler::EndFrame()
+{
+    if (!recording_)
+        return;
+
+    // Close the phases left open, e.g. by an exception during the rendering.
+    EndCompositorBlock();
+    for(int i = NumPhases - 1; i >= 0; --i)
+        if (open_[i])
+            Mark((Phase)i, false);
+    queries_->EndFrame(current_);
+
+    frames_[current_].pending = true;
+    recording_ = false;
+    current_ = (current_ + 1) % frames_.size();
+}
+
+void GpuProfiler::Mark(Phase phase, bool start)
+{
+    if (!recording_ || open_[phase] == start)
+        return;
+    Frame &frame = frames_[current_];
+    queries_->Issue(current_, frame.timestamps.size());
+    Timestamp timestamp = { phase, start, -1 };
+    frame.timestamps.push_back(timestamp);
+    open_[phase] = start;
+}
+
+void GpuProfiler::MarkCompositor(const std::string &name)
+{
+    if (!recording_)
+        return;
+    int index = (int)(std::find(compositorNames_.begin(), compositorNames_.end(), name) - compositorNames_.begin());
+    if (index == (int)compositorNames_.size())
+        compositorNames_.push_back(name);
+    // The consecutive passes of a compositor are in the same block.
+    if (index == openCompositor_)
+        return;
+    EndCompositorBlock();
+
+    Frame &frame = frames_[current_];
+    queries_->Issue(current_, frame.timestamps.size());
+    Timestamp timestamp = { PhaseCompositors, true, index };
+    frame.timestamps.push_back(timestamp);
+    openCompositor_ = index;
+}
+
+void GpuProfiler::EndCompositorBlock()
+{
+    if (!recording_ || openCompositor_ < 0)
+        return;
+    Frame &frame = frames_[current_];
+    queries_->Issue(current_, frame.timestamps.size());
+    Timestamp timestamp = { PhaseCompositors, false, openCompositor_ };
+    frame.timestamps.push_back(timestamp);
+    openCompositor_ = -1;
+}
+
+void GpuProfiler::ReadBack()
+{
+    Profiler *profiler = ProfilerSection::GetProfiler();
+    std::vector<u64> timestamps;
+    for(size_t i = 1; i <= frames_.size(); ++i)
+    {
+        // The slot after the current one is the oldest.
+        const size_t slot = (current_ + i) % frames_.size();
+        Frame &frame = frames_[slot];
+        if (!frame.pending)
+            continue;
+        double ticksPerSecond = 0.0;
+        const int result = queries_->Read(slot, frame.timestamps.size(), timestamps, ticksPerSecond);
+        if (result == 0)
+            break; // The later frames are not finished either.
+        frame.pending = false;
+        if (result < 0 || !profiler)
+            continue;
+
+        double elapsed[NumPhases] = {};
+        u64 starts[NumPhases] = {};
+        bool measured[NumPhases] = {};
+        std::vector<double> compositorElapsed(compositorNames_.size(), 0.0);
+        std::vector<u64> compositorStarts(compositorNames_.size(), 0);
+        std::vector<bool> compositorMeasured(compositorNames_.size(), false);
+        for(size_t j = 0; j < frame.timestamps.size(); ++j)
+        {
+            const Timestamp &timestamp = frame.timestamps[j];
+            if (timestamp.compositor >= 0)
+            {
+                const size_t c = (size_t)timestamp.compositor;
+                if (timestamp.start)
+                    compositorStarts[c] = timestamps[j];
+                else if (timestamps[j] >= compositorStarts[c])
+                {
+                    compositorElapsed[c] += (double)(timestamps[j] - compositorStarts[c]) / ticksPerSecond;
+                    compositorMeasured[c] = true;
+                }
+            }
+            else if (timestamp.start)
+                starts[timestamp.phase] = timestamps[j];
+            else if (timestamps[j] >= starts[timestamp.phase])
+            {
+                elapsed[timestamp.phase] += (double)(timestamps[j] - starts[timestamp.phase]) / ticksPerSecond;
+                measured[timestamp.phase] = true;
+            }
+        }
+        for(int p = 0; p < NumPhases; ++p)
+            if (measured[p])
+                profiler->AddTiming(cGroupName, cPhaseNames[p], elapsed[p]);
+        for(size_t c = 0; c < compositorNames_.size(); ++c)
+            if (compositorMeasured[c])
+                profiler->AddTiming(cGroupName, "Renderer_GPU_Compositor_" + compositorNames_[c], compositorElapsed[c]);
+    }
+}
+
+void GpuProfiler::ListenToActiveWorld()
+{
+    OgreWorldPtr world = renderer_->GetActiveOgreWorld();
+    Ogre::SceneManager *sceneManager = world ? world->OgreSceneManager() : 0;
+    if (sceneManager == sceneManager_)
+        return;
+    if (sceneManager_)
+        sceneManager_->removeListener(this);
+    sceneManager_ = sceneManager;
+    if (sceneManager_)
+        sceneManager_->addListener(this);
+}
+
+void GpuProfiler::preRenderTargetUpdate(const Ogre::RenderTargetEvent &evt)
+{
+    if (evt.source != mainWindow_)
+        return;
+    Mark(PhaseMainWindow, true);
+    // The compositor chain renders its intermediate targets in its own listener of the window, which was added after this one.
+    if (HasEnabledCompositors(renderer_->MainViewport()))
+        Mark(PhaseCompositors, true);
+}
+
+void GpuProfiler::postRenderTargetUpdate(const Ogre::RenderTargetEvent &evt)
+{
+    if (evt.source != mainWindow_)
+        return;
+    Mark(PhaseCompositors, false);
+    Mark(PhaseMainWindow, false);
+}
+
+void GpuProfiler::preViewportUpdate(const Ogre::RenderTargetViewportEvent &evt)
+{
+    if (evt.source != renderer_->MainViewport())
+        return;
+    Mark(PhaseCompositors, false);
+    Mark(PhaseMainViewport, true);
+}
+
+void GpuProfiler::postViewportUpdate(const Ogre::RenderTargetViewportEvent &evt)
+{
+    if (evt.source != renderer_->MainViewport())
+        return;
+    EndCompositorBlock();
+    Mark(PhaseMainViewport, false);
+}
+
+void GpuProfiler::shadowTextureCasterPreViewProj(Ogre::Light * /*light*/, Ogre::Camera * /*camera*/, size_t /*iteration*/)
+{
+    // Called before each shadow texture is rendered; the first one starts the phase.
+    Mark(PhaseShadows, true);
+}
+
+void GpuProfiler::shadowTexturesUpdated(size_t /*numberOfShadowTextures*/)
+{
+    Mark(PhaseShadows, false);
+}
+
+void GpuProfiler::sceneManagerDestroyed(Ogre::SceneManager *source)
+{
+    if (source == sceneManager_)
+        sceneManager_ = 0;
+}
@@ -0,0 +1,131 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#pragma once
+
+#include "CoreDefines.h"
+#include "CoreTypes.h"
+#include "OgreModuleApi.h"
+#include "OgreModuleFwd.h"
+
+#include <OgreRenderTargetListener.h>
+#include <OgreSceneManager.h>
+
+#include <vector>
+#include <string>
+
+/// Measures the GPU time of the main phases of the frame with timestamp queries, and adds them to the Profiler.
+/** Created by Renderer in PROFILING builds, when the render system supports timestamp queries: Direct3D 9, or OpenGL with
+    GL_ARB_timer_query. The timestamps are read back without stalling when the GPU has passed them, a few frames later,
+    and added to the "Renderer_GPU" group of the Profiler as the blocks
+    <ul>
+    <li>Renderer_GPU_Frame: all render targets of the frame.
+    <li>Renderer_GPU_MainWindow: the main window. The rest of the frame is spent in the other targets, e.g. EC_RttTarget.
+    <li>Renderer_GPU_Compositors: the intermediate targets of the compositors of the main viewport, including their scene passes.
+    <li>Renderer_GPU_MainViewport: the main viewport, i.e. the scene or the output of the compositors, and the overlays.
+    <li>Renderer_GPU_Shadows: the shadow textures of the active world, also when rendered within the other phases.
+    <li>Renderer_GPU_Compositor_<name>: each compositor of the main viewport marked by OgreCompositionHandler, from its first
+        full-screen pass to the first pass of the next compositor. The block of the last compositor ends with the main viewport,
+        so it includes the overlays.
+    </ul>
+    The order of the render target listeners decides what the compositor phase covers, so the profiler is created before
+    any compositors are added to the main viewport. */
+class OGRE_MODULE_API GpuProfiler : public Ogre::RenderTargetListener, public Ogre::SceneManager::Listener
+{
+public:
+    /// Returns a new profiler for the active render system, or null if it does not support timestamp queries.
+    static GpuProfiler *Create(OgreRenderer::Renderer *renderer);
+
+    ~GpuProfiler();
+
+    /// Reads back the finished frames and issues the start timestamp of the frame. Call before updating the render targets.
+    void BeginFrame();
+
+    /// Issues the end timestamp of the frame. Call after updating the render targets.
+    void EndFrame();
+
+    /// Starts the block of the compositor in the current frame, ending the block of the previous compositor.
+    /** Called by OgreCompositionHandler before each full-screen pass of a compositor. */
+    void MarkCompositor(const std::string &name);
+
+    /// Ogre::RenderTargetListener overrides. Issue the timestamps of the main window and viewport.
+    void preRenderTargetUpdate(const Ogre::RenderTargetEvent &evt);
+    void postRenderTargetUpdate(const Ogre::RenderTargetEvent &evt);
+    void preViewportUpdate(const Ogre::RenderTargetViewportEvent &evt);
+    void postViewportUpdate(const Ogre::RenderTargetViewportEvent &evt);
+
+    /// Ogre::SceneManager::Listener overrides. Issue the timestamps of the shadow textures.
+    void shadowTextureCasterPreViewProj(Ogre::Light *light, Ogre::Camera *camera, size_t iteration);
+    void shadowTexturesUpdated(size_t numberOfShadowTextures);
+    void sceneManagerDestroyed(Ogre::SceneManager *source);
+
+    /// Interface to the timestamp queries of a render system.
+    class Queries
+    {
+    public:
+        virtual ~Queries() {}
+        /// Starts the queries of the frame in the slot.
+        virtual void BeginFrame(size_t slot) = 0;
+        /// Issues the timestamp query of the index in the slot, creating it if needed.
+        virtual void Issue(size_t slot, size_t index) = 0;
+        /// Ends the queries of the frame in the slot.
+        virtual void EndFrame(size_t slot) = 0;
+        /// Reads the timestamps of the slot if the GPU has passed them. Does not wait.
+        /** @return 1 if read, 0 if not yet available, and -1 if the results are lost or unreliable and should be dropped. */
+        virtual int Read(size_t slot, size_t numQueries, std::vector<u64> &timestamps, double &ticksPerSecond) = 0;
+    };
+
+private:
+    enum Phase
+    {
+        PhaseFrame,
+        PhaseMainWindow,
+        PhaseCompositors,
+        PhaseMainViewport,
+        PhaseShadows,
+        NumPhases
+    };
+
+    /// What a timestamp query of a frame marks.
+    struct Timestamp
+    {
+        Phase phase;
+        bool start; ///< If false, the timestamp is the end of the phase.
+        int compositor; ///< Index of the compositor whose block the timestamp marks instead of the phase, or -1.
+    };
+
+    /// The timestamps of one frame, waiting to be read back.
+    struct Frame
+    {
+        Frame() : pending(false) {}
+        bool pending;
+        /// The issued queries in order.
+        std::vector<Timestamp> timestamps;
+    };
+
+    GpuProfiler(OgreRenderer::Renderer *renderer, Queries *queries);
+
+    /// Issues a timestamp query for the start or the end of the phase in the current frame, if recording.
+    void Mark(Phase phase, bool start);
+    /// Ends the block of the compositor open in the current frame, if any.
+    void EndCompositorBlock();
+    /// Adds the results of the finished frames to the Profiler, oldest first.
+    void ReadBack();
+    /// Listens to the scene manager of the active world for its shadow textures.
+    void ListenToActiveWorld();
+
+    OgreRenderer::Renderer *renderer_;
+    Queries *queries_;
+    std::vector<Frame> frames_;
+    /// The slot of the frame being recorded.
+    size_t current_;
+    /// Whether the current frame is recorded.
+    bool recording_;
+    /// The phases that have been started and not ended in the current frame.
+    bool open_[NumPhases];
+    /// Names of the marked compositors, by their index in the timestamps.
+    std::vector<std::string> compositorNames_;
+    /// Index of the compositor whose block is open in the current frame, or -1.
+    int openCompositor_;
+    Ogre::RenderWindow *mainWindow_;
+    Ogre::SceneManager *sceneManager_;
+};
@@ -0,0 +1,347 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#include "StableHeaders.h"
+#define MATH_OGRE_INTEROP
+#include "DebugOperatorNew.h"
+
+#include "LightClusterer.h"
+#include "OgreWorld.h"
+#include "Renderer.h"
+#include "EC_Light.h"
+#include "EC_Mesh.h"
+#include "EC_Camera.h"
+#include "Entity.h"
+#include "Scene/Scene.h"
+#include "Framework.h"
+#include "FrameAPI.h"
+#include "Profiler.h"
+#include "Math/MathFunc.h"
+#include "Math/float4.h"
+#include "Geometry/AABB.h"
+#include "Geometry/Frustum.h"
+#include "Geometry/Sphere.h"
+
+#include <OgreEntity.h>
+#include <OgreLight.h>
+#include <OgreCamera.h>
+
+#include <algorithm>
+#include <cfloat>
+
+#include "MemoryLeakCheck.h"
+
+namespace
+{
+/// Number of the screen tiles and depth slices of the clusters.
+const int cTilesX = 16;
+const int cTilesY = 8;
+const int cDepthSlices = 16;
+/// View distance of the far end of the last depth slice, the farther objects are all in the last slice.
+const float cMaxSliceDistance = 500.f;
+/// Attenuation below which a light is taken not to reach.
+const float cMinAttenuation = 1.f / 256.f;
+/// Largest attenuation, for a light whose attenuation terms are all zero at the distance.
+const float cMaxAttenuation = 1e6f;
+const int cDefaultLightBudget = 8;
+
+float Attenuation(const Ogre::Light *light, float distance)
+{
+    const float denominator = light->getAttenuationConstant() + light->getAttenuationLinear() * distance +
+        light->getAttenuationQuadric() * distance * distance;
+    return denominator > 1.f / cMaxAttenuation ? 1.f / denominator : cMaxAttenuation;
+}
+
+/// Returns the distance at which the attenuation of the light falls below cMinAttenuation, limited by its range.
+float LightReach(const Ogre::Light *light)
+{
+    const float range = light->getAttenuationRange();
+    const float c = light->getAttenuationConstant() - 1.f / cMinAttenuation;
+    const float l = light->getAttenuationLinear();
+    const float q = light->getAttenuationQuadric();
+    // Solve q * d^2 + l * d + c = 0 for the attenuation 1 / (constant + l * d + q * d^2) = cMinAttenuation.
+    float reach = range;
+    if (q > 1e-6f)
+        reach = (-l + Sqrt(Max(0.f, l * l - 4.f * q * c))) / (2.f * q);
+    else if (l > 1e-6f)
+        reach = -c / l;
+    return Clamp(reach, 0.f, range);
+}
+
+float Brightness(const Ogre::Light *light)
+{
+    const Ogre::ColourValue &color = light->getDiffuseColour();
+    return Max(color.r, Max(color.g, color.b));
+}
+
+struct BinnedLight
+{
+    Ogre::Light *light;
+    float3 position;
+    float reach;
+    float brightness;
+};
+
+/// Orders the candidate lights of a mesh by their importance, the most important first.
+struct ImportanceGreater
+{
+    bool operator()(const std::pair<float, int> &a, const std::pair<float, int> &b) const { return a.first > b.first; }
+};
+
+}
+
+LightClusterer::LightClusterer(OgreWorld *world) :
+    world_(world),
+    lightBudget_(cDefaultLightBudget),
+    nearPlane_(0.1f),
+    farPlane_(cMaxSliceDistance),
+    clusters_(cTilesX * cTilesY * cDepthSlices),
+    numLights_(0),
+    numAssignedLights_(0)
+{
+    Framework *framework = world_->Scene()->GetFramework();
+    connect(framework->Frame(), SIGNAL(PostFrameUpdate(float)), SLOT(OnPostFrameUpdate(float)));
+}
+
+LightClusterer::~LightClusterer()
+{
+    for(QHash<Ogre::MovableObject*, Ogre::MovableObject::Listener*>::const_iterator it = listened_.begin(); it != listened_.end(); ++it)
+        if (it.key()->getListener() == this)
+            it.key()->setListener(it.value());
+}
+
+void LightClusterer::SetLightBudget(int budget)
+{
+    lightBudget_ = Max(1, budget);
+}
+
+const Ogre::LightList *LightClusterer::objectQueryLights(const Ogre::MovableObject *object)
+{
+    std::map<const Ogre::MovableObject*, Ogre::LightList>::const_iterator it = lightLists_.find(object);
+    if (it != lightLists_.end())
+        return &it->second;
+    Ogre::MovableObject::Listener *previous = listened_.value(const_cast<Ogre::MovableObject*>(object));
+    return previous ? previous->objectQueryLights(object) : 0;
+}
+
+bool LightClusterer::objectRendering(const Ogre::MovableObject *object, const Ogre::Camera *camera)
+{
+    Ogre::MovableObject::Listener *previous = listened_.value(const_cast<Ogre::MovableObject*>(object));
+    return previous ? previous->objectRendering(object, camera) : true;
+}
+
+void LightClusterer::objectDestroyed(Ogre::MovableObject *object)
+{
+    Ogre::MovableObject::Listener *previous = listened_.take(object);
+    lightLists_.erase(object);
+    if (previous)
+        previous->objectDestroyed(object);
+}
+
+void LightClusterer::objectMoved(Ogre::MovableObject *object)
+{
+    Ogre::MovableObject::Listener *previous = listened_.value(object);
+    if (previous)
+        previous->objectMoved(object);
+}
+
+void LightClusterer::objectAttached(Ogre::MovableObject *object)
+{
+    Ogre::MovableObject::Listener *previous = listened_.value(object);
+    if (previous)
+        previous->objectAttached(object);
+}
+
+void LightClusterer::objectDetached(Ogre::MovableObject *object)
+{
+    Ogre::MovableObject::Listener *previous = listened_.value(object);
+    if (previous)
+        previous->objectDetached(object);
+}
+
+void LightClusterer::Listen(Ogre::MovableObject *object)
+{
+    if (listened_.contains(object))
+        return;
+    // Chain to the listener the object already has, e.g. the OcclusionCuller, so that it keeps working.
+    listened_[object] = object->getListener();
+    object->setListener(this);
+}
+
+int LightClusterer::DepthSlice(float distance) const
+{
+    if (distance <= nearPlane_)
+        return 0;
+    // Exponential slices keep the clusters about as deep as they are wide on the screen.
+    const float slice = Ln(distance / nearPlane_) / Ln(farPlane_ / nearPlane_) * (float)cDepthSlices;
+    return Clamp((int)slice, 0, cDepthSlices - 1);
+}
+
+bool LightClusterer::ClustersOf(const AABB &box, ClusterRange &range) const
+{
+    float minX = FLT_MAX, minY = FLT_MAX, maxX = -FLT_MAX, maxY = -FLT_MAX;
+    float minZ = FLT_MAX, maxZ = -FLT_MAX;
+    bool crossesNearPlane = false;
+    for(int i = 0; i < 8; ++i)
+    {
+        const float3 corner = box.CornerPoint(i);
+        const float z = Dot(corner - eye_, front_);
+        minZ = Min(minZ, z);
+        maxZ = Max(maxZ, z);
+        const float4 clip = viewProj_.Transform(float4(corner, 1.f));
+        if (clip.w < nearPlane_)
+        {
+            crossesNearPlane = true;
+            continue;
+        }
+        minX = Min(minX, clip.x / clip.w);
+        maxX = Max(maxX, clip.x / clip.w);
+        minY = Min(minY, clip.y / clip.w);
+        maxY = Max(maxY, clip.y / clip.w);
+    }
+    if (maxZ < nearPlane_)
+        return false;
+    // The projection of a box that crosses the near plane is unbounded, so it covers the whole screen.
+    if (crossesNearPlane)
+    {
+        minX = minY = -1.f;
+        maxX = maxY = 1.f;
+    }
+    if (minX > 1.f || maxX < -1.f || minY > 1.f || maxY < -1.f)
+        return false;
+
+    range.x0 = Clamp((int)((minX * 0.5f + 0.5f) * cTilesX), 0, cTilesX - 1);
+    range.x1 = Clamp((int)((maxX * 0.5f + 0.5f) * cTilesX), 0, cTilesX - 1);
+    range.y0 = Clamp((int)((0.5f - maxY * 0.5f) * cTilesY), 0, cTilesY - 1);
+    range.y1 = Clamp((int)((0.5f - minY * 0.5f) * cTilesY), 0, cTilesY - 1);
+    range.z0 = DepthSlice(minZ);
+    range.z1 = DepthSlice(maxZ);
+    return true;
+}
+
+void LightClusterer::OnPostFrameUpdate(float /*frameTime*/)
+{
+    PROFILE(LightClusterer_Update);
+
+    lightLists_.clear();
+    numLights_ = 0;
+    numAssignedLights_ = 0;
+
+    OgreRenderer::Renderer *renderer = world_->Renderer();
+    ScenePtr scene = world_->Scene();
+    Entity *cameraEntity = renderer->MainCamera();
+    EC_Camera *camera = renderer->MainCameraComponent();
+    if (!scene || !cameraEntity || !camera || !camera->OgreCamera() || cameraEntity->ParentScene() != scene.get())
+        return;
+    const Frustum frustum = camera->ToFrustum();
+    viewProj_ = frustum.ViewProjMatrix();
+    eye_ = frustum.pos;
+    front_ = frustum.front;
+    nearPlane_ = Max(frustum.nearPlaneDistance, 0.01f);
+    farPlane_ = Clamp(frustum.farPlaneDistance, nearPlane_ * 2.f, cMaxSliceDistance);
+
+    // Bin the lights that reach into the view.
+    std::vector<Ogre::Light*> directionalLights;
+    std::vector<BinnedLight> lights;
+    for(size_t i = 0; i < clusters_.size(); ++i)
+        clusters_[i].clear();
+    std::vector<shared_ptr<EC_Light> > lightComponents = scene->Components<EC_Light>();
+    for(size_t i = 0; i < lightComponents.size(); ++i)
+    {
+        Ogre::Light *light = lightComponents[i]->OgreLight();
+        if (!light || !light->isVisible() || !light->isInScene())
+            continue;
+        if (light->getType() == Ogre::Light::LT_DIRECTIONAL)
+        {
+            directionalLights.push_back(light);
+            continue;
+        }
+        BinnedLight binned;
+        binned.light = light;
+        binned.position = light->getDerivedPosition();
+        binned.reach = LightReach(light);
+        binned.brightness = Brightness(light);
+        if (binned.reach <= 0.f || binned.brightness <= 0.f || !frustum.Intersects(Sphere(binned.position, binned.reach)))
+            continue;
+        ClusterRange range;
+        if (!ClustersOf(AABB(binned.position - float3::FromScalar(binned.reach), binned.position + float3::FromScalar(binned.reach)), range))
+            continue;
+        const int index = (int)lights.size();
+        lights.push_back(binned);
+        for(int z = range.z0; z <= range.z1; ++z)
+            for(int y = range.y0; y <= range.y1; ++y)
+                for(int x = range.x0; x <= range.x1; ++x)
+                    clusters_[(z * cTilesY + y) * cTilesX + x].push_back(index);
+    }
+    numLights_ = (int)lights.size();
+
+    // Give each mesh in view the most important lights of the clusters it overlaps.
+    std::vector<uint> lightStamps(lights.size(), 0);
+    uint stamp = 0;
+    std::vector<std::pair<float, int> > candidates;
+    std::vector<shared_ptr<EC_Mesh> > meshes = scene->Components<EC_Mesh>();
+    std::vector<EC_Mesh*> shown;
+    std::vector<AABB> boxes;
+    for(size_t i = 0; i < meshes.size(); ++i)
+    {
+        Ogre::Entity *entity = meshes[i]->OgreEntity();
+        // The entities baked to static geometry are hidden with a zero visibility mask.
+        if (!entity || !entity->isVisible() || entity->getVisibilityFlags() == 0 || !entity->isInScene())
+            continue;
+        const AABB box = meshes[i]->WorldAABB();
+        if (!box.IsFinite())
+            continue;
+        shown.push_back(meshes[i].get());
+        boxes.push_back(box);
+    }
+    // Cull the bounds against the frustum in one batch.
+    std::vector<u32> inFrustum((boxes.size() + 31) / 32);
+    if (!boxes.empty())
+        frustum.BatchIntersects(&boxes[0], (int)boxes.size(), &inFrustum[0]);
+
+    for(size_t i = 0; i < shown.size(); ++i)
+    {
+        if (!(inFrustum[i >> 5] & (1u << (i & 31))))
+            continue;
+        EC_Mesh *mesh = shown[i];
+        Ogre::Entity *entity = mesh->OgreEntity();
+        const AABB &box = boxes[i];
+        ClusterRange range;
+        if (!ClustersOf(box, range))
+            continue;
+
+        ++stamp;
+        candidates.clear();
+        const Ogre::uint32 lightMask = entity->getLightMask();
+        for(int z = range.z0; z <= range.z1; ++z)
+            for(int y = range.y0; y <= range.y1; ++y)
+                for(int x = range.x0; x <= range.x1; ++x)
+                {
+                    const std::vector<int> &cluster = clusters_[(z * cTilesY + y) * cTilesX + x];
+                    for(size_t j = 0; j < cluster.size(); ++j)
+                    {
+                        const int index = cluster[j];
+                        if (lightStamps[index] == stamp)
+                            continue;
+                        lightStamps[index] = stamp;
+                        const BinnedLight &binned = lights[index];
+                        if (!(binned.light->getLightMask() & lightMask))
+                            continue;
+                        const float distance = box.Distance(binned.position);
+                        if (distance > binned.reach)
+                            continue;
+                        candidates.push_back(std::make_pair(binned.brightness * Attenuation(binned.light, distance), index));
+                    }
+                }
+
+        Ogre::LightList &lightList = lightLists_[entity];
+        for(size_t j = 0; j < directionalLights.size() && (int)lightList.size() < lightBudget_; ++j)
+            if (directionalLights[j]->getLightMask() & lightMask)
+                lightList.push_back(directionalLights[j]);
+        const size_t numLights = std::min(candidates.size(), (size_t)Max(0, lightBudget_ - (int)lightList.size()));
+        std::partial_sort(candidates.begin(), candidates.begin() + numLights, candidates.end(), ImportanceGreater());
+        for(size_t j = 0; j < numLights; ++j)
+            lightList.push_back(lights[candidates[j].second].light);
+        numAssignedLights_ += (int)lightList.size();
+        Listen(entity);
+    }
+}
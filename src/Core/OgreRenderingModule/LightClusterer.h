@@ -0,0 +1,109 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#pragma once
+
+#include "CoreDefines.h"
+#include "OgreModuleApi.h"
+#include "OgreModuleFwd.h"
+#include "Math/float3.h"
+#include "Math/float4x4.h"
+
+#include <OgreMovableObject.h>
+
+#include <QObject>
+#include <QHash>
+
+#include <vector>
+#include <map>
+
+class OgreWorld;
+class AABB;
+
+/// Assigns each mesh in the view of the main camera only the lights that reach it, the most important first, up to a budget.
+/** Enabled with the --clusteredLights command line parameter. Before each frame is rendered, the point and spot lights
+    of EC_Light whose reach intersects the view of the main camera are binned into clusters of screen tiles and depth
+    slices. Each mesh in view then gets the lights of the clusters its bounds overlap, ordered by their importance for the
+    mesh and cut to the light budget, instead of the closest lights of the whole scene that Ogre would give it. The
+    directional lights are given to every mesh first.
+
+    The reach of a light is the distance at which its attenuation, from the range and the attenuation attributes of the
+    EC_Light, falls below 1/256, and its importance for a mesh is its brightest color component times its attenuation at
+    the nearest point of the mesh bounds. Spot lights are binned as point lights of the same reach.
+
+    The lists are given to the meshes for all cameras, so a render-to-texture camera looking at the part of a mesh outside
+    the main view may miss the lights that only reach that part. The cost of the pass is profiled in the
+    LightClusterer_Update block. */
+class OGRE_MODULE_API LightClusterer : public QObject, public Ogre::MovableObject::Listener
+{
+    Q_OBJECT
+
+public:
+    explicit LightClusterer(OgreWorld *world);
+    /// Restores the listeners of the objects that were listened to before.
+    ~LightClusterer();
+
+    /// Ogre::MovableObject::Listener override. Returns the lights assigned to the object in the last frame.
+    const Ogre::LightList *objectQueryLights(const Ogre::MovableObject *object);
+
+    /// Ogre::MovableObject::Listener overrides, which are passed on to the listener the object had before this.
+    bool objectRendering(const Ogre::MovableObject *object, const Ogre::Camera *camera);
+    void objectDestroyed(Ogre::MovableObject *object);
+    void objectMoved(Ogre::MovableObject *object);
+    void objectAttached(Ogre::MovableObject *object);
+    void objectDetached(Ogre::MovableObject *object);
+
+public slots:
+    /// Sets the maximum number of lights given to a mesh.
+    void SetLightBudget(int budget);
+
+    /// Returns the maximum number of lights given to a mesh.
+    int LightBudget() const { return lightBudget_; }
+
+    /// Returns the number of point and spot lights binned in the last frame.
+    int NumLights() const { return numLights_; }
+
+    /// Returns the number of meshes that lights were assigned to in the last frame.
+    int NumMeshes() const { return (int)lightLists_.size(); }
+
+    /// Returns the total number of lights assigned to the meshes in the last frame.
+    int NumAssignedLights() const { return numAssignedLights_; }
+
+private slots:
+    void OnPostFrameUpdate(float frameTime);
+
+private:
+    /// Range of clusters covered by a box.
+    struct ClusterRange
+    {
+        int x0, y0, z0;
+        int x1, y1, z1;
+    };
+
+    /// Computes the range of clusters the world space box overlaps. Returns false if it is out of the view.
+    bool ClustersOf(const AABB &box, ClusterRange &range) const;
+
+    /// Returns the depth slice of the view distance.
+    int DepthSlice(float distance) const;
+
+    /// Starts listening to the object, so that its light list can be given.
+    void Listen(Ogre::MovableObject *object);
+
+    OgreWorld *world_;
+    int lightBudget_;
+
+    /// Clustering frame of the main camera in the last frame.
+    float4x4 viewProj_;
+    float3 eye_;
+    float3 front_;
+    float nearPlane_;
+    float farPlane_;
+
+    /// Indices of the binned lights in each cluster, x fastest, then y, then the depth slice.
+    std::vector<std::vector<int> > clusters_;
+    /// Light lists of the meshes in the last frame.
+    std::map<const Ogre::MovableObject*, Ogre::LightList> lightLists_;
+    /// Objects whose listener has been set to this, with the listener they had before.
+    QHash<Ogre::MovableObject*, Ogre::MovableObject::Listener*> listened_;
+    int numLights_;
+    int numAssignedLights_;
+};
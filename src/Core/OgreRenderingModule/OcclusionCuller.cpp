@@ -0,0 +1,385 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#include "StableHeaders.h"
+#include "DebugOperatorNew.h"
+
+#include "OcclusionCuller.h"
+#include "OgreWorld.h"
+#include "OgreMeshAsset.h"
+#include "Renderer.h"
+#include "ScreenSize.h"
+#include "EC_Mesh.h"
+#include "EC_Camera.h"
+#include "EC_Placeable.h"
+#include "Entity.h"
+#include "Scene/Scene.h"
+#include "Framework.h"
+#include "FrameAPI.h"
+#include "Profiler.h"
+#include "Math/MathFunc.h"
+#include "Math/float3x4.h"
+#include "Math/float4x4.h"
+#include "Math/float4.h"
+#include "Geometry/AABB.h"
+#include "Geometry/Frustum.h"
+#include "Geometry/Triangle.h"
+
+#include <OgreEntity.h>
+#include <OgreSubEntity.h>
+#include <OgreMesh.h>
+#include <OgreSubMesh.h>
+#include <OgreCamera.h>
+
+#include <algorithm>
+#include <cfloat>
+
+#include "MemoryLeakCheck.h"
+
+namespace
+{
+/// Size of the software depth buffer.
+const int cDepthWidth = 256;
+const int cDepthHeight = 128;
+/// Maximum number of occluders rasterized per frame.
+const size_t cMaxOccluders = 32;
+/// Maximum number of triangles of a single occluder, larger meshes are too costly to rasterize.
+const size_t cMaxOccluderTriangles = 4096;
+/// Maximum number of triangles rasterized per frame.
+const size_t cMaxTotalOccluderTriangles = 32768;
+/// Smallest screen height of an occluder, as a fraction of the window height.
+const float cMinOccluderScreenFraction = 0.15f;
+/// Width and height in texels of the largest rectangle tested on a hierarchy level, the level is chosen to fit it.
+const int cMaxTestTexels = 4;
+
+size_t CountTriangles(const Ogre::MeshPtr &mesh)
+{
+    size_t numTriangles = 0;
+    for(unsigned short i = 0; mesh.get() && i < mesh->getNumSubMeshes(); ++i)
+    {
+        Ogre::SubMesh *submesh = mesh->getSubMesh(i);
+        if (submesh && submesh->indexData)
+            numTriangles += submesh->indexData->indexCount / 3;
+    }
+    return numTriangles;
+}
+
+/// Returns whether the entity is shown by its own settings, regardless of the culling.
+/** The entities baked to static geometry are hidden with a zero visibility mask. */
+bool IsShown(const Ogre::Entity *entity)
+{
+    return entity->getVisible() && entity->getVisibilityFlags() != 0 && entity->isInScene();
+}
+
+/// Returns whether the entity has no transparent or animated parts, so that its CPU triangles cover what is rendered.
+bool IsSolid(Ogre::Entity *entity)
+{
+    if (entity->hasSkeleton() || entity->hasVertexAnimation())
+        return false;
+    for(uint i = 0; i < entity->getNumSubEntities(); ++i)
+    {
+        const Ogre::MaterialPtr &material = entity->getSubEntity(i)->getMaterial();
+        if (material.isNull() || material->isTransparent())
+            return false;
+    }
+    return true;
+}
+
+/// Orders the occluders by their screen size, the largest first.
+struct ScreenSizeGreater
+{
+    template <typename T>
+    bool operator()(const T &a, const T &b) const { return a.screenSize > b.screenSize; }
+};
+
+}
+
+OcclusionCuller::OcclusionCuller(OgreWorld *world) :
+    world_(world),
+    camera_(0),
+    numOccluders_(0),
+    numTested_(0),
+    numOccludedTriangles_(0)
+{
+    int width = cDepthWidth;
+    int height = cDepthHeight;
+    for(;;)
+    {
+        levelWidths_.push_back(width);
+        levelHeights_.push_back(height);
+        depthLevels_.push_back(std::vector<float>(width * height, FLT_MAX));
+        if (width == 1 && height == 1)
+            break;
+        width = std::max(1, (width + 1) / 2);
+        height = std::max(1, (height + 1) / 2);
+    }
+
+    Framework *framework = world_->Scene()->GetFramework();
+    connect(framework->Frame(), SIGNAL(PostFrameUpdate(float)), SLOT(OnPostFrameUpdate(float)));
+}
+
+OcclusionCuller::~OcclusionCuller()
+{
+    foreach(Ogre::MovableObject *object, listened_)
+        if (object->getListener() == this)
+            object->setListener(0);
+}
+
+bool OcclusionCuller::objectRendering(const Ogre::MovableObject *object, const Ogre::Camera *camera)
+{
+    return camera != camera_ || !occluded_.contains(object);
+}
+
+void OcclusionCuller::objectDestroyed(Ogre::MovableObject *object)
+{
+    listened_.remove(object);
+    occluded_.remove(object);
+}
+
+void OcclusionCuller::Listen(Ogre::MovableObject *object)
+{
+    if (listened_.contains(object))
+        return;
+    // Leave the objects that someone else listens to alone.
+    if (object->getListener() && object->getListener() != this)
+        return;
+    object->setListener(this);
+    listened_.insert(object);
+}
+
+void OcclusionCuller::OnPostFrameUpdate(float /*frameTime*/)
+{
+    PROFILE(OcclusionCuller_Update);
+
+    occluded_.clear();
+    numOccluders_ = 0;
+    numTested_ = 0;
+    numOccludedTriangles_ = 0;
+    camera_ = 0;
+
+    OgreRenderer::Renderer *renderer = world_->Renderer();
+    ScenePtr scene = world_->Scene();
+    Entity *cameraEntity = renderer->MainCamera();
+    EC_Camera *camera = renderer->MainCameraComponent();
+    if (!scene || !cameraEntity || !camera || !camera->OgreCamera() || cameraEntity->ParentScene() != scene.get() || renderer->WindowHeight() <= 0)
+        return;
+    const Frustum frustum = camera->ToFrustum();
+    // The depths are the w of the clip space, which is the view distance only in a perspective projection.
+    if (frustum.type != PerspectiveFrustum)
+        return;
+    camera_ = camera->OgreCamera();
+
+    const float4x4 viewProj = frustum.ViewProjMatrix();
+    const float3 eye = frustum.pos;
+    const float nearPlane = std::max(frustum.nearPlaneDistance, 0.01f);
+    const float minOccluderScreenSize = cMinOccluderScreenFraction * (float)renderer->WindowHeight();
+
+    // Choose the occluders among the meshes in view by the screen size of their bounds.
+    std::vector<shared_ptr<EC_Mesh> > meshes = scene->Components<EC_Mesh>();
+    std::vector<EC_Mesh*> shown;
+    std::vector<AABB> boxes;
+    shown.reserve(meshes.size());
+    boxes.reserve(meshes.size());
+    for(size_t i = 0; i < meshes.size(); ++i)
+    {
+        Ogre::Entity *entity = meshes[i]->OgreEntity();
+        if (!entity || !IsShown(entity))
+            continue;
+        const AABB box = meshes[i]->WorldAABB();
+        if (!box.IsFinite())
+            continue;
+        shown.push_back(meshes[i].get());
+        boxes.push_back(box);
+    }
+    // Cull the bounds against the frustum in one batch.
+    std::vector<u32> inFrustum((boxes.size() + 31) / 32);
+    if (!boxes.empty())
+        frustum.BatchIntersects(&boxes[0], (int)boxes.size(), &inFrustum[0]);
+
+    std::vector<EC_Mesh*> occludees;
+    std::vector<Occluder> candidates;
+    occludees.reserve(shown.size());
+    for(size_t i = 0; i < shown.size(); ++i)
+    {
+        if (!(inFrustum[i >> 5] & (1u << (i & 31))))
+            continue;
+        EC_Mesh *mesh = shown[i];
+        Ogre::Entity *entity = mesh->OgreEntity();
+        const AABB &box = boxes[i];
+        occludees.push_back(mesh);
+
+        const float screenSize = OgreRenderer::ScreenSizeInPixels(camera_, box, std::max(box.Distance(eye), nearPlane));
+        if (screenSize < minOccluderScreenSize || !IsSolid(entity))
+            continue;
+        OgreMeshAssetPtr meshAsset = mesh->MeshAsset();
+        const size_t numTriangles = CountTriangles(entity->getMesh());
+        // Do not wait for the triangles of a mesh whose kD-tree is still being built in a worker thread.
+        if (!meshAsset || meshAsset->IsBuildingKdTree() || numTriangles == 0 || numTriangles > cMaxOccluderTriangles)
+            continue;
+        Occluder occluder;
+        occluder.mesh = mesh;
+        occluder.screenSize = screenSize;
+        occluder.numTriangles = numTriangles;
+        candidates.push_back(occluder);
+    }
+    if (candidates.empty())
+        return;
+
+    std::vector<EC_Mesh*> occluders;
+    {
+        PROFILE(OcclusionCuller_Rasterize);
+        ClearDepth();
+        std::sort(candidates.begin(), candidates.end(), ScreenSizeGreater());
+        size_t totalTriangles = 0;
+        for(size_t i = 0; i < candidates.size() && occluders.size() < cMaxOccluders; ++i)
+        {
+            if (totalTriangles + candidates[i].numTriangles > cMaxTotalOccluderTriangles)
+                continue;
+            totalTriangles += candidates[i].numTriangles;
+            RasterizeOccluder(candidates[i].mesh, viewProj, nearPlane);
+            occluders.push_back(candidates[i].mesh);
+        }
+        numOccluders_ = (int)occluders.size();
+    }
+    {
+        PROFILE(OcclusionCuller_BuildHierarchy);
+        BuildHierarchy();
+    }
+
+    PROFILE(OcclusionCuller_Test);
+    for(size_t i = 0; i < occludees.size(); ++i)
+    {
+        Ogre::Entity *entity = occludees[i]->OgreEntity();
+        ++numTested_;
+        // Listened to before it is occluded, so that the listeners that chain to this, such as the LightClusterer, come after.
+        Listen(entity);
+        // The occluders rasterized themselves, and would be hidden by their own depths.
+        if (std::find(occluders.begin(), occluders.end(), occludees[i]) != occluders.end() || !IsBoxOccluded(occludees[i]->WorldAABB(), viewProj, nearPlane))
+            continue;
+        occluded_.insert(entity);
+        numOccludedTriangles_ += (int)CountTriangles(entity->getMesh());
+    }
+}
+
+void OcclusionCuller::ClearDepth()
+{
+    std::fill(depthLevels_[0].begin(), depthLevels_[0].end(), FLT_MAX);
+}
+
+void OcclusionCuller::RasterizeOccluder(EC_Mesh *mesh, const float4x4 &viewProj, float nearPlane)
+{
+    OgreMeshAssetPtr meshAsset = mesh->MeshAsset();
+    const float4x4 localToClip = viewProj * mesh->LocalToWorld();
+    for(size_t s = 0; s < meshAsset->NumSubmeshes(); ++s)
+    {
+        const int numTris = meshAsset->NumTris((int)s);
+        for(int t = 0; t < numTris; ++t)
+        {
+            const Triangle tri = meshAsset->Tri((int)s, t);
+            RasterizeTriangle(localToClip.Transform(float4(tri.a, 1.f)), localToClip.Transform(float4(tri.b, 1.f)),
+                localToClip.Transform(float4(tri.c, 1.f)), nearPlane);
+        }
+    }
+}
+
+void OcclusionCuller::RasterizeTriangle(const float4 &a, const float4 &b, const float4 &c, float nearPlane)
+{
+    // Leave out the triangles that cross the near plane, which only makes the occluder smaller.
+    if (a.w < nearPlane || b.w < nearPlane || c.w < nearPlane)
+        return;
+
+    const float width = (float)levelWidths_[0];
+    const float height = (float)levelHeights_[0];
+    const float x0 = (a.x / a.w * 0.5f + 0.5f) * width, y0 = (0.5f - a.y / a.w * 0.5f) * height;
+    const float x1 = (b.x / b.w * 0.5f + 0.5f) * width, y1 = (0.5f - b.y / b.w * 0.5f) * height;
+    const float x2 = (c.x / c.w * 0.5f + 0.5f) * width, y2 = (0.5f - c.y / c.w * 0.5f) * height;
+    const float area = (x1 - x0) * (y2 - y0) - (x2 - x0) * (y1 - y0);
+    if (Abs(area) < 1e-6f)
+        return;
+    const float sign = area > 0.f ? 1.f : -1.f;
+
+    // The triangle is written with the depth of its farthest corner, so that it can not occlude more than it covers.
+    const float depth = std::max(a.w, std::max(b.w, c.w));
+    const int minX = std::max(0, (int)floor(std::min(x0, std::min(x1, x2))));
+    const int maxX = std::min(levelWidths_[0] - 1, (int)ceil(std::max(x0, std::max(x1, x2))));
+    const int minY = std::max(0, (int)floor(std::min(y0, std::min(y1, y2))));
+    const int maxY = std::min(levelHeights_[0] - 1, (int)ceil(std::max(y0, std::max(y1, y2))));
+
+    std::vector<float> &buffer = depthLevels_[0];
+    for(int y = minY; y <= maxY; ++y)
+    {
+        const float py = (float)y + 0.5f;
+        for(int x = minX; x <= maxX; ++x)
+        {
+            const float px = (float)x + 0.5f;
+            const float e0 = sign * ((x1 - x0) * (py - y0) - (y1 - y0) * (px - x0));
+            const float e1 = sign * ((x2 - x1) * (py - y1) - (y2 - y1) * (px - x1));
+            const float e2 = sign * ((x0 - x2) * (py - y2) - (y0 - y2) * (px - x2));
+            if (e0 < 0.f || e1 < 0.f || e2 < 0.f)
+                continue;
+            float &texel = buffer[y * levelWidths_[0] + x];
+            texel = std::min(texel, depth);
+        }
+    }
+}
+
+void OcclusionCuller::BuildHierarchy()
+{
+    for(size_t level = 1; level < depthLevels_.size(); ++level)
+    {
+        const std::vector<float> &src = depthLevels_[level - 1];
+        std::vector<float> &dst = depthLevels_[level];
+        const int srcWidth = levelWidths_[level - 1];
+        const int srcHeight = levelHeights_[level - 1];
+        for(int y = 0; y < levelHeights_[level]; ++y)
+            for(int x = 0; x < levelWidths_[level]; ++x)
+            {
+                const int sx = x * 2, sy = y * 2;
+                const int sx1 = std::min(sx + 1, srcWidth - 1), sy1 = std::min(sy + 1, srcHeight - 1);
+                dst[y * levelWidths_[level] + x] = std::max(std::max(src[sy * srcWidth + sx], src[sy * srcWidth + sx1]),
+                    std::max(src[sy1 * srcWidth + sx], src[sy1 * srcWidth + sx1]));
+            }
+    }
+}
+
+bool OcclusionCuller::IsBoxOccluded(const AABB &box, const float4x4 &viewProj, float nearPlane) const
+{
+    float minX = FLT_MAX, minY = FLT_MAX, maxX = -FLT_MAX, maxY = -FLT_MAX;
+    float nearestDepth = FLT_MAX;
+    const float width = (float)levelWidths_[0];
+    const float height = (float)levelHeights_[0];
+    for(int i = 0; i < 8; ++i)
+    {
+        const float4 clip = viewProj.Transform(float4(box.CornerPoint(i), 1.f));
+        // A box that reaches in front of the near plane is treated as visible.
+        if (clip.w < nearPlane)
+            return false;
+        const float x = (clip.x / clip.w * 0.5f + 0.5f) * width;
+        const float y = (0.5f - clip.y / clip.w * 0.5f) * height;
+        minX = std::min(minX, x);
+        maxX = std::max(maxX, x);
+        minY = std::min(minY, y);
+        maxY = std::max(maxY, y);
+        nearestDepth = std::min(nearestDepth, clip.w);
+    }
+
+    int x0 = std::max(0, (int)floor(minX));
+    int x1 = std::min(levelWidths_[0] - 1, (int)floor(maxX));
+    int y0 = std::max(0, (int)floor(minY));
+    int y1 = std::min(levelHeights_[0] - 1, (int)floor(maxY));
+    if (x0 > x1 || y0 > y1)
+        return false;
+
+    // Go up the hierarchy until the rectangle fits in a few texels.
+    size_t level = 0;
+    while(level + 1 < depthLevels_.size() && (x1 - x0 + 1 > cMaxTestTexels || y1 - y0 + 1 > cMaxTestTexels))
+    {
+        x0 /= 2; x1 /= 2; y0 /= 2; y1 /= 2;
+        ++level;
+    }
+    const std::vector<float> &buffer = depthLevels_[level];
+    for(int y = y0; y <= y1; ++y)
+        for(int x = x0; x <= x1; ++x)
+            if (buffer[y * levelWidths_[level] + x] >= nearestDepth)
+                return false;
+    return true;
+}
@@ -0,0 +1,102 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#pragma once
+
+#include "CoreDefines.h"
+#include "OgreModuleApi.h"
+#include "OgreModuleFwd.h"
+#include "Math/MathFwd.h"
+
+#include <OgreMovableObject.h>
+
+#include <QObject>
+#include <QSet>
+
+#include <vector>
+
+class EC_Mesh;
+class OgreWorld;
+
+/// Culls the meshes that are hidden behind large occluders from the view of the main camera.
+/** Enabled with the --occlusionCulling command line parameter. Before each frame is rendered, the triangles of the
+    largest opaque meshes in the view of the main camera are rasterized to a low resolution software depth buffer,
+    and a max-depth hierarchy is built from it. The screen rectangles of the world bounding boxes of the other meshes
+    in view are then tested against the hierarchy, and the meshes that are fully behind the occluders are skipped when
+    rendering from the main camera. Shadow and render-to-texture cameras still render them.
+
+    The cost of the pass is profiled in the OcclusionCuller_Update block, and the savings of the last frame are given by
+    NumOccluded and NumOccludedTriangles. */
+class OGRE_MODULE_API OcclusionCuller : public QObject, public Ogre::MovableObject::Listener
+{
+    Q_OBJECT
+
+public:
+    explicit OcclusionCuller(OgreWorld *world);
+    ~OcclusionCuller();
+
+    /// Returns whether the movable object was culled in the last frame.
+    bool IsOccluded(const Ogre::MovableObject *object) const { return occluded_.contains(object); }
+
+    /// Ogre::MovableObject::Listener override. Skips the occluded objects when rendering from the main camera.
+    bool objectRendering(const Ogre::MovableObject *object, const Ogre::Camera *camera);
+
+    /// Ogre::MovableObject::Listener override.
+    void objectDestroyed(Ogre::MovableObject *object);
+
+public slots:
+    /// Returns the number of meshes that were rasterized as occluders in the last frame.
+    int NumOccluders() const { return numOccluders_; }
+
+    /// Returns the number of meshes that were tested against the occluders in the last frame.
+    int NumTested() const { return numTested_; }
+
+    /// Returns the number of meshes that were culled in the last frame.
+    int NumOccluded() const { return occluded_.size(); }
+
+    /// Returns the number of triangles of the meshes that were culled in the last frame.
+    int NumOccludedTriangles() const { return numOccludedTriangles_; }
+
+private slots:
+    void OnPostFrameUpdate(float frameTime);
+
+private:
+    struct Occluder
+    {
+        EC_Mesh *mesh;
+        float screenSize; ///< Screen height in pixels of the world bounding box.
+        size_t numTriangles;
+    };
+
+    /// Clears the depth buffer to the far distance.
+    void ClearDepth();
+
+    /// Rasterizes the triangles of the occluder to the depth buffer.
+    void RasterizeOccluder(EC_Mesh *mesh, const float4x4 &viewProj, float nearPlane);
+
+    /// Rasterizes a triangle given in clip space, with the farthest depth of its corners.
+    void RasterizeTriangle(const float4 &a, const float4 &b, const float4 &c, float nearPlane);
+
+    /// Builds the coarser levels of the depth hierarchy, each texel holding the farthest depth of the four below it.
+    void BuildHierarchy();
+
+    /// Returns whether the world space box is fully behind the rasterized occluders.
+    bool IsBoxOccluded(const AABB &box, const float4x4 &viewProj, float nearPlane) const;
+
+    /// Starts listening to the rendering of the object, so that it can be skipped.
+    void Listen(Ogre::MovableObject *object);
+
+    OgreWorld *world_;
+    /// The main camera in the last frame, which the occluded objects are skipped for.
+    const Ogre::Camera *camera_;
+    /// Depth hierarchy, level 0 is the full resolution. The depths are distances along the view direction.
+    std::vector<std::vector<float> > depthLevels_;
+    std::vector<int> levelWidths_;
+    std::vector<int> levelHeights_;
+    /// Objects culled in the last frame.
+    QSet<const Ogre::MovableObject*> occluded_;
+    /// Objects whose listener has been set to this.
+    QSet<Ogre::MovableObject*> listened_;
+    int numOccluders_;
+    int numTested_;
+    int numOccludedTriangles_;
+};
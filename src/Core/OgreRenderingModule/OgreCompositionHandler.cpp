@@ -6,14 +6,54 @@
 #include "OgreCompositionHandler.h"
 #include "OgreRenderingModule.h"
 #include "OgreMaterialUtils.h"
+#include "GpuProfiler.h"
 
 #include <OgreCompositorManager.h>
 #include <OgreTechnique.h>
 #include <OgreCompositionTechnique.h>
 #include <OgreMaterialManager.h>
+#include <OgreCompositionTargetPass.h>
+#include <OgreCompositionPass.h>
+
+#include <set>
 
 #include "MemoryLeakCheck.h"
 
+namespace
+{
+/// A parameter value with which a compositor has no visible effect.
+struct NoOpRule
+{
+    const char *compositor;
+    const char *parameter;
+    float value; ///< Value of the parameter with which the compositor is a no-op.
+    float defaultValue; ///< Value of the parameter in the compositor material, used if the parameter has not been set.
+    const char *parameter2; ///< Other parameter that must also have its value for a no-op, or null.
+    float value2;
+    float defaultValue2;
+};
+
+/// The compositor is a no-op if any of its rules matches.
+const NoOpRule cNoOpRules[] =
+{
+    // blur * BlurWeight + sharp * OriginalImageWeight
+    { "Bloom", "BlurWeight", 0.f, 0.7f, "OriginalImageWeight", 1.f, 1.f },
+    // scene + glow * GlowBrightness
+    { "Glow", "GlowBrightness", 0.f, 1.f, 0, 0.f, 0.f },
+    // lerp(color, previous, blur)
+    { "Motion Blur", "blur", 0.f, 0.7f, 0, 0.f, 0.f },
+    // color + (average of the samples - color) * sampleStrength, sampled at most sampleDist away
+    { "Radial Blur", "sampleStrength", 0.f, 2.2f, 0, 0.f, 0.f },
+    { "Radial Blur", "sampleDist", 0.f, 1.f, 0, 0.f, 0.f }
+};
+
+bool ParameterHasValue(const std::map<std::string, Ogre::Vector4> &parameters, const char *name, float value, float defaultValue)
+{
+    std::map<std::string, Ogre::Vector4>::const_iterator it = parameters.find(name);
+    return Ogre::Math::RealEqual(it != parameters.end() ? it->second.x : defaultValue, value);
+}
+}
+
 ///@note This class and its implementation is taken from the Ogre samples
 class GlowMaterialListener : public Ogre::MaterialManager::Listener
 {
@@ -36,7 +76,9 @@ public:
     }
 };
 
-OgreCompositionHandler::OgreCompositionHandler() : viewport_(0)
+OgreCompositionHandler::OgreCompositionHandler() :
+    viewport_(0),
+    gpuProfiler_(0)
 {
 }
 
@@ -60,6 +102,8 @@ void OgreCompositionHandler::RemoveCompositorFromViewport(const std::string &com
         mgr->setCompositorEnabled(vp, compositor, false);
         mgr->removeCompositor(vp, compositor);
         priorities_.erase(compositor);
+        if (vp == viewport_)
+            CompositorRemoved(compositor);
     }
 }
 
@@ -68,6 +112,18 @@ void OgreCompositionHandler::RemoveAllCompositors()
     if (viewport_ && Ogre::CompositorManager::getSingletonPtr()->hasCompositorChain(viewport_))
         Ogre::CompositorManager::getSingletonPtr()->removeCompositorChain(viewport_);
     priorities_.clear();
+    enabled_.clear();
+    parameters_.clear();
+    costListeners_.clear();
+    Ogre::CompositorManager::getSingletonPtr()->freePooledTextures(true);
+}
+
+void OgreCompositionHandler::CompositorRemoved(const std::string &compositor)
+{
+    enabled_.erase(compositor);
+    parameters_.erase(compositor);
+    costListeners_.erase(compositor);
+    Ogre::CompositorManager::getSingletonPtr()->freePooledTextures(true);
 }
 
 void OgreCompositionHandler::CameraChanged(Ogre::Viewport* vp, Ogre::Camera* newCamera)
@@ -136,6 +192,7 @@ bool OgreCompositionHandler::AddCompositor(const std::string &compositor, Ogre::
     bool succesfull = false;
     if (vp != 0)
     {
+        PoolTextures(compositor);
         Ogre::CompositorInstance* comp = Ogre::CompositorManager::getSingletonPtr()->addCompositor(vp, compositor, position);
         if (comp != 0)
         {
@@ -151,7 +208,19 @@ bool OgreCompositionHandler::AddCompositor(const std::string &compositor, Ogre::
                 gaussian_listener_.notifyViewportSize(vp->getActualWidth(), vp->getActualHeight());
             }
 
-            Ogre::CompositorManager::getSingletonPtr()->setCompositorEnabled(vp, compositor, true);
+            bool enable = true;
+            if (vp == viewport_)
+            {
+                enabled_[compositor] = true;
+                enable = !IsNoOp(compositor);
+                if (gpuProfiler_ && !costListeners_.count(compositor))
+                {
+                    shared_ptr<CompositorCostListener> listener = MAKE_SHARED(CompositorCostListener, gpuProfiler_, compositor);
+                    comp->addListener(listener.get());
+                    costListeners_[compositor] = listener;
+                }
+            }
+            Ogre::CompositorManager::getSingletonPtr()->setCompositorEnabled(vp, compositor, enable);
             succesfull = true;
         }
     }
@@ -170,8 +239,12 @@ void OgreCompositionHandler::RemoveCompositorFromViewport(const std::string &com
     RemoveCompositorFromViewport(compositor, viewport_);
 }
 
-void OgreCompositionHandler::SetCompositorParameter(const std::string &compositorName, const QList< std::pair<std::string, Ogre::Vector4> > &source) const
+void OgreCompositionHandler::SetCompositorParameter(const std::string &compositorName, const QList< std::pair<std::string, Ogre::Vector4> > &source)
 {
+    std::map<std::string, Ogre::Vector4> &parameters = parameters_[compositorName];
+    for(int i = 0; i < source.size(); ++i)
+        parameters[source[i].first] = source[i].second;
+
     Ogre::CompositorPtr compositor = Ogre::CompositorManager::getSingletonPtr()->getByName(compositorName);
     if (compositor.get())
     {
@@ -235,10 +308,76 @@ QStringList OgreCompositionHandler::CompositorParameters(const std::string &comp
     return ret.toList();
 }
 
-void OgreCompositionHandler::SetCompositorEnabled(const std::string &compositor, bool enable) const
+void OgreCompositionHandler::SetCompositorEnabled(const std::string &compositor, bool enable)
+{
+    if (!viewport_)
+        return;
+    enabled_[compositor] = enable;
+    if (enable && IsNoOp(compositor))
+    {
+        LogDebug("OgreCompositionHandler::SetCompositorEnabled: " + compositor + " has no effect with its parameters, keeping it disabled.");
+        enable = false;
+    }
+    Ogre::CompositorManager::getSingletonPtr()->setCompositorEnabled(viewport_, compositor, enable);
+}
+
+bool OgreCompositionHandler::IsNoOp(const std::string &compositor) const
 {
-    if (viewport_)
-        Ogre::CompositorManager::getSingletonPtr()->setCompositorEnabled(viewport_, compositor, enable);
+    std::map<std::string, std::map<std::string, Ogre::Vector4> >::const_iterator it = parameters_.find(compositor);
+    const std::map<std::string, Ogre::Vector4> noParameters;
+    const std::map<std::string, Ogre::Vector4> &parameters = it != parameters_.end() ? it->second : noParameters;
+    for(size_t i = 0; i < sizeof(cNoOpRules) / sizeof(cNoOpRules[0]); ++i)
+    {
+        const NoOpRule &rule = cNoOpRules[i];
+        if (compositor == rule.compositor && ParameterHasValue(parameters, rule.parameter, rule.value, rule.defaultValue) &&
+            (!rule.parameter2 || ParameterHasValue(parameters, rule.parameter2, rule.value2, rule.defaultValue2)))
+            return true;
+    }
+    return false;
+}
+
+void OgreCompositionHandler::PoolTextures(const std::string &compositorName) const
+{
+    Ogre::CompositorPtr compositor = Ogre::CompositorManager::getSingletonPtr()->getByName(compositorName);
+    if (compositor.isNull())
+        return;
+    compositor->load();
+    for(uint t = 0; t < compositor->getNumTechniques(); ++t)
+    {
+        Ogre::CompositionTechnique *ct = compositor->getTechnique(t);
+
+        // A texture that is read before it is rendered to in the frame, or only rendered to on the first frame, carries
+        // its contents over from the previous frame, so it can not be shared.
+        std::set<std::string> written;
+        std::set<std::string> persistent;
+        for(uint tp = 0; tp <= ct->getNumTargetPasses(); ++tp)
+        {
+            Ogre::CompositionTargetPass *target = tp < ct->getNumTargetPasses() ? ct->getTargetPass(tp) : ct->getOutputTargetPass();
+            if (!target)
+                continue;
+            for(uint p = 0; p < target->getNumPasses(); ++p)
+            {
+                Ogre::CompositionPass *pass = target->getPass(p);
+                for(size_t i = 0; i < pass->getNumInputs(); ++i)
+                {
+                    const std::string &input = pass->getInput(i).name;
+                    if (!input.empty() && !written.count(input))
+                        persistent.insert(input);
+                }
+            }
+            if (target->getOnlyInitial())
+                persistent.insert(target->getOutputName());
+            written.insert(target->getOutputName());
+        }
+
+        Ogre::CompositionTechnique::TextureDefinitionIterator defIter = ct->getTextureDefinitionIterator();
+        while(defIter.hasMoreElements())
+        {
+            Ogre::CompositionTechnique::TextureDefinition *def = defIter.getNext();
+            if (def->refCompName.empty() && def->scope == Ogre::CompositionTechnique::TS_LOCAL)
+                def->pooled = !persistent.count(def->name);
+        }
+    }
 }
 
 void OgreCompositionHandler::SetCompositorTargetParameters(Ogre::CompositionTargetPass *target, const QList< std::pair<std::string, Ogre::Vector4> > &source) const
@@ -279,6 +418,19 @@ void OgreCompositionHandler::SetMaterialParameters(const Ogre::MaterialPtr &mate
     }
 }
 
+// CompositorCostListener
+
+CompositorCostListener::CompositorCostListener(GpuProfiler *profiler, const std::string &compositor) :
+    profiler_(profiler),
+    compositor_(compositor)
+{
+}
+
+void CompositorCostListener::notifyMaterialRender(Ogre::uint32 /*pass_id*/, Ogre::MaterialPtr &/*mat*/)
+{
+    profiler_->MarkCompositor(compositor_);
+}
+
 // HDRListener
 
 HDRListener::HDRListener()
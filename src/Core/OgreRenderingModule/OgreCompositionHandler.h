@@ -4,6 +4,7 @@
 
 #include "CoreTypes.h"
 #include "OgreModuleApi.h"
+#include "OgreModuleFwd.h"
 
 #include <OgreMaterial.h>
 #include <OgreCompositorInstance.h>
@@ -52,9 +53,27 @@ protected:
     float mBloomTexOffsetsHorz[15][4];
     float mBloomTexOffsetsVert[15][4];
 };
+
+/// Marks the start of the GPU cost of a compositor in the GpuProfiler before each of its full-screen passes.
+class CompositorCostListener : public Ogre::CompositorInstance::Listener
+{
+public:
+    CompositorCostListener(GpuProfiler *profiler, const std::string &compositor);
+    virtual void notifyMaterialRender(Ogre::uint32 pass_id, Ogre::MaterialPtr &mat);
+
+protected:
+    GpuProfiler *profiler_;
+    std::string compositor_;
+};
 /** @endcond PRIVATE */
 
 /// Handles the post-processing effects
+/** The local textures of the compositors are pooled, so that the compositors of the chain share the intermediate render
+    targets of the same size and format instead of each creating their own. The textures whose contents are kept from the
+    previous frame, such as the accumulation texture of Motion Blur, are not pooled.
+
+    The compositors whose parameters make them no-ops, e.g. Bloom with zero blur weight, are kept disabled while their
+    parameters stay so, even when enabled, so that their passes are not rendered at all. */
 class OGRE_MODULE_API OgreCompositionHandler
 {
 public:
@@ -81,15 +100,24 @@ public:
     void RemoveCompositorFromViewport(const std::string &compositor);
 
     /// Apply a shader parameter to the specified compositor.
-    /** The compositor should be enabled of course */
-    void SetCompositorParameter(const std::string &compositorName, const QList< std::pair<std::string, Ogre::Vector4> > &source) const;
+    /** The compositor should be enabled of course. The parameters are applied to whether the compositor is a no-op the next
+        time it is enabled. */
+    void SetCompositorParameter(const std::string &compositorName, const QList< std::pair<std::string, Ogre::Vector4> > &source);
 
     /// Returns list of compositor parameter names and their current values in format "name=value".
     /** @note Currently only returns parameters from compositor's composition techniques' output target pass. */
     QStringList CompositorParameters(const std::string &compositorName) const;
 
     /// Enable or disable a compositor that has already been added to the default viewport
-    void SetCompositorEnabled(const std::string &compositor, bool enable) const;
+    /** A compositor that is a no-op with its current parameters stays disabled. */
+    void SetCompositorEnabled(const std::string &compositor, bool enable);
+
+    /// Returns whether the compositor has no visible effect with the parameters set to it.
+    bool IsNoOp(const std::string &compositor) const;
+
+    /// Sets the profiler that the GPU cost of each compositor of the default viewport is reported to. Null to not report.
+    /** Applies to the compositors added after the call. */
+    void SetGpuProfiler(GpuProfiler *profiler) { gpuProfiler_ = profiler; }
 
     /// Disable all compositors from the viewport
     void RemoveAllCompositors();
@@ -117,6 +145,12 @@ private:
     /// Set gpu program parameters for the specified material
     void SetMaterialParameters(const Ogre::MaterialPtr &material, const QList< std::pair<std::string, Ogre::Vector4> > &source) const;
 
+    /// Marks the local textures of the compositor to be pooled, except the ones whose contents are kept over frames.
+    void PoolTextures(const std::string &compositor) const;
+
+    /// Removes the profiler listener of the compositor and frees the pooled textures that are no longer used.
+    void CompositorRemoved(const std::string &compositor);
+
     /// Ogre viewport.
     Ogre::Viewport* viewport_;
 
@@ -128,4 +162,16 @@ private:
     
     /// Stores priorities for compositors. Compositor name is used for the key to make sure each compositor only has one priority.
     std::map<std::string, int> priorities_;
+
+    /// Last values of the parameters set to the compositors, by compositor and parameter name.
+    std::map<std::string, std::map<std::string, Ogre::Vector4> > parameters_;
+
+    /// Whether the compositors of the default viewport have been requested to be enabled.
+    std::map<std::string, bool> enabled_;
+
+    /// Profiler the GPU cost of the compositors is reported to, or null.
+    GpuProfiler *gpuProfiler_;
+
+    /// Profiler listeners of the compositors of the default viewport.
+    std::map<std::string, shared_ptr<CompositorCostListener> > costListeners_;
 };
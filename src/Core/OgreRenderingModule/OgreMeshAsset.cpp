@@ -8,11 +8,15 @@
 #include "AssetAPI.h"
 #include "AssetCache.h"
 #include "Profiler.h"
+#include "Framework.h"
+#include "JobSystem.h"
 #include "Geometry/Ray.h"
 
 #include <QFile>
 #include <QFileInfo>
 #include <Ogre.h>
+#include <OgreProgressiveMesh.h>
+#include <OgrePixelCountLodStrategy.h>
 
 #include "LoggingFunctions.h"
 #include "MemoryLeakCheck.h"
@@ -28,17 +32,111 @@ OgreMeshAsset::~OgreMeshAsset()
     Unload();
 }
 
-bool OgreMeshAsset::LoadFromFile(QString filename)
+namespace
 {
-    /// @todo Duplicate allowAsynchronous code in OgreMeshAsset and TextureAsset.
-    bool allowAsynchronous = true;
-    if ((OGRE_THREAD_SUPPORT == 0) || !assetAPI->Cache() || assetAPI->IsHeadless() ||
-        assetAPI->GetFramework()->HasCommandLineParameter("--noAsyncAssetLoad") ||
-        assetAPI->GetFramework()->HasCommandLineParameter("--no_async_asset_load")) /**< @todo Remove support for the deprecated underscore version at some point. */
+    /// Meshes with fewer triangles than this are not worth generating LOD levels for.
+    const size_t cLodMinTriangles = 500;
+    /// Screen sizes of the mesh, in pixels of its projected bounding sphere, below which each generated LOD level is used.
+    const Ogre::Real cLodPixelCounts[] = { 40000.f, 10000.f, 2500.f };
+    /// Proportion of the vertices removed for each LOD level from the previous one.
+    const Ogre::Real cLodReduction = 0.5f;
+    /// Meshes with at least this many triangles get their kD-tree built in a worker thread right after load.
+    const size_t cKdTreeBackgroundMinTriangles = 10000;
+    /// Meshes with at least this many triangles get their kD-tree stored to the asset cache.
+    const size_t cKdTreeCacheMinTriangles = 10000;
+    /// Meshes with at least this many triangles get the subtrees of their kD-tree built in parallel.
+    const int cKdTreeParallelMinTriangles = 50000;
+    /// Number of the subtrees per thread of a parallel kD-tree build. More than one, as the subtrees are of uneven cost.
+    const int cKdTreeTasksPerThread = 4;
+
+    size_t CountTriangles(const Ogre::MeshPtr &mesh)
     {
-        allowAsynchronous = false;
+        size_t numTriangles = 0;
+        for(unsigned short i = 0; mesh.get() && i < mesh->getNumSubMeshes(); ++i)
+        {
+            Ogre::SubMesh *submesh = mesh->getSubMesh(i);
+            if (submesh && submesh->indexData)
+                numTriangles += submesh->indexData->indexCount / 3;
+        }
+        return numTriangles;
+    }
+
+    /// Builds the subtrees of a kD-tree build in the threads of ParallelFor.
+    class KdTreeSubtreeBuilder : public IParallelForBody
+    {
+    public:
+        explicit KdTreeSubtreeBuilder(KdTree<Triangle> &tree_) : tree(tree_) {}
+        void Run(int begin, int end)
+        {
+            for(int i = begin; i < end; ++i)
+                tree.RunBuildTask(i);
+        }
+
+    private:
+        KdTree<Triangle> &tree;
+    };
+
+    /// Builds the kD-tree, with the subtrees of large meshes built in parallel in the job system if there is one.
+    void BuildKdTree(KdTree<Triangle> &tree, JobSystem *jobs)
+    {
+        if (!jobs || jobs->NumWorkers() == 0 || tree.NumObjects() < cKdTreeParallelMinTriangles)
+        {
+            tree.Build();
+            return;
+        }
+        tree.BeginBuild((jobs->NumWorkers() + 1) * cKdTreeTasksPerThread);
+        KdTreeSubtreeBuilder builder(tree);
+        jobs->ParallelFor(0, tree.NumBuildTasks(), builder, 1, "OgreMeshAsset_KdTreeBuild");
+        tree.EndBuild();
     }
 
+    /// Replaces the triangles of the tree with the built tree read from the file, if the file has the same number of triangles.
+    bool ReadKdTree(KdTree<Triangle> &tree, const QString &fileName)
+    {
+        if (fileName.isEmpty())
+            return false;
+        QFile file(fileName);
+        if (!file.open(QIODevice::ReadOnly) || file.size() <= 0)
+            return false;
+        // Map the file instead of reading it, as the data is only copied once to the tree.
+        uchar *data = file.map(0, file.size());
+        if (!data)
+            return false;
+        KdTree<Triangle> cached;
+        bool success = cached.Deserialize(data, (size_t)file.size()) && cached.NumObjects() == tree.NumObjects();
+        file.unmap(data);
+        if (success)
+            tree.Swap(cached);
+        return success;
+    }
+}
+
+/// Builds a kD-tree in a worker thread of the job system, or reads it from the asset cache.
+/** The job holds the build, so that the asset can be unloaded while the build runs. */
+struct OgreMeshAsset::KdTreeBuild : public IJob
+{
+    explicit KdTreeBuild(JobSystem *jobs_) : IJob("OgreMeshAsset_KdTreeBuild"), jobs(jobs_), cacheable(false) {}
+
+    void Run()
+    {
+        if (!ReadKdTree(tree, cacheFile))
+        {
+            BuildKdTree(tree, jobs);
+            if (cacheable)
+                tree.Serialize(serialized);
+        }
+    }
+
+    JobSystem *jobs; ///< The job system that runs the build, for building the subtrees in parallel.
+    KdTree<Triangle> tree; ///< The triangles gathered in the main thread, then the built tree.
+    bool cacheable; ///< Whether to serialize the built tree for the asset cache.
+    QString cacheFile; ///< Disk source of the kD-tree stored to the asset cache, or empty if there is none.
+    std::vector<u8> serialized; ///< The built tree to store to the asset cache in the main thread, if it was not read from there.
+};
+
+bool OgreMeshAsset::LoadFromFile(QString filename)
+{
+    bool allowAsynchronous = AllowAsyncLoading();
     QString cacheDiskSource;
     if (allowAsynchronous)
     {
@@ -53,6 +151,29 @@ bool OgreMeshAsset::LoadFromFile(QString filename)
         return IAsset::LoadFromFile(filename);
 }
 
+bool OgreMeshAsset::LodGenerationEnabled() const
+{
+    return !assetAPI->IsHeadless() && assetAPI->GetFramework()->HasCommandLineParameter("--meshLod");
+}
+
+QString OgreMeshAsset::LodSidecarRef(const QString &contentHash)
+{
+    return "meshlod-" + contentHash + ".mesh";
+}
+
+bool OgreMeshAsset::AllowBackgroundLoad() const
+{
+    return !AllowAsyncLoading() || assetAPI->Cache()->FindInCache(Name()).isEmpty();
+}
+
+bool OgreMeshAsset::AllowAsyncLoading() const
+{
+    /// @todo Duplicate allowAsynchronous code in OgreMeshAsset and TextureAsset.
+    return !((OGRE_THREAD_SUPPORT == 0) || !assetAPI->Cache() || assetAPI->IsHeadless() ||
+        assetAPI->GetFramework()->HasCommandLineParameter("--noAsyncAssetLoad") ||
+        assetAPI->GetFramework()->HasCommandLineParameter("--no_async_asset_load")); /**< @todo Remove support for the deprecated underscore version at some point. */
+}
+
 bool OgreMeshAsset::DeserializeFromData(const u8 *data_, size_t numBytes, bool allowAsynchronous)
 {
     PROFILE(OgreMeshAsset_LoadFromFileInMemory);
@@ -68,6 +189,26 @@ bool OgreMeshAsset::DeserializeFromData(const u8 *data_, size_t numBytes, bool a
         allowAsynchronous = false;
     }
 
+    // The content hash keys the LOD levels and the kD-tree stored to the cache. Hashing the data is
+    // worth it only for the LOD levels, otherwise use the hash the cache has for the ref if any.
+    contentHash_.clear();
+    if (assetAPI->Cache() && !IsAssimpFileType())
+        contentHash_ = (data_ && LodGenerationEnabled()) ? AssetCache::ComputeContentHash(data_, numBytes) : assetAPI->Cache()->ContentHash(Name());
+
+    // Load the mesh with previously generated LOD levels instead of the source data if it is in the cache.
+    // Done synchronously, as it is much cheaper than generating the LOD levels again after a threaded load.
+    std::vector<u8> lodSidecarData;
+    if (LodGenerationEnabled() && !contentHash_.isEmpty())
+    {
+        const QString sidecar = assetAPI->Cache()->FindInCache(LodSidecarRef(contentHash_));
+        if (!sidecar.isEmpty() && LoadFileToVector(sidecar, lodSidecarData) && !lodSidecarData.empty())
+        {
+            data_ = &lodSidecarData[0];
+            numBytes = lodSidecarData.size();
+            allowAsynchronous = false;
+        }
+    }
+
     QString cacheDiskSource;
     if (allowAsynchronous)
     {
@@ -194,37 +335,72 @@ RayQueryResult OgreMeshAsset::Raycast(const Ray &ray)
 {
     if (!ogreMesh.get())
         return RayQueryResult();
-    if (meshData.NumObjects() == 0)
+    if (kdTreeBuild_ || meshData.NumObjects() == 0)
         CreateKdTree();
     KdTreeRayQueryFirstHitVisitor visitor;
     meshData.RayQuery(ray, visitor);
     if (visitor.result.triangleIndex != KdTree<Triangle>::BUCKET_SENTINEL)
+        CompleteRaycastHit(visitor.result);
+    return visitor.result;
+}
+
+void OgreMeshAsset::Raycast(const Ray *rays, int numRays, RayQueryResult *results)
+{
+    KdTreeRayQueryFirstHitVisitor miss;
+    for(int i = 0; i < numRays; ++i)
+        results[i] = miss.result;
+    if (!ogreMesh.get())
+        return;
+    if (kdTreeBuild_ || meshData.NumObjects() == 0)
+        CreateKdTree();
+    if (meshData.NumObjects() == 0)
+        return;
+
+    const int packetSize = KdTree<Triangle>::maxRayPacketSize;
+    for(int i = 0; i < numRays; i += packetSize)
     {
-        visitor.result.normal = normals[visitor.result.triangleIndex];
-        float2 uv = (uvs.size() > visitor.result.triangleIndex*3+2) ?
-                       (1.f - visitor.result.barycentricUV.x - visitor.result.barycentricUV.y) * uvs[visitor.result.triangleIndex*3]
-                       + visitor.result.barycentricUV.x * uvs[visitor.result.triangleIndex*3+1]
-                       + visitor.result.barycentricUV.y * uvs[visitor.result.triangleIndex*3+2]
-                    : float2(-1, -1);
-        visitor.result.uv = uv;
-        int triangleIndex = visitor.result.triangleIndex;
-        for(size_t i = 0; i < subMeshTriangleCounts.size(); ++i)
+        const int count = (numRays - i < packetSize ? numRays - i : packetSize);
+        TriangleKdTreeRayPacketNearestHitVisitor visitor(rays + i, count);
+        meshData.RayPacketQuery(rays + i, count, visitor);
+        for(int j = 0; j < count; ++j)
         {
-            if (triangleIndex < subMeshTriangleCounts[i])
-            {
-                visitor.result.submeshIndex = (unsigned)i;
-                break;
-            }
-            else
-                triangleIndex -= subMeshTriangleCounts[i];
+            if (visitor.triangleIndex[j] == KdTree<Triangle>::BUCKET_SENTINEL)
+                continue;
+            RayQueryResult &result = results[i + j];
+            result.t = visitor.rayT[j];
+            result.pos = rays[i + j].GetPoint(visitor.rayT[j]);
+            result.triangleIndex = visitor.triangleIndex[j];
+            result.barycentricUV = float2(visitor.barycentricU[j], visitor.barycentricV[j]);
+            CompleteRaycastHit(result);
         }
     }
-    return visitor.result;
+}
+
+void OgreMeshAsset::CompleteRaycastHit(RayQueryResult &result) const
+{
+    result.normal = normals[result.triangleIndex];
+    float2 uv = (uvs.size() > result.triangleIndex*3+2) ?
+                   (1.f - result.barycentricUV.x - result.barycentricUV.y) * uvs[result.triangleIndex*3]
+                   + result.barycentricUV.x * uvs[result.triangleIndex*3+1]
+                   + result.barycentricUV.y * uvs[result.triangleIndex*3+2]
+                : float2(-1, -1);
+    result.uv = uv;
+    int triangleIndex = result.triangleIndex;
+    for(size_t i = 0; i < subMeshTriangleCounts.size(); ++i)
+    {
+        if (triangleIndex < subMeshTriangleCounts[i])
+        {
+            result.submeshIndex = (unsigned)i;
+            break;
+        }
+        else
+            triangleIndex -= subMeshTriangleCounts[i];
+    }
 }
 
 Triangle OgreMeshAsset::Tri(int submeshIndex, int triangleIndex)
 {
-    if (subMeshTriangleCounts.size() == 0)
+    if (kdTreeBuild_ || subMeshTriangleCounts.size() == 0)
         CreateKdTree();
 
     if (triangleIndex < 0 || NumTris(submeshIndex) < triangleIndex)
@@ -260,7 +436,72 @@ int OgreMeshAsset::NumTris(int submeshIndex)
 
 void OgreMeshAsset::CreateKdTree()
 {
-    meshData.Clear();
+    if (kdTreeBuild_)
+    {
+        FinishKdTreeBuild();
+        return;
+    }
+
+    GatherTriangles();
+    const bool cacheable = meshData.NumObjects() >= (int)cKdTreeCacheMinTriangles && !contentHash_.isEmpty();
+    if (cacheable && ReadKdTree(meshData, assetAPI->Cache()->FindInCache(KdTreeCacheRef(contentHash_))))
+        return;
+
+    {
+        PROFILE(OgreMeshAsset_KdTree_Build);
+        BuildKdTree(meshData, assetAPI->GetFramework()->Jobs());
+    }
+    if (cacheable)
+    {
+        std::vector<u8> serialized;
+        meshData.Serialize(serialized);
+        StoreKdTree(serialized);
+    }
+}
+
+void OgreMeshAsset::StartKdTreeBuild()
+{
+    if (kdTreeBuild_ || CountTriangles(ogreMesh) < cKdTreeBackgroundMinTriangles)
+        return;
+
+    PROFILE(OgreMeshAsset_StartKdTreeBuild);
+    GatherTriangles();
+    JobSystem *jobs = assetAPI->GetFramework()->Jobs();
+    kdTreeBuild_ = MAKE_SHARED(KdTreeBuild, jobs);
+    kdTreeBuild_->tree.Swap(meshData);
+    kdTreeBuild_->cacheable = kdTreeBuild_->tree.NumObjects() >= (int)cKdTreeCacheMinTriangles && !contentHash_.isEmpty();
+    if (kdTreeBuild_->cacheable)
+        kdTreeBuild_->cacheFile = assetAPI->Cache()->FindInCache(KdTreeCacheRef(contentHash_));
+    jobs->Schedule(kdTreeBuild_);
+}
+
+void OgreMeshAsset::FinishKdTreeBuild()
+{
+    shared_ptr<KdTreeBuild> build = kdTreeBuild_;
+    kdTreeBuild_.reset();
+    {
+        PROFILE(OgreMeshAsset_WaitForKdTreeBuild);
+        build->jobs->Wait(build);
+    }
+    meshData.Swap(build->tree);
+    StoreKdTree(build->serialized);
+}
+
+void OgreMeshAsset::StoreKdTree(const std::vector<u8> &serialized)
+{
+    if (!serialized.empty() && !contentHash_.isEmpty() && assetAPI->Cache())
+        assetAPI->Cache()->StoreAsset(&serialized[0], serialized.size(), KdTreeCacheRef(contentHash_));
+}
+
+QString OgreMeshAsset::KdTreeCacheRef(const QString &contentHash)
+{
+    return "kdtree-" + contentHash + ".bin";
+}
+
+void OgreMeshAsset::GatherTriangles()
+{
+    KdTree<Triangle> empty;
+    meshData.Swap(empty); // Clear does not free the buckets of a built tree.
     normals.clear();
     uvs.clear();
     subMeshTriangleCounts.clear();
@@ -353,11 +594,6 @@ void OgreMeshAsset::CreateKdTree()
             vbufTex->unlock();
         ibuf->unlock();
     }
-
-    {
-        PROFILE(OgreMeshAsset_KdTree_Build);
-        meshData.Build();
-    }
 }
 
 bool OgreMeshAsset::GenerateMeshData()
@@ -402,6 +638,14 @@ bool OgreMeshAsset::GenerateMeshData()
         LogError("OgreMeshAsset::GenerateMeshData: Failed to generate extremity points to submeshes for mesh " + this->Name() + ": " + QString(e.what()));
     }
 
+    // Generate LOD levels and store the result to the cache, so that they need to be generated only once for the same mesh data.
+    if (LodGenerationEnabled() && GenerateLodLevels() && !contentHash_.isEmpty())
+    {
+        std::vector<u8> lodData;
+        if (SerializeTo(lodData, "") && !lodData.empty())
+            assetAPI->Cache()->StoreAsset(&lodData[0], lodData.size(), LodSidecarRef(contentHash_));
+    }
+
     try
     {
         // Assign default materials that won't complain
@@ -420,9 +664,43 @@ bool OgreMeshAsset::GenerateMeshData()
     //internal_name_ = AssetAPI::SanitateAssetRef(id_);
     //LogDebug("Ogre mesh " + this->Name().toStdString() + " created");
 
+    if (!assetAPI->IsHeadless())
+        StartKdTreeBuild();
     return true;
 }
 
+bool OgreMeshAsset::GenerateLodLevels()
+{
+    PROFILE(OgreMeshAsset_GenerateLodLevels);
+    if (ogreMesh.isNull() || ogreMesh->getNumLodLevels() > 1 || ogreMesh->hasSkeleton() || ogreMesh->hasVertexAnimation())
+        return false;
+
+    if (CountTriangles(ogreMesh) < cLodMinTriangles)
+        return false;
+
+    try
+    {
+        Ogre::Mesh::LodValueList lodValues(cLodPixelCounts, cLodPixelCounts + NUMELEMS(cLodPixelCounts));
+#if OGRE_VERSION_MAJOR <= 1 && OGRE_VERSION_MINOR < 9
+        ogreMesh->setLodStrategy(Ogre::PixelCountLodStrategy::getSingletonPtr());
+#else
+        ogreMesh->setLodStrategy(Ogre::AbsolutePixelCountLodStrategy::getSingletonPtr());
+#endif
+#if OGRE_VERSION_MAJOR <= 1 && OGRE_VERSION_MINOR < 8
+        ogreMesh->generateLodLevels(lodValues, Ogre::ProgressiveMesh::VRQ_PROPORTIONAL, cLodReduction);
+#else
+        Ogre::ProgressiveMesh::generateLodLevels(ogreMesh.get(), lodValues, Ogre::ProgressiveMesh::VRQ_PROPORTIONAL, cLodReduction);
+#endif
+    }
+    catch(const Ogre::Exception &e)
+    {
+        LogError("OgreMeshAsset::GenerateLodLevels: Failed to generate LOD levels for mesh " + Name() + ": " + QString(e.what()));
+        ogreMesh->removeLodLevels();
+        return false;
+    }
+    return ogreMesh->getNumLodLevels() > 1;
+}
+
 void OgreMeshAsset::operationCompleted(Ogre::BackgroundProcessTicket ticket, const Ogre::BackgroundProcessResult &result)
 {
     if (ticket != loadTicket_)
@@ -468,6 +746,14 @@ void OgreMeshAsset::DoUnload()
         loadTicket_ = 0;
     }
     
+    // A build still running keeps its own data alive, so it can be left to finish on its own.
+    kdTreeBuild_.reset();
+    KdTree<Triangle> empty;
+    meshData.Swap(empty);
+    normals.clear();
+    uvs.clear();
+    subMeshTriangleCounts.clear();
+
     if (ogreMesh.isNull())
         return;
 
@@ -498,6 +784,11 @@ bool OgreMeshAsset::IsLoaded() const
     return (ogreMesh.get() != 0);
 }
 
+size_t OgreMeshAsset::MemoryUsage() const
+{
+    return ogreMesh.get() ? ogreMesh->getSize() : 0;
+}
+
 QString OgreMeshAsset::OgreMeshName() const
 {
     return (ogreMesh.get() != 0 ? QString::fromStdString(ogreMesh->getName()) : "");
@@ -25,6 +25,9 @@ public:
     /// Load mesh from file. IAsset override.
     virtual bool LoadFromFile(QString filename);
 
+    /// Returns false if LoadFromFile loads the mesh from the asset cache with Ogre's threaded loading. IAsset override.
+    virtual bool AllowBackgroundLoad() const;
+
     /// Load mesh from memory. IAsset override.
     virtual bool DeserializeFromData(const u8 *data_, size_t numBytes, bool allowAsynchronous);
 
@@ -34,6 +37,11 @@ public:
     /// Ogre threaded load listener. Ogre::ResourceBackgroundQueue::Listener override.
     virtual void operationCompleted(Ogre::BackgroundProcessTicket ticket, const Ogre::BackgroundProcessResult &result);
 
+    /// Executes raycasts of many rays to the CPU-side cached geometry, writing the result of ray i to results[i].
+    /** Traverses the kD-tree with packets of rays, so is faster than casting the rays one by one, the more so
+        the more coherent the rays are, f.ex. the rays of ambient occlusion from a point. */
+    void Raycast(const Ray *rays, int numRays, RayQueryResult *results);
+
     /// Loaded Ogre mesh asset, null if not loaded.
     Ogre::MeshPtr ogreMesh;
 
@@ -41,6 +49,9 @@ public slots:
     /// IAsset override.
     virtual bool IsLoaded() const;
 
+    /// Returns the size of the vertex and index data of the mesh. IAsset override.
+    virtual size_t MemoryUsage() const;
+
     /// Returns Ogres internal asset name.
     QString OgreMeshName() const;
 
@@ -56,6 +67,12 @@ public slots:
     /// Returns triangle count for submesh.
     int NumTris(int submeshIndex);
 
+    /// Returns the content hash of the source mesh data, which the data derived from the mesh is stored to the asset cache by. Empty if not known.
+    const QString &ContentHash() const { return contentHash_; }
+
+    /// Returns whether the kD-tree is being built in a worker thread, in which case Tri, NumTris and Raycast wait for it.
+    bool IsBuildingKdTree() const { return kdTreeBuild_.get() != 0; }
+
     /// Is this mesh a Assimp supported file type.
     bool IsAssimpFileType() const;
 
@@ -71,18 +88,53 @@ private:
     /// Unload mesh from Ogre. IAsset override.
     virtual void DoUnload();
 
-    /// Precomputes a kD-tree for the triangle data of this mesh.
+    /// Precomputes a kD-tree for the triangle data of this mesh, or reads it from the asset cache.
+    /** Waits for the background build if one was started. */
     void CreateKdTree();
 
+    /// Gathers the triangles of large meshes and starts building their kD-tree in a worker thread.
+    void StartKdTreeBuild();
+
+    /// Waits for the background kD-tree build to finish and takes its result into use.
+    void FinishKdTreeBuild();
+
+    /// Reads the triangles, normals and UVs of the mesh from the Ogre buffers, without building the kD-tree.
+    void GatherTriangles();
+
+    /// Stores the serialized kD-tree to the asset cache, if the content hash of the mesh is known.
+    void StoreKdTree(const std::vector<u8> &serialized);
+
+    /// Returns the asset cache name of the kD-tree for the source mesh data of the content hash.
+    static QString KdTreeCacheRef(const QString &contentHash);
+
     /// Process mesh data after loading to create tangents and such.
     bool GenerateMeshData();
 
+    /// Fills in the normal, the UV and the submesh of a raycast hit from its triangle index and barycentric UV.
+    void CompleteRaycastHit(RayQueryResult &result) const;
+
     /// Sets default material.
     void SetDefaultMaterial();
 
+    /// Returns whether Ogre's threaded loading can be used for loading the mesh from the asset cache.
+    bool AllowAsyncLoading() const;
+
+    /// Returns whether LOD levels are generated for meshes that have none, see the --meshLod command line parameter.
+    bool LodGenerationEnabled() const;
+
+    /// Generates LOD levels with edge-collapse decimation and sets the mesh to switch them by its screen size in pixels.
+    /** Returns false, and leaves the mesh as it is, if the mesh already has LOD levels, is animated or is too small to benefit from them. */
+    bool GenerateLodLevels();
+
+    /// Returns the asset cache name of the mesh with generated LOD levels for the source mesh data of the content hash.
+    static QString LodSidecarRef(const QString &contentHash);
+
     /// Ticket for ogres threaded loading operation.
     Ogre::BackgroundProcessTicket loadTicket_;
 
+    /// Content hash of the source mesh data, used for storing the generated LOD levels and the kD-tree to the asset cache. Empty if not known.
+    QString contentHash_;
+
     /// Stores a CPU-side version of the mesh geometry data (positions), for raycasting purposes.
     KdTree<Triangle> meshData;
 
@@ -94,4 +146,8 @@ private:
 
     /// Triangle counts per submesh.
     std::vector<int> subMeshTriangleCounts;
+
+    struct KdTreeBuild;
+    /// The kD-tree build running in a worker thread, null if none.
+    shared_ptr<KdTreeBuild> kdTreeBuild_;
 };
@@ -33,6 +33,9 @@ namespace Ogre
     class Bone;
     class InstancedEntity;
     class InstanceManager;
+    class StaticGeometry;
+    class MovableObject;
+    class AxisAlignedBox;
 }
 
 typedef shared_ptr<Ogre::Root> OgreRootPtr;
@@ -52,7 +55,17 @@ typedef OgreRenderer::RendererWeakPtr OgreRendererWeakPtr;
 
 class OgreCompositionHandler;
 class GaussianListener;
+class FramePacer;
+class GpuProfiler;
 class OgreWorld;
+class OcclusionCuller;
+class LightClusterer;
+class BillboardBatcher;
+class ParticleBudget;
+class ShaderCache;
+class ShadowMapCache;
+class SpatialWorld;
+class TextureStreamer;
 class UiPlane;
 class RenderWindow;
 
@@ -84,3 +97,4 @@ class EC_Fog;
 
 typedef shared_ptr<OgreWorld> OgreWorldPtr;
 typedef weak_ptr<OgreWorld> OgreWorldWeakPtr;
+typedef shared_ptr<SpatialWorld> SpatialWorldPtr;
@@ -20,16 +20,22 @@
 #include "EC_EnvironmentLight.h"
 #include "EC_Sky.h"
 #include "OgreWorld.h"
+#include "SpatialWorld.h"
 #include "OgreMeshAsset.h"
 #include "OgreParticleAsset.h"
 #include "OgreSkeletonAsset.h"
 #include "OgreMaterialAsset.h"
 #include "TextureAsset.h"
+#include "TextureStreamer.h"
+#include "OcclusionCuller.h"
+#include "ShadowMapCache.h"
 
 #include "Application.h"
 #include "Entity.h"
 #include "Scene/Scene.h"
 #include "AssetAPI.h"
+#include "IAssetTransfer.h"
+#include "IAssetTransferPrioritizer.h"
 #include "GenericAssetFactory.h"
 #include "NullAssetFactory.h"
 #include "Profiler.h"
@@ -51,6 +57,37 @@ namespace OgreRenderer
 
 std::string OgreRenderingModule::CACHE_RESOURCE_GROUP = "TundraAssetCache";
 
+namespace
+{
+
+/// Derives the priorities of asset transfers from the distance of the requesting entity to the main camera.
+class CameraDistancePrioritizer : public IAssetTransferPrioritizer
+{
+public:
+    explicit CameraDistancePrioritizer(Renderer *renderer_) : renderer(renderer_) {}
+
+    float DerivedPriority(IAssetTransfer *transfer)
+    {
+        EntityPtr requester = transfer->Requester();
+        Entity *camera = renderer->MainCamera();
+        if (!requester || !camera || requester->ParentScene() != camera->ParentScene())
+            return 0.f;
+        shared_ptr<EC_Placeable> requesterPlaceable = requester->Component<EC_Placeable>();
+        shared_ptr<EC_Placeable> cameraPlaceable = camera->Component<EC_Placeable>();
+        if (!requesterPlaceable || !cameraPlaceable)
+            return 0.f;
+
+        // 1 at the camera, 0.5 at 10 units, approaching 0 far away
+        float distance = requesterPlaceable->WorldPosition().Distance(cameraPlaceable->WorldPosition());
+        return 1.f / (1.f + distance * 0.1f);
+    }
+
+private:
+    Renderer *renderer;
+};
+
+} // ~unnamed namespace
+
 #ifdef OGRE_HAS_PROFILER_HOOKS
 
 #ifdef WIN32
@@ -187,6 +224,12 @@ void OgreRenderingModule::Initialize()
     framework_->RegisterRenderer(renderer.get());
     framework_->RegisterDynamicObject("renderer", renderer.get());
 
+    transferPrioritizer = MAKE_SHARED(CameraDistancePrioritizer, renderer.get());
+    framework_->Asset()->SetTransferPrioritizer(transferPrioritizer.get());
+
+    if (!framework_->IsHeadless() && framework_->HasCommandLineParameter("--textureStreaming"))
+        textureStreamer = MAKE_SHARED(TextureStreamer, framework_, renderer.get());
+
     // Connect to scene change signals.
     connect(framework_->Scene(), SIGNAL(SceneCreated(Scene *, AttributeChange::Type)), SLOT(CreateOgreWorld(Scene *)));
     connect(framework_->Scene(), SIGNAL(SceneAboutToBeRemoved(Scene *, AttributeChange::Type)), SLOT(RemoveOgreWorld(Scene *)));
@@ -203,9 +246,13 @@ void OgreRenderingModule::Initialize()
 
 void OgreRenderingModule::Uninitialize()
 {
+    textureStreamer.reset();
+
     // We're shutting down. Force a release of all loaded asset objects from the Asset API so that 
     // no refs to Ogre assets remain - below 'renderer.reset()' is going to delete Ogre::Root.
     framework_->Asset()->ForgetAllAssets();
+    framework_->Asset()->SetTransferPrioritizer(0);
+    transferPrioritizer.reset();
 
     // Clear up the renderer object, so that it will not be left dangling.
     framework_->RegisterRenderer(0);
@@ -224,6 +271,14 @@ void OgreRenderingModule::ConsoleStats()
         c->Print("Best FPS: " + QString::number(stats.bestFPS));
         c->Print("Triangles: " + QString::number(stats.triangleCount));
         c->Print("Batches: " + QString::number(stats.batchCount));
+        OgreWorldPtr world = renderer->GetActiveOgreWorld();
+        OcclusionCuller *culler = world ? world->OcclusionCulling() : 0;
+        if (culler)
+            c->Print(QString("Occlusion culling: %1 occluders, %2 of %3 meshes culled, %4 triangles saved").arg(culler->NumOccluders())
+                .arg(culler->NumOccluded()).arg(culler->NumTested()).arg(culler->NumOccludedTriangles()));
+        ShadowMapCache *shadowCache = world ? world->ShadowMapCaching() : 0;
+        if (shadowCache)
+            c->Print(QString("Shadow map caching: static casters rendered %1 times, reused %2 times").arg(shadowCache->NumRefreshes()).arg(shadowCache->NumReuses()));
         return;
     }
     else
@@ -249,6 +304,11 @@ void OgreRenderingModule::CreateOgreWorld(Scene *scene)
     OgreWorldPtr newWorld = MAKE_SHARED(OgreWorld, renderer.get(), scene->shared_from_this());
     renderer->ogreWorlds[scene] = newWorld;
     scene->setProperty(OgreWorld::PropertyName(), QVariant::fromValue<QObject*>(newWorld.get()));
+
+    // Add a SpatialWorld to the scene, also on a headless server
+    SpatialWorldPtr spatialWorld = MAKE_SHARED(SpatialWorld, scene->shared_from_this());
+    spatialWorlds[scene] = spatialWorld;
+    scene->setProperty(SpatialWorld::PropertyName(), QVariant::fromValue<QObject*>(spatialWorld.get()));
 }
 
 void OgreRenderingModule::RemoveOgreWorld(Scene *scene)
@@ -259,6 +319,11 @@ void OgreRenderingModule::RemoveOgreWorld(Scene *scene)
         scene->setProperty(OgreWorld::PropertyName(), QVariant());
         renderer->ogreWorlds.erase(scene);
     }
+    if (spatialWorlds.find(scene) != spatialWorlds.end())
+    {
+        scene->setProperty(SpatialWorld::PropertyName(), QVariant());
+        spatialWorlds.erase(scene);
+    }
 }
 
 void OgreRenderingModule::SetMaterialAttribute(const QStringList &params)
@@ -6,6 +6,9 @@
 #include "OgreModuleApi.h"
 #include "OgreModuleFwd.h"
 #include "SceneFwd.h"
+#include "AssetFwd.h"
+
+#include <map>
 
 namespace OgreRenderer
 {
@@ -32,6 +35,9 @@ namespace OgreRenderer
         /// Returns the renderer.
         const RendererPtr &Renderer() const { return renderer; }
 
+        /// Returns the texture streamer, or null if texture streaming is not enabled with --textureStreaming.
+        TextureStreamer *TextureStreaming() const { return textureStreamer.get(); }
+
         /// Ogre resource group for cached asset files.
         static std::string CACHE_RESOURCE_GROUP;
 
@@ -52,12 +58,15 @@ namespace OgreRenderer
         void SetMaterialAttribute(const QStringList &params);
 
     private slots:
-        /// Creates OgreWorld for a Scene.
+        /// Creates OgreWorld and SpatialWorld for a Scene.
         void CreateOgreWorld(Scene *scene);
-        /// Removes OgreWorld from a Scene.
+        /// Removes OgreWorld and SpatialWorld from a Scene.
         void RemoveOgreWorld(Scene *scene);
 
     private:
         RendererPtr renderer;  ///< Renderer
+        shared_ptr<IAssetTransferPrioritizer> transferPrioritizer; ///< Prioritizes the asset transfers by the distance of the requesters to the main camera
+        std::map<Scene*, SpatialWorldPtr> spatialWorlds; ///< Spatial worlds of the scenes
+        shared_ptr<TextureStreamer> textureStreamer; ///< Streams the mip levels of the textures, if enabled
     };
 }
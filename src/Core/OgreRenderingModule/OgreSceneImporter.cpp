@@ -27,6 +27,8 @@
 #include "SceneAPI.h"
 #include "CoreException.h"
 #include "FileUtils.h"
+#include "JobSystem.h"
+#include "Profiler.h"
 
 #include <Ogre.h>
 
@@ -36,6 +38,177 @@
 
 #include "MemoryLeakCheck.h"
 
+namespace
+{
+    // Chunk IDs of the OGRE .mesh format, see OgreMeshFileFormat.h.
+    const u16 cMeshHeaderChunk = 0x1000;
+    const u16 cMeshChunk = 0x3000;
+    const u16 cSubMeshChunk = 0x4000;
+    const u16 cSkeletonLinkChunk = 0x6000;
+    const u16 cFirstMeshSubChunk = 0x4000;
+    const u16 cLastMeshSubChunk = 0xE000;
+    const int cChunkHeaderSize = 6; // u16 ID and u32 length. The length includes the header.
+
+    /// Reads the scalars and strings of an OGRE .mesh file.
+    struct MeshDataReader
+    {
+        MeshDataReader(const QByteArray &data_) : data(data_), pos(0), swap(false) {}
+
+        bool ReadU16(u16 &value)
+        {
+            if (pos + (int)sizeof(u16) > data.size())
+                return false;
+            memcpy(&value, data.constData() + pos, sizeof(u16));
+            if (swap)
+                value = (u16)((value >> 8) | (value << 8));
+            pos += sizeof(u16);
+            return true;
+        }
+
+        bool ReadU32(u32 &value)
+        {
+            if (pos + (int)sizeof(u32) > data.size())
+                return false;
+            memcpy(&value, data.constData() + pos, sizeof(u32));
+            if (swap)
+                value = (value >> 24) | ((value >> 8) & 0xff00) | ((value << 8) & 0xff0000) | (value << 24);
+            pos += sizeof(u32);
+            return true;
+        }
+
+        /// Reads a newline-terminated string.
+        bool ReadString(QString &str)
+        {
+            int end = data.indexOf('\n', pos);
+            if (end < 0)
+                return false;
+            str = QString::fromUtf8(data.constData() + pos, end - pos);
+            pos = end + 1;
+            return true;
+        }
+
+        const QByteArray &data;
+        int pos;
+        bool swap; ///< Whether the file was written with the other endianness.
+    };
+
+    /// Reads the material names of the submeshes and the skeleton name of an OGRE .mesh file without Ogre.
+    /** Only walks the chunk headers, so that it is cheap and safe to call in any thread. The slashes of the material
+        names are replaced with underscores, like for the names inspected with Ogre.
+        @return False if the data is not a mesh file whose chunks are as expected. */
+    bool ReadMeshMaterialsAndSkeleton(const QByteArray &data, QStringList &materialNames, QString &skeletonName)
+    {
+        MeshDataReader reader(data);
+        u16 id;
+        if (!reader.ReadU16(id))
+            return false;
+        if (id != cMeshHeaderChunk)
+        {
+            if (id != (u16)((cMeshHeaderChunk >> 8) | (cMeshHeaderChunk << 8)))
+                return false;
+            reader.swap = true;
+        }
+        QString version;
+        if (!reader.ReadString(version) || !version.startsWith("[MeshSerializer_"))
+            return false;
+
+        const int meshStart = reader.pos;
+        u32 length;
+        if (!reader.ReadU16(id) || !reader.ReadU32(length) || id != cMeshChunk)
+            return false;
+        // The mesh chunk runs to the end of the file in practice, but clamp in case a writer left its length unset.
+        const int meshEnd = (length >= (u32)cChunkHeaderSize && length <= (u32)(data.size() - meshStart)) ? meshStart + (int)length : data.size();
+        ++reader.pos; // Skip the skeletally animated flag.
+
+        while(reader.pos + cChunkHeaderSize <= meshEnd)
+        {
+            const int chunkStart = reader.pos;
+            reader.ReadU16(id);
+            reader.ReadU32(length);
+            if (id < cFirstMeshSubChunk || id > cLastMeshSubChunk || length < (u32)cChunkHeaderSize || length > (u32)(meshEnd - chunkStart))
+                return false;
+            if (id == cSubMeshChunk)
+            {
+                QString materialName;
+                if (!reader.ReadString(materialName))
+                    return false;
+                materialNames.push_back(materialName.replace('/', '_'));
+            }
+            else if (id == cSkeletonLinkChunk)
+            {
+                if (!reader.ReadString(skeletonName))
+                    return false;
+            }
+            reader.pos = chunkStart + (int)length;
+        }
+        // The chunk lengths must add up to the mesh chunk, otherwise the layout was not understood.
+        return reader.pos == meshEnd;
+    }
+
+    /// Mesh file to inspect for its materials and skeleton.
+    struct MeshInspection
+    {
+        MeshInspection() : inspected(false) {}
+
+        QString meshFile; ///< Mesh file name as in the document.
+        QString path; ///< Resolved local path of the mesh file.
+        QStringList materialNames;
+        QString skeletonName;
+        bool inspected; ///< Whether the file was read and understood. If not, the mesh is inspected with Ogre afterwards.
+    };
+
+    /// Reads and inspects the mesh files in the threads of ParallelFor.
+    class MeshInspector : public IParallelForBody
+    {
+    public:
+        explicit MeshInspector(std::vector<MeshInspection> &meshes_) : meshes(meshes_) {}
+        void Run(int begin, int end)
+        {
+            for(int i = begin; i < end; ++i)
+            {
+                MeshInspection &mesh = meshes[i];
+                QFile file(mesh.path);
+                if (file.open(QFile::ReadOnly))
+                    mesh.inspected = ReadMeshMaterialsAndSkeleton(file.readAll(), mesh.materialNames, mesh.skeletonName);
+                if (!mesh.inspected)
+                {
+                    mesh.materialNames.clear();
+                    mesh.skeletonName.clear();
+                }
+            }
+        }
+
+    private:
+        std::vector<MeshInspection> &meshes;
+    };
+
+    /// Loads the material scripts of the files in the threads of ParallelFor.
+    class MaterialFileLoader : public IParallelForBody
+    {
+    public:
+        explicit MaterialFileLoader(const QStringList &files_) : files(files_), materials(files_.size()) {}
+        void Run(int begin, int end)
+        {
+            for(int i = begin; i < end; ++i)
+                materials[i] = OgreRenderer::LoadAllMaterialsFromFile(files[i]);
+        }
+
+        const QStringList &files;
+        std::vector<std::set<OgreRenderer::MaterialInfo> > materials; ///< Materials of each file.
+    };
+}
+
+/// Entity node of a dotscene, collected for the inspection of the meshes and the creation of the entities.
+struct OgreSceneImporter::ImportNode
+{
+    QString name; ///< Unique name of the node.
+    QString meshFile; ///< Mesh file name as in the document.
+    bool castShadows;
+    bool hasSubentities; ///< Whether the materials were named in subentity elements. If not, they are read from the mesh.
+    QVector<QString> materials; ///< Material references of the subentity elements.
+    Transform transform; ///< World transform of the node.
+};
+
 OgreSceneImporter::OgreSceneImporter(const ScenePtr &scene) :
     scene_(scene)
 {
@@ -215,9 +388,12 @@ QList<Entity *> OgreSceneImporter::Import(const QString &filename, const QString
         
         QDomElement node_elem = nodes_elem.firstChildElement("node");
         
-        // First pass: get used assets
+        // First pass: collect the entity nodes and their transforms, and get used assets
         LogDebug("OgreSceneImporter::Import: Processing scene for assets");
-        ProcessNodeForAssets(node_elem, in_asset_dir);
+        std::vector<ImportNode> nodes;
+        Quat rot = worldtransform.Orientation();
+        ProcessNodeForImport(nodes, node_elem, worldtransform.pos, rot, worldtransform.scale, prefix, flipyz);
+        InspectMeshes(nodes, in_asset_dir);
         
         // Write out the needed assets
         LogDebug("OgreSceneImporter::Import: Saving needed assets");
@@ -249,8 +425,7 @@ QList<Entity *> OgreSceneImporter::Import(const QString &filename, const QString
         // Second pass: build scene hierarchy and actually create entities. This assumes assets are available
         LogDebug("OgreSceneImporter::Import: Creating entities");
 
-        Quat rot = worldtransform.Orientation();
-        ProcessNodeForCreation(ret, node_elem, worldtransform.pos, rot, worldtransform.scale, change, prefix, flipyz, replace);
+        CreateNodeEntities(ret, nodes, change, prefix, replace);
     }
     catch(Exception& e)
     {
@@ -277,6 +452,13 @@ bool OgreSceneImporter::ParseMeshForMaterialsAndSkeleton(const QString& meshname
     {
         QByteArray mesh_bytes = mesh_in.readAll();
         mesh_in.close();
+
+        // Read the names from the chunks if the layout is understood, which does not need the renderer
+        if (ReadMeshMaterialsAndSkeleton(mesh_bytes, material_names, skeleton_name))
+            return true;
+        material_names.clear();
+        skeleton_name.clear();
+
         OgreRendererPtr renderer = scene_->GetFramework()->Module<OgreRenderingModule>()->Renderer();
         if (!renderer)
         {
@@ -575,58 +757,8 @@ SceneDesc OgreSceneImporter::CreateSceneDescFromScene(const QString &filename)
     return sceneDesc;
 }
 
-void OgreSceneImporter::ProcessNodeForAssets(QDomElement node_elem, const QString& in_asset_dir)
-{
-    while(!node_elem.isNull())
-    {
-        // Process entity node, if any
-        QDomElement entity_elem = node_elem.firstChildElement("entity");
-        if (!entity_elem.isNull())
-        {
-            QString mesh_name = entity_elem.attribute("meshFile");
-            // Store the original name. Later we fix duplicates.
-            mesh_names_[mesh_name] = mesh_name;
-            QDomElement subentities_elem = entity_elem.firstChildElement("subentities");
-            if (!subentities_elem.isNull())
-            {
-                QDomElement subentity_elem = subentities_elem.firstChildElement("subentity");
-                while(!subentity_elem.isNull())
-                {
-                    QString material_name = subentity_elem.attribute("materialName");
-                    material_names_.insert(material_name);
-                    subentity_elem = subentity_elem.nextSiblingElement("subentity");
-                }
-            }
-            else
-            {
-                // If no subentity element, have to interrogate the mesh.
-                QStringList material_names;
-                QString skeleton_name;
-                QString meshRef;
-
-                AssetAPI::FileQueryResult result = scene_->GetFramework()->Asset()->ResolveLocalAssetPath(mesh_name, in_asset_dir, meshRef);
-                if (result == AssetAPI::FileQueryLocalFileMissing)
-                    LogWarning("Mesh file \"" + mesh_name + "\" cannot be found from path \"" + in_asset_dir + "\"!");
-
-                ParseMeshForMaterialsAndSkeleton(meshRef, material_names, skeleton_name);
-                for(uint i = 0; i < (uint)material_names.size(); ++i)
-                    material_names_.insert(material_names[i]);
-                mesh_default_materials_[mesh_name] = material_names;
-            }
-        }
-
-        // Process child nodes
-        QDomElement childnode_elem = node_elem.firstChildElement("node");
-        if (!childnode_elem.isNull())
-            ProcessNodeForAssets(childnode_elem, in_asset_dir);
-
-        // Process siblings
-        node_elem = node_elem.nextSiblingElement("node");
-    }
-}
-
-void OgreSceneImporter::ProcessNodeForCreation(QList<Entity* > &entities, QDomElement node_elem, float3 pos, Quat rot, float3 scale,
-    AttributeChange::Type change, const QString &prefix, bool flipyz, bool replace)
+void OgreSceneImporter::ProcessNodeForImport(std::vector<ImportNode> &nodes, QDomElement node_elem, float3 pos, Quat rot, float3 scale,
+    const QString &prefix, bool flipyz)
 {
     while(!node_elem.isNull())
     {
@@ -673,6 +805,8 @@ void OgreSceneImporter::ProcessNodeForCreation(QList<Entity* > &entities, QDomEl
         QDomElement entity_elem = node_elem.firstChildElement("entity");
         if (!entity_elem.isNull())
         {
+            ImportNode node;
+
             // Enforce uniqueness for node names, which may not be guaranteed by artists
             QString base_node_name = node_elem.attribute("name");
             if (base_node_name.isEmpty())
@@ -685,123 +819,181 @@ void OgreSceneImporter::ProcessNodeForCreation(QList<Entity* > &entities, QDomEl
                 ++append_num;
             }
             node_names_.insert(node_name);
-            
-            // Get mesh name from map
-            QString orig_mesh_name = entity_elem.attribute("meshFile");
-            QString mesh_name = mesh_names_[orig_mesh_name];
-            
-            bool cast_shadows = ::ParseBool(entity_elem.attribute("castShadows"));
+            node.name = node_name;
 
-            mesh_name = prefix + mesh_name;
+            node.meshFile = entity_elem.attribute("meshFile");
+            // Store the original name. Later we fix duplicates.
+            mesh_names_[node.meshFile] = node.meshFile;
+            node.castShadows = ::ParseBool(entity_elem.attribute("castShadows"));
 
-            EntityPtr entity;
-            bool new_entity = false;
-            QString node_name_qstr = node_name;
+            QDomElement subentities_elem = entity_elem.firstChildElement("subentities");
+            node.hasSubentities = !subentities_elem.isNull();
+            if (node.hasSubentities)
+            {
+                QDomElement subentity_elem = subentities_elem.firstChildElement("subentity");
+                while(!subentity_elem.isNull())
+                {
+                    material_names_.insert(subentity_elem.attribute("materialName"));
+
+                    QString material_name = subentity_elem.attribute("materialName") + ".material";
+                    material_name.replace('/', '_');
 
-            // Try to find existing entity by name
-            if (replace)
-                entity = scene_->GetEntityByName(node_name_qstr);
+                    int index = subentity_elem.attribute("index").toInt();
+                    material_name = prefix + material_name;
+                    if (index >= node.materials.size())
+                        node.materials.resize(index + 1);
+                    node.materials[index] = material_name;
 
-            if (!entity)
+                    subentity_elem = subentity_elem.nextSiblingElement("subentity");
+                }
+            }
+
+            /// \todo Allow any transformation of coordinate axes, not just fixed y/z flip
+            if (flipyz)
             {
-                entity = scene_->CreateEntity(scene_->NextFreeId());
-                new_entity = true;
+                Quat adjustedrot(-newrot.x, newrot.z, newrot.y, newrot.w);
+                adjustedrot = Quat::FromEulerZYX(0, pi, 0) * adjustedrot;
+                node.transform.SetPos(-newpos.x, newpos.z, newpos.y);
+                node.transform.SetOrientation(adjustedrot);
+                node.transform.SetScale(newscale.x, newscale.z, newscale.y);
             }
             else
             {
-                LogInfo("Updating existing entity " + node_name);
+                node.transform.SetPos(newpos);
+                node.transform.SetOrientation(newrot);
+                node.transform.SetScale(newscale);
             }
 
-            if (entity)
-            {
-                shared_ptr<EC_Mesh> meshPtr = entity->GetOrCreateComponent<EC_Mesh>("", change);
-                shared_ptr<EC_Name> namePtr = entity->GetOrCreateComponent<EC_Name>("", change);
-                shared_ptr<EC_Placeable> placeablePtr = entity->GetOrCreateComponent<EC_Placeable>("", change);
-                assert(meshPtr && namePtr && placeablePtr);
-                if (meshPtr && namePtr && placeablePtr)
-                {
-                    namePtr->name.Set(node_name_qstr, change);
-                    
-                    QVector<QString> materials;
-                    QDomElement subentities_elem = entity_elem.firstChildElement("subentities");
-                    if (!subentities_elem.isNull())
-                    {
-                        QDomElement subentity_elem = subentities_elem.firstChildElement("subentity");
-                        while(!subentity_elem.isNull())
-                        {
-                            QString material_name = subentity_elem.attribute("materialName") + ".material";
-                            material_name.replace('/', '_');
-
-                            int index = subentity_elem.attribute("index").toInt();
-                            material_name = prefix + material_name;
-                            if (index >= materials.size())
-                                materials.resize(index + 1);
-                            materials[index] = material_name;
-
-                            subentity_elem = subentity_elem.nextSiblingElement("subentity");
-                        }
-                    }
-                    else
-                    {
-                        // If no subentity element, use the inspected material names we stored earlier
-                        const QStringList& default_materials = mesh_default_materials_[orig_mesh_name];
-                        materials.resize(default_materials.size());
-                        for(uint i = 0; i < (uint)default_materials.size(); ++i)
-                            materials[i] =  prefix + default_materials[i] + ".material";
-                    }
-                    
-                    Transform entity_transform;
-                    
-                    /// \todo Allow any transformation of coordinate axes, not just fixed y/z flip
-                    if (flipyz)
-                    {
-                        float3 rot_euler;
-                        Quat adjustedrot(-newrot.x, newrot.z, newrot.y, newrot.w);
-                        adjustedrot = Quat::FromEulerZYX(0, pi, 0) * adjustedrot;
-                        entity_transform.SetPos(-newpos.x, newpos.z, newpos.y);
-                        entity_transform.SetOrientation(adjustedrot);
-                        entity_transform.SetScale(newscale.x, newscale.z, newscale.y);
-                    }
-                    else
-                    {
-                        entity_transform.SetPos(newpos);
-                        entity_transform.SetOrientation(newrot);
-                        entity_transform.SetScale(newscale);
-                    }
-
-                    placeablePtr->transform.Set(entity_transform, change);
-                    meshPtr->meshRef.Set(AssetReference(mesh_name), change);
-
-                    AssetReferenceList materialRefs;
-                    foreach(QString material, materials)
-                        materialRefs.Append(AssetReference(material));
-
-                    meshPtr->meshMaterial.Set(materialRefs, change);
-                    meshPtr->castShadows.Set(cast_shadows, change);
-
-                    if (new_entity)
-                        scene_->EmitEntityCreated(entity.get(), change);
-                    placeablePtr->ComponentChanged(change);
-                    meshPtr->ComponentChanged(change);
-                    namePtr->ComponentChanged(change);
-
-                    entities.append(entity.get());
-                }
-                else
-                    LogError("Could not create mesh, placeable, name components");
-            }
+            nodes.push_back(node);
         }
 
         // Process child nodes
         QDomElement childnode_elem = node_elem.firstChildElement("node");
         if (!childnode_elem.isNull())
-            ProcessNodeForCreation(entities, childnode_elem, newpos, newrot, newscale, change, prefix, flipyz, replace);
+            ProcessNodeForImport(nodes, childnode_elem, newpos, newrot, newscale, prefix, flipyz);
 
         // Process siblings
         node_elem = node_elem.nextSiblingElement("node");
     }
 }
 
+void OgreSceneImporter::InspectMeshes(const std::vector<ImportNode> &nodes, const QString& in_asset_dir)
+{
+    PROFILE(OgreSceneImporter_InspectMeshes);
+
+    // If no subentity element, have to interrogate the mesh. Do it once for each mesh however many nodes use it.
+    std::vector<MeshInspection> meshes;
+    QSet<QString> meshFiles;
+    for(size_t i = 0; i < nodes.size(); ++i)
+    {
+        if (nodes[i].hasSubentities || meshFiles.contains(nodes[i].meshFile))
+            continue;
+        meshFiles.insert(nodes[i].meshFile);
+
+        MeshInspection mesh;
+        mesh.meshFile = nodes[i].meshFile;
+        AssetAPI::FileQueryResult result = scene_->GetFramework()->Asset()->ResolveLocalAssetPath(mesh.meshFile, in_asset_dir, mesh.path);
+        if (result == AssetAPI::FileQueryLocalFileMissing)
+            LogWarning("Mesh file \"" + mesh.meshFile + "\" cannot be found from path \"" + in_asset_dir + "\"!");
+        meshes.push_back(mesh);
+    }
+    if (meshes.empty())
+        return;
+
+    MeshInspector inspector(meshes);
+    JobSystem *jobs = scene_->GetFramework()->Jobs();
+    if (jobs)
+        jobs->ParallelFor(0, (int)meshes.size(), inspector, 1, "OgreSceneImporter_InspectMeshes");
+    else
+        inspector.Run(0, (int)meshes.size());
+
+    for(size_t i = 0; i < meshes.size(); ++i)
+    {
+        // Fall back to Ogre for the meshes that could not be read in the jobs. It logs the errors, too.
+        if (!meshes[i].inspected)
+            ParseMeshForMaterialsAndSkeleton(meshes[i].path, meshes[i].materialNames, meshes[i].skeletonName);
+        for(int j = 0; j < meshes[i].materialNames.size(); ++j)
+            material_names_.insert(meshes[i].materialNames[j]);
+        mesh_default_materials_[meshes[i].meshFile] = meshes[i].materialNames;
+    }
+}
+
+void OgreSceneImporter::CreateNodeEntities(QList<Entity *> &entities, const std::vector<ImportNode> &nodes, AttributeChange::Type change,
+    const QString &prefix, bool replace)
+{
+    PROFILE(OgreSceneImporter_CreateNodeEntities);
+
+    // Try to find existing entities by name, and create the rest with one call
+    std::vector<EntityPtr> nodeEntities(nodes.size());
+    uint numNew = 0;
+    for(size_t i = 0; i < nodes.size(); ++i)
+    {
+        if (replace)
+            nodeEntities[i] = scene_->GetEntityByName(nodes[i].name);
+        if (!nodeEntities[i])
+            ++numNew;
+        else
+            LogInfo("Updating existing entity " + nodes[i].name);
+    }
+    EntityList newEntities = scene_->CreateEntities(numNew, QStringList() << EC_Mesh::TypeNameStatic() <<
+        EC_Name::TypeNameStatic() << EC_Placeable::TypeNameStatic(), change);
+    EntityList::const_iterator newIter = newEntities.begin();
+
+    for(size_t i = 0; i < nodes.size(); ++i)
+    {
+        const ImportNode &node = nodes[i];
+        EntityPtr entity = nodeEntities[i];
+        bool new_entity = false;
+        if (!entity && newIter != newEntities.end())
+        {
+            entity = *newIter++;
+            new_entity = true;
+        }
+        if (!entity)
+            continue;
+
+        shared_ptr<EC_Mesh> meshPtr = entity->GetOrCreateComponent<EC_Mesh>("", change);
+        shared_ptr<EC_Name> namePtr = entity->GetOrCreateComponent<EC_Name>("", change);
+        shared_ptr<EC_Placeable> placeablePtr = entity->GetOrCreateComponent<EC_Placeable>("", change);
+        assert(meshPtr && namePtr && placeablePtr);
+        if (!meshPtr || !namePtr || !placeablePtr)
+        {
+            LogError("Could not create mesh, placeable, name components");
+            continue;
+        }
+
+        QVector<QString> materials = node.materials;
+        if (!node.hasSubentities)
+        {
+            // If no subentity element, use the inspected material names we stored earlier
+            const QStringList& default_materials = mesh_default_materials_[node.meshFile];
+            materials.resize(default_materials.size());
+            for(uint j = 0; j < (uint)default_materials.size(); ++j)
+                materials[j] = prefix + default_materials[j] + ".material";
+        }
+
+        AssetReferenceList materialRefs;
+        foreach(QString material, materials)
+            materialRefs.Append(AssetReference(material));
+
+        // The new entities are replicated with all their attributes when their creation is signaled at the end of the frame,
+        // so only the local handlers of their components need to be told of the changes.
+        AttributeChange::Type attrChange = new_entity ? AttributeChange::Disconnected : change;
+        namePtr->name.Set(node.name, attrChange);
+        placeablePtr->transform.Set(node.transform, attrChange);
+        meshPtr->meshRef.Set(AssetReference(prefix + mesh_names_[node.meshFile]), attrChange);
+        meshPtr->meshMaterial.Set(materialRefs, attrChange);
+        meshPtr->castShadows.Set(node.castShadows, attrChange);
+
+        AttributeChange::Type componentChange = (new_entity && change != AttributeChange::Disconnected) ? AttributeChange::LocalOnly : change;
+        placeablePtr->ComponentChanged(componentChange);
+        meshPtr->ComponentChanged(componentChange);
+        namePtr->ComponentChanged(componentChange);
+
+        entities.append(entity.get());
+    }
+}
+
 void OgreSceneImporter::ProcessNodeForDesc(SceneDesc &desc, QDomElement nodeElement, float3 pos, Quat rot, float3 scale, const QString &prefix, bool flipyz, 
     QStringList &meshFiles, QStringList &skeletonFiles, QSet<QString> &usedMaterials, const QString &parentRef)
 {
@@ -1021,13 +1213,32 @@ void OgreSceneImporter::CreateAssetDescs(const QString &path, const QStringList
         desc.assets[qMakePair(ad.source, ad.subname)] = ad;
     }
 
-    // Get all materials scripts from all material script files.
-    std::set<OgreRenderer::MaterialInfo> allMaterials;
+    // Get all materials scripts from all material script files, parsing the files in parallel.
+    // The files that cannot be read are left to the main thread, which logs the errors.
+    QStringList readableFiles;
     foreach(QString filename, materialFiles)
     {
-        std::set<OgreRenderer::MaterialInfo> mats = OgreRenderer::LoadAllMaterialsFromFile(filename);
-        allMaterials.insert(mats.begin(), mats.end());
+        QFileInfo fileInfo(filename);
+        if (fileInfo.isReadable() && fileInfo.size() > 0)
+            readableFiles << filename;
+        else
+            OgreRenderer::LoadAllMaterialsFromFile(filename);
     }
+    MaterialFileLoader loader(readableFiles);
+    JobSystem *jobs = scene_->GetFramework()->Jobs();
+    if (jobs)
+        jobs->ParallelFor(0, readableFiles.size(), loader, 1, "OgreSceneImporter_LoadMaterials");
+    else
+        loader.Run(0, readableFiles.size());
+
+    std::set<OgreRenderer::MaterialInfo> allMaterials;
+    for(size_t i = 0; i < loader.materials.size(); ++i)
+        allMaterials.insert(loader.materials[i].begin(), loader.materials[i].end());
+
+    // Index the materials by name. Of materials with the same name, the one of the last source file is used.
+    QHash<QString, const OgreRenderer::MaterialInfo *> materialsByName;
+    for(std::set<OgreRenderer::MaterialInfo>::const_iterator it = allMaterials.begin(); it != allMaterials.end(); ++it)
+        materialsByName[it->name] = &*it;
 
     // Find the used materials and create material assets descs even if the files don't exist.
     foreach(QString matName, usedMaterials)
@@ -1038,14 +1249,14 @@ void OgreSceneImporter::CreateAssetDescs(const QString &path, const QStringList
         ad.dataInMemory = true;
         ad.destinationName = matName + ".material";
 
-        foreach(OgreRenderer::MaterialInfo mat, allMaterials)
-            if (mat.name == matName)
-            {
-                ad.source = mat.source;
-                ad.data = mat.data.toAscii();
-            }
+        const OgreRenderer::MaterialInfo *mat = materialsByName.value(matName, 0);
+        if (mat)
+        {
+            ad.source = mat->source;
+            ad.data = mat->data.toAscii();
+        }
 
-            desc.assets[qMakePair(ad.source, ad.subname)] = ad;
+        desc.assets[qMakePair(ad.source, ad.subname)] = ad;
     }
 
     // Process materials for textures.
@@ -10,6 +10,8 @@
 #include "SceneFwd.h"
 #include "AttributeChangeType.h"
 
+#include <vector>
+
 class Transform;
 class Quat;
 class float3;
@@ -76,22 +78,31 @@ public:
 private:
     Q_DISABLE_COPY(OgreSceneImporter)
 
-    /// Process the asset references of a node, and its child nodes
-    /** @param nodeElem Node element. */
-    void ProcessNodeForAssets(QDomElement nodeElem, const QString& inAssetDir);
+    struct ImportNode;
 
-    /// Process node and its child nodes for creation of entities & components. Done after asset pass
-    /** @param [out] entities List of created entities
+    /// Process node and its child nodes for their entities, asset references and world transforms
+    /** @param [out] nodes Entity nodes, in document order
         @param nodeElem Node element
         @param pos Current position
         @param rot Current rotation
         @param scale Current scale
+        @param prefix Asset storage prefix to be added to the material references
+        @param flipyz Whether to switch y/z axes from Ogre to OpenSim convention */
+    void ProcessNodeForImport(std::vector<ImportNode> &nodes, QDomElement nodeElem, float3 pos, Quat rot, float3 scale,
+        const QString &prefix, bool flipyz);
+
+    /// Inspects the meshes of the nodes without subentity elements for their materials, each distinct mesh once.
+    /** The mesh files are read and inspected in parallel in the job system. */
+    void InspectMeshes(const std::vector<ImportNode> &nodes, const QString &inAssetDir);
+
+    /// Creates or updates the entities & components of the nodes. Done after the inspection of the meshes
+    /** @param [out] entities List of created entities
+        @param nodes Entity nodes
         @param change What changetype to use in scene operations
-        @param flipyz Whether to switch y/z axes from Ogre to OpenSim convention
-        @param prefix 
+        @param prefix Asset storage prefix to be added to the mesh references
         @param replace Whether to replace contents of entities by name. If false, all entities will be created as new. */
-    void ProcessNodeForCreation(QList<Entity *> &entities, QDomElement nodeElem, float3 pos, Quat rot, float3 scale,
-        AttributeChange::Type change, const QString &prefix, bool flipyz, bool replace);
+    void CreateNodeEntities(QList<Entity *> &entities, const std::vector<ImportNode> &nodes, AttributeChange::Type change,
+        const QString &prefix, bool replace);
 
     /// Process node and its child nodes for creation of scene description.
     /// @todo Implement and use in CreateSceneDescFromScene
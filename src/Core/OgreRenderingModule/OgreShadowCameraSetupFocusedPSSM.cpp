@@ -5,7 +5,17 @@
 #include "MemoryLeakCheck.h"
 #include "OgreShadowCameraSetupFocusedPSSM.h"
 
-OgreShadowCameraSetupFocusedPSSM::OgreShadowCameraSetupFocusedPSSM() : mSplitPadding(1.0f)
+namespace
+{
+/// Distance the cache camera can move from its position at the refresh of a split, as a fraction of the far distance of the split.
+const float cCacheMoveTolerance = 0.05f;
+/// Angle the cache camera can turn from its direction at the refresh of a split.
+const Ogre::Degree cCacheTurnTolerance(3.f);
+/// Angle the light direction can change from its direction at the refresh of a split.
+const Ogre::Degree cCacheLightTolerance(0.5f);
+}
+
+OgreShadowCameraSetupFocusedPSSM::OgreShadowCameraSetupFocusedPSSM() : mSplitPadding(1.0f), mCacheCamera(0)
 {
     calculateSplitPoints(3, 100, 100000);
 }
@@ -34,6 +44,7 @@ void OgreShadowCameraSetupFocusedPSSM::calculateSplitPoints(size_t splitCount, f
         mSplitPoints[i] = splitPoint;
     }
     mSplitPoints[splitCount] = farDist;
+    mCachedSplits.assign(mSplitCount, CachedSplit());
 }
 
 void OgreShadowCameraSetupFocusedPSSM::setSplitPoints(const SplitPointList& newSplitPoints)
@@ -44,6 +55,13 @@ void OgreShadowCameraSetupFocusedPSSM::setSplitPoints(const SplitPointList& newS
     mSplitCount = newSplitPoints.size() - 1;
     mSplitPoints = newSplitPoints;
     mOptimalAdjustFactors.resize(mSplitCount);
+    mCachedSplits.assign(mSplitCount, CachedSplit());
+}
+
+void OgreShadowCameraSetupFocusedPSSM::invalidateCache()
+{
+    for(size_t i = 0; i < mCachedSplits.size(); ++i)
+        mCachedSplits[i].valid = false;
 }
 
 float OgreShadowCameraSetupFocusedPSSM::getOptimalAdjustFactor() const
@@ -66,6 +84,31 @@ void OgreShadowCameraSetupFocusedPSSM::getShadowCamera(const Ogre::SceneManager
 
     mCurrentIteration = iteration;
 
+    // The first split is always rendered in full, it is small and has most of the dynamic casters.
+    CachedSplit *cached = (mCacheCamera && cam == mCacheCamera && iteration > 0 && iteration < mCachedSplits.size()) ? &mCachedSplits[iteration] : 0;
+    if (iteration < mCachedSplits.size())
+    {
+        mCachedSplits[iteration].cached = (cached != 0);
+        mCachedSplits[iteration].refreshed = false;
+    }
+    if (cached && cached->valid &&
+        cached->cameraPosition.distance(cam->getDerivedPosition()) <= cCacheMoveTolerance * farDist &&
+        cached->cameraDirection.dotProduct(cam->getDerivedDirection()) >= Ogre::Math::Cos(cCacheTurnTolerance) &&
+        cached->lightDirection.dotProduct(light->getDerivedDirection()) >= Ogre::Math::Cos(cCacheLightTolerance))
+    {
+        texCam->setNearClipDistance(cached->nearClip);
+        texCam->setFarClipDistance(cached->farClip);
+        texCam->setCustomViewMatrix(true, cached->viewMatrix);
+        texCam->setCustomProjectionMatrix(true, cached->projMatrix);
+        return;
+    }
+    // Pad the cached split by the move tolerance, so that it still covers the view when the camera has moved.
+    if (cached)
+    {
+        nearDist = std::max(mSplitPoints[0], nearDist - cCacheMoveTolerance * farDist);
+        farDist += cCacheMoveTolerance * farDist;
+    }
+
     // Ouch, I know this is hacky, but it's the easiest way to re-use LiSPSM / Focussed
     // functionality right now without major changes
     Ogre::Camera* _cam = const_cast<Ogre::Camera*>(cam);
@@ -79,4 +122,17 @@ void OgreShadowCameraSetupFocusedPSSM::getShadowCamera(const Ogre::SceneManager
     // restore near/far
     _cam->setNearClipDistance(oldNear);
     _cam->setFarClipDistance(oldFar);
+
+    if (cached)
+    {
+        cached->valid = true;
+        cached->refreshed = true;
+        cached->viewMatrix = texCam->getViewMatrix();
+        cached->projMatrix = texCam->getProjectionMatrix();
+        cached->nearClip = texCam->getNearClipDistance();
+        cached->farClip = texCam->getFarClipDistance();
+        cached->cameraPosition = cam->getDerivedPosition();
+        cached->cameraDirection = cam->getDerivedDirection();
+        cached->lightDirection = light->getDerivedDirection();
+    }
 }
@@ -52,11 +52,44 @@ public:
     /// Overridden, recommended internal use only since depends on current iteration
     float getOptimalAdjustFactor() const;
 
+    /// Sets the camera whose shadow cameras of the splits after the first one are cached, or null to disable the caching.
+    /** While the camera stays within a tolerance of its position and direction at the last refresh of a split, and the light
+        direction does not change, the split reuses the shadow camera of the refresh, so that the static casters rendered
+        then stay valid. @see ShadowMapCache */
+    void setCacheCamera(const Ogre::Camera *cam) { mCacheCamera = cam; }
+
+    /// Forces the cached splits to be refreshed on their next setup, e.g. when the static casters have changed.
+    void invalidateCache();
+
+    /// Returns whether the split was last set up for the cache camera, i.e. whether it uses the cached shadow camera.
+    bool isSplitCached(size_t splitIndex) const { return splitIndex < mCachedSplits.size() && mCachedSplits[splitIndex].cached; }
+
+    /// Returns whether the cached shadow camera of the split was refreshed in its last setup, so that the static casters need to be rendered again.
+    bool isSplitRefreshed(size_t splitIndex) const { return splitIndex < mCachedSplits.size() && mCachedSplits[splitIndex].refreshed; }
+
 protected:
+    /// Shadow camera of a split stored at its last refresh.
+    struct CachedSplit
+    {
+        CachedSplit() : valid(false), cached(false), refreshed(false), nearClip(0.f), farClip(0.f) {}
+        bool valid;
+        bool cached;
+        bool refreshed;
+        Ogre::Matrix4 viewMatrix;
+        Ogre::Matrix4 projMatrix;
+        float nearClip;
+        float farClip;
+        Ogre::Vector3 cameraPosition;
+        Ogre::Vector3 cameraDirection;
+        Ogre::Vector3 lightDirection;
+    };
+
     size_t mSplitCount;
     SplitPointList mSplitPoints;
     OptimalAdjustFactorList mOptimalAdjustFactors;
     float mSplitPadding;
     mutable size_t mCurrentIteration;
+    const Ogre::Camera *mCacheCamera;
+    mutable std::vector<CachedSplit> mCachedSplits;
 };
 /** @endcond */
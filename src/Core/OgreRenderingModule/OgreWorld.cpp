@@ -11,11 +11,19 @@
 #include "EC_Camera.h"
 #include "EC_Placeable.h"
 #include "EC_Mesh.h"
+#include "EC_Billboard.h"
+#include "BillboardBatcher.h"
 #include "OgreCompositionHandler.h"
 #include "OgreShadowCameraSetupFocusedPSSM.h"
 #include "OgreBulletCollisionsDebugLines.h"
 #include "OgreMaterialAsset.h"
 #include "OgreMeshAsset.h"
+#include "OgreSkeletonAsset.h"
+#include "OcclusionCuller.h"
+#include "LightClusterer.h"
+#include "ParticleBudget.h"
+#include "ShadowMapCache.h"
+#include "SpatialWorld.h"
 
 #include "OgreMeshAsset.h"
 #include "Entity.h"
@@ -45,6 +53,59 @@
 
 #include "MemoryLeakCheck.h"
 
+namespace
+{
+/// Seconds a static geometry cell must go without changes before it is rebuilt.
+const float cStaticGeometrySettleTime = 0.5f;
+
+/// Intersects a ray with a billboard of the given world size that faces the camera.
+/** @param camWorldTransform World transform of the camera the billboards face.
+    @param d [out] Distance of the hit along the ray.
+    @param hitPos [out] World position of the hit.
+    @param uv [out] Coordinates of the hit on the billboard, from 0 to 1.
+    @return True if the ray hits the billboard within maxDistance. */
+bool IntersectBillboard(const Ray &ray, const float3 &worldPos, float w, float h, const float3x4 &camWorldTransform, float maxDistance,
+    float &d, float3 &hitPos, float2 &uv)
+{
+    float3 billboardFrontDir = camWorldTransform.Col(2).Normalized(); // The -direction this camera views in world space. (In Ogre, like common in OpenGL, cameras view towards -Z in their local space).
+    float3 cameraUpDir = camWorldTransform.Col(1).Normalized(); // The direction of the up vector of the camera in world space.
+    float3 cameraRightDir = camWorldTransform.Col(0).Normalized(); // The direction of the right vector of the camera in world space.
+
+    Plane billboardPlane(worldPos, billboardFrontDir); // The plane of this billboard in world space.
+    if (!billboardPlane.Intersects(ray, &d) || d > maxDistance)
+        return false;
+
+    hitPos = ray.GetPoint(d); // The point where the ray intersects the plane of the billboard.
+
+    // Compute the 3D world space -> local normalized 2D (x,y) coordinate frame mapping for this billboard.
+    float3x3 m(w*0.5f*cameraRightDir, h*0.5f*cameraUpDir, billboardFrontDir);
+    bool success = m.InverseColOrthogonal();
+    assume(success);
+    if (!success)
+        return false;
+
+    // Compute the 2D coordinates of the ray hit on the billboard plane.
+    const float3 hit = m * (hitPos - worldPos);
+
+    /* Test code: To visualize the borders of the billboards, do this:
+    float3 tl = worldPos - w*0.5f*cameraRightDir + h*0.5f*cameraUpDir;
+    float3 tr = worldPos + w*0.5f*cameraRightDir + h*0.5f*cameraUpDir;
+    float3 bl = worldPos - w*0.5f*cameraRightDir - h*0.5f*cameraUpDir;
+    float3 br = worldPos + w*0.5f*cameraRightDir - h*0.5f*cameraUpDir;
+
+    DebugDrawLineSegment(LineSegment(tl, tr), 1,1,0);
+    DebugDrawLineSegment(LineSegment(tr, br), 1,0,0);
+    DebugDrawLineSegment(LineSegment(br, bl), 1,0,0);
+    DebugDrawLineSegment(LineSegment(bl, tl), 1,0,0); */
+
+    // The visible range of the billboard is normalized to [-1,1] in x & y. See if the hit is inside the billboard.
+    if (hit.x < -1.f || hit.x > 1.f || hit.y < -1.f || hit.y > 1.f)
+        return false;
+    uv = float2((hit.x + 1.f) * 0.5f, (hit.y + 1.f) * 0.5f);
+    return true;
+}
+}
+
 struct RaycastResultLessThan
 {
     bool operator()(const RaycastResult *left, const RaycastResult *right ) const
@@ -61,7 +122,11 @@ OgreWorld::OgreWorld(OgreRenderer::Renderer* renderer, ScenePtr scene) :
     rayQuery_(0),
     debugLines_(0),
     debugLinesNoDepth_(0),
-    drawDebugInstancing_(false)
+    drawDebugInstancing_(false),
+    autoInstancingThreshold_(16),
+    staticGeometryCellSize_(250.f),
+    shadowTextureSize_(0),
+    shadowResolutionScale_(1.f)
 {
     assert(renderer_->IsInitialized());
     sceneManager_ = Ogre::Root::getSingleton().createSceneManager(Ogre::ST_GENERIC, scene->Name().toStdString());
@@ -93,6 +158,14 @@ OgreWorld::OgreWorld(OgreRenderer::Renderer* renderer, ScenePtr scene) :
         sceneManager_->getRootSceneNode()->attachObject(debugLines_);
         sceneManager_->getRootSceneNode()->attachObject(debugLinesNoDepth_);
         debugLinesNoDepth_->setRenderQueueGroup(Ogre::RENDER_QUEUE_OVERLAY);
+
+        if (framework_->HasCommandLineParameter("--occlusionCulling"))
+            occlusionCuller_ = MAKE_SHARED(OcclusionCuller, this);
+        // Created after the occlusion culler, so that the culler listens to the entities first and the clusterer chains to it.
+        if (framework_->HasCommandLineParameter("--clusteredLights"))
+            lightClusterer_ = MAKE_SHARED(LightClusterer, this);
+        if (!framework_->HasCommandLineParameter("--noBillboardBatching"))
+            billboardBatcher_ = MAKE_SHARED(BillboardBatcher, this);
     }
 
     connect(framework_->Frame(), SIGNAL(Updated(float)), this, SLOT(OnUpdated(float)));
@@ -145,7 +218,19 @@ OgreWorld::~OgreWorld()
         *i = 0;
     }
     rayResults_.clear();
+    for(size_t i = 0; i < rayBatchResults_.size(); ++i)
+        delete rayBatchResults_[i];
+    rayBatchResults_.clear();
     
+    // The entities of the static geometry are destroyed by their components, only the batches are left here.
+    foreach(StaticGeometryCell *cell, staticGeometryCells_)
+    {
+        if (cell->geometry)
+            sceneManager_->destroyStaticGeometry(cell->geometry);
+        delete cell;
+    }
+    staticGeometryCells_.clear();
+
     if (debugLines_)
     {
         sceneManager_->getRootSceneNode()->detachObject(debugLines_);
@@ -168,6 +253,16 @@ OgreWorld::~OgreWorld()
     if (shaderGenerator)
         shaderGenerator->removeSceneManager(sceneManager_);
 #endif
+    // Forget the particle systems before they are destroyed with the scene manager.
+    if (renderer_->Particles())
+        renderer_->Particles()->UnregisterSceneManager(sceneManager_);
+    // Remove the clusterer and the culler from the listeners of the entities before they are destroyed with the scene manager.
+    lightClusterer_.reset();
+    occlusionCuller_.reset();
+    // The cache listens to the shadow textures of the scene manager.
+    shadowMapCache_.reset();
+    // The batches destroy their billboard sets.
+    billboardBatcher_.reset();
     Ogre::Root::getSingleton().destroySceneManager(sceneManager_);
 }
 
@@ -197,12 +292,24 @@ void OgreWorld::SetDefaultSceneFog()
         renderer_->MainViewport()->setBackgroundColour(Color::Black);
 }
 
-Ogre::InstancedEntity *OgreWorld::CreateInstance(IComponent *owner, const QString &meshRef, const AssetReferenceList &materials, float drawDistance, bool castShadows)
+Ogre::InstancedEntity *OgreWorld::CreateInstance(IComponent *owner, const QString &meshRef, const AssetReferenceList &materials, float drawDistance, bool castShadows,
+    const QString &skeletonRef)
 {
-    return CreateInstance(owner, framework_->Asset()->GetAsset(meshRef), materials, drawDistance, castShadows);
+    AssetPtr skeletonAsset;
+    if (!skeletonRef.trimmed().isEmpty())
+    {
+        skeletonAsset = framework_->Asset()->GetAsset(skeletonRef.trimmed());
+        if (!skeletonAsset.get())
+        {
+            LogError(QString("OgreWorld::CreateInstance: Cannot create instance for %1, skeleton %2 is not loaded!").arg(meshRef).arg(skeletonRef));
+            return 0;
+        }
+    }
+    return CreateInstance(owner, framework_->Asset()->GetAsset(meshRef), materials, drawDistance, castShadows, skeletonAsset);
 }
 
-Ogre::InstancedEntity *OgreWorld::CreateInstance(IComponent *owner, const AssetPtr &meshAsset, const AssetReferenceList &materials, float drawDistance, bool castShadows)
+Ogre::InstancedEntity *OgreWorld::CreateInstance(IComponent *owner, const AssetPtr &meshAsset, const AssetReferenceList &materials, float drawDistance, bool castShadows,
+    const AssetPtr &skeletonAsset)
 {
     PROFILE(OgreWorld_CreateInstance);
 
@@ -219,6 +326,33 @@ Ogre::InstancedEntity *OgreWorld::CreateInstance(IComponent *owner, const AssetP
     if (!mesh || !mesh->IsLoaded())
         return 0;
 
+    // Skinned instances share the skeleton of the Ogre mesh, set it like EC_Mesh does for the non-instanced entities.
+    const bool skinned = skeletonAsset.get() != 0;
+    if (skinned)
+    {
+        OgreSkeletonAsset *skeleton = dynamic_cast<OgreSkeletonAsset*>(skeletonAsset.get());
+        if (!skeleton || !skeleton->IsLoaded() || skeleton->ogreSkeleton.isNull())
+        {
+            LogError(QString("OgreWorld::CreateInstance: Cannot create instance for %1, skeleton %2 is not loaded!").arg(mesh->Name()).arg(skeletonAsset->Name()));
+            return 0;
+        }
+        if (!IsSkinnedInstancingSupported())
+        {
+            LogError(QString("OgreWorld::CreateInstance: Cannot create skinned instance for %1, the render system does not support vertex texture fetch!").arg(mesh->Name()));
+            return 0;
+        }
+        try
+        {
+            if (mesh->ogreMesh->getSkeletonName() != skeleton->ogreSkeleton->getName())
+                mesh->ogreMesh->_notifySkeleton(skeleton->ogreSkeleton);
+        }
+        catch (Ogre::Exception &e)
+        {
+            LogError(QString("OgreWorld::CreateInstance: Failed to set skeleton %1 to %2: %3").arg(skeleton->Name()).arg(mesh->Name()).arg(e.what()));
+            return 0;
+        }
+    }
+
     int submeshCount = static_cast<int>(mesh->ogreMesh->getNumSubMeshes());
 
     // Verify materials have been loaded. Use 'AssetLoadError' from Tundras core
@@ -244,7 +378,7 @@ Ogre::InstancedEntity *OgreWorld::CreateInstance(IComponent *owner, const AssetP
 
             // This function will clone the current material if needed for instancing use.
             // If it returns empty string it means something went wrong so bail out.
-            materialRef = PrepareInstancingMaterial(material);
+            materialRef = (skinned ? PrepareSkinnedInstancingMaterial(material) : PrepareInstancingMaterial(material));
             if (materialRef.isEmpty())
             {
                 LogError(QString("OgreWorld::CreateInstance: Cannot create instance for %1, material in index %2 could not be prepared").arg(mesh->Name()).arg(i));
@@ -252,7 +386,7 @@ Ogre::InstancedEntity *OgreWorld::CreateInstance(IComponent *owner, const AssetP
             }
         }
         else
-            materialRef = "Tundra/Instancing/HWBasic/Empty";
+            materialRef = (skinned ? "Tundra/Instancing/HWVTF/Empty" : "Tundra/Instancing/HWBasic/Empty");
 
         instanceMaterials << materialRef;
     }
@@ -264,7 +398,7 @@ Ogre::InstancedEntity *OgreWorld::CreateInstance(IComponent *owner, const AssetP
     {
         for (int i=0; i<submeshCount; ++i)
         {
-            MeshInstanceTarget *target = GetOrCreateInstanceMeshTarget(mesh->OgreMeshName(), i);
+            MeshInstanceTarget *target = GetOrCreateInstanceMeshTarget(mesh->OgreMeshName(), i, skinned);
             Ogre::InstancedEntity *instance = target->CreateInstance(sceneManager_, i, instanceMaterials[i], mainInstance);
 
             instance->setRenderingDistance(drawDistance);
@@ -298,6 +432,274 @@ Ogre::InstancedEntity *OgreWorld::CreateInstance(IComponent *owner, const AssetP
     return mainInstance;
 }
 
+bool OgreWorld::CanAutoInstance(const AssetPtr &meshAsset, const AssetReferenceList &materials, const AssetPtr &skeletonAsset)
+{
+    OgreMeshAsset *mesh = dynamic_cast<OgreMeshAsset*>(meshAsset.get());
+    if (!mesh || !mesh->IsLoaded() || mesh->ogreMesh.isNull() || mesh->ogreMesh->sharedVertexData != 0)
+        return false;
+    const bool skinned = skeletonAsset.get() != 0;
+    if (skinned && !IsSkinnedInstancingSupported())
+        return false;
+
+    Ogre::HighLevelGpuProgramManager *programs = Ogre::HighLevelGpuProgramManager::getSingletonPtr();
+    const int submeshCount = static_cast<int>(mesh->ogreMesh->getNumSubMeshes());
+    for (int i=0; i<submeshCount && i<materials.Size(); ++i)
+    {
+        QString materialRef = materials[i].ref.trimmed();
+        if (materialRef.isEmpty())
+            continue;
+        OgreMaterialAsset *material = dynamic_cast<OgreMaterialAsset*>(framework_->Asset()->GetAsset(materialRef).get());
+        if (!material || !material->IsLoaded())
+            return false;
+        // Materials without shaders get the basic instancing shaders, which light them like the fixed function pipeline.
+        QString VS = material->VertexShader(0, 0).trimmed();
+        if (VS.isEmpty())
+            continue;
+        if (skinned)
+            return false;
+        if (VS.contains("instanced", Qt::CaseInsensitive) || VS.contains("instancing", Qt::CaseInsensitive))
+            continue;
+        // Falling back to the basic instancing shaders would lose the look of the material.
+        if (!programs || programs->getByName((VS + "/Instanced").toStdString()).isNull())
+            return false;
+    }
+    return true;
+}
+
+void OgreWorld::SetAutoInstancingKey(EC_Mesh *mesh, const QString &key)
+{
+    if (!mesh)
+        return;
+    const QString oldKey = autoInstancingKeys_.value(mesh);
+    if (oldKey == key)
+        return;
+
+    if (!oldKey.isEmpty())
+    {
+        QSet<EC_Mesh*> &population = autoInstancingPopulations_[oldKey];
+        population.remove(mesh);
+        if (population.isEmpty())
+        {
+            autoInstancingPopulations_.remove(oldKey);
+            autoInstancedKeys_.remove(oldKey);
+        }
+        else
+            UpdateAutoInstancing(oldKey);
+    }
+
+    if (key.isEmpty())
+    {
+        autoInstancingKeys_.remove(mesh);
+        return;
+    }
+
+    autoInstancingKeys_[mesh] = key;
+    autoInstancingPopulations_[key].insert(mesh);
+    UpdateAutoInstancing(key);
+    mesh->SetAutoInstanced(autoInstancedKeys_.contains(key));
+}
+
+void OgreWorld::UpdateAutoInstancing(const QString &key)
+{
+    QHash<QString, QSet<EC_Mesh*> >::const_iterator iter = autoInstancingPopulations_.find(key);
+    if (iter == autoInstancingPopulations_.end())
+        return;
+
+    const int count = iter->size();
+    const bool instanced = autoInstancedKeys_.contains(key);
+    bool instance = false;
+    if (autoInstancingThreshold_ > 0)
+        instance = (instanced ? count >= std::max(autoInstancingThreshold_ / 2, 1) : count >= autoInstancingThreshold_);
+    if (instance == instanced)
+        return;
+
+    if (instance)
+        autoInstancedKeys_.insert(key);
+    else
+        autoInstancedKeys_.remove(key);
+    LogDebug(QString("OgreWorld: %1 automatic instancing for %2 meshes of %3").arg(instance ? "Enabling" : "Disabling").arg(count).arg(key));
+
+    // Copy the population, as switching the meshes may change it.
+    const QSet<EC_Mesh*> population = *iter;
+    foreach(EC_Mesh *mesh, population)
+        mesh->SetAutoInstanced(instance);
+}
+
+void OgreWorld::SetAutoInstancingThreshold(int threshold)
+{
+    threshold = std::max(threshold, 0);
+    if (threshold == autoInstancingThreshold_)
+        return;
+    autoInstancingThreshold_ = threshold;
+
+    const QList<QString> keys = autoInstancingPopulations_.keys();
+    foreach(const QString &key, keys)
+        UpdateAutoInstancing(key);
+}
+
+bool OgreWorld::IsSkinnedInstancingSupported() const
+{
+    Ogre::RenderSystem *renderSystem = Ogre::Root::getSingleton().getRenderSystem();
+    return renderSystem && renderSystem->getCapabilities() && renderSystem->getCapabilities()->hasCapability(Ogre::RSC_VERTEX_TEXTURE_FETCH);
+}
+
+void OgreWorld::SetStaticGeometryMember(EC_Mesh *mesh, bool isStatic)
+{
+    if (!mesh || !sceneManager_)
+        return;
+
+    const QString oldKey = staticGeometryMembers_.value(mesh);
+    const QString key = (isStatic ? StaticGeometryCellKey(mesh) : QString());
+    if (!oldKey.isEmpty())
+    {
+        // The mesh has changed or is removed. Show the meshes of the cell as entities until the cell is rebuilt.
+        StaticGeometryCell *cell = staticGeometryCells_.value(oldKey);
+        if (cell)
+        {
+            cell->members.remove(mesh);
+            UnbakeStaticGeometryCell(cell);
+            cell->dirty = true;
+            cell->timeSinceChange = 0.f;
+        }
+        staticGeometryMembers_.remove(mesh);
+    }
+    if (key.isEmpty())
+        return;
+
+    StaticGeometryCell *&cell = staticGeometryCells_[key];
+    if (!cell)
+        cell = new StaticGeometryCell();
+    cell->members.insert(mesh);
+    cell->dirty = true;
+    cell->timeSinceChange = 0.f;
+    staticGeometryMembers_[mesh] = key;
+}
+
+QString OgreWorld::StaticGeometryCellKey(EC_Mesh *mesh) const
+{
+    Ogre::Entity *entity = mesh->OgreEntity();
+    Ogre::SceneNode *node = (entity ? entity->getParentSceneNode() : 0);
+    if (!node)
+        return "";
+    const Ogre::Vector3 &pos = node->_getDerivedPosition();
+    return QString("%1_%2_%3_%4_%5").arg((int)floor(pos.x / staticGeometryCellSize_)).arg((int)floor(pos.y / staticGeometryCellSize_))
+        .arg((int)floor(pos.z / staticGeometryCellSize_)).arg(mesh->castShadows.Get() ? 1 : 0).arg(mesh->drawDistance.Get());
+}
+
+void OgreWorld::UnbakeStaticGeometryCell(StaticGeometryCell *cell)
+{
+    // The static casters change, so the cached shadows of them must be rendered again.
+    if (shadowMapCache_ && (!cell->baked.isEmpty() || cell->geometry))
+        shadowMapCache_->Invalidate();
+    foreach(Ogre::Entity *entity, cell->baked)
+    {
+        staticGeometryBaked_.remove(entity);
+        entity->setVisibilityFlags(Ogre::MovableObject::getDefaultVisibilityFlags());
+    }
+    cell->baked.clear();
+    if (cell->geometry)
+        cell->geometry->reset();
+}
+
+void OgreWorld::RebuildStaticGeometryCell(const QString &key, StaticGeometryCell *cell)
+{
+    PROFILE(OgreWorld_RebuildStaticGeometryCell);
+
+    UnbakeStaticGeometryCell(cell);
+    cell->dirty = false;
+    if (cell->members.isEmpty())
+    {
+        if (cell->geometry)
+            sceneManager_->destroyStaticGeometry(cell->geometry);
+        staticGeometryCells_.remove(key);
+        delete cell;
+        return;
+    }
+
+    try
+    {
+        if (!cell->geometry)
+            cell->geometry = sceneManager_->createStaticGeometry(GenerateUniqueObjectName("OgreWorld_StaticGeometry"));
+
+        // The members of a cell have the same shadow casting and draw distance, they are in the key.
+        EC_Mesh *first = *cell->members.begin();
+        cell->geometry->setCastShadows(first->castShadows.Get());
+        cell->geometry->setRenderingDistance(first->drawDistance.Get());
+        if (shadowMapCache_)
+            cell->geometry->setVisibilityFlags(~ShadowMapCache::DynamicCasterFlag);
+
+        // StaticGeometry groups the submeshes of the entities by their materials.
+        foreach(EC_Mesh *mesh, cell->members)
+        {
+            Ogre::Entity *entity = mesh->OgreEntity();
+            Ogre::SceneNode *node = (entity ? entity->getParentSceneNode() : 0);
+            if (!node)
+                continue;
+            cell->geometry->addEntity(entity, node->_getDerivedPosition(), node->_getDerivedOrientation(), node->_getDerivedScale());
+            cell->baked << entity;
+        }
+        cell->geometry->build();
+    }
+    catch(Ogre::Exception &e)
+    {
+        LogError(QString("OgreWorld::RebuildStaticGeometryCell: Failed to build static geometry for %1 meshes: %2").arg(cell->members.size()).arg(e.what()));
+        if (cell->geometry)
+            cell->geometry->reset();
+        cell->baked.clear();
+        return;
+    }
+
+    foreach(Ogre::Entity *entity, cell->baked)
+    {
+        entity->setVisibilityFlags(0);
+        staticGeometryBaked_.insert(entity);
+    }
+}
+
+void OgreWorld::UpdateStaticGeometry(float timeStep)
+{
+    if (staticGeometryCells_.isEmpty())
+        return;
+
+    PROFILE(OgreWorld_UpdateStaticGeometry);
+
+    // Ogre builds the hardware buffers of the batches, which must happen in the main thread.
+    // Spread the cost over the frames by rebuilding at most one settled cell per frame.
+    QString rebuildKey;
+    StaticGeometryCell *rebuildCell = 0;
+    for(QHash<QString, StaticGeometryCell*>::iterator iter = staticGeometryCells_.begin(); iter != staticGeometryCells_.end(); ++iter)
+    {
+        StaticGeometryCell *cell = iter.value();
+        if (!cell->dirty)
+            continue;
+        cell->timeSinceChange += timeStep;
+        if (!rebuildCell && cell->timeSinceChange >= cStaticGeometrySettleTime)
+        {
+            rebuildKey = iter.key();
+            rebuildCell = cell;
+        }
+    }
+    if (rebuildCell)
+        RebuildStaticGeometryCell(rebuildKey, rebuildCell);
+}
+
+void OgreWorld::SetStaticGeometryCellSize(float size)
+{
+    size = std::max(size, 1.f);
+    if (size == staticGeometryCellSize_)
+        return;
+    staticGeometryCellSize_ = size;
+
+    const QList<EC_Mesh*> members = staticGeometryMembers_.keys();
+    foreach(EC_Mesh *mesh, members)
+        SetStaticGeometryMember(mesh, true);
+}
+
+bool OgreWorld::IsOccluded(const Ogre::MovableObject *object) const
+{
+    return occlusionCuller_ && occlusionCuller_->IsOccluded(object);
+}
+
 QList<Ogre::InstancedEntity*> OgreWorld::ChildInstances(Ogre::InstancedEntity *parent)
 {
     QList<Ogre::InstancedEntity*> children;
@@ -345,14 +747,14 @@ void OgreWorld::DestroyInstance(Ogre::InstancedEntity* instance)
     }
 }
 
-MeshInstanceTarget *OgreWorld::GetOrCreateInstanceMeshTarget(const QString &meshRef, int submesh)
+MeshInstanceTarget *OgreWorld::GetOrCreateInstanceMeshTarget(const QString &meshRef, int submesh, bool skinned)
 {
     PROFILE(OgreWorld_GetOrCreateInstanceMeshTarget);
 
     for (int i=0; i<instancingTargets_.size(); ++i)
     {
         MeshInstanceTarget *target = instancingTargets_[i];
-        if (target->ref.compare(meshRef, Qt::CaseSensitive) == 0)
+        if (target->skinned == skinned && target->ref.compare(meshRef, Qt::CaseSensitive) == 0)
             return target;
     }
 
@@ -364,7 +766,7 @@ MeshInstanceTarget *OgreWorld::GetOrCreateInstanceMeshTarget(const QString &mesh
         throw ::Exception("Cannot create instances with Ogre::Mesh that uses shared vertexes!");
 
     // No target for the mesh ref exists.
-    MeshInstanceTarget *target = new MeshInstanceTarget(meshRef, MeshInstanceCount(meshRef));
+    MeshInstanceTarget *target = new MeshInstanceTarget(meshRef, MeshInstanceCount(meshRef), false, skinned);
     instancingTargets_ << target;
     return target;
 }
@@ -476,6 +878,64 @@ QString OgreWorld::PrepareInstancingMaterial(OgreMaterialAsset *material)
     return material->ogreAssetName;
 }
 
+QString OgreWorld::PrepareSkinnedInstancingMaterial(OgreMaterialAsset *material)
+{
+    // The shaders of the material can not be used with the vertex texture fetch, so the clone is made from the VTF instancing material.
+    QString cloneRef = material->Name().replace(".material", "_Cloned_InstancingVTF.material", Qt::CaseInsensitive);
+    AssetPtr clone = framework_->Asset()->GetAsset(cloneRef);
+    if (clone.get())
+    {
+        OgreMaterialAsset *clonedMaterial = dynamic_cast<OgreMaterialAsset*>(clone.get());
+        return (clonedMaterial != 0 ? clonedMaterial->ogreAssetName : "");
+    }
+
+    Ogre::MaterialPtr vtfMaterial = Ogre::MaterialManager::getSingleton().getByName("Tundra/Instancing/HWVTF/Empty");
+    if (vtfMaterial.isNull())
+    {
+        LogError("OgreWorld::CreateInstance: Could not find the skinned instancing material Tundra/Instancing/HWVTF/Empty!");
+        return "";
+    }
+
+    // Use the first texture of the material as the diffuse map.
+    std::string diffuseMap = "TextureMissing.png";
+    Ogre::Material *ogreMat = material->ogreMaterial.get();
+    if (ogreMat && ogreMat->getNumTechniques() > 0 && ogreMat->getTechnique(0)->getNumPasses() > 0)
+    {
+        Ogre::Pass *pass = ogreMat->getTechnique(0)->getPass(0);
+        for (ushort i = 0; i < pass->getNumTextureUnitStates(); ++i)
+        {
+            const std::string &textureName = pass->getTextureUnitState(i)->getTextureName();
+            if (!textureName.empty())
+            {
+                diffuseMap = textureName;
+                break;
+            }
+        }
+    }
+
+    clone = material->Clone(cloneRef);
+    OgreMaterialAsset *clonedMaterial = dynamic_cast<OgreMaterialAsset*>(clone.get());
+    if (!clonedMaterial || clonedMaterial->ogreMaterial.isNull())
+    {
+        LogError(QString("OgreWorld::CreateInstance: Failed to clone material '%1' with skinned instancing shaders!").arg(material->Name()));
+        return "";
+    }
+
+    try
+    {
+        vtfMaterial->copyDetailsTo(clonedMaterial->ogreMaterial);
+        Ogre::AliasTextureNamePairList aliases;
+        aliases["DiffuseMap"] = diffuseMap;
+        clonedMaterial->ogreMaterial->applyTextureAliases(aliases);
+    }
+    catch (Ogre::Exception &e)
+    {
+        LogError(QString("OgreWorld::CreateInstance: Failed to clone material '%1' with skinned instancing shaders: %2").arg(material->Name()).arg(e.what()));
+        return "";
+    }
+    return clonedMaterial->ogreAssetName;
+}
+
 RaycastResult* OgreWorld::Raycast(int x, int y)
 {
     return Raycast(x, y, 0xffffffff, FLOAT_INF);
@@ -590,13 +1050,74 @@ QList<RaycastResult*> OgreWorld::RaycastAll(const Ray& ray, unsigned layerMask,
     return rayHits_;
 }
 
+QList<RaycastResult*> OgreWorld::RaycastBatch(const QList<Ray> &rays, unsigned layerMask, float maxDistance)
+{
+    PROFILE(OgreWorld_RaycastBatch);
+
+    QList<RaycastResult*> batch;
+    for(int i = 0; i < rays.size(); ++i)
+    {
+        while(rayBatchResults_.size() <= (size_t)i)
+            rayBatchResults_.push_back(new RaycastResult());
+        RaycastResult *dst = rayBatchResults_[i];
+        const RaycastResult *src = Raycast(rays[i], layerMask, maxDistance);
+        dst->entity = src->entity;
+        dst->component = src->component;
+        dst->pos = src->pos;
+        dst->normal = src->normal;
+        dst->submesh = src->submesh;
+        dst->index = src->index;
+        dst->u = src->u;
+        dst->v = src->v;
+        dst->t = src->t;
+        batch.push_back(dst);
+    }
+    return batch;
+}
+
+void OgreWorld::QuerySpatialRaycastCandidates(SpatialWorld *spatialWorld, const Ray &ray, float maxDistance, Ogre::RaySceneQueryResult &results)
+{
+    std::vector<EC_Placeable*> placeables;
+    spatialWorld->Query(ray, maxDistance, placeables);
+    for(size_t i = 0; i < placeables.size(); ++i)
+    {
+        std::vector<shared_ptr<EC_Mesh> > meshes = placeables[i]->ParentEntity()->ComponentsOfType<EC_Mesh>();
+        for(size_t j = 0; j < meshes.size(); ++j)
+        {
+            Ogre::Entity *meshEntity = meshes[j]->OgreEntity();
+            if (!meshEntity || !meshEntity->isInScene() || !(meshEntity->getQueryFlags() & SpatialRaycastQueryFlag))
+                continue;
+            float dNear, dFar;
+            if (!meshes[j]->WorldAABB().Intersects(ray, dNear, dFar) || dNear > maxDistance)
+                continue;
+            Ogre::RaySceneQueryResultEntry entry;
+            entry.distance = std::max(dNear, 0.f);
+            entry.movable = meshEntity;
+            entry.worldFragment = 0;
+            results.push_back(entry);
+        }
+    }
+}
+
 void OgreWorld::RaycastInternal(unsigned layerMask, float maxDistance, bool getAllResults)
 {
     PROFILE(OgreWorld_Raycast);
     
     Ray ray = rayQuery_->getRay();
     
+    // The mesh entities are found through the bounding volume hierarchy of the SpatialWorld, and left out of the Ogre
+    // ray scene query, which tests the bounds of every object in the scene. The rest, e.g. billboards, terrain and
+    // mesh attachments, are still found by the Ogre query.
+    ScenePtr scene = scene_.lock();
+    SpatialWorldPtr spatialWorld = scene ? scene->Subsystem<SpatialWorld>() : SpatialWorldPtr();
+    rayQuery_->setQueryMask(spatialWorld ? ~SpatialRaycastQueryFlag : 0xffffffff);
     Ogre::RaySceneQueryResult &results = rayQuery_->execute();
+    if (spatialWorld)
+    {
+        PROFILE(OgreWorld_Raycast_SpatialWorld);
+        QuerySpatialRaycastCandidates(spatialWorld.get(), ray, maxDistance, results);
+        std::sort(results.begin(), results.end());
+    }
     float closestDistance = -1.0f;
     size_t hitIndex = 0;
     
@@ -611,10 +1132,18 @@ void OgreWorld::RaycastInternal(unsigned layerMask, float maxDistance, bool getA
         if (!entry.movable)
             continue;
 
-        // No result for invisible entity
-        if (!entry.movable->isVisible())
+        // No result for invisible entity. The entities in static geometry and the occluded ones are hidden, but still hit.
+        if (!entry.movable->isVisible() && !staticGeometryBaked_.contains(entry.movable) && !IsOccluded(entry.movable))
             continue;
         
+        // The batched billboards of many entities share a billboard set, which has no component of its own.
+        if (billboardBatcher_ && billboardBatcher_->IsBatch(entry.movable))
+        {
+            if (getAllResults || closestDistance < 0.0f || entry.distance <= closestDistance)
+                RaycastBillboardBatch(static_cast<Ogre::BillboardSet*>(entry.movable), ray, layerMask, maxDistance, getAllResults, closestDistance, hitIndex);
+            continue;
+        }
+
         const Ogre::Any& any = entry.movable->getUserAny();
         if (any.isEmpty())
             continue;
@@ -707,10 +1236,6 @@ void OgreWorld::RaycastInternal(unsigned layerMask, float maxDistance, bool getA
             {
                 float3x4 camWorldTransform = float4x4(renderer_->MainOgreCamera()->getParentSceneNode()->_getFullTransform()).Float3x4Part();
 
-                float3 billboardFrontDir = camWorldTransform.Col(2).Normalized(); // The -direction this camera views in world space. (In Ogre, like common in OpenGL, cameras view towards -Z in their local space).
-                float3 cameraUpDir = camWorldTransform.Col(1).Normalized(); // The direction of the up vector of the camera in world space.
-                float3 cameraRightDir = camWorldTransform.Col(0).Normalized(); // The direction of the right vector of the camera in world space.
-
                 Ogre::Matrix4 w_;
                 bbs->getWorldTransforms(&w_);
                 float3x4 world = float4x4(w_).Float3x4Part(); // The world transform of the whole billboard set.
@@ -722,56 +1247,31 @@ void OgreWorld::RaycastInternal(unsigned layerMask, float maxDistance, bool getA
                 {
                     Ogre::Billboard *b = bbs->getBillboard(i);
                     float3 worldPos = world.MulPos(b->getPosition()); // A point on this billboard in world space. (@todo assuming this is the center point, but Ogre can use others!)
-                    Plane billboardPlane(worldPos, billboardFrontDir); // The plane of this billboard in world space.
+                    float w = (b->hasOwnDimensions() ? b->getOwnWidth() : bbs->getDefaultWidth()) * world.Col(0).Length();
+                    float h = (b->hasOwnDimensions() ? b->getOwnHeight() : bbs->getDefaultHeight()) * world.Col(1).Length();
                     float d;
-                    bool success = billboardPlane.Intersects(ray, &d);
-                    if (!success || d > maxDistance)
+                    float3 intersectionPoint;
+                    float2 uv;
+                    if (!IntersectBillboard(ray, worldPos, w, h, camWorldTransform, maxDistance, d, intersectionPoint, uv))
                         continue;
                     if (!getAllResults && closestDistance > 0.0f && d >= closestDistance)
                         continue;
                     if (hasHit && d > closestBillboardDistance)
                         continue;
 
-                    float3 intersectionPoint = ray.GetPoint(d); // The point where the ray intersects the plane of the billboard.
-
-                    // Compute the 3D world space -> local normalized 2D (x,y) coordinate frame mapping for this billboard.
-                    float w = (b->hasOwnDimensions() ? b->getOwnWidth() : bbs->getDefaultWidth()) * world.Col(0).Length();
-                    float h = (b->hasOwnDimensions() ? b->getOwnHeight() : bbs->getDefaultHeight()) * world.Col(1).Length();
-                    float3x3 m(w*0.5f*cameraRightDir, h*0.5f*cameraUpDir, billboardFrontDir);
-                    success = m.InverseColOrthogonal();
-                    assume(success);
-
-                    // Compute the 2D coordinates of the ray hit on the billboard plane.
-                    const float3 hit = m * (intersectionPoint - worldPos);
-
-                    /* Test code: To visualize the borders of the billboards, do this:
-                    float3 tl = worldPos - w*0.5f*cameraRightDir + h*0.5f*cameraUpDir;
-                    float3 tr = worldPos + w*0.5f*cameraRightDir + h*0.5f*cameraUpDir;
-                    float3 bl = worldPos - w*0.5f*cameraRightDir - h*0.5f*cameraUpDir;
-                    float3 br = worldPos + w*0.5f*cameraRightDir - h*0.5f*cameraUpDir;
-
-                    DebugDrawLineSegment(LineSegment(tl, tr), 1,1,0);
-                    DebugDrawLineSegment(LineSegment(tr, br), 1,0,0);
-                    DebugDrawLineSegment(LineSegment(br, bl), 1,0,0);
-                    DebugDrawLineSegment(LineSegment(bl, tl), 1,0,0); */
-
-                    // The visible range of the billboard is normalized to [-1,1] in x & y. See if the hit is inside the billboard.
-                    if (hit.x >= -1.f && hit.x <= 1.f && hit.y >= -1.f && hit.y <= 1.f)
-                    {
-                        closestDistance = d;
-                        closestBillboardDistance = d;
-                        hasHit = true;
-                        RaycastResult* result = GetOrCreateRaycastResult(hitIndex);
-                        result->entity = entity;
-                        result->component = component;
-                        result->pos = intersectionPoint;
-                        result->normal = billboardFrontDir;
-                        result->submesh = i; // Store in the 'submesh' index the index of the individual billboard we hit.
-                        result->index = (unsigned int)-1; // Not applicable for billboards.
-                        result->u = (hit.x + 1.f) * 0.5f;
-                        result->v = (hit.y + 1.f) * 0.5f;
-                        result->t = d;
-                    }
+                    closestDistance = d;
+                    closestBillboardDistance = d;
+                    hasHit = true;
+                    RaycastResult* result = GetOrCreateRaycastResult(hitIndex);
+                    result->entity = entity;
+                    result->component = component;
+                    result->pos = intersectionPoint;
+                    result->normal = camWorldTransform.Col(2).Normalized();
+                    result->submesh = i; // Store in the 'submesh' index the index of the individual billboard we hit.
+                    result->index = (unsigned int)-1; // Not applicable for billboards.
+                    result->u = uv.x;
+                    result->v = uv.y;
+                    result->t = d;
                 }
                 if (hasHit)
                 {
@@ -813,6 +1313,50 @@ void OgreWorld::RaycastInternal(unsigned layerMask, float maxDistance, bool getA
     }
 }
 
+void OgreWorld::RaycastBillboardBatch(Ogre::BillboardSet *batch, const Ray &ray, unsigned layerMask, float maxDistance, bool getAllResults,
+    float &closestDistance, size_t &hitIndex)
+{
+    float3x4 camWorldTransform = float4x4(renderer_->MainOgreCamera()->getParentSceneNode()->_getFullTransform()).Float3x4Part();
+
+    // The batch is attached to the root scene node, so the billboards are in world space.
+    std::vector<std::pair<EC_Billboard*, Ogre::Billboard*> > members;
+    billboardBatcher_->Members(batch, members);
+    for(size_t i = 0; i < members.size(); ++i)
+    {
+        Ogre::Billboard *b = members[i].second;
+        if (b->getOwnWidth() <= 0.f || b->getOwnHeight() <= 0.f)
+            continue; // Hidden
+        Entity *entity = members[i].first->ParentEntity();
+        if (!entity)
+            continue;
+        EC_Placeable *placeable = entity->GetComponent<EC_Placeable>().get();
+        if (placeable && !(placeable->selectionLayer.Get() & layerMask))
+            continue;
+
+        float d;
+        float3 intersectionPoint;
+        float2 uv;
+        if (!IntersectBillboard(ray, b->getPosition(), b->getOwnWidth(), b->getOwnHeight(), camWorldTransform, maxDistance, d, intersectionPoint, uv))
+            continue;
+        if (!getAllResults && closestDistance > 0.0f && d >= closestDistance)
+            continue;
+
+        closestDistance = d;
+        RaycastResult* result = GetOrCreateRaycastResult(hitIndex);
+        result->entity = entity;
+        result->component = members[i].first;
+        result->pos = intersectionPoint;
+        result->normal = camWorldTransform.Col(2).Normalized();
+        result->submesh = 0; // The component has one billboard.
+        result->index = (unsigned int)-1; // Not applicable for billboards.
+        result->u = uv.x;
+        result->v = uv.y;
+        result->t = d;
+        rayHits_.push_back(result);
+        ++hitIndex;
+    }
+}
+
 RaycastResult* OgreWorld::GetOrCreateRaycastResult(size_t index)
 {
     while (rayResults_.size() <= index)
@@ -943,6 +1487,8 @@ void OgreWorld::StopViewTracking(Entity* entity)
 void OgreWorld::OnUpdated(float timeStep)
 {
     PROFILE(OgreWorld_OnUpdated);
+    UpdateStaticGeometry(timeStep);
+
     // Do nothing if visibility not being tracked for any entities
     if (visibilityTrackedEntities_.empty())
     {
@@ -988,6 +1534,17 @@ void OgreWorld::OnUpdated(float timeStep)
     }
 }
 
+void OgreWorld::SetShadowResolutionScale(float scale)
+{
+    scale = Clamp(scale, 0.f, 1.f);
+    if (!shadowTextureSize_ || shadowMapCache_ || scale == shadowResolutionScale_)
+        return;
+    shadowResolutionScale_ = scale;
+    const unsigned short size = (unsigned short)Max(128, (int)(shadowTextureSize_ * scale));
+    // The shadow textures are recreated on the next frame, and bound to the receivers by their content type.
+    sceneManager_->setShadowTextureSize(size);
+}
+
 void OgreWorld::SetupShadows()
 {
     OgreRenderer::Renderer::ShadowQualitySetting shadowQuality = renderer_->ShadowQuality();
@@ -1025,6 +1582,7 @@ void OgreWorld::SetupShadows()
     sceneManager_->setShadowTextureFSAA(shadowTextureFSAA);
 
     sceneManager_->setShadowTextureSettings(shadowTextureSize, shadowTextureCount, Ogre::PF_FLOAT32_R);
+    shadowTextureSize_ = shadowTextureSize;
 
     Ogre::ShadowCameraSetupPtr shadowCameraSetup;
     if (pssmEnabled)
@@ -1042,6 +1600,11 @@ void OgreWorld::SetupShadows()
 #include "EnableMemoryLeakCheck.h"
         pssmSetup->setSplitPoints(splitpoints);
         shadowCameraSetup = Ogre::ShadowCameraSetupPtr(pssmSetup);
+
+        // The soft shadow blur is applied on each pass, so it would blur the cached casters twice.
+        if (framework_->Config()->Get(ConfigAPI::FILE_FRAMEWORK, ConfigAPI::SECTION_RENDERING, "shadow map caching", false).toBool() &&
+            !framework_->Config()->Get(ConfigAPI::FILE_FRAMEWORK, ConfigAPI::SECTION_RENDERING, "soft shadow", false).toBool())
+            shadowMapCache_ = MAKE_SHARED(ShadowMapCache, this, pssmSetup);
     }
     else
     {
@@ -1357,10 +1920,11 @@ void OgreWorld::DebugDrawSoundSource(const float3 &soundPos, float soundInnerRad
 
 /// MeshInstanceTarget
 
-MeshInstanceTarget::MeshInstanceTarget(const QString &_ref, uint _batchSize, bool _static) :
+MeshInstanceTarget::MeshInstanceTarget(const QString &_ref, uint _batchSize, bool _static, bool _skinned) :
     ref(_ref),
     batchSize(_batchSize),
     isStatic(_static),
+    skinned(_skinned),
     optimizationTimer_(new QTimer())
 {
     optimizationTimer_->setSingleShot(true);
@@ -1391,10 +1955,13 @@ Ogre::InstancedEntity *MeshInstanceTarget::CreateInstance(Ogre::SceneManager *sc
 
     if (!managerTarget)
     {
+        // Skinned instances read their bone matrices from a vertex texture. Forcing one weight per vertex
+        // keeps it to one matrix, ie. three texture fetches, per vertex in Tundra/Instancing/HWVTFVS.
         managerTarget = new ManagerTarget(submesh);
-        managerTarget->manager = sceneManager->createInstanceManager(QString("InstanceManager_%1_%2").arg(ref).arg(submesh).toStdString(),
+        managerTarget->manager = sceneManager->createInstanceManager(QString("InstanceManager_%1_%2%3").arg(ref).arg(submesh).arg(skinned ? "_VTF" : "").toStdString(),
             ref.toStdString(), Ogre::ResourceGroupManager::AUTODETECT_RESOURCE_GROUP_NAME,
-            Ogre::InstanceManager::HWInstancingBasic, static_cast<size_t>(batchSize), Ogre::IM_USEALL, submesh);
+            skinned ? Ogre::InstanceManager::HWInstancingVTF : Ogre::InstanceManager::HWInstancingBasic, static_cast<size_t>(batchSize),
+            skinned ? Ogre::IM_USEALL | Ogre::IM_FORCEONEWEIGHT : Ogre::IM_USEALL, submesh);
         managers << managerTarget;
     }
 
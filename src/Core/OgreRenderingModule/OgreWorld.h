@@ -15,6 +15,7 @@
 #include <QList>
 #include <QPair>
 #include <QHash>
+#include <QSet>
 
 #include <set>
 
@@ -32,6 +33,11 @@ class OGRE_MODULE_API OgreWorld : public QObject, public enable_shared_from_this
 {
     Q_OBJECT
     Q_PROPERTY(bool drawDebugInstancing READ IsDebugInstancingEnabled WRITE SetDebugInstancingEnabled)
+    /// Number of EC_Mesh components with the same mesh, materials and skeleton, after which they are instanced automatically.
+    /** The meshes stay instanced until their number drops below the half of the threshold. 0 disables the automatic instancing. */
+    Q_PROPERTY(int autoInstancingThreshold READ AutoInstancingThreshold WRITE SetAutoInstancingThreshold)
+    /// Size of the cubic cells the static geometry is batched in. Each cell is rebuilt separately when its meshes change.
+    Q_PROPERTY(float staticGeometryCellSize READ StaticGeometryCellSize WRITE SetStaticGeometryCellSize)
 
 public:
     /// Called by the OgreRenderingModule upon the creation of a new scene
@@ -42,6 +48,9 @@ public:
     /// Dynamic scene property name "ogre"
     static const char* PropertyName() { return "ogre"; }
 
+    /// Ogre query flag of the EC_Mesh entities, which the raycasts find through the SpatialWorld of the scene instead of the Ogre ray scene query.
+    static const uint SpatialRaycastQueryFlag = 0x80000000;
+
     /// Returns an unique name to create Ogre objects that require a mandatory name. Calls the parent Renderer
     /** @param prefix Prefix for the name. */
     std::string GenerateUniqueObjectName(const std::string &prefix);
@@ -62,8 +71,11 @@ public:
         @param Material asset references. Each material must be loaded to the asset system. Empty refs get a default error material.
         @param Draw distance for the created instanced entities.
         @param Does the created instanced entities cast shadows.
+        @param Skeleton asset reference. If not empty, the skeleton must be loaded to the asset system, and the instances
+               are skinned with vertex texture fetch, @see IsSkinnedInstancingSupported.
         @return Instanced entity or null ptr if instance could not be created with given input. */
-    Ogre::InstancedEntity *CreateInstance(IComponent *owner, const QString &meshRef, const AssetReferenceList &materials, float drawDistance = 0.0f, bool castShadows = false);
+    Ogre::InstancedEntity *CreateInstance(IComponent *owner, const QString &meshRef, const AssetReferenceList &materials, float drawDistance = 0.0f, bool castShadows = false,
+        const QString &skeletonRef = QString());
 
     /// @overload
     /** @param Component that will own the instanced entity/entities. Will be set as Ogre::MovalbleObject::setUserAny().
@@ -71,8 +83,34 @@ public:
         @param Material asset references. Each material must be loaded to the asset system. Empty refs get a default error material.
         @param Draw distance for the created instanced entities.
         @param Does the created instanced entities cast shadows.
+        @param Skeleton asset. If not null, must be in loaded state. The skeleton is set to the Ogre mesh, so all the skinned
+               instances of the mesh share it. Each instance has its own animation states. Only one bone weight per vertex is used.
         @return Instanced entity or null ptr if instance could not be created with given input. */
-    Ogre::InstancedEntity *CreateInstance(IComponent *owner, const AssetPtr &meshAsset, const AssetReferenceList &materials, float drawDistance = 0.0f, bool castShadows = false);
+    Ogre::InstancedEntity *CreateInstance(IComponent *owner, const AssetPtr &meshAsset, const AssetReferenceList &materials, float drawDistance = 0.0f, bool castShadows = false,
+        const AssetPtr &skeletonAsset = AssetPtr());
+
+    /// Returns if a mesh with the materials and skeleton can be instanced without changing how it looks.
+    /** Used for the automatic instancing. The mesh can not use shared vertices, and the materials must either have no shaders
+        or have an instancing variant of their vertex shader. Skinned meshes can only be instanced with materials that have no shaders.
+        @param Mesh asset. Must be in loaded state.
+        @param Material asset references. Each material must be loaded to the asset system.
+        @param Skeleton asset, or null if the mesh is not skinned. */
+    bool CanAutoInstance(const AssetPtr &meshAsset, const AssetReferenceList &materials, const AssetPtr &skeletonAsset = AssetPtr());
+
+    /// Sets the automatic instancing population of a mesh component.
+    /** Called by EC_Mesh when its mesh, materials or skeleton change, with an empty key when it is destroyed. When the population
+        of the key grows over autoInstancingThreshold, or drops below the half of it, the meshes of the population are switched with
+        EC_Mesh::SetAutoInstanced. */
+    void SetAutoInstancingKey(EC_Mesh *mesh, const QString &key);
+
+    /// Adds a mesh component to the static geometry batches, updates it if it already is in them, or removes it.
+    /** Called by EC_Mesh when its entity, materials or placeable change. The batches are rebuilt a cell at a time in the frame
+        updates, once the cell has had no additions for a moment, and right away on removals. Until a mesh is in a built batch,
+        its own entity is rendered. The entities of the batched meshes are hidden, but can still be raycasted.
+        @note The batched meshes are not in the visible entities of the cameras.
+        @param Mesh component. Must have a non-instanced Ogre entity attached to its placeable when added.
+        @param Add or update the mesh if true, remove it if false. */
+    void SetStaticGeometryMember(EC_Mesh *mesh, bool isStatic);
 
     /// Returns children for a instanced entity.
     /** In practice if you have a mesh with >1 submeshes the CreateInstance() function returned the
@@ -152,6 +190,15 @@ public slots:
     /** Does raycast into the world using a ray in world space coordinates and a maximum distance, and returns all results */
     QList<RaycastResult*> RaycastAll(const Ray& ray, unsigned layerMask, float maxDistance);
     
+    /// Does a raycast into the world for each of the rays in world space coordinates, with the given layers and maximum distance.
+    /** Meant for gameplay scripts that cast many rays per frame, e.g. for line of sight or ground tests. The results refer to
+        the hits of the rays in the same order, and are valid until the next batched raycast. A ray with no hit has a result
+        with a null RaycastResult::entity. */
+    QList<RaycastResult*> RaycastBatch(const QList<Ray> &rays, unsigned layerMask, float maxDistance);
+    /// @overload
+    /** Does a raycast into the world for each of the rays, using all selection layers and no maximum distance. */
+    QList<RaycastResult*> RaycastBatch(const QList<Ray> &rays) { return RaycastBatch(rays, 0xffffffff, FLOAT_INF); }
+
     /// Does a frustum query to the world from viewport coordinates.
     /** @param viewRect The query rectangle in 2d window coords.
         @return List of entities within the frustrum. */
@@ -205,6 +252,46 @@ public slots:
     /// Set debug drawing for instancing  enabled.
     void SetDebugInstancingEnabled(bool enabled);
 
+    /// Scales the resolution of the shadow textures from the configured size, e.g. for FramePacer under load.
+    /** Does nothing if the shadows are off or the static shadow casters are cached, as ShadowMapCache keeps textures of the configured size. */
+    void SetShadowResolutionScale(float scale);
+
+    /// Returns the scale of the resolution of the shadow textures from the configured size.
+    float ShadowResolutionScale() const { return shadowResolutionScale_; }
+
+    /// Returns the automatic instancing threshold, @see autoInstancingThreshold.
+    int AutoInstancingThreshold() const { return autoInstancingThreshold_; }
+
+    /// Sets the automatic instancing threshold and applies it to the current meshes, @see autoInstancingThreshold.
+    void SetAutoInstancingThreshold(int threshold);
+
+    /// Returns if the render system can fetch textures in vertex shaders, which the skinned instancing needs.
+    bool IsSkinnedInstancingSupported() const;
+
+    /// Returns the static geometry cell size, @see staticGeometryCellSize.
+    float StaticGeometryCellSize() const { return staticGeometryCellSize_; }
+
+    /// Sets the static geometry cell size and rebuilds the static geometry, @see staticGeometryCellSize.
+    void SetStaticGeometryCellSize(float size);
+
+    /// Returns the number of static geometry cells.
+    int NumStaticGeometryCells() const { return staticGeometryCells_.size(); }
+
+    /// Returns the occlusion culler of the world, or null if occlusion culling is not enabled with --occlusionCulling.
+    OcclusionCuller *OcclusionCulling() const { return occlusionCuller_.get(); }
+
+    /// Returns the light clusterer of the world, or null if clustered light assignment is not enabled with --clusteredLights.
+    LightClusterer *LightClustering() const { return lightClusterer_.get(); }
+
+    /// Returns the billboard batcher of the world, or null if the billboard batching is disabled with --noBillboardBatching.
+    BillboardBatcher *BillboardBatching() const { return billboardBatcher_.get(); }
+
+    /// Returns whether the movable object was culled by the occlusion culler in the last frame.
+    bool IsOccluded(const Ogre::MovableObject *object) const;
+
+    /// Returns the shadow map cache of the world, or null if the "shadow map caching" rendering setting is not enabled with high shadow quality.
+    ShadowMapCache *ShadowMapCaching() const { return shadowMapCache_.get(); }
+
     /// Renders an axis-aligned bounding box.
     void DebugDrawAABB(const AABB &aabb, const Color &clr, bool depthTest = true);
     void DebugDrawAABB(const AABB &aabb, float r, float g, float b, bool depthTest = true) { DebugDrawAABB(aabb, Color(r, g, b), depthTest); } /**< @overload */
@@ -266,6 +353,13 @@ private:
     /// Do the actual raycast. rayQuery_ must have been set up beforehand
     void RaycastInternal(unsigned layerMask, float maxDistance, bool getAllResults);
 
+    /// Appends the EC_Mesh entities whose world AABB the ray hits to the results, found through the bounding volume hierarchy of the SpatialWorld.
+    void QuerySpatialRaycastCandidates(SpatialWorld *spatialWorld, const Ray &ray, float maxDistance, Ogre::RaySceneQueryResult &results);
+
+    /// Appends the hits of the ray to the billboards of a billboard batch to the results, each with the component of its billboard.
+    void RaycastBillboardBatch(Ogre::BillboardSet *batch, const Ray &ray, unsigned layerMask, float maxDistance, bool getAllResults,
+        float &closestDistance, size_t &hitIndex);
+
     /// Clear the hit status from raycast results.
     void ClearRaycastResults();
     
@@ -301,6 +395,9 @@ private:
     
     /// Ray query results which contain a hit (RaycastAll only)
     QList<RaycastResult*> rayHits_;
+
+    /// Results of the batched raycasts, one per ray.
+    std::vector<RaycastResult*> rayBatchResults_;
     
     /// Soft shadow gaussian listeners
     std::list<GaussianListener *> gaussianListeners_;
@@ -326,9 +423,78 @@ private:
     /// Debug drawing for instancing.
     bool drawDebugInstancing_;
 
+    /// Automatic instancing threshold.
+    int autoInstancingThreshold_;
+
+    /// Mesh components by their automatic instancing key.
+    QHash<QString, QSet<EC_Mesh*> > autoInstancingPopulations_;
+
+    /// Automatic instancing keys by mesh component.
+    QHash<EC_Mesh*, QString> autoInstancingKeys_;
+
+    /// Automatic instancing keys whose meshes are currently instanced.
+    QSet<QString> autoInstancedKeys_;
+
+    /// Switches the meshes of an automatic instancing population on or off by its size.
+    void UpdateAutoInstancing(const QString &key);
+
+    /// Static geometry batch of the meshes in a cell, with the same shadow casting and draw distance.
+    struct StaticGeometryCell
+    {
+        StaticGeometryCell() : geometry(0), dirty(false), urgent(false), timeSinceChange(0.f) {}
+        Ogre::StaticGeometry *geometry;
+        QSet<EC_Mesh*> members;
+        QList<Ogre::Entity*> baked; ///< Entities of the members that are in the built batch, and hidden.
+        bool dirty; ///< Do the members differ from the built batch.
+        bool urgent; ///< Has a member been removed, in which case the batch is rebuilt without waiting.
+        float timeSinceChange;
+    };
+
+    /// Size of the static geometry cells.
+    float staticGeometryCellSize_;
+
+    /// Static geometry cells by their key.
+    QHash<QString, StaticGeometryCell*> staticGeometryCells_;
+
+    /// Static geometry cell keys by mesh component.
+    QHash<EC_Mesh*, QString> staticGeometryMembers_;
+
+    /// Entities that are hidden because they are in a built static geometry batch.
+    QSet<const Ogre::MovableObject*> staticGeometryBaked_;
+
+    /// Culls the meshes hidden behind large occluders, if enabled.
+    shared_ptr<OcclusionCuller> occlusionCuller_;
+
+    /// Assigns the lights to the meshes in view by clusters, if enabled.
+    shared_ptr<LightClusterer> lightClusterer_;
+
+    /// Caches the static shadow casters of the far shadow splits, if enabled.
+    shared_ptr<ShadowMapCache> shadowMapCache_;
+
+    /// Renders the billboards in shared billboard sets by material, unless disabled.
+    shared_ptr<BillboardBatcher> billboardBatcher_;
+
+    /// Configured size of the shadow textures, 0 if the shadows are off.
+    unsigned short shadowTextureSize_;
+    /// Scale of the shadow textures from the configured size.
+    float shadowResolutionScale_;
+
+    /// Returns the key of the static geometry cell of a mesh component.
+    QString StaticGeometryCellKey(EC_Mesh *mesh) const;
+
+    /// Shows the entities hidden by a static geometry cell.
+    void UnbakeStaticGeometryCell(StaticGeometryCell *cell);
+
+    /// Rebuilds a static geometry cell from its members.
+    void RebuildStaticGeometryCell(const QString &key, StaticGeometryCell *cell);
+
+    /// Rebuilds the dirty static geometry cells, a cell per frame.
+    void UpdateStaticGeometry(float timeStep);
+
     /// Get or create a instance manager for mesh ref and submesh index.
-    /** @note meshRef needs to be a Ogre mesh resource name, not Tundra AssetAPI reference. */
-    MeshInstanceTarget *GetOrCreateInstanceMeshTarget(const QString &meshRef, int submesh);
+    /** @note meshRef needs to be a Ogre mesh resource name, not Tundra AssetAPI reference.
+        @param Are the instances skinned with the HWInstancingVTF technique. */
+    MeshInstanceTarget *GetOrCreateInstanceMeshTarget(const QString &meshRef, int submesh, bool skinned = false);
 
     /// Analyzes the current scene on how many instances potentially can be created with input mesh ref.
     /** @note meshRef needs to be a Ogre mesh resource name, not Tundra AssetAPI reference. */
@@ -336,6 +502,9 @@ private:
 
     /// Prepares a material for instanced use. This function will clone the material if necessary.
     QString PrepareInstancingMaterial(OgreMaterialAsset *material);
+
+    /// Prepares a material for skinned instanced use. Clones Tundra/Instancing/HWVTF with the first texture of the material as the diffuse map.
+    QString PrepareSkinnedInstancingMaterial(OgreMaterialAsset *material);
 };
 
 /// Instancing mesh target data.
@@ -344,12 +513,13 @@ class MeshInstanceTarget : public QObject
 Q_OBJECT
 
 public:
-    MeshInstanceTarget(const QString &_ref, uint _batchSize, bool _static = false);
+    MeshInstanceTarget(const QString &_ref, uint _batchSize, bool _static = false, bool _skinned = false);
     ~MeshInstanceTarget();
 
     QString ref;
     uint batchSize;
     bool isStatic;
+    bool skinned; ///< Are the instances skinned with the HWInstancingVTF technique.
 
     struct ManagerTarget
     {
@@ -0,0 +1,245 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#include "StableHeaders.h"
+#include "DebugOperatorNew.h"
+
+#include "ParticleBudget.h"
+#include "Renderer.h"
+#include "ScreenSize.h"
+#include "Framework.h"
+#include "FrameAPI.h"
+#include "ConfigAPI.h"
+#include "Profiler.h"
+
+#include <OgreParticleSystem.h>
+#include <OgreParticleEmitter.h>
+#include <OgreSceneManager.h>
+#include <OgreCamera.h>
+
+#include <QStringList>
+
+#include <algorithm>
+#include <cmath>
+
+#include "MemoryLeakCheck.h"
+
+namespace
+{
+/// Default budget of live particles.
+const int cDefaultMaxParticles = 20000;
+/// Screen height in pixels at and above which a system emits at its authored rates.
+const float cFullDetailScreenSize = 200.f;
+/// Smallest emission scale by the screen size, so that small systems do not fade out altogether.
+const float cMinScreenSizeScale = 0.1f;
+/// Screen height in pixels below which a system is too small to see, and is culled.
+const float cCullScreenSize = 2.f;
+/// Seconds a system is out of the view before it is paused.
+const float cPauseDelay = 0.5f;
+/// Maximum seconds a system is fast-forwarded when it comes back to the view.
+const float cMaxFastForward = 5.f;
+/// Seconds between the steps of the fast-forward.
+const float cFastForwardInterval = 0.1f;
+/// Relative change of the emission scale below which the emission rates are not set again.
+const float cScaleTolerance = 0.05f;
+}
+
+ParticleBudget::ParticleBudget(Framework *framework, OgreRenderer::Renderer *renderer) :
+    framework_(framework),
+    renderer_(renderer),
+    maxParticles_(cDefaultMaxParticles),
+    numPaused_(0),
+    numParticles_(0),
+    numWanted_(0),
+    budgetScale_(1.f)
+{
+    ConfigData configData(ConfigAPI::FILE_FRAMEWORK, ConfigAPI::SECTION_RENDERING);
+    maxParticles_ = std::max(0, framework_->Config()->DeclareSetting(configData, "particle budget", cDefaultMaxParticles).toInt());
+    QStringList budgetParam = framework_->CommandLineParameters("--particleBudget");
+    if (budgetParam.size() > 0)
+        maxParticles_ = std::max(0, budgetParam.first().toInt());
+
+    connect(framework_->Frame(), SIGNAL(Updated(float)), SLOT(OnUpdated(float)));
+}
+
+ParticleBudget::~ParticleBudget()
+{
+}
+
+void ParticleBudget::Register(Ogre::ParticleSystem *system)
+{
+    if (!system)
+        return;
+    int index = IndexOf(system);
+    if (index >= 0)
+    {
+        Restore(systems_[index]);
+        systems_.erase(systems_.begin() + index);
+    }
+
+    ManagedSystem managed;
+    managed.system = system;
+    managed.sceneManager = system->_getManager();
+    managed.speedFactor = system->getSpeedFactor();
+    float authoredParticles = 0.f;
+    for(unsigned short i = 0; i < system->getNumEmitters(); ++i)
+    {
+        Ogre::ParticleEmitter *emitter = system->getEmitter(i);
+        managed.emissionRates.push_back(emitter->getEmissionRate());
+        authoredParticles += emitter->getEmissionRate() * emitter->getMaxTimeToLive();
+    }
+    managed.authoredParticles = std::min(authoredParticles, (float)system->getParticleQuota());
+    managed.wantedScale = 1.f;
+    managed.emissionScale = 1.f;
+    managed.hiddenTime = 0.f;
+    managed.pausedTime = 0.f;
+    managed.paused = false;
+    managed.culled = false;
+    systems_.push_back(managed);
+}
+
+void ParticleBudget::Unregister(Ogre::ParticleSystem *system)
+{
+    int index = IndexOf(system);
+    if (index < 0)
+        return;
+    Restore(systems_[index]);
+    systems_.erase(systems_.begin() + index);
+}
+
+void ParticleBudget::UnregisterSceneManager(Ogre::SceneManager *sceneManager)
+{
+    size_t j = 0;
+    for(size_t i = 0; i < systems_.size(); ++i)
+        if (systems_[i].sceneManager != sceneManager)
+            systems_[j++] = systems_[i];
+    systems_.resize(j);
+}
+
+void ParticleBudget::SetMaxParticles(int maxParticles)
+{
+    maxParticles_ = std::max(0, maxParticles);
+    framework_->Config()->Set(ConfigAPI::FILE_FRAMEWORK, ConfigAPI::SECTION_RENDERING, "particle budget", maxParticles_);
+}
+
+int ParticleBudget::IndexOf(Ogre::ParticleSystem *system) const
+{
+    for(size_t i = 0; i < systems_.size(); ++i)
+        if (systems_[i].system == system)
+            return (int)i;
+    return -1;
+}
+
+void ParticleBudget::SetEmissionScale(ManagedSystem &managed, float scale)
+{
+    const unsigned short numEmitters = std::min(managed.system->getNumEmitters(), (unsigned short)managed.emissionRates.size());
+    for(unsigned short i = 0; i < numEmitters; ++i)
+        managed.system->getEmitter(i)->setEmissionRate(managed.emissionRates[i] * scale);
+    managed.emissionScale = scale;
+}
+
+void ParticleBudget::Restore(ManagedSystem &managed)
+{
+    if (managed.emissionScale != 1.f)
+        SetEmissionScale(managed, 1.f);
+    if (managed.paused)
+        managed.system->setSpeedFactor(managed.speedFactor);
+    if (managed.culled)
+        managed.system->setVisible(true);
+    managed.paused = false;
+    managed.culled = false;
+}
+
+void ParticleBudget::OnUpdated(float frameTime)
+{
+    numPaused_ = 0;
+    numParticles_ = 0;
+    numWanted_ = 0;
+    budgetScale_ = 1.f;
+    if (systems_.empty())
+        return;
+
+    PROFILE(ParticleBudget_Update);
+    Ogre::Camera *camera = renderer_->MainOgreCamera();
+    const Ogre::Vector3 eye = camera ? camera->getDerivedPosition() : Ogre::Vector3::ZERO;
+    const float nearPlane = camera ? std::max(camera->getNearClipDistance(), 0.01f) : 1.f;
+
+    // Find the screen sizes, and pause the systems that have been out of the view for a while.
+    float wantedParticles = 0.f;
+    for(size_t i = 0; i < systems_.size(); ++i)
+    {
+        ManagedSystem &managed = systems_[i];
+        Ogre::ParticleSystem *system = managed.system;
+        numParticles_ += (int)system->getNumParticles();
+
+        float screenSize = 0.f;
+        bool inView = false;
+        if (camera && camera->getSceneManager() == managed.sceneManager && system->getParentSceneNode())
+        {
+            Ogre::AxisAlignedBox box = system->getWorldBoundingBox(true);
+            // A system that has not emitted yet has no bounds, so use its position.
+            if (box.isNull() || box.isInfinite())
+            {
+                const Ogre::Vector3 pos = system->getParentSceneNode()->_getDerivedPosition();
+                box.setExtents(pos - Ogre::Vector3(0.5f), pos + Ogre::Vector3(0.5f));
+            }
+            if (camera->isVisible(box))
+            {
+                inView = true;
+                Ogre::Vector3 nearest = eye;
+                nearest.makeCeil(box.getMinimum());
+                nearest.makeFloor(box.getMaximum());
+                const float distance = std::max(eye.distance(nearest), nearPlane);
+                screenSize = OgreRenderer::ScreenSizeInPixels(camera, box, distance);
+            }
+        }
+
+        const bool tooSmall = inView && screenSize < cCullScreenSize;
+        if (tooSmall != managed.culled)
+        {
+            system->setVisible(!tooSmall);
+            managed.culled = tooSmall;
+        }
+
+        if (!inView || tooSmall)
+        {
+            managed.hiddenTime += frameTime;
+            if (managed.paused)
+                managed.pausedTime += frameTime;
+            else if (managed.hiddenTime >= cPauseDelay)
+            {
+                system->setSpeedFactor(0.f);
+                managed.paused = true;
+                managed.pausedTime = 0.f;
+            }
+            if (managed.paused)
+                ++numPaused_;
+            continue;
+        }
+
+        managed.hiddenTime = 0.f;
+        if (managed.paused)
+        {
+            // Catch up with the time the system was paused, so that it looks like it was running all along.
+            system->setSpeedFactor(managed.speedFactor);
+            system->fastForward(std::min(managed.pausedTime, cMaxFastForward), cFastForwardInterval);
+            managed.paused = false;
+        }
+
+        managed.wantedScale = std::min(1.f, std::max(cMinScreenSizeScale, screenSize / cFullDetailScreenSize));
+        wantedParticles += managed.wantedScale * managed.authoredParticles;
+    }
+    numWanted_ = (int)wantedParticles;
+
+    // Scale the emission of the visible systems down evenly if their particles would not fit in the budget.
+    if (maxParticles_ > 0 && wantedParticles > (float)maxParticles_)
+        budgetScale_ = (float)maxParticles_ / wantedParticles;
+    for(size_t i = 0; i < systems_.size(); ++i)
+    {
+        ManagedSystem &managed = systems_[i];
+        if (managed.paused || managed.culled)
+            continue;
+        const float scale = maxParticles_ > 0 ? managed.wantedScale * budgetScale_ : 1.f;
+        if (std::fabs(scale - managed.emissionScale) > cScaleTolerance * managed.emissionScale || (scale == 1.f && managed.emissionScale != 1.f))
+            SetEmissionScale(managed, scale);
+    }
+}
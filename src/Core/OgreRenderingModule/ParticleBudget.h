@@ -0,0 +1,98 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#pragma once
+
+#include "CoreDefines.h"
+#include "OgreModuleApi.h"
+#include "OgreModuleFwd.h"
+
+#include <QObject>
+
+#include <vector>
+
+class Framework;
+
+/// Keeps the particle systems of all the scenes within a renderer-wide particle budget.
+/** Created by Renderer when not headless. EC_ParticleSystem registers the Ogre particle systems it creates.
+
+    Each frame, the screen size of each system is found from its world bounds and the main camera. The emission rates
+    of the emitters are scaled down from their authored rates for the systems that are small on the screen, and the
+    emission of all the systems is scaled down further if the particles they are authored to keep would exceed the budget,
+    set with the "particle budget" setting or --particleBudget. A budget of 0 leaves the emission rates as authored.
+    Ogre never shrinks the particle pools of the systems, so the particle quotas are not lowered, but the scaled emission
+    keeps the systems below them.
+
+    The systems that have been out of the view, or too small to see, for a short while are paused. When they come back
+    to the view, they are fast-forwarded by the time they were paused, up to a few seconds, so that e.g. a fire does not
+    restart from its first particles. The systems too small to see are also hidden. */
+class OGRE_MODULE_API ParticleBudget : public QObject
+{
+    Q_OBJECT
+    Q_PROPERTY(int maxParticles READ MaxParticles WRITE SetMaxParticles)
+
+public:
+    ParticleBudget(Framework *framework, OgreRenderer::Renderer *renderer);
+    ~ParticleBudget();
+
+    /// Starts managing the particle system, and stores its authored emission rates. Called by EC_ParticleSystem.
+    /** Call again if the emitters of the system change. */
+    void Register(Ogre::ParticleSystem *system);
+
+    /// Stops managing the particle system, and restores its authored emission. Called by EC_ParticleSystem before destroying it.
+    void Unregister(Ogre::ParticleSystem *system);
+
+    /// Stops managing all the particle systems of the scene manager without touching them. Called by OgreWorld before destroying it.
+    void UnregisterSceneManager(Ogre::SceneManager *sceneManager);
+
+public slots:
+    /// Sets the budget, the number of particles the systems may keep at a time. 0 disables the budget.
+    void SetMaxParticles(int maxParticles);
+    /// Returns the budget, the number of particles the systems may keep at a time, or 0 if disabled.
+    int MaxParticles() const { return maxParticles_; }
+
+    /// Returns the number of managed particle systems.
+    int NumSystems() const { return (int)systems_.size(); }
+    /// Returns the number of managed particle systems that were paused on the last frame.
+    int NumPausedSystems() const { return numPaused_; }
+    /// Returns the number of live particles of the managed systems on the last frame.
+    int NumParticles() const { return numParticles_; }
+    /// Returns the number of particles the visible systems were authored to keep, before the budget, on the last frame.
+    int NumWantedParticles() const { return numWanted_; }
+    /// Returns the factor the emission was scaled by to fit the budget on the last frame, 1 if it fit.
+    float BudgetScale() const { return budgetScale_; }
+
+private slots:
+    void OnUpdated(float frameTime);
+
+private:
+    struct ManagedSystem
+    {
+        Ogre::ParticleSystem *system;
+        Ogre::SceneManager *sceneManager;
+        std::vector<float> emissionRates; ///< Authored emission rates of the emitters.
+        float speedFactor; ///< Authored speed factor.
+        float authoredParticles; ///< Particles the system keeps at its authored rates, bounded by its quota.
+        float wantedScale; ///< Emission scale by the screen size on the last frame.
+        float emissionScale; ///< Emission scale in effect.
+        float hiddenTime; ///< Seconds the system has been out of the view or too small.
+        float pausedTime; ///< Seconds the system has been paused.
+        bool paused;
+        bool culled; ///< Whether the system is hidden for being too small on the screen.
+    };
+
+    /// Returns the index of the managed system, or -1 if not managed.
+    int IndexOf(Ogre::ParticleSystem *system) const;
+    /// Sets the emission rates of the emitters of the system to its authored rates scaled.
+    static void SetEmissionScale(ManagedSystem &managed, float scale);
+    /// Restores the authored emission, speed and visibility of the system.
+    static void Restore(ManagedSystem &managed);
+
+    Framework *framework_;
+    OgreRenderer::Renderer *renderer_;
+    std::vector<ManagedSystem> systems_;
+    int maxParticles_;
+    int numPaused_;
+    int numParticles_;
+    int numWanted_;
+    float budgetScale_;
+};
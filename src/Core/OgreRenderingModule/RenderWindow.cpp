@@ -276,6 +276,32 @@ void RenderWindow::UpdateOverlayImage(const QImage &src)
     texture->getBuffer()->blitFromMemory(bufbox);
 }
 
+void RenderWindow::UpdateOverlayImage(const QImage &src, const QRect &rect)
+{
+    if (!overlay)
+        return;
+
+    Ogre::TextureManager &mgr = Ogre::TextureManager::getSingleton();
+    Ogre::TexturePtr texture = mgr.getByName(rttTextureName);
+    assert(texture.get());
+    if ((int)texture->getWidth() != src.width() || (int)texture->getHeight() != src.height())
+    {
+        UpdateOverlayImage(src);
+        return;
+    }
+
+    const QRect clipped = rect.intersected(src.rect());
+    if (clipped.isEmpty())
+        return;
+
+    PROFILE(RenderWindow_UpdateOverlayImage_Rect);
+
+    // The sub-volume keeps the row pitch of the whole image, so the rectangle is copied straight out of the source scanlines.
+    Ogre::PixelBox bufbox(Ogre::Box(0, 0, src.width(), src.height()), Ogre::PF_A8R8G8B8, (void *)src.bits());
+    Ogre::Box dirtyBox(clipped.left(), clipped.top(), clipped.right() + 1, clipped.bottom() + 1);
+    texture->getBuffer()->blitFromMemory(bufbox.getSubVolume(dirtyBox), dirtyBox);
+}
+
 void RenderWindow::ShowOverlay(bool visible)
 {
     if (overlayContainer)
@@ -17,6 +17,7 @@ namespace Ogre
 }
 
 class QImage;
+class QRect;
 
 /// Stores the main Ogre::RenderWindow that is created by the Renderer.
 class OGRE_MODULE_API RenderWindow : public QObject
@@ -48,6 +49,10 @@ public slots:
     /// Fully repaints the Ogre 2D Overlay from the given source image.
     void UpdateOverlayImage(const QImage &src);
 
+    /// Repaints the given rectangle of the Ogre 2D Overlay from the same rectangle of the given source image.
+    /** Fully repaints the overlay if the source image and the overlay texture differ in size. */
+    void UpdateOverlayImage(const QImage &src, const QRect &rect);
+
     /// Shows or hides whether the 2D Ogre Overlay is visible or not.
     void ShowOverlay(bool visible);
 
@@ -11,6 +11,10 @@
 #include "RenderWindow.h"
 #include "OgreShadowCameraSetupFocusedPSSM.h"
 #include "OgreCompositionHandler.h"
+#include "GpuProfiler.h"
+#include "ShaderCache.h"
+#include "ParticleBudget.h"
+#include "FramePacer.h"
 #include "UiPlane.h"
 #include "TextureAsset.h"
 #include "OgreMeshAsset.h"
@@ -85,6 +89,7 @@ static const int MINIMUM_TEXTURE_BUDGET = 1;
 
 #include <QCloseEvent>
 #include <QSize>
+#include <QRegion>
 #include <QDir>
 
 #ifdef PROFILING
@@ -252,16 +257,24 @@ namespace OgreRenderer
         defaultScene(0),
         dummyDefaultCamera(0),
         mainViewport(0),
+        gpuProfiler(0),
+        shaderCache(0),
+        particleBudget(0),
+        framePacer(0),
         overlaySystem(0),
         uniqueObjectId(0),
         renderWindow(0),
         lastWidth(0),
         lastHeight(0),
         resizedDirty(0),
+        uiOverlayHidden(false),
         viewDistance(500.0f),
         shadowQuality(Shadows_High),
         textureQuality(Texture_Normal),
-        textureBudget(DEFAULT_TEXTURE_BUDGET)
+        textureBudget(DEFAULT_TEXTURE_BUDGET),
+        pipelinedRendering(false),
+        framePending(false),
+        presentMsecs(0.0)
 #ifdef ANDROID
         , staticPluginLoader(0)
         , shaderGenerator(0)
@@ -300,6 +313,10 @@ namespace OgreRenderer
             defaultScene = 0;
         }
 
+        SAFE_DELETE(gpuProfiler);
+        SAFE_DELETE(shaderCache);
+        SAFE_DELETE(particleBudget);
+        SAFE_DELETE(framePacer);
         SAFE_DELETE(overlaySystem);
 #ifdef ANDROID
         Ogre::RTShader::ShaderGenerator::finalize();
@@ -384,6 +401,9 @@ namespace OgreRenderer
                 SetTextureBudget(sizeParam.first().toInt());
         }
 
+        pipelinedRendering = framework->Config()->DeclareSetting(configData, "pipelined rendering", false).toBool() ||
+            framework->HasCommandLineParameter("--pipelinedRendering");
+
         // Load plugins
         QStringList loadedPlugins = LoadOgrePlugins();
 
@@ -534,6 +554,11 @@ namespace OgreRenderer
                 throw;
             }
 
+            // Created before any programs are compiled, so that all of them are saved to the cache.
+            shaderCache = new ShaderCache(framework, this);
+            particleBudget = new ParticleBudget(framework, this);
+            framePacer = new FramePacer(framework, this);
+
             LogInfo("Renderer: Loading Ogre resources");
             LoadOgreResourceLocations();
             CreateInstancingShaders();
@@ -555,6 +580,11 @@ namespace OgreRenderer
             dummyDefaultCamera = defaultScene->createCamera("DefaultCamera");
         
             mainViewport = renderWindow->OgreRenderWindow()->addViewport(dummyDefaultCamera);
+#ifdef PROFILING
+            // Created before the compositors, so that its listener of the main window precedes theirs.
+            gpuProfiler = GpuProfiler::Create(this);
+            compositionHandler->SetGpuProfiler(gpuProfiler);
+#endif
             compositionHandler->SetViewport(mainViewport);
         }
 
@@ -596,6 +626,38 @@ namespace OgreRenderer
         framework->Config()->Set(ConfigAPI::FILE_FRAMEWORK, ConfigAPI::SECTION_RENDERING, "texture quality", (int)quality);
     }
     
+    void Renderer::SetPipelinedRendering(bool enabled)
+    {
+        if (!enabled)
+            PresentQueuedFrame();
+        pipelinedRendering = enabled;
+        framework->Config()->Set(ConfigAPI::FILE_FRAMEWORK, ConfigAPI::SECTION_RENDERING, "pipelined rendering", enabled);
+    }
+
+    void Renderer::PresentQueuedFrame()
+    {
+        if (!framePending)
+            return;
+        framePending = false;
+
+        PROFILE(Renderer_PresentQueuedFrame);
+        const tick_t presentStart = GetCurrentClockTime();
+        try
+        {
+            Ogre::RenderSystem *renderSystem = ogreRoot->getRenderSystem();
+#if OGRE_VERSION_MAJOR <= 1 && OGRE_VERSION_MINOR < 9
+            renderSystem->_swapAllRenderTargetBuffers(renderSystem->getWaitForVerticalBlank());
+#else
+            renderSystem->_swapAllRenderTargetBuffers();
+#endif
+        }
+        catch(const std::exception &e)
+        {
+            LogError(std::string("Renderer::PresentQueuedFrame: Swapping the buffers threw an exception: ") + (e.what() ? e.what() : "(null)"));
+        }
+        presentMsecs = (double)(GetCurrentClockTime() - presentStart) * 1000.0 / timerFrequency;
+    }
+
     void Renderer::SetTextureBudget(int budget)
     {
         textureBudget = Max(budget, MINIMUM_TEXTURE_BUDGET);
@@ -990,6 +1052,45 @@ namespace OgreRenderer
         renderWindow->UpdateOverlayImage(*backBuffer);
     }
 
+    void Renderer::DoUIRedraw(const QRegion &region)
+    {
+        if (framework->IsHeadless())
+            return;
+
+        if (!renderWindow->OgreOverlay())
+            return;
+
+        PROFILE(Renderer_DoUIRedraw);
+
+        UiGraphicsView *view = framework->Ui()->GraphicsView();
+
+        QImage *backBuffer = view->BackBuffer();
+        if (!backBuffer)
+        {
+            LogWarning("Renderer::DoUIRedraw: UiGraphicsView does not have a backbuffer initialized!");
+            return;
+        }
+
+        const QRegion dirty = region.intersected(QRect(QPoint(0, 0), backBuffer->size()));
+        if (dirty.isEmpty())
+            return;
+        const QVector<QRect> rects = dirty.rects();
+
+        // Clear and paint only the dirty rectangles into the buffer.
+        {
+            PROFILE(Renderer_DoUIRedraw_GraphicsViewPaint);
+            QPainter painter(backBuffer);
+            painter.setCompositionMode(QPainter::CompositionMode_Source);
+            for(int i = 0; i < rects.size(); ++i)
+                painter.fillRect(rects[i], Qt::transparent);
+            painter.setCompositionMode(QPainter::CompositionMode_SourceOver);
+            view->viewport()->render(&painter, dirty.boundingRect().topLeft(), dirty, QWidget::DrawChildren);
+        }
+
+        for(int i = 0; i < rects.size(); ++i)
+            renderWindow->UpdateOverlayImage(*backBuffer, rects[i]);
+    }
+
     RaycastResult* Renderer::Raycast(int x, int y)
     {
         OgreWorldPtr world = GetActiveOgreWorld();
@@ -1022,6 +1123,10 @@ namespace OgreRenderer
             
         PROFILE(Renderer_Render);
 
+        // The GPU has rendered the previous frame while the logic of this frame ran. Present it before the UI is
+        // composited on the buffers of this frame.
+        PresentQueuedFrame();
+
         // The message pump must be called on X11 systems,
         // but on Windows it is redundant (Qt already manages this), and has been profiled to take as much as 10ms per frame in some situations.
 #ifdef UNIX
@@ -1061,13 +1166,24 @@ namespace OgreRenderer
         UiGraphicsView *view = framework->Ui()->GraphicsView();
         assert(view);
 
+        // Skip the UI overlay pass entirely while there are no visible UI items to composite over the 3D view.
+        // The back buffer is not kept up to date meanwhile, so it is fully repainted when the UI is shown again.
+        const bool uiVisible = view->HasVisibleItems();
+        if (uiVisible == uiOverlayHidden)
+        {
+            renderWindow->ShowOverlay(uiVisible);
+            uiOverlayHidden = !uiVisible;
+            if (uiVisible)
+                resizedDirty = max(resizedDirty, 1);
+        }
+
 #ifdef DIRECTX_ENABLED
         if (!view->BackBuffer())
         {
             LogError("UI compositing failed! Null backbuffer!");
             return;
         }
-        if (view->IsViewDirty() || resizedDirty)
+        if (uiVisible && (view->IsViewDirty() || resizedDirty))
         {
             PROFILE(Renderer_Render_QtBlit);
 
@@ -1198,11 +1314,11 @@ namespace OgreRenderer
                 }
             }
         }
-#else // Not using the subrectangle blit - just do a full UI blit.
-        if (view->IsViewDirty() || resizedDirty)
-        {
+#else // Not using the D3D9 surface blit - repaint and upload the dirty rectangles through Ogre.
+        if (uiVisible && resizedDirty)
             DoFullUIRedraw();
-        }
+        else if (uiVisible && view->IsViewDirty())
+            DoUIRedraw(view->DirtyRegion());
 #endif
 
         if (resizedDirty > 0)
@@ -1238,13 +1354,31 @@ namespace OgreRenderer
                 Ogre::FrameEvent evt;
                 evt.timeSinceLastFrame = frameTime;
                 ogreRoot->_fireFrameStarted(evt);
-                ogreRoot->_updateAllRenderTargets();
+                if (gpuProfiler)
+                    gpuProfiler->BeginFrame();
+                // Same as Ogre::Root::_updateAllRenderTargets, but with the swap apart, so that the pipelined rendering can
+                // leave it to the next Render, and the frame pacer can time the submit and the swap separately.
+                const tick_t submitStart = GetCurrentClockTime();
+                ogreRoot->getRenderSystem()->_updateAllRenderTargets(false);
+                framePending = true;
+                ogreRoot->_fireFrameRenderingQueued();
+                const double submitMsecs = (double)(GetCurrentClockTime() - submitStart) * 1000.0 / timerFrequency;
+                if (!pipelinedRendering)
+                    PresentQueuedFrame();
+                for(Ogre::SceneManagerEnumerator::SceneManagerIterator it = ogreRoot->getSceneManagerIterator(); it.hasMoreElements(); it.moveNext())
+                    it.peekNextValue()->_handleLodEvents();
+                if (framePacer)
+                    framePacer->RenderTimed(submitMsecs, presentMsecs);
+                if (gpuProfiler)
+                    gpuProfiler->EndFrame();
                 ogreRoot->_fireFrameEnded();
             }
         } catch(const std::exception &e)
         {
             std::cout << "Ogre::Root::renderOneFrame threw an exception: " << (e.what() ? e.what() : "(null)") << std::endl;
             LogError(std::string("Ogre::Root::renderOneFrame threw an exception: ") + (e.what() ? e.what() : "(null)"));
+            if (gpuProfiler)
+                gpuProfiler->EndFrame();
         }
 
         view->MarkViewUndirty();
@@ -13,6 +13,7 @@
 #include <QDir>
 
 class QScriptEngine;
+class QRegion;
 class Framework;
 
 namespace Ogre
@@ -93,6 +94,12 @@ namespace OgreRenderer
         /// Returns RenderWindow used to display the 3D scene in.
         RenderWindow *GetRenderWindow() const { return renderWindow; }
 
+        /// Returns the renderer-wide particle budget, null if headless.
+        ParticleBudget *Particles() const { return particleBudget; }
+
+        /// Returns the adaptive frame pacer, null if headless.
+        FramePacer *Pacer() const { return framePacer; }
+
         /// Shadow quality settings
         enum ShadowQualitySetting
         {
@@ -146,6 +153,15 @@ namespace OgreRenderer
         /// Returns texture budget in megabytes.
         int TextureBudget() const { return textureBudget; }
 
+        /// Sets whether the rendering of a frame is pipelined with the logic of the next frame.
+        /** When set, the frame is submitted to the GPU at the end of Render, but presented at the start of the next Render,
+            so that the GPU renders the frame while the modules, scripts and assets run the logic of the next one. Costs a frame of
+            latency in the display. Stored in the config as "pipelined rendering"; the --pipelinedRendering switch sets it for the run. */
+        void SetPipelinedRendering(bool enabled);
+
+        /// Returns whether the rendering of a frame is pipelined with the logic of the next frame.
+        bool PipelinedRendering() const { return pipelinedRendering; }
+
         /// Calculate current texture usage ratio (1 = budget completely in use). Optionally specify a data size in bytes which is going to be loaded, and will be added to the calculation
         float TextureBudgetUse(size_t loadDataSize = 0) const;
 
@@ -192,6 +208,9 @@ namespace OgreRenderer
         /// Performs a full UI repaint with Qt and re-fills the GPU surface accordingly.
         void DoFullUIRedraw();
 
+        /// Repaints the given region of the UI with Qt and uploads only its rectangles to the GPU surface.
+        void DoUIRedraw(const QRegion &region);
+
         /// Returns the Entity which contains the currently active camera that is used to render on the main window.
         /// The returned Entity is guaranteed to have an EC_Camera component, and it is guaranteed to be attached to a scene.
         Entity *MainCamera();
@@ -261,6 +280,9 @@ namespace OgreRenderer
         /// Returns platform string that is used in --ogreConfig files.
         QString RenderingConfigPlatform() const;
 
+        /// Presents the frame left submitted by the pipelined rendering, if any.
+        void PresentQueuedFrame();
+
         /// Successfully initialized flag
         bool initialized;
 
@@ -307,12 +329,28 @@ namespace OgreRenderer
         /// handler for post-processing effects
         OgreCompositionHandler *compositionHandler;
 
+        /// Measures the GPU times of the frame in PROFILING builds, null if not supported.
+        GpuProfiler *gpuProfiler;
+
+        /// Keeps the compiled shaders across runs and warms up the loaded materials, null if headless.
+        ShaderCache *shaderCache;
+
+        /// Scales, pauses and culls the particle systems of all the scenes to the particle budget, null if headless.
+        ParticleBudget *particleBudget;
+
+        /// Trades the render resolution and shadow quality against the frame times in the adaptive frame pacing, null if headless.
+        FramePacer *framePacer;
+
         int lastHeight; ///< Last render window height
         int lastWidth; ///< Last render window width
         int resizedDirty; ///< Resized dirty count
+        bool uiOverlayHidden; ///< Is the UI overlay hidden because there are no visible UI items to composite.
         ShadowQualitySetting shadowQuality; ///< Shadow quality setting.
         TextureQualitySetting textureQuality; ///< Texture quality setting.
         int textureBudget; ///< Texture budget in megabytes.
+        bool pipelinedRendering; ///< Whether the present of a frame is deferred to the next Render.
+        bool framePending; ///< Whether a frame has been submitted but not presented yet.
+        double presentMsecs; ///< Milliseconds the last present took.
 
         /// Stores the wall clock time that specifies when the last frame was displayed.
         tick_t lastPresentTime;
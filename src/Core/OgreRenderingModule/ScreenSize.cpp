@@ -0,0 +1,39 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#include "StableHeaders.h"
+#include "DebugOperatorNew.h"
+
+#include "ScreenSize.h"
+#include "Math/MathFunc.h"
+#include "Geometry/AABB.h"
+
+#include <OgreCamera.h>
+#include <OgreViewport.h>
+#include <OgreAxisAlignedBox.h>
+
+#include "MemoryLeakCheck.h"
+
+namespace OgreRenderer
+{
+
+float ScreenSizeInPixels(const Ogre::Camera *camera, float size, float distance)
+{
+    const Ogre::Viewport *viewport = camera ? camera->getViewport() : 0;
+    if (!viewport || distance <= 0.f)
+        return 0.f;
+    // The screen height in pixels of an object of unit size at unit distance.
+    const float pixelsPerUnit = (float)viewport->getActualHeight() / (2.f * Tan(camera->getFOVy().valueRadians() * 0.5f));
+    return size / distance * pixelsPerUnit;
+}
+
+float ScreenSizeInPixels(const Ogre::Camera *camera, const Ogre::AxisAlignedBox &box, float distance)
+{
+    return ScreenSizeInPixels(camera, box.getSize().length(), distance);
+}
+
+float ScreenSizeInPixels(const Ogre::Camera *camera, const AABB &box, float distance)
+{
+    return ScreenSizeInPixels(camera, box.Size().Length(), distance);
+}
+
+}
@@ -0,0 +1,25 @@
+/**
+    For conditions of distribution and use, see copyright notice in LICENSE
+
+    @file   ScreenSize.h
+    @brief  Screen sizes of objects in the views of cameras, for choosing their levels of detail. */
+
+#pragma once
+
+#include "OgreModuleApi.h"
+#include "OgreModuleFwd.h"
+#include "Math/MathFwd.h"
+
+namespace OgreRenderer
+{
+    /// Returns the screen height in pixels of an object of the size at the distance from the camera.
+    /** The height is measured in the viewport the camera renders to, and is 0 for a camera that has no viewport.
+        @param size Size of the object, in world units.
+        @param distance Distance of the object from the camera, clamped by the caller to at least the near plane. */
+    float OGRE_MODULE_API ScreenSizeInPixels(const Ogre::Camera *camera, float size, float distance);
+    /// @overload
+    /** Uses the length of the diagonal of the box as the size of the object. */
+    float OGRE_MODULE_API ScreenSizeInPixels(const Ogre::Camera *camera, const Ogre::AxisAlignedBox &box, float distance);
+    /// @overload
+    float OGRE_MODULE_API ScreenSizeInPixels(const Ogre::Camera *camera, const AABB &box, float distance);
+}
@@ -0,0 +1,199 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#include "StableHeaders.h"
+#include "DebugOperatorNew.h"
+
+#include "ShaderCache.h"
+#include "OgreMaterialAsset.h"
+#include "Renderer.h"
+#include "Framework.h"
+#include "FrameAPI.h"
+#include "AssetAPI.h"
+#include "AssetCache.h"
+#include "Application.h"
+#include "HighPerfClock.h"
+#include "LoggingFunctions.h"
+#include "Profiler.h"
+
+#include <OgreGpuProgramManager.h>
+#include <OgreRoot.h>
+
+#include <QCryptographicHash>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+
+#include <fstream>
+
+#include "MemoryLeakCheck.h"
+
+namespace
+{
+/// Seconds of each frame that may be spent warming up the pending materials.
+const double cWarmUpBudget = 0.004;
+}
+
+ShaderCache::ShaderCache(Framework *framework, OgreRenderer::Renderer *renderer) :
+    framework_(framework),
+    renderer_(renderer)
+{
+    cacheFile_ = CacheFilePath();
+    if (!cacheFile_.isEmpty())
+    {
+#if OGRE_VERSION_MAJOR > 1 || OGRE_VERSION_MINOR >= 8
+        Ogre::GpuProgramManager::getSingleton().setSaveMicrocodesToCache(true);
+#endif
+        // A cleared asset cache starts the shader cache over too.
+        if (!framework_->HasCommandLineParameter("--clearAssetCache"))
+            LoadCache();
+    }
+
+    connect(framework_->Asset(), SIGNAL(AssetCreated(AssetPtr)), SLOT(OnAssetCreated(AssetPtr)));
+    connect(framework_->Frame(), SIGNAL(Updated(float)), SLOT(OnUpdated(float)));
+}
+
+ShaderCache::~ShaderCache()
+{
+    SaveCache();
+}
+
+QString ShaderCache::CacheFilePath() const
+{
+#if OGRE_VERSION_MAJOR <= 1 && OGRE_VERSION_MINOR < 8
+    return QString();
+#else
+    if (framework_->HasCommandLineParameter("--noShaderCache") || !framework_->Asset()->Cache())
+        return QString();
+    Ogre::RenderSystem *renderSystem = Ogre::Root::getSingleton().getRenderSystem();
+    if (!renderSystem || !renderSystem->getCapabilities() || !Ogre::GpuProgramManager::getSingleton().canGetCompiledShaderBuffer())
+        return QString();
+
+    // The microcodes are only valid for the render system, GPU and driver they were compiled with.
+    const Ogre::RenderSystemCapabilities *caps = renderSystem->getCapabilities();
+    QByteArray key = QByteArray(renderSystem->getName().c_str()) + "|" + caps->getDeviceName().c_str() + "|" +
+        caps->getDriverVersion().toString().c_str() + "|" + Application::Version();
+    QString name = QString(QCryptographicHash::hash(key, QCryptographicHash::Sha1).toHex()) + ".microcode";
+
+    QDir cacheDir(framework_->Asset()->Cache()->CacheDirectory());
+    cacheDir.cdUp();
+    if (!cacheDir.exists("shadercache") && !cacheDir.mkdir("shadercache"))
+    {
+        LogWarning("ShaderCache: Could not create the shader cache directory in " + cacheDir.absolutePath());
+        return QString();
+    }
+    return cacheDir.absoluteFilePath("shadercache/" + name);
+#endif
+}
+
+void ShaderCache::LoadCache()
+{
+#if OGRE_VERSION_MAJOR > 1 || OGRE_VERSION_MINOR >= 8
+    QFile file(cacheFile_);
+    if (!file.exists())
+        return;
+    if (!file.open(QIODevice::ReadOnly))
+    {
+        LogWarning("ShaderCache: Could not open " + cacheFile_);
+        return;
+    }
+    QByteArray data = file.readAll();
+    file.close();
+    if (data.isEmpty())
+        return;
+
+    try
+    {
+#include "DisableMemoryLeakCheck.h"
+        Ogre::DataStreamPtr stream(new Ogre::MemoryDataStream(data.data(), data.size(), false, true));
+#include "EnableMemoryLeakCheck.h"
+        Ogre::GpuProgramManager::getSingleton().loadMicrocodeCache(stream);
+        LogInfo("ShaderCache: Loaded compiled shaders from " + cacheFile_);
+    }
+    catch(const Ogre::Exception &e)
+    {
+        LogWarning("ShaderCache: Failed to load " + cacheFile_ + ": " + e.what());
+        QFile::remove(cacheFile_);
+    }
+#endif
+}
+
+void ShaderCache::SaveCache()
+{
+#if OGRE_VERSION_MAJOR > 1 || OGRE_VERSION_MINOR >= 8
+    if (cacheFile_.isEmpty() || !Ogre::GpuProgramManager::getSingletonPtr() || !Ogre::GpuProgramManager::getSingleton().isCacheDirty())
+        return;
+
+    // Written to a temporary file first, so that another process sharing the cache never reads a partial file.
+    const QString tempFile = cacheFile_ + ".tmp";
+    try
+    {
+#include "DisableMemoryLeakCheck.h"
+        std::fstream *fs = OGRE_NEW_T(std::fstream, Ogre::MEMCATEGORY_GENERAL)(QDir::toNativeSeparators(tempFile).toLocal8Bit().constData(),
+            std::ios::out | std::ios::binary | std::ios::trunc);
+        if (!fs->is_open())
+        {
+            OGRE_DELETE_T(fs, basic_fstream, Ogre::MEMCATEGORY_GENERAL);
+            LogWarning("ShaderCache: Could not write " + tempFile);
+            return;
+        }
+        Ogre::DataStreamPtr stream(new Ogre::FileStreamDataStream(fs));
+#include "EnableMemoryLeakCheck.h"
+        Ogre::GpuProgramManager::getSingleton().saveMicrocodeCache(stream);
+        stream->close();
+    }
+    catch(const Ogre::Exception &e)
+    {
+        LogWarning("ShaderCache: Failed to save " + cacheFile_ + ": " + e.what());
+        QFile::remove(tempFile);
+        return;
+    }
+
+    QFile::remove(cacheFile_);
+    if (!QFile::rename(tempFile, cacheFile_))
+    {
+        LogWarning("ShaderCache: Could not replace " + cacheFile_);
+        QFile::remove(tempFile);
+    }
+#endif
+}
+
+void ShaderCache::OnAssetCreated(AssetPtr asset)
+{
+    if (dynamic_cast<OgreMaterialAsset*>(asset.get()))
+        connect(asset.get(), SIGNAL(Loaded(AssetPtr)), SLOT(OnMaterialLoaded(AssetPtr)), Qt::UniqueConnection);
+}
+
+void ShaderCache::OnMaterialLoaded(AssetPtr asset)
+{
+    OgreMaterialAssetPtr material = dynamic_pointer_cast<OgreMaterialAsset>(asset);
+    if (material)
+        pending_.push_back(material);
+}
+
+void ShaderCache::OnUpdated(float /*frameTime*/)
+{
+    if (pending_.empty())
+        return;
+
+    PROFILE(ShaderCache_WarmUp);
+    const tick_t start = GetCurrentClockTime();
+    const double frequency = (double)GetCurrentClockFreq();
+    while(!pending_.empty() && (double)(GetCurrentClockTime() - start) / frequency < cWarmUpBudget)
+    {
+        OgreMaterialAssetPtr asset = pending_.front().lock();
+        pending_.pop_front();
+        if (!asset || asset->ogreMaterial.isNull() || asset->ogreMaterial->isLoaded())
+            continue;
+
+        // Loading the material compiles the programs of its supported techniques, so that the clones the
+        // components make of it share the programs that are already compiled.
+        try
+        {
+            asset->ogreMaterial->load();
+        }
+        catch(const Ogre::Exception &e)
+        {
+            LogWarning("ShaderCache: Failed to warm up material " + asset->Name() + ": " + e.what());
+        }
+    }
+}
@@ -0,0 +1,63 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#pragma once
+
+#include "CoreDefines.h"
+#include "OgreModuleApi.h"
+#include "OgreModuleFwd.h"
+#include "AssetFwd.h"
+
+#include <QObject>
+#include <QString>
+
+#include <deque>
+
+class Framework;
+
+/// Keeps the compiled shader programs across runs, and compiles the programs of the loaded materials ahead of rendering.
+/** Created by Renderer when not headless. The microcodes of the compiled GPU programs are saved on exit to a file in the
+    "shadercache" directory next to the asset cache, and loaded from it at startup, so that the programs are not recompiled
+    on every launch. The file is kept per render system, GPU and driver version, and per Tundra version, as the microcodes
+    are not portable between them. Programs whose source changes without a change of their name keep their cached microcode
+    until the cache is cleared with --clearAssetCache. The cache is available when the render system can return the
+    compiled programs, i.e. on Direct3D 9, and it is disabled with --noShaderCache or --noAssetCache.
+
+    When a material asset is loaded, its Ogre material is queued to be loaded, which compiles or fetches from the cache all
+    the programs of its supported techniques. The queue is worked on at the start of each frame for a few milliseconds,
+    so that the compiling is spread over frames instead of hitching the frame that first renders each material. A material
+    that is rendered before its turn loads on demand as before. */
+class OGRE_MODULE_API ShaderCache : public QObject
+{
+    Q_OBJECT
+
+public:
+    ShaderCache(Framework *framework, OgreRenderer::Renderer *renderer);
+    /// Saves the microcode cache if new programs have been compiled.
+    ~ShaderCache();
+
+public slots:
+    /// Returns whether the compiled programs are kept in the persistent cache.
+    bool IsPersistent() const { return !cacheFile_.isEmpty(); }
+
+    /// Returns the number of materials waiting to be warmed up.
+    int NumPending() const { return (int)pending_.size(); }
+
+private slots:
+    void OnAssetCreated(AssetPtr asset);
+    void OnMaterialLoaded(AssetPtr asset);
+    void OnUpdated(float frameTime);
+
+private:
+    /// Returns the cache file for the active render system and GPU, or an empty string if the cache can not be kept.
+    QString CacheFilePath() const;
+    /// Loads the microcodes from the cache file, if it exists.
+    void LoadCache();
+    /// Writes the microcodes to the cache file, if new programs have been compiled.
+    void SaveCache();
+
+    Framework *framework_;
+    OgreRenderer::Renderer *renderer_;
+    QString cacheFile_;
+    /// Material assets waiting to be warmed up, in the order they were loaded.
+    std::deque<weak_ptr<OgreMaterialAsset> > pending_;
+};
@@ -0,0 +1,174 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#include "StableHeaders.h"
+#include "DebugOperatorNew.h"
+
+#include "ShadowMapCache.h"
+#include "OgreShadowCameraSetupFocusedPSSM.h"
+#include "OgreWorld.h"
+#include "Renderer.h"
+#include "EC_Camera.h"
+#include "Entity.h"
+#include "Scene/Scene.h"
+#include "Framework.h"
+#include "FrameAPI.h"
+#include "Profiler.h"
+#include "LoggingFunctions.h"
+
+#include <Ogre.h>
+
+#include "MemoryLeakCheck.h"
+
+ShadowMapCache::ShadowMapCache(OgreWorld *world, OgreShadowCameraSetupFocusedPSSM *setup) :
+    world_(world),
+    setup_(setup),
+    casterPass_(0),
+    minBlending_(false),
+    inDynamicPass_(false),
+    numRefreshes_(0),
+    numReuses_(0)
+{
+    // The objects are dynamic casters unless they are tagged static.
+    Ogre::MovableObject::setDefaultVisibilityFlags(~StaticCasterFlag);
+
+    Ogre::SceneManager *sceneManager = world_->OgreSceneManager();
+    for(size_t i = 0; i < setup_->getSplitCount(); ++i)
+    {
+        Ogre::TexturePtr shadowTexture = sceneManager->getShadowTexture(i);
+        shadowTextures_.push_back(shadowTexture);
+        if (i == 0 || shadowTexture.isNull())
+        {
+            cacheTextures_.push_back(Ogre::TexturePtr());
+            continue;
+        }
+        try
+        {
+            Ogre::TexturePtr cacheTexture = Ogre::TextureManager::getSingleton().createManual(world_->GenerateUniqueObjectName("ShadowMapCache_Texture"),
+                Ogre::ResourceGroupManager::DEFAULT_RESOURCE_GROUP_NAME, Ogre::TEX_TYPE_2D, shadowTexture->getWidth(), shadowTexture->getHeight(), 0,
+                shadowTexture->getFormat(), Ogre::TU_RENDERTARGET);
+            cacheTexture->getBuffer()->getRenderTarget()->setAutoUpdated(false);
+            cacheTextures_.push_back(cacheTexture);
+            shadowTexture->getBuffer()->getRenderTarget()->addListener(this);
+        }
+        catch(Ogre::Exception &e)
+        {
+            LogError(QString("ShadowMapCache: Failed to create the cache texture of shadow split %1: %2").arg(i).arg(e.what()));
+            cacheTextures_.push_back(Ogre::TexturePtr());
+        }
+    }
+
+    Ogre::MaterialPtr casterMaterial = Ogre::MaterialManager::getSingleton().getByName("rex/ShadowCaster");
+    if (!casterMaterial.isNull() && casterMaterial->getNumTechniques() > 0 && casterMaterial->getTechnique(0)->getNumPasses() > 0)
+        casterPass_ = casterMaterial->getTechnique(0)->getPass(0);
+    Ogre::RenderSystem *renderSystem = Ogre::Root::getSingleton().getRenderSystem();
+    minBlending_ = renderSystem && renderSystem->getCapabilities() && renderSystem->getCapabilities()->hasCapability(Ogre::RSC_ADVANCED_BLEND_OPERATIONS);
+
+    Framework *framework = world_->Scene()->GetFramework();
+    connect(framework->Frame(), SIGNAL(PostFrameUpdate(float)), SLOT(OnPostFrameUpdate(float)));
+}
+
+ShadowMapCache::~ShadowMapCache()
+{
+    setup_->setCacheCamera(0);
+    for(size_t i = 0; i < cacheTextures_.size(); ++i)
+    {
+        if (cacheTextures_[i].isNull())
+            continue;
+        SetPassMode(shadowTextures_[i]->getBuffer()->getRenderTarget(), FullPass);
+        shadowTextures_[i]->getBuffer()->getRenderTarget()->removeListener(this);
+        Ogre::TextureManager::getSingleton().remove(cacheTextures_[i]->getName());
+    }
+    Ogre::MovableObject::setDefaultVisibilityFlags(0xFFFFFFFF);
+}
+
+void ShadowMapCache::Invalidate()
+{
+    setup_->invalidateCache();
+}
+
+void ShadowMapCache::OnPostFrameUpdate(float /*frameTime*/)
+{
+    // Only the shadows of the main camera are cached, the other cameras render them in full.
+    OgreRenderer::Renderer *renderer = world_->Renderer();
+    Entity *cameraEntity = renderer->MainCamera();
+    EC_Camera *camera = renderer->MainCameraComponent();
+    const bool isMainScene = cameraEntity && camera && cameraEntity->ParentScene() == world_->Scene().get();
+    setup_->setCacheCamera(isMainScene ? camera->OgreCamera() : 0);
+}
+
+int ShadowMapCache::SplitIndex(const Ogre::RenderTarget *target) const
+{
+    for(size_t i = 0; i < shadowTextures_.size(); ++i)
+        if (!cacheTextures_[i].isNull() && shadowTextures_[i]->getBuffer()->getRenderTarget() == target)
+            return (int)i;
+    return -1;
+}
+
+void ShadowMapCache::SetPassMode(Ogre::RenderTarget *target, PassMode mode)
+{
+    Ogre::Viewport *viewport = (target->getNumViewports() > 0 ? target->getViewport(0) : 0);
+    if (viewport)
+    {
+        viewport->setClearEveryFrame(true, mode == DynamicPass ? Ogre::FBT_DEPTH : Ogre::FBT_COLOUR | Ogre::FBT_DEPTH);
+        if (mode == StaticPass)
+            viewport->setVisibilityMask(StaticCasterFlag);
+        else if (mode == DynamicPass)
+            viewport->setVisibilityMask(DynamicCasterFlag);
+        else
+            viewport->setVisibilityMask(0xFFFFFFFF);
+    }
+    if (casterPass_ && minBlending_)
+    {
+        if (mode == DynamicPass)
+        {
+            casterPass_->setSceneBlending(Ogre::SBF_ONE, Ogre::SBF_ONE);
+            casterPass_->setSceneBlendingOperation(Ogre::SBO_MIN);
+        }
+        else
+        {
+            casterPass_->setSceneBlending(Ogre::SBF_ONE, Ogre::SBF_ZERO);
+            casterPass_->setSceneBlendingOperation(Ogre::SBO_ADD);
+        }
+    }
+}
+
+void ShadowMapCache::preRenderTargetUpdate(const Ogre::RenderTargetEvent &evt)
+{
+    const int split = SplitIndex(evt.source);
+    if (split < 0)
+        return;
+
+    if (inDynamicPass_)
+        SetPassMode(evt.source, DynamicPass);
+    else if (!setup_->isSplitCached(split))
+        SetPassMode(evt.source, FullPass);
+    else if (setup_->isSplitRefreshed(split))
+        SetPassMode(evt.source, StaticPass);
+    else
+    {
+        PROFILE(ShadowMapCache_RestoreStaticCasters);
+        shadowTextures_[split]->getBuffer()->blit(cacheTextures_[split]->getBuffer());
+        SetPassMode(evt.source, DynamicPass);
+        ++numReuses_;
+    }
+}
+
+void ShadowMapCache::postRenderTargetUpdate(const Ogre::RenderTargetEvent &evt)
+{
+    const int split = SplitIndex(evt.source);
+    if (split < 0 || inDynamicPass_)
+        return;
+
+    if (setup_->isSplitCached(split) && setup_->isSplitRefreshed(split))
+    {
+        PROFILE(ShadowMapCache_StoreStaticCasters);
+        cacheTextures_[split]->getBuffer()->blit(shadowTextures_[split]->getBuffer());
+        ++numRefreshes_;
+
+        // The shadow camera is still set up for the split, so render the dynamic casters on top now.
+        inDynamicPass_ = true;
+        evt.source->update(false);
+        inDynamicPass_ = false;
+    }
+    SetPassMode(evt.source, FullPass);
+}
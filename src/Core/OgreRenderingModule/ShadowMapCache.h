@@ -0,0 +1,90 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#pragma once
+
+#include "CoreDefines.h"
+#include "OgreModuleApi.h"
+#include "OgreModuleFwd.h"
+
+#include <OgreRenderTargetListener.h>
+#include <OgreTexture.h>
+
+#include <QObject>
+
+#include <vector>
+
+class OgreWorld;
+class OgreShadowCameraSetupFocusedPSSM;
+
+/// Caches the static shadow casters rendered to the far PSSM splits over frames.
+/** Enabled with the "shadow map caching" rendering config setting when the shadow quality is high. The meshes baked to the
+    static geometry batches of OgreWorld are the static casters, and everything else is a dynamic caster. The splits after
+    the first one are rendered in two passes. The static casters are rendered only when OgreShadowCameraSetupFocusedPSSM
+    refreshes the shadow camera of the split, that is when the main camera has moved or turned past a tolerance, the light
+    direction has changed, or Invalidate has been called, and the result is copied to a cache texture. On the other frames
+    the cache texture is copied to the shadow texture, and only the dynamic casters are rendered on top of it.
+
+    When the render system supports the min blending operation, the dynamic casters are blended to the cached depths with it
+    so that the nearer static casters stay. Otherwise the dynamic casters overwrite the static casters they overlap. */
+class OGRE_MODULE_API ShadowMapCache : public QObject, public Ogre::RenderTargetListener
+{
+    Q_OBJECT
+
+public:
+    ShadowMapCache(OgreWorld *world, OgreShadowCameraSetupFocusedPSSM *setup);
+    ~ShadowMapCache();
+
+    /// Visibility flag of the static casters. The default visibility flags of the movable objects are set not to have it.
+    static const uint StaticCasterFlag = 0x40000000;
+    /// Visibility flag of the dynamic casters. The static casters are given all the visibility flags but this.
+    static const uint DynamicCasterFlag = 0x20000000;
+
+    /// Forces the static casters of the cached splits to be rendered again on the next frame.
+    void Invalidate();
+
+    /// Ogre::RenderTargetListener override. Sets up the pass of the shadow texture of a cached split.
+    void preRenderTargetUpdate(const Ogre::RenderTargetEvent &evt);
+
+    /// Ogre::RenderTargetListener override. Stores the rendered static casters and renders the dynamic casters on top of them.
+    void postRenderTargetUpdate(const Ogre::RenderTargetEvent &evt);
+
+public slots:
+    /// Returns the number of times the static casters of the cached splits have been rendered.
+    int NumRefreshes() const { return numRefreshes_; }
+
+    /// Returns the number of frames the cached static casters of a split have been reused.
+    int NumReuses() const { return numReuses_; }
+
+private slots:
+    void OnPostFrameUpdate(float frameTime);
+
+private:
+    enum PassMode
+    {
+        FullPass, ///< All the casters, as without the cache.
+        StaticPass, ///< The static casters only, to be stored to the cache.
+        DynamicPass ///< The dynamic casters only, on top of the cached static casters.
+    };
+
+    /// Sets the clearing, the visibility mask and the caster blending of the shadow texture viewport for the pass.
+    void SetPassMode(Ogre::RenderTarget *target, PassMode mode);
+
+    /// Returns the split index of the shadow texture render target, or -1 if it is not one of the cached splits.
+    int SplitIndex(const Ogre::RenderTarget *target) const;
+
+    OgreWorld *world_;
+    /// The shadow camera setup of the scene, owned by the scene manager.
+    OgreShadowCameraSetupFocusedPSSM *setup_;
+    /// The shadow textures of the splits.
+    std::vector<Ogre::TexturePtr> shadowTextures_;
+    /// The static casters of the splits, the first split is not cached and has none.
+    std::vector<Ogre::TexturePtr> cacheTextures_;
+    /// The rex/ShadowCaster pass, which the dynamic casters are min blended with.
+    Ogre::Pass *casterPass_;
+    /// Whether the render system supports the min blending operation.
+    bool minBlending_;
+    /// Whether the dynamic pass of a refreshed split is being rendered from postRenderTargetUpdate.
+    bool inDynamicPass_;
+    int numRefreshes_;
+    int numReuses_;
+};
@@ -0,0 +1,407 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#include "StableHeaders.h"
+#include "DebugOperatorNew.h"
+
+#include "SpatialWorld.h"
+#include "EC_Placeable.h"
+#include "EC_Mesh.h"
+#include "Entity.h"
+#include "Scene/Scene.h"
+#include "Profiler.h"
+#include "Framework.h"
+#include "JobSystem.h"
+
+#include <algorithm>
+
+#include "MemoryLeakCheck.h"
+
+namespace
+{
+/// Margin the bounds are grown by in the tree, so that small movements do not restructure it.
+const float cBoundsMargin = 0.5f;
+/// The tree is not rebuilt while it has fewer objects than this, nor after fewer changes than this since the last rebuild.
+const int cMinRebuildChanges = 64;
+/// The tree is rebuilt when its SAH cost has grown by this factor since the last rebuild.
+const float cRebuildCostRatio = 1.5f;
+
+typedef DynamicAABBTree<EC_Placeable*> PlaceableTree;
+
+/// Appends the placeables in an entity to the result, for the intersection queries of SpatialWorld.
+struct IntersectionCollector
+{
+    explicit IntersectionCollector(std::vector<EC_Placeable*> &result_) : result(result_) {}
+    bool operator()(PlaceableTree &tree, int id)
+    {
+        EC_Placeable *placeable = tree.UserData(id);
+        if (placeable->ParentEntity())
+            result.push_back(placeable);
+        return false;
+    }
+    std::vector<EC_Placeable*> &result;
+};
+
+/// Collects the placeables whose bounds intersect the AABB with their bounds, for testing them in a batch after the query.
+struct CandidateCollector
+{
+    CandidateCollector(std::vector<EC_Placeable*> &placeables_, std::vector<AABB> &bounds_) : placeables(placeables_), bounds(bounds_) {}
+    bool operator()(PlaceableTree &tree, int id, const AABB & /*aabb*/)
+    {
+        placeables.push_back(tree.UserData(id));
+        bounds.push_back(tree.Bounds(id));
+        return false;
+    }
+    std::vector<EC_Placeable*> &placeables;
+    std::vector<AABB> &bounds;
+};
+
+/// Appends the placeables in an entity to the result in the order of the ray hits, up to the maximum distance.
+struct RayCollector
+{
+    RayCollector(float maxDistance_, std::vector<EC_Placeable*> &result_) : maxDistance(maxDistance_), result(result_) {}
+    bool operator()(PlaceableTree &tree, int id, const Ray & /*ray*/, float tNear, float /*tFar*/)
+    {
+        if (tNear > maxDistance)
+            return true;
+        EC_Placeable *placeable = tree.UserData(id);
+        if (placeable->ParentEntity())
+            result.push_back(placeable);
+        return false;
+    }
+    float maxDistance;
+    std::vector<EC_Placeable*> &result;
+};
+
+/// Appends the at most k nearest placeables in an entity to the result, up to the maximum distance.
+struct NearestCollector
+{
+    NearestCollector(size_t k_, float maxDistance_, std::vector<EC_Placeable*> &result_) : k(k_), found(0), maxDistance(maxDistance_), result(result_) {}
+    bool operator()(PlaceableTree &tree, const float3 & /*point*/, int id, float minDistance)
+    {
+        if (minDistance > maxDistance)
+            return true;
+        EC_Placeable *placeable = tree.UserData(id);
+        if (placeable->ParentEntity())
+        {
+            result.push_back(placeable);
+            ++found;
+        }
+        return found >= k;
+    }
+    size_t k;
+    size_t found;
+    float maxDistance;
+    std::vector<EC_Placeable*> &result;
+};
+} // ~unnamed namespace
+
+/// Builds a snapshot of the tree in a worker thread, and hands it back to the spatial world in the main thread.
+class SpatialWorld::RebuildJob : public IJob
+{
+public:
+    explicit RebuildJob(const shared_ptr<SpatialWorld> &world) : IJob("SpatialWorld_Rebuild"), world_(world) {}
+    void Run() { snapshot.Build(); }
+    void Finished()
+    {
+        shared_ptr<SpatialWorld> world = world_.lock();
+        if (world && world->rebuildJob_.get() == this)
+            world->FinishRebuild();
+    }
+
+    PlaceableTree::RebuildSnapshot snapshot;
+
+private:
+    weak_ptr<SpatialWorld> world_;
+};
+
+SpatialWorld::SpatialWorld(ScenePtr scene) :
+    scene_(scene),
+    tree_(cBoundsMargin),
+    changesSinceRebuild_(0),
+    rebuiltCost_(0.f)
+{
+}
+
+SpatialWorld::~SpatialWorld()
+{
+    for(size_t i = 0; i < proxies_.size(); ++i)
+        if (proxies_[i].placeable)
+        {
+            proxies_[i].placeable->spatialWorld_ = 0;
+            proxies_[i].placeable->spatialProxy_ = -1;
+        }
+}
+
+void SpatialWorld::Add(EC_Placeable *placeable)
+{
+    if (!placeable || placeable->spatialWorld_)
+        return;
+
+    int index;
+    if (!freeProxies_.empty())
+    {
+        index = freeProxies_.back();
+        freeProxies_.pop_back();
+    }
+    else
+    {
+        index = (int)proxies_.size();
+        proxies_.push_back(Proxy());
+    }
+    proxies_[index] = Proxy();
+    proxies_[index].placeable = placeable;
+    placeable->spatialWorld_ = this;
+    placeable->spatialProxy_ = index;
+    // The placeable is inserted into the tree on the first refit, when it has its entity and transform
+    MarkMoved(placeable);
+}
+
+void SpatialWorld::Remove(EC_Placeable *placeable)
+{
+    if (!placeable || placeable->spatialWorld_ != this)
+        return;
+
+    int index = placeable->spatialProxy_;
+    Proxy &proxy = proxies_[index];
+    if (proxy.object != -1)
+    {
+        tree_.Remove(proxy.object);
+        ++changesSinceRebuild_;
+    }
+    // A removed proxy is left in movedProxies_ and skipped by Refit, as it is not marked moved anymore.
+    proxy = Proxy();
+    freeProxies_.push_back(index);
+    placeable->spatialWorld_ = 0;
+    placeable->spatialProxy_ = -1;
+
+    // If there are no queries, drop the removed proxies from movedProxies_ before it grows past the placeables.
+    if (movedProxies_.size() > 2 * proxies_.size())
+    {
+        std::vector<int> moved;
+        for(size_t i = 0; i < movedProxies_.size(); ++i)
+            if (proxies_[movedProxies_[i]].moved)
+            {
+                proxies_[movedProxies_[i]].moved = false;
+                moved.push_back(movedProxies_[i]);
+            }
+        for(size_t i = 0; i < moved.size(); ++i)
+            proxies_[moved[i]].moved = true;
+        movedProxies_.swap(moved);
+    }
+}
+
+void SpatialWorld::MarkMoved(EC_Placeable *placeable)
+{
+    if (!placeable || placeable->spatialWorld_ != this)
+        return;
+    Proxy &proxy = proxies_[placeable->spatialProxy_];
+    if (!proxy.moved)
+    {
+        proxy.moved = true;
+        movedProxies_.push_back(placeable->spatialProxy_);
+    }
+}
+
+void SpatialWorld::OnMeshChanged()
+{
+    EC_Mesh *mesh = qobject_cast<EC_Mesh*>(sender());
+    Entity *entity = mesh ? mesh->ParentEntity() : 0;
+    if (entity)
+        MarkMoved(entity->Component<EC_Placeable>().get());
+}
+
+AABB SpatialWorld::Bounds(Proxy &proxy)
+{
+    EC_Placeable *placeable = proxy.placeable;
+    const float3 position = placeable->WorldPosition();
+    AABB bounds(position, position);
+    Entity *entity = placeable->ParentEntity();
+    if (!entity)
+        return bounds;
+    // The bounds enclose all the meshes of the entity, so that the ray queries of OgreWorld find each of them.
+    std::vector<shared_ptr<EC_Mesh> > meshes = entity->ComponentsOfType<EC_Mesh>();
+    for(size_t i = 0; i < meshes.size(); ++i)
+    {
+        connect(meshes[i].get(), SIGNAL(MeshChanged()), this, SLOT(OnMeshChanged()), Qt::UniqueConnection);
+        AABB meshBounds = meshes[i]->WorldAABB();
+        if (meshBounds.IsFinite())
+            bounds.Enclose(meshBounds);
+    }
+    return bounds;
+}
+
+void SpatialWorld::Refit()
+{
+    if (movedProxies_.empty())
+        return;
+
+    PROFILE(SpatialWorld_Refit);
+    std::vector<int> stillMoving;
+    for(size_t i = 0; i < movedProxies_.size(); ++i)
+    {
+        int index = movedProxies_[i];
+        Proxy &proxy = proxies_[index];
+        // Skip the removed proxies, and a reused proxy listed again after its removal
+        if (!proxy.moved)
+            continue;
+        proxy.moved = false;
+        if (!proxy.placeable->ParentEntity())
+        {
+            // Not in an entity yet, or detached from it. Leave out of the tree, and check again on the next query.
+            if (proxy.object != -1)
+            {
+                tree_.Remove(proxy.object);
+                proxy.object = -1;
+                ++changesSinceRebuild_;
+            }
+            stillMoving.push_back(index);
+            continue;
+        }
+
+        const AABB bounds = Bounds(proxy);
+        if (proxy.object == -1)
+        {
+            proxy.object = tree_.Insert(bounds, proxy.placeable);
+            ++changesSinceRebuild_;
+        }
+        else if (tree_.Update(proxy.object, bounds))
+            ++changesSinceRebuild_;
+
+        // Placeables attached to a bone do not cache their world transform, and are not notified when the bone
+        // animates, so refit them on every query.
+        if (proxy.placeable->worldTransformDirty_)
+            stillMoving.push_back(index);
+    }
+    movedProxies_.swap(stillMoving);
+    for(size_t i = 0; i < movedProxies_.size(); ++i)
+        proxies_[movedProxies_[i]].moved = true;
+
+    RebuildIfDegraded();
+}
+
+void SpatialWorld::RebuildIfDegraded()
+{
+    if (rebuildJob_ || changesSinceRebuild_ < std::max(cMinRebuildChanges, tree_.NumObjects() / 4) || tree_.NumObjects() < cMinRebuildChanges)
+        return;
+    changesSinceRebuild_ = 0;
+    if (tree_.SAHCost() <= cRebuildCostRatio * rebuiltCost_)
+        return;
+
+    ScenePtr scene = scene_.lock();
+    JobSystem *jobs = (scene && scene->GetFramework() ? scene->GetFramework()->Jobs() : 0);
+    if (!jobs)
+    {
+        PROFILE(SpatialWorld_Rebuild);
+        tree_.Rebuild();
+        rebuiltCost_ = tree_.SAHCost();
+        return;
+    }
+    // The changes made while the job runs are applied to the new tree in FinishRebuild.
+    rebuildJob_ = MAKE_SHARED(RebuildJob, shared_from_this());
+    tree_.BeginRebuild(rebuildJob_->snapshot);
+    jobs->Schedule(rebuildJob_, true);
+}
+
+void SpatialWorld::FinishRebuild()
+{
+    PROFILE(SpatialWorld_FinishRebuild);
+    tree_.EndRebuild(rebuildJob_->snapshot);
+    rebuildJob_.reset();
+    rebuiltCost_ = tree_.SAHCost();
+}
+
+void SpatialWorld::Query(const Sphere &sphere, std::vector<EC_Placeable*> &result)
+{
+    Refit();
+    IntersectionCollector collector(result);
+    tree_.IntersectionQuery(sphere, collector);
+}
+
+void SpatialWorld::Query(const AABB &aabb, std::vector<EC_Placeable*> &result)
+{
+    Refit();
+    IntersectionCollector collector(result);
+    tree_.IntersectionQuery(aabb, collector);
+}
+
+void SpatialWorld::Query(const Frustum &frustum, std::vector<EC_Placeable*> &result)
+{
+    Refit();
+    // Find the candidates by the AABB of the frustum, and test them against its planes in one batch, which is much
+    // faster than the exact frustum test of each node.
+    std::vector<EC_Placeable*> candidates;
+    std::vector<AABB> bounds;
+    CandidateCollector collector(candidates, bounds);
+    tree_.AABBQuery(frustum.MinimalEnclosingAABB(), collector);
+    if (bounds.empty())
+        return;
+    std::vector<u32> inFrustum((bounds.size() + 31) / 32);
+    frustum.BatchIntersects(&bounds[0], (int)bounds.size(), &inFrustum[0]);
+    for(size_t i = 0; i < candidates.size(); ++i)
+        if ((inFrustum[i >> 5] & (1u << (i & 31))) && candidates[i]->ParentEntity())
+            result.push_back(candidates[i]);
+}
+
+void SpatialWorld::Query(const Ray &ray, float maxDistance, std::vector<EC_Placeable*> &result)
+{
+    Refit();
+    RayCollector collector(maxDistance, result);
+    tree_.RayQuery(ray, collector);
+}
+
+void SpatialWorld::QueryNearest(const float3 &point, size_t k, float maxDistance, std::vector<EC_Placeable*> &result)
+{
+    Refit();
+    if (k == 0)
+        return;
+    NearestCollector collector(k, maxDistance, result);
+    tree_.NearestObjects(point, collector);
+}
+
+EntityList SpatialWorld::ToEntityList(const std::vector<EC_Placeable*> &placeables)
+{
+    EntityList entities;
+    for(size_t i = 0; i < placeables.size(); ++i)
+    {
+        Entity *entity = placeables[i]->ParentEntity();
+        if (entity)
+            entities.push_back(entity->shared_from_this());
+    }
+    return entities;
+}
+
+EntityList SpatialWorld::EntitiesInSphere(const Sphere &sphere)
+{
+    std::vector<EC_Placeable*> placeables;
+    Query(sphere, placeables);
+    return ToEntityList(placeables);
+}
+
+EntityList SpatialWorld::EntitiesInAABB(const AABB &aabb)
+{
+    std::vector<EC_Placeable*> placeables;
+    Query(aabb, placeables);
+    return ToEntityList(placeables);
+}
+
+EntityList SpatialWorld::EntitiesInFrustum(const Frustum &frustum)
+{
+    std::vector<EC_Placeable*> placeables;
+    Query(frustum, placeables);
+    return ToEntityList(placeables);
+}
+
+EntityList SpatialWorld::EntitiesOnRay(const Ray &ray, float maxDistance)
+{
+    std::vector<EC_Placeable*> placeables;
+    Query(ray, maxDistance, placeables);
+    return ToEntityList(placeables);
+}
+
+EntityList SpatialWorld::NearestEntities(const float3 &point, int k, float maxDistance)
+{
+    std::vector<EC_Placeable*> placeables;
+    if (k > 0)
+        QueryNearest(point, (size_t)k, maxDistance, placeables);
+    return ToEntityList(placeables);
+}
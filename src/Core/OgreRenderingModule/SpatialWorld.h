@@ -0,0 +1,124 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#pragma once
+
+#include "CoreDefines.h"
+#include "OgreModuleApi.h"
+#include "OgreModuleFwd.h"
+#include "SceneFwd.h"
+#include "Math/float3.h"
+#include "Geometry/AABB.h"
+#include "Geometry/Sphere.h"
+#include "Geometry/Frustum.h"
+#include "Geometry/Ray.h"
+#include "Geometry/DynamicAABBTree.h"
+
+#include <QObject>
+
+#include <vector>
+
+/// Dynamic bounding volume hierarchy over the placeable entities of a scene, for spatial queries from all modules.
+/** Every EC_Placeable of the scene is kept in a DynamicAABBTree. The bounds of a placeable are the world AABBs of
+    the EC_Mesh components of its entity when the meshes are loaded, and its world position otherwise. The tree stores the bounds
+    grown by a margin, so that a placeable moving within its grown bounds does not restructure the tree. Moved
+    placeables are refitted lazily on the next query. When the refits have degraded the tree, it is rebuilt in a
+    worker thread of the JobSystem, and the queries use the old tree until the new one is done.
+
+    The bounds are computed from EC_Placeable::LocalToWorld, so the queries work without Ogre scene nodes, also
+    on a headless server. The results contain the placeables that are in an entity, in no particular order, except
+    for the ray and nearest entity queries, which are sorted by distance.
+
+    The spatial world of a scene is accessible as the dynamic scene property "spatial", e.g. scene.spatial.EntitiesInSphere(...)
+    from JavaScript, or with Scene::Subsystem<SpatialWorld>() from C++. */
+class OGRE_MODULE_API SpatialWorld : public QObject, public enable_shared_from_this<SpatialWorld>
+{
+    Q_OBJECT
+
+public:
+    /// Called by the OgreRenderingModule upon the creation of a new scene
+    explicit SpatialWorld(ScenePtr scene);
+    /// Unlinks the placeables still in the tree.
+    ~SpatialWorld();
+
+    /// Dynamic scene property name "spatial"
+    static const char* PropertyName() { return "spatial"; }
+
+    /// Adds a placeable to the tree. Called by EC_Placeable on creation.
+    void Add(EC_Placeable *placeable);
+    /// Removes a placeable from the tree. Called by EC_Placeable on destruction.
+    void Remove(EC_Placeable *placeable);
+    /// Marks the bounds of a placeable to be refitted before the next query. Called by EC_Placeable when its world transform changes.
+    void MarkMoved(EC_Placeable *placeable);
+
+    /// Appends the placeables whose bounds intersect the sphere to the result.
+    void Query(const Sphere &sphere, std::vector<EC_Placeable*> &result);
+    /// Appends the placeables whose bounds intersect the AABB to the result.
+    void Query(const AABB &aabb, std::vector<EC_Placeable*> &result);
+    /// Appends the placeables whose bounds intersect the frustum to the result.
+    /** The test is conservative, see Frustum::BatchIntersects: a placeable near an edge of the frustum can be included. */
+    void Query(const Frustum &frustum, std::vector<EC_Placeable*> &result);
+    /// Appends the placeables whose bounds the ray hits within the maximum distance to the result, nearest first.
+    void Query(const Ray &ray, float maxDistance, std::vector<EC_Placeable*> &result);
+    /// Appends the at most k placeables whose bounds are nearest to the point within the maximum distance to the result, nearest first.
+    void QueryNearest(const float3 &point, size_t k, float maxDistance, std::vector<EC_Placeable*> &result);
+
+    /// Returns the number of placeables in the tree.
+    size_t NumPlaceables() const { return proxies_.size() - freeProxies_.size(); }
+
+public slots:
+    /// Returns the entities whose bounds intersect the sphere.
+    EntityList EntitiesInSphere(const Sphere &sphere);
+    /// @overload
+    EntityList EntitiesInSphere(const float3 &center, float radius) { return EntitiesInSphere(Sphere(center, radius)); }
+    /// Returns the entities whose bounds intersect the AABB.
+    EntityList EntitiesInAABB(const AABB &aabb);
+    /// Returns the entities whose bounds intersect the frustum.
+    EntityList EntitiesInFrustum(const Frustum &frustum);
+    /// Returns the entities whose bounds the ray hits within the maximum distance, nearest first.
+    EntityList EntitiesOnRay(const Ray &ray, float maxDistance);
+    /// @overload
+    EntityList EntitiesOnRay(const Ray &ray) { return EntitiesOnRay(ray, FLOAT_INF); }
+    /// Returns the at most k entities nearest to the point within the maximum distance, nearest first.
+    EntityList NearestEntities(const float3 &point, int k, float maxDistance);
+    /// @overload
+    EntityList NearestEntities(const float3 &point, int k) { return NearestEntities(point, k, FLOAT_INF); }
+
+private slots:
+    /// Refits the bounds of the placeable of the mesh that sent the signal.
+    void OnMeshChanged();
+
+private:
+    class RebuildJob;
+    friend class RebuildJob;
+
+    /// A placeable in the tree.
+    struct Proxy
+    {
+        Proxy() : placeable(0), object(-1), moved(false) {}
+
+        EC_Placeable *placeable; ///< Null for a free proxy.
+        int object; ///< Object of the placeable in the tree, or -1 until first refitted.
+        bool moved; ///< Whether the proxy is in movedProxies_.
+    };
+
+    /// Refits the moved proxies, and starts a rebuild if the tree has degraded. Called before each query.
+    void Refit();
+    /// Starts a rebuild in a worker thread if the tree has degraded enough since the last one.
+    void RebuildIfDegraded();
+    /// Replaces the tree with the one built by the rebuild job. Called by RebuildJob in the main thread.
+    void FinishRebuild();
+    /// Returns the current bounds of the placeable of the proxy.
+    AABB Bounds(Proxy &proxy);
+
+    /// Returns the entities of the queried placeables.
+    static EntityList ToEntityList(const std::vector<EC_Placeable*> &placeables);
+
+    SceneWeakPtr scene_;
+    DynamicAABBTree<EC_Placeable*> tree_;
+    std::vector<Proxy> proxies_;
+    std::vector<int> freeProxies_;
+    std::vector<int> movedProxies_; ///< Proxies to refit before the next query.
+    int changesSinceRebuild_; ///< Number of the insertions, removals and reinsertions in the tree since the last rebuild.
+    float rebuiltCost_; ///< DynamicAABBTree::SAHCost after the last rebuild.
+    shared_ptr<RebuildJob> rebuildJob_; ///< The rebuild in progress, or null.
+};
@@ -16,6 +16,13 @@
 #include <QFontMetrics>
 #include <QPainter>
 #include <QFileInfo>
+#include <QThread>
+#include <QThreadPool>
+#include <QRunnable>
+#include <QSemaphore>
+#include <QAtomicInt>
+
+#include <climits>
 
 #include <Ogre.h>
 
@@ -43,8 +50,488 @@
 const float BUDGET_THRESHOLD = 0.80f; // The point at which we start reducing texture size
 const float BUDGET_STEP = 0.05f; // The step at which texture maximum size limit is halved
 
+namespace
+{
+
+/// Returns the number of top mip levels to leave out of a texture to reduce it to at most outWidth x outHeight.
+/** Does not go below 4 pixels in either dimension, and leaves at least one level. */
+size_t NumTopMipLevelsToSkip(size_t width, size_t height, size_t outWidth, size_t outHeight, size_t numLevels)
+{
+    if (numLevels <= 1)
+        return 0;
+    size_t numSkipped = 0;
+    while((width > outWidth || height > outHeight) && width != 4 && height != 4)
+    {
+        width >>= 1;
+        height >>= 1;
+        ++numSkipped;
+    }
+    return std::min(numSkipped, numLevels - 1);
+}
+
+#if defined(DIRECTX_ENABLED) && defined(WIN32)
+/// Images with at least this many pixels are DXT compressed in strips in parallel.
+const int cMinParallelCompressPixels = 128 * 128;
+/// Rows of 4x4 blocks per strip when compressing in parallel. Small enough to balance the strips over the threads.
+const int cBlockRowsPerStrip = 4;
+
+/// The strips of an image being DXT compressed, taken one at a time by the threads that compress it.
+struct SquishCompressJob
+{
+    const u8 *rgba;
+    int width;
+    int height;
+    u8 *blocks;
+    int flags;
+    int blockRowBytes;
+    int numStrips;
+    QAtomicInt nextStrip;
+
+    /// Compresses the next strip that no other thread has taken, until none are left.
+    void CompressStrips()
+    {
+        for(;;)
+        {
+            const int strip = nextStrip.fetchAndAddRelaxed(1);
+            if (strip >= numStrips)
+                return;
+            // Each strip is written to its own range of blocks, as a block row covers four pixel rows.
+            const int y = strip * cBlockRowsPerStrip * 4;
+            squish::CompressImage((const squish::u8*)(rgba + (size_t)y * width * 4), width, std::min(cBlockRowsPerStrip * 4, height - y),
+                blocks + (size_t)strip * cBlockRowsPerStrip * blockRowBytes, flags);
+        }
+    }
+};
+
+/// Helps to DXT compress the strips of an image in a worker thread.
+class SquishStripTask : public QRunnable
+{
+public:
+    SquishStripTask(SquishCompressJob *job, QSemaphore *done) : job_(job), done_(done) {}
+
+    void run()
+    {
+        job_->CompressStrips();
+        done_->release();
+    }
+
+private:
+    SquishCompressJob *job_;
+    QSemaphore *done_;
+};
+
+/// DXT compresses an A8B8G8R8 image with libsquish, in strips of rows of whole blocks in parallel if the image is large.
+/** The calling thread compresses strips too, and is helped by the idle threads of the global thread pool, so that the
+    compression does not wait for the pool when it is busy with e.g. asset loads. */
+void SquishCompressImage(const u8 *rgba, int width, int height, u8 *blocks, int flags, int bytesPerBlock)
+{
+    SquishCompressJob job;
+    job.rgba = rgba;
+    job.width = width;
+    job.height = height;
+    job.blocks = blocks;
+    job.flags = flags;
+    job.blockRowBytes = (width + 3) / 4 * bytesPerBlock;
+    job.numStrips = ((height + 3) / 4 + cBlockRowsPerStrip - 1) / cBlockRowsPerStrip;
+
+    const int maxHelpers = std::min(QThread::idealThreadCount(), job.numStrips) - 1;
+    if (maxHelpers <= 0 || width * height < cMinParallelCompressPixels)
+    {
+        squish::CompressImage((const squish::u8*)rgba, width, height, blocks, flags);
+        return;
+    }
+
+    QSemaphore done;
+    int numHelpers = 0;
+    for(int i = 0; i < maxHelpers; ++i)
+    {
+        SquishStripTask *task = new SquishStripTask(&job, &done);
+        if (!QThreadPool::globalInstance()->tryStart(task)) // The pool deletes the task when done.
+        {
+            delete task;
+            break;
+        }
+        ++numHelpers;
+    }
+    job.CompressStrips();
+    done.acquire(numHelpers);
+}
+#endif
+
+#if OGRE_VERSION_MAJOR > 1 || OGRE_VERSION_MINOR >= 9
+/// Intensity modifier tables of ETC1, each {a, b, -a, -b} in the order of the pixel index values.
+const int cEtc1Modifiers[8][4] =
+{
+    { 2, 8, -2, -8 }, { 5, 17, -5, -17 }, { 9, 29, -9, -29 }, { 13, 42, -13, -42 },
+    { 18, 60, -18, -60 }, { 24, 80, -24, -80 }, { 33, 106, -33, -106 }, { 47, 183, -47, -183 }
+};
+
+/// Modifier tables of the EAC alpha blocks of ETC2 RGBA8.
+const int cEacModifiers[16][8] =
+{
+    { -3, -6, -9, -15, 2, 5, 8, 14 }, { -3, -7, -10, -13, 2, 6, 9, 12 }, { -2, -5, -8, -13, 1, 4, 7, 12 }, { -2, -4, -6, -13, 1, 3, 5, 12 },
+    { -3, -6, -8, -12, 2, 5, 7, 11 }, { -3, -7, -9, -11, 2, 6, 8, 10 }, { -4, -7, -8, -11, 3, 6, 7, 10 }, { -3, -5, -8, -11, 2, 4, 7, 10 },
+    { -2, -6, -8, -10, 1, 5, 7, 9 }, { -2, -5, -8, -10, 1, 4, 7, 9 }, { -2, -4, -8, -10, 1, 3, 7, 9 }, { -2, -5, -7, -10, 1, 4, 6, 9 },
+    { -3, -4, -7, -10, 2, 3, 6, 9 }, { -1, -2, -3, -10, 0, 1, 2, 9 }, { -4, -6, -8, -9, 3, 5, 7, 8 }, { -3, -5, -7, -9, 2, 4, 6, 8 }
+};
+
+inline int ClampByte(int value)
+{
+    return value < 0 ? 0 : (value > 255 ? 255 : value);
+}
+
+/// Expands an RGB565 colour to 8 bits per channel.
+void Unpack565(u16 packed, int *rgb)
+{
+    rgb[0] = ((packed >> 11) & 31) * 255 / 31;
+    rgb[1] = ((packed >> 5) & 63) * 255 / 63;
+    rgb[2] = (packed & 31) * 255 / 31;
+}
+
+/// Decodes the colour block of a DXT block to 16 RGB texels in row-major order.
+/** Returns false if the block uses the transparent index of DXT1, which ETC1 cannot express. */
+bool DecodeDXTColorBlock(const u8 *block, bool dxt1, int texels[16][3])
+{
+    const u16 c0 = (u16)(block[0] | (block[1] << 8));
+    const u16 c1 = (u16)(block[2] | (block[3] << 8));
+    int colors[4][3];
+    Unpack565(c0, colors[0]);
+    Unpack565(c1, colors[1]);
+    const bool fourColors = !dxt1 || c0 > c1;
+    for(int c = 0; c < 3; ++c)
+    {
+        if (fourColors)
+        {
+            colors[2][c] = (2 * colors[0][c] + colors[1][c]) / 3;
+            colors[3][c] = (colors[0][c] + 2 * colors[1][c]) / 3;
+        }
+        else
+        {
+            colors[2][c] = (colors[0][c] + colors[1][c]) / 2;
+            colors[3][c] = 0;
+        }
+    }
+    const u32 indices = block[4] | (block[5] << 8) | (block[6] << 16) | ((u32)block[7] << 24);
+    for(int i = 0; i < 16; ++i)
+    {
+        const int index = (indices >> (2 * i)) & 3;
+        if (index == 3 && !fourColors)
+            return false;
+        texels[i][0] = colors[index][0];
+        texels[i][1] = colors[index][1];
+        texels[i][2] = colors[index][2];
+    }
+    return true;
+}
+
+/// Decodes the alpha block of a DXT3 or DXT5 block to 16 alpha values in row-major order.
+void DecodeDXTAlphaBlock(const u8 *block, bool dxt5, int alpha[16])
+{
+    if (!dxt5)
+    {
+        for(int i = 0; i < 16; ++i)
+            alpha[i] = ((block[i / 2] >> (4 * (i & 1))) & 15) * 17;
+        return;
+    }
+    int values[8];
+    values[0] = block[0];
+    values[1] = block[1];
+    if (values[0] > values[1])
+    {
+        for(int i = 1; i < 7; ++i)
+            values[i + 1] = ((7 - i) * values[0] + i * values[1]) / 7;
+    }
+    else
+    {
+        for(int i = 1; i < 5; ++i)
+            values[i + 1] = ((5 - i) * values[0] + i * values[1]) / 5;
+        values[6] = 0;
+        values[7] = 255;
+    }
+    u64 indices = 0;
+    for(int i = 0; i < 6; ++i)
+        indices |= (u64)block[2 + i] << (8 * i);
+    for(int i = 0; i < 16; ++i)
+        alpha[i] = values[(indices >> (3 * i)) & 7];
+}
+
+/// Picks the modifier table and pixel indices of an ETC1 subblock for the given base colour. Returns the squared error.
+int FitEtc1Subblock(const int texels[16][3], const int *pixels, const int *base, int &bestTable, u32 &pixelIndices)
+{
+    int bestError = INT_MAX;
+    for(int table = 0; table < 8; ++table)
+    {
+        int error = 0;
+        u32 indices = 0;
+        for(int p = 0; p < 8; ++p)
+        {
+            const int *texel = texels[pixels[p]];
+            int bestPixelError = INT_MAX;
+            int bestIndex = 0;
+            for(int index = 0; index < 4; ++index)
+            {
+                const int modifier = cEtc1Modifiers[table][index];
+                const int dr = ClampByte(base[0] + modifier) - texel[0];
+                const int dg = ClampByte(base[1] + modifier) - texel[1];
+                const int db = ClampByte(base[2] + modifier) - texel[2];
+                const int pixelError = dr * dr + dg * dg + db * db;
+                if (pixelError < bestPixelError)
+                {
+                    bestPixelError = pixelError;
+                    bestIndex = index;
+                }
+            }
+            error += bestPixelError;
+            indices |= (u32)bestIndex << (2 * p);
+        }
+        if (error < bestError)
+        {
+            bestError = error;
+            bestTable = table;
+            pixelIndices = indices;
+        }
+    }
+    return bestError;
+}
+
+/// Writes the pixel indices of a subblock to the index bits of an ETC1 block, which are ordered by columns.
+void SetEtc1PixelIndices(const int *pixels, u32 subblockIndices, u32 &msbs, u32 &lsbs)
+{
+    for(int p = 0; p < 8; ++p)
+    {
+        const int x = pixels[p] & 3;
+        const int y = pixels[p] >> 2;
+        const u32 index = (subblockIndices >> (2 * p)) & 3;
+        msbs |= (index >> 1) << (x * 4 + y);
+        lsbs |= (index & 1) << (x * 4 + y);
+    }
+}
+
+/// Encodes 16 RGB texels in row-major order to an ETC1 block, which is also a valid ETC2 RGB8 block.
+/** A fast encoder: the base colours are the averages of the subblocks, in the differential mode when it fits
+    without overflowing, so that ETC2 decoders do not take the block for one of their additional modes. */
+void EncodeEtc1Block(const int texels[16][3], u8 *out)
+{
+    u64 bestBlock = 0;
+    int bestError = INT_MAX;
+    for(int flip = 0; flip < 2; ++flip)
+    {
+        int pixels[2][8];
+        int count[2] = { 0, 0 };
+        for(int i = 0; i < 16; ++i)
+        {
+            const int subblock = flip ? ((i >> 2) >= 2) : ((i & 3) >= 2);
+            pixels[subblock][count[subblock]++] = i;
+        }
+
+        int average[2][3];
+        for(int s = 0; s < 2; ++s)
+            for(int c = 0; c < 3; ++c)
+            {
+                int sum = 0;
+                for(int p = 0; p < 8; ++p)
+                    sum += texels[pixels[s][p]][c];
+                average[s][c] = (sum + 4) / 8;
+            }
+
+        int quantized[2][3];
+        bool differential = true;
+        for(int c = 0; c < 3; ++c)
+        {
+            quantized[0][c] = (average[0][c] * 31 + 127) / 255;
+            quantized[1][c] = (average[1][c] * 31 + 127) / 255;
+            const int delta = quantized[1][c] - quantized[0][c];
+            if (delta < -4 || delta > 3)
+                differential = false;
+        }
+        int base[2][3];
+        for(int c = 0; c < 3; ++c)
+        {
+            if (differential)
+            {
+                base[0][c] = (quantized[0][c] << 3) | (quantized[0][c] >> 2);
+                base[1][c] = (quantized[1][c] << 3) | (quantized[1][c] >> 2);
+            }
+            else
+            {
+                quantized[0][c] = (average[0][c] * 15 + 127) / 255;
+                quantized[1][c] = (average[1][c] * 15 + 127) / 255;
+                base[0][c] = quantized[0][c] * 17;
+                base[1][c] = quantized[1][c] * 17;
+            }
+        }
+
+        int tables[2];
+        u32 indices[2];
+        const int error = FitEtc1Subblock(texels, pixels[0], base[0], tables[0], indices[0]) +
+            FitEtc1Subblock(texels, pixels[1], base[1], tables[1], indices[1]);
+        if (error >= bestError)
+            continue;
+        bestError = error;
+
+        u32 high = 0;
+        for(int c = 0; c < 3; ++c)
+        {
+            const int shift = 24 - 8 * c;
+            if (differential)
+                high |= (u32)((quantized[0][c] << 3) | ((quantized[1][c] - quantized[0][c]) & 7)) << shift;
+            else
+                high |= (u32)((quantized[0][c] << 4) | quantized[1][c]) << shift;
+        }
+        high |= (u32)tables[0] << 5 | (u32)tables[1] << 2 | (differential ? 2u : 0u) | (u32)flip;
+
+        u32 msbs = 0, lsbs = 0;
+        SetEtc1PixelIndices(pixels[0], indices[0], msbs, lsbs);
+        SetEtc1PixelIndices(pixels[1], indices[1], msbs, lsbs);
+        bestBlock = ((u64)high << 32) | (msbs << 16) | lsbs;
+    }
+    for(int i = 0; i < 8; ++i)
+        out[i] = (u8)(bestBlock >> (56 - 8 * i));
+}
+
+/// Encodes 16 alpha values in row-major order to an EAC alpha block of ETC2 RGBA8.
+void EncodeEacAlphaBlock(const int alpha[16], u8 *out)
+{
+    int minAlpha = 255, maxAlpha = 0;
+    for(int i = 0; i < 16; ++i)
+    {
+        minAlpha = std::min(minAlpha, alpha[i]);
+        maxAlpha = std::max(maxAlpha, alpha[i]);
+    }
+
+    u64 bestBlock = 0;
+    int bestError = INT_MAX;
+    for(int table = 0; table < 16 && bestError > 0; ++table)
+    {
+        const int *modifiers = cEacModifiers[table];
+        const int range = modifiers[7] - modifiers[3];
+        const int base = ClampByte((minAlpha * modifiers[7] - maxAlpha * modifiers[3] + range / 2) / range);
+        const int multiplier = (maxAlpha - minAlpha + range / 2) / range;
+        // Try the multipliers next to the estimate too, as the tables are not symmetric.
+        for(int m = std::max(1, multiplier - 1); m <= std::min(15, multiplier + 1); ++m)
+        {
+            int error = 0;
+            u64 indices = 0;
+            for(int i = 0; i < 16; ++i)
+            {
+                int bestPixelError = INT_MAX;
+                int bestIndex = 0;
+                for(int index = 0; index < 8; ++index)
+                {
+                    const int d = ClampByte(base + modifiers[index] * m) - alpha[i];
+                    if (d * d < bestPixelError)
+                    {
+                        bestPixelError = d * d;
+                        bestIndex = index;
+                    }
+                }
+                error += bestPixelError;
+                // The pixel indices are ordered by columns, the first pixel in the most significant bits.
+                const int pixel = (i & 3) * 4 + (i >> 2);
+                indices |= (u64)bestIndex << (45 - 3 * pixel);
+            }
+            if (error < bestError)
+            {
+                bestError = error;
+                bestBlock = ((u64)base << 56) | ((u64)m << 52) | ((u64)table << 48) | indices;
+            }
+        }
+    }
+    for(int i = 0; i < 8; ++i)
+        out[i] = (u8)(bestBlock >> (56 - 8 * i));
+}
+
+/// Returns whether the render system lacks DXT but has ETC texture compression, so that DXT textures are transcoded to ETC.
+bool NeedsETCTranscode()
+{
+    Ogre::RenderSystem *renderSystem = Ogre::Root::getSingleton().getRenderSystem();
+    const Ogre::RenderSystemCapabilities *caps = renderSystem ? renderSystem->getCapabilities() : 0;
+    return caps && !caps->hasCapability(Ogre::RSC_TEXTURE_COMPRESSION_DXT) &&
+        (caps->hasCapability(Ogre::RSC_TEXTURE_COMPRESSION_ETC1) || caps->hasCapability(Ogre::RSC_TEXTURE_COMPRESSION_ETC2));
+}
+
+/// Loads a DXT1, DXT3 or DXT5 DDS image, with all its faces and mip levels, as ETC1 or ETC2.
+/** Ogre would decompress the DXT data of a DDS image when the render system does not support DXT. DXT1 goes to ETC1,
+    and DXT3 and DXT5 to ETC2 RGBA8, which both have the same block sizes as their source so that the blocks map one to one
+    over the whole image. Returns false and rewinds the stream if the render system does not support the target format,
+    the image is not a 2D or cube map DXT image, or a DXT1 block has transparent texels. */
+bool LoadDDSAsETC(Ogre::DataStreamPtr &stream, Ogre::Image &image)
+{
+    crn_uint32 signature = 0;
+    crnlib::DDSURFACEDESC2 header;
+    stream->seek(0);
+    const bool validHeader = stream->read(&signature, sizeof(signature)) == sizeof(signature) && signature == crnlib::cDDSFileSignature &&
+        stream->read(&header, sizeof(header)) == sizeof(header) && (header.ddpfPixelFormat.dwFlags & crnlib::DDPF_FOURCC) &&
+        !(header.ddsCaps.dwCaps2 & crnlib::DDSCAPS2_VOLUME);
+    const crn_uint32 fourCC = validHeader ? header.ddpfPixelFormat.dwFourCC : 0;
+    const Ogre::RenderSystemCapabilities *caps = Ogre::Root::getSingleton().getRenderSystem()->getCapabilities();
+    const bool dxt1 = fourCC == crnlib::PIXEL_FMT_DXT1;
+    if (!dxt1 && !((fourCC == crnlib::PIXEL_FMT_DXT3 || fourCC == crnlib::PIXEL_FMT_DXT5) && caps->hasCapability(Ogre::RSC_TEXTURE_COMPRESSION_ETC2)))
+    {
+        stream->seek(0);
+        return false;
+    }
+
+    PROFILE(TextureAsset_LoadDDSAsETC);
+    const size_t width = std::max(1U, header.dwWidth);
+    const size_t height = std::max(1U, header.dwHeight);
+    const size_t numLevels = (header.dwFlags & crnlib::DDSD_MIPMAPCOUNT) ? std::max(1U, header.dwMipMapCount) : 1;
+    const size_t numFaces = (header.ddsCaps.dwCaps2 & crnlib::DDSCAPS2_CUBEMAP) ? 6 : 1;
+    const size_t blockSize = dxt1 ? 8 : 16;
+    size_t numBlocks = 0;
+    for(size_t level = 0; level < numLevels; ++level)
+        numBlocks += ((std::max<size_t>(1, width >> level) + 3) / 4) * ((std::max<size_t>(1, height >> level) + 3) / 4);
+    numBlocks *= numFaces;
+
+    std::vector<u8> blocks(numBlocks * blockSize);
+    if (stream->read(&blocks[0], blocks.size()) != blocks.size())
+    {
+        stream->seek(0);
+        return false;
+    }
+
+    u8 *dst = OGRE_ALLOC_T(u8, blocks.size(), Ogre::MEMCATEGORY_GENERAL);
+    int texels[16][3];
+    int alpha[16];
+    for(size_t i = 0; i < numBlocks; ++i)
+    {
+        const u8 *src = &blocks[i * blockSize];
+        u8 *out = dst + i * blockSize;
+        if (dxt1)
+        {
+            if (!DecodeDXTColorBlock(src, true, texels))
+            {
+                OGRE_FREE(dst, Ogre::MEMCATEGORY_GENERAL);
+                stream->seek(0);
+                return false;
+            }
+            EncodeEtc1Block(texels, out);
+        }
+        else
+        {
+            DecodeDXTAlphaBlock(src, fourCC == crnlib::PIXEL_FMT_DXT5, alpha);
+            DecodeDXTColorBlock(src + 8, false, texels);
+            EncodeEacAlphaBlock(alpha, out);
+            EncodeEtc1Block(texels, out + 8);
+        }
+    }
+
+    Ogre::PixelFormat etcFormat = Ogre::PF_ETC2_RGBA8;
+    if (dxt1)
+        etcFormat = caps->hasCapability(Ogre::RSC_TEXTURE_COMPRESSION_ETC1) ? Ogre::PF_ETC1_RGB8 : Ogre::PF_ETC2_RGB8;
+    // The image takes the ownership of the transcoded data. Ogre does not count the top level as a mipmap.
+    image.loadDynamicImage(dst, width, height, 1, etcFormat, true, numFaces, numLevels - 1);
+    return true;
+}
+#else
+bool NeedsETCTranscode() { return false; }
+bool LoadDDSAsETC(Ogre::DataStreamPtr &, Ogre::Image &) { return false; }
+#endif
+
+}
+
 TextureAsset::TextureAsset(AssetAPI *owner, const QString &type_, const QString &name_) :
-    IAsset(owner, type_, name_), loadTicket_(0)
+    IAsset(owner, type_, name_), loadTicket_(0), streamingMaxSize_(0), transcodeSizeShift_(0), transcodeMaxSize_(0)
 {
     ogreAssetName = AssetAPI::SanitateAssetRef(NameInternal());
 }
@@ -72,6 +559,11 @@ bool TextureAsset::LoadFromFile(QString filename)
         return IAsset::LoadFromFile(filename);
 }
 
+bool TextureAsset::AllowBackgroundLoad() const
+{
+    return !AllowAsyncLoading() || assetAPI->Cache()->FindInCache(Name()).isEmpty();
+}
+
 QString TextureAsset::NameInternal() const
 {
     return NameInternal(name);
@@ -96,20 +588,50 @@ QString TextureAsset::NameSuffix() const
 bool TextureAsset::DecompressCRNtoDDS(const u8 *crnData, size_t crnNumBytes, std::vector<u8> &ddsData)
 {
     PROFILE(TextureAsset_DeserializeFromData_CRN_Uncompress);
+    size_t sizeShift, maxSize;
+    TranscodeLimits(sizeShift, maxSize);
+    QString error;
+    if (!TranscodeCRNtoDDS(crnData, crnNumBytes, ddsData, sizeShift, maxSize, error))
+    {
+        LogError("TextureAsset::DecompressCRNtoDDS: " + Name() + ": " + error);
+        return false;
+    }
+    return true;
+}
+
+bool TextureAsset::TranscodeCRNtoDDS(const u8 *crnData, size_t crnNumBytes, std::vector<u8> &ddsData, size_t sizeShift, size_t maxSize, QString &error)
+{
     ddsData.clear();
     
     // Texture data
     crnd::crn_texture_info textureInfo;
     if (!crnd::crnd_get_texture_info((void*)crnData, (crnd::uint32)crnNumBytes, &textureInfo))
     {
-        LogError("CRN texture info parsing failed, invalid input data.");
+        error = "CRN texture info parsing failed, invalid input data.";
         return false;
     }
+
+    // Leave out the top mip levels that would be stripped when loading, see ProcessDDSImage. Cubemaps are transcoded as they are.
+    crn_uint32 firstLevel = 0;
+    if (textureInfo.m_faces == 1)
+    {
+        size_t outWidth = textureInfo.m_width >> sizeShift;
+        size_t outHeight = textureInfo.m_height >> sizeShift;
+        while(maxSize > 0 && (outWidth > maxSize || outHeight > maxSize))
+        {
+            outWidth >>= 1;
+            outHeight >>= 1;
+        }
+        firstLevel = (crn_uint32)NumTopMipLevelsToSkip(textureInfo.m_width, textureInfo.m_height, std::max<size_t>(1, outWidth),
+            std::max<size_t>(1, outHeight), textureInfo.m_levels);
+    }
+    const crn_uint32 numLevels = textureInfo.m_levels - firstLevel;
+
     // Begin unpack
     crnd::crnd_unpack_context crnContext = crnd::crnd_unpack_begin((void*)crnData, (crnd::uint32)crnNumBytes);
     if (!crnContext)
     {
-        LogError("CRN texture data unpacking failed, invalid input data.");
+        error = "CRN texture data unpacking failed, invalid input data.";
         return false;
     }
     
@@ -118,10 +640,10 @@ bool TextureAsset::DecompressCRNtoDDS(const u8 *crnData, size_t crnNumBytes, std
     memset(&header, 0, sizeof(header));
     header.dwSize = sizeof(header);
     // - Size and flags
-    header.dwFlags = crnlib::DDSD_CAPS | crnlib::DDSD_HEIGHT | crnlib::DDSD_WIDTH | crnlib::DDSD_PIXELFORMAT | ((textureInfo.m_levels > 1) ? crnlib::DDSD_MIPMAPCOUNT : 0);
+    header.dwFlags = crnlib::DDSD_CAPS | crnlib::DDSD_HEIGHT | crnlib::DDSD_WIDTH | crnlib::DDSD_PIXELFORMAT | ((numLevels > 1) ? crnlib::DDSD_MIPMAPCOUNT : 0);
     header.ddsCaps.dwCaps = crnlib::DDSCAPS_TEXTURE;
-    header.dwWidth = textureInfo.m_width;
-    header.dwHeight = textureInfo.m_height;
+    header.dwWidth = std::max(1U, textureInfo.m_width >> firstLevel);
+    header.dwHeight = std::max(1U, textureInfo.m_height >> firstLevel);
     // - Pixelformat
     header.ddpfPixelFormat.dwSize = sizeof(crnlib::DDPIXELFORMAT);
     header.ddpfPixelFormat.dwFlags = crnlib::DDPF_FOURCC;
@@ -130,8 +652,8 @@ bool TextureAsset::DecompressCRNtoDDS(const u8 *crnData, size_t crnNumBytes, std
     if (fundamentalFormat != textureInfo.m_format)
         header.ddpfPixelFormat.dwRGBBitCount = crnd::crnd_crn_format_to_fourcc(textureInfo.m_format);
     // - Mipmaps
-    header.dwMipMapCount = (textureInfo.m_levels > 1) ? textureInfo.m_levels : 0;
-    if (textureInfo.m_levels > 1)
+    header.dwMipMapCount = (numLevels > 1) ? numLevels : 0;
+    if (numLevels > 1)
         header.ddsCaps.dwCaps |= (crnlib::DDSCAPS_COMPLEX | crnlib::DDSCAPS_MIPMAP);
     // - Cubemap with 6 faces
     if (textureInfo.m_faces == 6)
@@ -160,7 +682,7 @@ bool TextureAsset::DecompressCRNtoDDS(const u8 *crnData, size_t crnNumBytes, std
     writePos += header.dwSize;
     
     // Now transcode all face and mipmap levels into memory, one mip level at a time.    
-    for (crn_uint32 iLevel = 0; iLevel < textureInfo.m_levels; iLevel++)
+    for (crn_uint32 iLevel = firstLevel; iLevel < textureInfo.m_levels; iLevel++)
     {
         // Compute the face's width, height, number of DXT blocks per row/col, etc.
         const crn_uint32 width = std::max(1U, textureInfo.m_width >> iLevel);
@@ -187,12 +709,62 @@ bool TextureAsset::DecompressCRNtoDDS(const u8 *crnData, size_t crnNumBytes, std
     
     if (ddsData.size() == 0)
     {
-        LogError("CRN uncompression failed!");
+        error = "CRN uncompression failed!";
         return false;
     }
     return true;
 }
 
+bool TextureAsset::DecodeInBackground(std::vector<u8> &data) const
+{
+    // CRN data that has been transcoded already, e.g. by a previous load, is passed on as it is.
+    if (NameSuffix() != "crn" || (data.size() >= 4 && memcmp(&data[0], "DDS ", 4) == 0))
+        return true;
+    if (data.empty())
+        return false;
+    std::vector<u8> ddsData;
+    QString error;
+    if (!TranscodeCRNtoDDS(&data[0], data.size(), ddsData, transcodeSizeShift_, transcodeMaxSize_, error))
+        return false;
+    data.swap(ddsData);
+    return true;
+}
+
+bool TextureAsset::PreferBackgroundDecode() const
+{
+    return NameSuffix() == "crn";
+}
+
+void TextureAsset::PrepareBackgroundDecode()
+{
+    TranscodeLimits(transcodeSizeShift_, transcodeMaxSize_);
+}
+
+void TextureAsset::TranscodeLimits(size_t &sizeShift, size_t &maxSize) const
+{
+    sizeShift = 0;
+    maxSize = 0;
+    // With threaded loading from the cache the transcoded data is stored as it is, so keep the full size to not degrade the cached copy.
+    if (assetAPI->IsHeadless() || AllowAsyncLoading())
+        return;
+
+    // As in CalculateTextureSize, but with the current budget use, as the size of the texture is not known yet.
+    OgreRenderer::RendererPtr renderer = assetAPI->GetFramework()->GetModule<OgreRenderer::OgreRenderingModule>()->GetRenderer();
+    if (renderer->TextureQuality() == OgreRenderer::Renderer::Texture_Low)
+        sizeShift = 1;
+    float t = renderer->TextureBudgetUse();
+    if (t > BUDGET_THRESHOLD)
+        maxSize = (size_t)4096 >> std::min(12, std::max(0, (int)((t - BUDGET_THRESHOLD) / BUDGET_STEP)));
+    QStringList sizeParam = assetAPI->GetFramework()->CommandLineParameters("--maxTextureSize");
+    if (sizeParam.size() > 0 && sizeParam.first().toInt() > 0)
+    {
+        size_t size = (size_t)sizeParam.first().toInt();
+        maxSize = maxSize > 0 ? std::min(maxSize, size) : size;
+    }
+    if (streamingMaxSize_ > 0)
+        maxSize = maxSize > 0 ? std::min(maxSize, streamingMaxSize_) : streamingMaxSize_;
+}
+
 bool TextureAsset::DeserializeFromData(const u8 *data, size_t numBytes, bool allowAsynchronous)
 {
     if (assetAPI->GetFramework()->HasCommandLineParameter("--notextures"))
@@ -222,10 +794,28 @@ bool TextureAsset::DeserializeFromData(const u8 *data, size_t numBytes, bool all
 
     QString nameSuffix = NameSuffix();
     bool isCompressed = nameSuffix == "crn" || nameSuffix == "dds";
+    const bool isDDSData = data && numBytes >= 4 && memcmp(data, "DDS ", 4) == 0;
+    // The files baked from local textures with TextureTool --bake are DDS data by the name of the source texture.
+    bool isBakedDDS = !isCompressed && isDDSData;
+    isCompressed |= isBakedDDS;
     
     // Check if this is a crunch library CRN file and we need to decompress to DDS.
+    // The data has been transcoded to DDS already if it was decoded in the background, see DecodeInBackground.
     std::vector<u8> crnUncompressData;
-    if (nameSuffix == "crn")
+    if (nameSuffix == "crn" && isDDSData)
+    {
+        if (allowAsynchronous)
+        {
+            cacheDiskSource = assetAPI->GetAssetCache()->FindInCache(NameInternal());
+            if (diskSourceType == IAsset::Original || cacheDiskSource.isEmpty())
+            {
+                PROFILE(TextureAsset_DeserializeFromData_CRN_CacheStore);
+                cacheDiskSource = assetAPI->GetAssetCache()->StoreAsset(data, numBytes, NameInternal());
+            }
+            allowAsynchronous = !cacheDiskSource.isEmpty();
+        }
+    }
+    else if (nameSuffix == "crn")
     {
         /** If asynchronous loading is allowed we want to store the decompressed DDS data to the asset cache.
             This way below threaded loading can be done on the DDS disk source. If saving to disk fails, it is not
@@ -327,8 +917,10 @@ bool TextureAsset::DeserializeFromData(const u8 *data, size_t numBytes, bool all
         
 #include "EnableMemoryLeakCheck.h"
         // Load up the image as an Ogre CPU image object.
+        // GPUs without S3TC, f.ex. on Android, get DXT textures as ETC instead of having them decompressed.
         Ogre::Image image;
-        image.load(stream);
+        if (!isCompressed || !NeedsETCTranscode() || !LoadDDSAsETC(stream, image))
+            image.load(stream);
 
         // Resize non-DDS images here if necessary
         if (!isCompressed)
@@ -360,7 +952,7 @@ bool TextureAsset::DeserializeFromData(const u8 *data, size_t numBytes, bool all
         // 3. If the texture is updated dynamically, we might not afford to regenerate mips at each update.
         size_t numMipmapsInImage = image.getNumMipmaps(); // Note: This is actually numMipmaps - 1: Ogre doesn't think the first level is a mipmap.
         int numMipmapsToUseOnGPU = (int)Ogre::MIP_DEFAULT;
-        if (numMipmapsInImage == 0 && nameInternal.endsWith(".dds", Qt::CaseInsensitive))
+        if (numMipmapsInImage == 0 && (isBakedDDS || nameInternal.endsWith(".dds", Qt::CaseInsensitive)))
             numMipmapsToUseOnGPU = 0;
 
         if (ogreTexture.isNull()) // If we are creating this texture for the first time, create a new Ogre::Texture object.
@@ -532,11 +1124,59 @@ void TextureAsset::DoUnload()
     catch(...) {}
 }
 
+bool TextureAsset::Restream()
+{
+    if (ogreTexture.isNull() || loadTicket_ != 0 || DiskSource().isEmpty())
+        return false;
+
+    PROFILE(TextureAsset_Restream);
+    std::vector<u8> data;
+    if (!LoadFileToVector(DiskSource(), data) || data.size() < 4)
+        return false;
+    if (NameSuffix() == "crn" && memcmp(&data[0], "DDS ", 4) != 0)
+    {
+        std::vector<u8> ddsData;
+        if (!DecompressCRNtoDDS(&data[0], data.size(), ddsData))
+            return false;
+        data.swap(ddsData);
+    }
+    if (memcmp(&data[0], "DDS ", 4) != 0)
+        return false; // Only DDS data has the mip levels to choose from.
+
+    try
+    {
+#include "DisableMemoryLeakCheck.h"
+        Ogre::DataStreamPtr stream(new Ogre::MemoryDataStream((void*)&data[0], data.size(), false));
+        std::vector<u8> modifiedDDSData;
+        ProcessDDSImage(stream, modifiedDDSData);
+#include "EnableMemoryLeakCheck.h"
+        Ogre::Image image;
+        if (!NeedsETCTranscode() || !LoadDDSAsETC(stream, image))
+            image.load(stream);
+
+        // Load the levels to the existing Ogre texture, so that the materials using it keep referring to it.
+        ogreTexture->unload();
+        ogreTexture->setNumMipmaps(image.getNumMipmaps());
+        ogreTexture->loadImage(image);
+    }
+    catch(const std::exception &e)
+    {
+        LogError("TextureAsset::Restream: Failed to reload texture " + Name() + ": " + e.what());
+        return false;
+    }
+    return true;
+}
+
 bool TextureAsset::IsLoaded() const
 {
     return ogreTexture.get() != 0;
 }
 
+size_t TextureAsset::MemoryUsage() const
+{
+    return ogreTexture.get() ? ogreTexture->getSize() : 0;
+}
+
 QImage TextureAsset::ToQImage(Ogre::Texture* tex, size_t faceIndex, size_t mipmapLevel)
 {
     PROFILE(TextureAsset_ToQImage);
@@ -690,6 +1330,27 @@ void TextureAsset::SetContents(size_t newWidth, size_t newHeight, const u8 *data
     }
 }
 
+bool TextureAsset::SetContentsRect(const QRect &rect, const u8 *data, size_t bytesPerLine, Ogre::PixelFormat ogreFormat)
+{
+    PROFILE(TextureAsset_SetContentsRect);
+
+    if (!ogreTexture.get() || ogreTexture->getBuffer().isNull() || !data || ogreFormat != ogreTexture->getFormat())
+        return false;
+
+    const QRect r = rect & QRect(0, 0, (int)ogreTexture->getWidth(), (int)ogreTexture->getHeight());
+    if (r.isEmpty())
+        return true;
+
+    // The pixel box addresses the rectangle within the whole source image.
+    Ogre::Box box(r.left(), r.top(), r.right() + 1, r.bottom() + 1);
+    ///\todo Review Ogre internals of whether the const_cast here is safe!
+    Ogre::PixelBox pixelBox(box, ogreFormat, const_cast<u8*>(data));
+    pixelBox.rowPitch = bytesPerLine / Ogre::PixelUtil::getNumElemBytes(ogreFormat);
+    pixelBox.slicePitch = pixelBox.rowPitch * ogreTexture->getHeight();
+    ogreTexture->getBuffer()->blitFromMemory(pixelBox, box);
+    return true;
+}
+
 void TextureAsset::SetContentsDrawText(int newWidth, int newHeight, QString text, const QColor &textColor, const QFont &font, const QBrush &backgroundBrush, const QPen &borderPen, int flags, bool generateMipmaps, bool dynamic,
                                        float xRadius, float yRadius)
 {
@@ -724,11 +1385,25 @@ void TextureAsset::SetContentsDrawText(int newWidth, int newHeight, QString text
 
 void TextureAsset::PostProcessTexture()
 {
-    if (assetAPI->GetFramework()->HasCommandLineParameter("--autoDxtCompress"))
-        CompressTexture();
+    if (!assetAPI->GetFramework()->HasCommandLineParameter("--autoDxtCompress"))
+        return;
+
+    CompressionQuality quality = Compression_Fast;
+    QStringList qualityParam = assetAPI->GetFramework()->CommandLineParameters("--dxtQuality");
+    if (qualityParam.size() > 0)
+    {
+        QString value = qualityParam.first().trimmed().toLower();
+        if (value == "normal")
+            quality = Compression_Normal;
+        else if (value == "high")
+            quality = Compression_High;
+        else if (value != "fast")
+            LogWarning("TextureAsset::PostProcessTexture: Unknown --dxtQuality " + qualityParam.first() + ", using fast.");
+    }
+    CompressTexture(quality);
 }
 
-void TextureAsset::CompressTexture()
+void TextureAsset::CompressTexture(CompressionQuality quality)
 {
 #if defined(DIRECTX_ENABLED) && defined(WIN32)
     if (ogreTexture.isNull())
@@ -820,6 +1495,10 @@ void TextureAsset::CompressTexture()
     
     // Determine format
     int flags = squish::kColourRangeFit; // Lowest quality, but fastest
+    if (quality == Compression_Normal)
+        flags = squish::kColourClusterFit;
+    else if (quality == Compression_High)
+        flags = squish::kColourIterativeClusterFit;
     size_t bytesPerBlock = 8;
     Ogre::PixelFormat newFormat = Ogre::PF_DXT1;
     if (ogreTexture->hasAlpha())
@@ -843,7 +1522,7 @@ void TextureAsset::CompressTexture()
         int compressedSize = squish::GetStorageRequirements((int)imageBoxes[level].right, (int)imageBoxes[level].bottom, flags);
         LogDebug("Compressing level " + QString::number(level) + " " + QString::number(imageBoxes[level].right) + "x" + QString::number(imageBoxes[level].bottom) + " into " + QString::number(compressedSize) + " bytes");
         unsigned char* compressedData = new unsigned char[compressedSize];
-        squish::CompressImage((squish::u8*)imageData[level], (int)imageBoxes[level].right, (int)imageBoxes[level].bottom, compressedData, flags);
+        SquishCompressImage(imageData[level], (int)imageBoxes[level].right, (int)imageBoxes[level].bottom, compressedData, flags, (int)bytesPerBlock);
         compressedImageData.push_back(compressedData);
     }
     
@@ -907,8 +1586,9 @@ bool TextureAsset::AllowAsyncLoading() const
     /// \todo NeedSizeModification() does not take into account the current texture's data size, in which case we may go on the threaded loading path
     /// without a possibility to resize the texture smaller. This means that potentially one texture may go in unresized and increase the texture load
     /// significantly over the budget.
+    // The background loads go to Ogre as they are, without the ETC transcoding of DXT textures.
     if (NeedSizeModification() || assetAPI->GetFramework()->IsHeadless() || assetAPI->GetFramework()->HasCommandLineParameter("--no_async_asset_load") ||
-        assetAPI->GetFramework()->HasCommandLineParameter("--noAsyncAssetLoad") || !assetAPI->GetAssetCache() || (OGRE_THREAD_SUPPORT == 0))
+        assetAPI->GetFramework()->HasCommandLineParameter("--noAsyncAssetLoad") || !assetAPI->GetAssetCache() || (OGRE_THREAD_SUPPORT == 0) || NeedsETCTranscode())
         return false;
     else
         return true;
@@ -918,7 +1598,7 @@ bool TextureAsset::NeedSizeModification() const
 {
     OgreRenderer::RendererPtr renderer = assetAPI->GetFramework()->GetModule<OgreRenderer::OgreRenderingModule>()->GetRenderer();
     return assetAPI->GetFramework()->HasCommandLineParameter("--maxTextureSize") || renderer->TextureBudgetUse() > BUDGET_THRESHOLD || 
-        renderer->TextureQuality() == OgreRenderer::Renderer::Texture_Low;
+        renderer->TextureQuality() == OgreRenderer::Renderer::Texture_Low || streamingMaxSize_ > 0;
 }
 
 void TextureAsset::CalculateTextureSize(size_t width, size_t height, size_t& outWidth, size_t& outHeight, size_t bitsPerPixel)
@@ -977,6 +1657,16 @@ void TextureAsset::CalculateTextureSize(size_t width, size_t height, size_t& out
             }
         }
     }
+
+    // The texture streamer limits the size by the screen size of the meshes the texture is on.
+    if (streamingMaxSize_ > 0)
+    {
+        while (outWidth > streamingMaxSize_ || outHeight > streamingMaxSize_)
+        {
+            outWidth >>= 1;
+            outHeight >>= 1;
+        }
+    }
     
     if (!outWidth)
         outWidth = 1;
@@ -1044,24 +1734,10 @@ void TextureAsset::ProcessDDSImage(Ogre::DataStreamPtr& stream, std::vector<u8>&
         return; // No resize, can use original stream
     }
 
-    size_t numberOfTopMipMapToSkip = 0;
-    size_t curWidth = header.dwWidth;
-    size_t curHeight = header.dwHeight;
-    while (curWidth > outWidth || curHeight > outHeight)
-    {
-        // Do not allow to go below 4 in either dimension
-        if (curWidth == 4 || curHeight == 4)
-            break;
-        curWidth >>= 1;
-        curHeight >>= 1;
-        ++numberOfTopMipMapToSkip;
-    }
-    
     // If no mips, can not resize
-    if (!header.dwMipMapCount || header.dwMipMapCount == 1)
-        numberOfTopMipMapToSkip = 0;
-    else if (numberOfTopMipMapToSkip > header.dwMipMapCount - 1)
-        numberOfTopMipMapToSkip = header.dwMipMapCount - 1;
+    size_t numberOfTopMipMapToSkip = NumTopMipLevelsToSkip(header.dwWidth, header.dwHeight, outWidth, outHeight, header.dwMipMapCount);
+    size_t curWidth = header.dwWidth >> numberOfTopMipMapToSkip;
+    size_t curHeight = header.dwHeight >> numberOfTopMipMapToSkip;
     
     if (!numberOfTopMipMapToSkip)
     {
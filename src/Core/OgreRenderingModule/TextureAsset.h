@@ -20,8 +20,19 @@ public:
     TextureAsset(AssetAPI *owner, const QString &type, const QString &name);
     ~TextureAsset();
 
+    /// Quality of the DXT compression of CompressTexture, from the fastest to the best.
+    enum CompressionQuality
+    {
+        Compression_Fast, ///< Range fit. Fast enough for textures generated interactively, e.g. in the editors.
+        Compression_Normal, ///< Cluster fit.
+        Compression_High ///< Iterative cluster fit. Several times slower than cluster fit.
+    };
+
     virtual bool LoadFromFile(QString filename);
 
+    /// Returns false if LoadFromFile loads the texture from the asset cache with Ogre's threaded loading. IAsset override.
+    virtual bool AllowBackgroundLoad() const;
+
     /// Load texture from memory
     virtual bool DeserializeFromData(const u8 *data_, size_t numBytes, bool allowAsynchronous);
 
@@ -33,6 +44,20 @@ public:
 
     bool IsLoaded() const;
 
+    /// Returns the size of the texture on the GPU. IAsset override.
+    size_t MemoryUsage() const;
+
+    /// Sets the maximum width and height to load the texture in, or 0 for no limit. Used by TextureStreamer.
+    /** The top mip levels of DDS and CRN textures above the size are left out, and other textures are scaled down.
+        Takes effect when the texture is next loaded, or restreamed with Restream. */
+    void SetStreamingMaxSize(size_t maxSize) { streamingMaxSize_ = maxSize; }
+    size_t StreamingMaxSize() const { return streamingMaxSize_; }
+
+    /// Reloads a loaded DDS or CRN texture from its disk source in the current streaming maximum size.
+    /** The levels are loaded to the existing Ogre texture, so the materials using the texture get them without reloading.
+        @return false if the texture is not loaded, is not DDS or CRN data, or the reload failed. */
+    bool Restream();
+
     /// Sets the contents of this texture asset from raw pixel data.
     /** @param newWidth The desired pixel width for this texture.
         @param newHeight The desired pixel height for this texture. If newWidth or newHeight do not match with the current texture size on the GPU side,
@@ -50,6 +75,15 @@ public:
         @todo Add support for different pixel formats */
     void SetContents(size_t newWidth, size_t newHeight, const u8 *data, size_t numBytes, Ogre::PixelFormat ogreFormat, bool regenerateMipmaps, bool dynamic, bool renderTarget/* = false*/);
 
+    /// Uploads a rectangle of an image of the same size as this texture to the same place in the texture.
+    /** Used to upload only the changed parts of a texture that is updated often, e.g. from a rendered Qt widget.
+        @param rect The rectangle to upload, clipped to the texture size.
+        @param data A pointer to the first pixel of the whole image, in the given format.
+        @param bytesPerLine The distance in bytes between the rows of the image.
+        @return false if the texture has not been created with SetContents, or the given format differs from its format.
+        @see SetContents(). */
+    bool SetContentsRect(const QRect &rect, const u8 *data, size_t bytesPerLine, Ogre::PixelFormat ogreFormat);
+
     /// Sets this texture to the given size and fills it with the given color value.
     void SetContentsFillSolidColor(int newWidth, int newHeight, u32 color, Ogre::PixelFormat ogreFormat, bool regenerateMipmaps, bool dynamic);
 
@@ -65,7 +99,8 @@ public:
     void PostProcessTexture();
     
     /// Compress texture to suitable DXT format. Also, if applicable, reduce texture size at the same time.
-    void CompressTexture();
+    /** Large textures are compressed in strips in parallel, by the calling thread and the idle threads of the global thread pool. */
+    void CompressTexture(CompressionQuality quality = Compression_Fast);
 
     /// Reduce texture size only according to command line options
     void ReduceTextureSize();
@@ -94,13 +129,28 @@ public:
     void CalculateTextureSize(size_t width, size_t height, size_t& outWidth, size_t& outHeight, size_t bitsPerPixel);
     
     /// Decompresses any CRN input data to DDS.
-    /** @param crnData Ptr to compressed crn data.
+    /** The top mip levels that would be stripped by the current texture quality setting and budget are left out.
+     ** @param crnData Ptr to compressed crn data.
      ** @param crnNumBytes Size of crn data in bytes.
-     ** @param outDdsNumByte Size of decompressed dds data in bytes is assigned to this parameter.
-     ** @return void* to the uncompressed DDS data. It is the callers responsibility to free the 
-     ** data with crn_free_block when done with it. */
+     ** @param ddsData [out] Receives the decompressed DDS data.
+     ** @return Whether the decompression succeeded. */
     bool DecompressCRNtoDDS(const u8 *crnData, size_t crnNumBytes, std::vector<u8> &ddsData);
 
+    /// Transcodes CRN data to DDS, leaving out the top mip levels above the given size. Thread-safe.
+    /** @param sizeShift Number of times to halve the texture size, before applying maxSize.
+        @param maxSize Maximum width and height of the texture, or 0 for no limit.
+        @param error [out] Receives the reason if the transcoding fails. */
+    static bool TranscodeCRNtoDDS(const u8 *crnData, size_t crnNumBytes, std::vector<u8> &ddsData, size_t sizeShift, size_t maxSize, QString &error);
+
+    /// Transcodes CRN data to DDS in a worker thread. IAsset override.
+    virtual bool DecodeInBackground(std::vector<u8> &data) const;
+
+    /// Returns true for CRN textures, so that downloaded CRN data is transcoded in a worker thread. IAsset override.
+    virtual bool PreferBackgroundDecode() const;
+
+    /// Reads the texture quality and budget limits for DecodeInBackground. IAsset override.
+    virtual void PrepareBackgroundDecode();
+
 public slots:
     /// Convert texture to QImage
     QImage ToQImage(size_t faceIndex = 0, size_t mipmapLevel = 0) const;
@@ -124,6 +174,13 @@ private:
     /// Check whether asynchronous loading can be supported
     bool AllowAsyncLoading() const;
     
+    /// Returns the limits to transcode CRN data with for the current texture quality setting, budget and --maxTextureSize, see TranscodeCRNtoDDS.
+    void TranscodeLimits(size_t &sizeShift, size_t &maxSize) const;
+
+    size_t streamingMaxSize_; ///< Maximum width and height to load the texture in, or 0 for no limit.
+    size_t transcodeSizeShift_; ///< The sizeShift of TranscodeCRNtoDDS for DecodeInBackground, set in PrepareBackgroundDecode.
+    size_t transcodeMaxSize_; ///< The maxSize of TranscodeCRNtoDDS for DecodeInBackground, set in PrepareBackgroundDecode.
+
     /// Strip the top level mips from a DDS image if it is too large. Overwrite memory stream with modified one as necessary. Needs a temp vector for the modified data.
     void ProcessDDSImage(Ogre::DataStreamPtr& stream, std::vector<u8>& modifiedDDSData);
 };
@@ -0,0 +1,290 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#include "StableHeaders.h"
+#include "DebugOperatorNew.h"
+
+#include "TextureStreamer.h"
+#include "TextureAsset.h"
+#include "OgreMaterialAsset.h"
+#include "Renderer.h"
+#include "ScreenSize.h"
+#include "EC_Mesh.h"
+#include "EC_Camera.h"
+#include "EC_Placeable.h"
+#include "Entity.h"
+#include "Scene/Scene.h"
+#include "Framework.h"
+#include "FrameAPI.h"
+#include "AssetAPI.h"
+#include "Profiler.h"
+#include "Math/MathFunc.h"
+
+#include <OgreTextureManager.h>
+
+#include <QHash>
+
+#include <algorithm>
+#include <utility>
+
+#include "MemoryLeakCheck.h"
+
+namespace
+{
+/// Seconds between the updates of the wanted texture sizes.
+const float cUpdateInterval = 0.25f;
+/// Size the textures are loaded in before an update has seen them on screen.
+const size_t cInitialSize = 64;
+/// Size the textures that are not on screen are dropped to.
+const size_t cMinSize = 32;
+/// Largest size the textures are streamed in.
+const size_t cMaxSize = 16384;
+/// Maximum number of textures to restream per update, to spread the reloads over frames.
+const size_t cMaxRestreamsPerUpdate = 4;
+
+/// Returns the smallest power of two that is at least the screen size, within [cMinSize, cMaxSize].
+size_t SizeForScreenSize(float screenSize)
+{
+    size_t size = cMinSize;
+    while(size < cMaxSize && (float)size < screenSize)
+        size <<= 1;
+    return size;
+}
+
+/// Returns the estimated GPU memory use of a texture when streamed in the given size.
+/** The memory use scales by the area, and a texture that is smaller than its streaming limit is loaded in full. */
+double EstimatedMemoryUsage(const TextureAsset *texture, size_t size)
+{
+    const size_t currentSize = std::max(texture->Width(), texture->Height());
+    const double usage = (double)texture->MemoryUsage();
+    if (currentSize == 0)
+        return 0.0;
+    const bool isFull = texture->StreamingMaxSize() == 0 || currentSize < texture->StreamingMaxSize();
+    if (isFull && size >= currentSize)
+        return usage;
+    const double scale = (double)size / (double)currentSize;
+    return usage * scale * scale;
+}
+
+/// Orders the streamed textures by their screen size, the smallest first.
+struct ScreenSizeLess
+{
+    template <typename T>
+    bool operator()(const T *a, const T *b) const { return a->screenSize < b->screenSize; }
+};
+
+}
+
+TextureStreamer::TextureStreamer(Framework *framework, OgreRenderer::Renderer *renderer) :
+    framework_(framework),
+    renderer_(renderer),
+    timeSinceUpdate_(0.f)
+{
+    connect(framework_->Asset(), SIGNAL(AssetCreated(AssetPtr)), SLOT(OnAssetCreated(AssetPtr)));
+    connect(framework_->Frame(), SIGNAL(Updated(float)), SLOT(OnUpdated(float)));
+}
+
+TextureStreamer::~TextureStreamer()
+{
+    // Let the textures load in full if they are reloaded after the streamer is gone.
+    for(size_t i = 0; i < textures_.size(); ++i)
+    {
+        TextureAssetPtr texture = textures_[i].texture.lock();
+        if (texture)
+            texture->SetStreamingMaxSize(0);
+    }
+}
+
+double TextureStreamer::MemoryUsage() const
+{
+    double usage = 0.0;
+    for(size_t i = 0; i < textures_.size(); ++i)
+    {
+        TextureAssetPtr texture = textures_[i].texture.lock();
+        if (texture)
+            usage += (double)texture->MemoryUsage();
+    }
+    return usage;
+}
+
+void TextureStreamer::OnAssetCreated(AssetPtr asset)
+{
+    TextureAssetPtr texture = dynamic_pointer_cast<TextureAsset>(asset);
+    if (!texture)
+        return;
+    // Only DDS and CRN textures have the mip levels to stream.
+    const QString suffix = texture->NameSuffix();
+    if (suffix != "dds" && suffix != "crn")
+        return;
+
+    texture->SetStreamingMaxSize(cInitialSize);
+    StreamedTexture streamed;
+    streamed.texture = texture;
+    streamed.screenSize = 0.f;
+    streamed.wantedSize = cInitialSize;
+    textures_.push_back(streamed);
+}
+
+void TextureStreamer::OnUpdated(float frameTime)
+{
+    timeSinceUpdate_ += frameTime;
+    if (timeSinceUpdate_ < cUpdateInterval || textures_.empty())
+        return;
+    timeSinceUpdate_ = 0.f;
+
+    PROFILE(TextureStreamer_Update);
+    UpdateScreenSizes();
+    UpdateWantedSizes();
+    RestreamTextures();
+}
+
+void TextureStreamer::UpdateScreenSizes()
+{
+    // Drop the textures that have been forgotten, and index the rest by asset for the lookups from the materials.
+    QHash<IAsset*, size_t> indices;
+    size_t j = 0;
+    for(size_t i = 0; i < textures_.size(); ++i)
+    {
+        TextureAssetPtr texture = textures_[i].texture.lock();
+        if (!texture)
+            continue;
+        textures_[j] = textures_[i];
+        textures_[j].screenSize = 0.f;
+        indices[texture.get()] = j++;
+    }
+    textures_.resize(j);
+
+    Entity *cameraEntity = renderer_->MainCamera();
+    EC_Camera *camera = renderer_->MainCameraComponent();
+    if (!cameraEntity || !camera || renderer_->WindowHeight() <= 0)
+        return;
+    shared_ptr<EC_Placeable> cameraPlaceable = cameraEntity->Component<EC_Placeable>();
+    if (!cameraPlaceable)
+        return;
+
+    const float3 eye = cameraPlaceable->WorldPosition();
+    const Frustum frustum = camera->ToFrustum();
+    const float nearPlane = std::max(camera->nearPlane.Get(), 0.01f);
+
+    AssetAPI *assetAPI = framework_->Asset();
+    std::vector<shared_ptr<EC_Mesh> > meshes = cameraEntity->ParentScene()->Components<EC_Mesh>();
+    std::vector<EC_Mesh*> shown;
+    std::vector<AABB> boxes;
+    for(size_t i = 0; i < meshes.size(); ++i)
+    {
+        if (!meshes[i]->OgreEntity())
+            continue;
+        const AABB box = meshes[i]->WorldAABB();
+        if (!box.IsFinite())
+            continue;
+        shown.push_back(meshes[i].get());
+        boxes.push_back(box);
+    }
+    // Cull the bounds against the frustum in one batch.
+    std::vector<u32> inFrustum((boxes.size() + 31) / 32);
+    if (!boxes.empty())
+        frustum.BatchIntersects(&boxes[0], (int)boxes.size(), &inFrustum[0]);
+
+    for(size_t i = 0; i < shown.size(); ++i)
+    {
+        if (!(inFrustum[i >> 5] & (1u << (i & 31))))
+            continue;
+        EC_Mesh *mesh = shown[i];
+        const AABB &box = boxes[i];
+        const float distance = std::max(box.Distance(eye), nearPlane);
+        const float screenSize = OgreRenderer::ScreenSizeInPixels(camera->OgreCamera(), box, distance);
+
+        for(uint m = 0; m < mesh->NumMaterials(); ++m)
+        {
+            OgreMaterialAssetPtr material = mesh->MaterialAsset(m);
+            if (!material)
+                continue;
+            std::vector<AssetReference> refs = material->FindReferences();
+            for(size_t r = 0; r < refs.size(); ++r)
+            {
+                QHash<IAsset*, size_t>::const_iterator iter = indices.find(assetAPI->GetAsset(refs[r].ref).get());
+                if (iter != indices.end())
+                    textures_[*iter].screenSize = std::max(textures_[*iter].screenSize, screenSize);
+            }
+        }
+    }
+}
+
+void TextureStreamer::UpdateWantedSizes()
+{
+    // The streamed textures get the budget that the other textures leave.
+    double streamedUsage = 0.0;
+    double wantedUsage = 0.0;
+    std::vector<StreamedTexture*> order;
+    order.reserve(textures_.size());
+    for(size_t i = 0; i < textures_.size(); ++i)
+    {
+        StreamedTexture &streamed = textures_[i];
+        TextureAssetPtr texture = streamed.texture.lock();
+        streamed.wantedSize = streamed.screenSize > 0.f ? SizeForScreenSize(streamed.screenSize) : cMinSize;
+        streamedUsage += (double)texture->MemoryUsage();
+        wantedUsage += EstimatedMemoryUsage(texture.get(), streamed.wantedSize);
+        order.push_back(&streamed);
+    }
+    const double totalUsage = (double)Ogre::TextureManager::getSingleton().getMemoryUsage();
+    const double budget = (double)renderer_->TextureBudget() * 1024.0 * 1024.0 - std::max(0.0, totalUsage - streamedUsage);
+
+    // Halve the textures with the smallest screen size first, until the wanted sizes fit in the budget.
+    std::sort(order.begin(), order.end(), ScreenSizeLess());
+    bool reduced = true;
+    while(wantedUsage > budget && reduced)
+    {
+        reduced = false;
+        for(size_t i = 0; i < order.size() && wantedUsage > budget; ++i)
+        {
+            StreamedTexture &streamed = *order[i];
+            if (streamed.wantedSize <= cMinSize)
+                continue;
+            TextureAssetPtr texture = streamed.texture.lock();
+            wantedUsage -= EstimatedMemoryUsage(texture.get(), streamed.wantedSize) - EstimatedMemoryUsage(texture.get(), streamed.wantedSize / 2);
+            streamed.wantedSize /= 2;
+            reduced = true;
+        }
+    }
+}
+
+void TextureStreamer::RestreamTextures()
+{
+    // Drop the levels first, so that the memory is freed before more is loaded, then stream in the largest on screen first.
+    std::vector<std::pair<float, TextureAsset*> > drops;
+    std::vector<std::pair<float, TextureAsset*> > loads;
+    for(size_t i = 0; i < textures_.size(); ++i)
+    {
+        const StreamedTexture &streamed = textures_[i];
+        TextureAssetPtr texture = streamed.texture.lock();
+        if (!texture->IsLoaded())
+        {
+            // Let a texture that is still loading load in the wanted size.
+            texture->SetStreamingMaxSize(streamed.wantedSize);
+            continue;
+        }
+        const size_t limit = texture->StreamingMaxSize();
+        const size_t currentSize = std::max(texture->Width(), texture->Height());
+        if (streamed.wantedSize < limit && streamed.wantedSize < currentSize)
+            drops.push_back(std::make_pair(streamed.screenSize, texture.get()));
+        else if (streamed.wantedSize > limit && currentSize >= limit) // Smaller than the limit means that it is loaded in full.
+            loads.push_back(std::make_pair(-streamed.screenSize, texture.get()));
+    }
+    std::sort(drops.begin(), drops.end());
+    std::sort(loads.begin(), loads.end());
+
+    QHash<TextureAsset*, size_t> wantedSizes;
+    for(size_t i = 0; i < textures_.size(); ++i)
+        wantedSizes[textures_[i].texture.lock().get()] = textures_[i].wantedSize;
+
+    size_t numRestreamed = 0;
+    for(size_t i = 0; i < drops.size() && numRestreamed < cMaxRestreamsPerUpdate; ++i, ++numRestreamed)
+    {
+        drops[i].second->SetStreamingMaxSize(wantedSizes[drops[i].second]);
+        drops[i].second->Restream();
+    }
+    for(size_t i = 0; i < loads.size() && numRestreamed < cMaxRestreamsPerUpdate; ++i, ++numRestreamed)
+    {
+        loads[i].second->SetStreamingMaxSize(wantedSizes[loads[i].second]);
+        loads[i].second->Restream();
+    }
+}
@@ -0,0 +1,62 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#pragma once
+
+#include "CoreDefines.h"
+#include "OgreModuleApi.h"
+#include "OgreModuleFwd.h"
+#include "AssetFwd.h"
+
+#include <QObject>
+
+#include <vector>
+
+class Framework;
+
+/// Streams the mip levels of DDS and CRN textures by the screen size of the meshes they are on.
+/** Enabled with the --textureStreaming command line parameter. The DDS and CRN textures are first loaded with their
+    low mip levels only. A few times a second, the streamer finds the largest screen size of the EC_Mesh components
+    in the view of the main camera that use each texture in their materials, and restreams the textures whose wanted
+    size has changed with TextureAsset::Restream, a few textures at a time.
+
+    The textures are kept within Renderer::TextureBudget, less the memory of the other textures, by dropping the top
+    mip levels of the textures with the smallest screen size first. */
+class OGRE_MODULE_API TextureStreamer : public QObject
+{
+    Q_OBJECT
+
+public:
+    TextureStreamer(Framework *framework, OgreRenderer::Renderer *renderer);
+    ~TextureStreamer();
+
+public slots:
+    /// Returns the number of streamed textures.
+    int NumTextures() const { return (int)textures_.size(); }
+
+    /// Returns the memory use of the streamed textures on the GPU, in bytes.
+    double MemoryUsage() const;
+
+private slots:
+    void OnAssetCreated(AssetPtr asset);
+    void OnUpdated(float frameTime);
+
+private:
+    struct StreamedTexture
+    {
+        weak_ptr<TextureAsset> texture;
+        float screenSize; ///< Largest screen height in pixels of the meshes the texture is on, or 0 if none is in view.
+        size_t wantedSize; ///< Maximum width and height to stream the texture in.
+    };
+
+    /// Finds the screen sizes of the streamed textures from the meshes in the view of the main camera.
+    void UpdateScreenSizes();
+    /// Chooses the wanted sizes by the screen sizes, and drops them until the textures fit in the budget.
+    void UpdateWantedSizes();
+    /// Restreams the textures whose wanted size differs from the size they are loaded in.
+    void RestreamTextures();
+
+    Framework *framework_;
+    OgreRenderer::Renderer *renderer_;
+    std::vector<StreamedTexture> textures_;
+    float timeSinceUpdate_;
+};
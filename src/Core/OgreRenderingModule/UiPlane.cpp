@@ -16,6 +16,8 @@
 #include <OgreOverlayManager.h>
 #include <OgrePanelOverlayElement.h>
 
+#include <QImage>
+
 #include "MemoryLeakCheck.h"
 
 UiPlane::UiPlane(Framework *framework, RenderWindow *renderWindow)
@@ -137,6 +139,45 @@ void UiPlane::SetTexture(TextureAsset *texture)
     UpdateOgreOverlay();
 }
 
+void UiPlane::SetContents(const QImage &image, const QRegion &dirtyRegion)
+{
+    if (image.isNull())
+        return;
+    if (image.format() != QImage::Format_ARGB32 && image.format() != QImage::Format_ARGB32_Premultiplied)
+    {
+        SetContents(image.convertToFormat(QImage::Format_ARGB32), dirtyRegion);
+        return;
+    }
+
+    shared_ptr<TextureAsset> texAsset = textureAsset.lock();
+    if (!texAsset)
+    {
+        AssetAPI *asset = fw->Asset();
+        texAsset = dynamic_pointer_cast<TextureAsset>(asset->CreateNewAsset("Texture", asset->GenerateUniqueAssetName("Texture", "UiPlane")));
+        if (!texAsset)
+        {
+            LogError("UiPlane::SetContents: Could not create texture asset!");
+            return;
+        }
+        SetTexture(texAsset.get());
+    }
+
+    bool fullUpload = dirtyRegion.isEmpty() || !texAsset->ogreTexture.get() ||
+        (int)texAsset->ogreTexture->getWidth() != image.width() || (int)texAsset->ogreTexture->getHeight() != image.height();
+    if (!fullUpload)
+    {
+        QVector<QRect> rects = dirtyRegion.rects();
+        for(int i = 0; i < rects.size() && !fullUpload; ++i)
+            fullUpload = !texAsset->SetContentsRect(rects[i], image.bits(), image.bytesPerLine(), Ogre::PF_A8R8G8B8);
+    }
+    if (fullUpload)
+    {
+        texAsset->SetContents(image.width(), image.height(), image.bits(), image.width() * image.height() * 4, Ogre::PF_A8R8G8B8, false, true, false);
+        // The texture may have been recreated.
+        UpdateOgreOverlay();
+    }
+}
+
 void UiPlane::UpdateOgreOverlay()
 {
     // Create an Ogre material for the Overlay, if one didn't exist.
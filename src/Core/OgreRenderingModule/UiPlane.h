@@ -3,8 +3,10 @@
 #pragma once
 
 #include <QObject>
+#include <QRegion>
 #include "AssetFwd.h"
 
+class QImage;
 class Framework;
 class TextureAsset;
 class OgreMaterialAsset;
@@ -94,6 +96,13 @@ public slots:
 //    void SetMaterial(OgreMaterialAsset *material);
     void SetTexture(TextureAsset *texture);
 
+    /// Uploads the image to the texture of this UiPlane, creating a texture if none is set.
+    /** If the texture already has the size of the image, only the rectangles of dirtyRegion are uploaded,
+        so that e.g. a widget rendered to the image only costs the upload of its repainted parts.
+        @param image The image in the Format_ARGB32 or Format_ARGB32_Premultiplied format. Other formats are converted.
+        @param dirtyRegion The changed region of the image, or an empty region to upload the whole image. */
+    void SetContents(const QImage &image, const QRegion &dirtyRegion = QRegion());
+
     /// Refreshes all internal parameters of the Ogre overlay material to match the currently set state.
     /// One shouldn't ever need to call this function manually (but exposed still to allow debugging potential problems).
     void UpdateOgreOverlay();
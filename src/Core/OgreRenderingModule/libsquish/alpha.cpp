@@ -28,6 +28,10 @@
 #include <climits>
 #include <algorithm>
 
+#if SQUISH_USE_SSE >= 2
+#include <emmintrin.h>
+#endif
+
 namespace squish {
 
 static int FloatToInt( float a, int limit )
@@ -101,6 +105,54 @@ static void FixRange( int& min, int& max, int steps )
 
 static int FitCodes( u8 const* rgba, int mask, u8 const* codes, u8* indices )
 {
+#if SQUISH_USE_SSE >= 2
+	// gather the alpha values as two vectors of eight 16-bit values
+	short alpha[16];
+	short valid[16];
+	for( int i = 0; i < 16; ++i )
+	{
+		alpha[i] = rgba[4*i + 3];
+		valid[i] = ( mask & ( 1 << i ) ) ? -1 : 0;
+	}
+	
+	int err = 0;
+	for( int half = 0; half < 2; ++half )
+	{
+		__m128i const value = _mm_loadu_si128( ( __m128i const* )( alpha + 8*half ) );
+		__m128i least = _mm_set1_epi16( ( short )0xffff );
+		__m128i index = _mm_setzero_si128();
+		for( int j = 0; j < 8; ++j )
+		{
+			// the squared error of each value from this code, at most 255*255 so it fits in unsigned 16 bits
+			__m128i const diff = _mm_sub_epi16( value, _mm_set1_epi16( codes[j] ) );
+			__m128i const dist = _mm_mullo_epi16( diff, diff );
+			
+			// compare with the best so far as unsigned, keeping the first least code as the scalar path does
+			__m128i const bias = _mm_set1_epi16( ( short )0x8000 );
+			__m128i const less = _mm_cmplt_epi16( _mm_xor_si128( dist, bias ), _mm_xor_si128( least, bias ) );
+			least = _mm_or_si128( _mm_and_si128( less, dist ), _mm_andnot_si128( less, least ) );
+			index = _mm_or_si128( _mm_and_si128( less, _mm_set1_epi16( ( short )j ) ), _mm_andnot_si128( less, index ) );
+		}
+		
+		// use the first code and no error for the pixels that are not valid
+		__m128i const isValid = _mm_loadu_si128( ( __m128i const* )( valid + 8*half ) );
+		least = _mm_and_si128( least, isValid );
+		index = _mm_and_si128( index, isValid );
+		
+		unsigned short errors[8];
+		short best[8];
+		_mm_storeu_si128( ( __m128i* )errors, least );
+		_mm_storeu_si128( ( __m128i* )best, index );
+		for( int i = 0; i < 8; ++i )
+		{
+			indices[8*half + i] = ( u8 )best[i];
+			err += errors[i];
+		}
+	}
+	
+	// return the total error
+	return err;
+#else
 	// fit each alpha value to the codebook
 	int err = 0;
 	for( int i = 0; i < 16; ++i )
@@ -139,6 +191,7 @@ static int FitCodes( u8 const* rgba, int mask, u8 const* codes, u8* indices )
 	
 	// return the total error
 	return err;
+#endif
 }
 
 static void WriteAlphaBlock( int alpha0, int alpha1, u8 const* indices, void* block )
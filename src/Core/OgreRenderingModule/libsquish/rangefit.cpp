@@ -28,8 +28,89 @@
 #include "colourblock.h"
 #include <cfloat>
 
+#if SQUISH_USE_SSE >= 2
+#include <emmintrin.h>
+#endif
+
 namespace squish {
 
+// matches each point to the closest code by the metric, and returns the total error
+static float MatchCodes( int count, Vec3 const* values, Vec3 const* codes, int numCodes, Vec3::Arg metric, u8* closest )
+{
+#if SQUISH_USE_SSE >= 2
+	// four points at a time, the points of the last group padded with the first code
+	float xs[16], ys[16], zs[16];
+	int const padded = ( count + 3 ) & ~3;
+	for( int i = 0; i < padded; ++i )
+	{
+		Vec3 const& v = i < count ? values[i] : codes[0];
+		xs[i] = v.X();
+		ys[i] = v.Y();
+		zs[i] = v.Z();
+	}
+	
+	__m128 const mx = _mm_set1_ps( metric.X() );
+	__m128 const my = _mm_set1_ps( metric.Y() );
+	__m128 const mz = _mm_set1_ps( metric.Z() );
+	__m128 error = _mm_setzero_ps();
+	for( int i = 0; i < padded; i += 4 )
+	{
+		__m128 const px = _mm_loadu_ps( xs + i );
+		__m128 const py = _mm_loadu_ps( ys + i );
+		__m128 const pz = _mm_loadu_ps( zs + i );
+		__m128 dist = _mm_set1_ps( FLT_MAX );
+		__m128i idx = _mm_setzero_si128();
+		for( int j = 0; j < numCodes; ++j )
+		{
+			__m128 const dx = _mm_mul_ps( mx, _mm_sub_ps( px, _mm_set1_ps( codes[j].X() ) ) );
+			__m128 const dy = _mm_mul_ps( my, _mm_sub_ps( py, _mm_set1_ps( codes[j].Y() ) ) );
+			__m128 const dz = _mm_mul_ps( mz, _mm_sub_ps( pz, _mm_set1_ps( codes[j].Z() ) ) );
+			__m128 const d = _mm_add_ps( _mm_add_ps( _mm_mul_ps( dx, dx ), _mm_mul_ps( dy, dy ) ), _mm_mul_ps( dz, dz ) );
+			
+			// keep the first closest code, as the scalar path does
+			__m128i const closer = _mm_castps_si128( _mm_cmplt_ps( d, dist ) );
+			idx = _mm_or_si128( _mm_and_si128( closer, _mm_set1_epi32( j ) ), _mm_andnot_si128( closer, idx ) );
+			dist = _mm_min_ps( d, dist );
+		}
+		error = _mm_add_ps( error, dist );
+		
+		int indices[4];
+		_mm_storeu_si128( ( __m128i* )indices, idx );
+		for( int k = 0; k < 4 && i + k < count; ++k )
+			closest[i + k] = ( u8 )indices[k];
+	}
+	
+	// the padded points are on the first code, so they add no error
+	float errors[4];
+	_mm_storeu_ps( errors, error );
+	return ( errors[0] + errors[1] ) + ( errors[2] + errors[3] );
+#else
+	float error = 0.0f;
+	for( int i = 0; i < count; ++i )
+	{
+		// find the closest code
+		float dist = FLT_MAX;
+		int idx = 0;
+		for( int j = 0; j < numCodes; ++j )
+		{
+			float d = LengthSquared( metric*( values[i] - codes[j] ) );
+			if( d < dist )
+			{
+				dist = d;
+				idx = j;
+			}
+		}
+		
+		// save the index
+		closest[i] = ( u8 )idx;
+		
+		// accumulate the error
+		error += dist;
+	}
+	return error;
+#endif
+}
+
 RangeFit::RangeFit( ColourSet const* colours, int flags, float* metric ) 
   : ColourFit( colours, flags )
 {
@@ -107,28 +188,7 @@ void RangeFit::Compress3( void* block )
 
 	// match each point to the closest code
 	u8 closest[16];
-	float error = 0.0f;
-	for( int i = 0; i < count; ++i )
-	{
-		// find the closest code
-		float dist = FLT_MAX;
-		int idx = 0;
-		for( int j = 0; j < 3; ++j )
-		{
-			float d = LengthSquared( m_metric*( values[i] - codes[j] ) );
-			if( d < dist )
-			{
-				dist = d;
-				idx = j;
-			}
-		}
-		
-		// save the index
-		closest[i] = ( u8 )idx;
-		
-		// accumulate the error
-		error += dist;
-	}
+	float error = MatchCodes( count, values, codes, 3, m_metric, closest );
 	
 	// save this scheme if it wins
 	if( error < m_besterror )
@@ -160,28 +220,7 @@ void RangeFit::Compress4( void* block )
 
 	// match each point to the closest code
 	u8 closest[16];
-	float error = 0.0f;
-	for( int i = 0; i < count; ++i )
-	{
-		// find the closest code
-		float dist = FLT_MAX;
-		int idx = 0;
-		for( int j = 0; j < 4; ++j )
-		{
-			float d = LengthSquared( m_metric*( values[i] - codes[j] ) );
-			if( d < dist )
-			{
-				dist = d;
-				idx = j;
-			}
-		}
-		
-		// save the index
-		closest[i] = ( u8 )idx;
-		
-		// accumulate the error
-		error += dist;
-	}
+	float error = MatchCodes( count, values, codes, 4, m_metric, closest );
 	
 	// save this scheme if it wins
 	if( error < m_besterror )
@@ -0,0 +1,374 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#include "StableHeaders.h"
+#include "DebugOperatorNew.h"
+
+#include "CollisionMeshLoader.h"
+
+#include <QFile>
+#include <QByteArray>
+
+#include <cstring>
+#include <map>
+
+#include "MemoryLeakCheck.h"
+
+namespace
+{
+
+/// Chunk IDs of the Ogre binary mesh format, see OgreMeshFileFormat.h.
+const u16 cHeaderChunk = 0x1000;
+const u16 cMeshChunk = 0x3000;
+const u16 cSubMeshChunk = 0x4000;
+const u16 cSubMeshOperationChunk = 0x4010;
+const u16 cGeometryChunk = 0x5000;
+const u16 cVertexDeclarationChunk = 0x5100;
+const u16 cVertexElementChunk = 0x5110;
+const u16 cVertexBufferChunk = 0x5200;
+const u16 cVertexBufferDataChunk = 0x5210;
+/// Size of the ID and the length of a chunk. The length of a chunk includes it.
+const size_t cChunkOverhead = sizeof(u16) + sizeof(u32);
+/// Maximum length of the version string of the header.
+const size_t cMaxVersionLength = 64;
+
+/// Ogre::VertexElementSemantic and Ogre::VertexElementType values of the positions.
+const u16 cPositionSemantic = 1;
+const u16 cFloat3Type = 2;
+const u16 cFloat4Type = 3;
+/// Ogre::RenderOperation::OperationType values of the triangles.
+const u16 cTriangleList = 4;
+const u16 cTriangleStrip = 5;
+const u16 cTriangleFan = 6;
+
+/// Identifies the baked collision format: "TCOL", followed by the version and the number of triangles.
+const u32 cBakedMagic = 0x4C4F4354;
+const u32 cBakedVersion = 1;
+const size_t cBakedHeaderSize = 3 * sizeof(u32);
+
+/// Reads the values of the mesh data in either byte order.
+class MeshDataReader
+{
+public:
+    MeshDataReader(const u8 *data, size_t numBytes, bool swap) : data_(data), size_(numBytes), pos_(0), swap_(swap) {}
+
+    size_t Pos() const { return pos_; }
+    bool Seek(size_t pos) { if (pos > size_) return false; pos_ = pos; return true; }
+
+    bool Read(void *dst, size_t numBytes)
+    {
+        if (size_ - pos_ < numBytes)
+            return false;
+        memcpy(dst, data_ + pos_, numBytes);
+        if (swap_)
+        {
+            u8 *bytes = (u8 *)dst;
+            for(size_t i = 0; i < numBytes / 2; ++i)
+                std::swap(bytes[i], bytes[numBytes - 1 - i]);
+        }
+        pos_ += numBytes;
+        return true;
+    }
+
+    /// Skips a string terminated by a line feed.
+    bool SkipString()
+    {
+        while(pos_ < size_ && data_[pos_] != '\n')
+            ++pos_;
+        return Seek(pos_ + 1);
+    }
+
+    /// Reads the ID and the length of a chunk. The length includes the chunk header.
+    bool ReadChunkHeader(u16 &id, u32 &length)
+    {
+        return Read(&id, sizeof(id)) && Read(&length, sizeof(length)) && length >= cChunkOverhead;
+    }
+
+private:
+    const u8 *data_;
+    size_t size_;
+    size_t pos_;
+    bool swap_;
+};
+
+/// Positions of the vertices of a geometry chunk.
+typedef std::vector<float3> Positions;
+
+/// Reads the positions of the geometry chunk whose vertex count is next, up to the end of the chunk.
+bool ReadGeometry(MeshDataReader &reader, size_t chunkEnd, Positions &positions)
+{
+    u32 vertexCount;
+    if (!reader.Read(&vertexCount, sizeof(vertexCount)))
+        return false;
+
+    u16 positionSource = 0, positionType = 0, positionOffset = 0;
+    bool hasPosition = false;
+    // Offsets of the data of the vertex buffers and the sizes of their vertices, by the binding index.
+    std::map<u16, std::pair<size_t, u16> > buffers;
+    u16 id;
+    u32 length;
+    while(reader.Pos() < chunkEnd && reader.ReadChunkHeader(id, length))
+    {
+        const size_t subChunkEnd = reader.Pos() - cChunkOverhead + length;
+        if (id == cVertexDeclarationChunk)
+        {
+            while(reader.Pos() < subChunkEnd && reader.ReadChunkHeader(id, length))
+            {
+                const size_t elementEnd = reader.Pos() - cChunkOverhead + length;
+                u16 source, type, semantic, offset;
+                if (id == cVertexElementChunk && reader.Read(&source, sizeof(u16)) && reader.Read(&type, sizeof(u16)) &&
+                    reader.Read(&semantic, sizeof(u16)) && reader.Read(&offset, sizeof(u16)) && semantic == cPositionSemantic && !hasPosition)
+                {
+                    positionSource = source;
+                    positionType = type;
+                    positionOffset = offset;
+                    hasPosition = true;
+                }
+                if (!reader.Seek(elementEnd))
+                    return false;
+            }
+        }
+        else if (id == cVertexBufferChunk)
+        {
+            u16 bindIndex, vertexSize;
+            if (!reader.Read(&bindIndex, sizeof(u16)) || !reader.Read(&vertexSize, sizeof(u16)) || !reader.ReadChunkHeader(id, length))
+                return false;
+            if (id == cVertexBufferDataChunk)
+                buffers[bindIndex] = std::make_pair(reader.Pos(), vertexSize);
+        }
+        if (!reader.Seek(subChunkEnd))
+            return false;
+    }
+
+    std::map<u16, std::pair<size_t, u16> >::const_iterator buffer = buffers.find(positionSource);
+    if (!hasPosition || (positionType != cFloat3Type && positionType != cFloat4Type) || buffer == buffers.end())
+        return false;
+    positions.resize(vertexCount);
+    for(u32 i = 0; i < vertexCount; ++i)
+    {
+        // The vertex data is in the byte order of the file per element, so the floats are read one by one.
+        if (!reader.Seek(buffer->second.first + i * buffer->second.second + positionOffset) ||
+            !reader.Read(&positions[i].x, sizeof(float)) || !reader.Read(&positions[i].y, sizeof(float)) || !reader.Read(&positions[i].z, sizeof(float)))
+            return false;
+    }
+    return reader.Seek(chunkEnd);
+}
+
+struct SubMesh
+{
+    SubMesh() : useSharedVertices(false), operation(cTriangleList) {}
+    bool useSharedVertices;
+    std::vector<u32> indices;
+    Positions positions;
+    u16 operation;
+};
+
+/// Reads the submesh chunk whose material name is next, up to the end of the chunk.
+bool ReadSubMesh(MeshDataReader &reader, size_t chunkEnd, SubMesh &subMesh)
+{
+    u8 useSharedVertices, indexes32Bit;
+    u32 indexCount;
+    if (!reader.SkipString() || !reader.Read(&useSharedVertices, 1) || !reader.Read(&indexCount, sizeof(u32)) || !reader.Read(&indexes32Bit, 1))
+        return false;
+    subMesh.useSharedVertices = useSharedVertices != 0;
+    subMesh.indices.resize(indexCount);
+    for(u32 i = 0; i < indexCount; ++i)
+    {
+        if (indexes32Bit)
+        {
+            if (!reader.Read(&subMesh.indices[i], sizeof(u32)))
+                return false;
+        }
+        else
+        {
+            u16 index;
+            if (!reader.Read(&index, sizeof(u16)))
+                return false;
+            subMesh.indices[i] = index;
+        }
+    }
+
+    u16 id;
+    u32 length;
+    while(reader.Pos() < chunkEnd && reader.ReadChunkHeader(id, length))
+    {
+        const size_t subChunkEnd = reader.Pos() - cChunkOverhead + length;
+        if (id == cGeometryChunk && !subMesh.useSharedVertices)
+        {
+            if (!ReadGeometry(reader, subChunkEnd, subMesh.positions))
+                return false;
+        }
+        else if (id == cSubMeshOperationChunk)
+        {
+            if (!reader.Read(&subMesh.operation, sizeof(u16)))
+                return false;
+        }
+        if (!reader.Seek(subChunkEnd))
+            return false;
+    }
+    return reader.Seek(chunkEnd);
+}
+
+/// Appends the triangles of the submesh, unrolling strips and fans.
+void AppendTriangles(const SubMesh &subMesh, const Positions &positions, std::vector<float3> &triangles)
+{
+    const std::vector<u32> &indices = subMesh.indices;
+    const size_t numCorners = indices.size();
+    for(size_t i = 0; i + 2 < numCorners; i += (subMesh.operation == cTriangleList ? 3 : 1))
+    {
+        u32 a = indices[i], b = indices[i + 1], c = indices[i + 2];
+        if (subMesh.operation == cTriangleStrip && (i & 1))
+            std::swap(a, b);
+        else if (subMesh.operation == cTriangleFan)
+            a = indices[0];
+        if (a >= positions.size() || b >= positions.size() || c >= positions.size())
+            continue;
+        triangles.push_back(positions[a]);
+        triangles.push_back(positions[b]);
+        triangles.push_back(positions[c]);
+    }
+}
+
+bool IsHostBigEndian()
+{
+#if Q_BYTE_ORDER == Q_BIG_ENDIAN
+    return true;
+#else
+    return false;
+#endif
+}
+
+}
+
+bool CollisionMeshLoader::Read(const u8 *data, size_t numBytes, std::vector<float3> &triangles)
+{
+    triangles.clear();
+    if (!data || numBytes < sizeof(u32))
+        return false;
+    if ((u32)(data[0] | (data[1] << 8) | (data[2] << 16) | (data[3] << 24)) == cBakedMagic)
+        return ReadBaked(data, numBytes, triangles);
+    return ReadOgreMesh(data, numBytes, triangles);
+}
+
+bool CollisionMeshLoader::ReadFile(const QString &filename, std::vector<float3> &triangles)
+{
+    triangles.clear();
+    QFile file(filename);
+    if (filename.isEmpty() || !file.open(QIODevice::ReadOnly) || file.size() <= 0)
+        return false;
+    uchar *data = file.map(0, file.size());
+    if (data)
+    {
+        bool ok = Read(data, (size_t)file.size(), triangles);
+        file.unmap(data);
+        return ok;
+    }
+    QByteArray bytes = file.readAll();
+    return Read((const u8 *)bytes.constData(), (size_t)bytes.size(), triangles);
+}
+
+bool CollisionMeshLoader::ReadOgreMesh(const u8 *data, size_t numBytes, std::vector<float3> &triangles)
+{
+    // The header chunk ID tells the byte order of the file.
+    const u16 headerId = (u16)(data[0] | (data[1] << 8));
+    bool swap;
+    if (headerId == cHeaderChunk)
+        swap = false;
+    else if (headerId == ((cHeaderChunk >> 8) | ((cHeaderChunk & 0xff) << 8)))
+        swap = true;
+    else
+        return false;
+    if (IsHostBigEndian())
+        swap = !swap;
+
+    // The header chunk has no length, only the version string terminated by a line feed.
+    size_t pos = sizeof(u16);
+    while(pos < numBytes && pos < cMaxVersionLength && data[pos] != '\n')
+        ++pos;
+    if (pos >= numBytes || data[pos] != '\n')
+        return false;
+
+    MeshDataReader reader(data, numBytes, swap);
+    reader.Seek(pos + 1);
+    u16 id;
+    u32 length;
+    while(reader.ReadChunkHeader(id, length))
+    {
+        const size_t chunkEnd = reader.Pos() - cChunkOverhead + length;
+        if (id != cMeshChunk)
+        {
+            if (!reader.Seek(chunkEnd))
+                return false;
+            continue;
+        }
+
+        // The mesh chunk begins with the skeletally animated flag, followed by the sub-chunks of the mesh.
+        if (!reader.Seek(reader.Pos() + 1))
+            return false;
+        Positions sharedPositions;
+        std::vector<SubMesh> subMeshes;
+        while(reader.Pos() < chunkEnd && reader.ReadChunkHeader(id, length))
+        {
+            const size_t subChunkEnd = reader.Pos() - cChunkOverhead + length;
+            if (id == cGeometryChunk)
+            {
+                if (!ReadGeometry(reader, subChunkEnd, sharedPositions))
+                    return false;
+            }
+            else if (id == cSubMeshChunk)
+            {
+                subMeshes.push_back(SubMesh());
+                if (!ReadSubMesh(reader, subChunkEnd, subMeshes.back()))
+                    return false;
+            }
+            if (!reader.Seek(subChunkEnd))
+                return false;
+        }
+
+        for(size_t i = 0; i < subMeshes.size(); ++i)
+            if (subMeshes[i].operation == cTriangleList || subMeshes[i].operation == cTriangleStrip || subMeshes[i].operation == cTriangleFan)
+                AppendTriangles(subMeshes[i], subMeshes[i].useSharedVertices ? sharedPositions : subMeshes[i].positions, triangles);
+        return !triangles.empty();
+    }
+    return false;
+}
+
+bool CollisionMeshLoader::ReadBaked(const u8 *data, size_t numBytes, std::vector<float3> &triangles)
+{
+    // The baked format is little-endian.
+    MeshDataReader reader(data, numBytes, IsHostBigEndian());
+    u32 magic, version, numTriangles;
+    if (!reader.Read(&magic, sizeof(u32)) || !reader.Read(&version, sizeof(u32)) || !reader.Read(&numTriangles, sizeof(u32)) ||
+        magic != cBakedMagic || version != cBakedVersion || (numBytes - cBakedHeaderSize) / (9 * sizeof(float)) < numTriangles)
+        return false;
+    triangles.resize(numTriangles * 3);
+    for(size_t i = 0; i < triangles.size(); ++i)
+        if (!reader.Read(&triangles[i].x, sizeof(float)) || !reader.Read(&triangles[i].y, sizeof(float)) || !reader.Read(&triangles[i].z, sizeof(float)))
+            return false;
+    return !triangles.empty();
+}
+
+void CollisionMeshLoader::WriteBaked(const std::vector<float3> &triangles, std::vector<u8> &data)
+{
+    const u32 numTriangles = (u32)(triangles.size() / 3);
+    std::vector<u32> words;
+    words.reserve(cBakedHeaderSize / sizeof(u32) + numTriangles * 9);
+    words.push_back(cBakedMagic);
+    words.push_back(cBakedVersion);
+    words.push_back(numTriangles);
+    for(size_t i = 0; i < numTriangles * 3; ++i)
+        for(int j = 0; j < 3; ++j)
+        {
+            u32 word;
+            memcpy(&word, &triangles[i][j], sizeof(u32));
+            words.push_back(word);
+        }
+
+    data.resize(words.size() * sizeof(u32));
+    for(size_t i = 0; i < words.size(); ++i)
+    {
+        data[i * 4] = (u8)(words[i] & 0xff);
+        data[i * 4 + 1] = (u8)((words[i] >> 8) & 0xff);
+        data[i * 4 + 2] = (u8)((words[i] >> 16) & 0xff);
+        data[i * 4 + 3] = (u8)((words[i] >> 24) & 0xff);
+    }
+}
@@ -0,0 +1,36 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#pragma once
+
+#include "CoreDefines.h"
+#include "CoreTypes.h"
+#include "PhysicsModuleApi.h"
+#include "Math/float3.h"
+
+#include <QString>
+
+#include <vector>
+
+/// Reads the triangles of collision meshes without Ogre, so that a headless server can collide against meshes.
+/** Reads the geometry of Ogre binary meshes (.mesh) directly from the vertex and index data chunks of the file, in either
+    byte order of the mesh format. Only the positions are read, and the LOD levels, animations and edge lists are skipped.
+    Also reads the baked collision format (.collision), which is just the triangles. The baked format is the smaller and
+    faster to read, and can be made from a mesh with the bakeCollisionMesh console command.
+
+    The triangles are given as three vertices per triangle, like Physics::GetTrianglesFromMesh gives them from Ogre meshes. */
+class PHYSICS_MODULE_API CollisionMeshLoader
+{
+public:
+    /// Reads the triangles from Ogre binary mesh data or baked collision data. Returns false if the data is neither, or has no triangles.
+    static bool Read(const u8 *data, size_t numBytes, std::vector<float3> &triangles);
+
+    /// Reads the triangles from an Ogre binary mesh file or a baked collision file.
+    static bool ReadFile(const QString &filename, std::vector<float3> &triangles);
+
+    /// Writes the triangles in the baked collision format.
+    static void WriteBaked(const std::vector<float3> &triangles, std::vector<u8> &data);
+
+private:
+    static bool ReadOgreMesh(const u8 *data, size_t numBytes, std::vector<float3> &triangles);
+    static bool ReadBaked(const u8 *data, size_t numBytes, std::vector<float3> &triangles);
+};
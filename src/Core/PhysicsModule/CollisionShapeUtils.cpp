@@ -30,8 +30,12 @@ void GenerateTriangleMesh(Ogre::Mesh* mesh, btTriangleMesh* ptr)
 {
     std::vector<float3> triangles;
     GetTrianglesFromMesh(mesh, triangles);
-    
-    for(uint i = 0; i < triangles.size(); i += 3)
+    GenerateTriangleMesh(triangles, ptr);
+}
+
+void GenerateTriangleMesh(const std::vector<float3>& triangles, btTriangleMesh* ptr)
+{
+    for(uint i = 0; i + 2 < triangles.size(); i += 3)
         ptr->addTriangle(triangles[i], triangles[i+1], triangles[i+2]);
 }
 
@@ -39,6 +43,11 @@ void GenerateConvexHullSet(Ogre::Mesh* mesh, ConvexHullSet* ptr)
 {
     std::vector<float3> vertices;
     GetTrianglesFromMesh(mesh, vertices);
+    GenerateConvexHullSet(vertices, ptr);
+}
+
+void GenerateConvexHullSet(const std::vector<float3>& vertices, ConvexHullSet* ptr)
+{
     if (!vertices.size())
     {
         LogError("Mesh had no triangles; aborting convex hull generation");
@@ -14,4 +14,7 @@ namespace Physics
     void PHYSICS_MODULE_API GenerateTriangleMesh(Ogre::Mesh* mesh, btTriangleMesh* ptr);
     void PHYSICS_MODULE_API GetTrianglesFromMesh(Ogre::Mesh* mesh, std::vector<float3>& dest);
     void PHYSICS_MODULE_API GenerateConvexHullSet(Ogre::Mesh* mesh, ConvexHullSet* ptr);
+    /// Overloads for the triangles given as three vertices per triangle, e.g. read with CollisionMeshLoader.
+    void PHYSICS_MODULE_API GenerateTriangleMesh(const std::vector<float3>& triangles, btTriangleMesh* ptr);
+    void PHYSICS_MODULE_API GenerateConvexHullSet(const std::vector<float3>& vertices, ConvexHullSet* ptr);
 }
@@ -10,6 +10,7 @@
 #include "PhysicsModule.h"
 #include "PhysicsUtils.h"
 #include "PhysicsWorld.h"
+#include "TerrainHeightfieldShape.h"
 
 #include "Profiler.h"
 #include "OgreMeshAsset.h"
@@ -38,25 +39,69 @@ static const float cForceThresholdSq = 0.0005f * 0.0005f;
 static const float cImpulseThresholdSq = 0.0005f * 0.0005f;
 static const float cTorqueThresholdSq = 0.0005f * 0.0005f;
 
-struct EC_RigidBody::Impl : public btMotionState
+struct EC_RigidBody::Impl : public btMotionState, public IAttributeChangeListener
 {
     Impl(EC_RigidBody *rb) :
         body(0),
         world(0),
         shape(0),
-        childShape(0),
         heightField(0),
         disconnected(false),
         cachedShapeType(-1),
         cachedSize(float3::zero),
         clientExtrapolating(false),
-        rigidBody(rb)
+        hasCollisionListeners(false),
+        rigidBody(rb),
+        kinematicPosition(float3::zero),
+        kinematicOrientation(Quat::identity)
     {
     }
 
+    /// IAttributeChangeListener override. Called when the transform of the placeable has changed
+    void OnAttributeChanged(IComponent* /*component*/, IAttribute *attribute, AttributeChange::Type /*change*/)
+    {
+        rigidBody->PlaceableUpdated(attribute);
+    }
+
+    /// Sets the scaling of the heightfield, and its transform in the compound shape from the terrain and the height range of the heightfield.
+    void UpdateHeightFieldTransform(EC_Terrain *terrain)
+    {
+        /** \todo EC_Terrain uses its own transform that is independent of the placeable. It is not nice to support, since rest of EC_RigidBody assumes
+            the transform is in the placeable. Right now, we only support position & scaling. Here, we also counteract Bullet's nasty habit to center 
+            the heightfield on its own. Also, Bullet's collisionshapes generally do not support arbitrary transforms, so we must construct a "compound shape"
+            and add the heightfield as its child, to be able to specify the transform.
+         */
+        const float xzSpacing = 1.0f;
+        float3 scale = terrain->nodeTransformation.Get().scale;
+        float3 bbMin(0, heightField->MinHeight(), 0);
+        float3 bbMax(xzSpacing * (terrain->VerticesWidth() - 1), heightField->MaxHeight(), xzSpacing * (terrain->VerticesHeight() - 1));
+        float3 bbCenter = scale.Mul((bbMin + bbMax) * 0.5f);
+        heightField->setLocalScaling(scale);
+
+        float3 positionAdjust = terrain->nodeTransformation.Get().pos;
+        positionAdjust += bbCenter;
+        static_cast<btCompoundShape*>(shape)->updateChildTransform(0, btTransform(btQuaternion(0,0,0,1), positionAdjust));
+    }
+
+    /// Returns the Bullet body, after waiting for the step of the physics world running in a dedicated thread, if any.
+    btRigidBody *Body() const
+    {
+        if (world)
+            world->WaitForStep();
+        return body;
+    }
+
     /// btMotionState override. Called when Bullet wants us to tell the body's initial transform
     void getWorldTransform(btTransform &worldTrans) const
     {
+        // The step in the dedicated thread asks for the transform of a kinematic body, and gets the one taken before it
+        if (world && world->IsStepRunning())
+        {
+            worldTrans.setOrigin(kinematicPosition);
+            worldTrans.setRotation(kinematicOrientation);
+            return;
+        }
+
         if (placeable.expired())
             return;
 
@@ -69,6 +114,27 @@ struct EC_RigidBody::Impl : public btMotionState
 
     /// btMotionState override. Called when Bullet wants to tell us the body's current transform
     void setWorldTransform(const btTransform &worldTrans)
+    {
+        float3 linearVel = float3::zero;
+        float3 angularVel = float3::zero;
+        if (body)
+        {
+            linearVel = body->getLinearVelocity();
+            angularVel = RadToDeg(body->getAngularVelocity());
+        }
+
+        // The step in the dedicated thread must not touch the scene, so publish the state to be applied after the step
+        if (world && world->IsStepRunning())
+        {
+            world->PublishBodyState(rigidBody, worldTrans.getOrigin(), worldTrans.getRotation(), linearVel, angularVel);
+            return;
+        }
+
+        SetPlaceableState(worldTrans.getOrigin(), worldTrans.getRotation(), linearVel, angularVel);
+    }
+
+    /// Sets the transform of the placeable, and the velocities, to the body's state from the simulation.
+    void SetPlaceableState(float3 position, Quat orientation, const float3 &linearVel, const float3 &angularVel)
     {
         /// \todo For a large scene, applying the changed transforms of rigid bodies is slow (slower than the physics simulation itself,
         /// or handling collisions) due to the large number of Qt signals being fired.
@@ -89,9 +155,6 @@ struct EC_RigidBody::Impl : public btMotionState
         AttributeChange::Type changeType = hasAuthority ? AttributeChange::Default : AttributeChange::LocalOnly;
 
         // Set transform
-        float3 position = worldTrans.getOrigin();
-        Quat orientation = worldTrans.getRotation();
-    
         // Non-parented case
         if (p->parentRef.Get().IsEmpty())
         {
@@ -123,8 +186,6 @@ struct EC_RigidBody::Impl : public btMotionState
             // Performance optimization: because applying each attribute causes signals to be fired, which is slow in a large scene
             // (and furthermore, on a server, causes each connection's sync state to be accessed), do not set the linear/angular
             // velocities if they haven't changed
-            float3 linearVel = body->getLinearVelocity();
-            float3 angularVel = RadToDeg(body->getAngularVelocity());
             if (!linearVel.Equals(rigidBody->linearVelocity.Get()))
                 rigidBody->linearVelocity.Set(linearVel, changeType);
             if (!angularVel.Equals(rigidBody->angularVelocity.Get()))
@@ -176,12 +237,12 @@ struct EC_RigidBody::Impl : public btMotionState
     /// using local physics computations (true).
     /// On the server side, this flag is not used.
     bool clientExtrapolating;
+    /// Whether the PhysicsCollision signal has listeners. If not, PhysicsWorld does not generate collision events for this body
+    bool hasCollisionListeners;
     /// Bullet body
     btRigidBody* body;
     /// Bullet collision shape
     btCollisionShape* shape;
-    /// Bullet collision child shape. This is needed to use btScaledBvhTriangleMeshShape
-    btCollisionShape* childShape;
     /// Physics world. May be 0 if the scene does not have a physics world. In that case most of EC_RigidBody's functionality is a no-op
     PhysicsWorld* world;
     /// PhysicsModule pointer
@@ -190,14 +251,15 @@ struct EC_RigidBody::Impl : public btMotionState
     int cachedShapeType;
     /// Cached shapesize (last created)
     float3 cachedSize;
-    /// Bullet triangle mesh
-    shared_ptr<btTriangleMesh> triangleMesh;
+    /// Bullet BVH triangle mesh shape, shared by the rigid bodies of the same mesh and scaled per body by shape
+    shared_ptr<btBvhTriangleMeshShape> bvhShape;
     /// Convex hull set
     shared_ptr<ConvexHullSet> convexHullSet;
-    /// Bullet heightfield shape. Note: this is always put inside a compound shape (impl->shape)
-    btHeightfieldTerrainShape* heightField;
-    /// Heightfield values, for the case the shape is a heightfield.
-    std::vector<float> heightValues;
+    /// Bullet heightfield shape, which reads the heights of the terrain. Note: this is always put inside a compound shape (impl->shape)
+    TerrainHeightfieldShape* heightField;
+    /// World transform of the placeable of a kinematic body, taken before each step run in a dedicated thread
+    float3 kinematicPosition;
+    Quat kinematicOrientation;
 };
 
 EC_RigidBody::EC_RigidBody(Scene* scene) :
@@ -247,7 +309,13 @@ EC_RigidBody::~EC_RigidBody()
     RemoveBody();
     RemoveCollisionShape();
     if (impl->world)
+    {
         impl->world->debugRigidBodies_.erase(this);
+        impl->world->ForgetComponent(this);
+    }
+    shared_ptr<EC_Placeable> placeable = impl->placeable.lock();
+    if (placeable)
+        placeable->RemoveAttributeChangeListener(impl);
     delete impl;
 }
 
@@ -299,9 +367,9 @@ void EC_RigidBody::ApplyForce(const float3& force, const float3& position)
     {
         Activate();
         if (position == float3::zero)
-            impl->body->applyCentralForce(force);
+            impl->Body()->applyCentralForce(force);
         else
-            impl->body->applyForce(force, position);
+            impl->Body()->applyForce(force, position);
     }
 }
 
@@ -320,7 +388,7 @@ void EC_RigidBody::ApplyTorque(const float3& torque)
     if (impl->body)
     {
         Activate();
-        impl->body->applyTorque(torque);
+        impl->Body()->applyTorque(torque);
     }
 }
 
@@ -340,9 +408,9 @@ void EC_RigidBody::ApplyImpulse(const float3& impulse, const float3& position)
     {
         Activate();
         if (position == float3::zero)
-            impl->body->applyCentralImpulse(impulse);
+            impl->Body()->applyCentralImpulse(impulse);
         else
-            impl->body->applyImpulse(impulse, position);
+            impl->Body()->applyImpulse(impulse, position);
     }
 }
 
@@ -361,7 +429,7 @@ void EC_RigidBody::ApplyTorqueImpulse(const float3& torqueImpulse)
     if (impl->body)
     {
         Activate();
-        impl->body->applyTorqueImpulse(torqueImpulse);
+        impl->Body()->applyTorqueImpulse(torqueImpulse);
     }
 }
 
@@ -374,19 +442,19 @@ void EC_RigidBody::Activate()
     if (!impl->body)
         CreateBody();
     if (impl->body)
-        impl->body->activate();
+        impl->Body()->activate();
 }
 
 void EC_RigidBody::KeepActive()
 {
     if (impl->body)
-        impl->body->activate(true);
+        impl->Body()->activate(true);
 }
 
 bool EC_RigidBody::IsActive()
 {
     if (impl->body)
-        return impl->body->isActive();
+        return impl->Body()->isActive();
     else
         return false;
 }
@@ -400,7 +468,7 @@ void EC_RigidBody::ResetForces()
     if (!impl->body)
         CreateBody();
     if (impl->body)
-        impl->body->clearForces();
+        impl->Body()->clearForces();
 }
 
 void EC_RigidBody::UpdateSignals()
@@ -430,7 +498,8 @@ void EC_RigidBody::CheckForPlaceableAndTerrain()
         if (placeable)
         {
             impl->placeable = placeable;
-            connect(placeable.get(), SIGNAL(AttributeChanged(IAttribute*, AttributeChange::Type)), this, SLOT(PlaceableUpdated(IAttribute*)));
+            // The transform changes every frame for moving objects, so listen to it without a Qt signal
+            placeable->AddAttributeChangeListener(impl, placeable->transform.Index());
         }
     }
     if (!impl->terrain.lock())
@@ -440,6 +509,7 @@ void EC_RigidBody::CheckForPlaceableAndTerrain()
         {
             impl->terrain = terrain;
             connect(terrain.get(), SIGNAL(TerrainRegenerated()), this, SLOT(OnTerrainRegenerated()));
+            connect(terrain.get(), SIGNAL(HeightsChanged(uint, uint, uint, uint)), this, SLOT(OnTerrainHeightsChanged(uint, uint, uint, uint)));
             connect(terrain.get(), SIGNAL(AttributeChanged(IAttribute*, AttributeChange::Type)), this, SLOT(TerrainUpdated(IAttribute*)));
         }
     }
@@ -474,12 +544,9 @@ void EC_RigidBody::CreateCollisionShape()
         impl->shape = new btCapsuleShape(sizeVec.x * 0.5f, sizeVec.y * 0.5f);
         break;
     case Shape_TriMesh:
-        if (impl->triangleMesh)
-        {
-            // Need to first create a bvhTriangleMeshShape, then a scaled version of it to allow for individual scaling.
-            impl->childShape = new btBvhTriangleMeshShape(impl->triangleMesh.get(), true, true);
-            impl->shape = new btScaledBvhTriangleMeshShape(static_cast<btBvhTriangleMeshShape*>(impl->childShape), btVector3(1.0f, 1.0f, 1.0f));
-        }
+        // The BVH shape of the mesh is shared, so wrap it in a scaled version to allow for individual scaling.
+        if (impl->bvhShape)
+            impl->shape = new btScaledBvhTriangleMeshShape(impl->bvhShape.get(), btVector3(1.0f, 1.0f, 1.0f));
         break;
     case Shape_HeightField:
         CreateHeightFieldFromTerrain();
@@ -503,10 +570,9 @@ void EC_RigidBody::RemoveCollisionShape()
     if (impl->shape)
     {
         if (impl->body)
-            impl->body->setCollisionShape(0);
+            impl->Body()->setCollisionShape(0);
         SAFE_DELETE(impl->shape);
     }
-    SAFE_DELETE(impl->childShape);
     SAFE_DELETE(impl->heightField);
 }
 
@@ -515,6 +581,8 @@ void EC_RigidBody::CreateBody()
     if (!impl->world || !ParentEntity() || impl->body)
         return;
     
+    // The new body reads its transform from the placeable, which a step running in a dedicated thread would not let it do
+    impl->world->WaitForStep();
     CheckForPlaceableAndTerrain();
     
     CreateCollisionShape();
@@ -527,11 +595,11 @@ void EC_RigidBody::CreateBody()
     
     impl->body = new btRigidBody(m, impl, impl->shape, localInertia);
     // TEST: Adjust the threshold of when to sleep the object - for reducing network bandwidth.
-//    impl->body->setSleepingThresholds(0.2f, 0.5f); // Bullet defaults are 0.8 and 1.0.
-    impl->body->setUserPointer(this);
-    impl->body->setCollisionFlags(collisionFlags);
+//    impl->Body()->setSleepingThresholds(0.2f, 0.5f); // Bullet defaults are 0.8 and 1.0.
+    impl->Body()->setUserPointer(this);
+    impl->Body()->setCollisionFlags(collisionFlags);
     impl->world->BulletWorld()->addRigidBody(impl->body, collisionLayer.Get(), collisionMask.Get());
-    impl->body->activate();
+    impl->Body()->activate();
     
     UpdateGravity();
 }
@@ -548,19 +616,19 @@ void EC_RigidBody::ReaddBody()
 
     impl->world->BulletWorld()->removeRigidBody(impl->body);
 
-    impl->body->setCollisionShape(impl->shape);
-    impl->body->setMassProps(m, localInertia);
-    impl->body->setCollisionFlags(collisionFlags);
+    impl->Body()->setCollisionShape(impl->shape);
+    impl->Body()->setMassProps(m, localInertia);
+    impl->Body()->setCollisionFlags(collisionFlags);
 
     // We have changed the inertia tensor properties of the object, so recompute it.
     // http://www.bulletphysics.org/Bullet/phpBB3/viewtopic.php?f=9&t=5194&hilit=inertia+tensor#p18820
-    impl->body->updateInertiaTensor();
+    impl->Body()->updateInertiaTensor();
 
     impl->world->BulletWorld()->addRigidBody(impl->body, collisionLayer.Get(), collisionMask.Get());
-    impl->body->clearForces();
-    impl->body->setLinearVelocity(btVector3(0.0f, 0.0f, 0.0f));
-    impl->body->setAngularVelocity(btVector3(0.0f, 0.0f, 0.0f));
-    impl->body->activate();
+    impl->Body()->clearForces();
+    impl->Body()->setLinearVelocity(btVector3(0.0f, 0.0f, 0.0f));
+    impl->Body()->setAngularVelocity(btVector3(0.0f, 0.0f, 0.0f));
+    impl->Body()->activate();
 }
 
 void EC_RigidBody::RemoveBody()
@@ -568,10 +636,16 @@ void EC_RigidBody::RemoveBody()
     if (impl->body && impl->world)
     {
         impl->world->BulletWorld()->removeRigidBody(impl->body);
+        impl->world->ForgetBody(this);
         SAFE_DELETE(impl->body);
     }
 }
 
+void EC_RigidBody::ApplyBodyState(const float3 &position, const Quat &orientation, const float3 &linearVelocity, const float3 &angularVelocity)
+{
+    impl->SetPlaceableState(position, orientation, linearVelocity, angularVelocity);
+}
+
 void EC_RigidBody::SetClientExtrapolating(bool isClientExtrapolating)
 {
     impl->clientExtrapolating = isClientExtrapolating;
@@ -579,40 +653,85 @@ void EC_RigidBody::SetClientExtrapolating(bool isClientExtrapolating)
 
 btRigidBody* EC_RigidBody::BulletRigidBody() const
 {
-    return impl->body;
+    return impl->Body();
+}
+
+bool EC_RigidBody::HasCollisionListeners() const
+{
+    return impl->hasCollisionListeners;
+}
+
+void EC_RigidBody::connectNotify(const char *signal)
+{
+    IComponent::connectNotify(signal);
+    impl->hasCollisionListeners = receivers(SIGNAL(PhysicsCollision(Entity*, const float3&, const float3&, float, float, bool))) > 0;
+}
+
+void EC_RigidBody::disconnectNotify(const char *signal)
+{
+    IComponent::disconnectNotify(signal);
+    impl->hasCollisionListeners = receivers(SIGNAL(PhysicsCollision(Entity*, const float3&, const float3&, float, float, bool))) > 0;
 }
 
 void EC_RigidBody::OnTerrainRegenerated()
 {
-    if (shapeType.Get() == Shape_HeightField)
+    // The heightfield reads the terrain, and the changed heights are handled by OnTerrainHeightsChanged, so only recreate it when the terrain is resized
+    if (shapeType.Get() == Shape_HeightField && (!impl->heightField || !impl->heightField->Matches(impl->terrain.lock().get())))
         CreateCollisionShape();
 }
 
+void EC_RigidBody::OnTerrainHeightsChanged(uint minPatchX, uint minPatchY, uint maxPatchX, uint maxPatchY)
+{
+    EC_Terrain* terrain = impl->terrain.lock().get();
+    if (!terrain || shapeType.Get() != Shape_HeightField || !impl->heightField)
+        return;
+    if (!impl->heightField->Matches(terrain))
+    {
+        CreateCollisionShape();
+        return;
+    }
+
+    // The new heights are already seen by the shape: only grow its bounding box around them
+    PROFILE(EC_RigidBody_OnTerrainHeightsChanged);
+    float minY, maxY;
+    TerrainHeightfieldShape::PatchHeightRange(terrain, minPatchX, minPatchY, maxPatchX, maxPatchY, minY, maxY);
+    if (minY > maxY)
+        return;
+    if (impl->world)
+        impl->world->WaitForStep();
+    if (impl->heightField->GrowHeightRange(minY, maxY))
+    {
+        impl->UpdateHeightFieldTransform(terrain);
+        if (impl->body && impl->world)
+            impl->world->BulletWorld()->updateSingleAabb(impl->body);
+    }
+}
+
 void EC_RigidBody::OnCollisionMeshAssetLoaded(AssetPtr asset)
 {
     OgreMeshAsset *meshAsset = dynamic_cast<OgreMeshAsset*>(asset.get());
-    if (!meshAsset || !meshAsset->ogreMesh.get())
-        LogError("EC_RigidBody::OnCollisionMeshAssetLoaded: Mesh asset load finished for asset \"" +
-            asset->Name() + "\", but Ogre::Mesh pointer was null!");
+    Ogre::Mesh *mesh = meshAsset ? meshAsset->ogreMesh.get() : 0;
+    // The headless server reads the geometry from the asset data without Ogre, as is done for the baked collision meshes.
+    const bool fromData = !mesh || GetFramework()->IsHeadless();
 
-    Ogre::Mesh *mesh = meshAsset->ogreMesh.get();
-
-    if (mesh)
+    if (shapeType.Get() == Shape_TriMesh)
     {
-        if (shapeType.Get() == Shape_TriMesh)
-        {
-            impl->triangleMesh = impl->owner->GetTriangleMeshFromOgreMesh(mesh);
-            CreateCollisionShape();
-        }
-        if (shapeType.Get() == Shape_ConvexHull)
-        {
-            impl->convexHullSet = impl->owner->GetConvexHullSetFromOgreMesh(mesh);
-            CreateCollisionShape();
-        }
-
-        impl->cachedShapeType = shapeType.Get();
-        impl->cachedSize = size.Get();
+        impl->bvhShape = fromData ? impl->owner->GetBvhTriangleMeshShapeFromAsset(asset.get()) :
+            impl->owner->GetBvhTriangleMeshShapeFromOgreMesh(mesh, meshAsset->ContentHash());
+        if (!impl->bvhShape)
+            LogError("EC_RigidBody::OnCollisionMeshAssetLoaded: Could not read the triangles of collision mesh asset \"" + asset->Name() + "\".");
+        CreateCollisionShape();
     }
+    if (shapeType.Get() == Shape_ConvexHull)
+    {
+        impl->convexHullSet = fromData ? impl->owner->GetConvexHullSetFromAsset(asset.get()) : impl->owner->GetConvexHullSetFromOgreMesh(mesh);
+        if (!impl->convexHullSet)
+            LogError("EC_RigidBody::OnCollisionMeshAssetLoaded: Could not read the triangles of collision mesh asset \"" + asset->Name() + "\".");
+        CreateCollisionShape();
+    }
+
+    impl->cachedShapeType = shapeType.Get();
+    impl->cachedSize = size.Get();
 }
 
 void EC_RigidBody::AttributesChanged()
@@ -632,22 +751,22 @@ void EC_RigidBody::AttributesChanged()
         ReaddBody();
     
     if (friction.ValueChanged())
-        impl->body->setFriction(friction.Get());
+        impl->Body()->setFriction(friction.Get());
     
     if (rollingFriction.ValueChanged())
-        impl->body->setRollingFriction(rollingFriction.Get());
+        impl->Body()->setRollingFriction(rollingFriction.Get());
     
     if (restitution.ValueChanged())
-        impl->body->setRestitution(friction.Get());
+        impl->Body()->setRestitution(friction.Get());
     
     if (linearDamping.ValueChanged() || angularDamping.ValueChanged())
-         impl->body->setDamping(linearDamping.Get(), angularDamping.Get());
+         impl->Body()->setDamping(linearDamping.Get(), angularDamping.Get());
     
     if (linearFactor.ValueChanged())
-        impl->body->setLinearFactor(linearFactor.Get());
+        impl->Body()->setLinearFactor(linearFactor.Get());
     
     if (angularFactor.ValueChanged())
-        impl->body->setAngularFactor(angularFactor.Get());
+        impl->Body()->setAngularFactor(angularFactor.Get());
     
     if (shapeType.ValueChanged() || size.ValueChanged())
     {
@@ -681,12 +800,12 @@ void EC_RigidBody::AttributesChanged()
         bool enable = drawDebug.Get();
         if (impl->body)
         {
-            int collisionFlags = impl->body->getCollisionFlags();
+            int collisionFlags = impl->Body()->getCollisionFlags();
             if (enable)
                 collisionFlags &= ~btCollisionObject::CF_DISABLE_VISUALIZE_OBJECT;
             else
                 collisionFlags |= btCollisionObject::CF_DISABLE_VISUALIZE_OBJECT;
-            impl->body->setCollisionFlags(collisionFlags);
+            impl->Body()->setCollisionFlags(collisionFlags);
         }
         
         // Refresh PhysicsWorld's knowledge of debug-enabled rigidbodies
@@ -701,14 +820,14 @@ void EC_RigidBody::AttributesChanged()
     
     if (linearVelocity.ValueChanged() && !impl->disconnected)
     {
-        impl->body->setLinearVelocity(linearVelocity.Get());
-        impl->body->activate();
+        impl->Body()->setLinearVelocity(linearVelocity.Get());
+        impl->Body()->activate();
     }
     
     if (angularVelocity.ValueChanged() && !impl->disconnected)
     {
-        impl->body->setAngularVelocity(DegToRad(angularVelocity.Get()));
-        impl->body->activate();
+        impl->Body()->setAngularVelocity(DegToRad(angularVelocity.Get()));
+        impl->Body()->activate();
     }
     
     if (useGravity.ValueChanged())
@@ -735,7 +854,7 @@ void EC_RigidBody::PlaceableUpdated(IAttribute* attribute)
 
         // Since we programmatically changed the orientation of the object outside the simulation, we must recompute the 
         // inertia tensor matrix of the object manually (it's dependent on the world space orientation of the object)
-        impl->body->updateInertiaTensor();
+        impl->Body()->updateInertiaTensor();
     }
 }
 
@@ -748,6 +867,13 @@ void EC_RigidBody::OnAboutToUpdate()
     EC_Placeable* placeable = impl->placeable.lock().get();
     if (placeable && !placeable->parentRef.Get().IsEmpty() && placeable->IsAttached())
         UpdatePosRotFromPlaceable();
+
+    // The step in a dedicated thread cannot read the placeable, so take the transform of a kinematic body for it beforehand
+    if (placeable && impl->world && impl->world->IsAsyncStep() && kinematic.Get())
+    {
+        impl->kinematicPosition = placeable->WorldPosition();
+        impl->kinematicOrientation = placeable->WorldOrientation();
+    }
 }
 
 void EC_RigidBody::SetRotation(const float3& rotation)
@@ -767,11 +893,11 @@ void EC_RigidBody::SetRotation(const float3& rotation)
         
         if (impl->body)
         {
-            btTransform& worldTrans = impl->body->getWorldTransform();
-            btTransform interpTrans = impl->body->getInterpolationWorldTransform();
+            btTransform& worldTrans = impl->Body()->getWorldTransform();
+            btTransform interpTrans = impl->Body()->getInterpolationWorldTransform();
             worldTrans.setRotation(trans.Orientation());
             interpTrans.setRotation(worldTrans.getRotation());
-            impl->body->setInterpolationWorldTransform(interpTrans);
+            impl->Body()->setInterpolationWorldTransform(interpTrans);
         }
     }
     
@@ -795,11 +921,11 @@ void EC_RigidBody::Rotate(const float3& rotation)
         
         if (impl->body)
         {
-            btTransform& worldTrans = impl->body->getWorldTransform();
-            btTransform interpTrans = impl->body->getInterpolationWorldTransform();
+            btTransform& worldTrans = impl->Body()->getWorldTransform();
+            btTransform interpTrans = impl->Body()->getInterpolationWorldTransform();
             worldTrans.setRotation(trans.Orientation());
             interpTrans.setRotation(worldTrans.getRotation());
-            impl->body->setInterpolationWorldTransform(interpTrans);
+            impl->Body()->setInterpolationWorldTransform(interpTrans);
         }
     }
     
@@ -814,7 +940,7 @@ PhysicsWorld* EC_RigidBody::World() const
 float3 EC_RigidBody::GetLinearVelocity()
 {
     if (impl->body)
-        return impl->body->getLinearVelocity();
+        return impl->Body()->getLinearVelocity();
     else 
         return linearVelocity.Get();
 }
@@ -822,7 +948,7 @@ float3 EC_RigidBody::GetLinearVelocity()
 float3 EC_RigidBody::GetAngularVelocity()
 {
     if (impl->body)
-        return RadToDeg(impl->body->getAngularVelocity());
+        return RadToDeg(impl->Body()->getAngularVelocity());
     else
         return angularVelocity.Get();
 }
@@ -830,7 +956,7 @@ float3 EC_RigidBody::GetAngularVelocity()
 void EC_RigidBody::GetAabbox(float3 &outAabbMin, float3 &outAabbMax)
 {
     btVector3 aabbMin, aabbMax;
-    impl->body->getAabb(aabbMin, aabbMax);
+    impl->Body()->getAabb(aabbMin, aabbMax);
     outAabbMin.Set(aabbMin.x(), aabbMin.y(), aabbMin.z());
     outAabbMax.Set(aabbMax.x(), aabbMax.y(), aabbMax.z());
 }
@@ -846,7 +972,7 @@ bool EC_RigidBody::HasAuthority() const
 AABB EC_RigidBody::ShapeAABB() const
 {
     btVector3 aabbMin, aabbMax;
-    impl->body->getAabb(aabbMin, aabbMax);
+    impl->Body()->getAabb(aabbMin, aabbMax);
     return AABB(aabbMin, aabbMax);
 }
 
@@ -874,9 +1000,20 @@ void EC_RigidBody::TerrainUpdated(IAttribute* attribute)
     EC_Terrain* terrain = impl->terrain.lock().get();
     if (!terrain)
         return;
-    /// \todo It is suboptimal to regenerate the whole heightfield when just the terrain's transform changes
-    if (attribute == &terrain->nodeTransformation && shapeType.Get() == Shape_HeightField)
+    if (attribute != &terrain->nodeTransformation || shapeType.Get() != Shape_HeightField)
+        return;
+    if (!impl->heightField || !impl->heightField->Matches(terrain))
+    {
         CreateCollisionShape();
+        return;
+    }
+
+    // Only the transform changed: move the heightfield within the compound shape
+    if (impl->world)
+        impl->world->WaitForStep();
+    impl->UpdateHeightFieldTransform(terrain);
+    if (impl->body && impl->world)
+        impl->world->BulletWorld()->updateSingleAabb(impl->body);
 }
 
 void EC_RigidBody::RequestMesh()
@@ -933,19 +1070,19 @@ void EC_RigidBody::UpdateGravity()
     if (!impl->body || !impl->world)
         return;
     
-    int flags = impl->body->getFlags();
+    int flags = impl->Body()->getFlags();
     if (useGravity.Get())
     {
-        impl->body->setGravity(impl->world->BulletWorld()->getGravity());
-        impl->body->activate(); // Activate in case body was sleeping
+        impl->Body()->setGravity(impl->world->BulletWorld()->getGravity());
+        impl->Body()->activate(); // Activate in case body was sleeping
         flags &= ~BT_DISABLE_WORLD_GRAVITY;
     }
     else
     {
-        impl->body->setGravity(btVector3(0.0f, 0.0f, 0.0f));
+        impl->Body()->setGravity(btVector3(0.0f, 0.0f, 0.0f));
         flags |= BT_DISABLE_WORLD_GRAVITY;
     }
-    impl->body->setFlags(flags);
+    impl->Body()->setFlags(flags);
 }
 
 void EC_RigidBody::CreateHeightFieldFromTerrain()
@@ -956,48 +1093,21 @@ void EC_RigidBody::CreateHeightFieldFromTerrain()
     if (!terrain)
         return;
     
-    uint width = terrain->PatchWidth() * EC_Terrain::cPatchSize;
-    uint height = terrain->PatchHeight() * EC_Terrain::cPatchSize;
-    if (!width || !height)
+    if (!terrain->PatchWidth() || !terrain->PatchHeight())
         return;
     
-    impl->heightValues.resize(width * height);
-    
-    float xzSpacing = 1.0f;
-    float ySpacing = 1.0f;
-    float minY = 1000000000;
-    float maxY = -1000000000;
-    for(uint z = 0; z < height; ++z)
-        for(uint x = 0; x < width; ++x)
-        {
-            float value = terrain->GetPoint(x, z);
-            if (value < minY)
-                minY = value;
-            if (value > maxY)
-                maxY = value;
-            impl->heightValues[z * width + x] = value;
-        }
-
-    float3 scale = terrain->nodeTransformation.Get().scale;
-    float3 bbMin(0, minY, 0);
-    float3 bbMax(xzSpacing * (width - 1), maxY, xzSpacing * (height - 1));
-    float3 bbCenter = scale.Mul((bbMin + bbMax) * 0.5f);
-    
-    impl->heightField = new btHeightfieldTerrainShape(width, height, &impl->heightValues[0], ySpacing, minY, maxY, 1, PHY_FLOAT, false);
-    
-    /** \todo EC_Terrain uses its own transform that is independent of the placeable. It is not nice to support, since rest of EC_RigidBody assumes
-        the transform is in the placeable. Right now, we only support position & scaling. Here, we also counteract Bullet's nasty habit to center 
-        the heightfield on its own. Also, Bullet's collisionshapes generally do not support arbitrary transforms, so we must construct a "compound shape"
-        and add the heightfield as its child, to be able to specify the transform.
-     */
-    impl->heightField->setLocalScaling(scale);
+    // The shape reads the heights from the terrain patches, so only their range is needed here
+    float minY, maxY;
+    TerrainHeightfieldShape::PatchHeightRange(terrain, 0, 0, terrain->PatchWidth() - 1, terrain->PatchHeight() - 1, minY, maxY);
+    if (minY > maxY)
+        minY = maxY = 0.f;
     
-    float3 positionAdjust = terrain->nodeTransformation.Get().pos;
-    positionAdjust += bbCenter;
+    impl->heightField = new TerrainHeightfieldShape(terrain, minY, maxY);
     
     btCompoundShape* compound = new btCompoundShape();
     impl->shape = compound;
-    compound->addChildShape(btTransform(btQuaternion(0,0,0,1), positionAdjust), impl->heightField);
+    compound->addChildShape(btTransform::getIdentity(), impl->heightField);
+    impl->UpdateHeightFieldTransform(terrain);
 }
 
 void EC_RigidBody::CreateConvexHullSetShape()
@@ -1032,15 +1142,15 @@ void EC_RigidBody::UpdatePosRotFromPlaceable()
     float3 position = placeable->WorldPosition();
     Quat orientation = placeable->WorldOrientation();
 
-    btTransform& worldTrans = impl->body->getWorldTransform();
+    btTransform& worldTrans = impl->Body()->getWorldTransform();
     worldTrans.setOrigin(position);
     worldTrans.setRotation(orientation);
     
     // When we forcibly set the physics transform, also set the interpolation transform to prevent jerky motion
-    btTransform interpTrans = impl->body->getInterpolationWorldTransform();
+    btTransform interpTrans = impl->Body()->getInterpolationWorldTransform();
     interpTrans.setOrigin(worldTrans.getOrigin());
     interpTrans.setRotation(worldTrans.getRotation());
-    impl->body->setInterpolationWorldTransform(interpTrans);
+    impl->Body()->setInterpolationWorldTransform(interpTrans);
     
     KeepActive();
 }
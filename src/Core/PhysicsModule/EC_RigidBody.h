@@ -203,8 +203,12 @@ public:
 
     void SetClientExtrapolating(bool isClientExtrapolating);
 
+    /// Returns the Bullet body, after waiting for the step of the physics world if it runs in a dedicated thread.
     btRigidBody* BulletRigidBody() const;
 
+    /// Returns whether the PhysicsCollision signal has listeners. Collision events are only generated for the bodies that have them, or whose collisions the physics world signals.
+    bool HasCollisionListeners() const;
+
     /// Constructs axis-aligned bounding box from bullet collision shape
     /** @param outMin The minimum corner of the box
         @param outMax The maximum corner of the box */
@@ -306,6 +310,11 @@ public slots:
     // DEPRECATED
     PhysicsWorld* GetPhysicsWorld() const; /**< @deprecated use World instead. @todo Remove at some point. */
 
+protected:
+    /// QObject overrides. Track whether PhysicsCollision has listeners.
+    void connectNotify(const char *signal);
+    void disconnectNotify(const char *signal);
+
 private slots:
     /// Called when the parent entity has been set.
     void UpdateSignals();
@@ -313,7 +322,7 @@ private slots:
     /// Called when the simulation is about to be stepped
     void OnAboutToUpdate();
     
-    /// Called when attributes of the placeable have changed
+    /// Called when the transform of the placeable has changed
     void PlaceableUpdated(IAttribute *attribute);
     
     /// Called when attributes of the terrain have changed
@@ -325,6 +334,9 @@ private slots:
     /// Called when EC_Terrain has been regenerated
     void OnTerrainRegenerated();
 
+    /// Called when the heights of some patches of EC_Terrain have changed. Grows the bounding box of the heightfield around them.
+    void OnTerrainHeightsChanged(uint minPatchX, uint minPatchY, uint maxPatchX, uint maxPatchY);
+
     /// Called when collision mesh has been downloaded.
     void OnCollisionMeshAssetLoaded(AssetPtr asset);
 
@@ -366,6 +378,9 @@ private:
     /// Request mesh resource (for trimesh & convexhull shapes)
     void RequestMesh();
 
+    /// Apply the state of the body published by the step of PhysicsWorld run in a dedicated thread. Called from PhysicsWorld
+    void ApplyBodyState(const float3 &position, const Quat &orientation, const float3 &linearVelocity, const float3 &angularVelocity);
+
     /// Emit a physics collision. Called from PhysicsWorld
     void EmitPhysicsCollision(Entity* otherEntity, const float3& position, const float3& normal, float distance, float impulse, bool newCollision);
 
@@ -25,13 +25,17 @@ using namespace Physics;
 EC_VolumeTrigger::EC_VolumeTrigger(Scene* scene) :
     IComponent(scene),
     INIT_ATTRIBUTE_VALUE(byPivot, "By Pivot", false),
-    INIT_ATTRIBUTE(entities, "Entities")
+    INIT_ATTRIBUTE(entities, "Entities"),
+    candidatesAdded_(false)
 {
     connect(this, SIGNAL(ParentEntitySet()), this, SLOT(UpdateSignals()), Qt::UniqueConnection);
 }
 
 EC_VolumeTrigger::~EC_VolumeTrigger()
 {
+    PhysicsWorldPtr world = world_.lock();
+    if (world)
+        world->UnregisterTrigger(this);
 }
 
 QList<EntityWeakPtr> EC_VolumeTrigger::GetEntitiesInside() const
@@ -169,9 +173,7 @@ void EC_VolumeTrigger::UpdateSignals()
     connect(parent, SIGNAL(ComponentAdded(IComponent*, AttributeChange::Type)), this, SLOT(CheckForRigidBody()), Qt::UniqueConnection);
 
     Scene* scene = parent->ParentScene();
-    PhysicsWorld* world = scene->GetWorld<PhysicsWorld>().get();
-    if (world)
-        connect(world, SIGNAL(Updated(float)), this, SLOT(OnPhysicsUpdate()), Qt::UniqueConnection);
+    world_ = scene->GetWorld<PhysicsWorld>();
 }
 
 void EC_VolumeTrigger::CheckForRigidBody()
@@ -183,103 +185,157 @@ void EC_VolumeTrigger::CheckForRigidBody()
     if (!rigidbody_.lock())
     {
         shared_ptr<EC_RigidBody> rigidbody = parent->GetComponent<EC_RigidBody>();
-        if (rigidbody)
+        PhysicsWorldPtr world = world_.lock();
+        if (rigidbody && world)
         {
             rigidbody_ = rigidbody;
-            connect(rigidbody.get(), SIGNAL(PhysicsCollision(Entity*, const float3&, const float3&, float, float, bool)),
-                this, SLOT(OnPhysicsCollision(Entity*, const float3&, const float3&, float, float, bool)), Qt::UniqueConnection);
+            world->RegisterTrigger(this, rigidbody.get());
         }
     }
 }
 
-void EC_VolumeTrigger::OnPhysicsUpdate()
+void EC_VolumeTrigger::OnPairChanged(EC_RigidBody *other, bool added)
 {
-    PROFILE(EC_VolumeTrigger_OnPhysicsUpdate);
-    
-    for(EntitiesWithinVolumeMap::iterator it = entities_.begin(); it != entities_.end();)
+    if (added)
     {
-        bool remove = false;
-        EntityPtr entity = it->first.lock();
-        
-        // Entity was destroyed without us knowing? Remove from map in that case
-        if (!entity)
-            remove = true;
-        else
-        {
-            // If collision is old, remove the entity if its rigidbody is active
-            // (inactive rigidbodies do not refresh the collision, so we would remove the entity mistakenly)
-            if (!it->second)
-            {
-                bool active = true;
-                shared_ptr<EC_RigidBody> rigidbody = entity->GetComponent<EC_RigidBody>();
-                if (rigidbody)
-                    active = rigidbody->IsActive();
-                if (active)
-                    remove = true;
-            }
-            else
-            {
-                // Age the collision from new to old
-                it->second = false;
-            }
-        }
-        
-        if (!remove)
-            ++it;
-        else
+        if (candidates_.find(other) == candidates_.end())
         {
-            EntitiesWithinVolumeMap::iterator current = it;
-            ++it;
-            entities_.erase(current);
-            if (entity)
-            {
-                emit EntityLeave(entity.get());
-                emit entityLeave(entity.get());
-                disconnect(entity.get(), SIGNAL(EntityRemoved(Entity*, AttributeChange::Type)), this, SLOT(OnEntityRemoved(Entity*)));
-            }
+            candidates_[other] = Candidate();
+            candidatesAdded_ = true;
         }
+        return;
+    }
+
+    CandidateMap::iterator it = candidates_.find(other);
+    if (it == candidates_.end())
+        return;
+    if (it->second.inside)
+    {
+        entities_.erase(it->second.entity);
+        leftEntities_.push_back(it->second.entity);
     }
+    candidates_.erase(it);
 }
 
-void EC_VolumeTrigger::OnPhysicsCollision(Entity* otherEntity, const float3& /*position*/,
-    const float3& /*normal*/, float /*distance*/, float /*impulse*/, bool newCollision)
+void EC_VolumeTrigger::ResolveCandidates()
 {
-    PROFILE(EC_VolumeTrigger_OnPhysicsCollision);
+    if (!candidatesAdded_)
+        return;
 
-    assert(otherEntity && "Physics collision with no entity.");
+    for(CandidateMap::iterator it = candidates_.begin(); it != candidates_.end(); ++it)
+    {
+        Candidate &candidate = it->second;
+        if (candidate.resolved)
+            continue;
+        candidate.resolved = true;
+        candidate.body = static_pointer_cast<EC_RigidBody>(it->first->shared_from_this());
+        Entity *entity = it->first->ParentEntity();
+        if (entity && entity != ParentEntity())
+            candidate.entity = entity->shared_from_this();
+    }
+}
 
-    if (!entities.Get().isEmpty() && !IsInterestingEntity(otherEntity->Name()))
+void EC_VolumeTrigger::UpdateOverlaps()
+{
+    if (candidates_.empty() && leftEntities_.empty())
         return;
 
-    EntityPtr entity = otherEntity->shared_from_this();
+    PROFILE(EC_VolumeTrigger_UpdateOverlaps);
 
-    // If byPivot attribute is enabled, we require the object pivot to enter the volume trigger area.
-    // Otherwise, we react on each physics collision message (i.e. we accept if the volumetrigger and other entity just touch).
-    if (byPivot.Get() && !IsPivotInside(entity.get()))
-        return;
+    std::vector<EntityWeakPtr> left;
+    left.swap(leftEntities_);
+    std::vector<EntityWeakPtr> entered;
 
-    bool refreshed = false;
-    
-    if (newCollision)
+    // Unless the volume moved or got new candidates, only the awake candidates can have entered or left
+    shared_ptr<EC_RigidBody> rigidbody = rigidbody_.lock();
+    const bool testAll = candidatesAdded_ || (rigidbody && rigidbody->IsActive());
+    candidatesAdded_ = false;
+
+    for(CandidateMap::iterator it = candidates_.begin(); it != candidates_.end(); ++it)
     {
-        // make sure the entity isn't already inside the volume
-        if (entities_.find(entity) == entities_.end())
+        Candidate &candidate = it->second;
+        shared_ptr<EC_RigidBody> other = candidate.body.lock();
+        EntityPtr entity = candidate.entity.lock();
+        if (!other || !entity)
+            continue;
+        if (!testAll && !other->IsActive())
+            continue;
+
+        const bool inside = TestInside(entity.get(), other.get());
+        if (inside == candidate.inside)
+            continue;
+        candidate.inside = inside;
+        if (inside)
+        {
+            entities_[candidate.entity] = it->first;
+            entered.push_back(candidate.entity);
+        }
+        else
         {
-            entities_[entity] = true;
-            emit EntityEnter(otherEntity);
-            refreshed = true;
-            emit entityEnter(otherEntity);
-            connect(otherEntity, SIGNAL(EntityRemoved(Entity*, AttributeChange::Type)), this, SLOT(OnEntityRemoved(Entity*)), Qt::UniqueConnection);
+            entities_.erase(candidate.entity);
+            left.push_back(candidate.entity);
         }
     }
 
-    if (!refreshed)
+    for(size_t i = 0; i < left.size(); ++i)
+    {
+        EntityPtr entity = left[i].lock();
+        if (entity)
+            EmitLeave(entity.get());
+    }
+    for(size_t i = 0; i < entered.size(); ++i)
     {
-        // Refresh the collision status to new
-        entities_[entity] = true;
+        EntityPtr entity = entered[i].lock();
+        if (entity)
+            EmitEnter(entity.get());
     }
 }
 
+bool EC_VolumeTrigger::TestInside(Entity *entity, EC_RigidBody *other) const
+{
+    if (!entities.Get().isEmpty() && !IsInterestingEntity(entity->Name()))
+        return false;
+
+    // If byPivot attribute is enabled, we require the object pivot to enter the volume trigger area.
+    // Otherwise, we accept if the volumetrigger and other entity just touch.
+    if (byPivot.Get())
+        return IsPivotInside(entity);
+
+    shared_ptr<EC_RigidBody> rigidbody = rigidbody_.lock();
+    PhysicsWorldPtr world = world_.lock();
+    if (!rigidbody || !world || !rigidbody->BulletRigidBody() || !other->BulletRigidBody())
+        return false;
+
+    struct ContactCallback : public btCollisionWorld::ContactResultCallback
+    {
+        ContactCallback() : touching(false) {}
+
+        virtual btScalar addSingleResult(btManifoldPoint &, const btCollisionObjectWrapper *, int, int, const btCollisionObjectWrapper *, int, int)
+        {
+            touching = true;
+            return 0.0f;
+        }
+
+        bool touching;
+    } callback;
+    world->BulletWorld()->contactPairTest(rigidbody->BulletRigidBody(), other->BulletRigidBody(), callback);
+    return callback.touching;
+}
+
+void EC_VolumeTrigger::EmitEnter(Entity *entity)
+{
+    emit EntityEnter(entity);
+    emit entityEnter(entity);
+    connect(entity, SIGNAL(EntityRemoved(Entity*, AttributeChange::Type)), this, SLOT(OnEntityRemoved(Entity*)), Qt::UniqueConnection);
+}
+
+void EC_VolumeTrigger::EmitLeave(Entity *entity)
+{
+    emit EntityLeave(entity);
+    emit entityLeave(entity);
+    disconnect(entity, SIGNAL(EntityRemoved(Entity*, AttributeChange::Type)), this, SLOT(OnEntityRemoved(Entity*)));
+}
+
 /** Called when the given entity is deleted from the scene. In that case, remove the Entity immediately from our tracking data structure (and signal listeners). */
 void EC_VolumeTrigger::OnEntityRemoved(Entity *entity)
 {
@@ -287,6 +343,9 @@ void EC_VolumeTrigger::OnEntityRemoved(Entity *entity)
     EntitiesWithinVolumeMap::iterator i = entities_.find(entity->shared_from_this());
     if (i != entities_.end())
     {
+        CandidateMap::iterator candidate = candidates_.find(i->second);
+        if (candidate != candidates_.end())
+            candidate->second.inside = false;
         entities_.erase(i);
         emit EntityLeave(entity);
         emit entityLeave(entity);
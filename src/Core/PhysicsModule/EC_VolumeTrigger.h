@@ -8,6 +8,7 @@
 #include "PhysicsModuleFwd.h"
 
 #include <map>
+#include <vector>
 
 /// Physics volume trigger component
 /** <table class="header">
@@ -49,6 +50,11 @@
 
     <b>Depends on the component RigitBody.</b>.
 
+    The bodies whose bounding boxes overlap the volume are tracked from the pairs of the physics broadphase, so a trigger
+    does no work on a frame when no pair has changed, and when neither the volume nor any of the bodies near it is awake.
+    The overlapping bodies are the candidates, which are tested against the actual volume when they enter it or move in it.
+    The signals are emitted once per frame, after the physics update.
+
     @note If you use 'byPivot' -option or use IsPivotInside-function, the pivot point shouldn't be outside the mesh 
         (or physics collision primitive) because physics collisions are used for efficiency even in this case.
     @todo If you add an entity to the 'interesting entities list', no signals may get send for that entity,
@@ -148,15 +154,9 @@ public slots:
 private slots:
     void UpdateSignals();
 
-    /// Check for rigid body component and connect to its signal
+    /// Check for rigid body component and register its pairs to the physics world
     void CheckForRigidBody();
 
-    /// Collisions have been processed for the scene the parent entity is in
-    void OnPhysicsUpdate();
-
-    /// Called when physics collisions occurs.
-    void OnPhysicsCollision(Entity* otherEntity, const float3& position, const float3& normal, float distance, float impulse, bool newCollision);
-
     /// Called when entity inside this volume is removed from the scene
     void OnEntityRemoved(Entity* entity);
 
@@ -164,17 +164,56 @@ private:
     /// Called when some of the attributes has been changed.
     void AttributesChanged();
 
+    /// Called by PhysicsWorld when the broadphase pair of the volume and another body is added or removed. Emits no signals.
+    /** @note The other body may have been deleted already, if the pair is removed. */
+    void OnPairChanged(EC_RigidBody *other, bool added);
+
+    /// Called by PhysicsWorld after the pair changes of the frame. Gets the entities of the new candidates while the bodies are known to exist.
+    void ResolveCandidates();
+
+    /// Called by PhysicsWorld after the pair changes of the frame. Tests the candidates that may have entered or left, and emits the signals.
+    void UpdateOverlaps();
+
+    /// Returns whether the body of the candidate is inside the volume, by pivot or by contact depending on the byPivot attribute.
+    bool TestInside(Entity *entity, EC_RigidBody *other) const;
+
+    /// Emits the enter signals and starts tracking the removal of the entity.
+    void EmitEnter(Entity *entity);
+    /// Emits the leave signals and stops tracking the removal of the entity.
+    void EmitLeave(Entity *entity);
+
     /// Rigid body component that is needed for collision signals
     weak_ptr<EC_RigidBody> rigidbody_;
 
+    /// Physics world the rigid body is registered to.
+    PhysicsWorldWeakPtr world_;
+
+    /// Body whose bounding box overlaps the volume.
+    struct Candidate
+    {
+        Candidate() : resolved(false), inside(false) {}
+
+        weak_ptr<EC_RigidBody> body;
+        EntityWeakPtr entity;
+        bool resolved; ///< Whether body and entity have been set.
+        bool inside;
+    };
+    /// The candidates by the address of their body. The address is only a key, the body is accessed through the weak pointer.
+    typedef std::map<EC_RigidBody*, Candidate> CandidateMap;
+    CandidateMap candidates_;
+
+    /// Entities that left with their pair, to signal in UpdateOverlaps.
+    std::vector<EntityWeakPtr> leftEntities_;
+
+    /// Whether a candidate has been added after the last UpdateOverlaps.
+    bool candidatesAdded_;
+
     /// As C++ standard weak_ptr doesn't provide less than operator (or any comparison operators for that matter), we need to provide it ourselves.
     struct EntityWeakPtrLessThan
     {
         bool operator() (const EntityWeakPtr &a, const EntityWeakPtr &b) const { return WEAK_PTR_LESS_THAN(a, b); }
     };
-    typedef std::map<EntityWeakPtr, bool, EntityWeakPtrLessThan> EntitiesWithinVolumeMap;
-    /// Map of entities inside this volume. 
-    /** The value is used in physics update to see if the entity is still inside
-        this volume or if it left the volume during last physics update. */
+    typedef std::map<EntityWeakPtr, EC_RigidBody*, EntityWeakPtrLessThan> EntitiesWithinVolumeMap;
+    /// Map of entities inside this volume, and the key of their candidate.
     EntitiesWithinVolumeMap entities_;
 };
@@ -0,0 +1,362 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#include "StableHeaders.h"
+#include "DebugOperatorNew.h"
+
+#include "ParallelPhysics.h"
+#include "Profiler.h"
+
+// Disable unreferenced formal parameter coming from Bullet
+#ifdef _MSC_VER
+#pragma warning(push)
+#pragma warning(disable : 4100)
+#endif
+#include <BulletCollision/CollisionDispatch/btConvexConvexAlgorithm.h>
+#include <BulletCollision/CollisionDispatch/btSimulationIslandManager.h>
+#include <BulletCollision/NarrowPhaseCollision/btVoronoiSimplexSolver.h>
+#ifdef _MSC_VER
+#pragma warning(pop)
+#endif
+
+#include <QThread>
+#include <QCoreApplication>
+
+#include <algorithm>
+
+#include "MemoryLeakCheck.h"
+
+namespace
+{
+
+#ifdef PROFILING
+/// Profiles a stage of the step, unless the step runs in a dedicated thread, as the profiler can only be used in the main thread.
+class StageProfiler
+{
+public:
+    explicit StageProfiler(const char *name) : section_(0)
+    {
+        if (QThread::currentThread() == QCoreApplication::instance()->thread())
+            section_ = new ProfilerSection(name);
+    }
+    ~StageProfiler() { delete section_; }
+
+private:
+    ProfilerSection *section_;
+};
+
+#define PROFILE_STAGE(x) StageProfiler x ## __profiler__(#x);
+#else
+#define PROFILE_STAGE(x)
+#endif
+
+/// Convex-convex algorithm with its own simplex solver.
+class ConvexConvexAlgorithm : public btConvexConvexAlgorithm
+{
+public:
+    ConvexConvexAlgorithm(btPersistentManifold *mf, const btCollisionAlgorithmConstructionInfo &ci, const btCollisionObjectWrapper *body0Wrap,
+        const btCollisionObjectWrapper *body1Wrap, btConvexPenetrationDepthSolver *pdSolver, int numPerturbationIterations, int minimumPointsPerturbationThreshold) :
+        btConvexConvexAlgorithm(mf, ci, body0Wrap, body1Wrap, &simplexSolver_, pdSolver, numPerturbationIterations, minimumPointsPerturbationThreshold)
+    {
+    }
+
+private:
+    /// The base only stores the pointer when constructed, so the solver need not be constructed before it.
+    btVoronoiSimplexSolver simplexSolver_;
+};
+
+struct ConvexConvexCreateFunc : public btConvexConvexAlgorithm::CreateFunc
+{
+    explicit ConvexConvexCreateFunc(btConvexPenetrationDepthSolver *pdSolver) : btConvexConvexAlgorithm::CreateFunc(0, pdSolver) {}
+
+    virtual btCollisionAlgorithm *CreateCollisionAlgorithm(btCollisionAlgorithmConstructionInfo &ci, const btCollisionObjectWrapper *body0Wrap, const btCollisionObjectWrapper *body1Wrap)
+    {
+        void *mem = ci.m_dispatcher1->allocateCollisionAlgorithm(sizeof(ConvexConvexAlgorithm));
+#include "DisableMemoryLeakCheck.h"
+        return new(mem) ConvexConvexAlgorithm(ci.m_manifold, ci, body0Wrap, body1Wrap, m_pdSolver, m_numPerturbationIterations, m_minimumPointsPerturbationThreshold);
+#include "EnableMemoryLeakCheck.h"
+    }
+};
+
+/// Returns the construction info of the default configuration, with room for ConvexConvexAlgorithm in the algorithm pool.
+btDefaultCollisionConstructionInfo ConstructionInfo()
+{
+    btDefaultCollisionConstructionInfo info;
+    info.m_customCollisionAlgorithmMaxElementSize = sizeof(ConvexConvexAlgorithm);
+    return info;
+}
+
+/// Returns the island of the constraint, like btDiscreteDynamicsWorld does.
+int ConstraintIslandId(const btTypedConstraint *constraint)
+{
+    const btCollisionObject &objectA = constraint->getRigidBodyA();
+    const btCollisionObject &objectB = constraint->getRigidBodyB();
+    return objectA.getIslandTag() >= 0 ? objectA.getIslandTag() : objectB.getIslandTag();
+}
+
+struct ConstraintIslandLess
+{
+    bool operator()(const btTypedConstraint *lhs, const btTypedConstraint *rhs) const { return ConstraintIslandId(lhs) < ConstraintIslandId(rhs); }
+    bool operator()(const btTypedConstraint *lhs, int rhs) const { return ConstraintIslandId(lhs) < rhs; }
+    bool operator()(int lhs, const btTypedConstraint *rhs) const { return lhs < ConstraintIslandId(rhs); }
+};
+
+/// Returns whether a manifold or a constraint of an island involves a kinematic body.
+bool TouchesKinematic(btPersistentManifold **manifolds, int numManifolds, btTypedConstraint **constraints, int numConstraints)
+{
+    for(int i = 0; i < numManifolds; ++i)
+        if (manifolds[i]->getBody0()->isKinematicObject() || manifolds[i]->getBody1()->isKinematicObject())
+            return true;
+    for(int i = 0; i < numConstraints; ++i)
+        if (constraints[i]->getRigidBodyA().isKinematicObject() || constraints[i]->getRigidBodyB().isKinematicObject())
+            return true;
+    return false;
+}
+
+template<typename T>
+T **DataOrNull(std::vector<T *> &v)
+{
+    return v.empty() ? 0 : &v[0];
+}
+
+} // ~unnamed namespace
+
+ParallelCollisionConfiguration::ParallelCollisionConfiguration() :
+    btDefaultCollisionConfiguration(ConstructionInfo()),
+    convexConvexCreateFunc_(0)
+{
+#include "DisableMemoryLeakCheck.h"
+    convexConvexCreateFunc_ = new ConvexConvexCreateFunc(m_pdSolver);
+#include "EnableMemoryLeakCheck.h"
+}
+
+ParallelCollisionConfiguration::~ParallelCollisionConfiguration()
+{
+    delete convexConvexCreateFunc_;
+}
+
+btCollisionAlgorithmCreateFunc *ParallelCollisionConfiguration::getCollisionAlgorithmCreateFunc(int proxyType0, int proxyType1)
+{
+    btCollisionAlgorithmCreateFunc *func = btDefaultCollisionConfiguration::getCollisionAlgorithmCreateFunc(proxyType0, proxyType1);
+    return func == m_convexConvexCreateFunc ? convexConvexCreateFunc_ : func;
+}
+
+void ParallelCollisionDispatcher::NarrowphaseJob::Run(float /*frameTime*/)
+{
+    btNearCallback nearCallback = dispatcher->getNearCallback();
+    for(int i = 0; i < numPairs; ++i)
+        nearCallback(pairs[i], *dispatcher, *dispatchInfo);
+}
+
+ParallelCollisionDispatcher::ParallelCollisionDispatcher(btCollisionConfiguration *collisionConfiguration, UpdateScheduler *scheduler) :
+    btCollisionDispatcher(collisionConfiguration),
+    scheduler_(scheduler),
+    parallel_(false)
+{
+}
+
+ParallelCollisionDispatcher::~ParallelCollisionDispatcher()
+{
+}
+
+btPersistentManifold *ParallelCollisionDispatcher::getNewManifold(const btCollisionObject *b0, const btCollisionObject *b1)
+{
+    QMutexLocker lock(&mutex_);
+    return btCollisionDispatcher::getNewManifold(b0, b1);
+}
+
+void ParallelCollisionDispatcher::releaseManifold(btPersistentManifold *manifold)
+{
+    QMutexLocker lock(&mutex_);
+    btCollisionDispatcher::releaseManifold(manifold);
+}
+
+void *ParallelCollisionDispatcher::allocateCollisionAlgorithm(int size)
+{
+    QMutexLocker lock(&mutex_);
+    return btCollisionDispatcher::allocateCollisionAlgorithm(size);
+}
+
+void ParallelCollisionDispatcher::freeCollisionAlgorithm(void *ptr)
+{
+    QMutexLocker lock(&mutex_);
+    btCollisionDispatcher::freeCollisionAlgorithm(ptr);
+}
+
+void ParallelCollisionDispatcher::dispatchAllCollisionPairs(btOverlappingPairCache *pairCache, const btDispatcherInfo &dispatchInfo, btDispatcher *dispatcher)
+{
+    PROFILE_STAGE(PhysicsWorld_Narrowphase);
+    const int numPairs = pairCache->getNumOverlappingPairs();
+    const int maxThreads = scheduler_ ? scheduler_->MaxThreadCount() : 0;
+    if (!parallel_ || maxThreads == 0 || numPairs < cMinParallelPairs)
+    {
+        btCollisionDispatcher::dispatchAllCollisionPairs(pairCache, dispatchInfo, dispatcher);
+        return;
+    }
+
+    // A few jobs per thread, so that a thread that finishes early takes on the remaining ones
+    const int pairsPerJob = std::max(cMinParallelPairs / 4, numPairs / (4 * (maxThreads + 1)) + 1);
+    const int numJobs = (numPairs + pairsPerJob - 1) / pairsPerJob;
+    btBroadphasePair *pairs = pairCache->getOverlappingPairArrayPtr();
+    jobs_.resize(numJobs);
+    std::vector<IUpdateJob *> jobs(numJobs);
+    for(int i = 0; i < numJobs; ++i)
+    {
+        NarrowphaseJob &job = jobs_[i];
+        job.dispatcher = this;
+        job.dispatchInfo = &dispatchInfo;
+        job.pairs = pairs + i * pairsPerJob;
+        job.numPairs = std::min(pairsPerJob, numPairs - i * pairsPerJob);
+        jobs[i] = &job;
+    }
+    scheduler_->RunParallel(jobs, 0.f, "PhysicsWorld_Narrowphase");
+}
+
+/// Sorts the awake islands into the solver jobs: the ones that touch a kinematic body to the first job, and the rest evenly to the others.
+struct ParallelDynamicsWorld::IslandGatherer : public btSimulationIslandManager::IslandCallback
+{
+    IslandGatherer(std::vector<SolverJob> &jobs_, btAlignedObjectArray<btTypedConstraint *> &constraints_, size_t jobSize_) :
+        jobs(jobs_),
+        constraints(constraints_),
+        jobSize(jobSize_),
+        current(1)
+    {
+    }
+
+    virtual void processIsland(btCollisionObject **bodies, int numBodies, btPersistentManifold **manifolds, int numManifolds, int islandId)
+    {
+        // An island id of -1 stands for all the islands at once, when the islands are not split
+        btTypedConstraint **islandConstraints = constraints.size() ? &constraints[0] : 0;
+        int numConstraints = constraints.size();
+        if (islandId >= 0 && numConstraints > 0)
+        {
+            std::pair<btTypedConstraint **, btTypedConstraint **> range = std::equal_range(islandConstraints,
+                islandConstraints + numConstraints, islandId, ConstraintIslandLess());
+            islandConstraints = range.first;
+            numConstraints = (int)(range.second - range.first);
+        }
+        if (numManifolds == 0 && numConstraints == 0)
+            return;
+
+        SolverJob &job = (islandId < 0 || TouchesKinematic(manifolds, numManifolds, islandConstraints, numConstraints)) ? jobs[0] : jobs[current];
+        job.bodies.insert(job.bodies.end(), bodies, bodies + numBodies);
+        job.manifolds.insert(job.manifolds.end(), manifolds, manifolds + numManifolds);
+        job.constraints.insert(job.constraints.end(), islandConstraints, islandConstraints + numConstraints);
+        if (&job != &jobs[0] && job.Size() >= jobSize && current + 1 < jobs.size())
+            ++current;
+    }
+
+    std::vector<SolverJob> &jobs;
+    btAlignedObjectArray<btTypedConstraint *> &constraints;
+    size_t jobSize;
+    size_t current;
+};
+
+void ParallelDynamicsWorld::SolverJob::Run(float /*frameTime*/)
+{
+#if BT_BULLET_VERSION < 282
+    solver->solveGroup(DataOrNull(bodies), (int)bodies.size(), DataOrNull(manifolds), (int)manifolds.size(),
+        DataOrNull(constraints), (int)constraints.size(), *solverInfo, 0, 0, dispatcher);
+#else
+    solver->solveGroup(DataOrNull(bodies), (int)bodies.size(), DataOrNull(manifolds), (int)manifolds.size(),
+        DataOrNull(constraints), (int)constraints.size(), *solverInfo, 0, dispatcher);
+#endif
+}
+
+ParallelDynamicsWorld::ParallelDynamicsWorld(btDispatcher *dispatcher, btBroadphaseInterface *pairCache, btConstraintSolver *constraintSolver,
+    btCollisionConfiguration *collisionConfiguration, UpdateScheduler *scheduler) :
+    btDiscreteDynamicsWorld(dispatcher, pairCache, constraintSolver, collisionConfiguration),
+    scheduler_(scheduler),
+    parallel_(false)
+{
+}
+
+ParallelDynamicsWorld::~ParallelDynamicsWorld()
+{
+    for(size_t i = 0; i < solvers_.size(); ++i)
+        delete solvers_[i];
+}
+
+bool ParallelDynamicsWorld::CanSolveInParallel()
+{
+#ifdef BT_NO_PROFILE
+    return true;
+#else
+    return false;
+#endif
+}
+
+void ParallelDynamicsWorld::performDiscreteCollisionDetection()
+{
+    PROFILE_STAGE(PhysicsWorld_CollisionDetection);
+    btDiscreteDynamicsWorld::performDiscreteCollisionDetection();
+}
+
+void ParallelDynamicsWorld::StepOnce(btScalar timeStep)
+{
+    saveKinematicState(timeStep);
+    applyGravity();
+    internalSingleStepSimulation(timeStep);
+    clearForces();
+}
+
+void ParallelDynamicsWorld::predictUnconstraintMotion(btScalar timeStep)
+{
+    PROFILE_STAGE(PhysicsWorld_PredictMotion);
+    btDiscreteDynamicsWorld::predictUnconstraintMotion(timeStep);
+}
+
+void ParallelDynamicsWorld::calculateSimulationIslands()
+{
+    PROFILE_STAGE(PhysicsWorld_Islands);
+    btDiscreteDynamicsWorld::calculateSimulationIslands();
+}
+
+void ParallelDynamicsWorld::integrateTransforms(btScalar timeStep)
+{
+    PROFILE_STAGE(PhysicsWorld_IntegrateTransforms);
+    btDiscreteDynamicsWorld::integrateTransforms(timeStep);
+}
+
+void ParallelDynamicsWorld::solveConstraints(btContactSolverInfo &solverInfo)
+{
+    PROFILE_STAGE(PhysicsWorld_SolveConstraints);
+    const int maxThreads = scheduler_ ? scheduler_->MaxThreadCount() : 0;
+    if (!parallel_ || !CanSolveInParallel() || maxThreads == 0)
+    {
+        btDiscreteDynamicsWorld::solveConstraints(solverInfo);
+        return;
+    }
+
+    sortedConstraints_.resize(m_constraints.size());
+    for(int i = 0; i < m_constraints.size(); ++i)
+        sortedConstraints_[i] = m_constraints[i];
+    sortedConstraints_.quickSort(ConstraintIslandLess());
+
+    // The first job is for the islands that touch a kinematic body, and the others a few for each thread.
+    const size_t numJobs = 2 * (maxThreads + 1) + 1;
+#include "DisableMemoryLeakCheck.h"
+    while(solvers_.size() < numJobs)
+        solvers_.push_back(new btSequentialImpulseConstraintSolver());
+#include "EnableMemoryLeakCheck.h"
+    jobs_.resize(numJobs);
+    for(size_t i = 0; i < numJobs; ++i)
+    {
+        SolverJob &job = jobs_[i];
+        job.solver = solvers_[i];
+        job.solverInfo = &solverInfo;
+        job.dispatcher = getDispatcher();
+        job.bodies.clear();
+        job.manifolds.clear();
+        job.constraints.clear();
+    }
+
+    const size_t total = getDispatcher()->getNumManifolds() + m_constraints.size();
+    IslandGatherer gatherer(jobs_, sortedConstraints_, std::max((size_t)solverInfo.m_minimumSolverBatchSize, total / (numJobs - 1) + 1));
+    getSimulationIslandManager()->buildAndProcessIslands(getDispatcher(), this, &gatherer);
+
+    std::vector<IUpdateJob *> jobs;
+    for(size_t i = 0; i < numJobs; ++i)
+        if (jobs_[i].Size() > 0)
+            jobs.push_back(&jobs_[i]);
+    scheduler_->RunParallel(jobs, solverInfo.m_timeStep, "PhysicsWorld_SolveConstraints");
+}
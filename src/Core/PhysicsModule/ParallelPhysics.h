@@ -0,0 +1,142 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#pragma once
+
+#include "CoreTypes.h"
+#include "UpdateScheduler.h"
+
+// Disable unreferenced formal parameter coming from Bullet
+#ifdef _MSC_VER
+#pragma warning(push)
+#pragma warning(disable : 4100)
+#endif
+#include <btBulletDynamicsCommon.h>
+#ifdef _MSC_VER
+#pragma warning(pop)
+#endif
+
+#include <QMutex>
+
+#include <vector>
+
+/// Collision configuration whose convex-convex algorithms each have their own simplex solver, so that the pairs can be processed in parallel.
+/** The default configuration shares one simplex solver between all of its convex-convex algorithms. */
+class ParallelCollisionConfiguration : public btDefaultCollisionConfiguration
+{
+public:
+    ParallelCollisionConfiguration();
+    ~ParallelCollisionConfiguration();
+
+    /// btDefaultCollisionConfiguration override. Returns the algorithm with its own simplex solver for the convex-convex pairs.
+    btCollisionAlgorithmCreateFunc *getCollisionAlgorithmCreateFunc(int proxyType0, int proxyType1);
+
+private:
+    btCollisionAlgorithmCreateFunc *convexConvexCreateFunc_;
+};
+
+/// Collision dispatcher that processes the narrowphase of the overlapping pairs in the worker threads of the UpdateScheduler.
+/** In parallel mode, the pairs are split into jobs and processed with the near callback of the dispatcher in parallel.
+    The manifolds and the collision algorithms are allocated and freed under a mutex. The order of the manifolds of the
+    dispatcher then varies from run to run, so the simulation is not deterministic. Less than cMinParallelPairs pairs
+    are processed in the calling thread. The cost is profiled in the PhysicsWorld_Narrowphase block, when stepping in the main thread. */
+class ParallelCollisionDispatcher : public btCollisionDispatcher
+{
+public:
+    ParallelCollisionDispatcher(btCollisionConfiguration *collisionConfiguration, UpdateScheduler *scheduler);
+    ~ParallelCollisionDispatcher();
+
+    /// Sets whether the narrowphase is run in parallel.
+    void SetParallel(bool enable) { parallel_ = enable; }
+    bool IsParallel() const { return parallel_; }
+
+    /// btCollisionDispatcher overrides, which lock the mutex.
+    btPersistentManifold *getNewManifold(const btCollisionObject *b0, const btCollisionObject *b1);
+    void releaseManifold(btPersistentManifold *manifold);
+    void *allocateCollisionAlgorithm(int size);
+    void freeCollisionAlgorithm(void *ptr);
+
+    /// btCollisionDispatcher override. Processes the pairs in parallel in parallel mode.
+    void dispatchAllCollisionPairs(btOverlappingPairCache *pairCache, const btDispatcherInfo &dispatchInfo, btDispatcher *dispatcher);
+
+    /// Minimum number of overlapping pairs to process in parallel.
+    static const int cMinParallelPairs = 64;
+
+private:
+    /// Processes a range of the overlapping pairs.
+    struct NarrowphaseJob : public IUpdateJob
+    {
+        ParallelCollisionDispatcher *dispatcher;
+        const btDispatcherInfo *dispatchInfo;
+        btBroadphasePair *pairs;
+        int numPairs;
+
+        void Run(float frameTime);
+    };
+
+    UpdateScheduler *scheduler_;
+    bool parallel_;
+    QMutex mutex_;
+    std::vector<NarrowphaseJob> jobs_;
+};
+
+/// Dynamics world that solves the simulation islands in the worker threads of the UpdateScheduler, and profiles the stages of the step.
+/** In parallel mode, the awake islands are grouped into jobs of about even size, each solved with its own sequential
+    impulse solver. The islands that touch a kinematic body are solved together in one job, as the solver writes to the
+    kinematic bodies it solves against. Parallel solving needs Bullet to be built with BT_NO_PROFILE, as the profiler
+    of Bullet can only be used from one thread. Without it, the islands are solved in the stepping thread.
+
+    The stages of the step are profiled in the PhysicsWorld_PredictMotion, PhysicsWorld_CollisionDetection,
+    PhysicsWorld_Islands, PhysicsWorld_SolveConstraints and PhysicsWorld_IntegrateTransforms blocks, when stepping in the main thread. */
+class ParallelDynamicsWorld : public btDiscreteDynamicsWorld
+{
+public:
+    ParallelDynamicsWorld(btDispatcher *dispatcher, btBroadphaseInterface *pairCache, btConstraintSolver *constraintSolver,
+        btCollisionConfiguration *collisionConfiguration, UpdateScheduler *scheduler);
+    ~ParallelDynamicsWorld();
+
+    /// Sets whether the islands are solved in parallel.
+    void SetParallel(bool enable) { parallel_ = enable; }
+    bool IsParallel() const { return parallel_; }
+
+    /// Returns whether this build can solve the islands in parallel.
+    static bool CanSolveInParallel();
+
+    /// btCollisionWorld override, profiled.
+    void performDiscreteCollisionDetection();
+
+    /// Runs one internal step of the given length, like stepSimulation does for each substep, but leaves the time
+    /// accumulated by stepSimulation and the motion states alone. Used to resimulate steps that have been simulated already.
+    void StepOnce(btScalar timeStep);
+
+protected:
+    /// btDiscreteDynamicsWorld overrides, profiled.
+    void predictUnconstraintMotion(btScalar timeStep);
+    void calculateSimulationIslands();
+    void integrateTransforms(btScalar timeStep);
+
+    /// btDiscreteDynamicsWorld override. Solves the islands in parallel in parallel mode.
+    void solveConstraints(btContactSolverInfo &solverInfo);
+
+private:
+    /// Solves a group of islands.
+    struct SolverJob : public IUpdateJob
+    {
+        btConstraintSolver *solver;
+        const btContactSolverInfo *solverInfo;
+        btDispatcher *dispatcher;
+        std::vector<btCollisionObject *> bodies;
+        std::vector<btPersistentManifold *> manifolds;
+        std::vector<btTypedConstraint *> constraints;
+
+        /// Returns the number of manifolds and constraints to solve.
+        size_t Size() const { return manifolds.size() + constraints.size(); }
+        void Run(float frameTime);
+    };
+    struct IslandGatherer;
+
+    UpdateScheduler *scheduler_;
+    bool parallel_;
+    std::vector<SolverJob> jobs_;
+    std::vector<btSequentialImpulseConstraintSolver *> solvers_; ///< Solver of each job.
+    btAlignedObjectArray<btTypedConstraint *> sortedConstraints_; ///< The constraints sorted by island.
+};
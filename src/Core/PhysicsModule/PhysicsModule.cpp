@@ -6,6 +6,7 @@
 #include "PhysicsModule.h"
 #include "PhysicsWorld.h"
 #include "CollisionShapeUtils.h"
+#include "CollisionMeshLoader.h"
 #include "ConvexHull.h"
 #include "EC_RigidBody.h"
 #include "EC_VolumeTrigger.h"
@@ -19,14 +20,20 @@
 #include "Entity.h"
 #include "SceneAPI.h"
 #include "Framework.h"
+#include "FrameAPI.h"
 #include "Scene/Scene.h"
 #include "Profiler.h"
 #include "Renderer.h"
 #include "ConsoleAPI.h"
+#include "MetricsRegistry.h"
 #include "IComponentFactory.h"
 #include "QScriptEngineHelpers.h"
 #include "LoggingFunctions.h"
 #include "StaticPluginRegistry.h"
+#include "AssetAPI.h"
+#include "AssetCache.h"
+#include "BinaryAsset.h"
+#include "GenericAssetFactory.h"
 
 // Disable unreferenced formal parameter coming from Bullet
 #ifdef _MSC_VER
@@ -40,6 +47,7 @@
 
 #include <QtScript>
 #include <QTreeWidgetItem>
+#include <QFile>
 
 #include <Ogre.h>
 
@@ -47,6 +55,99 @@
 
 using namespace Physics;
 
+namespace
+{
+/// Meshes with at least this many triangles get their BVH stored to the asset cache.
+const int cBvhCacheMinTriangles = 1000;
+/// Identifies the BVH files in the asset cache: "TBVH".
+const u32 cBvhCacheMagic = 0x48564254;
+/// Size of the header of a BVH file. Keeps the serialized BVH after it 16-byte aligned.
+const size_t cBvhCacheHeaderSize = 16;
+
+QString BvhCacheRef(const QString &contentHash)
+{
+    return "bvh-" + contentHash + ".bin";
+}
+
+/// Returns the name the collision shapes of the asset are cached by, which is the name of its Ogre mesh.
+std::string CollisionMeshName(IAsset *asset)
+{
+    return AssetAPI::SanitateAssetRef(asset->Name()).toStdString();
+}
+
+/// Reads the triangles of a collision mesh asset from its disk source, or from its data if it only is in memory.
+bool ReadCollisionTriangles(IAsset *asset, std::vector<float3> &triangles)
+{
+    if (CollisionMeshLoader::ReadFile(asset->DiskSource(), triangles))
+        return true;
+    BinaryAsset *binary = dynamic_cast<BinaryAsset*>(asset);
+    return binary && !binary->data.empty() && CollisionMeshLoader::Read(&binary->data[0], binary->data.size(), triangles);
+}
+
+/// Deletes a shared BVH shape, and the buffer its BVH was deserialized in place to, if any.
+struct BvhShapeDeleter
+{
+    BvhShapeDeleter(void *buffer_, const shared_ptr<btTriangleMesh> &triangleMesh_) : buffer(buffer_), triangleMesh(triangleMesh_) {}
+    void operator()(btBvhTriangleMeshShape *shape)
+    {
+        delete shape;
+        if (buffer)
+            btAlignedFree(buffer);
+    }
+    void *buffer;
+    /// Keeps the triangles the shape refers to alive.
+    shared_ptr<btTriangleMesh> triangleMesh;
+};
+
+/// Reads the BVH stored for the triangle mesh into a new aligned buffer. Returns null if there is no valid stored BVH.
+void *ReadBvh(const QString &fileName, const btTriangleMesh *triangleMesh, btOptimizedBvh *&bvh)
+{
+    QFile file(fileName);
+    if (fileName.isEmpty() || !file.open(QIODevice::ReadOnly) || file.size() <= (qint64)cBvhCacheHeaderSize)
+        return 0;
+    const size_t size = (size_t)file.size();
+    char *buffer = (char *)btAlignedAlloc(size, 16);
+    if (file.read(buffer, size) != (qint64)size)
+    {
+        btAlignedFree(buffer);
+        return 0;
+    }
+    // Bullet does not version the serialized BVH, so the file is only used by the same Bullet version for the same triangles.
+    const u32 *header = (const u32 *)buffer;
+    if (header[0] != cBvhCacheMagic || header[1] != (u32)BT_BULLET_VERSION || header[2] != (u32)triangleMesh->getNumTriangles())
+    {
+        btAlignedFree(buffer);
+        return 0;
+    }
+    bvh = static_cast<btOptimizedBvh *>(btOptimizedBvh::deSerializeInPlace(buffer + cBvhCacheHeaderSize, (unsigned)(size - cBvhCacheHeaderSize), false));
+    if (!bvh)
+    {
+        btAlignedFree(buffer);
+        return 0;
+    }
+    return buffer;
+}
+
+/// Stores the BVH of the shape to the asset cache.
+void StoreBvh(AssetCache *cache, const QString &contentHash, btBvhTriangleMeshShape *shape, const btTriangleMesh *triangleMesh)
+{
+    btOptimizedBvh *bvh = shape->getOptimizedBvh();
+    if (!bvh)
+        return;
+    const unsigned bvhSize = bvh->calculateSerializeBufferSize();
+    const size_t size = cBvhCacheHeaderSize + bvhSize;
+    char *buffer = (char *)btAlignedAlloc(size, 16);
+    u32 *header = (u32 *)buffer;
+    header[0] = cBvhCacheMagic;
+    header[1] = (u32)BT_BULLET_VERSION;
+    header[2] = (u32)triangleMesh->getNumTriangles();
+    header[3] = 0;
+    if (bvh->serialize(buffer + cBvhCacheHeaderSize, bvhSize, false))
+        cache->StoreAsset((const u8 *)buffer, size, BvhCacheRef(contentHash));
+    btAlignedFree(buffer);
+}
+}
+
 PhysicsModule::PhysicsModule()
 :IModule("Physics"),
 defaultPhysicsUpdatePeriod_(1.0f / 60.0f),
@@ -64,6 +165,9 @@ void PhysicsModule::Load()
     framework_->Scene()->RegisterComponentFactory(MAKE_SHARED(GenericComponentFactory<EC_VolumeTrigger>));
     framework_->Scene()->RegisterComponentFactory(MAKE_SHARED(GenericComponentFactory<EC_PhysicsMotor>));
     framework_->Scene()->RegisterComponentFactory(MAKE_SHARED(GenericComponentFactory<EC_PhysicsConstraint>));
+
+    // Baked collision meshes are read by CollisionMeshLoader from the plain data.
+    framework_->Asset()->RegisterAssetTypeFactory(MAKE_SHARED(BinaryAssetFactory, "CollisionMesh", ".collision"));
 }
 
 void PhysicsModule::Initialize()
@@ -73,6 +177,15 @@ void PhysicsModule::Initialize()
     connect(framework_->Scene(), SIGNAL(SceneCreated(Scene *, AttributeChange::Type)), this, SLOT(CreatePhysicsWorld(Scene *)));
     connect(framework_->Scene(), SIGNAL(SceneAboutToBeRemoved(Scene *, AttributeChange::Type)), this, SLOT(RemovePhysicsWorld(Scene *)));
 
+    MetricsRegistry *metrics = framework_->Metrics();
+    if (metrics->IsEnabled())
+    {
+        metrics->Describe("tundra_physics_step_seconds_total", MetricsRegistry::Counter, "Time spent in the physics steps of each scene.");
+        metrics->Describe("tundra_physics_steps_total", MetricsRegistry::Counter, "Number of the physics steps of each scene, one per simulated frame.");
+        metrics->Describe("tundra_physics_active_bodies", MetricsRegistry::Gauge, "Number of the active dynamic rigid bodies of each scene.");
+        connect(metrics, SIGNAL(Collect()), this, SLOT(CollectMetrics()));
+    }
+
     framework_->Console()->RegisterCommand("physicsDebug",
         "Toggles drawing of physics debug geometry.",
         this, SLOT(ToggleDebugGeometry()));
@@ -85,6 +198,10 @@ void PhysicsModule::Initialize()
     framework_->Console()->RegisterCommand("autoCollisionMesh",
         "Auto-assigns static rigid bodies with collision mesh to all visible meshes.",
         this, SLOT(AutoCollisionMesh()));
+    framework_->Console()->RegisterCommand("bakeCollisionMesh",
+        "Bakes the triangles of an Ogre binary mesh file to a collision mesh file, which the physics reads faster without Ogre. "
+        "Usage: bakeCollisionMesh(meshFile,collisionFile)",
+        this, SLOT(BakeCollisionMesh(const QString &, const QString &)));
     
     // Check physics execution rate related command line parameters
     if (framework_->HasCommandLineParameter("--physicsrate"))
@@ -172,11 +289,17 @@ void PhysicsModule::Update(f64 frametime)
     PROFILE(PhysicsModule_Update);
     // Loop all the physics worlds and update them.
     PhysicsWorldMap::iterator i = physicsWorlds_.begin();
+    bool simulating = false;
     while(i != physicsWorlds_.end())
     {
         i->second->Simulate(frametime);
+        if (i->second->IsRunning() && i->second->NumActiveBodies() > 0)
+            simulating = true;
         ++i;
     }
+    // Keep the main loop from idling until the bodies have come to rest.
+    if (simulating)
+        framework_->Frame()->KeepAwake();
 }
 
 void PhysicsModule::CreatePhysicsWorld(Scene *scene)
@@ -199,6 +322,41 @@ void PhysicsModule::RemovePhysicsWorld(Scene *scene)
     }
 }
 
+void PhysicsModule::CollectMetrics()
+{
+    MetricsRegistry *metrics = framework_->Metrics();
+    metrics->Clear("tundra_physics_step_seconds_total");
+    metrics->Clear("tundra_physics_steps_total");
+    metrics->Clear("tundra_physics_active_bodies");
+    for(PhysicsWorldMap::const_iterator iter = physicsWorlds_.begin(); iter != physicsWorlds_.end(); ++iter)
+    {
+        const PhysicsWorld *world = iter->second.get();
+        const QString scene = MetricsRegistry::Label("scene", iter->first->Name());
+        metrics->Set("tundra_physics_step_seconds_total", world->StepTimeTotal(), scene);
+        metrics->Set("tundra_physics_steps_total", (double)world->NumSteps(), scene);
+        metrics->Set("tundra_physics_active_bodies", world->NumActiveBodies(), scene);
+    }
+}
+
+void PhysicsModule::BakeCollisionMesh(const QString &meshFile, const QString &collisionFile)
+{
+    std::vector<float3> triangles;
+    if (!CollisionMeshLoader::ReadFile(meshFile, triangles))
+    {
+        LogError("PhysicsModule::BakeCollisionMesh: Could not read the triangles of " + meshFile);
+        return;
+    }
+    std::vector<u8> data;
+    CollisionMeshLoader::WriteBaked(triangles, data);
+    QFile file(collisionFile);
+    if (!file.open(QIODevice::WriteOnly) || file.write((const char *)&data[0], data.size()) != (qint64)data.size())
+    {
+        LogError("PhysicsModule::BakeCollisionMesh: Could not write " + collisionFile);
+        return;
+    }
+    LogInfo("PhysicsModule::BakeCollisionMesh: Baked " + QString::number(triangles.size() / 3) + " triangles to " + collisionFile);
+}
+
 void PhysicsModule::SetRunPhysics(bool enable)
 {
     for (PhysicsWorldMap::iterator i = physicsWorlds_.begin(); i != physicsWorlds_.end(); ++i)
@@ -234,6 +392,101 @@ shared_ptr<btTriangleMesh> PhysicsModule::GetTriangleMeshFromOgreMesh(Ogre::Mesh
     return ptr;
 }
 
+shared_ptr<btBvhTriangleMeshShape> PhysicsModule::GetBvhTriangleMeshShapeFromOgreMesh(Ogre::Mesh* mesh, const QString &contentHash)
+{
+    if (!mesh)
+        return shared_ptr<btBvhTriangleMeshShape>();
+    return GetBvhTriangleMeshShape(mesh->getName(), GetTriangleMeshFromOgreMesh(mesh), contentHash);
+}
+
+shared_ptr<btTriangleMesh> PhysicsModule::GetTriangleMeshFromAsset(IAsset *asset)
+{
+    shared_ptr<btTriangleMesh> ptr;
+    if (!asset)
+        return ptr;
+    const std::string name = CollisionMeshName(asset);
+
+    // Check if has already been converted
+    TriangleMeshMap::const_iterator iter = triangleMeshes_.find(name);
+    if (iter != triangleMeshes_.end())
+        return iter->second;
+
+    std::vector<float3> triangles;
+    if (!ReadCollisionTriangles(asset, triangles))
+        return ptr;
+#include "DisableMemoryLeakCheck.h"
+    ptr = MAKE_SHARED(btTriangleMesh);
+#include "EnableMemoryLeakCheck.h"
+    GenerateTriangleMesh(triangles, ptr.get());
+
+    triangleMeshes_[name] = ptr;
+
+    return ptr;
+}
+
+shared_ptr<ConvexHullSet> PhysicsModule::GetConvexHullSetFromAsset(IAsset *asset)
+{
+    shared_ptr<ConvexHullSet> ptr;
+    if (!asset)
+        return ptr;
+    const std::string name = CollisionMeshName(asset);
+
+    // Check if has already been converted
+    ConvexHullSetMap::const_iterator iter = convexHullSets_.find(name);
+    if (iter != convexHullSets_.end())
+        return iter->second;
+
+    std::vector<float3> triangles;
+    if (!ReadCollisionTriangles(asset, triangles))
+        return ptr;
+    ptr = MAKE_SHARED(ConvexHullSet);
+    GenerateConvexHullSet(triangles, ptr.get());
+
+    convexHullSets_[name] = ptr;
+
+    return ptr;
+}
+
+shared_ptr<btBvhTriangleMeshShape> PhysicsModule::GetBvhTriangleMeshShapeFromAsset(IAsset *asset)
+{
+    if (!asset)
+        return shared_ptr<btBvhTriangleMeshShape>();
+    AssetCache *cache = framework_->Asset()->Cache();
+    return GetBvhTriangleMeshShape(CollisionMeshName(asset), GetTriangleMeshFromAsset(asset), cache ? cache->ContentHash(asset->Name()) : QString());
+}
+
+shared_ptr<btBvhTriangleMeshShape> PhysicsModule::GetBvhTriangleMeshShape(const std::string &name, const shared_ptr<btTriangleMesh> &triangleMesh, const QString &contentHash)
+{
+    shared_ptr<btBvhTriangleMeshShape> ptr;
+    if (!triangleMesh)
+        return ptr;
+
+    // Check if has already been built
+    BvhShapeMap::const_iterator iter = bvhShapes_.find(name);
+    if (iter != bvhShapes_.end())
+        return iter->second;
+
+    PROFILE(PhysicsModule_CreateBvhShape);
+    AssetCache *cache = framework_->Asset()->Cache();
+    const bool cacheable = cache && !contentHash.isEmpty() && triangleMesh->getNumTriangles() >= cBvhCacheMinTriangles;
+
+    // Use the BVH stored to the asset cache if there is one, otherwise build it.
+    btOptimizedBvh *bvh = 0;
+    void *buffer = cacheable ? ReadBvh(cache->FindInCache(BvhCacheRef(contentHash)), triangleMesh.get(), bvh) : 0;
+#include "DisableMemoryLeakCheck.h"
+    btBvhTriangleMeshShape *shape = new btBvhTriangleMeshShape(triangleMesh.get(), true, buffer == 0);
+#include "EnableMemoryLeakCheck.h"
+    if (buffer)
+        shape->setOptimizedBvh(bvh);
+    else if (cacheable)
+        StoreBvh(cache, contentHash, shape, triangleMesh.get());
+
+    ptr = shared_ptr<btBvhTriangleMeshShape>(shape, BvhShapeDeleter(buffer, triangleMesh));
+    bvhShapes_[name] = ptr;
+
+    return ptr;
+}
+
 shared_ptr<ConvexHullSet> PhysicsModule::GetConvexHullSetFromOgreMesh(Ogre::Mesh* mesh)
 {
     shared_ptr<ConvexHullSet> ptr;
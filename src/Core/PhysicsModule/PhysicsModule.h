@@ -6,9 +6,11 @@
 #include "PhysicsModuleFwd.h"
 #include "IModule.h"
 #include "SceneFwd.h"
+#include "AssetFwd.h"
 
 #include <set>
 #include <QObject>
+#include <QString>
 #include <QMetaType>
 
 namespace Ogre
@@ -42,6 +44,26 @@ public:
     /** If already has been generated, returns the previously created one */
     shared_ptr<btTriangleMesh> GetTriangleMeshFromOgreMesh(Ogre::Mesh* mesh);
 
+    /// Get a Bullet BVH triangle mesh shape corresponding to an Ogre mesh, shared by all the rigid bodies of the mesh.
+    /** If already has been generated, returns the previously created one. Scale it per body with btScaledBvhTriangleMeshShape.
+        @param contentHash Content hash of the mesh asset data. If not empty, the built BVH is stored to the asset cache by it,
+        and read from there instead of built on later runs. */
+    shared_ptr<btBvhTriangleMeshShape> GetBvhTriangleMeshShapeFromOgreMesh(Ogre::Mesh* mesh, const QString &contentHash = QString());
+
+    /// Get a Bullet triangle mesh from the data of a collision mesh asset, read without Ogre with CollisionMeshLoader.
+    /** The asset can be an Ogre binary mesh or a baked collision mesh. The meshes are cached by the same name as the
+        ones generated from the Ogre mesh of the asset. If already has been generated, returns the previously created one. */
+    shared_ptr<btTriangleMesh> GetTriangleMeshFromAsset(IAsset *asset);
+
+    /// Get a Bullet convex hull set from the data of a collision mesh asset, read without Ogre with CollisionMeshLoader.
+    /** If already has been generated, returns the previously created one */
+    shared_ptr<ConvexHullSet> GetConvexHullSetFromAsset(IAsset *asset);
+
+    /// Get a shared Bullet BVH triangle mesh shape from the data of a collision mesh asset, read without Ogre with CollisionMeshLoader.
+    /** If already has been generated, returns the previously created one. The BVH is stored to the asset cache by the
+        content hash of the asset, see GetBvhTriangleMeshShapeFromOgreMesh. */
+    shared_ptr<btBvhTriangleMeshShape> GetBvhTriangleMeshShapeFromAsset(IAsset *asset);
+
     /// Get a Bullet convex hull set (using minimum recursion, not very accurate but fast) corresponding to an Ogre mesh.
     /** If already has been generated, returns the previously created one */
     shared_ptr<ConvexHullSet> GetConvexHullSetFromOgreMesh(Ogre::Mesh* mesh);
@@ -73,6 +95,9 @@ public slots:
 
     /// Enable/disable physics simulation from all physics worlds
     void SetRunPhysics(bool enable);
+
+    /// Bakes the triangles of an Ogre binary mesh file to a collision mesh file (.collision), which is faster to read without Ogre.
+    void BakeCollisionMesh(const QString &meshFile, const QString &collisionFile);
     
     /// Initialize physics datatypes for a script engine
     void OnScriptEngineCreated(QScriptEngine* engine);
@@ -82,8 +107,13 @@ private slots:
     void CreatePhysicsWorld(Scene *scene);
     /// Removes PhysicsWorld of a Scene.
     void RemovePhysicsWorld(Scene *scene);
+    /// Sets the metrics of the physics worlds, see MetricsRegistry::Collect.
+    void CollectMetrics();
 
 private:
+    /// Returns the shared BVH shape of the triangle mesh by the name, building it or reading it from the asset cache if not created yet.
+    shared_ptr<btBvhTriangleMeshShape> GetBvhTriangleMeshShape(const std::string &name, const shared_ptr<btTriangleMesh> &triangleMesh, const QString &contentHash);
+
     typedef std::map<Scene*, PhysicsWorldPtr > PhysicsWorldMap;
     /// Map of physics worlds assigned to scenes
     PhysicsWorldMap physicsWorlds_;
@@ -92,6 +122,10 @@ private:
     /// Bullet triangle meshes generated from Ogre meshes
     TriangleMeshMap triangleMeshes_;
 
+    typedef std::map<std::string, shared_ptr<btBvhTriangleMeshShape> > BvhShapeMap;
+    /// Bullet BVH triangle mesh shapes generated from Ogre meshes
+    BvhShapeMap bvhShapes_;
+
     typedef std::map<std::string, shared_ptr<ConvexHullSet> > ConvexHullSetMap;
     /// Bullet convex hull sets generated from Ogre meshes
     ConvexHullSetMap convexHullSets_;
@@ -7,16 +7,20 @@
 #include "PhysicsModule.h"
 #include "PhysicsWorld.h"
 #include "PhysicsUtils.h"
+#include "ParallelPhysics.h"
 #include "Profiler.h"
 #include "Scene/Scene.h"
 #include "OgreWorld.h"
 #include "EC_RigidBody.h"
+#include "EC_VolumeTrigger.h"
 #include "LoggingFunctions.h"
 #include "Geometry/LineSegment.h"
 #include "Geometry/OBB.h"
 #include "Math/float3x3.h"
 #include "Math/Quat.h"
 #include "Entity.h"
+#include "Framework.h"
+#include "FrameAPI.h"
 
 #include <LinearMath/btIDebugDraw.h>
 // Disable unreferenced formal parameter coming from Bullet
@@ -25,12 +29,20 @@
 #pragma warning(disable : 4100)
 #endif
 #include <btBulletDynamicsCommon.h>
+#include <BulletCollision/CollisionDispatch/btGhostObject.h>
 #ifdef _MSC_VER
 #pragma warning(pop)
 #endif
 
 #include <Ogre.h>
 
+#include <QThreadPool>
+#include <QRunnable>
+
+#include <algorithm>
+#include <deque>
+#include <map>
+
 #include "MemoryLeakCheck.h"
 
 namespace
@@ -45,6 +57,9 @@ struct CollisionSignal
     float distance;
     float impulse;
     bool newCollision;
+    bool signalWorld; ///< Whether signaled by the world.
+    bool signalBodyA; ///< Whether signaled by body A.
+    bool signalBodyB; ///< Whether signaled by body B.
 };
 
 struct ObbCallback : public btCollisionWorld::ContactResultCallback
@@ -66,32 +81,436 @@ void TickCallback(btDynamicsWorld *world, btScalar timeStep)
     static_cast<PhysicsWorld*>(world->getWorldUserInfo())->ProcessPostTick(timeStep);
 }
 
+void PreTickCallback(btDynamicsWorld *world, btScalar /*timeStep*/)
+{
+    static_cast<PhysicsWorld*>(world->getWorldUserInfo())->ProcessPreTick();
+}
+
+/// A contact recorded in a substep, signaled after it.
+struct PendingCollision
+{
+    EC_RigidBody *bodyA; ///< Null if the body was removed before the signal.
+    EC_RigidBody *bodyB; ///< Null if the body was removed before the signal.
+    float3 position;
+    float3 normal;
+    float distance;
+    float impulse;
+    bool newCollision;
+    bool signalWorld; ///< Whether signaled by the world.
+    bool signalBodyA; ///< Whether signaled by body A.
+    bool signalBodyB; ///< Whether signaled by body B.
+};
+
+/// Returns a contact as given to scripts in the PhysicsCollisions batch.
+QVariantMap CollisionToVariant(Entity *entityA, Entity *entityB, const float3 &position, const float3 &normal, float distance, float impulse, bool newCollision)
+{
+    QVariantMap collision;
+    collision["entityA"] = QVariant::fromValue<QObject*>(entityA);
+    collision["entityB"] = QVariant::fromValue<QObject*>(entityB);
+    collision["position"] = QVariant::fromValue(position);
+    collision["normal"] = QVariant::fromValue(normal);
+    collision["distance"] = distance;
+    collision["impulse"] = impulse;
+    collision["newCollision"] = newCollision;
+    return collision;
+}
+
+/// Returns the entity of the rigid body of a Bullet object, or null.
+Entity *EntityOf(const btCollisionObject *object)
+{
+    EC_RigidBody *body = object ? static_cast<EC_RigidBody*>(object->getUserPointer()) : 0;
+    return body ? body->ParentEntity() : 0;
+}
+
+/// A batch of queries, run in ranges by RunQueries.
+struct QueryBatch
+{
+    virtual ~QueryBatch() {}
+    /// Runs the queries [begin, end). Called in a worker thread or the calling thread.
+    virtual void Run(size_t begin, size_t end) = 0;
+};
+
+/// Runs a range of the queries of a batch.
+struct QueryJob : public IUpdateJob
+{
+    QueryBatch *batch;
+    size_t begin;
+    size_t end;
+
+    void Run(float /*frameTime*/) { batch->Run(begin, end); }
+};
+
+/// Runs the queries of a batch in the worker threads of the scheduler, or in the calling thread if not run in parallel.
+void RunQueries(QueryBatch &batch, size_t numQueries, UpdateScheduler *scheduler, bool parallel, const QString &name)
+{
+    const int maxThreads = scheduler ? scheduler->MaxThreadCount() : 0;
+    // Bullet's profiler, used by the narrowphase of some shapes, can only be used from one thread
+    if (!parallel || maxThreads == 0 || numQueries < PhysicsWorld::cMinParallelQueries || !ParallelDynamicsWorld::CanSolveInParallel())
+    {
+        batch.Run(0, numQueries);
+        return;
+    }
+
+    // A few jobs per thread, so that a thread that finishes early takes on the remaining ones
+    const size_t minQueriesPerJob = PhysicsWorld::cMinParallelQueries / 4;
+    const size_t queriesPerJob = std::max(minQueriesPerJob, numQueries / (4 * (maxThreads + 1)) + 1);
+    const size_t numJobs = (numQueries + queriesPerJob - 1) / queriesPerJob;
+    std::vector<QueryJob> jobs(numJobs);
+    std::vector<IUpdateJob *> jobPtrs(numJobs);
+    for(size_t i = 0; i < numJobs; ++i)
+    {
+        jobs[i].batch = &batch;
+        jobs[i].begin = i * queriesPerJob;
+        jobs[i].end = std::min(numQueries, (i + 1) * queriesPerJob);
+        jobPtrs[i] = &jobs[i];
+    }
+    scheduler->RunParallel(jobPtrs, 0.f, name);
+}
+
+/// Gathers the broadphase proxies of the Dbvt leaves hit by a ray or overlapping a volume.
+/** Used with the re-entrant Dbvt traversals, as the ray and sweep tests of btCollisionWorld share the traversal stack of the broadphase. */
+struct ProxyGatherer : public btDbvt::ICollide
+{
+    void Process(const btDbvtNode *leaf) { proxies.push_back(static_cast<btBroadphaseProxy*>(leaf->data)); }
+
+    std::vector<btBroadphaseProxy*> proxies;
+};
+
+struct RayQueryBatch : public QueryBatch
+{
+    btDbvtBroadphase *broadphase;
+    const std::vector<PhysicsRayQuery> *rays;
+    std::vector<PhysicsQueryHit> *hits;
+
+    void Run(size_t begin, size_t end)
+    {
+        ProxyGatherer gatherer;
+        for(size_t i = begin; i < end; ++i)
+        {
+            const PhysicsRayQuery &ray = (*rays)[i];
+            btCollisionWorld::ClosestRayResultCallback callback(ray.origin, ray.origin + ray.maxDistance * ray.direction.Normalized());
+            callback.m_collisionFilterGroup = ray.collisionGroup;
+            callback.m_collisionFilterMask = ray.collisionMask;
+
+            gatherer.proxies.clear();
+            for(int s = 0; s < 2; ++s)
+                btDbvt::rayTest(broadphase->m_sets[s].m_root, callback.m_rayFromWorld, callback.m_rayToWorld, gatherer);
+
+            const btTransform fromTrans(btQuaternion::getIdentity(), callback.m_rayFromWorld);
+            const btTransform toTrans(btQuaternion::getIdentity(), callback.m_rayToWorld);
+            for(size_t j = 0; j < gatherer.proxies.size(); ++j)
+            {
+                if (!callback.needsCollision(gatherer.proxies[j]))
+                    continue;
+                btCollisionObject *object = static_cast<btCollisionObject*>(gatherer.proxies[j]->m_clientObject);
+                btCollisionWorld::rayTestSingle(fromTrans, toTrans, object, object->getCollisionShape(), object->getWorldTransform(), callback);
+            }
+
+            PhysicsQueryHit &hit = (*hits)[i];
+            hit = PhysicsQueryHit();
+            if (callback.hasHit())
+            {
+                hit.entity = EntityOf(callback.m_collisionObject);
+                hit.pos = callback.m_hitPointWorld;
+                hit.normal = callback.m_hitNormalWorld;
+                hit.distance = (hit.pos - ray.origin).Length();
+            }
+        }
+    }
+};
+
+struct SweepQueryBatch : public QueryBatch
+{
+    btDbvtBroadphase *broadphase;
+    const std::vector<PhysicsSweepQuery> *sweeps;
+    std::vector<PhysicsQueryHit> *hits;
+
+    void Run(size_t begin, size_t end)
+    {
+        ProxyGatherer gatherer;
+        for(size_t i = begin; i < end; ++i)
+        {
+            const PhysicsSweepQuery &sweep = (*sweeps)[i];
+            btSphereShape sphere(sweep.shape.radius);
+            btBoxShape box(sweep.shape.halfSize); // Note: Bullet uses box halfsize
+            const btConvexShape *castShape = sweep.shape.isBox ? static_cast<btConvexShape*>(&box) : static_cast<btConvexShape*>(&sphere);
+            const btTransform fromTrans(sweep.shape.orientation, sweep.from);
+            const btTransform toTrans(sweep.shape.orientation, sweep.to);
+
+            // The swept volume is bounded by the bounding boxes of the shape at both ends
+            btVector3 aabbMin, aabbMax, toMin, toMax;
+            castShape->getAabb(fromTrans, aabbMin, aabbMax);
+            castShape->getAabb(toTrans, toMin, toMax);
+            aabbMin.setMin(toMin);
+            aabbMax.setMax(toMax);
+            const btDbvtVolume volume = btDbvtVolume::FromMM(aabbMin, aabbMax);
+            gatherer.proxies.clear();
+            for(int s = 0; s < 2; ++s)
+                broadphase->m_sets[s].collideTV(broadphase->m_sets[s].m_root, volume, gatherer);
+
+            btCollisionWorld::ClosestConvexResultCallback callback(fromTrans.getOrigin(), toTrans.getOrigin());
+            callback.m_collisionFilterGroup = sweep.collisionGroup;
+            callback.m_collisionFilterMask = sweep.collisionMask;
+            for(size_t j = 0; j < gatherer.proxies.size(); ++j)
+            {
+                if (!callback.needsCollision(gatherer.proxies[j]))
+                    continue;
+                btCollisionObject *object = static_cast<btCollisionObject*>(gatherer.proxies[j]->m_clientObject);
+                btCollisionWorld::objectQuerySingle(castShape, fromTrans, toTrans, object, object->getCollisionShape(), object->getWorldTransform(), callback, 0.f);
+            }
+
+            PhysicsQueryHit &hit = (*hits)[i];
+            hit = PhysicsQueryHit();
+            if (callback.hasHit())
+            {
+                hit.entity = EntityOf(callback.m_hitCollisionObject);
+                hit.pos = callback.m_hitPointWorld;
+                hit.normal = callback.m_hitNormalWorld;
+                hit.distance = callback.m_closestHitFraction * (sweep.to - sweep.from).Length();
+            }
+        }
+    }
+};
+
+/// Gathers the entities of the objects in contact with the query object.
+struct OverlapCallback : public btCollisionWorld::ContactResultCallback
+{
+    OverlapCallback(const btCollisionObject *query_, std::vector<Entity*> &entities_) : query(query_), entities(entities_) {}
+
+    virtual btScalar addSingleResult(btManifoldPoint &, const btCollisionObjectWrapper *colObj0, int, int, const btCollisionObjectWrapper *colObj1, int, int)
+    {
+        const btCollisionObject *other = colObj0->getCollisionObject() == query ? colObj1->getCollisionObject() : colObj0->getCollisionObject();
+        Entity *entity = EntityOf(other);
+        if (entity)
+            entities.push_back(entity);
+        return 0.0f;
+    }
+
+    const btCollisionObject *query;
+    std::vector<Entity*> &entities;
+};
+
+struct OverlapQueryBatch : public QueryBatch
+{
+    btCollisionWorld *world;
+    const std::vector<PhysicsOverlapQuery> *queries;
+    std::vector<std::vector<Entity*> > *entities; ///< Entities of each query.
+
+    void Run(size_t begin, size_t end)
+    {
+        for(size_t i = begin; i < end; ++i)
+        {
+            const PhysicsOverlapQuery &query = (*queries)[i];
+            btSphereShape sphere(query.shape.radius);
+            btBoxShape box(query.shape.halfSize); // Note: Bullet uses box halfsize
+            btCollisionObject object;
+            object.setCollisionShape(query.shape.isBox ? static_cast<btCollisionShape*>(&box) : static_cast<btCollisionShape*>(&sphere));
+            object.setWorldTransform(btTransform(query.shape.orientation, query.center));
+
+            std::vector<Entity*> &result = (*entities)[i];
+            result.clear();
+            OverlapCallback callback(&object, result);
+            callback.m_collisionFilterGroup = query.collisionGroup;
+            callback.m_collisionFilterMask = query.collisionMask;
+            world->contactTest(&object, callback);
+
+            // Each contact point is reported, so list each entity once
+            std::sort(result.begin(), result.end());
+            result.erase(std::unique(result.begin(), result.end()), result.end());
+        }
+    }
+};
+
+/// Appends the closest hits of a batch for scripts, cScriptHitStride numbers each.
+void AppendScriptHits(const std::vector<PhysicsQueryHit> &hits, QVariantList &out)
+{
+    out.reserve(out.size() + (int)hits.size() * PhysicsWorld::cScriptHitStride);
+    for(size_t i = 0; i < hits.size(); ++i)
+    {
+        const PhysicsQueryHit &hit = hits[i];
+        out << (hit.entity ? hit.entity->Id() : 0u) << hit.distance
+            << hit.pos.x << hit.pos.y << hit.pos.z
+            << hit.normal.x << hit.normal.y << hit.normal.z;
+    }
+}
+
+/// Appends the overlapping entities of a batch for scripts, the count of each query followed by the entity ids.
+void AppendScriptOverlaps(const std::vector<Entity*> &entities, const std::vector<size_t> &offsets, QVariantList &out)
+{
+    for(size_t i = 0; i + 1 < offsets.size(); ++i)
+    {
+        out << (uint)(offsets[i + 1] - offsets[i]);
+        for(size_t j = offsets[i]; j < offsets[i + 1]; ++j)
+            out << entities[j]->Id();
+    }
+}
+
+/// State of a body at the end of a step run in the dedicated thread.
+struct BodyState
+{
+    EC_RigidBody *body; ///< Null if the body was removed before the state was applied.
+    float3 position;
+    Quat orientation;
+    float3 linearVelocity;
+    float3 angularVelocity;
+};
+
+/// Inputs of a predicted body for a step, and its state after the step.
+struct PredictionSample
+{
+    u32 step;
+    float3 deltaLinearVelocity; ///< Change of the linear velocity between the steps, e.g. by impulses.
+    float3 deltaAngularVelocity; ///< Change of the angular velocity between the steps, in radians/s.
+    float3 force; ///< Total force applied for the step, without gravity.
+    float3 torque; ///< Total torque applied for the step.
+    PhysicsBodyState state;
+};
+
+/// History of a predicted body.
+struct PredictedBody
+{
+    PredictedBody() : lastLinearVelocity(float3::zero), lastAngularVelocity(float3::zero) {}
+
+    /// Sample of a step, or null if not in the history.
+    PredictionSample *Sample(u32 step)
+    {
+        if (history.empty() || step > history.back().step || history.back().step - step >= history.size())
+            return 0;
+        return &history[history.size() - 1 - (history.back().step - step)];
+    }
+
+    std::deque<PredictionSample> history; ///< One sample per step, the latest last.
+    float3 lastLinearVelocity; ///< Velocities after the last step, in Bullet units.
+    float3 lastAngularVelocity;
+};
+
+/// Added or removed broadphase pair of a volume trigger.
+struct TriggerPairChange
+{
+    EC_VolumeTrigger *trigger;
+    EC_RigidBody *other; ///< Only compared against, as the body may have been deleted after the pair was removed.
+    bool added;
+};
+
+/// Ghost pair callback of the broadphase, which also records the pair changes of the bodies of the volume triggers.
+/** Called from the thread that steps the world, and from the main thread when bodies are removed. */
+class TriggerPairCallback : public btGhostPairCallback
+{
+public:
+    virtual btBroadphasePair *addOverlappingPair(btBroadphaseProxy *proxy0, btBroadphaseProxy *proxy1)
+    {
+        btGhostPairCallback::addOverlappingPair(proxy0, proxy1);
+        if (!triggers.empty())
+            Record(proxy0, proxy1, true);
+        return 0;
+    }
+
+    virtual void *removeOverlappingPair(btBroadphaseProxy *proxy0, btBroadphaseProxy *proxy1, btDispatcher *dispatcher)
+    {
+        btGhostPairCallback::removeOverlappingPair(proxy0, proxy1, dispatcher);
+        if (!triggers.empty())
+            Record(proxy0, proxy1, false);
+        return 0;
+    }
+
+    /// Bodies of the volume triggers.
+    std::map<EC_RigidBody*, EC_VolumeTrigger*> triggers;
+    /// Pair changes since the triggers were last updated.
+    std::vector<TriggerPairChange> changes;
+
+private:
+    void Record(btBroadphaseProxy *proxy0, btBroadphaseProxy *proxy1, bool added)
+    {
+        EC_RigidBody *body0 = static_cast<EC_RigidBody*>(static_cast<btCollisionObject*>(proxy0->m_clientObject)->getUserPointer());
+        EC_RigidBody *body1 = static_cast<EC_RigidBody*>(static_cast<btCollisionObject*>(proxy1->m_clientObject)->getUserPointer());
+        if (!body0 || !body1)
+            return;
+        std::map<EC_RigidBody*, EC_VolumeTrigger*>::const_iterator it = triggers.find(body0);
+        if (it != triggers.end())
+        {
+            TriggerPairChange change = { it->second, body1, added };
+            changes.push_back(change);
+        }
+        it = triggers.find(body1);
+        if (it != triggers.end())
+        {
+            TriggerPairChange change = { it->second, body0, added };
+            changes.push_back(change);
+        }
+    }
+};
+
 } // ~unnamed namespace
 
+/// What a step records for the main thread.
+struct PhysicsWorld::StepResults
+{
+    StepResults() : numObjectsWithoutBody(0), numParentlessBodies(0) {}
+
+    void Clear()
+    {
+        bodyStates.clear();
+        collisions.clear();
+        ticks.clear();
+    }
+
+    std::vector<BodyState> bodyStates;
+    std::vector<PendingCollision> collisions;
+    /// Length of each substep, and the end index of its collisions.
+    std::vector<std::pair<float, size_t> > ticks;
+    int numObjectsWithoutBody;
+    int numParentlessBodies;
+};
+
+/// Runs a step in the dedicated thread.
+class PhysicsStepTask : public QRunnable
+{
+public:
+    PhysicsStepTask(PhysicsWorld *world, f64 frametime) : world_(world), frametime_(frametime) {}
+    void run() { world_->Step(frametime_); }
+
+private:
+    PhysicsWorld *world_;
+    f64 frametime_;
+};
+
 struct PhysicsWorld::Impl : public btIDebugDraw
 {
-    explicit Impl(PhysicsWorld *owner) :
+    Impl(PhysicsWorld *owner, UpdateScheduler *scheduler) :
         collisionConfiguration(0),
         collisionDispatcher(0),
         broadphase(0),
         solver(0),
         world(0),
         debugDrawMode(0),
-        cachedOgreWorld(0)
+        cachedOgreWorld(0),
+        scheduler(scheduler),
+        stepThread(0),
+        stepRunning(false),
+        backResults(0),
+        stepIndex(0),
+        resimulating(false),
+        stepFinished(false),
+        stepTime(0.0),
+        activeBodies(0)
     {
 #include "DisableMemoryLeakCheck.h"
-        collisionConfiguration = new btDefaultCollisionConfiguration();
-        collisionDispatcher = new btCollisionDispatcher(collisionConfiguration);
+        collisionConfiguration = new ParallelCollisionConfiguration();
+        collisionDispatcher = new ParallelCollisionDispatcher(collisionConfiguration, scheduler);
         broadphase = new btDbvtBroadphase();
         solver = new btSequentialImpulseConstraintSolver();
-        world = new btDiscreteDynamicsWorld(collisionDispatcher, broadphase, solver, collisionConfiguration);
+        world = new ParallelDynamicsWorld(collisionDispatcher, broadphase, solver, collisionConfiguration, scheduler);
         world->setDebugDrawer(this);
         world->setInternalTickCallback(TickCallback, (void*)owner, false);
+        world->setInternalTickCallback(PreTickCallback, (void*)owner, true);
+        broadphase->getOverlappingPairCache()->setInternalGhostPairCallback(&triggerPairs);
 #include "EnableMemoryLeakCheck.h"
     }
 
     ~Impl()
     {
+        WaitForStep();
+        delete stepThread;
         delete world;
         delete solver;
         delete broadphase;
@@ -127,20 +546,56 @@ struct PhysicsWorld::Impl : public btIDebugDraw
 
     bool IsDebugGeometryEnabled() const { return getDebugMode() != btIDebugDraw::DBG_NoDebug; }
 
+    /// Waits for the step running in the dedicated thread, if any.
+    void WaitForStep()
+    {
+        if (stepRunning)
+        {
+            PROFILE(PhysicsWorld_WaitForStep);
+            stepThread->waitForDone();
+            stepRunning = false;
+        }
+    }
+
     /// Bullet collision config
     btCollisionConfiguration* collisionConfiguration;
     /// Bullet collision dispatcher
-    btDispatcher* collisionDispatcher;
+    ParallelCollisionDispatcher* collisionDispatcher;
     /// Bullet collision broadphase
-    btBroadphaseInterface* broadphase;
+    btDbvtBroadphase* broadphase;
     /// Bullet constraint equation solver
     btConstraintSolver* solver;
     /// Bullet physics world
-    btDiscreteDynamicsWorld* world;
+    ParallelDynamicsWorld* world;
     /// Bullet debug draw / debug behaviour flags
     int debugDrawMode;
     /// Cached OgreWorld pointer for drawing debug geometry
     OgreWorld* cachedOgreWorld;
+    /// Scheduler whose worker threads run the parallel step and the parallel batched queries
+    UpdateScheduler* scheduler;
+    /// Dedicated thread of the asynchronous step, null if the step is not asynchronous
+    QThreadPool* stepThread;
+    /// Whether a step is running in stepThread
+    bool stepRunning;
+    /// The running step records to results[backResults], and the results of the previous one are applied from the other
+    StepResults results[2];
+    int backResults;
+    /// Bodies frozen by the physics LOD, and their activation states before
+    std::map<EC_RigidBody*, int> frozenBodies;
+    /// Records the broadphase pair changes of the volume triggers
+    TriggerPairCallback triggerPairs;
+    /// Triggers being updated in UpdateTriggers. Nulled if unregistered meanwhile.
+    std::vector<EC_VolumeTrigger*> updatingTriggers;
+    /// Locally predicted bodies and their histories
+    std::map<EC_RigidBody*, PredictedBody> predictedBodies;
+    /// Number of internal steps simulated
+    u32 stepIndex;
+    /// Whether CorrectPrediction is resimulating steps
+    bool resimulating;
+    /// Whether Step has finished since the statistics were last recorded, and the time and the active bodies of the step
+    bool stepFinished;
+    double stepTime;
+    int activeBodies;
 };
 
 PhysicsWorld::PhysicsWorld(const ScenePtr &scene, bool isClient) :
@@ -151,12 +606,39 @@ PhysicsWorld::PhysicsWorld(const ScenePtr &scene, bool isClient) :
     runPhysics_(true),
     drawDebugManuallySet_(false),
     useVariableTimestep_(false),
-    impl(new Impl(this))
+    deterministic_(false),
+    collisionSignalLayers_(-1),
+    hasCollisionListeners_(false),
+    hasBatchListeners_(false),
+    lodRadius_(0.f),
+    observersKnown_(false),
+    stepTimeTotal_(0.0),
+    numSteps_(0),
+    numActiveBodies_(0),
+    impl(new Impl(this, scene->GetFramework()->Frame()->Scheduler()))
 {
     if (scene->GetFramework()->HasCommandLineParameter("--variablephysicsstep"))
         useVariableTimestep_ = true;
+    if (scene->GetFramework()->HasCommandLineParameter("--parallelPhysics"))
+        SetParallel(true);
+    if (scene->GetFramework()->HasCommandLineParameter("--asyncPhysics"))
+        SetAsyncStep(true);
+    if (scene->GetFramework()->HasCommandLineParameter("--physicsLod"))
+    {
+        const QStringList params = scene->GetFramework()->CommandLineParameters("--physicsLod");
+        bool ok = false;
+        const float radius = params.isEmpty() ? 0.f : params.first().toFloat(&ok);
+        if (ok && radius > 0.f)
+            SetLodRadius(radius);
+        else
+            LogWarning("PhysicsWorld: Malformed --physicsLod value, expected the radius around the observers.");
+    }
 }
 
+const float PhysicsWorld::cLodFreezeFactor = 1.25f;
+const float PhysicsWorld::cPredictionPositionTolerance = 0.02f;
+const float PhysicsWorld::cPredictionAngleTolerance = 0.02f;
+
 PhysicsWorld::~PhysicsWorld()
 {
     delete impl;
@@ -178,16 +660,36 @@ void PhysicsWorld::SetMaxSubSteps(int steps)
 
 void PhysicsWorld::SetGravity(const float3& gravity)
 {
+    impl->WaitForStep();
     impl->world->setGravity(gravity);
 }
 
 float3 PhysicsWorld::Gravity() const
 {
+    impl->WaitForStep();
     return impl->world->getGravity();
 }
 
+void PhysicsWorld::SetParallel(bool enable)
+{
+    impl->collisionDispatcher->SetParallel(enable);
+    impl->WaitForStep();
+    impl->world->SetParallel(enable);
+}
+
+bool PhysicsWorld::IsParallel() const
+{
+    return impl->collisionDispatcher->IsParallel();
+}
+
+bool PhysicsWorld::IsSolvingInParallel() const
+{
+    return IsParallel() && ParallelDynamicsWorld::CanSolveInParallel();
+}
+
 btDiscreteDynamicsWorld* PhysicsWorld::BulletWorld() const
 {
+    impl->WaitForStep();
     return impl->world;
 }
 
@@ -197,24 +699,82 @@ void PhysicsWorld::Simulate(f64 frametime)
         return;
     
     PROFILE(PhysicsWorld_Simulate);
+
+    // Apply the body states of the step started on the previous frame before anything reads the placeables
+    StepResults *finished = 0;
+    if (impl->stepThread)
+    {
+        impl->WaitForStep();
+        finished = &impl->results[impl->backResults];
+        impl->backResults = 1 - impl->backResults;
+        ApplyBodyStates(*finished);
+        RecordStepStatistics();
+    }
     
     emit AboutToUpdate((float)frametime);
+
+    UpdateLod();
     
+    if (finished)
+    {
+        // Update the triggers from the pairs of the finished step while the Bullet world is free
+        UpdateTriggers();
+        // Draw the debug geometry of the finished step before the next one takes the Bullet world
+        UpdateDebugGeometry();
+        impl->results[impl->backResults].Clear();
+        impl->stepRunning = true;
+        impl->stepThread->start(new PhysicsStepTask(this, frametime)); // The pool deletes the task when done.
+        EmitStepSignals(*finished);
+        return;
+    }
+
     {
         PROFILE(Bullet_stepSimulation); ///\note Do not delete or rename this PROFILE() block. The DebugStats profiler uses this string as a label to know where to inject the Bullet internal profiling data.
-        
-        // Use variable timestep if enabled, and if frame timestep exceeds the single physics simulation substep
-        if (useVariableTimestep_ && frametime > physicsUpdatePeriod_)
-        {
-            float clampedTimeStep = (float)frametime;
-            if (clampedTimeStep > 0.1f)
-                clampedTimeStep = 0.1f; // Advance max. 1/10 sec. during one frame
-            impl->world->stepSimulation(clampedTimeStep, 0, clampedTimeStep);
-        }
-        else
-            impl->world->stepSimulation((float)frametime, maxSubSteps_, physicsUpdatePeriod_);
+        Step(frametime);
     }
+    RecordStepStatistics();
     
+    UpdateTriggers();
+    UpdateDebugGeometry();
+}
+
+void PhysicsWorld::Step(f64 frametime)
+{
+    const tick_t start = GetCurrentClockTime();
+    // Use variable timestep if enabled, and if frame timestep exceeds the single physics simulation substep
+    if (useVariableTimestep_ && !deterministic_ && frametime > physicsUpdatePeriod_)
+    {
+        float clampedTimeStep = (float)frametime;
+        if (clampedTimeStep > 0.1f)
+            clampedTimeStep = 0.1f; // Advance max. 1/10 sec. during one frame
+        impl->world->stepSimulation(clampedTimeStep, 0, clampedTimeStep);
+    }
+    else
+        impl->world->stepSimulation((float)frametime, maxSubSteps_, physicsUpdatePeriod_);
+    impl->stepTime = (double)(GetCurrentClockTime() - start) / (double)GetCurrentClockFreq();
+
+    // Counted here, as the bodies are not to be touched by the main thread while an asynchronous step runs
+    int activeBodies = 0;
+    const btCollisionObjectArray &objects = impl->world->getCollisionObjectArray();
+    for(int i = 0; i < objects.size(); ++i)
+        if (objects[i]->isActive() && !objects[i]->isStaticOrKinematicObject() && btRigidBody::upcast(objects[i]))
+            ++activeBodies;
+    impl->activeBodies = activeBodies;
+    impl->stepFinished = true;
+}
+
+void PhysicsWorld::RecordStepStatistics()
+{
+    if (!impl->stepFinished)
+        return;
+    impl->stepFinished = false;
+    stepTimeTotal_ += impl->stepTime;
+    ++numSteps_;
+    numActiveBodies_ = impl->activeBodies;
+}
+
+void PhysicsWorld::UpdateDebugGeometry()
+{
     // Automatically enable debug geometry if at least one debug-enabled rigidbody. Automatically disable if no debug-enabled rigidbodies
     // However, do not do this if user has used the physicsdebug console command
     if (!drawDebugManuallySet_)
@@ -229,116 +789,661 @@ void PhysicsWorld::Simulate(f64 frametime)
         DrawDebugGeometry();
 }
 
-void PhysicsWorld::ProcessPostTick(float substeptime)
+void PhysicsWorld::SetAsyncStep(bool enable)
 {
-    PROFILE(PhysicsWorld_ProcessPostTick);
-    // Check contacts and send collision signals for them
-    int numManifolds = impl->collisionDispatcher->getNumManifolds();
-    
-    std::set<std::pair<const btCollisionObject*, const btCollisionObject*> > currentCollisions;
-    
-    // Collect all collision signals to a list before emitting any of them, in case a collision
-    // handler changes physics state before the loop below is over (which would lead into catastrophic
-    // consequences)
-    std::vector<CollisionSignal> collisions;
-    collisions.reserve(numManifolds * 3); // Guess some initial memory size for the collision list.
+    if (enable == IsAsyncStep())
+        return;
 
-    if (numManifolds > 0)
+    if (enable)
     {
-        PROFILE(PhysicsWorld_SendCollisions);
-        
-        for(int i = 0; i < numManifolds; ++i)
+        impl->stepThread = new QThreadPool();
+        impl->stepThread->setMaxThreadCount(1);
+        impl->stepThread->setExpiryTimeout(-1); // Keep the thread for the following steps
+    }
+    else
+    {
+        impl->WaitForStep();
+        delete impl->stepThread;
+        impl->stepThread = 0;
+        StepResults &finished = impl->results[impl->backResults];
+        impl->backResults = 1 - impl->backResults;
+        ApplyBodyStates(finished);
+        EmitStepSignals(finished);
+    }
+}
+
+bool PhysicsWorld::IsAsyncStep() const
+{
+    return impl->stepThread != 0;
+}
+
+void PhysicsWorld::WaitForStep()
+{
+    impl->WaitForStep();
+}
+
+bool PhysicsWorld::IsStepRunning() const
+{
+    return impl->stepRunning;
+}
+
+void PhysicsWorld::PublishBodyState(EC_RigidBody *body, const float3 &position, const Quat &orientation, const float3 &linearVelocity, const float3 &angularVelocity)
+{
+    BodyState state = { body, position, orientation, linearVelocity, angularVelocity };
+    impl->results[impl->backResults].bodyStates.push_back(state);
+}
+
+void PhysicsWorld::SetLodRadius(float radius)
+{
+    lodRadius_ = std::max(radius, 0.f);
+    if (lodRadius_ == 0.f)
+        ThawAll();
+}
+
+void PhysicsWorld::SetObservers(const std::vector<float3> &positions)
+{
+    observers_ = positions;
+    observersKnown_ = true;
+}
+
+void PhysicsWorld::ClearObservers()
+{
+    observers_.clear();
+    observersKnown_ = false;
+}
+
+size_t PhysicsWorld::NumFrozenBodies() const
+{
+    return impl->frozenBodies.size();
+}
+
+void PhysicsWorld::UpdateLod()
+{
+    if (lodRadius_ <= 0.f)
+        return;
+    if (!observersKnown_)
+    {
+        ThawAll();
+        return;
+    }
+
+    PROFILE(PhysicsWorld_UpdateLod);
+    const float thawDistanceSq = lodRadius_ * lodRadius_;
+    const float freezeDistanceSq = thawDistanceSq * cLodFreezeFactor * cLodFreezeFactor;
+    btCollisionObjectArray &objects = impl->world->getCollisionObjectArray();
+    for(int i = 0; i < objects.size(); ++i)
+    {
+        btRigidBody *body = btRigidBody::upcast(objects[i]);
+        if (!body || body->isStaticOrKinematicObject())
+            continue;
+        EC_RigidBody *rigidBody = static_cast<EC_RigidBody*>(body->getUserPointer());
+        if (!rigidBody)
+            continue;
+
+        const float3 pos = body->getWorldTransform().getOrigin();
+        float nearestSq = FLOAT_INF;
+        for(size_t j = 0; j < observers_.size() && nearestSq > thawDistanceSq; ++j)
+            nearestSq = std::min(nearestSq, observers_[j].DistanceSq(pos));
+
+        std::map<EC_RigidBody*, int>::iterator frozen = impl->frozenBodies.find(rigidBody);
+        if (frozen == impl->frozenBodies.end())
         {
-            btPersistentManifold* contactManifold = impl->collisionDispatcher->getManifoldByIndexInternal(i);
-            int numContacts = contactManifold->getNumContacts();
-            if (numContacts == 0)
+            if (nearestSq > freezeDistanceSq)
+            {
+                impl->frozenBodies[rigidBody] = body->getActivationState();
+                body->forceActivationState(DISABLE_SIMULATION);
+            }
+        }
+        else if (nearestSq <= thawDistanceSq)
+        {
+            body->forceActivationState(frozen->second);
+            impl->frozenBodies.erase(frozen);
+        }
+    }
+}
+
+void PhysicsWorld::ThawAll()
+{
+    if (impl->frozenBodies.empty())
+        return;
+    impl->WaitForStep();
+    for(std::map<EC_RigidBody*, int>::iterator i = impl->frozenBodies.begin(); i != impl->frozenBodies.end(); ++i)
+    {
+        btRigidBody *body = i->first->BulletRigidBody();
+        if (body)
+            body->forceActivationState(i->second);
+    }
+    impl->frozenBodies.clear();
+}
+
+void PhysicsWorld::ForgetBody(EC_RigidBody *body)
+{
+    impl->WaitForStep();
+    impl->frozenBodies.erase(body);
+    for(int r = 0; r < 2; ++r)
+    {
+        StepResults &results = impl->results[r];
+        for(size_t i = 0; i < results.bodyStates.size(); ++i)
+            if (results.bodyStates[i].body == body)
+                results.bodyStates[i].body = 0;
+        for(size_t i = 0; i < results.collisions.size(); ++i)
+        {
+            if (results.collisions[i].bodyA == body)
+                results.collisions[i].bodyA = 0;
+            if (results.collisions[i].bodyB == body)
+                results.collisions[i].bodyB = 0;
+        }
+    }
+}
+
+void PhysicsWorld::RegisterTrigger(EC_VolumeTrigger *trigger, EC_RigidBody *body)
+{
+    impl->WaitForStep();
+    UnregisterTrigger(trigger);
+    impl->triggerPairs.triggers[body] = trigger;
+
+    // Pick up the pairs that the body already has
+    if (!body->BulletRigidBody() || !body->BulletRigidBody()->getBroadphaseHandle())
+        return;
+    btBroadphaseProxy *proxy = body->BulletRigidBody()->getBroadphaseHandle();
+    btBroadphasePairArray &pairs = impl->broadphase->getOverlappingPairCache()->getOverlappingPairArray();
+    for(int i = 0; i < pairs.size(); ++i)
+    {
+        btBroadphaseProxy *other = pairs[i].m_pProxy0 == proxy ? pairs[i].m_pProxy1 : (pairs[i].m_pProxy1 == proxy ? pairs[i].m_pProxy0 : 0);
+        EC_RigidBody *otherBody = other ? static_cast<EC_RigidBody*>(static_cast<btCollisionObject*>(other->m_clientObject)->getUserPointer()) : 0;
+        if (otherBody)
+            trigger->OnPairChanged(otherBody, true);
+    }
+}
+
+void PhysicsWorld::UnregisterTrigger(EC_VolumeTrigger *trigger)
+{
+    impl->WaitForStep();
+    TriggerPairCallback &pairs = impl->triggerPairs;
+    for(std::map<EC_RigidBody*, EC_VolumeTrigger*>::iterator it = pairs.triggers.begin(); it != pairs.triggers.end();)
+    {
+        if (it->second == trigger)
+            pairs.triggers.erase(it++);
+        else
+            ++it;
+    }
+    for(size_t i = 0; i < pairs.changes.size();)
+    {
+        if (pairs.changes[i].trigger == trigger)
+            pairs.changes.erase(pairs.changes.begin() + i);
+        else
+            ++i;
+    }
+    std::replace(impl->updatingTriggers.begin(), impl->updatingTriggers.end(), trigger, (EC_VolumeTrigger*)0);
+}
+
+void PhysicsWorld::ForgetComponent(EC_RigidBody *body)
+{
+    impl->WaitForStep();
+    impl->triggerPairs.triggers.erase(body);
+    impl->predictedBodies.erase(body);
+}
+
+void PhysicsWorld::UpdateTriggers()
+{
+    TriggerPairCallback &pairs = impl->triggerPairs;
+    if (pairs.triggers.empty())
+        return;
+
+    PROFILE(PhysicsWorld_UpdateTriggers);
+
+    // Apply the pair changes first, without signals, so that no body is deleted while they refer to it
+    for(size_t i = 0; i < pairs.changes.size(); ++i)
+        pairs.changes[i].trigger->OnPairChanged(pairs.changes[i].other, pairs.changes[i].added);
+    pairs.changes.clear();
+    for(std::map<EC_RigidBody*, EC_VolumeTrigger*>::const_iterator it = pairs.triggers.begin(); it != pairs.triggers.end(); ++it)
+        it->second->ResolveCandidates();
+
+    // The enter and leave signals may delete triggers
+    impl->updatingTriggers.clear();
+    for(std::map<EC_RigidBody*, EC_VolumeTrigger*>::const_iterator it = pairs.triggers.begin(); it != pairs.triggers.end(); ++it)
+        impl->updatingTriggers.push_back(it->second);
+    for(size_t i = 0; i < impl->updatingTriggers.size(); ++i)
+        if (impl->updatingTriggers[i])
+            impl->updatingTriggers[i]->UpdateOverlaps();
+    impl->updatingTriggers.clear();
+}
+
+void PhysicsWorld::SetDeterministic(bool enable)
+{
+    if (enable)
+    {
+        SetParallel(false);
+        SetAsyncStep(false);
+    }
+    deterministic_ = enable;
+}
+
+void PhysicsWorld::SetPredicted(EC_RigidBody *body, bool enable)
+{
+    if (!body)
+        return;
+    impl->WaitForStep();
+    if (!enable)
+    {
+        impl->predictedBodies.erase(body);
+        return;
+    }
+    if (impl->predictedBodies.find(body) != impl->predictedBodies.end())
+        return;
+    PredictedBody &predicted = impl->predictedBodies[body];
+    if (body->BulletRigidBody())
+    {
+        predicted.lastLinearVelocity = body->BulletRigidBody()->getLinearVelocity();
+        predicted.lastAngularVelocity = body->BulletRigidBody()->getAngularVelocity();
+    }
+}
+
+bool PhysicsWorld::IsPredicted(EC_RigidBody *body) const
+{
+    return impl->predictedBodies.find(body) != impl->predictedBodies.end();
+}
+
+void PhysicsWorld::SetBodyState(btRigidBody *body, const PhysicsBodyState &state)
+{
+    btTransform transform(state.orientation, state.position);
+    body->setWorldTransform(transform);
+    body->setInterpolationWorldTransform(transform);
+    body->setLinearVelocity(state.linearVelocity);
+    body->setInterpolationLinearVelocity(state.linearVelocity);
+    body->setAngularVelocity(DegToRad(state.angularVelocity));
+    body->setInterpolationAngularVelocity(DegToRad(state.angularVelocity));
+    body->activate(true);
+}
+
+void PhysicsWorld::RecordPredictedStates(u32 step)
+{
+    for(std::map<EC_RigidBody*, PredictedBody>::iterator it = impl->predictedBodies.begin(); it != impl->predictedBodies.end(); ++it)
+    {
+        btRigidBody *body = it->first->BulletRigidBody();
+        PredictionSample *sample = body ? it->second.Sample(step) : 0;
+        if (!sample || (impl->resimulating && body->getActivationState() == DISABLE_SIMULATION))
+            continue;
+        const btTransform &transform = body->getWorldTransform();
+        sample->state.position = transform.getOrigin();
+        sample->state.orientation = transform.getRotation();
+        sample->state.linearVelocity = body->getLinearVelocity();
+        sample->state.angularVelocity = RadToDeg(float3(body->getAngularVelocity()));
+        it->second.lastLinearVelocity = body->getLinearVelocity();
+        it->second.lastAngularVelocity = body->getAngularVelocity();
+    }
+}
+
+bool PhysicsWorld::CorrectPrediction(const std::vector<PhysicsBodyCorrection> &corrections, int stepsAgo)
+{
+    impl->WaitForStep();
+    stepsAgo = Clamp(stepsAgo, 0, cPredictionHistory - 1);
+    const u32 target = impl->stepIndex - (u32)stepsAgo;
+
+    // Find the corrections that are off by more than the tolerance
+    std::map<EC_RigidBody*, const PhysicsBodyState*> rewound;
+    for(size_t i = 0; i < corrections.size(); ++i)
+    {
+        EC_RigidBody *body = corrections[i].body;
+        std::map<EC_RigidBody*, PredictedBody>::iterator it = impl->predictedBodies.find(body);
+        if (it == impl->predictedBodies.end() || !body->BulletRigidBody())
+            continue;
+        const PhysicsBodyState &state = corrections[i].state;
+        const PredictionSample *sample = it->second.Sample(target);
+        if (!sample)
+        {
+            SetBodyState(body->BulletRigidBody(), state);
+            it->second.history.clear();
+            continue;
+        }
+        if (sample->state.position.Distance(state.position) > cPredictionPositionTolerance ||
+            sample->state.orientation.AngleBetween(state.orientation) > cPredictionAngleTolerance)
+            rewound[body] = &state;
+    }
+    if (rewound.empty() || stepsAgo == 0)
+    {
+        for(std::map<EC_RigidBody*, const PhysicsBodyState*>::const_iterator it = rewound.begin(); it != rewound.end(); ++it)
+            SetBodyState(it->first->BulletRigidBody(), *it->second);
+        if (!rewound.empty())
+            impl->world->synchronizeMotionStates();
+        return !rewound.empty();
+    }
+
+    PROFILE(PhysicsWorld_CorrectPrediction);
+
+    // Rewind the predicted bodies, and freeze the others in place
+    std::vector<std::pair<btRigidBody*, int> > frozen;
+    btCollisionObjectArray &objects = impl->world->getCollisionObjectArray();
+    for(int i = 0; i < objects.size(); ++i)
+    {
+        btRigidBody *body = btRigidBody::upcast(objects[i]);
+        if (!body || body->isStaticOrKinematicObject())
+            continue;
+        EC_RigidBody *component = static_cast<EC_RigidBody*>(body->getUserPointer());
+        std::map<EC_RigidBody*, PredictedBody>::iterator it = impl->predictedBodies.find(component);
+        const PredictionSample *sample = it != impl->predictedBodies.end() ? it->second.Sample(target) : 0;
+        if (sample)
+        {
+            std::map<EC_RigidBody*, const PhysicsBodyState*>::const_iterator correction = rewound.find(component);
+            SetBodyState(body, correction != rewound.end() ? *correction->second : sample->state);
+        }
+        else
+        {
+            frozen.push_back(std::make_pair(body, body->getActivationState()));
+            body->forceActivationState(DISABLE_SIMULATION);
+        }
+    }
+
+    // Resimulate with the recorded inputs
+    impl->resimulating = true;
+    for(u32 step = target + 1; step <= impl->stepIndex; ++step)
+    {
+        for(std::map<EC_RigidBody*, PredictedBody>::iterator it = impl->predictedBodies.begin(); it != impl->predictedBodies.end(); ++it)
+        {
+            btRigidBody *body = it->first->BulletRigidBody();
+            const PredictionSample *sample = body ? it->second.Sample(step) : 0;
+            if (!sample || body->getActivationState() == DISABLE_SIMULATION)
                 continue;
+            body->setLinearVelocity(body->getLinearVelocity() + sample->deltaLinearVelocity);
+            body->setAngularVelocity(body->getAngularVelocity() + sample->deltaAngularVelocity);
+            body->applyCentralForce(sample->force);
+            body->applyTorque(sample->torque);
+            if (!sample->deltaLinearVelocity.IsZero() || !sample->deltaAngularVelocity.IsZero() || !sample->force.IsZero() || !sample->torque.IsZero())
+                body->activate();
+        }
+        impl->world->StepOnce(physicsUpdatePeriod_);
+        RecordPredictedStates(step);
+    }
+    impl->resimulating = false;
 
-            const btCollisionObject* objectA = contactManifold->getBody0();
-            const btCollisionObject* objectB = contactManifold->getBody1();
-			
-            std::pair<const btCollisionObject*, const btCollisionObject*> objectPair;
-            if (objectA < objectB)
-                objectPair = std::make_pair(objectA, objectB);
-            else
-                objectPair = std::make_pair(objectB, objectA);
-            
-            EC_RigidBody* bodyA = static_cast<EC_RigidBody*>(objectA->getUserPointer());
-            EC_RigidBody* bodyB = static_cast<EC_RigidBody*>(objectB->getUserPointer());
-            
-            // We are only interested in collisions where both EC_RigidBody components are known
-            if (!bodyA || !bodyB)
-            {
-                LogError("Inconsistent Bullet physics scene state! An object exists in the physics scene which does not have an associated EC_RigidBody!");
+    for(size_t i = 0; i < frozen.size(); ++i)
+        frozen[i].first->forceActivationState(frozen[i].second);
+    impl->world->synchronizeMotionStates();
+    return true;
+}
+
+void PhysicsWorld::ApplyBodyStates(StepResults &results)
+{
+    PROFILE(PhysicsWorld_ApplyBodyStates);
+    LogInconsistencies(results);
+    // Go by index, as ForgetBody nulls the bodies that the attribute change handlers remove
+    for(size_t i = 0; i < results.bodyStates.size(); ++i)
+    {
+        const BodyState &state = results.bodyStates[i];
+        if (state.body)
+            state.body->ApplyBodyState(state.position, state.orientation, state.linearVelocity, state.angularVelocity);
+    }
+    results.bodyStates.clear();
+}
+
+void PhysicsWorld::EmitStepSignals(StepResults &results)
+{
+    PROFILE(PhysicsWorld_EmitStepSignals);
+    // Go by index and recheck the bodies after each signal, as ForgetBody nulls the bodies that the signal handlers remove
+    size_t i = 0;
+    for(size_t t = 0; t < results.ticks.size(); ++t)
+    {
+        const size_t begin = i;
+        bool batch = false;
+        for(; i < results.ticks[t].second; ++i)
+        {
+            const PendingCollision &c = results.collisions[i];
+            batch = batch || c.signalWorld;
+            if (!c.bodyA || !c.bodyB)
                 continue;
-            }
-            // Also, both bodies should have valid parent entities
-            Entity* entityA = bodyA->ParentEntity();
-            Entity* entityB = bodyB->ParentEntity();
-            if (!entityA || !entityB)
-            {
-                LogError("Inconsistent Bullet physics scene state! A parentless EC_RigidBody exists in the physics scene!");
+            if (c.signalWorld && hasCollisionListeners_)
+                emit PhysicsCollision(c.bodyA->ParentEntity(), c.bodyB->ParentEntity(), c.position, c.normal, c.distance, c.impulse, c.newCollision);
+
+            if (!c.bodyA || !c.bodyB)
                 continue;
-            }
-            // Check that at least one of the bodies is active
-            if (!objectA->isActive() && !objectB->isActive())
+            if (c.signalBodyA)
+                c.bodyA->EmitPhysicsCollision(c.bodyB->ParentEntity(), c.position, c.normal, c.distance, c.impulse, c.newCollision);
+
+            if (!c.bodyA || !c.bodyB)
                 continue;
-            
-            bool newCollision = previousCollisions_.find(objectPair) == previousCollisions_.end();
-            
-            for(int j = 0; j < numContacts; ++j)
+            if (c.signalBodyB)
+                c.bodyB->EmitPhysicsCollision(c.bodyA->ParentEntity(), c.position, c.normal, c.distance, c.impulse, c.newCollision);
+        }
+
+        if (batch && hasBatchListeners_)
+        {
+            QVariantList collisions;
+            for(size_t j = begin; j < i; ++j)
             {
-                btManifoldPoint& point = contactManifold->getContactPoint(j);
-                
-                CollisionSignal s;
-                s.bodyA = static_pointer_cast<EC_RigidBody>(bodyA->shared_from_this());
-                s.bodyB = static_pointer_cast<EC_RigidBody>(bodyB->shared_from_this());
-                s.position = point.m_positionWorldOnB;
-                s.normal = point.m_normalWorldOnB;
-                s.distance = point.m_distance1;
-                s.impulse = point.m_appliedImpulse;
-                s.newCollision = newCollision;
-                collisions.push_back(s);
-                
-                // Report newCollision = true only for the first contact, in case there are several contacts, and application does some logic depending on it
-                // (for example play a sound -> avoid multiple sounds being played)
-                newCollision = false;
+                const PendingCollision &c = results.collisions[j];
+                if (c.signalWorld && c.bodyA && c.bodyB)
+                    collisions.push_back(CollisionToVariant(c.bodyA->ParentEntity(), c.bodyB->ParentEntity(), c.position, c.normal, c.distance, c.impulse, c.newCollision));
             }
-            
-            currentCollisions.insert(objectPair);
+            if (!collisions.isEmpty())
+                emit PhysicsCollisions(collisions);
+        }
+
+        emit Updated(results.ticks[t].first);
+    }
+    results.Clear();
+}
+
+void PhysicsWorld::ProcessPreTick()
+{
+    if (impl->predictedBodies.empty() || impl->resimulating)
+        return;
+
+    for(std::map<EC_RigidBody*, PredictedBody>::iterator it = impl->predictedBodies.begin(); it != impl->predictedBodies.end(); ++it)
+    {
+        btRigidBody *body = it->first->BulletRigidBody();
+        if (!body)
+            continue;
+        PredictedBody &predicted = it->second;
+        PredictionSample sample;
+        sample.step = impl->stepIndex + 1;
+        sample.deltaLinearVelocity = float3(body->getLinearVelocity()) - predicted.lastLinearVelocity;
+        sample.deltaAngularVelocity = float3(body->getAngularVelocity()) - predicted.lastAngularVelocity;
+        // The world has applied the gravity of the active bodies already, and applies it again when resimulating
+        sample.force = body->getTotalForce();
+        if (body->isActive() && !body->isStaticOrKinematicObject() && body->getInvMass() > 0.f)
+            sample.force -= float3(body->getGravity()) / body->getInvMass();
+        sample.torque = body->getTotalTorque();
+        predicted.history.push_back(sample);
+        if (predicted.history.size() > (size_t)cPredictionHistory)
+            predicted.history.pop_front();
+    }
+}
+
+void PhysicsWorld::ProcessPostTick(float substeptime)
+{
+    if (impl->resimulating)
+        return; // CorrectPrediction records the states of the resimulated steps, and no signals are emitted for them
+    ++impl->stepIndex;
+    if (!impl->predictedBodies.empty())
+        RecordPredictedStates(impl->stepIndex);
+
+    // The step runs in its own thread: only record the collisions, and signal them in the main thread after the step
+    if (IsStepRunning())
+    {
+        StepResults &results = impl->results[impl->backResults];
+        CollectCollisions(results);
+        results.ticks.push_back(std::make_pair(substeptime, results.collisions.size()));
+        return;
+    }
+
+    PROFILE(PhysicsWorld_ProcessPostTick);
+    // Check contacts and send collision signals for them
+    // Collect all collision signals to a list before emitting any of them, in case a collision
+    // handler changes physics state before the loop below is over (which would lead into catastrophic
+    // consequences)
+    std::vector<CollisionSignal> collisions;
+    {
+        PROFILE(PhysicsWorld_SendCollisions);
+        StepResults results;
+        CollectCollisions(results);
+        LogInconsistencies(results);
+
+        collisions.resize(results.collisions.size());
+        for(size_t i = 0; i < results.collisions.size(); ++i)
+        {
+            const PendingCollision &c = results.collisions[i];
+            CollisionSignal &s = collisions[i];
+            s.bodyA = static_pointer_cast<EC_RigidBody>(c.bodyA->shared_from_this());
+            s.bodyB = static_pointer_cast<EC_RigidBody>(c.bodyB->shared_from_this());
+            s.position = c.position;
+            s.normal = c.normal;
+            s.distance = c.distance;
+            s.impulse = c.impulse;
+            s.newCollision = c.newCollision;
+            s.signalWorld = c.signalWorld;
+            s.signalBodyA = c.signalBodyA;
+            s.signalBodyB = c.signalBodyB;
         }
     }
 
     // Now fire all collision signals. Safeguard for the body components expiring in case signal handlers delete them from the scene
     {
         PROFILE(PhysicsWorld_emit_PhysicsCollisions);
+        bool batch = false;
         for(size_t i = 0; i < collisions.size(); ++i)
         {
+            batch = batch || collisions[i].signalWorld;
             if (collisions[i].bodyA.expired() || collisions[i].bodyB.expired())
                 continue;
-            emit PhysicsCollision(collisions[i].bodyA.lock()->ParentEntity(), collisions[i].bodyB.lock()->ParentEntity(), collisions[i].position, collisions[i].normal, collisions[i].distance, collisions[i].impulse, collisions[i].newCollision);
+            if (collisions[i].signalWorld && hasCollisionListeners_)
+                emit PhysicsCollision(collisions[i].bodyA.lock()->ParentEntity(), collisions[i].bodyB.lock()->ParentEntity(), collisions[i].position, collisions[i].normal, collisions[i].distance, collisions[i].impulse, collisions[i].newCollision);
             
             if (collisions[i].bodyA.expired() || collisions[i].bodyB.expired())
                 continue;
-            collisions[i].bodyA.lock()->EmitPhysicsCollision(collisions[i].bodyB.lock()->ParentEntity(), collisions[i].position, collisions[i].normal, collisions[i].distance, collisions[i].impulse, collisions[i].newCollision);
+            if (collisions[i].signalBodyA)
+                collisions[i].bodyA.lock()->EmitPhysicsCollision(collisions[i].bodyB.lock()->ParentEntity(), collisions[i].position, collisions[i].normal, collisions[i].distance, collisions[i].impulse, collisions[i].newCollision);
             
             if (collisions[i].bodyA.expired() || collisions[i].bodyB.expired())
                 continue;
-            collisions[i].bodyB.lock()->EmitPhysicsCollision(collisions[i].bodyA.lock()->ParentEntity(), collisions[i].position, collisions[i].normal, collisions[i].distance, collisions[i].impulse, collisions[i].newCollision);
+            if (collisions[i].signalBodyB)
+                collisions[i].bodyB.lock()->EmitPhysicsCollision(collisions[i].bodyA.lock()->ParentEntity(), collisions[i].position, collisions[i].normal, collisions[i].distance, collisions[i].impulse, collisions[i].newCollision);
+        }
+
+        // Then the batch for scripts, without the bodies that the signal handlers removed
+        if (batch && hasBatchListeners_)
+        {
+            QVariantList batchedCollisions;
+            for(size_t i = 0; i < collisions.size(); ++i)
+            {
+                if (!collisions[i].signalWorld || collisions[i].bodyA.expired() || collisions[i].bodyB.expired())
+                    continue;
+                batchedCollisions.push_back(CollisionToVariant(collisions[i].bodyA.lock()->ParentEntity(), collisions[i].bodyB.lock()->ParentEntity(), collisions[i].position, collisions[i].normal, collisions[i].distance, collisions[i].impulse, collisions[i].newCollision));
+            }
+            if (!batchedCollisions.isEmpty())
+                emit PhysicsCollisions(batchedCollisions);
         }
     }
 
-    previousCollisions_ = currentCollisions;
-    
     {
         PROFILE(PhysicsWorld_ProcessPostTick_Updated);
         emit Updated(substeptime);
     }
 }
 
+void PhysicsWorld::CollectCollisions(StepResults &results)
+{
+    int numManifolds = impl->collisionDispatcher->getNumManifolds();
+    // Only contacts that someone listens to are recorded and tracked
+    const bool worldListeners = hasCollisionListeners_ || hasBatchListeners_;
+    QSet<CollisionPair> currentCollisions;
+    currentCollisions.reserve(previousCollisions_.size());
+    results.collisions.reserve(results.collisions.size() + numManifolds * 3); // Guess some initial memory size for the collision list.
+
+    for(int i = 0; i < numManifolds; ++i)
+    {
+        btPersistentManifold* contactManifold = impl->collisionDispatcher->getManifoldByIndexInternal(i);
+        int numContacts = contactManifold->getNumContacts();
+        if (numContacts == 0)
+            continue;
+
+        const btCollisionObject* objectA = contactManifold->getBody0();
+        const btCollisionObject* objectB = contactManifold->getBody1();
+
+        EC_RigidBody* bodyA = static_cast<EC_RigidBody*>(objectA->getUserPointer());
+        EC_RigidBody* bodyB = static_cast<EC_RigidBody*>(objectB->getUserPointer());
+        
+        // We are only interested in collisions where both EC_RigidBody components are known
+        if (!bodyA || !bodyB)
+        {
+            ++results.numObjectsWithoutBody;
+            continue;
+        }
+        // Also, both bodies should have valid parent entities
+        if (!bodyA->ParentEntity() || !bodyB->ParentEntity())
+        {
+            ++results.numParentlessBodies;
+            continue;
+        }
+        // Check that at least one of the bodies is active
+        if (!objectA->isActive() && !objectB->isActive())
+            continue;
+
+        const bool signalWorld = worldListeners && ((objectA->getBroadphaseHandle()->m_collisionFilterGroup |
+            objectB->getBroadphaseHandle()->m_collisionFilterGroup) & collisionSignalLayers_) != 0;
+        const bool signalBodyA = bodyA->HasCollisionListeners();
+        const bool signalBodyB = bodyB->HasCollisionListeners();
+        if (!signalWorld && !signalBodyA && !signalBodyB)
+            continue;
+
+        const CollisionPair objectPair = objectA < objectB ? qMakePair(objectA, objectB) : qMakePair(objectB, objectA);
+        bool newCollision = !previousCollisions_.contains(objectPair);
+        
+        for(int j = 0; j < numContacts; ++j)
+        {
+            btManifoldPoint& point = contactManifold->getContactPoint(j);
+            
+            PendingCollision c;
+            c.bodyA = bodyA;
+            c.bodyB = bodyB;
+            c.position = point.m_positionWorldOnB;
+            c.normal = point.m_normalWorldOnB;
+            c.distance = point.m_distance1;
+            c.impulse = point.m_appliedImpulse;
+            c.newCollision = newCollision;
+            c.signalWorld = signalWorld;
+            c.signalBodyA = signalBodyA;
+            c.signalBodyB = signalBodyB;
+            results.collisions.push_back(c);
+            
+            // Report newCollision = true only for the first contact, in case there are several contacts, and application does some logic depending on it
+            // (for example play a sound -> avoid multiple sounds being played)
+            newCollision = false;
+        }
+        
+        currentCollisions.insert(objectPair);
+    }
+
+    previousCollisions_.swap(currentCollisions);
+}
+
+void PhysicsWorld::connectNotify(const char *signal)
+{
+    QObject::connectNotify(signal);
+    hasCollisionListeners_ = receivers(SIGNAL(PhysicsCollision(Entity*, const float3&, const float3&, float, float, bool))) > 0;
+    hasBatchListeners_ = receivers(SIGNAL(PhysicsCollisions(const QVariantList&))) > 0;
+}
+
+void PhysicsWorld::disconnectNotify(const char *signal)
+{
+    QObject::disconnectNotify(signal);
+    hasCollisionListeners_ = receivers(SIGNAL(PhysicsCollision(Entity*, const float3&, const float3&, float, float, bool))) > 0;
+    hasBatchListeners_ = receivers(SIGNAL(PhysicsCollisions(const QVariantList&))) > 0;
+}
+
+void PhysicsWorld::LogInconsistencies(StepResults &results)
+{
+    if (results.numObjectsWithoutBody > 0)
+        LogError("Inconsistent Bullet physics scene state! An object exists in the physics scene which does not have an associated EC_RigidBody!");
+    if (results.numParentlessBodies > 0)
+        LogError("Inconsistent Bullet physics scene state! A parentless EC_RigidBody exists in the physics scene!");
+    results.numObjectsWithoutBody = 0;
+    results.numParentlessBodies = 0;
+}
+
 PhysicsRaycastResult* PhysicsWorld::Raycast(const float3& origin, const float3& direction, float maxdistance, int collisiongroup, int collisionmask)
 {
     PROFILE(PhysicsWorld_Raycast);
+    impl->WaitForStep();
     
     static PhysicsRaycastResult result;
     
@@ -372,6 +1477,7 @@ PhysicsRaycastResult* PhysicsWorld::Raycast(const float3& origin, const float3&
 EntityList PhysicsWorld::ObbCollisionQuery(const OBB &obb, int collisionGroup, int collisionMask)
 {
     PROFILE(PhysicsWorld_ObbCollisionQuery);
+    impl->WaitForStep();
     
     std::set<btCollisionObjectWrapper*> objects;
     EntityList entities;
@@ -402,6 +1508,136 @@ EntityList PhysicsWorld::ObbCollisionQuery(const OBB &obb, int collisionGroup, i
     return entities;
 }
 
+void PhysicsWorld::RaycastBatch(const std::vector<PhysicsRayQuery> &rays, std::vector<PhysicsQueryHit> &hits, bool parallel)
+{
+    PROFILE(PhysicsWorld_RaycastBatch);
+    impl->WaitForStep();
+
+    hits.resize(rays.size());
+    RayQueryBatch batch;
+    batch.broadphase = impl->broadphase;
+    batch.rays = &rays;
+    batch.hits = &hits;
+    RunQueries(batch, rays.size(), impl->scheduler, parallel, "PhysicsWorld_RaycastBatch");
+}
+
+void PhysicsWorld::SweepBatch(const std::vector<PhysicsSweepQuery> &sweeps, std::vector<PhysicsQueryHit> &hits, bool parallel)
+{
+    PROFILE(PhysicsWorld_SweepBatch);
+    impl->WaitForStep();
+
+    hits.resize(sweeps.size());
+    SweepQueryBatch batch;
+    batch.broadphase = impl->broadphase;
+    batch.sweeps = &sweeps;
+    batch.hits = &hits;
+    RunQueries(batch, sweeps.size(), impl->scheduler, parallel, "PhysicsWorld_SweepBatch");
+}
+
+void PhysicsWorld::OverlapBatch(const std::vector<PhysicsOverlapQuery> &queries, std::vector<Entity*> &entities, std::vector<size_t> &offsets, bool parallel)
+{
+    PROFILE(PhysicsWorld_OverlapBatch);
+    impl->WaitForStep();
+
+    std::vector<std::vector<Entity*> > results(queries.size());
+    OverlapQueryBatch batch;
+    batch.world = impl->world;
+    batch.queries = &queries;
+    batch.entities = &results;
+    RunQueries(batch, queries.size(), impl->scheduler, parallel, "PhysicsWorld_OverlapBatch");
+
+    entities.clear();
+    offsets.resize(queries.size() + 1);
+    for(size_t i = 0; i < results.size(); ++i)
+    {
+        offsets[i] = entities.size();
+        entities.insert(entities.end(), results[i].begin(), results[i].end());
+    }
+    offsets[queries.size()] = entities.size();
+}
+
+QVariantList PhysicsWorld::RaycastBatch(const QVariantList &rays, float maxDistance, int collisionGroup, int collisionMask, bool parallel)
+{
+    std::vector<PhysicsRayQuery> queries(rays.size() / 6);
+    for(size_t i = 0; i < queries.size(); ++i)
+    {
+        const int j = (int)i * 6;
+        queries[i].origin = float3(rays[j].toFloat(), rays[j + 1].toFloat(), rays[j + 2].toFloat());
+        queries[i].direction = float3(rays[j + 3].toFloat(), rays[j + 4].toFloat(), rays[j + 5].toFloat());
+        queries[i].maxDistance = maxDistance;
+        queries[i].collisionGroup = collisionGroup;
+        queries[i].collisionMask = collisionMask;
+    }
+
+    std::vector<PhysicsQueryHit> hits;
+    RaycastBatch(queries, hits, parallel);
+    QVariantList ret;
+    AppendScriptHits(hits, ret);
+    return ret;
+}
+
+QVariantList PhysicsWorld::SweepSphereBatch(const QVariantList &sweeps, float radius, int collisionGroup, int collisionMask, bool parallel)
+{
+    std::vector<PhysicsSweepQuery> queries(sweeps.size() / 6);
+    for(size_t i = 0; i < queries.size(); ++i)
+    {
+        const int j = (int)i * 6;
+        queries[i].shape = PhysicsQueryShape::Sphere(radius);
+        queries[i].from = float3(sweeps[j].toFloat(), sweeps[j + 1].toFloat(), sweeps[j + 2].toFloat());
+        queries[i].to = float3(sweeps[j + 3].toFloat(), sweeps[j + 4].toFloat(), sweeps[j + 5].toFloat());
+        queries[i].collisionGroup = collisionGroup;
+        queries[i].collisionMask = collisionMask;
+    }
+
+    std::vector<PhysicsQueryHit> hits;
+    SweepBatch(queries, hits, parallel);
+    QVariantList ret;
+    AppendScriptHits(hits, ret);
+    return ret;
+}
+
+QVariantList PhysicsWorld::OverlapSphereBatch(const QVariantList &spheres, int collisionGroup, int collisionMask, bool parallel)
+{
+    std::vector<PhysicsOverlapQuery> queries(spheres.size() / 4);
+    for(size_t i = 0; i < queries.size(); ++i)
+    {
+        const int j = (int)i * 4;
+        queries[i].shape = PhysicsQueryShape::Sphere(spheres[j + 3].toFloat());
+        queries[i].center = float3(spheres[j].toFloat(), spheres[j + 1].toFloat(), spheres[j + 2].toFloat());
+        queries[i].collisionGroup = collisionGroup;
+        queries[i].collisionMask = collisionMask;
+    }
+
+    std::vector<Entity*> entities;
+    std::vector<size_t> offsets;
+    OverlapBatch(queries, entities, offsets, parallel);
+    QVariantList ret;
+    AppendScriptOverlaps(entities, offsets, ret);
+    return ret;
+}
+
+QVariantList PhysicsWorld::OverlapBoxBatch(const QVariantList &boxes, int collisionGroup, int collisionMask, bool parallel)
+{
+    std::vector<PhysicsOverlapQuery> queries(boxes.size() / 10);
+    for(size_t i = 0; i < queries.size(); ++i)
+    {
+        const int j = (int)i * 10;
+        const float3 halfSize(boxes[j + 3].toFloat(), boxes[j + 4].toFloat(), boxes[j + 5].toFloat());
+        const Quat orientation(boxes[j + 6].toFloat(), boxes[j + 7].toFloat(), boxes[j + 8].toFloat(), boxes[j + 9].toFloat());
+        queries[i].shape = PhysicsQueryShape::Box(halfSize, orientation.Normalized());
+        queries[i].center = float3(boxes[j].toFloat(), boxes[j + 1].toFloat(), boxes[j + 2].toFloat());
+        queries[i].collisionGroup = collisionGroup;
+        queries[i].collisionMask = collisionMask;
+    }
+
+    std::vector<Entity*> entities;
+    std::vector<size_t> offsets;
+    OverlapBatch(queries, entities, offsets, parallel);
+    QVariantList ret;
+    AppendScriptOverlaps(entities, offsets, ret);
+    return ret;
+}
+
 void PhysicsWorld::SetDebugGeometryEnabled(bool enable)
 {
     if (scene_.expired() || !scene_.lock()->ViewEnabled() || IsDebugGeometryEnabled() == enable)
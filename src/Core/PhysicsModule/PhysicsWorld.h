@@ -7,13 +7,19 @@
 #include "PhysicsModuleApi.h"
 #include "PhysicsModuleFwd.h"
 #include "Math/float3.h"
+#include "Math/Quat.h"
 #include "Math/MathFwd.h"
 
 #include <set>
+#include <vector>
 #include <QObject>
 #include <QMetaType>
+#include <QPair>
+#include <QSet>
+#include <QVariant>
 
 class OgreWorld;
+class PhysicsStepTask;
 
 /// Result of a raycast to the physical representation of a scene.
 /** Other fields are valid only if entity is non-null
@@ -40,6 +46,90 @@ public:
 };
 Q_DECLARE_METATYPE(PhysicsRaycastResult*);
 
+/// A ray of a batched raycast.
+/** @sa PhysicsWorld::RaycastBatch */
+struct PhysicsRayQuery
+{
+    PhysicsRayQuery() : origin(float3::zero), direction(float3::unitZ), maxDistance(1000.f), collisionGroup(-1), collisionMask(-1) {}
+
+    float3 origin; ///< World origin position
+    float3 direction; ///< Direction to raycast to. Will be normalized automatically
+    float maxDistance; ///< Length of ray
+    int collisionGroup; ///< Collision layer. Default has all bits set.
+    int collisionMask; ///< Collision mask. Default has all bits set.
+};
+
+/// Convex shape of a batched sweep or overlap query: a sphere, or an oriented box.
+struct PhysicsQueryShape
+{
+    PhysicsQueryShape() : isBox(false), radius(0.5f), halfSize(float3::zero), orientation(Quat::identity) {}
+
+    static PhysicsQueryShape Sphere(float radius) { PhysicsQueryShape s; s.radius = radius; return s; }
+    static PhysicsQueryShape Box(const float3 &halfSize, const Quat &orientation) { PhysicsQueryShape s; s.isBox = true; s.halfSize = halfSize; s.orientation = orientation; return s; }
+
+    bool isBox; ///< Whether the shape is a box instead of a sphere
+    float radius; ///< Radius of the sphere
+    float3 halfSize; ///< Half size of the box
+    Quat orientation; ///< World orientation of the box
+};
+
+/// A convex sweep of a batched sweep query.
+/** @sa PhysicsWorld::SweepBatch */
+struct PhysicsSweepQuery
+{
+    PhysicsSweepQuery() : from(float3::zero), to(float3::zero), collisionGroup(-1), collisionMask(-1) {}
+
+    PhysicsQueryShape shape; ///< Swept shape
+    float3 from; ///< World position the shape is swept from
+    float3 to; ///< World position the shape is swept to
+    int collisionGroup; ///< Collision layer. Default has all bits set.
+    int collisionMask; ///< Collision mask. Default has all bits set.
+};
+
+/// A shape of a batched overlap query.
+/** @sa PhysicsWorld::OverlapBatch */
+struct PhysicsOverlapQuery
+{
+    PhysicsOverlapQuery() : center(float3::zero), collisionGroup(-1), collisionMask(-1) {}
+
+    PhysicsQueryShape shape; ///< Tested shape
+    float3 center; ///< World position of the shape
+    int collisionGroup; ///< Collision layer. Default has all bits set.
+    int collisionMask; ///< Collision mask. Default has all bits set.
+};
+
+/// Closest hit of a ray or a sweep of a batched query. Plain data, unlike PhysicsRaycastResult.
+/** Other fields are valid only if entity is non-null */
+struct PhysicsQueryHit
+{
+    PhysicsQueryHit() : entity(0), pos(float3::zero), normal(float3::zero), distance(0.f) {}
+
+    Entity* entity; ///< Entity that was hit, null if none
+    float3 pos; ///< World coordinates of hit position. For a sweep, the contact point.
+    float3 normal; ///< World face normal of hit.
+    float distance; ///< Distance from ray origin to the hit point. For a sweep, the distance the shape travels until the hit.
+};
+
+/// State of a rigid body, e.g. as received from the server to correct the prediction of a client.
+struct PhysicsBodyState
+{
+    PhysicsBodyState() : position(float3::zero), orientation(Quat::identity), linearVelocity(float3::zero), angularVelocity(float3::zero) {}
+
+    float3 position; ///< World position.
+    Quat orientation; ///< World orientation.
+    float3 linearVelocity; ///< Linear velocity in m/s.
+    float3 angularVelocity; ///< Angular velocity in degrees/s, like EC_RigidBody::angularVelocity.
+};
+
+/// Authoritative state of a predicted body. @sa PhysicsWorld::CorrectPrediction
+struct PhysicsBodyCorrection
+{
+    PhysicsBodyCorrection() : body(0) {}
+
+    EC_RigidBody *body;
+    PhysicsBodyState state;
+};
+
 /// A physics world that encapsulates a Bullet physics world
 class PHYSICS_MODULE_API PhysicsWorld : public QObject, public enable_shared_from_this<PhysicsWorld>
 {
@@ -49,11 +139,21 @@ class PHYSICS_MODULE_API PhysicsWorld : public QObject, public enable_shared_fro
     Q_PROPERTY(float3 gravity READ Gravity WRITE SetGravity)
     Q_PROPERTY(bool drawDebugGeometry READ IsDebugGeometryEnabled WRITE SetDebugGeometryEnabled)
     Q_PROPERTY(bool running READ IsRunning WRITE SetRunning)
+    Q_PROPERTY(bool parallel READ IsParallel WRITE SetParallel)
+    Q_PROPERTY(bool asyncStep READ IsAsyncStep WRITE SetAsyncStep)
+    Q_PROPERTY(int collisionSignalLayers READ CollisionSignalLayers WRITE SetCollisionSignalLayers)
+    Q_PROPERTY(float lodRadius READ LodRadius WRITE SetLodRadius)
+    Q_PROPERTY(bool deterministic READ IsDeterministic WRITE SetDeterministic)
 
     friend class ::PhysicsModule;
     friend class ::EC_RigidBody;
+    friend class ::PhysicsStepTask;
+    friend class ::EC_VolumeTrigger;
 
 public:
+    /// Pair of colliding objects, the one with the lower address first.
+    typedef QPair<const btCollisionObject*, const btCollisionObject*> CollisionPair;
+
     /// Constructor.
     /** @param scene Scene of which this PhysicsWorld is physical representation of.
         @param isClient Whether this physics world is for a client scene i.e. only simulates local entities' motion on their own.*/
@@ -65,13 +165,23 @@ public:
     
     /// Process collision from an internal sub-step (Bullet post-tick callback)
     void ProcessPostTick(float subStepTime);
+
+    /// Records the inputs of the predicted bodies for an internal sub-step (Bullet pre-tick callback)
+    void ProcessPreTick();
+
+    /// Returns whether a step is running in the dedicated thread. Then the Bullet callbacks must not touch the scene.
+    bool IsStepRunning() const;
+
+    /// Records the state of a body at the end of the step running in the dedicated thread, to be applied to its placeable after the step. Called from the motion state of EC_RigidBody
+    void PublishBodyState(EC_RigidBody *body, const float3 &position, const Quat &orientation, const float3 &linearVelocity, const float3 &angularVelocity);
     
     /// Dynamic scene property name
     static const char* PropertyName() { return "physics"; }
 
     /// Returns the set of collisions that occurred during the previous frame.
-    /// \important Use this function only for debugging, the availability of this set data structure is not guaranteed in the future.
-    const std::set<std::pair<const btCollisionObject*, const btCollisionObject*> > &PreviousFrameCollisions() const { return previousCollisions_; }
+    /** Only has the pairs for which collision signals are generated, see SetCollisionSignalLayers.
+        \important Use this function only for debugging, the availability of this set data structure is not guaranteed in the future. */
+    const QSet<CollisionPair> &PreviousFrameCollisions() const { return previousCollisions_; }
 
     /// Set physics update period (= length of each simulation step.) By default 1/60th of a second.
     /** @param updatePeriod Update period */
@@ -106,15 +216,143 @@ public:
     /// Return whether simulation is on
     bool IsRunning() const { return runPhysics_; }
 
+    /// Set the collision layers for which the PhysicsCollision and PhysicsCollisions signals of the world are emitted.
+    /** A contact is signaled by the world if the collision layer of either body has some of the bits. Default has all bits set.
+        Collision signals are only generated for the contacts that someone listens to: a contact is skipped
+        if neither of its rigid bodies has a PhysicsCollision listener, and no one listens to the world signals
+        or the layers of the bodies are not in these layers. */
+    void SetCollisionSignalLayers(int layers) { collisionSignalLayers_ = layers; }
+
+    /// Return the collision layers for which the collision signals of the world are emitted.
+    int CollisionSignalLayers() const { return collisionSignalLayers_; }
+
+    /// Enable/disable the multithreaded step, which runs the narrowphase and the island solving in the worker threads of UpdateScheduler.
+    /** Enabled by default with the --parallelPhysics command line parameter. The number of threads is that of the scheduler.
+        The island solving only goes parallel if Bullet is built without its profiler, see IsSolvingInParallel.
+        The multithreaded step is not deterministic, as the order of the contacts varies from run to run. */
+    void SetParallel(bool enable);
+
+    /// Return whether the multithreaded step is enabled
+    bool IsParallel() const;
+
+    /// Return whether the islands are solved in parallel, which needs the multithreaded step and Bullet built with BT_NO_PROFILE.
+    bool IsSolvingInParallel() const;
+
+    /// Enable/disable stepping the simulation in a dedicated thread, overlapped with the rest of the frame of the main thread.
+    /** Enabled by default with the --asyncPhysics command line parameter. Simulate then waits for the step started on
+        the previous frame, applies the body transforms it published to the placeables in one batch, starts the next step
+        and emits the collision and Updated signals of the finished one, while the next step runs. The scene sync thus sends
+        the results of step N while step N+1 is being simulated, and the placeables lag the bodies by one step.
+        The accessors of PhysicsWorld and EC_RigidBody wait for the running step before touching Bullet; code that uses
+        the Bullet world or bodies directly must call WaitForStep first. Disabling applies the results of the last step. */
+    void SetAsyncStep(bool enable);
+
+    /// Return whether the simulation is stepped in a dedicated thread
+    bool IsAsyncStep() const;
+
+    /// Set the radius around the observers beyond which the dynamic bodies are frozen. 0 (default) disables the physics LOD.
+    /** Enabled by default with the --physicsLod <radius> command line parameter. A frozen body is not simulated, keeps its
+        velocities and is thawed in its former activation state once an observer comes within the radius. To not toggle at
+        the edge, a body is frozen only beyond cLodFreezeFactor times the radius from every observer. The bodies are checked
+        before each step in the order of the Bullet world, so the same observer motion freezes and thaws the same bodies.
+        Nothing is frozen until the observers are set, see SetObservers. Disabling thaws all the frozen bodies. */
+    void SetLodRadius(float radius);
+
+    /// Return the radius of the physics LOD, 0 if disabled.
+    float LodRadius() const { return lodRadius_; }
+
+    /// Return the total time in seconds spent in the Bullet steps, which are one per simulated frame, including those in the dedicated thread.
+    double StepTimeTotal() const { return stepTimeTotal_; }
+
+    /// Return the number of the Bullet steps finished.
+    u64 NumSteps() const { return numSteps_; }
+
+    /// Return the number of the dynamic bodies that were active after the last finished step.
+    int NumActiveBodies() const { return numActiveBodies_; }
+
+    /// Set the world positions of the observers of the physics LOD, e.g. those of the connected users. With no observers, all dynamic bodies are frozen.
+    void SetObservers(const std::vector<float3> &positions);
+
+    /// Forget the observers, e.g. when the position of some user is not known. The physics LOD then thaws all bodies until the observers are set again.
+    void ClearObservers();
+
+    /// Return the number of bodies frozen by the physics LOD.
+    size_t NumFrozenBodies() const;
+
+    /// Ratio of the freezing distance to the thawing distance of the physics LOD.
+    static const float cLodFreezeFactor;
+
+    /// Enable/disable the deterministic mode, which steps only at the fixed update period, serially in the main thread.
+    /** The same inputs then give the same results, which the rollback of the predicted bodies relies on.
+        Enabling turns off the variable timestep, the multithreaded step and the asynchronous step. */
+    void SetDeterministic(bool enable);
+
+    /// Return whether the deterministic mode is enabled
+    bool IsDeterministic() const { return deterministic_; }
+
+    /// Set whether a body is predicted locally, e.g. one controlled by the user of a client.
+    /** A predicted body keeps a history of its inputs and states over the last cPredictionHistory steps,
+        so that CorrectPrediction can roll it back to an authoritative state and resimulate. */
+    void SetPredicted(EC_RigidBody *body, bool enable);
+
+    /// Return whether a body is predicted locally
+    bool IsPredicted(EC_RigidBody *body) const;
+
+    /// Corrects the predicted bodies with their authoritative states from stepsAgo steps ago.
+    /** The corrections within cPredictionPositionTolerance and cPredictionAngleTolerance of the predicted
+        states are ignored. Otherwise all the predicted bodies are rolled back stepsAgo steps, the corrected ones
+        to their authoritative states and the others to their own history, and the steps are resimulated with the
+        recorded forces and velocity changes. The other bodies are frozen in place while resimulating, and no
+        collision or Updated signals are emitted. A body without history that far back is moved to its
+        authoritative state as is. The deterministic mode should be enabled for the resimulation to match.
+        @return Whether the bodies were rolled back. */
+    bool CorrectPrediction(const std::vector<PhysicsBodyCorrection> &corrections, int stepsAgo);
+
+    /// Number of steps of history kept for the predicted bodies.
+    static const int cPredictionHistory = 64;
+    /// Position error in meters below which a prediction is not corrected.
+    static const float cPredictionPositionTolerance;
+    /// Orientation error in radians below which a prediction is not corrected.
+    static const float cPredictionAngleTolerance;
+
+    /// Wait until the step running in the dedicated thread, if any, is done. Call in the main thread before touching the Bullet world or bodies directly.
+    void WaitForStep();
+
     /// Return the Bullet world object
     btDiscreteDynamicsWorld* BulletWorld() const;
 
+    /// Raycasts a batch of rays, and gives the closest hit of each.
+    /** The queries of a batch are run in the worker threads of UpdateScheduler if parallel is true, there are
+        at least cMinParallelQueries of them and Bullet is built without its profiler, see IsSolvingInParallel.
+        @param rays Rays to cast
+        @param[out] hits Closest hit of each ray, in the order of the rays */
+    void RaycastBatch(const std::vector<PhysicsRayQuery> &rays, std::vector<PhysicsQueryHit> &hits, bool parallel = false);
+
+    /// Sweeps a batch of convex shapes, and gives the first hit of each. Run in parallel like RaycastBatch.
+    /** @param sweeps Shapes to sweep
+        @param[out] hits First hit of each sweep, in the order of the sweeps */
+    void SweepBatch(const std::vector<PhysicsSweepQuery> &sweeps, std::vector<PhysicsQueryHit> &hits, bool parallel = false);
+
+    /// Tests a batch of convex shapes for overlap with the rigid bodies. Run in parallel like RaycastBatch.
+    /** @param queries Shapes to test
+        @param[out] entities The entities overlapping the shapes, those of the first query first, each entity once per query
+        @param[out] offsets Index of the first entity of each query in entities, and the size of entities at the end.
+                    The entities of query i are [offsets[i], offsets[i + 1]). */
+    void OverlapBatch(const std::vector<PhysicsOverlapQuery> &queries, std::vector<Entity*> &entities, std::vector<size_t> &offsets, bool parallel = false);
+
+    /// Minimum number of queries of a batch to run in parallel.
+    static const size_t cMinParallelQueries = 32;
+
+    /// Number of values per ray or sweep given by the script versions of RaycastBatch and SweepSphereBatch.
+    static const int cScriptHitStride = 8;
+
 public slots:
     /// Return whether the physics world is for a client scene. Client scenes only simulate local entities' motion on their own.
     bool IsClient() const { return isClient_; }
 
     /// Raycast to the world. Returns only a single (the closest) result.
-    /** @param origin World origin position
+    /** For many rays, RaycastBatch is faster.
+        @param origin World origin position
         @param direction Direction to raycast to. Will be normalized automatically
         @param maxDistance Length of ray
         @param collisionGroup Collision layer. Default has all bits set.
@@ -129,6 +367,31 @@ public slots:
         @return List of entities with EC_RigidBody component intersecting the OBB */
     EntityList ObbCollisionQuery(const OBB &obb, int collisionGroup = -1, int collisionMask = -1);
 
+    /// Raycasts a batch of rays. Flat number arrays in and out, so that no objects are made per ray for scripts.
+    /** @param rays Origin x, y, z and direction x, y, z of each ray, six numbers per ray
+        @param maxDistance Length of the rays
+        @param collisionGroup Collision layer. Default has all bits set.
+        @param collisionMask Collision mask. Default has all bits set.
+        @param parallel Whether to run the rays in parallel, see RaycastBatch
+        @return Eight numbers per ray: the id of the hit entity, 0 if none, the distance, and the hit position x, y, z and normal x, y, z */
+    QVariantList RaycastBatch(const QVariantList &rays, float maxDistance, int collisionGroup = -1, int collisionMask = -1, bool parallel = false);
+
+    /// Sweeps a batch of spheres. Flat number arrays in and out, like RaycastBatch.
+    /** @param sweeps Start x, y, z and end x, y, z of each sweep, six numbers per sweep
+        @param radius Radius of the spheres
+        @return Eight numbers per sweep: the id of the hit entity, 0 if none, the distance, and the contact position x, y, z and normal x, y, z */
+    QVariantList SweepSphereBatch(const QVariantList &sweeps, float radius, int collisionGroup = -1, int collisionMask = -1, bool parallel = false);
+
+    /// Tests a batch of spheres for overlap. Flat number arrays in and out, like RaycastBatch.
+    /** @param spheres Center x, y, z and radius of each sphere, four numbers per sphere
+        @return For each sphere the number of overlapping entities, followed by their ids */
+    QVariantList OverlapSphereBatch(const QVariantList &spheres, int collisionGroup = -1, int collisionMask = -1, bool parallel = false);
+
+    /// Tests a batch of oriented boxes for overlap. Flat number arrays in and out, like RaycastBatch.
+    /** @param boxes Center x, y, z, half size x, y, z and orientation quaternion x, y, z, w of each box, ten numbers per box
+        @return For each box the number of overlapping entities, followed by their ids */
+    QVariantList OverlapBoxBatch(const QVariantList &boxes, int collisionGroup = -1, int collisionMask = -1, bool parallel = false);
+
 signals:
     /// A physics collision has happened between two entities. 
     /** Note: both rigidbodies participating in the collision will also emit a signal separately. 
@@ -142,6 +405,12 @@ signals:
         @param newCollision True if same collision did not happen on the previous frame.
                 If collision has multiple contact points, newCollision can only be true for the first of them. */
     void PhysicsCollision(Entity* entityA, Entity* entityB, const float3& position, const float3& normal, float distance, float impulse, bool newCollision);
+
+    /// The physics collisions of a simulation step, in one batch. Meant for scripts, to save a call per contact.
+    /** Emitted after the PhysicsCollision signals of the step, if there were collisions in the collision signal layers.
+        @param collisions List of maps with the entityA, entityB, position, normal, distance, impulse and newCollision
+                of each contact, as given to PhysicsCollision. */
+    void PhysicsCollisions(const QVariantList &collisions);
     
     /// Emitted before the simulation steps. Note: emitted only once per frame, not before each substep.
     /** @param frametime Length of simulation steps */
@@ -151,10 +420,57 @@ signals:
     /** @param frametime Length of simulation step */
     void Updated(float frametime);
 
+protected:
+    /// QObject overrides. Track whether the collision signals have listeners.
+    void connectNotify(const char *signal);
+    void disconnectNotify(const char *signal);
+
 private:
     /// Draw physics debug geometry, if debug drawing enabled
     void DrawDebugGeometry();
 
+    /// Enables or disables the debug geometry by the debug-enabled rigid bodies, and draws it.
+    void UpdateDebugGeometry();
+
+    /// Steps the Bullet world.
+    void Step(f64 frametime);
+
+    /// Adds the time and the active bodies of the finished step to the statistics, if a step has finished since the last call.
+    void RecordStepStatistics();
+
+    /// Freezes the dynamic bodies far from the observers and thaws the ones near, if the physics LOD is enabled.
+    void UpdateLod();
+
+    /// Thaws all the bodies frozen by the physics LOD.
+    void ThawAll();
+
+    /// Drops the recorded states and collisions of a body that is being removed.
+    void ForgetBody(EC_RigidBody *body);
+
+    /// Tracks the broadphase pairs of the body of a volume trigger. Replaces the earlier body of the trigger.
+    void RegisterTrigger(EC_VolumeTrigger *trigger, EC_RigidBody *body);
+    /// Stops tracking the pairs of a volume trigger.
+    void UnregisterTrigger(EC_VolumeTrigger *trigger);
+    /// Drops the trigger registration and the prediction history of a body component that is being deleted.
+    void ForgetComponent(EC_RigidBody *body);
+
+    /// Sets the state of a body in the Bullet world.
+    static void SetBodyState(btRigidBody *body, const PhysicsBodyState &state);
+    /// Records the states of the predicted bodies after the given step.
+    void RecordPredictedStates(u32 step);
+    /// Gives the volume triggers their pair changes, and lets them emit the enter and leave signals.
+    void UpdateTriggers();
+
+    struct StepResults;
+    /// Records the contacts of the last substep.
+    void CollectCollisions(StepResults &results);
+    /// Logs the inconsistencies of the scene met in CollectCollisions, and resets their counts.
+    void LogInconsistencies(StepResults &results);
+    /// Applies the body states recorded by the step in the dedicated thread to the placeables.
+    void ApplyBodyStates(StepResults &results);
+    /// Emits the collision and Updated signals recorded by the step in the dedicated thread.
+    void EmitStepSignals(StepResults &results);
+
     struct Impl;
     Impl *impl;
     /// Length of one physics simulation step
@@ -166,14 +482,32 @@ private:
     /// Parent scene
     SceneWeakPtr scene_;
     /// Previous frame's collisions. We store these to know whether the collision was new or "ongoing"
-    std::set<std::pair<const btCollisionObject*, const btCollisionObject*> > previousCollisions_;
+    QSet<CollisionPair> previousCollisions_;
+    /// Collision layers of the collision signals of the world
+    int collisionSignalLayers_;
+    /// Whether PhysicsCollision has listeners
+    bool hasCollisionListeners_;
+    /// Whether PhysicsCollisions has listeners
+    bool hasBatchListeners_;
+    /// Radius of the physics LOD, 0 if disabled
+    float lodRadius_;
+    /// Observer positions of the physics LOD
+    std::vector<float3> observers_;
+    /// Whether the observers of the physics LOD are known
+    bool observersKnown_;
     /// Debug geometry manually enabled/disabled (with physicsdebug console command). If true, do not automatically enable/disable debug geometry anymore
     bool drawDebugManuallySet_;
     /// Whether should run physics. Default true
     bool runPhysics_;
     /// Variable timestep flag
     bool useVariableTimestep_;
+    /// Deterministic mode flag
+    bool deterministic_;
     /// Debug draw-enabled rigidbodies. Note: these pointers are never dereferenced, it is just used for counting
     std::set<EC_RigidBody*> debugRigidBodies_;
+    /// Statistics of the finished steps
+    double stepTimeTotal_;
+    u64 numSteps_;
+    int numActiveBodies_;
 };
 Q_DECLARE_METATYPE(PhysicsWorld*);
@@ -0,0 +1,66 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#include "StableHeaders.h"
+#include "DebugOperatorNew.h"
+
+#include "TerrainHeightfieldShape.h"
+#include "EC_Terrain.h"
+
+#include <algorithm>
+#include <limits>
+
+#include "MemoryLeakCheck.h"
+
+TerrainHeightfieldShape::TerrainHeightfieldShape(const EC_Terrain *terrain, float minHeight, float maxHeight) :
+    // The height data pointer of Bullet is unused, as getRawHeightFieldValue reads the terrain
+    btHeightfieldTerrainShape(terrain->VerticesWidth(), terrain->VerticesHeight(), 0, 1.f, minHeight, maxHeight, 1, PHY_FLOAT, false),
+    terrain_(terrain)
+{
+}
+
+bool TerrainHeightfieldShape::Matches(const EC_Terrain *terrain) const
+{
+    return terrain == terrain_ && (int)terrain->VerticesWidth() == m_heightStickWidth && (int)terrain->VerticesHeight() == m_heightStickLength;
+}
+
+bool TerrainHeightfieldShape::GrowHeightRange(float minHeight, float maxHeight)
+{
+    if (minHeight >= m_minHeight && maxHeight <= m_maxHeight)
+        return false;
+
+    m_minHeight = std::min(minHeight, m_minHeight);
+    m_maxHeight = std::max(maxHeight, m_maxHeight);
+    // As in btHeightfieldTerrainShape::initialize, with the up axis Y
+    m_localAabbMin.setValue(0, m_minHeight, 0);
+    m_localAabbMax.setValue(m_width, m_maxHeight, m_length);
+    m_localOrigin = btScalar(0.5) * (m_localAabbMin + m_localAabbMax);
+    return true;
+}
+
+void TerrainHeightfieldShape::PatchHeightRange(const EC_Terrain *terrain, uint minPatchX, uint minPatchY, uint maxPatchX, uint maxPatchY, float &minHeight, float &maxHeight)
+{
+    minHeight = std::numeric_limits<float>::max();
+    maxHeight = -std::numeric_limits<float>::max();
+    if (!terrain->PatchWidth() || !terrain->PatchHeight())
+        return;
+    maxPatchX = std::min(maxPatchX, terrain->PatchWidth() - 1);
+    maxPatchY = std::min(maxPatchY, terrain->PatchHeight() - 1);
+    for(uint y = minPatchY; y <= maxPatchY; ++y)
+        for(uint x = minPatchX; x <= maxPatchX; ++x)
+        {
+            const std::vector<float> &heights = terrain->GetPatch(x, y).heightData;
+            for(size_t i = 0; i < heights.size(); ++i)
+            {
+                minHeight = std::min(minHeight, heights[i]);
+                maxHeight = std::max(maxHeight, heights[i]);
+            }
+        }
+}
+
+btScalar TerrainHeightfieldShape::getRawHeightFieldValue(int x, int y) const
+{
+    const EC_Terrain::Patch &patch = terrain_->GetPatch(x / EC_Terrain::cPatchSize, y / EC_Terrain::cPatchSize);
+    if (patch.heightData.empty())
+        return m_minHeight;
+    return patch.GetHeightValue(x % EC_Terrain::cPatchSize, y % EC_Terrain::cPatchSize);
+}
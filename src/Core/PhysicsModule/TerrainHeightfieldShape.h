@@ -0,0 +1,52 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#pragma once
+
+#include "CoreDefines.h"
+#include "CoreTypes.h"
+
+// Disable unreferenced formal parameter coming from Bullet
+#ifdef _MSC_VER
+#pragma warning(push)
+#pragma warning(disable : 4100)
+#endif
+#include <BulletCollision/CollisionShapes/btHeightfieldTerrainShape.h>
+#ifdef _MSC_VER
+#pragma warning(pop)
+#endif
+
+class EC_Terrain;
+
+/// Heightfield shape that reads the height values straight from the patches of an EC_Terrain, instead of a copy of them.
+/** Edits of the terrain are seen by the shape at once. The terrain must outlive the shape and keep its patch dimensions;
+    recreate the shape when they change, see Matches. The Bullet bounding box of the shape is given by its height range:
+    after the heights of some patches change, grow the range with PatchHeightRange and GrowHeightRange. The range only
+    grows, so the bounding box stays loose after the terrain is lowered, until the shape is recreated.
+    The terrain must not be edited while a physics step runs in a dedicated thread, see PhysicsWorld::SetAsyncStep. */
+class TerrainHeightfieldShape : public btHeightfieldTerrainShape
+{
+public:
+    /// Creates the shape over the whole terrain.
+    /** @param minHeight Lowest height value of the terrain, see EC_Terrain::GetTerrainHeightRange
+        @param maxHeight Highest height value of the terrain */
+    TerrainHeightfieldShape(const EC_Terrain *terrain, float minHeight, float maxHeight);
+
+    /// Returns whether the shape is of the given terrain and its current patch dimensions.
+    bool Matches(const EC_Terrain *terrain) const;
+
+    /// Grows the height range to include the given one. Returns true if it grew, which moves the center of the shape.
+    bool GrowHeightRange(float minHeight, float maxHeight);
+
+    float MinHeight() const { return m_minHeight; }
+    float MaxHeight() const { return m_maxHeight; }
+
+    /// Gives the height range of the loaded patches within the inclusive range of patch coordinates. Gives an empty range, min > max, if none are loaded.
+    static void PatchHeightRange(const EC_Terrain *terrain, uint minPatchX, uint minPatchY, uint maxPatchX, uint maxPatchY, float &minHeight, float &maxHeight);
+
+protected:
+    /// btHeightfieldTerrainShape override. Reads the height from the terrain patch, or gives the lowest height if the patch is not loaded.
+    btScalar getRawHeightFieldValue(int x, int y) const;
+
+private:
+    const EC_Terrain *terrain_;
+};
@@ -13,6 +13,7 @@
 #include "IAssetTypeFactory.h"
 #include "IAssetBundleTypeFactory.h"
 #include "IAssetUploadTransfer.h"
+#include "IAssetTransferPrioritizer.h"
 #include "GenericAssetFactory.h"
 #include "NullAssetFactory.h"
 #include "AssetCache.h"
@@ -24,24 +25,116 @@
 #include "Profiler.h"
 #include "CoreStringUtils.h"
 #include "FileUtils.h"
+#include "MetricsRegistry.h"
 
 #include <QDir>
+#include <QFile>
 #include <QFileSystemWatcher>
 #include <QList>
 #include <QMap>
+#include <QThreadPool>
+#include <QRunnable>
+#include <QAtomicInt>
+
+#include <algorithm>
 
 #include "MemoryLeakCheck.h"
 
+/// Reads the disk source of an asset, or gets the data of a sub asset from its bundle, and decodes it in a worker thread.
+/** If there is neither a file name nor a bundle, the data is already in memory and is only decoded.
+    Owned by AssetAPI, not by the thread pool, so that the result is there to be picked up in the main thread. */
+struct AssetAPI::BackgroundLoad : public QRunnable
+{
+    BackgroundLoad(const AssetTransferPtr &transfer_, const QString &fileName_, const AssetBundlePtr &bundle_ = AssetBundlePtr(), const QString &subAssetName_ = QString()) :
+        transfer(transfer_),
+        asset(transfer_->asset.get()),
+        fileName(fileName_),
+        bundle(bundle_),
+        subAssetName(subAssetName_)
+    {
+        setAutoDelete(false);
+    }
+
+    void run()
+    {
+        if (bundle)
+        {
+            data = bundle->GetSubAssetData(subAssetName);
+            if (data.empty())
+                error = "The sub asset does not exist in the bundle, or could not be unpacked.";
+        }
+        else if (!fileName.isEmpty())
+            ReadFile();
+        if (error.isEmpty() && !asset->DecodeInBackground(data))
+            error = "Decoding the data failed.";
+        finished.fetchAndStoreRelease(1);
+    }
+
+    void ReadFile()
+    {
+        QFile file(fileName);
+        if (!file.open(QIODevice::ReadOnly))
+            error = "Could not open the file for reading.";
+        else if (file.size() <= 0)
+            error = "The file is empty.";
+        else
+        {
+            data.resize((size_t)file.size());
+            if (file.read((char*)&data[0], file.size()) < file.size())
+                error = "Could not read the file.";
+        }
+    }
+
+    bool IsFinished() { return finished.fetchAndAddAcquire(0) != 0; }
+
+    AssetTransferPtr transfer; ///< Only touched in the main thread, keeps the asset alive.
+    const IAsset *asset; ///< The asset to decode the data with in the worker thread.
+    QString fileName; ///< The disk source to read, or the name of the bundle.
+    AssetBundlePtr bundle; ///< The bundle to get the sub asset data from, or null to read the disk source or to decode the data in memory.
+    QString subAssetName;
+    std::vector<u8> data;
+    QString error; ///< Empty if the read and decode succeeded.
+    QAtomicInt finished;
+};
+
 AssetAPI::AssetAPI(Framework *framework, bool headless) :
     fw(framework),
     isHeadless(headless),
     assetCache(0),
-    diskSourceChangeWatcher(0)
+    diskSourceChangeWatcher(0),
+    memoryBudgetTimer(0.0),
+    loadThreadPool(new QThreadPool(this)),
+    requestingCachedDependencies(false),
+    transferPrioritizer(0)
 {
     // The Asset API always understands at least this single built-in asset type "Binary".
     // You can use this type to request asset data as binary, without generating any kind of in-memory representation or loading for it.
     // Your module/component can then parse the content in a custom way.
     RegisterAssetTypeFactory(MAKE_SHARED(BinaryAssetFactory, "Binary", ""));
+
+    // The budgets are given as type=megabytes, f.ex. '--assetMemoryBudget Texture=256;OgreMesh=128'
+    foreach(const QString &param, fw->CommandLineParameters("--assetMemoryBudget"))
+        foreach(const QString &budget, param.split(';', QString::SkipEmptyParts))
+        {
+            bool ok = false;
+            qint64 megabytes = budget.section('=', 1).trimmed().toLongLong(&ok);
+            QString assetType = budget.section('=', 0, 0).trimmed();
+            if (ok && !assetType.isEmpty())
+                SetMemoryBudget(assetType, megabytes * 1024 * 1024);
+            else
+                LogWarning("AssetAPI: Malformed --assetMemoryBudget value \"" + budget + "\", expected type=megabytes.");
+        }
+
+    MetricsRegistry *metrics = fw->Metrics();
+    if (metrics->IsEnabled())
+    {
+        metrics->Describe("tundra_asset_transfers", MetricsRegistry::Gauge, "Number of the asset transfers in progress.");
+        metrics->Describe("tundra_asset_transfers_total", MetricsRegistry::Counter, "Number of the finished asset transfers by the provider and the result.");
+        metrics->Describe("tundra_assets", MetricsRegistry::Gauge, "Number of the assets in memory.");
+        metrics->Describe("tundra_asset_cache_requests_total", MetricsRegistry::Counter,
+            "Number of the requests of network assets served from the asset cache (hit) or downloaded (miss).");
+        connect(metrics, SIGNAL(Collect()), SLOT(CollectMetrics()));
+    }
 }
 
 AssetAPI::~AssetAPI()
@@ -492,6 +585,7 @@ bool AssetAPI::ForgetAsset(AssetPtr asset, bool removeDiskSource)
     if (diskSourceChangeWatcher && !asset->DiskSource().isEmpty())
         diskSourceChangeWatcher->removePath(asset->DiskSource());
     assets.erase(iter);
+    evictedAssets.erase(asset->Name());
     return true;
 }
 
@@ -608,14 +702,41 @@ AssetUploadTransferPtr AssetAPI::UploadAssetFromFile(const QString &filename, As
     if (!provider)
         throw Exception("AssetAPI::UploadAssetFromFile failed! The provider pointer of the passed destination asset storage was null!");
 
-    std::vector<u8> data;
-    bool success = LoadFileToVector(filename, data);
-    if (!success)
-        throw Exception("AssetAPI::UploadAssetFromFile failed! Could not load file to a data vector.");
-    if (data.size() == 0)
-        throw Exception("AssetAPI::UploadAssetFromFile failed! Loaded file to data vector but size is zero.");
+    shared_ptr<QFile> file = MAKE_SHARED(QFile, filename);
+    if (!file->open(QIODevice::ReadOnly))
+        throw Exception("AssetAPI::UploadAssetFromFile failed! Could not open the file for reading.");
+    if (file->size() == 0)
+        throw Exception("AssetAPI::UploadAssetFromFile failed! Opened the file but size is zero.");
 
-    return UploadAssetFromFileInMemory(&data[0], data.size(), destination, assetName);
+    AssetUploadTransferPtr transfer = UploadAssetFromDevice(file, destination, assetName);
+    if (transfer)
+        transfer->sourceFilename = filename;
+    return transfer;
+}
+
+AssetUploadTransferPtr AssetAPI::UploadAssetFromDevice(const shared_ptr<QIODevice> &device, AssetStoragePtr destination, const QString &assetName)
+{
+    if (!device || !device->isReadable())
+        throw Exception("AssetAPI::UploadAssetFromDevice failed! The passed device is null or not open for reading!");
+
+    if (assetName.isEmpty())
+        throw Exception("AssetAPI::UploadAssetFromDevice failed! No destination asset name given!");
+
+    if (!destination)
+        throw Exception("AssetAPI::UploadAssetFromDevice failed! The passed destination asset storage was null!");
+
+    if (!destination->Writable())
+        throw Exception("AssetAPI::UploadAssetFromDevice failed! The storage is not writable.");
+
+    AssetProviderPtr provider = destination->provider.lock();
+    if (!provider)
+        throw Exception("AssetAPI::UploadAssetFromDevice failed! The provider pointer of the passed destination asset storage was null!");
+
+    AssetUploadTransferPtr transfer = provider->UploadAssetFromDevice(device, destination, assetName);
+    if (transfer)
+        currentUploadTransfers[transfer->destinationStorage.lock()->GetFullAssetURL(assetName)] = transfer;
+
+    return transfer;
 }
 
 AssetUploadTransferPtr AssetAPI::UploadAssetFromFileInMemory(const QByteArray &data, const QString &storageName, const QString &assetName)
@@ -676,6 +797,9 @@ AssetUploadTransferPtr AssetAPI::UploadAssetFromFileInMemory(const u8 *data, siz
 
 void AssetAPI::ForgetAllAssets()
 {
+    AbortBackgroundLoads();
+    requestHistory.clear();
+    requestHistoryRefs.clear();
     readyTransfers.clear();
     readySubTransfers.clear();
 
@@ -690,6 +814,7 @@ void AssetAPI::ForgetAllAssets()
     while(assets.size() > 0)
         ForgetAsset(assets.begin()->second, false);
     assets.clear();
+    evictedAssets.clear();
    
     // Abort all current transfers.
     while (currentTransfers.size() > 0)
@@ -727,11 +852,27 @@ void AssetAPI::Reset()
     readyTransfers.clear();
     readySubTransfers.clear();
     assetDependencies.clear();
+    assetDependents.clear();
     currentUploadTransfers.clear();
     currentTransfers.clear();
     providers.clear();
 }
 
+void AssetAPI::SetTransferPrioritizer(IAssetTransferPrioritizer *prioritizer)
+{
+    transferPrioritizer = prioritizer;
+}
+
+float AssetAPI::TransferPriority(IAssetTransfer *transfer) const
+{
+    if (!transfer)
+        return 0.f;
+    float priority = transfer->Priority();
+    if (transferPrioritizer)
+        priority += transferPrioritizer->DerivedPriority(transfer);
+    return priority;
+}
+
 std::vector<AssetTransferPtr> AssetAPI::PendingTransfers() const
 {
     std::vector<AssetTransferPtr> transfers;
@@ -789,6 +930,9 @@ AssetTransferPtr AssetAPI::RequestAsset(QString assetRef, QString assetType, boo
     if (isSubAsset) 
         assetRef = mainAssetPart;
 
+    if (requestHistoryRefs.insert(fullAssetRef).second)
+        requestHistory.push_back(std::make_pair(fullAssetRef, assetType.isEmpty() ? GetResourceTypeFromAssetRef(fullAssetRef) : assetType));
+
     // To optimize, we first check if there is an outstanding request to the given asset. If so, we return that request. In effect, we never
     // have multiple transfers running to the same asset. Important: This must occur before checking the assets map for whether we already have the asset in memory, since
     // an asset will be stored in the AssetMap when it has been downloaded, but it might not yet have all its dependencies loaded.
@@ -847,6 +991,7 @@ AssetTransferPtr AssetAPI::RequestAsset(QString assetRef, QString assetType, boo
     if (existingAssetIter != assets.end())
     {
         existingAsset = existingAssetIter->second;
+        existingAsset->MarkUsed();
         if (!assetType.isEmpty() && assetType != existingAsset->Type())
             LogWarning("AssetAPI::RequestAsset: Tried to request asset \"" + assetRef + "\" by type \"" + assetType + "\". Asset by that name exists, but it is of type \"" + existingAsset->Type() + "\"!");
         assetType = existingAsset->Type();
@@ -886,6 +1031,32 @@ AssetTransferPtr AssetAPI::RequestAsset(QString assetRef, QString assetType, boo
         return transfer;
     }    
 
+    // An asset unloaded to stay within the memory budget of its type is reloaded from its disk source, like an asset found from the disk cache.
+    if (existingAsset && !forceTransfer && !isSubAsset)
+    {
+        std::set<QString, QStringLessThanNoCase>::iterator evictedIter = evictedAssets.find(fullAssetRef);
+        if (evictedIter != evictedAssets.end())
+        {
+            evictedAssets.erase(evictedIter);
+            if (QFile::exists(existingAsset->DiskSource()))
+            {
+                AssetTransferPtr transfer = MAKE_SHARED(VirtualAssetTransfer);
+                transfer->asset = existingAsset;
+                transfer->source.ref = assetRef;
+                transfer->assetType = assetType;
+                transfer->provider = existingAsset->AssetProvider();
+                transfer->storage = existingAsset->AssetStorage();
+                transfer->diskSourceType = existingAsset->DiskSourceType();
+                transfer->SetCachingBehavior(false, existingAsset->DiskSource());
+
+                // Unlike for a loaded asset, the transfer is tracked until the asset and its dependencies have been loaded.
+                currentTransfers[assetRef] = transfer;
+                readyTransfers.push_back(transfer);
+                return transfer;
+            }
+        }
+    }
+
     // If this is a sub asset request check if its parent bundle is already available.
     // If it is load/reload the asset data to the transfer and use the readyTransfers
     // list to do the AssetTransferCompleted callback on the next frame.
@@ -966,7 +1137,10 @@ AssetTransferPtr AssetAPI::RequestAsset(QString assetRef, QString assetType, boo
 
     // Request for a direct asset reference.
     if (!isSubAsset)
+    {
+        RequestCachedDependencies(assetRef);
         return transfer;
+    }
     // Request for a sub asset in a bundle. 
     else
     {       
@@ -1344,7 +1518,17 @@ bool AssetAPI::LoadSubAssetToTransfer(AssetTransferPtr transfer, IAssetBundle *b
     // manage with one of these, it does not need them both.
     std::vector<u8> subAssetData;
     QString subAssetDiskSource = bundle->GetSubAssetDiskSource(subAssetRef);
-    if (subAssetDiskSource.isEmpty()) 
+
+    // Get the sub asset data in a worker thread if the bundle allows it.
+    AssetBundlePtr backgroundBundle;
+    if (subAssetDiskSource.isEmpty() && bundle->IsSubAssetDataThreadSafe() && BackgroundLoadsEnabled())
+    {
+        AssetBundleMap::const_iterator bundleIter = assetBundles.find(bundle->Name());
+        if (bundleIter != assetBundles.end())
+            backgroundBundle = bundleIter->second;
+    }
+
+    if (subAssetDiskSource.isEmpty() && !backgroundBundle)
     {
         subAssetData = bundle->GetSubAssetData(subAssetRef);
         if (subAssetData.size() == 0)
@@ -1384,7 +1568,13 @@ bool AssetAPI::LoadSubAssetToTransfer(AssetTransferPtr transfer, IAssetBundle *b
     transfer->EmitAssetDownloaded();
 
     bool success = false;
-    if (subAssetData.size() > 0)
+    if (backgroundBundle)
+    {
+        // The load completes or fails in FinishBackgroundLoads.
+        StartBackgroundLoad(transfer, backgroundBundle, subAssetRef);
+        success = true;
+    }
+    else if (subAssetData.size() > 0)
         success = transfer->asset->LoadFromFileInMemory(&subAssetData[0], subAssetData.size());
     else if (!transfer->asset->DiskSource().isEmpty())
         success = transfer->asset->LoadFromFile(subAssetDiskSource);
@@ -1486,6 +1676,103 @@ void AssetAPI::Update(f64 frametime)
         }
         readySubTransfers.clear();
     }
+
+    if (!backgroundLoads.empty())
+        FinishBackgroundLoads();
+
+    if (!memoryBudgets.empty())
+    {
+        memoryBudgetTimer += frametime;
+        if (memoryBudgetTimer >= 1.0)
+        {
+            memoryBudgetTimer = 0.0;
+            EnforceMemoryBudgets();
+        }
+    }
+}
+
+void AssetAPI::SetMemoryBudget(const QString &assetType, qint64 bytes)
+{
+    if (bytes > 0)
+        memoryBudgets[assetType] = bytes;
+    else
+        memoryBudgets.erase(assetType);
+}
+
+qint64 AssetAPI::MemoryBudget(const QString &assetType) const
+{
+    std::map<QString, qint64>::const_iterator iter = memoryBudgets.find(assetType);
+    return iter != memoryBudgets.end() ? iter->second : 0;
+}
+
+qint64 AssetAPI::MemoryUsage(const QString &assetType) const
+{
+    qint64 usage = 0;
+    for(AssetMap::const_iterator iter = assets.begin(); iter != assets.end(); ++iter)
+        if (iter->second->Type() == assetType)
+            usage += (qint64)iter->second->MemoryUsage();
+    return usage;
+}
+
+bool AssetAPI::IsEvictable(const AssetPtr &asset) const
+{
+    if (asset->NumRefListeners() > 0 || asset->IsModified() || asset->DiskSource().isEmpty())
+        return false;
+    if (asset->DiskSourceType() != IAsset::Cached && asset->DiskSourceType() != IAsset::Original)
+        return false;
+    if (FindTransferIterator(asset->Name()) != currentTransfers.end())
+        return false;
+    for(size_t i = 0; i < readyTransfers.size(); ++i)
+        if (readyTransfers[i]->asset == asset)
+            return false;
+    return true;
+}
+
+void AssetAPI::EnforceMemoryBudgets()
+{
+    PROFILE(AssetAPI_EnforceMemoryBudgets);
+
+    // The assets that loaded assets depend on are not unloaded, as the dependents would be left referring to unloaded data.
+    std::set<QString, QStringLessThanNoCase> dependees;
+    for(AssetRefListMap::const_iterator iter = assetDependencies.begin(); iter != assetDependencies.end(); ++iter)
+    {
+        AssetMap::const_iterator dependent = assets.find(iter->first);
+        if (dependent != assets.end() && dependent->second->IsLoaded())
+            dependees.insert(iter->second.begin(), iter->second.end());
+    }
+
+    typedef std::map<u64, AssetPtr> AssetsByUse;
+    std::map<QString, AssetsByUse> candidates;
+    std::map<QString, qint64> usage;
+    for(AssetMap::const_iterator iter = assets.begin(); iter != assets.end(); ++iter)
+    {
+        const AssetPtr &asset = iter->second;
+        if (memoryBudgets.find(asset->Type()) == memoryBudgets.end() || !asset->IsLoaded())
+            continue;
+        usage[asset->Type()] += (qint64)asset->MemoryUsage();
+        if (IsEvictable(asset) && dependees.find(asset->Name()) == dependees.end())
+            candidates[asset->Type()][asset->LastUsed()] = asset;
+    }
+
+    for(std::map<QString, qint64>::const_iterator budget = memoryBudgets.begin(); budget != memoryBudgets.end(); ++budget)
+    {
+        qint64 &typeUsage = usage[budget->first];
+        if (typeUsage <= budget->second)
+            continue;
+
+        // The use sequence numbers are unique, so the map iterates the assets from the least recently used.
+        const AssetsByUse &assetsByUse = candidates[budget->first];
+        int numUnloaded = 0;
+        for(AssetsByUse::const_iterator iter = assetsByUse.begin(); iter != assetsByUse.end() && typeUsage > budget->second; ++iter)
+        {
+            typeUsage -= (qint64)iter->second->MemoryUsage();
+            iter->second->Unload();
+            evictedAssets.insert(iter->second->Name());
+            ++numUnloaded;
+        }
+        if (numUnloaded > 0)
+            LogDebug(QString("AssetAPI: Unloaded %1 assets of type %2 to stay within its memory budget.").arg(numUnloaded).arg(budget->first));
+    }
 }
 
 QString GuaranteeTrailingSlash(const QString &source)
@@ -1528,6 +1815,87 @@ std::map<QString, QString> ParseAssetRefArgs(const QString &url, QString *body)
     return keyValues;
 }
 
+int AssetAPI::PrefetchAssets(const AssetRefTypeList &refs)
+{
+    int numRequests = 0;
+    for(size_t i = 0; i < refs.size(); ++i)
+    {
+        QString assetRef = ResolveAssetRef("", refs[i].first);
+        if (assetRef.isEmpty() || GetAsset(assetRef) || FindTransferIterator(assetRef) != currentTransfers.end())
+            continue;
+        if (RequestAsset(assetRef, refs[i].second))
+            ++numRequests;
+    }
+    return numRequests;
+}
+
+void AssetAPI::StartBackgroundLoad(const AssetTransferPtr &transfer)
+{
+    transfer->asset->PrepareBackgroundDecode();
+    shared_ptr<BackgroundLoad> load = MAKE_SHARED(BackgroundLoad, transfer, transfer->asset->DiskSource());
+    backgroundLoads.push_back(load);
+    loadThreadPool->start(load.get());
+}
+
+void AssetAPI::StartBackgroundLoad(const AssetTransferPtr &transfer, const AssetBundlePtr &bundle, const QString &subAssetName)
+{
+    transfer->asset->PrepareBackgroundDecode();
+    shared_ptr<BackgroundLoad> load = MAKE_SHARED(BackgroundLoad, transfer, bundle->Name(), bundle, subAssetName);
+    backgroundLoads.push_back(load);
+    loadThreadPool->start(load.get());
+}
+
+void AssetAPI::StartBackgroundDecode(const AssetTransferPtr &transfer)
+{
+    transfer->asset->PrepareBackgroundDecode();
+    shared_ptr<BackgroundLoad> load = MAKE_SHARED(BackgroundLoad, transfer, QString());
+    load->data = transfer->rawAssetData; // Copied, as the provider may still refer to the data of the transfer.
+    backgroundLoads.push_back(load);
+    loadThreadPool->start(load.get());
+}
+
+bool AssetAPI::BackgroundLoadsEnabled() const
+{
+    return !fw->HasCommandLineParameter("--noAsyncAssetLoad") && !fw->HasCommandLineParameter("--no_async_asset_load");
+}
+
+void AssetAPI::FinishBackgroundLoads()
+{
+    PROFILE(AssetAPI_FinishBackgroundLoads);
+    std::list<shared_ptr<BackgroundLoad> >::iterator iter = backgroundLoads.begin();
+    while(iter != backgroundLoads.end())
+    {
+        if (!(*iter)->IsFinished())
+        {
+            ++iter;
+            continue;
+        }
+        shared_ptr<BackgroundLoad> load = *iter;
+        iter = backgroundLoads.erase(iter);
+
+        // Drop the result if the transfer was aborted or the asset forgotten while the file was being read.
+        AssetPtr asset = load->transfer->asset;
+        if (FindTransferIterator(load->transfer.get()) == currentTransfers.end() || GetAsset(asset->Name()) != asset)
+            continue;
+
+        if (!load->error.isEmpty())
+        {
+            QString source = load->fileName.isEmpty() ? QString("downloaded data") : (load->bundle ? "bundle \"" : "file \"") + load->fileName + "\"";
+            LogError("AssetAPI: Failed to load asset \"" + asset->Name() + "\" from " + source + ": " + load->error);
+            AssetLoadFailed(asset->Name());
+        }
+        // As for downloaded data, success can mean that the asset loads asynchronously and calls AssetLoadCompleted later.
+        else if (!asset->LoadFromFileInMemory(&load->data[0], load->data.size()))
+            AssetLoadFailed(asset->Name());
+    }
+}
+
+void AssetAPI::AbortBackgroundLoads()
+{
+    loadThreadPool->waitForDone();
+    backgroundLoads.clear();
+}
+
 AssetTransferMap::iterator AssetAPI::FindTransferIterator(QString assetRef)
 {
     return currentTransfers.find(assetRef);
@@ -1543,7 +1911,11 @@ AssetTransferMap::iterator AssetAPI::FindTransferIterator(IAssetTransfer *transf
     if (!transfer)
         return currentTransfers.end();
 
-    for(AssetTransferMap::iterator iter = currentTransfers.begin(); iter != currentTransfers.end(); ++iter)
+    // The transfers are usually tracked by their source ref, so look there first before going through all of them.
+    AssetTransferMap::iterator iter = currentTransfers.find(transfer->source.ref);
+    if (iter != currentTransfers.end() && iter->second.get() == transfer)
+        return iter;
+    for(iter = currentTransfers.begin(); iter != currentTransfers.end(); ++iter)
         if (iter->second.get() == transfer)
             return iter;
 
@@ -1555,7 +1927,10 @@ AssetTransferMap::const_iterator AssetAPI::FindTransferIterator(IAssetTransfer *
     if (!transfer)
         return currentTransfers.end();
 
-    for(AssetTransferMap::const_iterator iter = currentTransfers.begin(); iter != currentTransfers.end(); ++iter)
+    AssetTransferMap::const_iterator iter = currentTransfers.find(transfer->source.ref);
+    if (iter != currentTransfers.end() && iter->second.get() == transfer)
+        return iter;
+    for(iter = currentTransfers.begin(); iter != currentTransfers.end(); ++iter)
         if (iter->second.get() == transfer)
             return iter;
 
@@ -1575,6 +1950,8 @@ void AssetAPI::AssetTransferCompleted(IAssetTransfer *transfer_)
         
     AssetTransferPtr transfer = transfer_->shared_from_this(); // Elevate to a SharedPtr immediately to keep at least one ref alive of this transfer for the duration of this function call.
     //LogDebug("Transfer of asset \"" + transfer->assetType + "\", name \"" + transfer->source.ref + "\" succeeded.");
+    if (transfer->Time(IAssetTransfer::TimeDownloaded) < 0)
+        transfer->RecordTime(IAssetTransfer::TimeDownloaded);
 
     // This is a duplicated transfer to an asset that has already been previously loaded. Only signal that the asset's been loaded and finish.
     if (dynamic_cast<VirtualAssetTransfer*>(transfer_) && transfer->asset && transfer->asset->IsLoaded()) 
@@ -1666,7 +2043,10 @@ void AssetAPI::AssetTransferCompleted(IAssetTransfer *transfer_)
         // Save this asset to cache, and find out which file will represent a cached version of this asset.
         QString assetDiskSource = transfer->DiskSource(); // The asset provider may have specified an explicit filename to use as a disk source.
         if (transfer->CachingAllowed() && transfer->rawAssetData.size() > 0 && assetCache)
+        {
             assetDiskSource = assetCache->StoreAsset(&transfer->rawAssetData[0], transfer->rawAssetData.size(), transfer->source.ref);
+            transfer->RecordTime(IAssetTransfer::TimeCached);
+        }
 
         // If disksource is still empty, forcibly look up if the asset exists in the cache now.
         if (assetDiskSource.isEmpty() && assetCache)
@@ -1683,8 +2063,21 @@ void AssetAPI::AssetTransferCompleted(IAssetTransfer *transfer_)
 
         bool success = false;
         const u8 *data = (transfer->rawAssetData.size() > 0 ? &transfer->rawAssetData[0] : 0);
-        if (data)
+        if (data && transfer->asset->PreferBackgroundDecode() && FindTransferIterator(transfer.get()) != currentTransfers.end() && BackgroundLoadsEnabled())
+        {
+            // Decode the data in a worker thread. The load completes or fails in FinishBackgroundLoads.
+            StartBackgroundDecode(transfer);
+            success = true;
+        }
+        else if (data)
             success = transfer->asset->LoadFromFileInMemory(data, transfer->rawAssetData.size());
+        else if (FindTransferIterator(transfer.get()) != currentTransfers.end() && transfer->asset->AllowBackgroundLoad() &&
+            !transfer->asset->DiskSource().isEmpty() && BackgroundLoadsEnabled())
+        {
+            // Read and decode the file in a worker thread. The load completes or fails in FinishBackgroundLoads.
+            StartBackgroundLoad(transfer);
+            success = true;
+        }
         else
             success = transfer->asset->LoadFromFile(transfer->asset->DiskSource());
 
@@ -1703,6 +2096,7 @@ void AssetAPI::AssetTransferFailed(IAssetTransfer *transfer, QString reason)
         return;
         
     LogError("Transfer of asset \"" + transfer->assetType + "\", name \"" + transfer->source.ref + "\" failed! Reason: \"" + reason + "\"");
+    PROFILE_EVENT("asset", "Transfer failed " + transfer->source.ref);
 
     ///\todo In this function, there is a danger of reaching an infinite recursion. Remember recursion parents and avoid infinite loops. (A -> B -> C -> A)
 
@@ -1712,6 +2106,7 @@ void AssetAPI::AssetTransferFailed(IAssetTransfer *transfer, QString reason)
 
     // Signal any listeners that this asset transfer failed.
     transfer->EmitAssetFailed(reason);
+    RecordTransferTimings(transfer, false);
 
     // Propagate the failure of this asset transfer to all assets which depend on this asset.
     std::vector<AssetPtr> dependents = FindDependents(transfer->source.ref);
@@ -1758,6 +2153,7 @@ void AssetAPI::AssetTransferAborted(IAssetTransfer *transfer)
 void AssetAPI::AssetLoadCompleted(const QString assetRef)
 {
     PROFILE(AssetAPI_AssetLoadCompleted);
+    PROFILE_EVENT("asset", "Loaded " + assetRef);
 
     AssetPtr asset;
     AssetTransferMap::const_iterator iter = FindTransferIterator(assetRef);
@@ -1779,6 +2175,8 @@ void AssetAPI::AssetLoadCompleted(const QString assetRef)
 
     if (asset.get())
     {
+        if (iter != currentTransfers.end())
+            iter->second->RecordTime(IAssetTransfer::TimeLoaded);
         asset->LoadCompleted();
 
         // Add to watch this path for changed, note this does nothing if the path is already added
@@ -1830,6 +2228,7 @@ void AssetAPI::AssetLoadCompleted(const QString assetRef)
 
 void AssetAPI::AssetLoadFailed(const QString assetRef)
 {
+    PROFILE_EVENT("asset", "Load failed " + assetRef);
     AssetTransferMap::iterator iter = FindTransferIterator(assetRef);
     AssetMap::const_iterator iter2 = assets.find(assetRef);
 
@@ -1837,6 +2236,7 @@ void AssetAPI::AssetLoadFailed(const QString assetRef)
     {
         AssetTransferPtr transfer = iter->second;
         transfer->EmitAssetFailed("Failed to load " + transfer->assetType + " '" + transfer->source.ref + "' from asset data.");
+        RecordTransferTimings(transfer.get(), false);
         currentTransfers.erase(iter);
     }
     else if (iter2 != assets.end())
@@ -1929,6 +2329,7 @@ void AssetAPI::AssetDependenciesCompleted(AssetTransferPtr transfer)
 
     // Emit success for this transfer
     transfer->EmitTransferSucceeded();
+    RecordTransferTimings(transfer.get(), true);
 
     // This asset transfer has finished, remove it from the internal state.
     AssetTransferMap::iterator transferIter = FindTransferIterator(transfer.get());
@@ -1947,6 +2348,7 @@ void AssetAPI::NotifyAssetDependenciesChanged(AssetPtr asset)
     RemoveAssetDependencies(asset->Name());
 
     std::vector<AssetReference> refs = asset->FindReferences();
+    std::vector<QString> dependencies;
     for(size_t i = 0; i < refs.size(); ++i)
     {
         // Turn named storage (and default storage) specifiers to absolute specifiers.
@@ -1955,8 +2357,15 @@ void AssetAPI::NotifyAssetDependenciesChanged(AssetPtr asset)
             continue;
 
         // Remember this assetref for future lookup.
-        assetDependencies.push_back(std::make_pair(asset->Name(), ref));
+        dependencies.push_back(ref);
+        assetDependents[ref].push_back(asset->Name());
     }
+    if (!dependencies.empty())
+        assetDependencies[asset->Name()] = dependencies;
+
+    // Remember the dependencies of the cached data, so that they can be requested along with the asset on the next run.
+    if (assetCache)
+        assetCache->StoreDependencies(asset->Name(), refs);
 }
 
 void AssetAPI::RequestAssetDependencies(AssetPtr asset)
@@ -1965,6 +2374,7 @@ void AssetAPI::RequestAssetDependencies(AssetPtr asset)
     // Make sure we have most up-to-date internal view of the asset dependencies.
     NotifyAssetDependenciesChanged(asset);
 
+    AssetTransferPtr parentTransfer = GetPendingTransfer(asset->Name());
     std::vector<AssetReference> refs = asset->FindReferences();
     for(size_t i = 0; i < refs.size(); ++i)
     {
@@ -1976,7 +2386,15 @@ void AssetAPI::RequestAssetDependencies(AssetPtr asset)
         if (!existing || !existing->IsLoaded())
         {
 //            LogDebug("Asset " + asset->ToString() + " depends on asset " + ref.ref + " (type=\"" + ref.type + "\") which has not been loaded yet. Requesting..");
-            RequestAsset(ref);
+            AssetTransferPtr dependencyTransfer = RequestAsset(ref);
+
+            // The dependencies are needed as urgently as the asset itself
+            if (dependencyTransfer && parentTransfer)
+            {
+                if (!dependencyTransfer->Requester())
+                    dependencyTransfer->SetRequester(parentTransfer->Requester());
+                dependencyTransfer->SetPriority(std::max(dependencyTransfer->Priority(), parentTransfer->Priority()));
+            }
         }
     }
 }
@@ -1984,12 +2402,57 @@ void AssetAPI::RequestAssetDependencies(AssetPtr asset)
 void AssetAPI::RemoveAssetDependencies(QString asset)
 {
     PROFILE(AssetAPI_RemoveAssetDependencies);
-    for(size_t i = 0; i < assetDependencies.size(); ++i)
-        if (QString::compare(assetDependencies[i].first, asset, Qt::CaseInsensitive) == 0)
-        {
-            assetDependencies.erase(assetDependencies.begin() + i);
-            --i;
-        }
+    AssetRefListMap::iterator iter = assetDependencies.find(asset);
+    if (iter == assetDependencies.end())
+        return;
+
+    const std::vector<QString> &dependees = iter->second;
+    for(size_t i = 0; i < dependees.size(); ++i)
+    {
+        AssetRefListMap::iterator dependentsIter = assetDependents.find(dependees[i]);
+        if (dependentsIter == assetDependents.end())
+            continue;
+        std::vector<QString> &dependents = dependentsIter->second;
+        for(size_t j = 0; j < dependents.size(); ++j)
+            if (QString::compare(dependents[j], asset, Qt::CaseInsensitive) == 0)
+            {
+                dependents.erase(dependents.begin() + j);
+                break;
+            }
+        if (dependents.empty())
+            assetDependents.erase(dependentsIter);
+    }
+    assetDependencies.erase(iter);
+}
+
+void AssetAPI::RequestCachedDependencies(const QString &assetRef)
+{
+    if (!assetCache || requestingCachedDependencies)
+        return;
+
+    PROFILE(AssetAPI_RequestCachedDependencies);
+    // Walk the recorded graph here, so that all the dependencies are requested at once. The requests made below skip this.
+    requestingCachedDependencies = true;
+    std::set<QString, QStringLessThanNoCase> walked;
+    walked.insert(assetRef);
+    std::vector<AssetReference> unwalkedRefs = assetCache->CachedDependencies(assetRef);
+    while(!unwalkedRefs.empty())
+    {
+        AssetReference ref = unwalkedRefs.back();
+        unwalkedRefs.pop_back();
+        if (ref.ref.isEmpty() || !walked.insert(ref.ref).second)
+            continue;
+
+        // The dependencies of a loaded asset are requested by RequestAssetDependencies as usual.
+        AssetPtr existing = GetAsset(ref.ref);
+        if (existing && existing->IsLoaded())
+            continue;
+        RequestAsset(ref);
+
+        std::vector<AssetReference> refs = assetCache->CachedDependencies(ref.ref);
+        unwalkedRefs.insert(unwalkedRefs.end(), refs.begin(), refs.end());
+    }
+    requestingCachedDependencies = false;
 }
 
 std::vector<AssetPtr> AssetAPI::FindDependents(QString dependee)
@@ -1997,16 +2460,124 @@ std::vector<AssetPtr> AssetAPI::FindDependents(QString dependee)
     PROFILE(AssetAPI_FindDependents);
 
     std::vector<AssetPtr> dependents;
-    for(size_t i = 0; i < assetDependencies.size(); ++i)
+    AssetRefListMap::const_iterator dependentsIter = assetDependents.find(dependee);
+    if (dependentsIter == assetDependents.end())
+        return dependents;
+    for(size_t i = 0; i < dependentsIter->second.size(); ++i)
+    {
+        AssetMap::iterator iter = assets.find(dependentsIter->second[i]);
+        if (iter != assets.end())
+            dependents.push_back(iter->second);
+    }
+    return dependents;
+}
+
+void AssetAPI::CollectMetrics()
+{
+    MetricsRegistry *metrics = fw->Metrics();
+    metrics->Set("tundra_asset_transfers", (double)(currentTransfers.size() + readyTransfers.size()));
+    metrics->Set("tundra_assets", (double)assets.size());
+    metrics->Clear("tundra_asset_transfers_total"); // The statistics can be reset.
+    for(std::map<QString, TransferTimingStats>::const_iterator iter = transferStatsByProvider.begin(); iter != transferStatsByProvider.end(); ++iter)
     {
-        if (QString::compare(assetDependencies[i].second, dependee, Qt::CaseInsensitive) == 0)
+        const QString provider = MetricsRegistry::Label("provider", iter->first);
+        metrics->Set("tundra_asset_transfers_total", iter->second.count - iter->second.failed, provider + ",result=\"succeeded\"");
+        metrics->Set("tundra_asset_transfers_total", iter->second.failed, provider + ",result=\"failed\"");
+    }
+}
+
+void AssetAPI::RecordTransferTimings(IAssetTransfer *transfer, bool succeeded)
+{
+    // The transfers to assets that were already loaded only measure the frame they waited for.
+    if (succeeded && transfer->Time(IAssetTransfer::TimeLoaded) < 0)
+        return;
+
+    const int cMaxRecentTransferTimings = 500;
+    TransferTimingRecord record;
+    record.ref = transfer->source.ref;
+    record.type = transfer->assetType;
+    AssetProviderPtr provider = transfer->provider.lock();
+    record.provider = provider ? provider->Name() : QString();
+    record.succeeded = succeeded;
+    for(int i = 0; i < IAssetTransfer::NumTimingPoints; ++i)
+        record.times.push_back(transfer->Time((IAssetTransfer::TimingPoint)i));
+
+    TransferTimingStats *stats[] = { &transferStatsByProvider[record.provider], &transferStatsByType[record.type] };
+    for(size_t i = 0; i < sizeof(stats) / sizeof(stats[0]); ++i)
+    {
+        stats[i]->stageTotals.resize(IAssetTransfer::NumTimingPoints, 0);
+        ++stats[i]->count;
+        if (!succeeded)
+            ++stats[i]->failed;
+        for(int j = IAssetTransfer::TimeStarted; j < IAssetTransfer::NumTimingPoints; ++j)
+            stats[i]->stageTotals[j] += transfer->StageDuration((IAssetTransfer::TimingPoint)j);
+    }
+
+    recentTransferTimings.push_back(record);
+    if ((int)recentTransferTimings.size() > cMaxRecentTransferTimings)
+        recentTransferTimings.pop_front();
+}
+
+QVariantList AssetAPI::TransferStatistics() const
+{
+    QVariantList statistics;
+    const std::map<QString, TransferTimingStats> *groups[] = { &transferStatsByProvider, &transferStatsByType };
+    const char *groupNames[] = { "provider", "type" };
+    for(int i = 0; i < 2; ++i)
+        for(std::map<QString, TransferTimingStats>::const_iterator iter = groups[i]->begin(); iter != groups[i]->end(); ++iter)
         {
-            AssetMap::iterator iter = assets.find(assetDependencies[i].first);
-            if (iter != assets.end())
-                dependents.push_back(iter->second);
+            const TransferTimingStats &stats = iter->second;
+            QVariantMap entry;
+            entry["group"] = groupNames[i];
+            entry["name"] = iter->first;
+            entry["count"] = stats.count;
+            entry["failed"] = stats.failed;
+            double total = 0.0;
+            for(int j = IAssetTransfer::TimeStarted; j < IAssetTransfer::NumTimingPoints; ++j)
+            {
+                double average = (double)stats.stageTotals[j] / std::max(stats.count, 1);
+                entry[IAssetTransfer::StageName((IAssetTransfer::TimingPoint)j)] = average;
+                total += average;
+            }
+            entry["total"] = total;
+            statistics << entry;
         }
+    return statistics;
+}
+
+QVariantList AssetAPI::RecentTransferTimings() const
+{
+    QVariantList timings;
+    for(std::list<TransferTimingRecord>::const_iterator iter = recentTransferTimings.begin(); iter != recentTransferTimings.end(); ++iter)
+    {
+        QVariantMap entry;
+        entry["ref"] = iter->ref;
+        entry["type"] = iter->type;
+        entry["provider"] = iter->provider;
+        entry["succeeded"] = iter->succeeded;
+        QVariantList times;
+        for(size_t i = 0; i < iter->times.size(); ++i)
+            times << iter->times[i];
+        entry["times"] = times;
+        timings << entry;
     }
-    return dependents;
+    return timings;
+}
+
+void AssetAPI::ResetTransferStatistics()
+{
+    transferStatsByProvider.clear();
+    transferStatsByType.clear();
+    recentTransferTimings.clear();
+}
+
+AssetAPI::AssetDependenciesMap AssetAPI::DebugGetAssetDependencies() const
+{
+    AssetDependenciesMap dependencies;
+    for(AssetRefListMap::const_iterator iter = assetDependencies.begin(); iter != assetDependencies.end(); ++iter)
+        for(size_t i = 0; i < iter->second.size(); ++i)
+            dependencies.push_back(std::make_pair(iter->first, iter->second[i]));
+    return dependencies;
 }
 
 int AssetAPI::NumPendingDependencies(AssetPtr asset) const
@@ -2089,8 +2660,10 @@ bool AssetAPI::HasPendingDependencies(AssetPtr asset) const
     return false;
 }
 
-void AssetAPI::HandleAssetDiscovery(const QString &assetRef, const QString &assetType)
+void AssetAPI::HandleAssetDiscovery(const QString &assetRef, const QString &assetType, const QString &contentHash)
 {
+    if (!contentHash.isEmpty() && assetCache)
+        assetCache->StoreAlias(assetRef, contentHash);
     HandleAssetDiscovery(assetRef, assetType, AssetStoragePtr());
 }
 
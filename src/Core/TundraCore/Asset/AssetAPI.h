@@ -9,11 +9,16 @@
 #include "IAssetStorage.h"
 
 #include <QObject>
+#include <QVariant>
 #include <vector>
 #include <utility>
 #include <map>
+#include <set>
+#include <list>
 
 class QFileSystemWatcher;
+class QThreadPool;
+class QIODevice;
 
 /// Loads the given local file into the specified vector. Clears all data previously in the vector.
 /// Returns true on success.
@@ -40,6 +45,7 @@ typedef std::map<QString, AssetTransferPtr, QStringLessThanNoCase> AssetTransfer
 typedef std::map<QString, AssetBundleMonitorPtr, QStringLessThanNoCase> AssetBundleMonitorMap;
 
 typedef std::vector<AssetStoragePtr> AssetStorageVector;
+typedef std::vector<std::pair<QString, QString> > AssetRefTypeList; ///< Pairs of asset references and asset types.
 
 /// Implements asset download and upload functionality.
 class TUNDRACORE_API AssetAPI : public QObject
@@ -76,6 +82,26 @@ public:
     /// Returns all the currently ongoing or waiting asset transfers.
     std::vector<AssetTransferPtr> PendingTransfers() const;
 
+    /// Sets the object that derives priorities for the asset transfers from their requesters, or null to use the explicit priorities only.
+    /** The caller retains ownership, and must unset the prioritizer before deleting it. */
+    void SetTransferPrioritizer(IAssetTransferPrioritizer *prioritizer);
+
+    /// Returns the transfer prioritizer, or null if none is set.
+    IAssetTransferPrioritizer *TransferPrioritizer() const { return transferPrioritizer; }
+
+    /// Returns the effective priority of a transfer: its explicit priority plus the priority derived by the transfer prioritizer.
+    /** Asset providers that queue their transfers, like HttpAssetProvider, start the queued transfers of the highest effective priority first. */
+    float TransferPriority(IAssetTransfer *transfer) const;
+
+    /// Returns the assets requested during the session, in the order of their first request, as pairs of asset reference and type.
+    /** The server sends these to the joining clients as a prefetch manifest, see PrefetchAssets. Cleared by ForgetAllAssets. */
+    const AssetRefTypeList &RequestHistory() const { return requestHistory; }
+
+    /// Requests the given assets that are neither known nor being transferred, in the given order. Returns the number of requests made.
+    /** Used to start the downloads of the assets a session is known to need before the scene refers to them,
+        f.ex. those of the manifest the server sends at login. */
+    int PrefetchAssets(const AssetRefTypeList &refs);
+
     /// Performs internal tick-based updates of the whole asset system.
     /** This function is intended to be called only by the core, do not call it yourself. */
     void Update(f64 frametime);
@@ -171,6 +197,13 @@ public:
 
     Framework *GetFramework() const { return fw; }
 
+    /// Returns all assets known to the asset system without copying the map, for C++ code that only iterates it.
+    /** @note Don't create or forget assets while iterating the map, as that modifies it. Scripts use Assets. */
+    const AssetMap &AllAssets() const { return assets; }
+
+    /// Returns all asset bundles known to the asset system without copying the map, see AllAssets.
+    const AssetBundleMap &AllAssetBundles() const { return assetBundles; }
+
     // DEPRECATED
     bool IsAssetTypeFactoryRegistered(const QString &typeName) const { return AssetTypeFactory(typeName) != 0; } /**< @deprecated Use AssetTypeFactory. @todo Remove. */
     std::vector<AssetProviderPtr> GetAssetProviders() const { return AssetProviders(); }  /**< @deprecated Use AssetProviders instead @todo Add warning print in some distant future */
@@ -345,7 +378,9 @@ public slots:
     AssetUploadTransferPtr UploadAssetFromFile(const QString &filename, const QString &storageName, const QString &assetName = "");
 
     /// Uploads an asset to an asset storage.
-    /** @param filename The source file to load the asset from.
+    /** The file is streamed to the storage with UploadAssetFromDevice, so it is not read to memory as a whole
+        if the provider of the storage supports streaming.
+        @param filename The source file to load the asset from.
         @param destination The asset storage to upload the asset to.
         @param assetName The name to give to the asset in the storage.
         @return The returned IAssetUploadTransfer pointer represents the ongoing asset upload process.
@@ -353,6 +388,17 @@ public slots:
         @note This function will never return 0, but instead will throw Exception (CoreException.h) if passed data is invalid. */
     AssetUploadTransferPtr UploadAssetFromFile(const QString &filename, AssetStoragePtr destination, const QString &assetName);
 
+    /// Uploads an asset by streaming its data from the given device to an asset storage.
+    /** HttpAssetProvider sends the data in parallel parts to the storages that support partial uploads, and otherwise
+        in a single streamed PUT. The other providers read all the data to memory first.
+        @param device The device to read the data from. It must be open for reading. The upload keeps a reference to it until it is done.
+        @param destination The asset storage to upload the asset to.
+        @param assetName The name to give to the asset in the storage.
+        @return The returned IAssetUploadTransfer pointer represents the ongoing asset upload process. Its ProgressChanged signal reports the bytes sent.
+
+        @note This function will never return 0, but instead will throw Exception (CoreException.h) if passed data is invalid. */
+    AssetUploadTransferPtr UploadAssetFromDevice(const shared_ptr<QIODevice> &device, AssetStoragePtr destination, const QString &assetName);
+
     /// Uploads an asset from the given data in memory to an asset storage.
     /** @param data A QByteArray that has the uploaded data.
         @param destination The asset storage to upload the asset to.
@@ -379,6 +425,22 @@ public slots:
         @note Do not dereference any asset pointers that might have been left over after calling this function. */
     void ForgetAllAssets();
 
+    /// Sets the memory budget of the loaded assets of a type.
+    /** When the loaded assets of the type take more memory than the budget, see IAsset::MemoryUsage, the least recently used of them
+        that no AssetRefListener refers to are unloaded until the type is within its budget. An unloaded asset stays known to the
+        Asset API, and is reloaded from its disk source when it is requested again. Only the assets that have a cached or original
+        disk source, are not modified in memory and no loaded asset depends on are unloaded. The budgets are checked once a second.
+        The budgets can also be set with the --assetMemoryBudget command line parameter.
+        @param assetType The asset type, e.g. "Texture".
+        @param bytes The budget in bytes, or 0 to remove the budget of the type. */
+    void SetMemoryBudget(const QString &assetType, qint64 bytes);
+
+    /// Returns the memory budget of an asset type in bytes, or 0 if the type has no budget.
+    qint64 MemoryBudget(const QString &assetType) const;
+
+    /// Returns the total estimated memory usage of the loaded assets of a type in bytes.
+    qint64 MemoryUsage(const QString &assetType) const;
+
     /// Cleans up everything in the Asset API.
     /** Forgets all assets, kills all asset transfers, frees all storages, providers, and type factories.
         Deletes the asset cache and the disk watcher. */
@@ -404,7 +466,9 @@ public slots:
     bool HasPendingDependencies(AssetPtr asset) const;
 
     /// Handle discovery of a new asset through the AssetDiscovery network message
-    void HandleAssetDiscovery(const QString &assetRef, const QString &assetType);
+    /** @param contentHash Content hash of the asset data advertised by the sender, or empty. If the asset cache has a blob
+        with the hash, the ref is mapped to it, and the data is not downloaded again. @sa AssetCache::StoreAlias */
+    void HandleAssetDiscovery(const QString &assetRef, const QString &assetType, const QString &contentHash = "");
 
     /// Handle deletion of an asset through the AssetDeleted network message
     void HandleAssetDeleted(const QString &assetRef);
@@ -422,11 +486,25 @@ public slots:
     size_t NumCurrentTransfers() const { return currentTransfers.size(); }
     
     /// Return the current asset dependency map (debugging)
-    const AssetDependenciesMap& DebugGetAssetDependencies() const { return assetDependencies; }
+    AssetDependenciesMap DebugGetAssetDependencies() const;
     
     /// Return ready asset transfers (debugging)
     const std::vector<AssetTransferPtr>& DebugGetReadyTransfers() const { return readyTransfers; }
 
+    /// Returns the asset pipeline statistics of the finished transfers, aggregated per provider and per asset type.
+    /** Each entry of the list is a map with "group" ("provider" or "type"), "name", "count", "failed", and the average
+        milliseconds of each stage by IAssetTransfer::StageName, and of the whole transfer as "total".
+        The transfers to assets that were already loaded are not counted. */
+    QVariantList TransferStatistics() const;
+
+    /// Returns the timings of the latest finished transfers, the oldest first, e.g. for a waterfall view.
+    /** Each entry of the list is a map with "ref", "type", "provider", "succeeded", and "times", a list of the times of
+        the IAssetTransfer::TimingPoints in milliseconds since the epoch, or -1 for the points that were not recorded. */
+    QVariantList RecentTransferTimings() const;
+
+    /// Clears the transfer statistics and timings.
+    void ResetTransferStatistics();
+
     // DEPRECATED
     AssetMap GetAllAssets() const { return Assets(); } /**< @deprecated Use Assets instead @todo Add warning print in some distant future */
     AssetMap GetAllAssetsOfType(const QString& type) const { return AssetsOfType(type); } /**< @deprecated Use AssetsOfType instead @todo Add warning print in some distant future */
@@ -498,6 +576,9 @@ private slots:
     /// Listens to the IAssetBundle Failed signal.
     void AssetBundleLoadFailed(IAssetBundle *bundle);
 
+    /// Sets the metrics of the transfers and the loaded assets, see MetricsRegistry::Collect.
+    void CollectMetrics();
+
 private:
     AssetTransferMap::iterator FindTransferIterator(QString assetRef);
     AssetTransferMap::const_iterator FindTransferIterator(QString assetRef) const;
@@ -505,9 +586,13 @@ private:
     AssetTransferMap::iterator FindTransferIterator(IAssetTransfer *transfer);
     AssetTransferMap::const_iterator FindTransferIterator(IAssetTransfer *transfer) const;
 
-    /// Removes from AssetDependenciesMap all dependencies the given asset has.
+    /// Removes all the dependencies the given asset has.
     void RemoveAssetDependencies(QString asset);
 
+    /// Requests the dependencies, and their dependencies and so on, recorded in the asset cache for the asset when it was last loaded.
+    /** Called when a new transfer is started, so that the whole dependency graph is downloaded at once instead of one level at a time. */
+    void RequestCachedDependencies(const QString &assetRef);
+
     /// Handle discovery of a new asset, when the storage is already known. This is used internally for optimization, so that providers don't need to be queried
     void HandleAssetDiscovery(const QString &assetRef, const QString &assetType, AssetStoragePtr storage);
     
@@ -520,6 +605,34 @@ private:
     /// Overload that takes in AssetBundlePtr instead of refs.
     bool LoadSubAssetToTransfer(AssetTransferPtr transfer, IAssetBundle *bundle, const QString &fullSubAssetRef, QString subAssetType = QString());
 
+    /// Unloads the least recently used assets of the types that exceed their memory budget.
+    void EnforceMemoryBudgets();
+
+    /// Returns whether the asset can be unloaded to stay within the memory budget of its type, and be reloaded from its disk source.
+    bool IsEvictable(const AssetPtr &asset) const;
+
+    /// Reads the disk source of the asset of the transfer, and decodes it with IAsset::DecodeInBackground, in a worker thread.
+    /** The asset is deserialized in FinishBackgroundLoads once the read is done. */
+    void StartBackgroundLoad(const AssetTransferPtr &transfer);
+
+    /// Gets the data of a sub asset from its bundle, and decodes it with IAsset::DecodeInBackground, in a worker thread.
+    void StartBackgroundLoad(const AssetTransferPtr &transfer, const AssetBundlePtr &bundle, const QString &subAssetName);
+
+    /// Decodes the downloaded data of the transfer with IAsset::DecodeInBackground in a worker thread.
+    void StartBackgroundDecode(const AssetTransferPtr &transfer);
+
+    /// Returns whether the background loads are enabled, i.e. the --noAsyncAssetLoad command line parameter is not given.
+    bool BackgroundLoadsEnabled() const;
+
+    /// Deserializes the assets whose background reads have finished, in the order they were started.
+    void FinishBackgroundLoads();
+
+    /// Waits for the background reads to finish and discards their results.
+    void AbortBackgroundLoads();
+
+    /// Adds the timings of a finished transfer to the transfer statistics.
+    void RecordTransferTimings(IAssetTransfer *transfer, bool succeeded);
+
     bool isHeadless;
 
     /// Stores all the currently ongoing asset transfers.
@@ -532,9 +645,16 @@ private:
     /// Stores all the currently ongoing asset uploads, maps full assetRefs to the asset upload transfer structures.
     AssetUploadTransferMap currentUploadTransfers;
 
-    /// Keeps track of all the dependencies each asset has to each other asset.
-    /// \todo Find a more effective data structure for this. Needs something like boost::bimap but for multi-indices.
-    AssetDependenciesMap assetDependencies;
+    typedef std::map<QString, std::vector<QString>, QStringLessThanNoCase> AssetRefListMap;
+
+    /// The refs of the assets each asset depends on, by the name of the dependent asset.
+    AssetRefListMap assetDependencies;
+
+    /// The names of the assets that depend on each asset, by the ref of the dependee. The reverse of assetDependencies.
+    AssetRefListMap assetDependents;
+
+    /// Whether RequestCachedDependencies is in progress, so that the requests it makes do not walk the graph again.
+    bool requestingCachedDependencies;
 
     /// Stores a list of asset requests to assets that have already been downloaded into the system. These requests don't go to the asset providers
     /// to process, but are internally filled by the Asset API. This member vector is needed to be able to delay the requests and virtual completions
@@ -573,6 +693,51 @@ private:
     /// Stores all the already loaded asset bundles in the system.
     AssetBundleMap assetBundles;
 
+    /// Memory budgets in bytes by asset type.
+    std::map<QString, qint64> memoryBudgets;
+
+    /// Names of the assets unloaded to stay within the memory budgets. These are reloaded from their disk source when requested.
+    std::set<QString, QStringLessThanNoCase> evictedAssets;
+
+    /// Time since the memory budgets were last checked, in seconds.
+    f64 memoryBudgetTimer;
+
+    /// The assets requested during the session, in the order of their first request.
+    AssetRefTypeList requestHistory;
+
+    /// The references in requestHistory, for detecting the repeated requests.
+    std::set<QString, QStringLessThanNoCase> requestHistoryRefs;
+
+    /// Sums of the stage timings of the finished transfers of a provider or an asset type.
+    struct TransferTimingStats
+    {
+        TransferTimingStats() : count(0), failed(0) {}
+        int count;
+        int failed;
+        std::vector<qint64> stageTotals; ///< Total milliseconds of each stage, by IAssetTransfer::TimingPoint.
+    };
+    std::map<QString, TransferTimingStats> transferStatsByProvider;
+    std::map<QString, TransferTimingStats> transferStatsByType;
+
+    /// The timings of a finished transfer.
+    struct TransferTimingRecord
+    {
+        QString ref;
+        QString type;
+        QString provider;
+        bool succeeded;
+        std::vector<qint64> times; ///< By IAssetTransfer::TimingPoint.
+    };
+    /// The latest finished transfers, the oldest first.
+    std::list<TransferTimingRecord> recentTransferTimings;
+
+    struct BackgroundLoad;
+    /// The background reads that have not been finished yet, in the order they were started.
+    std::list<shared_ptr<BackgroundLoad> > backgroundLoads;
+
+    /// Runs the background reads. Owned by this object.
+    QThreadPool *loadThreadPool;
+
     /// Tracks all loaded assets if their DiskSources change, and issues a reload of the assets.
     QFileSystemWatcher *diskSourceChangeWatcher;
 
@@ -581,6 +746,7 @@ private:
 
     Framework *fw;
     AssetCache *assetCache;
+    IAssetTransferPrioritizer *transferPrioritizer;
 };
 
 #include "AssetAPI.inl"
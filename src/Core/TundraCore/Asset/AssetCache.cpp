@@ -6,6 +6,7 @@
 #include "AssetCache.h"
 #include "AssetAPI.h"
 #include "IAsset.h"
+#include "OgreMeshBounds.h"
 
 #include "CoreDefines.h"
 #include "Framework.h"
@@ -17,11 +18,14 @@
 #include <QDataStream>
 #include <QFileInfo>
 #include <QScopedPointer>
+#include <QCryptographicHash>
+#include <QTextStream>
+#include <QStringList>
+#include <QCoreApplication>
 
 #ifdef Q_WS_WIN
 #include "Win.h"
 #else
-#include <sys/stat.h>
 #include <utime.h>
 #endif
 
@@ -29,9 +33,11 @@
 
 AssetCache::AssetCache(AssetAPI *owner, QString assetCacheDirectory) : 
     assetAPI(owner),
-    cacheDirectory(GuaranteeTrailingSlash(QDir::fromNativeSeparators(assetCacheDirectory)))
+    cacheDirectory(GuaranteeTrailingSlash(QDir::fromNativeSeparators(assetCacheDirectory))),
+    shared(owner->GetFramework()->HasCommandLineParameter("--sharedAssetCache")),
+    contentIndexReadPos(0)
 {
-    LogInfo("* Asset cache directory  : " + QDir::toNativeSeparators(cacheDirectory));  
+    LogInfo("* Asset cache directory  : " + QDir::toNativeSeparators(cacheDirectory) + (shared ? " (shared)" : ""));
 
     // Check that the main directory exists
     QDir assetDir(cacheDirectory);
@@ -48,6 +54,19 @@ AssetCache::AssetCache(AssetAPI *owner, QString assetCacheDirectory) :
     if (!assetDir.exists("data"))
         assetDir.mkdir("data");
     assetDataDir = QDir(cacheDirectory + "data");
+    if (!assetDir.exists("blobs"))
+        assetDir.mkdir("blobs");
+    blobDir = QDir(cacheDirectory + "blobs");
+    contentIndexPath = cacheDirectory + "contentindex.txt";
+    LoadContentIndex();
+    if (!assetDir.exists("partial"))
+        assetDir.mkdir("partial");
+    partialDir = QDir(cacheDirectory + "partial");
+    if (!partialDir.exists("validators"))
+        partialDir.mkdir("validators");
+    // Several processes could write the partial data of the same ref at once.
+    if (!shared)
+        LoadPartials();
 
     // Check --clearAssetCache start param
     if (owner->GetFramework()->HasCommandLineParameter("--clearAssetCache") ||
@@ -58,20 +77,76 @@ AssetCache::AssetCache(AssetAPI *owner, QString assetCacheDirectory) :
     }
 }
 
+QString AssetCache::ComputeContentHash(const u8 *data, size_t numBytes)
+{
+    QByteArray bytes = QByteArray::fromRawData((const char *)data, (int)numBytes);
+    return QString::fromLatin1(QCryptographicHash::hash(bytes, QCryptographicHash::Sha1).toHex());
+}
+
+AssetCache::FileInfo AssetCache::ReadFileInfo(const QFileInfo &file)
+{
+    FileInfo info;
+    info.size = file.size();
+    info.lastModified = file.lastModified().toMSecsSinceEpoch() / 1000;
+    return info;
+}
+
+QString AssetCache::FindFile(const QString &key, FileInfo *info) const
+{
+    QHash<QString, ContentEntry>::const_iterator it = contentIndex.find(key);
+    if (it != contentIndex.end())
+    {
+        QHash<QString, FileInfo>::const_iterator blob = blobs.find(it->blobName);
+        if (blob != blobs.end())
+        {
+            if (info)
+                *info = *blob;
+            return BlobPath(it->blobName);
+        }
+    }
+
+    // Files cached by earlier versions are under the sanitized ref
+    QHash<QString, FileInfo>::const_iterator legacy = legacyFiles.find(key);
+    if (legacy != legacyFiles.end())
+    {
+        if (info)
+            *info = *legacy;
+        return assetDataDir.absolutePath() + "/" + key;
+    }
+    return "";
+}
+
 QString AssetCache::FindInCache(const QString &assetRef)
 {
-    QString absolutePath = GetDiskSourceByRef(assetRef);
-    if (QFile::exists(absolutePath))
-        return absolutePath;
-    else // The file is not in cache, return an empty string to denote that.
-        return "";
+    // If the file is not in cache, an empty string is returned to denote that.
+    QString key = AssetAPI::SanitateAssetRef(assetRef);
+    QString path = FindFile(key, 0);
+    if (path.isEmpty() && shared)
+    {
+        // Another process may have cached it since.
+        RefreshContentIndex();
+        path = FindFile(key, 0);
+    }
+    return path;
+}
+
+qint64 AssetCache::SizeInCache(const QString &assetRef) const
+{
+    FileInfo info;
+    if (FindFile(AssetAPI::SanitateAssetRef(assetRef), &info).isEmpty())
+        return -1;
+    return info.size;
 }
 
 QString AssetCache::GetDiskSourceByRef(const QString &assetRef)
 {
-    // Return the path where the given asset ref would be stored, if it was saved in the cache
-    // (regardless of whether it now exists in the cache).
-    return assetDataDir.absolutePath() + "/" + AssetAPI::SanitateAssetRef(assetRef);
+    // Return the path where the given asset ref is stored, if it is in the content index,
+    // or the path where an earlier version would have stored it (regardless of whether it now exists in the cache).
+    QString key = AssetAPI::SanitateAssetRef(assetRef);
+    QHash<QString, ContentEntry>::const_iterator it = contentIndex.find(key);
+    if (it != contentIndex.end())
+        return BlobPath(it->blobName);
+    return assetDataDir.absolutePath() + "/" + key;
 }
 
 QString AssetCache::CacheDirectory() const
@@ -88,64 +163,554 @@ QString AssetCache::StoreAsset(AssetPtr asset)
 
 QString AssetCache::StoreAsset(const u8 *data, size_t numBytes, const QString &assetName)
 {
-    QString absolutePath = GetDiskSourceByRef(assetName);
-    bool success = SaveAssetFromMemoryToFile(data, numBytes, absolutePath);
-    if (success)
-        return absolutePath;
-    return "";
+    QString key = AssetAPI::SanitateAssetRef(assetName);
+    // Keep the suffix of the ref, as some loaders look at the suffix of the disk source
+    QString suffix = QFileInfo(key).suffix();
+    ContentEntry entry;
+    entry.blobName = ComputeContentHash(data, numBytes);
+    if (!suffix.isEmpty() && suffix.length() <= 8)
+        entry.blobName += "." + suffix;
+
+    QString blobPath = BlobPath(entry.blobName);
+    if (!blobs.contains(entry.blobName))
+    {
+        // Write to a temporary file and rename it in place, so that a blob is never seen partially written,
+        // by another process sharing the cache or after a crash.
+        QString tempPath = blobPath + ".tmp" + QString::number(QCoreApplication::applicationPid());
+        if (!SaveAssetFromMemoryToFile(data, numBytes, tempPath))
+            return "";
+        if (!QFile::rename(tempPath, blobPath))
+        {
+            // The rename fails if the blob exists, when another process has just stored the same data.
+            QFile::remove(tempPath);
+            if (!QFile::exists(blobPath))
+            {
+                LogWarning("AssetCache::StoreAsset: Failed to rename the stored data of " + assetName + " to " + blobPath);
+                return "";
+            }
+        }
+        FileInfo info;
+        info.size = (qint64)numBytes;
+        info.lastModified = QDateTime::currentMSecsSinceEpoch() / 1000;
+        blobs[entry.blobName] = info;
+    }
+    SetContentEntry(key, entry);
+    verifiedRefs.remove(key);
+
+    // The file cached under the ref by an earlier version is superseded by the blob
+    if (legacyFiles.remove(key) > 0)
+        QFile::remove(assetDataDir.absolutePath() + "/" + key);
+    return blobPath;
 }
 
-QDateTime AssetCache::LastModified(const QString &assetRef)
+QString AssetCache::ContentHash(const QString &assetRef) const
 {
-    QString absolutePath = FindInCache(assetRef);
-    if (absolutePath.isEmpty())
-        return QDateTime();
+    QHash<QString, ContentEntry>::const_iterator it = contentIndex.find(AssetAPI::SanitateAssetRef(assetRef));
+    return it != contentIndex.end() ? HashOfBlob(it->blobName) : QString();
+}
 
-#ifdef Q_WS_WIN
-    HANDLE fileHandle = (HANDLE)OpenFileHandle(absolutePath);
-    if (fileHandle == INVALID_HANDLE_VALUE)
+QString AssetCache::FindByContentHash(const QString &contentHash) const
+{
+    QString blobName = blobsByHash.value(contentHash.toLower());
+    return !blobName.isEmpty() ? BlobPath(blobName) : "";
+}
+
+bool AssetCache::StoreAlias(const QString &assetRef, const QString &contentHash)
+{
+    QString hash = contentHash.toLower();
+    QString key = AssetAPI::SanitateAssetRef(assetRef);
+    QHash<QString, ContentEntry>::const_iterator it = contentIndex.find(key);
+    if (it == contentIndex.end() || HashOfBlob(it->blobName) != hash)
     {
-        LogError("AssetCache: Failed to open cache file to read last modified time: " + assetRef);
-        return QDateTime();
+        if (shared && !blobsByHash.contains(hash))
+            RefreshContentIndex();
+        QString blobName = blobsByHash.value(hash);
+        if (blobName.isEmpty())
+            return false;
+        ContentEntry entry;
+        entry.blobName = blobName;
+        SetContentEntry(key, entry);
     }
+    verifiedRefs.insert(key);
+    return true;
+}
 
-    // Get last write time.
-    FILETIME fileTime;
-    BOOL success = GetFileTime(fileHandle, 0, 0, &fileTime); // http://msdn.microsoft.com/en-us/library/windows/desktop/ms724320(v=VS.85).aspx
-    CloseHandle(fileHandle);
-    if (!success)
+bool AssetCache::IsVerified(const QString &assetRef) const
+{
+    return verifiedRefs.contains(AssetAPI::SanitateAssetRef(assetRef));
+}
+
+void AssetCache::LoadContentIndex()
+{
+    QFileInfoList files = blobDir.entryInfoList(QDir::Files | QDir::NoDotAndDotDot);
+    foreach(const QFileInfo &blob, files)
+        blobs[blob.fileName()] = ReadFileInfo(blob);
+    files = assetDataDir.entryInfoList(QDir::Files | QDir::NoSymLinks | QDir::NoDotAndDotDot);
+    foreach(const QFileInfo &file, files)
+        legacyFiles[file.fileName()] = ReadFileInfo(file);
+
+    QFile file(contentIndexPath);
+    if (file.open(QIODevice::ReadOnly))
     {
-        LogError("AssetCache: Failed to read cache file last modified time: " + assetRef);
-        return QDateTime();
+        ReadContentIndexLines(file, false);
+        file.close();
     }
 
-    // Convert to UTC.
-    SYSTEMTIME sysTime;
-    if (!FileTimeToSystemTime(&fileTime, &sysTime)) // http://msdn.microsoft.com/en-us/library/windows/desktop/ms724280(v=VS.85).aspx
+    for(QHash<QString, ContentEntry>::iterator it = contentIndex.begin(); it != contentIndex.end();)
     {
-        LogError("Win32 FileTimeToSystemTime failed for asset ref " + assetRef);
-        return QDateTime();
+        QHash<QString, FileInfo>::iterator blob = blobs.find(it->blobName);
+        if (blob == blobs.end())
+        {
+            it = contentIndex.erase(it);
+            continue;
+        }
+        ++blob->refCount;
+        if (!blobsByHash.contains(HashOfBlob(it->blobName)))
+            blobsByHash[HashOfBlob(it->blobName)] = it->blobName;
+        ++it;
     }
 
-    // Ignore msec
-    QDateTime dateTime;
-    dateTime.setTimeSpec(Qt::UTC);
-    dateTime.setDate(QDate((int)sysTime.wYear, (int)sysTime.wMonth, (int)sysTime.wDay));
-    dateTime.setTime(QTime((int)sysTime.wHour, (int)sysTime.wMinute, (int)sysTime.wSecond, 0));
-    return dateTime;
-#else
-    QDateTime dateTime;
-    QString nativePath = QDir::toNativeSeparators(absolutePath);
-    struct stat fileStats;
-    if (stat(nativePath.toStdString().c_str(), &fileStats) == 0)
+    // Drop the dependencies recorded for data that is no longer cached
+    for(QHash<QString, DependencyEntry>::iterator it = dependencies.begin(); it != dependencies.end();)
+    {
+        QHash<QString, ContentEntry>::const_iterator content = contentIndex.find(it.key());
+        if (content == contentIndex.end() || HashOfBlob(content->blobName) != it->contentHash)
+            it = dependencies.erase(it);
+        else
+            ++it;
+    }
+
+    // Drop the mesh bounds of data that is no longer cached
+    for(QHash<QString, AABB>::iterator it = meshBounds.begin(); it != meshBounds.end();)
+    {
+        if (!blobsByHash.contains(it.key()))
+            it = meshBounds.erase(it);
+        else
+            ++it;
+    }
+
+    // Remove the blobs no ref refers to, e.g. left by a crash between writing the blob and the journal.
+    // In a shared cache they can be blobs another process has just written, so only forget them.
+    for(QHash<QString, FileInfo>::iterator it = blobs.begin(); it != blobs.end();)
+    {
+        if (it->refCount == 0)
+        {
+            if (!shared)
+                blobDir.remove(it.key());
+            it = blobs.erase(it);
+        }
+        else
+            ++it;
+    }
+
+    // Rewrite the journal with only the current entries. A shared journal is not rewritten, as the other processes append to it.
+    if (shared)
+        return;
+    if (file.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Text))
     {
-        qint64 msecFromEpoch = (qint64)fileStats.st_mtime * 1000;
-        dateTime.setMSecsSinceEpoch(msecFromEpoch);
+        QTextStream out(&file);
+        out.setCodec("UTF-8");
+        for(QHash<QString, ContentEntry>::const_iterator it = contentIndex.begin(); it != contentIndex.end(); ++it)
+            out << "S " << it->blobName << " " << it->lastModified << " " << it.key() << "\n";
+        for(QHash<QString, DependencyEntry>::const_iterator it = dependencies.begin(); it != dependencies.end(); ++it)
+            out << DependencyLine(it.key()) << "\n";
+        for(QHash<QString, AABB>::const_iterator it = meshBounds.begin(); it != meshBounds.end(); ++it)
+            out << MeshBoundsLine(it.key()) << "\n";
     }
     else
-        LogError("AssetCache: Failed to read cache file last modified time: " + assetRef);
+        LogWarning("AssetCache: Failed to write content index " + contentIndexPath);
+}
+
+void AssetCache::ReadContentIndexLines(QFile &file, bool incremental)
+{
+    while(!file.atEnd())
+    {
+        QByteArray bytes = file.readLine();
+        // A line without the line feed is still being written by another process, or was cut by a crash.
+        if (!bytes.endsWith('\n'))
+            break;
+        contentIndexReadPos = file.pos();
+        bytes.chop(1);
+        if (bytes.endsWith('\r'))
+            bytes.chop(1);
+        ApplyContentIndexLine(QString::fromUtf8(bytes.constData(), bytes.size()), incremental);
+    }
+}
+
+void AssetCache::ApplyContentIndexLine(const QString &line, bool incremental)
+{
+    if (line.startsWith("S "))
+    {
+        ContentEntry entry;
+        entry.blobName = line.section(' ', 1, 1);
+        entry.lastModified = line.section(' ', 2, 2).toLongLong();
+        QString key = line.section(' ', 3);
+        if (entry.blobName.isEmpty() || key.isEmpty())
+            return;
+        if (!incremental)
+        {
+            contentIndex[key] = entry;
+            return;
+        }
+        // The entry may refer to a blob another process has written after this one listed the blobs.
+        if (!blobs.contains(entry.blobName))
+        {
+            QFileInfo blob(BlobPath(entry.blobName));
+            if (!blob.exists())
+                return;
+            blobs[entry.blobName] = ReadFileInfo(blob);
+        }
+        ApplyContentEntry(key, entry);
+    }
+    else if (line.startsWith("D "))
+    {
+        QString key = line.mid(2);
+        QHash<QString, ContentEntry>::iterator it = contentIndex.find(key);
+        if (it != contentIndex.end())
+        {
+            QString blobName = it->blobName;
+            contentIndex.erase(it);
+            if (incremental)
+                ReleaseBlob(blobName);
+        }
+        dependencies.remove(key);
+    }
+    else if (line.startsWith("R\t"))
+    {
+        // R <content hash> <key> followed by the ref and type of each dependency, separated by tabs
+        QStringList fields = line.split('\t');
+        if (fields.size() >= 3 && fields.size() % 2 == 1)
+        {
+            DependencyEntry &entry = dependencies[fields[2]];
+            entry.contentHash = fields[1];
+            entry.refs.clear();
+            for(int i = 3; i + 1 < fields.size(); i += 2)
+                entry.refs.push_back(AssetReference(fields[i], fields[i + 1]));
+        }
+    }
+    else if (line.startsWith("B "))
+    {
+        // B <content hash> followed by the min and max points of the bounds, or nothing if the data is not a mesh
+        QStringList fields = line.split(' ', QString::SkipEmptyParts);
+        if (fields.size() == 8)
+        {
+            float values[6];
+            bool ok = true;
+            for(int i = 0; i < 6 && ok; ++i)
+                values[i] = fields[i + 2].toFloat(&ok);
+            if (ok)
+                meshBounds[fields[1]] = AABB(float3(values[0], values[1], values[2]), float3(values[3], values[4], values[5]));
+        }
+        else if (fields.size() == 2)
+        {
+            AABB invalid;
+            invalid.SetNegativeInfinity();
+            meshBounds[fields[1]] = invalid;
+        }
+    }
+}
+
+void AssetCache::RefreshContentIndex()
+{
+    if (!shared)
+        return;
+    QFile file(contentIndexPath);
+    if (!file.open(QIODevice::ReadOnly))
+        return;
+    // The journal has been cleared by another process.
+    if (file.size() < contentIndexReadPos)
+        contentIndexReadPos = 0;
+    if (file.size() == contentIndexReadPos || !file.seek(contentIndexReadPos))
+        return;
+    ReadContentIndexLines(file, true);
+}
+
+void AssetCache::LoadPartials()
+{
+    QFileInfoList files = partialDir.entryInfoList(QDir::Files | QDir::NoDotAndDotDot);
+    foreach(const QFileInfo &partial, files)
+    {
+        QFile validatorFile(PartialValidatorPath(partial.fileName()));
+        PartialInfo info;
+        info.size = partial.size();
+        if (validatorFile.open(QIODevice::ReadOnly))
+        {
+            info.validator = QString::fromUtf8(validatorFile.readAll());
+            validatorFile.close();
+        }
+        if (info.size > 0 && !info.validator.isEmpty())
+            partials[partial.fileName()] = info;
+        else
+        {
+            partialDir.remove(partial.fileName());
+            QFile::remove(validatorFile.fileName());
+        }
+    }
+}
+
+qint64 AssetCache::PartialSize(const QString &assetRef) const
+{
+    QHash<QString, PartialInfo>::const_iterator it = partials.find(AssetAPI::SanitateAssetRef(assetRef));
+    return it != partials.end() ? it->size : 0;
+}
+
+QString AssetCache::PartialValidator(const QString &assetRef) const
+{
+    QHash<QString, PartialInfo>::const_iterator it = partials.find(AssetAPI::SanitateAssetRef(assetRef));
+    return it != partials.end() ? it->validator : QString();
+}
+
+QByteArray AssetCache::ReadPartial(const QString &assetRef) const
+{
+    QString key = AssetAPI::SanitateAssetRef(assetRef);
+    if (!partials.contains(key))
+        return QByteArray();
+    QFile file(partialDir.absolutePath() + "/" + key);
+    if (!file.open(QIODevice::ReadOnly))
+        return QByteArray();
+    return file.readAll();
+}
+
+bool AssetCache::StorePartial(const QString &assetRef, qint64 offset, const QByteArray &data, const QString &validator)
+{
+    if (shared)
+        return false;
+    QString key = AssetAPI::SanitateAssetRef(assetRef);
+    QHash<QString, PartialInfo>::iterator it = partials.find(key);
+    if (offset > 0 && (it == partials.end() || it->validator != validator || offset > it->size))
+        return false;
+    if (offset == 0 && data.isEmpty())
+    {
+        DeletePartial(assetRef);
+        return false;
+    }
+
+    QFile file(partialDir.absolutePath() + "/" + key);
+    if (!file.open(offset > 0 ? QIODevice::ReadWrite : QIODevice::WriteOnly | QIODevice::Truncate) ||
+        !file.resize(offset) || !file.seek(offset) || file.write(data) != data.size())
+    {
+        LogWarning("AssetCache::StorePartial: Failed to write partial data of " + assetRef);
+        file.close();
+        DeletePartial(assetRef);
+        return false;
+    }
+    file.close();
+
+    if (offset == 0 || it == partials.end())
+    {
+        QFile validatorFile(PartialValidatorPath(key));
+        if (!validatorFile.open(QIODevice::WriteOnly | QIODevice::Truncate) || validatorFile.write(validator.toUtf8()) < 0)
+        {
+            LogWarning("AssetCache::StorePartial: Failed to write the validator of " + assetRef);
+            DeletePartial(assetRef);
+            return false;
+        }
+    }
+    PartialInfo &info = partials[key];
+    info.size = offset + data.size();
+    info.validator = validator;
+    return true;
+}
+
+void AssetCache::DeletePartial(const QString &assetRef)
+{
+    QString key = AssetAPI::SanitateAssetRef(assetRef);
+    partials.remove(key);
+    partialDir.remove(key);
+    QFile::remove(PartialValidatorPath(key));
+}
+
+std::vector<AssetReference> AssetCache::CachedDependencies(const QString &assetRef) const
+{
+    QString key = AssetAPI::SanitateAssetRef(assetRef);
+    QHash<QString, DependencyEntry>::const_iterator it = dependencies.find(key);
+    if (it == dependencies.end())
+        return std::vector<AssetReference>();
+    QHash<QString, ContentEntry>::const_iterator content = contentIndex.find(key);
+    if (content == contentIndex.end() || HashOfBlob(content->blobName) != it->contentHash)
+        return std::vector<AssetReference>();
+    return it->refs;
+}
+
+void AssetCache::StoreDependencies(const QString &assetRef, const std::vector<AssetReference> &refs)
+{
+    QString key = AssetAPI::SanitateAssetRef(assetRef);
+    QHash<QString, ContentEntry>::const_iterator content = contentIndex.find(key);
+    if (content == contentIndex.end())
+        return;
+
+    DependencyEntry entry;
+    entry.contentHash = HashOfBlob(content->blobName);
+    for(size_t i = 0; i < refs.size(); ++i)
+        if (!refs[i].ref.isEmpty() && !refs[i].ref.contains('\t') && !refs[i].type.contains('\t'))
+            entry.refs.push_back(refs[i]);
+
+    QHash<QString, DependencyEntry>::const_iterator it = dependencies.find(key);
+    if (it != dependencies.end() && it->contentHash == entry.contentHash && it->refs.size() == entry.refs.size())
+    {
+        bool same = true;
+        for(size_t i = 0; i < entry.refs.size() && same; ++i)
+            same = (entry.refs[i].ref == it->refs[i].ref && entry.refs[i].type == it->refs[i].type);
+        if (same)
+            return;
+    }
+    if (it == dependencies.end() && entry.refs.empty())
+        return;
+    dependencies[key] = entry;
+    AppendContentIndex(DependencyLine(key));
+}
+
+QString AssetCache::DependencyLine(const QString &key) const
+{
+    DependencyEntry entry = dependencies.value(key);
+    QStringList fields;
+    fields << "R" << entry.contentHash << key;
+    for(size_t i = 0; i < entry.refs.size(); ++i)
+        fields << entry.refs[i].ref << entry.refs[i].type;
+    return fields.join("\t");
+}
+
+bool AssetCache::MeshBounds(const QString &assetRef, AABB &bounds)
+{
+    QString key = AssetAPI::SanitateAssetRef(assetRef);
+    QHash<QString, ContentEntry>::const_iterator content = contentIndex.find(key);
+    if (content == contentIndex.end())
+    {
+        // Files cached by earlier versions have no content hash to keep the bounds by, so they are read every time.
+        const QString path = FindFile(key, 0);
+        return !path.isEmpty() && OgreMeshBounds::ReadFile(path, bounds);
+    }
+
+    const QString contentHash = HashOfBlob(content->blobName);
+    QHash<QString, AABB>::const_iterator it = meshBounds.find(contentHash);
+    if (it == meshBounds.end())
+    {
+        AABB read;
+        if (!OgreMeshBounds::ReadFile(BlobPath(content->blobName), read))
+            read.SetNegativeInfinity();
+        meshBounds[contentHash] = read;
+        AppendContentIndex(MeshBoundsLine(contentHash));
+        it = meshBounds.find(contentHash);
+    }
+    if (!it->IsFinite())
+        return false;
+    bounds = *it;
+    return true;
+}
+
+QString AssetCache::MeshBoundsLine(const QString &contentHash) const
+{
+    AABB bounds = meshBounds.value(contentHash);
+    if (!bounds.IsFinite())
+        return "B " + contentHash;
+    return QString("B %1 %2 %3 %4 %5 %6 %7").arg(contentHash)
+        .arg(bounds.minPoint.x, 0, 'g', 9).arg(bounds.minPoint.y, 0, 'g', 9).arg(bounds.minPoint.z, 0, 'g', 9)
+        .arg(bounds.maxPoint.x, 0, 'g', 9).arg(bounds.maxPoint.y, 0, 'g', 9).arg(bounds.maxPoint.z, 0, 'g', 9);
+}
+
+void AssetCache::AppendContentIndex(const QString &line)
+{
+    // The line is appended with a single unbuffered write, so that the lines of processes sharing the journal are not interleaved.
+    QFile file(contentIndexPath);
+    QByteArray bytes = line.toUtf8() + '\n';
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Append | QIODevice::Unbuffered) || file.write(bytes) != bytes.size())
+    {
+        LogWarning("AssetCache: Failed to write content index " + contentIndexPath);
+        return;
+    }
+    file.close();
+
+    // Apply the lines in the order of the journal, so that all the processes end up with the same index.
+    // This reads back the line just written, which has already been applied.
+    RefreshContentIndex();
+}
+
+void AssetCache::SetContentEntry(const QString &key, const ContentEntry &entry)
+{
+    ApplyContentEntry(key, entry);
+    AppendContentIndex(QString("S %1 %2 %3").arg(entry.blobName).arg(entry.lastModified).arg(key));
+}
+
+void AssetCache::ApplyContentEntry(const QString &key, const ContentEntry &entry)
+{
+    QHash<QString, ContentEntry>::iterator it = contentIndex.find(key);
+    const bool isNew = (it == contentIndex.end());
+    QString previousBlob;
+    if (!isNew)
+    {
+        if (it->blobName != entry.blobName)
+            previousBlob = it->blobName;
+        *it = entry;
+    }
+    else
+        contentIndex[key] = entry;
+
+    if (isNew || !previousBlob.isEmpty())
+    {
+        ++blobs[entry.blobName].refCount;
+        if (!blobsByHash.contains(HashOfBlob(entry.blobName)))
+            blobsByHash[HashOfBlob(entry.blobName)] = entry.blobName;
+    }
+    if (!previousBlob.isEmpty())
+        ReleaseBlob(previousBlob);
+}
+
+bool AssetCache::RemoveContentEntry(const QString &key)
+{
+    QHash<QString, ContentEntry>::iterator it = contentIndex.find(key);
+    if (it == contentIndex.end())
+        return false;
+    QString blobName = it->blobName;
+    contentIndex.erase(it);
+    dependencies.remove(key);
+    AppendContentIndex("D " + key);
+    ReleaseBlob(blobName);
+    return true;
+}
+
+void AssetCache::ReleaseBlob(const QString &blobName)
+{
+    QHash<QString, FileInfo>::iterator it = blobs.find(blobName);
+    if (it == blobs.end() || --it->refCount > 0)
+        return;
+    blobs.erase(it);
+    // Other processes sharing the cache may still refer to the blob.
+    if (!shared)
+        blobDir.remove(blobName);
+
+    // Another blob of the same content may remain, stored with a different suffix
+    QString hash = HashOfBlob(blobName);
+    if (blobsByHash.value(hash) == blobName)
+    {
+        blobsByHash.remove(hash);
+        for(QHash<QString, FileInfo>::const_iterator i = blobs.begin(); i != blobs.end(); ++i)
+            if (HashOfBlob(i.key()) == hash)
+            {
+                blobsByHash[hash] = i.key();
+                break;
+            }
+    }
+}
+
+QDateTime AssetCache::LastModified(const QString &assetRef)
+{
+    // The blobs may be shared by several refs, so the last modified times set for the refs are kept in the content index
+    QString key = AssetAPI::SanitateAssetRef(assetRef);
+    if (shared && !contentIndex.contains(key))
+        RefreshContentIndex();
+    QHash<QString, ContentEntry>::const_iterator it = contentIndex.find(key);
+    qint64 lastModified = (it != contentIndex.end() ? it->lastModified : 0);
+    if (lastModified <= 0)
+    {
+        FileInfo info;
+        if (FindFile(key, &info).isEmpty())
+            return QDateTime();
+        lastModified = info.lastModified;
+    }
+
+    QDateTime dateTime;
+    dateTime.setMSecsSinceEpoch(lastModified * 1000);
     return dateTime;
-#endif
 }
 
 bool AssetCache::SetLastModified(const QString &assetRef, const QDateTime &dateTime)
@@ -156,9 +721,20 @@ bool AssetCache::SetLastModified(const QString &assetRef, const QDateTime &dateT
         return false;
     }
 
-    QString absolutePath = FindInCache(assetRef);
-    if (absolutePath.isEmpty())
+    QString key = AssetAPI::SanitateAssetRef(assetRef);
+    QHash<QString, ContentEntry>::const_iterator it = contentIndex.find(key);
+    if (it != contentIndex.end())
+    {
+        ContentEntry entry = *it;
+        entry.lastModified = dateTime.toMSecsSinceEpoch() / 1000;
+        SetContentEntry(key, entry);
+        return true;
+    }
+
+    QHash<QString, FileInfo>::iterator legacy = legacyFiles.find(key);
+    if (legacy == legacyFiles.end())
         return false;
+    QString absolutePath = assetDataDir.absolutePath() + "/" + key;
 
     QDate date = dateTime.date();
     QTime time = dateTime.time();
@@ -195,6 +771,7 @@ bool AssetCache::SetLastModified(const QString &assetRef, const QDateTime &dateT
         LogError("AssetCache: Failed to update cache file last modified time: " + assetRef);
         return false;
     }
+    legacy->lastModified = dateTime.toMSecsSinceEpoch() / 1000;
     return true;
 #else
     QString nativePath = QDir::toNativeSeparators(absolutePath);
@@ -206,8 +783,8 @@ bool AssetCache::SetLastModified(const QString &assetRef, const QDateTime &dateT
         LogError("AssetCache: Failed to read cache file last modified time: " + assetRef);
         return false;
     }
-    else
-        return true;
+    legacy->lastModified = dateTime.toMSecsSinceEpoch() / 1000;
+    return true;
 #endif
 }
 
@@ -238,13 +815,37 @@ void *AssetCache::OpenFileHandle(const QString &absolutePath)
 
 void AssetCache::DeleteAsset(const QString &assetRef)
 {
-    QString absolutePath = GetDiskSourceByRef(assetRef);
-    if (QFile::exists(absolutePath))
-        QFile::remove(absolutePath);
+    QString key = AssetAPI::SanitateAssetRef(assetRef);
+    RemoveContentEntry(key);
+    verifiedRefs.remove(key);
+    if (legacyFiles.remove(key) > 0)
+        QFile::remove(assetDataDir.absolutePath() + "/" + key);
+    if (partials.contains(key))
+        DeletePartial(assetRef);
 }
 
 void AssetCache::ClearAssetCache()
 {
+    contentIndex.clear();
+    blobs.clear();
+    legacyFiles.clear();
+    blobsByHash.clear();
+    verifiedRefs.clear();
+    dependencies.clear();
+    meshBounds.clear();
+    foreach(const QString &key, partials.keys())
+    {
+        partialDir.remove(key);
+        QFile::remove(PartialValidatorPath(key));
+    }
+    partials.clear();
+    QFile::remove(contentIndexPath);
+    contentIndexReadPos = 0;
+    QFileInfoList blobFiles = blobDir.entryInfoList(QDir::Files | QDir::NoDotAndDotDot);
+    foreach(const QFileInfo &blob, blobFiles)
+        if (!blobDir.remove(blob.fileName()))
+            LogWarning("AssetCache::ClearAssetCache could not remove file " + blob.absoluteFilePath());
+
     if (!assetDataDir.exists())
         return;
     QFileInfoList entries = assetDataDir.entryInfoList(QDir::Files|QDir::NoSymLinks|QDir::NoDotAndDotDot);
@@ -5,13 +5,44 @@
 #include "TundraCoreApi.h"
 #include "CoreTypes.h"
 #include "AssetFwd.h"
+#include "AssetReference.h"
+#include "Geometry/AABB.h"
 
 #include <QString>
 #include <QDir>
 #include <QObject>
 #include <QDateTime>
+#include <QHash>
+#include <QSet>
+
+#include <vector>
+
+class QFile;
 
 /// Implements a disk cache for asset files to avoid re-downloading assets between runs.
+/** The cached data is stored by content: each distinct content is a blob file named by the SHA-1 hash of the data, and
+    a content index maps the asset refs to the blobs. The same data cached under several refs, e.g. a texture served from
+    several storages, is stored only once, and a renamed asset that a server advertises with its content hash can be
+    mapped to the blob already in the cache instead of downloaded again, see StoreAlias.
+
+    The content index is a journal file in the cache directory, which is compacted when the cache is opened. Files
+    cached under their sanitized refs by earlier versions are still found, and are moved to blobs when stored again.
+
+    The cache directory is listed once when the cache is opened, and the sizes and modification times of the blobs and
+    the files are kept in memory from then on, so the lookups never touch the file system.
+
+    The beginnings of interrupted downloads are kept as partial files, along with the validator of the source data,
+    so that an asset provider can resume the download later instead of starting it over, see StorePartial.
+
+    The dependencies of the cached assets found when they were last loaded are kept in the content index too, so that
+    AssetAPI can request the whole dependency graph of an asset at once on later runs, see StoreDependencies.
+
+    With the --sharedAssetCache command line parameter, several processes on the same host can use the same cache
+    directory, so that an asset downloaded by one of them is found by the others. The blobs are written to temporary
+    files and renamed in place, each journal line is appended with a single write, and the lines appended by the other
+    processes are read when a lookup misses. The shared blobs are not deleted when a process no longer refers to them,
+    the journal is not compacted, and interrupted downloads are not kept for resuming.
+    @note Other programs must not modify the cache directory while it is open, as the changes would not be seen. */
 class TUNDRACORE_API AssetCache : public QObject
 {
     Q_OBJECT
@@ -19,6 +50,12 @@ class TUNDRACORE_API AssetCache : public QObject
 public:
     explicit AssetCache(AssetAPI *owner, QString assetCacheDirectory);
 
+    /// Returns the content hash of the data, the hex encoded SHA-1 hash.
+    static QString ComputeContentHash(const u8 *data, size_t numBytes);
+
+    /// Returns whether the cache directory is shared with other processes, see --sharedAssetCache.
+    bool IsShared() const { return shared; }
+
 public slots:
     /// Returns the absolute path on the local file system that contains a cached copy of the given asset ref.
     /// If the given asset file does not exist in the cache, an empty string is returned.
@@ -45,13 +82,16 @@ public slots:
     /// @return QDateTime Last modified date and time of the cache file.
     QDateTime LastModified(const QString &assetRef);
 
+    /// Returns the size in bytes of the cached data of the asset ref, or -1 if the ref is not in the cache.
+    qint64 SizeInCache(const QString &assetRef) const;
+
     /// Sets the last modified date and time for the assetRefs cache file.
     /// @param QString assetRef Asset reference thats cache file last modified date and time will be set.
     /// @param QDateTime The date and time to set.
     /// @return bool Returns true if successful, false otherwise.
     bool SetLastModified(const QString &assetRef, const QDateTime &dateTime);
 
-    /// Deletes the asset with the given assetRef from the cache, if it exists.
+    /// Deletes the asset with the given assetRef from the cache, if it exists, along with its partially downloaded data.
     /// @param QString asset reference.
     void DeleteAsset(const QString &assetRef);
 
@@ -62,8 +102,108 @@ public slots:
     /// Get the cache directory. Returned path is guaranteed to have a trailing slash /.
     /// @return QString absolute path to the caches data directory
     QString CacheDirectory() const;
-    
+
+    /// Returns the content hash of the cached data of the asset ref, or an empty string if the ref is not in the content index.
+    QString ContentHash(const QString &assetRef) const;
+
+    /// Returns the absolute path of the cached blob with the content hash, or an empty string if there is none.
+    QString FindByContentHash(const QString &contentHash) const;
+
+    /// Maps the asset ref to the cached blob with the content hash, and marks the ref verified.
+    /// Called when a server advertises the content hash of an asset, so that the blob is used instead of downloading the data again.
+    /// @return false if the cache has no blob with the content hash.
+    bool StoreAlias(const QString &assetRef, const QString &contentHash);
+
+    /// Returns whether a server has advertised the content hash of the cached data of the asset ref during this run.
+    /// The cached data of a verified ref is up to date, and need not be checked against the source.
+    bool IsVerified(const QString &assetRef) const;
+
+    /// Returns the size in bytes of the partially downloaded data of the asset ref, or 0 if there is none.
+    qint64 PartialSize(const QString &assetRef) const;
+
+    /// Returns the validator of the partially downloaded data of the asset ref, f.ex. a HTTP ETag, or an empty string if there is no partial data.
+    QString PartialValidator(const QString &assetRef) const;
+
+    /// Reads the partially downloaded data of the asset ref. Returns an empty array if there is none.
+    QByteArray ReadPartial(const QString &assetRef) const;
+
+    /// Stores the beginning of an interrupted download of the asset ref.
+    /// @param offset Offset of the data from the beginning of the asset. Data beyond offset that is already stored is replaced.
+    ///        The offset must be 0, or the size of the stored partial data of the same validator.
+    /// @param validator Identifies the version of the source data, so that only the rest of the same version is appended to it.
+    /// @return false if the data could not be written, or the offset does not continue the stored partial data.
+    bool StorePartial(const QString &assetRef, qint64 offset, const QByteArray &data, const QString &validator);
+
+    /// Deletes the partially downloaded data of the asset ref, if there is any.
+    void DeletePartial(const QString &assetRef);
+
+public:
+    /// Returns the dependencies recorded for the cached data of the asset ref with StoreDependencies.
+    /** Returns an empty list if no dependencies are recorded, or the cached data has changed since they were. */
+    std::vector<AssetReference> CachedDependencies(const QString &assetRef) const;
+
+    /// Records the dependencies of the asset ref, found when its cached data was loaded.
+    /** Does nothing if the ref is not in the content index, or the same dependencies are already recorded. */
+    void StoreDependencies(const QString &assetRef, const std::vector<AssetReference> &refs);
+
+    /// Returns the bounds of the cached Ogre binary mesh of the asset ref.
+    /** The bounds are read from the headers of the mesh data when first asked, and kept in the content index by the content
+        hash, so that later runs do not read the data again. Returns false if the ref is not in the cache, or its data is not
+        an Ogre binary mesh with bounds. @sa OgreMeshBounds */
+    bool MeshBounds(const QString &assetRef, AABB &bounds);
+
 private:
+    /// Entry of the content index.
+    struct ContentEntry
+    {
+        ContentEntry() : lastModified(0) {}
+        QString blobName; ///< File name of the blob in the blob directory: the content hash, followed by the suffix of the ref it was stored with.
+        qint64 lastModified; ///< Last modified time in seconds since the epoch, or 0 to use the modification time of the blob.
+    };
+
+    /// Lists the blobs and the legacy files, reads the content index journal, drops the entries whose blob is missing, and rewrites the journal compacted.
+    void LoadContentIndex();
+    /// Reads the complete lines of the content index journal from the current position of the file, and applies them.
+    /** @param incremental Whether the lines are applied on top of the loaded index, keeping the blob reference counts up to date. */
+    void ReadContentIndexLines(QFile &file, bool incremental);
+    /// Applies a line of the content index journal. @sa ReadContentIndexLines
+    void ApplyContentIndexLine(const QString &line, bool incremental);
+    /// Reads the lines other processes have appended to the shared content index journal. Does nothing if the cache is not shared.
+    void RefreshContentIndex();
+    /// Lists the partial files and reads their validators. Deletes the partial files that have no validator.
+    void LoadPartials();
+    /// Returns the path of the validator file of the sanitized ref.
+    QString PartialValidatorPath(const QString &key) const { return partialDir.absolutePath() + "/validators/" + key; }
+    /// Returns the content index journal line of the recorded dependencies of the sanitized ref.
+    QString DependencyLine(const QString &key) const;
+    /// Appends a line to the content index journal.
+    void AppendContentIndex(const QString &line);
+    /// Sets the entry of the sanitized ref, releasing the blob of its previous entry, and appends it to the journal.
+    void SetContentEntry(const QString &key, const ContentEntry &entry);
+    /// Sets the entry of the sanitized ref in memory, releasing the blob of its previous entry.
+    void ApplyContentEntry(const QString &key, const ContentEntry &entry);
+    /// Removes the entry of the sanitized ref, and deletes its blob if no other ref refers to it. Returns whether there was an entry.
+    bool RemoveContentEntry(const QString &key);
+    /// Metadata of a file in the cache directory.
+    struct FileInfo
+    {
+        FileInfo() : size(0), lastModified(0), refCount(0) {}
+        qint64 size; ///< Size in bytes.
+        qint64 lastModified; ///< Modification time in seconds since the epoch.
+        int refCount; ///< Number of refs in the content index referring to the blob. Unused for the legacy files.
+    };
+
+    /// Returns the metadata of a stored file from the file system.
+    static FileInfo ReadFileInfo(const QFileInfo &file);
+    /// Returns the path of the blob or legacy file of the sanitized ref, and sets its metadata, or an empty string if the ref is not in the cache.
+    QString FindFile(const QString &key, FileInfo *info) const;
+    /// Decrements the reference count of the blob, and deletes the blob when it reaches zero.
+    void ReleaseBlob(const QString &blobName);
+    /// Returns the absolute path of the blob.
+    QString BlobPath(const QString &blobName) const { return blobDir.absolutePath() + "/" + blobName; }
+    /// Returns the content hash part of a blob name.
+    static QString HashOfBlob(const QString &blobName) { return blobName.section('.', 0, 0); }
+
 #ifdef Q_WS_WIN
     /// Windows specific helper to open a file handle to absolutePath
     void *OpenFileHandle(const QString &absolutePath);
@@ -71,9 +211,66 @@ private:
     /// Cache directory, passed here from AssetAPI in the ctor.
     QString cacheDirectory;
 
+    /// Whether the cache directory is shared with other processes.
+    bool shared;
+
+    /// Offset of the first line of the content index journal that has not been read.
+    qint64 contentIndexReadPos;
+
     /// AssetAPI ptr.
     AssetAPI *assetAPI;
 
-    /// Asset data dir.
+    /// Asset data dir, which has the files cached under their sanitized refs by earlier versions.
     QDir assetDataDir;
+
+    /// Directory of the content blobs.
+    QDir blobDir;
+
+    /// Path of the content index journal.
+    QString contentIndexPath;
+
+    /// Content index entries by sanitized asset ref.
+    QHash<QString, ContentEntry> contentIndex;
+
+    /// Metadata of the blobs, by blob name.
+    QHash<QString, FileInfo> blobs;
+
+    /// Metadata of the files cached under their sanitized refs by earlier versions, by sanitized ref.
+    QHash<QString, FileInfo> legacyFiles;
+
+    /// Blob names by content hash.
+    QHash<QString, QString> blobsByHash;
+
+    /// Sanitized refs whose content hash has been advertised by a server during this run.
+    QSet<QString> verifiedRefs;
+
+    /// Dependencies of the cached data of an asset ref.
+    struct DependencyEntry
+    {
+        QString contentHash; ///< Content hash of the data the dependencies were found in.
+        std::vector<AssetReference> refs;
+    };
+
+    /// The recorded dependencies, by sanitized ref.
+    QHash<QString, DependencyEntry> dependencies;
+
+    /// Returns the content index journal line of the mesh bounds of the content hash.
+    QString MeshBoundsLine(const QString &contentHash) const;
+
+    /// The bounds of the cached Ogre meshes, by content hash. Data that is not an Ogre mesh has an invalid box.
+    QHash<QString, AABB> meshBounds;
+
+    /// Partially downloaded data of an asset ref.
+    struct PartialInfo
+    {
+        PartialInfo() : size(0) {}
+        qint64 size; ///< Size in bytes of the partial file.
+        QString validator; ///< Version of the source data, stored in the validator file next to the partial file.
+    };
+
+    /// Directory of the partial files, which are named by the sanitized ref.
+    QDir partialDir;
+
+    /// The partial files, by sanitized ref.
+    QHash<QString, PartialInfo> partials;
 };
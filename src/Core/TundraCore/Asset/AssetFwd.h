@@ -19,6 +19,7 @@ typedef weak_ptr<IAssetBundle> AssetBundleWeakPtr;
 class IAssetTransfer;
 typedef shared_ptr<IAssetTransfer> AssetTransferPtr;
 typedef weak_ptr<IAssetTransfer> AssetTransferWeakPtr;
+class IAssetTransferPrioritizer;
 
 class AssetBundleMonitor;
 typedef shared_ptr<AssetBundleMonitor> AssetBundleMonitorPtr;
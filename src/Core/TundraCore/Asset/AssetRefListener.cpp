@@ -7,6 +7,7 @@
 #include "IAttribute.h"
 #include "AssetReference.h"
 #include "IComponent.h"
+#include "Entity.h"
 #include "Framework.h"
 #include "AssetAPI.h"
 #include "IAsset.h"
@@ -15,11 +16,28 @@
 
 #include "MemoryLeakCheck.h"
 
+AssetRefListener::~AssetRefListener()
+{
+    SetAsset(AssetPtr());
+}
+
 AssetPtr AssetRefListener::Asset() const
 {
     return asset.lock();
 }
 
+void AssetRefListener::SetAsset(const AssetPtr &newAsset)
+{
+    AssetPtr oldAsset = asset.lock();
+    if (oldAsset == newAsset)
+        return;
+    if (oldAsset)
+        oldAsset->RemoveRefListener();
+    if (newAsset)
+        newAsset->AddRefListener();
+    asset = newAsset;
+}
+
 void AssetRefListener::HandleAssetRefChange(IAttribute *assetRef, const QString& assetType)
 {
     Attribute<AssetReference> *attr = dynamic_cast<Attribute<AssetReference> *>(assetRef);
@@ -29,10 +47,12 @@ void AssetRefListener::HandleAssetRefChange(IAttribute *assetRef, const QString&
             (assetRef == 0 ? "null" : assetRef->TypeName()) + " instead).");
         return;
     }
-    HandleAssetRefChange(attr->Owner()->GetFramework()->Asset(), attr->Get().ref, assetType);
+    // The entity of the component is the requester, which the distance based priority of the transfer is derived from
+    Entity *entity = attr->Owner()->ParentEntity();
+    HandleAssetRefChange(attr->Owner()->GetFramework()->Asset(), attr->Get().ref, assetType, entity ? entity->shared_from_this() : EntityPtr());
 }
 
-void AssetRefListener::HandleAssetRefChange(AssetAPI *assetApi, QString assetRef, const QString& assetType)
+void AssetRefListener::HandleAssetRefChange(AssetAPI *assetApi, QString assetRef, const QString& assetType, const EntityPtr &requester)
 {
     // Disconnect from any previous transfer we might be listening to
     if (!currentTransfer.expired())
@@ -65,6 +85,8 @@ void AssetRefListener::HandleAssetRefChange(AssetAPI *assetApi, QString assetRef
         LogWarning("AssetRefListener::HandleAssetRefChange: Asset request for asset \"" + assetRef + "\" failed.");
         return;
     }
+    if (requester && !transfer->Requester())
+        transfer->SetRequester(requester);
 
     connect(transfer.get(), SIGNAL(Succeeded(AssetPtr)), this, SLOT(OnTransferSucceeded(AssetPtr)), Qt::UniqueConnection);
     connect(transfer.get(), SIGNAL(Failed(IAssetTransfer*, QString)), this, SLOT(OnTransferFailed(IAssetTransfer*, QString)), Qt::UniqueConnection);
@@ -74,7 +96,7 @@ void AssetRefListener::HandleAssetRefChange(AssetAPI *assetApi, QString assetRef
     AssetPtr assetData = asset.lock();
     if (assetData)
         disconnect(assetData.get(), SIGNAL(Loaded(AssetPtr)), this, SIGNAL(Loaded(AssetPtr)));
-    asset = AssetPtr();
+    SetAsset(AssetPtr());
 }
 
 void AssetRefListener::OnTransferSucceeded(AssetPtr assetData)
@@ -82,7 +104,7 @@ void AssetRefListener::OnTransferSucceeded(AssetPtr assetData)
     if (!assetData)
         return;
     
-    asset = assetData;
+    SetAsset(assetData);
     
     // Connect to further reloads of the asset to be able to notify of them.
     connect(assetData.get(), SIGNAL(Loaded(AssetPtr)), this, SLOT(OnAssetLoaded(AssetPtr)), Qt::UniqueConnection);
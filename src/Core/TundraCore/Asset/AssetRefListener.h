@@ -4,6 +4,7 @@
 
 #include "TundraCoreApi.h"
 #include "AssetFwd.h"
+#include "SceneFwd.h"
 #include "AssetReference.h"
 
 #include <QObject>
@@ -17,6 +18,7 @@ class TUNDRACORE_API AssetRefListener : public QObject
 
 public:
     AssetRefListener() : myAssetAPI(0), requestedRef(""), /** \todo This needs to be removed. */ inspectCreated(false) {};
+    ~AssetRefListener();
 
     /// Issues a new asset request to the given AssetReference.
     /// @param assetRef A pointer to an attribute of type AssetReference.
@@ -26,7 +28,8 @@ public:
     /// Issues a new asset request to the given assetRef URL.
     /// @param assetApi Pass a pointer to the system Asset API into this function (This utility object doesn't keep reference to framework).
     /// @param assetType Optional asset type name
-    void HandleAssetRefChange(AssetAPI *assetApi, QString assetRef, const QString& assetType = "");
+    /// @param requester Optional entity the asset is requested for, see IAssetTransfer::SetRequester.
+    void HandleAssetRefChange(AssetAPI *assetApi, QString assetRef, const QString& assetType = "", const EntityPtr &requester = EntityPtr());
     
     /// Returns the asset currently stored in this asset reference.
     AssetPtr Asset() const;
@@ -48,6 +51,9 @@ private slots:
     void OnAssetCreated(AssetPtr asset);
 
 private:
+    /// Sets the asset, updating the listener counts of the previous and the new asset.
+    void SetAsset(const AssetPtr &newAsset);
+
     AssetAPI *myAssetAPI;
     AssetWeakPtr asset;
     AssetTransferWeakPtr currentTransfer;
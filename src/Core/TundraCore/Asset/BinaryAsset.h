@@ -51,5 +51,10 @@ public:
         return data.size() > 0;
     }
 
+    size_t MemoryUsage() const
+    {
+        return data.size();
+    }
+
     std::vector<u8> data;
 };
@@ -5,18 +5,47 @@
 
 #include "IAsset.h"
 #include "AssetAPI.h"
+#include "AssetCache.h"
 
 #include "Profiler.h"
 #include "LoggingFunctions.h"
 
+#include <QFileInfo>
+
 #include <set>
 
 #include "MemoryLeakCheck.h"
 
 IAsset::IAsset(AssetAPI *owner, const QString &type_, const QString &name_)
-:assetAPI(owner), type(type_), name(name_), diskSourceType(Programmatic), modified(false)
+:assetAPI(owner), type(type_), name(name_), diskSourceType(Programmatic), modified(false), numRefListeners(0), lastUsed(0)
 {
     assert(assetAPI);
+    MarkUsed();
+}
+
+size_t IAsset::MemoryUsage() const
+{
+    if (!IsLoaded() || diskSource.isEmpty())
+        return 0;
+    AssetCache *cache = assetAPI->Cache();
+    qint64 size = (cache ? cache->SizeInCache(name) : -1);
+    if (size < 0)
+        size = QFileInfo(diskSource).size();
+    return (size_t)size;
+}
+
+void IAsset::RemoveRefListener()
+{
+    if (numRefListeners > 0)
+        --numRefListeners;
+    MarkUsed();
+}
+
+void IAsset::MarkUsed()
+{
+    // Assets are used in the main thread only
+    static u64 useCounter = 0;
+    lastUsed = ++useCounter;
 }
 
 void IAsset::SetDiskSource(const QString &diskSource_)
@@ -63,6 +63,28 @@ public slots:
     /// Forces a reload of this asset from its disk source. Returns true if loading succeeded, false otherwise.
     bool LoadFromCache();
 
+    /// Returns whether AssetAPI may read the disk source of this asset, and decode it with DecodeInBackground, in a worker thread.
+    /** When true, a downloaded or cached asset that has no data in memory is deserialized from the read data in the main thread
+        once the read is done, instead of calling LoadFromFile. Override to return false if LoadFromFile loads the disk source
+        asynchronously by itself. The default implementation returns true. */
+    virtual bool AllowBackgroundLoad() const { return true; }
+
+    /// Converts the data read from the disk source to the data passed to DeserializeFromData. Called in a worker thread.
+    /** Override to do CPU-side decoding, f.ex. decompression, off the main thread. The implementation must be thread-safe:
+        it must not modify this asset or read its loaded contents, emit signals, log, profile, or call other APIs than those
+        known to be thread-safe. Reading the name and type is fine. The default implementation leaves the data as it is.
+        @return false if the data cannot be decoded, in which case the load fails. */
+    virtual bool DecodeInBackground(std::vector<u8> & /*data*/) const { return true; }
+
+    /// Returns whether downloaded data, which is already in memory, is to be decoded with DecodeInBackground in a worker thread too.
+    /** The default implementation returns false, so the downloaded data is deserialized in the main thread right away.
+        Override to return true if DecodeInBackground does work that is worth the wait of a frame or more. */
+    virtual bool PreferBackgroundDecode() const { return false; }
+
+    /// Called in the main thread before the data of this asset is decoded with DecodeInBackground.
+    /** Override to copy the state of other APIs that the decoding depends on to this asset, for DecodeInBackground to read. */
+    virtual void PrepareBackgroundDecode() {}
+
     /// Unloads this asset from memory.
     /** After calling this function, this asset still can be queried for its Type(), Name() and CacheFile(),
         but its dependencies cannot be determined and it cannot be used in any other way. */
@@ -86,6 +108,15 @@ public slots:
     
     /// Returns true if the asset has been modified in memory without saving to the source.
     bool IsModified() const { return modified; }
+
+    /// Returns the estimated number of bytes this asset takes in system and GPU memory, or 0 if it is not loaded.
+    /** Used by AssetAPI to keep the loaded assets of each type within their memory budget, see AssetAPI::SetMemoryBudget.
+        The default implementation returns the size of the disk source. Subclasses override it with the size of their in-memory data. */
+    virtual size_t MemoryUsage() const;
+
+    /// Returns the number of AssetRefListeners that currently refer to this asset.
+    /** An asset no listener refers to may be unloaded by AssetAPI when its type exceeds its memory budget. */
+    int NumRefListeners() const { return numRefListeners; }
     
     /// Makes a clone of this asset.
     /** For this function to succeed, the asset must be loaded in memory. (IsLoaded() == true)
@@ -175,6 +206,18 @@ public:
     /// Saves the storage this asset was downloaded from. Intended to be only called internally by Asset API at asset load time.
     void SetAssetStorage(AssetStoragePtr storage); 
 
+    /// Increments the number of AssetRefListeners referring to this asset. Intended to be only called internally by AssetRefListener.
+    void AddRefListener() { ++numRefListeners; }
+
+    /// Decrements the number of AssetRefListeners referring to this asset, and marks it used. Intended to be only called internally by AssetRefListener.
+    void RemoveRefListener();
+
+    /// Marks this asset used now. The assets used least recently are unloaded first to stay within the memory budgets.
+    void MarkUsed();
+
+    /// Returns the sequence number of the latest use of this asset. Larger numbers are more recent.
+    u64 LastUsed() const { return lastUsed; }
+
     /// Saves this asset to the given data buffer. Returns true on success. If this asset is unloaded, will return false.
     /// @param serializationParameters Optional parameters for the actual asset type serializer that specifies custom options on how to perform the serialization.
     virtual bool SerializeTo(std::vector<u8> &data, const QString &serializationParameters = "") const;
@@ -214,4 +257,10 @@ protected:
     
     /// Modified in memory -status of the asset.
     bool modified;
+
+    /// Number of AssetRefListeners referring to this asset.
+    int numRefListeners;
+
+    /// Sequence number of the latest use of this asset.
+    u64 lastUsed;
 };
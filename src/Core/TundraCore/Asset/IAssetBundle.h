@@ -53,6 +53,12 @@ public slots:
         @return Absolute disk source path if available, empty string otherwise.*/
     virtual QString GetSubAssetDiskSource(const QString &subAssetName) = 0;
 
+    /// Returns whether GetSubAssetData may be called in a worker thread.
+    /** If true, AssetAPI calls GetSubAssetData for the sub assets that have no disk source in a worker thread, concurrently with
+        the main thread and with other calls of it, and deserializes the sub asset in the main thread once the data is there.
+        The bundle is kept alive meanwhile, but it may be unloaded. The default implementation returns false. */
+    virtual bool IsSubAssetDataThreadSafe() const { return false; }
+
     /// Returns the sub asset count in this bundle.
     /** @return Count of the assets or -1 if count is unknown. */
     virtual int SubAssetCount() const { return -1; }
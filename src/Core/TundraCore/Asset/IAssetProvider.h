@@ -8,6 +8,8 @@
 #include "CoreDefines.h"
 
 #include <QString>
+#include <QByteArray>
+#include <QIODevice>
 
 /// A common interface for all classes that implement downloading and uploading assets via different protocols.
 /** Asset providers receive asset download requests through the RequestAsset() function. It should
@@ -64,6 +66,17 @@ public:
         return AssetUploadTransferPtr();
     }
 
+    /// Starts an asset upload that streams the data from the given device to the given storage.
+    /** The device must be open for reading, and the upload keeps a reference to it until it is done.
+        The default implementation reads all the data to memory and calls UploadAssetFromFileInMemory. */
+    virtual AssetUploadTransferPtr UploadAssetFromDevice(const shared_ptr<QIODevice> &device, AssetStoragePtr destination, const QString &assetName)
+    {
+        QByteArray data = device->readAll();
+        if (data.isEmpty())
+            return AssetUploadTransferPtr();
+        return UploadAssetFromFileInMemory((const u8*)data.constData(), (size_t)data.size(), destination, assetName);
+    }
+
     /// Reads the given storage string and tries to deserialize it to an asset storage in this provider.
     /** Returns a pointer to the newly created storage, or 0 if the storage string is not of the type of this asset provider. */
     virtual AssetStoragePtr TryDeserializeStorageFromString(const QString &storage, bool fromNetwork) = 0;
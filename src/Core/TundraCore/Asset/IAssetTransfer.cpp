@@ -8,10 +8,18 @@
 #include "Profiler.h"
 #include "LoggingFunctions.h"
 
+#include <QDateTime>
+
+#include <algorithm>
+
 IAssetTransfer::IAssetTransfer() : 
     cachingAllowed(true),
-    diskSourceType(IAsset::Original)
+    diskSourceType(IAsset::Original),
+    priority(0.f)
 {
+    for(int i = 0; i < NumTimingPoints; ++i)
+        times[i] = -1;
+    RecordTime(TimeRequested);
 }
 
 IAssetTransfer::~IAssetTransfer()
@@ -26,12 +34,62 @@ void IAssetTransfer::EmitAssetDownloaded()
 void IAssetTransfer::EmitTransferSucceeded()
 {
     PROFILE(IAssetTransfer_AssetDependenciesCompleted);
+    RecordTime(TimeCompleted);
     emit Succeeded(this->asset);
+    RecordTime(TimeSignaled);
 }
 
 void IAssetTransfer::EmitAssetFailed(QString reason)
 {
+    RecordTime(TimeCompleted);
     emit Failed(this, reason);
+    RecordTime(TimeSignaled);
+}
+
+void IAssetTransfer::RecordTime(TimingPoint point)
+{
+    if (point >= 0 && point < NumTimingPoints)
+        times[point] = QDateTime::currentMSecsSinceEpoch();
+}
+
+qint64 IAssetTransfer::StageDuration(TimingPoint point) const
+{
+    if (point <= TimeRequested || point >= NumTimingPoints || times[point] < 0)
+        return 0;
+    for(int i = point - 1; i >= 0; --i)
+        if (times[i] >= 0)
+            return std::max<qint64>(0, times[point] - times[i]);
+    return 0;
+}
+
+const char *IAssetTransfer::StageName(TimingPoint point)
+{
+    switch(point)
+    {
+    case TimeRequested: return "requested";
+    case TimeStarted: return "queueWait";
+    case TimeFirstByte: return "firstByte";
+    case TimeDownloaded: return "download";
+    case TimeCached: return "cacheWrite";
+    case TimeLoaded: return "decode";
+    case TimeCompleted: return "dependencyWait";
+    case TimeSignaled: return "signal";
+    default: return "";
+    }
+}
+
+QVariantMap IAssetTransfer::Timings() const
+{
+    QVariantMap timings;
+    qint64 total = 0;
+    for(int i = TimeStarted; i < NumTimingPoints; ++i)
+    {
+        qint64 duration = StageDuration((TimingPoint)i);
+        timings[StageName((TimingPoint)i)] = duration;
+        total += duration;
+    }
+    timings["total"] = total;
+    return timings;
 }
 
 bool IAssetTransfer::Abort()
@@ -5,12 +5,14 @@
 #include "TundraCoreApi.h"
 #include "CoreTypes.h"
 #include "AssetFwd.h"
+#include "SceneFwd.h"
 #include "AssetReference.h"
 #include "IAsset.h"
 
 #include <QObject>
 #include <vector>
 #include <QByteArray>
+#include <QVariant>
 
 /// Represents a currently ongoing asset download operation.
 class TUNDRACORE_API IAssetTransfer : public QObject, public enable_shared_from_this<IAssetTransfer>
@@ -54,6 +56,40 @@ public:
     /// Stores the raw asset bytes for this asset.
     std::vector<u8> rawAssetData;
 
+    /// Sets the entity the asset is requested for, which the derived priority of the transfer is computed from. @sa IAssetTransferPrioritizer
+    void SetRequester(const EntityPtr &entity) { requester = entity; }
+
+    /// Returns the entity the asset is requested for, or null if it is not known or has been removed.
+    EntityPtr Requester() const { return requester.lock(); }
+
+    /// Points of time in the life of a transfer, recorded for the asset pipeline statistics. @sa AssetAPI::TransferStatistics
+    /** Not all the points are recorded for all the transfers, e.g. a local file has no first byte. The time of a stage is
+        counted from the latest recorded point before it. */
+    enum TimingPoint
+    {
+        TimeRequested = 0, ///< The transfer was created.
+        TimeStarted, ///< The provider started the transfer, e.g. sent the HTTP request. The time before is the queue wait.
+        TimeFirstByte, ///< The first response, e.g. the HTTP headers, was received. Includes the name lookup and connecting.
+        TimeDownloaded, ///< All the data was received.
+        TimeCached, ///< The data was written to the asset cache.
+        TimeLoaded, ///< The asset was decoded and deserialized.
+        TimeCompleted, ///< The dependencies of the asset were loaded, or the transfer failed.
+        TimeSignaled, ///< The handlers of the Succeeded or Failed signal returned.
+        NumTimingPoints
+    };
+
+    /// Records the time of the point as now, in milliseconds since the epoch.
+    void RecordTime(TimingPoint point);
+
+    /// Returns the recorded time of the point in milliseconds since the epoch, or -1 if it has not been recorded.
+    qint64 Time(TimingPoint point) const { return times[point]; }
+
+    /// Returns the milliseconds spent in the stage that ends at the point, or 0 if the point has not been recorded.
+    qint64 StageDuration(TimingPoint point) const;
+
+    /// Returns the name of the stage that ends at the point, e.g. "download", as used in Timings.
+    static const char *StageName(TimingPoint point);
+
 public slots:
     /// Aborts the transfer immediately. Override this function in a subclass implementation.
     /** @note Default IAssetTransfer implementation logs a not implemented warning and return false.
@@ -94,6 +130,16 @@ public slots:
     /** @note Will be null until Succeeded is emitted */
     AssetPtr Asset() const;
 
+    /// Sets the explicit priority of the transfer. Queued transfers of higher priority are started first. The default is 0.
+    /** Can be changed while the transfer is queued. A priority derived from the requester is added to it, see AssetAPI::TransferPriority. */
+    void SetPriority(float priority_) { priority = priority_; }
+
+    /// Returns the explicit priority of the transfer.
+    float Priority() const { return priority; }
+
+    /// Returns the milliseconds spent in each stage so far, by StageName, and the total milliseconds as "total".
+    QVariantMap Timings() const;
+
     /// @todo Returns the current transfer progress in the range [0, 1].
     // float Progress() const;
 
@@ -110,6 +156,9 @@ signals:
 private:
     QString diskSource;
     bool cachingAllowed;
+    float priority;
+    EntityWeakPtr requester;
+    qint64 times[NumTimingPoints];
     
 };
 
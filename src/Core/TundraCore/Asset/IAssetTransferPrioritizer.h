@@ -0,0 +1,19 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#pragma once
+
+#include "TundraCoreApi.h"
+#include "AssetFwd.h"
+
+/// Derives priorities for asset transfers, e.g. from the distance of the requesting entity to the active camera.
+/** Set with AssetAPI::SetTransferPrioritizer. The derived priority is added to the explicit priority of the transfer,
+    see AssetAPI::TransferPriority. It is evaluated again each time the asset providers order their queued transfers,
+    so it can change as the camera moves. */
+class TUNDRACORE_API IAssetTransferPrioritizer
+{
+public:
+    virtual ~IAssetTransferPrioritizer() {}
+
+    /// Returns the derived priority of the transfer in the range [0, 1]. Higher priorities are started first.
+    virtual float DerivedPriority(IAssetTransfer *transfer) = 0;
+};
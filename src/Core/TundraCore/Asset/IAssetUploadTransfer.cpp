@@ -5,12 +5,36 @@
 
 #include "IAssetUploadTransfer.h"
 
+#include <QIODevice>
+
+#include <algorithm>
+
 #include "MemoryLeakCheck.h"
 
+IAssetUploadTransfer::IAssetUploadTransfer() :
+    bytesSent(0),
+    totalBytes(0)
+{
+}
+
 IAssetUploadTransfer::~IAssetUploadTransfer()
 {
 }
 
+float IAssetUploadTransfer::Progress() const
+{
+    if (totalBytes <= 0)
+        return 0.f;
+    return std::min(1.f, (float)((double)bytesSent / (double)totalBytes));
+}
+
+void IAssetUploadTransfer::SetProgress(qint64 sent, qint64 total)
+{
+    bytesSent = sent;
+    totalBytes = total;
+    emit ProgressChanged(this, bytesSent, totalBytes);
+}
+
 void IAssetUploadTransfer::EmitTransferCompleted()
 {
     emit Completed(this);
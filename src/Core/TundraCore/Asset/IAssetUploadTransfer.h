@@ -10,16 +10,19 @@
 #include <QByteArray>
 #include <QHash>
 
+class QIODevice;
+
 /// Represents a currently ongoing asset upload operation.
 class TUNDRACORE_API IAssetUploadTransfer : public QObject, public enable_shared_from_this<IAssetUploadTransfer>
 {
     Q_OBJECT
 
 public:
+    IAssetUploadTransfer();
     virtual ~IAssetUploadTransfer();
 
     /// Returns the current transfer progress in the range [0, 1].
-    virtual float Progress() const { return 0.f; }
+    virtual float Progress() const;
 
     /// Specifies the source file of the upload transfer, or none if this upload does not originate from a file in the system.
     QString sourceFilename;
@@ -27,6 +30,15 @@ public:
     /// Contains the raw asset data to upload. If sourceFilename=="", the data is taken from this array instead.
     std::vector<u8> assetData;
 
+    /// The device the asset data is streamed from, if the upload was started with AssetAPI::UploadAssetFromDevice. In that case assetData is empty.
+    shared_ptr<QIODevice> sourceDevice;
+
+    /// Number of bytes sent so far.
+    qint64 bytesSent;
+
+    /// Total number of bytes to send, or 0 if not known.
+    qint64 totalBytes;
+
     /// Contains the reply from the storage if one was provided. Eg. HTTP PUT/POST may give response data in the body.
     QByteArray replyData;
 
@@ -48,11 +60,15 @@ public:
     /// Emits Failed signal.
     void EmitTransferFailed();
 
+    /// Sets the number of bytes sent and emits ProgressChanged signal.
+    void SetProgress(qint64 sent, qint64 total);
+
 public slots:
     /// Returns the full assetRef address this asset will have when the upload is complete.
     QString AssetRef();
 
     /// Returns a copy of the raw asset data in this upload.
+    /** @note Empty for uploads that stream the data from a device. */
     QByteArray RawData() const;
 
     /// Returns the raw reply data returned by this upload.
@@ -76,4 +92,7 @@ signals:
 
     /// Emitted when upload fails.
     void Failed(IAssetUploadTransfer *transfer);
+
+    /// Emitted when more of the data has been sent.
+    void ProgressChanged(IAssetUploadTransfer *transfer, qint64 bytesSent, qint64 totalBytes);
 };
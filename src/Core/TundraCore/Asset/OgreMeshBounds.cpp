@@ -0,0 +1,161 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#include "StableHeaders.h"
+#include "DebugOperatorNew.h"
+
+#include "OgreMeshBounds.h"
+#include "AssetAPI.h"
+#include "AssetCache.h"
+#include "IAsset.h"
+
+#include <QFile>
+
+#include <cstring>
+
+#include "MemoryLeakCheck.h"
+
+namespace
+{
+
+/// Chunk IDs of the Ogre binary mesh format, see OgreMeshFileFormat.h.
+const u16 cHeaderChunk = 0x1000;
+const u16 cMeshChunk = 0x3000;
+const u16 cMeshBoundsChunk = 0x9000;
+/// Size of the ID and the length of a chunk. The length of a chunk includes it.
+const size_t cChunkOverhead = sizeof(u16) + sizeof(u32);
+/// Maximum length of the version string of the header.
+const size_t cMaxVersionLength = 64;
+
+/// Reads the values of the mesh data in either byte order.
+class MeshDataReader
+{
+public:
+    MeshDataReader(const u8 *data, size_t numBytes, bool swap) : data_(data), size_(numBytes), pos_(0), swap_(swap) {}
+
+    size_t Pos() const { return pos_; }
+    size_t Size() const { return size_; }
+    bool Seek(size_t pos) { if (pos > size_) return false; pos_ = pos; return true; }
+
+    bool Read(void *dst, size_t numBytes)
+    {
+        if (size_ - pos_ < numBytes)
+            return false;
+        memcpy(dst, data_ + pos_, numBytes);
+        if (swap_)
+        {
+            u8 *bytes = (u8 *)dst;
+            for(size_t i = 0; i < numBytes / 2; ++i)
+                std::swap(bytes[i], bytes[numBytes - 1 - i]);
+        }
+        pos_ += numBytes;
+        return true;
+    }
+
+    /// Reads the ID and the length of a chunk. The length includes the chunk header.
+    bool ReadChunkHeader(u16 &id, u32 &length)
+    {
+        return Read(&id, sizeof(id)) && Read(&length, sizeof(length)) && length >= cChunkOverhead;
+    }
+
+private:
+    const u8 *data_;
+    size_t size_;
+    size_t pos_;
+    bool swap_;
+};
+
+}
+
+bool OgreMeshBounds::Read(const u8 *data, size_t numBytes, AABB &bounds)
+{
+    if (!data || numBytes < sizeof(u16))
+        return false;
+
+    // The header chunk ID tells the byte order of the file.
+    const u16 headerId = (u16)(data[0] | (data[1] << 8));
+    bool swap;
+    if (headerId == cHeaderChunk)
+        swap = false;
+    else if (headerId == ((cHeaderChunk >> 8) | ((cHeaderChunk & 0xff) << 8)))
+        swap = true;
+    else
+        return false;
+#if Q_BYTE_ORDER == Q_BIG_ENDIAN
+    swap = !swap;
+#endif
+
+    // The header chunk has no length, only the version string terminated by a line feed.
+    size_t pos = sizeof(u16);
+    while(pos < numBytes && pos < cMaxVersionLength && data[pos] != '\n')
+        ++pos;
+    if (pos >= numBytes || data[pos] != '\n')
+        return false;
+
+    MeshDataReader reader(data, numBytes, swap);
+    reader.Seek(pos + 1);
+    u16 id;
+    u32 length;
+    while(reader.ReadChunkHeader(id, length))
+    {
+        const size_t chunkEnd = reader.Pos() - cChunkOverhead + length;
+        if (id != cMeshChunk)
+        {
+            if (!reader.Seek(chunkEnd))
+                return false;
+            continue;
+        }
+
+        // The mesh chunk begins with the skeletally animated flag, followed by the sub-chunks of the mesh.
+        if (!reader.Seek(reader.Pos() + 1))
+            return false;
+        while(reader.Pos() < chunkEnd && reader.ReadChunkHeader(id, length))
+        {
+            if (id == cMeshBoundsChunk)
+            {
+                float values[6];
+                for(int i = 0; i < 6; ++i)
+                    if (!reader.Read(&values[i], sizeof(float)))
+                        return false;
+                bounds.minPoint = float3(values[0], values[1], values[2]);
+                bounds.maxPoint = float3(values[3], values[4], values[5]);
+                return bounds.IsFinite() && bounds.minPoint.x <= bounds.maxPoint.x &&
+                    bounds.minPoint.y <= bounds.maxPoint.y && bounds.minPoint.z <= bounds.maxPoint.z;
+            }
+            if (!reader.Seek(reader.Pos() - cChunkOverhead + length))
+                return false;
+        }
+        return false;
+    }
+    return false;
+}
+
+bool OgreMeshBounds::ReadFile(const QString &filename, AABB &bounds)
+{
+    QFile file(filename);
+    if (!file.open(QIODevice::ReadOnly) || file.size() <= 0)
+        return false;
+    // Mapped, so that only the pages of the chunk headers are read from the disk.
+    uchar *data = file.map(0, file.size());
+    if (data)
+    {
+        bool ok = Read(data, (size_t)file.size(), bounds);
+        file.unmap(data);
+        return ok;
+    }
+    QByteArray bytes = file.readAll();
+    return Read((const u8 *)bytes.constData(), (size_t)bytes.size(), bounds);
+}
+
+bool OgreMeshBounds::Find(AssetAPI *assetAPI, const QString &assetRef, AABB &bounds)
+{
+    if (!assetAPI)
+        return false;
+    const QString ref = assetAPI->ResolveAssetRef("", assetRef);
+    if (ref.isEmpty())
+        return false;
+
+    AssetPtr asset = assetAPI->GetAsset(ref);
+    if (asset && !asset->DiskSource().isEmpty() && ReadFile(asset->DiskSource(), bounds))
+        return true;
+    return assetAPI->Cache() && assetAPI->Cache()->MeshBounds(ref, bounds);
+}
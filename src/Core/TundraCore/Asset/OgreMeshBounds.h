@@ -0,0 +1,31 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#pragma once
+
+#include "TundraCoreApi.h"
+#include "CoreTypes.h"
+#include "Geometry/AABB.h"
+
+#include <QString>
+
+class AssetAPI;
+
+/// Reads the bounding boxes of Ogre binary meshes (.mesh) without loading them to Ogre.
+/** Only the chunk headers of the mesh are read, skipping the geometry, until the bounds chunk of the mesh is found.
+    Both byte orders of the mesh format are understood. Used by the headless server, which has no Ogre meshes to get the
+    bounds from, e.g. for interest management and for the spatial index of the indexed scene files.
+    The bounds of the meshes in the asset cache are kept in its content index, see AssetCache::MeshBounds. */
+class TUNDRACORE_API OgreMeshBounds
+{
+public:
+    /// Reads the bounds from Ogre binary mesh data. Returns false if the data is not an Ogre mesh or has no bounds.
+    static bool Read(const u8 *data, size_t numBytes, AABB &bounds);
+
+    /// Reads the bounds from an Ogre binary mesh file. Returns false if the file can not be read, is not an Ogre mesh or has no bounds.
+    static bool ReadFile(const QString &filename, AABB &bounds);
+
+    /// Returns the bounds of the mesh of the asset ref, if its data is on the local disk.
+    /** The data is looked for in the disk source of the loaded asset of the ref, and in the asset cache.
+        Returns false if the data is not available without a download, or is not an Ogre binary mesh. */
+    static bool Find(AssetAPI *assetAPI, const QString &assetRef, AABB &bounds);
+};
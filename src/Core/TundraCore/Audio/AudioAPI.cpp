@@ -32,10 +32,17 @@ struct ALCcontext;
 struct ALCdevice;
 #endif
 
+#include <algorithm>
+
 #include "MemoryLeakCheck.h"
 
 using namespace std;
 
+/// The default number of OpenAL sources that the channels share.
+static const uint cDefaultNumSources = 32;
+/// Factor of the audibility of a channel that has a source, so that two channels of about the same audibility do not trade the source each frame.
+static const float cBoundChannelPriority = 1.25f;
+
 struct AudioAPI::AudioApiImpl
 {
 public:
@@ -48,7 +55,8 @@ public:
         captureDevice(0),
         captureSampleSize(0),
         nextChannelId(0),
-        masterGain(0.0f)
+        masterGain(0.0f),
+        maxSources(cDefaultNumSources)
     {
     }
 
@@ -66,6 +74,12 @@ public:
     SoundChannelMap channels;
     /// Next channel id
     sound_id_t nextChannelId;
+    /// The pool of OpenAL sources
+    std::vector<ALuint> sources;
+    /// The sources of the pool that no channel has
+    std::vector<ALuint> freeSources;
+    /// Number of sources to create at Initialize
+    uint maxSources;
     
     /// Listener position
     float3 listenerPosition;
@@ -99,6 +113,17 @@ assetAPI(assetAPI_)
     if (devices.size() > 1)
         LogWarning("[AudioAPI]: Specified multiple --audioDevice parameters. Using \"" + devices.last() + "\".");
 
+    QStringList numSources = fw->CommandLineParameters("--audioSources");
+    if (!numSources.isEmpty())
+    {
+        bool ok = false;
+        uint value = numSources.last().toUInt(&ok);
+        if (ok && value > 0)
+            impl->maxSources = value;
+        else
+            LogWarning("[AudioAPI]: Erroneous number of sources given with --audioSources: " + numSources.last() + ". Ignoring.");
+    }
+
     Initialize(!devices.isEmpty() ? devices.last() : "");    
     LoadSoundSettingsFromConfig();
 
@@ -147,6 +172,20 @@ bool AudioAPI::Initialize(const QString &playbackDeviceName)
     if (!playbackDeviceName.isEmpty())
         LogInfo("Opened OpenAL playback device '" + playbackDeviceName + "'.");
 
+    // Create the pool of sources up front, as many as the device gives.
+    for(uint i = 0; i < impl->maxSources; ++i)
+    {
+        ALuint source = 0;
+        alGetError();
+        alGenSources(1, &source);
+        if (alGetError() != AL_NONE || !source)
+            break;
+        impl->sources.push_back(source);
+    }
+    if (impl->sources.size() < impl->maxSources)
+        LogWarning("Could create only " + QString::number(impl->sources.size()) + " of " + QString::number(impl->maxSources) + " OpenAL sound sources");
+    impl->freeSources = impl->sources;
+
     impl->initialized = true;
     
 #endif
@@ -192,9 +231,16 @@ void AudioAPI::Uninitialize()
 
     StopRecording();
 
+#ifndef TUNDRA_NO_AUDIO
+    // Channels may outlive the API in their users, so take the sources away from them.
+    for(SoundChannelMap::iterator i = impl->channels.begin(); i != impl->channels.end(); ++i)
+        i->second->ReleaseSource();
     impl->channels.clear();
+    if (!impl->sources.empty())
+        alDeleteSources((ALsizei)impl->sources.size(), &impl->sources[0]);
+    impl->sources.clear();
+    impl->freeSources.clear();
 
-#ifndef TUNDRA_NO_AUDIO
     if (impl->context)
     {
         alcMakeContextCurrent(0);
@@ -206,6 +252,8 @@ void AudioAPI::Uninitialize()
         alcCloseDevice(impl->device);
         impl->device = 0;
     }
+#else
+    impl->channels.clear();
 #endif    
     
     impl->initialized = false;
@@ -226,7 +274,7 @@ std::vector<SoundChannelPtr> AudioAPI::ActiveSounds() const
     return ret;
 }
 
-void AudioAPI::Update(f64 /*frametime*/)
+void AudioAPI::Update(f64 frametime)
 {
     if (!impl || !impl->initialized)
         return;
@@ -245,16 +293,45 @@ void AudioAPI::Update(f64 /*frametime*/)
     ALfloat orient[] = {front.x, front.y, front.z, up.x, up.y, up.z};
     alListenerfv(AL_ORIENTATION, orient);
 
-    // Update channel attenuations, check which have stopped
+    // Update channel attenuations, and rank the audible channels
+    std::vector<std::pair<float, SoundChannel*> > audible;
+    audible.reserve(impl->channels.size());
     SoundChannelMap::iterator i = impl->channels.begin();
     while(i != impl->channels.end())
     {
-        i->second->Update(impl->listenerPosition);
+        SoundChannel *channel = i->second.get();
+        channel->UpdateAttenuation(impl->listenerPosition);
+        float audibility = channel->Audibility();
+        if (audibility > 0.f)
+            audible.push_back(make_pair(channel->HasSource() ? audibility * cBoundChannelPriority : audibility, channel));
+        else if (channel->HasSource())
+            impl->freeSources.push_back(channel->ReleaseSource());
+        ++i;
+    }
+
+    // The most audible channels play on the sources, the rest virtually
+    size_t numReal = std::min(audible.size(), impl->sources.size());
+    std::sort(audible.begin(), audible.end(), greater<std::pair<float, SoundChannel*> >());
+    for(size_t j = numReal; j < audible.size(); ++j)
+        if (audible[j].second->HasSource())
+            impl->freeSources.push_back(audible[j].second->ReleaseSource());
+    for(size_t j = 0; j < numReal; ++j)
+        if (!audible[j].second->HasSource() && !impl->freeSources.empty())
+        {
+            audible[j].second->BindSource(impl->freeSources.back());
+            impl->freeSources.pop_back();
+        }
+
+    // Update the channels, check which have stopped
+    for(i = impl->channels.begin(); i != impl->channels.end(); ++i)
+    {
+        i->second->Update(frametime);
         if (i->second->State() == SoundChannel::Stopped)
         {
+            if (i->second->HasSource())
+                impl->freeSources.push_back(i->second->ReleaseSource());
             channelsToDelete.push_back(i);
         }
-        ++i;
     }
 
     // Remove stopped channels
@@ -265,6 +342,11 @@ void AudioAPI::Update(f64 /*frametime*/)
 #endif
 }
 
+uint AudioAPI::NumSources() const
+{
+    return impl ? (uint)impl->sources.size() : 0;
+}
+
 bool AudioAPI::IsInitialized() const
 {
     return impl && impl->initialized;
@@ -328,6 +410,13 @@ void AudioAPI::SetListener(const float3 &position, const Quat &orientation)
     impl->listenerOrientation = orientation;
 }
 
+float3 AudioAPI::ListenerPosition() const
+{
+    if (!impl)
+        return float3::zero;
+    return impl->listenerPosition;
+}
+
 SoundChannelPtr AudioAPI::PlaySound(const AssetPtr &audioAsset, SoundChannel::SoundType type, SoundChannelPtr channel)
 {
     if (!impl || !impl->initialized)
@@ -336,7 +425,7 @@ SoundChannelPtr AudioAPI::PlaySound(const AssetPtr &audioAsset, SoundChannel::So
     if (!channel)
     {
         sound_id_t newId = NextSoundChannelID();
-        channel = MAKE_SHARED(SoundChannel, newId, type);
+        channel = MAKE_SHARED(SoundChannel, newId, type, assetAPI->GetFramework()->Jobs());
         impl->channels.insert(make_pair(newId, channel));
     }
 
@@ -355,7 +444,7 @@ SoundChannelPtr AudioAPI::PlaySound3D(const float3 &position, const AssetPtr &au
     if (!channel)
     {
         sound_id_t newId = NextSoundChannelID();
-        channel = MAKE_SHARED(SoundChannel, newId, type);
+        channel = MAKE_SHARED(SoundChannel, newId, type, assetAPI->GetFramework()->Jobs());
         impl->channels.insert(make_pair(newId, channel));
     }
 
@@ -375,7 +464,7 @@ SoundChannelPtr AudioAPI::PlaySoundBuffer(const SoundBuffer &buffer, SoundChanne
     if (!channel)
     {
         sound_id_t newId = NextSoundChannelID();
-        channel = MAKE_SHARED(SoundChannel, newId, type);
+        channel = MAKE_SHARED(SoundChannel, newId, type, assetAPI->GetFramework()->Jobs());
         impl->channels.insert(make_pair(newId, channel));
     }
 
@@ -396,7 +485,7 @@ SoundChannelPtr AudioAPI::PlaySoundBuffer3D(const SoundBuffer &buffer, SoundChan
     if (!channel)
     {
         sound_id_t newId = NextSoundChannelID();
-        channel = MAKE_SHARED(SoundChannel, newId, type);
+        channel = MAKE_SHARED(SoundChannel, newId, type, assetAPI->GetFramework()->Jobs());
         impl->channels.insert(make_pair(newId, channel));
     }
 
@@ -54,9 +54,13 @@ public:
     uint RecordedSoundData(void* buffer, uint size);
 
     /// Update.
-    /** Cleans up channels not playing anymore, and checks sound cache.
+    /** Gives the OpenAL sources to the most audible channels, updates the channels and cleans up channels not playing anymore.
         This function is called from the core Framework. You should not call this manually. */
     void Update(f64 frametime);
+
+    /// Returns the number of OpenAL sources that the channels share.
+    /** Set with the --audioSources command line parameter. The channels beyond the most audible ones play virtually, without a source. */
+    uint NumSources() const;
     
     /// Returns initialized status
     bool IsInitialized() const;
@@ -80,6 +84,9 @@ public slots:
         @param orientation Orientation as quaternion */
     void SetListener(const float3 &position, const Quat &orientation);
 
+    /// Returns the listener position
+    float3 ListenerPosition() const;
+
     /// Sets master gain of whole sound system
     /** @param masterGain New master gain, in range 0.0 - 1.0 */
     void SetMasterGain(float masterGain);
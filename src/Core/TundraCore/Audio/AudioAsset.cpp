@@ -5,6 +5,8 @@
 
 #include "AudioAsset.h"
 #include "AssetAPI.h"
+#include "Framework.h"
+#include "JobSystem.h"
 #include "LoggingFunctions.h"
 #include "WavLoader.h"
 #include "OggVorbisLoader.h"
@@ -23,8 +25,78 @@
 
 #include "MemoryLeakCheck.h"
 
+/// Decodes a .wav or .ogg file in a worker thread, and loads the asset with the decoded data in the main thread.
+struct AudioAsset::DecodeJob : public IJob
+{
+    DecodeJob(const AudioAssetPtr &asset_, const u8 *data, size_t numBytes, bool isWav_) :
+        IJob("AudioAsset_Decode"),
+        asset(asset_),
+        fileData(new std::vector<u8>(data, data + numBytes)),
+        isWav(isWav_),
+        success(false),
+        streamed(false),
+        duration(0.f)
+    {
+    }
+
+    void Run()
+    {
+        if (isWav)
+        {
+            success = WavLoader::LoadWavFileToSoundBuffer(&(*fileData)[0], fileData->size(), buffer);
+            return;
+        }
+
+        OggVorbisLoader::OggVorbisDecoder decoder(fileData);
+        if (decoder.IsOpen() && decoder.DecodedSize() > AudioAsset::cMinStreamedBytes)
+        {
+            streamed = true;
+            duration = (float)decoder.DecodedSize() / (decoder.Frequency() * (decoder.IsStereo() ? 4 : 2));
+            success = true;
+            return;
+        }
+        success = OggVorbisLoader::LoadOggVorbisFileToSoundBuffer(&(*fileData)[0], fileData->size(), buffer);
+    }
+
+    void Finished()
+    {
+        AudioAssetPtr audioAsset = asset.lock();
+        if (!audioAsset || audioAsset->decodeJob.get() != this)
+            return; // Unloaded or loaded again meanwhile.
+        shared_ptr<DecodeJob> self = audioAsset->decodeJob; // Keep alive until the end, as the asset lets go of the job.
+        audioAsset->decodeJob.reset();
+
+        bool loaded = false;
+        if (success && streamed)
+        {
+            audioAsset->SetStreamedData(fileData, duration);
+            loaded = true;
+        }
+        else if (success && buffer.data.size() > 0)
+            loaded = audioAsset->LoadFromSoundBuffer(buffer);
+
+        if (loaded)
+            audioAsset->assetAPI->AssetLoadCompleted(audioAsset->Name());
+        else
+        {
+            LogError("AudioAsset: Failed to decode " + audioAsset->Name());
+            audioAsset->assetAPI->AssetLoadFailed(audioAsset->Name());
+        }
+    }
+
+    AudioAssetWeakPtr asset;
+    shared_ptr<std::vector<u8> > fileData;
+    bool isWav;
+
+    // Results of Run.
+    bool success;
+    bool streamed;
+    float duration;
+    SoundBuffer buffer;
+};
+
 AudioAsset::AudioAsset(AssetAPI *owner, const QString &type_, const QString &name_)
-:IAsset(owner, type_, name_), handle(0)
+:IAsset(owner, type_, name_), handle(0), duration(0.f)
 {
 }
 
@@ -42,20 +114,43 @@ void AudioAsset::DoUnload()
         handle = 0;
     }
 #endif
+    streamedData.reset();
+    duration = 0.f;
+    decodeJob.reset();
 }
 
-bool AudioAsset::DeserializeFromData(const u8 *data, size_t numBytes, bool /*allowAsynchronous*/)
+void AudioAsset::SetStreamedData(const shared_ptr<std::vector<u8> > &fileData, float duration_)
+{
+    DoUnload();
+    streamedData = fileData;
+    duration = duration_;
+}
+
+bool AudioAsset::DeserializeFromData(const u8 *data, size_t numBytes, bool allowAsynchronous)
 {
     bool loadResult = false;
 
 #ifndef TUNDRA_NO_AUDIO
-    if (WavLoader::IdentifyWavFileInMemory(data, numBytes) && this->Name().endsWith(".wav", Qt::CaseInsensitive)) // Detect whether this file is Wav data or not.
+    bool isWav = WavLoader::IdentifyWavFileInMemory(data, numBytes) && this->Name().endsWith(".wav", Qt::CaseInsensitive); // Detect whether this file is Wav data or not.
+    bool isOgg = !isWav && this->Name().endsWith(".ogg", Qt::CaseInsensitive);
+
+    // Decode in a worker thread if there are any, so that a burst of arriving sounds does not stall the main thread.
+    JobSystem *jobs = assetAPI->GetFramework()->Jobs();
+    if (allowAsynchronous && (isWav || isOgg) && data && numBytes > 0 && jobs && jobs->NumWorkers() > 0)
+    {
+        DoUnload();
+        decodeJob = MAKE_SHARED(DecodeJob, static_pointer_cast<AudioAsset>(shared_from_this()), data, numBytes, isWav);
+        jobs->Schedule(decodeJob, true);
+        return true;
+    }
+
+    if (isWav)
     {
         loadResult = LoadFromWavFileInMemory(data, numBytes);
         if (loadResult)
             assetAPI->AssetLoadCompleted(Name());
     }
-    else if (this->Name().endsWith(".ogg", Qt::CaseInsensitive))
+    else if (isOgg)
     {
         loadResult = LoadFromOggVorbisFileInMemory(data, numBytes);
         if (loadResult)
@@ -80,6 +175,18 @@ bool AudioAsset::LoadFromWavFileInMemory(const u8 *data, size_t numBytes)
 
 bool AudioAsset::LoadFromOggVorbisFileInMemory(const u8 *data, size_t numBytes)
 {
+    if (data && numBytes > 0)
+    {
+        // Open the file once to find out the decoded size, and stream it instead of decoding if it is long.
+        shared_ptr<std::vector<u8> > fileData(new std::vector<u8>(data, data + numBytes));
+        OggVorbisLoader::OggVorbisDecoder decoder(fileData);
+        if (decoder.IsOpen() && decoder.DecodedSize() > cMinStreamedBytes)
+        {
+            SetStreamedData(fileData, (float)decoder.DecodedSize() / (decoder.Frequency() * (decoder.IsStereo() ? 4 : 2)));
+            return true;
+        }
+    }
+
     SoundBuffer buf;
     bool success = OggVorbisLoader::LoadOggVorbisFileToSoundBuffer(data, numBytes, buf);
     if (!success || buf.data.size() == 0)
@@ -121,6 +228,7 @@ bool AudioAsset::LoadFromRawPCMWavData(const u8 *data, size_t numBytes, bool ste
         DoUnload();
         return false;
     }
+    duration = (float)numBytes / (frequency * (stereo ? 2 : 1) * (is16Bit ? 2 : 1));
     return true;
 #else
     return false;
@@ -158,5 +266,5 @@ bool AudioAsset::CreateBuffer()
 
 bool AudioAsset::IsLoaded() const
 {
-    return handle != 0;
+    return handle != 0 || streamedData.get() != 0;
 }
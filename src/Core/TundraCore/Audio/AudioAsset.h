@@ -8,6 +8,11 @@
 #include "SoundBuffer.h"
 
 /// Stores raw decoded audio data ready for playback.
+/** A long .ogg file is streamed instead: the asset keeps only the compressed file, and each SoundChannel that plays it
+    decodes it chunk by chunk while playing. See LoadFromOggVorbisFileInMemory.
+
+    When AssetAPI allows asynchronous loading, the .wav and .ogg files are decoded in a job of the JobSystem, and only
+    the decoded data is uploaded to OpenAL in the main thread, after which the asset is reported loaded. */
 class TUNDRACORE_API AudioAsset : public IAsset
 {
     Q_OBJECT
@@ -17,12 +22,15 @@ public:
 
     ~AudioAsset();
 
+    /// Loads the asset from a .wav or .ogg file. If allowAsynchronous, decodes the file in a worker thread.
     virtual bool DeserializeFromData(const u8 *data, size_t numBytes, bool allowAsynchronous);
 
     /// Loads this audio asset from the given .wav file in memory.
     bool LoadFromWavFileInMemory(const u8 *data, size_t numBytes);
 
     /// Loads this audio asset from the given .ogg file in memory.
+    /** If the decoded sound would take more than cMinStreamedBytes, keeps a copy of the compressed file for streaming
+        instead of decoding it, see IsStreamed. */
     bool LoadFromOggVorbisFileInMemory(const u8 *data, size_t numBytes);
 
     /// Loads this audio asset from the given raw PCM WAV data.
@@ -41,15 +49,43 @@ public:
     /// Returns true on success, false otherwise.
     bool CreateBuffer();
 
+    /// Returns the OpenAL buffer of the decoded sound, or 0 if the sound is streamed or not loaded.
     ALuint GetHandle() const { return handle; }
 
+    /// Returns the length of the sound, in seconds.
+    float Duration() const { return duration; }
+
+    /// Returns whether the sound is streamed, in which case it has no OpenAL buffer.
+    bool IsStreamed() const { return streamedData.get() != 0; }
+
+    /// Returns the compressed .ogg file of a streamed sound, or null.
+    const shared_ptr<std::vector<u8> > &StreamedData() const { return streamedData; }
+
     bool IsLoaded() const;
 
+    /// The decoded size, in bytes, above which a .ogg file is streamed. About 12 seconds of 44.1 kHz 16-bit stereo.
+    static const size_t cMinStreamedBytes = 2 * 1024 * 1024;
+
 private:
     virtual void DoUnload();
 
+    /// Makes this a streamed sound of the given .ogg file.
+    void SetStreamedData(const shared_ptr<std::vector<u8> > &fileData, float duration_);
+
+    /// Decodes the file of the asset in a worker thread.
+    struct DecodeJob;
+
+    /// The pending decode job of an asynchronous load, or null. A job that is no longer the pending one is ignored when it finishes.
+    shared_ptr<DecodeJob> decodeJob;
+
     /// The actual sound data is stored in an OpenAL internal audio buffer. This handle specifies the buffer.
-    /// If == 0, then this AudioAsset is unloaded.
+    /// If == 0, then this AudioAsset is unloaded or streamed.
     ALuint handle;
+
+    /// The length of the sound, in seconds, or 0 if unloaded.
+    float duration;
+
+    /// The compressed .ogg file of a streamed sound, shared with the decoders of the channels that play it.
+    shared_ptr<std::vector<u8> > streamedData;
 };
 
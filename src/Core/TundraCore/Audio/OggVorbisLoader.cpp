@@ -8,6 +8,7 @@
 #include "LoggingFunctions.h"
 
 #include <sstream>
+#include <algorithm>
 
 #ifndef TUNDRA_NO_AUDIO
 #include <vorbis/vorbisfile.h>
@@ -177,4 +178,131 @@ bool LoadOggVorbisFromFileInMemory(const u8 *fileData, size_t numBytes, std::vec
 #endif
 }
 
+#ifndef TUNDRA_NO_AUDIO
+struct OggVorbisDecoder::Impl
+{
+    explicit Impl(const shared_ptr<std::vector<u8> > &fileData) :
+        data(fileData),
+        source(fileData->empty() ? 0 : &(*fileData)[0], fileData->size()),
+        open(false),
+        stereo(false),
+        frequency(0),
+        decodedSize(0)
+    {
+    }
+
+    shared_ptr<std::vector<u8> > data; ///< Holds the file the source reads.
+    OggMemDataSource source;
+    OggVorbis_File vf;
+    bool open;
+    bool stereo;
+    int frequency;
+    size_t decodedSize;
+};
+
+OggVorbisDecoder::OggVorbisDecoder(const shared_ptr<std::vector<u8> > &fileData) :
+    impl(new Impl(fileData))
+{
+    if (fileData->empty())
+    {
+        LogError("OggVorbisDecoder: Null input data passed in");
+        return;
+    }
+
+    ov_callbacks cb;
+    cb.read_func = &OggReadCallback;
+    cb.seek_func = &OggSeekCallback;
+    cb.tell_func = &OggTellCallback;
+    cb.close_func = 0;
+
+    if (ov_open_callbacks(&impl->source, &impl->vf, 0, 0, cb) < 0)
+    {
+        LogError("OggVorbisDecoder: Not ogg vorbis format");
+        ov_clear(&impl->vf);
+        return;
+    }
+    vorbis_info* vi = ov_info(&impl->vf, -1);
+    if (!vi)
+    {
+        LogError("OggVorbisDecoder: No ogg vorbis stream info");
+        ov_clear(&impl->vf);
+        return;
+    }
+    if (vi->channels != 1 && vi->channels != 2)
+        LogWarning("OggVorbisDecoder: Ogg Vorbis data contains an unsupported number of channels: " + QString::number(vi->channels));
+
+    impl->open = true;
+    impl->stereo = (vi->channels > 1);
+    impl->frequency = vi->rate;
+    const ogg_int64_t numSamples = ov_pcm_total(&impl->vf, -1); // Per channel, or negative if not known.
+    impl->decodedSize = (numSamples > 0 ? (size_t)numSamples * vi->channels * 2 : 0);
+}
+
+OggVorbisDecoder::~OggVorbisDecoder()
+{
+    if (impl->open)
+        ov_clear(&impl->vf);
+    delete impl;
+}
+
+bool OggVorbisDecoder::IsOpen() const
+{
+    return impl->open;
+}
+
+bool OggVorbisDecoder::IsStereo() const
+{
+    return impl->stereo;
+}
+
+int OggVorbisDecoder::Frequency() const
+{
+    return impl->frequency;
+}
+
+size_t OggVorbisDecoder::DecodedSize() const
+{
+    return impl->decodedSize;
+}
+
+size_t OggVorbisDecoder::Decode(u8 *dst, size_t maxBytes)
+{
+    if (!impl->open)
+        return 0;
+    size_t decoded = 0;
+    while(decoded < maxBytes)
+    {
+        int bitstream;
+        long ret = ov_read(&impl->vf, (char*)dst + decoded, (int)std::min<size_t>(maxBytes - decoded, 16384), 0, 2, 1, &bitstream);
+        if (ret == OV_HOLE) // A gap in the data, which the decoder skips.
+            continue;
+        if (ret <= 0)
+            break;
+        decoded += ret;
+    }
+    return decoded;
+}
+
+bool OggVorbisDecoder::Rewind()
+{
+    return impl->open && ov_raw_seek(&impl->vf, 0) == 0;
+}
+
+bool OggVorbisDecoder::Seek(double seconds)
+{
+    return impl->open && ov_time_seek(&impl->vf, seconds) == 0;
+}
+#else
+struct OggVorbisDecoder::Impl {};
+OggVorbisDecoder::OggVorbisDecoder(const shared_ptr<std::vector<u8> > &) : impl(0) {}
+OggVorbisDecoder::~OggVorbisDecoder() {}
+bool OggVorbisDecoder::IsOpen() const { return false; }
+bool OggVorbisDecoder::IsStereo() const { return false; }
+int OggVorbisDecoder::Frequency() const { return 0; }
+size_t OggVorbisDecoder::DecodedSize() const { return 0; }
+size_t OggVorbisDecoder::Decode(u8 *, size_t) { return 0; }
+bool OggVorbisDecoder::Rewind() { return false; }
+bool OggVorbisDecoder::Seek(double) { return false; }
+#endif
+
 } // ~OggVorbisLoader
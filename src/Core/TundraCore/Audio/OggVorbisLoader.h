@@ -29,4 +29,44 @@ inline bool TUNDRACORE_API LoadOggVorbisFileToSoundBuffer(const u8 *data, size_t
 /// Returns true the header of the given file in memory matches a .ogg file. \todo Implement this.
 /// bool TUNDRACORE_API IdentifyOggVorbisFileInMemory(const u8 *fileData, size_t numBytes);
 
+/// Decodes a .ogg file in memory chunk by chunk, for streamed playback.
+/** Only the compressed file and the decoder state are kept in memory. Not thread-safe, but it can be used from one
+    thread at a time, f.ex. from a job of the JobSystem. */
+class TUNDRACORE_API OggVorbisDecoder
+{
+public:
+    /// Opens the .ogg file. Check IsOpen for success.
+    /// @param fileData The .ogg file contents. Shared, not copied, so that the decoder can outlive the owner of the data.
+    explicit OggVorbisDecoder(const shared_ptr<std::vector<u8> > &fileData);
+    ~OggVorbisDecoder();
+
+    /// Returns whether the file was opened, and can be decoded.
+    bool IsOpen() const;
+
+    /// Returns whether the decoded data is stereo (true) or mono (false). The data is always 16 bits per sample.
+    bool IsStereo() const;
+
+    /// Returns the sample frequency of the decoded data.
+    int Frequency() const;
+
+    /// Returns the size of the whole decoded PCM data, in bytes.
+    size_t DecodedSize() const;
+
+    /// Decodes the next PCM data, and returns the number of bytes decoded.
+    /** Fills dst up to maxBytes, and decodes less only at the end of the stream or on an error. */
+    size_t Decode(u8 *dst, size_t maxBytes);
+
+    /// Rewinds to the start of the stream. Returns false on an error.
+    bool Rewind();
+
+    /// Moves to the given time from the start of the stream, in seconds. Returns false on an error.
+    bool Seek(double seconds);
+
+private:
+    Q_DISABLE_COPY(OggVorbisDecoder)
+
+    struct Impl;
+    Impl *impl;
+};
+
 } // ~OggVorbisLoader
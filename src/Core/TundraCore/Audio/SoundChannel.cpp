@@ -4,6 +4,8 @@
 #include "DebugOperatorNew.h"
 
 #include "SoundChannel.h"
+#include "OggVorbisLoader.h"
+#include "JobSystem.h"
 #include "LoggingFunctions.h"
 #include "Math/MathFunc.h"
 
@@ -17,7 +19,12 @@
 #endif
 #endif
 
+#include <QMutex>
+#include <QMutexLocker>
+
 #include <cfloat>
+#include <deque>
+#include <algorithm>
 
 #include "MemoryLeakCheck.h"
 
@@ -25,10 +32,83 @@ static const float cMinimumRollOff = 0.1f;
 static const float cDefaultRollOff = 2.0f;
 static const float cDefaultInnerRadius = 1.0f;
 static const float cDefaultOuterRadius = 50.0f;
+/// OpenAL buffers in the ring of a streamed sound.
+static const int cNumStreamBuffers = 4;
+/// Bytes decoded to one stream buffer, about 0.37 seconds of 44.1 kHz 16-bit stereo.
+static const size_t cStreamChunkSize = 65536;
+
+/// The decoder of a streamed sound, and the chunks it has decoded for the channel.
+/** The decode job holds the stream too, so that the channel can stop and go while a job runs. */
+struct SoundChannel::SoundStream
+{
+    explicit SoundStream(const shared_ptr<std::vector<u8> > &fileData) :
+        decoder(fileData),
+        looped(false),
+        finished(false)
+    {
+    }
+
+    /// Decodes the stream in a worker thread.
+    struct DecodeJob : public IJob
+    {
+        explicit DecodeJob(const shared_ptr<SoundStream> &stream_) : IJob("SoundChannel_DecodeStream"), stream(stream_) {}
+
+        void Run() { stream->Decode(); }
+
+        shared_ptr<SoundStream> stream;
+    };
 
-SoundChannel::SoundChannel(sound_id_t channelId_, SoundType type) :
+    /// Decodes chunks until cNumStreamBuffers of them wait for the channel, or until the end of the sound.
+    void Decode()
+    {
+        for(;;)
+        {
+            bool loop;
+            {
+                QMutexLocker lock(&mutex);
+                if (finished || (int)chunks.size() >= cNumStreamBuffers)
+                    return;
+                loop = looped;
+            }
+
+            std::vector<u8> chunk(cStreamChunkSize);
+            size_t size = decoder.Decode(&chunk[0], chunk.size());
+            bool end = (size < chunk.size());
+            if (end && loop && decoder.Rewind())
+            {
+                // Continue from the start in the same chunk, so that the loop has no gap.
+                size += decoder.Decode(&chunk[size], chunk.size() - size);
+                end = (size < chunk.size()); // Only for a broken stream, as a streamed sound is longer than a chunk.
+            }
+            chunk.resize(size);
+
+            QMutexLocker lock(&mutex);
+            if (size > 0)
+            {
+                chunks.push_back(std::vector<u8>());
+                chunks.back().swap(chunk);
+            }
+            finished = end;
+        }
+    }
+
+    /// Used by one decode at a time: by the last job, or by the channel if there is no job system.
+    OggVorbisLoader::OggVorbisDecoder decoder;
+    QMutex mutex;
+    std::deque<std::vector<u8> > chunks; ///< Decoded chunks waiting for a free buffer, guarded by mutex.
+    bool looped; ///< Whether to continue from the start at the end, guarded by mutex.
+    bool finished; ///< Whether the end has been decoded, guarded by mutex.
+
+    // Used only by the channel in the main thread.
+    JobPtr job; ///< The last decode job.
+    std::vector<ALuint> buffers; ///< The ring of OpenAL buffers.
+    std::vector<ALuint> freeBuffers; ///< The buffers that are not queued to the source.
+};
+
+SoundChannel::SoundChannel(sound_id_t channelId_, SoundType type, JobSystem *jobs) :
     type_(type),
     handle_(0),
+    jobs_(jobs),
     pitch_(1.0f),
     gain_(1.0f),
     master_gain_(1.0f),
@@ -37,6 +117,7 @@ SoundChannel::SoundChannel(sound_id_t channelId_, SoundType type) :
     outer_radius_(cDefaultOuterRadius),
     rolloff_(cDefaultRollOff),
     attenuation_(1.0f),
+    playOffset_(0.0f),
     positional_(false),
     looped_(false),
     buffered_mode_(false),
@@ -47,24 +128,40 @@ SoundChannel::SoundChannel(sound_id_t channelId_, SoundType type) :
 
 SoundChannel::~SoundChannel()
 {
-    DeleteSource();
+    // The source belongs to the pool of AudioAPI, which releases it before dropping the channel.
+    Stop();
 }
 
-void SoundChannel::Update(const float3& listener_pos)
+void SoundChannel::Update(f64 frametime)
 {
 #ifndef TUNDRA_NO_AUDIO
-    CalculateAttenuation(listener_pos);
-    SetAttenuatedGain();
-    QueueBuffers();
-    UnqueueBuffers();
-    
+    if (!handle_)
+        UpdateVirtual();
+    else
+    {
+        // The position is set here once a frame, instead of on each SetPosition.
+        SetPositionAndMode();
+        SetAttenuatedGain();
+        QueueBuffers();
+        UnqueueBuffers();
+        UpdateStream();
+    }
+
     if (state_ == Playing)
     {
+        if (!buffered_mode_)
+        {
+            playOffset_ += (float)frametime * pitch_;
+            const float duration = playing_sounds_.size() > 0 ? playing_sounds_.front()->Duration() : 0.f;
+            if (looped_ && duration > 0.f && playOffset_ >= duration)
+                playOffset_ = fmod(playOffset_, duration);
+        }
         if (handle_)
         {
             ALint playing;
             alGetSourcei(handle_, AL_SOURCE_STATE, &playing);
-            if (playing != AL_PLAYING)
+            // A stream that has fallen behind is playing again as soon as it has decoded more.
+            if (playing != AL_PLAYING && !stream_)
             {
                 // Stopped state may trigger removal of audio channel, so don't
                 // do that in buffered mode
@@ -80,74 +177,165 @@ void SoundChannel::Update(const float3& listener_pos)
 #endif
 }
 
-void SoundChannel::Play(AudioAssetPtr audioAsset)
+void SoundChannel::UpdateAttenuation(const float3 &listener_pos)
 {
-#ifndef TUNDRA_NO_AUDIO
-    // Stop any previously buffered sound
-    Stop();
+    if ((outer_radius_ == 0.0f) || (outer_radius_ <= inner_radius_))
+    {
+        attenuation_ = 1.0f;
+        return;
+    }
+      
+    float distance = (position_ - listener_pos).Length();
+    if (distance <= inner_radius_)
+    {
+        attenuation_ = 1.0f;
+        return;
+    }
+    if (distance >= outer_radius_)
+    {
+        attenuation_ = 0.0f;
+        return;
+    }
+    
+    attenuation_ = pow(1.0f - (distance - inner_radius_) / (outer_radius_ - inner_radius_), rolloff_);
+}  
 
-    if (!audioAsset)
+float SoundChannel::Audibility() const
+{
+    if (state_ == Stopped)
+        return 0.f;
+    return master_gain_ * gain_ * (positional_ ? attenuation_ : 1.f);
+}
+
+void SoundChannel::BindSource(ALuint source)
+{
+#ifndef TUNDRA_NO_AUDIO
+    if (handle_ || !source)
         return;
 
-    pending_sounds_.push_back(audioAsset);
+    handle_ = source;
+    alSourcef(handle_, AL_PITCH, pitch_);
+    alSourcei(handle_, AL_LOOPING, looped_ && !stream_ ? AL_TRUE : AL_FALSE);
+    // No matter whether sound is positional or not, we use own attenuation, so OpenAL rolloff is 0
+    alSourcef(handle_, AL_ROLLOFF_FACTOR, 0.0);
+    SetPositionAndMode();
+    SetAttenuatedGain();
 
-    // Start actual playback on next update
-    state_ = Pending;
-    buffered_mode_ = false;
+    // Resume a sound that played virtually from where it is now. Pending sounds start in QueueBuffers.
+    if (state_ != Playing || buffered_mode_ || playing_sounds_.empty())
+        return;
+    AudioAssetPtr sound = playing_sounds_.front();
+    playing_sounds_.clear();
+    if (sound->IsStreamed())
+    {
+        StartStream(sound, playOffset_);
+        return;
+    }
+    ALuint buffer = sound->GetHandle();
+    alSourceQueueBuffers(handle_, 1, &buffer);
+    alSourcef(handle_, AL_SEC_OFFSET, playOffset_);
+    alSourcePlay(handle_);
+    playing_sounds_.push_back(sound);
 #endif
 }
 
-void SoundChannel::AddBuffer(AudioAssetPtr buffer)
+ALuint SoundChannel::ReleaseSource()
 {
 #ifndef TUNDRA_NO_AUDIO
-    pending_sounds_.push_back(buffer);
+    const ALuint source = handle_;
+    if (!source)
+        return 0;
 
-    // Buffered mode should not loop
-    SetLooped(false);
+    if (state_ == Playing && !stream_ && !buffered_mode_)
+    {
+        // Take the exact position from the source, as it may be off from the one counted in Update.
+        ALint playing;
+        alGetSourcei(handle_, AL_SOURCE_STATE, &playing);
+        ALfloat offset = 0.f;
+        alGetSourcef(handle_, AL_SEC_OFFSET, &offset);
+        if (playing == AL_PLAYING)
+            playOffset_ = offset;
+    }
 
-    // Start actual playback on next update
-    if (state_ == Stopped)
+    // Keep playing the sound virtually, and drop the buffers of buffered mode, as they can not wait for a source.
+    AudioAssetPtr sound = !buffered_mode_ && playing_sounds_.size() > 0 ? playing_sounds_.front() : AudioAssetPtr();
+    EndStream();
+    alSourceStop(handle_);
+    alSourcei(handle_, AL_BUFFER, 0);
+    handle_ = 0;
+    playing_sounds_.clear();
+    if (sound)
+        playing_sounds_.push_back(sound);
+    else if (buffered_mode_ && state_ == Playing)
         state_ = Pending;
-    buffered_mode_ = true;
+    return source;
+#else
+    return 0;
 #endif
 }
 
-bool SoundChannel::CreateSource()
+void SoundChannel::UpdateVirtual()
 {
-#ifndef TUNDRA_NO_AUDIO
-    if (!handle_)
-        alGenSources(1, &handle_);
+    if (buffered_mode_)
+    {
+        pending_sounds_.clear();
+        return;
+    }
 
-    if (!handle_)
+    if (state_ == Pending)
+    {
+        // Start once the sound has loaded, as QueueBuffers would.
+        AudioAssetPtr sound = pending_sounds_.size() > 0 ? pending_sounds_.front() : AudioAssetPtr();
+        if (!sound)
+        {
+            pending_sounds_.clear();
+            state_ = Stopped;
+        }
+        else if (sound->IsLoaded())
+        {
+            pending_sounds_.pop_front();
+            playing_sounds_.push_back(sound);
+            playOffset_ = 0.f;
+            state_ = Playing;
+        }
+    }
+    else if (state_ == Playing)
     {
-        LogError("Could not create OpenAL sound source");
-        return false;
+        const float duration = playing_sounds_.size() > 0 ? playing_sounds_.front()->Duration() : 0.f;
+        if (!looped_ && playOffset_ >= duration)
+            Stop();
     }
+}
 
-    alSourcef(handle_, AL_PITCH, pitch_);
-    alSourcei(handle_, AL_LOOPING, looped_ ? AL_TRUE : AL_FALSE);
-    // No matter whether sound is positional or not, we use own attenuation, so OpenAL rolloff is 0
-    alSourcef(handle_, AL_ROLLOFF_FACTOR, 0.0);
+void SoundChannel::Play(AudioAssetPtr audioAsset)
+{
+#ifndef TUNDRA_NO_AUDIO
+    // Stop any previously buffered sound
+    Stop();
 
-    SetPositionAndMode();
-    SetAttenuatedGain();
+    if (!audioAsset)
+        return;
 
-    return true;
-#else
-    return false;
+    pending_sounds_.push_back(audioAsset);
+
+    // Start actual playback on next update
+    state_ = Pending;
+    buffered_mode_ = false;
 #endif
 }
 
-void SoundChannel::DeleteSource()
+void SoundChannel::AddBuffer(AudioAssetPtr buffer)
 {
 #ifndef TUNDRA_NO_AUDIO
-    Stop();
+    pending_sounds_.push_back(buffer);
 
-    if (handle_)
-    {
-        alDeleteSources(1, &handle_);
-        handle_ = 0;
-    }
+    // Buffered mode should not loop
+    SetLooped(false);
+
+    // Start actual playback on next update
+    if (state_ == Stopped)
+        state_ = Pending;
+    buffered_mode_ = true;
 #endif
 }
 
@@ -160,11 +348,13 @@ void SoundChannel::Stop()
         // Set null buffer to be sure we cleared the buffer queue
         alSourcei(handle_, AL_BUFFER, 0);
     }
+    EndStream();
     
     pending_sounds_.clear();
     playing_sounds_.clear();
     
     state_ = Stopped;
+    playOffset_ = 0.f;
 #endif
 }
 
@@ -183,15 +373,11 @@ QString SoundChannel::SoundName() const
 void SoundChannel::SetPosition(const float3 &position)
 {
     position_ = position;
-    
-    SetPositionAndMode();
 }
 
 void SoundChannel::SetPositional(bool enable)
 {
     positional_ = enable;
-   
-    SetPositionAndMode();
 }
 
 void SoundChannel::SetLooped(bool enable)
@@ -202,8 +388,9 @@ void SoundChannel::SetLooped(bool enable)
         enable = false;
 
     looped_ = enable;
+    // A streamed sound loops by decoding it again from the start, see UpdateStream.
     if (handle_)
-        alSourcei(handle_, AL_LOOPING, looped_ ? AL_TRUE : AL_FALSE);
+        alSourcei(handle_, AL_LOOPING, looped_ && !stream_ ? AL_TRUE : AL_FALSE);
 #endif
 }
 
@@ -255,29 +442,6 @@ void SoundChannel::SetPositionAndMode()
 #endif
 }
 
-void SoundChannel::CalculateAttenuation(const float3& listener_pos)
-{
-    if ((outer_radius_ == 0.0f) || (outer_radius_ <= inner_radius_))
-    {
-        attenuation_ = 1.0f;
-        return;
-    }
-      
-    float distance = (position_ - listener_pos).Length();
-    if (distance <= inner_radius_)
-    {
-        attenuation_ = 1.0f;
-        return;
-    }
-    if (distance >= outer_radius_)
-    {
-        attenuation_ = 0.0f;
-        return;
-    }
-    
-    attenuation_ = pow(1.0f - (distance - inner_radius_) / (outer_radius_ - inner_radius_), rolloff_);
-}  
-
 void SoundChannel::SetAttenuatedGain()
 {
 #ifndef TUNDRA_NO_AUDIO
@@ -297,28 +461,32 @@ void SoundChannel::QueueBuffers()
     // See that we do have waiting sounds and they're ready to play
     AudioAssetPtr pending = pending_sounds_.size() > 0 ? pending_sounds_.front() : AudioAssetPtr();
 
-    if (!pending)
+    if (!pending || !handle_)
         return;
     
-    // Create source now if did not exist already
-    if (!CreateSource())
-    {
-        state_ = Stopped;
-        pending_sounds_.clear();
-        return;
-    }
-    
     bool queued = false;
     
     // Buffer pending sounds, move them to playing vector
     while(pending_sounds_.size() > 0)
     {
+        // A streamed sound plays to its end before the sounds after it.
+        if (stream_)
+            break;
         AudioAssetPtr sound = pending_sounds_.front();
         if (!sound)
         {
             pending_sounds_.pop_front();
             continue;
         }
+        if (sound->IsStreamed())
+        {
+            // Stream after the queued buffers have played. UpdateStream starts the playback.
+            if (playing_sounds_.size() > 0)
+                break;
+            pending_sounds_.pop_front();
+            StartStream(sound);
+            continue;
+        }
         ALuint buffer = sound->GetHandle();
         // If no valid handle yet, cannot play this one, break out
         if (!buffer)
@@ -375,7 +543,9 @@ void SoundChannel::UnqueueBuffers()
         {
             ALuint buffer = 0;
             alSourceUnqueueBuffers(handle_, 1, &buffer);
-            if (buffer)
+            if (buffer && stream_ && std::find(stream_->buffers.begin(), stream_->buffers.end(), buffer) != stream_->buffers.end())
+                stream_->freeBuffers.push_back(buffer);
+            else if (buffer)
             {
                 // See if we find matching buffer from the sounds vector.
                 // If found, erase so that the sound may be freed if not used elsewhere
@@ -392,3 +562,108 @@ void SoundChannel::UnqueueBuffers()
     }
 #endif
 }
+
+void SoundChannel::StartStream(const AudioAssetPtr &sound, float offset)
+{
+#ifndef TUNDRA_NO_AUDIO
+    shared_ptr<SoundStream> stream = MAKE_SHARED(SoundStream, sound->StreamedData());
+    if (!stream->decoder.IsOpen())
+        return;
+    if (offset > 0.f)
+        stream->decoder.Seek(offset);
+
+    stream->buffers.resize(cNumStreamBuffers);
+    alGetError();
+    alGenBuffers(cNumStreamBuffers, &stream->buffers[0]);
+    if (alGetError() != AL_NONE)
+    {
+        LogError("Could not create OpenAL stream buffers for " + sound->Name());
+        return;
+    }
+    stream->freeBuffers = stream->buffers;
+    stream->looped = looped_;
+
+    stream_ = stream;
+    playing_sounds_.push_back(sound);
+    alSourcei(handle_, AL_LOOPING, AL_FALSE);
+#endif
+}
+
+void SoundChannel::UpdateStream()
+{
+#ifndef TUNDRA_NO_AUDIO
+    if (!stream_ || !handle_)
+        return;
+    SoundStream &stream = *stream_;
+
+    // Take the chunks decoded meanwhile for the free buffers.
+    std::vector<std::vector<u8> > chunks;
+    bool decodedAll, decodeMore;
+    {
+        QMutexLocker lock(&stream.mutex);
+        stream.looped = looped_;
+        while(chunks.size() < stream.freeBuffers.size() && !stream.chunks.empty())
+        {
+            chunks.push_back(std::vector<u8>());
+            chunks.back().swap(stream.chunks.front());
+            stream.chunks.pop_front();
+        }
+        decodedAll = stream.finished && stream.chunks.empty();
+        decodeMore = !stream.finished && (int)stream.chunks.size() < cNumStreamBuffers;
+    }
+
+    const ALenum format = stream.decoder.IsStereo() ? AL_FORMAT_STEREO16 : AL_FORMAT_MONO16;
+    for(uint i = 0; i < chunks.size(); ++i)
+    {
+        ALuint buffer = stream.freeBuffers.back();
+        stream.freeBuffers.pop_back();
+        alBufferData(buffer, format, (const ALvoid*)&chunks[i][0], (ALsizei)chunks[i].size(), stream.decoder.Frequency());
+        alSourceQueueBuffers(handle_, 1, &buffer);
+    }
+
+    if (decodeMore && (!stream.job || stream.job->IsDone()))
+    {
+        if (jobs_)
+        {
+            stream.job = MAKE_SHARED(SoundStream::DecodeJob, stream_);
+            jobs_->Schedule(stream.job);
+        }
+        else
+            stream.Decode();
+    }
+
+    ALint playing;
+    alGetSourcei(handle_, AL_SOURCE_STATE, &playing);
+    if (playing != AL_PLAYING)
+    {
+        // Starts the playback, or resumes it if the decoding fell behind and the source ran out of buffers.
+        if (stream.freeBuffers.size() < stream.buffers.size())
+        {
+            alSourcePlay(handle_);
+            state_ = Playing;
+        }
+        else if (decodedAll)
+            EndStream();
+    }
+#endif
+}
+
+void SoundChannel::EndStream()
+{
+#ifndef TUNDRA_NO_AUDIO
+    if (!stream_)
+        return;
+
+    if (handle_)
+    {
+        alSourceStop(handle_);
+        alSourcei(handle_, AL_BUFFER, 0);
+        alSourcei(handle_, AL_LOOPING, looped_ ? AL_TRUE : AL_FALSE);
+    }
+    alDeleteBuffers((ALsizei)stream_->buffers.size(), &stream_->buffers[0]);
+    // The job holds the stream, so break the cycle. A job that is still running frees the stream when it returns.
+    stream_->job.reset();
+    stream_.reset();
+    playing_sounds_.clear();
+#endif
+}
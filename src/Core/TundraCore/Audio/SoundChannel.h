@@ -9,7 +9,13 @@
 #include "Math/float3.h"
 #include "AssetFwd.h"
 
+class JobSystem;
+
 /// An OpenAL sound channel (source).
+/** A streamed AudioAsset is decoded while it plays, in jobs of the JobSystem, into a small ring of OpenAL buffers.
+    The channel does not own its OpenAL source: AudioAPI binds the sources of its fixed pool to the most audible
+    channels each frame. A channel without one is virtual, and plays on silently, so that it continues from the
+    right place when it gets a source again. */
 class TUNDRACORE_API SoundChannel : public QObject, public enable_shared_from_this<SoundChannel>
 {
     Q_OBJECT
@@ -45,7 +51,8 @@ public:
         Voice
     };
 
-    SoundChannel(sound_id_t channelId, SoundType type);
+    /// @param jobs The job system that decodes the streamed sounds. If null, they are decoded in Update.
+    SoundChannel(sound_id_t channelId, SoundType type, JobSystem *jobs = 0);
     ~SoundChannel();
     
 public slots:
@@ -71,8 +78,28 @@ public slots:
     void SetRange(float innerRadius, float outerRadius, float rollOff);
 
 public:
-    /// Per-frame update with new listener position
-    void Update(const float3& listenerPos);
+    /// Per-frame update. Plays the sound on the source, or advances the virtual playback if the channel has none.
+    void Update(f64 frametime);
+
+    /// Calculates the distance attenuation from the listener position. Called by AudioAPI each frame before Update.
+    void UpdateAttenuation(const float3 &listenerPos);
+
+    /// Returns the final gain of the channel, gain * master gain * distance attenuation, or 0 if stopped.
+    /** AudioAPI gives the sources to the channels that have the highest audibility. */
+    float Audibility() const;
+
+    /// Returns whether the channel is playing or pending without an OpenAL source.
+    bool IsVirtual() const { return !handle_ && state_ != Stopped; }
+
+    /// Returns whether the channel has an OpenAL source.
+    bool HasSource() const { return handle_ != 0; }
+
+    /// Gives the channel an OpenAL source from the pool of AudioAPI, and resumes the playback on it.
+    void BindSource(ALuint source);
+
+    /// Stops the playback on the OpenAL source, keeping the channel playing virtually, and returns the source to give back to the pool.
+    /** Returns 0 if the channel had no source. */
+    ALuint ReleaseSource();
 
     /// Return current state of channel.
     SoundState State() const { return state_; }
@@ -133,12 +160,14 @@ private:
     void QueueBuffers();
     /// Remove processed buffers
     void UnqueueBuffers();
-    /// Create OpenAL source if one does not exist yet
-    bool CreateSource();
-    /// Delete OpenAL source
-    void DeleteSource();
-    /// Calculate attenuation from position, listener position & range parameters
-    void CalculateAttenuation(const float3 &listener_pos);
+    /// Advance the playback of a channel without a source
+    void UpdateVirtual();
+    /// Start streaming a streamed sound, once the queued buffers have played, from the given time in seconds
+    void StartStream(const AudioAssetPtr &sound, float offset = 0.f);
+    /// Queue the decoded chunks of the streamed sound, and decode more
+    void UpdateStream();
+    /// Stop streaming, and free the stream buffers
+    void EndStream();
     /// Set positionality & position
     void SetPositionAndMode();
     /// Set gain, taking attenuation into account
@@ -152,6 +181,11 @@ private:
     std::list<AudioAssetPtr> pending_sounds_;
     /// Currently playing sound buffers
     std::vector<AudioAssetPtr> playing_sounds_;
+    /// State of the sound being streamed, shared with its decode job. Null if no sound is streamed
+    struct SoundStream;
+    shared_ptr<SoundStream> stream_;
+    /// Job system that decodes the streamed sounds, or null
+    JobSystem *jobs_;
     /// Pitch
     float pitch_;
     /// Gain
@@ -166,6 +200,8 @@ private:
     float rolloff_;
     /// Last calculated attenuation factor
     float attenuation_;
+    /// Playback position in the playing sound, in seconds. Not kept in buffered mode
+    float playOffset_;
     /// Looped flag
     bool looped_;
     /// Positional flag
@@ -10,6 +10,7 @@
 #include "ConsoleAPI.h"
 #include "ConsoleWidget.h"
 #include "ShellInputThread.h"
+#include "LogWriter.h"
 #include "Application.h"
 #include "Profiler.h"
 #include "Framework.h"
@@ -30,18 +31,26 @@
 
 #include "MemoryLeakCheck.h"
 
+namespace
+{
+/// Number of the warning, info and debug messages written per second by default, see LogWriter.
+const int cDefaultLogRateLimit = 200;
+} // ~unnamed namespace
+
 ConsoleAPI::ConsoleAPI(Framework *fw) :
     QObject(fw),
     framework(fw),
     enabledLogChannels(LogLevelErrorWarnInfo),
     logFile(0),
-    logFileText(0)
+    logFileText(0),
+    logWriter(new LogWriter)
 {
 }
 
 ConsoleAPI::~ConsoleAPI()
 {
     Reset();
+    SAFE_DELETE(logWriter);
 }
 
 void ConsoleAPI::Reset()
@@ -50,6 +59,8 @@ void ConsoleAPI::Reset()
     inputContext.reset();
     SAFE_DELETE(consoleWidget);
     shellInputThread.reset();
+    logWriter->Flush();
+    logWriter->SetLogFile(0);
     SAFE_DELETE(logFileText);
     SAFE_DELETE(logFile);
 }
@@ -184,43 +195,29 @@ void ConsoleAPI::ExecuteCommand(const QString &command)
 
 void ConsoleAPI::Print(const QString &message)
 {
-    if (consoleWidget)
-        consoleWidget->PrintToConsole(message);
-    else if (!framework->IsHeadless())
-        backBuffer << message; // ConsoleWidget not created yet, but will be - store message to back buffer.
+    logWriter->Write(0, message);
+}
 
-    ///\todo Temporary hack which appends line ending in case it's not there (output of console commands in headless mode)
-    if (!message.endsWith("\n"))
-    {
-#ifndef ANDROID
-        printf("%s\n", message.toStdString().c_str());
-#else
-        __android_log_print(ANDROID_LOG_INFO, "Tundra", "%s\n", message.toStdString().c_str());
-#endif
-        if (logFileText)
-        {
-            (*logFileText) << message << "\n";
-            /// \note If we want to guarantee that each message gets to the log even in the presence of a crash, we must flush()
-            /// after each write. Tested that on Windows 7, if you kill the process using Ctrl-C on command line, or from 
-            /// task manager, the log will not contain all the text, so this is required for correctness.
-            /// But this flush() after each message also causes a *serious* performance drawback.
-            /// One way to try avoiding this issue is to move to using C API for file writing, and at atexit() and other crash
-            /// handlers, close the file handle gracefully.
-            logFileText->flush(); 
-        }
-    }
-    else
+void ConsoleAPI::Write(u32 logChannel, const QString &message)
+{
+    logWriter->Write(logChannel, message);
+}
+
+void ConsoleAPI::FlushLog()
+{
+    logWriter->Flush();
+}
+
+void ConsoleAPI::PrintDisplayedMessages()
+{
+    QStringList messages;
+    logWriter->TakeDisplayed(messages);
+    foreach(const QString &message, messages)
     {
-#ifndef ANDROID
-        printf("%s", message.toStdString().c_str());
-#else
-        __android_log_print(ANDROID_LOG_INFO, "Tundra", "%s", message.toStdString().c_str());
-#endif
-        if (logFileText)
-        {
-            (*logFileText) << message;
-            logFileText->flush(); // See comment about flush() above.
-        }
+        if (consoleWidget)
+            consoleWidget->PrintToConsole(message);
+        else if (!framework->IsHeadless())
+            backBuffer << message; // ConsoleWidget not created yet, but will be - store message to back buffer.
     }
 }
 
@@ -263,12 +260,12 @@ void ConsoleAPI::SetLogFile(const QString &wildCardFilename)
     QString filename = Application::ParseWildCardFilename(wildCardFilename);
     
     // An empty log file closes the log output writing.
+    logWriter->SetLogFile(0);
+    SAFE_DELETE(logFileText);
+    SAFE_DELETE(logFile);
     if (filename.isEmpty())
-    {
-        SAFE_DELETE(logFileText);
-        SAFE_DELETE(logFile);
         return;
-    }
+
     logFile = new QFile(filename);
     bool isOpen = logFile->open(QIODevice::WriteOnly | QIODevice::Text);
     if (!isOpen)
@@ -278,8 +275,9 @@ void ConsoleAPI::SetLogFile(const QString &wildCardFilename)
     }
     else
     {
-        printf("Opened logging file \"%s\".\n", filename.toStdString().c_str());
+        Print("Opened logging file \"" + filename + "\".");
         logFileText = new QTextStream(logFile);
+        logWriter->SetLogFile(logFileText);
     }
 }
 
@@ -287,6 +285,8 @@ void ConsoleAPI::Update(f64 /*frametime*/)
 {
     PROFILE(ConsoleAPI_Update);
 
+    PrintDisplayedMessages();
+
     std::string input = shellInputThread->GetLine();
     if (input.length() > 0)
         ExecuteCommand(input.c_str());
@@ -312,6 +312,23 @@ void ConsoleAPI::Initialize()
     if (logFile.size() > 1)
         LogWarning("Ignoring multiple --logFile command line parameters!");
 
+    const QStringList rateLimit = framework->CommandLineParameters("--logRateLimit");
+    if (rateLimit.size() >= 1)
+    {
+        bool ok = false;
+        const int messagesPerSecond = rateLimit.last().toInt(&ok);
+        if (ok && messagesPerSecond >= 0)
+            logWriter->SetRateLimit(messagesPerSecond);
+        else
+            LogWarning("Invalid --logRateLimit " + rateLimit.last() + ", not limiting the log rate.");
+    }
+    else
+        logWriter->SetRateLimit(cDefaultLogRateLimit);
+    // Write in the background only from here on, so that nothing of the early startup is lost if it crashes.
+    logWriter->SetAsynchronous(!framework->HasCommandLineParameter("--syncLogging"));
+
+    PrintDisplayedMessages();
+    logWriter->SetCollectDisplayed(!framework->IsHeadless());
     if (!framework->IsHeadless())
     {
        consoleWidget = new ConsoleWidget(framework);
@@ -22,6 +22,7 @@ class Framework;
 class ConsoleWidget;
 class ShellInputThread;
 class ConsoleCommand;
+class LogWriter;
 
 /// Console core API.
 /** Allows printing text to console, executing console commands programmatically and registering new console commands.
@@ -45,6 +46,15 @@ public:
     /// Erases all registered console commands and stops the native input thread.
     void Reset();
 
+    /// Writes a message of a log channel to the console widget's log, stdout and the log file.
+    /** The message is written in the background, see LogWriter, unless --syncLogging is given. Thread-safe.
+        @param logChannel The LogChannel of the message, or 0 for a plain print.
+        @note Does not check whether the channel is enabled, see PrintLogMessage. */
+    void Write(u32 logChannel, const QString &message);
+
+    /// Writes out the queued log messages before returning.
+    void FlushLog();
+
     /// Registers a new console command which invokes a slot on the specified QObject.
     /** @param name The function name to use for this command.
         @param desc A help description of this command.
@@ -77,7 +87,8 @@ public slots:
     void ExecuteCommand(const QString &command);
 
     /// Prints a message to the console widget's log and stdout.
-    /** @param message The text message to print. */
+    /** @param message The text message to print.
+        @note The message reaches the console widget in the next frame. */
     void Print(const QString &message);
 
     /// Lists all console commands and their descriptions to the log.
@@ -141,6 +152,10 @@ private:
     QFile *logFile; ///< Points to the currently open text file for logging.
     QTextStream *logFileText;
     QStringList backBuffer; ///< Back buffer of unprinted log prints before ConsoleWidget is created.
+    LogWriter *logWriter; ///< Writes the log output in the background.
+
+    /// Prints the messages written since the last call to the console widget, or to the back buffer.
+    void PrintDisplayedMessages();
 
 private slots:
     void HandleKeyEvent(KeyEvent *e);
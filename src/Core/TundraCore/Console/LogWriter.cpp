@@ -0,0 +1,327 @@
+/**
+    For conditions of distribution and use, see copyright notice in LICENSE
+
+    @file   LogWriter.cpp
+    @brief  Writes the log output to stdout and the log file in a background thread. */
+
+#include "StableHeaders.h"
+#include "DebugOperatorNew.h"
+
+#include "LogWriter.h"
+#include "LoggingFunctions.h"
+#include "HighPerfClock.h"
+
+#include <QThread>
+#include <QMutexLocker>
+#include <QTextStream>
+
+#include <stdio.h>
+#include <limits.h>
+
+#include "Win.h"
+
+#ifdef ANDROID
+#include <android/log.h>
+#endif
+
+#include "MemoryLeakCheck.h"
+
+class LogWriter::WriterThread : public QThread
+{
+public:
+    explicit WriterThread(LogWriter *owner) : owner_(owner) {}
+    void run() { owner_->Run(); }
+
+private:
+    LogWriter *owner_;
+};
+
+LogWriter::LogWriter() :
+    head(0),
+    numPending(0),
+    numDropped(0),
+    asynchronous(0),
+    thread(0),
+    sleeping(0),
+    quit(false),
+    logFile(0),
+    lastChannel(0),
+    repeats(0),
+    repeatsStartTime(0),
+    rateLimit(0),
+    rateWindowStartTime(0),
+    rateWindowCount(0),
+    suppressed(0),
+    wroteToLogFile(false),
+    collectDisplayed(true)
+{
+}
+
+LogWriter::~LogWriter()
+{
+    SetAsynchronous(false);
+}
+
+void LogWriter::SetAsynchronous(bool enabled)
+{
+    if (enabled == IsAsynchronous())
+        return;
+
+    if (enabled)
+    {
+        thread = new WriterThread(this);
+        thread->start();
+        asynchronous.fetchAndStoreOrdered(1);
+        return;
+    }
+
+    asynchronous.fetchAndStoreOrdered(0);
+    {
+        QMutexLocker lock(&sleepMutex);
+        quit = true;
+        messageQueued.wakeAll();
+    }
+    thread->wait();
+    delete thread;
+    thread = 0;
+    quit = false;
+    // Write the messages that were queued while the thread was stopping.
+    Flush();
+}
+
+void LogWriter::Write(u32 logChannel, const QString &text)
+{
+    if (!asynchronous.fetchAndAddOrdered(0))
+    {
+        QMutexLocker lock(&processMutex);
+        Process(logChannel, text);
+        // Flush after each message, see the note in the class description.
+        if (logFile && wroteToLogFile)
+            logFile->flush();
+        wroteToLogFile = false;
+        return;
+    }
+
+    if (numPending.fetchAndAddRelaxed(1) >= cMaxPending)
+    {
+        numPending.deref();
+        numDropped.ref();
+        return;
+    }
+
+    Message *message = new Message;
+    message->channel = logChannel;
+    message->text = text;
+    Message *first;
+    do
+    {
+        first = head;
+        message->next = first;
+    } while(!head.testAndSetOrdered(first, message));
+
+    // Lock only to wake the thread up, so that a burst of messages does not contend with the writer.
+    if (sleeping.fetchAndAddOrdered(0))
+    {
+        QMutexLocker lock(&sleepMutex);
+        messageQueued.wakeOne();
+    }
+}
+
+void LogWriter::Flush()
+{
+    QMutexLocker lock(&processMutex);
+    ProcessQueued();
+    ReportRepeats();
+    ReportSuppressed();
+    if (logFile && wroteToLogFile)
+        logFile->flush();
+    wroteToLogFile = false;
+}
+
+void LogWriter::SetLogFile(QTextStream *stream)
+{
+    QMutexLocker lock(&processMutex);
+    if (logFile && wroteToLogFile)
+        logFile->flush();
+    logFile = stream;
+    wroteToLogFile = false;
+}
+
+void LogWriter::SetRateLimit(int messagesPerSecond)
+{
+    QMutexLocker lock(&processMutex);
+    rateLimit = messagesPerSecond > 0 ? messagesPerSecond : 0;
+}
+
+void LogWriter::SetCollectDisplayed(bool enabled)
+{
+    QMutexLocker lock(&displayMutex);
+    collectDisplayed = enabled;
+    if (!collectDisplayed)
+        displayed.clear();
+}
+
+void LogWriter::TakeDisplayed(QStringList &messages)
+{
+    QMutexLocker lock(&displayMutex);
+    messages.swap(displayed);
+    displayed.clear();
+}
+
+void LogWriter::Run()
+{
+    for(;;)
+    {
+        bool hasReports;
+        {
+            QMutexLocker lock(&processMutex);
+            const bool processed = ProcessQueued();
+            if (logFile && wroteToLogFile)
+                logFile->flush();
+            wroteToLogFile = false;
+            if (processed)
+                continue;
+            hasReports = repeats > 0 || suppressed > 0 || numDropped.fetchAndAddRelaxed(0) > 0;
+        }
+
+        QMutexLocker lock(&sleepMutex);
+        if (quit)
+            return;
+        sleeping.fetchAndStoreOrdered(1);
+        bool timedOut = false;
+        // Check the queue again after setting the flag, as Write checks the flag after pushing.
+        if (head.testAndSetOrdered(0, 0))
+            timedOut = !messageQueued.wait(&sleepMutex, hasReports ? 1000 : ULONG_MAX);
+        sleeping.fetchAndStoreOrdered(0);
+        lock.unlock();
+
+        // Idle for a second: the burst is over, so report what was collapsed or suppressed.
+        if (timedOut)
+        {
+            QMutexLocker processLock(&processMutex);
+            ReportRepeats();
+            ReportSuppressed();
+            if (logFile && wroteToLogFile)
+                logFile->flush();
+            wroteToLogFile = false;
+        }
+    }
+}
+
+bool LogWriter::ProcessQueued()
+{
+    // The stack is linked newest first, so reverse it.
+    Message *message = head.fetchAndStoreAcquire(0);
+    if (!message)
+        return false;
+    Message *oldest = 0;
+    while(message)
+    {
+        Message *next = message->next;
+        message->next = oldest;
+        oldest = message;
+        message = next;
+    }
+    while(oldest)
+    {
+        Message *next = oldest->next;
+        numPending.deref();
+        Process(oldest->channel, oldest->text);
+        delete oldest;
+        oldest = next;
+    }
+    return true;
+}
+
+void LogWriter::Process(u32 channel, const QString &text)
+{
+    const u64 now = GetCurrentClockTime();
+    const u64 freq = GetCurrentClockFreq();
+
+    // Plain prints are never collapsed, as the output of a console command may well repeat a line.
+    if (channel != 0 && channel == lastChannel && text == lastText)
+    {
+        if (repeats++ == 0)
+            repeatsStartTime = now;
+        else if (now - repeatsStartTime >= freq)
+            ReportRepeats();
+        return;
+    }
+    ReportRepeats();
+
+    if (channel != 0 && (channel & LogChannelError) == 0 && rateLimit > 0)
+    {
+        if (now - rateWindowStartTime >= freq)
+        {
+            ReportSuppressed();
+            rateWindowStartTime = now;
+            rateWindowCount = 0;
+        }
+        if (++rateWindowCount > rateLimit)
+        {
+            ++suppressed;
+            lastChannel = 0; // The repeats of a suppressed message are suppressed too.
+            lastText.clear();
+            return;
+        }
+    }
+
+    Output(channel, text);
+    lastChannel = channel;
+    lastText = (channel != 0 ? text : QString());
+}
+
+void LogWriter::ReportRepeats()
+{
+    if (repeats == 0)
+        return;
+    const int count = repeats;
+    repeats = 0;
+    Output(lastChannel, QString("Last message repeated %1 times.\n").arg(count));
+}
+
+void LogWriter::ReportSuppressed()
+{
+    const int dropped = numDropped.fetchAndStoreRelaxed(0);
+    if (dropped > 0)
+        Output(LogChannelWarning, QString("Warning: Dropped %1 log messages, the log output fell %2 messages behind.\n").arg(dropped).arg(cMaxPending));
+    if (suppressed > 0)
+    {
+        Output(LogChannelWarning, QString("Warning: Suppressed %1 log messages over the limit of %2 messages per second.\n").arg(suppressed).arg(rateLimit));
+        suppressed = 0;
+    }
+}
+
+void LogWriter::Output(u32 channel, const QString &text)
+{
+    // On Windows, highlight errors and warnings.
+#ifdef WIN32
+    if ((channel & LogChannelError) != 0) SetConsoleTextAttribute(GetStdHandle(STD_OUTPUT_HANDLE), FOREGROUND_RED | FOREGROUND_INTENSITY);
+    else if ((channel & LogChannelWarning) != 0) SetConsoleTextAttribute(GetStdHandle(STD_OUTPUT_HANDLE), FOREGROUND_RED | FOREGROUND_GREEN | FOREGROUND_INTENSITY);
+#endif
+
+    ///\todo Temporary hack which appends line ending in case it's not there (output of console commands in headless mode)
+    const bool endsWithNewline = text.endsWith("\n");
+    const std::string str = text.toStdString();
+#ifndef ANDROID
+    printf(endsWithNewline ? "%s" : "%s\n", str.c_str());
+#else
+    __android_log_print(ANDROID_LOG_INFO, "Tundra", endsWithNewline ? "%s" : "%s\n", str.c_str());
+#endif
+    if (logFile)
+    {
+        (*logFile) << text;
+        if (!endsWithNewline)
+            (*logFile) << "\n";
+        wroteToLogFile = true;
+    }
+
+    // Restore the text color to normal.
+#ifdef WIN32
+    SetConsoleTextAttribute(GetStdHandle(STD_OUTPUT_HANDLE), FOREGROUND_RED | FOREGROUND_GREEN | FOREGROUND_BLUE);
+#endif
+
+    QMutexLocker lock(&displayMutex);
+    if (collectDisplayed)
+        displayed << text;
+}
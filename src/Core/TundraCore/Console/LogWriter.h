@@ -0,0 +1,129 @@
+/**
+    For conditions of distribution and use, see copyright notice in LICENSE
+
+    @file   LogWriter.h
+    @brief  Writes the log output to stdout and the log file in a background thread. */
+
+#pragma once
+
+#include "CoreTypes.h"
+
+#include <QString>
+#include <QStringList>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QAtomicInt>
+#include <QAtomicPointer>
+
+class QTextStream;
+
+/// Writes the log output to stdout and the log file in a background thread, collapsing repeated messages and limiting their rate.
+/** Write pushes the message to a lock-free stack, like the event queue of the WebSocket server, and returns, so that a
+    log print costs the same on the hot path however slow the terminal or the log file is. The writer thread takes the
+    messages in batches and flushes the log file once per batch instead of after each message.
+
+    Consecutive repeats of a message are collapsed to a "Last message repeated N times" line, which is written once the
+    message changes, a second has passed or the writer goes idle. At most RateLimit warning, info and debug messages per
+    second are written, and the rest are counted and reported as suppressed. Errors and plain prints are never suppressed.
+    If the thread falls more than cMaxPending messages behind, the new messages are dropped and reported as such.
+
+    The written messages are also collected for the console widget, which ConsoleAPI prints in the main thread.
+    Until SetAsynchronous is called, and with --syncLogging, Write writes in the calling thread and flushes the log file
+    after each message, so that nothing is lost if the process crashes. Owned by ConsoleAPI. */
+class LogWriter
+{
+public:
+    LogWriter();
+    /// Writes out the queued messages and stops the thread.
+    ~LogWriter();
+
+    /// Starts or stops the background thread. A stopped writer writes in the calling thread.
+    void SetAsynchronous(bool enabled);
+
+    /// Returns whether the messages are written in the background thread.
+    bool IsAsynchronous() const { return thread != 0; }
+
+    /// Queues a message. Thread-safe.
+    /** @param logChannel The LogChannel of the message, or 0 for a plain print, e.g. the output of a console command. */
+    void Write(u32 logChannel, const QString &text);
+
+    /// Writes out the queued messages and the pending repeat and suppression reports before returning. Thread-safe.
+    void Flush();
+
+    /// Sets the stream the messages are written to in addition to stdout, or null. Thread-safe.
+    /** The caller keeps the ownership, and can delete the previous stream once this returns. */
+    void SetLogFile(QTextStream *stream);
+
+    /// Sets the number of the warning, info and debug messages written per second, or 0 for no limit. Thread-safe.
+    void SetRateLimit(int messagesPerSecond);
+
+    /// Returns the number of the warning, info and debug messages written per second, or 0 for no limit.
+    int RateLimit() const { return rateLimit; }
+
+    /// Sets whether the written messages are collected for TakeDisplayed.
+    void SetCollectDisplayed(bool enabled);
+
+    /// Takes the collected messages in the order they were written. Thread-safe.
+    void TakeDisplayed(QStringList &messages);
+
+    /// The number of the messages the thread can fall behind before the new ones are dropped.
+    static const int cMaxPending = 16384;
+
+private:
+    Q_DISABLE_COPY(LogWriter)
+
+    class WriterThread;
+
+    struct Message
+    {
+        u32 channel;
+        QString text;
+        Message *next;
+    };
+
+    /// Main loop of the writer thread.
+    void Run();
+
+    /// Takes and processes the queued messages. Returns false if there were none. Call with processMutex locked.
+    bool ProcessQueued();
+
+    /// Collapses, rate-limits and writes a message. Call with processMutex locked.
+    void Process(u32 channel, const QString &text);
+
+    /// Writes the report of the repeats of the last message, if any. Call with processMutex locked.
+    void ReportRepeats();
+
+    /// Writes the report of the suppressed and dropped messages, if any. Call with processMutex locked.
+    void ReportSuppressed();
+
+    /// Writes a message to stdout and the log file, and collects it for the console widget. Call with processMutex locked.
+    void Output(u32 channel, const QString &text);
+
+    QAtomicPointer<Message> head; ///< Lock-free stack of the queued messages, newest first.
+    QAtomicInt numPending; ///< Number of the queued messages.
+    QAtomicInt numDropped; ///< Number of the messages dropped for going over cMaxPending.
+    QAtomicInt asynchronous; ///< Whether Write queues the messages for the thread.
+
+    WriterThread *thread;
+    QMutex sleepMutex;
+    QWaitCondition messageQueued; ///< Wakes the writer thread, with sleepMutex.
+    QAtomicInt sleeping; ///< Whether the writer thread is waiting for messageQueued.
+    bool quit; ///< Guarded by sleepMutex.
+
+    // The output state, guarded by processMutex.
+    QMutex processMutex;
+    QTextStream *logFile;
+    u32 lastChannel; ///< Channel of the last written message, 0 if it can not be repeated.
+    QString lastText;
+    int repeats; ///< Number of the repeats of the last message since it was written or reported.
+    u64 repeatsStartTime; ///< Clock time of the first unreported repeat.
+    int rateLimit;
+    u64 rateWindowStartTime; ///< Clock time of the start of the current second of the rate limit.
+    int rateWindowCount; ///< Number of the rate-limited messages in the current second.
+    int suppressed; ///< Number of the messages suppressed by the rate limit and not reported yet.
+    bool wroteToLogFile; ///< Whether the log file has unflushed output.
+
+    QMutex displayMutex;
+    bool collectDisplayed; ///< Guarded by displayMutex.
+    QStringList displayed; ///< Guarded by displayMutex.
+};
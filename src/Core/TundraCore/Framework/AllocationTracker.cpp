@@ -0,0 +1,151 @@
+/**
+    For conditions of distribution and use, see copyright notice in LICENSE
+
+    @file   AllocationTracker.cpp
+    @brief  Counts the heap allocations of the main thread, for attributing them to the modules and the profiling blocks. */
+
+#include "StableHeaders.h"
+#include "DebugOperatorNew.h"
+
+#include "AllocationTracker.h"
+
+#include <stdlib.h>
+#include <new>
+
+#include "MemoryLeakCheck.h"
+
+#if defined(_MSC_VER)
+#define TUNDRA_THREAD_LOCAL __declspec(thread)
+#else
+#define TUNDRA_THREAD_LOCAL __thread
+#endif
+
+namespace
+{
+
+// Plain zero-initialized data, as the allocations start before any constructors of the statics are run.
+bool enabled = false;
+TUNDRA_THREAD_LOCAL bool isMainThread = false;
+u64 numAllocations = 0;
+u64 numBytes = 0;
+u64 numFrees = 0;
+
+} // ~unnamed namespace
+
+bool AllocationTracker::IsAvailable()
+{
+#ifdef ALLOCATION_TRACKING
+    return true;
+#else
+    return false;
+#endif
+}
+
+void AllocationTracker::SetEnabled(bool enable)
+{
+    enabled = enable && IsAvailable();
+}
+
+bool AllocationTracker::IsEnabled()
+{
+    return enabled;
+}
+
+void AllocationTracker::SetMainThread()
+{
+    isMainThread = true;
+}
+
+AllocationCounts AllocationTracker::MainThreadCounts()
+{
+    AllocationCounts counts;
+    counts.allocations = numAllocations;
+    counts.bytes = numBytes;
+    counts.frees = numFrees;
+    return counts;
+}
+
+void *AllocationTracker::Allocate(std::size_t size)
+{
+    void *ptr = malloc(size > 0 ? size : 1);
+    if (!ptr)
+        throw std::bad_alloc();
+    if (enabled && isMainThread)
+    {
+        ++numAllocations;
+        numBytes += size;
+    }
+    return ptr;
+}
+
+void AllocationTracker::Free(void *ptr)
+{
+    if (!ptr)
+        return;
+    if (enabled && isMainThread)
+        ++numFrees;
+    free(ptr);
+}
+
+#if defined(ALLOCATION_TRACKING) && !defined(_MSC_VER)
+// Replaces the global operators of the process. On MSVC they are inlined to each compilation unit, see DebugOperatorNew.h.
+#if __cplusplus >= 201103L
+#define TUNDRA_THROW_BAD_ALLOC
+#else
+#define TUNDRA_THROW_BAD_ALLOC throw(std::bad_alloc)
+#endif
+
+void *operator new(std::size_t size) TUNDRA_THROW_BAD_ALLOC
+{
+    return AllocationTracker::Allocate(size);
+}
+
+void *operator new[](std::size_t size) TUNDRA_THROW_BAD_ALLOC
+{
+    return AllocationTracker::Allocate(size);
+}
+
+void *operator new(std::size_t size, const std::nothrow_t &) throw()
+{
+    try
+    {
+        return AllocationTracker::Allocate(size);
+    }
+    catch(const std::bad_alloc &)
+    {
+        return 0;
+    }
+}
+
+void *operator new[](std::size_t size, const std::nothrow_t &) throw()
+{
+    try
+    {
+        return AllocationTracker::Allocate(size);
+    }
+    catch(const std::bad_alloc &)
+    {
+        return 0;
+    }
+}
+
+void operator delete(void *ptr) throw()
+{
+    AllocationTracker::Free(ptr);
+}
+
+void operator delete[](void *ptr) throw()
+{
+    AllocationTracker::Free(ptr);
+}
+
+void operator delete(void *ptr, const std::nothrow_t &) throw()
+{
+    AllocationTracker::Free(ptr);
+}
+
+void operator delete[](void *ptr, const std::nothrow_t &) throw()
+{
+    AllocationTracker::Free(ptr);
+}
+#endif
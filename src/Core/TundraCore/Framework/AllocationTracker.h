@@ -0,0 +1,78 @@
+/**
+    For conditions of distribution and use, see copyright notice in LICENSE
+
+    @file   AllocationTracker.h
+    @brief  Counts the heap allocations of the main thread, for attributing them to the modules and the profiling blocks. */
+
+#pragma once
+
+#include "TundraCoreApi.h"
+#include "CoreTypes.h"
+
+#include <cstddef>
+
+/// Number of the heap allocations and the allocated bytes, and the number of the frees.
+struct AllocationCounts
+{
+    AllocationCounts() : allocations(0), bytes(0), frees(0) {}
+
+    AllocationCounts operator -(const AllocationCounts &rhs) const
+    {
+        AllocationCounts delta;
+        delta.allocations = allocations - rhs.allocations;
+        delta.bytes = bytes - rhs.bytes;
+        delta.frees = frees - rhs.frees;
+        return delta;
+    }
+
+    AllocationCounts &operator +=(const AllocationCounts &rhs)
+    {
+        allocations += rhs.allocations;
+        bytes += rhs.bytes;
+        frees += rhs.frees;
+        return *this;
+    }
+
+    u64 allocations;
+    u64 bytes; ///< The requested sizes of the allocations.
+    u64 frees;
+};
+
+/// Counts the heap allocations of the main thread, hooked to the C++ operator new and delete.
+/** Unlike DebugOperatorNew.h and MemoryLeakCheck.h, which track the leaks in the MSVC debug builds, the hook is meant for
+    finding out which module and which profiling block allocates the most each frame, also in the release builds.
+    The hook is compiled in when building with ENABLE_ALLOCATION_TRACKING, which defines ALLOCATION_TRACKING, and counts
+    the allocations once enabled with --trackAllocations or SetEnabled. The counts are running totals of the main thread:
+    Framework reads them around the Update of each module for FrameTimeStatistics, and Profiler at the start and the end
+    of each block, so the counts of a block include those of its child blocks, like the times. The allocations of the
+    other threads are not counted.
+
+    On GCC and Clang the hook replaces the global operator new and delete of the process. On MSVC each module has its own
+    operator new, so the hook is inlined to each compilation unit that includes DebugOperatorNew.h, which all the modules do.
+    The sizes of the frees are not known without a header on each block, so only the number of the frees is counted.
+
+    All the functions are static, as the allocations start before the Framework is created. */
+class TUNDRACORE_API AllocationTracker
+{
+public:
+    /// Returns whether the hook is compiled in, i.e. whether the build defines ALLOCATION_TRACKING.
+    static bool IsAvailable();
+
+    /// Starts or stops counting the allocations. Has no effect unless the hook is compiled in.
+    static void SetEnabled(bool enabled);
+
+    /// Returns whether the allocations are being counted.
+    static bool IsEnabled();
+
+    /// Marks the calling thread as the main thread, of which the allocations are counted. Called by Framework.
+    static void SetMainThread();
+
+    /// Returns the counts of the main thread since the start of the run. Call from the main thread only.
+    static AllocationCounts MainThreadCounts();
+
+    /// Allocates memory for operator new and counts the allocation. Throws std::bad_alloc on failure.
+    static void *Allocate(std::size_t size);
+
+    /// Frees the memory of Allocate for operator delete and counts the free.
+    static void Free(void *ptr);
+};
@@ -11,6 +11,7 @@
 #include "CoreException.h"
 #include "LoggingFunctions.h"
 #include "TundraVersionInfo.h"
+#include "FrameAPI.h"
 
 #include <iostream>
 #include <utility>
@@ -20,10 +21,12 @@
 #include <QTranslator>
 #include <QLocale>
 #include <QIcon>
-#ifndef ANDROID
+#if !defined(ANDROID) && !defined(TUNDRA_SERVER_ONLY)
 #include <QWebSettings>
 #endif
 #include <QSplashScreen>
+#include <QThread>
+#include <QAbstractEventDispatcher>
 
 #if defined(_WINDOWS)
 #include "Win.h"
@@ -60,6 +63,14 @@
 
 #include "MemoryLeakCheck.h"
 
+namespace
+{
+/// Milliseconds before the start of a frame that the adaptive frame pacing waits with the high-resolution clock instead of the timer.
+const double cPreciseWaitMsecs = 2.0;
+/// Number of the consecutive frames without FrameAPI::KeepAwake after which the main loop starts idling in the idle mode.
+const int cFramesBeforeIdle = 30;
+} // ~unnamed namespace
+
 /// @note Modify these values from the root CMakeLists.txt if you are making a custom Tundra build.
 const char *Application::organizationName = TUNDRA_ORGANIZATION_NAME;
 const char *Application::applicationName = TUNDRA_APPLICATION_NAME;
@@ -74,6 +85,14 @@ Application::Application(int &argc, char **argv) :
     appTranslator(new QTranslator),
 #endif
     targetFpsLimit(60.0),
+    adaptiveFramePacing(false),
+    frameWorkMsecs(0.0),
+    nextFrameTime(0),
+    idleMode(false),
+    idle(false),
+    idleTickMsecs(250),
+    framesNotKeptAwake(0),
+    blockedSinceFrame(false),
     splashScreen(0)
 {
 
@@ -137,7 +156,7 @@ Application::Application(int &argc, char **argv) :
     setQuitOnLastWindowClosed(false);
 
     /// @todo This seems a bit odd here. Would there be a better place and could this be configurable at startup-/run-time?
-#ifndef ANDROID
+#if !defined(ANDROID) && !defined(TUNDRA_SERVER_ONLY)
     QWebSettings::globalSettings()->setAttribute(QWebSettings::PluginsEnabled, true); //enable flash
 #endif
 }
@@ -245,6 +264,13 @@ void Application::Go()
     frameUpdateTimer.setSingleShot(true);
     frameUpdateTimer.start(0);
 
+    QAbstractEventDispatcher *dispatcher = QAbstractEventDispatcher::instance();
+    if (dispatcher)
+    {
+        connect(dispatcher, SIGNAL(aboutToBlock()), this, SLOT(OnEventLoopAboutToBlock()), Qt::DirectConnection);
+        connect(dispatcher, SIGNAL(awake()), this, SLOT(OnEventLoopAwake()), Qt::DirectConnection);
+    }
+
     try
     {
         exec();
@@ -653,6 +679,85 @@ void Application::SetTargetFpsLimitWhenInactive(double fpsWhenInactive)
         targetFpsLimitWhenInactive = 0.0;
 }
 
+void Application::SetAdaptiveFramePacing(bool enabled)
+{
+    adaptiveFramePacing = enabled;
+    nextFrameTime = 0;
+}
+
+void Application::SetIdleMode(bool enabled)
+{
+    idleMode = enabled;
+    framesNotKeptAwake = 0;
+    if (!idleMode)
+        WakeFromIdle();
+}
+
+void Application::Wake()
+{
+    if (idle)
+        QMetaObject::invokeMethod(this, "WakeFromIdle", Qt::QueuedConnection);
+}
+
+void Application::WakeFromIdle()
+{
+    if (idle && !framework->IsExiting())
+        frameUpdateTimer.start(0);
+}
+
+void Application::OnEventLoopAboutToBlock()
+{
+    blockedSinceFrame = true;
+}
+
+void Application::OnEventLoopAwake()
+{
+    // An event woke the loop up before the idle wait was over. Each pass of the event loop emits awake, so run the frame
+    // only if the loop has waited since the last frame, otherwise the frame would restart the timer over and over.
+    if (idle && blockedSinceFrame)
+    {
+        blockedSinceFrame = false;
+        WakeFromIdle();
+    }
+}
+
+bool Application::ScheduleIdleFrame()
+{
+    if (!idleMode || !framework->IsHeadless())
+    {
+        idle = false;
+        return false;
+    }
+
+    if (framework->Frame()->TakeKeepAwake())
+    {
+        framesNotKeptAwake = 0;
+        if (idle)
+        {
+            idle = false;
+            LogInfo("Application: Leaving the idle mode.");
+        }
+        return false;
+    }
+    if (!idle && ++framesNotKeptAwake < cFramesBeforeIdle)
+        return false;
+    if (!idle)
+    {
+        idle = true;
+        nextFrameTime = 0;
+        LogInfo("Application: Nothing to update, entering the idle mode.");
+    }
+
+    int msecsToSleep = idleTickMsecs;
+    const int msecsToTimer = framework->Frame()->MsecsToNextTimer();
+    if (msecsToTimer >= 0)
+        msecsToSleep = std::min(msecsToSleep, msecsToTimer);
+    // A wake-up during the frame has started the timer already. See the note in UpdateFrame on starting the timer with 0 msecs.
+    if (!frameUpdateTimer.isActive())
+        frameUpdateTimer.start(std::max(1, msecsToSleep));
+    return true;
+}
+
 void Application::UpdateFrame()
 {
     // Don't pump the QEvents to QApplication if we are exiting
@@ -660,8 +765,19 @@ void Application::UpdateFrame()
     if (framework->IsExiting())
         return;
 
+    blockedSinceFrame = false;
+
     try
     {
+        // The timer was started short of the frame start, as it fires only at a millisecond granularity at best.
+        // Wait for the rest with the high-resolution clock.
+        if (adaptiveFramePacing && nextFrameTime)
+        {
+            PROFILE(Application_WaitForFrame);
+            while(GetCurrentClockTime() < nextFrameTime)
+                QThread::yieldCurrentThread();
+        }
+
         const tick_t frameStartTime = GetCurrentClockTime();
 
         QApplication::processEvents(QEventLoop::AllEvents, 1);
@@ -674,10 +790,29 @@ void Application::UpdateFrame()
         static tick_t timerFrequency = GetCurrentClockFreq();
 
         double msecsSpentInFrame = (double)(timeNow - frameStartTime) * 1000.0 / timerFrequency;
+        frameWorkMsecs = msecsSpentInFrame;
+
+        if (ScheduleIdleFrame())
+            return;
 
         const double msecsPerFrame = 1000.0 / (targetFpsLimit <= 1.0 ? 1000.0 : targetFpsLimit);
         double msecsPerFrameWhenInactive = 1000.0 / (targetFpsLimitWhenInactive <= 1.0 ? 1000.0 : targetFpsLimitWhenInactive);
 
+        if (adaptiveFramePacing && !frameUpdateTimer.isActive())
+        {
+            // Schedule the frames at fixed intervals from the previous frame start, so that the waits do not accumulate
+            // the timer granularity. A frame that runs late starts the next one immediately.
+            const double msecsInterval = (appActivated || framework->IsHeadless()) ? msecsPerFrame : msecsPerFrameWhenInactive;
+            const tick_t interval = (tick_t)(msecsInterval * timerFrequency / 1000.0);
+            nextFrameTime = (nextFrameTime && nextFrameTime + interval > timeNow) ? nextFrameTime + interval : frameStartTime + interval;
+            if (nextFrameTime < timeNow)
+                nextFrameTime = timeNow;
+            const double msecsToWait = (double)(nextFrameTime - timeNow) * 1000.0 / timerFrequency;
+            // See the note below on starting the timer with 0 msecs.
+            frameUpdateTimer.start(std::max(1, (int)(msecsToWait - cPreciseWaitMsecs)));
+            return;
+        }
+
         ///\note Ideally we should sleep 0 msecs when running at a high fps rate,
         /// but need to avoid QTimer::start() with 0 msecs, since that will cause the timer to immediately fire,
         /// which can cause the Win32 message loop inside Qt to starve. (Qt keeps spinning the timer.start(0) loop for Tundra mainloop and neglects Win32 API).
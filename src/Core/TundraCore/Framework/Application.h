@@ -3,10 +3,13 @@
 #pragma once
 
 #include "TundraCoreApi.h"
+#include "HighPerfClock.h"
 #include <QTimer>
 #include <QApplication>
 #include <QStringList>
 
+#include <algorithm>
+
 class QDir;
 class QGraphicsView;
 class QTranslator;
@@ -39,6 +42,9 @@ class TUNDRACORE_API Application : public QApplication
 
     Q_PROPERTY(double targetFpsLimit READ TargetFpsLimit WRITE SetTargetFpsLimit) /**< @copydoc TargetFpsLimit */
     Q_PROPERTY(double targetFpsLimitWhenInactive READ TargetFpsLimitWhenInactive WRITE SetTargetFpsLimitWhenInactive); /**< @copydoc TargetFpsLimitWhenInactive */
+    Q_PROPERTY(bool adaptiveFramePacing READ AdaptiveFramePacing WRITE SetAdaptiveFramePacing) /**< @copydoc AdaptiveFramePacing */
+    Q_PROPERTY(bool idleMode READ IdleMode WRITE SetIdleMode) /**< @copydoc IdleMode */
+    Q_PROPERTY(bool idle READ IsIdle) /**< @copydoc IsIdle */
 
 public:
     /// Constructs the application singleton.
@@ -155,6 +161,38 @@ public:
     /// Returns the current FPS limit when inactive.
     double TargetFpsLimitWhenInactive() const { return targetFpsLimitWhenInactive; }
 
+    /// Sets whether the main loop paces the frames adaptively to hold the target frame time.
+    /** In the adaptive mode the frames are started at precise intervals of the FPS limit, waiting out the last moments
+        of the interval with the high-resolution clock instead of the coarse timer, and the frames that run late start
+        the next one without waiting. The renderer trades render resolution and shadow quality against the measured frame
+        times to hold the target. Also set with the "adaptive frame pacing" setting and --adaptiveFramePacing. */
+    void SetAdaptiveFramePacing(bool enabled);
+
+    /// Returns whether the main loop paces the frames adaptively to hold the target frame time.
+    bool AdaptiveFramePacing() const { return adaptiveFramePacing; }
+
+    /// Sets whether the main loop idles when there is nothing to update. Has an effect only in the headless mode.
+    /** In the idle mode, once a number of frames have passed without anything calling FrameAPI::KeepAwake, the main
+        loop stops running frames at the FPS limit and sleeps until a Qt event arrives, e.g. a socket, file watcher or
+        timer event or a call to Wake, the next DelayedExecute timer expires, or the idle tick has passed. A frame that
+        keeps it awake brings the loop back to the FPS limit. Also set with the "idle mode" setting and --idleMode. */
+    void SetIdleMode(bool enabled);
+
+    /// Returns whether the main loop idles when there is nothing to update.
+    bool IdleMode() const { return idleMode; }
+
+    /// Returns whether the main loop is idling, see SetIdleMode.
+    bool IsIdle() const { return idle; }
+
+    /// Sets the longest time in milliseconds the idle main loop sleeps between the frames. Also set with --idleTick.
+    /** The work that is not driven by Qt events, f.ex. the connection attempts of new kNet clients, is picked up at
+        this interval. */
+    void SetIdleTick(int msecs) { idleTickMsecs = std::max(1, msecs); }
+    int IdleTick() const { return idleTickMsecs; }
+
+    /// Returns the milliseconds the last frame spent in processing, excluding the wait for the next frame.
+    double FrameWorkTime() const { return frameWorkMsecs; }
+
     /// Find .qm translation files from @c dir.
     QStringList FindQmFiles(const QDir &dir);
 
@@ -166,6 +204,10 @@ public slots:
     /// Update application.
     void UpdateFrame();
 
+    /// Runs the next frame without delay if the main loop is idling. Thread-safe.
+    /** Call from the threads that queue work for the main thread outside the Qt event loop, f.ex. the network I/O threads. */
+    void Wake();
+
     /// Change language to input translation .qm @c file
     void ChangeLanguage(const QString& file);
 
@@ -188,6 +230,20 @@ private:
     /// Initializes splash screen.
     void InitializeSplash();
 
+    /// Updates the idle state after a frame and starts the frame timer for the idle wait. Returns false if not idling.
+    bool ScheduleIdleFrame();
+
+private slots:
+    /// Wakes the idling main loop from the main thread.
+    void WakeFromIdle();
+
+    /// Notes that the event loop is going to wait for events.
+    void OnEventLoopAboutToBlock();
+
+    /// Runs the next frame without delay if the idling event loop returns from a wait before the frame timer.
+    void OnEventLoopAwake();
+
+private:
     Framework *framework;
     bool appActivated;
     QSplashScreen *splashScreen;
@@ -199,6 +255,14 @@ private:
     static const char *version;
     double targetFpsLimit;
     double targetFpsLimitWhenInactive;
+    bool adaptiveFramePacing;
+    double frameWorkMsecs; ///< Milliseconds the last frame spent in processing.
+    tick_t nextFrameTime; ///< Clock time the next frame starts at in the adaptive mode, 0 if not scheduled.
+    bool idleMode;
+    bool idle; ///< Whether the main loop is idling.
+    int idleTickMsecs;
+    int framesNotKeptAwake; ///< Number of the consecutive frames in which no-one called FrameAPI::KeepAwake.
+    bool blockedSinceFrame; ///< Whether the event loop has waited for events since the last frame.
 
     uint versionNumbers[4];
 };
@@ -9,6 +9,35 @@
 
 #include <QSettings>
 #include <QDir>
+#include <QFileInfo>
+#include <QFileSystemWatcher>
+#include <QThread>
+#include <QMutexLocker>
+
+namespace
+{
+/// Milliseconds from the last write to the write-back of the config files.
+const int cFlushDelayMsecs = 1000;
+
+/// Returns the value as it is read back from an INI file, where QSettings stores the numbers, booleans and strings as text.
+/** Keeps Read returning the same types after a write as after parsing the file. */
+QVariant AsStoredInFile(const QVariant &value)
+{
+    switch(value.type())
+    {
+    case QVariant::Bool:
+    case QVariant::Int:
+    case QVariant::UInt:
+    case QVariant::LongLong:
+    case QVariant::ULongLong:
+    case QVariant::Double:
+    case QVariant::String:
+        return QVariant(value.toString());
+    default:
+        return value;
+    }
+}
+} // ~unnamed namespace
 
 QString ConfigAPI::FILE_FRAMEWORK = "tundra";
 QString ConfigAPI::SECTION_FRAMEWORK = "framework";
@@ -20,8 +49,103 @@ QString ConfigAPI::SECTION_SOUND = "sound";
 
 ConfigAPI::ConfigAPI(Framework *framework) :
     QObject(framework),
-    framework_(framework)
+    framework_(framework),
+    watcher_(new QFileSystemWatcher(this))
+{
+    flushTimer_.setSingleShot(true);
+    flushTimer_.setInterval(cFlushDelayMsecs);
+    connect(&flushTimer_, SIGNAL(timeout()), SLOT(Flush()));
+    connect(watcher_, SIGNAL(fileChanged(const QString &)), SLOT(OnFileChanged(const QString &)));
+}
+
+ConfigAPI::~ConfigAPI()
+{
+    Flush();
+}
+
+ConfigAPI::ConfigFile &ConfigAPI::CachedFile(const QString &filePath) const
+{
+    ConfigFileMap::iterator iter = files_.find(filePath);
+    if (iter != files_.end())
+        return iter.value();
+
+    ConfigFile &cached = files_[filePath];
+    ParseFile(filePath, cached);
+    WatchFile(filePath);
+    return cached;
+}
+
+void ConfigAPI::ParseFile(const QString &filePath, ConfigFile &cached) const
+{
+    QHash<QString, QVariant> values;
+    QSettings config(filePath, QSettings::IniFormat);
+    foreach(const QString &key, config.allKeys())
+        values[key] = config.value(key);
+    // Keep the values that have not been written back yet.
+    foreach(const QString &key, cached.dirtyKeys)
+        values[key] = cached.values.value(key);
+    cached.values.swap(values);
+
+    QFileInfo info(filePath);
+    cached.lastModified = info.exists() ? info.lastModified() : QDateTime();
+    cached.size = info.exists() ? info.size() : -1;
+}
+
+void ConfigAPI::WatchFile(const QString &filePath) const
+{
+    if (QThread::currentThread() != thread())
+        return;
+    if (QFile::exists(filePath) && !watcher_->files().contains(filePath))
+        watcher_->addPath(filePath);
+}
+
+void ConfigAPI::Flush()
+{
+    QMutexLocker lock(&mutex_);
+    for(ConfigFileMap::iterator iter = files_.begin(); iter != files_.end(); ++iter)
+    {
+        ConfigFile &cached = iter.value();
+        if (cached.dirtyKeys.isEmpty())
+            continue;
+
+        // QSettings merges the values with the file, keeping the values others have written meanwhile.
+        QSettings config(iter.key(), QSettings::IniFormat);
+        if (!config.isWritable())
+        {
+            LogWarning("ConfigAPI: Config file \"" + iter.key() + "\" is not writable, the changes are kept in memory only.");
+            cached.dirtyKeys.clear();
+            continue;
+        }
+        foreach(const QString &key, cached.dirtyKeys)
+            config.setValue(key, cached.values.value(key));
+        config.sync();
+        cached.dirtyKeys.clear();
+
+        // Remember the state of the file after the write, so that the change notification of it is not taken for someone else's change.
+        QFileInfo info(iter.key());
+        cached.lastModified = info.exists() ? info.lastModified() : QDateTime();
+        cached.size = info.exists() ? info.size() : -1;
+        WatchFile(iter.key());
+    }
+}
+
+void ConfigAPI::OnFileChanged(const QString &filePath)
 {
+    QMutexLocker lock(&mutex_);
+    ConfigFileMap::iterator iter = files_.find(filePath);
+    if (iter == files_.end())
+        return;
+
+    QFileInfo info(filePath);
+    const QDateTime lastModified = info.exists() ? info.lastModified() : QDateTime();
+    const qint64 size = info.exists() ? info.size() : -1;
+    if (lastModified != iter.value().lastModified || size != iter.value().size)
+    {
+        LogDebug("ConfigAPI: Config file \"" + filePath + "\" was changed on disk, reading it again.");
+        ParseFile(filePath, iter.value());
+    }
+    // The watcher stops watching a file that is replaced, which is how many editors save.
+    WatchFile(filePath);
 }
 
 void ConfigAPI::PrepareDataFolder(QString configFolder)
@@ -118,10 +242,8 @@ bool ConfigAPI::HasKey(QString file, QString section, QString key) const
     if (!IsFilePathSecure(file))
         return false;
 
-    QSettings config(GetFilePath(file), QSettings::IniFormat);
-    if (!section.isEmpty())
-        key = section + "/" + key;
-    return config.allKeys().contains(key);
+    QMutexLocker lock(&mutex_);
+    return CachedFile(GetFilePath(file)).values.contains(ValueKey(section, key));
 }
 
 QVariant ConfigAPI::Read(const ConfigData &data) const
@@ -164,11 +286,8 @@ QVariant ConfigAPI::Read(QString file, QString section, QString key, const QVari
     if (!IsFilePathSecure(file))
         return QVariant();
 
-    QSettings config(GetFilePath(file), QSettings::IniFormat);
-    if (section.isEmpty())
-        return config.value(key, defaultValue);
-    else
-        return config.value(section + "/" + key, defaultValue);
+    QMutexLocker lock(&mutex_);
+    return CachedFile(GetFilePath(file)).values.value(ValueKey(section, key), defaultValue);
 }
 
 void ConfigAPI::Write(const ConfigData &data)
@@ -211,14 +330,19 @@ void ConfigAPI::Write(QString file, QString section, QString key, const QVariant
     if (!IsFilePathSecure(file))
         return;
 
-    QSettings config(GetFilePath(file), QSettings::IniFormat);
-    if (!config.isWritable())
-        return;
-    if (section.isEmpty())
-        config.setValue(key, value);
+    {
+        QMutexLocker lock(&mutex_);
+        ConfigFile &cached = CachedFile(GetFilePath(file));
+        const QString valueKey = ValueKey(section, key);
+        cached.values[valueKey] = AsStoredInFile(value);
+        cached.dirtyKeys.insert(valueKey);
+    }
+
+    // Write back once the writes have stopped for a moment. QTimer::start is a slot, so it can be queued from other threads.
+    if (QThread::currentThread() == thread())
+        flushTimer_.start();
     else
-        config.setValue(section + "/" + key, value);
-    config.sync();
+        QMetaObject::invokeMethod(&flushTimer_, "start", Qt::QueuedConnection);
 }
 
 QVariant ConfigAPI::DeclareSetting(const QString &file, const QString &section, const QString &key, const QVariant &defaultValue)
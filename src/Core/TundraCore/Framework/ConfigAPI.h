@@ -7,8 +7,14 @@
 #include <QObject>
 #include <QVariant>
 #include <QString>
+#include <QHash>
+#include <QSet>
+#include <QDateTime>
+#include <QMutex>
+#include <QTimer>
 
 class Framework;
+class QFileSystemWatcher;
 
 /// Convenience structure for dealing constantly with same config file/sections.
 struct TUNDRACORE_API ConfigData
@@ -69,7 +75,12 @@ Q_DECLARE_METATYPE(ConfigData*)
     @endcode
 
     @note All file, key and section parameters are case-insensitive. This means all of them are transformed to 
-    lower case before any accessing files. "MyKey" will get and set you same value as "mykey". */
+    lower case before any accessing files. "MyKey" will get and set you same value as "mykey".
+
+    The config files are parsed once and kept in memory, so reading a value is a hash lookup. The written values are
+    written back to the files in a batch a moment after the last write, and when the API is destroyed; call Flush to
+    write them immediately. A file changed on disk by someone else is parsed again, keeping the values written but
+    not yet written back. */
 class TUNDRACORE_API ConfigAPI : public QObject
 {
     Q_OBJECT
@@ -118,6 +129,9 @@ public slots:
     void Write(const ConfigData &data, const QVariant &value); /**< @overload @param data ConfigData object that has file, section and key filled. */
     void Write(const ConfigData &data); /**< @overload @param data Filled ConfigData object.*/
 
+    /// Writes the values written since the last write-back to the config files.
+    void Flush();
+
     /// Returns the absolute path to the config folder where configs are stored. Guaranteed to have a trailing forward slash '/'.
     QString ConfigFolder() const { return configFolder_; }
 
@@ -142,11 +156,41 @@ public slots:
     bool HasValue(const ConfigData &data, QString key) const { return HasKey(data, key); } /**< @deprecated Use HasKey. @todo Add warning print @todo Remove */
     QString GetConfigFolder() const { return ConfigFolder(); } /**< @deprecated Use ConfigFolder. @todo Add warning print @todo Remove */
     /// @endcond
+private slots:
+    /// Parses a cached config file again if it has been changed by someone else than this API.
+    void OnFileChanged(const QString &filePath);
+
 private:
     friend class Framework;
 
     /// @note Framework takes ownership of the object.
     explicit ConfigAPI(Framework *framework);
+    ~ConfigAPI();
+
+    /// Parsed values of a config file.
+    struct ConfigFile
+    {
+        ConfigFile() : size(-1) {}
+
+        QHash<QString, QVariant> values; ///< Values by "section/key", or by key for the keys without a section.
+        QSet<QString> dirtyKeys; ///< Keys written but not yet written back to the file.
+        QDateTime lastModified; ///< Modification time of the file when it was last parsed or written back.
+        qint64 size; ///< Size of the file when it was last parsed or written back, -1 if it did not exist.
+    };
+    typedef QHash<QString, ConfigFile> ConfigFileMap;
+
+    /// Returns the cached config file of the file path, parsing it first if it is not cached. Call with mutex_ locked.
+    ConfigFile &CachedFile(const QString &filePath) const;
+
+    /// Parses the values of a config file into the cache entry. Call with mutex_ locked.
+    void ParseFile(const QString &filePath, ConfigFile &cached) const;
+
+    /// Watches a config file for the changes made by others, if it exists. Call with mutex_ locked.
+    /** Has no effect outside the main thread, as the watcher belongs to it. */
+    void WatchFile(const QString &filePath) const;
+
+    /// Returns the key of a value in the cache.
+    static QString ValueKey(const QString &section, const QString &key) { return section.isEmpty() ? key : section + "/" + key; }
 
     /// Get absolute file path for file. Guarantees that it ends with .ini.
     QString GetFilePath(const QString &file) const;
@@ -166,4 +210,8 @@ private:
 
     Framework *framework_;
     QString configFolder_; ///< Absolute path to the folder where to store the config files.
+    mutable QMutex mutex_; ///< Guards the cache, as the API can be used from any thread.
+    mutable ConfigFileMap files_; ///< Parsed config files by the absolute file path.
+    QFileSystemWatcher *watcher_; ///< Watches the cached files for the changes made by others.
+    QTimer flushTimer_; ///< Single-shot timer of the batched write-back.
 };
@@ -6,6 +6,8 @@
 #include <QTextStream>
 #include <QByteArray>
 #include <QRegExpValidator>
+#include <QVariant>
+#include <QStringList>
 
 #include <kNet/DataSerializer.h>
 #include <kNet/DataDeserializer.h>
@@ -273,3 +275,51 @@ bool IsAlphanumeric(QString &str, int &invalidCharPosition)
     static QRegExpValidator alphaNumericValidator(QRegExp("[A-Za-z0-9]"));
     return (alphaNumericValidator.validate(str, invalidCharPosition) == QValidator::Acceptable);
 }
+
+/// Approximate size of the header of the shared data of a QString, QByteArray or QList.
+static const size_t cSharedDataHeaderSize = 4 * sizeof(int) + sizeof(void *);
+
+size_t StringMemoryUsage(const QString &str)
+{
+    return str.isNull() ? 0 : cSharedDataHeaderSize + (size_t)(str.capacity() + 1) * sizeof(QChar);
+}
+
+size_t VariantMemoryUsage(const QVariant &variant)
+{
+    switch(variant.type())
+    {
+    case QVariant::String:
+        return StringMemoryUsage(variant.toString());
+    case QVariant::ByteArray:
+    {
+        const QByteArray bytes = variant.toByteArray();
+        return bytes.isNull() ? 0 : cSharedDataHeaderSize + (size_t)bytes.capacity() + 1;
+    }
+    case QVariant::StringList:
+    {
+        const QStringList list = variant.toStringList();
+        size_t bytes = cSharedDataHeaderSize + (size_t)list.size() * sizeof(void *);
+        for(int i = 0; i < list.size(); ++i)
+            bytes += sizeof(QString) + StringMemoryUsage(list[i]);
+        return bytes;
+    }
+    case QVariant::List:
+    {
+        const QVariantList list = variant.toList();
+        size_t bytes = cSharedDataHeaderSize + (size_t)list.size() * sizeof(void *);
+        for(int i = 0; i < list.size(); ++i)
+            bytes += sizeof(QVariant) + VariantMemoryUsage(list[i]);
+        return bytes;
+    }
+    case QVariant::Map:
+    {
+        const QVariantMap map = variant.toMap();
+        size_t bytes = cSharedDataHeaderSize;
+        for(QVariantMap::const_iterator i = map.begin(); i != map.end(); ++i)
+            bytes += 4 * sizeof(void *) + sizeof(QString) + sizeof(QVariant) + StringMemoryUsage(i.key()) + VariantMemoryUsage(i.value());
+        return bytes;
+    }
+    default:
+        return 0;
+    }
+}
@@ -6,6 +6,7 @@
 #include "CoreTypes.h"
 
 namespace kNet { class DataSerializer; class DataDeserializer; }
+class QVariant;
 
 /// @cond PRIVATE
 class TUNDRACORE_API QStringLessThanNoCase
@@ -115,3 +116,10 @@ QString TUNDRACORE_API CamelCase(const QString &str, bool lowerCase = true);
 
 /// Returns if the string only contains alphanumeric characters with regexp "[A-Za-z0-9]".
 bool TUNDRACORE_API IsAlphanumeric(QString &str, int &invalidCharPosition);
+
+/// Returns the approximate number of bytes the string has allocated for its characters, or 0 for a null string.
+/** @note Implicitly shared data is counted for each string sharing it. */
+size_t TUNDRACORE_API StringMemoryUsage(const QString &str);
+
+/// Returns the approximate number of bytes the variant has allocated for its strings, byte arrays and lists, recursively.
+size_t TUNDRACORE_API VariantMemoryUsage(const QVariant &variant);
@@ -10,6 +10,9 @@
     After getting the list of leaks when you close the application, look for entries saying 
     "client block" and "Unknown source". Unfortunately this method can not tell you the exact file/line of
     these allocations - to do that, see MemoryLeakCheck.h
+
+    When building with ALLOCATION_TRACKING on MSVC, the operator new of the current compilation unit is instead
+    routed to AllocationTracker, which counts the allocations per module and per profiling block, also in release builds.
 */
 
 #pragma once
@@ -48,4 +51,27 @@ __forceinline void operator delete[](void *ptr)
     _free_dbg(ptr, _NORMAL_BLOCK);
 }
 
+#elif defined(_MSC_VER) && defined(ALLOCATION_TRACKING)
+#include "AllocationTracker.h"
+
+__forceinline void *operator new(std::size_t size)
+{
+    return AllocationTracker::Allocate(size);
+}
+
+__forceinline void *operator new[](std::size_t size)
+{
+    return AllocationTracker::Allocate(size);
+}
+
+__forceinline void operator delete(void *ptr)
+{
+    AllocationTracker::Free(ptr);
+}
+
+__forceinline void operator delete[](void *ptr)
+{
+    AllocationTracker::Free(ptr);
+}
+
 #endif // ~_MSC_VER
@@ -10,23 +10,40 @@
 #include "FrameAPI.h"
 #include "HighPerfClock.h"
 #include "Profiler.h"
-#include <QTimer>
+#include "UpdateScheduler.h"
+#include "Framework.h"
+#include "LoggingFunctions.h"
+#include <QMetaMethod>
+
+#include <algorithm>
 
 #include "MemoryLeakCheck.h"
 
-FrameAPI::FrameAPI(Framework *fw) : QObject(fw), currentFrameNumber(0)
+FrameAPI::FrameAPI(Framework *fw) :
+    QObject(fw),
+    currentFrameNumber(0),
+    scheduler(new UpdateScheduler(fw->Jobs())),
+    nextLowPriorityUpdate(0),
+    lowPriorityBudget(2.f),
+    keepAwake(false)
 {
     startTime = GetCurrentClockTime();
 }
 
 FrameAPI::~FrameAPI()
 {
+    delete scheduler;
 }
 
 void FrameAPI::Reset()
 {
+    timers.Clear();
     qDeleteAll(delayedSignals);
     delayedSignals.clear();
+    delayedSignalPool.clear();
+    qDeleteAll(lowPriorityUpdates);
+    lowPriorityUpdates.clear();
+    nextLowPriorityUpdate = 0;
 }
 
 float FrameAPI::WallClockTime() const
@@ -34,29 +51,185 @@ float FrameAPI::WallClockTime() const
     return (float)((double)(GetCurrentClockTime() - startTime) / GetCurrentClockFreq());
 }
 
+u64 FrameAPI::TimerTick(u64 clockTime) const
+{
+    return (clockTime - startTime) * 1000 / GetCurrentClockFreq();
+}
+
 DelayedSignal *FrameAPI::DelayedExecute(float time)
 {
-    DelayedSignal *delayed = new DelayedSignal(GetCurrentClockTime());
-    QTimer::singleShot(time*1000, delayed, SLOT(Expire()));
-    connect(delayed, SIGNAL(Triggered(float)), SLOT(DeleteDelayedSignal()));
-    delayedSignals.push_back(delayed);
+    DelayedSignal *delayed = 0;
+    if (!delayedSignalPool.empty())
+    {
+        delayed = delayedSignalPool.back();
+        delayedSignalPool.pop_back();
+    }
+    else
+    {
+        delayed = new DelayedSignal(this);
+        delayedSignals.push_back(delayed);
+    }
+
+    FrameTimer timer;
+    timer.signal = delayed;
+    timer.startTime = GetCurrentClockTime();
+    delayed->timerId = timers.Add(TimerTick(timer.startTime) + (u64)std::max(time * 1000.f, 0.f), timer);
     return delayed;
 }
 
-void FrameAPI::DelayedExecute(float time, const QObject *receiver, const char *member)
+u64 FrameAPI::DelayedExecute(float time, const QObject *receiver, const char *member, bool coalesce)
+{
+    if (!receiver || !member)
+        return 0;
+    // The first character of the member is the code of SLOT() or SIGNAL().
+    const QMetaObject *metaObject = receiver->metaObject();
+    const int method = metaObject->indexOfMethod(QMetaObject::normalizedSignature(member + 1));
+    if (method < 0)
+    {
+        LogError(QString("FrameAPI::DelayedExecute: %1 has no member %2.").arg(metaObject->className()).arg(member + 1));
+        return 0;
+    }
+
+    FrameTimer timer;
+    timer.receiver = const_cast<QObject *>(receiver);
+    timer.method = method;
+    timer.startTime = GetCurrentClockTime();
+    timer.coalesce = coalesce;
+    return timers.Add(TimerTick(timer.startTime) + (u64)std::max(time * 1000.f, 0.f), timer);
+}
+
+bool FrameAPI::CancelDelayedExecute(u64 timerId)
+{
+    FrameTimer *timer = timers.Find(timerId);
+    if (!timer)
+        return false;
+    if (timer->signal)
+    {
+        RecycleDelayedSignal(timer->signal);
+        return true;
+    }
+    return timers.Remove(timerId);
+}
+
+void FrameAPI::RecycleDelayedSignal(DelayedSignal *delayed)
+{
+    if (delayed->timerId)
+        timers.Remove(delayed->timerId);
+    delayed->timerId = 0;
+    disconnect(delayed, SIGNAL(Triggered(float)), 0, 0);
+
+    const size_t cMaxPooledDelayedSignals = 256;
+    if (delayedSignalPool.size() < cMaxPooledDelayedSignals)
+        delayedSignalPool.push_back(delayed);
+    else
+    {
+        delayedSignals.removeOne(delayed);
+        SAFE_DELETE_LATER(delayed);
+    }
+}
+
+void FrameAPI::RunTimers()
+{
+    if (timers.Size() == 0)
+        return;
+
+    PROFILE(FrameAPI_RunTimers);
+    const u64 now = GetCurrentClockTime();
+    const double freq = (double)GetCurrentClockFreq();
+    // The timers started by the triggered timers expire on the next frame at the earliest.
+    timers.Advance(TimerTick(now));
+    coalescedThisFrame.clear();
+
+    FrameTimer timer;
+    while(timers.PopExpired(timer))
+    {
+        const float elapsed = (float)((now - timer.startTime) / freq);
+        if (timer.signal)
+        {
+            DelayedSignal *delayed = timer.signal;
+            delayed->timerId = 0;
+            emit delayed->Triggered(elapsed);
+            RecycleDelayedSignal(delayed);
+            continue;
+        }
+
+        QObject *receiver = timer.receiver;
+        if (!receiver)
+            continue;
+        if (timer.coalesce)
+        {
+            std::pair<QObject *, int> key(receiver, timer.method);
+            if (std::find(coalescedThisFrame.begin(), coalescedThisFrame.end(), key) != coalescedThisFrame.end())
+                continue;
+            coalescedThisFrame.push_back(key);
+        }
+        QMetaMethod method = receiver->metaObject()->method(timer.method);
+        if (method.parameterTypes().isEmpty())
+            method.invoke(receiver, Qt::DirectConnection);
+        else
+            method.invoke(receiver, Qt::DirectConnection, Q_ARG(float, elapsed));
+    }
+}
+
+LowPriorityUpdate *FrameAPI::ScheduleLowPriorityUpdate(const QString &name)
+{
+    LowPriorityUpdate *update = new LowPriorityUpdate(name, GetCurrentClockTime());
+    connect(update, SIGNAL(destroyed(QObject *)), SLOT(RemoveLowPriorityUpdate(QObject *)));
+    lowPriorityUpdates.push_back(update);
+    return update;
+}
+
+void FrameAPI::SetLowPriorityBudget(float msecs)
+{
+    lowPriorityBudget = std::max(msecs, 0.f);
+}
+
+void FrameAPI::RunLowPriorityUpdates()
+{
+    if (lowPriorityUpdates.isEmpty())
+        return;
+
+    PROFILE(FrameAPI_LowPriorityUpdates);
+    const u64 start = GetCurrentClockTime();
+    const u64 budget = (u64)((double)lowPriorityBudget * GetCurrentClockFreq() / 1000.0);
+    // The updates scheduled during this frame get their turn in the next one.
+    const int numUpdates = lowPriorityUpdates.size();
+    for(int i = 0; i < numUpdates && !lowPriorityUpdates.isEmpty(); ++i)
+    {
+        const u64 now = GetCurrentClockTime();
+        // Run at least one update each frame, so that every update is run eventually.
+        if (i > 0 && now - start >= budget)
+            break;
+        if (nextLowPriorityUpdate >= lowPriorityUpdates.size())
+            nextLowPriorityUpdate = 0;
+        LowPriorityUpdate *update = lowPriorityUpdates[nextLowPriorityUpdate++];
+        if (update->cancelled)
+            continue;
+        update->Run(now);
+        if (update->lastDuration > lowPriorityBudget && lowPriorityBudget > 0.f)
+            LogWarning("FrameAPI: Low-priority update " + (update->name.isEmpty() ? QString("(unnamed)") : update->name) + " took " +
+                QString::number(update->lastDuration, 'f', 2) + " ms, over the whole low-priority budget of " + QString::number(lowPriorityBudget) + " ms. Split it into smaller steps.");
+    }
+}
+
+void FrameAPI::RemoveLowPriorityUpdate(QObject *update)
 {
-    DelayedSignal *delayed = new DelayedSignal(GetCurrentClockTime());
-    QTimer::singleShot(time*1000, delayed, SLOT(Expire()));
-    connect(delayed, SIGNAL(Triggered(float)), receiver, member);
-    connect(delayed, SIGNAL(Triggered(float)), SLOT(DeleteDelayedSignal()));
-    delayedSignals.push_back(delayed);
+    int index = lowPriorityUpdates.indexOf(static_cast<LowPriorityUpdate *>(update));
+    if (index < 0)
+        return;
+    lowPriorityUpdates.removeAt(index);
+    if (index < nextLowPriorityUpdate)
+        --nextLowPriorityUpdate;
 }
 
 void FrameAPI::Update(float frametime)
 {
     PROFILE(FrameAPI_Update);
 
+    RunTimers();
     emit Updated(frametime);
+    scheduler->Run(frametime);
+    RunLowPriorityUpdates();
     emit PostFrameUpdate(frametime);
 
     ++currentFrameNumber;
@@ -64,24 +237,61 @@ void FrameAPI::Update(float frametime)
         currentFrameNumber = 0;
 }
 
-void FrameAPI::DeleteDelayedSignal()
+int FrameAPI::FrameNumber() const
 {
-    DelayedSignal *expiredSignal = checked_static_cast<DelayedSignal *>(sender());
-    assert(expiredSignal);
-    delayedSignals.removeOne(expiredSignal);
-    SAFE_DELETE_LATER(expiredSignal);
+    return currentFrameNumber;
 }
 
-int FrameAPI::FrameNumber() const
+int FrameAPI::MsecsToNextTimer() const
+{
+    if (timers.Size() == 0)
+        return -1;
+    const u64 now = TimerTick(GetCurrentClockTime());
+    const u64 next = timers.NextExpiryBound();
+    return next > now ? (int)std::min<u64>(next - now, 0x7FFFFFFF) : 0;
+}
+
+bool FrameAPI::TakeKeepAwake()
+{
+    const bool wasKeptAwake = keepAwake;
+    keepAwake = false;
+    return wasKeptAwake;
+}
+
+DelayedSignal::DelayedSignal(FrameAPI *owner_) : owner(owner_), timerId(0)
+{
+}
+
+void DelayedSignal::Cancel()
+{
+    if (timerId)
+        owner->RecycleDelayedSignal(this);
+}
+
+LowPriorityUpdate::LowPriorityUpdate(const QString &name_, u64 startTime) :
+    name(name_),
+    lastTime(startTime),
+    lastDuration(0.f),
+    cancelled(false)
 {
-    return currentFrameNumber;
 }
 
-DelayedSignal::DelayedSignal(u64 startTime_) : startTime(startTime_)
+void LowPriorityUpdate::Cancel()
 {
+    if (cancelled)
+        return;
+    cancelled = true;
+    deleteLater();
 }
 
-void DelayedSignal::Expire()
+void LowPriorityUpdate::Run(u64 now)
 {
-    emit Triggered((float)((GetCurrentClockTime() - startTime) / GetCurrentClockFreq()));
+    const double freq = (double)GetCurrentClockFreq();
+    emit Updated((float)((now - lastTime) / freq));
+    lastTime = now;
+    const u64 end = GetCurrentClockTime();
+    lastDuration = (float)((end - now) * 1000.0 / freq);
+#ifdef PROFILING
+    ProfilerSection::GetProfiler()->AddTiming("LowPriorityUpdates", (name.isEmpty() ? QString("(unnamed)") : name).toStdString(), (end - now) / freq);
+#endif
 }
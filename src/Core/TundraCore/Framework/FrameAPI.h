@@ -8,44 +8,89 @@
 
 #include "TundraCoreApi.h"
 #include "CoreTypes.h"
+#include "TimerWheel.h"
 
 #include <QObject>
+#include <QPointer>
+
+#include <vector>
 
 class Framework;
 class DelayedSignal;
+class LowPriorityUpdate;
+class UpdateScheduler;
 
 /// Provides a mechanism for plugins and scripts to receive per-frame and time-based events.
 /** This class cannot be created directly, it's created by Framework.
     FrameAPI object can be used to:
     -retrieve signal every time frame has been processed
     -retrieve the wall clock time of Framework
-    -trigger delayed signals when spesified amount of time has elapsed. */
+    -trigger delayed signals when spesified amount of time has elapsed.
+    -spread low-priority updates across the frames within a time budget. */
 class TUNDRACORE_API FrameAPI : public QObject
 {
     Q_OBJECT
 
+public:
+    /// Returns the scheduler of the update jobs, which are run after Updated and before PostFrameUpdate each frame.
+    UpdateScheduler *Scheduler() const { return scheduler; }
+
+    /// Returns the milliseconds until the next DelayedExecute timer expires at the latest, or -1 if there are none pending.
+    /** Used by Application to cap the sleep of the idle mode. */
+    int MsecsToNextTimer() const;
+
+    /// Returns whether KeepAwake has been called since the last call, and clears the request. Called by Application each frame.
+    bool TakeKeepAwake();
+
 public slots:
     /// Return wall clock time of Framework in seconds.
     float WallClockTime() const;
 
-    /// Triggers DelayedSignal::Triggered(float) signal when spesified amount of time has elapsed.
-    /** Use this function when the receiver is a QObject.
+    /// Invokes the member of the receiver when spesified amount of time has elapsed.
+    /** Use this function when the receiver is a QObject. The member is given the elapsed time as a float argument, if it takes one.
+        The timers are kept in a timer wheel which FrameAPI advances at the start of each frame, so this allocates no objects.
         @param time Time in seconds.
-        @param receiver Receiver object.
-        @param member Member slot. */
-    void DelayedExecute(float time, const QObject *receiver, const char *member);
+        @param receiver Receiver object. If it is deleted before the time has elapsed, the member is not invoked.
+        @param member Member slot or signal, e.g. SLOT(OnTimeout(float)).
+        @param coalesce If true, the member is invoked only once for the receiver in a frame, even if several coalesced timers of
+            the member expire on the frame.
+        @return Id of the timer for CancelDelayedExecute, or 0 if the receiver has no such member. */
+    u64 DelayedExecute(float time, const QObject *receiver, const char *member, bool coalesce = false);
 
     /// @overload
     /** This function is provided for convenience for scripting languages
         @param time Time in seconds.
         @note Never returns null pointer
-        @note Never store the returned pointer. */
+        @note Never store the returned pointer. The object is reused for a later call once it has been triggered or cancelled. */
     DelayedSignal *DelayedExecute(float time);
 
+    /// Cancels a timer started with DelayedExecute. Returns false if the timer has been triggered or cancelled already.
+    bool CancelDelayedExecute(u64 timerId);
+
+    /// Schedules a low-priority update, which is triggered once in that many frames as fit in the low-priority budget.
+    /** The low-priority updates are run in turns each frame, after the update jobs and before PostFrameUpdate, until the
+        budget of the frame is used. At least one update is run each frame, so every update is run eventually. Use for work
+        that does not need to be done every frame, and split long work into steps. The time of each update is added to the
+        LowPriorityUpdates group of the profiler.
+        @param name Name of the update, shown in the profiler and in the warnings.
+        @note Never returns null pointer. Call LowPriorityUpdate::Cancel to stop the updates. */
+    LowPriorityUpdate *ScheduleLowPriorityUpdate(const QString &name = QString());
+
+    /// Sets the time budget of the low-priority updates of each frame, in milliseconds. Can also be set with --lowPriorityBudget.
+    void SetLowPriorityBudget(float msecs);
+    float LowPriorityBudget() const { return lowPriorityBudget; }
+
     /// Returns the current application frame number.
     /** @note It is best not to tie any timing-specific animation to this number, but instead use WallClockTime(). */
     int FrameNumber() const;
 
+    /// Keeps the main loop from going to the idle mode after this frame.
+    /** When the idle mode is enabled, see Application::SetIdleMode, the main loop runs a frame only when an event arrives
+        or on a slow heartbeat, once no-one has called this for a while. Call each frame from work that has to keep
+        running without events, f.ex. a running simulation or a script that animates on Updated. The server with
+        connected users, the physics with active bodies and the attribute interpolations keep the loop awake already. */
+    void KeepAwake() { keepAwake = true; }
+
 signals:
     /// Emitted when it is time for client code to update their applications.
     /** Scripts and client C++ code can hook into this signal to perform custom per-frame processing.
@@ -74,17 +119,50 @@ private:
     /// Clears all registered signals to this API.
     void Reset();
 
-    /// Emits Updated() signal. Called by Framework each frame.
+    /// Expired timer of DelayedExecute.
+    struct FrameTimer
+    {
+        FrameTimer() : signal(0), method(-1), startTime(0), coalesce(false) {}
+
+        DelayedSignal *signal; ///< The signal to trigger, or null to invoke the method of the receiver.
+        QPointer<QObject> receiver;
+        int method; ///< Index of the method of the receiver.
+        u64 startTime;
+        bool coalesce;
+    };
+
+    /// Returns the tick of the timer wheel for a clock time. The ticks are milliseconds since startTime.
+    u64 TimerTick(u64 clockTime) const;
+
+    /// Triggers the expired timers.
+    void RunTimers();
+
+    /// Stops the timer of a delayed signal and puts the signal back to the pool, disconnecting its receivers.
+    void RecycleDelayedSignal(DelayedSignal *delayed);
+
+    /// Runs the low-priority updates within the budget, continuing from where the previous frame stopped.
+    void RunLowPriorityUpdates();
+
+    /// Triggers the expired timers, emits Updated() signal, runs the update jobs and the low-priority updates, and emits PostFrameUpdate() signal.
+    /// Called by Framework each frame.
     /** @param frametime Time elapsed since last frame. */
     void Update(float frametime);
 
     u64 startTime; ///< Start time time of Framework/this object;
-    QList<DelayedSignal *> delayedSignals; ///< Delayed signals waiting for expiration.
+    QList<DelayedSignal *> delayedSignals; ///< All delayed signal objects, both the pending and the pooled ones.
+    std::vector<DelayedSignal *> delayedSignalPool; ///< Delayed signal objects ready for reuse.
+    TimerWheel<FrameTimer> timers; ///< Pending timers of DelayedExecute.
+    std::vector<std::pair<QObject *, int> > coalescedThisFrame; ///< The receivers and methods of the coalesced timers triggered in this frame.
     int currentFrameNumber;
+    UpdateScheduler *scheduler; ///< Scheduler of the update jobs, owned by this object.
+    QList<LowPriorityUpdate *> lowPriorityUpdates; ///< Scheduled low-priority updates, in the order they take turns.
+    int nextLowPriorityUpdate; ///< Index of the low-priority update to run first in the next frame.
+    float lowPriorityBudget; ///< Time budget of the low-priority updates of each frame, in milliseconds.
+    bool keepAwake; ///< Whether KeepAwake has been called since the last TakeKeepAwake.
 
 private slots:
-    /// Deletes delayed signal object and removes it from the list when it's expired.
-    void DeleteDelayedSignal();
+    /// Removes a cancelled low-priority update from the list.
+    void RemoveLowPriorityUpdate(QObject *update);
 };
 
 /// Stores a delayed signal invocation.
@@ -97,6 +175,10 @@ class TUNDRACORE_API DelayedSignal : public QObject
 
     friend class FrameAPI;
 
+public slots:
+    /// Cancels the delayed signal, so that Triggered is not emitted.
+    void Cancel();
+
 signals:
     /// Emitted when delayed signal is triggered.
     /** @param time Elapsed framework wall clock time. */
@@ -104,13 +186,44 @@ signals:
 
 private:
     /// Construct new signal delayed signal object.
-    /** @param startTime Application tick. */
-    explicit DelayedSignal(u64 startTime);
+    /** @param owner The FrameAPI that triggers the signal. */
+    explicit DelayedSignal(FrameAPI *owner);
 
-    u64 startTime; ///< Application tick when object was created.
+    FrameAPI *owner;
+    u64 timerId; ///< Id of the timer in the timer wheel of owner, or 0 if not pending.
+};
 
-private slots:
-    /// Emits Triggered() signal
-    /** Called by FrameAPI object when the spesified amount of time has passed. */
-    void Expire();
+/// Low-priority update, which FrameAPI triggers when it has its turn and there is time left in the low-priority budget of the frame.
+/** Scripting languages connect their slots to Updated. This class cannot be created directly, it's created by FrameAPI. */
+class TUNDRACORE_API LowPriorityUpdate : public QObject
+{
+    Q_OBJECT
+
+    friend class FrameAPI;
+
+public slots:
+    /// Stops the updates and deletes this object.
+    void Cancel();
+
+    /// Returns the name given to FrameAPI::ScheduleLowPriorityUpdate.
+    QString Name() const { return name; }
+
+    /// Returns how long the last update took, in milliseconds.
+    float LastDuration() const { return lastDuration; }
+
+signals:
+    /// Emitted when the update has its turn.
+    /** @param elapsedTime Elapsed time in seconds since the previous update. */
+    void Updated(float elapsedTime);
+
+private:
+    LowPriorityUpdate(const QString &name, u64 startTime);
+
+    /// Emits Updated() and measures how long it took.
+    void Run(u64 now);
+
+    QString name;
+    u64 lastTime; ///< Application tick of the previous update.
+    float lastDuration;
+    bool cancelled;
 };
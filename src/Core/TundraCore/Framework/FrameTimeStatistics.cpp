@@ -0,0 +1,298 @@
+/**
+    For conditions of distribution and use, see copyright notice in LICENSE
+
+    @file   FrameTimeStatistics.cpp
+    @brief  Percentiles of the frame times and the module update times over sliding windows. */
+
+#include "StableHeaders.h"
+#include "DebugOperatorNew.h"
+
+#include "FrameTimeStatistics.h"
+#include "Framework.h"
+#include "MetricsRegistry.h"
+#include "LoggingFunctions.h"
+
+#include <QStringList>
+
+#include <algorithm>
+
+#include "MemoryLeakCheck.h"
+
+namespace
+{
+
+const double cPercentiles[] = { 0.5, 0.95, 0.99 };
+const char * const cQuantileLabels[] = { "quantile=\"0.5\"", "quantile=\"0.95\"", "quantile=\"0.99\"", "quantile=\"1\"" };
+
+/// Formats a duration in seconds as milliseconds for the printouts.
+QString Msecs(double seconds, int width)
+{
+    return QString("%1").arg(seconds * 1e3, width, 'f', 2);
+}
+
+} // ~unnamed namespace
+
+TimeHistogram::TimeHistogram() :
+    slices(cNumSlices),
+    current(0)
+{
+}
+
+int TimeHistogram::Bucket(u32 usecs)
+{
+    if (usecs < (u32)cSubBuckets)
+        return (int)usecs;
+    // Shift the duration to the range [cSubBuckets, 2 * cSubBuckets), the shift being the power of two past the exact buckets.
+    int shift = 0;
+    while((usecs >> shift) >= (u32)(2 * cSubBuckets))
+        ++shift;
+    const int bucket = cSubBuckets + shift * cSubBuckets + (int)(usecs >> shift) - cSubBuckets;
+    return std::min(bucket, cNumBuckets - 1);
+}
+
+double TimeHistogram::BucketValue(int bucket)
+{
+    if (bucket < cSubBuckets)
+        return bucket * 1e-6;
+    const int shift = (bucket - cSubBuckets) / cSubBuckets;
+    const int sub = (bucket - cSubBuckets) % cSubBuckets;
+    const double lower = (double)((cSubBuckets + sub) << shift);
+    return (lower + (double)(1 << shift) * 0.5) * 1e-6;
+}
+
+void TimeHistogram::Add(double seconds)
+{
+    const double usecs = std::max(0.0, seconds * 1e6);
+    Slice &slice = slices[current];
+    ++slice.buckets[Bucket(usecs >= 4e9 ? 0xFFFFFFFFu : (u32)usecs)];
+    ++slice.count;
+    slice.max = std::max(slice.max, seconds);
+}
+
+void TimeHistogram::Advance()
+{
+    current = (current + 1) % cNumSlices;
+    slices[current] = Slice();
+}
+
+u32 TimeHistogram::Count(int numSlices) const
+{
+    u32 count = 0;
+    numSlices = std::min(std::max(numSlices, 1), (int)cNumSlices);
+    for(int i = 0; i < numSlices; ++i)
+        count += slices[(current - i + cNumSlices) % cNumSlices].count;
+    return count;
+}
+
+double TimeHistogram::Max(int numSlices) const
+{
+    double max = 0.0;
+    numSlices = std::min(std::max(numSlices, 1), (int)cNumSlices);
+    for(int i = 0; i < numSlices; ++i)
+        max = std::max(max, slices[(current - i + cNumSlices) % cNumSlices].max);
+    return max;
+}
+
+double TimeHistogram::Percentile(double fraction, int numSlices) const
+{
+    numSlices = std::min(std::max(numSlices, 1), (int)cNumSlices);
+    const u32 count = Count(numSlices);
+    if (count == 0)
+        return 0.0;
+
+    // The rank of the duration, from 1, that the fraction of the durations are at or below.
+    u32 rank = (u32)(fraction * (double)count + 0.999999);
+    rank = std::min(std::max(rank, 1u), count);
+
+    u32 cumulative = 0;
+    for(int bucket = 0; bucket < cNumBuckets; ++bucket)
+    {
+        for(int i = 0; i < numSlices; ++i)
+            cumulative += slices[(current - i + cNumSlices) % cNumSlices].buckets[bucket];
+        if (cumulative >= rank)
+            return std::min(BucketValue(bucket), Max(numSlices)); // The middle of the last bucket may be past the longest duration.
+    }
+    return Max(numSlices);
+}
+
+const float FrameTimeStatistics::cRegressionFactor = 1.5f;
+const float FrameTimeStatistics::cRegressionMinimum = 0.02f;
+
+FrameTimeStatistics::FrameTimeStatistics(Framework *owner) :
+    QObject(owner),
+    framework(owner),
+    sliceStart(0),
+    framesLastSlice(0),
+    logRegressions(owner->HasCommandLineParameter("--logFrameTimeRegressions")),
+    regressionCooldown(cLongWindow / 2) // The long window needs to be filled for a baseline.
+{
+    MetricsRegistry *metrics = owner->Metrics();
+    if (metrics->IsEnabled())
+    {
+        metrics->Describe("tundra_frame_seconds_quantile", MetricsRegistry::Gauge, "Percentiles of the time between the starts of the frames over the last minute. Quantile 1 is the maximum.");
+        metrics->Describe("tundra_module_update_seconds_quantile", MetricsRegistry::Gauge, "Percentiles of the Update time of each module over the last minute. Quantile 1 is the maximum.");
+        if (AllocationTracker::IsEnabled())
+        {
+            metrics->Describe("tundra_module_allocations_total", MetricsRegistry::Counter, "Heap allocations in the Update of each module.");
+            metrics->Describe("tundra_module_allocated_bytes_total", MetricsRegistry::Counter, "Heap allocated bytes in the Update of each module.");
+        }
+        connect(metrics, SIGNAL(Collect()), SLOT(CollectMetrics()));
+    }
+}
+
+FrameTimeStatistics::~FrameTimeStatistics()
+{
+}
+
+void FrameTimeStatistics::AddFrame(double seconds)
+{
+    frames.Add(seconds);
+}
+
+void FrameTimeStatistics::AddModuleUpdate(size_t index, const QString &name, double seconds, const AllocationCounts &allocations)
+{
+    if (index >= modules.size())
+        modules.resize(index + 1);
+    Module &module = modules[index];
+    if (module.name.isEmpty())
+        module.name = name;
+    module.histogram.Add(seconds);
+    module.allocations += allocations;
+}
+
+void FrameTimeStatistics::Update()
+{
+    const tick_t now = GetCurrentClockTime();
+    const tick_t freq = GetCurrentClockFreq();
+    if (sliceStart == 0)
+        sliceStart = now;
+    if (now - sliceStart < freq)
+        return;
+
+    // The allocations of the slice that finished, of which the frames are counted before the slice is advanced.
+    framesLastSlice = frames.Count(1);
+    const AllocationCounts frameAllocations = AllocationTracker::MainThreadCounts();
+    frameAllocationsLastSlice = frameAllocations - frameAllocationsAtSlice;
+    frameAllocationsAtSlice = frameAllocations;
+    for(size_t i = 0; i < modules.size(); ++i)
+    {
+        modules[i].allocationsLastSlice = modules[i].allocations - modules[i].allocationsAtSlice;
+        modules[i].allocationsAtSlice = modules[i].allocations;
+    }
+
+    // After a long frame, the seconds it spanned are empty slices.
+    const tick_t elapsed = (now - sliceStart) / freq;
+    const int numSlices = (int)std::min<tick_t>(elapsed, TimeHistogram::cNumSlices);
+    for(int i = 0; i < numSlices; ++i)
+    {
+        frames.Advance();
+        for(size_t j = 0; j < modules.size(); ++j)
+            modules[j].histogram.Advance();
+    }
+    sliceStart += elapsed * freq;
+
+    if (regressionCooldown > 0)
+        regressionCooldown = std::max(0, regressionCooldown - numSlices);
+    else if (logRegressions)
+        CheckRegression();
+}
+
+void FrameTimeStatistics::CheckRegression()
+{
+    // The new slice is empty, so the short window ends at the slice that just finished.
+    const int shortSlices = cShortWindow + 1;
+    const double shortP99 = frames.Percentile(0.99, shortSlices);
+    const double longP99 = frames.Percentile(0.99, cLongWindow);
+    if (shortP99 < cRegressionMinimum || shortP99 <= cRegressionFactor * longP99)
+        return;
+
+    // Name the modules of which p99 grew the most.
+    std::vector<std::pair<double, size_t> > growth;
+    for(size_t i = 0; i < modules.size(); ++i)
+    {
+        const double delta = modules[i].histogram.Percentile(0.99, shortSlices) - modules[i].histogram.Percentile(0.99, cLongWindow);
+        if (delta > 0.001)
+            growth.push_back(std::make_pair(delta, i));
+    }
+    std::sort(growth.rbegin(), growth.rend());
+    QStringList culprits;
+    for(size_t i = 0; i < growth.size() && i < 3; ++i)
+    {
+        const Module &module = modules[growth[i].second];
+        culprits << QString("%1 %2 ms (from %3 ms)").arg(module.name).arg(Msecs(module.histogram.Percentile(0.99, shortSlices), 0))
+            .arg(Msecs(module.histogram.Percentile(0.99, cLongWindow), 0));
+    }
+    LogWarning(QString("Frame time p99 of the last %1 s is %2 ms, up from %3 ms of the last %4 s.%5").arg(cShortWindow)
+        .arg(Msecs(shortP99, 0)).arg(Msecs(longP99, 0)).arg(cLongWindow)
+        .arg(culprits.isEmpty() ? QString() : " Modules: " + culprits.join(", ") + "."));
+    regressionCooldown = shortSlices;
+}
+
+QVariantList FrameTimeStatistics::Statistics(int windowSeconds) const
+{
+    QVariantList list;
+    for(size_t i = 0; i <= modules.size(); ++i)
+    {
+        const TimeHistogram &histogram = i == 0 ? frames : modules[i - 1].histogram;
+        QVariantMap entry;
+        entry["name"] = i == 0 ? QString("Frame") : modules[i - 1].name;
+        entry["count"] = histogram.Count(windowSeconds);
+        entry["p50"] = histogram.Percentile(0.5, windowSeconds) * 1e3;
+        entry["p95"] = histogram.Percentile(0.95, windowSeconds) * 1e3;
+        entry["p99"] = histogram.Percentile(0.99, windowSeconds) * 1e3;
+        entry["max"] = histogram.Max(windowSeconds) * 1e3;
+        if (AllocationTracker::IsEnabled())
+            AddAllocations(entry, i == 0 ? frameAllocationsLastSlice : modules[i - 1].allocationsLastSlice);
+        list << entry;
+    }
+    return list;
+}
+
+void FrameTimeStatistics::AddAllocations(QVariantMap &entry, const AllocationCounts &lastSlice) const
+{
+    const double numFrames = (double)std::max(framesLastSlice, 1u);
+    entry["allocations"] = (double)lastSlice.allocations / numFrames;
+    entry["allocatedBytes"] = (double)lastSlice.bytes / numFrames;
+}
+
+void FrameTimeStatistics::Print() const
+{
+    LogInfo(QString("Frame and module update times in ms over the last %1 s | %2 s:").arg(cShortWindow).arg(cLongWindow));
+    LogInfo(QString("%1 %2 %3 %4 %5 | %6 %7 %8 %9").arg("", -32).arg("p50", 8).arg("p95", 8).arg("p99", 8).arg("max", 8)
+        .arg("p50", 8).arg("p95", 8).arg("p99", 8).arg("max", 8));
+    for(size_t i = 0; i <= modules.size(); ++i)
+    {
+        const TimeHistogram &histogram = i == 0 ? frames : modules[i - 1].histogram;
+        QString line = (i == 0 ? QString("Frame") : modules[i - 1].name).leftJustified(32, ' ', true);
+        const int windows[] = { cShortWindow, cLongWindow };
+        for(int w = 0; w < 2; ++w)
+        {
+            line += w == 0 ? " " : " |";
+            for(size_t p = 0; p < sizeof(cPercentiles) / sizeof(cPercentiles[0]); ++p)
+                line += " " + Msecs(histogram.Percentile(cPercentiles[p], windows[w]), 8);
+            line += " " + Msecs(histogram.Max(windows[w]), 8);
+        }
+        LogInfo(line);
+    }
+}
+
+void FrameTimeStatistics::CollectMetrics()
+{
+    MetricsRegistry *metrics = framework->Metrics();
+    for(size_t p = 0; p < sizeof(cPercentiles) / sizeof(cPercentiles[0]); ++p)
+        metrics->Set("tundra_frame_seconds_quantile", frames.Percentile(cPercentiles[p], cLongWindow), cQuantileLabels[p]);
+    metrics->Set("tundra_frame_seconds_quantile", frames.Max(cLongWindow), cQuantileLabels[3]);
+    for(size_t i = 0; i < modules.size(); ++i)
+    {
+        const QString module = MetricsRegistry::Label("module", modules[i].name) + ",";
+        for(size_t p = 0; p < sizeof(cPercentiles) / sizeof(cPercentiles[0]); ++p)
+            metrics->Set("tundra_module_update_seconds_quantile", modules[i].histogram.Percentile(cPercentiles[p], cLongWindow), module + cQuantileLabels[p]);
+        metrics->Set("tundra_module_update_seconds_quantile", modules[i].histogram.Max(cLongWindow), module + cQuantileLabels[3]);
+        if (AllocationTracker::IsEnabled())
+        {
+            const QString label = MetricsRegistry::Label("module", modules[i].name);
+            metrics->Set("tundra_module_allocations_total", (double)modules[i].allocations.allocations, label);
+            metrics->Set("tundra_module_allocated_bytes_total", (double)modules[i].allocations.bytes, label);
+        }
+    }
+}
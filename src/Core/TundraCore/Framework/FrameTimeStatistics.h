@@ -0,0 +1,164 @@
+/**
+    For conditions of distribution and use, see copyright notice in LICENSE
+
+    @file   FrameTimeStatistics.h
+    @brief  Percentiles of the frame times and the module update times over sliding windows. */
+
+#pragma once
+
+#include "TundraCoreApi.h"
+#include "CoreTypes.h"
+#include "HighPerfClock.h"
+#include "AllocationTracker.h"
+
+#include <QObject>
+#include <QString>
+#include <QVariant>
+
+#include <vector>
+
+class Framework;
+
+/// Log-linear histogram of durations over a sliding window of one-second slices.
+/** The durations are counted in microseconds, in buckets of 1/16 of a power of two each, so that the percentiles are
+    within about 6% at any magnitude, in the manner of the HDR histograms. Durations from 16 s up go to the last bucket.
+    The window is cNumSlices slices, of which the percentiles can be read over the latest ones. */
+class TUNDRACORE_API TimeHistogram
+{
+public:
+    TimeHistogram();
+
+    /// Adds a duration in seconds to the current slice.
+    void Add(double seconds);
+
+    /// Starts a new slice, dropping the oldest one.
+    void Advance();
+
+    /// Returns the duration in seconds below which the fraction of the durations of the latest slices fall, f.ex. 0.99 for p99.
+    /** @param numSlices Number of the latest slices, including the current one. Returns 0 if there are no durations. */
+    double Percentile(double fraction, int numSlices) const;
+
+    /// Returns the longest duration of the latest slices in seconds.
+    double Max(int numSlices) const;
+
+    /// Returns the number of durations in the latest slices.
+    u32 Count(int numSlices) const;
+
+    /// Number of the slices kept, i.e. length of the longest window in seconds.
+    static const int cNumSlices = 60;
+
+    /// Number of the exact buckets below the first power of two with 16 sub-buckets.
+    static const int cSubBuckets = 16;
+
+    /// Number of the buckets: the exact ones and 16 per power of two from 16 us to 16 s.
+    static const int cNumBuckets = cSubBuckets + 20 * cSubBuckets;
+
+private:
+    struct Slice
+    {
+        Slice() : count(0), max(0.0) { for(int i = 0; i < cNumBuckets; ++i) buckets[i] = 0; }
+        u32 buckets[cNumBuckets];
+        u32 count;
+        double max;
+    };
+
+    /// Returns the bucket of a duration in microseconds.
+    static int Bucket(u32 usecs);
+
+    /// Returns the middle of the range of a bucket in seconds.
+    static double BucketValue(int bucket);
+
+    std::vector<Slice> slices;
+    int current; ///< Index of the current slice.
+};
+
+/// Percentiles of the frame times and the module update times over sliding windows.
+/** This class cannot be created directly, it's created by Framework, which records the time of each frame, and of the
+    Update of each module, every frame. The percentiles p50, p95, p99 and the maximum are reported over the last
+    cShortWindow and cLongWindow seconds by the frameTimes console command, the DebugStats window, and the metrics of
+    MetricsRegistry. The average FPS hides the hitches, which show in p99 and the maximum.
+
+    When AllocationTracker is enabled, the heap allocations of each module's Update, and of the whole frame, are
+    reported too, per frame over the last full second.
+
+    With --logFrameTimeRegressions, or SetRegressionLogging, a warning is logged when p99 of the short window is more than
+    cRegressionFactor times that of the long window, naming the modules whose p99 regressed the most. */
+class TUNDRACORE_API FrameTimeStatistics : public QObject
+{
+    Q_OBJECT
+
+public:
+    ~FrameTimeStatistics();
+
+    /// Records the time of a frame in seconds. Called by Framework each frame.
+    void AddFrame(double seconds);
+
+    /// Records the time of the Update of a module in seconds, and the heap allocations of it. Called by Framework each frame.
+    /** @param index Index of the module in the Framework, which stays the same for the run. */
+    void AddModuleUpdate(size_t index, const QString &name, double seconds, const AllocationCounts &allocations);
+
+    /// Starts a new slice of the histograms once a second, and logs the regressions if enabled. Called by Framework each frame.
+    void Update();
+
+    /// Length of the short window in seconds.
+    static const int cShortWindow = 5;
+
+    /// Length of the long window in seconds.
+    static const int cLongWindow = TimeHistogram::cNumSlices;
+
+    /// Factor by which p99 of the short window needs to exceed that of the long window for a regression to be logged.
+    static const float cRegressionFactor;
+
+    /// p99 of the frames of the short window below which no regression is logged, in seconds.
+    static const float cRegressionMinimum;
+
+public slots:
+    /// Returns the statistics of the frames and the modules over the latest seconds, up to cLongWindow.
+    /** @return List of maps with name, count, and p50, p95, p99 and max in milliseconds. The frames are the first entry,
+        named "Frame", followed by the modules in the order of the Framework. When AllocationTracker is enabled, the maps
+        also have allocations and allocatedBytes, the averages per frame over the last full second regardless of the window. */
+    QVariantList Statistics(int windowSeconds) const;
+
+    /// Prints the percentiles of the frames and the modules over the short and the long window.
+    void Print() const;
+
+    /// Logs a warning when p99 of the frame times regresses, see cRegressionFactor.
+    void SetRegressionLogging(bool enabled) { logRegressions = enabled; }
+    bool RegressionLogging() const { return logRegressions; }
+
+private slots:
+    /// Sets the percentile metrics of the long window, see MetricsRegistry::Collect.
+    void CollectMetrics();
+
+private:
+    Q_DISABLE_COPY(FrameTimeStatistics)
+    friend class Framework;
+
+    /// Constructs the statistics. Framework takes ownership of this object.
+    explicit FrameTimeStatistics(Framework *owner);
+
+    /// Checks the frames of the short window for a regression of p99, and logs it.
+    void CheckRegression();
+
+    struct Module
+    {
+        QString name;
+        TimeHistogram histogram;
+        AllocationCounts allocations; ///< Total of the run.
+        AllocationCounts allocationsAtSlice; ///< Total of the run when the current slice started.
+        AllocationCounts allocationsLastSlice; ///< Allocations of the last full slice.
+    };
+
+    /// Adds the allocation averages per frame of the last full slice to a map of Statistics.
+    void AddAllocations(QVariantMap &entry, const AllocationCounts &lastSlice) const;
+
+    Framework *framework;
+    TimeHistogram frames;
+    AllocationCounts frameAllocationsAtSlice; ///< Allocations of the main thread when the current slice started.
+    AllocationCounts frameAllocationsLastSlice; ///< Allocations of the main thread in the last full slice.
+    u32 framesLastSlice; ///< Number of the frames in the last full slice.
+    std::vector<Module> modules;
+    tick_t sliceStart; ///< Clock time the current slice started.
+    bool logRegressions;
+    int regressionCooldown; ///< Number of the slices to go before the next regression is logged.
+};
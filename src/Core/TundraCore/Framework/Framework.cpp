@@ -15,12 +15,18 @@
 #include "IModule.h"
 #include "FrameAPI.h"
 #include "ConsoleAPI.h"
+#include "MetricsRegistry.h"
+#include "FrameTimeStatistics.h"
+#include "JobSystem.h"
+#include "AllocationTracker.h"
+#include "Math/SIMDCapability.h"
 
 #include "InputAPI.h"
 #include "AssetAPI.h"
 #include "AudioAPI.h"
 #include "SceneAPI.h"
 #include "UiAPI.h"
+#include "EntityAction.h"
 
 #ifndef _WINDOWS
 #include <sys/ioctl.h>
@@ -127,7 +133,12 @@ Framework::Framework(int argc_, char** argv_, Application *app) :
     profiler(0),
 #endif
     profilerQObj(0),
-    renderer(0)
+    metrics(0),
+    frameTimes(0),
+    jobs(0),
+    renderer(0),
+    frameTimeMetric(0),
+    modulesInitialized(false)
 {
     // Make sure the C locale is set to ensure e.g. proper txml loading
     setlocale(LC_ALL, "C");
@@ -140,6 +151,12 @@ Framework::Framework(int argc_, char** argv_, Application *app) :
     LoadCommandLineFromFile();
 #else
     ProcessStartupOptions();
+#endif
+    ApplyLowMemoryProfile();
+#ifdef TUNDRA_SERVER_ONLY
+    // The server-only build always runs headless, as it is built without the client UI and rendering plugins.
+    if (!HasCommandLineParameter("--headless"))
+        AddCommandLineParameter("--headless");
 #endif
     // In headless mode, no main UI/rendering window is initialized.
     headless = HasCommandLineParameter("--headless");
@@ -175,23 +192,55 @@ Framework::Framework(int argc_, char** argv_, Application *app) :
         cmdLineDescs.commands["--disableRunOnLoad"] = "Prevents script applications (EC_Script's with applicationName defined) starting automatically."; //JavascriptModule
         cmdLineDescs.commands["--server"] = "Starts Tundra as server."; // TundraLogicModule
         cmdLineDescs.commands["--port"] = "Specifies the Tundra server port."; // TundraLogicModule
+        cmdLineDescs.commands["--websocketThreads"] = "Number of threads the WebSocket server runs its network I/O on. Usage: '--websocketThreads <number>', without a number the number of CPU cores. Default: 1."; // WebSocketServerModule
         cmdLineDescs.commands["--protocol"] = "Specifies the Tundra server protocol. Options: '--protocol tcp' and '--protocol udp'. Defaults to udp if no protocol is specified."; // KristalliProtocolModule
+        cmdLineDescs.commands["--serverSockets"] = "Number of consecutive ports from --port a UDP server listens in, each with a socket and network thread of its own. "
+            "The connections of all ports are users of the same server. Usage: --serverSockets <n>. Default 1."; // KristalliProtocolModule
         cmdLineDescs.commands["--fpsLimit"] = "Specifies the FPS cap to use in rendering. Default: 60. Pass in 0 to disable."; // Framework
+        cmdLineDescs.commands["--adaptiveFramePacing"] = "Starts the frames at precise intervals of the FPS limit, and lowers the render resolution and shadow quality under load to hold it."; // Framework, OgreRenderingModule
+        cmdLineDescs.commands["--idleMode"] = "In the headless mode, sleeps until a network, timer or file event arrives when there are no connected users, active physics, "
+            "attribute interpolations or other work that keeps the main loop awake, instead of running frames at the FPS limit."; // Framework
+        cmdLineDescs.commands["--idleTick"] = "Specifies the longest time in milliseconds the main loop sleeps between the frames in the idle mode. Default: 250."; // Framework
+        cmdLineDescs.commands["--profilerCapture"] = "Saves the profiling blocks of the given number of frames from the startup on as a Chrome trace, which opens in chrome://tracing and the Perfetto UI. "
+            "Usage: '--profilerCapture <frames>'. Only in the builds with profiling enabled."; // Framework
+        cmdLineDescs.commands["--profilerCaptureFile"] = "Specifies the file of --profilerCapture. Default: profiler_trace.json."; // Framework
+        cmdLineDescs.commands["--profilerHitch"] = "Saves the profiling blocks of the last frames as a Chrome trace whenever a frame takes longer than the given milliseconds, "
+            "to profiler_hitch-<time>.json. Usage: '--profilerHitch <msecs>'. Only in the builds with profiling enabled."; // Framework
         cmdLineDescs.commands["--fpsLimitWhenInactive"] = "Specifies the FPS cap to use when the window is not active. Default: 30 (half of the FPS). Pass 0 to disable."; // Framework
+        cmdLineDescs.commands["--lowPriorityBudget"] = "Specifies the time budget in milliseconds of the low-priority updates of each frame. Default: 2."; // Framework
+        cmdLineDescs.commands["--lowMemory"] = "Applies the defaults of the low-memory profile for the parameters not given: '--maxTextureSize 1024', "
+            "'--assetMemoryBudget \"Texture=96;OgreMesh=48\"' and '--sharedScriptEngines'. On by default on Android, disable with --noLowMemory."; // Framework
         cmdLineDescs.commands["--run"] = "Runs script on startup"; // JavaScriptModule
         cmdLineDescs.commands["--plugin"] = "Specifies a shared library (a 'plugin') to be loaded, relative to 'TUNDRA_DIRECTORY/plugins' path. Multiple plugin parameters are supported, f.ex. '--plugin MyPlugin --plugin MyOtherPlugin', or multiple parameters per --plugin, separated with semicolon (;) and enclosed in quotation marks, f.ex. --plugin \"MyPlugin;OtherPlugin;Etc\""; // Framework
         cmdLineDescs.commands["--jsplugin"] = "Specifies a javascript file to be loaded at startup, relative to 'TUNDRA_DIRECTORY/jsplugins' path. Multiple jsplugin parameters are supported, f.ex. '--jsplugin MyPlugin.js --jsplugin MyOtherPlugin.js', or multiple parameters per --jsplugin, separated with semicolon (;) and enclosed in quotation marks, f.ex. --jsplugin \"MyPlugin.js;MyOtherPlugin.js;Etc.js\". If JavascriptModule is not loaded, this parameter has no effect."; // JavascriptModule
+        cmdLineDescs.commands["--sharedScriptEngines"] = "Runs the Javascript instances in pooled script engines, each instance with a global object of its own, instead of one engine per instance. "
+            "Saves memory and startup time with many scripted entities. The scripts should disconnect their signal handlers in OnScriptDestroyed, as the engine outlives them."; // JavascriptModule
+        cmdLineDescs.commands["--scriptBudget"] = "Specifies the time in milliseconds a Javascript instance may spend in the calls from the frame signals, timers and other signals each frame, before it is reported as over the budget. Default: 5. Pass 0 to disable the reporting."; // JavascriptModule
+        cmdLineDescs.commands["--hotReloadScripts"] = "When a script asset of a running EC_Script changes, re-evaluates only the changed script in the existing Javascript engine instead of restarting the instance. "
+            "The scripts can disconnect their signal handlers in OnScriptReloading and keep state in engine.PersistentState()."; // JavascriptModule
+        cmdLineDescs.commands["--jsSample"] = "Starts sampling the call stacks of the Javascript instances at startup. Save the samples with the jsSampleSave console command."; // JavascriptModule
         cmdLineDescs.commands["--file"] = "Specifies a startup scene file. Multiple files supported. Accepts absolute and relative paths, local:// and http:// are accepted and fetched via the AssetAPI."; // TundraLogicModule & AssetModule
         cmdLineDescs.commands["--storage"] = "Adds the given directory as a local storage directory on startup."; // AssetModule
+        cmdLineDescs.commands["--parallelPluginLoading"] = "Opens the shared libraries of the plugins concurrently at startup. The plugins are still started in the given order. See the startupTimes console command."; // Framework & PluginAPI
         cmdLineDescs.commands["--config"] = "Specifies a startup configuration file to use. Multiple config files are supported, f.ex. '--config tundra.json --config MyCustomAddons.xml'. XML and JSON Tundra startup configs are supported."; // Framework & PluginAPI
         cmdLineDescs.commands["--connect"] = "Connects to a Tundra server automatically. Syntax: '--connect serverIp;port;protocol;name;password'. Password is optional."; // TundraLogicModule & AssetModule
         cmdLineDescs.commands["--login"] = "Automatically login to server using provided data. Url syntax: {tundra|http|https}://host[:port]/?username=x[&password=y&avatarurl=z&protocol={udp|tcp}]. Minimum information needed to try a connection in the url are host and username."; // TundraLogicModule & AssetModule
         cmdLineDescs.commands["--netRate"] = "Specifies the number of network updates per second. Default: 30."; // TundraLogicModule
         cmdLineDescs.commands["--noAssetCache"] = "Disable asset cache."; // Framework
+        cmdLineDescs.commands["--httpMaxRequestsPerHost"] = "Specifies the maximum number of concurrent HTTP asset requests to a host. Default: 6."; // AssetModule
+        cmdLineDescs.commands["--httpPipelining"] = "Sends all HTTP asset requests pipelined, not only the requests to storages with 'pipelining=true'."; // AssetModule
         cmdLineDescs.commands["--assetCacheDir"] = "Specify asset cache directory to use."; // Framework
+        cmdLineDescs.commands["--noShaderCache"] = "Disables the cache of compiled shader programs that is kept next to the asset cache."; // OgreRenderingModule
         cmdLineDescs.commands["--clearAssetCache"] = "At the start of Tundra, remove all data and metadata files from asset cache."; // AssetCache
+        cmdLineDescs.commands["--sharedAssetCache"] = "Share the asset cache directory with other Tundra processes on the same host, so that each asset is downloaded once per host."; // AssetCache
+        cmdLineDescs.commands["--assetMemoryBudget"] = "Sets the memory budgets of asset types in megabytes. The least recently used assets not referred to by any component are unloaded when their type exceeds its budget. Usage example: '--assetMemoryBudget \"Texture=256;OgreMesh=128\"'."; // AssetAPI
+        cmdLineDescs.commands["--audioSources"] = "Specifies the number of OpenAL sources that the most audible sound channels play on; the rest play silently. Default: 32."; // AudioAPI
         cmdLineDescs.commands["--logLevel"] = "Sets the current log level: 'error', 'warning', 'info', 'debug'."; // ConsoleAPI
         cmdLineDescs.commands["--logFile"] = "Sets logging file. Usage example: '--logfile TundraLogFile.txt'."; // ConsoleAPI
+        cmdLineDescs.commands["--logRateLimit"] = "Sets the number of warning, info and debug messages written to the log per second; the rest are counted as suppressed. "
+            "Pass 0 to disable. Default: 200."; // ConsoleAPI
+        cmdLineDescs.commands["--syncLogging"] = "Writes each log message to stdout and the log file in the calling thread and flushes the log file after it, "
+            "instead of in the background. Slower, but nothing is lost if the process crashes."; // ConsoleAPI
         cmdLineDescs.commands["--physicsRate"] = "Specifies the number of physics simulation steps per second. Default: 60."; // PhysicsModule
         cmdLineDescs.commands["--physicsMaxSteps"] = "Specifies the maximum number of physics simulation steps in one frame to limit CPU usage. If the limit would be exceeded, physics will appear to slow down. Default: 6."; // PhysicsModule
         cmdLineDescs.commands["--splash"] = "Shows splash screen during the startup."; // Framework
@@ -200,10 +249,21 @@ Framework::Framework(int argc_, char** argv_, Application *app) :
         cmdLineDescs.commands["--vsyncFrequency"] = "Sets display frequency rate for vsync, applicable only if fullscreen is set. Usage: '--vsyncFrequency <number>'."; // OgreRenderingModule
         cmdLineDescs.commands["--antialias"] = "Sets full screen antialiasing factor. Usage '--antialias <number>'."; // OgreRenderingModule
         cmdLineDescs.commands["--hideBenignOgreMessages"] = "Sets some uninformative Ogre log messages to be ignored from the log output."; // OgreRenderingModule
-        cmdLineDescs.commands["--noAsyncAssetLoad"] = "Disables threaded loading of Ogre assets."; // OgreRenderingModule
+        cmdLineDescs.commands["--noAsyncAssetLoad"] = "Disables threaded loading of assets."; // AssetAPI, OgreRenderingModule
         cmdLineDescs.commands["--autoDxtCompress"] = "Compress uncompressed texture assets to DXT1/DXT5 format on load to save memory."; // OgreRenderingModule
+        cmdLineDescs.commands["--dxtQuality"] = "Quality of the --autoDxtCompress compression: 'fast' (default), 'normal' or 'high'. The better qualities are slower to load."; // OgreRenderingModule
+        cmdLineDescs.commands["--particleBudget"] = "Maximum number of live particles of all the particle systems, default 20000. The emission is scaled down to fit it. 0 disables the budget."; // OgreRenderingModule
+        cmdLineDescs.commands["--pipelinedRendering"] = "Presents each frame only after the logic of the next frame has run, so that the GPU renders in parallel with the logic. Adds a frame of display latency."; // OgreRenderingModule
+        cmdLineDescs.commands["--textureStreaming"] = "Loads DDS and CRN textures in low resolution first, and streams their mip levels by the screen size of the meshes they are on, within the texture budget."; // OgreRenderingModule
+        cmdLineDescs.commands["--occlusionCulling"] = "Culls the meshes that are hidden behind large meshes from the main camera, tested against a low resolution software depth buffer of the largest meshes in view."; // OgreRenderingModule
+        cmdLineDescs.commands["--clusteredLights"] = "Gives each mesh in view only the lights that reach it, the most important first up to a budget, binned by screen tiles and depth slices of the main camera."; // OgreRenderingModule
+        cmdLineDescs.commands["--noBillboardBatching"] = "Gives each billboard a billboard set of its own, instead of rendering the billboards of the same material in a shared billboard set."; // OgreRenderingModule
+        cmdLineDescs.commands["--meshLod"] = "Generates levels of detail for mesh assets that have none, switched by the screen size of the mesh. The generated meshes are kept in the asset cache."; // OgreRenderingModule
         cmdLineDescs.commands["--maxTextureSize"] = "Resize texture assets that are larger than this. Default: no resizing."; // OgreRenderingModule
         cmdLineDescs.commands["--variablePhysicsStep"] = "Use variable physics timestep to avoid taking multiple physics substeps during one frame."; // PhysicsModule
+        cmdLineDescs.commands["--parallelPhysics"] = "Runs the narrowphase collision detection, and the island solving if Bullet is built without its profiler, of the physics step in the worker threads of the update scheduler."; // PhysicsModule
+        cmdLineDescs.commands["--asyncPhysics"] = "Runs the physics step in a dedicated thread, overlapped with the rest of the frame. The placeables get the body transforms one step late, in one batch."; // PhysicsModule
+        cmdLineDescs.commands["--physicsLod"] = "Specifies the radius around the observers, on a server those of the connected users, beyond which dynamic physics bodies are frozen. Default: 0, disabled."; // PhysicsModule
         cmdLineDescs.commands["--opengl"] = "Use Ogre with \"OpenGL Rendering Subsystem\" for rendering, overrides the option that was set in config.";
         cmdLineDescs.commands["--nullRenderer"] = "Disables all Ogre rendering operations."; // OgreRenderingModule
         cmdLineDescs.commands["--ogreCaptureTopWindow"] = "On some systems, the Ogre rendering output is overdrawn by the desktop compositing manager, "
@@ -214,8 +274,57 @@ Framework::Framework(int argc_, char** argv_, Application *app) :
         cmdLineDescs.commands["--noMenuBar"] = "Disables showing of the application menu bar automatically."; // Framework
         cmdLineDescs.commands["--clientExtrapolationTime"] = "Rigid body extrapolation time on client in milliseconds. Default 66."; // TundraProtocolModule
         cmdLineDescs.commands["--noClientPhysics"] = "Disables rigid body handoff to client simulation after no movement packets received from server."; // TundraProtocolModule
+        cmdLineDescs.commands["--syncThreads"] = "Number of worker threads the server uses to assemble scene sync messages for the connected users. Usage: '--syncThreads <number>'. Default: 0 (assemble on the main thread)."; // TundraProtocolModule
+        cmdLineDescs.commands["--noAttributeDeltas"] = "Disables delta-encoding of replicated attribute values against the last values each client received."; // TundraProtocolModule
+        cmdLineDescs.commands["--syncBandwidthLimit"] = "Limits the rate of scene sync data the server sends to each client, in bytes per second. Usage: '--syncBandwidthLimit <number>' for all clients, or '--syncBandwidthLimit <connectionType>:<number>', f.ex. '--syncBandwidthLimit websocket:32768'. Default: unlimited."; // TundraProtocolModule
+        cmdLineDescs.commands["--syncBatchSize"] = "Largest size in bytes of the batch messages the server packs the reliable scene sync messages to each client to. 0 disables batching. Default: 1400."; // TundraProtocolModule
+        cmdLineDescs.commands["--loginAdmissionsPerFrame"] = "Number of authenticated users the server admits to the scene per frame at most, the rest waiting in a queue. Usage: '--loginAdmissionsPerFrame <number>'. Default: 2, 0 for no limit."; // TundraProtocolModule
+        cmdLineDescs.commands["--noAssetManifest"] = "Disables sending joining clients the list of the assets requested during the server session for prefetching."; // TundraProtocolModule
+        cmdLineDescs.commands["--noSceneSnapshots"] = "Disables sending the scene to joining clients as one compressed snapshot. The entities are streamed instead."; // TundraProtocolModule
+        cmdLineDescs.commands["--noAdaptiveUpdateRate"] = "Disables adapting the scene sync rate of each client to its round-trip time, packet loss and send queue length."; // TundraProtocolModule
+        cmdLineDescs.commands["--syncStatistics"] = "Records scene sync traffic per connection, message type, component type and attribute. Available from SyncManager and the DebugStats window."; // TundraProtocolModule
+        cmdLineDescs.commands["--syncDeadReckoningThreshold"] = "Predicted client-side position error in meters above which rigid body updates are sent. 0 disables dead reckoning. Default 0."; // TundraProtocolModule
+        cmdLineDescs.commands["--syncProgressiveJoin"] = "Sends the scene to joining clients progressively, nearest entities to the client's observer first, at most the given number of entities per network update. Usage: '--syncProgressiveJoin <number>'. Default: 0 (send the whole scene at once)."; // TundraProtocolModule
+        cmdLineDescs.commands["--syncSessionResumeTime"] = "Seconds the server keeps the sync state of a client whose connection dropped, so that the reconnecting client is sent only the changes instead of the whole scene. Usage: '--syncSessionResumeTime <seconds>'. Default: 30, 0 disables."; // TundraProtocolModule
+        cmdLineDescs.commands["--syncStateCompactDistance"] = "Distance from a client's observer beyond which the per-client sync states of idle entities are compacted to save server memory. Usage: '--syncStateCompactDistance <meters>'. Default: 0 (disabled)."; // TundraProtocolModule
+        cmdLineDescs.commands["--syncIdempotentActions"] = "Comma-separated names of entity actions of which identical copies queued to a client during one network update are sent once. Usage: --syncIdempotentActions <name,name,...>"; // TundraProtocolModule
+        cmdLineDescs.commands["--syncCompressionThreshold"] = "Size in bytes from which scene sync messages are sent compressed to peers that support it, 0 disables. Default 1024."; // TundraProtocolModule
+        cmdLineDescs.commands["--syncCapture"] = "Captures the network messages the server receives to a trace file, for replaying with --syncReplay. Usage: --syncCapture <file>"; // TundraProtocolModule
+        cmdLineDescs.commands["--syncReplay"] = "Replays a trace captured with --syncCapture to the server's message handlers as fast as possible, "
+            "reports the handler times and exits. Start the server with the scene the capture was started with. Usage: --syncReplay <file>"; // TundraProtocolModule
+        cmdLineDescs.commands["--zone"] = "Enables zone sharding of the server scene with other servers, this server owning the given zone of the XZ plane. "
+            "Usage: --zone <id,minX,minZ,maxX,maxZ>, the ID unique among the servers in 0-255."; // TundraProtocolModule
+        cmdLineDescs.commands["--zonePort"] = "Port the server accepts the zone links of its neighbours in, when zone sharding. Default 2445."; // TundraProtocolModule
+        cmdLineDescs.commands["--zoneNeighbour"] = "A neighbouring zone and the address of its server's zone links, when zone sharding. Can be given many times. "
+            "Usage: --zoneNeighbour <id,host:port,minX,minZ,maxX,maxZ>"; // TundraProtocolModule
+        cmdLineDescs.commands["--zoneBorder"] = "Distance from a neighbouring zone within which entities are mirrored to its server, when zone sharding. Default 20."; // TundraProtocolModule
+        cmdLineDescs.commands["--metrics"] = "Collects the metrics of the frame times, module updates, scene sync traffic, asset transfers, physics and scenes, "
+            "served in the Prometheus text format at http://<host>:<port>/metrics by the WebSocket server."; // Framework
+        cmdLineDescs.commands["--logFrameTimeRegressions"] = "Logs a warning when p99 of the frame times of the last 5 seconds is over 1.5 times that of the last minute, "
+            "naming the modules whose update times grew the most. See the frameTimes console command."; // Framework
+        cmdLineDescs.commands["--jobThreads"] = "Number of the worker threads of the job system shared by the modules. Default one less than the number of the cores, 0 runs the jobs in the main thread."; // Framework
+        cmdLineDescs.commands["--simd"] = "Highest instruction set of the math kernels: none, sse2, sse41 or avx. Default the best one the CPU supports. "
+            "Usage: '--simd sse2'."; // Framework
+        cmdLineDescs.commands["--trackAllocations"] = "Counts the heap allocations of the main thread per module update and per profiling block, "
+            "shown in the profiling window. Only in the builds with ENABLE_ALLOCATION_TRACKING."; // Framework
         cmdLineDescs.commands["--dumpProfiler"] = "Dump profiling blocks to console every 5 seconds."; // DebugStatsModule
+        cmdLineDescs.commands["--remoteProfiler"] = "Lets the clients that give the password stream the profiler snapshots of this server to their profiling window with the profRemote console command. "
+            "Usage: '--remoteProfiler <password>'. Only in the builds with profiling enabled."; // DebugStatsModule
+        cmdLineDescs.commands["--loadTestClients"] = "Number of simulated clients the load generator connects to the server. Usage: --loadTestClients <n>"; // SyncLoadTestModule
+        cmdLineDescs.commands["--loadTestServer"] = "Server the simulated clients connect to. Usage: --loadTestServer <address:port>. Default 127.0.0.1:2345."; // SyncLoadTestModule
+        cmdLineDescs.commands["--loadTestProtocol"] = "Transport of the simulated client connections, udp or tcp. Default udp."; // SyncLoadTestModule
+        cmdLineDescs.commands["--loadTestEntity"] = "ID of the entity the simulated clients send entity actions and transform edits to. "
+            "Default is the first replicated entity with an EC_Placeable."; // SyncLoadTestModule
+        cmdLineDescs.commands["--loadTestRates"] = "Per-client observer position, entity action and transform edit rates per second. "
+            "Usage: --loadTestRates <observerHz,actionHz,editHz>. Default 10,1,1."; // SyncLoadTestModule
+        cmdLineDescs.commands["--loadTestReport"] = "Seconds between load test statistics reports. On a server, enables reporting of sync tick time and bandwidth. Default 5."; // SyncLoadTestModule
+        cmdLineDescs.commands["--runBenchmarks"] = "Runs the benchmarks once the startup is over, writes the results as JSON and exits."; // BenchmarkModule
+        cmdLineDescs.commands["--benchmarkFilter"] = "Runs only the benchmarks whose name contains the given text. Usage: --benchmarkFilter <text>"; // BenchmarkModule
+        cmdLineDescs.commands["--benchmarkOutput"] = "File the benchmark results are written to. Default benchmarks.json."; // BenchmarkModule
+        cmdLineDescs.commands["--benchmarkRepetitions"] = "Number of the timed repetitions of each benchmark. Default 7."; // BenchmarkModule
+        cmdLineDescs.commands["--benchmarkUsers"] = "Number of the synthetic users of the sync tick benchmark. Default 50."; // BenchmarkModule
         cmdLineDescs.commands["--acceptUnknownLocalSources"] = "If specified, assets outside any known local storages are allowed. Otherwise, requests to them will fail."; // AssetModule
+        cmdLineDescs.commands["--noBakedAssets"] = "Loads the source files of local assets even if there are up-to-date files baked from them with TextureTool --bake."; // AssetModule
         cmdLineDescs.commands["--acceptUnknownHttpSources"] = "If specified, asset requests outside any registered HTTP storages are also accepted, and will appear as assets with no storage. "
             "Otherwise, all requests to assets outside any registered storage will fail."; // AssetModule
 
@@ -245,6 +354,30 @@ Framework::Framework(int argc_, char** argv_, Application *app) :
     PROFILE(FW_Startup);
 #endif
     profilerQObj = new ProfilerQObj;
+    metrics = new MetricsRegistry(this); // Created before the core APIs, which connect to it.
+    if (metrics->IsEnabled())
+    {
+        metrics->DescribeHistogram("tundra_frame_seconds", "Time between the starts of the frames.", MetricsRegistry::DefaultTimeBuckets());
+        metrics->Describe("tundra_module_update_seconds_total", MetricsRegistry::Counter, "Time spent in the Update of each module.");
+    }
+    AllocationTracker::SetMainThread();
+    if (HasCommandLineParameter("--trackAllocations"))
+    {
+        if (AllocationTracker::IsAvailable())
+            AllocationTracker::SetEnabled(true);
+        else
+            LogWarning("Framework: --trackAllocations given, but the build does not have the allocation tracking enabled, see ENABLE_ALLOCATION_TRACKING.");
+    }
+    const QStringList simdParam = CommandLineParameters("--simd");
+    if (!simdParam.isEmpty())
+    {
+        SIMDCapability simd;
+        if (SIMDCapabilityFromString(simdParam.last().toLower().toStdString().c_str(), simd))
+            SetActiveSIMDCapability(simd);
+        else
+            LogWarning("Framework: Invalid --simd value \"" + simdParam.last() + "\", using " + SIMDCapabilityToString(ActiveSIMDCapability()) + ".");
+    }
+    frameTimes = new FrameTimeStatistics(this);
 
     // Create ConfigAPI, pass application data and prepare data folder.
     config = new ConfigAPI(this);
@@ -294,8 +427,37 @@ Framework::Framework(int argc_, char** argv_, Application *app) :
             LogWarning("Erroneous FPS limit given with --fpsLimitWhenInactive: " + fpsLimitWhenInactive.first() + ". Ignoring.");
     }
 
+    if (config->DeclareSetting(targetFpsConfigData, "adaptive frame pacing", false).toBool() || HasCommandLineParameter("--adaptiveFramePacing"))
+        application->SetAdaptiveFramePacing(true);
+
+    if (config->DeclareSetting(targetFpsConfigData, "idle mode", false).toBool() || HasCommandLineParameter("--idleMode"))
+        application->SetIdleMode(true);
+    const QStringList idleTickParam = CommandLineParameters("--idleTick");
+    if (idleTickParam.size() > 0)
+    {
+        bool ok;
+        const int idleTick = idleTickParam.first().toInt(&ok);
+        if (ok && idleTick > 0)
+            application->SetIdleTick(idleTick);
+        else
+            LogWarning("Erroneous idle tick given with --idleTick: " + idleTickParam.first() + ". Ignoring.");
+    }
+
     // Create core APIs
+    jobs = new JobSystem(this); // Created before FrameAPI, of which UpdateScheduler runs its jobs in it.
     frame = new FrameAPI(this);
+    const QStringList lowPriorityBudgetParam = CommandLineParameters("--lowPriorityBudget");
+    if (lowPriorityBudgetParam.size() > 1)
+        LogWarning("Multiple --lowPriorityBudget parameters specified! Using " + lowPriorityBudgetParam.first() + " as the value.");
+    if (lowPriorityBudgetParam.size() > 0)
+    {
+        bool ok;
+        float budget = lowPriorityBudgetParam.first().toFloat(&ok);
+        if (ok && budget >= 0.f)
+            frame->SetLowPriorityBudget(budget);
+        else
+            LogWarning("Erroneous low-priority budget given with --lowPriorityBudget: " + lowPriorityBudgetParam.first() + ". Ignoring.");
+    }
     scene = new SceneAPI(this);
     plugin = new PluginAPI(this);
     asset = new AssetAPI(this, headless);
@@ -317,6 +479,39 @@ Framework::Framework(int argc_, char** argv_, Application *app) :
     console->RegisterCommand("inputContexts", "Prints all currently registered input contexts in InputAPI.", input, SLOT(DumpInputContexts()));
     console->RegisterCommand("dynamicObjects", "Prints all currently registered dynamic objets in Framework.", this, SLOT(PrintDynamicObjects()));
     console->RegisterCommand("plugins", "Prints all currently loaded plugins.", plugin, SLOT(ListPlugins()));
+    console->RegisterCommand("startupTimes", "Prints the time it took to load each plugin and to initialize each module at startup.", this, SLOT(PrintStartupTimes()));
+    console->RegisterCommand("frameTimes", "Prints p50, p95, p99 and the maximum of the frame times and of the update times of each module, "
+        "over the last 5 and 60 seconds.", frameTimes, SLOT(Print()));
+    console->RegisterCommand("profilerCapture", "Saves the profiling blocks of the next frames as a Chrome trace, which opens in chrome://tracing and the Perfetto UI. "
+        "Usage: profilerCapture(frames, fileName). The file name defaults to profiler_trace.json.",
+        profilerQObj, SLOT(CaptureTrace(int, const QString &)), SLOT(CaptureTrace(int)));
+    console->RegisterCommand("profilerHitch", "Saves the profiling blocks of the last frames as a Chrome trace whenever a frame takes longer than the threshold. "
+        "Usage: profilerHitch(thresholdMs, fileName). Pass 0 to stop. The time of the hitch is appended to the file name, which defaults to profiler_hitch.json.",
+        profilerQObj, SLOT(CaptureHitches(float, const QString &)), SLOT(CaptureHitches(float)));
+
+#ifdef PROFILING
+    const QStringList captureParam = CommandLineParameters("--profilerCapture");
+    if (!captureParam.isEmpty())
+    {
+        bool ok;
+        int frames = captureParam.first().toInt(&ok);
+        const QStringList captureFileParam = CommandLineParameters("--profilerCaptureFile");
+        if (ok && frames > 0)
+            profiler->Trace().Capture(frames, captureFileParam.isEmpty() ? "profiler_trace.json" : captureFileParam.first());
+        else
+            LogWarning("Erroneous frame count given with --profilerCapture: " + captureParam.first() + ". Ignoring.");
+    }
+    const QStringList hitchParam = CommandLineParameters("--profilerHitch");
+    if (!hitchParam.isEmpty())
+    {
+        bool ok;
+        float threshold = hitchParam.first().toFloat(&ok);
+        if (ok && threshold > 0.f)
+            profiler->Trace().SetHitchCapture(threshold, "profiler_hitch.json");
+        else
+            LogWarning("Erroneous threshold given with --profilerHitch: " + hitchParam.first() + ". Ignoring.");
+    }
+#endif
 
     RegisterDynamicObject("ui", ui);
     RegisterDynamicObject("frame", frame);
@@ -327,6 +522,8 @@ Framework::Framework(int argc_, char** argv_, Application *app) :
     RegisterDynamicObject("application", application);
     RegisterDynamicObject("config", config);
     RegisterDynamicObject("profiler", profilerQObj);
+    RegisterDynamicObject("metrics", metrics);
+    RegisterDynamicObject("frameTimes", frameTimes);
 
     PrintStartupOptions();
 }
@@ -345,7 +542,10 @@ Framework::~Framework()
     SAFE_DELETE(console);
     SAFE_DELETE(scene);
     SAFE_DELETE(frame);
+    SAFE_DELETE(jobs);
     SAFE_DELETE(ui);
+    SAFE_DELETE(frameTimes);
+    SAFE_DELETE(metrics);
 }
 
 void Framework::ProcessOneFrame()
@@ -368,14 +568,34 @@ void Framework::ProcessOneFrame()
     double frametime = ((double)currClockTime - (double)lastClockTime) / (double) clockFreq;
     lastClockTime = currClockTime;
 
+    frameTimes->AddFrame(frametime);
+    const bool metricsEnabled = metrics->IsEnabled();
+    if (metricsEnabled)
+    {
+        if (!frameTimeMetric)
+            frameTimeMetric = metrics->Find("tundra_frame_seconds", MetricsRegistry::Histogram);
+        frameTimeMetric->Observe(frametime);
+        while(moduleUpdateMetrics.size() < modules.size())
+            moduleUpdateMetrics.push_back(metrics->Find("tundra_module_update_seconds_total", MetricsRegistry::Counter,
+                MetricsRegistry::Label("module", modules[moduleUpdateMetrics.size()]->Name())));
+    }
+
     for(size_t i = 0; i < modules.size(); ++i)
     {
+        if (!modules[i]->IsInitialized())
+            continue; // A lazy module not used yet.
         try
         {
 #ifdef PROFILING
             ProfilerSection ps(("Module_" + modules[i]->Name() + "_Update").toStdString());
 #endif
+            const AllocationCounts allocationsStart = AllocationTracker::MainThreadCounts();
+            const tick_t updateStart = GetCurrentClockTime();
             modules[i]->Update(frametime);
+            const double updateTime = (double)(GetCurrentClockTime() - updateStart) / (double)clockFreq;
+            frameTimes->AddModuleUpdate(i, modules[i]->Name(), updateTime, AllocationTracker::MainThreadCounts() - allocationsStart);
+            if (metricsEnabled)
+                moduleUpdateMetrics[i]->Add(updateTime);
         }
         catch(const std::exception &e)
         {
@@ -400,6 +620,16 @@ void Framework::ProcessOneFrame()
 
     if (renderer)
         renderer->Render(frametime);
+
+    jobs->Update();
+    frameTimes->Update();
+    metrics->Update();
+
+#ifdef PROFILING
+    EntityAction::FlushInvocations(GetProfiler());
+    ThreadProfiler::Aggregate(GetProfiler());
+    GetProfiler()->Trace().EndFrame();
+#endif
 }
 
 void Framework::Go()
@@ -419,6 +649,7 @@ void Framework::Go()
         It does not find plugins correctly from current generation xml files.
         New style xml plugins are added to the command line params.
         Remove this at some point when people have converted their startup xmls. */
+    const tick_t startupStart = GetCurrentClockTime();
     foreach(const QString &config, plugin->ConfigurationFiles())
     {
         if (config.trimmed().endsWith(".xml", Qt::CaseInsensitive))
@@ -427,12 +658,20 @@ void Framework::Go()
 
     // Load plugins from command line params and from new style xml/json config files.
     plugin->LoadPluginsFromCommandLine();
+    const tick_t pluginsLoaded = GetCurrentClockTime();
 
+    modulesInitialized = true;
     for(size_t i = 0; i < modules.size(); ++i)
     {
-        LogDebug("Initializing module " + modules[i]->Name());
-        modules[i]->Initialize();
+        if (modules[i]->IsLazy())
+            LogDebug("Deferring the initialization of module " + modules[i]->Name() + " to its first use");
+        else
+            InitializeModule(modules[i].get());
     }
+    const tick_t clockFreq = GetCurrentClockFreq();
+    LogInfo(QString("Loaded the plugins in %1 ms and initialized the modules in %2 ms. See the startupTimes console command.")
+        .arg((double)(pluginsLoaded - startupStart) * 1000.0 / (double)clockFreq, 0, 'f', 0)
+        .arg((double)(GetCurrentClockTime() - pluginsLoaded) * 1000.0 / (double)clockFreq, 0, 'f', 0));
 
     // Run our QApplication subclass.
     application->Go();
@@ -442,6 +681,8 @@ void Framework::Go()
 
     for(size_t i = 0; i < modules.size(); ++i)
     {
+        if (!modules[i]->IsInitialized())
+            continue;
         LogDebug("Uninitializing module " + modules[i]->Name());
         modules[i]->Uninitialize();
     }
@@ -553,6 +794,16 @@ PluginAPI *Framework::Plugins() const
     return plugin;
 }
 
+MetricsRegistry *Framework::Metrics() const
+{
+    return metrics;
+}
+
+FrameTimeStatistics *Framework::FrameTimes() const
+{
+    return frameTimes;
+}
+
 IRenderer *Framework::Renderer() const
 {
     return renderer;
@@ -574,10 +825,28 @@ IModule *Framework::ModuleByName(const QString &name) const
 {
     for(size_t i = 0; i < modules.size(); ++i)
         if (modules[i]->Name() == name)
+        {
+            if (!modules[i]->IsInitialized())
+                InitializeModule(modules[i].get());
             return modules[i].get();
+        }
     return 0;
 }
 
+void Framework::InitializeModule(IModule *module) const
+{
+    if (module->initialized || !modulesInitialized || exitSignal)
+        return;
+    module->initialized = true; // Before Initialize, in case the module looks itself up in it.
+    if (module->IsLazy())
+        LogInfo("Initializing lazy module " + module->Name() + " on first use");
+    else
+        LogDebug("Initializing module " + module->Name());
+    const tick_t start = GetCurrentClockTime();
+    module->Initialize();
+    module->initializeMsecs = (double)(GetCurrentClockTime() - start) * 1000.0 / (double)GetCurrentClockFreq();
+}
+
 bool Framework::RegisterDynamicObject(QString name, QObject *object)
 {
     if (name.length() == 0 || !object)
@@ -939,6 +1208,26 @@ void Framework::AddCommandLineParameter(const QString &command, const QString &p
     startupOptions.insert(std::make_pair(command, std::make_pair((int)startupOptions.size() + 1, parameter)));
 }
 
+void Framework::ApplyLowMemoryProfile()
+{
+#ifdef ANDROID
+    bool lowMemory = !HasCommandLineParameter("--noLowMemory");
+#else
+    bool lowMemory = HasCommandLineParameter("--lowMemory");
+#endif
+    if (!lowMemory)
+        return;
+
+    // The explicitly given parameters override the profile.
+    if (!HasCommandLineParameter("--maxTextureSize"))
+        AddCommandLineParameter("--maxTextureSize", "1024");
+    if (!HasCommandLineParameter("--assetMemoryBudget"))
+        AddCommandLineParameter("--assetMemoryBudget", "Texture=96;OgreMesh=48");
+    if (!HasCommandLineParameter("--sharedScriptEngines"))
+        AddCommandLineParameter("--sharedScriptEngines");
+    LogInfo("Framework: Using the low-memory profile.");
+}
+
 bool Framework::HasCommandLineParameter(const QString &value) const
 {
     if (value.compare("--config", Qt::CaseInsensitive) == 0)
@@ -1049,7 +1338,14 @@ void Framework::ProcessStartupOptions()
     }
 
     if (!HasCommandLineParameter("--config"))
+    {
+#ifdef TUNDRA_SERVER_ONLY
+        // The server-only build does not have the client plugins of tundra.json.
+        LoadStartupOptionsFromFile("tundra-server.json");
+#else
         LoadStartupOptionsFromFile("tundra.json");
+#endif
+    }
 }
 
 void Framework::PrintStartupOptions()
@@ -1084,6 +1380,18 @@ void Framework::PrintDynamicObjects()
         LogInfo(QString(obj));
 }
 
+void Framework::PrintStartupTimes()
+{
+    plugin->PrintLoadTimes();
+    LogInfo(QString("%1 %2").arg("Module", -40).arg("Initialize ms", 14));
+    for(size_t i = 0; i < modules.size(); ++i)
+    {
+        const IModule *module = modules[i].get();
+        const QString time = module->IsInitialized() ? QString::number(module->InitializeTime(), 'f', 1) : QString("lazy, not used");
+        LogInfo(QString("%1 %2").arg(module->Name().leftJustified(40, ' ', true)).arg(time, 14));
+    }
+}
+
 #ifdef ANDROID
 StaticPluginRegistry* Framework::StaticPluginRegistryInstance()
 {
@@ -11,6 +11,7 @@
 #include <QStringList>
 
 #include <map>
+#include <vector>
 
 #ifdef ANDROID
 #include <jni.h>
@@ -43,6 +44,14 @@ public:
     template <class T>
     T *Module() const;
 
+    /// Returns the pool of worker threads shared by the modules.
+    /** @note Never returns a null pointer. */
+    JobSystem *Jobs() const { return jobs; }
+
+    /// Initializes a module, unless it's initialized already. Called at startup, and for the lazy modules on first lookup.
+    /** Only for internal use. The lazy modules looked up before the startup initialization are initialized in it. */
+    void InitializeModule(IModule *module) const;
+
     /// Registers a new module into the Framework.
     /** Framework will take ownership of the module pointer, so it is safe to pass in a raw pointer. */
     void RegisterModule(IModule *module);
@@ -139,6 +148,13 @@ public slots:
     /// Returns core API Plugin object.
     PluginAPI *Plugins() const;
 
+    /// Returns the registry of the metrics for monitoring.
+    /** @note Never returns a null pointer. The metrics are collected only when started with --metrics, see MetricsRegistry::IsEnabled. */
+    MetricsRegistry *Metrics() const;
+
+    /// Returns the percentiles of the frame times and the module update times over sliding windows.
+    FrameTimeStatistics *FrameTimes() const;
+
     /// Returns raw module pointer.
     /** @param name Name of the module.
         @note Do not store the returned raw module pointer anywhere or make a weak_ptr/shared_ptr out of it. */
@@ -175,6 +191,10 @@ public slots:
     /// Prints to console all the registered dynamic objects.
     void PrintDynamicObjects();
 
+    /// Prints to console the time it took to load each plugin and to initialize each module at startup.
+    /** The lazy modules that are not used yet are listed as such. See IModule::SetLazyInitialization. */
+    void PrintStartupTimes();
+
     // DEPRECATED
     IModule *GetModuleByName(const QString &name) const { return ModuleByName(name); } /**< @deprecated Use ModuleByName instead. @todo Add deprecation warning print. @todo Remove. */
 
@@ -182,6 +202,9 @@ private:
     /// Adds new command line parameter (option | value pair) to the unordered multimap.
     void AddCommandLineParameter(const QString &command, const QString &parameter = "");
 
+    /// Adds the parameters of the low-memory profile that are not given, when --lowMemory is given or on Android.
+    void ApplyLowMemoryProfile();
+
     /// Directs to XML of JSON parsing function depending on file suffix.
     bool LoadStartupOptionsFromFile(const QString &configurationFile);
     
@@ -222,8 +245,15 @@ private:
     SceneAPI *scene;
     ConfigAPI *config;
     PluginAPI *plugin;
+    MetricsRegistry *metrics;
+    FrameTimeStatistics *frameTimes;
+    JobSystem *jobs;
     IRenderer *renderer;
 
+    /// The series of the frame and module update time metrics, by the index of the module. Set on the first frame with the metrics enabled.
+    MetricSeries *frameTimeMetric;
+    std::vector<MetricSeries*> moduleUpdateMetrics;
+
     /// Sorts OptionsMap by options' insertion order.
     struct OptionMapLessThan
     {
@@ -245,6 +275,8 @@ private:
     /// Framework owns the memory of all the modules in the system. These are freed when Framework is exiting.
     std::vector<shared_ptr<IModule> > modules;
 
+    bool modulesInitialized; ///< Whether the startup initialization of the modules has begun, after which the lazy ones are initialized on first lookup.
+
     static Framework *instance;
     int argc; ///< Command line argument count as supplied by the operating system.
     char **argv; ///< Command line arguments as supplied by the operating system.
@@ -262,7 +294,11 @@ T *Framework::Module() const
     {
         T *module = dynamic_cast<T*>(modules[i].get());
         if (module)
+        {
+            if (!modules[i]->IsInitialized())
+                InitializeModule(modules[i].get());
             return module;
+        }
     }
 
     return 0;
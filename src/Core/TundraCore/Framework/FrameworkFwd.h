@@ -13,6 +13,10 @@ class RaycastResult;
 class IRenderer;
 class Profiler;
 class ProfilerQObj;
+class MetricsRegistry;
+struct MetricSeries;
+class FrameTimeStatistics;
+class JobSystem;
 class IModule;
 class Color;
 class Transform;
@@ -22,7 +22,7 @@ class TUNDRACORE_API IModule : public QObject, public enable_shared_from_this<IM
 public:
     /// Constructor.
     /** @param moduleName Module name. */
-    explicit IModule(const QString &moduleName) : name(moduleName), framework_(0) {}
+    explicit IModule(const QString &moduleName) : framework_(0), name(moduleName), lazy(false), initialized(false), initializeMsecs(0.0) {}
     virtual ~IModule() {}
 
     /// Called when module is loaded into memory.
@@ -53,7 +53,22 @@ public:
     /// Returns parent framework.
     Framework *GetFramework() const { return framework_; }
 
+    /// Returns whether the module is initialized on first use instead of at startup, see SetLazyInitialization.
+    bool IsLazy() const { return lazy; }
+
+    /// Returns whether Initialize has been called.
+    bool IsInitialized() const { return initialized; }
+
+    /// Returns the time Initialize took in milliseconds, or 0 if the module is not initialized.
+    double InitializeTime() const { return initializeMsecs; }
+
 protected:
+    /// Declares the module to be initialized only when first looked up with Framework::Module or ModuleByName, instead of at startup.
+    /** Call in the constructor or in Load. The module is not updated before it is initialized. Only make a module lazy
+        if it does nothing until it is used, f.ex. a tool that opens a window on a console command: the modules and the
+        scripts that only connect to the signals of the module without looking it up do not initialize it. */
+    void SetLazyInitialization(bool lazyInitialization) { lazy = lazyInitialization; }
+
     Framework *framework_; ///< Parent framework
 
 private:
@@ -63,4 +78,7 @@ private:
     void SetFramework(Framework *framework) { framework_ = framework; assert (framework_); }
 
     const QString name; ///< Name of the module
+    bool lazy;
+    bool initialized;
+    double initializeMsecs;
 };
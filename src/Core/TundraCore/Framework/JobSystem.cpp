@@ -0,0 +1,355 @@
+/**
+    For conditions of distribution and use, see copyright notice in LICENSE
+
+    @file   JobSystem.cpp
+    @brief  Work-stealing pool of worker threads shared by the modules. */
+
+#include "StableHeaders.h"
+#include "DebugOperatorNew.h"
+
+#include "JobSystem.h"
+#include "Framework.h"
+#include "Profiler.h"
+#include "LoggingFunctions.h"
+
+#include <QThread>
+#include <QMutexLocker>
+
+#include <algorithm>
+#include <exception>
+
+#include "MemoryLeakCheck.h"
+
+namespace
+{
+
+/// Runs a range of the items of a ParallelFor.
+class ParallelForJob : public IJob
+{
+public:
+    ParallelForJob(const QString &name, IParallelForBody &body, int begin, int end) :
+        IJob(name),
+        body_(body),
+        begin_(begin),
+        end_(end)
+    {
+    }
+
+    void Run() { body_.Run(begin_, end_); }
+
+private:
+    IParallelForBody &body_;
+    int begin_;
+    int end_;
+};
+
+} // ~unnamed namespace
+
+IJob::IJob(const QString &jobName) :
+    name(jobName),
+    pendingDependencies(1),
+    done(0),
+    continueOnMainThread(false),
+    finished(false)
+{
+}
+
+bool IJob::IsDone() const
+{
+    return const_cast<QAtomicInt &>(done).fetchAndAddAcquire(0) != 0;
+}
+
+class JobSystem::WorkerThread : public QThread
+{
+public:
+    WorkerThread(JobSystem *owner, int index) : owner_(owner), index_(index) {}
+    void run() { owner_->WorkerLoop(index_); }
+
+private:
+    JobSystem *owner_;
+    int index_;
+};
+
+JobSystem::JobSystem(Framework *owner) :
+    numQueued(0),
+    numWaiting(0),
+    quit(false)
+{
+    int numWorkers = std::max(0, QThread::idealThreadCount() - 1);
+    const QStringList param = owner->CommandLineParameters("--jobThreads");
+    if (!param.isEmpty())
+    {
+        bool ok = false;
+        const int count = param.first().toInt(&ok);
+        if (ok && count >= 0)
+            numWorkers = count;
+        else
+            LogWarning("JobSystem: Invalid --jobThreads " + param.first() + ", using " + QString::number(numWorkers) + " worker threads.");
+    }
+
+    for(int i = 0; i < numWorkers; ++i)
+        workers.push_back(new Worker());
+    // Start only after all the workers exist, as they steal from each other.
+    for(int i = 0; i < numWorkers; ++i)
+    {
+        workers[i]->thread = new WorkerThread(this, i);
+        workers[i]->thread->start();
+    }
+}
+
+JobSystem::~JobSystem()
+{
+    {
+        QMutexLocker lock(&sleepMutex);
+        quit = true;
+        jobQueued.wakeAll();
+    }
+    for(size_t i = 0; i < workers.size(); ++i)
+    {
+        workers[i]->thread->wait();
+        delete workers[i]->thread;
+        delete workers[i];
+    }
+    workers.clear();
+}
+
+void JobSystem::AddDependency(const JobPtr &job, const JobPtr &dependency)
+{
+    if (!job || !dependency || job == dependency)
+        return;
+    QMutexLocker lock(&dependency->dependentsMutex);
+    if (dependency->finished)
+        return;
+    job->pendingDependencies.ref();
+    dependency->dependents.push_back(job);
+}
+
+void JobSystem::Schedule(const JobPtr &job, bool continueOnMainThread)
+{
+    if (!job)
+        return;
+    job->continueOnMainThread = continueOnMainThread;
+    // Drops the count that keeps the job from being queued while its dependencies are added.
+    if (!job->pendingDependencies.deref())
+        Enqueue(job);
+}
+
+void JobSystem::Enqueue(const JobPtr &job)
+{
+    const int worker = CurrentWorker();
+    if (worker >= 0)
+    {
+        QMutexLocker lock(&workers[worker]->mutex);
+        workers[worker]->jobs.push_back(job);
+    }
+    else
+    {
+        QMutexLocker lock(&sharedMutex);
+        sharedJobs.push_back(job);
+    }
+    numQueued.ref();
+
+    QMutexLocker lock(&sleepMutex);
+    jobQueued.wakeOne();
+    if (numWaiting.fetchAndAddAcquire(0) > 0)
+        jobDone.wakeAll(); // The waiting threads help with the jobs too.
+}
+
+JobPtr JobSystem::Take(int worker)
+{
+    if (numQueued.fetchAndAddAcquire(0) <= 0)
+        return JobPtr();
+
+    JobPtr job;
+    if (worker >= 0)
+    {
+        QMutexLocker lock(&workers[worker]->mutex);
+        if (!workers[worker]->jobs.empty())
+        {
+            job = workers[worker]->jobs.back();
+            workers[worker]->jobs.pop_back();
+        }
+    }
+    if (!job)
+    {
+        QMutexLocker lock(&sharedMutex);
+        if (!sharedJobs.empty())
+        {
+            job = sharedJobs.front();
+            sharedJobs.pop_front();
+        }
+    }
+    // Steal from the other workers, starting from the next one so that the thieves spread out.
+    for(size_t i = 1; !job && i <= workers.size(); ++i)
+    {
+        Worker *victim = workers[(worker + i) % workers.size()];
+        QMutexLocker lock(&victim->mutex);
+        if (!victim->jobs.empty())
+        {
+            job = victim->jobs.front();
+            victim->jobs.pop_front();
+        }
+    }
+    if (job)
+        numQueued.deref();
+    return job;
+}
+
+void JobSystem::Execute(const JobPtr &job)
+{
+    PROFILE_THREAD(JobSystem_Job);
+    try
+    {
+        job->Run();
+    }
+    catch(const std::exception &e)
+    {
+        QMutexLocker lock(&continuationMutex);
+        errors << job->Name() + ": " + (e.what() ? e.what() : "(null)");
+    }
+    catch(...)
+    {
+        QMutexLocker lock(&continuationMutex);
+        errors << job->Name() + ": unknown exception";
+    }
+
+    std::vector<JobPtr> dependents;
+    {
+        QMutexLocker lock(&job->dependentsMutex);
+        job->finished = true;
+        dependents.swap(job->dependents);
+    }
+    for(size_t i = 0; i < dependents.size(); ++i)
+        if (!dependents[i]->pendingDependencies.deref())
+            Enqueue(dependents[i]);
+
+    if (job->continueOnMainThread)
+    {
+        QMutexLocker lock(&continuationMutex);
+        continuations.push_back(job);
+    }
+    job->done.fetchAndStoreRelease(1);
+
+    if (numWaiting.fetchAndAddAcquire(0) > 0)
+    {
+        QMutexLocker lock(&sleepMutex);
+        jobDone.wakeAll();
+    }
+}
+
+int JobSystem::CurrentWorker() const
+{
+    QThread *thread = QThread::currentThread();
+    for(size_t i = 0; i < workers.size(); ++i)
+        if (workers[i]->thread == thread)
+            return (int)i;
+    return -1;
+}
+
+void JobSystem::WorkerLoop(int worker)
+{
+    for(;;)
+    {
+        JobPtr job = Take(worker);
+        if (job)
+        {
+            Execute(job);
+            continue;
+        }
+        QMutexLocker lock(&sleepMutex);
+        if (quit)
+            return;
+        if (numQueued.fetchAndAddAcquire(0) <= 0)
+            jobQueued.wait(&sleepMutex);
+    }
+}
+
+void JobSystem::Wait(const JobPtr &job)
+{
+    if (!job)
+        return;
+    const int worker = CurrentWorker();
+    while(!job->IsDone())
+    {
+        JobPtr other = Take(worker);
+        if (other)
+        {
+            Execute(other);
+            continue;
+        }
+        // The job is running in another thread. Sleep until a job is done or queued.
+        QMutexLocker lock(&sleepMutex);
+        numWaiting.ref();
+        if (!job->IsDone() && numQueued.fetchAndAddAcquire(0) <= 0)
+            jobDone.wait(&sleepMutex, 1);
+        numWaiting.deref();
+    }
+}
+
+void JobSystem::Wait(const std::vector<JobPtr> &jobs)
+{
+    for(size_t i = 0; i < jobs.size(); ++i)
+        Wait(jobs[i]);
+}
+
+void JobSystem::ParallelFor(int begin, int end, IParallelForBody &body, int grainSize, const QString &name)
+{
+    if (end <= begin)
+        return;
+    PROFILE_THREAD(JobSystem_ParallelFor);
+
+    // A few ranges per thread, so that the threads that finish early steal from the others.
+    const int count = end - begin;
+    grainSize = std::max(grainSize, 1);
+    const int numRanges = std::max(1, std::min((count + grainSize - 1) / grainSize, (NumWorkers() + 1) * 4));
+    const int rangeSize = (count + numRanges - 1) / numRanges;
+
+    std::vector<JobPtr> jobs;
+    for(int first = begin + rangeSize; first < end; first += rangeSize)
+    {
+        jobs.push_back(MAKE_SHARED(ParallelForJob, name, body, first, std::min(first + rangeSize, end)));
+        Schedule(jobs.back());
+    }
+    // The calling thread takes the first range, then helps with the rest.
+    Execute(MAKE_SHARED(ParallelForJob, name, body, begin, std::min(begin + rangeSize, end)));
+    Wait(jobs);
+}
+
+void JobSystem::Update()
+{
+    if (workers.empty())
+    {
+        JobPtr job;
+        while((job = Take(-1)))
+            Execute(job);
+    }
+
+    std::vector<JobPtr> finished;
+    QStringList jobErrors;
+    {
+        QMutexLocker lock(&continuationMutex);
+        finished.swap(continuations);
+        jobErrors.swap(errors);
+    }
+    foreach(const QString &error, jobErrors)
+        LogError("JobSystem: job " + error);
+    if (finished.empty())
+        return;
+
+    PROFILE(JobSystem_Continuations);
+    for(size_t i = 0; i < finished.size(); ++i)
+    {
+        try
+        {
+            finished[i]->Finished();
+        }
+        catch(const std::exception &e)
+        {
+            LogError("JobSystem: continuation of job " + finished[i]->Name() + " threw an exception: " + (e.what() ? e.what() : "(null)"));
+        }
+        catch(...)
+        {
+            LogError("JobSystem: continuation of job " + finished[i]->Name() + " threw an unknown exception.");
+        }
+    }
+}
@@ -0,0 +1,167 @@
+/**
+    For conditions of distribution and use, see copyright notice in LICENSE
+
+    @file   JobSystem.h
+    @brief  Work-stealing pool of worker threads shared by the modules. */
+
+#pragma once
+
+#include "TundraCoreApi.h"
+#include "CoreTypes.h"
+
+#include <QString>
+#include <QStringList>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QAtomicInt>
+
+#include <vector>
+#include <deque>
+
+class Framework;
+class JobSystem;
+class IJob;
+
+typedef shared_ptr<IJob> JobPtr;
+
+/// A unit of work run by JobSystem in a worker thread.
+/** Subclass and implement Run. Run must not touch the scene, emit Qt signals or call the renderer: do such things in
+    Finished, which JobSystem calls in the main thread after Run if the job was scheduled with a main thread continuation.
+    A job is scheduled once. */
+class TUNDRACORE_API IJob
+{
+public:
+    /// Constructs an unscheduled job.
+    /** @param jobName Name of the job, used in error messages. */
+    explicit IJob(const QString &jobName);
+    virtual ~IJob() {}
+
+    /// Does the work of the job. Called in a worker thread, or in a thread that waits for the jobs.
+    virtual void Run() = 0;
+
+    /// Called in the main thread by JobSystem::Update after Run, if the job was scheduled with a main thread continuation.
+    virtual void Finished() {}
+
+    /// Returns whether Run has returned. The continuation may not have run yet.
+    bool IsDone() const;
+
+    /// Returns the name of the job.
+    const QString &Name() const { return name; }
+
+private:
+    friend class JobSystem;
+    Q_DISABLE_COPY(IJob)
+
+    QString name;
+    QAtomicInt pendingDependencies; ///< Unfinished dependencies, plus one until the job is scheduled.
+    QAtomicInt done;
+    bool continueOnMainThread;
+    QMutex dependentsMutex;
+    std::vector<JobPtr> dependents; ///< Jobs waiting for this one, guarded by dependentsMutex.
+    bool finished; ///< Whether the dependents are released, guarded by dependentsMutex.
+};
+
+/// The body of JobSystem::ParallelFor.
+class TUNDRACORE_API IParallelForBody
+{
+public:
+    virtual ~IParallelForBody() {}
+
+    /// Processes the items of the range [begin, end). Called concurrently for disjoint ranges.
+    virtual void Run(int begin, int end) = 0;
+};
+
+/// Work-stealing pool of worker threads shared by the modules, with job dependencies, main thread continuations and parallel-for.
+/** This class cannot be created directly, it's created by Framework, and is got with Framework::Jobs. Instead of each
+    module running a thread pool of its own, which oversubscribes the cores when several of them are busy at once, the
+    modules schedule their work here.
+
+    Each worker thread has a queue of its own. A job scheduled in a worker thread, f.ex. a dependent released by a
+    finished job, goes to the back of the queue of that worker, which takes its jobs from the back, so that the related
+    work stays on the same core. The jobs scheduled in the other threads go to a shared queue. An idle worker takes from
+    the shared queue, and then steals from the front of the queues of the other workers.
+
+    A job runs after the jobs it depends on, see AddDependency. A job scheduled with a main thread continuation has its
+    Finished called in the main thread in Update, which Framework calls each frame. Wait and ParallelFor help with the
+    queued jobs while waiting, so that they can be called in the main thread each frame without idling it.
+
+    The number of the workers is one less than QThread::idealThreadCount by default, as the main thread runs jobs too
+    while it waits. Set with --jobThreads. With no workers, the jobs are run in Wait and Update in the main thread. */
+class TUNDRACORE_API JobSystem
+{
+public:
+    ~JobSystem();
+
+    /// Makes a job run only after another one has finished. Call before scheduling the job.
+    /** Has no effect if the dependency has already finished. The dependency can be scheduled before or after. */
+    void AddDependency(const JobPtr &job, const JobPtr &dependency);
+
+    /// Schedules a job to run when its dependencies have finished. Thread-safe.
+    /** @param continueOnMainThread Whether to call Finished of the job in the main thread after it has run. */
+    void Schedule(const JobPtr &job, bool continueOnMainThread = false);
+
+    /// Returns when the job has run, running the queued jobs in the calling thread meanwhile. Thread-safe.
+    /** Do not wait for a job in its continuation, nor for a job that is not scheduled. */
+    void Wait(const JobPtr &job);
+
+    /// Returns when all the jobs have run. See Wait.
+    void Wait(const std::vector<JobPtr> &jobs);
+
+    /// Calls body.Run for ranges of [begin, end) in parallel in the worker threads and the calling thread, and returns when all are done.
+    /** @param grainSize The smallest number of items to process in one call. Thread-safe. */
+    void ParallelFor(int begin, int end, IParallelForBody &body, int grainSize = 1, const QString &name = "ParallelFor");
+
+    /// Returns the number of the worker threads.
+    int NumWorkers() const { return (int)workers.size(); }
+
+    /// Runs the main thread continuations of the finished jobs, and logs the errors of the jobs. Called by Framework each frame.
+    /** With no worker threads, runs the queued jobs first. */
+    void Update();
+
+private:
+    friend class Framework;
+    Q_DISABLE_COPY(JobSystem)
+
+    class WorkerThread;
+
+    struct Worker
+    {
+        Worker() : thread(0) {}
+        WorkerThread *thread;
+        QMutex mutex;
+        std::deque<JobPtr> jobs; ///< Guarded by mutex. The worker takes from the back, the thieves from the front.
+    };
+
+    /// Constructs the job system and starts the worker threads.
+    explicit JobSystem(Framework *owner);
+
+    /// Queues a job that has no unfinished dependencies.
+    void Enqueue(const JobPtr &job);
+
+    /// Takes a queued job for the worker, or for another thread if worker is -1. Returns null if there are none.
+    JobPtr Take(int worker);
+
+    /// Runs a job and releases its dependents.
+    void Execute(const JobPtr &job);
+
+    /// Returns the index of the worker of the calling thread, or -1.
+    int CurrentWorker() const;
+
+    /// Main loop of a worker thread.
+    void WorkerLoop(int worker);
+
+    std::vector<Worker*> workers;
+    QMutex sharedMutex;
+    std::deque<JobPtr> sharedJobs; ///< Jobs scheduled outside the workers, guarded by sharedMutex.
+    QAtomicInt numQueued; ///< Number of the queued jobs in all the queues.
+
+    QMutex sleepMutex;
+    QWaitCondition jobQueued; ///< Wakes the idle workers, with sleepMutex.
+    QWaitCondition jobDone; ///< Wakes the waiting threads, with sleepMutex.
+    QAtomicInt numWaiting; ///< Number of the threads sleeping in Wait.
+    bool quit; ///< Guarded by sleepMutex.
+
+    QMutex continuationMutex;
+    std::vector<JobPtr> continuations; ///< Finished jobs with a main thread continuation, guarded by continuationMutex.
+    QStringList errors; ///< Exceptions thrown by the jobs, guarded by continuationMutex.
+};
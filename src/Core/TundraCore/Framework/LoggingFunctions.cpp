@@ -18,24 +18,23 @@ void PrintLogMessage(u32 logChannel, const char *str)
     Framework *instance = Framework::Instance();
     ConsoleAPI *console = (instance ? instance->Console() : 0);
 
-    // On Windows, highlight errors and warnings.
-#ifdef WIN32
-    if ((logChannel & LogChannelError) != 0) SetConsoleTextAttribute(GetStdHandle(STD_OUTPUT_HANDLE), FOREGROUND_RED | FOREGROUND_INTENSITY);
-    else if ((logChannel & LogChannelWarning) != 0) SetConsoleTextAttribute(GetStdHandle(STD_OUTPUT_HANDLE), FOREGROUND_RED | FOREGROUND_GREEN | FOREGROUND_INTENSITY);
-#endif
-    // The console and stdout prints are equivalent.
+    // The console and stdout prints are equivalent. The console writes in the background, highlighting the errors and warnings on Windows.
     if (console)
-        console->Print(str);
-    else // The Console API is already dead for some reason, print directly to stdout to guarantee we don't lose any logging messags.
     {
-        #ifndef ANDROID
-            printf("%s", str);
-        #else
-            __android_log_print(ANDROID_LOG_INFO, "Tundra", "%s", str);
-        #endif
+        console->Write(logChannel, str);
+        return;
     }
 
-    // Restore the text color to normal.
+    // The Console API is already dead for some reason, print directly to stdout to guarantee we don't lose any logging messags.
+#ifdef WIN32
+    if ((logChannel & LogChannelError) != 0) SetConsoleTextAttribute(GetStdHandle(STD_OUTPUT_HANDLE), FOREGROUND_RED | FOREGROUND_INTENSITY);
+    else if ((logChannel & LogChannelWarning) != 0) SetConsoleTextAttribute(GetStdHandle(STD_OUTPUT_HANDLE), FOREGROUND_RED | FOREGROUND_GREEN | FOREGROUND_INTENSITY);
+#endif
+#ifndef ANDROID
+    printf("%s", str);
+#else
+    __android_log_print(ANDROID_LOG_INFO, "Tundra", "%s", str);
+#endif
 #ifdef WIN32
     SetConsoleTextAttribute(GetStdHandle(STD_OUTPUT_HANDLE), FOREGROUND_RED | FOREGROUND_GREEN | FOREGROUND_BLUE);
 #endif
@@ -0,0 +1,217 @@
+/**
+    For conditions of distribution and use, see copyright notice in LICENSE
+
+    @file   MetricsRegistry.cpp
+    @brief  Counters, gauges and histograms of the running instance, for scraping by a monitoring system. */
+
+#include "StableHeaders.h"
+#include "DebugOperatorNew.h"
+
+#include "MetricsRegistry.h"
+#include "Framework.h"
+#include "Profiler.h"
+#include "LoggingFunctions.h"
+
+#include <QMutexLocker>
+
+#include "MemoryLeakCheck.h"
+
+namespace
+{
+
+const char * const cTypeNames[] = { "counter", "gauge", "histogram" };
+
+QString FormatValue(double value)
+{
+    if (value != value)
+        return "NaN";
+    return QString::number(value, 'g', 15);
+}
+
+/// Escapes the help text of a metric, in which backslashes and line feeds are escaped.
+QString EscapeHelp(const QString &help)
+{
+    QString escaped = help;
+    escaped.replace('\\', "\\\\");
+    escaped.replace('\n', "\\n");
+    return escaped;
+}
+
+} // ~unnamed namespace
+
+MetricsRegistry::MetricsRegistry(Framework *owner) :
+    QObject(owner),
+    enabled(owner->HasCommandLineParameter("--metrics")),
+    lastCollectTime(0)
+{
+}
+
+MetricsRegistry::~MetricsRegistry()
+{
+}
+
+std::vector<double> MetricsRegistry::DefaultTimeBuckets()
+{
+    const double bounds[] = { 0.001, 0.0025, 0.005, 0.01, 0.0167, 0.025, 0.0333, 0.05, 0.1, 0.25, 0.5, 1.0 };
+    return std::vector<double>(bounds, bounds + sizeof(bounds) / sizeof(bounds[0]));
+}
+
+MetricsRegistry::Family *MetricsRegistry::FindFamily(const QString &name, MetricType type)
+{
+    FamilyMap::iterator iter = families.find(name);
+    if (iter == families.end())
+    {
+        iter = families.insert(std::make_pair(name, Family())).first;
+        iter->second.type = type;
+        if (type == Histogram)
+            iter->second.bounds = DefaultTimeBuckets();
+    }
+    else if (iter->second.type != type)
+    {
+        LogError(QString("MetricsRegistry: Metric %1 is a %2, not a %3.").arg(name).arg(cTypeNames[iter->second.type]).arg(cTypeNames[type]));
+        return 0;
+    }
+    return &iter->second;
+}
+
+MetricSeries *MetricsRegistry::Find(const QString &name, MetricType type, const QString &labels)
+{
+    Family *family = FindFamily(name, type);
+    if (!family)
+        return 0;
+    std::map<QString, MetricSeries>::iterator iter = family->series.find(labels);
+    if (iter == family->series.end())
+    {
+        iter = family->series.insert(std::make_pair(labels, MetricSeries())).first;
+        if (type == Histogram)
+        {
+            iter->second.buckets.resize(family->bounds.size(), 0);
+            iter->second.bounds = &family->bounds;
+        }
+    }
+    return &iter->second;
+}
+
+void MetricsRegistry::Describe(const QString &name, MetricType type, const QString &help)
+{
+    Family *family = FindFamily(name, type);
+    if (family)
+        family->help = help;
+}
+
+void MetricsRegistry::DescribeHistogram(const QString &name, const QString &help, const std::vector<double> &bounds)
+{
+    Family *family = FindFamily(name, Histogram);
+    if (!family)
+        return;
+    family->help = help;
+    family->bounds = bounds;
+    family->series.clear();
+}
+
+void MetricsRegistry::Set(const QString &name, double value, const QString &labels)
+{
+    if (!enabled)
+        return;
+    FamilyMap::const_iterator iter = families.find(name);
+    MetricSeries *series = Find(name, iter != families.end() ? iter->second.type : Gauge, labels);
+    if (series && series->bounds == 0)
+        series->Set(value);
+}
+
+void MetricsRegistry::Add(const QString &name, double delta, const QString &labels)
+{
+    if (!enabled)
+        return;
+    FamilyMap::const_iterator iter = families.find(name);
+    MetricSeries *series = Find(name, iter != families.end() ? iter->second.type : Counter, labels);
+    if (series && series->bounds == 0)
+        series->Add(delta);
+}
+
+void MetricsRegistry::Observe(const QString &name, double value, const QString &labels)
+{
+    if (!enabled)
+        return;
+    MetricSeries *series = Find(name, Histogram, labels);
+    if (series)
+        series->Observe(value);
+}
+
+void MetricsRegistry::Remove(const QString &name, const QString &labels)
+{
+    FamilyMap::iterator iter = families.find(name);
+    if (iter != families.end())
+        iter->second.series.erase(labels);
+}
+
+void MetricsRegistry::Clear(const QString &name)
+{
+    FamilyMap::iterator iter = families.find(name);
+    if (iter != families.end())
+        iter->second.series.clear();
+}
+
+QString MetricsRegistry::Label(const QString &key, const QString &value)
+{
+    QString escaped = value;
+    escaped.replace('\\', "\\\\");
+    escaped.replace('"', "\\\"");
+    escaped.replace('\n', "\\n");
+    return key + "=\"" + escaped + "\"";
+}
+
+void MetricsRegistry::Update()
+{
+    if (!enabled)
+        return;
+    const tick_t now = GetCurrentClockTime();
+    if (lastCollectTime != 0 && (double)(now - lastCollectTime) * 1e3 < cCollectIntervalMsecs * (double)GetCurrentClockFreq())
+        return;
+    lastCollectTime = now;
+
+    PROFILE(MetricsRegistry_Collect);
+    emit Collect();
+    Render();
+}
+
+void MetricsRegistry::Render()
+{
+    QString text;
+    for(FamilyMap::const_iterator iter = families.begin(); iter != families.end(); ++iter)
+    {
+        const QString &name = iter->first;
+        const Family &family = iter->second;
+        if (family.series.empty())
+            continue;
+        if (!family.help.isEmpty())
+            text += "# HELP " + name + " " + EscapeHelp(family.help) + "\n";
+        text += "# TYPE " + name + " " + cTypeNames[family.type] + "\n";
+        for(std::map<QString, MetricSeries>::const_iterator s = family.series.begin(); s != family.series.end(); ++s)
+        {
+            const QString &labels = s->first;
+            const MetricSeries &series = s->second;
+            if (family.type != Histogram)
+            {
+                text += name + (labels.isEmpty() ? QString() : "{" + labels + "}") + " " + FormatValue(series.value) + "\n";
+                continue;
+            }
+            const QString prefix = labels.isEmpty() ? QString("{") : "{" + labels + ",";
+            for(size_t i = 0; i < series.buckets.size(); ++i)
+                text += name + "_bucket" + prefix + "le=\"" + FormatValue(family.bounds[i]) + "\"} " + QString::number(series.buckets[i]) + "\n";
+            text += name + "_bucket" + prefix + "le=\"+Inf\"} " + QString::number(series.count) + "\n";
+            text += name + "_sum" + (labels.isEmpty() ? QString() : "{" + labels + "}") + " " + FormatValue(series.sum) + "\n";
+            text += name + "_count" + (labels.isEmpty() ? QString() : "{" + labels + "}") + " " + QString::number(series.count) + "\n";
+        }
+    }
+
+    QByteArray utf8 = text.toUtf8();
+    QMutexLocker lock(&mutex);
+    exposition = utf8;
+}
+
+QByteArray MetricsRegistry::Exposition() const
+{
+    QMutexLocker lock(&mutex);
+    return exposition;
+}
@@ -0,0 +1,155 @@
+/**
+    For conditions of distribution and use, see copyright notice in LICENSE
+
+    @file   MetricsRegistry.h
+    @brief  Counters, gauges and histograms of the running instance, for scraping by a monitoring system. */
+
+#pragma once
+
+#include "TundraCoreApi.h"
+#include "CoreTypes.h"
+#include "HighPerfClock.h"
+
+#include <QObject>
+#include <QString>
+#include <QByteArray>
+#include <QMutex>
+
+#include <map>
+#include <vector>
+
+class Framework;
+
+/// A series of a metric of MetricsRegistry. The pointers to the series stay valid until the series is removed, or the histogram redescribed.
+struct MetricSeries
+{
+    MetricSeries() : value(0.0), sum(0.0), count(0), bounds(0) {}
+
+    /// Adds to the value of a counter or gauge.
+    void Add(double delta) { value += delta; }
+    /// Sets the value of a gauge, or the total of a counter that is kept elsewhere.
+    void Set(double v) { value = v; }
+    /// Adds a value to the distribution of a histogram.
+    void Observe(double v)
+    {
+        for(size_t i = 0; i < buckets.size(); ++i)
+            if (v <= (*bounds)[i])
+                ++buckets[i];
+        sum += v;
+        ++count;
+    }
+
+    double value;
+    double sum; ///< Histogram only.
+    u64 count; ///< Histogram only.
+    std::vector<u64> buckets; ///< Histogram only. Cumulative count of the values up to the upper bound of each bucket.
+    const std::vector<double> *bounds; ///< Histogram only. The upper bounds of the buckets, kept by the metric.
+};
+
+/// Counters, gauges and histograms of the running instance, exposed in the Prometheus text format.
+/** This class cannot be created directly, it's created by Framework. The metrics are collected only when the instance
+    is started with --metrics. The registry then emits Collect about once a second, on which the subsystems set their
+    metrics: the Framework the frame and module update times, SyncManager the traffic of each connection, AssetAPI the
+    transfers and the asset cache hits, PhysicsWorld the step time and the active bodies, and SceneAPI the entity counts.
+    After Collect the metrics are rendered to the text format, which the WebSocketServerModule serves at
+    http://<host>:<port>/metrics for a Prometheus server to scrape. Scripts can add metrics of their own.
+
+    A metric is a family of series of the same name, one series for each set of labels. The labels are given in the
+    exposition format, f.ex. <tt>connection="3",direction="sent"</tt>. Use Label to escape the values.
+
+    Threadsafety: the metrics are set from the main thread only. Exposition is thread-safe. */
+class TUNDRACORE_API MetricsRegistry : public QObject
+{
+    Q_OBJECT
+    Q_ENUMS(MetricType)
+
+public:
+    ~MetricsRegistry();
+
+    /// Type of a metric.
+    enum MetricType
+    {
+        Counter, ///< Value that only increases, such as bytes sent. Named with a _total suffix.
+        Gauge, ///< Value that can go up and down, such as the number of entities.
+        Histogram ///< Distribution of observed values, such as frame times, in buckets.
+    };
+
+    /// Returns the series of a metric by the labels, creating the series, and the metric as undocumented, if new.
+    /** Use for the metrics that are updated often, to skip the lookups. Returns null if the metric exists with another type. */
+    MetricSeries *Find(const QString &name, MetricType type, const QString &labels = QString());
+
+    /// Documents a histogram and sets the upper bounds of its buckets, in ascending order. Clears the series of the histogram.
+    void DescribeHistogram(const QString &name, const QString &help, const std::vector<double> &bounds);
+
+    /// Returns the metrics in the Prometheus text exposition format, as rendered after the last Collect. Thread-safe.
+    QByteArray Exposition() const;
+
+    /// Emits Collect and renders the metrics after it, if due. Called by Framework each frame when enabled.
+    void Update();
+
+    /// Interval of Collect in milliseconds.
+    static const int cCollectIntervalMsecs = 1000;
+
+    /// Default bucket bounds of the histograms of durations, in seconds.
+    static std::vector<double> DefaultTimeBuckets();
+
+public slots:
+    /// Returns whether the metrics are collected, i.e. whether the instance was started with --metrics.
+    bool IsEnabled() const { return enabled; }
+
+    /// Documents a metric, creating it if new. The names of the metrics are of the form tundra_<subsystem>_<name>_<unit>.
+    void Describe(const QString &name, MetricType type, const QString &help);
+
+    /// Sets the value of a gauge series, or the total of a counter series that is kept elsewhere.
+    void Set(const QString &name, double value, const QString &labels = QString());
+
+    /// Adds to the value of a counter or a gauge series.
+    void Add(const QString &name, double delta = 1.0, const QString &labels = QString());
+
+    /// Adds a value to a histogram series.
+    void Observe(const QString &name, double value, const QString &labels = QString());
+
+    /// Removes a series of a metric, f.ex. that of a connection that has closed.
+    void Remove(const QString &name, const QString &labels);
+
+    /// Removes all the series of a metric.
+    void Clear(const QString &name);
+
+    /// Returns the label in the exposition format, with the value escaped, f.ex. Label("scene", "TundraServer") gives scene="TundraServer".
+    static QString Label(const QString &key, const QString &value);
+
+signals:
+    /// Emitted about once a second when enabled, for the subsystems to set their metrics.
+    void Collect();
+
+private:
+    Q_DISABLE_COPY(MetricsRegistry)
+    friend class Framework;
+
+    /// Constructs the registry. Framework takes ownership of this object.
+    explicit MetricsRegistry(Framework *owner);
+
+    /// A metric and its series.
+    struct Family
+    {
+        Family() : type(Gauge) {}
+        MetricType type;
+        QString help;
+        std::vector<double> bounds; ///< Upper bounds of the buckets of a histogram.
+        std::map<QString, MetricSeries> series; ///< By the labels.
+    };
+
+    typedef std::map<QString, Family> FamilyMap;
+
+    /// Returns the metric by the name, or creates it with the type. Returns null if the metric exists with another type.
+    Family *FindFamily(const QString &name, MetricType type);
+
+    /// Renders the metrics to the exposition.
+    void Render();
+
+    bool enabled;
+    tick_t lastCollectTime;
+    FamilyMap families;
+    QByteArray exposition; ///< Guarded by mutex, as the HTTP handlers of the WebSocketServerModule read it in the I/O threads.
+    mutable QMutex mutex;
+};
@@ -0,0 +1,78 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#include "StableHeaders.h"
+#include "DebugOperatorNew.h"
+
+#include "ObjectPool.h"
+
+#include <algorithm>
+
+#include "MemoryLeakCheck.h"
+
+namespace
+{
+    /// Alignment of the blocks, enough for any type of the scene objects.
+    const size_t cBlockAlignment = 16;
+}
+
+ObjectPool::ObjectPool(size_t blockSize, size_t blocksPerChunk) :
+    blockSize_(std::max(blockSize, sizeof(void *))),
+    blocksPerChunk_(std::max(blocksPerChunk, (size_t)1)),
+    numAllocated_(0),
+    freeList_(0)
+{
+    blockSize_ = (blockSize_ + cBlockAlignment - 1) & ~(cBlockAlignment - 1);
+}
+
+ObjectPool::~ObjectPool()
+{
+    for(size_t i = 0; i < chunks_.size(); ++i)
+        ::operator delete(chunks_[i]);
+}
+
+void *ObjectPool::Allocate()
+{
+    if (!freeList_)
+        AddChunk();
+    void *block = freeList_;
+    freeList_ = *static_cast<void **>(block);
+    ++numAllocated_;
+    return block;
+}
+
+void ObjectPool::Deallocate(void *block)
+{
+    if (!block)
+        return;
+    *static_cast<void **>(block) = freeList_;
+    freeList_ = block;
+    --numAllocated_;
+
+    // Release the memory of a mass teardown, but keep a chunk for the objects created next.
+    if (numAllocated_ == 0 && chunks_.size() > 1)
+    {
+        for(size_t i = 1; i < chunks_.size(); ++i)
+            ::operator delete(chunks_[i]);
+        chunks_.resize(1);
+        freeList_ = 0;
+        FreeChunkBlocks(chunks_[0]);
+    }
+}
+
+void ObjectPool::AddChunk()
+{
+    char *chunk = static_cast<char *>(::operator new(blockSize_ * blocksPerChunk_));
+    chunks_.push_back(chunk);
+    FreeChunkBlocks(chunk);
+}
+
+void ObjectPool::FreeChunkBlocks(char *chunk)
+{
+    // Link the blocks in address order, so that consecutively created objects are adjacent in memory.
+    for(size_t i = blocksPerChunk_; i > 0; --i)
+    {
+        void *block = chunk + (i - 1) * blockSize_;
+        *static_cast<void **>(block) = freeList_;
+        freeList_ = block;
+    }
+}
@@ -0,0 +1,113 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#pragma once
+
+#include "TundraCoreApi.h"
+#include "CoreTypes.h"
+
+#include <vector>
+#include <new>
+#include <cstddef>
+
+/// Allocator of fixed-size memory blocks from large chunks, for objects that are created and destroyed in masses.
+/** The freed blocks are kept in a free list and reused, so creating and destroying objects of the same type does
+    not fragment the heap. When the last block is freed, all the chunks but the first are released at once, so e.g.
+    removing all the entities of a scene also returns their memory.
+    @note Not thread-safe. The pools of the scene objects are only used from the main thread. */
+class TUNDRACORE_API ObjectPool
+{
+public:
+    /// Creates a pool of blocks of the size, allocating the blocks in chunks of the number of blocks.
+    explicit ObjectPool(size_t blockSize, size_t blocksPerChunk = 64);
+    /// Releases all the chunks. The blocks must have been freed.
+    ~ObjectPool();
+
+    /// Returns a block of the pool's block size.
+    void *Allocate();
+    /// Returns a block allocated by this pool to the pool.
+    void Deallocate(void *block);
+
+    /// Returns the size of the blocks.
+    size_t BlockSize() const { return blockSize_; }
+    /// Returns the number of blocks allocated and not yet freed.
+    size_t NumAllocated() const { return numAllocated_; }
+    /// Returns the number of blocks in the chunks of the pool.
+    size_t Capacity() const { return chunks_.size() * blocksPerChunk_; }
+
+private:
+    /// Allocates a new chunk and adds its blocks to the free list.
+    void AddChunk();
+    /// Adds the blocks of the chunk to the free list.
+    void FreeChunkBlocks(char *chunk);
+
+    size_t blockSize_;
+    size_t blocksPerChunk_;
+    size_t numAllocated_;
+    void *freeList_; ///< First free block, whose first bytes point to the next free block.
+    std::vector<char *> chunks_;
+};
+
+/// Returns the pool of the blocks for objects of type T.
+template<typename T>
+ObjectPool &PoolOf()
+{
+    static ObjectPool pool(sizeof(T));
+    return pool;
+}
+
+/// Standard allocator that allocates single objects from the pool of their type, e.g. for allocate_shared.
+/** Arrays, which allocate_shared does not use, are allocated with operator new. */
+template<typename T>
+class PoolAllocator
+{
+public:
+    typedef T value_type;
+    typedef T *pointer;
+    typedef const T *const_pointer;
+    typedef T &reference;
+    typedef const T &const_reference;
+    typedef size_t size_type;
+    typedef ptrdiff_t difference_type;
+
+    template<typename U>
+    struct rebind { typedef PoolAllocator<U> other; };
+
+    PoolAllocator() {}
+    template<typename U>
+    PoolAllocator(const PoolAllocator<U> &) {}
+
+    pointer address(reference value) const { return &value; }
+    const_pointer address(const_reference value) const { return &value; }
+
+    pointer allocate(size_type n, const void * = 0)
+    {
+        return static_cast<pointer>(n == 1 ? PoolOf<T>().Allocate() : ::operator new(n * sizeof(T)));
+    }
+
+    void deallocate(pointer p, size_type n)
+    {
+        if (n == 1)
+            PoolOf<T>().Deallocate(p);
+        else
+            ::operator delete(p);
+    }
+
+    size_type max_size() const { return size_type(-1) / sizeof(T); }
+
+    void construct(pointer p, const T &value) { new(p) T(value); }
+    void destroy(pointer p) { p->~T(); }
+
+    template<typename U>
+    bool operator ==(const PoolAllocator<U> &) const { return true; }
+    template<typename U>
+    bool operator !=(const PoolAllocator<U> &) const { return false; }
+};
+
+/** @def MAKE_POOLED_SHARED(type, ...)
+    Like MAKE_SHARED, but allocates the object and its reference counts as one block from the pool of their type
+    with allocate_shared. Where allocate_shared is not available, the same as MAKE_SHARED. */
+#if !defined(TUNDRA_NO_BOOST) || (defined(_MSC_VER) && (_MSC_VER >= 1600)) || (defined(__APPLE__) && defined(__clang__) && __clang_major__ == 4 && __clang_minor__ == 2)
+#define MAKE_POOLED_SHARED(type, ...) CORETYPES_NAMESPACE::allocate_shared<type>(PoolAllocator<type>(), __VA_ARGS__)
+#else
+#define MAKE_POOLED_SHARED(type, ...) MAKE_SHARED(type, __VA_ARGS__)
+#endif
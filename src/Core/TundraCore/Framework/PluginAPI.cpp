@@ -5,10 +5,13 @@
 #include "LoggingFunctions.h"
 #include "Framework.h"
 #include "Application.h"
+#include "HighPerfClock.h"
 
 #include <QtXml>
 #include <QDir>
 #include <QFile>
+#include <QThreadPool>
+#include <QRunnable>
 
 #include <vector>
 #include <sstream>
@@ -61,12 +64,60 @@ static std::string GetErrorString(int error)
 /// Signature for Tundra plugins
 typedef void (*TundraPluginMainSignature)(Framework *owner);
 
+/// Opens the shared library of a plugin, in a worker thread when loading the plugins in parallel.
+/** The dynamic linker is thread-safe, and the libraries the plugins depend on are loaded by whichever thread needs
+    them first, so the plugins can be opened in any order. TundraPluginMain is run later in the main thread. */
+struct PluginAPI::OpenLibraryTask : public QRunnable
+{
+    OpenLibraryTask(const QString &name_, const QString &path_) :
+        name(name_),
+        path(path_),
+        handle(0),
+        msecs(0.0)
+    {
+        setAutoDelete(false);
+    }
+
+    void run()
+    {
+        const tick_t start = GetCurrentClockTime();
+        ///\todo Unicode support!
+#ifdef WIN32
+        HMODULE module = LoadLibraryA(path.toStdString().c_str());
+        if (module == NULL)
+            error = QString("Failed to load plugin from \"%1\": %2 (Missing dependencies?)").arg(path).arg(GetErrorString(GetLastError()).c_str());
+        handle = module;
+#else
+        const char *dlerrstr;
+        dlerror();
+        handle = dlopen(path.toStdString().c_str(), RTLD_GLOBAL|RTLD_LAZY);
+        if ((dlerrstr=dlerror()) != 0)
+        {
+            error = "Failed to load plugin from file \"" + path + "\": Error " + dlerrstr + "!";
+            handle = 0;
+        }
+#endif
+        msecs = (double)(GetCurrentClockTime() - start) * 1000.0 / (double)GetCurrentClockFreq();
+    }
+
+    QString name;
+    QString path;
+    void *handle; ///< Null if the library could not be opened.
+    QString error;
+    double msecs; ///< Time it took to open the library and its dependencies.
+};
+
 PluginAPI::PluginAPI(Framework *owner_)
 :owner(owner_)
 {
 }
 
 void PluginAPI::LoadPlugin(const QString &filename)
+{
+    LoadPlugins(QStringList(filename));
+}
+
+void PluginAPI::LoadPlugins(const QStringList &filenames)
 {
 #ifdef ANDROID
     // On Android plugins are currently static
@@ -85,53 +136,74 @@ void PluginAPI::LoadPlugin(const QString &filename)
     const QString pluginSuffix = ".dylib";
 #endif
 
-    // Check if the plugin source file even exists.
-    QString path = QDir::toNativeSeparators(Application::InstallationDirectory() + "plugins/" + filename.trimmed() + pluginSuffix);
-    if (!QFile::exists(path))
+    std::vector<shared_ptr<OpenLibraryTask> > tasks;
+    foreach(const QString &filename, filenames)
     {
-        LogWarning(QString("Cannot load plugin \"%1\" as the file does not exist.").arg(path));
-        return;
+        // Check if the plugin source file even exists.
+        QString path = QDir::toNativeSeparators(Application::InstallationDirectory() + "plugins/" + filename.trimmed() + pluginSuffix);
+        if (!QFile::exists(path))
+        {
+            LogWarning(QString("Cannot load plugin \"%1\" as the file does not exist.").arg(path));
+            continue;
+        }
+        tasks.push_back(MAKE_SHARED(OpenLibraryTask, filename, path));
     }
-    LogInfo("Loading plugin " + filename);
-    owner->App()->SetSplashMessage("Loading plugin " + filename);
 
-    ///\todo Unicode support!
-#ifdef WIN32
-    HMODULE module = LoadLibraryA(path.toStdString().c_str());
-    if (module == NULL)
+    const bool parallel = tasks.size() > 1 && owner->HasCommandLineParameter("--parallelPluginLoading");
+    if (parallel)
     {
-        DWORD errorCode = GetLastError();
-        LogError(QString("Failed to load plugin from \"%1\": %2 (Missing dependencies?)").arg(path).arg(GetErrorString(errorCode).c_str()));
+        LogInfo(QString("Loading %1 plugins in parallel").arg(tasks.size()));
+        owner->App()->SetSplashMessage(QString("Loading %1 plugins").arg(tasks.size()));
+        QThreadPool pool;
+        for(size_t i = 0; i < tasks.size(); ++i)
+            pool.start(tasks[i].get());
+        pool.waitForDone();
+    }
+
+    // The plugins are started in the given order, as a plugin may use the modules of the plugins before it.
+    for(size_t i = 0; i < tasks.size(); ++i)
+    {
+        OpenLibraryTask &task = *tasks[i];
+        if (!parallel)
+        {
+            LogInfo("Loading plugin " + task.name);
+            owner->App()->SetSplashMessage("Loading plugin " + task.name);
+            task.run();
+        }
+        StartPlugin(task);
+    }
+}
+
+void PluginAPI::StartPlugin(const OpenLibraryTask &task)
+{
+    if (!task.handle)
+    {
+        LogError(task.error);
         return;
     }
-    TundraPluginMainSignature mainEntryPoint = (TundraPluginMainSignature)GetProcAddress(module, "TundraPluginMain");
+#ifdef WIN32
+    TundraPluginMainSignature mainEntryPoint = (TundraPluginMainSignature)GetProcAddress((HMODULE)task.handle, "TundraPluginMain");
     if (mainEntryPoint == NULL)
     {
         DWORD errorCode = GetLastError();
-        LogError(QString("Failed to find plugin startup function 'TundraPluginMain' from plugin file \"%1\": %2").arg(path).arg(GetErrorString(errorCode).c_str()));
+        LogError(QString("Failed to find plugin startup function 'TundraPluginMain' from plugin file \"%1\": %2").arg(task.path).arg(GetErrorString(errorCode).c_str()));
         return;
     }
 #else
     const char *dlerrstr;
     dlerror();
-    void *module = dlopen(path.toStdString().c_str(), RTLD_GLOBAL|RTLD_LAZY);
-    if ((dlerrstr=dlerror()) != 0)
-    {
-        LogError("Failed to load plugin from file \"" + path + "\": Error " + dlerrstr + "!");
-        return;
-    }
-
-    dlerror();
-    TundraPluginMainSignature mainEntryPoint = (TundraPluginMainSignature)dlsym(module, "TundraPluginMain");
+    TundraPluginMainSignature mainEntryPoint = (TundraPluginMainSignature)dlsym(task.handle, "TundraPluginMain");
     if ((dlerrstr=dlerror()) != 0)
     {
-        LogError("Failed to find plugin startup function 'TundraPluginMain' from plugin file \"" + path + "\": Error " + dlerrstr + "!");
+        LogError("Failed to find plugin startup function 'TundraPluginMain' from plugin file \"" + task.path + "\": Error " + dlerrstr + "!");
         return;
     }
 #endif
-    Plugin p = { module, filename, path };
+    Plugin p = { task.handle, task.name, task.path, task.msecs, 0.0 };
     plugins.push_back(p);
+    const tick_t start = GetCurrentClockTime();
     mainEntryPoint(owner);
+    plugins.back().mainMsecs = (double)(GetCurrentClockTime() - start) * 1000.0 / (double)GetCurrentClockFreq();
 }
 
 void PluginAPI::UnloadPlugins()
@@ -153,6 +225,13 @@ void PluginAPI::ListPlugins() const
         LogInfo(plugin.name);
 }
 
+void PluginAPI::PrintLoadTimes() const
+{
+    LogInfo(QString("%1 %2 %3").arg("Plugin", -40).arg("Open ms", 10).arg("Main ms", 10));
+    foreach(const Plugin &plugin, plugins)
+        LogInfo(QString("%1 %2 %3").arg(plugin.name.leftJustified(40, ' ', true)).arg(plugin.loadMsecs, 10, 'f', 1).arg(plugin.mainMsecs, 10, 'f', 1));
+}
+
 QString LookupRelativePath(QString path)
 {
     // If a relative path was specified, lookup from cwd first, then from application installation directory.
@@ -201,14 +280,14 @@ void PluginAPI::LoadPluginsFromXML(QString pluginConfigurationFile)
 
     QDomElement docElem = doc.documentElement();
 
+    QStringList pluginPaths;
     QDomNode n = docElem.firstChild();
     while(!n.isNull())
     {
         QDomElement e = n.toElement(); // try to convert the node to an element.
         if (!e.isNull() && e.tagName() == "plugin" && e.hasAttribute("path"))
         {
-            QString pluginPath = e.attribute("path");
-            LoadPlugin(pluginPath);
+            pluginPaths << e.attribute("path");
             if (showDeprecationWarning)
             {
                 LogWarning("PluginAPI::LoadPluginsFromXML: In file " + pluginConfigurationFile + ", using XML tag <plugin path=\"PluginNameHere\"/> will be deprecated. Consider replacing it with --plugin command line argument instead");
@@ -217,6 +296,7 @@ void PluginAPI::LoadPluginsFromXML(QString pluginConfigurationFile)
         }
         n = n.nextSibling();
     }
+    LoadPlugins(pluginPaths);
 }
 
 void PluginAPI::LoadPluginsFromCommandLine()
@@ -225,15 +305,14 @@ void PluginAPI::LoadPluginsFromCommandLine()
         return;
 
     QStringList plugins = owner->CommandLineParameters("--plugin");
+    QStringList pluginNames;
     foreach(QString plugin, plugins)
     {
         plugin = plugin.trimmed();
         if (!plugin.contains(";"))
-            LoadPlugin(plugin);
+            pluginNames << plugin;
         else
-        {
-            foreach(const QString &pluginIter, plugin.simplified().replace(" ", "").split(";", QString::SkipEmptyParts))
-                LoadPlugin(pluginIter);
-        }
+            pluginNames << plugin.simplified().replace(" ", "").split(";", QString::SkipEmptyParts);
     }
+    LoadPlugins(pluginNames);
 }
@@ -5,6 +5,7 @@
 #include "TundraCoreApi.h"
 
 #include <QString>
+#include <QStringList>
 #include <QObject>
 
 class Framework;
@@ -23,6 +24,12 @@ public:
     /// Loads and executes the given shared library plugin.
     void LoadPlugin(const QString &filename);
 
+    /// Loads and executes the given shared library plugins in order.
+    /** With --parallelPluginLoading the shared libraries are opened concurrently in worker threads first, which overlaps
+        the disk reads, the relocations and the static initializers of the libraries. TundraPluginMain of each plugin
+        is run in the main thread in the given order in any case, as the plugins may depend on the ones before them. */
+    void LoadPlugins(const QStringList &filenames);
+
     /// Parses the specified .xml file and loads and executes all plugins specified in that file.
     void LoadPluginsFromXML(QString pluginListFilename);
 
@@ -35,12 +42,23 @@ public slots:
     /// Prints the list of loaded plugins to the console.
     void ListPlugins() const;
 
+    /// Prints the time it took to open the shared library of each plugin, and to run its TundraPluginMain, to the console.
+    /** The time of the main includes the Load of the modules the plugin registers. See also Framework::PrintStartupTimes. */
+    void PrintLoadTimes() const;
+
 private:
+    struct OpenLibraryTask;
+
+    /// Runs TundraPluginMain of a plugin of which the shared library is opened.
+    void StartPlugin(const OpenLibraryTask &task);
+
     struct Plugin
     {
         void *handle;
         QString name;
         QString filename;
+        double loadMsecs; ///< Time it took to open the shared library.
+        double mainMsecs; ///< Time it took to run TundraPluginMain.
     };
     std::list<Plugin> plugins;
 
@@ -6,6 +6,7 @@
 #include "CoreDefines.h"
 #include "CoreStringUtils.h"
 #include "HighPerfClock.h"
+#include "LoggingFunctions.h"
 #include "MemoryLeakCheck.h"
 #include "Math/MathFunc.h"
 
@@ -69,7 +70,9 @@ void Profiler::StartBlock(const std::string &name)
     {
         current_node_ = node;
 
-        checked_static_cast<ProfilerNode*>(node)->block_.Start();
+        ProfilerNode *timings = checked_static_cast<ProfilerNode*>(node);
+        timings->allocations_start_ = AllocationTracker::MainThreadCounts();
+        timings->block_.Start();
     }
 #endif
 }
@@ -86,23 +89,19 @@ void Profiler::EndBlock(const std::string &name)
     UNREFERENCED_PARAM(name)
     ProfilerNode* node = checked_static_cast<ProfilerNode*>(treeNode);
     node->block_.Stop();
-    node->num_called_total_++;
-    node->num_called_current_++;
-
-    double elapsed = node->block_.ElapsedTimeSeconds();
-
-    node->elapsed_current_ += elapsed;
-    node->elapsed_min_current_ = (EqualAbs(node->elapsed_min_current_, 0.0) ? elapsed : (elapsed < node->elapsed_min_current_ ? elapsed : node->elapsed_min_current_));
-    node->elapsed_max_current_ = elapsed > node->elapsed_max_current_ ? elapsed : node->elapsed_max_current_;
-    node->total_ += elapsed;
-
-    node->num_called_custom_++;
-    node->total_custom_ += elapsed;
-    node->custom_elapsed_min_ = std::min(node->custom_elapsed_min_, elapsed);
-    node->custom_elapsed_max_ = std::max(node->custom_elapsed_max_, elapsed);
+    Accumulate(node, node->block_.ElapsedTimeSeconds());
 
     assert (node->recursion_ >= 0);
 
+    if (node->recursion_ == 0)
+    {
+        const AllocationCounts allocations = AllocationTracker::MainThreadCounts() - node->allocations_start_;
+        node->num_allocations_custom_ += allocations.allocations;
+        node->allocated_bytes_custom_ += allocations.bytes;
+        if (trace_.IsRecording())
+            trace_.AddBlock(node, 0, node->block_.StartTime(), node->block_.EndTime());
+    }
+
     // need to handle recursion
     if (node->recursion_ > 0)
         --node->recursion_;
@@ -111,6 +110,50 @@ void Profiler::EndBlock(const std::string &name)
 #endif
 }
 
+void Profiler::AddTiming(const std::string &group, const std::string &name, double elapsedSeconds, unsigned int numCalls)
+{
+#ifdef PROFILING
+    ProfilerNodeTree *groupNode = Child(&root_, group, false);
+    ProfilerNode *node = dynamic_cast<ProfilerNode*>(Child(groupNode, name, true));
+    if (node && numCalls > 0)
+        Accumulate(node, elapsedSeconds, numCalls);
+#else
+    UNREFERENCED_PARAM(group)
+    UNREFERENCED_PARAM(name)
+    UNREFERENCED_PARAM(elapsedSeconds)
+    UNREFERENCED_PARAM(numCalls)
+#endif
+}
+
+ProfilerNodeTree *Profiler::Child(ProfilerNodeTree *parent, const std::string &name, bool timings)
+{
+    ProfilerNodeTree *node = parent->GetChild(name);
+    if (!node)
+    {
+        node = timings ? new ProfilerNode(name) : new ProfilerNodeTree(name);
+        parent->AddChild(shared_ptr<ProfilerNodeTree>(node));
+    }
+    return node;
+}
+
+void Profiler::Accumulate(ProfilerNode *node, double elapsed, unsigned int numCalls)
+{
+    const double perCall = elapsed / numCalls;
+
+    node->num_called_total_ += numCalls;
+    node->num_called_current_ += numCalls;
+
+    node->elapsed_current_ += elapsed;
+    node->elapsed_min_current_ = (EqualAbs(node->elapsed_min_current_, 0.0) ? perCall : (perCall < node->elapsed_min_current_ ? perCall : node->elapsed_min_current_));
+    node->elapsed_max_current_ = perCall > node->elapsed_max_current_ ? perCall : node->elapsed_max_current_;
+    node->total_ += elapsed;
+
+    node->num_called_custom_ += numCalls;
+    node->total_custom_ += elapsed;
+    node->custom_elapsed_min_ = std::min(node->custom_elapsed_min_, perCall);
+    node->custom_elapsed_max_ = std::max(node->custom_elapsed_max_, perCall);
+}
+
 void ProfilerQObj::BeginBlock(const QString &name)
 {
 #ifdef PROFILING
@@ -136,6 +179,34 @@ void ProfilerQObj::EndBlock()
 #endif
 }
 
+void ProfilerQObj::CaptureTrace(int numFrames, const QString &fileName)
+{
+#ifdef PROFILING
+    Framework *fw = Framework::Instance();
+    Profiler *p = fw ? fw->GetProfiler() : 0;
+    if (p)
+        p->Trace().Capture(numFrames, fileName);
+#else
+    UNREFERENCED_PARAM(numFrames)
+    UNREFERENCED_PARAM(fileName)
+    LogWarning("ProfilerQObj::CaptureTrace: Profiling is not enabled in this build.");
+#endif
+}
+
+void ProfilerQObj::CaptureHitches(float thresholdMsecs, const QString &fileName)
+{
+#ifdef PROFILING
+    Framework *fw = Framework::Instance();
+    Profiler *p = fw ? fw->GetProfiler() : 0;
+    if (p)
+        p->Trace().SetHitchCapture(thresholdMsecs, fileName);
+#else
+    UNREFERENCED_PARAM(thresholdMsecs)
+    UNREFERENCED_PARAM(fileName)
+    LogWarning("ProfilerQObj::CaptureHitches: Profiling is not enabled in this build.");
+#endif
+}
+
 ProfilerNodeTree *FindBlockByName(ProfilerNodeTree *parent, const char *name)
 {
     if (!parent)
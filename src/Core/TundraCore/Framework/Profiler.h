@@ -7,6 +7,9 @@
 #include "TundraCoreApi.h"
 #include "Framework.h"
 #include "HighPerfClock.h"
+#include "ThreadProfiler.h"
+#include "ProfilerTrace.h"
+#include "AllocationTracker.h"
 
 // Allows short-timed block tracing
 #define TRACESTART(x) kNet::PolledTimer polledTimer_##x;
@@ -25,6 +28,11 @@
 /** Use when you wish to end a profiling block before it goes out of scope. */
 #define ELIFORP(x) x ## __profiler__.Destruct();
 
+/// Records an event to the trace of the profiler while it is recording, see ProfilerTrace. Main thread only.
+/** @param category Category of the event, a string literal, f.ex. "asset".
+    @param name Name of the event as a QString. Not evaluated unless the trace is recording. */
+#define PROFILE_EVENT(category, name) { Profiler *profiler__ = ProfilerSection::GetProfiler(); if (profiler__->Trace().IsRecording()) profiler__->Trace().AddInstant(category, name); }
+
 /// Resets profiling data per frame and prepares the next frame.
 /// \todo Currently this is not called at any point in the code, as DebugStatsModule implements its own profiler frame counting via the custom 
 /// fields in the profiler nodes.
@@ -37,6 +45,7 @@
 #define LOGTIMEDBLOCK(name)
 #define PROFILE(x)
 #define ELIFORP(x)
+#define PROFILE_EVENT(category, name)
 #define RESETPROFILER
 #endif
 
@@ -63,6 +72,12 @@ public:
         end_time_ = GetCurrentClockTime();
     }
 
+    /// Returns the clock time of the last Start().
+    s64 StartTime() const { return start_time_; }
+
+    /// Returns the clock time of the last Stop().
+    s64 EndTime() const { return end_time_; }
+
     /// Returns elapsed time between start and stop in seconds
     double ElapsedTimeSeconds()
     {
@@ -195,7 +210,9 @@ public:
         num_called_custom_(0),
         total_custom_(0),
         custom_elapsed_min_(0),
-        custom_elapsed_max_(0)
+        custom_elapsed_max_(0),
+        num_allocations_custom_(0),
+        allocated_bytes_custom_(0)
         {
         }
 
@@ -246,6 +263,11 @@ public:
     mutable double custom_elapsed_min_;
     mutable double custom_elapsed_max_;
 
+    // Heap allocations of the main thread in this block, including those of the child blocks, accumulated like the
+    // custom timings. Zero unless AllocationTracker is enabled.
+    mutable u64 num_allocations_custom_;
+    mutable u64 allocated_bytes_custom_;
+
     float TotalCustomSpentInChildren() const;
 
 private:
@@ -256,6 +278,9 @@ private:
     double elapsed_min_current_;
     double elapsed_max_current_;
 
+    /// Allocation counts of the main thread when the outermost call of the block started.
+    AllocationCounts allocations_start_;
+
     ProfilerBlock block_;
 };
 
@@ -273,13 +298,23 @@ public slots:
     /// Ends profiling block.
     /** @see BeginBlock() */
     void EndBlock();
+
+    /// Saves the profiling blocks of the next frames as a Chrome trace, which opens in chrome://tracing and the Perfetto UI.
+    /** @param numFrames Number of the frames to capture.
+        @param fileName Name of the file, profiler_trace.json by default. */
+    void CaptureTrace(int numFrames, const QString &fileName = "profiler_trace.json");
+
+    /// Saves the profiling blocks of the last frames as a Chrome trace whenever a frame takes longer than the threshold.
+    /** @param thresholdMsecs The frame time in milliseconds, 0 to stop.
+        @param fileName Base name of the files, to which the time of the hitch is appended. */
+    void CaptureHitches(float thresholdMsecs, const QString &fileName = "profiler_hitch.json");
 };
 
 /// Profiler can be used to measure execution time of a block of code.
 /** Do not use this class directly for profiling, use instead PROFILE
     and ELIFORP macros.
 
-    Threadsafety: Can *only* be used from the main thread.
+    Threadsafety: Can *only* be used from the main thread. Use PROFILE_THREAD in the other threads, see ThreadProfiler.
 
  */
 class TUNDRACORE_API Profiler
@@ -305,6 +340,17 @@ public:
         Re-entrant. */
     void EndBlock(const std::string &name);
 
+    /// Adds a timing that was measured elsewhere, e.g. on the GPU, to a block of a group under the root node.
+    /** The group node carries no timings of its own, so the added blocks do not count towards the time of the CPU blocks.
+        @param group Name of the group node, created under the root node when first used.
+        @param name Name of the block in the group.
+        @param elapsedSeconds The measured time. It is accumulated like a call of a block of the CPU profiler.
+        @param numCalls Number of calls the time was measured over, for the timings that are summed up before adding. */
+    void AddTiming(const std::string &group, const std::string &name, double elapsedSeconds, unsigned int numCalls = 1);
+
+    /// Returns the recorder of the timeline of the blocks.
+    ProfilerTrace &Trace() { return trace_; }
+
     /// Reset profiling data for the current frame. Don't call directly, use RESETPROFILER macro instead.
     void ResetValues();
 
@@ -329,13 +375,24 @@ public:
     /// Only used internally, *NOT* for public use.
     ProfilerNodeTree *CurrentNode() { return current_node_; }
 private:
+    /// Accumulates calls of the given total duration to the statistics of the node.
+    /** The minimum and maximum of several calls are accumulated as their average. */
+    void Accumulate(ProfilerNode *node, double elapsed, unsigned int numCalls = 1);
+
+    /// Returns the child node of the parent with the name, creating it if not found.
+    /** @param timings Whether a created node is a ProfilerNode with timings, or a plain group node. */
+    ProfilerNodeTree *Child(ProfilerNodeTree *parent, const std::string &name, bool timings);
+
     /// The single global root node object.
     ProfilerNodeTree root_;
 
     /// Points to the current topmost profile block in the stack.
     ProfilerNodeTree *current_node_;
 
+    ProfilerTrace trace_;
+
     friend class ProfilerQObj;
+    friend class ThreadProfiler;
 };
 
 /// Used by PROFILE - macro to automatically stop profiling clock when going out of scope
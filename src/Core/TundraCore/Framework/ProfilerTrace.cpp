@@ -0,0 +1,246 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#include "StableHeaders.h"
+#include "DebugOperatorNew.h"
+
+#include "ProfilerTrace.h"
+#include "Profiler.h"
+#include "LoggingFunctions.h"
+
+#include <QFile>
+#include <QTextStream>
+#include <QDateTime>
+
+#include <algorithm>
+
+#include "MemoryLeakCheck.h"
+
+namespace
+{
+
+const char * const cFrameName = "Frame";
+
+QString EscapeJson(const QString &str)
+{
+    QString escaped;
+    escaped.reserve(str.length());
+    for(int i = 0; i < str.length(); ++i)
+    {
+        const QChar c = str[i];
+        if (c == '"' || c == '\\')
+            escaped += QChar('\\') + c;
+        else if (c.unicode() < 0x20)
+            escaped += QString("\\u%1").arg((int)c.unicode(), 4, 16, QChar('0'));
+        else
+            escaped += c;
+    }
+    return escaped;
+}
+
+} // ~unnamed namespace
+
+ProfilerTrace::ProfilerTrace() :
+    frame_(0),
+    frameStart_(0),
+    captureFramesLeft_(0),
+    full_(false),
+    hitchThreshold_(0),
+    lastHitchFrame_(0)
+{
+    // The frames are recorded as blocks of a name of their own, on the track of the main thread.
+    names_.push_back(cFrameName);
+    threadNames_[0] = "Main thread";
+}
+
+void ProfilerTrace::Capture(int numFrames, const QString &fileName)
+{
+    if (numFrames <= 0 || fileName.isEmpty())
+    {
+        LogError("ProfilerTrace::Capture: Expected a positive number of frames and a file name.");
+        return;
+    }
+    // The frames kept for the hitch capture go to the capture as well.
+    if (hitchThreshold_ == 0)
+        Clear();
+    captureFramesLeft_ = numFrames;
+    captureFile_ = fileName;
+    full_ = false;
+    LogInfo(QString("Capturing the profiling blocks of %1 frames to %2.").arg(numFrames).arg(fileName));
+}
+
+void ProfilerTrace::SetHitchCapture(float thresholdMsecs, const QString &fileName)
+{
+    hitchThreshold_ = thresholdMsecs > 0.f ? (tick_t)(thresholdMsecs * 1e-3 * (double)GetCurrentClockFreq()) : 0;
+    hitchFile_ = fileName;
+    lastHitchFrame_ = frame_;
+    if (hitchThreshold_ > 0)
+        LogInfo(QString("Saving the profiling blocks of the last %1 frames when a frame takes longer than %2 ms.").arg(cHitchHistoryFrames).arg(thresholdMsecs));
+    else if (captureFramesLeft_ == 0)
+        Clear();
+}
+
+void ProfilerTrace::AddBlock(const ProfilerNodeTree *node, u32 thread, tick_t start, tick_t end)
+{
+    if (full_)
+        return;
+    if (blocks_.size() >= cMaxBlocks)
+    {
+        // The hitch capture drops the oldest frames instead, so only a capture fills up.
+        LogWarning(QString("ProfilerTrace: More than %1 profiling blocks recorded, the rest of the frames of the capture are left out.").arg(cMaxBlocks));
+        full_ = true;
+        return;
+    }
+    Block block;
+    block.start = start;
+    block.end = end;
+    block.name = NameIndex(node);
+    block.thread = thread;
+    block.frame = frame_;
+    blocks_.push_back(block);
+}
+
+void ProfilerTrace::AddInstant(const char *category, const QString &name)
+{
+    if (full_)
+        return;
+    Instant instant;
+    instant.time = GetCurrentClockTime();
+    instant.category = category;
+    instant.name = name;
+    instant.frame = frame_;
+    instants_.push_back(instant);
+}
+
+void ProfilerTrace::SetThreadName(u32 thread, const std::string &name)
+{
+    threadNames_[thread] = name;
+}
+
+void ProfilerTrace::EndFrame()
+{
+    const tick_t now = GetCurrentClockTime();
+    const tick_t start = frameStart_;
+    frameStart_ = now;
+    if (!IsRecording() || start == 0)
+        return;
+
+    // The frames span from the end of the previous one, so that the time spent in the event loop between the frames counts.
+    Block frame;
+    frame.start = start;
+    frame.end = now;
+    frame.name = 0;
+    frame.thread = 0;
+    frame.frame = frame_;
+    blocks_.push_back(frame);
+    ++frame_;
+
+    if (captureFramesLeft_ > 0)
+    {
+        if (--captureFramesLeft_ == 0)
+        {
+            if (Save(captureFile_))
+                LogInfo("Saved the profiler capture to " + captureFile_ + ".");
+            Clear();
+        }
+        return;
+    }
+
+    if (hitchThreshold_ > 0)
+    {
+        if (now - start > hitchThreshold_ && frame_ - lastHitchFrame_ > cHitchHistoryFrames / 4)
+        {
+            QString fileName = hitchFile_;
+            const QString time = QDateTime::currentDateTime().toString("yyyyMMdd-hhmmss-zzz");
+            if (fileName.endsWith(".json", Qt::CaseInsensitive))
+                fileName.insert(fileName.length() - 5, "-" + time);
+            else
+                fileName += "-" + time + ".json";
+            const double msecs = (double)(now - start) * 1e3 / (double)GetCurrentClockFreq();
+            if (Save(fileName))
+                LogInfo(QString("A frame took %1 ms, saved the last frames to %2.").arg(msecs, 0, 'f', 1).arg(fileName));
+            lastHitchFrame_ = frame_;
+            Clear();
+        }
+        else
+            Prune();
+    }
+}
+
+bool ProfilerTrace::Save(const QString &fileName) const
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Text))
+    {
+        LogError("ProfilerTrace::Save: Could not open " + fileName + " for writing.");
+        return false;
+    }
+
+    tick_t base = 0;
+    if (!blocks_.empty() || !instants_.empty())
+    {
+        base = blocks_.empty() ? instants_.front().time : blocks_.front().start;
+        for(size_t i = 0; i < blocks_.size(); ++i)
+            base = std::min(base, blocks_[i].start);
+        for(size_t i = 0; i < instants_.size(); ++i)
+            base = std::min(base, instants_[i].time);
+    }
+    const double usecsPerTick = 1e6 / (double)GetCurrentClockFreq();
+
+    QTextStream out(&file);
+    out << "{\"traceEvents\":[";
+    bool first = true;
+    for(std::map<u32, std::string>::const_iterator iter = threadNames_.begin(); iter != threadNames_.end(); ++iter)
+    {
+        out << (first ? "" : ",") << "{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":" << iter->first
+            << ",\"args\":{\"name\":\"" << EscapeJson(QString::fromStdString(iter->second)) << "\"}}";
+        first = false;
+    }
+    std::vector<QString> names;
+    names.reserve(names_.size());
+    for(size_t i = 0; i < names_.size(); ++i)
+        names.push_back(EscapeJson(QString::fromStdString(names_[i])));
+    for(size_t i = 0; i < blocks_.size(); ++i)
+    {
+        const Block &b = blocks_[i];
+        out << ",{\"ph\":\"X\",\"cat\":\"" << (b.name == 0 ? "frame" : "profiler") << "\",\"name\":\"" << names[b.name]
+            << "\",\"pid\":1,\"tid\":" << b.thread << ",\"ts\":" << QString::number((b.start - base) * usecsPerTick, 'f', 3)
+            << ",\"dur\":" << QString::number((b.end - b.start) * usecsPerTick, 'f', 3) << "}";
+    }
+    for(size_t i = 0; i < instants_.size(); ++i)
+    {
+        const Instant &e = instants_[i];
+        out << ",{\"ph\":\"i\",\"s\":\"t\",\"cat\":\"" << e.category << "\",\"name\":\"" << EscapeJson(e.name)
+            << "\",\"pid\":1,\"tid\":0,\"ts\":" << QString::number((e.time - base) * usecsPerTick, 'f', 3) << "}";
+    }
+    out << "],\"displayTimeUnit\":\"ms\"}\n";
+    return true;
+}
+
+u32 ProfilerTrace::NameIndex(const ProfilerNodeTree *node)
+{
+    std::map<const ProfilerNodeTree*, u32>::const_iterator iter = nameIndices_.find(node);
+    if (iter != nameIndices_.end())
+        return iter->second;
+    const u32 index = (u32)names_.size();
+    names_.push_back(node->Name());
+    nameIndices_[node] = index;
+    return index;
+}
+
+void ProfilerTrace::Clear()
+{
+    blocks_.clear();
+    instants_.clear();
+    full_ = false;
+}
+
+void ProfilerTrace::Prune()
+{
+    if (frame_ <= cHitchHistoryFrames)
+        return;
+    const u32 oldest = frame_ - cHitchHistoryFrames;
+    while(!blocks_.empty() && blocks_.front().frame < oldest)
+        blocks_.pop_front();
+    while(!instants_.empty() && instants_.front().frame < oldest)
+        instants_.pop_front();
+}
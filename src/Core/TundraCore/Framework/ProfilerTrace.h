@@ -0,0 +1,110 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#pragma once
+
+#include "TundraCoreApi.h"
+#include "CoreTypes.h"
+#include "HighPerfClock.h"
+
+#include <QString>
+
+#include <deque>
+#include <map>
+#include <vector>
+#include <string>
+
+class ProfilerNodeTree;
+
+/// Records the timeline of the profiling blocks of a number of frames and saves it as a Chrome trace.
+/** Owned by the Profiler, which feeds it the PROFILE blocks of the main thread as they end, and ThreadProfiler the
+    PROFILE_THREAD blocks of the other threads as they are aggregated. The blocks are saved as complete ("X") events of
+    the Chrome Trace Event format, one track per thread, with the frames as blocks of the main thread and the asset and
+    network events as instant events. The files open in chrome://tracing and in the Perfetto UI.
+
+    There are two ways to record, which can be on at the same time:
+    - Capture records the given number of frames from the next one on, saves them and stops.
+    - Hitch capture keeps the frames of the last cHitchHistoryFrames frames, and saves them when a frame takes longer than
+      the threshold, to a file of its own, so that the frames that lead to the hitch can be looked at afterwards.
+
+    Threadsafety: the main thread only. */
+class TUNDRACORE_API ProfilerTrace
+{
+public:
+    ProfilerTrace();
+
+    /// Records the given number of frames, and saves them to the file after the last of them. Restarts a capture in progress.
+    void Capture(int numFrames, const QString &fileName);
+
+    /// Saves the last frames whenever a frame takes longer than the threshold. Pass 0 to stop.
+    /** @param fileName Base name of the files. The time of the hitch is appended to it, before the .json suffix. */
+    void SetHitchCapture(float thresholdMsecs, const QString &fileName);
+
+    /// Returns whether the blocks are being recorded, i.e. whether a capture or hitch capture is on.
+    bool IsRecording() const { return captureFramesLeft_ > 0 || hitchThreshold_ > 0; }
+
+    /// Records a block of a profiler node on a thread. The caller checks IsRecording first.
+    /** @param thread 0 for the main thread, the thread index of ThreadProfiler for the others. */
+    void AddBlock(const ProfilerNodeTree *node, u32 thread, tick_t start, tick_t end);
+
+    /// Records an event at the current time on the main thread, such as an asset load or a network message.
+    void AddInstant(const char *category, const QString &name);
+
+    /// Sets the name of the track of a thread.
+    void SetThreadName(u32 thread, const std::string &name);
+
+    /// Ends the frame. Called by the Framework at the end of each frame.
+    void EndFrame();
+
+    /// Saves the recorded frames as a Chrome trace. Returns false if the file could not be written.
+    bool Save(const QString &fileName) const;
+
+    /// Number of the frames kept for the hitch capture.
+    static const u32 cHitchHistoryFrames = 120;
+
+    /// Maximum number of the recorded blocks. A capture stops recording blocks when it has this many, to bound the memory use.
+    static const size_t cMaxBlocks = 1 << 20;
+
+private:
+    struct Block
+    {
+        tick_t start;
+        tick_t end;
+        u32 name; ///< Index to names_.
+        u32 thread;
+        u32 frame;
+    };
+
+    struct Instant
+    {
+        tick_t time;
+        const char *category;
+        QString name;
+        u32 frame;
+    };
+
+    /// Returns the index of the name of the node in names_, copying the name when the node is first seen.
+    u32 NameIndex(const ProfilerNodeTree *node);
+
+    /// Removes all the recorded frames.
+    void Clear();
+
+    /// Removes the frames before the hitch history.
+    void Prune();
+
+    std::deque<Block> blocks_;
+    std::deque<Instant> instants_;
+    std::vector<std::string> names_;
+    std::map<const ProfilerNodeTree*, u32> nameIndices_;
+    std::map<u32, std::string> threadNames_;
+
+    u32 frame_; ///< Number of the current frame.
+    tick_t frameStart_; ///< Clock time the current frame started, that is the previous one ended, or 0 before the first frame.
+
+    int captureFramesLeft_;
+    QString captureFile_;
+    bool full_; ///< Whether the blocks of the capture were cut at cMaxBlocks.
+
+    tick_t hitchThreshold_; ///< In clock ticks, 0 if the hitch capture is off.
+    QString hitchFile_;
+    u32 lastHitchFrame_; ///< The frame that was last saved by the hitch capture, to not save the same frames twice.
+};
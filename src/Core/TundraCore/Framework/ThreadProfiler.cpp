@@ -0,0 +1,229 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#include "StableHeaders.h"
+#include "DebugOperatorNew.h"
+
+#include "ThreadProfiler.h"
+#include "Profiler.h"
+#include "HighPerfClock.h"
+
+#include <QThread>
+#include <QThreadStorage>
+#include <QAtomicInt>
+#include <QMutex>
+#include <QMutexLocker>
+
+#include <map>
+#include <vector>
+#include <utility>
+
+#include "MemoryLeakCheck.h"
+
+namespace
+{
+
+struct Event
+{
+    tick_t time;
+    u32 scope;
+    u32 begin; ///< 1 for the beginning of a block, 0 for its end.
+};
+
+/// Events of a thread. Only the owning thread writes the events, and only the main thread reads them.
+struct ThreadBuffer
+{
+    ThreadBuffer() : events(ThreadProfiler::cBufferSize), openDepth(0), skipDepth(0), index(0) {}
+
+    std::vector<Event> events;
+    QAtomicInt writeIndex; ///< Number of events written, stored by the owning thread.
+    QAtomicInt readIndex; ///< Number of events read, stored by the main thread.
+    QAtomicInt retired; ///< Set when the owning thread has exited.
+
+    // The owning thread only.
+    u32 openDepth; ///< Number of the recorded blocks that have not ended.
+    u32 skipDepth; ///< Number of the open blocks that were dropped, as the buffer was full.
+
+    std::string name; ///< Guarded by the mutex of the registry.
+    u32 index; ///< Index of the thread, from 1 on, as the main thread is 0 in the trace of the profiler.
+
+    /// The open blocks of the thread while aggregating. The main thread only.
+    struct OpenBlock
+    {
+        ProfilerNodeTree *node;
+        tick_t start;
+        bool accumulate; ///< False if the block recurses into itself, or its name is taken by a group node.
+    };
+    std::vector<OpenBlock> stack;
+};
+
+struct Registry
+{
+    Registry() : nextThreadIndex(1) {}
+
+    QMutex mutex;
+    std::map<std::string, u32> ids;
+    std::vector<std::string> names;
+    std::vector<ThreadBuffer*> buffers;
+    int nextThreadIndex;
+};
+
+/// Never deleted, as the threads may exit after the static destructors have run.
+Registry *const registry = new Registry;
+
+/// Retires the buffer of the thread when the thread exits.
+struct BufferHolder
+{
+    explicit BufferHolder(ThreadBuffer *buffer_) : buffer(buffer_) {}
+    ~BufferHolder() { buffer->retired.fetchAndStoreRelease(1); }
+
+    ThreadBuffer *buffer;
+};
+
+QThreadStorage<BufferHolder*> threadBuffers;
+
+ThreadBuffer *CurrentBuffer()
+{
+    if (threadBuffers.hasLocalData())
+        return threadBuffers.localData()->buffer;
+
+    ThreadBuffer *buffer = new ThreadBuffer;
+    QThread *thread = QThread::currentThread();
+    {
+        QMutexLocker lock(&registry->mutex);
+        buffer->name = (thread && !thread->objectName().isEmpty()) ? thread->objectName().toStdString() :
+            "Thread " + QString::number(registry->nextThreadIndex).toStdString();
+        buffer->index = (u32)registry->nextThreadIndex++;
+        registry->buffers.push_back(buffer);
+    }
+    threadBuffers.setLocalData(new BufferHolder(buffer));
+    return buffer;
+}
+
+inline void Push(ThreadBuffer *buffer, u32 write, u32 scope, u32 begin)
+{
+    Event &event = buffer->events[write & (ThreadProfiler::cBufferSize - 1)];
+    event.time = GetCurrentClockTime();
+    event.scope = scope;
+    event.begin = begin;
+    buffer->writeIndex.fetchAndStoreRelease((int)(write + 1));
+}
+
+} // ~unnamed namespace
+
+u32 ThreadProfiler::InternScope(const char *name)
+{
+    QMutexLocker lock(&registry->mutex);
+    std::map<std::string, u32>::const_iterator iter = registry->ids.find(name);
+    if (iter != registry->ids.end())
+        return iter->second;
+    const u32 id = (u32)registry->names.size();
+    registry->names.push_back(name);
+    registry->ids[name] = id;
+    return id;
+}
+
+void ThreadProfiler::Begin(u32 scope)
+{
+    ThreadBuffer *buffer = CurrentBuffer();
+    if (buffer->skipDepth > 0)
+    {
+        ++buffer->skipDepth;
+        return;
+    }
+    const u32 write = (u32)(int)buffer->writeIndex;
+    const u32 read = (u32)buffer->readIndex.fetchAndAddAcquire(0);
+    // Keep room for the ends of the open blocks and of this one.
+    if (write - read + buffer->openDepth + 2 > cBufferSize)
+    {
+        buffer->skipDepth = 1;
+        return;
+    }
+    Push(buffer, write, scope, 1);
+    ++buffer->openDepth;
+}
+
+void ThreadProfiler::End(u32 scope)
+{
+    ThreadBuffer *buffer = CurrentBuffer();
+    if (buffer->skipDepth > 0)
+    {
+        --buffer->skipDepth;
+        return;
+    }
+    if (buffer->openDepth == 0)
+        return;
+    Push(buffer, (u32)(int)buffer->writeIndex, scope, 0);
+    --buffer->openDepth;
+}
+
+void ThreadProfiler::SetThreadName(const std::string &name)
+{
+#ifdef PROFILING
+    ThreadBuffer *buffer = CurrentBuffer();
+    QMutexLocker lock(&registry->mutex);
+    buffer->name = name;
+#else
+    UNREFERENCED_PARAM(name)
+#endif
+}
+
+void ThreadProfiler::Aggregate(Profiler *profiler)
+{
+    if (!profiler)
+        return;
+    QMutexLocker lock(&registry->mutex);
+    if (registry->buffers.empty())
+        return;
+
+    const double freq = (double)GetCurrentClockFreq();
+    ProfilerTrace &trace = profiler->Trace();
+    const bool recording = trace.IsRecording();
+    ProfilerNodeTree *threads = profiler->Child(profiler->GetRoot(), "Threads", false);
+    for(size_t i = 0; i < registry->buffers.size(); ++i)
+    {
+        ThreadBuffer *buffer = registry->buffers[i];
+        // Read the retired flag first, so that the events written before the thread exited are read below.
+        const bool retired = buffer->retired.fetchAndAddAcquire(0) != 0;
+        const u32 write = (u32)buffer->writeIndex.fetchAndAddAcquire(0);
+        u32 read = (u32)(int)buffer->readIndex;
+
+        ProfilerNodeTree *threadNode = profiler->Child(threads, buffer->name, false);
+        if (recording)
+            trace.SetThreadName(buffer->index, buffer->name);
+        for(; read != write; ++read)
+        {
+            const Event &event = buffer->events[read & (cBufferSize - 1)];
+            if (event.begin)
+            {
+                ProfilerNodeTree *parent = buffer->stack.empty() ? threadNode : buffer->stack.back().node;
+                const std::string &name = registry->names[event.scope];
+                ThreadBuffer::OpenBlock block;
+                // As with PROFILE, a block that recurses into itself is timed by its outermost call only.
+                const bool recursion = (name == parent->Name());
+                block.node = recursion ? parent : profiler->Child(parent, name, true);
+                block.accumulate = !recursion && dynamic_cast<ProfilerNode*>(block.node) != 0;
+                block.start = event.time;
+                buffer->stack.push_back(block);
+            }
+            else if (!buffer->stack.empty())
+            {
+                const ThreadBuffer::OpenBlock block = buffer->stack.back();
+                buffer->stack.pop_back();
+                if (block.accumulate)
+                {
+                    profiler->Accumulate(static_cast<ProfilerNode*>(block.node), (double)(event.time - block.start) / freq);
+                    if (recording)
+                        trace.AddBlock(block.node, buffer->index, block.start, event.time);
+                }
+            }
+        }
+        buffer->readIndex.fetchAndStoreRelease((int)write);
+
+        if (retired)
+        {
+            delete buffer;
+            registry->buffers.erase(registry->buffers.begin() + i);
+            --i;
+        }
+    }
+}
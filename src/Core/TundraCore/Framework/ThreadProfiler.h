@@ -0,0 +1,78 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#pragma once
+
+#include "TundraCoreApi.h"
+#include "CoreTypes.h"
+
+#include <string>
+
+class Profiler;
+
+#if defined(PROFILING)
+
+/// Profiles a block of code in the current scope on any thread. Ends the profiling when it goes out of scope.
+/** Unlike PROFILE, does not look up the block by name at runtime: the name is interned to a scope id once per call site,
+    and the scope records only its id and the clock time to a buffer of the calling thread on entry and exit. The blocks
+    appear in the profiler tree under "Threads", by thread, after the main thread has aggregated the buffers at the end
+    of the frame. The name must be unique in the scope, as with PROFILE.
+    @param x Unique name for the profiling block, use without quotes, f.ex. PROFILE_THREAD(name_of_the_block) */
+#define PROFILE_THREAD(x) static const ThreadProfilerScope x ## __scope__(#x); ThreadProfilerSection x ## __tprofiler__(x ## __scope__.id);
+
+#else
+#define PROFILE_THREAD(x)
+#endif
+
+/// Profiler backend for the blocks of code that run outside the main thread, and for the hot paths of the main thread.
+/** Each thread that enters a PROFILE_THREAD block gets a ring buffer of its own, which only that thread writes and only
+    the main thread reads, so recording an event takes no locks: it is a clock read and a few stores. The events are begin
+    and end pairs of (scope id, time), so that the blocks nested in a long-running block, such as the loop of a network
+    thread, are aggregated as they end rather than when the outer block does. When a buffer is full, the blocks that begin
+    are dropped until it has room, keeping room for the ends of the blocks that are open.
+
+    Aggregate replays the events into ProfilerNodes under Root/Threads/<thread name>, where they show up in the profiler
+    views like the blocks of the main thread. The name of a thread is the object name of its QThread, or can be set with
+    SetThreadName. The buffer of a thread that has exited is freed on the next aggregation. While the trace of the profiler
+    is recording, the blocks also go to it, on a track per thread. */
+class TUNDRACORE_API ThreadProfiler
+{
+public:
+    /// Returns the id of the scope name, adding it if new. Thread-safe; called once per PROFILE_THREAD call site.
+    static u32 InternScope(const char *name);
+
+    /// Records the beginning of a block on the calling thread.
+    static void Begin(u32 scope);
+
+    /// Records the end of the innermost open block on the calling thread.
+    static void End(u32 scope);
+
+    /// Sets the name of the calling thread in the profiler tree. No-op unless PROFILING is defined.
+    static void SetThreadName(const std::string &name);
+
+    /// Moves the events of all the threads to the profiler tree. Call from the main thread only.
+    static void Aggregate(Profiler *profiler);
+
+    /// Number of events in the buffer of each thread. A block takes two events.
+    static const u32 cBufferSize = 16384;
+};
+
+/// Interned scope id of a PROFILE_THREAD call site.
+/** A function-local static, which is constructed on the first pass of each call site. Compilers that do not guard the
+    construction of the statics may construct it twice on a race, which is harmless, as both get the same id. */
+struct TUNDRACORE_API ThreadProfilerScope
+{
+    explicit ThreadProfilerScope(const char *name) : id(ThreadProfiler::InternScope(name)) {}
+
+    u32 id;
+};
+
+/// Used by PROFILE_THREAD to end the block when it goes out of scope.
+class ThreadProfilerSection
+{
+public:
+    explicit ThreadProfilerSection(u32 scope) : scope_(scope) { ThreadProfiler::Begin(scope_); }
+    ~ThreadProfilerSection() { ThreadProfiler::End(scope_); }
+
+private:
+    u32 scope_;
+};
@@ -0,0 +1,258 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#pragma once
+
+#include "CoreTypes.h"
+
+#include <vector>
+#include <algorithm>
+
+/// Hierarchical timer wheel, which expires timers in constant time per timer regardless of how many are pending.
+/** The time is counted in integer ticks, which the owner advances with Advance. The wheel has cNumLevels levels of cNumSlots
+    slots. The first level holds the timers that expire within cNumSlots ticks, one slot per tick, and each further level
+    holds the timers cNumSlots times further away, one slot per cNumSlots ticks of the level below. When a slot of the first
+    level wraps around, the next slot of the level above is cascaded down. 4 levels of 256 slots cover 2^32 ticks; timers
+    further away are clamped to that.
+
+    The timers are kept in a vector with a free list, linked into the slots by index, so adding and removing timers does not
+    allocate once the vector has grown. The ids of the timers contain a generation count, so the id of an expired or removed
+    timer stays invalid when its entry is reused. 0 is never a valid id.
+
+    Advance moves the expired timers to a list of their own, from which PopExpired takes them in expiry order one by one, so
+    that the callback of a timer can remove the other expired timers before they are fired. Not thread-safe. */
+template<typename T>
+class TimerWheel
+{
+public:
+    typedef u64 Id;
+
+    static const int cLevelBits = 8;
+    static const int cNumSlots = 1 << cLevelBits;
+    static const int cNumLevels = 4;
+
+    TimerWheel() : currentTick_(0), freeList_(-1), size_(0)
+    {
+        for(int i = 0; i < cNumLists; ++i)
+            heads_[i] = tails_[i] = -1;
+    }
+
+    /// Adds a timer that expires at the tick. A tick that has passed already expires on the next Advance.
+    Id Add(u64 expiryTick, const T &payload)
+    {
+        int index = freeList_;
+        if (index >= 0)
+            freeList_ = entries_[index].next;
+        else
+        {
+            index = (int)entries_.size();
+            entries_.push_back(Entry());
+        }
+        Entry &entry = entries_[index];
+        ++entry.generation;
+        entry.expiry = std::max(expiryTick, currentTick_);
+        entry.payload = payload;
+        Link(index, ListOf(entry.expiry));
+        ++size_;
+        return MakeId(index, entry.generation);
+    }
+
+    /// Removes a pending or expired timer. Returns false if the id is not of a timer in the wheel.
+    bool Remove(Id id)
+    {
+        int index = IndexOf(id);
+        if (index < 0)
+            return false;
+        Unlink(index);
+        Free(index);
+        return true;
+    }
+
+    /// Returns the payload of a pending or expired timer, or null if the id is not of a timer in the wheel.
+    T *Find(Id id)
+    {
+        int index = IndexOf(id);
+        return index >= 0 ? &entries_[index].payload : 0;
+    }
+
+    /// Expires the timers up to and including the tick, moving them to the expired list.
+    void Advance(u64 tick)
+    {
+        if (size_ == 0 && tick >= currentTick_)
+        {
+            currentTick_ = tick + 1;
+            return;
+        }
+        while(currentTick_ <= tick)
+        {
+            const int slot = (int)(currentTick_ & (cNumSlots - 1));
+            // When the first level wraps around, bring the timers of the next slot of each level above down.
+            if (slot == 0)
+                for(int level = 1; level < cNumLevels; ++level)
+                {
+                    const int levelSlot = (int)((currentTick_ >> (level * cLevelBits)) & (cNumSlots - 1));
+                    Cascade(level * cNumSlots + levelSlot);
+                    if (levelSlot != 0)
+                        break;
+                }
+
+            // Append the slot, whose timers are in the order they were added, to the expired list.
+            for(int index = heads_[slot]; index >= 0; )
+            {
+                int next = entries_[index].next;
+                Unlink(index);
+                Link(index, cExpiredList);
+                index = next;
+            }
+            ++currentTick_;
+        }
+    }
+
+    /// Takes the first expired timer. Returns false if there are none.
+    bool PopExpired(T &payload, Id *id = 0)
+    {
+        int index = heads_[cExpiredList];
+        if (index < 0)
+            return false;
+        payload = entries_[index].payload;
+        if (id)
+            *id = MakeId(index, entries_[index].generation);
+        Unlink(index);
+        Free(index);
+        return true;
+    }
+
+    /// Removes all the timers.
+    void Clear()
+    {
+        for(size_t i = 0; i < entries_.size(); ++i)
+            if (entries_[i].list >= 0)
+            {
+                Unlink((int)i);
+                Free((int)i);
+            }
+    }
+
+    /// Returns the next tick to be expired by Advance.
+    u64 CurrentTick() const { return currentTick_; }
+
+    /// Returns a tick at or before which the first pending timer expires, or CurrentTick if there are expired timers.
+    /** Scans the first level up to its wraparound, when the timers of the levels above are cascaded down, so the tick is
+        exact for the timers due within that and the wraparound tick for the others. Meant for sleeping until the next
+        timer: the caller wakes up at the latest in time for it. Call only when Size is nonzero. */
+    u64 NextExpiryBound() const
+    {
+        if (heads_[cExpiredList] >= 0)
+            return currentTick_;
+        const u64 wrap = (currentTick_ | (cNumSlots - 1)) + 1;
+        for(u64 tick = currentTick_; tick < wrap; ++tick)
+            if (heads_[tick & (cNumSlots - 1)] >= 0)
+                return tick;
+        return wrap;
+    }
+
+    /// Returns the number of pending and expired timers.
+    size_t Size() const { return size_; }
+
+private:
+    static const int cExpiredList = cNumLevels * cNumSlots;
+    static const int cNumLists = cExpiredList + 1;
+
+    struct Entry
+    {
+        Entry() : expiry(0), generation(0), prev(-1), next(-1), list(-1) {}
+
+        u64 expiry;
+        u32 generation;
+        int prev;
+        int next; ///< Next entry in the list, or in the free list when free.
+        int list; ///< Index of the list the entry is in, or -1 if free.
+        T payload;
+    };
+
+    static Id MakeId(int index, u32 generation) { return ((u64)generation << 32) | (u32)index; }
+
+    int IndexOf(Id id) const
+    {
+        const u32 index = (u32)(id & 0xFFFFFFFF);
+        if (index >= entries_.size())
+            return -1;
+        const Entry &entry = entries_[index];
+        return (entry.list >= 0 && entry.generation == (u32)(id >> 32)) ? (int)index : -1;
+    }
+
+    /// Returns the list of the slot for the expiry tick, relative to the current tick.
+    int ListOf(u64 expiry) const
+    {
+        u64 delta = expiry - currentTick_;
+        const u64 maxDelta = ((u64)1 << (cNumLevels * cLevelBits)) - 1;
+        if (delta > maxDelta)
+        {
+            delta = maxDelta;
+            expiry = currentTick_ + delta;
+        }
+        for(int level = 0; level < cNumLevels; ++level)
+            if (delta < ((u64)1 << ((level + 1) * cLevelBits)))
+                return level * cNumSlots + (int)((expiry >> (level * cLevelBits)) & (cNumSlots - 1));
+        return (cNumLevels - 1) * cNumSlots + (int)((expiry >> ((cNumLevels - 1) * cLevelBits)) & (cNumSlots - 1));
+    }
+
+    /// Re-adds the timers of a slot of an upper level, which puts them on the levels below.
+    void Cascade(int list)
+    {
+        int index = heads_[list];
+        heads_[list] = -1;
+        tails_[list] = -1;
+        while(index >= 0)
+        {
+            int next = entries_[index].next;
+            entries_[index].list = -1;
+            Link(index, ListOf(entries_[index].expiry));
+            index = next;
+        }
+    }
+
+    /// Appends the entry to the end of the list.
+    void Link(int index, int list)
+    {
+        Entry &entry = entries_[index];
+        entry.list = list;
+        entry.next = -1;
+        entry.prev = tails_[list];
+        if (heads_[list] < 0)
+            heads_[list] = index;
+        else
+            entries_[tails_[list]].next = index;
+        tails_[list] = index;
+    }
+
+    void Unlink(int index)
+    {
+        Entry &entry = entries_[index];
+        if (entry.prev >= 0)
+            entries_[entry.prev].next = entry.next;
+        else
+            heads_[entry.list] = entry.next;
+        if (entry.next >= 0)
+            entries_[entry.next].prev = entry.prev;
+        else
+            tails_[entry.list] = entry.prev;
+        entry.list = -1;
+        entry.prev = entry.next = -1;
+    }
+
+    void Free(int index)
+    {
+        Entry &entry = entries_[index];
+        entry.payload = T();
+        entry.next = freeList_;
+        freeList_ = index;
+        --size_;
+    }
+
+    std::vector<Entry> entries_;
+    int heads_[cNumLists];
+    int tails_[cNumLists];
+    u64 currentTick_; ///< The next tick to be expired.
+    int freeList_;
+    size_t size_;
+};
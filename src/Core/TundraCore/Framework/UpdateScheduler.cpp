@@ -0,0 +1,304 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#include "StableHeaders.h"
+#include "DebugOperatorNew.h"
+
+#include "UpdateScheduler.h"
+#include "LoggingFunctions.h"
+#include "Profiler.h"
+#include "JobSystem.h"
+
+#include <QAtomicInt>
+#include <QMutex>
+#include <QStringList>
+
+#include <algorithm>
+#include <exception>
+#include <map>
+
+#include "MemoryLeakCheck.h"
+
+namespace
+{
+
+/// Jobs of a batch being run, shared by the main thread and the worker threads.
+struct BatchState
+{
+    std::vector<IUpdateJob *> jobs; ///< The threaded jobs, claimed with next.
+    std::vector<QString> names;
+    QAtomicInt next;
+    float frameTime;
+    QMutex errorMutex;
+    QStringList errors; ///< Names of the jobs that threw, guarded by errorMutex.
+
+    /// Claims and runs jobs until there are none left.
+    void RunJobs()
+    {
+        for(;;)
+        {
+            int index = next.fetchAndAddOrdered(1);
+            if (index >= (int)jobs.size())
+                return;
+            try
+            {
+                jobs[index]->Run(frameTime);
+            }
+            catch(const std::exception &e)
+            {
+                QMutexLocker lock(&errorMutex);
+                errors << names[index] + ": " + (e.what() ? e.what() : "(null)");
+            }
+            catch(...)
+            {
+                QMutexLocker lock(&errorMutex);
+                errors << names[index] + ": unknown exception";
+            }
+        }
+    }
+};
+
+/// Runs the jobs of a batch in a worker thread.
+class BatchJob : public IJob
+{
+public:
+    explicit BatchJob(BatchState &state) : IJob("UpdateScheduler_Batch"), state_(state) {}
+    void Run() { state_.RunJobs(); }
+
+private:
+    BatchState &state_;
+};
+
+/// Runs the jobs of the state in the calling thread and in numWorkers worker threads of the job system, and waits for them.
+void RunInJobSystem(JobSystem *jobSystem, BatchState &state, int numWorkers)
+{
+    std::vector<JobPtr> batchJobs;
+    for(int i = 0; i < numWorkers; ++i)
+    {
+        batchJobs.push_back(MAKE_SHARED(BatchJob, state));
+        jobSystem->Schedule(batchJobs.back());
+    }
+    state.RunJobs();
+    jobSystem->Wait(batchJobs);
+}
+
+/// Returns the largest batch index in the map for the types, or -1 if none of them is in it.
+int LastBatch(const std::map<u32, int> &batches, const std::vector<u32> &typeIds)
+{
+    int last = -1;
+    for(size_t i = 0; i < typeIds.size(); ++i)
+    {
+        std::map<u32, int>::const_iterator it = batches.find(typeIds[i]);
+        if (it != batches.end())
+            last = std::max(last, it->second);
+    }
+    return last;
+}
+
+/// Sorts the type IDs and removes the duplicates.
+void SortUnique(std::vector<u32> &typeIds)
+{
+    std::sort(typeIds.begin(), typeIds.end());
+    typeIds.erase(std::unique(typeIds.begin(), typeIds.end()), typeIds.end());
+}
+
+} // ~unnamed namespace
+
+UpdateScheduler::UpdateScheduler(JobSystem *jobSystem) :
+    scheduleDirty_(false),
+    running_(false),
+    hasRemoved_(false),
+    jobSystem_(jobSystem),
+    maxThreadCount_(jobSystem->NumWorkers())
+{
+}
+
+UpdateScheduler::~UpdateScheduler()
+{
+}
+
+void UpdateScheduler::AddJob(IUpdateJob *job, const QString &name, const std::vector<u32> &reads, const std::vector<u32> &writes, bool threaded)
+{
+    if (!job)
+        return;
+
+    Job entry;
+    entry.job = job;
+    entry.name = name;
+    entry.writes = writes;
+    SortUnique(entry.writes);
+    entry.reads = reads;
+    entry.reads.insert(entry.reads.end(), writes.begin(), writes.end());
+    SortUnique(entry.reads);
+    entry.threaded = threaded;
+
+    scheduleDirty_ = true;
+    for(size_t i = 0; i < jobs_.size(); ++i)
+        if (jobs_[i].job == job)
+        {
+            jobs_[i] = entry;
+            return;
+        }
+    jobs_.push_back(entry);
+}
+
+bool UpdateScheduler::RemoveJob(IUpdateJob *job)
+{
+    for(size_t i = 0; i < jobs_.size(); ++i)
+        if (jobs_[i].job == job)
+        {
+            scheduleDirty_ = true;
+            if (running_)
+            {
+                // The batches refer to the jobs by index, so only mark the job removed
+                jobs_[i].job = 0;
+                hasRemoved_ = true;
+            }
+            else
+                jobs_.erase(jobs_.begin() + i);
+            return true;
+        }
+    return false;
+}
+
+void UpdateScheduler::SetMaxThreadCount(int count)
+{
+    maxThreadCount_ = std::max(0, count);
+}
+
+int UpdateScheduler::MaxThreadCount() const
+{
+    return maxThreadCount_;
+}
+
+void UpdateScheduler::Schedule()
+{
+    PROFILE(UpdateScheduler_Schedule);
+    batches_.clear();
+    // The latest batch that reads, or writes, each type so far. A job goes after the batches it conflicts with.
+    std::map<u32, int> lastRead;
+    std::map<u32, int> lastWrite;
+    for(size_t i = 0; i < jobs_.size(); ++i)
+    {
+        const Job &job = jobs_[i];
+        if (!job.job)
+            continue;
+        int batch = std::max(LastBatch(lastWrite, job.reads), LastBatch(lastRead, job.writes)) + 1;
+        if (batch >= (int)batches_.size())
+            batches_.resize(batch + 1);
+        batches_[batch].push_back(i);
+
+        for(size_t j = 0; j < job.reads.size(); ++j)
+            lastRead[job.reads[j]] = std::max(lastRead[job.reads[j]], batch);
+        for(size_t j = 0; j < job.writes.size(); ++j)
+            lastWrite[job.writes[j]] = std::max(lastWrite[job.writes[j]], batch);
+    }
+    scheduleDirty_ = false;
+}
+
+void UpdateScheduler::Run(float frameTime)
+{
+    if (jobs_.empty() || running_)
+        return;
+
+    PROFILE(UpdateScheduler_Run);
+    if (scheduleDirty_)
+        Schedule();
+    running_ = true;
+
+    // Jobs added during the frame are run from the next frame on
+    const size_t numJobs = jobs_.size();
+    for(size_t i = 0; i < numJobs; ++i)
+        if (jobs_[i].job)
+            jobs_[i].job->Prepare(frameTime);
+
+    for(size_t i = 0; i < batches_.size(); ++i)
+        RunBatch(batches_[i], frameTime);
+
+    for(size_t i = 0; i < numJobs; ++i)
+        if (jobs_[i].job)
+            jobs_[i].job->Finish(frameTime);
+
+    running_ = false;
+    if (hasRemoved_)
+        EraseRemoved();
+}
+
+void UpdateScheduler::RunBatch(const std::vector<size_t> &batch, float frameTime)
+{
+    BatchState state;
+    state.frameTime = frameTime;
+    std::vector<IUpdateJob *> mainThreadJobs;
+    std::vector<QString> mainThreadNames;
+    for(size_t i = 0; i < batch.size(); ++i)
+    {
+        const Job &job = jobs_[batch[i]];
+        if (!job.job)
+            continue;
+        if (job.threaded)
+        {
+            state.jobs.push_back(job.job);
+            state.names.push_back(job.name);
+        }
+        else
+        {
+            mainThreadJobs.push_back(job.job);
+            mainThreadNames.push_back(job.name);
+        }
+    }
+
+    // The main thread claims jobs too, so one job less than there are needs no worker
+    int numWorkers = std::min((int)state.jobs.size() - (mainThreadJobs.empty() ? 1 : 0), std::min(maxThreadCount_, jobSystem_->NumWorkers()));
+    std::vector<JobPtr> batchJobs;
+    for(int i = 0; i < numWorkers; ++i)
+    {
+        batchJobs.push_back(MAKE_SHARED(BatchJob, state));
+        jobSystem_->Schedule(batchJobs.back());
+    }
+
+    for(size_t i = 0; i < mainThreadJobs.size(); ++i)
+    {
+        try
+        {
+            mainThreadJobs[i]->Run(frameTime);
+        }
+        catch(const std::exception &e)
+        {
+            LogError("UpdateScheduler::Run: job " + mainThreadNames[i] + " threw an exception: " + (e.what() ? e.what() : "(null)"));
+        }
+        catch(...)
+        {
+            LogError("UpdateScheduler::Run: job " + mainThreadNames[i] + " threw an unknown exception.");
+        }
+    }
+    state.RunJobs();
+    jobSystem_->Wait(batchJobs);
+
+    foreach(const QString &error, state.errors)
+        LogError("UpdateScheduler::Run: job " + error);
+}
+
+void UpdateScheduler::RunParallel(const std::vector<IUpdateJob *> &jobs, float frameTime, const QString &name)
+{
+    if (jobs.empty())
+        return;
+
+    BatchState state;
+    state.frameTime = frameTime;
+    state.jobs = jobs;
+    state.names.resize(jobs.size(), name);
+
+    RunInJobSystem(jobSystem_, state, std::min((int)jobs.size() - 1, std::min(maxThreadCount_, jobSystem_->NumWorkers())));
+
+    foreach(const QString &error, state.errors)
+        LogError("UpdateScheduler::RunParallel: job " + error);
+}
+
+void UpdateScheduler::EraseRemoved()
+{
+    size_t j = 0;
+    for(size_t i = 0; i < jobs_.size(); ++i)
+        if (jobs_[i].job)
+            jobs_[j++] = jobs_[i];
+    jobs_.resize(j);
+    hasRemoved_ = false;
+}
@@ -0,0 +1,116 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#pragma once
+
+#include "TundraCoreApi.h"
+#include "CoreTypes.h"
+
+#include <QString>
+
+#include <vector>
+
+class JobSystem;
+
+/// A per-frame update job run by UpdateScheduler, possibly in a worker thread.
+/** Each frame, the scheduler calls Prepare of all the jobs in the main thread, then Run of all the jobs, in parallel
+    where their declared component sets allow, and finally Finish of all the jobs in the main thread.
+    Run of a threaded job must only read the data of the component types the job declared to read, write the data of
+    those it declared to write, and its own private state that no other job reads. It must not emit Qt signals, create
+    or remove entities or components, or call the renderer. Do such things in Prepare and Finish, e.g. gather the
+    inputs in Prepare and apply or signal the results in Finish.
+    @note A job must remove itself from the scheduler before it is destroyed. */
+class TUNDRACORE_API IUpdateJob
+{
+public:
+    virtual ~IUpdateJob() {}
+
+    /// Called in the main thread before any job of the frame is run.
+    virtual void Prepare(float /*frameTime*/) {}
+
+    /// Does the work of the job. Called in a worker thread or the main thread.
+    virtual void Run(float frameTime) = 0;
+
+    /// Called in the main thread after all the jobs of the frame have been run.
+    virtual void Finish(float /*frameTime*/) {}
+};
+
+/// Runs the registered update jobs each frame, in parallel where their declared component sets do not conflict.
+/** Get the scheduler with FrameAPI::Scheduler. The jobs are run after FrameAPI::Updated and before FrameAPI::PostFrameUpdate.
+
+    Each job declares the component type IDs it reads and writes. Two jobs conflict if one of them writes a type the
+    other one reads or writes. The jobs are grouped into batches so that no two jobs of a batch conflict, and a job that
+    conflicts with an earlier registered job is always in a later batch, so conflicting jobs run in registration order.
+    The batches are run one after another. The jobs of a batch are claimed one by one by the main thread and the worker
+    threads of JobSystem, so a thread that finishes its jobs early takes on the remaining ones. Jobs that are not threaded
+    are run by the main thread within the batch.
+
+    Add and remove jobs in the main thread, but not from Run of a job: from Prepare or Finish, or outside the scheduler.
+    A job added during a frame is run from the next frame on. */
+class TUNDRACORE_API UpdateScheduler
+{
+public:
+    /// Constructs the scheduler, which runs the jobs in the worker threads of the job system.
+    explicit UpdateScheduler(JobSystem *jobSystem);
+    ~UpdateScheduler();
+
+    /// Adds a job, or updates the name and component sets of a job already added.
+    /** @param job The job. The caller retains ownership.
+        @param name Name of the job, used in error messages.
+        @param reads Type IDs of the components the job reads.
+        @param writes Type IDs of the components the job writes. No need to repeat them in reads.
+        @param threaded Whether the job can run in a worker thread. If false, it is run in the main thread. */
+    void AddJob(IUpdateJob *job, const QString &name, const std::vector<u32> &reads, const std::vector<u32> &writes, bool threaded = true);
+
+    /// Removes a job. Returns whether the job was added.
+    bool RemoveJob(IUpdateJob *job);
+
+    /// Returns the number of jobs.
+    size_t NumJobs() const { return jobs_.size(); }
+
+    /// Returns the number of batches the jobs were grouped into on the latest frame.
+    size_t NumBatches() const { return batches_.size(); }
+
+    /// Sets the maximum number of worker threads. Zero runs all the jobs in the main thread.
+    /** By default the number of the workers of JobSystem, which is one less than QThread::idealThreadCount, as the main
+        thread runs jobs too. More than that has no effect. */
+    void SetMaxThreadCount(int count);
+    int MaxThreadCount() const;
+
+    /// Runs the jobs. Called by FrameAPI each frame.
+    void Run(float frameTime);
+
+    /// Runs the given jobs right away in the main thread and the worker threads, and returns when all of them are done.
+    /** For splitting the work of a single system over the worker threads, e.g. the physics step. The jobs must not
+        conflict with each other, and only Run of them is called. Call in the main thread or in a thread of its own, e.g. the
+        physics step thread, but not from Run of a job. Can be called in two threads at once.
+        @param name Name of the jobs, used in error messages. */
+    void RunParallel(const std::vector<IUpdateJob *> &jobs, float frameTime, const QString &name);
+
+private:
+    struct Job
+    {
+        IUpdateJob *job; ///< Null for a job removed during Run.
+        QString name;
+        std::vector<u32> reads; ///< Sorted read type IDs, including the written ones.
+        std::vector<u32> writes; ///< Sorted written type IDs.
+        bool threaded;
+    };
+
+    /// Groups the jobs into batches.
+    void Schedule();
+    /// Runs a batch in the main thread and the worker threads.
+    void RunBatch(const std::vector<size_t> &batch, float frameTime);
+    /// Erases the jobs removed during Run.
+    void EraseRemoved();
+
+    UpdateScheduler(const UpdateScheduler &);
+    void operator =(const UpdateScheduler &);
+
+    std::vector<Job> jobs_;
+    std::vector<std::vector<size_t> > batches_; ///< Indices to jobs_ of the jobs of each batch.
+    bool scheduleDirty_; ///< Whether jobs have been added or removed since the batches were formed.
+    bool running_; ///< Whether Run is in progress.
+    bool hasRemoved_; ///< Whether jobs were removed during Run and are to be erased when it ends.
+    JobSystem *jobSystem_;
+    int maxThreadCount_;
+};
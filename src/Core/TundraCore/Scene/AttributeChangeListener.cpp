@@ -0,0 +1,75 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#include "StableHeaders.h"
+#include "DebugOperatorNew.h"
+
+#include "AttributeChangeListener.h"
+#include "IAttribute.h"
+
+#include "MemoryLeakCheck.h"
+
+void AttributeChangeListenerList::Add(IAttributeChangeListener *listener, int attributeIndex)
+{
+    if (!listener)
+        return;
+    for(size_t i = 0; i < entries_.size(); ++i)
+        if (entries_[i].listener == listener && entries_[i].attributeIndex == attributeIndex)
+            return;
+    Entry entry;
+    entry.listener = listener;
+    entry.attributeIndex = attributeIndex < 0 ? -1 : attributeIndex;
+    entries_.push_back(entry);
+}
+
+bool AttributeChangeListenerList::Remove(IAttributeChangeListener *listener)
+{
+    bool found = false;
+    for(size_t i = 0; i < entries_.size(); ++i)
+        if (entries_[i].listener == listener)
+        {
+            // Keep the indices of an ongoing dispatch valid, and erase the entry when it ends
+            entries_[i].listener = 0;
+            found = true;
+        }
+    if (!found)
+        return false;
+
+    if (dispatchDepth_ > 0)
+        hasRemoved_ = true;
+    else
+        EraseRemoved();
+    return true;
+}
+
+void AttributeChangeListenerList::Dispatch(IComponent *component, IAttribute *attribute, AttributeChange::Type change)
+{
+    if (entries_.empty())
+        return;
+
+    const int index = attribute->Index();
+    // Listeners added by the listeners are not invoked for this change
+    const size_t numEntries = entries_.size();
+    ++dispatchDepth_;
+    for(size_t i = 0; i < numEntries; ++i)
+    {
+        IAttributeChangeListener *listener = entries_[i].listener;
+        if (listener && (entries_[i].attributeIndex < 0 || entries_[i].attributeIndex == index))
+            listener->OnAttributeChanged(component, attribute, change);
+    }
+    --dispatchDepth_;
+
+    if (dispatchDepth_ == 0 && hasRemoved_)
+    {
+        hasRemoved_ = false;
+        EraseRemoved();
+    }
+}
+
+void AttributeChangeListenerList::EraseRemoved()
+{
+    size_t j = 0;
+    for(size_t i = 0; i < entries_.size(); ++i)
+        if (entries_[i].listener)
+            entries_[j++] = entries_[i];
+    entries_.resize(j);
+}
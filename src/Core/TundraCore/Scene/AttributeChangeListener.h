@@ -0,0 +1,57 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#pragma once
+
+#include "TundraCoreApi.h"
+#include "SceneFwd.h"
+#include "AttributeChangeType.h"
+
+#include <vector>
+
+/// Engine-internal listener of attribute changes, notified with a direct virtual call instead of a Qt signal.
+/** Listen to the changes of the attributes of a component with IComponent::AddAttributeChangeListener, or of all
+    the components of a type in a scene with Scene::AddAttributeChangeListener. The listeners are invoked just before
+    the corresponding AttributeChanged signals, and only for the component types and attributes they registered for.
+    Scripts and other QObject-based code should keep using the signals.
+    @note A listener must remove itself from the components and scenes it listens to before it is destroyed. */
+class TUNDRACORE_API IAttributeChangeListener
+{
+public:
+    virtual ~IAttributeChangeListener() {}
+
+    /// Called when an attribute the listener registered for has changed.
+    virtual void OnAttributeChanged(IComponent *component, IAttribute *attribute, AttributeChange::Type change) = 0;
+};
+
+/// List of attribute change listeners, each for one or all attribute indices, of a component or component type.
+/** Listeners may be added and removed while the list is dispatching a change. A listener removed during a dispatch
+    is not invoked anymore, and one added during a dispatch is invoked from the next change on. */
+class TUNDRACORE_API AttributeChangeListenerList
+{
+public:
+    AttributeChangeListenerList() : dispatchDepth_(0), hasRemoved_(false) {}
+
+    /// Adds a listener for the attribute index, or for all the attributes if the index is negative.
+    void Add(IAttributeChangeListener *listener, int attributeIndex = -1);
+    /// Removes all the registrations of the listener. Returns whether the listener was in the list.
+    bool Remove(IAttributeChangeListener *listener);
+    /// Returns whether the list has no listeners.
+    bool Empty() const { return entries_.empty(); }
+
+    /// Invokes the listeners of the attribute.
+    void Dispatch(IComponent *component, IAttribute *attribute, AttributeChange::Type change);
+
+private:
+    struct Entry
+    {
+        IAttributeChangeListener *listener; ///< Null for an entry removed during a dispatch.
+        int attributeIndex; ///< Index of the attribute listened to, or -1 for all.
+    };
+
+    /// Erases the entries of the removed listeners.
+    void EraseRemoved();
+
+    std::vector<Entry> entries_;
+    int dispatchDepth_; ///< Number of nested Dispatch calls in progress.
+    bool hasRemoved_; ///< Whether entries were removed during the dispatch and are to be erased when it ends.
+};
@@ -0,0 +1,325 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#include "StableHeaders.h"
+#include "DebugOperatorNew.h"
+
+#include "AttributeInterpolationTracks.h"
+#include "IAttribute.h"
+#include "Transform.h"
+#include "Color.h"
+#include "Math/float3.h"
+#include "Math/Quat.h"
+#include "Math/MathBuildConfig.h"
+
+#include <cmath>
+
+#ifdef MATH_SSE
+#include <xmmintrin.h>
+#endif
+
+#include "MemoryLeakCheck.h"
+
+namespace
+{
+
+/// Linearly interpolates the first count values of each lane, result = start + t * (end - start) as in Lerp.
+void LerpLanes(const float *start, const float *end, const float *t, float *result, size_t count)
+{
+    size_t i = 0;
+#ifdef MATH_SSE
+    for(; i + 4 <= count; i += 4)
+    {
+        __m128 s = _mm_loadu_ps(start + i);
+        __m128 d = _mm_sub_ps(_mm_loadu_ps(end + i), s);
+        _mm_storeu_ps(result + i, _mm_add_ps(s, _mm_mul_ps(_mm_loadu_ps(t + i), d)));
+    }
+#endif
+    for(; i < count; ++i)
+        result[i] = start[i] + t[i] * (end[i] - start[i]);
+}
+
+/// Returns the weights of the start and end quaternions of a slerp, as computed by Quat::Slerp.
+/** @param dot Dot product of the quaternions. The sign that takes the shorter path is included in the start weight. */
+void SlerpWeights(float dot, float t, float &startWeight, float &endWeight)
+{
+    float sign = 1.f;
+    if (dot < 0.f)
+    {
+        dot = -dot;
+        sign = -1.f;
+    }
+
+    if (dot <= 0.97f)
+    {
+        float angle = acosf(dot);
+        float c = 1.f / sinf(angle);
+        startWeight = sinf((1.f - t) * angle) * c * sign;
+        endWeight = sinf(angle * t) * c;
+    }
+    else // The quaternions are so close that linear interpolation is accurate and avoids the division by sin(angle).
+    {
+        startWeight = (1.f - t) * sign;
+        endWeight = t;
+    }
+}
+
+/// Spherically interpolates the first count quaternions of the x, y, z and w lanes, writing normalized results.
+void SlerpLanes(const float *const *start, const float *const *end, const float *t, float *const *result, size_t count)
+{
+    size_t i = 0;
+#ifdef MATH_SSE
+    for(; i + 4 <= count; i += 4)
+    {
+        __m128 ax = _mm_loadu_ps(start[0] + i), ay = _mm_loadu_ps(start[1] + i), az = _mm_loadu_ps(start[2] + i), aw = _mm_loadu_ps(start[3] + i);
+        __m128 bx = _mm_loadu_ps(end[0] + i), by = _mm_loadu_ps(end[1] + i), bz = _mm_loadu_ps(end[2] + i), bw = _mm_loadu_ps(end[3] + i);
+        __m128 dot = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ax, bx), _mm_mul_ps(ay, by)), _mm_add_ps(_mm_mul_ps(az, bz), _mm_mul_ps(aw, bw)));
+
+        // The trigonometry is done per lane; the weights of the rare distant endpoints are not worth a vector approximation.
+        float dots[4], startWeights[4], endWeights[4];
+        _mm_storeu_ps(dots, dot);
+        for(size_t j = 0; j < 4; ++j)
+            SlerpWeights(dots[j], t[i + j], startWeights[j], endWeights[j]);
+        __m128 wa = _mm_loadu_ps(startWeights);
+        __m128 wb = _mm_loadu_ps(endWeights);
+
+        __m128 x = _mm_add_ps(_mm_mul_ps(ax, wa), _mm_mul_ps(bx, wb));
+        __m128 y = _mm_add_ps(_mm_mul_ps(ay, wa), _mm_mul_ps(by, wb));
+        __m128 z = _mm_add_ps(_mm_mul_ps(az, wa), _mm_mul_ps(bz, wb));
+        __m128 w = _mm_add_ps(_mm_mul_ps(aw, wa), _mm_mul_ps(bw, wb));
+        __m128 length = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)), _mm_add_ps(_mm_mul_ps(z, z), _mm_mul_ps(w, w))));
+        _mm_storeu_ps(result[0] + i, _mm_div_ps(x, length));
+        _mm_storeu_ps(result[1] + i, _mm_div_ps(y, length));
+        _mm_storeu_ps(result[2] + i, _mm_div_ps(z, length));
+        _mm_storeu_ps(result[3] + i, _mm_div_ps(w, length));
+    }
+#endif
+    for(; i < count; ++i)
+    {
+        float dot = start[0][i] * end[0][i] + start[1][i] * end[1][i] + start[2][i] * end[2][i] + start[3][i] * end[3][i];
+        float wa, wb;
+        SlerpWeights(dot, t[i], wa, wb);
+        float q[4];
+        for(size_t k = 0; k < 4; ++k)
+            q[k] = start[k][i] * wa + end[k][i] * wb;
+        float length = sqrtf(q[0] * q[0] + q[1] * q[1] + q[2] * q[2] + q[3] * q[3]);
+        for(size_t k = 0; k < 4; ++k)
+            result[k][i] = q[k] / length;
+    }
+}
+
+/// Unpacks the value of a typed attribute into the components of a lane. Returns false if the attribute is of another type.
+bool UnpackValue(AttributeInterpolationTracks::Kind kind, IAttribute *attribute, float *values)
+{
+    switch(kind)
+    {
+    case AttributeInterpolationTracks::KindFloat:
+    {
+        Attribute<float> *attr = dynamic_cast<Attribute<float> *>(attribute);
+        if (!attr)
+            return false;
+        values[0] = attr->Get();
+        return true;
+    }
+    case AttributeInterpolationTracks::KindFloat3:
+    {
+        Attribute<float3> *attr = dynamic_cast<Attribute<float3> *>(attribute);
+        if (!attr)
+            return false;
+        const float3 &v = attr->Get();
+        values[0] = v.x; values[1] = v.y; values[2] = v.z;
+        return true;
+    }
+    case AttributeInterpolationTracks::KindQuat:
+    {
+        Attribute<Quat> *attr = dynamic_cast<Attribute<Quat> *>(attribute);
+        if (!attr)
+            return false;
+        const Quat &q = attr->Get();
+        values[0] = q.x; values[1] = q.y; values[2] = q.z; values[3] = q.w;
+        return true;
+    }
+    case AttributeInterpolationTracks::KindColor:
+    {
+        Attribute<Color> *attr = dynamic_cast<Attribute<Color> *>(attribute);
+        if (!attr)
+            return false;
+        const Color &c = attr->Get();
+        values[0] = c.r; values[1] = c.g; values[2] = c.b; values[3] = c.a;
+        return true;
+    }
+    case AttributeInterpolationTracks::KindTransform:
+    {
+        Attribute<Transform> *attr = dynamic_cast<Attribute<Transform> *>(attribute);
+        if (!attr)
+            return false;
+        const Transform &tm = attr->Get();
+        // The Euler angles are converted to a quaternion once per segment instead of on every frame.
+        Quat q = tm.Orientation();
+        values[0] = tm.pos.x; values[1] = tm.pos.y; values[2] = tm.pos.z;
+        values[3] = tm.scale.x; values[4] = tm.scale.y; values[5] = tm.scale.z;
+        values[6] = q.x; values[7] = q.y; values[8] = q.z; values[9] = q.w;
+        return true;
+    }
+    default:
+        return false;
+    }
+}
+
+}
+
+AttributeInterpolationTracks::AttributeInterpolationTracks()
+{
+    lanes_[KindFloat].numLerp = 1;
+    lanes_[KindFloat3].numLerp = 3;
+    lanes_[KindQuat].slerp = true;
+    lanes_[KindColor].numLerp = 4;
+    lanes_[KindTransform].numLerp = 6; // Position and scale
+    lanes_[KindTransform].slerp = true;
+}
+
+AttributeInterpolationTracks::Kind AttributeInterpolationTracks::KindOf(const IAttribute *attribute)
+{
+    switch(attribute ? attribute->TypeId() : cAttributeNone)
+    {
+    case cAttributeReal: return KindFloat;
+    case cAttributeFloat3: return KindFloat3;
+    case cAttributeQuat: return KindQuat;
+    case cAttributeColor: return KindColor;
+    case cAttributeTransform: return KindTransform;
+    default: return KindGeneric;
+    }
+}
+
+size_t AttributeInterpolationTracks::Add(Kind kind, size_t owner)
+{
+    Lanes &lanes = lanes_[kind];
+    const size_t numComponents = lanes.NumComponents();
+    for(size_t i = 0; i < numComponents; ++i)
+    {
+        lanes.start[i].push_back(0.f);
+        lanes.end[i].push_back(0.f);
+        lanes.result[i].push_back(0.f);
+    }
+    lanes.t.push_back(0.f);
+    lanes.owners.push_back(owner);
+    return lanes.owners.size() - 1;
+}
+
+size_t AttributeInterpolationTracks::Remove(Kind kind, size_t track)
+{
+    Lanes &lanes = lanes_[kind];
+    const size_t last = lanes.Size() - 1;
+    size_t moved = cNoOwner;
+    if (track < last)
+    {
+        const size_t numComponents = lanes.NumComponents();
+        for(size_t i = 0; i < numComponents; ++i)
+        {
+            lanes.start[i][track] = lanes.start[i][last];
+            lanes.end[i][track] = lanes.end[i][last];
+            lanes.result[i][track] = lanes.result[i][last];
+        }
+        lanes.t[track] = lanes.t[last];
+        lanes.owners[track] = lanes.owners[last];
+        moved = lanes.owners[track];
+    }
+
+    const size_t numComponents = lanes.NumComponents();
+    for(size_t i = 0; i < numComponents; ++i)
+    {
+        lanes.start[i].pop_back();
+        lanes.end[i].pop_back();
+        lanes.result[i].pop_back();
+    }
+    lanes.t.pop_back();
+    lanes.owners.pop_back();
+    return moved;
+}
+
+void AttributeInterpolationTracks::SetSegment(Kind kind, size_t track, IAttribute *start, IAttribute *end)
+{
+    Lanes &lanes = lanes_[kind];
+    const size_t numComponents = lanes.NumComponents();
+    float startValues[cMaxComponents], endValues[cMaxComponents];
+    bool hasStart = UnpackValue(kind, start, startValues);
+    bool hasEnd = UnpackValue(kind, end, endValues);
+    // IAttribute::Interpolate leaves the value untouched if either endpoint is of the wrong type; hold the valid one instead.
+    if (!hasStart && !hasEnd)
+        return;
+    for(size_t i = 0; i < numComponents; ++i)
+    {
+        lanes.start[i][track] = hasStart ? startValues[i] : endValues[i];
+        lanes.end[i][track] = hasEnd ? endValues[i] : startValues[i];
+    }
+}
+
+void AttributeInterpolationTracks::Evaluate()
+{
+    for(int kind = 0; kind < NumKinds; ++kind)
+    {
+        Lanes &lanes = lanes_[kind];
+        const size_t count = lanes.Size();
+        if (!count)
+            continue;
+        const float *t = &lanes.t[0];
+        for(size_t i = 0; i < lanes.numLerp; ++i)
+            LerpLanes(&lanes.start[i][0], &lanes.end[i][0], t, &lanes.result[i][0], count);
+        if (lanes.slerp)
+        {
+            const size_t q = lanes.numLerp;
+            const float *start[4] = { &lanes.start[q][0], &lanes.start[q + 1][0], &lanes.start[q + 2][0], &lanes.start[q + 3][0] };
+            const float *end[4] = { &lanes.end[q][0], &lanes.end[q + 1][0], &lanes.end[q + 2][0], &lanes.end[q + 3][0] };
+            float *result[4] = { &lanes.result[q][0], &lanes.result[q + 1][0], &lanes.result[q + 2][0], &lanes.result[q + 3][0] };
+            SlerpLanes(start, end, t, result, count);
+        }
+    }
+}
+
+void AttributeInterpolationTracks::Apply(Kind kind, size_t track, IAttribute *dest, AttributeChange::Type change) const
+{
+    const Lanes &lanes = lanes_[kind];
+    const std::vector<float> *r = lanes.result;
+    // The kind was determined from the type ID of the destination, so the casts are safe.
+    switch(kind)
+    {
+    case KindFloat:
+        static_cast<Attribute<float> *>(dest)->Set(r[0][track], change);
+        break;
+    case KindFloat3:
+        static_cast<Attribute<float3> *>(dest)->Set(float3(r[0][track], r[1][track], r[2][track]), change);
+        break;
+    case KindQuat:
+        static_cast<Attribute<Quat> *>(dest)->Set(Quat(r[0][track], r[1][track], r[2][track], r[3][track]), change);
+        break;
+    case KindColor:
+        static_cast<Attribute<Color> *>(dest)->Set(Color(r[0][track], r[1][track], r[2][track], r[3][track]), change);
+        break;
+    case KindTransform:
+    {
+        Transform tm;
+        tm.pos = float3(r[0][track], r[1][track], r[2][track]);
+        tm.scale = float3(r[3][track], r[4][track], r[5][track]);
+        tm.SetOrientation(Quat(r[6][track], r[7][track], r[8][track], r[9][track]));
+        static_cast<Attribute<Transform> *>(dest)->Set(tm, change);
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+void AttributeInterpolationTracks::Clear()
+{
+    for(int kind = 0; kind < NumKinds; ++kind)
+    {
+        Lanes &lanes = lanes_[kind];
+        for(size_t i = 0; i < cMaxComponents; ++i)
+        {
+            lanes.start[i].clear();
+            lanes.end[i].clear();
+            lanes.result[i].clear();
+        }
+        lanes.t.clear();
+        lanes.owners.clear();
+    }
+}
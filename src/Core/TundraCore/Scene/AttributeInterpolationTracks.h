@@ -0,0 +1,84 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#pragma once
+
+#include "TundraCoreApi.h"
+#include "SceneFwd.h"
+#include "AttributeChangeType.h"
+
+#include <vector>
+
+/// Typed attribute interpolation tracks of a scene, in structure-of-arrays layout.
+/** Scene keeps a track for each running interpolation of a float, float3, Quat, Color or Transform attribute.
+    The start and end values of the current segment of each track are unpacked into one array per value component
+    when the segment begins, and Evaluate interpolates all the tracks of a type at once, four at a time with SSE when
+    enabled in the math library. The values are then written to the destination attributes with Apply. Attributes of
+    other types are interpolated with IAttribute::Interpolate by the scene. */
+class TUNDRACORE_API AttributeInterpolationTracks
+{
+public:
+    AttributeInterpolationTracks();
+
+    /// Value type of a track.
+    enum Kind
+    {
+        KindGeneric = -1, ///< Not interpolated by the tracks.
+        KindFloat = 0,
+        KindFloat3,
+        KindQuat,
+        KindColor,
+        KindTransform,
+        NumKinds
+    };
+
+    /// Owner index of no interpolation, returned by Remove when no track was moved.
+    static const size_t cNoOwner = (size_t)-1;
+
+    /// Returns the kind of track for the attribute, or KindGeneric.
+    static Kind KindOf(const IAttribute *attribute);
+
+    /// Adds a track of the kind for the scene interpolation of the owner index. Returns the index of the track.
+    size_t Add(Kind kind, size_t owner);
+    /// Removes the track by moving the last track of the kind into its place.
+    /** @return The owner index of the moved track, which now has the index of the removed track, or cNoOwner. */
+    size_t Remove(Kind kind, size_t track);
+    /// Changes the owner index of the track.
+    void SetOwner(Kind kind, size_t track, size_t owner) { lanes_[kind].owners[track] = owner; }
+
+    /// Unpacks the start and end values of a new segment of the track.
+    void SetSegment(Kind kind, size_t track, IAttribute *start, IAttribute *end);
+    /// Sets the interpolation factor of the track, between 0 and 1, for the next Evaluate.
+    void SetTime(Kind kind, size_t track, float t) { lanes_[kind].t[track] = t; }
+
+    /// Interpolates the values of all the tracks.
+    void Evaluate();
+    /// Sets the value of the destination attribute of the track from the last Evaluate.
+    void Apply(Kind kind, size_t track, IAttribute *dest, AttributeChange::Type change) const;
+
+    /// Removes all the tracks.
+    void Clear();
+
+private:
+    /// Maximum number of value components of a kind: position, scale and orientation of a Transform.
+    static const size_t cMaxComponents = 10;
+
+    /// Tracks of a kind. The first numLerp components are interpolated linearly, and if slerp is set, the next four
+    /// are the x, y, z and w of a quaternion interpolated spherically.
+    struct Lanes
+    {
+        Lanes() : numLerp(0), slerp(false) {}
+
+        size_t numLerp;
+        bool slerp;
+        std::vector<float> start[cMaxComponents];
+        std::vector<float> end[cMaxComponents];
+        std::vector<float> result[cMaxComponents];
+        std::vector<float> t;
+        std::vector<size_t> owners;
+
+        size_t NumComponents() const { return numLerp + (slerp ? 4 : 0); }
+        size_t Size() const { return owners.size(); }
+    };
+
+    Lanes lanes_[NumKinds];
+};
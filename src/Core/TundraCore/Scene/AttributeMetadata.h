@@ -29,6 +29,17 @@ public:
         Interpolate
     };
 
+    /// Wire encoding of the attribute's value in scene replication.
+    enum QuantizationMode
+    {
+        NoQuantization, ///< Full precision.
+        QuantizeRange, ///< Each element is clamped to [quantizationMin, quantizationMax] and sent with quantizationBits bits. For real, float2, float3, float4, Color and Quat.
+        QuantizeAngle, ///< Each element is an angle in degrees, wrapped to [0, 360) and sent with quantizationBits bits. For real, float2 and float3.
+        QuantizeNormal, ///< The value is a unit direction vector sent with quantizationBits bits in total. For float2 and float3.
+        QuantizeHalf, ///< Each element is sent as a 16-bit half-precision float. quantizationBits is not used. For real, float2, float3, float4, Color and Quat.
+        QuantizeRotation ///< The value is a rotation sent with the smallest three encoding, 2 + 3 * quantizationBits bits in total. For Quat.
+    };
+
     /// Contains all information needed to create QPushButtons to ECEditor.
     struct ButtonInfo
     {
@@ -59,7 +70,16 @@ public:
     typedef std::map<int, QString> EnumDescMap_t;
 
     /// Default constructor.
-    AttributeMetadata() : interpolation(None), designable(true) {}
+    AttributeMetadata() :
+        interpolation(None),
+        designable(true),
+        quantization(NoQuantization),
+        quantizationBits(0),
+        quantizationMin(0.f),
+        quantizationMax(1.f),
+        latestValueOnly(false)
+    {
+    }
 
     /// Constructor.
     /** @param desc Description.
@@ -77,7 +97,12 @@ public:
         step(step_),
         enums(enum_desc),
         interpolation(interpolation_),
-        designable(designable_)
+        designable(designable_),
+        quantization(NoQuantization),
+        quantizationBits(0),
+        quantizationMin(0.f),
+        quantizationMax(1.f),
+        latestValueOnly(false)
     {
     }
 
@@ -111,6 +136,39 @@ public:
     /// Indicates if Attribute should be shown in designer/editor ui.
     bool designable;
 
+    /// Sets the quantization hint used when the attribute's value is replicated.
+    /** @param mode Quantization mode.
+        @param numBits Number of bits per element, in total for QuantizeNormal, or per sent component for QuantizeRotation.
+        @param min_ Smallest value of an element, used by QuantizeRange.
+        @param max_ Largest value of an element, used by QuantizeRange. */
+    void SetQuantization(QuantizationMode mode, int numBits, float min_ = 0.f, float max_ = 1.f)
+    {
+        quantization = mode;
+        quantizationBits = numBits;
+        quantizationMin = min_;
+        quantizationMax = max_;
+    }
+
+    /// Quantization mode for replication. Lossy: the receiver gets the value at the precision the hint allows.
+    /** @note The server and the client must use the same hint, so it should be set in the component's constructor. */
+    QuantizationMode quantization;
+
+    /// Number of bits per element, in total for QuantizeNormal, or per sent component for QuantizeRotation.
+    int quantizationBits;
+
+    /// Smallest value of an element for QuantizeRange.
+    float quantizationMin;
+
+    /// Largest value of an element for QuantizeRange.
+    float quantizationMax;
+
+    /// Replication hint for high-frequency transient attributes, of which only the latest value matters.
+    /** The server sends the changes of the attribute to clients unreliably, and a lost change is superseded by the next one.
+        When the attribute stops changing, its final value is sent reliably. Use f.ex. for animation phases or aim directions
+        that change on most network ticks.
+        @note The server and the client must use the same hint, so it should be set in the component's constructor. */
+    bool latestValueOnly;
+
 private:
     AttributeMetadata(const AttributeMetadata &);
     void operator=(const AttributeMetadata &);
@@ -8,6 +8,7 @@
 
 #include "Entity.h"
 #include "LoggingFunctions.h"
+#include "CoreStringUtils.h"
 #include "Scene/Scene.h"
 
 #include <QScriptEngine>
@@ -114,10 +115,7 @@ void EC_DynamicComponent::DeserializeCommon(std::vector<DeserializeData>& deseri
         // Attribute has already created and we only need to update it's value.
         if((*iter1)->Id() == (*iter2).id_)
         {
-            //SetAttribute(QString::fromStdString(iter2->name_), QString::fromStdString(iter2->value_), change);
-            for(AttributeVector::const_iterator attr_iter = attributes.begin(); attr_iter != attributes.end(); ++attr_iter)
-                if((*attr_iter)->Id() == iter2->id_)
-                    (*attr_iter)->FromString(iter2->value_, change);
+            (*iter1)->FromString(iter2->value_, change);
 
             ++iter2;
             ++iter1;
@@ -154,8 +152,9 @@ void EC_DynamicComponent::DeserializeCommon(std::vector<DeserializeData>& deseri
 
 IAttribute *EC_DynamicComponent::CreateAttribute(const QString &typeName, const QString &id, AttributeChange::Type change)
 {
-    if (ContainsAttribute(id))
-        return IComponent::AttributeById(id);
+    IAttribute *existing = IndexedAttribute(id);
+    if (existing)
+        return existing;
 
     IAttribute *attribute = SceneAPI::CreateAttribute(typeName, id);
     if (!attribute)
@@ -177,12 +176,9 @@ IAttribute *EC_DynamicComponent::CreateAttribute(const QString &typeName, const
 
 void EC_DynamicComponent::RemoveAttribute(const QString &id, AttributeChange::Type change)
 {
-    for(AttributeVector::const_iterator iter = attributes.begin(); iter != attributes.end(); ++iter)
-        if(*iter && (*iter)->Id().compare(id, Qt::CaseInsensitive) == 0)
-        {
-            IComponent::RemoveAttribute((*iter)->Index(), change);
-            break;
-        }
+    IAttribute *attr = IndexedAttribute(id);
+    if (attr)
+        IComponent::RemoveAttribute(attr->Index(), change);
 }
 
 void EC_DynamicComponent::RemoveAllAttributes(AttributeChange::Type change)
@@ -192,6 +188,7 @@ void EC_DynamicComponent::RemoveAllAttributes(AttributeChange::Type change)
             IComponent::RemoveAttribute((*iter)->Index(), change);
 
     attributes.clear();
+    attributeIndex_.clear();
 }
 
 int EC_DynamicComponent::GetInternalAttributeIndex(int index) const
@@ -215,11 +212,7 @@ void EC_DynamicComponent::AddQVariantAttribute(const QString &id, AttributeChang
     LogWarning("EC_DynamicComponent::AddQVariantAttribute is deprecated and will be removed. Use CreateAttribute(\"QVariant\",...) instead.");
     //Check if the attribute has already been created.
     if(!ContainsAttribute(id))
-    {
-        Attribute<QVariant> *attribute = new Attribute<QVariant>(this, id.toStdString().c_str());
-        EmitAttributeChanged(attribute, change);
-        emit AttributeAdded(attribute);
-    }
+        CreateAttribute("QVariant", id, change);
     else
         LogWarning("Failed to add a new QVariant with ID " + id + ", because there already is an attribute with that ID.");
 }
@@ -235,7 +228,8 @@ QVariant EC_DynamicComponent::GetAttribute(int index) const
 
 QVariant EC_DynamicComponent::GetAttribute(const QString &id) const
 {
-    return IComponent::GetAttributeQVariant(id);
+    IAttribute *attr = IndexedAttribute(id);
+    return attr ? attr->ToQVariant() : QVariant();
 }
 
 void EC_DynamicComponent::SetAttribute(int index, const QVariant &value, AttributeChange::Type change)
@@ -253,18 +247,41 @@ void EC_DynamicComponent::SetAttribute(int index, const QVariant &value, Attribu
 void EC_DynamicComponent::SetAttributeQScript(const QString &id, const QScriptValue &value, AttributeChange::Type change)
 {
     LogWarning("EC_DynamicComponent::SetAttributeQScript is deprecated and will be removed. Use SetAttribute instead.");
-    IAttribute* attr = AttributeById(id);
+    IAttribute* attr = IndexedAttribute(id);
     if (attr)
         attr->FromScriptValue(value, change);
 }
 
 void EC_DynamicComponent::SetAttribute(const QString &id, const QVariant &value, AttributeChange::Type change)
 {
-    IAttribute* attr = AttributeById(id);
+    IAttribute* attr = IndexedAttribute(id);
     if (attr)
         attr->FromQVariant(value, change);
 }
 
+int EC_DynamicComponent::AttributeHandle(const QString &id) const
+{
+    IAttribute *attr = IndexedAttribute(id);
+    return attr ? (int)attr->Index() : -1;
+}
+
+QVariant EC_DynamicComponent::GetAttributeByHandle(int handle) const
+{
+    if (handle < 0 || handle >= (int)attributes.size() || !attributes[handle])
+        return QVariant();
+    return attributes[handle]->ToQVariant();
+}
+
+void EC_DynamicComponent::SetAttributeByHandle(int handle, const QVariant &value, AttributeChange::Type change)
+{
+    if (handle < 0 || handle >= (int)attributes.size() || !attributes[handle])
+    {
+        LogWarning("Cannot set attribute, invalid handle " + QString::number(handle));
+        return;
+    }
+    attributes[handle]->FromQVariant(value, change);
+}
+
 QString EC_DynamicComponent::GetAttributeName(int index) const
 {
     LogWarning("EC_DynamicComponent::GetAttributeName is deprecated and will be removed. For dynamic attributes ID is the same as name. Use GetAttributeId instead.");
@@ -344,7 +361,35 @@ bool EC_DynamicComponent::ContainSameAttributes(const EC_DynamicComponent &comp)
 
 bool EC_DynamicComponent::ContainsAttribute(const QString &id) const
 {
-    return AttributeById(id) != 0;
+    return IndexedAttribute(id) != 0;
+}
+
+IAttribute *EC_DynamicComponent::IndexedAttribute(const QString &id) const
+{
+    QHash<QString, u8>::const_iterator iter = attributeIndex_.find(id.toLower());
+    return iter != attributeIndex_.end() && iter.value() < attributes.size() ? attributes[iter.value()] : 0;
+}
+
+void EC_DynamicComponent::DynamicAttributeAdded(IAttribute *attr)
+{
+    attributeIndex_[attr->Id().toLower()] = attr->Index();
+}
+
+void EC_DynamicComponent::DynamicAttributeRemoved(IAttribute *attr)
+{
+    // Keep the entry if it has been taken over by another attribute of the same ID
+    QHash<QString, u8>::iterator iter = attributeIndex_.find(attr->Id().toLower());
+    if (iter != attributeIndex_.end() && iter.value() == attr->Index())
+        attributeIndex_.erase(iter);
+}
+
+size_t EC_DynamicComponent::MemoryUsage() const
+{
+    // Approximate a hash node as two pointers, the hash value and the key-value pair
+    size_t bytes = IComponent::MemoryUsage() + attributeIndex_.capacity() * sizeof(void *);
+    for(QHash<QString, u8>::const_iterator iter = attributeIndex_.begin(); iter != attributeIndex_.end(); ++iter)
+        bytes += 2 * sizeof(void *) + sizeof(uint) + sizeof(QString) + sizeof(u8) + StringMemoryUsage(iter.key());
+    return bytes;
 }
 
 void EC_DynamicComponent::SerializeToBinary(kNet::DataSerializer& dest) const
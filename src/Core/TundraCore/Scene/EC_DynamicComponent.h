@@ -7,6 +7,7 @@
 #include "IAttribute.h"
 
 #include <QVariant>
+#include <QHash>
 
 namespace kNet
 {
@@ -30,6 +31,10 @@ struct DeserializeData;
 
     Use CreateAttribute for creating new attributes.
 
+    The attributes are indexed by their IDs, so the ID lookups do not depend on the number of attributes. To access
+    the same attribute repeatedly, f.ex. each frame, resolve its handle once with AttributeHandle and use
+    GetAttributeByHandle and SetAttributeByHandle, which skip the ID lookup altogether.
+
     When component is deserialized it will compare old and a new attribute values and will get difference
     between those two and use that information to remove attributes that are not in the new list and add those
     that are only in new list and only update those values that are same in both lists.
@@ -44,6 +49,9 @@ struct DeserializeData;
     <li>"GetAttribute": @copydoc GetAttribute
     <li>"SetAttribute": @copydoc SetAttribute
     <li>"GetAttributeName": @copydoc GetAttributeName
+    <li>"AttributeHandle": @copydoc AttributeHandle
+    <li>"GetAttributeByHandle": @copydoc GetAttributeByHandle
+    <li>"SetAttributeByHandle": @copydoc SetAttributeByHandle
     <li>"ContainSameAttributes": @copydoc ContainSameAttributes
     <li>"RemoveAttribute": @copydoc RemoveAttribute
     <li>"ContainsAttribute": @copydoc ContainsAttribute
@@ -78,6 +86,9 @@ public:
     /// IComponent override
     virtual void DeserializeFromBinary(kNet::DataDeserializer& source, AttributeChange::Type change);
 
+    /// IComponent override. Includes the attribute ID index.
+    virtual size_t MemoryUsage() const;
+
 public slots:
     /// IComponent override
     virtual bool SupportsDynamicAttributes() const { return true; }
@@ -115,6 +126,22 @@ public slots:
     /** @param index Index of the attribute. */
     QString GetAttributeId(int index) const;
 
+    /// Returns a handle to the attribute, for accessing it repeatedly without looking up its ID.
+    /** The handle stays valid until the attribute is removed. After that it may refer to an attribute created later.
+        @param id ID of the attribute, case-insensitive.
+        @return The handle, or -1 if there is no such attribute. */
+    int AttributeHandle(const QString &id) const;
+
+    /// Get attribute value as QVariant by a handle returned by AttributeHandle.
+    /** @return Return attribute value as QVariant if the handle is valid, else return null QVariant. */
+    QVariant GetAttributeByHandle(int handle) const;
+
+    /// Inserts new attribute value to the attribute of a handle returned by AttributeHandle.
+    /** @param handle Handle of the attribute.
+        @param value Value of the attribute.
+        @param change Change type. */
+    void SetAttributeByHandle(int handle, const QVariant &value, AttributeChange::Type change = AttributeChange::Default);
+
     /// Checks if a given component @c comp is holding exactly same attributes as this component.
     /** @param comp Component to be compared with.
         @return Return true if component is holding same attributes as this component else return false. */
@@ -143,4 +170,13 @@ private:
     void DeserializeCommon(std::vector<DeserializeData>& deserializedAttributes, AttributeChange::Type change);
     /// Convert attribute index without holes (used by client) into actual attribute index. Returns below zero if not found. Requires a linear search.
     int GetInternalAttributeIndex(int index) const;
+    /// Returns the attribute of the ID from the attribute ID index, or null.
+    IAttribute *IndexedAttribute(const QString &id) const;
+
+    /// IComponent override. Adds the attribute to the attribute ID index.
+    virtual void DynamicAttributeAdded(IAttribute *attr);
+    /// IComponent override. Removes the attribute from the attribute ID index.
+    virtual void DynamicAttributeRemoved(IAttribute *attr);
+
+    QHash<QString, u8> attributeIndex_; ///< Indices of the attributes by their lowercase IDs.
 };
@@ -13,6 +13,7 @@
 #include "CoreStringUtils.h"
 #include "LoggingFunctions.h"
 #include "Profiler.h"
+#include "HighPerfClock.h"
 
 #include <QDomDocument>
 
@@ -485,8 +486,21 @@ void Entity::SerializeToXML(QDomDocument &doc, QDomElement &base_element, bool s
     if (serializeTemporary)
         entity_elem.setAttribute("temporary", BoolToString(IsTemporary()));
 
+    // Write only the overrides of an instance, unless its prototype is not saved along with it
+    EntityPtr prototype = Prototype();
+    if (prototype && ((prototype->IsTemporary() && !serializeTemporary) || (prototype->IsLocal() && !IsLocal())))
+        prototype.reset();
+    if (prototype)
+        entity_elem.setAttribute("prototype", QString::number(prototype->Id()));
+
     for (ComponentMap::const_iterator i = components_.begin(); i != components_.end(); ++i)
-        i->second->SerializeTo(doc, entity_elem, serializeTemporary);
+    {
+        ComponentPtr prototypeComp = prototype ? prototype->Component(i->second->TypeId(), i->second->Name()) : ComponentPtr();
+        if (prototypeComp)
+            i->second->SerializeOverridesTo(doc, entity_elem, prototypeComp.get(), serializeTemporary);
+        else
+            i->second->SerializeTo(doc, entity_elem, serializeTemporary);
+    }
 
     // Serialize child entities
     if (serializeChildren)
@@ -547,6 +561,10 @@ EntityPtr Entity::Clone(bool local, bool temporary, const QString &cloneName, At
     entityElem.setAttribute("id", local ? scene_->NextFreeIdLocal() : scene_->NextFreeId());
     // Set the temporary status in advance so it's valid when Scene::CreateContentFromXml signals changes in the scene
     entityElem.setAttribute("temporary", BoolToString(temporary));
+    // The clone of an instance is an instance of the same prototype
+    EntityPtr prototype = Prototype();
+    if (prototype)
+        entityElem.setAttribute("prototype", QString::number(prototype->Id()));
     // Setting of a new name for the clone is a bit clumsy, but this is the best way to do it currently.
     const bool setNameForClone = !cloneName.isEmpty();
     bool cloneNameWritten = false;
@@ -576,6 +594,35 @@ EntityPtr Entity::Clone(bool local, bool temporary, const QString &cloneName, At
     return (!newEntities.isEmpty() && newEntities.first() ? newEntities.first()->shared_from_this() : EntityPtr());
 }
 
+EntityPtr Entity::Instantiate(bool local, bool temporary, const QString &instanceName, AttributeChange::Type changeType) const
+{
+    // The instance is created from XML that only refers to this entity, and Scene::CreateContentFromXml copies the components.
+    QDomDocument doc("Scene");
+    QDomElement sceneElem = doc.createElement("scene");
+    QDomElement entityElem = doc.createElement("entity");
+    entityElem.setAttribute("sync", BoolToString(!local));
+    entityElem.setAttribute("id", local ? scene_->NextFreeIdLocal() : scene_->NextFreeId());
+    entityElem.setAttribute("temporary", BoolToString(temporary));
+    entityElem.setAttribute("prototype", QString::number(Id()));
+    if (!instanceName.isEmpty())
+    {
+        QDomElement nameCompElem = doc.createElement("component");
+        nameCompElem.setAttribute("type", EC_Name::TypeNameStatic());
+        nameCompElem.setAttribute("typeId", QString::number(EC_Name::ComponentTypeId));
+        QDomElement nameAttrElem = doc.createElement("attribute");
+        nameAttrElem.setAttribute("id", "name");
+        nameAttrElem.setAttribute("value", instanceName);
+        nameCompElem.appendChild(nameAttrElem);
+        entityElem.appendChild(nameCompElem);
+    }
+
+    sceneElem.appendChild(entityElem);
+    doc.appendChild(sceneElem);
+
+    QList<Entity *> newEntities = scene_->CreateContentFromXml(doc, true, changeType);
+    return (!newEntities.isEmpty() && newEntities.first() ? newEntities.first()->shared_from_this() : EntityPtr());
+}
+
 void Entity::SetName(const QString &name)
 {
     shared_ptr<EC_Name> comp = GetOrCreateComponent<EC_Name>();
@@ -616,22 +663,43 @@ QString Entity::Group() const
 
 EntityAction *Entity::Action(const QString &name)
 {
-    foreach(EntityAction *action, actions_)
-        if (action->Name().compare(name, Qt::CaseInsensitive) == 0)
-            return action;
+    // The actions of the names that did not fit in the interned names have id 0, and are found by name only.
+    const EntityAction::ActionId actionId = EntityAction::InternId(name);
+    EntityAction *action = actionId != 0 ? actionsById_.value(actionId, 0) : actions_.value(name, 0);
+    if (action)
+        return action;
 
-    EntityAction *action = new EntityAction(name);
+    action = new EntityAction(name, actionId);
     actions_.insert(name, action);
+    if (actionId != 0)
+        actionsById_.insert(actionId, action);
+    return action;
+}
+
+EntityAction *Entity::ActionById(EntityAction::ActionId actionId)
+{
+    EntityAction *action = actionsById_.value(actionId, 0);
+    if (action)
+        return action;
+
+    const QString name = EntityAction::NameOf(actionId);
+    if (name.isEmpty())
+        return 0;
+    action = new EntityAction(name, actionId);
+    actions_.insert(name, action);
+    actionsById_.insert(actionId, action);
     return action;
 }
 
 void Entity::RemoveAction(const QString &name)
 {
-    ActionMap::iterator iter = actions_.find(name);
-    if (iter != actions_.end())
+    const EntityAction::ActionId actionId = EntityAction::FindId(name);
+    EntityAction *action = actionId != 0 ? actionsById_.value(actionId, 0) : actions_.value(name, 0);
+    if (action)
     {
-        (*iter)->deleteLater();
-        actions_.erase(iter);
+        actions_.remove(action->Name());
+        actionsById_.remove(action->Id());
+        action->deleteLater();
     }
 }
 
@@ -642,40 +710,91 @@ void Entity::ConnectAction(const QString &name, const QObject *receiver, const c
     connect(action, SIGNAL(Triggered(QString, QString, QString, QStringList)), receiver, member, Qt::UniqueConnection);
 }
 
+void Entity::ConnectTypedAction(const QString &name, const QObject *receiver, const char *member)
+{
+    EntityAction *action = Action(name);
+    assert(action);
+    connect(action, SIGNAL(TriggeredVariants(QVariantList)), receiver, member, Qt::UniqueConnection);
+}
+
 void Entity::Exec(EntityAction::ExecTypeField type, const QString &action, const QString &p1, const QString &p2, const QString &p3)
 {
     Exec(type, action, QStringList(QStringList() << p1 << p2 << p3));
 }
 
 void Entity::Exec(EntityAction::ExecTypeField type, const QString &action, const QStringList &params)
+{
+    // Create the action with the name as spelled here, if it does not exist yet.
+    ExecAction(type, Action(action), params);
+}
+
+void Entity::Exec(EntityAction::ExecTypeField type, const QString &action, const QVariantList &params)
+{
+    ExecAction(type, Action(action), params);
+}
+
+void Entity::Exec(EntityAction::ExecTypeField type, EntityAction::ActionId actionId, const QStringList &params)
+{
+    EntityAction *act = ActionById(actionId);
+    if (act)
+        ExecAction(type, act, params);
+    else
+        LogWarning("Entity::Exec: Invalid action ID " + QString::number(actionId) + ".");
+}
+
+void Entity::Exec(EntityAction::ExecTypeField type, EntityAction::ActionId actionId, const QVariantList &params)
+{
+    EntityAction *act = ActionById(actionId);
+    if (act)
+        ExecAction(type, act, params);
+    else
+        LogWarning("Entity::Exec: Invalid action ID " + QString::number(actionId) + ".");
+}
+
+void Entity::ExecAction(EntityAction::ExecTypeField type, EntityAction *act, const QStringList &params)
 {
     PROFILE(Entity_ExecEntityAction);
-    
-    EntityAction *act = Action(action);
+
+#ifdef PROFILING
+    const tick_t start = GetCurrentClockTime();
+#endif
+
     if ((type & EntityAction::Local) != 0)
-    {
-        if (params.size() == 0)
-            act->Trigger();
-        else if (params.size() == 1)
-            act->Trigger(params[0]);
-        else if (params.size() == 2)
-            act->Trigger(params[0], params[1]);
-        else if (params.size() == 3)
-            act->Trigger(params[0], params[1], params[2]);
-        else if (params.size() >= 4)
-            act->Trigger(params[0], params[1], params[2], params.mid(3));
-    }
+        act->Trigger(params);
 
     if (ParentScene())
-        ParentScene()->EmitActionTriggered(this, action, params, type);
+        ParentScene()->EmitActionTriggered(this, act->Name(), params, type);
+
+#ifdef PROFILING
+    static const double clockFreq = (double)GetCurrentClockFreq();
+    EntityAction::AddInvocation(act->Id(), (double)(GetCurrentClockTime() - start) / clockFreq);
+#endif
 }
 
-void Entity::Exec(EntityAction::ExecTypeField type, const QString &action, const QVariantList &params)
+void Entity::ExecAction(EntityAction::ExecTypeField type, EntityAction *act, const QVariantList &params)
 {
-    QStringList stringParams;
-    foreach(QVariant var, params)
-        stringParams << var.toString();
-    Exec(type, action, stringParams);
+    PROFILE(Entity_ExecEntityAction);
+
+#ifdef PROFILING
+    const tick_t start = GetCurrentClockTime();
+#endif
+
+    if ((type & EntityAction::Local) != 0)
+        act->Trigger(params);
+
+    if (ParentScene())
+    {
+        // The scene signal, through which the action is sent to network, carries the parameters as strings.
+        QStringList stringParams;
+        for(int i = 0; i < params.size(); ++i)
+            stringParams << params[i].toString();
+        ParentScene()->EmitActionTriggered(this, act->Name(), stringParams, type);
+    }
+
+#ifdef PROFILING
+    static const double clockFreq = (double)GetCurrentClockFreq();
+    EntityAction::AddInvocation(act->Id(), (double)(GetCurrentClockTime() - start) / clockFreq);
+#endif
 }
 
 void Entity::EmitEntityRemoved(AttributeChange::Type change)
@@ -867,6 +986,58 @@ EntityPtr Entity::CreateLocalChild(const QStringList &components, AttributeChang
     return child;
 }
 
+size_t Entity::MemoryUsage() const
+{
+    // Approximate a map node as four pointers and the value
+    size_t bytes = sizeof(Entity) + children_.capacity() * sizeof(EntityWeakPtr);
+    for(ComponentMap::const_iterator i = components_.begin(); i != components_.end(); ++i)
+        bytes += 4 * sizeof(void *) + sizeof(ComponentMap::value_type) + i->second->MemoryUsage();
+    for(ActionMap::const_iterator i = actions_.begin(); i != actions_.end(); ++i)
+        bytes += 4 * sizeof(void *) + sizeof(QString) + sizeof(EntityAction *) + StringMemoryUsage(i.key()) + sizeof(EntityAction);
+    // Approximate a hash node as two pointers and the value
+    bytes += actionsById_.size() * (2 * sizeof(void *) + sizeof(EntityAction::ActionId) + sizeof(EntityAction *));
+    return bytes;
+}
+
+ComponentPtr Entity::PrototypeComponent(const IComponent *component) const
+{
+    EntityPtr prototype = prototype_.lock();
+    return (prototype && component) ? prototype->Component(component->TypeId(), component->Name()) : ComponentPtr();
+}
+
+void Entity::SetPrototype(EntityPtr prototype)
+{
+    if (prototype.get() == this)
+    {
+        LogError("Entity::SetPrototype: " + ToString() + " can not be its own prototype.");
+        return;
+    }
+    if (prototype && prototype->ParentScene() != scene_)
+    {
+        LogError("Entity::SetPrototype: the prototype of " + ToString() + " must be in the same scene.");
+        return;
+    }
+    prototype_ = prototype;
+}
+
+void Entity::CopyPrototypeComponents()
+{
+    EntityPtr prototype = prototype_.lock();
+    if (!prototype)
+        return;
+
+    const ComponentMap &components = prototype->Components();
+    for(ComponentMap::const_iterator i = components.begin(); i != components.end(); ++i)
+    {
+        const IComponent *source = i->second.get();
+        ComponentPtr comp = GetOrCreateComponent(source->TypeId(), source->Name(), AttributeChange::Default, source->IsReplicated());
+        if (!comp)
+            continue;
+        comp->SetTemporary(source->IsTemporary());
+        comp->CopyAttributesFrom(source, AttributeChange::Disconnected);
+    }
+}
+
 EntityPtr Entity::Child(size_t index) const
 {
     return index < children_.size() ? children_[index].lock() : EntityPtr();
@@ -14,6 +14,7 @@
 
 #include <QObject>
 #include <QMap>
+#include <QHash>
 
 class QDomDocument;
 class QDomElement;
@@ -57,6 +58,7 @@ class TUNDRACORE_API Entity : public QObject, public enable_shared_from_this<Ent
     Q_PROPERTY(bool temporary READ IsTemporary WRITE SetTemporary) /**< @copydoc IsTemporary */
     Q_PROPERTY(ComponentMap components READ Components) /**< @copydoc Components */
     Q_PROPERTY(EntityPtr parent READ Parent WRITE SetParent); /**< @copydoc Parent */
+    Q_PROPERTY(EntityPtr prototype READ Prototype WRITE SetPrototype) /**< @copydoc Prototype */
 
 public:
     typedef std::map<component_id_t, ComponentPtr> ComponentMap; ///< Component container.
@@ -144,6 +146,30 @@ public:
         @param member Member slot. */
     void ConnectAction(const QString &name, const QObject *receiver, const char *member);
 
+    /// Connects action with a specific name to a receiver object with member slot that takes the parameters as variants.
+    /** The slot has the signature of EntityAction::TriggeredVariants, e.g. SLOT(OnAction(QVariantList)).
+        The parameters given to the typed Exec reach the slot as they are, without string conversions.
+        @param name Name of the action.
+        @param receiver Receiver object.
+        @param member Member slot. */
+    void ConnectTypedAction(const QString &name, const QObject *receiver, const char *member);
+
+    /// Returns the action of the interned id, creating it if it does not exist yet.
+    /** @param actionId Interned id of the action name, see EntityAction::InternId.
+        @return The action, or null if the id is not valid.
+        @note Never store the returned pointer. */
+    EntityAction *ActionById(EntityAction::ActionId actionId);
+
+    /// Executes the action of the interned id, without looking it up by name.
+    /** @param type Execution type(s), i.e. where the actions is executed.
+        @param actionId Interned id of the action name, see EntityAction::InternId.
+        @param params List of parameters for the action. */
+    void Exec(EntityAction::ExecTypeField type, EntityAction::ActionId actionId, const QStringList &params);
+    /// @overload
+    /** Passes the parameters as they are to the slots connected with ConnectTypedAction. They are converted to strings
+        for the slots connected with ConnectAction, if any, and for sending to network. */
+    void Exec(EntityAction::ExecTypeField type, EntityAction::ActionId actionId, const QVariantList &params);
+
     /// @cond PRIVATE
     /// Do not directly allocate new entities using operator new, but use the factory-based Scene::CreateEntity functions instead.
     /** @param framework Framework
@@ -164,6 +190,13 @@ public:
     template <class T> shared_ptr<T> GetComponent(const QString& name) const { return Component<T>(name); }/**< @deprecated Use Component<T>(name) instead. @todo Add deprecation warning print. @todo Remove. */
     /// @endcond
 
+    /// Returns the approximate number of bytes used by the entity and its components. Does not include the child entities.
+    size_t MemoryUsage() const;
+
+    /// Returns the component of the prototype entity that the component is an instance of, i.e. the one of the same type and name, or null.
+    /** @sa Prototype */
+    ComponentPtr PrototypeComponent(const IComponent *component) const;
+
 public slots:
     /// Returns a component by ID. This is the fastest way to query, as the components are stored in a map by id.
     ComponentPtr ComponentById(component_id_t id) const;
@@ -280,6 +313,15 @@ public slots:
         @return Pointer to the new entity, or null pointer if the cloning fails. */
     EntityPtr Clone(bool createAsLocal, bool createAsTemporary, const QString &cloneName= "", AttributeChange::Type changeType = AttributeChange::Default) const;
 
+    /// Creates an instance of the entity, i.e. a new entity that has this entity as its prototype.
+    /** The instance gets copies of the components of this entity, but not of its child entities. See Prototype.
+        @param createAsLocal If true, the new entity will be local entity. If false, the entity will be replicated.
+        @param createAsTemporary Will the new entity be temporary.
+        @param instanceName Name for the new entity. If empty, the name of this entity is inherited.
+        @param changeType Change signaling mode.
+        @return Pointer to the new entity, or null pointer if the instantiation fails. */
+    EntityPtr Instantiate(bool createAsLocal, bool createAsTemporary, const QString &instanceName = "", AttributeChange::Type changeType = AttributeChange::Default) const;
+
     /// Serializes this entity and its' components to the given XML document
     /** @param doc The XML document to serialize this entity to.
         @param base_element Points to the <scene> element of this XML document. This entity will be serialized as a child to base_element.
@@ -338,7 +380,7 @@ public slots:
     /** @param params List of parameters for the action. */
     void Exec(EntityAction::ExecTypeField type, const QString &action, const QStringList &params);
     /// @overload
-    /** Experimental overload using QVariant. Converts the variants to strings.
+    /** Experimental overload using QVariant. Converts the variants to strings, except for the slots connected with ConnectTypedAction.
         @note If called from JavaScript, syntax '<targetEntity>["Exec(EntityAction::ExecTypeField,QString,QVariantList)"](2, "name", params);' must be used. */
     void Exec(EntityAction::ExecTypeField type, const QString &action, const QVariantList &params);
 
@@ -451,6 +493,18 @@ public slots:
     /// Returns child entities. Optionally recursive
     EntityList Children(bool recursive = false) const;
 
+    /// Returns the prototype entity of this entity, or null if the entity is not an instance of a prototype.
+    /** An instance starts as a copy of the components of its prototype, see Instantiate. Only the attributes of the instance
+        that differ from those of the prototype, i.e. the overridden ones, are saved to scene XML and sent in full to the peers
+        that already have the prototype. The rest take the values of the prototype when the instance is loaded or replicated.
+        Thus changes to the prototype apply to the inherited attributes of the instances the next time they are loaded, but
+        not to the instances already in the scene. The memory of the inherited string and list values is shared with the prototype.
+        @note Components that support dynamic attributes are always saved and sent in full. */
+    EntityPtr Prototype() const { return prototype_.lock(); }
+
+    /// Sets the prototype entity of this entity. Null makes the entity a regular one. Does not change the components of the entity.
+    void SetPrototype(EntityPtr prototype);
+
     // DEPRECATED:
     /// @cond PRIVATE
     ComponentPtr GetComponentById(component_id_t id) const { return ComponentById(id); } /**< @deprecated Use ComponentById instead. @todo Add deprecation warning print. @todo Remove. */
@@ -506,16 +560,27 @@ private:
     /// Collect child entities into an entity list, optionally recursive.
     void CollectChildren(EntityList& children, bool recursive) const;
 
+    /// Triggers the action locally if the type has Local, and signals the scene of it, from where it is sent to network.
+    void ExecAction(EntityAction::ExecTypeField type, EntityAction *act, const QStringList &params);
+    /// @overload
+    void ExecAction(EntityAction::ExecTypeField type, EntityAction *act, const QVariantList &params);
+
+    /// Creates the components of the prototype entity to this entity and copies their attribute values. Called from Scene when loading an instance.
+    /** The attribute values are copied without signalling, like when creating content from XML. */
+    void CopyPrototypeComponents();
+
     UniqueIdGenerator idGenerator_; ///< Component ID generator
     ComponentMap components_; ///< a list of all components
     entity_id_t id_; ///< Unique id for this entity
     Framework* framework_; ///< Pointer to framework
     Scene* scene_; ///< Pointer to scene
     ActionMap actions_; ///< Map of registered entity actions.
+    QHash<EntityAction::ActionId, EntityAction *> actionsById_; ///< The registered entity actions by the interned ids of their names.
     bool temporary_; ///< Temporary-flag
 
     ChildEntityVector children_; ///< Child entities. Note that the entities are authoritatively owned by the scene; the child reference is weak intentionally.
     EntityWeakPtr parent_; ///< Parent entity. Note that the entities are authoritatively owned by the scene; the parent reference is weak intentionally.
+    EntityWeakPtr prototype_; ///< Prototype entity, if this entity is an instance of one.
 };
 
 #include "Entity.inl"
@@ -8,14 +8,162 @@
 #include "StableHeaders.h"
 #include "DebugOperatorNew.h"
 #include "EntityAction.h"
+#include "Profiler.h"
+#include "LoggingFunctions.h"
+
+#include <QHash>
+
+#include <vector>
+
 #include "MemoryLeakCheck.h"
 
+namespace
+{
+/// Invocations of an action since the last flush to the profiler.
+struct ActionInvocations
+{
+    ActionInvocations() : count(0), seconds(0.0) {}
+    unsigned int count;
+    double seconds;
+};
+
+/// The interned action names.
+struct ActionRegistry
+{
+    ActionRegistry() : full(false) {}
+    QHash<QString, EntityAction::ActionId> ids; ///< Ids by the names as spelled by the callers, so that the usual lookups need not lowercase the name.
+    QHash<QString, EntityAction::ActionId> lowerCaseIds; ///< Ids by the lowercase names.
+    std::vector<QString> names; ///< First spelling of the name of id n at index n - 1.
+    std::vector<ActionInvocations> invocations; ///< Invocations of id n at index n - 1.
+    std::vector<EntityAction::ActionId> invoked; ///< Ids invoked since the last flush to the profiler.
+    bool full; ///< Whether a name has gone uninterned because of cMaxInternedActionNames.
+};
+
+ActionRegistry &Registry()
+{
+    static ActionRegistry registry;
+    return registry;
+}
+}
+
+EntityAction::ActionId EntityAction::InternId(const QString &name)
+{
+    ActionRegistry &registry = Registry();
+    QHash<QString, ActionId>::const_iterator iter = registry.ids.find(name);
+    if (iter != registry.ids.end())
+        return iter.value();
+
+    const QString lowerCaseName = name.toLower();
+    ActionId actionId = registry.lowerCaseIds.value(lowerCaseName, 0);
+    if (actionId == 0)
+    {
+        if (registry.names.size() >= cMaxInternedActionNames)
+        {
+            if (!registry.full)
+                LogWarning("EntityAction::InternId: " + QString::number(cMaxInternedActionNames) + " action names interned, not interning more.");
+            registry.full = true;
+            return 0;
+        }
+        registry.names.push_back(name);
+        registry.invocations.push_back(ActionInvocations());
+        actionId = (ActionId)registry.names.size();
+        registry.lowerCaseIds.insert(lowerCaseName, actionId);
+    }
+    // The other spellings of the names are found through the lowercase names, but slower.
+    if (registry.ids.size() < 4 * (int)cMaxInternedActionNames)
+        registry.ids.insert(name, actionId);
+    return actionId;
+}
+
+EntityAction::ActionId EntityAction::FindId(const QString &name)
+{
+    const ActionRegistry &registry = Registry();
+    QHash<QString, ActionId>::const_iterator iter = registry.ids.find(name);
+    return iter != registry.ids.end() ? iter.value() : registry.lowerCaseIds.value(name.toLower(), 0);
+}
+
+QString EntityAction::NameOf(ActionId actionId)
+{
+    const ActionRegistry &registry = Registry();
+    return actionId > 0 && actionId <= registry.names.size() ? registry.names[actionId - 1] : QString();
+}
+
+void EntityAction::AddInvocation(ActionId actionId, double elapsedSeconds)
+{
+    ActionRegistry &registry = Registry();
+    if (actionId == 0 || actionId > registry.invocations.size())
+        return;
+    ActionInvocations &invocations = registry.invocations[actionId - 1];
+    if (invocations.count == 0)
+        registry.invoked.push_back(actionId);
+    ++invocations.count;
+    invocations.seconds += elapsedSeconds;
+}
+
+void EntityAction::FlushInvocations(Profiler *profiler)
+{
+    ActionRegistry &registry = Registry();
+    for(size_t i = 0; i < registry.invoked.size(); ++i)
+    {
+        ActionInvocations &invocations = registry.invocations[registry.invoked[i] - 1];
+#ifdef PROFILING
+        if (profiler)
+            profiler->AddTiming("EntityActions", registry.names[registry.invoked[i] - 1].toStdString(), invocations.seconds, invocations.count);
+#else
+        UNREFERENCED_PARAM(profiler)
+#endif
+        invocations = ActionInvocations();
+    }
+    registry.invoked.clear();
+}
+
 void EntityAction::Trigger(const QString &param1, const QString &param2, const QString &param3, const QStringList &params)
 {
     emit Triggered(param1, param2, param3, params);
 }
 
-EntityAction::EntityAction(const QString &name_)
-:name(name_)
+void EntityAction::Trigger(const QStringList &params)
+{
+    EmitTriggered(params);
+
+    if (receivers(SIGNAL(TriggeredVariants(QVariantList))) > 0)
+    {
+        QVariantList variants;
+        variants.reserve(params.size());
+        for(int i = 0; i < params.size(); ++i)
+            variants << params[i];
+        emit TriggeredVariants(variants);
+    }
+}
+
+void EntityAction::Trigger(const QVariantList &params)
+{
+    emit TriggeredVariants(params);
+
+    if (receivers(SIGNAL(Triggered(QString, QString, QString, QStringList))) > 0)
+    {
+        QStringList strings;
+        for(int i = 0; i < params.size(); ++i)
+            strings << params[i].toString();
+        EmitTriggered(strings);
+    }
+}
+
+void EntityAction::EmitTriggered(const QStringList &params)
+{
+    if (params.size() == 0)
+        Trigger();
+    else if (params.size() == 1)
+        Trigger(params[0]);
+    else if (params.size() == 2)
+        Trigger(params[0], params[1]);
+    else if (params.size() == 3)
+        Trigger(params[0], params[1], params[2]);
+    else
+        Trigger(params[0], params[1], params[2], params.mid(3));
+}
+
+EntityAction::EntityAction(const QString &name_, ActionId id_)
+:name(name_), id(id_)
 {
 }
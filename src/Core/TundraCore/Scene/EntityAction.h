@@ -10,13 +10,20 @@
 #include "CoreTypes.h"
 
 #include <QObject>
+#include <QStringList>
+#include <QVariantList>
 
 class Entity;
+class Profiler;
 
 /// Represents an executable command on an Entity.
 /** Components (and other instances) can register to these actions by using Entity::ConnectAction().
     Actions allow more complicated in-world logic to be built in slightly more data-driven fashion.
-    Actions cannot be created directly, they're created by Entity::Action(). */
+    Actions cannot be created directly, they're created by Entity::Action().
+
+    The action names are interned process-wide into ids, see InternId, so that the native code can execute and look up
+    actions by id with a hash lookup. The invocations of each action are counted and timed, and added to the profiler
+    once per frame in the "EntityActions" group. */
 class TUNDRACORE_API EntityAction : public QObject
 {
     Q_OBJECT
@@ -25,9 +32,37 @@ class TUNDRACORE_API EntityAction : public QObject
 public:
     ~EntityAction() {}
 
+    /// Interned id of an action name. The names that differ only in case have the same id. 0 is never a valid id.
+    typedef u32 ActionId;
+
     /// Returns name of the action.
     const QString &Name() const { return name; }
 
+    /// Returns the interned id of the name of the action.
+    ActionId Id() const { return id; }
+
+    /// Returns the id of the action name, case-insensitive, interning the name if it has not been seen before.
+    /** The ids are the same for the lifetime of the process, so they can be looked up once and stored. At most
+        cMaxInternedActionNames names are interned, after which the new names get 0, and their actions are looked up
+        by name only.
+        @note Not thread-safe, call only from the main thread. */
+    static ActionId InternId(const QString &name);
+
+    /// Returns the id of the action name, case-insensitive, or 0 if the name has not been interned.
+    /** Unlike InternId, never adds to the interned names, so use this for the names that come from outside, e.g. network.
+        @note Not thread-safe, call only from the main thread. */
+    static ActionId FindId(const QString &name);
+
+    /// The maximum number of interned action names, so that the names received from network cannot grow them without bound.
+    static const size_t cMaxInternedActionNames = 16384;
+
+    /// Returns the name the action id was first interned with, or an empty string if the id is not valid.
+    static QString NameOf(ActionId id);
+
+    /// Adds the invocation counts and times of the actions since the last call to the profiler, and resets them.
+    /** Called once per frame by Framework. */
+    static void FlushInvocations(Profiler *profiler);
+
     /// Execution type of the action, i.e. where the actions is executed.
     /** As combinations we get local+server, local+peers(all clients but not server),
         server+peers (everyone but me), local+server+peers (everyone).
@@ -52,12 +87,18 @@ signals:
         @param rest Rest of the parameters, if applicable. */
     void Triggered(QString p1, QString p2, QString p3, QStringList rest);
 
+    /// Emitted when action is triggered, with the parameters as they were given to Entity::Exec.
+    /** For the native handlers that take typed parameters, see Entity::ConnectTypedAction. The parameters of the actions
+        executed with strings, e.g. the ones received from network, are strings. */
+    void TriggeredVariants(QVariantList params);
+
 private:
     friend class Entity;
 
     /// Constructor.
-    /** @param name Name of the action. */
-    explicit EntityAction(const QString &name);
+    /** @param name Name of the action.
+        @param id Interned id of the name. */
+    EntityAction(const QString &name, ActionId id);
 
     /// Triggers this action i.e. emits the Triggered signal.
     /** @param p1 1st parameter for the action, if applicable.
@@ -66,5 +107,18 @@ private:
         @param rest Rest of the parameters, if applicable. */
     void Trigger(const QString &p1 = "", const QString &p2 = "", const QString &p3 = "", const QStringList &rest = QStringList());
 
+    /// Triggers this action with string parameters. Converts them to variants only if TriggeredVariants is connected.
+    void Trigger(const QStringList &params);
+
+    /// Triggers this action with typed parameters. Converts them to strings only if Triggered is connected.
+    void Trigger(const QVariantList &params);
+
+    /// Emits Triggered with the parameters split to the first three and the rest.
+    void EmitTriggered(const QStringList &params);
+
+    /// Accumulates an invocation of the action of the id for the profiler.
+    static void AddInvocation(ActionId id, double elapsedSeconds);
+
     const QString name; ///< Name of the action.
+    const ActionId id; ///< Interned id of the name.
 };
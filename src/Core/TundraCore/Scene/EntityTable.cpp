@@ -0,0 +1,133 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#include "StableHeaders.h"
+#include "DebugOperatorNew.h"
+
+#include "EntityTable.h"
+#include "Entity.h"
+#include "UniqueIdGenerator.h"
+
+#include "MemoryLeakCheck.h"
+
+namespace
+{
+/// Number of slots a range can grow to regardless of the slots it already has.
+const size_t cMinGrowSlots = 1024;
+}
+
+EntityTable::EntityTable() :
+    size_(0)
+{
+    ranges_[0].first = 0;
+    ranges_[1].first = UniqueIdGenerator::FIRST_UNACKED_ID;
+    ranges_[2].first = UniqueIdGenerator::FIRST_LOCAL_ID;
+}
+
+size_t EntityTable::RangeOf(entity_id_t id)
+{
+    if (id < UniqueIdGenerator::FIRST_UNACKED_ID)
+        return 0;
+    return id < UniqueIdGenerator::FIRST_LOCAL_ID ? 1 : 2;
+}
+
+EntityTable::iterator EntityTable::find(entity_id_t id)
+{
+    if (id == 0)
+        return end();
+    size_t rangeIndex = RangeOf(id);
+    Range &range = ranges_[rangeIndex];
+    size_t offset = id - range.first;
+    if (offset < range.slots.size())
+        return range.slots[offset].first != 0 ? iterator(this, rangeIndex, offset) : end();
+    OverflowMap::iterator it = range.overflow.find(id);
+    return it != range.overflow.end() ? iterator(this, rangeIndex, it) : end();
+}
+
+EntityTable::const_iterator EntityTable::find(entity_id_t id) const
+{
+    if (id == 0)
+        return end();
+    size_t rangeIndex = RangeOf(id);
+    const Range &range = ranges_[rangeIndex];
+    size_t offset = id - range.first;
+    if (offset < range.slots.size())
+        return range.slots[offset].first != 0 ? const_iterator(this, rangeIndex, offset) : end();
+    OverflowMap::const_iterator it = range.overflow.find(id);
+    return it != range.overflow.end() ? const_iterator(this, rangeIndex, it) : end();
+}
+
+EntityPtr &EntityTable::operator[](entity_id_t id)
+{
+    Range &range = ranges_[RangeOf(id)];
+    size_t offset = id - range.first;
+    // Grow the slots only moderately past the used ones, so that a single high ID does not allocate a huge table.
+    if (offset >= range.slots.size() && offset < 2 * range.slots.size() + cMinGrowSlots)
+        Grow(range, offset);
+
+    value_type &slot = offset < range.slots.size() ? range.slots[offset] : range.overflow[id];
+    if (slot.first == 0)
+    {
+        slot.first = id;
+        ++size_;
+    }
+    return slot.second;
+}
+
+size_t EntityTable::erase(entity_id_t id)
+{
+    iterator it = find(id);
+    if (it == end())
+        return 0;
+    erase(it);
+    return 1;
+}
+
+void EntityTable::erase(iterator it)
+{
+    Range &range = ranges_[it.range_];
+    if (it.slot_ == cOverflowSlot)
+        range.overflow.erase(it.overflow_);
+    else
+    {
+        range.slots[it.slot_] = value_type();
+        // Drop the unused slots at the end, so that the overflow IDs stay beyond the slots and iteration in order.
+        while(!range.slots.empty() && range.slots.back().first == 0)
+            range.slots.pop_back();
+    }
+    --size_;
+}
+
+void EntityTable::clear()
+{
+    for(size_t i = 0; i < cNumRanges; ++i)
+    {
+        std::vector<value_type>().swap(ranges_[i].slots);
+        ranges_[i].overflow.clear();
+    }
+    size_ = 0;
+}
+
+void EntityTable::Reserve(entity_id_t first, size_t count)
+{
+    if (first == 0 || count == 0)
+        return;
+    Range &range = ranges_[RangeOf(first)];
+    size_t offset = first - range.first;
+    // Same limit as in operator [], beyond which the IDs go to the overflow map
+    if (offset < 2 * range.slots.size() + cMinGrowSlots && offset + count > range.slots.size())
+        Grow(range, offset + count - 1);
+}
+
+void EntityTable::Grow(Range &range, size_t offset)
+{
+    if (offset >= range.slots.capacity())
+        range.slots.reserve(offset + 1 > 2 * range.slots.capacity() ? offset + 1 : 2 * range.slots.capacity());
+    range.slots.resize(offset + 1);
+
+    while(!range.overflow.empty() && range.overflow.begin()->first - range.first < range.slots.size())
+    {
+        OverflowMap::iterator it = range.overflow.begin();
+        range.slots[it->first - range.first] = it->second;
+        range.overflow.erase(it);
+    }
+}
@@ -0,0 +1,182 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#pragma once
+
+#include "TundraCoreApi.h"
+#include "SceneFwd.h"
+#include "CoreTypes.h"
+
+#include <cstddef>
+#include <iterator>
+#include <map>
+#include <utility>
+#include <vector>
+
+/// Entities of a scene by their IDs, in a table indexed directly by the ID.
+/** The ID space of UniqueIdGenerator is split into the replicated, unacked and local ranges, and each range keeps its
+    entities in a vector of slots indexed by the offset of the ID from the start of the range. As the IDs are allocated
+    in order, the slots are dense, and lookup by ID is O(1) and iteration linear in memory. An ID far beyond the slots of
+    its range, e.g. a manually given one, is kept in an ordered overflow map of the range until the slots grow to it.
+
+    The interface is a subset of std::map: the elements are ID-entity pairs, and iteration is in ascending ID order.
+    Inserting may invalidate all iterators, erasing invalidates only the iterators to the erased element. */
+class TUNDRACORE_API EntityTable
+{
+public:
+    typedef std::pair<entity_id_t, EntityPtr> value_type;
+    typedef entity_id_t key_type;
+    typedef EntityPtr mapped_type;
+    typedef size_t size_type;
+
+private:
+    typedef std::map<entity_id_t, value_type> OverflowMap;
+
+    /// A range of the ID space.
+    struct Range
+    {
+        Range() : first(0) {}
+
+        entity_id_t first; ///< First ID of the range.
+        std::vector<value_type> slots; ///< Entities by ID offset from first. The ID of an unused slot is 0.
+        OverflowMap overflow; ///< Entities with IDs beyond the slots.
+    };
+
+    static const size_t cNumRanges = 3;
+    static const size_t cOverflowSlot = (size_t)-1; ///< Slot index of an iterator in the overflow map of its range.
+
+public:
+    /// Forward iterator over the entities of the table.
+    template <typename TableType, typename ValueType, typename OverflowIterator>
+    class IteratorBase
+    {
+    public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef EntityTable::value_type value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef ValueType* pointer;
+        typedef ValueType& reference;
+
+        IteratorBase() : table_(0), range_(cNumRanges), slot_(0) {}
+
+        /// Converts an iterator to a const_iterator.
+        template <typename T, typename V, typename O>
+        IteratorBase(const IteratorBase<T, V, O> &rhs) :
+            table_(rhs.table_), range_(rhs.range_), slot_(rhs.slot_)
+        {
+            if (slot_ == cOverflowSlot)
+                overflow_ = rhs.overflow_;
+        }
+
+        reference operator*() const { return slot_ != cOverflowSlot ? table_->ranges_[range_].slots[slot_] : overflow_->second; }
+        pointer operator->() const { return &**this; }
+
+        IteratorBase &operator++()
+        {
+            if (slot_ != cOverflowSlot)
+                ++slot_;
+            else
+                ++overflow_;
+            SkipUnused();
+            return *this;
+        }
+
+        IteratorBase operator++(int)
+        {
+            IteratorBase it = *this;
+            ++*this;
+            return it;
+        }
+
+        template <typename T, typename V, typename O>
+        bool operator==(const IteratorBase<T, V, O> &rhs) const
+        {
+            return range_ == rhs.range_ && slot_ == rhs.slot_ && (slot_ != cOverflowSlot || overflow_ == rhs.overflow_);
+        }
+
+        template <typename T, typename V, typename O>
+        bool operator!=(const IteratorBase<T, V, O> &rhs) const { return !(*this == rhs); }
+
+    private:
+        friend class EntityTable;
+        template <typename, typename, typename> friend class IteratorBase;
+
+        /// Iterator to a slot, or to the end if range is cNumRanges.
+        IteratorBase(TableType *table, size_t range, size_t slot) : table_(table), range_(range), slot_(slot) {}
+
+        /// Iterator to an entity in the overflow map of a range.
+        IteratorBase(TableType *table, size_t range, OverflowIterator overflow) :
+            table_(table), range_(range), slot_(cOverflowSlot), overflow_(overflow)
+        {
+        }
+
+        /// Moves forward to the first used slot or overflow entity at or after the current position.
+        void SkipUnused()
+        {
+            while(range_ < cNumRanges)
+            {
+                const Range &range = table_->ranges_[range_];
+                if (slot_ != cOverflowSlot)
+                {
+                    while(slot_ < range.slots.size() && range.slots[slot_].first == 0)
+                        ++slot_;
+                    if (slot_ < range.slots.size())
+                        return;
+                    slot_ = cOverflowSlot;
+                    overflow_ = table_->ranges_[range_].overflow.begin();
+                }
+                if (overflow_ != table_->ranges_[range_].overflow.end())
+                    return;
+                ++range_;
+                slot_ = 0;
+            }
+        }
+
+        TableType *table_;
+        size_t range_;
+        size_t slot_;
+        OverflowIterator overflow_; ///< Valid only if slot_ is cOverflowSlot.
+    };
+
+    typedef IteratorBase<EntityTable, value_type, OverflowMap::iterator> iterator;
+    typedef IteratorBase<const EntityTable, const value_type, OverflowMap::const_iterator> const_iterator;
+
+    EntityTable();
+
+    iterator begin() { iterator it(this, 0, 0); it.SkipUnused(); return it; }
+    iterator end() { return iterator(this, cNumRanges, 0); }
+    const_iterator begin() const { const_iterator it(this, 0, 0); it.SkipUnused(); return it; }
+    const_iterator end() const { return const_iterator(this, cNumRanges, 0); }
+
+    /// Returns the number of entities.
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+
+    /// Returns iterator to the entity of the ID, or end() if there is none.
+    iterator find(entity_id_t id);
+    const_iterator find(entity_id_t id) const;
+    size_t count(entity_id_t id) const { return find(id) != end() ? 1 : 0; }
+
+    /// Returns the entity of the ID, inserting a null entity if there is none. The ID must not be 0.
+    EntityPtr &operator[](entity_id_t id);
+
+    /// Removes the entity of the ID. Returns the number of entities removed.
+    size_t erase(entity_id_t id);
+    /// Removes the entity the iterator points to.
+    void erase(iterator it);
+
+    /// Removes all entities and releases the slots.
+    void clear();
+
+    /// Grows the slots in one go to hold the IDs from first to first + count - 1, if they are near enough to the used slots.
+    void Reserve(entity_id_t first, size_t count);
+
+private:
+    /// Returns the index of the range of the ID.
+    static size_t RangeOf(entity_id_t id);
+
+    /// Grows the slots of the range to contain the offset, and moves the overflow entities that fit in them to the slots.
+    void Grow(Range &range, size_t offset);
+
+    Range ranges_[cNumRanges];
+    size_t size_;
+};
@@ -604,6 +604,50 @@ template<> QVariant TUNDRACORE_API Attribute<QPoint>::ToQVariant() const
     return QVariant::fromValue<QPoint>(Get());
 }
 
+// MEMORYUSAGE TEMPLATE IMPLEMENTATIONS.
+
+template<> size_t TUNDRACORE_API Attribute<QString>::MemoryUsage() const
+{
+    return sizeof(*this) + StringMemoryUsage(id) + StringMemoryUsage(name) + StringMemoryUsage(value);
+}
+
+template<> size_t TUNDRACORE_API Attribute<AssetReference>::MemoryUsage() const
+{
+    return sizeof(*this) + StringMemoryUsage(id) + StringMemoryUsage(name) + StringMemoryUsage(value.ref) + StringMemoryUsage(value.type);
+}
+
+template<> size_t TUNDRACORE_API Attribute<AssetReferenceList>::MemoryUsage() const
+{
+    return sizeof(*this) + StringMemoryUsage(id) + StringMemoryUsage(name) + VariantMemoryUsage(value.refs) + StringMemoryUsage(value.type);
+}
+
+template<> size_t TUNDRACORE_API Attribute<EntityReference>::MemoryUsage() const
+{
+    return sizeof(*this) + StringMemoryUsage(id) + StringMemoryUsage(name) + StringMemoryUsage(value.ref);
+}
+
+template<> size_t TUNDRACORE_API Attribute<QVariant>::MemoryUsage() const
+{
+    return sizeof(*this) + StringMemoryUsage(id) + StringMemoryUsage(name) + VariantMemoryUsage(value);
+}
+
+template<> size_t TUNDRACORE_API Attribute<QVariantList>::MemoryUsage() const
+{
+    return sizeof(*this) + StringMemoryUsage(id) + StringMemoryUsage(name) + VariantMemoryUsage(value);
+}
+
+template<> size_t TUNDRACORE_API Attribute<int>::MemoryUsage() const { return sizeof(*this) + StringMemoryUsage(id) + StringMemoryUsage(name); }
+template<> size_t TUNDRACORE_API Attribute<float>::MemoryUsage() const { return sizeof(*this) + StringMemoryUsage(id) + StringMemoryUsage(name); }
+template<> size_t TUNDRACORE_API Attribute<Color>::MemoryUsage() const { return sizeof(*this) + StringMemoryUsage(id) + StringMemoryUsage(name); }
+template<> size_t TUNDRACORE_API Attribute<float2>::MemoryUsage() const { return sizeof(*this) + StringMemoryUsage(id) + StringMemoryUsage(name); }
+template<> size_t TUNDRACORE_API Attribute<float3>::MemoryUsage() const { return sizeof(*this) + StringMemoryUsage(id) + StringMemoryUsage(name); }
+template<> size_t TUNDRACORE_API Attribute<float4>::MemoryUsage() const { return sizeof(*this) + StringMemoryUsage(id) + StringMemoryUsage(name); }
+template<> size_t TUNDRACORE_API Attribute<bool>::MemoryUsage() const { return sizeof(*this) + StringMemoryUsage(id) + StringMemoryUsage(name); }
+template<> size_t TUNDRACORE_API Attribute<uint>::MemoryUsage() const { return sizeof(*this) + StringMemoryUsage(id) + StringMemoryUsage(name); }
+template<> size_t TUNDRACORE_API Attribute<Quat>::MemoryUsage() const { return sizeof(*this) + StringMemoryUsage(id) + StringMemoryUsage(name); }
+template<> size_t TUNDRACORE_API Attribute<Transform>::MemoryUsage() const { return sizeof(*this) + StringMemoryUsage(id) + StringMemoryUsage(name); }
+template<> size_t TUNDRACORE_API Attribute<QPoint>::MemoryUsage() const { return sizeof(*this) + StringMemoryUsage(id) + StringMemoryUsage(name); }
+
 // FROMSCRIPTVALUE TEMPLATE IMPLEMENTATIONS.
 
 template<> void TUNDRACORE_API Attribute<QString>::FromScriptValue(const QScriptValue &value, AttributeChange::Type change)
@@ -76,6 +76,9 @@ public:
     /// Returns the value as QVariant (For scripts).
     virtual QVariant ToQVariant() const = 0;
 
+    /// Returns the approximate number of bytes used by the attribute, including the heap storage of its ID, name and value.
+    virtual size_t MemoryUsage() const = 0;
+
     /// Convert QVariant to attribute value.
     virtual void FromQVariant(const QVariant &variant, AttributeChange::Type change) = 0;
 
@@ -242,6 +245,7 @@ public:
     virtual const QString &TypeName() const; ///< IAttribute override
     virtual u32 TypeId() const; ///< IAttribute override
     virtual QVariant ToQVariant() const; ///< IAttribute override
+    virtual size_t MemoryUsage() const; ///< IAttribute override
     virtual void FromQVariant(const QVariant &variant, AttributeChange::Type change); ///< IAttribute override
     virtual void FromScriptValue(const QScriptValue &value, AttributeChange::Type change); ///< IAttribute override
 
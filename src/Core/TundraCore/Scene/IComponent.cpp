@@ -11,6 +11,7 @@
 #include "Entity.h"
 #include "Scene/Scene.h"
 #include "SceneAPI.h"
+#include "EC_Name.h"
 
 #include "CoreStringUtils.h"
 #include "Framework.h"
@@ -20,8 +21,21 @@
 
 #include <kNet.h>
 
+#include <algorithm>
+#include <cstring>
+
 #include "MemoryLeakCheck.h"
 
+namespace
+{
+    u64 lastChangeStamp = 0; ///< Components are only modified in the main thread.
+
+    u64 NextChangeStamp()
+    {
+        return ++lastChangeStamp;
+    }
+}
+
 IComponent::IComponent(Scene* scene) :
     parentEntity(0),
     framework(scene ? scene->GetFramework() : 0),
@@ -29,7 +43,8 @@ IComponent::IComponent(Scene* scene) :
     replicated(true),
     temporary(false),
     internalQObjectPropertyUpdateOngoing_(false),
-    id(0)
+    id(0),
+    changeStamp_(NextChangeStamp())
 {
 }
 
@@ -55,6 +70,7 @@ void IComponent::SetName(const QString& name_)
 
     QString oldName = name;
     name = name_;
+    changeStamp_ = NextChangeStamp();
     emit ComponentNameChanged(name, oldName);
 }
 
@@ -264,7 +280,9 @@ void IComponent::RemoveAttribute(u8 index, AttributeChange::Type change)
         
         // Trigger internal signal(s)
         emit AttributeAboutToBeRemoved(attr);
+        DynamicAttributeRemoved(attr);
         SAFE_DELETE(attributes[index]);
+        changeStamp_ = NextChangeStamp();
     }
     else
         LogError("Can not remove nonexisting attribute at index " + QString::number(index));
@@ -274,6 +292,7 @@ void IComponent::AddAttribute(IAttribute* attr)
 {
     if (!attr)
         return;
+    changeStamp_ = NextChangeStamp();
     // If attribute is static (member variable attributes), we can just push_back it.
     if (!attr->IsDynamic())
     {
@@ -291,12 +310,14 @@ void IComponent::AddAttribute(IAttribute* attr)
                 attr->index = i;
                 attr->owner = this;
                 attributes[i] = attr;
+                DynamicAttributeAdded(attr);
                 return;
             }
         }
         attr->index = (u8)attributes.size();
         attr->owner = this;
         attributes.push_back(attr);
+        DynamicAttributeAdded(attr);
 
         // Create dynamic QObject property
         CreateDynamicProperty(attr);
@@ -320,6 +341,7 @@ bool IComponent::AddAttribute(IAttribute* attr, u8 index)
             else
             {
                 LogWarning("Removing existing attribute at index " + QString::number(index) + " to make room for new attribute");
+                DynamicAttributeRemoved(existing);
                 delete existing;
                 attributes[index] = 0;
             }
@@ -338,7 +360,10 @@ bool IComponent::AddAttribute(IAttribute* attr, u8 index)
 
     // Create dynamic QObject property
     if (attr->IsDynamic())
+    {
+        DynamicAttributeAdded(attr);
         CreateDynamicProperty(attr);
+    }
 
     return true;
 }
@@ -494,6 +519,12 @@ bool IComponent::BeginDeserialization(QDomElement& compElem)
 
 void IComponent::EmitAttributeChanged(IAttribute* attribute, AttributeChange::Type change)
 {
+    changeStamp_ = NextChangeStamp();
+    Scene* scene = ParentScene();
+    // The name index of the scene follows also the changes that are not signaled
+    if (scene && TypeId() == EC_Name::TypeIdStatic())
+        scene->UpdateNameIndex(this);
+
     // If this message should be sent with the default attribute change mode specified in the IComponent,
     // take the change mode from this component.
     if (change == AttributeChange::Default)
@@ -504,11 +535,17 @@ void IComponent::EmitAttributeChanged(IAttribute* attribute, AttributeChange::Ty
         return; // No signals
     
     // Trigger scenemanager signal
-    Scene* scene = ParentScene();
+    if (scene && scene->InChangeTransaction())
+    {
+        // Signaled when the transaction commits
+        scene->DeferAttributeChange(this, attribute, change);
+        return;
+    }
     if (scene)
         scene->EmitAttributeChanged(this, attribute, change);
     
-    // Trigger internal signal
+    // Trigger internal listeners and signal
+    changeListeners_.Dispatch(this, attribute, change);
     emit AttributeChanged(attribute, change);
 
     // Tell the derived class that some attributes have changed.
@@ -520,6 +557,27 @@ void IComponent::EmitAttributeChanged(IAttribute* attribute, AttributeChange::Ty
             attributes[i]->ClearChangedFlag();
 }
 
+void IComponent::EmitDeferredAttributeChanges(const std::vector<std::pair<IAttribute*, AttributeChange::Type> > &changes)
+{
+    if (changes.empty())
+        return;
+
+    Scene* scene = ParentScene();
+    for(size_t i = 0; i < changes.size(); ++i)
+    {
+        if (scene)
+            scene->EmitAttributeChanged(this, changes[i].first, changes[i].second);
+        changeListeners_.Dispatch(this, changes[i].first, changes[i].second);
+        emit AttributeChanged(changes[i].first, changes[i].second);
+    }
+
+    // The change bits of the attributes have accumulated during the transaction, so one call covers them all
+    AttributesChanged();
+    for(size_t i = 0; i < attributes.size(); ++i)
+        if (attributes[i])
+            attributes[i]->ClearChangedFlag();
+}
+
 void IComponent::EmitAttributeMetadataChanged(IAttribute* attribute)
 {
     if (!attribute)
@@ -620,6 +678,68 @@ void IComponent::DeserializeFromBinary(kNet::DataDeserializer& source, Attribute
             attributes[i]->FromBinary(source, change);
 }
 
+std::vector<bool> IComponent::OverriddenAttributes(const IComponent *prototype) const
+{
+    const int numStaticAttrs = NumStaticAttributes();
+    std::vector<bool> overridden(numStaticAttrs, true);
+    if (!prototype || prototype->TypeId() != TypeId())
+        return overridden;
+
+    // Assume 64KB max per attribute, like Entity::SerializeToBinary does per component
+    std::vector<char> bytes(64 * 1024);
+    std::vector<char> prototypeBytes(64 * 1024);
+    const AttributeVector &prototypeAttrs = prototype->Attributes();
+    for(int i = 0; i < numStaticAttrs && i < (int)prototypeAttrs.size(); ++i)
+    {
+        if (!prototypeAttrs[i] || prototypeAttrs[i]->IsDynamic() || prototypeAttrs[i]->TypeId() != attributes[i]->TypeId())
+            continue;
+        kNet::DataSerializer dest(&bytes[0], bytes.size());
+        attributes[i]->ToBinary(dest);
+        kNet::DataSerializer prototypeDest(&prototypeBytes[0], prototypeBytes.size());
+        prototypeAttrs[i]->ToBinary(prototypeDest);
+        overridden[i] = dest.BytesFilled() != prototypeDest.BytesFilled() || memcmp(&bytes[0], &prototypeBytes[0], dest.BytesFilled()) != 0;
+    }
+    return overridden;
+}
+
+void IComponent::SerializeOverridesTo(QDomDocument& doc, QDomElement& baseElement, const IComponent *prototype, bool serializeTemporary) const
+{
+    if (!prototype || SupportsDynamicAttributes())
+    {
+        SerializeTo(doc, baseElement, serializeTemporary);
+        return;
+    }
+
+    const std::vector<bool> overridden = OverriddenAttributes(prototype);
+    if (std::find(overridden.begin(), overridden.end(), true) == overridden.end() && replicated == prototype->IsReplicated() &&
+        (!serializeTemporary || temporary == prototype->IsTemporary()))
+        return;
+
+    QDomElement comp_element = BeginSerialization(doc, baseElement, serializeTemporary);
+    for(uint i = 0; i < overridden.size(); ++i)
+        if (overridden[i])
+            WriteAttribute(doc, comp_element, attributes[i]->Name(), attributes[i]->Id(), attributes[i]->ToString(), attributes[i]->TypeName());
+}
+
+void IComponent::CopyAttributesFrom(const IComponent *prototype, AttributeChange::Type change)
+{
+    if (!prototype || prototype->TypeId() != TypeId())
+        return;
+
+    const AttributeVector &prototypeAttrs = prototype->Attributes();
+    for(uint i = 0; i < prototypeAttrs.size(); ++i)
+    {
+        IAttribute *source = prototypeAttrs[i];
+        if (!source)
+            continue;
+        IAttribute *attr = i < attributes.size() ? attributes[i] : 0;
+        if (!attr && source->IsDynamic() && SupportsDynamicAttributes())
+            attr = CreateAttribute((u8)i, source->TypeId(), source->Id(), change);
+        if (attr && attr->TypeId() == source->TypeId())
+            attr->CopyValue(source, change);
+    }
+}
+
 void IComponent::ComponentChanged(AttributeChange::Type change)
 {
     // If this message should be sent with the default attribute change mode specified in the IComponent,
@@ -635,9 +755,34 @@ void IComponent::ComponentChanged(AttributeChange::Type change)
             EmitAttributeChanged(attributes[i], change);
 }
 
+size_t IComponent::MemoryUsage() const
+{
+    // The static attributes are members of the concrete component, so their size approximates the rest of it
+    return sizeof(IComponent) + StringMemoryUsage(name) + attributes.capacity() * sizeof(IAttribute *) +
+        AttributeMemoryUsage() + DynamicPropertyMemoryUsage();
+}
+
+size_t IComponent::AttributeMemoryUsage() const
+{
+    size_t bytes = 0;
+    for(size_t i = 0; i < attributes.size(); ++i)
+        if (attributes[i])
+            bytes += attributes[i]->MemoryUsage();
+    return bytes;
+}
+
+size_t IComponent::DynamicPropertyMemoryUsage() const
+{
+    size_t bytes = 0;
+    for(QHash<QString, QByteArray>::const_iterator i = dynamicPropertyNames_.begin(); i != dynamicPropertyNames_.end(); ++i)
+        bytes += 4 * sizeof(void *) + sizeof(QString) + sizeof(QByteArray) + StringMemoryUsage(i.key()) + (size_t)i.value().capacity() + 1;
+    return bytes;
+}
+
 void IComponent::SetTemporary(bool enable)
 {
     temporary = enable;
+    changeStamp_ = NextChangeStamp();
 }
 
 bool IComponent::IsTemporary() const
@@ -10,6 +10,7 @@
 #include "SceneFwd.h"
 #include "AttributeChangeType.h"
 #include "IAttribute.h"
+#include "AttributeChangeListener.h"
 #include "LoggingFunctions.h"
 
 #include <QObject>
@@ -166,6 +167,22 @@ public:
         it depends on the situation if they are needed or not. */
     virtual void DeserializeFromBinary(kNet::DataDeserializer& source, AttributeChange::Type change);
 
+    /// Returns, for each static attribute, whether its value differs from that of the same attribute in the prototype component.
+    /** Used to serialize only the overridden attributes of an instance of a prototype entity, see Entity::Prototype.
+        The values are compared by their binary serialization. An attribute the prototype does not have, f.ex. because
+        of a component version mismatch, is always overridden. */
+    std::vector<bool> OverriddenAttributes(const IComponent *prototype) const;
+
+    /// Serializes this component and those of its attributes that differ from the prototype component to the given XML document.
+    /** Writes nothing if no attribute differs and the component has the same sync and temporary flags as the prototype.
+        Components that support dynamic attributes are serialized in full with SerializeTo.
+        @sa OverriddenAttributes */
+    void SerializeOverridesTo(QDomDocument& doc, QDomElement& baseElement, const IComponent *prototype, bool serializeTemporary = false) const;
+
+    /// Copies the attribute values of the prototype component of the same type, creating its dynamic attributes if this component supports them.
+    /** The heap storage of the values, f.ex. strings and asset reference lists, is shared with the prototype until an attribute is changed. */
+    void CopyAttributesFrom(const IComponent *prototype, AttributeChange::Type change);
+
     /// Create an attribute with specified index, type and ID. Return it if successful or null if not. Called by SyncManager.
     /** Component must override SupportsDynamicAttributes() to allow creating attributes. 
         @note For dynamic attributes ID and name will be same. */
@@ -245,6 +262,17 @@ public:
                 return dynamic_cast<Attribute<T> *>(&attributes[i]);
         return 0;
     }
+
+    /// Returns the approximate number of bytes used by the component, including its attributes and dynamic property names.
+    /** Components that allocate significant memory of their own, e.g. for renderer or physics objects, may override
+        this to add it. The memory of the assets the component refers to is not included, as assets are shared. */
+    virtual size_t MemoryUsage() const;
+
+    /// Returns the approximate number of bytes used by the attributes of the component, including the heap storage of their values.
+    size_t AttributeMemoryUsage() const;
+
+    /// Returns the approximate number of bytes used by the names of the dynamic properties of the dynamic attributes.
+    size_t DynamicPropertyMemoryUsage() const;
     
 public slots:
     /// Returns true if network synchronization of the attributes of this component is enabled.
@@ -299,10 +327,26 @@ public slots:
         attribute is changed. */
     void EmitAttributeChanged(IAttribute* attribute, AttributeChange::Type change);
 
+    /// Emits the attribute changes deferred by a scene change transaction, and calls AttributesChanged once for all of them.
+    /** Called by Scene::CommitChangeTransaction.
+        @param changes The changed attributes and their change types, neither Default nor Disconnected. */
+    void EmitDeferredAttributeChanges(const std::vector<std::pair<IAttribute*, AttributeChange::Type> > &changes);
+
     /// Informs this component that the metadata of a member Attribute has changed.
     /** @param The attribute of which metadata was changed. The attribute passed here must be an Attribute member of this component. */
     void EmitAttributeMetadataChanged(IAttribute* attribute);
 
+    /// Adds an engine-internal listener of the changes of an attribute, or of all the attributes if the index is negative.
+    /** The listener is called just before the AttributeChanged signal. See IAttributeChangeListener. */
+    void AddAttributeChangeListener(IAttributeChangeListener *listener, int attributeIndex = -1) { changeListeners_.Add(listener, attributeIndex); }
+
+    /// Removes all the registrations of an attribute change listener from this component.
+    void RemoveAttributeChangeListener(IAttributeChangeListener *listener) { changeListeners_.Remove(listener); }
+
+    /// Returns a stamp that changes whenever the attributes, the attribute structure, the name or the temporary flag of this component change.
+    /** The stamps are unique over all the components, so an equal stamp means the same, unchanged component. Used by SceneSnapshot. */
+    u64 ChangeStamp() const { return changeStamp_; }
+
     /// @overload
     /** @param attributeName Name of the attribute that changed. @note this is a no-op if the named attribute is not found.
         @param change Informs to the component the type of change that occurred. */
@@ -452,6 +496,13 @@ private:
     /// and after reacting to the change, call IAttribute::ClearChangedFlag().
     virtual void AttributesChanged() {}
 
+    /// Called by the base class after a dynamic attribute has been added to the attribute vector, before the signals of the addition.
+    /** A component that indexes its dynamic attributes, like EC_DynamicComponent, overrides this and DynamicAttributeRemoved. */
+    virtual void DynamicAttributeAdded(IAttribute * /*attr*/) {}
+
+    /// Called by the base class before a dynamic attribute is deleted from the attribute vector.
+    virtual void DynamicAttributeRemoved(IAttribute * /*attr*/) {}
+
     /// Set component id. Called by Entity
     void SetNewId(component_id_t newId);
 
@@ -461,4 +512,7 @@ private:
 
     /// Update a QObject dynamic property.
     QHash<QString, QByteArray> dynamicPropertyNames_;
+
+    AttributeChangeListenerList changeListeners_; ///< Engine-internal attribute change listeners of this component.
+    u64 changeStamp_; ///< Stamp of the latest change, see ChangeStamp.
 };
@@ -4,6 +4,7 @@
 
 #include "TundraCoreApi.h"
 #include "CoreTypes.h"
+#include "ObjectPool.h"
 #include "IComponent.h"
 
 #include <QString>
@@ -22,6 +23,8 @@ public:
 };
 
 /// A factory for instantiating components of a templated type T.
+/** The components are allocated from the object pool of the type, together with their static attributes, which are
+    members of the component. */
 template<typename T>
 class GenericComponentFactory : public IComponentFactory
 {
@@ -31,7 +34,7 @@ public:
 
     ComponentPtr Create(Scene* scene, const QString &newComponentName) const
     {
-        ComponentPtr component = MAKE_SHARED(T, scene);
+        ComponentPtr component = MAKE_POOLED_SHARED(T, scene);
         component->SetName(newComponentName);
         return component;
     }
@@ -0,0 +1,760 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#include "StableHeaders.h"
+#include "DebugOperatorNew.h"
+
+#include "IndexedSceneFile.h"
+#include "Scene/Scene.h"
+#include "SceneAPI.h"
+#include "Entity.h"
+#include "IComponent.h"
+#include "IAttribute.h"
+#include "EntityReference.h"
+#include "Transform.h"
+#include "AssetReference.h"
+#include "OgreMeshBounds.h"
+#include "Framework.h"
+#include "Profiler.h"
+#include "LoggingFunctions.h"
+
+#include <kNet/DataDeserializer.h>
+#include <kNet/DataSerializer.h>
+
+#include <algorithm>
+#include <set>
+
+#include "MemoryLeakCheck.h"
+
+using namespace kNet;
+
+namespace
+{
+
+/// "TBN2" in the byte order of the file.
+const u32 cIndexedSceneMagic = 0x324E4254;
+const u32 cIndexedSceneVersion = 2;
+const size_t cHeaderSize = 10 * sizeof(u32);
+const size_t cEntityEntrySize = 4 * sizeof(u32);
+const size_t cNodeSize = 6 * sizeof(float) + 2 * sizeof(u32);
+const size_t cSpatialEntrySize = 6 * sizeof(float) + sizeof(u32);
+/// Entity table flag of the entities that have bounds in the spatial index.
+const u32 cEntityPlaced = 1;
+/// Maximum number of entities in a leaf of the spatial index.
+const size_t cMaxLeafEntries = 4;
+/// Maximum depth of the placeable parent chain followed when computing the world position of an entity.
+const int cMaxParentDepth = 32;
+/// Type ID of EC_Placeable, which is not known to the core.
+const u32 cPlaceableTypeId = 20;
+/// Type ID of EC_Mesh, which is not known to the core.
+const u32 cMeshTypeId = 17;
+
+/// Header of the indexed binary scene format.
+struct IndexedSceneHeader
+{
+    u32 numEntities;
+    u32 entityTableOffset;
+    u32 numComponentTypes;
+    u32 typeDictionaryOffset;
+    u32 numNodes;
+    u32 nodesOffset;
+    u32 numSpatialEntries;
+    u32 spatialEntriesOffset;
+
+    /// Reads and validates the header. Returns false if the data is not in the indexed format or the sections do not fit in it.
+    bool Read(const char *data, size_t numBytes)
+    {
+        if (!data || numBytes < cHeaderSize)
+            return false;
+        DataDeserializer dd(data, cHeaderSize);
+        if (dd.Read<u32>() != cIndexedSceneMagic || dd.Read<u32>() != cIndexedSceneVersion)
+            return false;
+        numEntities = dd.Read<u32>();
+        entityTableOffset = dd.Read<u32>();
+        numComponentTypes = dd.Read<u32>();
+        typeDictionaryOffset = dd.Read<u32>();
+        numNodes = dd.Read<u32>();
+        nodesOffset = dd.Read<u32>();
+        numSpatialEntries = dd.Read<u32>();
+        spatialEntriesOffset = dd.Read<u32>();
+        return Fits(entityTableOffset, numEntities, cEntityEntrySize, numBytes) &&
+            Fits(nodesOffset, numNodes, cNodeSize, numBytes) &&
+            Fits(spatialEntriesOffset, numSpatialEntries, cSpatialEntrySize, numBytes) &&
+            typeDictionaryOffset <= numBytes;
+    }
+
+    static bool Fits(u32 offset, u32 count, size_t elementSize, size_t numBytes)
+    {
+        return offset <= numBytes && (u64)count * elementSize <= numBytes - offset;
+    }
+};
+
+AABB ReadAABB(DataDeserializer &dd)
+{
+    AABB aabb;
+    aabb.minPoint.x = dd.Read<float>();
+    aabb.minPoint.y = dd.Read<float>();
+    aabb.minPoint.z = dd.Read<float>();
+    aabb.maxPoint.x = dd.Read<float>();
+    aabb.maxPoint.y = dd.Read<float>();
+    aabb.maxPoint.z = dd.Read<float>();
+    return aabb;
+}
+
+void WriteAABB(DataSerializer &ds, const AABB &aabb)
+{
+    ds.Add<float>(aabb.minPoint.x);
+    ds.Add<float>(aabb.minPoint.y);
+    ds.Add<float>(aabb.minPoint.z);
+    ds.Add<float>(aabb.maxPoint.x);
+    ds.Add<float>(aabb.maxPoint.y);
+    ds.Add<float>(aabb.maxPoint.z);
+}
+
+/// Intersection test of the spatial index against a box. Inclusive, as the bounds of single placeables are points.
+struct BoxTest
+{
+    explicit BoxTest(const AABB &aabb) : box(aabb) {}
+
+    bool operator()(const AABB &bounds) const
+    {
+        return bounds.minPoint.x <= box.maxPoint.x && bounds.minPoint.y <= box.maxPoint.y && bounds.minPoint.z <= box.maxPoint.z &&
+            box.minPoint.x <= bounds.maxPoint.x && box.minPoint.y <= bounds.maxPoint.y && box.minPoint.z <= bounds.maxPoint.z;
+    }
+
+    AABB box;
+};
+
+/// Intersection test of the spatial index against a sphere.
+struct SphereTest
+{
+    SphereTest(const float3 &sphereCenter, float sphereRadius) : center(sphereCenter), radius(sphereRadius) {}
+
+    bool operator()(const AABB &bounds) const { return bounds.Distance(center) <= radius; }
+
+    float3 center;
+    float radius;
+};
+
+/// An entity of the spatial index being built.
+struct BuildEntry
+{
+    AABB bounds;
+    u32 entityIndex;
+};
+
+/// A node of the spatial index being built. A leaf has count entries starting from first, an inner node has count 0
+/// and its children at the next index and at first.
+struct BuildNode
+{
+    AABB box;
+    u32 first;
+    u32 count;
+};
+
+struct CentroidLess
+{
+    explicit CentroidLess(int splitAxis) : axis(splitAxis) {}
+
+    bool operator()(const BuildEntry &lhs, const BuildEntry &rhs) const
+    {
+        return lhs.bounds.CenterPoint()[axis] < rhs.bounds.CenterPoint()[axis];
+    }
+
+    int axis;
+};
+
+struct EntityIdLess
+{
+    bool operator()(const EntityPtr &lhs, const EntityPtr &rhs) const { return lhs->Id() < rhs->Id(); }
+};
+
+/// Builds the spatial index over the entries in preorder, splitting at the median of the longest axis of the centroids.
+void BuildSpatialIndex(std::vector<BuildEntry> &entries, size_t begin, size_t end, std::vector<BuildNode> &nodes)
+{
+    const size_t nodeIndex = nodes.size();
+    nodes.push_back(BuildNode());
+
+    AABB box;
+    box.SetNegativeInfinity();
+    AABB centroids;
+    centroids.SetNegativeInfinity();
+    for(size_t i = begin; i < end; ++i)
+    {
+        box.Enclose(entries[i].bounds);
+        centroids.Enclose(entries[i].bounds.CenterPoint());
+    }
+    nodes[nodeIndex].box = box;
+
+    if (end - begin <= cMaxLeafEntries)
+    {
+        nodes[nodeIndex].first = (u32)begin;
+        nodes[nodeIndex].count = (u32)(end - begin);
+        return;
+    }
+
+    const float3 extent = centroids.maxPoint - centroids.minPoint;
+    const int axis = (extent.x >= extent.y && extent.x >= extent.z) ? 0 : (extent.y >= extent.z ? 1 : 2);
+    const size_t mid = begin + (end - begin) / 2;
+    std::nth_element(entries.begin() + begin, entries.begin() + mid, entries.begin() + end, CentroidLess(axis));
+
+    BuildSpatialIndex(entries, begin, mid, nodes);
+    nodes[nodeIndex].first = (u32)nodes.size();
+    nodes[nodeIndex].count = 0;
+    BuildSpatialIndex(entries, mid, end, nodes);
+}
+
+/// Returns the world transform of the placeable of the entity, following the placeable parents. Returns false if the entity has no placeable.
+bool PlaceableWorldTransform(Entity *entity, float3x4 &transform)
+{
+    float3x4 world = float3x4::identity;
+    bool placed = false;
+    Entity *current = entity;
+    for(int depth = 0; current && depth < cMaxParentDepth; ++depth)
+    {
+        ComponentPtr placeable = current->Component(cPlaceableTypeId);
+        Attribute<Transform> *transform = placeable ? dynamic_cast<Attribute<Transform> *>(placeable->AttributeById("transform")) : 0;
+        if (!transform)
+            break;
+        world = transform->Get().ToFloat3x4() * world;
+        placed = true;
+
+        Attribute<EntityReference> *parentRef = dynamic_cast<Attribute<EntityReference> *>(placeable->AttributeById("parentRef"));
+        current = parentRef ? parentRef->Get().LookupParent(current).get() : 0;
+    }
+    if (placed)
+        transform = world;
+    return placed;
+}
+
+/// Returns the bounds of the mesh of the entity in the space of its placeable, if the mesh data is on the local disk.
+bool MeshLocalBounds(Entity *entity, AssetAPI *assetAPI, AABB &bounds)
+{
+    ComponentPtr mesh = entity->Component(cMeshTypeId);
+    Attribute<AssetReference> *meshRef = mesh ? dynamic_cast<Attribute<AssetReference> *>(mesh->AttributeById("meshRef")) : 0;
+    if (!meshRef || meshRef->Get().ref.trimmed().isEmpty() || !OgreMeshBounds::Find(assetAPI, meshRef->Get().ref, bounds))
+        return false;
+    Attribute<Transform> *nodeTransform = dynamic_cast<Attribute<Transform> *>(mesh->AttributeById("nodeTransformation"));
+    if (nodeTransform)
+        bounds.TransformAsAABB(nodeTransform->Get().ToFloat3x4());
+    return true;
+}
+
+/// Encloses the world positions of the placeables of the entity and its saved children, and the world bounds of their meshes
+/// whose data is on the local disk. Returns false if none has a placeable.
+bool EnclosePlaceables(Entity *entity, bool saveTemporary, AssetAPI *assetAPI, AABB &bounds)
+{
+    bool placed = false;
+    float3x4 world;
+    if (PlaceableWorldTransform(entity, world))
+    {
+        bounds.Enclose(world.TranslatePart());
+        AABB meshBounds;
+        if (MeshLocalBounds(entity, assetAPI, meshBounds))
+        {
+            meshBounds.TransformAsAABB(world);
+            bounds.Enclose(meshBounds);
+        }
+        placed = true;
+    }
+    for(size_t i = 0; i < entity->NumChildren(); ++i)
+    {
+        EntityPtr child = entity->Child(i);
+        if (child && (saveTemporary || !child->IsTemporary()))
+            placed = EnclosePlaceables(child.get(), saveTemporary, assetAPI, bounds) || placed;
+    }
+    return placed;
+}
+
+/// Collects the component type IDs of the entity and its saved children, and returns an upper bound of their serialized size.
+size_t CollectSaveInfo(Entity *entity, bool saveTemporary, std::set<u32> &typeIds)
+{
+    size_t size = 3 * sizeof(u32);
+    const Entity::ComponentMap &components = entity->Components();
+    for(Entity::ComponentMap::const_iterator i = components.begin(); i != components.end(); ++i)
+    {
+        if (!saveTemporary && i->second->IsTemporary())
+            continue;
+        typeIds.insert(i->second->TypeId());
+        // As in Entity::SerializeToBinary, which assumes 64KB max per component
+        size += 16 + i->second->Name().toStdString().size() + 64 * 1024;
+    }
+    for(size_t i = 0; i < entity->NumChildren(); ++i)
+    {
+        EntityPtr child = entity->Child(i);
+        if (child && (saveTemporary || !child->IsTemporary()))
+            size += CollectSaveInfo(child.get(), saveTemporary, typeIds);
+    }
+    return size;
+}
+
+} // ~unnamed namespace
+
+IndexedSceneFile::IndexedSceneFile(const ScenePtr &scene) :
+    scene_(scene),
+    data_(0),
+    size_(0),
+    numEntities_(0),
+    entityTableOffset_(0),
+    numNodes_(0),
+    nodesOffset_(0),
+    numSpatialEntries_(0),
+    spatialEntriesOffset_(0)
+{
+}
+
+IndexedSceneFile::~IndexedSceneFile()
+{
+    Close();
+}
+
+bool IndexedSceneFile::Save(const Scene *scene, const QString &filename, bool saveTemporary, bool saveLocal)
+{
+    PROFILE(IndexedSceneFile_Save);
+
+    if (!scene)
+        return false;
+
+    std::vector<EntityPtr> entities;
+    EntityList rootLevel = scene->RootLevelEntities();
+    for(EntityList::const_iterator iter = rootLevel.begin(); iter != rootLevel.end(); ++iter)
+    {
+        EntityPtr ent = *iter;
+        if ((ent->IsLocal() && !saveLocal) || (ent->IsTemporary() && !saveTemporary))
+            continue;
+        entities.push_back(ent);
+    }
+    std::sort(entities.begin(), entities.end(), EntityIdLess());
+    AssetAPI *assetAPI = scene->GetFramework()->Asset();
+
+    // Serialize the entity data, and collect the component types and the bounds of the placed entities.
+    QByteArray records;
+    QByteArray recordBytes;
+    std::vector<u32> recordOffsets;
+    std::vector<u32> recordSizes;
+    std::vector<BuildEntry> spatialEntries;
+    std::set<u32> typeIds;
+    for(size_t i = 0; i < entities.size(); ++i)
+    {
+        const size_t maxSize = CollectSaveInfo(entities[i].get(), saveTemporary, typeIds);
+        if (recordBytes.size() < (int)maxSize)
+            recordBytes.resize((int)maxSize);
+        DataSerializer dest(recordBytes.data(), recordBytes.size());
+        entities[i]->SerializeToBinary(dest, saveTemporary);
+
+        recordOffsets.push_back((u32)records.size());
+        recordSizes.push_back((u32)dest.BytesFilled());
+        records.append(recordBytes.constData(), (int)dest.BytesFilled());
+
+        BuildEntry entry;
+        entry.bounds.SetNegativeInfinity();
+        entry.entityIndex = (u32)i;
+        if (EnclosePlaceables(entities[i].get(), saveTemporary, assetAPI, entry.bounds))
+            spatialEntries.push_back(entry);
+    }
+
+    std::vector<BuildNode> nodes;
+    if (!spatialEntries.empty())
+        BuildSpatialIndex(spatialEntries, 0, spatialEntries.size(), nodes);
+    std::vector<u32> flags(entities.size(), 0);
+    for(size_t i = 0; i < spatialEntries.size(); ++i)
+        flags[spatialEntries[i].entityIndex] |= cEntityPlaced;
+
+    QByteArray dictionary;
+    dictionary.resize((int)(typeIds.size() * (sizeof(u32) + 256)));
+    DataSerializer dictDest(dictionary.data(), dictionary.size());
+    SceneAPI *sceneAPI = scene->GetFramework()->Scene();
+    for(std::set<u32>::const_iterator i = typeIds.begin(); i != typeIds.end(); ++i)
+    {
+        dictDest.Add<u32>(*i);
+        dictDest.AddString(sceneAPI->ComponentTypeNameForTypeId(*i).left(255).toStdString());
+    }
+    dictionary.resize((int)dictDest.BytesFilled());
+
+    const u32 typeDictionaryOffset = (u32)cHeaderSize;
+    const u32 entityTableOffset = typeDictionaryOffset + (u32)dictionary.size();
+    const u32 nodesOffset = entityTableOffset + (u32)(entities.size() * cEntityEntrySize);
+    const u32 spatialEntriesOffset = nodesOffset + (u32)(nodes.size() * cNodeSize);
+    const u32 dataOffset = spatialEntriesOffset + (u32)(spatialEntries.size() * cSpatialEntrySize);
+
+    QByteArray index;
+    index.resize((int)dataOffset);
+    DataSerializer dest(index.data(), index.size());
+    dest.Add<u32>(cIndexedSceneMagic);
+    dest.Add<u32>(cIndexedSceneVersion);
+    dest.Add<u32>((u32)entities.size());
+    dest.Add<u32>(entityTableOffset);
+    dest.Add<u32>((u32)typeIds.size());
+    dest.Add<u32>(typeDictionaryOffset);
+    dest.Add<u32>((u32)nodes.size());
+    dest.Add<u32>(nodesOffset);
+    dest.Add<u32>((u32)spatialEntries.size());
+    dest.Add<u32>(spatialEntriesOffset);
+    if (!dictionary.isEmpty())
+        dest.AddArray<u8>((const u8*)dictionary.constData(), dictionary.size());
+    for(size_t i = 0; i < entities.size(); ++i)
+    {
+        dest.Add<u32>(entities[i]->Id());
+        dest.Add<u32>(dataOffset + recordOffsets[i]);
+        dest.Add<u32>(recordSizes[i]);
+        dest.Add<u32>(flags[i]);
+    }
+    for(size_t i = 0; i < nodes.size(); ++i)
+    {
+        WriteAABB(dest, nodes[i].box);
+        dest.Add<u32>(nodes[i].first);
+        dest.Add<u32>(nodes[i].count);
+    }
+    for(size_t i = 0; i < spatialEntries.size(); ++i)
+    {
+        WriteAABB(dest, spatialEntries[i].bounds);
+        dest.Add<u32>(spatialEntries[i].entityIndex);
+    }
+
+    QFile sceneFile(filename);
+    if (!sceneFile.open(QFile::WriteOnly))
+    {
+        LogError("Could not open file " + filename + " for writing when saving indexed scene binary");
+        return false;
+    }
+    sceneFile.write(index);
+    sceneFile.write(records);
+    sceneFile.close();
+    return true;
+}
+
+bool IndexedSceneFile::IsIndexedSceneData(const char *data, size_t numBytes)
+{
+    if (!data || numBytes < sizeof(u32))
+        return false;
+    DataDeserializer dd(data, sizeof(u32));
+    return dd.Read<u32>() == cIndexedSceneMagic;
+}
+
+QByteArray IndexedSceneFile::ToFlatSceneData(const char *data, size_t numBytes)
+{
+    IndexedSceneHeader header;
+    if (!header.Read(data, numBytes))
+    {
+        LogError("IndexedSceneFile::ToFlatSceneData: Malformed indexed scene data.");
+        return QByteArray();
+    }
+
+    std::vector<std::pair<u32, u32> > records;
+    size_t flatSize = sizeof(u32);
+    DataDeserializer table(data + header.entityTableOffset, header.numEntities * cEntityEntrySize);
+    for(u32 i = 0; i < header.numEntities; ++i)
+    {
+        table.Read<u32>(); // ID
+        u32 offset = table.Read<u32>();
+        u32 size = table.Read<u32>();
+        table.Read<u32>(); // Flags
+        if (offset > numBytes || size > numBytes - offset)
+        {
+            LogError("IndexedSceneFile::ToFlatSceneData: Entity data out of bounds.");
+            return QByteArray();
+        }
+        records.push_back(std::make_pair(offset, size));
+        flatSize += size;
+    }
+
+    QByteArray flat;
+    flat.resize((int)flatSize);
+    DataSerializer dest(flat.data(), flat.size());
+    dest.Add<u32>(header.numEntities);
+    for(size_t i = 0; i < records.size(); ++i)
+        if (records[i].second)
+            dest.AddArray<u8>((const u8*)data + records[i].first, records[i].second);
+    return flat;
+}
+
+uint IndexedSceneFile::NumMaterialized() const
+{
+    uint count = 0;
+    for(size_t i = 0; i < materialized_.size(); ++i)
+        if (!materialized_[i].expired())
+            ++count;
+    return count;
+}
+
+bool IndexedSceneFile::Open(const QString &filename)
+{
+    Close();
+
+    file_.setFileName(filename);
+    if (!file_.open(QIODevice::ReadOnly))
+    {
+        LogError("IndexedSceneFile::Open: Failed to open file " + filename + ".");
+        return false;
+    }
+
+    size_ = (size_t)file_.size();
+    uchar *mapped = size_ ? file_.map(0, file_.size()) : 0;
+    if (mapped)
+        data_ = (const char *)mapped;
+    else
+    {
+        bytes_ = file_.readAll();
+        data_ = bytes_.constData();
+        size_ = bytes_.size();
+    }
+
+    IndexedSceneHeader header;
+    if (!header.Read(data_, size_))
+    {
+        LogError("IndexedSceneFile::Open: File " + filename + " is not an indexed scene binary.");
+        Close();
+        return false;
+    }
+    numEntities_ = header.numEntities;
+    entityTableOffset_ = header.entityTableOffset;
+    numNodes_ = header.numNodes;
+    nodesOffset_ = header.nodesOffset;
+    numSpatialEntries_ = header.numSpatialEntries;
+    spatialEntriesOffset_ = header.spatialEntriesOffset;
+    materialized_.resize(numEntities_);
+
+    try
+    {
+        DataDeserializer dd(data_ + header.typeDictionaryOffset, size_ - header.typeDictionaryOffset);
+        for(u32 i = 0; i < header.numComponentTypes; ++i)
+        {
+            u32 typeId = dd.Read<u32>();
+            QString typeName = QString::fromStdString(dd.ReadString());
+            componentTypes_.append(typeName.isEmpty() ? QString::number(typeId) : typeName);
+        }
+    }
+    catch(...)
+    {
+        LogError("IndexedSceneFile::Open: Malformed component type dictionary in " + filename + ".");
+        Close();
+        return false;
+    }
+
+    return true;
+}
+
+void IndexedSceneFile::Close()
+{
+    if (data_ && bytes_.isEmpty())
+        file_.unmap((uchar *)data_);
+    if (file_.isOpen())
+        file_.close();
+    bytes_.clear();
+    data_ = 0;
+    size_ = 0;
+    numEntities_ = 0;
+    numNodes_ = 0;
+    numSpatialEntries_ = 0;
+    componentTypes_.clear();
+    materialized_.clear();
+}
+
+QStringList IndexedSceneFile::ComponentTypes() const
+{
+    return componentTypes_;
+}
+
+bool IndexedSceneFile::IsMaterialized(entity_id_t id) const
+{
+    int index = IndexOf(id);
+    return index >= 0 && !materialized_[index].expired();
+}
+
+EntityPtr IndexedSceneFile::Materialize(entity_id_t id, AttributeChange::Type change)
+{
+    int index = IndexOf(id);
+    if (index < 0)
+        return EntityPtr();
+    if (materialized_[index].expired())
+        MaterializeIndices(std::vector<u32>(1, (u32)index), change);
+    return materialized_[index].lock();
+}
+
+QList<Entity *> IndexedSceneFile::MaterializeInAABB(const AABB &aabb, AttributeChange::Type change)
+{
+    std::vector<u32> indices;
+    QueryIndex(BoxTest(aabb), indices);
+    return MaterializeIndices(indices, change);
+}
+
+QList<Entity *> IndexedSceneFile::MaterializeInSphere(const float3 &center, float radius, AttributeChange::Type change)
+{
+    std::vector<u32> indices;
+    QueryIndex(SphereTest(center, radius), indices);
+    return MaterializeIndices(indices, change);
+}
+
+QList<Entity *> IndexedSceneFile::MaterializeUnplaced(AttributeChange::Type change)
+{
+    std::vector<u32> indices;
+    for(uint i = 0; i < numEntities_; ++i)
+        if (!(EntryAt(i).flags & cEntityPlaced))
+            indices.push_back(i);
+    return MaterializeIndices(indices, change);
+}
+
+QList<Entity *> IndexedSceneFile::MaterializeAll(AttributeChange::Type change)
+{
+    std::vector<u32> indices(numEntities_);
+    for(uint i = 0; i < numEntities_; ++i)
+        indices[i] = i;
+    return MaterializeIndices(indices, change);
+}
+
+int IndexedSceneFile::UnloadOutside(const AABB &aabb, AttributeChange::Type change)
+{
+    ScenePtr scene = scene_.lock();
+    if (!scene || !IsOpen())
+        return 0;
+
+    std::vector<u32> inside;
+    QueryIndex(BoxTest(aabb), inside);
+    std::vector<bool> keep(numEntities_, false);
+    for(size_t i = 0; i < inside.size(); ++i)
+        keep[inside[i]] = true;
+
+    int removed = 0;
+    for(uint i = 0; i < numEntities_; ++i)
+    {
+        if (keep[i] || materialized_[i].expired() || !(EntryAt(i).flags & cEntityPlaced))
+            continue;
+        EntityPtr entity = materialized_[i].lock();
+        materialized_[i].reset();
+        if (scene->RemoveEntity(entity->Id(), change))
+            ++removed;
+    }
+    return removed;
+}
+
+IndexedSceneFile::EntityEntry IndexedSceneFile::EntryAt(uint index) const
+{
+    DataDeserializer dd(data_ + entityTableOffset_ + index * cEntityEntrySize, cEntityEntrySize);
+    EntityEntry entry;
+    entry.id = dd.Read<u32>();
+    entry.offset = dd.Read<u32>();
+    entry.size = dd.Read<u32>();
+    entry.flags = dd.Read<u32>();
+    return entry;
+}
+
+int IndexedSceneFile::IndexOf(entity_id_t id) const
+{
+    // The entity table is sorted by ID.
+    uint first = 0;
+    uint last = numEntities_;
+    while(first < last)
+    {
+        uint mid = first + (last - first) / 2;
+        entity_id_t midId = EntryAt(mid).id;
+        if (midId == id)
+            return (int)mid;
+        if (midId < id)
+            first = mid + 1;
+        else
+            last = mid;
+    }
+    return -1;
+}
+
+AABB IndexedSceneFile::NodeAt(uint index, u32 &first, u32 &count) const
+{
+    DataDeserializer dd(data_ + nodesOffset_ + index * cNodeSize, cNodeSize);
+    AABB box = ReadAABB(dd);
+    first = dd.Read<u32>();
+    count = dd.Read<u32>();
+    return box;
+}
+
+AABB IndexedSceneFile::SpatialEntryAt(uint index, u32 &entityIndex) const
+{
+    DataDeserializer dd(data_ + spatialEntriesOffset_ + index * cSpatialEntrySize, cSpatialEntrySize);
+    AABB bounds = ReadAABB(dd);
+    entityIndex = dd.Read<u32>();
+    return bounds;
+}
+
+template <typename Test>
+void IndexedSceneFile::QueryIndex(const Test &test, std::vector<u32> &result) const
+{
+    if (!IsOpen() || !numNodes_)
+        return;
+
+    std::vector<u32> stack(1, 0);
+    while(!stack.empty())
+    {
+        const u32 index = stack.back();
+        stack.pop_back();
+        u32 first, count;
+        if (!test(NodeAt(index, first, count)))
+            continue;
+
+        if (count)
+        {
+            // Validate the ranges, so that a corrupt file can not make the traversal read out of bounds.
+            if (first > numSpatialEntries_ || count > numSpatialEntries_ - first)
+                continue;
+            for(u32 i = first; i < first + count; ++i)
+            {
+                u32 entityIndex;
+                if (test(SpatialEntryAt(i, entityIndex)) && entityIndex < numEntities_)
+                    result.push_back(entityIndex);
+            }
+        }
+        else if (index + 1 < numNodes_ && first > index + 1 && first < numNodes_)
+        {
+            // The children follow their parent in preorder, which also guarantees that the traversal terminates.
+            stack.push_back(index + 1);
+            stack.push_back(first);
+        }
+    }
+}
+
+QList<Entity *> IndexedSceneFile::MaterializeIndices(const std::vector<u32> &indices, AttributeChange::Type change)
+{
+    PROFILE(IndexedSceneFile_MaterializeIndices);
+
+    QList<Entity *> ret;
+    ScenePtr scene = scene_.lock();
+    if (!scene || !IsOpen())
+        return ret;
+
+    std::vector<u32> pending;
+    size_t contentSize = sizeof(u32);
+    for(size_t i = 0; i < indices.size(); ++i)
+    {
+        if (indices[i] >= numEntities_ || !materialized_[indices[i]].expired())
+            continue;
+        EntityEntry entry = EntryAt(indices[i]);
+        if (entry.offset > size_ || entry.size > size_ - entry.offset)
+        {
+            LogError("IndexedSceneFile::MaterializeIndices: Data of entity " + QString::number(entry.id) + " out of bounds.");
+            continue;
+        }
+        pending.push_back(indices[i]);
+        contentSize += entry.size;
+    }
+    if (pending.empty())
+        return ret;
+
+    // Create all the pending entities with one call, so that they are decoded in parallel and their parent references are resolved together.
+    QByteArray content;
+    content.resize((int)contentSize);
+    DataSerializer dest(content.data(), content.size());
+    dest.Add<u32>((u32)pending.size());
+    for(size_t i = 0; i < pending.size(); ++i)
+    {
+        EntityEntry entry = EntryAt(pending[i]);
+        if (entry.size)
+            dest.AddArray<u8>((const u8*)data_ + entry.offset, entry.size);
+    }
+    scene->CreateContentFromBinary(content.constData(), content.size(), true, change);
+
+    for(size_t i = 0; i < pending.size(); ++i)
+    {
+        EntityPtr entity = scene->EntityById(EntryAt(pending[i]).id);
+        materialized_[pending[i]] = entity;
+        if (entity)
+            ret.append(entity.get());
+    }
+    return ret;
+}
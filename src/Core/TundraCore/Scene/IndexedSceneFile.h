@@ -0,0 +1,144 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#pragma once
+
+#include "TundraCoreApi.h"
+#include "SceneFwd.h"
+#include "AttributeChangeType.h"
+#include "Geometry/AABB.h"
+#include "Math/float3.h"
+
+#include <QObject>
+#include <QFile>
+#include <QByteArray>
+#include <QStringList>
+#include <QList>
+
+#include <vector>
+
+/// Indexed binary scene file, whose entities are materialized into a scene on demand.
+/** The indexed binary scene format (version 2 of .tbin) consists of:
+    <ul>
+    <li>A header with the "TBN2" magic, the version and the offsets and sizes of the sections below.
+    <li>A component type dictionary with the type IDs and names of all the components in the file.
+    <li>An entity table with the ID, data offset, data size and flags of each root-level entity, sorted by ID.
+    <li>A spatial index: a bounding volume hierarchy over the bounds of the placed root-level entities, built on save.
+        The bounds of an entity enclose the world positions of the placeables of it and its children, and the world bounds
+        of their Ogre meshes whose data is on the local disk, read with OgreMeshBounds.
+    <li>The entity data, each root-level entity with its children in the record format of the flat binary scene format.
+    </ul>
+
+    Opening a file memory-maps it and reads only the header and the type dictionary, so even a huge scene opens instantly.
+    The entities are then created into the scene as needed, e.g. with MaterializeInAABB around the observers, touching
+    only the pages of the file that are used. The entities created from the file keep their IDs, so entity and parent
+    references between entities that are materialized at different times stay valid.
+
+    Scene::LoadSceneBinary and Scene::CreateContentFromBinary also accept the indexed format, and load all of it.
+    Save a scene in the indexed format with Scene::SaveSceneBinaryIndexed. */
+class TUNDRACORE_API IndexedSceneFile : public QObject
+{
+    Q_OBJECT
+    Q_PROPERTY(bool open READ IsOpen)
+    Q_PROPERTY(uint numEntities READ NumEntities)
+    Q_PROPERTY(uint numMaterialized READ NumMaterialized)
+
+public:
+    /// Creates a file reader that materializes the entities into the scene.
+    explicit IndexedSceneFile(const ScenePtr &scene);
+    ~IndexedSceneFile();
+
+    /// Saves the root-level entities of the scene and their children in the indexed format.
+    static bool Save(const Scene *scene, const QString &filename, bool saveTemporary, bool saveLocal);
+
+    /// Returns whether the data starts with the header of the indexed format.
+    static bool IsIndexedSceneData(const char *data, size_t numBytes);
+
+    /// Converts indexed scene data to the flat binary scene format of Scene::CreateContentFromBinary.
+    /** Returns an empty array if the data is malformed. */
+    static QByteArray ToFlatSceneData(const char *data, size_t numBytes);
+
+    /// Returns whether a file is open.
+    bool IsOpen() const { return data_ != 0; }
+
+    /// Returns the number of root-level entities in the file.
+    uint NumEntities() const { return numEntities_; }
+
+    /// Returns the number of root-level entities of the file currently in the scene.
+    uint NumMaterialized() const;
+
+public slots:
+    /// Opens an indexed scene file. Returns false if the file can not be read or is not in the indexed format.
+    bool Open(const QString &filename);
+
+    /// Closes the file. The entities already materialized stay in the scene.
+    void Close();
+
+    /// Returns the names of the component types in the file.
+    QStringList ComponentTypes() const;
+
+    /// Returns whether the root-level entity of the ID in the file is currently in the scene.
+    bool IsMaterialized(entity_id_t id) const;
+
+    /// Creates the root-level entity of the ID in the file and its children into the scene, if it is not there yet.
+    /** Returns the entity, or null if the file has no such entity. */
+    EntityPtr Materialize(entity_id_t id, AttributeChange::Type change = AttributeChange::Default);
+
+    /// Creates the placed root-level entities whose bounds intersect the box, with their children, into the scene.
+    /** Returns the root-level entities created, not those that were already in the scene. */
+    QList<Entity *> MaterializeInAABB(const AABB &aabb, AttributeChange::Type change = AttributeChange::Default);
+
+    /// Creates the placed root-level entities whose bounds intersect the sphere, with their children, into the scene.
+    /** Returns the root-level entities created, not those that were already in the scene. */
+    QList<Entity *> MaterializeInSphere(const float3 &center, float radius, AttributeChange::Type change = AttributeChange::Default);
+
+    /// Creates the root-level entities that have no placeable, e.g. environment and script entities, into the scene.
+    QList<Entity *> MaterializeUnplaced(AttributeChange::Type change = AttributeChange::Default);
+
+    /// Creates all the root-level entities of the file into the scene.
+    QList<Entity *> MaterializeAll(AttributeChange::Type change = AttributeChange::Default);
+
+    /// Removes the materialized placed root-level entities whose bounds do not intersect the box from the scene.
+    /** The changes made to the removed entities since they were materialized are lost, unless the scene is saved first.
+        Returns the number of root-level entities removed. */
+    int UnloadOutside(const AABB &aabb, AttributeChange::Type change = AttributeChange::Default);
+
+private:
+    /// An entry of the entity table.
+    struct EntityEntry
+    {
+        entity_id_t id;
+        u32 offset; ///< Offset of the entity data from the start of the file.
+        u32 size;
+        u32 flags;
+    };
+
+    /// Returns the entry of the entity table at the index.
+    EntityEntry EntryAt(uint index) const;
+    /// Returns the index of the entity of the ID in the entity table, or -1 if there is none.
+    int IndexOf(entity_id_t id) const;
+    /// Reads the box of the spatial index node at the index, and the right child or entry range of the node.
+    AABB NodeAt(uint index, u32 &first, u32 &count) const;
+    /// Reads the bounds of the spatial index entry at the index, and the entity table index of the entry.
+    AABB SpatialEntryAt(uint index, u32 &entityIndex) const;
+
+    /// Appends the entity table indices of the placed entities whose bounds pass the intersection test.
+    template <typename Test>
+    void QueryIndex(const Test &test, std::vector<u32> &result) const;
+
+    /// Creates the entities of the entity table indices that are not in the scene yet. Returns the root-level entities created.
+    QList<Entity *> MaterializeIndices(const std::vector<u32> &indices, AttributeChange::Type change);
+
+    SceneWeakPtr scene_;
+    QFile file_;
+    QByteArray bytes_; ///< Contents of the file if it could not be memory-mapped.
+    const char *data_; ///< Mapped or read data of the file, or null if no file is open.
+    size_t size_;
+    uint numEntities_;
+    u32 entityTableOffset_;
+    u32 numNodes_;
+    u32 nodesOffset_;
+    u32 numSpatialEntries_;
+    u32 spatialEntriesOffset_;
+    QStringList componentTypes_;
+    std::vector<EntityWeakPtr> materialized_; ///< Entities created from the file, by entity table index.
+};
@@ -7,6 +7,7 @@
 #include "Scene/Scene.h"
 #include "Entity.h"
 #include "SceneDesc.h"
+#include "IndexedSceneFile.h"
 #include "IComponent.h"
 #include "IAttribute.h"
 #include "EC_Name.h"
@@ -16,21 +17,34 @@
 #include "Framework.h"
 #include "Application.h"
 #include "AssetAPI.h"
+#include "IAsset.h"
+#include "AssetReference.h"
 #include "FrameAPI.h"
 #include "Profiler.h"
 #include "LoggingFunctions.h"
+#include "CoreException.h"
+#include "EC_PlaceholderComponent.h"
+#include "ObjectPool.h"
+#include "SceneSnapshot.h"
+#include "ScenePersistence.h"
 
 #include <QString>
 #include <QRegExp>
 #include <QDomDocument>
+#include <QXmlStreamReader>
 #include <QFile>
 #include <QDir>
-#include <QTextStream>
+#include <QFileInfo>
 #include <QHash>
+#include <QThread>
+#include <QThreadPool>
+#include <QRunnable>
 
 #include <kNet/DataDeserializer.h>
 #include <kNet/DataSerializer.h>
 
+#include <algorithm>
+#include <set>
 #include <utility>
 #include "MemoryLeakCheck.h"
 
@@ -40,7 +54,11 @@ Scene::Scene(const QString &name, Framework *framework, bool viewEnabled, bool a
     name_(name),
     framework_(framework),
     interpolating_(false),
-    authority_(authority)
+    authority_(authority),
+    changeTransactionDepth_(0),
+    snapshotsEnabled_(false),
+    persistence_(0),
+    changeJournalEnabled_(false)
 {
     // In headless mode only view disabled-scenes can be created
     viewEnabled_ = framework->IsHeadless() ? false : viewEnabled;
@@ -52,6 +70,10 @@ Scene::Scene(const QString &name, Framework *framework, bool viewEnabled, bool a
 Scene::~Scene()
 {
     EndAllAttributeInterpolations();
+
+    // Write the last checkpoint while the entities are still there
+    if (persistence_)
+        persistence_->Stop();
     
     // Do not send entity removal or scene cleared events on destruction
     RemoveAllEntities(false);
@@ -68,18 +90,7 @@ EntityPtr Scene::CreateEntity(entity_id_t id, const QStringList &components, Att
 {
     // Figure out new entity id
     if (id == 0)
-    {
-        // Loop until a free ID found
-        for (;;)
-        {
-            if (IsAuthority())
-                id = replicated ? idGenerator_.AllocateReplicated() : idGenerator_.AllocateLocal();
-            else
-                id = replicated ? idGenerator_.AllocateUnacked() : idGenerator_.AllocateLocal();
-            if (entities_.find(id) == entities_.end())
-                break;
-        }
-    }
+        id = AllocateFreeId(replicated);
     else
     {
         if(entities_.find(id) != entities_.end())
@@ -95,7 +106,7 @@ EntityPtr Scene::CreateEntity(entity_id_t id, const QStringList &components, Att
         }
     }
 
-    EntityPtr entity = MAKE_SHARED(Entity, framework_, id, this);
+    EntityPtr entity = MAKE_POOLED_SHARED(Entity, framework_, id, this);
     entity->SetTemporary(temporary);
     for(int i = 0 ;i < components.size(); ++i)
     {
@@ -114,6 +125,74 @@ EntityPtr Scene::CreateEntity(entity_id_t id, const QStringList &components, Att
     return entity;
 }
 
+entity_id_t Scene::AllocateFreeId(bool replicated)
+{
+    // Loop until a free ID found
+    for (;;)
+    {
+        entity_id_t id;
+        if (IsAuthority())
+            id = replicated ? idGenerator_.AllocateReplicated() : idGenerator_.AllocateLocal();
+        else
+            id = replicated ? idGenerator_.AllocateUnacked() : idGenerator_.AllocateLocal();
+        if (entities_.find(id) == entities_.end())
+            return id;
+    }
+}
+
+EntityList Scene::CreateEntities(uint count, const QStringList &components, AttributeChange::Type change, bool replicated, bool componentsReplicated, bool temporary)
+{
+    PROFILE(Scene_CreateEntities);
+    EntityList created;
+    if (count == 0)
+        return created;
+
+    // Allocate all the IDs first, so that the table grows only once for them
+    std::vector<entity_id_t> ids;
+    ids.reserve(count);
+    for(uint i = 0; i < count; ++i)
+        ids.push_back(AllocateFreeId(replicated));
+    if (ids.back() >= ids.front() && ids.back() - ids.front() < 2 * count)
+        entities_.Reserve(ids.front(), ids.back() - ids.front() + 1);
+
+    // Look up the component types once for all the entities
+    SceneAPI *sceneAPI = framework_->Scene();
+    std::vector<u32> typeIds;
+    for(int i = 0; i < components.size(); ++i)
+    {
+        u32 typeId = sceneAPI->GetComponentTypeId(components[i]);
+        if (typeId == 0)
+            LogError("Scene::CreateEntities: unknown component type " + components[i]);
+        else
+            typeIds.push_back(typeId);
+    }
+
+    CreatedEntityBatch batch;
+    batch.change = change;
+    batch.entities.reserve(count);
+    for(uint i = 0; i < count; ++i)
+    {
+        EntityPtr entity = MAKE_POOLED_SHARED(Entity, framework_, ids[i], this);
+        entity->SetTemporary(temporary);
+        for(size_t j = 0; j < typeIds.size(); ++j)
+        {
+            ComponentPtr newComp = sceneAPI->CreateComponentById(this, typeIds[j]);
+            if (newComp)
+            {
+                newComp->SetReplicated(componentsReplicated);
+                entity->AddComponent(newComp, change);
+            }
+        }
+        entities_[entity->Id()] = entity;
+        batch.entities.push_back(entity);
+        created.push_back(entity);
+    }
+
+    if (change != AttributeChange::Disconnected)
+        entityBatchesCreatedThisFrame_.push_back(batch);
+    return created;
+}
+
 EntityPtr Scene::EntityById(entity_id_t id) const
 {
     EntityMap::const_iterator it = entities_.find(id);
@@ -123,16 +202,68 @@ EntityPtr Scene::EntityById(entity_id_t id) const
     return EntityPtr();
 }
 
+namespace
+{
+
+/// Adds a component to the name or group index under the key, unless the key is empty.
+template<typename Index>
+void AddToNameIndex(Index &index, const QString &key, IComponent *comp)
+{
+    if (!key.isEmpty())
+        index[key].push_back(comp);
+}
+
+/// Removes a component from the name or group index under the key, and the key if no components remain.
+template<typename Index>
+void RemoveFromNameIndex(Index &index, const QString &key, IComponent *comp)
+{
+    if (key.isEmpty())
+        return;
+    typename Index::iterator it = index.find(key);
+    if (it == index.end())
+        return;
+    std::vector<IComponent*> &components = it.value();
+    components.erase(std::remove(components.begin(), components.end(), comp), components.end());
+    if (components.empty())
+        index.erase(it);
+}
+
+bool EntityIdLess(const Entity *a, const Entity *b)
+{
+    return a->Id() < b->Id();
+}
+
+/// Returns the entities in ascending ID order, like a scan of all the entities of the scene would.
+EntityList ToSortedEntityList(std::vector<Entity*> &entities)
+{
+    std::sort(entities.begin(), entities.end(), EntityIdLess);
+    // An entity with many EC_Name components of the same name is listed once
+    entities.erase(std::unique(entities.begin(), entities.end()), entities.end());
+    EntityList result;
+    for(size_t i = 0; i < entities.size(); ++i)
+        result.push_back(entities[i]->shared_from_this());
+    return result;
+}
+
+} // ~unnamed namespace
+
 EntityPtr Scene::EntityByName(const QString &name) const
 {
     if (name.isEmpty())
         return EntityPtr();
 
-    for(const_iterator it = begin(); it != end(); ++it)
-        if (it->second->Name() == name)
-            return it->second;
+    QMap<QString, std::vector<IComponent*> >::const_iterator it = componentsByName_.find(name);
+    if (it == componentsByName_.end())
+        return EntityPtr();
 
-    return EntityPtr();
+    // Return the entity of the lowest ID, like a scan of the entities in ascending ID order
+    std::vector<Entity*> named;
+    AppendEntitiesNamed(name, it.value(), named);
+    Entity *first = 0;
+    for(size_t i = 0; i < named.size(); ++i)
+        if (!first || named[i]->Id() < first->Id())
+            first = named[i];
+    return first ? first->shared_from_this() : EntityPtr();
 }
 
 bool Scene::IsUniqueName(const QString& name) const
@@ -197,6 +328,63 @@ bool Scene::RemoveEntity(entity_id_t id, AttributeChange::Type change)
     return false;
 }
 
+namespace
+{
+
+/// Appends the entity and its descendants, parents before children, skipping the entities already appended.
+void AppendWithDescendants(const EntityPtr &entity, std::vector<EntityPtr> &entities, std::set<Entity*> &appended)
+{
+    if (!appended.insert(entity.get()).second)
+        return;
+    entities.push_back(entity);
+    EntityList children = entity->Children();
+    for(EntityList::const_iterator it = children.begin(); it != children.end(); ++it)
+        AppendWithDescendants(*it, entities, appended);
+}
+
+} // ~unnamed namespace
+
+uint Scene::RemoveEntities(const EntityList &entities, AttributeChange::Type change)
+{
+    PROFILE(Scene_RemoveEntities);
+    std::vector<EntityPtr> removed;
+    std::set<Entity*> appended;
+    for(EntityList::const_iterator it = entities.begin(); it != entities.end(); ++it)
+        if (*it && (*it)->ParentScene() == this)
+            AppendWithDescendants(*it, removed, appended);
+    if (removed.empty())
+        return 0;
+
+    // Signal first, as there may be scripts which depend on the components still being there for their cleanup
+    if (change != AttributeChange::Disconnected)
+    {
+        AttributeChange::Type signalChange = (change == AttributeChange::Default ? AttributeChange::Replicate : change);
+        EntityList signaled(removed.begin(), removed.end());
+        for(size_t i = 0; i < removed.size(); ++i)
+            RecordEntityChange(removed[i].get(), SceneChange::EntityRemoved, signalChange);
+        emit EntitiesRemoved(signaled, signalChange);
+        for(size_t i = 0; i < removed.size(); ++i)
+            removed[i]->EmitEntityRemoved(signalChange);
+    }
+
+    // Remove the children before their parents, so that a parent has no children of the batch left to remove one by one
+    for(size_t i = removed.size(); i-- > 0;)
+    {
+        const EntityPtr &entity = removed[i];
+        // A signal handler may have removed it already
+        if (entity->ParentScene() != this)
+            continue;
+        entity->RemoveAllComponents(change);
+        if (entity->Parent())
+            entity->SetParent(EntityPtr(), AttributeChange::Disconnected);
+        // Children added by the signal handlers are removed one by one
+        entity->RemoveAllChildren(change);
+        entities_.erase(entity->Id());
+        entity->SetScene(0);
+    }
+    return (uint)removed.size();
+}
+
 void Scene::RemoveAllEntities(bool signal, AttributeChange::Type change)
 {
     // If we don't want to emit signals, make sure the change mode is disconnected.
@@ -226,6 +414,8 @@ void Scene::RemoveAllEntities(bool signal, AttributeChange::Type change)
         LogWarning("Scene::RemoveAllEntities: entity map was not clear after removing all entities, clearing manually");
         entities_.clear();
     }
+    componentsByType_.clear();
+    componentIndices_.clear();
     
     if (signal)
         emit SceneCleared(this);
@@ -254,9 +444,19 @@ EntityList Scene::EntitiesWithComponent(const QString &typeName, const QString &
 EntityList Scene::EntitiesWithComponent(u32 typeId, const QString &name) const
 {
     EntityList entities;
-    for(const_iterator it = begin(); it != end(); ++it)
-        if ((name.isEmpty() && it->second->Component(typeId)) || it->second->Component(typeId, name))
-            entities.push_back(it->second);
+    std::map<u32, std::vector<IComponent*> >::const_iterator type = componentsByType_.find(typeId);
+    if (type == componentsByType_.end())
+        return entities;
+
+    // An entity can have many components of the same type, so list each entity only once.
+    std::set<Entity*> found;
+    const std::vector<IComponent*> &components = type->second;
+    for(size_t i = 0; i < components.size(); ++i)
+    {
+        Entity *entity = components[i]->ParentEntity();
+        if (entity && (name.isEmpty() || components[i]->Name() == name) && found.insert(entity).second)
+            entities.push_back(entity->shared_from_this());
+    }
     return entities;
 }
 
@@ -266,11 +466,20 @@ EntityList Scene::EntitiesOfGroup(const QString &groupName) const
     if (groupName.isEmpty())
         return entities;
 
-    for (const_iterator it = begin(); it != end(); ++it)
-        if (it->second->Group() == groupName)
-            entities.push_back(it->second);
+    QHash<QString, std::vector<IComponent*> >::const_iterator it = componentsByGroup_.find(groupName);
+    if (it == componentsByGroup_.end())
+        return entities;
 
-    return entities;
+    std::vector<Entity*> grouped;
+    const std::vector<IComponent*> &components = it.value();
+    for(size_t i = 0; i < components.size(); ++i)
+    {
+        // Entity::Group is that of the first EC_Name of the entity
+        Entity *entity = components[i]->ParentEntity();
+        if (entity && entity->Group() == groupName)
+            grouped.push_back(entity);
+    }
+    return ToSortedEntityList(grouped);
 }
 
 Entity::ComponentVector Scene::Components(const QString &typeName, const QString &name) const
@@ -281,23 +490,24 @@ Entity::ComponentVector Scene::Components(const QString &typeName, const QString
 Entity::ComponentVector Scene::Components(u32 typeId, const QString &name) const
 {
     Entity::ComponentVector ret;
+    std::map<u32, std::vector<IComponent*> >::const_iterator type = componentsByType_.find(typeId);
+    if (type == componentsByType_.end())
+        return ret;
+
+    const std::vector<IComponent*> &components = type->second;
     if (name.isEmpty())
     {
-        for(const_iterator it = begin(); it != end(); ++it)
-        {
-            Entity::ComponentVector components =  it->second->ComponentsOfType(typeId);
-            if (!components.empty())
-                ret.insert(ret.end(), components.begin(), components.end());
-        }
+        ret.reserve(components.size());
+        for(size_t i = 0; i < components.size(); ++i)
+            ret.push_back(components[i]->shared_from_this());
     }
     else
     {
-        for(const_iterator it = begin(); it != end(); ++it)
-        {
-            ComponentPtr component = it->second->GetComponent(typeId, name);
-            if (component)
-                ret.push_back(component);
-        }
+        // Entity::GetComponent returns the first component with the name, so return at most one per entity.
+        std::set<Entity*> found;
+        for(size_t i = 0; i < components.size(); ++i)
+            if (components[i]->Name() == name && found.insert(components[i]->ParentEntity()).second)
+                ret.push_back(components[i]->shared_from_this());
     }
     return ret;
 }
@@ -315,19 +525,24 @@ EntityList Scene::GetAllEntities() const
 
 void Scene::EmitComponentAdded(Entity* entity, IComponent* comp, AttributeChange::Type change)
 {
+    // Index also the components added without signaling
+    IndexComponent(comp);
     if (change == AttributeChange::Disconnected)
         return;
     if (change == AttributeChange::Default)
         change = comp->UpdateMode();
+    RecordComponentChange(comp, SceneChange::ComponentAdded, change);
     emit ComponentAdded(entity, comp, change);
 }
 
 void Scene::EmitComponentRemoved(Entity* entity, IComponent* comp, AttributeChange::Type change)
 {
+    UnindexComponent(comp);
     if (change == AttributeChange::Disconnected)
         return;
     if (change == AttributeChange::Default)
         change = comp->UpdateMode();
+    RecordComponentChange(comp, SceneChange::ComponentRemoved, change);
     emit ComponentRemoved(entity, comp, change);
 }
 
@@ -337,9 +552,97 @@ void Scene::EmitAttributeChanged(IComponent* comp, IAttribute* attribute, Attrib
         return;
     if (change == AttributeChange::Default)
         change = comp->UpdateMode();
+    RecordComponentChange(comp, SceneChange::AttributesChanged, change, attribute->Index());
+    changeListeners_.Dispatch(comp, attribute, change);
+    if (!changeListenersByType_.empty())
+    {
+        std::map<u32, AttributeChangeListenerList>::iterator it = changeListenersByType_.find(comp->TypeId());
+        if (it != changeListenersByType_.end())
+            it->second.Dispatch(comp, attribute, change);
+    }
     emit AttributeChanged(comp, attribute, change);
 }
 
+void Scene::AddAttributeChangeListener(IAttributeChangeListener *listener, u32 componentTypeId, int attributeIndex)
+{
+    if (componentTypeId == 0)
+        changeListeners_.Add(listener, attributeIndex);
+    else
+        changeListenersByType_[componentTypeId].Add(listener, attributeIndex);
+}
+
+void Scene::RemoveAttributeChangeListener(IAttributeChangeListener *listener)
+{
+    changeListeners_.Remove(listener);
+    // The lists are not erased when they become empty, as a removal may happen while the list is dispatching.
+    for(std::map<u32, AttributeChangeListenerList>::iterator it = changeListenersByType_.begin(); it != changeListenersByType_.end(); ++it)
+        it->second.Remove(listener);
+}
+
+void Scene::DeferAttributeChange(IComponent* comp, IAttribute* attribute, AttributeChange::Type change)
+{
+    std::map<IComponent*, size_t>::iterator it = deferredChangeIndices_.find(comp);
+    // A component may have been destroyed and another one allocated at its address inside the transaction
+    if (it == deferredChangeIndices_.end() || deferredChanges_[it->second].component.expired())
+    {
+        DeferredComponentChanges changes;
+        changes.component = comp->shared_from_this();
+        deferredChangeIndices_[comp] = deferredChanges_.size();
+        deferredChanges_.push_back(changes);
+        it = deferredChangeIndices_.find(comp);
+    }
+
+    std::vector<std::pair<u8, AttributeChange::Type> > &attributes = deferredChanges_[it->second].attributes;
+    for(size_t i = 0; i < attributes.size(); ++i)
+        if (attributes[i].first == attribute->Index())
+        {
+            // Replicate is stronger than LocalOnly
+            attributes[i].second = std::max(attributes[i].second, change);
+            return;
+        }
+    attributes.push_back(std::make_pair(attribute->Index(), change));
+}
+
+void Scene::BeginChangeTransaction()
+{
+    ++changeTransactionDepth_;
+}
+
+void Scene::CommitChangeTransaction()
+{
+    if (changeTransactionDepth_ <= 0)
+    {
+        LogWarning("Scene::CommitChangeTransaction: no change transaction open.");
+        return;
+    }
+    if (--changeTransactionDepth_ > 0)
+        return;
+
+    PROFILE(Scene_CommitChangeTransaction);
+    // Take the changes first, as the signal handlers may change attributes, and those are signaled immediately
+    std::vector<DeferredComponentChanges> changes;
+    changes.swap(deferredChanges_);
+    deferredChangeIndices_.clear();
+
+    std::vector<std::pair<IAttribute*, AttributeChange::Type> > attributes;
+    for(size_t i = 0; i < changes.size(); ++i)
+    {
+        ComponentPtr comp = changes[i].component.lock();
+        if (!comp)
+            continue;
+        attributes.clear();
+        const AttributeVector &compAttributes = comp->Attributes();
+        for(size_t j = 0; j < changes[i].attributes.size(); ++j)
+        {
+            u8 index = changes[i].attributes[j].first;
+            // Dynamic attributes may have been removed inside the transaction
+            if (index < compAttributes.size() && compAttributes[index])
+                attributes.push_back(std::make_pair(compAttributes[index], changes[i].attributes[j].second));
+        }
+        comp->EmitDeferredAttributeChanges(attributes);
+    }
+}
+
 void Scene::EmitAttributeAdded(IComponent* comp, IAttribute* attribute, AttributeChange::Type change)
 {
     // "Stealth" addition (disconnected changetype) is not supported. Always signal.
@@ -347,6 +650,7 @@ void Scene::EmitAttributeAdded(IComponent* comp, IAttribute* attribute, Attribut
         return;
     if (change == AttributeChange::Default)
         change = comp->UpdateMode();
+    RecordComponentChange(comp, SceneChange::AttributesAddedOrRemoved, change, attribute->Index());
     emit AttributeAdded(comp, attribute, change);
 }
 
@@ -357,6 +661,7 @@ void Scene::EmitAttributeRemoved(IComponent* comp, IAttribute* attribute, Attrib
         return;
     if (change == AttributeChange::Default)
         change = comp->UpdateMode();
+    RecordComponentChange(comp, SceneChange::AttributesAddedOrRemoved, change, attribute->Index());
     emit AttributeRemoved(comp, attribute, change);
 }
 
@@ -378,7 +683,10 @@ void Scene::EmitEntityCreated(Entity *entity, AttributeChange::Type change)
         change = AttributeChange::Replicate;
     ///@note This is not enough, it might be that entity is deleted after this call so we have dangling pointer in queue. 
     if (entity)
+    {
+        RecordEntityChange(entity, SceneChange::EntityCreated, change);
         emit EntityCreated(entity, change);
+    }
 }
 
 void Scene::EmitEntityParentChanged(Entity* entity, Entity* newParent, AttributeChange::Type change)
@@ -387,6 +695,7 @@ void Scene::EmitEntityParentChanged(Entity* entity, Entity* newParent, Attribute
         return;
     if (change == AttributeChange::Default)
         change = entity->IsLocal() ? AttributeChange::LocalOnly : AttributeChange::Replicate;
+    RecordEntityChange(entity, SceneChange::EntityParentChanged, change);
     emit EntityParentChanged(entity, newParent, change);
 }
 
@@ -396,6 +705,7 @@ void Scene::EmitEntityRemoved(Entity* entity, AttributeChange::Type change)
         return;
     if (change == AttributeChange::Default)
         change = AttributeChange::Replicate;
+    RecordEntityChange(entity, SceneChange::EntityRemoved, change);
     emit EntityRemoved(entity, change);
     entity->EmitEntityRemoved(change);
 }
@@ -451,23 +761,22 @@ QList<Entity *> Scene::LoadSceneXML(const QString& filename, bool clearScene, bo
         return ret;
     }
 
-    QTextStream stream(&file);
-    stream.setCodec("UTF-8");
-    QDomDocument scene_doc("Scene");
-    QString errorMsg;
-    int errorLine, errorColumn;
-    if (!scene_doc.setContent(stream.readAll(), &errorMsg, &errorLine, &errorColumn))
-    {
-        LogError(QString("Parsing scene XML from %1 failed when loading Scene XML: %2 at line %3 column %4.").arg(filename).arg(errorMsg).arg(errorLine).arg(errorColumn));
-        file.close();
-        return ret;
-    }
-
     // Purge all old entities. Send events for the removal
     if (clearScene)
         RemoveAllEntities(true, change);
 
-    return CreateContentFromXml(scene_doc, useEntityIDsFromFile, change);
+    return CreateContentFromXml(&file, useEntityIDsFromFile, change);
+}
+
+namespace
+{
+    /// Tells whether an entity is in a set of prototype entities.
+    struct IsInPrototypeSet
+    {
+        explicit IsInPrototypeSet(const std::set<Entity *> &prototypes) : prototypes_(prototypes) {}
+        bool operator()(const EntityPtr &entity) const { return prototypes_.find(entity.get()) != prototypes_.end(); }
+        const std::set<Entity *> &prototypes_;
+    };
 }
 
 QByteArray Scene::SerializeToXmlString(bool serializeTemporary, bool serializeLocal) const
@@ -477,6 +786,17 @@ QByteArray Scene::SerializeToXmlString(bool serializeTemporary, bool serializeLo
 
     EntityList rootLevel = RootLevelEntities();
 
+    // Write the prototype entities first, so that they exist when their instances are loaded.
+    std::set<Entity *> prototypes;
+    for(const_iterator iter = begin(); iter != end(); ++iter)
+    {
+        EntityPtr prototype = iter->second->Prototype();
+        if (prototype)
+            prototypes.insert(prototype.get());
+    }
+    if (!prototypes.empty())
+        std::stable_partition(rootLevel.begin(), rootLevel.end(), IsInPrototypeSet(prototypes));
+
     for(EntityList::const_iterator iter = rootLevel.begin(); iter != rootLevel.end(); ++iter)
     {
         EntityPtr ent = *iter;
@@ -585,19 +905,30 @@ bool Scene::SaveSceneBinary(const QString& filename, bool getTemporary, bool get
     }
 }
 
+bool Scene::SaveSceneBinaryIndexed(const QString& filename, bool saveTemporary, bool saveLocal) const
+{
+    return IndexedSceneFile::Save(this, filename, saveTemporary, saveLocal);
+}
+
+ScenePersistence *Scene::Persistence()
+{
+    if (!persistence_)
+        persistence_ = new ScenePersistence(this); // Deleted as a child of the scene
+    return persistence_;
+}
+
 QList<Entity *> Scene::CreateContentFromXml(const QString &xml,  bool useEntityIDsFromFile, AttributeChange::Type change)
 {
-    QList<Entity *> ret;
-    QString errorMsg;
-    QDomDocument scene_doc("Scene");
-    int errorLine, errorColumn;
-    if (!scene_doc.setContent(xml, false, &errorMsg, &errorLine, &errorColumn))
-    {
-        LogError(QString("Parsing scene XML from text failed when loading Scene XML: %1 at line %2 column %3.").arg(errorMsg).arg(errorLine).arg(errorColumn));
-        return ret;
-    }
+    QXmlStreamReader reader(xml);
+    return CreateContentFromXmlStream(reader, useEntityIDsFromFile, change);
+}
 
-    return CreateContentFromXml(scene_doc, useEntityIDsFromFile, change);
+QList<Entity *> Scene::CreateContentFromXml(QIODevice *device, bool useEntityIDsFromFile, AttributeChange::Type change)
+{
+    if (!device)
+        return QList<Entity *>();
+    QXmlStreamReader reader(device);
+    return CreateContentFromXmlStream(reader, useEntityIDsFromFile, change);
 }
 
 QList<Entity *> Scene::CreateContentFromXml(const QDomDocument &xml, bool useEntityIDsFromFile, AttributeChange::Type change)
@@ -634,33 +965,101 @@ QList<Entity *> Scene::CreateContentFromXml(const QDomDocument &xml, bool useEnt
         ent_elem = ent_elem.nextSiblingElement("entity");
     }
 
+    return FinishCreatedContent(entities, useEntityIDsFromFile, oldToNewIds, change);
+}
+
+namespace
+{
+
+/// Reads the element the stream is at, with its attributes and child elements, into an element of the document.
+QDomElement ReadXmlElement(QXmlStreamReader &reader, QDomDocument &doc)
+{
+    QDomElement elem = doc.createElement(reader.name().toString());
+    foreach(const QXmlStreamAttribute &attr, reader.attributes())
+        elem.setAttribute(attr.name().toString(), attr.value().toString());
+    while(reader.readNextStartElement())
+        elem.appendChild(ReadXmlElement(reader, doc));
+    return elem;
+}
+
+} // ~unnamed namespace
+
+entity_id_t Scene::ReserveIdForCreatedEntity(entity_id_t id, bool replicated, bool useEntityIDsFromFile, QHash<entity_id_t, entity_id_t>& oldToNewIds)
+{
+    if (!useEntityIDsFromFile || id == 0) // If we don't want to use entity IDs from file, or if file doesn't contain one, generate a new one.
+    {
+        entity_id_t originaId = id;
+        id = replicated ? NextFreeId() : NextFreeIdLocal();
+        if (originaId != 0 && !oldToNewIds.contains(originaId))
+            oldToNewIds[originaId] = id;
+    }
+    else if (useEntityIDsFromFile && HasEntity(id)) // If we use IDs from file and they conflict with some of the existing IDs, change the ID of the old entity
+    {
+        entity_id_t newID = replicated ? NextFreeId() : NextFreeIdLocal();
+        ChangeEntityId(id, newID);
+    }
+
+    if (HasEntity(id)) // If the entity we are about to add conflicts in ID with an existing entity in the scene, delete the old entity.
+    {
+        LogDebug("Scene: Destroying previous entity with id " + QString::number(id) + " to avoid conflict with new created entity with the same id.");
+        LogError("Warning: Invoking buggy behavior: Object with id " + QString::number(id) +" might not replicate properly!");
+        RemoveEntity(id, AttributeChange::Replicate); ///<@todo Consider do we want to always use Replicate
+    }
+    return id;
+}
+
+void Scene::ApplyPrototypeForCreatedEntity(Entity *entity, const QString &prototypeId, const QHash<entity_id_t, entity_id_t>& oldToNewIds)
+{
+    if (prototypeId.isEmpty())
+        return;
+
+    // The prototype is either created earlier from the same content, possibly with a new ID, or already in the scene.
+    entity_id_t id = ParseUInt(prototypeId, 0);
+    if (oldToNewIds.contains(id))
+        id = oldToNewIds.value(id);
+    EntityPtr prototype = EntityById(id);
+    if (!prototype || prototype.get() == entity)
+    {
+        LogWarning("Scene::CreateContentFromXml: Prototype entity " + prototypeId + " of " + entity->ToString() + " not found, creating only the overridden attributes.");
+        return;
+    }
+    entity->SetPrototype(prototype);
+    entity->CopyPrototypeComponents();
+}
+
+QList<Entity *> Scene::FinishCreatedContent(const std::vector<EntityWeakPtr>& entities, bool useEntityIDsFromFile, const QHash<entity_id_t, entity_id_t>& oldToNewIds, AttributeChange::Type change)
+{
     // Now that we have each entity spawned to the scene, trigger all the signals for EntityCreated/ComponentChanged messages.
-    for(unsigned i = 0; i < entities.size(); ++i)
+    // The attribute changes are delivered per component at the end of the change transaction.
     {
-        if (!entities[i].expired())
-            EmitEntityCreated(entities[i].lock().get(), change);
-        if (!entities[i].expired())
+        SceneChangeTransaction transaction(this);
+        for(unsigned i = 0; i < entities.size(); ++i)
         {
-            EntityPtr entityShared = entities[i].lock();
-            const Entity::ComponentMap &components = entityShared->Components();
-            for (Entity::ComponentMap::const_iterator i = components.begin(); i != components.end(); ++i)
+            if (!entities[i].expired())
+                EmitEntityCreated(entities[i].lock().get(), change);
+            if (!entities[i].expired())
             {
-                /// @todo Duplicate code
-                if (!useEntityIDsFromFile && i->second->TypeId() == 20 /*EC_Placeable*/)
+                EntityPtr entityShared = entities[i].lock();
+                const Entity::ComponentMap &components = entityShared->Components();
+                for (Entity::ComponentMap::const_iterator i = components.begin(); i != components.end(); ++i)
                 {
-                    // Go and fix parent ref of EC_Placeable if new entity IDs were generated
-                    Attribute<EntityReference> *parentRef = dynamic_cast<Attribute<EntityReference> *>(i->second->AttributeById("parentRef"));
-                    if (parentRef && !parentRef->Get().IsEmpty())
+                    /// @todo Duplicate code
+                    if (!useEntityIDsFromFile && i->second->TypeId() == 20 /* EC_Placeable*/)
                     {
-                        // We only need to fix the id parent refs.
-                        // Ones with entity names should work as expected.
-                        bool isNumber = false;
-                        entity_id_t refId = parentRef->Get().ref.toUInt(&isNumber);
-                        if (isNumber && refId > 0 && oldToNewIds.contains(refId))
-                            parentRef->Set(EntityReference(oldToNewIds[refId]), change);
+                        // Go and fix parent ref of EC_Placeable if new entity IDs were generated
+                        Attribute<EntityReference> *parentRef = dynamic_cast<Attribute<EntityReference> *>(i->second->AttributeById("parentRef"));
+                        if (parentRef && !parentRef->Get().IsEmpty())
+                        {
+                            // We only need to fix the id parent refs.
+                            // Ones with entity names should work as expected.
+                            bool isNumber = false;
+                            entity_id_t refId = parentRef->Get().ref.toUInt(&isNumber);
+                            if (isNumber && refId > 0 && oldToNewIds.contains(refId))
+                                parentRef->Set(EntityReference(oldToNewIds.value(refId)), change);
+                        }
                     }
+                    i->second->ComponentChanged(change);
                 }
-                i->second->ComponentChanged(change);
             }
         }
     }
@@ -668,40 +1067,168 @@ QList<Entity *> Scene::CreateContentFromXml(const QDomDocument &xml, bool useEnt
     // The above signals may have caused scripts to remove entities. Return those that still exist.
     QList<Entity *> ret;
     for(unsigned i = 0; i < entities.size(); ++i)
-    {
         if (!entities[i].expired())
             ret.append(entities[i].lock().get());
-    }
-    
+
     return ret;
 }
 
-void Scene::CreateEntityFromXml(EntityPtr parent, const QDomElement& ent_elem, bool useEntityIDsFromFile, AttributeChange::Type change, std::vector<EntityWeakPtr>& entities, QHash<entity_id_t, entity_id_t>& oldToNewIds)
+QList<Entity *> Scene::CreateContentFromXmlStream(QXmlStreamReader& reader, bool useEntityIDsFromFile, AttributeChange::Type change)
 {
-    const bool replicated = ParseBool(ent_elem.attribute("sync"), true);
-    const bool temporary = ParseBool(ent_elem.attribute("temporary"), false);
+    PROFILE(Scene_CreateContentFromXmlStream);
 
-    QString id_str = ent_elem.attribute("id");
+    /// @todo Make server fix any broken parenting when it changes the entity IDs from unacked to replicated!
+    if (!IsAuthority() && !useEntityIDsFromFile)
+        LogWarning("Scene: The created entitity IDs need to be verified from the server. This will break EC_Placeable parenting.");
+
+    // Check for existence of the scene element before we begin
+    if (!reader.readNextStartElement() || reader.name() != "scene")
+    {
+        if (reader.hasError())
+            LogError(QString("Parsing scene XML failed when loading Scene XML: %1 at line %2 column %3.").arg(reader.errorString()).arg(reader.lineNumber()).arg(reader.columnNumber()));
+        else
+            LogError("Could not find 'scene' element from XML.");
+        return QList<Entity*>();
+    }
+
+    std::vector<EntityWeakPtr> entities;
+    QHash<entity_id_t, entity_id_t> oldToNewIds;
+
+    // Create the storages and spawn the entities in document order.
+    while(reader.readNextStartElement())
+    {
+        if (reader.name() == "storage")
+        {
+            framework_->Asset()->DeserializeAssetStorageFromString(Application::ParseWildCardFilename(reader.attributes().value("specifier").toString()), false);
+            reader.skipCurrentElement();
+        }
+        else if (reader.name() == "entity")
+            CreateEntityFromXmlStream(EntityPtr(), reader, useEntityIDsFromFile, change, entities, oldToNewIds);
+        else
+            reader.skipCurrentElement();
+    }
+
+    if (reader.hasError())
+        LogError(QString("Parsing scene XML failed when loading Scene XML: %1 at line %2 column %3. Keeping the %4 entities created before the error.")
+            .arg(reader.errorString()).arg(reader.lineNumber()).arg(reader.columnNumber()).arg((int)entities.size()));
+
+    return FinishCreatedContent(entities, useEntityIDsFromFile, oldToNewIds, change);
+}
+
+void Scene::CreateEntityFromXmlStream(EntityPtr parent, QXmlStreamReader& reader, bool useEntityIDsFromFile, AttributeChange::Type change, std::vector<EntityWeakPtr>& entities, QHash<entity_id_t, entity_id_t>& oldToNewIds)
+{
+    const QXmlStreamAttributes attributes = reader.attributes();
+    const bool replicated = ParseBool(attributes.value("sync").toString(), true);
+    const bool temporary = ParseBool(attributes.value("temporary").toString(), false);
+
+    QString id_str = attributes.value("id").toString();
     entity_id_t id = !id_str.isEmpty() ? static_cast<entity_id_t>(id_str.toInt()) : 0;
-    if (!useEntityIDsFromFile || id == 0) // If we don't want to use entity IDs from file, or if file doesn't contain one, generate a new one.
+    id = ReserveIdForCreatedEntity(id, replicated, useEntityIDsFromFile, oldToNewIds);
+
+    EntityPtr entity;
+    if (!parent)
+        entity = CreateEntity(id);
+    else
+        entity = parent->CreateChild(id);
+
+    if (entity)
     {
-        entity_id_t originaId = id;
-        id = replicated ? NextFreeId() : NextFreeIdLocal();
-        if (originaId != 0 && !oldToNewIds.contains(originaId))
-            oldToNewIds[originaId] = id;
+        entity->SetTemporary(temporary);
+        ApplyPrototypeForCreatedEntity(entity.get(), attributes.value("prototype").toString(), oldToNewIds);
+        entities.push_back(entity);
     }
-    else if (useEntityIDsFromFile && HasEntity(id)) // If we use IDs from file and they conflict with some of the existing IDs, change the ID of the old entity
+    else
+        LogError("Scene::CreateContentFromXml: Failed to create entity with id " + QString::number(id) + "!");
+
+    while(reader.readNextStartElement())
     {
-        entity_id_t newID = replicated ? NextFreeId() : NextFreeIdLocal();
-        ChangeEntityId(id, newID);
+        if (reader.name() == "component" && entity)
+            CreateComponentFromXmlStream(entity.get(), reader);
+        else if (reader.name() == "entity") // Spawn any child entities
+            CreateEntityFromXmlStream(entity, reader, useEntityIDsFromFile, change, entities, oldToNewIds);
+        else
+            reader.skipCurrentElement();
     }
+}
 
-    if (HasEntity(id)) // If the entity we are about to add conflicts in ID with an existing entity in the scene, delete the old entity.
+void Scene::CreateComponentFromXmlStream(Entity *entity, QXmlStreamReader& reader)
+{
+    const QXmlStreamAttributes attributes = reader.attributes();
+    const QString typeName = attributes.value("type").toString();
+    const u32 typeId = ParseUInt(attributes.value("typeId").toString(), 0xffffffff);
+    const QString name = attributes.value("name").toString();
+    const bool compReplicated = ParseBool(attributes.value("sync").toString(), true);
+    const bool temporary = ParseBool(attributes.value("temporary").toString(), false);
+
+    // If we encounter an unknown component type, now is the time to register a placeholder type for it.
+    // The type is registered from the element, so read this one component into a DOM.
+    QDomDocument compDoc;
+    QDomElement comp_elem;
+    SceneAPI* sceneAPI = framework_->Scene();
+    if (!sceneAPI->IsComponentTypeRegistered(typeName))
     {
-        LogDebug("Scene::CreateContentFromXml: Destroying previous entity with id " + QString::number(id) + " to avoid conflict with new created entity with the same id.");
-        LogError("Warning: Invoking buggy behavior: Object with id " + QString::number(id) +" might not replicate properly!");
-        RemoveEntity(id, AttributeChange::Replicate); ///<@todo Consider do we want to always use Replicate
+        comp_elem = ReadXmlElement(reader, compDoc);
+        compDoc.appendChild(comp_elem);
+        sceneAPI->RegisterPlaceholderComponentType(comp_elem);
+    }
+
+    ComponentPtr new_comp = (!typeName.isEmpty() ? entity->GetOrCreateComponent(typeName, name, AttributeChange::Default, compReplicated) :
+        entity->GetOrCreateComponent(typeId, name, AttributeChange::Default, compReplicated));
+    if (!new_comp)
+    {
+        if (comp_elem.isNull())
+            reader.skipCurrentElement();
+        return;
     }
+    new_comp->SetTemporary(temporary);
+
+    // Trigger no signal yet when scene is in incoherent state
+    if (comp_elem.isNull() && !new_comp->SupportsDynamicAttributes())
+    {
+        // Apply the attribute values straight from the stream, like IComponent::DeserializeFrom.
+        while(reader.readNextStartElement())
+        {
+            if (reader.name() == "attribute")
+            {
+                const QXmlStreamAttributes attrAttributes = reader.attributes();
+                IAttribute* attr = 0;
+                QString id = attrAttributes.value("id").toString();
+                // Prefer lookup by ID if it's specified, but fallback to using attribute human-readable name if not defined
+                if (id.length())
+                    attr = new_comp->AttributeById(id);
+                else
+                {
+                    id = attrAttributes.value("name").toString();
+                    attr = new_comp->AttributeByName(id);
+                }
+
+                if (!attr)
+                    LogWarning(new_comp->TypeName() + "::DeserializeFrom: Could not find attribute \"" + id + "\" specified in the XML element.");
+                else
+                    attr->FromString(attrAttributes.value("value").toString(), AttributeChange::Disconnected);
+            }
+            reader.skipCurrentElement();
+        }
+        return;
+    }
+
+    // Dynamic components create their attributes from the element.
+    if (comp_elem.isNull())
+    {
+        comp_elem = ReadXmlElement(reader, compDoc);
+        compDoc.appendChild(comp_elem);
+    }
+    new_comp->DeserializeFrom(comp_elem, AttributeChange::Disconnected);
+}
+
+void Scene::CreateEntityFromXml(EntityPtr parent, const QDomElement& ent_elem, bool useEntityIDsFromFile, AttributeChange::Type change, std::vector<EntityWeakPtr>& entities, QHash<entity_id_t, entity_id_t>& oldToNewIds)
+{
+    const bool replicated = ParseBool(ent_elem.attribute("sync"), true);
+    const bool temporary = ParseBool(ent_elem.attribute("temporary"), false);
+
+    QString id_str = ent_elem.attribute("id");
+    entity_id_t id = !id_str.isEmpty() ? static_cast<entity_id_t>(id_str.toInt()) : 0;
+    id = ReserveIdForCreatedEntity(id, replicated, useEntityIDsFromFile, oldToNewIds);
 
     EntityPtr entity;
     if (!parent)
@@ -712,6 +1239,7 @@ void Scene::CreateEntityFromXml(EntityPtr parent, const QDomElement& ent_elem, b
     if (entity)
     {
         entity->SetTemporary(temporary);
+        ApplyPrototypeForCreatedEntity(entity.get(), ent_elem.attribute("prototype"), oldToNewIds);
 
         QDomElement comp_elem = ent_elem.firstChildElement("component");
         while(!comp_elem.isNull())
@@ -755,30 +1283,144 @@ void Scene::CreateEntityFromXml(EntityPtr parent, const QDomElement& ent_elem, b
 }
 
 
-QList<Entity *> Scene::CreateContentFromBinary(const QString &filename, bool useEntityIDsFromFile, AttributeChange::Type change)
+QList<Entity *> Scene::CreateContentFromBinary(const QString &filename, bool useEntityIDsFromFile, AttributeChange::Type change)
+{
+
+    QFile file(filename);
+    if (!file.open(QIODevice::ReadOnly))
+    {
+        LogError("Failed to open file " + filename + " when loading scene binary.");
+        return QList<Entity*>();
+    }
+
+    QByteArray bytes = file.readAll();
+    file.close();
+    
+    if (!bytes.size())
+    {
+        LogError("File " + filename + "contained 0 bytes when loading scene binary.");
+        return QList<Entity*>();
+    }
+
+    return CreateContentFromBinary(bytes.data(), bytes.size(), useEntityIDsFromFile, change);
+}
+
+namespace
+{
+
+/// Minimum number of root-level entities for decoding a binary scene on worker threads.
+const uint cMinParallelBinaryEntities = 64;
+
+/// Attributes of a component type, cloned for the decoded attribute values.
+typedef std::map<u32, AttributeVector> BinaryComponentPrototypes;
+
+/// Reads an entity and its children from binary data, without decoding the component data.
+void ReadBinaryEntityDesc(DataDeserializer &source, const char *data, BinaryEntityDesc &desc)
+{
+    desc.id = source.Read<u32>();
+    desc.replicated = source.Read<u8>() ? true : false;
+
+    uint num_components = source.Read<u32>();
+    uint num_childEntities = num_components >> 16;
+    num_components &= 0xffff;
+
+    desc.components.resize(num_components);
+    for(uint i = 0; i < num_components; ++i)
+    {
+        BinaryComponentDesc &compDesc = desc.components[i];
+        compDesc.typeId = source.Read<u32>(); ///\todo VLE this!
+        compDesc.name = QString::fromStdString(source.ReadString());
+        compDesc.sync = source.Read<u8>() ? true : false;
+        compDesc.dataSize = source.Read<u32>();
+        if (compDesc.dataSize > source.BytesLeft())
+            throw Exception("Component data exceeds the binary scene data!");
+        compDesc.data = data + source.BytePos();
+        source.SkipBytes(compDesc.dataSize);
+    }
+
+    desc.children.resize(num_childEntities);
+    for(uint i = 0; i < num_childEntities; ++i)
+        ReadBinaryEntityDesc(source, data, desc.children[i]);
+}
+
+/// Decodes the component data of an entity and its children to standalone attributes.
+/** Touches no scene objects, so can be run on a worker thread. The data of a component whose type has no prototype,
+    or that fails to decode, is left for the main thread to deserialize. */
+void DecodeBinaryEntityDesc(BinaryEntityDesc &desc, const BinaryComponentPrototypes &prototypes)
+{
+    for(size_t i = 0; i < desc.components.size(); ++i)
+    {
+        BinaryComponentDesc &compDesc = desc.components[i];
+        BinaryComponentPrototypes::const_iterator proto = prototypes.find(compDesc.typeId);
+        if (!compDesc.dataSize || proto == prototypes.end())
+            continue;
+
+        const AttributeVector &protoAttributes = proto->second;
+        try
+        {
+            DataDeserializer comp_source(compDesc.data, compDesc.dataSize);
+            if (comp_source.Read<u8>() != protoAttributes.size())
+                continue;
+            compDesc.attributes.reserve(protoAttributes.size());
+            for(size_t j = 0; j < protoAttributes.size(); ++j)
+            {
+                shared_ptr<IAttribute> attr(protoAttributes[j]->Clone());
+                attr->FromBinary(comp_source, AttributeChange::Disconnected);
+                compDesc.attributes.push_back(attr);
+            }
+        }
+        catch(...)
+        {
+            compDesc.attributes.clear();
+        }
+    }
+
+    for(size_t i = 0; i < desc.children.size(); ++i)
+        DecodeBinaryEntityDesc(desc.children[i], prototypes);
+}
+
+/// Decodes a slice of the root-level entities of a binary scene on a worker thread.
+class BinaryDecodeTask : public QRunnable
 {
+public:
+    explicit BinaryDecodeTask(const BinaryComponentPrototypes &prototypes) : prototypes_(prototypes) {}
 
-    QFile file(filename);
-    if (!file.open(QIODevice::ReadOnly))
+    void run()
     {
-        LogError("Failed to open file " + filename + " when loading scene binary.");
-        return QList<Entity*>();
+        for(size_t i = 0; i < entities.size(); ++i)
+            DecodeBinaryEntityDesc(*entities[i], prototypes_);
     }
 
-    QByteArray bytes = file.readAll();
-    file.close();
-    
-    if (!bytes.size())
-    {
-        LogError("File " + filename + "contained 0 bytes when loading scene binary.");
-        return QList<Entity*>();
-    }
+    std::vector<BinaryEntityDesc*> entities;
 
-    return CreateContentFromBinary(bytes.data(), bytes.size(), useEntityIDsFromFile, change);
+private:
+    const BinaryComponentPrototypes &prototypes_;
+};
+
+/// Collects the component type IDs of an entity and its children.
+void CollectBinaryComponentTypes(const BinaryEntityDesc &desc, std::set<u32> &typeIds)
+{
+    for(size_t i = 0; i < desc.components.size(); ++i)
+        typeIds.insert(desc.components[i].typeId);
+    for(size_t i = 0; i < desc.children.size(); ++i)
+        CollectBinaryComponentTypes(desc.children[i], typeIds);
 }
 
+} // ~unnamed namespace
+
 QList<Entity *> Scene::CreateContentFromBinary(const char *data, int numBytes, bool useEntityIDsFromFile, AttributeChange::Type change)
 {
+    PROFILE(Scene_CreateContentFromBinary);
+
+    // Load all of an indexed binary scene
+    if (IndexedSceneFile::IsIndexedSceneData(data, numBytes))
+    {
+        QByteArray flatData = IndexedSceneFile::ToFlatSceneData(data, numBytes);
+        if (flatData.isEmpty())
+            return QList<Entity *>();
+        return CreateContentFromBinary(flatData.constData(), flatData.size(), useEntityIDsFromFile, change);
+    }
+
     /// @todo Make server fix any broken parenting when it changes the entity IDs from unacked to replicated!
     if (!IsAuthority() && !useEntityIDsFromFile)
         LogWarning("Scene: The created entitity IDs need to be verified from the server. This will break EC_Placeable parenting.");
@@ -787,13 +1429,17 @@ QList<Entity *> Scene::CreateContentFromBinary(const char *data, int numBytes, b
     assert(data);
     assert(numBytes > 0);
     QHash<entity_id_t, entity_id_t> oldToNewIds;
+
+    // Split the data to entities, and check that it is well-formed before touching the scene.
+    std::vector<BinaryEntityDesc> descs;
     try
     {
         DataDeserializer source(data, numBytes);
 
         uint num_entities = source.Read<u32>();
+        descs.resize(num_entities);
         for(uint i = 0; i < num_entities; ++i)
-            CreateEntityFromBinary(EntityPtr(), source, useEntityIDsFromFile, change, entities, oldToNewIds);
+            ReadBinaryEntityDesc(source, data, descs[i]);
     }
     catch(...)
     {
@@ -801,69 +1447,59 @@ QList<Entity *> Scene::CreateContentFromBinary(const char *data, int numBytes, b
         return QList<Entity *>();
     }
 
-    // Now that we have each entity spawned to the scene, trigger all the signals for EntityCreated/ComponentChanged messages.
-    for(unsigned i = 0; i < entities.size(); ++i)
+    // Decode the attribute values of the components into clones of the attributes of a prototype component of each type.
+    // Dynamic and placeholder components have no fixed attributes, so they are deserialized when created.
+    std::set<u32> typeIds;
+    for(size_t i = 0; i < descs.size(); ++i)
+        CollectBinaryComponentTypes(descs[i], typeIds);
+    std::vector<ComponentPtr> prototypeComponents;
+    BinaryComponentPrototypes prototypes;
+    SceneAPI *sceneAPI = framework_->Scene();
+    for(std::set<u32>::const_iterator i = typeIds.begin(); i != typeIds.end(); ++i)
     {
-        if (!entities[i].expired())
-            EmitEntityCreated(entities[i].lock().get(), change);
-        if (!entities[i].expired())
-        {
-            EntityPtr entityShared = entities[i].lock();
-            const Entity::ComponentMap &components = entityShared->Components();
-            for (Entity::ComponentMap::const_iterator i = components.begin(); i != components.end(); ++i)
-            {
-                /// @todo Duplicate code
-                if (!useEntityIDsFromFile && i->second->TypeId() == 20 /* EC_Placeable*/)
-                {
-                    // Go and fix parent ref of EC_Placeable if new entity IDs were generated
-                    Attribute<EntityReference> *parentRef = dynamic_cast<Attribute<EntityReference> *>(i->second->AttributeById("parentRef"));
-                    if (parentRef && !parentRef->Get().IsEmpty())
-                    {
-                        // We only need to fix the id parent refs.
-                        // Ones with entity names should work as expected.
-                        bool isNumber = false;
-                        entity_id_t refId = parentRef->Get().ref.toUInt(&isNumber);
-                        if (isNumber && refId > 0 && oldToNewIds.contains(refId))
-                            parentRef->Set(EntityReference(oldToNewIds[refId]), change);
-                    }
-                }
-                i->second->ComponentChanged(change);
-            }
-        }
+        ComponentPtr prototype = sceneAPI->CreateComponentById(0, *i, "");
+        if (!prototype || prototype->SupportsDynamicAttributes() || dynamic_cast<EC_PlaceholderComponent*>(prototype.get()))
+            continue;
+        const AttributeVector &attributes = prototype->Attributes();
+        if (std::find(attributes.begin(), attributes.end(), (IAttribute*)0) != attributes.end())
+            continue;
+        prototypeComponents.push_back(prototype);
+        prototypes[*i] = attributes;
     }
-    
-    // The above signals may have caused scripts to remove entities. Return those that still exist.
-    QList<Entity *> ret;
-    for(unsigned i = 0; i < entities.size(); ++i)
-        if (!entities[i].expired())
-            ret.append(entities[i].lock().get());
-
-    return ret;
-}
 
-void Scene::CreateEntityFromBinary(EntityPtr parent, kNet::DataDeserializer& source, bool useEntityIDsFromFile, AttributeChange::Type change, std::vector<EntityWeakPtr>& entities, QHash<entity_id_t, entity_id_t>& oldToNewIds)
-{
-    entity_id_t id = source.Read<u32>();
-    bool replicated = source.Read<u8>() ? true : false;
-    if (!useEntityIDsFromFile || id == 0)
+    const int numThreads = QThread::idealThreadCount();
+    if (numThreads > 1 && descs.size() >= cMinParallelBinaryEntities)
     {
-        entity_id_t originalId = id;
-        id = replicated ? NextFreeId() : NextFreeIdLocal();
-        if (originalId != 0 && !oldToNewIds.contains(originalId))
-            oldToNewIds[originalId] = id;
+        // The workers only write to their own entity descriptions, and read the immutable prototypes.
+        QThreadPool pool;
+        pool.setMaxThreadCount(numThreads);
+        for(int t = 0; t < numThreads; ++t)
+        {
+            BinaryDecodeTask *task = new BinaryDecodeTask(prototypes);
+            for(size_t i = t; i < descs.size(); i += numThreads)
+                task->entities.push_back(&descs[i]);
+            pool.start(task); // The pool deletes the task when done.
+        }
+        pool.waitForDone();
     }
-    else if (useEntityIDsFromFile && HasEntity(id))
+    else
     {
-        entity_id_t newID = replicated ? NextFreeId() : NextFreeIdLocal();
-        ChangeEntityId(id, newID);
+        for(size_t i = 0; i < descs.size(); ++i)
+            DecodeBinaryEntityDesc(descs[i], prototypes);
     }
 
-    if (HasEntity(id)) // If the entity we are about to add conflicts in ID with an existing entity in the scene.
-    {
-        LogDebug("Scene::CreateContentFromBinary: Destroying previous entity with id " + QString::number(id) + " to avoid conflict with new created entity with the same id.");
-        LogError("Warning: Invoking buggy behavior: Object with id " + QString::number(id) + "might not replicate properly!");
-        RemoveEntity(id, AttributeChange::Replicate); ///<@todo Consider do we want to always use Replicate
-    }
+    for(size_t i = 0; i < descs.size(); ++i)
+        CreateEntityFromBinaryDesc(EntityPtr(), descs[i], useEntityIDsFromFile, change, entities, oldToNewIds);
+    descs.clear();
+    prototypes.clear();
+    prototypeComponents.clear();
+
+    return FinishCreatedContent(entities, useEntityIDsFromFile, oldToNewIds, change);
+}
+
+void Scene::CreateEntityFromBinaryDesc(EntityPtr parent, const BinaryEntityDesc& source, bool useEntityIDsFromFile, AttributeChange::Type change, std::vector<EntityWeakPtr>& entities, QHash<entity_id_t, entity_id_t>& oldToNewIds)
+{
+    entity_id_t id = ReserveIdForCreatedEntity(source.id, source.replicated, useEntityIDsFromFile, oldToNewIds);
 
     EntityPtr entity;
     if (!parent)
@@ -876,50 +1512,41 @@ void Scene::CreateEntityFromBinary(EntityPtr parent, kNet::DataDeserializer& sou
         LogError("Failed to create entity, stopping scene load!");
         return;
     }
-    
-    uint num_components = source.Read<u32>();
-    uint num_childEntities = num_components >> 16;
-    num_components &= 0xffff;
 
-    for(uint i = 0; i < num_components; ++i)
+    for(size_t i = 0; i < source.components.size(); ++i)
     {
-        u32 typeId = source.Read<u32>(); ///\todo VLE this!
-        QString name = QString::fromStdString(source.ReadString());
-        bool compReplicated = source.Read<u8>() ? true : false;
-        uint data_size = source.Read<u32>();
-                
-        // Read the component data into a separate byte array, then deserialize from there.
-        // This way the whole stream should not desync even if something goes wrong
-        QByteArray comp_bytes;
-        comp_bytes.resize(data_size);
-        if (data_size)
-            source.ReadArray<u8>((u8*)comp_bytes.data(), comp_bytes.size());
-                
+        const BinaryComponentDesc &compDesc = source.components[i];
         try
         {
-            ComponentPtr new_comp = entity->GetOrCreateComponent(typeId, name, AttributeChange::Default, compReplicated);
+            ComponentPtr new_comp = entity->GetOrCreateComponent(compDesc.typeId, compDesc.name, AttributeChange::Default, compDesc.sync);
             if (new_comp)
             {
-                if (data_size)
+                // Trigger no signal yet when scene is in incoherent state
+                const AttributeVector &attributes = new_comp->Attributes();
+                if (!compDesc.attributes.empty() && compDesc.attributes.size() == attributes.size())
+                {
+                    for(size_t j = 0; j < attributes.size(); ++j)
+                        attributes[j]->CopyValue(compDesc.attributes[j].get(), AttributeChange::Disconnected);
+                }
+                else if (compDesc.dataSize)
                 {
-                    DataDeserializer comp_source(comp_bytes.data(), comp_bytes.size());
-                    // Trigger no signal yet when scene is in incoherent state
+                    DataDeserializer comp_source(compDesc.data, compDesc.dataSize);
                     new_comp->DeserializeFromBinary(comp_source, AttributeChange::Disconnected);
                 }
             }
             else
-                LogError("Failed to load component \"" + framework_->Scene()->GetComponentTypeName(typeId) + "\"!");
+                LogError("Failed to load component \"" + framework_->Scene()->GetComponentTypeName(compDesc.typeId) + "\"!");
         }
         catch(...)
         {
-            LogError("Failed to load component \"" + framework_->Scene()->GetComponentTypeName(typeId) + "\"!");
+            LogError("Failed to load component \"" + framework_->Scene()->GetComponentTypeName(compDesc.typeId) + "\"!");
         }
     }
 
     entities.push_back(entity);
 
-    for (uint i = 0; i < num_childEntities; ++i)
-        CreateEntityFromBinary(entity, source, useEntityIDsFromFile, change, entities, oldToNewIds);
+    for(size_t i = 0; i < source.children.size(); ++i)
+        CreateEntityFromBinaryDesc(entity, source.children[i], useEntityIDsFromFile, change, entities, oldToNewIds);
 }
 
 QList<Entity *> Scene::CreateContentFromSceneDesc(const SceneDesc &desc, bool useEntityIDsFromFile, AttributeChange::Type change)
@@ -1077,33 +1704,35 @@ SceneDesc Scene::CreateSceneDescFromXml(const QString &filename) const
 
 SceneDesc Scene::CreateSceneDescFromXml(QByteArray &data, SceneDesc &sceneDesc) const
 {
-    QTextStream stream(&data);
-    stream.setCodec("UTF-8");
-    QDomDocument scene_doc("Scene");
-    QString errorMsg;
-    int errorLine, errorColumn;
-    if (!scene_doc.setContent(stream.readAll(), &errorMsg, &errorLine, &errorColumn))
-    {
-        LogError(QString("Parsing scene XML from %1 failed when loading Scene XML: %2 at line %3 column %4.").arg(sceneDesc.filename).arg(errorMsg).arg(errorLine).arg(errorColumn));
-        return sceneDesc;
-    }
+    QXmlStreamReader reader(data);
 
     // Check for existence of the scene element before we begin
-    QDomElement scene_elem = scene_doc.firstChildElement("scene");
-    if (scene_elem.isNull())
+    if (!reader.readNextStartElement() || reader.name() != "scene")
     {
-        LogError("Could not find 'scene' element from XML.");
+        if (reader.hasError())
+            LogError(QString("Parsing scene XML from %1 failed when loading Scene XML: %2 at line %3 column %4.").arg(sceneDesc.filename).arg(reader.errorString()).arg(reader.lineNumber()).arg(reader.columnNumber()));
+        else
+            LogError("Could not find 'scene' element from XML.");
         return sceneDesc;
     }
 
-    QDomElement ent_elem = scene_elem.firstChildElement("entity");
-    while(!ent_elem.isNull())
+    while(reader.readNextStartElement())
     {
-        CreateEntityDescFromXml(sceneDesc, sceneDesc.entities, ent_elem);
-        // Process siblings.
-        ent_elem = ent_elem.nextSiblingElement("entity");
+        if (reader.name() == "entity")
+        {
+            // Read one root-level entity at a time into a DOM, so that the whole document is never held as a DOM.
+            QDomDocument entityDoc;
+            QDomElement ent_elem = ReadXmlElement(reader, entityDoc);
+            entityDoc.appendChild(ent_elem);
+            CreateEntityDescFromXml(sceneDesc, sceneDesc.entities, ent_elem);
+        }
+        else
+            reader.skipCurrentElement();
     }
 
+    if (reader.hasError())
+        LogError(QString("Parsing scene XML from %1 failed when loading Scene XML: %2 at line %3 column %4.").arg(sceneDesc.filename).arg(reader.errorString()).arg(reader.lineNumber()).arg(reader.columnNumber()));
+
     return sceneDesc;
 }
 
@@ -1293,7 +1922,8 @@ SceneDesc Scene::CreateSceneDescFromBinary(const QString &filename) const
 
 SceneDesc Scene::CreateSceneDescFromBinary(QByteArray &data, SceneDesc &sceneDesc) const
 {
-    QByteArray bytes = data;
+    QByteArray bytes = IndexedSceneFile::IsIndexedSceneData(data.constData(), data.size()) ?
+        IndexedSceneFile::ToFlatSceneData(data.constData(), data.size()) : data;
     if (!bytes.size())
     {
         LogError("File " + sceneDesc.filename + " contained 0 bytes when trying to create scene description.");
@@ -1446,8 +2076,30 @@ bool Scene::StartAttributeInterpolation(IAttribute* attr, IAttribute* endvalue,
         return false;
     }
     
-    // End previous interpolation if existed
-    bool previous = EndAttributeInterpolation(attr);
+    // If the previous endpoint has not been reached yet, buffer the new one. Restarting from the current value
+    // would make the motion uneven whenever the values do not arrive at exactly the interpolation length apart.
+    bool previous = false;
+    std::map<IAttribute*, size_t>::iterator existing = interpolationIndices_.find(attr);
+    if (existing != interpolationIndices_.end())
+    {
+        AttributeInterpolation& interp = interpolations_[existing->second];
+        // An expired interpolation belonged to a destroyed attribute at the same address.
+        previous = !interp.dest.Expired();
+        if (previous && interp.time < interp.length)
+        {
+            // Bound the latency: drop the oldest buffered endpoint if the buffer is full.
+            const size_t cMaxPendingEndpoints = 2;
+            if (interp.pending.size() >= cMaxPendingEndpoints)
+            {
+                delete interp.pending.front().first;
+                interp.pending.erase(interp.pending.begin());
+            }
+            interp.pending.push_back(std::make_pair(endvalue, length));
+            return true;
+        }
+        // End previous interpolation
+        RemoveAttributeInterpolation(existing->second);
+    }
     
     // If previous interpolation does not exist, perform a direct snapping to the end value
     // but still start an interpolation period, so that on the next update we detect that an interpolation is going on,
@@ -1460,25 +2112,25 @@ bool Scene::StartAttributeInterpolation(IAttribute* attr, IAttribute* endvalue,
     newInterp.start = AttributeWeakPtr(comp->shared_from_this(), attr->Clone());
     newInterp.end = AttributeWeakPtr(comp->shared_from_this(), endvalue);
     newInterp.length = length;
+    newInterp.kind = AttributeInterpolationTracks::KindOf(attr);
+    if (newInterp.kind != AttributeInterpolationTracks::KindGeneric)
+    {
+        newInterp.track = interpolationTracks_.Add(newInterp.kind, interpolations_.size());
+        interpolationTracks_.SetSegment(newInterp.kind, newInterp.track, newInterp.start.Get(), newInterp.end.Get());
+    }
     
+    interpolationIndices_[attr] = interpolations_.size();
     interpolations_.push_back(newInterp);
     return true;
 }
 
 bool Scene::EndAttributeInterpolation(IAttribute* attr)
 {
-    for(uint i = 0; i < interpolations_.size(); ++i)
-    {
-        AttributeInterpolation& interp = interpolations_[i];
-        if (interp.dest.Get() == attr)
-        {
-            delete interp.start.Get();
-            delete interp.end.Get();
-            interpolations_.erase(interpolations_.begin() + i);
-            return true;
-        }
-    }
-    return false;
+    std::map<IAttribute*, size_t>::iterator existing = interpolationIndices_.find(attr);
+    if (existing == interpolationIndices_.end())
+        return false;
+    RemoveAttributeInterpolation(existing->second);
+    return true;
 }
 
 void Scene::EndAllAttributeInterpolations()
@@ -1486,19 +2138,140 @@ void Scene::EndAllAttributeInterpolations()
     for(uint i = 0; i < interpolations_.size(); ++i)
     {
         AttributeInterpolation& interp = interpolations_[i];
-        delete interp.start.Get();
-        delete interp.end.Get();
+        delete interp.start.attribute;
+        delete interp.end.attribute;
+        for(size_t j = 0; j < interp.pending.size(); ++j)
+            delete interp.pending[j].first;
     }
     
     interpolations_.clear();
+    interpolationIndices_.clear();
+    interpolationTracks_.Clear();
+}
+
+void Scene::RemoveAttributeInterpolation(size_t index)
+{
+    AttributeInterpolation& interp = interpolations_[index];
+    // The start and end values are copies without an owner, so delete them even if the destination component has expired.
+    delete interp.start.attribute;
+    delete interp.end.attribute;
+    for(size_t j = 0; j < interp.pending.size(); ++j)
+        delete interp.pending[j].first;
+    interpolationIndices_.erase(interp.dest.attribute);
+    if (interp.kind != AttributeInterpolationTracks::KindGeneric)
+    {
+        size_t moved = interpolationTracks_.Remove(interp.kind, interp.track);
+        if (moved != AttributeInterpolationTracks::cNoOwner)
+            interpolations_[moved].track = interp.track;
+    }
+
+    if (index + 1 < interpolations_.size())
+    {
+        interp = interpolations_.back();
+        interpolationIndices_[interp.dest.attribute] = index;
+        if (interp.kind != AttributeInterpolationTracks::KindGeneric)
+            interpolationTracks_.SetOwner(interp.kind, interp.track, index);
+    }
+    interpolations_.pop_back();
+}
+
+void Scene::IndexComponent(IComponent *comp)
+{
+    if (componentIndices_.find(comp) != componentIndices_.end())
+        return;
+    std::vector<IComponent*> &components = componentsByType_[comp->TypeId()];
+    componentIndices_[comp] = components.size();
+    components.push_back(comp);
+    if (comp->TypeId() == EC_Name::TypeIdStatic())
+        IndexName(comp);
+}
+
+void Scene::UnindexComponent(IComponent *comp)
+{
+    std::map<IComponent*, size_t>::iterator it = componentIndices_.find(comp);
+    if (it == componentIndices_.end())
+        return;
+    size_t index = it->second;
+    componentIndices_.erase(it);
+    if (comp->TypeId() == EC_Name::TypeIdStatic())
+        UnindexName(comp);
+
+    std::vector<IComponent*> &components = componentsByType_[comp->TypeId()];
+    if (index + 1 < components.size())
+    {
+        components[index] = components.back();
+        componentIndices_[components[index]] = index;
+    }
+    components.pop_back();
+}
+
+void Scene::IndexName(IComponent *comp)
+{
+    EC_Name *nameComp = static_cast<EC_Name *>(comp);
+    IndexedName &indexed = indexedNames_[comp];
+    indexed.name = nameComp->name.Get();
+    indexed.group = nameComp->group.Get();
+    AddToNameIndex(componentsByName_, indexed.name, comp);
+    AddToNameIndex(componentsByGroup_, indexed.group, comp);
+}
+
+void Scene::UnindexName(IComponent *comp)
+{
+    QHash<IComponent*, IndexedName>::iterator it = indexedNames_.find(comp);
+    if (it == indexedNames_.end())
+        return;
+    RemoveFromNameIndex(componentsByName_, it.value().name, comp);
+    RemoveFromNameIndex(componentsByGroup_, it.value().group, comp);
+    indexedNames_.erase(it);
+}
+
+void Scene::UpdateNameIndex(IComponent* comp)
+{
+    // Components not in the scene yet are indexed when added to it
+    QHash<IComponent*, IndexedName>::iterator it = indexedNames_.find(comp);
+    if (it == indexedNames_.end())
+        return;
+
+    EC_Name *nameComp = static_cast<EC_Name *>(comp);
+    IndexedName &indexed = it.value();
+    if (nameComp->name.Get() != indexed.name)
+    {
+        RemoveFromNameIndex(componentsByName_, indexed.name, comp);
+        indexed.name = nameComp->name.Get();
+        AddToNameIndex(componentsByName_, indexed.name, comp);
+    }
+    if (nameComp->group.Get() != indexed.group)
+    {
+        RemoveFromNameIndex(componentsByGroup_, indexed.group, comp);
+        indexed.group = nameComp->group.Get();
+        AddToNameIndex(componentsByGroup_, indexed.group, comp);
+    }
+}
+
+void Scene::AppendEntitiesNamed(const QString &name, const std::vector<IComponent*> &components, std::vector<Entity*> &result) const
+{
+    for(size_t i = 0; i < components.size(); ++i)
+    {
+        // Entity::Name is that of the first EC_Name of the entity
+        Entity *entity = components[i]->ParentEntity();
+        if (entity && entity->Name() == name)
+            result.push_back(entity);
+    }
 }
 
 void Scene::UpdateAttributeInterpolations(float frametime)
 {
     PROFILE(Scene_UpdateInterpolation);
-    
+
+    // Keep the main loop from idling until the interpolations have finished.
+    if (!interpolations_.empty())
+        framework_->Frame()->KeepAwake();
+
     interpolating_ = true;
     
+    // The values of the float, float3, Quat, Color and Transform attributes are computed for all of them at once
+    // by interpolationTracks_ between this timing pass and the pass that sets them. Other types use IAttribute::Interpolate.
+    // Removal moves the last interpolation to the removed index, which has already been processed when iterating backwards.
     for(size_t i = interpolations_.size() - 1; i < interpolations_.size(); --i)
     {
         AttributeInterpolation& interp = interpolations_[i];
@@ -1511,11 +2284,32 @@ void Scene::UpdateAttributeInterpolations(float frametime)
             // This is for the continuous/discontinuous update detection in StartAttributeInterpolation()
             if (interp.time <= interp.length)
             {
-                interp.time += frametime;
+                // Play slightly faster while endpoints are buffered, to catch up the latency caused by network jitter.
+                interp.time += frametime * (1.0f + 0.25f * (float)interp.pending.size());
+                // Continue to the next buffered endpoint from the one just reached.
+                bool newSegment = false;
+                while(interp.time > interp.length && !interp.pending.empty())
+                {
+                    interp.time -= interp.length;
+                    delete interp.start.attribute;
+                    interp.start = interp.end;
+                    interp.end.attribute = interp.pending.front().first;
+                    interp.length = interp.pending.front().second;
+                    interp.pending.erase(interp.pending.begin());
+                    newSegment = true;
+                }
                 float t = interp.time / interp.length;
                 if (t > 1.0f)
                     t = 1.0f;
-                interp.dest.Get()->Interpolate(interp.start.Get(), interp.end.Get(), t, AttributeChange::LocalOnly);
+                if (interp.kind != AttributeInterpolationTracks::KindGeneric)
+                {
+                    if (newSegment)
+                        interpolationTracks_.SetSegment(interp.kind, interp.track, interp.start.Get(), interp.end.Get());
+                    interpolationTracks_.SetTime(interp.kind, interp.track, t);
+                    interp.apply = true;
+                }
+                else
+                    interp.dest.Get()->Interpolate(interp.start.Get(), interp.end.Get(), t, AttributeChange::LocalOnly);
             }
             else
             {
@@ -1529,11 +2323,20 @@ void Scene::UpdateAttributeInterpolations(float frametime)
         
         // Remove interpolation (& delete start/endpoints) when done
         if (finished)
-        {
-            delete interp.start.Get();
-            delete interp.end.Get();
-            interpolations_.erase(interpolations_.begin() + i);
-        }
+            RemoveAttributeInterpolation(i);
+    }
+
+    interpolationTracks_.Evaluate();
+
+    // Setting a value may end interpolations from the change signal handlers, so check the index and owner again.
+    for(size_t i = interpolations_.size() - 1; i < interpolations_.size(); --i)
+    {
+        AttributeInterpolation& interp = interpolations_[i];
+        if (!interp.apply)
+            continue;
+        interp.apply = false;
+        if (!interp.dest.owner.expired())
+            interpolationTracks_.Apply(interp.kind, interp.track, interp.dest.Get(), AttributeChange::LocalOnly);
     }
 
     interpolating_ = false;
@@ -1541,6 +2344,14 @@ void Scene::UpdateAttributeInterpolations(float frametime)
 
 void Scene::OnUpdated(float /*frameTime*/)
 {
+    // A transaction left open, e.g. by a script that failed before committing, would defer the changes forever
+    if (changeTransactionDepth_ > 0)
+    {
+        LogWarning("Scene::OnUpdated: change transaction left open at frame end, committing it.");
+        changeTransactionDepth_ = 1;
+        CommitChangeTransaction();
+    }
+
     // Signal queued entity creations now
     for (unsigned i = 0; i < entitiesCreatedThisFrame_.size(); ++i)
     {
@@ -1554,16 +2365,123 @@ void Scene::OnUpdated(float /*frameTime*/)
         if (change == AttributeChange::Default)
             change = AttributeChange::Replicate;
         
+        RecordEntityChange(entity, SceneChange::EntityCreated, change);
         emit EntityCreated(entity, change);
     }
     
     entitiesCreatedThisFrame_.clear();
+
+    // Signal the entities created with CreateEntities one batch at a time
+    std::vector<CreatedEntityBatch> batches;
+    batches.swap(entityBatchesCreatedThisFrame_);
+    for(size_t i = 0; i < batches.size(); ++i)
+    {
+        EntityList entities;
+        for(size_t j = 0; j < batches[i].entities.size(); ++j)
+        {
+            EntityPtr entity = batches[i].entities[j].lock();
+            if (entity && entity->ParentScene() == this)
+                entities.push_back(entity);
+        }
+        if (entities.empty())
+            continue;
+        AttributeChange::Type change = batches[i].change;
+        if (change == AttributeChange::Default)
+            change = AttributeChange::Replicate;
+        for(EntityList::const_iterator it = entities.begin(); it != entities.end(); ++it)
+            RecordEntityChange(it->get(), SceneChange::EntityCreated, change);
+        emit EntitiesCreated(entities, change);
+    }
+
+    if (changeJournalEnabled_)
+    {
+        recordingJournal_.SetFrameNumber(framework_->Frame()->FrameNumber());
+        changeJournal_.Swap(recordingJournal_);
+        recordingJournal_.Clear();
+    }
+}
+
+void Scene::OnPostFrameUpdate(float /*frameTime*/)
+{
+    if (snapshotsEnabled_)
+        TakeSnapshot();
+}
+
+SceneSnapshotPtr Scene::LatestSnapshot() const
+{
+    QMutexLocker lock(&snapshotMutex_);
+    return latestSnapshot_;
+}
+
+SceneSnapshotPtr Scene::TakeSnapshot()
+{
+    PROFILE(Scene_TakeSnapshot);
+    // Only the main thread replaces the latest snapshot, so it can be read here without locking
+    SceneSnapshotPtr snapshot = SceneSnapshot::Create(this, latestSnapshot_);
+    SceneSnapshotPtr previous;
+    {
+        QMutexLocker lock(&snapshotMutex_);
+        previous = latestSnapshot_;
+        latestSnapshot_ = snapshot;
+    }
+    // The previous snapshot, if no longer read by anyone, is released here outside the lock
+    previous.reset();
+    return snapshot;
+}
+
+void Scene::SetSnapshotsEnabled(bool enabled)
+{
+    if (enabled == snapshotsEnabled_)
+        return;
+    snapshotsEnabled_ = enabled;
+    if (enabled)
+        connect(framework_->Frame(), SIGNAL(PostFrameUpdate(float)), this, SLOT(OnPostFrameUpdate(float)), Qt::UniqueConnection);
+    else
+    {
+        disconnect(framework_->Frame(), SIGNAL(PostFrameUpdate(float)), this, SLOT(OnPostFrameUpdate(float)));
+        SceneSnapshotPtr previous; // Released after the lock
+        QMutexLocker lock(&snapshotMutex_);
+        previous.swap(latestSnapshot_);
+    }
+}
+
+void Scene::SetChangeJournalEnabled(bool enabled)
+{
+    changeJournalEnabled_ = enabled;
+    if (!enabled)
+    {
+        changeJournal_.Clear();
+        recordingJournal_.Clear();
+    }
+}
+
+void Scene::RecordComponentChange(IComponent *comp, SceneChange::Kind kind, AttributeChange::Type change, int attributeIndex)
+{
+    if (!changeJournalEnabled_)
+        return;
+    Entity *entity = comp->ParentEntity();
+    if (entity)
+        recordingJournal_.Record(entity->Id(), comp->Id(), comp->TypeId(), kind, change, attributeIndex);
+}
+
+void Scene::RecordEntityChange(Entity *entity, SceneChange::Kind kind, AttributeChange::Type change)
+{
+    if (changeJournalEnabled_)
+        recordingJournal_.Record(entity->Id(), 0, 0, kind, change);
 }
 
 EntityList Scene::FindEntities(const QString &pattern) const
 {
-    QRegExp regex = QRegExp(pattern, Qt::CaseSensitive, QRegExp::WildcardUnix);
-    return FindEntities(regex);
+    QHash<QString, QRegExp>::const_iterator it = findPatterns_.find(pattern);
+    if (it == findPatterns_.end())
+    {
+        // Bound the cache in case the patterns are generated, e.g. from user input
+        const int cMaxCachedPatterns = 64;
+        if (findPatterns_.size() >= cMaxCachedPatterns)
+            findPatterns_.clear();
+        it = findPatterns_.insert(pattern, QRegExp(pattern, Qt::CaseSensitive, QRegExp::WildcardUnix));
+    }
+    return FindEntities(it.value());
 }
 
 EntityList Scene::FindEntities(const QRegExp &pattern) const
@@ -1572,14 +2490,30 @@ EntityList Scene::FindEntities(const QRegExp &pattern) const
     if (pattern.isEmpty() || !pattern.isValid())
         return entities;
 
-    for(const_iterator it = begin(); it != end(); ++it)
+    // Only the names that start with the literal prefix of a case-sensitive wildcard pattern can match it
+    QString prefix;
+    if (pattern.caseSensitivity() == Qt::CaseSensitive)
     {
-        EntityPtr entity = it->second;
-        if (pattern.exactMatch(entity->Name()))
-            entities.push_back(entity);
+        const QString &source = pattern.pattern();
+        if (pattern.patternSyntax() == QRegExp::FixedString)
+            prefix = source;
+        else if (pattern.patternSyntax() == QRegExp::Wildcard || pattern.patternSyntax() == QRegExp::WildcardUnix)
+        {
+            const QString wildcards("*?[\\");
+            int length = 0;
+            while(length < source.length() && !wildcards.contains(source[length]))
+                ++length;
+            prefix = source.left(length);
+        }
     }
 
-    return entities;
+    std::vector<Entity*> matched;
+    for(QMap<QString, std::vector<IComponent*> >::const_iterator it = componentsByName_.lowerBound(prefix);
+        it != componentsByName_.end() && it.key().startsWith(prefix); ++it)
+        if (pattern.exactMatch(it.key()))
+            AppendEntitiesNamed(it.key(), it.value(), matched);
+
+    return ToSortedEntityList(matched);
 }
 
 EntityList Scene::FindEntitiesContaining(const QString &substring) const
@@ -1588,14 +2522,139 @@ EntityList Scene::FindEntitiesContaining(const QString &substring) const
     if (substring.isEmpty())
         return entities;
 
+    std::vector<Entity*> matched;
+    for(QMap<QString, std::vector<IComponent*> >::const_iterator it = componentsByName_.begin(); it != componentsByName_.end(); ++it)
+        if (it.key().contains(substring, Qt::CaseSensitive))
+            AppendEntitiesNamed(it.key(), it.value(), matched);
+
+    return ToSortedEntityList(matched);
+}
+
+namespace
+{
+
+/// Memory usage of the components of a type.
+struct ComponentTypeMemory
+{
+    ComponentTypeMemory() : count(0), bytes(0), attributeBytes(0), dynamicPropertyBytes(0), assetBytes(0) {}
+
+    QString typeName;
+    uint count;
+    qulonglong bytes;
+    qulonglong attributeBytes;
+    qulonglong dynamicPropertyBytes;
+    std::set<QString> assets; ///< Names of the loaded assets referred to.
+    qulonglong assetBytes;
+};
+
+struct MemoryBytesGreater
+{
+    bool operator()(const QVariantMap &a, const QVariantMap &b) const { return a["bytes"].toULongLong() > b["bytes"].toULongLong(); }
+};
+
+/// Appends the asset references of the attributes of the component.
+void CollectAssetReferences(const IComponent *component, QStringList &refs)
+{
+    const AttributeVector &attributes = component->Attributes();
+    for(size_t i = 0; i < attributes.size(); ++i)
+    {
+        if (!attributes[i])
+            continue;
+        if (attributes[i]->TypeId() == cAttributeAssetReference)
+            refs << static_cast<Attribute<AssetReference> *>(attributes[i])->Get().ref;
+        else if (attributes[i]->TypeId() == cAttributeAssetReferenceList)
+        {
+            const AssetReferenceList &list = static_cast<Attribute<AssetReferenceList> *>(attributes[i])->Get();
+            for(int j = 0; j < list.Size(); ++j)
+                refs << list[j].ref;
+        }
+    }
+}
+
+/// Sorts the memory statistics entries by bytes, largest first, and returns at most maxEntries of them.
+QVariantList ToSortedVariantList(std::vector<QVariantMap> &entries, size_t maxEntries)
+{
+    std::sort(entries.begin(), entries.end(), MemoryBytesGreater());
+    QVariantList list;
+    for(size_t i = 0; i < entries.size() && i < maxEntries; ++i)
+        list << entries[i];
+    return list;
+}
+
+}
+
+QVariantList Scene::ComponentMemoryStatistics() const
+{
+    PROFILE(Scene_ComponentMemoryStatistics);
+    std::map<u32, ComponentTypeMemory> types;
+    QHash<QString, qint64> assetSizes; // Disk source sizes of the loaded assets by name, 0 for the ones not loaded
+    AssetAPI *assetAPI = framework_->Asset();
+    QStringList refs;
     for(const_iterator it = begin(); it != end(); ++it)
     {
-        EntityPtr entity = it->second;
-        if (entity->Name().contains(substring, Qt::CaseSensitive))
-            entities.push_back(entity);
+        const Entity::ComponentMap &components = it->second->Components();
+        for(Entity::ComponentMap::const_iterator ci = components.begin(); ci != components.end(); ++ci)
+        {
+            const IComponent *component = ci->second.get();
+            ComponentTypeMemory &type = types[component->TypeId()];
+            if (type.typeName.isEmpty())
+                type.typeName = component->TypeName();
+            ++type.count;
+            type.bytes += component->MemoryUsage();
+            type.attributeBytes += component->AttributeMemoryUsage();
+            type.dynamicPropertyBytes += component->DynamicPropertyMemoryUsage();
+
+            refs.clear();
+            CollectAssetReferences(component, refs);
+            for(int i = 0; i < refs.size(); ++i)
+            {
+                if (refs[i].trimmed().isEmpty())
+                    continue;
+                const QString assetRef = assetAPI->ResolveAssetRef("", refs[i]);
+                QHash<QString, qint64>::iterator size = assetSizes.find(assetRef);
+                if (size == assetSizes.end())
+                {
+                    AssetPtr asset = assetAPI->GetAsset(assetRef);
+                    size = assetSizes.insert(assetRef, asset && asset->IsLoaded() ? std::max<qint64>(QFileInfo(asset->DiskSource()).size(), 1) : 0);
+                }
+                if (size.value() > 0 && type.assets.insert(assetRef).second)
+                    type.assetBytes += (qulonglong)size.value();
+            }
+        }
     }
 
-    return entities;
+    std::vector<QVariantMap> entries;
+    for(std::map<u32, ComponentTypeMemory>::const_iterator it = types.begin(); it != types.end(); ++it)
+    {
+        QVariantMap entry;
+        entry["typeName"] = it->second.typeName;
+        entry["count"] = it->second.count;
+        entry["bytes"] = it->second.bytes;
+        entry["attributeBytes"] = it->second.attributeBytes;
+        entry["dynamicPropertyBytes"] = it->second.dynamicPropertyBytes;
+        entry["assets"] = (uint)it->second.assets.size();
+        entry["assetBytes"] = it->second.assetBytes;
+        entries.push_back(entry);
+    }
+    return ToSortedVariantList(entries, entries.size());
+}
+
+QVariantList Scene::EntityMemoryStatistics(int maxEntities) const
+{
+    PROFILE(Scene_EntityMemoryStatistics);
+    std::vector<QVariantMap> entries;
+    entries.reserve(entities_.size());
+    for(const_iterator it = begin(); it != end(); ++it)
+    {
+        const Entity *entity = it->second.get();
+        QVariantMap entry;
+        entry["id"] = entity->Id();
+        entry["name"] = entity->Name();
+        entry["components"] = (uint)entity->Components().size();
+        entry["bytes"] = (qulonglong)entity->MemoryUsage();
+        entries.push_back(entry);
+    }
+    return ToSortedVariantList(entries, maxEntities > 0 ? (size_t)maxEntities : 0);
 }
 
 EntityList Scene::RootLevelEntities() const
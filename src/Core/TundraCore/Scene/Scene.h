@@ -11,9 +11,17 @@
 #include "Math/float3.h"
 #include "SceneDesc.h"
 #include "Entity.h"
+#include "EntityTable.h"
+#include "AttributeInterpolationTracks.h"
+#include "AttributeChangeListener.h"
+#include "SceneChangeJournal.h"
 
 #include <QObject>
 #include <QVariant>
+#include <QMap>
+#include <QHash>
+#include <QRegExp>
+#include <QMutex>
 
 #include <map>
 
@@ -22,6 +30,8 @@ class Framework;
 /// Maybe have some kind of UserConnection interface class defined in Framework and use that instead.
 class UserConnection;
 class QDomDocument;
+class QIODevice;
+class QXmlStreamReader;
 
 /// A collection of entities which form an observable world.
 /** Acts as a factory for all entities.
@@ -41,7 +51,7 @@ class TUNDRACORE_API Scene : public QObject, public enable_shared_from_this<Scen
 public:
     ~Scene();
 
-    typedef std::map<entity_id_t, EntityPtr> EntityMap; ///< Maps entities to their unique IDs.
+    typedef EntityTable EntityMap; ///< Maps entities to their unique IDs. O(1) lookup and iteration in ascending ID order.
     typedef EntityMap::iterator iterator; ///< entity iterator, see begin() and end()
     typedef EntityMap::const_iterator const_iterator;///< const entity iterator. see begin() and end()
 
@@ -83,7 +93,9 @@ public:
     void ChangeEntityId(entity_id_t old_id, entity_id_t new_id);
 
     /// Starts an attribute interpolation
-    /** @param attr Attribute inside a static-structured component.
+    /** If the attribute is still interpolating towards a previous endpoint, the new endpoint is buffered and interpolated to
+        after the previous one is reached, so that values received at a jittery rate are played back at a steady pace.
+        @param attr Attribute inside a static-structured component.
         @param endvalue Same kind of attribute holding the endpoint value. You must dynamically allocate this yourself, but Scene
                will always take care of deleting it.
         @param length Time length
@@ -141,6 +153,28 @@ public:
         @return List of created entities. */
     QList<Entity *> CreateContentFromSceneDesc(const SceneDesc &desc, bool useEntityIDsFromFile, AttributeChange::Type change);
 
+    /// Records an attribute change made inside a change transaction, to be signaled when the transaction commits. Called by IComponent.
+    /** @param comp Component pointer
+        @param attribute Attribute pointer
+        @param change Change signaling mode, not Default or Disconnected
+        @sa BeginChangeTransaction */
+    void DeferAttributeChange(IComponent* comp, IAttribute* attribute, AttributeChange::Type change);
+
+    /// Adds an engine-internal listener of attribute changes in the components of a type, or of all types if the type ID is 0.
+    /** The listener is called just before the AttributeChanged signal, only for the attribute of the index, or for all
+        the attributes if the index is negative. See IAttributeChangeListener.
+        @param listener Listener, which must be removed with RemoveAttributeChangeListener before it is destroyed
+        @param componentTypeId Type ID of the components, or 0 for all
+        @param attributeIndex Index of the attribute in the components, or a negative value for all */
+    void AddAttributeChangeListener(IAttributeChangeListener *listener, u32 componentTypeId = 0, int attributeIndex = -1);
+
+    /// Removes all the registrations of an attribute change listener from this scene.
+    void RemoveAttributeChangeListener(IAttributeChangeListener *listener);
+
+    /// Updates the name and group indices of the scene after an attribute of an EC_Name has changed. Called by IComponent.
+    /** Called for all changes, also Disconnected ones and inside change transactions, so that the indices are always current. */
+    void UpdateNameIndex(IComponent* comp);
+
     /// Emits notification of an attribute changing. Called by IComponent.
     /** @param comp Component pointer
         @param attribute Attribute pointer
@@ -191,13 +225,22 @@ public:
     /// Emits a notification of a component creation acked by the server, and the component ID changing as a result. Called by SyncManager
     void EmitComponentAcked(IComponent* component, component_id_t oldId);
 
+    /// Returns the change journal of the latest completed frame.
+    /** The journal of a frame is completed in FrameAPI::Updated, after the entity creations queued during the frame
+        have been signaled, and stays valid until the same point of the next frame. Read it after FrameAPI::Updated,
+        e.g. in a FrameAPI::PostFrameUpdate handler. Changes made by the FrameAPI::Updated handlers after the scene's
+        own go into the journal of the next frame, so every change is in exactly one journal.
+        Empty if the journal is not enabled. @sa SetChangeJournalEnabled */
+    const SceneChangeJournal &ChangeJournal() const { return changeJournal_; }
+
     /// Returns all components of type T (and additionally with specific name) in the scene.
+    /** @note O(k) in the number of components of type T in the scene. */
     template <typename T>
     std::vector<shared_ptr<T> > Components(const QString &name = "") const;
 
     /// Returns list of entities with a specific component present.
     /** @param name Name of the component, optional.
-        @note O(n) */
+        @note O(k log k) in the number of components of type T in the scene. */
     template <typename T>
     EntityList EntitiesWithComponent(const QString &name = "") const;
 
@@ -216,6 +259,45 @@ public:
     /// @endcond
 
 public slots:
+    /// Begins a change transaction, which defers the attribute change signals until it is committed.
+    /** Inside a transaction, every signaled attribute change is recorded instead of emitted. When the outermost
+        transaction commits, each changed component gets its attribute changes signaled once per attribute, with
+        the strongest change type the attribute was set with, and IComponent::AttributesChanged called once for all
+        of them. Use for bulk operations, e.g. moving thousands of entities from a script, to avoid a signal storm.
+        Transactions can be nested. Every BeginChangeTransaction must be paired with a CommitChangeTransaction;
+        a transaction left open at the end of the frame is committed with a warning.
+        @sa SceneChangeTransaction */
+    void BeginChangeTransaction();
+
+    /// Commits a change transaction. When the outermost transaction commits, the deferred attribute changes are signaled.
+    void CommitChangeTransaction();
+
+    /// Returns whether a change transaction is open.
+    bool InChangeTransaction() const { return changeTransactionDepth_ > 0; }
+
+    /// Returns the latest snapshot of the scene, or null if none has been taken.
+    /** Thread-safe. Background threads can read the returned snapshot without locking while the main thread modifies the scene.
+        @sa SetSnapshotsEnabled, TakeSnapshot, SceneSnapshot */
+    SceneSnapshotPtr LatestSnapshot() const;
+
+    /// Takes a snapshot of the scene, sharing the unchanged data with the latest snapshot, and makes it the latest snapshot.
+    /** Must be called in the main thread. */
+    SceneSnapshotPtr TakeSnapshot();
+
+    /// Sets whether the scene takes a snapshot at the end of each frame. Disabled by default.
+    /** Disabling the snapshots releases the latest snapshot held by the scene. */
+    void SetSnapshotsEnabled(bool enabled);
+
+    /// Returns whether the scene takes a snapshot at the end of each frame.
+    bool SnapshotsEnabled() const { return snapshotsEnabled_; }
+
+    /// Sets whether the scene records the changes of each frame into a change journal. Disabled by default.
+    /** Disabling the journal clears it. @sa ChangeJournal */
+    void SetChangeJournalEnabled(bool enabled);
+
+    /// Returns whether the scene records the changes of each frame into a change journal.
+    bool ChangeJournalEnabled() const { return changeJournalEnabled_; }
+
     /// Creates new entity that contains the specified components.
     /** Entities should never be created directly, but instead created with this function.
 
@@ -244,6 +326,20 @@ public slots:
     EntityPtr CreateLocalEntity(const QStringList &components = QStringList(),
         AttributeChange::Type change = AttributeChange::Default, bool componentsReplicated = false, bool temporary = false);
 
+    /// Creates many entities with the same components at once.
+    /** The IDs are allocated in one go, and are consecutive unless some of them are already in use.
+        Instead of an EntityCreated signal per entity, the creation is signaled with one EntitiesCreated signal at the end of the frame.
+        @param count Number of entities to create.
+        @param components Optional list of component names ("EC_" prefix can be omitted) each entity will have.
+        @param change Notification/network replication mode
+        @param replicated Whether the entities are replicated. Default true.
+        @param componentsReplicated Whether components will be replicated, true by default.
+        @param temporary Whether the entities are temporary, false by default.
+        @return The created entities in ascending ID order.
+        @sa RemoveEntities */
+    EntityList CreateEntities(uint count, const QStringList &components = QStringList(),
+        AttributeChange::Type change = AttributeChange::Default, bool replicated = true, bool componentsReplicated = true, bool temporary = false);
+
     /// Returns scene up vector. For now it is a compile-time constant
     /** @sa RightVector,.ForwardVector */
     float3 UpVector() const;
@@ -275,12 +371,12 @@ public slots:
     /** @note The name of the entity is stored in a component EC_Name. If this component is not present in the entity, it has no name.
         @note Returns a shared pointer, but it is preferable to use a weak pointer, EntityWeakPtr,
               to avoid dangling references that prevent entities from being properly destroyed.
-        @note @note O(n)
+        @note O(log n + k) in the number of distinct names and the number of entities with the name.
         @sa EntityById, FindEntities, FindEntitiesContaining */
     EntityPtr EntityByName(const QString &name) const;
 
     /// Returns whether name is unique within the scene, ie. is only encountered once, or not at all.
-    /** @note O(n) */
+    /** @note O(log n + k), see EntityByName. */
     bool IsUniqueName(const QString& name) const;
 
     /// Returns true if entity with the specified id exists in this scene, false otherwise
@@ -294,6 +390,14 @@ public slots:
         @return Was the entity found and removed. */
     bool RemoveEntity(entity_id_t id, AttributeChange::Type change = AttributeChange::Default);
 
+    /// Removes many entities at once, together with their children.
+    /** Instead of an EntityRemoved signal per entity, the removal is signaled with one EntitiesRemoved signal before the
+        entities are removed. Each entity still emits its own Entity::EntityRemoved signal. Entities of other scenes are ignored.
+        @param entities The entities to remove.
+        @param change Origin of change regards to network replication.
+        @return Number of entities removed, including the children. */
+    uint RemoveEntities(const EntityList &entities, AttributeChange::Type change = AttributeChange::Default);
+
     /// Removes all entities
     /** The entities may not get deleted if dangling references to a pointer to them exist.
         @param signal Whether to send signals of each delete. */
@@ -310,7 +414,7 @@ public slots:
     /// Returns list of entities with a specific component present.
     /** @param typeId Type ID of the component
         @param name Name of the component, optional.
-        @note O(n) */
+        @note O(k log k) in the number of components of the type in the scene. The entities are in no particular order. */
     EntityList EntitiesWithComponent(u32 typeId, const QString &name = "") const;
     /// @overload
     /** @param typeName typeName Type name of the component.
@@ -318,12 +422,14 @@ public slots:
     EntityList EntitiesWithComponent(const QString &typeName, const QString &name = "") const;
 
     /// Returns list of entities that belong to the group 'groupName'
-    /** @param groupName The name of the group to be queried */
+    /** @param groupName The name of the group to be queried
+        @note O(k log k) in the number of entities in the group. */
     EntityList EntitiesOfGroup(const QString &groupName) const;
 
     /// Returns all components of specific type (and additionally with specific name) in the scene.
-    /*  @param typeId Component type ID.
-        @param name Arbitrary name of the component (optional). */
+    /** @param typeId Component type ID.
+        @param name Arbitrary name of the component (optional).
+        @note O(k) in the number of components of the type in the scene. The components are in no particular order. */
     Entity::ComponentVector Components(u32 typeId, const QString &name = "") const;
     /// overload
     /** @param typeName Component type name.
@@ -333,17 +439,32 @@ public slots:
     /// Performs a regular expression matching through the entities, and returns a list of the matched entities.
     /** @param pattern Regular expression to be matched.
         @note Wildcards can be escaped with '\' character.
+        @note Matches each distinct name once. A case-sensitive wildcard pattern that starts with a literal prefix, e.g. "Box*",
+              only tests the names that start with the prefix. The patterns given as strings are compiled once and cached.
         @sa FindEntitiesContaining */
     EntityList FindEntities(const QRegExp &pattern) const;
     EntityList FindEntities(const QString &pattern) const; /**< @overload @param pattern String pattern with wildcards. */
 
     /// Performs a search through the entities, and returns a list of all the entities that contain 'substring' in their names.
-    /** @param substring String to be searched. */
+    /** @param substring String to be searched.
+        @note Tests each distinct name once. */
     EntityList FindEntitiesContaining(const QString &substring) const;
 
     /// Return root-level entities, ie. those that have no parent.
     EntityList RootLevelEntities() const;
 
+    /// Returns the approximate memory usage of the components of the scene, aggregated by component type.
+    /** Each entry is a map of typeName, count, bytes (the sum of IComponent::MemoryUsage), attributeBytes, dynamicPropertyBytes,
+        assets (the number of distinct loaded assets the components of the type refer to) and assetBytes (the total size of the
+        disk sources of those assets, as an approximation of their memory). Sorted by bytes, largest first.
+        @sa EntityMemoryStatistics */
+    QVariantList ComponentMemoryStatistics() const;
+
+    /// Returns the approximate memory usage of the largest entities of the scene.
+    /** Each entry is a map of id, name, components and bytes (Entity::MemoryUsage). Sorted by bytes, largest first.
+        @param maxEntities Maximum number of entities returned. */
+    QVariantList EntityMemoryStatistics(int maxEntities = 20) const;
+
     /// Loads the scene from XML.
     /** @param filename File name
         @param clearScene Do we want to clear the existing scene.
@@ -384,6 +505,18 @@ public slots:
         @return true if successful */
     bool SaveSceneBinary(const QString& filename, bool saveTemporary, bool saveLocal) const;
 
+    /// Save the scene to the indexed binary format, whose entities can be loaded on demand with IndexedSceneFile
+    /** LoadSceneBinary loads the indexed format as a whole.
+        @param filename File name
+        @param saveTemporary Are temporary entities wanted to be included.
+        @param saveLocal Are local entities wanted to be included.
+        @return true if successful */
+    bool SaveSceneBinaryIndexed(const QString& filename, bool saveTemporary, bool saveLocal) const;
+
+    /// Returns the incremental background persistence of the scene, which is created on the first call.
+    /** Use it instead of periodic SaveSceneBinary calls to autosave a large scene without stalling the main loop. */
+    ScenePersistence *Persistence();
+
     /// Creates scene content from XML.
     /** @param xml XML document as string.
         @param useEntityIDsFromFile If true, the created entities will use the Entity IDs from the original file.
@@ -394,6 +527,18 @@ public slots:
     QList<Entity *> CreateContentFromXml(const QString &xml, bool useEntityIDsFromFile, AttributeChange::Type change);
     QList<Entity *> CreateContentFromXml(const QDomDocument &xml, bool useEntityIDsFromFile, AttributeChange::Type change); /**< @overload @param xml XML document. */
 
+    /// Creates scene content from XML read from a device, without building a DOM of the whole document.
+    /** The entities are created as their elements are parsed, so the memory use does not grow with the document.
+        As the document is not validated beforehand, the entities parsed before an XML error are kept.
+        The string overload of CreateContentFromXml and LoadSceneXML use this too.
+        @param device Device to read the XML from, e.g. an open QFile.
+        @param useEntityIDsFromFile If true, the created entities will use the Entity IDs from the original file.
+                  If the scene contains any previous entities with conflicting IDs, those are removed. If false, the entity IDs from the files are ignored,
+                  and new IDs are generated for the created entities.
+        @param change Change type that will be used, when removing the old scene, and deserializing the new
+        @return List of created entities. */
+    QList<Entity *> CreateContentFromXml(QIODevice *device, bool useEntityIDsFromFile, AttributeChange::Type change);
+
     /// Creates scene content from binary file.
     /** @param filename File name.
         @param useEntityIDsFromFile If true, the created entities will use the Entity IDs from the original file.
@@ -465,6 +610,14 @@ signals:
     /// Signal when an entity deleted
     void EntityRemoved(Entity* entity, AttributeChange::Type change);
 
+    /// Signal when entities have been created with CreateEntities, instead of EntityCreated for each of them.
+    /** @param entities The created entities that still exist, in ascending ID order. */
+    void EntitiesCreated(const EntityList &entities, AttributeChange::Type change);
+
+    /// Signal when entities are about to be removed with RemoveEntities, instead of EntityRemoved for each of them.
+    /** @param entities The entities to be removed, including the children, parents before their children. */
+    void EntitiesRemoved(const EntityList &entities, AttributeChange::Type change);
+
     /// A entity creation has been acked by the server and assigned a proper replicated ID
     void EntityAcked(Entity* entity, entity_id_t oldId);
 
@@ -499,13 +652,29 @@ private slots:
     /// Handle frame update. Signal this frame's entity creations.
     void OnUpdated(float frameTime);
 
+    /// Takes the snapshot of the frame, if snapshots are enabled.
+    void OnPostFrameUpdate(float frameTime);
+
 private:
     friend class ::SceneAPI;
 
+    /// Returns the ID for an entity to be created from a file, and clears the ID in the scene. Called internally.
+    entity_id_t ReserveIdForCreatedEntity(entity_id_t id, bool replicated, bool useEntityIDsFromFile, QHash<entity_id_t, entity_id_t>& oldToNewIds);
+    /// Fixes the parent refs of the entities created from a file, and emits the signals of their creation. Returns the entities that still exist. Called internally.
+    QList<Entity *> FinishCreatedContent(const std::vector<EntityWeakPtr>& entities, bool useEntityIDsFromFile, const QHash<entity_id_t, entity_id_t>& oldToNewIds, AttributeChange::Type change);
+    /// Sets the prototype of an entity created from a file, and copies the components of the prototype to it. Called internally.
+    /** @param prototypeId The prototype ID in the file, or an empty string if the entity is not an instance. */
+    void ApplyPrototypeForCreatedEntity(Entity *entity, const QString &prototypeId, const QHash<entity_id_t, entity_id_t>& oldToNewIds);
+    /// Create content from the XML of a stream positioned before the scene element. Called internally.
+    QList<Entity *> CreateContentFromXmlStream(QXmlStreamReader& reader, bool useEntityIDsFromFile, AttributeChange::Type change);
+    /// Create entity from the XML element the stream is at and recurse into child entities. Called internally.
+    void CreateEntityFromXmlStream(EntityPtr parent, QXmlStreamReader& reader, bool useEntityIDsFromFile, AttributeChange::Type change, std::vector<EntityWeakPtr>& entities, QHash<entity_id_t, entity_id_t>& oldToNewIds);
+    /// Create component from the XML element the stream is at. Called internally.
+    void CreateComponentFromXmlStream(Entity *entity, QXmlStreamReader& reader);
     /// Create entity from an XML element and recurse into child entities. Called internally.
     void CreateEntityFromXml(EntityPtr parent, const QDomElement& ent_elem, bool useEntityIDsFromFile, AttributeChange::Type change, std::vector<EntityWeakPtr>& entities, QHash<entity_id_t, entity_id_t>& oldToNewIds);
-    /// Create entity from binary data and recurse into child entities. Called internally.
-    void CreateEntityFromBinary(EntityPtr parent, kNet::DataDeserializer& source, bool useEntityIDsFromFile, AttributeChange::Type change, std::vector<EntityWeakPtr>& entities, QHash<entity_id_t, entity_id_t>& oldToNewIds);
+    /// Create entity from a description decoded from binary data and recurse into child entities. Called internally.
+    void CreateEntityFromBinaryDesc(EntityPtr parent, const BinaryEntityDesc& source, bool useEntityIDsFromFile, AttributeChange::Type change, std::vector<EntityWeakPtr>& entities, QHash<entity_id_t, entity_id_t>& oldToNewIds);
     /// Create entity from entity desc and recurse into child entities. Called internally.
     void CreateEntityFromDesc(EntityPtr parent, const EntityDesc& source, bool useEntityIDsFromFile, AttributeChange::Type change, QList<Entity *>& entities, QHash<entity_id_t, entity_id_t>& oldToNewIds);
     /// Create entity desc from an XML element and recurse into child entities. Called internally.
@@ -514,12 +683,60 @@ private:
     /// Container for an ongoing attribute interpolation
     struct AttributeInterpolation
     {
-        AttributeInterpolation() : time(0.0f), length(0.0f) {}
+        AttributeInterpolation() : time(0.0f), length(0.0f), kind(AttributeInterpolationTracks::KindGeneric), track(0), apply(false) {}
         AttributeWeakPtr dest, start, end;
         float time;
         float length;
+        std::vector<std::pair<IAttribute*, float> > pending; ///< Buffered endpoints and their time lengths, interpolated to after end.
+        AttributeInterpolationTracks::Kind kind; ///< Kind of the track in interpolationTracks_, or KindGeneric if interpolated with IAttribute::Interpolate.
+        size_t track; ///< Index of the track in interpolationTracks_.
+        bool apply; ///< Whether the evaluated value of the track is to be set to the destination on this update.
+    };
+
+    /// Deletes the interpolation's attribute copies and removes it from interpolations_. Moves the last interpolation to the index.
+    void RemoveAttributeInterpolation(size_t index);
+
+    /// Attribute changes of a component deferred by a change transaction.
+    struct DeferredComponentChanges
+    {
+        ComponentWeakPtr component;
+        std::vector<std::pair<u8, AttributeChange::Type> > attributes; ///< Indices of the changed attributes and their strongest change types.
+    };
+
+    /// Adds a component that was added to an entity of the scene to componentsByType_.
+    void IndexComponent(IComponent *comp);
+    /// Removes a component that is about to be removed from an entity of the scene from componentsByType_. Moves the last component of the type to its index.
+    void UnindexComponent(IComponent *comp);
+
+    /// Records a change of a component of an entity of the scene to the journal of the frame, if enabled.
+    void RecordComponentChange(IComponent *comp, SceneChange::Kind kind, AttributeChange::Type change, int attributeIndex = -1);
+    /// Records an entity-level change to the journal of the frame, if enabled.
+    void RecordEntityChange(Entity *entity, SceneChange::Kind kind, AttributeChange::Type change);
+
+    /// Allocates a free ID for a new entity, as CreateEntity with zero ID.
+    entity_id_t AllocateFreeId(bool replicated);
+
+    /// Entities created with CreateEntities, to signal at frame end.
+    struct CreatedEntityBatch
+    {
+        std::vector<EntityWeakPtr> entities;
+        AttributeChange::Type change;
+    };
+
+    /// Name and group of an EC_Name as in the name and group indices.
+    struct IndexedName
+    {
+        QString name;
+        QString group;
     };
 
+    /// Adds an EC_Name to componentsByName_ and componentsByGroup_. Called by IndexComponent.
+    void IndexName(IComponent *comp);
+    /// Removes an EC_Name from componentsByName_ and componentsByGroup_. Called by UnindexComponent.
+    void UnindexName(IComponent *comp);
+    /// Appends the entities whose name, as given by Entity::Name, is the name of the indexed EC_Name components.
+    void AppendEntitiesNamed(const QString &name, const std::vector<IComponent*> &components, std::vector<Entity*> &result) const;
+
     UniqueIdGenerator idGenerator_; ///< Entity ID generator
     EntityMap entities_; ///< All entities in the scene.
     Framework *framework_; ///< Parent framework.
@@ -528,7 +745,49 @@ private:
     bool interpolating_; ///< Currently doing interpolation-flag.
     bool authority_; ///< Authority -flag
     std::vector<AttributeInterpolation> interpolations_; ///< Running attribute interpolations.
+    std::map<IAttribute*, size_t> interpolationIndices_; ///< Indices to interpolations_ by destination attribute.
+    AttributeInterpolationTracks interpolationTracks_; ///< Values of the running interpolations of the vectorized attribute types.
+    std::map<u32, std::vector<IComponent*> > componentsByType_; ///< Components of the entities of the scene by type ID, for Components and EntitiesWithComponent.
+    std::map<IComponent*, size_t> componentIndices_; ///< Indices to componentsByType_ by component.
+    QMap<QString, std::vector<IComponent*> > componentsByName_; ///< EC_Name components by non-empty name, ordered for prefix queries.
+    QHash<QString, std::vector<IComponent*> > componentsByGroup_; ///< EC_Name components by non-empty group.
+    QHash<IComponent*, IndexedName> indexedNames_; ///< The name and group under which each EC_Name in the scene is indexed.
+    mutable QHash<QString, QRegExp> findPatterns_; ///< Compiled wildcard patterns of FindEntities.
     std::vector<std::pair<EntityWeakPtr, AttributeChange::Type> > entitiesCreatedThisFrame_; ///< Entities to signal for creation at frame end.
+    std::vector<CreatedEntityBatch> entityBatchesCreatedThisFrame_; ///< Entities created with CreateEntities, to signal for creation at frame end.
+    int changeTransactionDepth_; ///< Number of open change transactions.
+    AttributeChangeListenerList changeListeners_; ///< Attribute change listeners of all component types.
+    std::map<u32, AttributeChangeListenerList> changeListenersByType_; ///< Attribute change listeners by component type ID.
+    std::vector<DeferredComponentChanges> deferredChanges_; ///< Components changed inside the change transaction, in the order of their first change.
+    std::map<IComponent*, size_t> deferredChangeIndices_; ///< Indices to deferredChanges_ by component.
+    bool snapshotsEnabled_; ///< Whether a snapshot is taken at the end of each frame.
+    SceneSnapshotPtr latestSnapshot_; ///< Latest snapshot, guarded by snapshotMutex_.
+    mutable QMutex snapshotMutex_; ///< Guards latestSnapshot_, which background threads read.
+    ScenePersistence *persistence_; ///< Created on demand by Persistence.
+    bool changeJournalEnabled_; ///< Whether the changes of each frame are recorded.
+    SceneChangeJournal changeJournal_; ///< Journal of the latest completed frame.
+    SceneChangeJournal recordingJournal_; ///< Journal of the frame in progress, swapped with changeJournal_ when completed.
+};
+
+/// Opens a change transaction on a scene for the lifetime of the object.
+/** @code
+    {
+        SceneChangeTransaction transaction(scene);
+        // Change attributes of many entities
+    } // The changes are signaled here
+    @endcode
+    @sa Scene::BeginChangeTransaction */
+class SceneChangeTransaction
+{
+public:
+    explicit SceneChangeTransaction(Scene *scene) : scene_(scene) { if (scene_) scene_->BeginChangeTransaction(); }
+    ~SceneChangeTransaction() { if (scene_) scene_->CommitChangeTransaction(); }
+
+private:
+    SceneChangeTransaction(const SceneChangeTransaction &);
+    SceneChangeTransaction &operator=(const SceneChangeTransaction &);
+
+    Scene *scene_;
 };
 
 #include "Scene.inl"
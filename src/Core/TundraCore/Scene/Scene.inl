@@ -13,23 +13,13 @@ template <typename T>
 std::vector<shared_ptr<T> > Scene::Components(const QString &name) const
 {
     std::vector<shared_ptr<T> > ret;
-    if (name.isEmpty())
+    Entity::ComponentVector components = Components(T::ComponentTypeId, name);
+    ret.reserve(components.size());
+    for(size_t i = 0; i < components.size(); ++i)
     {
-        for(const_iterator it = begin(); it != end(); ++it)
-        {
-            std::vector<shared_ptr<T> > components =  it->second->ComponentsOfType<T>();
-            if (!components.empty())
-                ret.insert(ret.end(), components.begin(), components.end());
-        }
-    }
-    else
-    {
-        for(const_iterator it = begin(); it != end(); ++it)
-        {
-            shared_ptr<T> component = it->second->GetComponent<T>(name);
-            if (component)
-                ret.push_back(component);
-        }
+        shared_ptr<T> component = dynamic_pointer_cast<T>(components[i]);
+        if (component)
+            ret.push_back(component);
     }
     return ret;
 }
@@ -19,6 +19,8 @@
 #include "Math/float4.h"
 #include "Transform.h"
 #include "EC_PlaceholderComponent.h"
+#include "ObjectPool.h"
+#include "MetricsRegistry.h"
 
 #include <QDomElement>
 
@@ -35,6 +37,13 @@ SceneAPI::SceneAPI(Framework *owner) :
     QObject(owner),
     framework(owner)
 {
+    MetricsRegistry *metrics = framework->Metrics();
+    if (metrics->IsEnabled())
+    {
+        metrics->Describe("tundra_scene_entities", MetricsRegistry::Gauge, "Number of the replicated and the local entities of each scene.");
+        metrics->Describe("tundra_scene_components", MetricsRegistry::Gauge, "Number of the components of each scene.");
+        connect(metrics, SIGNAL(Collect()), SLOT(CollectMetrics()));
+    }
 }
 
 SceneAPI::~SceneAPI()
@@ -42,6 +51,30 @@ SceneAPI::~SceneAPI()
     Reset();
 }
 
+void SceneAPI::CollectMetrics()
+{
+    MetricsRegistry *metrics = framework->Metrics();
+    metrics->Clear("tundra_scene_entities");
+    metrics->Clear("tundra_scene_components");
+    for(SceneMap::const_iterator iter = scenes.begin(); iter != scenes.end(); ++iter)
+    {
+        size_t replicated = 0, local = 0, components = 0;
+        const Scene *scene = iter->second.get();
+        for(Scene::const_iterator e = scene->begin(); e != scene->end(); ++e)
+        {
+            if (e->second->IsReplicated())
+                ++replicated;
+            else
+                ++local;
+            components += e->second->Components().size();
+        }
+        const QString label = MetricsRegistry::Label("scene", iter->first);
+        metrics->Set("tundra_scene_entities", (double)replicated, label + ",replication=\"replicated\"");
+        metrics->Set("tundra_scene_entities", (double)local, label + ",replication=\"local\"");
+        metrics->Set("tundra_scene_components", (double)components, label);
+    }
+}
+
 void SceneAPI::Reset()
 {
     scenes.clear();
@@ -419,7 +452,7 @@ ComponentPtr SceneAPI::CreatePlaceholderComponentById(Scene* scene, u32 componen
 
     const ComponentDesc& desc = i->second;
 
-    EC_PlaceholderComponent* component = new EC_PlaceholderComponent(scene);
+    shared_ptr<EC_PlaceholderComponent> component = MAKE_POOLED_SHARED(EC_PlaceholderComponent, scene);
     component->SetTypeId(componentTypeid);
     component->SetTypeName(desc.typeName);
     component->SetName(newComponentName);
@@ -430,7 +463,7 @@ ComponentPtr SceneAPI::CreatePlaceholderComponentById(Scene* scene, u32 componen
         component->CreateAttribute(attr.typeName, attr.id, attr.name);
     }
 
-    return ComponentPtr(component);
+    return component;
 }
 
 QStringList SceneAPI::ComponentTypes() const
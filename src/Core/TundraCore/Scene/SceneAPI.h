@@ -198,6 +198,10 @@ signals:
         @param typeName Name of new component type */
     void PlaceholderComponentTypeRegistered(u32 typeId, const QString& typeName, AttributeChange::Type change);
 
+private slots:
+    /// Sets the metrics of the entity and component counts of the scenes, see MetricsRegistry::Collect.
+    void CollectMetrics();
+
 private:
     friend class Framework;
 
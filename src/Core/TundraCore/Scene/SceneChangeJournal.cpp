@@ -0,0 +1,59 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#include "StableHeaders.h"
+#include "DebugOperatorNew.h"
+
+#include "SceneChangeJournal.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "MemoryLeakCheck.h"
+
+void SceneChangeJournal::Record(entity_id_t entityId, component_id_t componentId, u32 componentTypeId, SceneChange::Kind kind, AttributeChange::Type change, int attributeIndex)
+{
+    size_t index = lastIndex_;
+    if (index >= changes_.size() || changes_[index].entityId != entityId || changes_[index].componentId != componentId)
+    {
+        std::map<Key, size_t>::iterator it = indices_.find(Key(entityId, componentId));
+        if (it != indices_.end())
+            index = it->second;
+        else
+        {
+            index = changes_.size();
+            indices_[Key(entityId, componentId)] = index;
+            SceneChange entry;
+            entry.entityId = entityId;
+            entry.componentId = componentId;
+            entry.componentTypeId = componentTypeId;
+            entry.kinds = 0;
+            entry.change = change;
+            memset(entry.attributes, 0, sizeof entry.attributes);
+            changes_.push_back(entry);
+        }
+        lastIndex_ = index;
+    }
+
+    SceneChange &entry = changes_[index];
+    entry.kinds |= (u8)kind;
+    // Replicate is stronger than LocalOnly
+    entry.change = std::max(entry.change, change);
+    if (attributeIndex >= 0 && attributeIndex < 256)
+        entry.attributes[attributeIndex >> 3] |= (u8)(1 << (attributeIndex & 7));
+}
+
+void SceneChangeJournal::Clear()
+{
+    changes_.clear();
+    indices_.clear();
+    frameNumber_ = -1;
+    lastIndex_ = 0;
+}
+
+void SceneChangeJournal::Swap(SceneChangeJournal &other)
+{
+    changes_.swap(other.changes_);
+    indices_.swap(other.indices_);
+    std::swap(frameNumber_, other.frameNumber_);
+    std::swap(lastIndex_, other.lastIndex_);
+}
@@ -0,0 +1,86 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#pragma once
+
+#include "TundraCoreApi.h"
+#include "CoreTypes.h"
+#include "AttributeChangeType.h"
+
+#include <map>
+#include <utility>
+#include <vector>
+
+/// The changes to an entity, or to one of its components, during a frame. An entry of SceneChangeJournal.
+/** Entity-level changes have zero componentId. All the changes of a component during the frame are coalesced into one entry, so e.g. an entity
+    that was removed and created again with the same ID during the frame has both EntityRemoved and EntityCreated set. */
+struct TUNDRACORE_API SceneChange
+{
+    /// Kinds of changes, combined as a bitmask in kinds.
+    enum Kind
+    {
+        EntityCreated = 1,
+        EntityRemoved = 2,
+        EntityParentChanged = 4,
+        ComponentAdded = 8,
+        ComponentRemoved = 16,
+        AttributesChanged = 32, ///< The changed attributes are set in attributes.
+        AttributesAddedOrRemoved = 64 ///< Dynamic attributes were added or removed. Their indices are set in attributes.
+    };
+
+    entity_id_t entityId;
+    component_id_t componentId; ///< Zero for entity-level changes.
+    u32 componentTypeId; ///< Zero for entity-level changes.
+    u8 kinds; ///< Bitmask of Kind.
+    AttributeChange::Type change; ///< Strongest change type of the coalesced changes.
+    u8 attributes[32]; ///< Bitfield of the attribute indices that changed, like ComponentSyncState::dirtyAttributes.
+
+    bool Has(Kind kind) const { return (kinds & kind) != 0; }
+    /// Returns whether the attribute of the index changed, or was added or removed.
+    bool IsAttributeChanged(u8 index) const { return (attributes[index >> 3] & (1 << (index & 7))) != 0; }
+};
+
+/// Compact list of the entity, component and attribute changes of a scene during one frame.
+/** For consumers that would rather poll the changes once per frame than connect to the per-change signals of Scene,
+    or to IAttributeChangeListener. Enable with Scene::SetChangeJournalEnabled and read Scene::ChangeJournal after
+    FrameAPI::Updated, e.g. in a FrameAPI::PostFrameUpdate handler.
+
+    The entries are stored in one contiguous vector, which keeps its capacity from frame to frame, and are in the order
+    of the first change of each entity or component. Changes signaled with AttributeChange::Disconnected are not recorded,
+    like they are not signaled.
+    @note The IDs are those at the time of the change. An entity or component may have been removed since, so look
+    them up from the scene instead of assuming that they exist. */
+class TUNDRACORE_API SceneChangeJournal
+{
+public:
+    SceneChangeJournal() : frameNumber_(-1), lastIndex_(0) {}
+
+    /// Returns the changes in the order of the first change of each entity or component.
+    const std::vector<SceneChange> &Changes() const { return changes_; }
+    size_t NumChanges() const { return changes_.size(); }
+    bool IsEmpty() const { return changes_.empty(); }
+
+    /// Returns the FrameAPI::FrameNumber of the frame the changes were made in, or -1 if the journal has not been completed.
+    int FrameNumber() const { return frameNumber_; }
+
+    /// @cond PRIVATE
+    /// Records a change. Called by Scene.
+    /** @param attributeIndex Index of the changed, added or removed attribute, or -1 if the change is not about an attribute. */
+    void Record(entity_id_t entityId, component_id_t componentId, u32 componentTypeId, SceneChange::Kind kind, AttributeChange::Type change, int attributeIndex = -1);
+
+    /// Clears the changes, keeping the allocated memory.
+    void Clear();
+
+    /// Swaps the contents with another journal.
+    void Swap(SceneChangeJournal &other);
+
+    void SetFrameNumber(int frameNumber) { frameNumber_ = frameNumber; }
+    /// @endcond
+
+private:
+    typedef std::pair<entity_id_t, component_id_t> Key;
+
+    std::vector<SceneChange> changes_;
+    std::map<Key, size_t> indices_; ///< Indices to changes_ by entity and component ID, for coalescing.
+    int frameNumber_;
+    size_t lastIndex_; ///< Index of the last recorded change, checked before indices_ as the changes of a component usually come in a row.
+};
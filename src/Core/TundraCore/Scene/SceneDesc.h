@@ -12,6 +12,8 @@
 #include <QMap>
 #include <QPair>
 
+#include <vector>
+
 /// Description of a scene (Scene).
 /** A source-agnostic scene graph description of a Tundra scene.
     A Tundra scene consist of entities, components, attributes and assets references.
@@ -153,3 +155,31 @@ struct TUNDRACORE_API AssetDesc
     /// Equality operator. Returns true if filenames match, false otherwise.
     bool operator ==(const AssetDesc &rhs) const { return source == rhs.source; }
 };
+
+/// Description of a component read from the binary scene format (.tbin).
+/** Used by Scene::CreateContentFromBinary, which decodes the attribute values of the components on worker threads
+    before creating the actual components on the main thread. */
+struct TUNDRACORE_API BinaryComponentDesc
+{
+    u32 typeId; ///< Type ID.
+    QString name; ///< Name.
+    bool sync; ///< Synchronize component.
+    const char *data; ///< Serialized attribute data, pointing to the binary scene data, which must outlive the description.
+    uint dataSize; ///< Size of the serialized attribute data.
+    /// Attribute values decoded from the data, owned by no component. Empty if the data was not decoded,
+    /// in which case the component is deserialized from the data directly.
+    std::vector<shared_ptr<IAttribute> > attributes;
+
+    BinaryComponentDesc() : typeId(0xffffffff), sync(true), data(0), dataSize(0) {}
+};
+
+/// Description of an entity read from the binary scene format (.tbin).
+struct TUNDRACORE_API BinaryEntityDesc
+{
+    entity_id_t id; ///< ID in the binary data.
+    bool replicated; ///< Is entity replicated.
+    std::vector<BinaryComponentDesc> components; ///< Components the entity has.
+    std::vector<BinaryEntityDesc> children; ///< Child entities the entity has.
+
+    BinaryEntityDesc() : id(0), replicated(true) {}
+};
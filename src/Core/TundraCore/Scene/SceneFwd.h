@@ -18,12 +18,18 @@ class IComponentFactory;
 class IAttribute;
 class AttributeMetadata;
 class ChangeRequest;
+class SceneSnapshot;
+class EntitySnapshot;
+class ComponentSnapshot;
+class ScenePersistence;
 
 struct SceneDesc;
 struct EntityDesc;
 struct ComponentDesc;
 struct AttributeDesc;
 struct AssetDesc;
+struct BinaryEntityDesc;
+struct BinaryComponentDesc;
 struct EntityReference;
 
 typedef shared_ptr<Scene> ScenePtr;
@@ -35,4 +41,7 @@ typedef shared_ptr<IComponent> ComponentPtr;
 typedef weak_ptr<IComponent> ComponentWeakPtr;
 typedef shared_ptr<IComponentFactory> ComponentFactoryPtr;
 typedef std::vector<IAttribute*> AttributeVector;
+typedef shared_ptr<const SceneSnapshot> SceneSnapshotPtr;
+typedef shared_ptr<const EntitySnapshot> EntitySnapshotPtr;
+typedef shared_ptr<const ComponentSnapshot> ComponentSnapshotPtr;
 typedef std::map<QString, ScenePtr> SceneMap;
@@ -0,0 +1,619 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#include "StableHeaders.h"
+#include "DebugOperatorNew.h"
+
+#include "ScenePersistence.h"
+#include "Scene/Scene.h"
+#include "SceneSnapshot.h"
+#include "Profiler.h"
+#include "LoggingFunctions.h"
+#include "CoreException.h"
+
+#include <kNet/DataDeserializer.h>
+#include <kNet/DataSerializer.h>
+
+#include <QDir>
+#include <QFile>
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QStringList>
+
+#include <map>
+#include <set>
+#include <vector>
+
+#include "MemoryLeakCheck.h"
+
+using namespace kNet;
+
+namespace
+{
+
+/// "TPC1" in the byte order of the files.
+const u32 cCheckpointMagic = 0x31435054;
+/// Checkpoint kinds.
+const u32 cBaseCheckpoint = 0;
+const u32 cDeltaCheckpoint = 1;
+/// Magic, kind, number, payload size and payload checksum.
+const size_t cCheckpointHeaderSize = 5 * sizeof(u32);
+/// Maximum serialized size of a component, as in Entity::SerializeToBinary.
+const size_t cMaxComponentSize = 64 * 1024;
+
+const QString cBaseFilename("scene.base");
+const QString cNewBaseFilename("scene.base.new");
+const QString cJournalFilename("scene.journal");
+
+/// Returns whether the entity is written into the checkpoints.
+bool IsPersisted(const EntitySnapshot *entity, bool saveLocal)
+{
+    return !entity->IsTemporary() && (saveLocal || entity->IsReplicated());
+}
+
+/// Appends the record of an entity, without its children: ID, parent ID, replicated flag and components in the binary scene format.
+void AppendEntityRecord(QByteArray &dest, const EntitySnapshot *entity, std::vector<char> &componentBuffer)
+{
+    const std::vector<ComponentSnapshotPtr> &components = entity->Components();
+    u32 numPersisted = 0;
+    for(size_t i = 0; i < components.size(); ++i)
+        if (!components[i]->IsTemporary())
+            ++numPersisted;
+
+    char header[3 * sizeof(u32) + sizeof(u8)];
+    DataSerializer headerDs(header, sizeof(header));
+    headerDs.Add<u32>(entity->Id());
+    headerDs.Add<u32>(entity->ParentId());
+    headerDs.Add<u8>(entity->IsReplicated() ? 1 : 0);
+    headerDs.Add<u32>(numPersisted);
+    dest.append(header, (int)headerDs.BytesFilled());
+
+    for(size_t i = 0; i < components.size(); ++i)
+    {
+        const ComponentSnapshot *component = components[i].get();
+        if (component->IsTemporary())
+            continue;
+        DataSerializer componentDs(&componentBuffer[0], componentBuffer.size());
+        component->SerializeToBinary(componentDs);
+
+        char componentHeader[2 * sizeof(u32) + 2 * sizeof(u8) + 256];
+        DataSerializer componentHeaderDs(componentHeader, sizeof(componentHeader));
+        componentHeaderDs.Add<u32>(component->TypeId());
+        componentHeaderDs.AddString(component->Name().toStdString());
+        componentHeaderDs.Add<u8>(component->IsReplicated() ? 1 : 0);
+        componentHeaderDs.Add<u32>((u32)componentDs.BytesFilled());
+        dest.append(componentHeader, (int)componentHeaderDs.BytesFilled());
+        dest.append(&componentBuffer[0], (int)componentDs.BytesFilled());
+    }
+}
+
+/// Writes a checkpoint, i.e. the header and the payload, to the file.
+bool WriteCheckpoint(QFile &file, u32 kind, u32 number, const QByteArray &payload)
+{
+    char header[cCheckpointHeaderSize];
+    DataSerializer headerDs(header, sizeof(header));
+    headerDs.Add<u32>(cCheckpointMagic);
+    headerDs.Add<u32>(kind);
+    headerDs.Add<u32>(number);
+    headerDs.Add<u32>((u32)payload.size());
+    headerDs.Add<u32>(qChecksum(payload.constData(), (uint)payload.size()));
+    return file.write(header, (qint64)headerDs.BytesFilled()) == (qint64)headerDs.BytesFilled() &&
+        file.write(payload) == payload.size() && file.flush();
+}
+
+/// Reads the header of the checkpoint at the current position and validates the payload that follows it.
+/** On success, skips the checkpoint and returns the position and size of the payload. */
+bool ReadCheckpoint(DataDeserializer &source, const char *data, u32 &kind, u32 &number, const char *&payload, u32 &payloadSize)
+{
+    if (source.BytesLeft() < cCheckpointHeaderSize || source.Read<u32>() != cCheckpointMagic)
+        return false;
+    kind = source.Read<u32>();
+    number = source.Read<u32>();
+    payloadSize = source.Read<u32>();
+    const u32 checksum = source.Read<u32>();
+    if (payloadSize > source.BytesLeft())
+        return false; // Cut short
+    payload = data + source.BytePos();
+    if (qChecksum(payload, payloadSize) != checksum)
+        return false;
+    source.SkipBytes(payloadSize);
+    return true;
+}
+
+/// Saved state of an entity, while recovering.
+struct PersistedEntity
+{
+    entity_id_t parentId;
+    bool replicated;
+    u32 numComponents;
+    QByteArray componentData; ///< The components in the binary scene format.
+};
+
+typedef std::map<entity_id_t, PersistedEntity> PersistedEntityMap;
+
+/// Reads entity records into the state, replacing the earlier state of the same entities.
+void ReadEntityRecords(DataDeserializer &source, const char *data, PersistedEntityMap &entities)
+{
+    const u32 numEntities = source.Read<u32>();
+    for(u32 i = 0; i < numEntities; ++i)
+    {
+        const entity_id_t id = source.Read<u32>();
+        PersistedEntity &entity = entities[id];
+        entity.parentId = source.Read<u32>();
+        entity.replicated = source.Read<u8>() ? true : false;
+        entity.numComponents = source.Read<u32>();
+
+        const size_t componentsBegin = source.BytePos();
+        for(u32 j = 0; j < entity.numComponents; ++j)
+        {
+            source.Read<u32>(); // Type ID
+            source.ReadString(); // Name
+            source.Read<u8>(); // Replicated
+            const u32 dataSize = source.Read<u32>();
+            if (dataSize > source.BytesLeft())
+                throw Exception("Component data exceeds the checkpoint!");
+            source.SkipBytes(dataSize);
+        }
+        entity.componentData = QByteArray(data + componentsBegin, (int)(source.BytePos() - componentsBegin));
+    }
+}
+
+typedef std::map<entity_id_t, std::vector<entity_id_t> > EntityChildMap;
+
+/// Places the entity and its not yet placed descendants into the tree.
+void PlaceEntity(entity_id_t id, const EntityChildMap &children, EntityChildMap &tree, std::set<entity_id_t> &placed)
+{
+    placed.insert(id);
+    EntityChildMap::const_iterator it = children.find(id);
+    if (it == children.end())
+        return;
+    for(size_t i = 0; i < it->second.size(); ++i)
+        if (placed.find(it->second[i]) == placed.end())
+        {
+            tree[id].push_back(it->second[i]);
+            PlaceEntity(it->second[i], children, tree, placed);
+        }
+}
+
+/// Writes an entity and its children in the flat binary scene format.
+void WriteFlatEntity(DataSerializer &dest, entity_id_t id, const PersistedEntityMap &entities, const EntityChildMap &tree)
+{
+    const PersistedEntity &entity = entities.find(id)->second;
+    EntityChildMap::const_iterator children = tree.find(id);
+    const u32 numChildren = children != tree.end() ? (u32)children->second.size() : 0;
+    dest.Add<u32>(id);
+    dest.Add<u8>(entity.replicated ? 1 : 0);
+    dest.Add<u32>(entity.numComponents | (numChildren << 16));
+    if (!entity.componentData.isEmpty())
+        dest.AddArray<u8>((const u8*)entity.componentData.constData(), (u32)entity.componentData.size());
+    for(u32 i = 0; i < numChildren; ++i)
+        WriteFlatEntity(dest, children->second[i], entities, tree);
+}
+
+/// Converts the recovered state to the flat binary scene format of Scene::CreateContentFromBinary.
+QByteArray ToFlatSceneData(const PersistedEntityMap &entities)
+{
+    EntityChildMap children;
+    std::vector<entity_id_t> roots;
+    size_t numBytes = sizeof(u32);
+    for(PersistedEntityMap::const_iterator it = entities.begin(); it != entities.end(); ++it)
+    {
+        const entity_id_t parentId = it->second.parentId;
+        if (parentId && parentId != it->first && entities.find(parentId) != entities.end())
+            children[parentId].push_back(it->first);
+        else
+            roots.push_back(it->first);
+        numBytes += 2 * sizeof(u32) + sizeof(u8) + it->second.componentData.size();
+    }
+
+    // Place the entities under their parents. The entities left over are in a parenting cycle, which is broken at the root level.
+    EntityChildMap tree;
+    std::set<entity_id_t> placed;
+    for(size_t i = 0; i < roots.size(); ++i)
+        PlaceEntity(roots[i], children, tree, placed);
+    for(PersistedEntityMap::const_iterator it = entities.begin(); it != entities.end(); ++it)
+        if (placed.find(it->first) == placed.end())
+        {
+            roots.push_back(it->first);
+            PlaceEntity(it->first, children, tree, placed);
+        }
+
+    QByteArray bytes;
+    bytes.resize((int)numBytes);
+    DataSerializer dest(bytes.data(), bytes.size());
+    dest.Add<u32>((u32)roots.size());
+    for(size_t i = 0; i < roots.size(); ++i)
+        WriteFlatEntity(dest, roots[i], entities, tree);
+    bytes.resize((int)dest.BytesFilled());
+    return bytes;
+}
+
+/// Reads the base checkpoint and the valid delta checkpoints after it. Returns false if there is no readable base checkpoint.
+bool ReadSavedState(const QString &directory, PersistedEntityMap &entities, uint &numDeltas)
+{
+    QDir dir(directory);
+    // A base checkpoint in scene.base.new is complete only if scene.base was already removed to replace it.
+    QFile baseFile(dir.filePath(QFile::exists(dir.filePath(cBaseFilename)) ? cBaseFilename : cNewBaseFilename));
+    if (!baseFile.open(QFile::ReadOnly))
+        return false;
+    const QByteArray base = baseFile.readAll();
+    baseFile.close();
+
+    u32 baseNumber = 0;
+    try
+    {
+        DataDeserializer source(base.constData(), base.size());
+        u32 kind = 0;
+        const char *payload = 0;
+        u32 payloadSize = 0;
+        if (!ReadCheckpoint(source, base.constData(), kind, baseNumber, payload, payloadSize) || kind != cBaseCheckpoint)
+            return false;
+        DataDeserializer payloadSource(payload, payloadSize);
+        ReadEntityRecords(payloadSource, payload, entities);
+    }
+    catch(...)
+    {
+        return false;
+    }
+
+    numDeltas = 0;
+    QFile journalFile(dir.filePath(cJournalFilename));
+    if (!journalFile.open(QFile::ReadOnly))
+        return true;
+    const QByteArray journal = journalFile.readAll();
+    journalFile.close();
+
+    DataDeserializer source(journal.constData(), journal.size());
+    u32 kind = 0;
+    u32 number = 0;
+    const char *payload = 0;
+    u32 payloadSize = 0;
+    // Stop at the first checkpoint that was cut short or is otherwise broken, as the state after it can not be trusted.
+    while(ReadCheckpoint(source, journal.constData(), kind, number, payload, payloadSize))
+    {
+        // The journal may still have the delta checkpoints already included in the base, if the compaction was interrupted.
+        if (kind != cDeltaCheckpoint || number <= baseNumber)
+            continue;
+        PersistedEntityMap delta;
+        std::vector<entity_id_t> removed;
+        try
+        {
+            DataDeserializer payloadSource(payload, payloadSize);
+            const u32 numRemoved = payloadSource.Read<u32>();
+            for(u32 i = 0; i < numRemoved; ++i)
+                removed.push_back(payloadSource.Read<u32>());
+            ReadEntityRecords(payloadSource, payload, delta);
+        }
+        catch(...)
+        {
+            break;
+        }
+        for(size_t i = 0; i < removed.size(); ++i)
+            entities.erase(removed[i]);
+        for(PersistedEntityMap::const_iterator it = delta.begin(); it != delta.end(); ++it)
+            entities[it->first] = it->second;
+        baseNumber = number;
+        ++numDeltas;
+    }
+    return true;
+}
+
+}
+
+/// Writes the checkpoints of the snapshots it is given on a thread of its own.
+/** @cond PRIVATE */
+class ScenePersistenceWorker : public QThread
+{
+public:
+    ScenePersistenceWorker(const QString &directory, bool saveLocal, uint compactInterval) :
+        directory_(directory),
+        saveLocal_(saveLocal),
+        compactInterval_(compactInterval > 0 ? compactInterval : 1),
+        compactPending_(false),
+        stopping_(false),
+        number_(0),
+        numDeltas_(0),
+        componentBuffer_(cMaxComponentSize)
+    {
+    }
+
+    /// Hands a snapshot to be written, superseding the one waiting to be written, if any. Called in the main thread.
+    void Post(const SceneSnapshotPtr &snapshot, bool compact)
+    {
+        QMutexLocker lock(&mutex_);
+        pending_ = snapshot;
+        compactPending_ = compactPending_ || compact;
+        wake_.wakeOne();
+    }
+
+    /// Writes the snapshot waiting to be written and stops the thread. Called in the main thread.
+    void Finish()
+    {
+        {
+            QMutexLocker lock(&mutex_);
+            stopping_ = true;
+            wake_.wakeOne();
+        }
+        wait();
+    }
+
+    /// Returns and clears the errors encountered since the previous call. Called in the main thread.
+    QStringList TakeErrors()
+    {
+        QMutexLocker lock(&mutex_);
+        QStringList errors = errors_;
+        errors_.clear();
+        return errors;
+    }
+
+private:
+    /// QThread override.
+    void run()
+    {
+        for(;;)
+        {
+            SceneSnapshotPtr snapshot;
+            bool compact = false;
+            {
+                QMutexLocker lock(&mutex_);
+                while(!pending_ && !stopping_)
+                    wake_.wait(&mutex_);
+                if (!pending_)
+                    break; // Stopping, and nothing left to write
+                snapshot.swap(pending_);
+                compact = compactPending_;
+                compactPending_ = false;
+            }
+
+            QString error;
+            try
+            {
+                if (!written_ || compact || numDeltas_ >= compactInterval_)
+                    error = WriteBase(snapshot);
+                else
+                    error = WriteDelta(snapshot);
+            }
+            catch(...)
+            {
+                error = "Failed to serialize the checkpoint of scene " + snapshot->SceneName();
+            }
+            if (!error.isEmpty())
+            {
+                QMutexLocker lock(&mutex_);
+                errors_ << error;
+            }
+        }
+        journal_.close();
+    }
+
+    /// Writes a base checkpoint of all the persisted entities and starts a new journal after it.
+    QString WriteBase(const SceneSnapshotPtr &snapshot)
+    {
+        const std::vector<EntitySnapshotPtr> &entities = snapshot->Entities();
+        u32 numPersisted = 0;
+        for(size_t i = 0; i < entities.size(); ++i)
+            if (IsPersisted(entities[i].get(), saveLocal_))
+                ++numPersisted;
+
+        QByteArray payload;
+        char count[sizeof(u32)];
+        DataSerializer countDs(count, sizeof(count));
+        countDs.Add<u32>(numPersisted);
+        payload.append(count, sizeof(count));
+        for(size_t i = 0; i < entities.size(); ++i)
+            if (IsPersisted(entities[i].get(), saveLocal_))
+                AppendEntityRecord(payload, entities[i].get(), componentBuffer_);
+
+        // Write the new base beside the old one, so that one of them is complete whenever the process might crash.
+        QDir dir(directory_);
+        QFile newBase(dir.filePath(cNewBaseFilename));
+        if (!newBase.open(QFile::WriteOnly | QFile::Truncate))
+            return "Could not open " + newBase.fileName() + " for writing the base checkpoint";
+        const u32 number = number_ + 1;
+        const bool ok = WriteCheckpoint(newBase, cBaseCheckpoint, number, payload);
+        newBase.close();
+        if (!ok)
+            return "Could not write the base checkpoint to " + newBase.fileName();
+        QFile::remove(dir.filePath(cBaseFilename));
+        if (!QFile::rename(newBase.fileName(), dir.filePath(cBaseFilename)))
+            return "Could not rename " + newBase.fileName() + " to " + cBaseFilename;
+
+        // The delta checkpoints so far are included in the base now.
+        journal_.close();
+        journal_.setFileName(dir.filePath(cJournalFilename));
+        if (!journal_.open(QFile::WriteOnly | QFile::Truncate))
+            return "Could not open " + journal_.fileName() + " for writing the delta checkpoints";
+
+        number_ = number;
+        numDeltas_ = 0;
+        written_ = snapshot;
+        return "";
+    }
+
+    /// Appends a delta checkpoint of the entities changed and removed since the previously written snapshot.
+    QString WriteDelta(const SceneSnapshotPtr &snapshot)
+    {
+        // Both are in ascending entity ID order, and an entity snapshot is shared between them if the entity has not changed.
+        const std::vector<EntitySnapshotPtr> &previous = written_->Entities();
+        const std::vector<EntitySnapshotPtr> &current = snapshot->Entities();
+        std::vector<entity_id_t> removed;
+        std::vector<const EntitySnapshot *> changed;
+        size_t p = 0;
+        size_t c = 0;
+        while(p < previous.size() || c < current.size())
+        {
+            if (c == current.size() || (p < previous.size() && previous[p]->Id() < current[c]->Id()))
+            {
+                if (IsPersisted(previous[p].get(), saveLocal_))
+                    removed.push_back(previous[p]->Id());
+                ++p;
+            }
+            else if (p == previous.size() || current[c]->Id() < previous[p]->Id())
+            {
+                if (IsPersisted(current[c].get(), saveLocal_))
+                    changed.push_back(current[c].get());
+                ++c;
+            }
+            else
+            {
+                const bool wasPersisted = IsPersisted(previous[p].get(), saveLocal_);
+                const bool isPersisted = IsPersisted(current[c].get(), saveLocal_);
+                if (isPersisted && (!wasPersisted || previous[p] != current[c]))
+                    changed.push_back(current[c].get());
+                else if (wasPersisted && !isPersisted)
+                    removed.push_back(previous[p]->Id());
+                ++p;
+                ++c;
+            }
+        }
+
+        written_ = snapshot;
+        if (removed.empty() && changed.empty())
+            return "";
+
+        QByteArray payload;
+        QByteArray header;
+        header.resize((int)((removed.size() + 1) * sizeof(u32)));
+        DataSerializer headerDs(header.data(), header.size());
+        headerDs.Add<u32>((u32)removed.size());
+        for(size_t i = 0; i < removed.size(); ++i)
+            headerDs.Add<u32>(removed[i]);
+        payload.append(header);
+        char count[sizeof(u32)];
+        DataSerializer countDs(count, sizeof(count));
+        countDs.Add<u32>((u32)changed.size());
+        payload.append(count, sizeof(count));
+        for(size_t i = 0; i < changed.size(); ++i)
+            AppendEntityRecord(payload, changed[i], componentBuffer_);
+
+        if (!WriteCheckpoint(journal_, cDeltaCheckpoint, number_ + 1, payload))
+        {
+            // The journal can not be trusted after a partial write, so write a base checkpoint next.
+            written_.reset();
+            return "Could not write a delta checkpoint to " + journal_.fileName();
+        }
+        ++number_;
+        ++numDeltas_;
+        return "";
+    }
+
+    const QString directory_;
+    const bool saveLocal_;
+    const uint compactInterval_;
+
+    QMutex mutex_; ///< Guards the members below it, up to errors_.
+    QWaitCondition wake_;
+    SceneSnapshotPtr pending_;
+    bool compactPending_;
+    bool stopping_;
+    QStringList errors_;
+
+    // Only used in the thread
+    SceneSnapshotPtr written_; ///< Snapshot of the latest checkpoint, or null if a base checkpoint is to be written next.
+    u32 number_; ///< Number of the latest checkpoint.
+    uint numDeltas_; ///< Number of delta checkpoints written since the base checkpoint.
+    QFile journal_;
+    std::vector<char> componentBuffer_;
+};
+/** @endcond */
+
+ScenePersistence::ScenePersistence(Scene *scene) :
+    QObject(scene),
+    scene_(scene),
+    worker_(0),
+    saveLocal_(false)
+{
+    connect(&checkpointTimer_, SIGNAL(timeout()), this, SLOT(Checkpoint()));
+}
+
+ScenePersistence::~ScenePersistence()
+{
+    checkpointTimer_.stop();
+    if (worker_)
+    {
+        worker_->Finish();
+        SAFE_DELETE(worker_);
+    }
+}
+
+bool ScenePersistence::HasSavedState(const QString &directory)
+{
+    QDir dir(directory);
+    return QFile::exists(dir.filePath(cBaseFilename)) || QFile::exists(dir.filePath(cNewBaseFilename));
+}
+
+bool ScenePersistence::Start(const QString &directory, int checkpointIntervalMsec, int compactInterval)
+{
+    Stop();
+    if (!QDir().mkpath(directory))
+    {
+        LogError("ScenePersistence::Start: Could not create directory " + directory);
+        return false;
+    }
+    directory_ = directory;
+    worker_ = new ScenePersistenceWorker(directory, saveLocal_, compactInterval > 0 ? (uint)compactInterval : 1);
+    worker_->start(QThread::LowPriority);
+    Checkpoint();
+    if (checkpointIntervalMsec > 0)
+        checkpointTimer_.start(checkpointIntervalMsec);
+    return true;
+}
+
+void ScenePersistence::Stop()
+{
+    if (!worker_)
+        return;
+    checkpointTimer_.stop();
+    Checkpoint();
+    worker_->Finish();
+    LogWorkerErrors();
+    SAFE_DELETE(worker_);
+    directory_.clear();
+}
+
+void ScenePersistence::Checkpoint()
+{
+    if (!worker_)
+        return;
+    PROFILE(ScenePersistence_Checkpoint);
+    LogWorkerErrors();
+    worker_->Post(scene_->TakeSnapshot(), false);
+}
+
+void ScenePersistence::Compact()
+{
+    if (!worker_)
+        return;
+    LogWorkerErrors();
+    worker_->Post(scene_->TakeSnapshot(), true);
+}
+
+bool ScenePersistence::Recover(const QString &directory, AttributeChange::Type change)
+{
+    PROFILE(ScenePersistence_Recover);
+    PersistedEntityMap entities;
+    uint numDeltas = 0;
+    if (!ReadSavedState(directory, entities, numDeltas))
+    {
+        LogError("ScenePersistence::Recover: No readable base checkpoint in " + directory);
+        return false;
+    }
+
+    scene_->RemoveAllEntities(true, change);
+    if (!entities.empty())
+    {
+        const QByteArray bytes = ToFlatSceneData(entities);
+        scene_->CreateContentFromBinary(bytes.constData(), bytes.size(), true, change);
+    }
+    LogInfo(QString("ScenePersistence: Recovered %1 entities from %2 with %3 delta checkpoints.").arg(entities.size()).arg(directory).arg(numDeltas));
+    return true;
+}
+
+void ScenePersistence::LogWorkerErrors()
+{
+    if (!worker_)
+        return;
+    const QStringList errors = worker_->TakeErrors();
+    for(int i = 0; i < errors.size(); ++i)
+        LogError("ScenePersistence: " + errors[i]);
+}
@@ -0,0 +1,94 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#pragma once
+
+#include "TundraCoreApi.h"
+#include "SceneFwd.h"
+#include "AttributeChangeType.h"
+
+#include <QObject>
+#include <QString>
+#include <QTimer>
+
+class ScenePersistenceWorker;
+
+/// Saves a scene incrementally in the background, and recovers it after a crash.
+/** Instead of serializing the whole scene on the main thread like Scene::SaveSceneBinary, the persistence takes a
+    SceneSnapshot at each checkpoint, which only copies the components changed since the previous one, and hands it to
+    a worker thread. The worker compares the snapshot to the previously written one and appends the changed and removed
+    entities to a journal as a delta checkpoint. Every compactInterval checkpoints the worker writes a full base
+    checkpoint of the scene instead and starts a new journal, so the journal does not grow without bounds.
+
+    The persistence directory contains:
+    <ul>
+    <li>scene.base, the full base checkpoint.
+    <li>scene.journal, the delta checkpoints written after the base, appended one after another.
+    </ul>
+    Each checkpoint is written with its size and checksum, so a checkpoint that was cut short by a crash is detected and
+    ignored on recovery, together with the checkpoints after it. Recover replays the base and the delta checkpoints into the scene.
+
+    Like the binary scene files, the checkpoints do not include temporary entities and components, nor local entities
+    unless enabled with SetSaveLocal. A persisted entity whose parent is not persisted is recovered at the root level.
+    @note The files are flushed to the operating system after each checkpoint, so they survive a crash of the process,
+    but not necessarily a power failure.
+
+    Get the persistence of a scene with Scene::Persistence. Recover the saved state before starting, as Start writes
+    a new base checkpoint of the current scene over the saved state. */
+class TUNDRACORE_API ScenePersistence : public QObject
+{
+    Q_OBJECT
+    Q_PROPERTY(bool running READ IsRunning)
+    Q_PROPERTY(QString directory READ Directory)
+    Q_PROPERTY(bool saveLocal READ SaveLocal WRITE SetSaveLocal)
+
+public:
+    explicit ScenePersistence(Scene *scene);
+    /// Waits for the checkpoint being written and stops the persistence, without taking a last checkpoint.
+    ~ScenePersistence();
+
+    /// Returns whether the directory has a saved base checkpoint to recover.
+    static bool HasSavedState(const QString &directory);
+
+    /// Returns whether checkpoints are being taken.
+    bool IsRunning() const { return worker_ != 0; }
+
+    /// Returns the persistence directory, or an empty string if not running.
+    const QString &Directory() const { return directory_; }
+
+    /// Sets whether local entities are persisted. False by default. Takes effect from the next Start.
+    void SetSaveLocal(bool saveLocal) { saveLocal_ = saveLocal; }
+    bool SaveLocal() const { return saveLocal_; }
+
+public slots:
+    /// Starts to persist the scene into the directory. The first checkpoint is a base checkpoint of the whole scene.
+    /** @param directory Persistence directory, created if it does not exist.
+        @param checkpointIntervalMsec Interval of the checkpoints. If zero or negative, checkpoints are only taken with Checkpoint.
+        @param compactInterval Number of checkpoints from a base checkpoint to the next.
+        @return false if the directory could not be created. */
+    bool Start(const QString &directory, int checkpointIntervalMsec = 10000, int compactInterval = 60);
+
+    /// Takes a last checkpoint, waits for it to be written and stops the persistence.
+    void Stop();
+
+    /// Takes a checkpoint now. The checkpoint is written in the background.
+    /** If the worker is still writing the previous checkpoint, the new one supersedes any other checkpoint waiting to be written. */
+    void Checkpoint();
+
+    /// Writes the next checkpoint as a base checkpoint, and takes it now.
+    void Compact();
+
+    /// Replaces the contents of the scene with the state saved in the directory.
+    /** The entities keep the IDs they were saved with. Call before Start, in the main thread.
+        @return false if the directory has no readable base checkpoint. */
+    bool Recover(const QString &directory, AttributeChange::Type change = AttributeChange::Default);
+
+private:
+    /// Logs the errors the worker has encountered since the previous call.
+    void LogWorkerErrors();
+
+    Scene *scene_;
+    ScenePersistenceWorker *worker_;
+    QTimer checkpointTimer_;
+    QString directory_;
+    bool saveLocal_;
+};
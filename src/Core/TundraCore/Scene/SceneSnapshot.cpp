@@ -0,0 +1,162 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#include "StableHeaders.h"
+#include "DebugOperatorNew.h"
+
+#include "SceneSnapshot.h"
+#include "Scene/Scene.h"
+#include "Entity.h"
+#include "IComponent.h"
+#include "EC_Name.h"
+
+#include <kNet/DataSerializer.h>
+
+#include "MemoryLeakCheck.h"
+
+ComponentSnapshot::ComponentSnapshot(const IComponent *component) :
+    typeId_(component->TypeId()),
+    typeName_(component->TypeName()),
+    name_(component->Name()),
+    id_(component->Id()),
+    replicated_(component->IsReplicated()),
+    temporary_(component->IsTemporary()),
+    dynamic_(component->SupportsDynamicAttributes()),
+    changeStamp_(component->ChangeStamp())
+{
+    const AttributeVector &attributes = component->Attributes();
+    attributes_.reserve(attributes.size());
+    attributeIds_.reserve(attributes.size());
+    for(size_t i = 0; i < attributes.size(); ++i)
+    {
+        attributes_.push_back(attributes[i] ? attributes[i]->Clone() : 0);
+        attributeIds_.push_back(attributes[i] ? attributes[i]->Id() : QString());
+    }
+}
+
+ComponentSnapshot::~ComponentSnapshot()
+{
+    for(size_t i = 0; i < attributes_.size(); ++i)
+        delete attributes_[i];
+}
+
+void ComponentSnapshot::SerializeToBinary(kNet::DataSerializer &dest) const
+{
+    dest.Add<u8>((u8)attributes_.size());
+    for(size_t i = 0; i < attributes_.size(); ++i)
+    {
+        if (!attributes_[i])
+            continue;
+        if (dynamic_)
+        {
+            // Same as EC_DynamicComponent::SerializeToBinary
+            dest.AddString(attributeIds_[i].toStdString());
+            dest.AddString(attributes_[i]->TypeName().toStdString());
+            dest.AddString(attributes_[i]->ToString().toStdString());
+        }
+        else
+            attributes_[i]->ToBinary(dest);
+    }
+}
+
+const IAttribute *ComponentSnapshot::AttributeById(const QString &id) const
+{
+    for(size_t i = 0; i < attributes_.size(); ++i)
+        if (attributes_[i] && attributeIds_[i].compare(id, Qt::CaseInsensitive) == 0)
+            return attributes_[i];
+    return 0;
+}
+
+QString EntitySnapshot::Name() const
+{
+    ComponentSnapshotPtr name = Component(EC_Name::TypeIdStatic());
+    return name ? name->Value<QString>("name") : "";
+}
+
+ComponentSnapshotPtr EntitySnapshot::Component(u32 typeId, const QString &name) const
+{
+    for(size_t i = 0; i < components_.size(); ++i)
+        if (components_[i]->TypeId() == typeId && (name.isEmpty() || components_[i]->Name() == name))
+            return components_[i];
+    return ComponentSnapshotPtr();
+}
+
+SceneSnapshotPtr SceneSnapshot::Create(const Scene *scene, const SceneSnapshotPtr &previous)
+{
+    shared_ptr<SceneSnapshot> snapshot(new SceneSnapshot());
+    if (!scene)
+        return snapshot;
+
+    snapshot->sceneName_ = scene->Name();
+    snapshot->number_ = previous ? previous->number_ + 1 : 1;
+    snapshot->entities_.reserve(scene->Entities().size());
+
+    // The scene and the previous snapshot are both in ascending entity ID order, so walk them in step
+    const std::vector<EntitySnapshotPtr> empty;
+    const std::vector<EntitySnapshotPtr> &previousEntities = previous ? previous->entities_ : empty;
+    size_t previousIndex = 0;
+    for(Scene::const_iterator it = scene->begin(); it != scene->end(); ++it)
+    {
+        const Entity *entity = it->second.get();
+        while(previousIndex < previousEntities.size() && previousEntities[previousIndex]->Id() < entity->Id())
+            ++previousIndex;
+        EntitySnapshotPtr previousEntity;
+        if (previousIndex < previousEntities.size() && previousEntities[previousIndex]->Id() == entity->Id())
+            previousEntity = previousEntities[previousIndex];
+        snapshot->entities_.push_back(CreateEntity(entity, previousEntity, snapshot->numCopiedComponents_));
+    }
+    return snapshot;
+}
+
+EntitySnapshotPtr SceneSnapshot::CreateEntity(const Entity *entity, const EntitySnapshotPtr &previous, size_t &numCopiedComponents)
+{
+    EntityPtr parent = entity->Parent();
+    const entity_id_t parentId = parent ? parent->Id() : 0;
+    const Entity::ComponentMap &components = entity->Components();
+
+    bool changed = !previous || previous->parentId_ != parentId || previous->temporary_ != entity->IsTemporary() ||
+        previous->components_.size() != components.size();
+    // The temporary flag of the component copies includes that of the entity, so copy them all again if it changed
+    const bool reuseComponents = previous && previous->temporary_ == entity->IsTemporary();
+
+    std::vector<ComponentSnapshotPtr> componentSnapshots;
+    componentSnapshots.reserve(components.size());
+    size_t index = 0;
+    for(Entity::ComponentMap::const_iterator it = components.begin(); it != components.end(); ++it, ++index)
+    {
+        // The components are in ascending ID order in both, and the stamps are unique, so an unchanged component is at the same index
+        const IComponent *component = it->second.get();
+        if (reuseComponents && index < previous->components_.size() && previous->components_[index]->changeStamp_ == component->ChangeStamp())
+            componentSnapshots.push_back(previous->components_[index]);
+        else
+        {
+            componentSnapshots.push_back(ComponentSnapshotPtr(new ComponentSnapshot(component)));
+            ++numCopiedComponents;
+            changed = true;
+        }
+    }
+
+    if (!changed)
+        return previous;
+
+    shared_ptr<EntitySnapshot> snapshot(new EntitySnapshot());
+    snapshot->id_ = entity->Id();
+    snapshot->parentId_ = parentId;
+    snapshot->temporary_ = entity->IsTemporary();
+    snapshot->components_.swap(componentSnapshots);
+    return snapshot;
+}
+
+EntitySnapshotPtr SceneSnapshot::EntityById(entity_id_t id) const
+{
+    size_t first = 0;
+    size_t last = entities_.size();
+    while(first < last)
+    {
+        size_t middle = first + (last - first) / 2;
+        if (entities_[middle]->Id() < id)
+            first = middle + 1;
+        else
+            last = middle;
+    }
+    return (first < entities_.size() && entities_[first]->Id() == id) ? entities_[first] : EntitySnapshotPtr();
+}
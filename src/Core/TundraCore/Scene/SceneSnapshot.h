@@ -0,0 +1,146 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#pragma once
+
+#include "TundraCoreApi.h"
+#include "SceneFwd.h"
+#include "IAttribute.h"
+#include "UniqueIdGenerator.h"
+
+#include <QString>
+
+#include <vector>
+
+namespace kNet
+{
+    class DataSerializer;
+}
+
+/// Immutable copy of the attributes of a component, part of a SceneSnapshot.
+/** The attribute values are copies that have no owner, so they can be read from any thread. */
+class TUNDRACORE_API ComponentSnapshot
+{
+public:
+    ~ComponentSnapshot();
+
+    u32 TypeId() const { return typeId_; }
+    const QString &TypeName() const { return typeName_; }
+    const QString &Name() const { return name_; }
+    component_id_t Id() const { return id_; }
+    bool IsReplicated() const { return replicated_; }
+    /// Returns whether the component was temporary, or in a temporary entity, when copied.
+    bool IsTemporary() const { return temporary_; }
+    bool SupportsDynamicAttributes() const { return dynamic_; }
+
+    /// Serializes the attribute values in the binary format of IComponent::SerializeToBinary of the component.
+    /** Can be called from any thread. */
+    void SerializeToBinary(kNet::DataSerializer &dest) const;
+
+    /// Returns the number of attribute slots, including the holes left by removed dynamic attributes.
+    size_t NumAttributes() const { return attributes_.size(); }
+    /// Returns the copy of the attribute at the index, or null for a hole.
+    const IAttribute *AttributeAt(size_t index) const { return index < attributes_.size() ? attributes_[index] : 0; }
+    /// Returns the copy of the attribute of the ID, compared case-insensitively, or null if there is none.
+    const IAttribute *AttributeById(const QString &id) const;
+
+    /// Returns the value of the attribute of the ID, or the default value if there is no such attribute of type T.
+    template<typename T>
+    T Value(const QString &id, const T &defaultValue = T()) const
+    {
+        const Attribute<T> *attr = dynamic_cast<const Attribute<T> *>(AttributeById(id));
+        return attr ? attr->Get() : defaultValue;
+    }
+
+private:
+    friend class SceneSnapshot;
+
+    /// Copies the attributes of the component. Called in the main thread.
+    explicit ComponentSnapshot(const IComponent *component);
+    ComponentSnapshot(const ComponentSnapshot &);
+    void operator =(const ComponentSnapshot &);
+
+    u32 typeId_;
+    QString typeName_;
+    QString name_;
+    component_id_t id_;
+    bool replicated_;
+    bool temporary_;
+    bool dynamic_; ///< Whether the component supports dynamic attributes, which are serialized with their IDs and types.
+    u64 changeStamp_; ///< IComponent::ChangeStamp of the component when copied.
+    std::vector<IAttribute *> attributes_; ///< Copies of the attributes, null for holes.
+    std::vector<QString> attributeIds_; ///< IDs of the attributes, as the copies have their names as IDs.
+};
+
+/// Immutable copy of an entity and its components, part of a SceneSnapshot.
+class TUNDRACORE_API EntitySnapshot
+{
+public:
+    entity_id_t Id() const { return id_; }
+    /// Returns the ID of the parent entity, or 0 if the entity is at the root level.
+    entity_id_t ParentId() const { return parentId_; }
+    bool IsTemporary() const { return temporary_; }
+    bool IsReplicated() const { return id_ < UniqueIdGenerator::FIRST_LOCAL_ID; }
+
+    /// Returns the name of the entity, i.e. the name of its first EC_Name, like Entity::Name.
+    QString Name() const;
+
+    /// Returns the components in ascending ID order.
+    const std::vector<ComponentSnapshotPtr> &Components() const { return components_; }
+    /// Returns the first component of the type, and of the name if the name is not empty, or null.
+    ComponentSnapshotPtr Component(u32 typeId, const QString &name = "") const;
+
+private:
+    friend class SceneSnapshot;
+
+    EntitySnapshot() : id_(0), parentId_(0), temporary_(false) {}
+    EntitySnapshot(const EntitySnapshot &);
+    void operator =(const EntitySnapshot &);
+
+    entity_id_t id_;
+    entity_id_t parentId_;
+    bool temporary_;
+    std::vector<ComponentSnapshotPtr> components_;
+};
+
+/// Immutable view of the entities and component attribute values of a scene, for reading from background threads.
+/** A snapshot is taken in the main thread with Create, or by the scene once per frame when enabled with
+    Scene::SetSnapshotsEnabled. After that it never changes, so any number of threads can read it without locking while
+    the main loop continues to modify the scene. Hold on to the SceneSnapshotPtr for as long as the snapshot is read.
+
+    The entities and components that have not changed since the previous snapshot are shared with it instead of
+    copied, so consecutive snapshots of a mostly static scene are cheap: only the changed components are copied, and
+    the rest of the work is a pass over the entity and component pointers.
+    @sa Scene::LatestSnapshot */
+class TUNDRACORE_API SceneSnapshot
+{
+public:
+    /// Takes a snapshot of the scene, sharing the unchanged entities and components with the previous snapshot.
+    /** Must be called in the main thread. */
+    static SceneSnapshotPtr Create(const Scene *scene, const SceneSnapshotPtr &previous = SceneSnapshotPtr());
+
+    /// Returns the name of the scene.
+    const QString &SceneName() const { return sceneName_; }
+    /// Returns the number of the snapshot of the scene, starting from 1 and increasing with each snapshot.
+    uint Number() const { return number_; }
+
+    /// Returns all the entities in ascending ID order.
+    const std::vector<EntitySnapshotPtr> &Entities() const { return entities_; }
+    size_t NumEntities() const { return entities_.size(); }
+    /// Returns the entity of the ID, or null. O(log n).
+    EntitySnapshotPtr EntityById(entity_id_t id) const;
+
+    /// Returns the number of component copies made for this snapshot, i.e. the number of components that were not shared with the previous one.
+    size_t NumCopiedComponents() const { return numCopiedComponents_; }
+
+private:
+    SceneSnapshot() : number_(0), numCopiedComponents_(0) {}
+    /// Returns the previous snapshot of the entity if it has not changed, or a new one sharing its unchanged components.
+    static EntitySnapshotPtr CreateEntity(const Entity *entity, const EntitySnapshotPtr &previous, size_t &numCopiedComponents);
+    SceneSnapshot(const SceneSnapshot &);
+    void operator =(const SceneSnapshot &);
+
+    QString sceneName_;
+    uint number_;
+    std::vector<EntitySnapshotPtr> entities_;
+    size_t numCopiedComponents_;
+};
@@ -13,6 +13,7 @@
 #include <QEvent>
 #include <QResizeEvent>
 #include <QGraphicsItem>
+#include <QGraphicsScene>
 #include <QMainWindow>
 #include <QMenuBar>
 
@@ -23,7 +24,7 @@
 using namespace std;
 
 UiGraphicsView::UiGraphicsView(Framework* fw, QWidget *parent)
-:QGraphicsView(parent), framework(fw), backBuffer(0)
+:QGraphicsView(parent), framework(fw), backBuffer(0), hasVisibleItems(false), visibleItemsDirty(true)
 {
     setAutoFillBackground(false);
     setAttribute(Qt::WA_NoSystemBackground, true);
@@ -51,6 +52,14 @@ QImage *UiGraphicsView::BackBuffer() const
 void UiGraphicsView::MarkViewUndirty()
 {
     dirtyRectangle = QRectF(-1, -1, -1, -1);
+    dirtyRegion = QRegion();
+}
+
+void UiGraphicsView::MarkViewDirty(int width, int height)
+{
+    dirtyRectangle = QRectF(0, 0, width, height);
+    dirtyRegion = QRegion(0, 0, width, height);
+    visibleItemsDirty = true;
 }
 
 bool UiGraphicsView::IsViewDirty() const
@@ -63,6 +72,37 @@ QRectF UiGraphicsView::DirtyRectangle() const
     return dirtyRectangle;
 }
 
+QRegion UiGraphicsView::DirtyRegion() const
+{
+    return dirtyRegion;
+}
+
+bool UiGraphicsView::HasVisibleItems() const
+{
+    if (!visibleItemsDirty)
+        return hasVisibleItems;
+
+    hasVisibleItems = false;
+    visibleItemsDirty = false;
+    QGraphicsScene *graphicsScene = scene();
+    if (!graphicsScene)
+        return false;
+    if (graphicsScene->backgroundBrush().style() != Qt::NoBrush || graphicsScene->foregroundBrush().style() != Qt::NoBrush)
+    {
+        hasVisibleItems = true;
+        return true;
+    }
+    // A child item is visible only if its parent is, so checking the top-level items suffices.
+    QList<QGraphicsItem *> allItems = graphicsScene->items();
+    for(int i = 0; i < allItems.size(); ++i)
+        if (!allItems[i]->parentItem() && allItems[i]->isVisible() && allItems[i]->effectiveOpacity() > 0.0)
+        {
+            hasVisibleItems = true;
+            break;
+        }
+    return hasVisibleItems;
+}
+
 void UiGraphicsView::drawBackground(QPainter *painter, const QRectF &rect)
 {
     // Default backgroudBrush for QGraphicsScene and QGraphicsView is NoBrush,
@@ -101,7 +141,7 @@ void UiGraphicsView::Resize(int newWidth, int newHeight)
         setGeometry(0, 0, newWidth, newHeight);
         viewport()->setGeometry(0, 0, newWidth, newHeight);
         scene()->setSceneRect(viewport()->rect());
-        dirtyRectangle = QRectF(0, 0, newWidth, newHeight);
+        MarkViewDirty(newWidth, newHeight);
 
         delete backBuffer;
         backBuffer = new QImage(newWidth, newHeight, QImage::Format_ARGB32);
@@ -139,6 +179,7 @@ void UiGraphicsView::resizeEvent(QResizeEvent *e)
         viewport()->setGeometry(newGeom);
     if (scene())
         scene()->setSceneRect(viewport()->geometry());
+    MarkViewDirty(newGeom.width(), newGeom.height());
 
     // Update our rendering backbuffer.
     delete backBuffer;
@@ -196,8 +237,10 @@ void UiGraphicsView::HandleSceneChanged(const QList<QRectF> &rectangles)
     // We received an unknown-sized scene change message. Mark everything dirty! (I've no idea what Qt
     // means when it sends a message saying 'nothing changed').
     if (rectangles.size() == 0)
-        dirtyRectangle = QRectF(0, 0, width(), height());
+        MarkViewDirty(width(), height());
 #endif
+    // Items may have been shown, hidden, added or removed.
+    visibleItemsDirty = true;
 
     if (!IsViewDirty() && rectangles.size() > 0)
         dirtyRectangle = rectangles[0];
@@ -216,6 +259,14 @@ void UiGraphicsView::HandleSceneChanged(const QList<QRectF> &rectangles)
     dirtyRectangle.setTop(max<int>(dirtyRectangle.top(), 0));
     dirtyRectangle.setRight(min<int>(dirtyRectangle.right(), width()));
     dirtyRectangle.setBottom(min<int>(dirtyRectangle.bottom(), height()));
+
+    const QRect viewRect(0, 0, width(), height());
+    for(int i = 0; i < rectangles.size(); ++i)
+        dirtyRegion += rectangles[i].toAlignedRect().adjusted(-guardbandWidth, -guardbandWidth, guardbandWidth, guardbandWidth).intersected(viewRect);
+    // Past a handful of rectangles, the overhead of the separate repaints and uploads exceeds the area saved.
+    const int maxDirtyRects = 16;
+    if (dirtyRegion.rectCount() > maxDirtyRects)
+        dirtyRegion = QRegion(dirtyRegion.boundingRect());
 }
 
 QGraphicsItem *UiGraphicsView::VisibleItemAtCoords(int x, int y) const
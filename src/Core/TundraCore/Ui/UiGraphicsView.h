@@ -6,6 +6,7 @@
 #include "TundraCoreApi.h"
 
 #include <QGraphicsView>
+#include <QRegion>
 
 class QDropEvent;
 class QDragEnterEvent;
@@ -37,6 +38,14 @@ public:
     /// Returns the rectangle that represents the dirty area of the screen, pending a Qt repaint.
     QRectF DirtyRectangle() const;
 
+    /// Returns the dirty area of the screen as separate rectangles, pending a Qt repaint.
+    /** Unlike DirtyRectangle, which bounds all the changes, does not cover the unchanged area between the changed items.
+        The rectangles are merged into their bounding rectangle when the changes are too scattered to repaint one by one. */
+    QRegion DirtyRegion() const;
+
+    /// Returns true if any item of the graphics scene is visible, i.e. there is UI to composite over the 3D view.
+    bool HasVisibleItems() const;
+
 public slots:
     /// Returns the topmost visible QGraphicsItem in the given application main window coordinates.
     QGraphicsItem *VisibleItemAtCoords(int x, int y) const;
@@ -73,6 +82,12 @@ private:
     Framework* framework;
     QImage *backBuffer;
     QRectF dirtyRectangle;
+    QRegion dirtyRegion;
+    mutable bool hasVisibleItems; ///< Cached result of HasVisibleItems.
+    mutable bool visibleItemsDirty; ///< Has the scene changed since hasVisibleItems was updated.
+
+    /// Marks the whole UI screen of the given size dirty.
+    void MarkViewDirty(int width, int height);
 
     /// This virtual function is overridden from the QGraphicsView original to disable any background drawing functionality.
     /// The main QGraphicsView background displays the 3D scene rendered using Ogre.
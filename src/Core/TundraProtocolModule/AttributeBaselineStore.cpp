@@ -0,0 +1,110 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#include "StableHeaders.h"
+#include "AttributeBaselineStore.h"
+#include "IAttribute.h"
+
+#include <kNet/DataSerializer.h>
+#include <kNet/DataDeserializer.h>
+
+#include "MemoryLeakCheck.h"
+
+const std::vector<u8> *AttributeBaselineStore::Find(entity_id_t entityId, component_id_t compId, u8 attrIndex) const
+{
+    EntityMap::const_iterator entity = entities_.find(entityId);
+    if (entity == entities_.end())
+        return 0;
+    AttributeMap::const_iterator attr = entity->second.find(Key(compId, attrIndex));
+    return attr != entity->second.end() ? &attr->second : 0;
+}
+
+void AttributeBaselineStore::Set(entity_id_t entityId, component_id_t compId, u8 attrIndex, const u8 *data, size_t numBytes)
+{
+    entities_[entityId][Key(compId, attrIndex)].assign(data, data + numBytes);
+}
+
+void AttributeBaselineStore::RemoveComponent(entity_id_t entityId, component_id_t compId)
+{
+    EntityMap::iterator entity = entities_.find(entityId);
+    if (entity == entities_.end())
+        return;
+    AttributeMap &attrs = entity->second;
+    for(AttributeMap::iterator i = attrs.begin(); i != attrs.end();)
+    {
+        if ((component_id_t)(i->first >> 8) == compId)
+            i = attrs.erase(i);
+        else
+            ++i;
+    }
+    if (attrs.empty())
+        entities_.erase(entity);
+}
+
+void AttributeBaselineStore::RemoveEntity(entity_id_t entityId)
+{
+    entities_.erase(entityId);
+}
+
+bool AttributeBaselineStore::IsDeltaEncodable(u32 attributeTypeId)
+{
+    switch(attributeTypeId)
+    {
+    case cAttributeString:
+    case cAttributeColor:
+    case cAttributeFloat3:
+    case cAttributeQuat:
+    case cAttributeTransform:
+        return true;
+    default:
+        return false;
+    }
+}
+
+bool AttributeBaselineStore::WriteValue(kNet::DataSerializer &ds, const std::vector<u8> *baseline, const u8 *value, size_t numBytes)
+{
+    bool useDelta = false;
+    if (baseline && numBytes > 0 && baseline->size() == numBytes)
+    {
+        size_t numChanged = 0;
+        for(size_t i = 0; i < numBytes; ++i)
+            if ((*baseline)[i] != value[i])
+                ++numChanged;
+
+        // Delta layout: byte count, one bit per byte telling whether it changed, then the XOR of each changed byte.
+        const size_t deltaBits = kNet::VLE8_16_32::GetEncodedBitLength((u32)numBytes) + numBytes + numChanged * 8;
+        useDelta = deltaBits < numBytes * 8;
+    }
+
+    ds.Add<kNet::bit>(useDelta ? 1 : 0);
+    if (!useDelta)
+    {
+        if (numBytes)
+            ds.AddArray<u8>(value, (u32)numBytes);
+        return false;
+    }
+
+    const std::vector<u8> &base = *baseline;
+    ds.AddVLE<kNet::VLE8_16_32>((u32)numBytes);
+    for(size_t i = 0; i < numBytes; ++i)
+        ds.Add<kNet::bit>(base[i] != value[i] ? 1 : 0);
+    for(size_t i = 0; i < numBytes; ++i)
+        if (base[i] != value[i])
+            ds.Add<u8>(base[i] ^ value[i]);
+    return true;
+}
+
+bool AttributeBaselineStore::ReadDelta(kNet::DataDeserializer &dd, const std::vector<u8> *baseline, std::vector<u8> &value)
+{
+    const u32 numBytes = dd.ReadVLE<kNet::VLE8_16_32>();
+    const bool valid = baseline && baseline->size() == numBytes;
+
+    value.resize(numBytes);
+    for(u32 i = 0; i < numBytes; ++i)
+        value[i] = (u8)dd.Read<kNet::bit>();
+    for(u32 i = 0; i < numBytes; ++i)
+    {
+        const u8 x = value[i] ? dd.Read<u8>() : 0;
+        value[i] = valid ? (u8)((*baseline)[i] ^ x) : 0;
+    }
+    return valid;
+}
@@ -0,0 +1,61 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#pragma once
+
+#include "TundraProtocolModuleApi.h"
+
+#include "CoreTypes.h"
+#include "VectorMap.h"
+
+#include <kNetFwd.h>
+
+#include <vector>
+
+/// Last attribute values exchanged over a user connection, used as baselines for delta-encoded attribute edits.
+/** The server records each delta-encodable attribute value it sends to a client in an EditAttributes message,
+    and the client records each such value it receives. Because the messages are reliable and in order, both ends
+    hold the same baseline bytes, and the server can send a value as the XOR difference to the baseline,
+    with the unchanged bytes omitted.
+    Baselines are dropped on both ends when the entity or component removal is sent, and received, respectively.
+    @note Requires ProtocolAttributeDeltas. */
+class TUNDRAPROTOCOL_MODULE_API AttributeBaselineStore
+{
+public:
+    /// Returns the baseline bytes of the attribute, or null if no baseline exists.
+    const std::vector<u8> *Find(entity_id_t entityId, component_id_t compId, u8 attrIndex) const;
+
+    /// Sets the baseline bytes of the attribute.
+    void Set(entity_id_t entityId, component_id_t compId, u8 attrIndex, const u8 *data, size_t numBytes);
+
+    /// Removes the baselines of all attributes of a component.
+    void RemoveComponent(entity_id_t entityId, component_id_t compId);
+
+    /// Removes the baselines of all attributes of an entity.
+    void RemoveEntity(entity_id_t entityId);
+
+    /// Removes all baselines.
+    void Clear() { entities_.clear(); }
+
+    /// Returns whether attributes of the type are delta-encoded.
+    /** True for fixed-size binary types (float3, Quat, Transform, Color) and strings. */
+    static bool IsDeltaEncodable(u32 attributeTypeId);
+
+    /// Writes a delta flag bit followed by either the value as a delta to the baseline, or the value bytes as is.
+    /** The delta is used if the baseline exists, has the same size and the delta is smaller than the value.
+        @return Whether a delta was written. */
+    static bool WriteValue(kNet::DataSerializer &ds, const std::vector<u8> *baseline, const u8 *value, size_t numBytes);
+
+    /// Reads a delta written by WriteValue (after its delta flag bit) and applies it to the baseline.
+    /** If the baseline is null or its size does not match, the delta is still read past, but false is returned.
+        @param value [out] The reconstructed value bytes. */
+    static bool ReadDelta(kNet::DataDeserializer &dd, const std::vector<u8> *baseline, std::vector<u8> &value);
+
+private:
+    /// Baselines of one entity, keyed by component ID and attribute index.
+    typedef VectorMap<u64, std::vector<u8> > AttributeMap;
+    typedef unordered_map<entity_id_t, AttributeMap> EntityMap;
+
+    static u64 Key(component_id_t compId, u8 attrIndex) { return ((u64)compId << 8) | (u64)attrIndex; }
+
+    EntityMap entities_;
+};
@@ -0,0 +1,130 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#include "StableHeaders.h"
+#include "AttributeChangeLog.h"
+#include "SyncState.h"
+
+#include "MemoryLeakCheck.h"
+
+void AttributeChangeLog::Record(entity_id_t entityId, component_id_t compId, u8 attrIndex, u32 sourceConnectionId)
+{
+    Entry entry;
+    entry.version = ++version_;
+    entry.entityId = entityId;
+    entry.compId = compId;
+    entry.sourceConnectionId = sourceConnectionId;
+    entry.attrIndex = attrIndex;
+    entry.retired = false;
+
+    SlotList &slots = slots_[entityId];
+    for(size_t i = 0; i < slots.size(); ++i)
+        if (slots[i].compId == compId && slots[i].attrIndex == attrIndex)
+        {
+            Retire(slots[i].version);
+            slots[i].version = entry.version;
+            entries_.push_back(entry);
+            return;
+        }
+
+    Slot slot;
+    slot.compId = compId;
+    slot.attrIndex = attrIndex;
+    slot.version = entry.version;
+    slots.push_back(slot);
+    entries_.push_back(entry);
+}
+
+void AttributeChangeLog::Forget(entity_id_t entityId, component_id_t compId, u8 attrIndex)
+{
+    SlotMap::iterator it = slots_.find(entityId);
+    if (it == slots_.end())
+        return;
+    SlotList &slots = it->second;
+    for(size_t i = 0; i < slots.size(); ++i)
+        if (slots[i].compId == compId && slots[i].attrIndex == attrIndex)
+        {
+            Retire(slots[i].version);
+            slots.erase(slots.begin() + i);
+            break;
+        }
+    if (slots.empty())
+        slots_.erase(it);
+}
+
+void AttributeChangeLog::ForgetComponent(entity_id_t entityId, component_id_t compId)
+{
+    SlotMap::iterator it = slots_.find(entityId);
+    if (it == slots_.end())
+        return;
+    SlotList &slots = it->second;
+    for(size_t i = 0; i < slots.size();)
+    {
+        if (slots[i].compId == compId)
+        {
+            Retire(slots[i].version);
+            slots.erase(slots.begin() + i);
+        }
+        else
+            ++i;
+    }
+    if (slots.empty())
+        slots_.erase(it);
+}
+
+void AttributeChangeLog::ForgetEntity(entity_id_t entityId)
+{
+    SlotMap::iterator it = slots_.find(entityId);
+    if (it == slots_.end())
+        return;
+    const SlotList &slots = it->second;
+    for(size_t i = 0; i < slots.size(); ++i)
+        Retire(slots[i].version);
+    slots_.erase(it);
+}
+
+void AttributeChangeLog::MarkDirty(SceneSyncState *state, u32 sinceVersion, u32 connectionId) const
+{
+    if (entries_.empty())
+        return;
+
+    // Versions wrap around, so compare them by their difference.
+    const s32 offset = (s32)(sinceVersion + 1 - entries_.front().version);
+    for(size_t i = (offset > 0 ? (size_t)offset : 0); i < entries_.size(); ++i)
+    {
+        const Entry &e = entries_[i];
+        if (!e.retired && (!e.sourceConnectionId || e.sourceConnectionId != connectionId))
+            state->MarkAttributeDirty(e.entityId, e.compId, e.attrIndex);
+    }
+}
+
+void AttributeChangeLog::Trim(u32 version)
+{
+    while(!entries_.empty() && (s32)(entries_.front().version - version) <= 0)
+    {
+        const Entry &e = entries_.front();
+        if (!e.retired)
+        {
+            // The entry is the live one of its attribute.
+            SlotMap::iterator it = slots_.find(e.entityId);
+            if (it != slots_.end())
+            {
+                SlotList &slots = it->second;
+                for(size_t i = 0; i < slots.size(); ++i)
+                    if (slots[i].version == e.version)
+                    {
+                        slots.erase(slots.begin() + i);
+                        break;
+                    }
+                if (slots.empty())
+                    slots_.erase(it);
+            }
+        }
+        entries_.pop_front();
+    }
+}
+
+void AttributeChangeLog::Clear()
+{
+    entries_.clear();
+    slots_.clear();
+}
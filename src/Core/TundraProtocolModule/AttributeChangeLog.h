@@ -0,0 +1,77 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#pragma once
+
+#include "TundraProtocolModuleApi.h"
+#include "TundraProtocolModuleFwd.h"
+
+#include "CoreTypes.h"
+
+#include <deque>
+#include <vector>
+
+/// Versioned log of the replicated attribute edits on the server, shared by all user connections.
+/** Recording an edit does not depend on the number of users. The edit gets the next value of a global, monotonically
+    increasing change version and is appended to the log. An older entry of the same attribute is retired, so each edited
+    attribute has one live entry, and the entries are in version order. Each user's sync state remembers the version it
+    has caught up to, SceneSyncState::attributeChangeVersion. SyncManager marks the attributes edited since then dirty to
+    the sync state only when it assembles the user's next update. The entries every user has caught up to are trimmed.
+    @note Creation and removal of attributes, components and entities are still marked to the sync states directly.
+    The recorded edits of removed attributes are forgotten, so that a stale edit is not marked after the removal. */
+class TUNDRAPROTOCOL_MODULE_API AttributeChangeLog
+{
+public:
+    AttributeChangeLog() : version_(0) {}
+
+    /// Records an edit of the attribute with a new change version.
+    /** @param sourceConnectionId Connection the edit was received from, to which it is not echoed back, or 0. */
+    void Record(entity_id_t entityId, component_id_t compId, u8 attrIndex, u32 sourceConnectionId = 0);
+
+    /// Forgets the recorded edit of an attribute.
+    void Forget(entity_id_t entityId, component_id_t compId, u8 attrIndex);
+    /// Forgets the recorded edits of a component's attributes.
+    void ForgetComponent(entity_id_t entityId, component_id_t compId);
+    /// Forgets the recorded edits of an entity's attributes.
+    void ForgetEntity(entity_id_t entityId);
+
+    /// Marks the attributes edited after the version dirty in a user's sync state, except the edits received from the user itself.
+    void MarkDirty(SceneSyncState *state, u32 sinceVersion, u32 connectionId) const;
+
+    /// Removes the entries of the version and older.
+    void Trim(u32 version);
+    /// Removes all entries. The change version keeps increasing.
+    void Clear();
+
+    /// Returns the change version of the latest recorded edit.
+    u32 Version() const { return version_; }
+    /// Returns whether the log is empty.
+    bool Empty() const { return entries_.empty(); }
+
+private:
+    struct Entry
+    {
+        u32 version;
+        entity_id_t entityId;
+        component_id_t compId;
+        u32 sourceConnectionId;
+        u8 attrIndex;
+        bool retired; ///< A later entry of the same attribute exists, or the attribute was forgotten.
+    };
+
+    /// Live entry of an attribute of an entity.
+    struct Slot
+    {
+        component_id_t compId;
+        u8 attrIndex;
+        u32 version;
+    };
+    typedef std::vector<Slot> SlotList;
+    typedef unordered_map<entity_id_t, SlotList> SlotMap;
+
+    /// Marks the entry of the version retired. The versions of the entries are consecutive, so it is found by offset.
+    void Retire(u32 version) { entries_[version - entries_.front().version].retired = true; }
+
+    std::deque<Entry> entries_; ///< Entries in version order.
+    SlotMap slots_; ///< Live entries of each entity, so that an older entry of an attribute is found in constant time.
+    u32 version_;
+};
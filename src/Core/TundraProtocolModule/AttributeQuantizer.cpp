@@ -0,0 +1,270 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#include "StableHeaders.h"
+#include "AttributeQuantizer.h"
+#include "IAttribute.h"
+#include "AttributeMetadata.h"
+#include "Color.h"
+#include "Math/Quat.h"
+#include "Math/float2.h"
+#include "Math/float3.h"
+#include "Math/float4.h"
+#include "Math/QuantizedSerialization.h"
+
+#include <kNet/DataSerializer.h>
+#include <kNet/DataDeserializer.h>
+
+#include <cmath>
+
+#include "MemoryLeakCheck.h"
+
+namespace
+{
+/// Number of quantized elements in a value of the attribute type, 0 if the mode is not supported for the type.
+int NumElements(u32 typeId, AttributeMetadata::QuantizationMode mode)
+{
+    switch(mode)
+    {
+    case AttributeMetadata::QuantizeRange:
+    case AttributeMetadata::QuantizeHalf:
+        switch(typeId)
+        {
+        case cAttributeReal: return 1;
+        case cAttributeFloat2: return 2;
+        case cAttributeFloat3: return 3;
+        case cAttributeFloat4:
+        case cAttributeColor:
+        case cAttributeQuat: return 4;
+        default: return 0;
+        }
+    case AttributeMetadata::QuantizeAngle:
+        switch(typeId)
+        {
+        case cAttributeReal: return 1;
+        case cAttributeFloat2: return 2;
+        case cAttributeFloat3: return 3;
+        default: return 0;
+        }
+    case AttributeMetadata::QuantizeNormal:
+        return (typeId == cAttributeFloat2 || typeId == cAttributeFloat3) ? 1 : 0;
+    case AttributeMetadata::QuantizeRotation:
+        return typeId == cAttributeQuat ? 1 : 0;
+    default:
+        return 0;
+    }
+}
+
+/// Number of bits of an element.
+int ElementBits(const AttributeMetadata &meta)
+{
+    switch(meta.quantization)
+    {
+    case AttributeMetadata::QuantizeHalf: return 16;
+    case AttributeMetadata::QuantizeRotation: return 2 + 3 * meta.quantizationBits;
+    default: return meta.quantizationBits;
+    }
+}
+
+void WriteElement(kNet::DataSerializer &ds, const AttributeMetadata &meta, float value)
+{
+    if (meta.quantization == AttributeMetadata::QuantizeHalf)
+        AddHalf(ds, value);
+    else if (meta.quantization == AttributeMetadata::QuantizeAngle)
+    {
+        value = fmod(value, 360.f);
+        if (value < 0.f)
+            value += 360.f;
+        AddQuantizedRange(ds, value, 0.f, 360.f, meta.quantizationBits);
+    }
+    else
+        AddQuantizedRange(ds, value, meta.quantizationMin, meta.quantizationMax, meta.quantizationBits);
+}
+
+float ReadElement(kNet::DataDeserializer &dd, const AttributeMetadata &meta)
+{
+    if (meta.quantization == AttributeMetadata::QuantizeHalf)
+        return ReadHalf(dd);
+    if (meta.quantization == AttributeMetadata::QuantizeAngle)
+        return ReadQuantizedRange(dd, 0.f, 360.f, meta.quantizationBits);
+    return ReadQuantizedRange(dd, meta.quantizationMin, meta.quantizationMax, meta.quantizationBits);
+}
+}
+
+bool AttributeQuantizer::IsQuantized(const IAttribute *attr)
+{
+    const AttributeMetadata *meta = attr->Metadata();
+    if (!meta || meta->quantization == AttributeMetadata::NoQuantization || NumElements(attr->TypeId(), meta->quantization) == 0)
+        return false;
+
+    if (meta->quantization == AttributeMetadata::QuantizeHalf)
+        return true;
+    // Normal vectors split the bits to yaw and pitch, so need at least one bit for each.
+    if (meta->quantization == AttributeMetadata::QuantizeNormal)
+        return meta->quantizationBits >= (attr->TypeId() == cAttributeFloat3 ? 2 : 1) && meta->quantizationBits <= 32;
+    if (meta->quantization == AttributeMetadata::QuantizeRotation)
+        return meta->quantizationBits >= 2 && meta->quantizationBits <= 20;
+    // More bits than a float's mantissa are no use.
+    return meta->quantizationBits >= 1 && meta->quantizationBits <= 24 &&
+        (meta->quantization != AttributeMetadata::QuantizeRange || meta->quantizationMin < meta->quantizationMax);
+}
+
+size_t AttributeQuantizer::NumBytes(const IAttribute *attr)
+{
+    const AttributeMetadata *meta = attr->Metadata();
+    const size_t numBits = (size_t)NumElements(attr->TypeId(), meta->quantization) * ElementBits(*meta);
+    return (numBits + 7) / 8;
+}
+
+void AttributeQuantizer::Write(kNet::DataSerializer &ds, const IAttribute *attr)
+{
+    const AttributeMetadata &meta = *attr->Metadata();
+    switch(attr->TypeId())
+    {
+    case cAttributeReal:
+        WriteElement(ds, meta, static_cast<const Attribute<float>*>(attr)->Get());
+        break;
+    case cAttributeFloat2:
+    {
+        const float2 &v = static_cast<const Attribute<float2>*>(attr)->Get();
+        if (meta.quantization == AttributeMetadata::QuantizeNormal)
+        {
+            float2 n = v;
+            n.Normalize();
+            ds.AddNormalizedVector2D(n.x, n.y, meta.quantizationBits);
+        }
+        else
+        {
+            WriteElement(ds, meta, v.x);
+            WriteElement(ds, meta, v.y);
+        }
+        break;
+    }
+    case cAttributeFloat3:
+    {
+        const float3 &v = static_cast<const Attribute<float3>*>(attr)->Get();
+        if (meta.quantization == AttributeMetadata::QuantizeNormal)
+        {
+            float3 n = v;
+            n.Normalize();
+            const int yawBits = (meta.quantizationBits + 1) / 2;
+            ds.AddNormalizedVector3D(n.x, n.y, n.z, yawBits, meta.quantizationBits - yawBits);
+        }
+        else
+        {
+            WriteElement(ds, meta, v.x);
+            WriteElement(ds, meta, v.y);
+            WriteElement(ds, meta, v.z);
+        }
+        break;
+    }
+    case cAttributeFloat4:
+    {
+        const float4 &v = static_cast<const Attribute<float4>*>(attr)->Get();
+        WriteElement(ds, meta, v.x);
+        WriteElement(ds, meta, v.y);
+        WriteElement(ds, meta, v.z);
+        WriteElement(ds, meta, v.w);
+        break;
+    }
+    case cAttributeColor:
+    {
+        const Color &c = static_cast<const Attribute<Color>*>(attr)->Get();
+        WriteElement(ds, meta, c.r);
+        WriteElement(ds, meta, c.g);
+        WriteElement(ds, meta, c.b);
+        WriteElement(ds, meta, c.a);
+        break;
+    }
+    case cAttributeQuat:
+    {
+        const Quat &q = static_cast<const Attribute<Quat>*>(attr)->Get();
+        if (meta.quantization == AttributeMetadata::QuantizeRotation)
+        {
+            AddQuatSmallestThree(ds, q, meta.quantizationBits);
+            break;
+        }
+        WriteElement(ds, meta, q.x);
+        WriteElement(ds, meta, q.y);
+        WriteElement(ds, meta, q.z);
+        WriteElement(ds, meta, q.w);
+        break;
+    }
+    }
+}
+
+void AttributeQuantizer::Read(kNet::DataDeserializer &dd, IAttribute *attr)
+{
+    const AttributeMetadata &meta = *attr->Metadata();
+    switch(attr->TypeId())
+    {
+    case cAttributeReal:
+        static_cast<Attribute<float>*>(attr)->Set(ReadElement(dd, meta), AttributeChange::Disconnected);
+        break;
+    case cAttributeFloat2:
+    {
+        float2 v;
+        if (meta.quantization == AttributeMetadata::QuantizeNormal)
+            dd.ReadNormalizedVector2D(meta.quantizationBits, v.x, v.y);
+        else
+        {
+            v.x = ReadElement(dd, meta);
+            v.y = ReadElement(dd, meta);
+        }
+        static_cast<Attribute<float2>*>(attr)->Set(v, AttributeChange::Disconnected);
+        break;
+    }
+    case cAttributeFloat3:
+    {
+        float3 v;
+        if (meta.quantization == AttributeMetadata::QuantizeNormal)
+        {
+            const int yawBits = (meta.quantizationBits + 1) / 2;
+            dd.ReadNormalizedVector3D(yawBits, meta.quantizationBits - yawBits, v.x, v.y, v.z);
+        }
+        else
+        {
+            v.x = ReadElement(dd, meta);
+            v.y = ReadElement(dd, meta);
+            v.z = ReadElement(dd, meta);
+        }
+        static_cast<Attribute<float3>*>(attr)->Set(v, AttributeChange::Disconnected);
+        break;
+    }
+    case cAttributeFloat4:
+    {
+        float4 v;
+        v.x = ReadElement(dd, meta);
+        v.y = ReadElement(dd, meta);
+        v.z = ReadElement(dd, meta);
+        v.w = ReadElement(dd, meta);
+        static_cast<Attribute<float4>*>(attr)->Set(v, AttributeChange::Disconnected);
+        break;
+    }
+    case cAttributeColor:
+    {
+        Color c;
+        c.r = ReadElement(dd, meta);
+        c.g = ReadElement(dd, meta);
+        c.b = ReadElement(dd, meta);
+        c.a = ReadElement(dd, meta);
+        static_cast<Attribute<Color>*>(attr)->Set(c, AttributeChange::Disconnected);
+        break;
+    }
+    case cAttributeQuat:
+    {
+        Quat q;
+        if (meta.quantization == AttributeMetadata::QuantizeRotation)
+            q = ReadQuatSmallestThree(dd, meta.quantizationBits);
+        else
+        {
+            q.x = ReadElement(dd, meta);
+            q.y = ReadElement(dd, meta);
+            q.z = ReadElement(dd, meta);
+            q.w = ReadElement(dd, meta);
+            q.Normalize();
+        }
+        static_cast<Attribute<Quat>*>(attr)->Set(q, AttributeChange::Disconnected);
+        break;
+    }
+    }
+}
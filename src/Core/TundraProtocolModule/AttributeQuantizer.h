@@ -0,0 +1,32 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#pragma once
+
+#include "TundraProtocolModuleApi.h"
+
+#include "CoreTypes.h"
+
+#include <kNetFwd.h>
+
+class IAttribute;
+
+/// Lossy wire encoding of attribute values, driven by the quantization hints in AttributeMetadata.
+/** SyncManager uses this for the values of EditAttributes messages sent to clients with ProtocolAttributeQuantization,
+    when the attribute's metadata has a quantization mode that suits the attribute's type.
+    Full component serializations (entity and component creation) are always sent at full precision.
+    @see AttributeMetadata::SetQuantization */
+class TUNDRAPROTOCOL_MODULE_API AttributeQuantizer
+{
+public:
+    /// Returns whether the attribute's value is sent quantized, ie. it has a valid quantization hint for its type.
+    static bool IsQuantized(const IAttribute *attr);
+
+    /// Returns the size of the quantized value in bytes, as written by Write() to an empty serializer.
+    static size_t NumBytes(const IAttribute *attr);
+
+    /// Writes the attribute's value quantized. The attribute must be IsQuantized().
+    static void Write(kNet::DataSerializer &ds, const IAttribute *attr);
+
+    /// Reads a quantized value written by Write() to the attribute, without emitting a change.
+    static void Read(kNet::DataDeserializer &dd, IAttribute *attr);
+};
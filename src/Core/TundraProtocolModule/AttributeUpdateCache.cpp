@@ -0,0 +1,80 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#include "StableHeaders.h"
+#include "AttributeUpdateCache.h"
+
+#include <cstring>
+
+#include "MemoryLeakCheck.h"
+
+const std::vector<u8> *AttributeUpdateCache::Find(entity_id_t entityId, component_id_t compId, const u8 *dirtyMask, size_t numMaskBytes, u8 format)
+{
+    QMutexLocker lock(threadSafe_ ? &mutex_ : 0);
+    EntryMap::const_iterator it = entries_.find(Key(entityId, compId));
+    if (it != entries_.end())
+    {
+        const EntryList &list = it->second;
+        for(EntryList::const_iterator i = list.begin(); i != list.end(); ++i)
+        {
+            const Entry &e = *i;
+            if (!e.full && e.format == format && e.mask.size() == numMaskBytes && (numMaskBytes == 0 || memcmp(&e.mask[0], dirtyMask, numMaskBytes) == 0))
+            {
+                ++numHits_;
+                return &e.data;
+            }
+        }
+    }
+    ++numMisses_;
+    return 0;
+}
+
+const std::vector<u8> *AttributeUpdateCache::FindFull(entity_id_t entityId, component_id_t compId)
+{
+    QMutexLocker lock(threadSafe_ ? &mutex_ : 0);
+    EntryMap::const_iterator it = entries_.find(Key(entityId, compId));
+    if (it != entries_.end())
+    {
+        const EntryList &list = it->second;
+        for(EntryList::const_iterator i = list.begin(); i != list.end(); ++i)
+            if (i->full)
+            {
+                ++numHits_;
+                return &i->data;
+            }
+    }
+    ++numMisses_;
+    return 0;
+}
+
+const std::vector<u8> &AttributeUpdateCache::Insert(entity_id_t entityId, component_id_t compId, const u8 *dirtyMask, size_t numMaskBytes, const char *data, size_t numBytes, u8 format)
+{
+    QMutexLocker lock(threadSafe_ ? &mutex_ : 0);
+    EntryList &list = entries_[Key(entityId, compId)];
+    list.push_back(Entry());
+    Entry &e = list.back();
+    e.format = format;
+    e.mask.assign(dirtyMask, dirtyMask + numMaskBytes);
+    e.data.assign((const u8*)data, (const u8*)data + numBytes);
+    return e.data;
+}
+
+const std::vector<u8> &AttributeUpdateCache::InsertFull(entity_id_t entityId, component_id_t compId, const char *data, size_t numBytes)
+{
+    QMutexLocker lock(threadSafe_ ? &mutex_ : 0);
+    EntryList &list = entries_[Key(entityId, compId)];
+    list.push_back(Entry());
+    Entry &e = list.back();
+    e.full = true;
+    e.data.assign((const u8*)data, (const u8*)data + numBytes);
+    return e.data;
+}
+
+void AttributeUpdateCache::Invalidate(entity_id_t entityId, component_id_t compId)
+{
+    entries_.erase(Key(entityId, compId));
+}
+
+void AttributeUpdateCache::Clear()
+{
+    entries_.clear();
+}
@@ -0,0 +1,85 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#pragma once
+
+#include "TundraProtocolModuleApi.h"
+
+#include "CoreTypes.h"
+
+#include <QMutex>
+
+#include <list>
+#include <vector>
+
+/// Per-tick cache of serialized component attribute payloads, shared by all user connections.
+/** When a replicated entity changes on the server, every connection that has the entity in its sync state
+    needs the same serialized attribute data. SyncManager serializes the payload once per component and dirty
+    attribute mask, and every connection's message assembly reuses it for the rest of the network tick.
+    Full component serializations (used for entity and component creation) are cached the same way.
+    @note The cache does not observe the scene: it must be cleared whenever the cached attribute values may have changed,
+    which SyncManager does at the start and end of each network tick.
+    @note When SyncManager assembles messages on several threads the cache is made thread-safe with SetThreadSafe().
+    The returned data pointers stay valid until the component's entries are invalidated or the cache is cleared. */
+class TUNDRAPROTOCOL_MODULE_API AttributeUpdateCache
+{
+public:
+    AttributeUpdateCache() : numHits_(0), numMisses_(0), threadSafe_(false) {}
+
+    /// Sets whether lookups and insertions are serialized with a mutex, so that they can be made from multiple threads.
+    /** Invalidate() and Clear() must still be called only when no other thread is accessing the cache. */
+    void SetThreadSafe(bool enabled) { threadSafe_ = enabled; }
+    /// Returns whether the cache is thread-safe.
+    bool IsThreadSafe() const { return threadSafe_; }
+
+    /// Returns the cached attribute data for the component's dirty mask, or null if not cached.
+    /** @param dirtyMask Dirty attributes bitfield.
+        @param numMaskBytes Number of meaningful bytes in dirtyMask.
+        @param format Wire format variant of the data, as connections with different protocol versions encode the same change differently. */
+    const std::vector<u8> *Find(entity_id_t entityId, component_id_t compId, const u8 *dirtyMask, size_t numMaskBytes, u8 format = 0);
+
+    /// Returns the cached full attribute serialization of the component, or null if not cached.
+    const std::vector<u8> *FindFull(entity_id_t entityId, component_id_t compId);
+
+    /// Stores attribute data for the component's dirty mask. Returns the stored copy.
+    const std::vector<u8> &Insert(entity_id_t entityId, component_id_t compId, const u8 *dirtyMask, size_t numMaskBytes, const char *data, size_t numBytes, u8 format = 0);
+
+    /// Stores the full attribute serialization of the component. Returns the stored copy.
+    const std::vector<u8> &InsertFull(entity_id_t entityId, component_id_t compId, const char *data, size_t numBytes);
+
+    /// Removes the cached data of a single component.
+    void Invalidate(entity_id_t entityId, component_id_t compId);
+
+    /// Removes all cached data.
+    void Clear();
+
+    /// Returns whether the cache is empty.
+    bool Empty() const { return entries_.empty(); }
+
+    /// Returns number of cache hits since last ResetStatistics().
+    uint NumHits() const { return numHits_; }
+    /// Returns number of cache misses since last ResetStatistics().
+    uint NumMisses() const { return numMisses_; }
+    /// Resets the hit and miss counters.
+    void ResetStatistics() { numHits_ = numMisses_ = 0; }
+
+private:
+    struct Entry
+    {
+        Entry() : full(false), format(0) {}
+        bool full; ///< Full attribute serialization, mask is unused.
+        u8 format; ///< Wire format variant of the data.
+        std::vector<u8> mask; ///< Dirty attribute mask the data was serialized for.
+        std::vector<u8> data; ///< Serialized attribute data.
+    };
+
+    typedef std::list<Entry> EntryList; ///< List, so that returned data pointers are not invalidated by insertions.
+    typedef unordered_map<u64, EntryList> EntryMap;
+
+    static u64 Key(entity_id_t entityId, component_id_t compId) { return ((u64)entityId << 32) | (u64)compId; }
+
+    EntryMap entries_;
+    uint numHits_;
+    uint numMisses_;
+    bool threadSafe_;
+    QMutex mutex_;
+};
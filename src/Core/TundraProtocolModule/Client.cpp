@@ -40,7 +40,9 @@ Client::Client(TundraLogicModule* owner) :
     framework_(owner->GetFramework()),
     loginstate_(NotConnected),
     reconnect_(false),
-    client_id_(0)
+    client_id_(0),
+    lastCheckpoint_(0),
+    redirectPort_(0)
 {
     // Create "virtual" client->server connection & syncstate. Used by SyncManager
     serverUserConnection_ = MAKE_SHARED(KNetUserConnection);
@@ -147,6 +149,10 @@ void Client::Login(const QString& address, unsigned short port, kNet::SocketTran
     }
 
     reconnect_ = false;
+    resumeToken_.clear();
+    lastCheckpoint_ = 0;
+    properties.remove("resumeToken");
+    properties.remove("resumeCheckpoint");
     
     if (protocol == kNet::InvalidTransportLayer)
     {
@@ -182,6 +188,16 @@ void Client::DelayedLogout()
     DoLogout(false);
 }
 
+void Client::DelayedZoneRedirect()
+{
+    // Keep the login properties of the session, e.g. the username, for the login to the neighbouring zone's server.
+    LoginPropertyMap sessionProperties = properties;
+    kNet::SocketTransportLayer transportLayer = StringToSocketTransportLayer(LoginProperty("protocol").toString().toStdString().c_str());
+    DoLogout(false);
+    properties = sessionProperties;
+    Login(redirectAddress_, redirectPort_, transportLayer);
+}
+
 void Client::DoLogout(bool fail)
 {
     if (loginstate_ != NotConnected)
@@ -282,6 +298,14 @@ void Client::CheckLogin()
             MsgLogin msg;
             emit AboutToConnect(); // This signal is used as a 'function call'. Any interested party can fill in
             // new content to the login properties of the client object, which will then be sent out on the line below.
+            // After a dropped connection, ask the server to resume the session instead of sending the whole scene again.
+            properties.remove("resumeToken");
+            properties.remove("resumeCheckpoint");
+            if (reconnect_ && !resumeToken_.isEmpty())
+            {
+                properties["resumeToken"] = resumeToken_;
+                properties["resumeCheckpoint"] = lastCheckpoint_;
+            }
             msg.loginData = StringToBuffer(LoginPropertiesAsXml().toStdString());
             DataSerializer ds(msg.Size() + 4);
             msg.SerializeTo(ds);
@@ -356,6 +380,27 @@ void Client::HandleKristalliMessage(MessageConnection* source, packet_id_t packe
             HandleClientLeft(source, msg);
         }
         break;
+    case cZoneRedirectMessage:
+        HandleZoneRedirect(data, numBytes);
+        break;
+    case cAssetManifestMessage:
+        HandleAssetManifest(data, numBytes);
+        break;
+    case cSyncCheckpointMessage:
+        {
+            DataDeserializer dd(data, numBytes);
+            lastCheckpoint_ = dd.ReadVLE<kNet::VLE8_16_32>();
+        }
+        break;
+    case cLoginQueueMessage:
+        {
+            DataDeserializer dd(data, numBytes);
+            int position = (int)dd.ReadVLE<kNet::VLE8_16_32>();
+            int queueLength = (int)dd.ReadVLE<kNet::VLE8_16_32>();
+            ::LogInfo(QString("Client: waiting for admission to the server scene, position %1 of %2 in the queue.").arg(position).arg(queueLength));
+            emit LoginQueued(position, queueLength);
+        }
+        break;
     }
 
     emit NetworkMessageReceived(packetId, messageId, data, numBytes);
@@ -375,6 +420,16 @@ void Client::HandleLoginReply(MessageConnection* /*source*/, const char *data, s
     if (dd.BytesLeft())
         serverUserConnection_->protocolVersion = (NetworkProtocolVersion)dd.ReadVLE<kNet::VLE8_16_32>();
 
+    // Read whether the server resumed the session, and the token to resume it with after a dropped connection.
+    bool resumed = false;
+    if (msg.success && serverUserConnection_->protocolVersion >= ProtocolSessionResume && dd.BytesLeft())
+    {
+        const bool serverResumed = dd.Read<u8>() != 0;
+        resumed = reconnect_ && serverResumed;
+        resumeToken_ = QString::fromStdString(dd.ReadString());
+        lastCheckpoint_ = 0;
+    }
+
     if (msg.success)
     {
         loginstate_ = LoggedIn;
@@ -399,6 +454,15 @@ void Client::HandleLoginReply(MessageConnection* /*source*/, const char *data, s
 
             emit Connected(&responseData);
         }
+        else if (resumed)
+        {
+            // The server sends the changes since the last checkpoint received. The attribute baselines and interned action
+            // names may have been updated by lost messages, and are started over like on the server.
+            ::LogInfo("Resumed the session");
+            serverUserConnection_->syncState->baselines.Clear();
+            serverUserConnection_->syncState->receivedActionNames.clear();
+            serverUserConnection_->syncState->receivedActionIds.clear();
+        }
         else
         {
             // If we are reconnecting, empty the scene, as the server will send everything again anyway
@@ -428,4 +492,40 @@ void Client::HandleClientLeft(MessageConnection* /*source*/, const MsgClientLeft
 {
 }
 
+void Client::HandleZoneRedirect(const char *data, size_t numBytes)
+{
+    DataDeserializer dd(data, numBytes);
+    redirectAddress_ = QString::fromStdString(dd.ReadString());
+    redirectPort_ = dd.Read<u16>();
+    ::LogInfo("Client: Redirected to the server of a neighbouring zone at " + redirectAddress_ + ":" + QString::number(redirectPort_));
+    emit ZoneRedirected(redirectAddress_, redirectPort_);
+    // Do not disconnect while the connection is delivering this message.
+    QTimer::singleShot(1, this, SLOT(DelayedZoneRedirect()));
+}
+
+void Client::HandleAssetManifest(const char *data, size_t numBytes)
+{
+    DataDeserializer dd(data, numBytes);
+    u32 numAssets = dd.ReadVLE<kNet::VLE8_16_32>();
+    if (numAssets > dd.BytesLeft() / 2) // Each asset takes at least the two length bytes.
+    {
+        ::LogWarning("Client: Received a malformed asset manifest.");
+        return;
+    }
+    AssetRefTypeList manifest(numAssets);
+    for(size_t i = 0; i < manifest.size(); ++i)
+    {
+        std::vector<char> ref(dd.ReadVLE<kNet::VLE8_16_32>());
+        if (!ref.empty())
+            dd.ReadArray<u8>((u8*)&ref[0], ref.size());
+        std::vector<char> type(dd.ReadVLE<kNet::VLE8_16_32>());
+        if (!type.empty())
+            dd.ReadArray<u8>((u8*)&type[0], type.size());
+        manifest[i].first = QString::fromUtf8(ref.empty() ? "" : &ref[0], (int)ref.size());
+        manifest[i].second = QString::fromUtf8(type.empty() ? "" : &type[0], (int)type.size());
+    }
+    int numRequests = framework_->Asset()->PrefetchAssets(manifest);
+    ::LogDebug("Client: Prefetching " + QString::number(numRequests) + " of the " + QString::number(manifest.size()) + " assets of the server's asset manifest.");
+}
+
 }
@@ -145,6 +145,16 @@ signals:
     /// Emitted when a login attempt failed to a server.
     void LoginFailed(const QString &reason);
 
+    /// Emitted when the server has authenticated the client but queues it for admission to the scene, and when the position changes.
+    /** @param position Position in the queue, 1 for the next admitted.
+        @param queueLength Number of the clients in the queue. */
+    void LoginQueued(int position, int queueLength);
+
+    /// Emitted when the server of a zone sharded scene tells the client to reconnect to the server of a neighbouring zone.
+    /** The client logs out and logs in to the new server right after, with the login properties of the current session.
+        @sa ZoneManager */
+    void ZoneRedirected(const QString &address, unsigned short port);
+
 private slots:
     /// Handles a Kristalli protocol message
     void HandleKristalliMessage(kNet::MessageConnection* source, kNet::packet_id_t, kNet::message_id_t id, const char* data, size_t numBytes);
@@ -154,6 +164,9 @@ private slots:
     /// Actually perform a delayed logout
     void DelayedLogout();
 
+    /// Logs out and logs in to the server the client was redirected to.
+    void DelayedZoneRedirect();
+
 private:
     /// Handles pending login to server
     void CheckLogin();
@@ -167,10 +180,20 @@ private:
     /// Client: Handles a client left message
     void HandleClientLeft(kNet::MessageConnection* source, const MsgClientLeft& msg);
 
+    /// Handles a zone redirect message
+    void HandleZoneRedirect(const char *data, size_t numBytes);
+
+    /// Handles an asset manifest message by prefetching the listed assets
+    void HandleAssetManifest(const char *data, size_t numBytes);
+
     ClientLoginState loginstate_; ///< Client's connection/login state
     LoginPropertyMap properties; ///< Specifies all the login properties.
     bool reconnect_; ///< Whether the connect attempt is a reconnect because of dropped connection
     u32 client_id_; ///< User ID, once known
+    QString resumeToken_; ///< Token with which the session can be resumed after a dropped connection, if the server supports it
+    u32 lastCheckpoint_; ///< Number of the last sync checkpoint received in the session
+    QString redirectAddress_; ///< Address of the server the client was redirected to by a zone redirect
+    unsigned short redirectPort_; ///< Port of the server the client was redirected to by a zone redirect
     TundraLogicModule* owner_; ///< Owning module
     Framework* framework_; ///< Framework pointer
     /// "Virtual" user connection representing the server and its syncstate (client only)
@@ -0,0 +1,133 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#include "StableHeaders.h"
+#include "EntitySpatialGrid.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "MemoryLeakCheck.h"
+
+EntitySpatialGrid::EntitySpatialGrid(float cellSize) :
+    cellSize_(1.f),
+    invCellSize_(1.f)
+{
+    SetCellSize(cellSize);
+}
+
+void EntitySpatialGrid::Update(entity_id_t id, const float3 &worldPos)
+{
+    if (!worldPos.IsFinite())
+    {
+        Remove(id);
+        return;
+    }
+
+    const CellKey cell = MakeKey(CellCoord(worldPos.x), CellCoord(worldPos.y), CellCoord(worldPos.z));
+    EntryMap::iterator it = entries_.find(id);
+    if (it != entries_.end())
+    {
+        it->second.pos = worldPos;
+        if (it->second.cell == cell)
+            return;
+        RemoveFromCell(it->second.cell, id);
+        it->second.cell = cell;
+    }
+    else
+    {
+        Entry entry;
+        entry.pos = worldPos;
+        entry.cell = cell;
+        entries_[id] = entry;
+    }
+    cells_[cell].push_back(id);
+}
+
+void EntitySpatialGrid::Remove(entity_id_t id)
+{
+    EntryMap::iterator it = entries_.find(id);
+    if (it == entries_.end())
+        return;
+    RemoveFromCell(it->second.cell, id);
+    entries_.erase(it);
+}
+
+void EntitySpatialGrid::Clear()
+{
+    cells_.clear();
+    entries_.clear();
+}
+
+void EntitySpatialGrid::EntitiesNear(const float3 &center, float radius, std::vector<entity_id_t> &out) const
+{
+    if (!center.IsFinite() || entries_.empty())
+        return;
+
+    const int minX = CellCoord(center.x - radius), maxX = CellCoord(center.x + radius);
+    const int minY = CellCoord(center.y - radius), maxY = CellCoord(center.y + radius);
+    const int minZ = CellCoord(center.z - radius), maxZ = CellCoord(center.z + radius);
+
+    // If the query volume covers more cells than there are occupied cells, walking the occupied cells is cheaper.
+    const s64 numQueryCells = (s64)(maxX - minX + 1) * (s64)(maxY - minY + 1) * (s64)(maxZ - minZ + 1);
+    if (numQueryCells > (s64)cells_.size())
+    {
+        const float radiusSq = (radius + cellSize_) * (radius + cellSize_);
+        for(EntryMap::const_iterator it = entries_.begin(); it != entries_.end(); ++it)
+            if (it->second.pos.DistanceSq(center) <= radiusSq)
+                out.push_back(it->first);
+        return;
+    }
+
+    for(int x = minX; x <= maxX; ++x)
+        for(int y = minY; y <= maxY; ++y)
+            for(int z = minZ; z <= maxZ; ++z)
+            {
+                CellMap::const_iterator cell = cells_.find(MakeKey(x, y, z));
+                if (cell != cells_.end())
+                    out.insert(out.end(), cell->second.begin(), cell->second.end());
+            }
+}
+
+void EntitySpatialGrid::SetCellSize(float size)
+{
+    size = std::max(size, 1.f);
+    if (size == cellSize_)
+        return;
+    cellSize_ = size;
+    invCellSize_ = 1.f / size;
+
+    // Re-bucket existing entries with the new cell size.
+    EntryMap old;
+    old.swap(entries_);
+    cells_.clear();
+    for(EntryMap::const_iterator it = old.begin(); it != old.end(); ++it)
+        Update(it->first, it->second.pos);
+}
+
+int EntitySpatialGrid::CellCoord(float v) const
+{
+    return (int)std::floor(v * invCellSize_);
+}
+
+EntitySpatialGrid::CellKey EntitySpatialGrid::MakeKey(int x, int y, int z)
+{
+    const u64 mask = (1 << 21) - 1;
+    return ((u64)(x & mask) << 42) | ((u64)(y & mask) << 21) | (u64)(z & mask);
+}
+
+void EntitySpatialGrid::RemoveFromCell(CellKey cell, entity_id_t id)
+{
+    CellMap::iterator it = cells_.find(cell);
+    if (it == cells_.end())
+        return;
+    std::vector<entity_id_t> &bucket = it->second;
+    std::vector<entity_id_t>::iterator pos = std::find(bucket.begin(), bucket.end(), id);
+    if (pos != bucket.end())
+    {
+        // Order within a cell is irrelevant, so swap-and-pop.
+        *pos = bucket.back();
+        bucket.pop_back();
+    }
+    if (bucket.empty())
+        cells_.erase(it);
+}
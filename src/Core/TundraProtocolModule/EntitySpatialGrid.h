@@ -0,0 +1,70 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#pragma once
+
+#include "TundraProtocolModuleApi.h"
+
+#include "CoreTypes.h"
+#include "Math/float3.h"
+
+#include <vector>
+
+/// Uniform hash grid of entity world positions, used by SyncManager to speed up interest management.
+/** The grid is shared by all user connections and updated incrementally as placeable transforms change.
+    Observers query only the cells near them, so that priority recomputation does not need to visit every
+    entity of every connection on each priority tick.
+    @remark Interest management */
+class TUNDRAPROTOCOL_MODULE_API EntitySpatialGrid
+{
+public:
+    /// Constructs the grid with the given cell size in world units.
+    explicit EntitySpatialGrid(float cellSize = 50.f);
+
+    /// Inserts the entity to the grid, or moves it to a new cell if its position changed.
+    void Update(entity_id_t id, const float3 &worldPos);
+
+    /// Removes the entity from the grid, if found.
+    void Remove(entity_id_t id);
+
+    /// Removes all entities from the grid.
+    void Clear();
+
+    /// Returns whether the entity is tracked by the grid.
+    bool Contains(entity_id_t id) const { return entries_.find(id) != entries_.end(); }
+
+    /// Returns number of entities tracked by the grid.
+    size_t Size() const { return entries_.size(); }
+
+    /// Appends IDs of all entities in the cells overlapping the sphere (center, radius) to @c out.
+    /** The result is conservative: entities slightly outside the radius may be returned too. */
+    void EntitiesNear(const float3 &center, float radius, std::vector<entity_id_t> &out) const;
+
+    /// Sets the cell size and re-buckets all tracked entities. Sizes below 1 world unit are clamped.
+    void SetCellSize(float size);
+    /// Returns the cell size in world units.
+    float CellSize() const { return cellSize_; }
+
+private:
+    typedef u64 CellKey;
+
+    struct Entry
+    {
+        float3 pos;
+        CellKey cell;
+    };
+
+    typedef unordered_map<CellKey, std::vector<entity_id_t> > CellMap;
+    typedef unordered_map<entity_id_t, Entry> EntryMap;
+
+    /// Returns integer cell coordinate of a world coordinate.
+    int CellCoord(float v) const;
+    /// Packs three cell coordinates to a single key. 21 bits are used for each axis.
+    static CellKey MakeKey(int x, int y, int z);
+    /// Removes the entity ID from the cell's bucket, erasing the bucket if it became empty.
+    void RemoveFromCell(CellKey cell, entity_id_t id);
+
+    float cellSize_;
+    float invCellSize_;
+    CellMap cells_;
+    EntryMap entries_;
+};
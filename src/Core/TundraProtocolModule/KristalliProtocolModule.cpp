@@ -89,6 +89,7 @@ static const int cReconnectAttempts = 5;
 
 KristalliProtocolModule::KristalliProtocolModule() :
     IModule("KristalliProtocol"),
+    serverSocketCount(1),
     serverConnection(0),
     server(0),
     reconnectAttempts(0),
@@ -128,6 +129,16 @@ void KristalliProtocolModule::Initialize()
         if (transportLayer != InvalidTransportLayer)
             defaultTransport = transportLayer;
     }
+    cmdLineParams = framework_->CommandLineParameters("--serverSockets");
+    if (cmdLineParams.size() > 0)
+    {
+        bool ok;
+        int count = cmdLineParams.first().toInt(&ok);
+        if (ok && count > 0)
+            serverSocketCount = count;
+        else
+            ::LogError("KristalliProtocolModule: --serverSockets parameter is not a valid positive integer.");
+    }
 #ifdef KNET_USE_QT
     framework_->Console()->RegisterCommand("kNet", "Shows the kNet statistics window.", this, SLOT(OpenKNetLogWindow()));
 #endif
@@ -176,15 +187,9 @@ void KristalliProtocolModule::Update(f64 /*frametime*/)
     {
         PROFILE(KristalliProtocolModule_kNet_server_Process);
 
-        server->Process();
-
-        // In Tundra, we *never* keep half-open server->client connections alive. 
-        // (the usual case would be to wait for a file transfer to complete, but Tundra messaging mechanism doesn't use that).
-        // So, bidirectionally close all half-open connections.
-        NetworkServer::ConnectionMap connections = server->GetConnections();
-        for(NetworkServer::ConnectionMap::iterator iter = connections.begin(); iter != connections.end(); ++iter)
-            if (!iter->second->IsReadOpen() && iter->second->IsWriteOpen())
-                iter->second->Disconnect(0);
+        ProcessServer(server);
+        for(size_t i = 0; i < extraServers.size(); ++i)
+            ProcessServer(extraServers[i]);
     }
     
     if ((!serverConnection || serverConnection->GetConnectionState() == ConnectionClosed ||
@@ -216,6 +221,19 @@ void KristalliProtocolModule::Update(f64 /*frametime*/)
         reconnectAttempts = cReconnectAttempts;
 }
 
+void KristalliProtocolModule::ProcessServer(NetworkServer *networkServer)
+{
+    networkServer->Process();
+
+    // In Tundra, we *never* keep half-open server->client connections alive. 
+    // (the usual case would be to wait for a file transfer to complete, but Tundra messaging mechanism doesn't use that).
+    // So, bidirectionally close all half-open connections.
+    NetworkServer::ConnectionMap connections = networkServer->GetConnections();
+    for(NetworkServer::ConnectionMap::iterator iter = connections.begin(); iter != connections.end(); ++iter)
+        if (!iter->second->IsReadOpen() && iter->second->IsWriteOpen())
+            iter->second->Disconnect(0);
+}
+
 void KristalliProtocolModule::Connect(const char *ip, unsigned short port, SocketTransportLayer transport)
 {
     if (Connected() && serverConnection && serverConnection->RemoteEndPoint().IPToString() != serverIp)
@@ -282,9 +300,31 @@ bool KristalliProtocolModule::StartServer(unsigned short port, SocketTransportLa
         ::LogError(error);
         throw Exception((error + "Please make sure that the port is free and not used by another application. The program will now abort.").toStdString().c_str());
     }
-    
+
+    // Listen in the additional ports, each with a network and worker thread of its own. The connections of all ports
+    // are reported to this module, so they become users of the same server.
+    int numPorts = 1;
+    if (transport == kNet::SocketOverUDP)
+    {
+        for(int i = 1; i < serverSocketCount && port + i <= 0xffff; ++i)
+        {
+            shared_ptr<kNet::Network> extraNetwork = MAKE_SHARED(kNet::Network);
+            kNet::NetworkServer *extraServer = extraNetwork->StartServer((unsigned short)(port + i), transport, this, allowAddressReuse);
+            if (!extraServer)
+            {
+                ::LogError("Failed to start server on additional port " + QString::number(port + i) + ".");
+                continue;
+            }
+            extraNetworks.push_back(extraNetwork);
+            extraServers.push_back(extraServer);
+            ++numPorts;
+        }
+    }
+    else if (serverSocketCount > 1)
+        ::LogWarning("KristalliProtocolModule: --serverSockets applies to UDP servers only, listening in one port.");
+
     ::LogInfo("Server started");
-    ::LogInfo("* Port     : " + QString::number(port));
+    ::LogInfo("* Port     : " + QString::number(port) + (numPorts > 1 ? "-" + QString::number(port + numPorts - 1) : QString()));
     ::LogInfo("* Protocol : " + SocketTransportLayerToString(transport));
     ::LogInfo("* Headless : " + BoolToString(framework_->IsHeadless()));
     return true;
@@ -295,6 +335,10 @@ void KristalliProtocolModule::StopServer()
     if (server)
     {
         network.StopServer();
+        for(size_t i = 0; i < extraNetworks.size(); ++i)
+            extraNetworks[i]->StopServer();
+        extraNetworks.clear();
+        extraServers.clear();
         // We may have connections registered by other server modules. Only clear native connections
         for(UserConnectionList::iterator iter = connections.begin(); iter != connections.end();)
         {
@@ -356,6 +400,7 @@ void KristalliProtocolModule::HandleMessage(kNet::MessageConnection *source, kNe
 {
     assert(source);
     assert(data || numBytes == 0);
+    PROFILE_EVENT("network", QString("Message %1, %2 bytes").arg(messageId).arg(numBytes));
 
     try
     {
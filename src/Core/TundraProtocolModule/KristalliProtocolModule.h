@@ -36,7 +36,8 @@ public:
     void Disconnect();
 
     /// Starts a Kristalli server at the given port/transport.
-    /// @return true if successful
+    /** With UDP, the server listens in serverSocketCount consecutive ports starting from the port, see serverSocketCount.
+        @return true if successful */
     bool StartServer(unsigned short port, kNet::SocketTransportLayer transport);
     
     /// Stops Kristalli server
@@ -59,6 +60,7 @@ public:
     kNet::MessageConnection *GetMessageConnection() { return serverConnection.ptr(); }
     
     /// Return server, for use by other modules (null if not running)
+    /** @note Returns the server of the first port only, when listening in several, see serverSocketCount. */
     kNet::NetworkServer* GetServer() const { return server; }
     
     kNet::Network *GetNetwork() { return &network; }
@@ -76,6 +78,13 @@ public:
     /// What trasport layer to use. Read on startup from "--protocol <udp|tcp>". Defaults to UDP if no start param was given.
     kNet::SocketTransportLayer defaultTransport;
 
+    /// Number of consecutive ports a UDP server listens in. Read on startup from "--serverSockets <n>". Defaults to 1.
+    /** Each port is served by a kNet network of its own, i.e. a separate socket and network worker thread, so that
+        the receiving of a server with very high UDP packet rates is spread over several threads. The connections of
+        all ports are users of the same server. Clients are distributed to the ports outside the server, e.g. by giving
+        them different ports in their login URLs. */
+    int serverSocketCount;
+
     /// Allocate a connection ID for new connection
     u32 AllocateNewConnectionID() const;
 
@@ -116,9 +125,17 @@ private:
     /// Store the transport type. Used for reconnecting
     kNet::SocketTransportLayer serverTransport;
     
+    /// Processes the incoming connections & messages of a server, and closes its half-open connections.
+    void ProcessServer(kNet::NetworkServer *networkServer);
+
     kNet::Network network;
     Ptr(kNet::MessageConnection) serverConnection;
     kNet::NetworkServer *server;
+
+    /// Networks of the ports after the first one a UDP server listens in, see serverSocketCount.
+    std::vector<shared_ptr<kNet::Network> > extraNetworks;
+    /// Servers of extraNetworks, in the same order.
+    std::vector<kNet::NetworkServer*> extraServers;
     
     /// Users that are connected to server
     UserConnectionList connections;
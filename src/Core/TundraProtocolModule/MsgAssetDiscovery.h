@@ -38,10 +38,11 @@ struct MsgAssetDiscovery
 
 	std::vector<s8> assetRef;
 	std::vector<s8> assetType;
+	std::vector<s8> contentHash;
 
 	inline size_t Size() const
 	{
-		return 1 + assetRef.size()*1 + 1 + assetType.size()*1;
+		return 1 + assetRef.size()*1 + 1 + assetType.size()*1 + 1 + contentHash.size()*1;
 	}
 
 	inline void SerializeTo(kNet::DataSerializer &dst) const
@@ -52,6 +53,9 @@ struct MsgAssetDiscovery
 		dst.Add<u8>((u8)assetType.size());
 		if (assetType.size() > 0)
 			dst.AddArray<s8>(&assetType[0], (u32)assetType.size());
+		dst.Add<u8>((u8)contentHash.size());
+		if (contentHash.size() > 0)
+			dst.AddArray<s8>(&contentHash[0], (u32)contentHash.size());
 	}
 
 	inline void DeserializeFrom(kNet::DataDeserializer &src)
@@ -62,6 +66,14 @@ struct MsgAssetDiscovery
 		assetType.resize(src.Read<u8>());
 		if (assetType.size() > 0)
 			src.ReadArray<s8>(&assetType[0], assetType.size());
+		// Older senders leave out the content hash
+		contentHash.clear();
+		if (src.BytesLeft() > 0)
+		{
+			contentHash.resize(src.Read<u8>());
+			if (contentHash.size() > 0)
+				src.ReadArray<s8>(&contentHash[0], contentHash.size());
+		}
 	}
 
 };
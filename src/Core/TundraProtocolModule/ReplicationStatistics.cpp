@@ -0,0 +1,90 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#include "StableHeaders.h"
+#include "ReplicationStatistics.h"
+
+#include "MemoryLeakCheck.h"
+
+void ReplicationStatistics::AddMessage(Direction dir, u32 connectionId, kNet::message_id_t messageId, size_t numBytes)
+{
+    QMutexLocker lock(threadSafe_ ? &mutex_ : 0);
+    Counter &c = messages_[Key(connectionId, messageId)];
+    ++c.count[dir];
+    c.amount[dir] += numBytes;
+}
+
+void ReplicationStatistics::AddComponent(Direction dir, u32 componentTypeId, size_t numBytes)
+{
+    QMutexLocker lock(threadSafe_ ? &mutex_ : 0);
+    Counter &c = components_[componentTypeId];
+    ++c.count[dir];
+    c.amount[dir] += numBytes;
+}
+
+void ReplicationStatistics::AddAttribute(Direction dir, u32 componentTypeId, u8 attrIndex, size_t numBits)
+{
+    QMutexLocker lock(threadSafe_ ? &mutex_ : 0);
+    Counter &c = attributes_[Key(componentTypeId, attrIndex)];
+    ++c.count[dir];
+    c.amount[dir] += numBits;
+}
+
+void ReplicationStatistics::Reset()
+{
+    QMutexLocker lock(&mutex_);
+    messages_.clear();
+    components_.clear();
+    attributes_.clear();
+}
+
+void ReplicationStatistics::FillCounters(QVariantMap &map, const Counter &counter, const QString &countName, bool bits)
+{
+    map["sent" + countName] = (qulonglong)counter.count[Sent];
+    map["sentBytes"] = (qulonglong)(bits ? (counter.amount[Sent] + 7) / 8 : counter.amount[Sent]);
+    map["received" + countName] = (qulonglong)counter.count[Received];
+    map["receivedBytes"] = (qulonglong)(bits ? (counter.amount[Received] + 7) / 8 : counter.amount[Received]);
+}
+
+QVariantList ReplicationStatistics::Messages() const
+{
+    QMutexLocker lock(&mutex_);
+    QVariantList ret;
+    for(CounterMap::const_iterator it = messages_.begin(); it != messages_.end(); ++it)
+    {
+        QVariantMap map;
+        map["connectionId"] = (uint)(it->first >> 32);
+        map["messageId"] = (uint)(it->first & 0xffffffff);
+        FillCounters(map, it->second, "Messages", false);
+        ret.push_back(map);
+    }
+    return ret;
+}
+
+QVariantList ReplicationStatistics::Components() const
+{
+    QMutexLocker lock(&mutex_);
+    QVariantList ret;
+    for(CounterMap::const_iterator it = components_.begin(); it != components_.end(); ++it)
+    {
+        QVariantMap map;
+        map["typeId"] = (uint)it->first;
+        FillCounters(map, it->second, "Updates", false);
+        ret.push_back(map);
+    }
+    return ret;
+}
+
+QVariantList ReplicationStatistics::Attributes() const
+{
+    QMutexLocker lock(&mutex_);
+    QVariantList ret;
+    for(CounterMap::const_iterator it = attributes_.begin(); it != attributes_.end(); ++it)
+    {
+        QVariantMap map;
+        map["typeId"] = (uint)(it->first >> 32);
+        map["attributeIndex"] = (uint)(it->first & 0xffffffff);
+        FillCounters(map, it->second, "Updates", true);
+        ret.push_back(map);
+    }
+    return ret;
+}
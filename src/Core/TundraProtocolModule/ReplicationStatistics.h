@@ -0,0 +1,75 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#pragma once
+
+#include "TundraProtocolModuleApi.h"
+
+#include "CoreTypes.h"
+
+#include <kNet/Types.h>
+
+#include <QMutex>
+#include <QVariant>
+
+#include <map>
+
+/// Counts scenesync traffic per message type and connection, per component type, and per component attribute.
+/** SyncManager records the messages it sends and receives, and the serialized size of each component and attribute
+    update in them, so that the replicated data causing the most traffic can be found at runtime.
+    Attribute sizes are counted in bits, as the values are bit-packed, and reported in bytes.
+    @note When SyncManager assembles messages on several threads the recording is made thread-safe with SetThreadSafe(). */
+class TUNDRAPROTOCOL_MODULE_API ReplicationStatistics
+{
+public:
+    /// Direction of the traffic.
+    enum Direction
+    {
+        Sent = 0,
+        Received = 1
+    };
+
+    ReplicationStatistics() : threadSafe_(false) {}
+
+    /// Sets whether recording is serialized with a mutex, so that it can be done from multiple threads.
+    void SetThreadSafe(bool enabled) { threadSafe_ = enabled; }
+
+    /// Records a message sent to or received from a connection.
+    void AddMessage(Direction dir, u32 connectionId, kNet::message_id_t messageId, size_t numBytes);
+
+    /// Records a serialized component update: creation, or attribute changes, of a component of the type.
+    void AddComponent(Direction dir, u32 componentTypeId, size_t numBytes);
+
+    /// Records a serialized attribute value of a component type.
+    void AddAttribute(Direction dir, u32 componentTypeId, u8 attrIndex, size_t numBits);
+
+    /// Clears all counters.
+    void Reset();
+
+    /// Returns message counters as a list of maps with connectionId, messageId, sentMessages, sentBytes, receivedMessages and receivedBytes.
+    QVariantList Messages() const;
+
+    /// Returns component counters as a list of maps with typeId, sentUpdates, sentBytes, receivedUpdates and receivedBytes.
+    QVariantList Components() const;
+
+    /// Returns attribute counters as a list of maps with typeId, attributeIndex, sentUpdates, sentBytes, receivedUpdates and receivedBytes.
+    QVariantList Attributes() const;
+
+private:
+    struct Counter
+    {
+        Counter() { count[Sent] = count[Received] = 0; amount[Sent] = amount[Received] = 0; }
+        u64 count[2]; ///< Number of messages or updates.
+        u64 amount[2]; ///< Bytes, or bits for attributes.
+    };
+
+    typedef std::map<u64, Counter> CounterMap;
+
+    static u64 Key(u32 high, u32 low) { return ((u64)high << 32) | (u64)low; }
+    static void FillCounters(QVariantMap &map, const Counter &counter, const QString &countName, bool bits);
+
+    CounterMap messages_; ///< By connection ID and message ID.
+    CounterMap components_; ///< By component type ID.
+    CounterMap attributes_; ///< By component type ID and attribute index.
+    bool threadSafe_;
+    mutable QMutex mutex_;
+};
@@ -18,6 +18,7 @@
 #include "CoreStringUtils.h"
 #include "SceneAPI.h"
 #include "ConfigAPI.h"
+#include "AssetAPI.h"
 #include "LoggingFunctions.h"
 #include "QScriptEngineHelpers.h"
 #include "CoreJsonUtils.h"
@@ -38,13 +39,24 @@ Q_DECLARE_METATYPE(LoginPropertyMap);
 
 using namespace kNet;
 
+/// Maximum number of assets listed in the asset manifest sent to a joining client.
+static const size_t cMaxAssetManifestSize = 2048;
+
+/// Seconds a deferred login waits for its authentication to complete before it is denied.
+static const f64 cLoginAuthenticationTimeout = 30.0;
+
+/// Interval in seconds of sending the users in the admission queue their positions.
+static const f64 cLoginQueueFeedbackInterval = 1.0;
+
 namespace TundraLogic
 {
 
 Server::Server(TundraLogicModule* owner) :
     owner_(owner),
     framework_(owner->GetFramework()),
-    current_port_(-1)
+    current_port_(-1),
+    admissionsPerFrame_(2),
+    queueFeedbackTime_(0.0)
 {
 }
 
@@ -52,8 +64,43 @@ Server::~Server()
 {
 }
 
-void Server::Update(f64 /*frametime*/)
+void Server::Update(f64 frametime)
 {
+    // Deny the deferred logins whose authentication has not completed in time
+    for(PendingLoginList::iterator it = authenticatingUsers_.begin(); it != authenticatingUsers_.end();)
+    {
+        UserConnectionPtr user = it->user.lock();
+        it->time += frametime;
+        if (!user)
+            it = authenticatingUsers_.erase(it);
+        else if (it->time >= cLoginAuthenticationTimeout)
+        {
+            it = authenticatingUsers_.erase(it);
+            ::LogInfo("Authentication of user with connection ID " + QString::number(user->userID) + " timed out.");
+            DenyLogin(user, "Authentication timed out");
+        }
+        else
+            ++it;
+    }
+
+    // Admit the authenticated users at a limited rate, so that a crowd joining at once does not stall the main loop
+    for(int admitted = 0; !admissionQueue_.empty() && (admissionsPerFrame_ <= 0 || admitted < admissionsPerFrame_);)
+    {
+        UserConnectionPtr user = admissionQueue_.front().user.lock();
+        admissionQueue_.pop_front();
+        if (user)
+        {
+            AdmitUser(user);
+            ++admitted;
+        }
+    }
+
+    queueFeedbackTime_ += frametime;
+    if (queueFeedbackTime_ >= cLoginQueueFeedbackInterval)
+    {
+        queueFeedbackTime_ = 0.0;
+        SendLoginQueuePositions();
+    }
 }
 
 bool Server::Start(unsigned short port, QString protocol)
@@ -96,6 +143,10 @@ bool Server::Start(unsigned short port, QString protocol)
     current_port_ = (int)port;
     current_protocol_ = (transportLayer == kNet::SocketOverUDP) ? "udp" : "tcp";
 
+    QStringList admissionsArg = framework_->CommandLineParameters("--loginAdmissionsPerFrame");
+    if (!admissionsArg.empty())
+        admissionsPerFrame_ = qMax(0, admissionsArg.last().toInt());
+
     // Create the default server scene
     /// \todo Should be not hard coded like this. Give some unique id (uuid perhaps) that could be returned to the client to make the corresponding named scene in client?
     ScenePtr scene = framework_->Scene()->CreateScene("TundraServer", true, true);
@@ -121,6 +172,8 @@ void Server::Stop()
 
         owner_->GetKristalliModule()->StopServer();
         framework_->Scene()->RemoveScene("TundraServer");
+        authenticatingUsers_.clear();
+        admissionQueue_.clear();
         
         emit ServerStopped();
 
@@ -260,13 +313,18 @@ void Server::RemoveExternalUser(UserConnectionPtr user)
     // If user had zero ID, was not logged in yet and does not need to be reported
     if (user->userID)
     {
-        // Tell everyone of the client leaving
+        RemovePendingLogin(user.get());
+
+        // Tell everyone of the client leaving, if it was admitted
         MsgClientLeft left;
         left.userID = user->userID;
-        foreach(const UserConnectionPtr &u, AuthenticatedUsers())
-            if (u->userID != user->userID)
-                u->Send(left);
+        if (user->properties["authenticated"].toBool() == true)
+            foreach(const UserConnectionPtr &u, AuthenticatedUsers())
+                if (u->userID != user->userID)
+                    u->Send(left);
     
+        // Keep the sync state before the application code reacts to the disconnection, so that its changes are marked to it.
+        owner_->GetSyncManager()->SuspendUserSession(user.get());
         emit UserDisconnected(user->userID, user.get());
     }
 
@@ -365,16 +423,115 @@ bool Server::FinalizeLogin(UserConnectionPtr user)
     emit UserAboutToConnect(user->userID, user.get());
     if (user->properties["authenticated"].toBool() != true)
     {
-        ::LogInfo("User with connection ID " + QString::number(user->userID) + " was denied access.");
-        MsgLoginReply reply;
-        reply.success = 0;
-        reply.userID = 0;
-        QByteArray responseByteData = user->properties["reason"].toString().toAscii();
-        reply.loginReplyData.insert(reply.loginReplyData.end(), responseByteData.data(), responseByteData.data() + responseByteData.size());
-        user->Send(reply);
+        RemovePendingLogin(user.get());
+        DenyLogin(user, user->properties["reason"].toString());
         return false;
     }
-    
+
+    // Until admitted to the scene, the user's messages other than login are dropped.
+    user->properties["authenticated"] = false;
+    bool deferred = false;
+    for(PendingLoginList::const_iterator it = authenticatingUsers_.begin(); it != authenticatingUsers_.end(); ++it)
+        if (it->user.lock() == user)
+            deferred = true;
+    if (deferred)
+        ::LogInfo("Login of user with connection ID " + QString::number(user->userID) + " is waiting for authentication.");
+    else
+        QueueForAdmission(user);
+    return true;
+}
+
+void Server::DeferLogin(UserConnection *connection)
+{
+    foreach(const UserConnectionPtr &user, UserConnections())
+        if (user.get() == connection)
+        {
+            for(PendingLoginList::const_iterator it = authenticatingUsers_.begin(); it != authenticatingUsers_.end(); ++it)
+                if (it->user.lock() == user)
+                    return;
+            authenticatingUsers_.push_back(PendingLogin(user));
+            return;
+        }
+    ::LogWarning("Server::DeferLogin: unknown user connection.");
+}
+
+void Server::CompleteLogin(UserConnection *connection, bool authenticated, const QString &reason)
+{
+    for(PendingLoginList::iterator it = authenticatingUsers_.begin(); it != authenticatingUsers_.end(); ++it)
+    {
+        UserConnectionPtr user = it->user.lock();
+        if (!user || user.get() != connection)
+            continue;
+        authenticatingUsers_.erase(it);
+        if (authenticated)
+            QueueForAdmission(user);
+        else
+            DenyLogin(user, reason);
+        return;
+    }
+    ::LogWarning("Server::CompleteLogin: the login of the user connection is not waiting for authentication.");
+}
+
+void Server::DenyLogin(const UserConnectionPtr &user, const QString &reason)
+{
+    ::LogInfo("User with connection ID " + QString::number(user->userID) + " was denied access.");
+    user->properties["authenticated"] = false;
+    MsgLoginReply reply;
+    reply.success = 0;
+    reply.userID = 0;
+    QByteArray responseByteData = reason.toAscii();
+    reply.loginReplyData.insert(reply.loginReplyData.end(), responseByteData.data(), responseByteData.data() + responseByteData.size());
+    user->Send(reply);
+}
+
+void Server::QueueForAdmission(const UserConnectionPtr &user)
+{
+    for(PendingLoginList::const_iterator it = admissionQueue_.begin(); it != admissionQueue_.end(); ++it)
+        if (it->user.lock() == user)
+            return;
+    admissionQueue_.push_back(PendingLogin(user));
+
+    // Tell at once a user who will not be admitted on the next frame that it is waiting in the queue
+    if (admissionsPerFrame_ > 0 && (int)admissionQueue_.size() > admissionsPerFrame_)
+        SendLoginQueuePositions();
+}
+
+void Server::SendLoginQueuePositions()
+{
+    u32 position = 0;
+    for(PendingLoginList::iterator it = admissionQueue_.begin(); it != admissionQueue_.end(); ++it)
+    {
+        UserConnectionPtr user = it->user.lock();
+        if (!user)
+            continue;
+        ++position;
+        if (position == it->sentPosition || user->protocolVersion < ProtocolLoginQueue)
+            continue;
+        it->sentPosition = position;
+
+        kNet::DataSerializer ds(16);
+        ds.AddVLE<kNet::VLE8_16_32>(position);
+        ds.AddVLE<kNet::VLE8_16_32>((u32)admissionQueue_.size());
+        user->Send(cLoginQueueMessage, ds.GetData(), ds.BytesFilled(), true, true);
+    }
+}
+
+void Server::RemovePendingLogin(UserConnection *user)
+{
+    PendingLoginList *lists[] = { &authenticatingUsers_, &admissionQueue_ };
+    for(size_t i = 0; i < 2; ++i)
+        for(PendingLoginList::iterator it = lists[i]->begin(); it != lists[i]->end();)
+        {
+            if (it->user.expired() || it->user.lock().get() == user)
+                it = lists[i]->erase(it);
+            else
+                ++it;
+        }
+}
+
+void Server::AdmitUser(const UserConnectionPtr &user)
+{
+    user->properties["authenticated"] = true;
     ::LogInfo("User with connection ID " + QString::number(user->userID) + " and protocol version " + QString::number(user->protocolVersion) + " logged in.");
     
     // Allow entityactions & EC sync from now on
@@ -417,25 +574,67 @@ bool Server::FinalizeLogin(UserConnectionPtr user)
 
     reply.loginReplyData.insert(reply.loginReplyData.end(), responseByteData.data(), responseByteData.data() + responseByteData.size());
 
-    // Send login reply, with protocol version accepted by the server appended
-    DataSerializer ds(reply.Size() + 4 + 4);
+    // Send login reply, with protocol version accepted by the server appended, followed by whether the session was
+    // resumed and the token to resume it with after a dropped connection.
+    const QByteArray resumeToken = user->syncState ? user->syncState->resumeToken.toAscii() : QByteArray();
+    DataSerializer ds(reply.Size() + 4 + 4 + 1 + 1 + resumeToken.size());
     reply.SerializeTo(ds);
     ds.AddVLE<kNet::VLE8_16_32>(user->protocolVersion); 
+    if (user->protocolVersion >= ProtocolSessionResume)
+    {
+        const bool resumed = !resumeToken.isEmpty() && user->properties["resumeToken"].toString() == user->syncState->resumeToken;
+        ds.Add<u8>(resumed ? 1 : 0);
+        ds.AddString(std::string(resumeToken.constData(), resumeToken.size()));
+    }
     user->Send(reply.messageID, reply.reliable, reply.inOrder, ds, reply.priority);
 
-    // Successful login
-    return true;
+    if (user->protocolVersion >= ProtocolAssetManifest && !framework_->HasCommandLineParameter("--noAssetManifest"))
+        SendAssetManifest(user);
+}
+
+void Server::SendAssetManifest(const UserConnectionPtr &user)
+{
+    // Only the assets the client can download itself are listed, not those of the server's local storages.
+    const AssetRefTypeList &history = framework_->Asset()->RequestHistory();
+    std::vector<std::pair<QByteArray, QByteArray> > manifest;
+    size_t numBytes = 4;
+    for(size_t i = 0; i < history.size() && manifest.size() < cMaxAssetManifestSize; ++i)
+    {
+        if (AssetAPI::ParseAssetRef(history[i].first) != AssetAPI::AssetRefExternalUrl)
+            continue;
+        manifest.push_back(std::make_pair(history[i].first.toUtf8(), history[i].second.toUtf8()));
+        numBytes += manifest.back().first.size() + manifest.back().second.size() + 8;
+    }
+    if (manifest.empty())
+        return;
+
+    std::vector<char> buffer(numBytes);
+    kNet::DataSerializer ds(&buffer[0], buffer.size());
+    ds.AddVLE<kNet::VLE8_16_32>((u32)manifest.size());
+    for(size_t i = 0; i < manifest.size(); ++i)
+    {
+        ds.AddVLE<kNet::VLE8_16_32>((u32)manifest[i].first.size());
+        ds.AddArray<u8>((const u8*)manifest[i].first.data(), (u32)manifest[i].first.size());
+        ds.AddVLE<kNet::VLE8_16_32>((u32)manifest[i].second.size());
+        ds.AddArray<u8>((const u8*)manifest[i].second.data(), (u32)manifest[i].second.size());
+    }
+    user->Send(cAssetManifestMessage, ds.GetData(), ds.BytesFilled(), true, true);
 }
 
 void Server::HandleUserDisconnected(UserConnection* user)
 {
-    // Tell everyone of the client leaving
+    RemovePendingLogin(user);
+
+    // Tell everyone of the client leaving, if it was admitted
     MsgClientLeft left;
     left.userID = user->userID;
-    foreach(const UserConnectionPtr &u, AuthenticatedUsers())
-        if (u->userID != user->userID)
-            u->Send(left);
+    if (user->properties["authenticated"].toBool() == true)
+        foreach(const UserConnectionPtr &u, AuthenticatedUsers())
+            if (u->userID != user->userID)
+                u->Send(left);
 
+    // Keep the sync state before the application code reacts to the disconnection, so that its changes are marked to it.
+    owner_->GetSyncManager()->SuspendUserSession(user);
     emit UserDisconnected(user->userID, user);
 }
 
@@ -12,6 +12,8 @@
 #include <QObject>
 #include <QVariant>
 
+#include <list>
+
 class QScriptEngine;
 
 class Framework;
@@ -84,6 +86,18 @@ public slots:
     /** @todo Rename to UserConnection or UserConnectionById. */
     UserConnectionPtr GetUserConnection(u32 connectionID) const;
 
+    /// Defers the login of a connecting user until CompleteLogin is called, f.ex. for asking an external authentication service.
+    /** Call from a handler of UserAboutToConnect. If CompleteLogin is not called in 30 seconds, the login is denied. */
+    void DeferLogin(UserConnection *connection);
+
+    /// Completes the deferred login of a user.
+    /** @param authenticated Whether the user is allowed in. An authenticated user is queued for admission to the scene.
+        @param reason Reason of the denial sent to the client, if not authenticated. */
+    void CompleteLogin(UserConnection *connection, bool authenticated, const QString &reason = "");
+
+    /// Returns the number of authenticated users waiting for admission to the scene.
+    int LoginQueueLength() const { return (int)admissionQueue_.size(); }
+
     /// Returns current sender of an action.
     /** Valid (non-null) only while an action packet is being handled. Null if it was invoked by server */
     UserConnectionPtr ActionSender() const;
@@ -95,7 +109,9 @@ public slots:
 
 signals:
     /// A user is connecting. This is your chance to deny access.
-    /** Call user->Disconnect() to deny access and kick the user out.
+    /** Set the "authenticated" property of the connection false to deny access, with the "reason" property, or call
+        user->Disconnect() to kick the user out. To authenticate asynchronously, call DeferLogin and later CompleteLogin.
+        The authenticated users are admitted to the scene at a limited rate per frame, see --loginAdmissionsPerFrame.
         @todo the connectionID parameter is unnecessary as it can be retrieved from connection. */
     void UserAboutToConnect(u32 connectionID, UserConnection* connection);
 
@@ -130,10 +146,38 @@ private slots:
 private:
     /// Handle a login message
     void HandleLogin(kNet::MessageConnection* source, const char* data, size_t numBytes);
+    /// Login of a user who waits for asynchronous authentication or admission to the scene.
+    struct PendingLogin
+    {
+        PendingLogin(const UserConnectionPtr &user_) : user(user_), time(0.0), sentPosition(0) {}
+
+        UserConnectionWeakPtr user;
+        f64 time; ///< Seconds waited for authentication.
+        u32 sentPosition; ///< Queue position last sent to the user, or 0 if none.
+    };
+    typedef std::list<PendingLogin> PendingLoginList;
+
     /// Finalize the login of a user. Allow security plugins to inspect login credentials. Return true if allowed to log in
+    /** The user is admitted to the scene later in Update, or after its authentication is completed with CompleteLogin. */
     bool FinalizeLogin(UserConnectionPtr user);
+    /// Admits an authenticated user to the scene sync and sends the login reply.
+    void AdmitUser(const UserConnectionPtr &user);
+    /// Sends the user a login reply denying access.
+    void DenyLogin(const UserConnectionPtr &user, const QString &reason);
+    /// Queues an authenticated user for admission to the scene.
+    void QueueForAdmission(const UserConnectionPtr &user);
+    /// Sends the users in the admission queue their positions, if changed since last sent.
+    void SendLoginQueuePositions();
+    /// Removes the user from the pending authentications and the admission queue.
+    void RemovePendingLogin(UserConnection *user);
+    /// Sends the user the external assets requested during the server session, for the client to prefetch.
+    void SendAssetManifest(const UserConnectionPtr &user);
 
     UserConnectionWeakPtr actionSender;
+    PendingLoginList authenticatingUsers_; ///< Users whose login was deferred to asynchronous authentication.
+    PendingLoginList admissionQueue_; ///< Authenticated users waiting for admission to the scene, in order.
+    int admissionsPerFrame_; ///< Users admitted to the scene per frame at most, 0 for no limit.
+    f64 queueFeedbackTime_; ///< Seconds since the queue positions were last sent.
     TundraLogicModule* owner_;
     Framework* framework_;
     int current_port_;
@@ -0,0 +1,197 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#include "StableHeaders.h"
+#include "SyncAssemblyContext.h"
+#include "UserConnection.h"
+#include "TundraMessages.h"
+#include "ReplicationStatistics.h"
+#include "LoggingFunctions.h"
+
+#include <kNet/DataSerializer.h>
+
+#include <QByteArray>
+
+#include "MemoryLeakCheck.h"
+
+namespace TundraLogic
+{
+
+SyncAssemblyContext::SyncAssemblyContext(bool deferred) :
+    deferred_(deferred),
+    numBytesSent_(0),
+    statistics_(0),
+    compressionThreshold_(0),
+    maxBatchSize_(0),
+    batchUser_(0),
+    numBatched_(0),
+    firstBatchedId_(0),
+    firstBatchedHeaderSize_(0)
+{
+}
+
+bool SyncAssemblyContext::IsBatchable(kNet::message_id_t id)
+{
+    switch(id)
+    {
+    case cEditEntityPropertiesMessage:
+    case cCreateEntityMessage:
+    case cCreateComponentsMessage:
+    case cCreateAttributesMessage:
+    case cEditAttributesMessage:
+    case cRemoveAttributesMessage:
+    case cRemoveComponentsMessage:
+    case cRemoveEntityMessage:
+    case cSetEntityParentMessage:
+    case cEditLatestAttributesMessage:
+        return true;
+    default:
+        return false;
+    }
+}
+
+bool SyncAssemblyContext::IsCompressible(kNet::message_id_t id)
+{
+    return IsBatchable(id) || id == cSceneSyncBatchMessage || id == cRegisterComponentTypeMessage;
+}
+
+bool SyncAssemblyContext::Compress(kNet::message_id_t id, const char *data, size_t numBytes, std::vector<char> &dst)
+{
+    const QByteArray compressed = qCompress((const uchar*)data, (int)numBytes);
+
+    char header[8];
+    kNet::DataSerializer headerDs(header, sizeof(header));
+    headerDs.AddVLE<kNet::VLE8_16_32>(id);
+    if (compressed.isEmpty() || headerDs.BytesFilled() + compressed.size() >= numBytes)
+        return false;
+
+    dst.assign(header, header + headerDs.BytesFilled());
+    dst.insert(dst.end(), compressed.constData(), compressed.constData() + compressed.size());
+    return true;
+}
+
+void SyncAssemblyContext::Send(UserConnection *user, kNet::message_id_t id, bool reliable, bool inOrder, kNet::DataSerializer &ds)
+{
+    const size_t numBytes = ds.BytesFilled();
+    numBytesSent_ += numBytes;
+    // Batched messages are recorded by their own ID, so that the statistics show what the batches consist of.
+    if (statistics_)
+        statistics_->AddMessage(ReplicationStatistics::Sent, user->ConnectionId(), id, numBytes);
+
+    // Batch entry layout: message ID, message size, message data.
+    char header[16];
+    kNet::DataSerializer headerDs(header, sizeof(header));
+    headerDs.AddVLE<kNet::VLE8_16_32>(id);
+    headerDs.AddVLE<kNet::VLE8_16_32>((u32)numBytes);
+    const size_t entrySize = headerDs.BytesFilled() + numBytes;
+
+    const bool batchable = maxBatchSize_ > 0 && reliable && inOrder && IsBatchable(id) &&
+        user->ProtocolVersion() >= ProtocolSceneSyncBatch && entrySize <= maxBatchSize_;
+    if (!batchable)
+    {
+        // Keep the order of the user's messages.
+        FlushBatch();
+        SendMessage(user, id, reliable, inOrder, ds.GetData(), numBytes);
+        return;
+    }
+
+    if (batchUser_ != user || batch_.size() + entrySize > maxBatchSize_)
+        FlushBatch();
+
+    if (numBatched_ == 0)
+    {
+        batchUser_ = user;
+        firstBatchedId_ = id;
+        firstBatchedHeaderSize_ = headerDs.BytesFilled();
+    }
+    batch_.insert(batch_.end(), header, header + headerDs.BytesFilled());
+    batch_.insert(batch_.end(), ds.GetData(), ds.GetData() + numBytes);
+    ++numBatched_;
+}
+
+void SyncAssemblyContext::FlushBatch()
+{
+    if (numBatched_ == 0)
+        return;
+
+    // A batch of one is sent as the plain message.
+    if (numBatched_ == 1)
+        SendMessage(batchUser_, firstBatchedId_, true, true, &batch_[0] + firstBatchedHeaderSize_, batch_.size() - firstBatchedHeaderSize_);
+    else
+        SendMessage(batchUser_, cSceneSyncBatchMessage, true, true, &batch_[0], batch_.size());
+
+    batch_.clear();
+    numBatched_ = 0;
+    batchUser_ = 0;
+}
+
+void SyncAssemblyContext::SendMessage(UserConnection *user, kNet::message_id_t id, bool reliable, bool inOrder, const char *data, size_t numBytes)
+{
+    if (compressionThreshold_ > 0 && numBytes >= compressionThreshold_ && reliable && IsCompressible(id) &&
+        user->ProtocolVersion() >= ProtocolCompressedMessages && Compress(id, data, numBytes, compressed_))
+    {
+        id = cCompressedMessage;
+        data = &compressed_[0];
+        numBytes = compressed_.size();
+    }
+
+    if (!deferred_)
+    {
+        user->Send(id, data, numBytes, reliable, inOrder);
+        return;
+    }
+
+    messages_.push_back(PendingMessage());
+    PendingMessage &msg = messages_.back();
+    msg.user = user;
+    msg.id = id;
+    msg.reliable = reliable;
+    msg.inOrder = inOrder;
+    msg.data.assign(data, data + numBytes);
+}
+
+void SyncAssemblyContext::Warning(const QString &msg)
+{
+    if (!deferred_)
+    {
+        LogWarning(msg);
+        return;
+    }
+    PendingLogEntry entry;
+    entry.error = false;
+    entry.msg = msg;
+    log_.push_back(entry);
+}
+
+void SyncAssemblyContext::Error(const QString &msg)
+{
+    if (!deferred_)
+    {
+        LogError(msg);
+        return;
+    }
+    PendingLogEntry entry;
+    entry.error = true;
+    entry.msg = msg;
+    log_.push_back(entry);
+}
+
+void SyncAssemblyContext::Flush()
+{
+    for(size_t i = 0; i < log_.size(); ++i)
+    {
+        if (log_[i].error)
+            LogError(log_[i].msg);
+        else
+            LogWarning(log_[i].msg);
+    }
+    log_.clear();
+
+    for(size_t i = 0; i < messages_.size(); ++i)
+    {
+        const PendingMessage &msg = messages_[i];
+        msg.user->Send(msg.id, msg.data.empty() ? 0 : &msg.data[0], msg.data.size(), msg.reliable, msg.inOrder);
+    }
+    messages_.clear();
+}
+
+}
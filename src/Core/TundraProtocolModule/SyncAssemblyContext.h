@@ -0,0 +1,131 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#pragma once
+
+#include "TundraProtocolModuleFwd.h"
+#include "TundraProtocolModuleApi.h"
+
+#include "CoreTypes.h"
+
+#include <kNetFwd.h>
+#include <kNet/Types.h>
+
+#include <QString>
+
+#include <vector>
+
+class ReplicationStatistics;
+
+namespace TundraLogic
+{
+/// Scratch buffers and outgoing messages used by SyncManager when assembling sync messages for user connections.
+/** In serial mode the messages are sent immediately. In parallel mode (see SyncManager::SetSyncThreadCount)
+    each worker thread has its own context: messages and log output are queued during the assembly phase and
+    delivered by Flush() on the main thread, as neither UserConnection::Send nor the logging functions may be
+    called from worker threads. */
+class TUNDRAPROTOCOL_MODULE_API SyncAssemblyContext
+{
+public:
+    /// Constructs the context. @param deferred Whether messages and log output are queued until Flush().
+    explicit SyncAssemblyContext(bool deferred = false);
+
+    /// Returns whether messages and log output are queued until Flush().
+    bool IsDeferred() const { return deferred_; }
+
+    /// Sends the message to the user, or queues it if the context is deferred.
+    /** If batching is enabled and the user supports ProtocolSceneSyncBatch, reliable in-order scenesync messages
+        are appended to a SceneSyncBatch message instead, which is sent when full, or by FlushBatch(). */
+    void Send(UserConnection *user, kNet::message_id_t id, bool reliable, bool inOrder, kNet::DataSerializer &ds);
+
+    /// Sets the largest SceneSyncBatch message size in bytes. 0 disables batching.
+    void SetMaxBatchSize(size_t numBytes) { maxBatchSize_ = numBytes; }
+    /// Returns the largest SceneSyncBatch message size in bytes.
+    size_t MaxBatchSize() const { return maxBatchSize_; }
+
+    /// Sets the statistics that sent messages and serialized component data are recorded to. Null disables recording.
+    void SetStatistics(ReplicationStatistics *statistics) { statistics_ = statistics; }
+    /// Returns the statistics that sent messages are recorded to, or null if recording is disabled.
+    ReplicationStatistics *Statistics() const { return statistics_; }
+
+    /// Sends the pending SceneSyncBatch message, if any. Must be called after the last message for a user has been sent.
+    void FlushBatch();
+
+    /// Returns whether the message type can be packed to a SceneSyncBatch message.
+    static bool IsBatchable(kNet::message_id_t id);
+
+    /// Sets the message size in bytes from which messages to users with ProtocolCompressedMessages are sent compressed. 0 disables compression.
+    void SetCompressionThreshold(size_t numBytes) { compressionThreshold_ = numBytes; }
+    /// Returns the message size in bytes from which messages are sent compressed.
+    size_t CompressionThreshold() const { return compressionThreshold_; }
+
+    /// Returns whether the message type can be sent as a CompressedMessage.
+    static bool IsCompressible(kNet::message_id_t id);
+
+    /// Compresses the message to CompressedMessage data: the message ID, followed by the qCompress()'d message.
+    /** @return False if compressing does not make the message smaller, in which case @c dst is not modified. */
+    static bool Compress(kNet::message_id_t id, const char *data, size_t numBytes, std::vector<char> &dst);
+
+    /// Prints a warning, or queues it if the context is deferred.
+    void Warning(const QString &msg);
+    /// Prints an error, or queues it if the context is deferred.
+    void Error(const QString &msg);
+
+    /// Prints the queued log output and sends the queued messages in the order they were queued. Call only from the main thread.
+    void Flush();
+
+    /// Returns the total number of message bytes sent or queued through this context.
+    size_t NumBytesSent() const { return numBytesSent_; }
+
+    /// Returns whether there are queued messages or log output.
+    bool HasPending() const { return !messages_.empty() || !log_.empty(); }
+
+    /// Fixed buffers for crafting messages
+    char createEntityBuffer[64 * 1024];
+    char createCompsBuffer[64 * 1024];
+    char editAttrsBuffer[64 * 1024];
+    char createAttrsBuffer[16 * 1024];
+    char attrDataBuffer[16 * 1024];
+    char attrValueBuffer[16 * 1024];
+    char removeCompsBuffer[1024];
+    char removeEntityBuffer[1024];
+    char removeAttrsBuffer[1024];
+    char latestAttrsBuffer[16 * 1024];
+    std::vector<u8> changedAttributes;
+    std::vector<u8> latestAttributes; ///< Changed latest-value-only attributes of a component, see AttributeMetadata::latestValueOnly.
+
+private:
+    /// Sends the message to the user immediately, or queues it if the context is deferred. Compresses the message if it is large enough.
+    void SendMessage(UserConnection *user, kNet::message_id_t id, bool reliable, bool inOrder, const char *data, size_t numBytes);
+
+    struct PendingMessage
+    {
+        UserConnection *user;
+        kNet::message_id_t id;
+        bool reliable;
+        bool inOrder;
+        std::vector<char> data;
+    };
+
+    struct PendingLogEntry
+    {
+        bool error;
+        QString msg;
+    };
+
+    bool deferred_;
+    size_t numBytesSent_;
+
+    ReplicationStatistics *statistics_;
+    size_t compressionThreshold_;
+    std::vector<char> compressed_; ///< Scratch buffer for compressed messages.
+    size_t maxBatchSize_;
+    UserConnection *batchUser_; ///< User of the pending batch.
+    std::vector<char> batch_; ///< Pending batch message data.
+    u32 numBatched_; ///< Number of messages in the pending batch.
+    kNet::message_id_t firstBatchedId_; ///< ID of the first message in the pending batch.
+    size_t firstBatchedHeaderSize_; ///< Size of the first message's entry header in the batch.
+    std::vector<PendingMessage> messages_;
+    std::vector<PendingLogEntry> log_;
+};
+
+}
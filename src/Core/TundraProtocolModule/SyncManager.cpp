@@ -5,6 +5,7 @@
 #include "DebugOperatorNew.h"
 
 #include "SyncManager.h"
+#include "SyncTrace.h"
 #include "TundraLogicModule.h"
 #include "Client.h"
 #include "Server.h"
@@ -16,11 +17,19 @@
 #include "EC_DynamicComponent.h"
 #include "AssetAPI.h"
 #include "IAssetStorage.h"
+#include "IAssetTransfer.h"
+#include "AssetCache.h"
+#include "BinaryAsset.h"
+#include "OgreMeshBounds.h"
 #include "AttributeMetadata.h"
+#include "AttributeQuantizer.h"
+#include "Math/Quantization.h"
 #include "LoggingFunctions.h"
 #include "Profiler.h"
+#include "MetricsRegistry.h"
 #include "EC_Placeable.h"
 #include "EC_RigidBody.h"
+#include "PhysicsWorld.h"
 #include "SceneAPI.h"
 #include "UserConnection.h"
 #include "EC_Mesh.h"
@@ -29,7 +38,15 @@
 
 #include <kNet.h>
 
+#include <QThread>
+#include <QThreadPool>
+#include <QRunnable>
+#include <QUuid>
+
+#include <algorithm>
+#include <functional>
 #include <cstring>
+#include <set>
 
 #include "MemoryLeakCheck.h"
 
@@ -38,6 +55,92 @@ namespace
 // Used to print EC mismatch warnings only once per EC.
 std::set<u32> mismatchingComponentTypes;
 
+// Outbound queue length above which a connection's update period is backed off.
+const size_t cMaxOutboundMessagesPending = 256;
+
+// Largest accepted decompressed size of a CompressedMessage.
+const u32 cMaxUncompressedMessageSize = 4 * 1024 * 1024;
+
+// Shortest interval in seconds between the sync checkpoints sent to a connection.
+const float cSyncCheckpointInterval = 0.5f;
+// Sync checkpoints kept per connection. The oldest ones cannot be resumed from, nor can the attribute edits since them be trimmed.
+const size_t cMaxSyncCheckpoints = 16;
+
+// Entities closer to the observer than this are always in its view cone.
+const float cViewConeNearDistance = 5.f;
+// View cone relevancy factor of entities directly behind the observer.
+const float cMinViewConeRelevancy = 0.1f;
+
+// Returns the view cone relevancy factor of an entity: 1 inside the cone, decreasing linearly with the angle cosine to cMinViewConeRelevancy behind the observer.
+float ViewConeRelevancy(const float3 &observerPos, const float3 &observerForward, float coneCos, const float3 &entityPos)
+{
+    float3 toEntity = entityPos - observerPos;
+    const float distance = toEntity.Normalize();
+    if (distance < cViewConeNearDistance)
+        return 1.f;
+    const float angleCos = observerForward.Dot(toEntity);
+    if (angleCos >= coneCos)
+        return 1.f;
+    return Lerp(1.f, cMinViewConeRelevancy, (coneCos - angleCos) / (coneCos + 1.f));
+}
+
+// Converts a string of an EntityAction message straight to a QString, as encoded by OnActionTriggered.
+QString ActionStringFromBuffer(const std::vector<s8> &buffer)
+{
+    return buffer.empty() ? QString() : QString::fromAscii((const char *)&buffer[0], (int)buffer.size());
+}
+
+// Width in world units of the distance rings around the observer in which the entities are sent to a progressively joining user.
+const float cProgressiveJoinRingSize = 50.f;
+// Time in seconds a progressive join waits for the client's first observer position before sending the entities without it.
+const float cProgressiveJoinObserverWait = 2.f;
+
+// Returns whether the attribute is replicated through the latest-value-only path, see AttributeMetadata::latestValueOnly.
+bool IsLatestValueOnly(IAttribute *attr)
+{
+    return attr->Metadata() && attr->Metadata()->latestValueOnly;
+}
+
+// Sync state compaction visits the entity sync states of a user in this many slices, one per network update tick.
+const size_t cNumCompactionSlices = 8;
+// Number of consecutive compaction visits an entity must be found clean on before its sync state is compacted.
+const u8 cCompactionIdleVisits = 2;
+
+// Largest number of entity action names interned per connection. Actions of further names carry their name inline.
+const u32 cMaxInternedActionNames = 256;
+
+// Orders entity action messages by entity, name and parameters, for coalescing identical actions.
+struct EntityActionLess
+{
+    bool operator()(const MsgEntityAction *a, const MsgEntityAction *b) const
+    {
+        if (a->entityId != b->entityId)
+            return a->entityId < b->entityId;
+        if (a->name != b->name)
+            return a->name < b->name;
+        if (a->parameters.size() != b->parameters.size())
+            return a->parameters.size() < b->parameters.size();
+        for(size_t i = 0; i < a->parameters.size(); ++i)
+            if (a->parameters[i].parameter != b->parameters[i].parameter)
+                return a->parameters[i].parameter < b->parameters[i].parameter;
+        return false;
+    }
+};
+
+// Number of replayed messages of a type and the time spent handling them, see SyncManager::ReplayTrace.
+struct ReplayHandlerTime
+{
+    ReplayHandlerTime() : count(0), ticks(0) {}
+    uint count;
+    kNet::tick_t ticks;
+};
+
+// Returns whether the user's client supports the optimized rigid body update message.
+bool SupportsRigidBodyMessage(UserConnection *user)
+{
+    return dynamic_cast<KNetUserConnection*>(user) != 0 || user->protocolVersion >= ProtocolWebClientRigidBodyMessage;
+}
+
 // Helper function for optimizing network transfer of position and orientation.
 void WriteOptimizedPosAndRot(kNet::DataSerializer &ds, int posSendType, const float3 &pos, int rotSendType, const float3x3 &rot)
 {
@@ -80,7 +183,8 @@ void WriteOptimizedPosAndRot(kNet::DataSerializer &ds, int posSendType, const fl
         }
 
         // Sends 10-31 bits.
-        u32 quantizedAngle = ds.AddQuantizedFloat(0, 3.141592654f, 10, angle);
+        const u32 quantizedAngle = QuantizeRange(angle, 0.f, 3.141592654f, 10);
+        ds.AppendBits(quantizedAngle, 10);
         if (quantizedAngle != 0)
             ds.AddNormalizedVector3D(axis.x, axis.y, axis.z, 11, 10);
     }
@@ -120,11 +224,11 @@ void ReadOptimizedPosAndRot(kNet::DataDeserializer &dd, int posSendType, float3
     }
     else if (rotSendType == 3)
     {
-        // Read the quantized float manually, without a call to ReadQuantizedFloat, to be able to compare the quantized bit pattern.
+        // Read the quantized angle manually, to be able to compare the quantized bit pattern.
         u32 quantizedAngle = dd.ReadBits(10);
         if (quantizedAngle != 0)
         {
-            float angle = quantizedAngle * 3.141592654f / (float)((1 << 10) - 1);
+            float angle = DequantizeRange(quantizedAngle, 0.f, 3.141592654f, 10);
             float3 axis;
             dd.ReadNormalizedVector3D(11, 10, axis.x, axis.y, axis.z);
             rot = Quat(axis, angle);
@@ -166,15 +270,356 @@ int DetectRotSendType(bool rotChanged, const float3x3 &rot)
 namespace TundraLogic
 {
 
-void SyncManager::WriteComponentFullUpdate(kNet::DataSerializer& ds, ComponentPtr comp)
+/// Assembles the sync messages of a slice of the server's users on a sync worker thread.
+class SyncAssemblyTask : public QRunnable
+{
+public:
+    SyncAssemblyTask(SyncManager *owner, SyncAssemblyContext *ctx) : owner_(owner), ctx_(ctx) {}
+
+    void run()
+    {
+        for(size_t i = 0; i < users.size(); ++i)
+        {
+            if (SupportsRigidBodyMessage(users[i]))
+                owner_->AssembleRigidBodyChanges(users[i], *ctx_);
+            owner_->AssembleSyncState(users[i], *ctx_);
+        }
+    }
+
+    std::vector<UserConnection*> users;
+
+private:
+    SyncManager *owner_;
+    SyncAssemblyContext *ctx_;
+};
+
+bool SyncManager::HasSyncedComponent(SceneSyncState *state, entity_id_t entityId, component_id_t compId)
+{
+    EntitySyncStateMap::iterator entityState = state->entities.find(entityId);
+    if (entityState == state->entities.end() || entityState->second.isNew || entityState->second.removed)
+        return false;
+    ComponentSyncStateMap::iterator compState = entityState->second.components.find(compId);
+    return compState != entityState->second.components.end() && !compState->second.isNew && !compState->second.removed && !compState->second.isInQueue;
+}
+
+void SyncManager::WriteCreateEntity(kNet::DataSerializer& ds, unsigned sceneId, Entity *entity, bool hierarchic, SceneSyncState *prototypeState, SyncAssemblyContext &ctx)
+{
+    // An instance can inherit the attributes only from a prototype the receiver already has
+    EntityPtr prototype = prototypeState ? entity->Prototype() : EntityPtr();
+    if (prototype && (!prototype->IsReplicated() || prototype->IsUnacked() || prototypeState->entities.find(prototype->Id()) == prototypeState->entities.end() ||
+        prototypeState->entities[prototype->Id()].isNew))
+        prototype.reset();
+
+    // Entity identification and flags: bit 0 is the temporary flag, bit 1 tells that the prototype entity ID follows (ProtocolPrototypeEntities)
+    ds.AddVLE<kNet::VLE8_16_32>(sceneId);
+    ds.AddVLE<kNet::VLE8_16_32>(entity->Id() & UniqueIdGenerator::LAST_REPLICATED_ID);
+    // Do not write the flags as bits to not desync the byte alignment at this point, as a lot of data potentially follows
+    ds.Add<u8>((entity->IsTemporary() ? 1 : 0) | (prototype ? 2 : 0));
+    // If hierarchic scene is supported, send parent entity ID or 0 if unparented. Note that this is a full 32bit ID to handle the unacked range if necessary
+    if (hierarchic)
+    {
+        if (entity->Parent() && entity->Parent()->IsLocal())
+            ctx.Warning("Replicated entity " + QString::number(entity->Id()) + " is parented to a local entity, can not replicate parenting properly over the network");
+
+        ds.Add<u32>(entity->Parent() ? entity->Parent()->Id() : 0);
+    }
+    if (prototype)
+        ds.Add<u32>(prototype->Id());
+    
+    const Entity::ComponentMap& components = entity->Components();
+    // Count the amount of replicated components
+    uint numReplicatedComponents = 0;
+    for (Entity::ComponentMap::const_iterator i = components.begin(); i != components.end(); ++i)
+    {
+        if (i->second->IsReplicated())
+            ++numReplicatedComponents;
+    }
+    ds.AddVLE<kNet::VLE8_16_32>(numReplicatedComponents);
+    
+    // Serialize each replicated component. With a prototype, each is preceded by a flag that tells whether it is written as overrides.
+    for (Entity::ComponentMap::const_iterator i = components.begin(); i != components.end(); ++i)
+    {
+        if (!i->second->IsReplicated())
+            continue;
+        if (!prototype)
+        {
+            WriteComponentFullUpdate(ds, i->second, ctx);
+            continue;
+        }
+        ComponentPtr prototypeComp = prototype->Component(i->second->TypeId(), i->second->Name());
+        const bool inherit = prototypeComp && prototypeComp->IsReplicated() && !i->second->SupportsDynamicAttributes() &&
+            HasSyncedComponent(prototypeState, prototype->Id(), prototypeComp->Id());
+        ds.Add<u8>(inherit ? 1 : 0);
+        if (inherit)
+            WriteComponentOverrides(ds, i->second.get(), prototypeComp.get(), ctx);
+        else
+            WriteComponentFullUpdate(ds, i->second, ctx);
+    }
+}
+
+void SyncManager::MarkReplicatedComponentsProcessed(SceneSyncState *state, Entity *entity)
+{
+    const Entity::ComponentMap& components = entity->Components();
+    for (Entity::ComponentMap::const_iterator i = components.begin(); i != components.end(); ++i)
+    {
+        if (i->second->IsReplicated())
+            state->MarkComponentProcessed(entity->Id(), i->second->Id());
+    }
+}
+
+void SyncManager::BuildSceneSnapshot()
+{
+    PROFILE(SyncManager_BuildSceneSnapshot);
+
+    ScenePtr scene = scene_.lock();
+    if (!scene)
+        return;
+
+    unsigned sceneId = 0; ///\todo Replace with proper scene ID once multiscene support is in place.
+
+    // The snapshot is a SceneSyncBatch of CreateEntity messages, in the order the entities would be streamed.
+    std::vector<char> batch;
+    sceneSnapshotEntities_.clear();
+    for(Scene::iterator iter = scene->begin(); iter != scene->end(); ++iter)
+    {
+        Entity *entity = iter->second.get();
+        if (entity->IsLocal() || entity->IsUnacked())
+            continue;
+
+        kNet::DataSerializer ds(serialContext_.createEntityBuffer, 64 * 1024);
+        // The snapshot is shared by users of all protocol versions, so the instances are written in full. The compression takes care of their repetition.
+        WriteCreateEntity(ds, sceneId, entity, true, 0, serialContext_);
+
+        char header[16];
+        kNet::DataSerializer headerDs(header, sizeof(header));
+        headerDs.AddVLE<kNet::VLE8_16_32>(cCreateEntityMessage);
+        headerDs.AddVLE<kNet::VLE8_16_32>((u32)ds.BytesFilled());
+        batch.insert(batch.end(), header, header + headerDs.BytesFilled());
+        batch.insert(batch.end(), ds.GetData(), ds.GetData() + ds.BytesFilled());
+        sceneSnapshotEntities_.push_back(entity->Id());
+    }
+
+    QByteArray compressed = qCompress(batch.empty() ? 0 : (const uchar*)&batch[0], (int)batch.size());
+
+    ++sceneSnapshotSequence_;
+    sceneSnapshot_.resize(compressed.size() + 16);
+    kNet::DataSerializer ds(sceneSnapshot_.data(), sceneSnapshot_.size());
+    ds.AddVLE<kNet::VLE8_16_32>(sceneId);
+    ds.Add<u32>(sceneSnapshotSequence_);
+    ds.AddArray<u8>((const u8*)compressed.constData(), (u32)compressed.size());
+    sceneSnapshot_.resize((int)ds.BytesFilled());
+    sceneSnapshotDirty_ = false;
+
+    LogDebug("SyncManager: Built scene snapshot " + QString::number(sceneSnapshotSequence_) + " of " + QString::number(sceneSnapshotEntities_.size()) +
+        " entities, " + QString::number(batch.size()) + " bytes, " + QString::number(sceneSnapshot_.size()) + " bytes compressed.");
+}
+
+bool SyncManager::SendSceneSnapshot(UserConnection *user)
+{
+    SceneSyncState *state = user->syncState.get();
+    if (!sceneSnapshotsEnabled_ || !state || user->ProtocolVersion() < ProtocolSceneSnapshot)
+        return false;
+
+    if (sceneSnapshotDirty_ || sceneSnapshot_.isEmpty())
+        BuildSceneSnapshot();
+
+    // The snapshot is shared by all joining users, so it can not be used if the user's sync state does not contain
+    // exactly the snapshot's entities, f.ex. when a script has rejected or delayed some of them in AboutToDirtyEntity.
+    if (state->HasPendingEntities() || state->entities.size() != sceneSnapshotEntities_.size())
+        return false;
+    for(size_t i = 0; i < sceneSnapshotEntities_.size(); ++i)
+        if (state->entities.find(sceneSnapshotEntities_[i]) == state->entities.end())
+            return false;
+
+    ScenePtr scene = scene_.lock();
+    SendPlaceholderComponentTypes(user); // The client must know the placeholder component types before it creates the components
+    user->Send(cSceneSnapshotMessage, sceneSnapshot_.constData(), sceneSnapshot_.size(), true, true);
+    if (statisticsEnabled_)
+        statistics_.AddMessage(ReplicationStatistics::Sent, user->ConnectionId(), cSceneSnapshotMessage, sceneSnapshot_.size());
+    state->bandwidthBudget.Consume(sceneSnapshot_.size());
+
+    // The user now has the snapshot's entities. Any later change is replicated to it as usual.
+    state->dirtyQueue.Clear();
+    for(size_t i = 0; i < sceneSnapshotEntities_.size(); ++i)
+    {
+        EntityPtr entity = scene->EntityById(sceneSnapshotEntities_[i]);
+        MarkReplicatedComponentsProcessed(state, entity.get());
+        state->MarkEntityProcessed(entity->Id());
+    }
+    return true;
+}
+
+void SyncManager::ProcessProgressiveJoin(UserConnection *user)
+{
+    SceneSyncState *state = user->syncState.get();
+    ScenePtr scene = scene_.lock();
+    if (!state || state->joinQueue.empty() || !scene)
+        return;
+
+    if (!state->joinQueueSorted)
+    {
+        // Wait briefly for the first observer position, so that the entities around the client go first.
+        state->joinWaitTime += updatePeriod_;
+        if (!state->observerPos.IsFinite() && state->joinWaitTime < cProgressiveJoinObserverWait)
+            return;
+        SortJoinQueue(state, scene.get());
+    }
+
+    int ring = state->joinQueue.back().first;
+    std::vector<Entity*> chain;
+    for(int numSent = 0; numSent < progressiveJoinQuota_ && !state->joinQueue.empty();)
+    {
+        // When a ring is done, re-sort the rest around the observer's current position.
+        if (state->joinQueue.back().first != ring)
+        {
+            SortJoinQueue(state, scene.get());
+            ring = state->joinQueue.back().first;
+        }
+        const entity_id_t id = state->joinQueue.back().second;
+        state->joinQueue.pop_back();
+        // Skip entities that were removed, or sent earlier as the parent of another entity.
+        if (state->joinQueuedEntities.find(id) == state->joinQueuedEntities.end())
+            continue;
+        EntityPtr entity = scene->EntityById(id);
+        if (!entity)
+        {
+            state->joinQueuedEntities.erase(id);
+            continue;
+        }
+
+        // The client can not attach an entity to a parent it does not have, so send the queued parents first.
+        chain.clear();
+        for(Entity *e = entity.get(); e && state->joinQueuedEntities.erase(e->Id()) > 0; e = e->Parent().get())
+            chain.push_back(e);
+        for(std::vector<Entity*>::reverse_iterator i = chain.rbegin(); i != chain.rend(); ++i)
+        {
+            state->MarkEntityDirty((*i)->Id());
+            if (interestManagementEnabled_)
+            {
+                EntitySyncStateMap::iterator es = state->entities.find((*i)->Id());
+                if (es != state->entities.end())
+                    ComputePriorityForEntitySyncState(state, es->second, *i);
+            }
+            ++numSent;
+        }
+    }
+}
+
+void SyncManager::UpdatePhysicsObservers(Scene *scene)
+{
+    PhysicsWorldPtr physics = scene->Subsystem<PhysicsWorld>();
+    if (!physics || physics->LodRadius() <= 0.f)
+        return;
+
+    std::vector<float3> observers;
+    UserConnectionList& users = owner_->GetServer()->UserConnections();
+    for(UserConnectionList::iterator i = users.begin(); i != users.end(); ++i)
+        if ((*i)->syncState)
+        {
+            // Freeze nothing until the positions of all users are known, so that no user sees frozen bodies.
+            const float3 &pos = (*i)->syncState->observerPos;
+            if (!pos.IsFinite())
+            {
+                physics->ClearObservers();
+                return;
+            }
+            observers.push_back(pos);
+        }
+    physics->SetObservers(observers);
+}
+
+void SyncManager::CompactSyncState(SceneSyncState *state, Scene *scene)
+{
+    PROFILE(SyncManager_CompactSyncState);
+    EntitySyncStateMap &entities = state->entities;
+    if (entities.empty())
+        return;
+
+    // On each tick only a slice of the sync state's hash buckets is visited, continuing from where the previous tick stopped.
+    const bool observerKnown = state->observerPos.IsFinite();
+    const float compactDistanceSq = syncStateCompactDistance_ * syncStateCompactDistance_;
+    const size_t numBuckets = entities.bucket_count();
+    const size_t sliceSize = std::max<size_t>(entities.size() / cNumCompactionSlices, 1);
+    size_t bucket = state->compactionCursor % numBuckets;
+    size_t numVisited = 0;
+    compactionCandidates_.clear();
+    for(size_t n = 0; n < numBuckets && numVisited < sliceSize; ++n)
+    {
+        for(EntitySyncStateMap::local_iterator it = entities.begin(bucket); it != entities.end(bucket); ++it, ++numVisited)
+        {
+            // MarkEntityDirty resets the count, so an entity that changes between the visits is kept.
+            EntitySyncState &entityState = it->second;
+            if (entityState.IsInQueue() || entityState.isNew)
+            {
+                entityState.idleCompactionVisits = 0;
+                continue;
+            }
+            if (entityState.idleCompactionVisits < cCompactionIdleVisits)
+                ++entityState.idleCompactionVisits;
+            if (entityState.idleCompactionVisits < cCompactionIdleVisits)
+                continue;
+
+            if (observerKnown)
+            {
+                EntityPtr entity = scene->EntityById(it->first);
+                EC_Placeable *placeable = entity ? entity->Component<EC_Placeable>().get() : 0;
+                if (placeable && placeable->WorldPosition().DistanceSq(state->observerPos) < compactDistanceSq)
+                    continue;
+            }
+            compactionCandidates_.push_back(it->first);
+        }
+        bucket = (bucket + 1) % numBuckets;
+    }
+    state->compactionCursor = bucket;
+
+    for(size_t i = 0; i < compactionCandidates_.size(); ++i)
+        state->CompactEntityState(compactionCandidates_[i]);
+}
+
+void SyncManager::SortJoinQueue(SceneSyncState *state, Scene *scene)
+{
+    PROFILE(SyncManager_SortJoinQueue);
+
+    const bool hasObserver = state->observerPos.IsFinite();
+    for(size_t i = 0; i < state->joinQueue.size(); ++i)
+    {
+        // Entities without a position, f.ex. scripts and environment settings, are in ring -1 which goes first.
+        // Without an observer position, the positioned entities are all in ring 0, i.e. sent in the order of their IDs.
+        int ringIndex = -1;
+        EntityPtr entity = scene->EntityById(state->joinQueue[i].second);
+        EC_Placeable *placeable = entity ? entity->Component<EC_Placeable>().get() : 0;
+        if (placeable)
+            ringIndex = hasObserver ? (int)(state->observerPos.Distance(placeable->WorldPosition()) / cProgressiveJoinRingSize) : 0;
+        state->joinQueue[i].first = ringIndex;
+    }
+    // Farthest ring and highest ID first, so that the nearest ring is taken from the back in ID order.
+    std::sort(state->joinQueue.begin(), state->joinQueue.end(), std::greater<std::pair<int, entity_id_t> >());
+    state->joinQueueSorted = true;
+}
+
+void SyncManager::WriteComponentFullUpdate(kNet::DataSerializer& ds, ComponentPtr comp, SyncAssemblyContext &ctx)
 {
     // Component identification
     ds.AddVLE<kNet::VLE8_16_32>(comp->Id() & UniqueIdGenerator::LAST_REPLICATED_ID);
     ds.AddVLE<kNet::VLE8_16_32>(comp->TypeId());
     ds.AddString(comp->Name().toStdString());
+
+    // On the server, the same component is often serialized in full for many users on the same tick, so reuse the earlier result.
+    const bool useCache = owner_->IsServer() && comp->ParentEntity() && !ctx.Statistics();
+    if (useCache)
+    {
+        const std::vector<u8> *cached = attrUpdateCache_.FindFull(comp->ParentEntity()->Id(), comp->Id());
+        if (cached)
+        {
+            ds.AddVLE<kNet::VLE8_16_32>((u32)cached->size());
+            if (!cached->empty())
+                ds.AddArray<u8>(&(*cached)[0], (u32)cached->size());
+            return;
+        }
+    }
     
     // Create a nested dataserializer for the attributes, so we can survive unknown or incompatible components
-    kNet::DataSerializer attrDs(attrDataBuffer_, 16 * 1024);
+    kNet::DataSerializer attrDs(ctx.attrDataBuffer, 16 * 1024);
     
     // Static-structured attributes
     unsigned numStaticAttrs = comp->NumStaticAttributes();
@@ -194,9 +639,224 @@ void SyncManager::WriteComponentFullUpdate(kNet::DataSerializer& ds, ComponentPt
         }
     }
     
+    if (useCache)
+        attrUpdateCache_.InsertFull(comp->ParentEntity()->Id(), comp->Id(), ctx.attrDataBuffer, attrDs.BytesFilled());
+    if (ctx.Statistics())
+        ctx.Statistics()->AddComponent(ReplicationStatistics::Sent, comp->TypeId(), attrDs.BytesFilled());
+
     // Add the attribute array to the main serializer
     ds.AddVLE<kNet::VLE8_16_32>((u32)attrDs.BytesFilled());
-    ds.AddArray<u8>((unsigned char*)attrDataBuffer_, (u32)attrDs.BytesFilled());
+    ds.AddArray<u8>((unsigned char*)ctx.attrDataBuffer, (u32)attrDs.BytesFilled());
+}
+
+void SyncManager::WriteComponentOverrides(kNet::DataSerializer& ds, IComponent *comp, IComponent *prototypeComp, SyncAssemblyContext &ctx)
+{
+    // Component identification
+    ds.AddVLE<kNet::VLE8_16_32>(comp->Id() & UniqueIdGenerator::LAST_REPLICATED_ID);
+    ds.AddVLE<kNet::VLE8_16_32>(comp->TypeId());
+    ds.AddString(comp->Name().toStdString());
+
+    // The overrides are specific to the instance, so they are not cached like the full updates.
+    const std::vector<bool> overridden = comp->OverriddenAttributes(prototypeComp);
+    const AttributeVector& attrs = comp->Attributes();
+    kNet::DataSerializer attrDs(ctx.attrDataBuffer, 16 * 1024);
+    attrDs.Add<u8>((u8)overridden.size());
+    for (size_t i = 0; i < overridden.size(); i += 8)
+    {
+        u8 bits = 0;
+        for (size_t j = i; j < i + 8 && j < overridden.size(); ++j)
+            if (overridden[j])
+                bits |= (u8)(1 << (j - i));
+        attrDs.Add<u8>(bits);
+    }
+    for (size_t i = 0; i < overridden.size(); ++i)
+        if (overridden[i])
+            attrs[i]->ToBinary(attrDs);
+
+    if (ctx.Statistics())
+        ctx.Statistics()->AddComponent(ReplicationStatistics::Sent, comp->TypeId(), attrDs.BytesFilled());
+
+    ds.AddVLE<kNet::VLE8_16_32>((u32)attrDs.BytesFilled());
+    ds.AddArray<u8>((unsigned char*)ctx.attrDataBuffer, (u32)attrDs.BytesFilled());
+}
+
+void SyncManager::WriteAttributeValue(kNet::DataSerializer& ds, IAttribute *attr, u8 attrIndex, SceneSyncState *state, entity_id_t entityId, component_id_t compId,
+    bool deltaFormat, bool quantize, bool useDeltas, SyncAssemblyContext &ctx)
+{
+    if (!deltaFormat)
+    {
+        attr->ToBinary(ds);
+        return;
+    }
+
+    if (quantize && AttributeQuantizer::IsQuantized(attr))
+    {
+        // Quantized values have a fixed size, so they can always be delta-encoded.
+        kNet::DataSerializer valueDs(ctx.attrValueBuffer, 16 * 1024);
+        AttributeQuantizer::Write(valueDs, attr);
+        const u8 *value = (const u8*)ctx.attrValueBuffer;
+        const size_t numBytes = valueDs.BytesFilled();
+
+        AttributeBaselineStore::WriteValue(ds, useDeltas ? state->baselines.Find(entityId, compId, attrIndex) : 0, value, numBytes);
+        if (useDeltas)
+            state->baselines.Set(entityId, compId, attrIndex, value, numBytes);
+        return;
+    }
+
+    if (!useDeltas || !AttributeBaselineStore::IsDeltaEncodable(attr->TypeId()))
+    {
+        ds.Add<kNet::bit>(0);
+        attr->ToBinary(ds);
+        return;
+    }
+
+    kNet::DataSerializer valueDs(ctx.attrValueBuffer, 16 * 1024);
+    attr->ToBinary(valueDs);
+    const u8 *value = (const u8*)ctx.attrValueBuffer;
+    const size_t numBytes = valueDs.BytesFilled();
+
+    AttributeBaselineStore::WriteValue(ds, state->baselines.Find(entityId, compId, attrIndex), value, numBytes);
+    state->baselines.Set(entityId, compId, attrIndex, value, numBytes);
+}
+
+bool SyncManager::ReadAttributeValue(kNet::DataDeserializer& ds, IAttribute *target, u8 attrIndex, SceneSyncState *state, entity_id_t entityId, component_id_t compId, bool deltaFormat, bool quantize)
+{
+    if (!deltaFormat)
+    {
+        target->FromBinary(ds, AttributeChange::Disconnected);
+        return true;
+    }
+
+    const bool quantized = quantize && AttributeQuantizer::IsQuantized(target);
+    if (ds.Read<kNet::bit>())
+    {
+        if (!AttributeBaselineStore::ReadDelta(ds, state->baselines.Find(entityId, compId, attrIndex), attrValue_))
+        {
+            LogWarning("Missing baseline for delta-encoded attribute " + target->Name() + " in EditAttributes message");
+            return false;
+        }
+        kNet::DataDeserializer valueDs(attrValue_.empty() ? 0 : (const char*)&attrValue_[0], attrValue_.size());
+        if (quantized)
+            AttributeQuantizer::Read(valueDs, target);
+        else
+            target->FromBinary(valueDs, AttributeChange::Disconnected);
+        state->baselines.Set(entityId, compId, attrIndex, attrValue_.empty() ? 0 : &attrValue_[0], attrValue_.size());
+        return true;
+    }
+
+    if (quantized)
+    {
+        // Keep the received bytes as the baseline, so that it matches the sender's exactly.
+        attrValue_.resize(AttributeQuantizer::NumBytes(target));
+        ds.ReadArray<u8>(&attrValue_[0], (u32)attrValue_.size());
+        kNet::DataDeserializer valueDs((const char*)&attrValue_[0], attrValue_.size());
+        AttributeQuantizer::Read(valueDs, target);
+        state->baselines.Set(entityId, compId, attrIndex, &attrValue_[0], attrValue_.size());
+        return true;
+    }
+
+    target->FromBinary(ds, AttributeChange::Disconnected);
+    if (AttributeBaselineStore::IsDeltaEncodable(target->TypeId()))
+    {
+        // The sender recorded the value it sent as the new baseline, so record the same.
+        kNet::DataSerializer valueDs(attrValueBuffer_, 16 * 1024);
+        target->ToBinary(valueDs);
+        state->baselines.Set(entityId, compId, attrIndex, (const u8*)attrValueBuffer_, valueDs.BytesFilled());
+    }
+    return true;
+}
+
+void SyncManager::WriteLatestAttributes(kNet::DataSerializer& ds, IComponent *comp, component_id_t compId, const std::vector<u8> &attrIndices, SyncAssemblyContext &ctx)
+{
+    const AttributeVector& attrs = comp->Attributes();
+    ReplicationStatistics *stats = ctx.Statistics();
+
+    // Create a nested dataserializer for the attribute data, so that the client can skip components it does not have
+    kNet::DataSerializer attrDataDs(ctx.attrDataBuffer, 16 * 1024);
+    attrDataDs.Add<u8>((u8)attrIndices.size());
+    for (size_t i = 0; i < attrIndices.size(); ++i)
+    {
+        IAttribute *attr = attrs[attrIndices[i]];
+        attrDataDs.Add<u8>(attrIndices[i]);
+        const size_t bitsBefore = attrDataDs.BitsFilled();
+        if (AttributeQuantizer::IsQuantized(attr))
+            AttributeQuantizer::Write(attrDataDs, attr);
+        else
+            attr->ToBinary(attrDataDs);
+        if (stats)
+            stats->AddAttribute(ReplicationStatistics::Sent, comp->TypeId(), attrIndices[i], attrDataDs.BitsFilled() - bitsBefore);
+    }
+    if (stats)
+        stats->AddComponent(ReplicationStatistics::Sent, comp->TypeId(), attrDataDs.BytesFilled());
+
+    ds.AddVLE<kNet::VLE8_16_32>(compId & UniqueIdGenerator::LAST_REPLICATED_ID);
+    ds.AddVLE<kNet::VLE8_16_32>((u32)attrDataDs.BytesFilled());
+    ds.AddArray<u8>((unsigned char*)ctx.attrDataBuffer, (u32)attrDataDs.BytesFilled());
+}
+
+void SyncManager::SettleLatestAttributes(UserConnection *user, Scene *scene, SyncAssemblyContext &ctx)
+{
+    unsigned sceneId = 0; ///\todo Replace with proper scene ID once multiscene support is in place.
+    SceneSyncState *state = user->syncState.get();
+
+    std::vector<LatestAttributeKey> &sent = state->latestAttributesSent;
+    std::sort(sent.begin(), sent.end());
+
+    // The last unreliable value of an attribute that did not change on this tick may have been lost, so send the current
+    // value once more reliably. Attributes that changed but were deferred by the bandwidth budget stay unsettled.
+    const std::vector<LatestAttributeKey> &unsettled = state->unsettledLatestAttributes;
+    std::vector<LatestAttributeKey> deferred;
+    size_t i = 0;
+    while (i < unsettled.size())
+    {
+        const entity_id_t entityId = unsettled[i].entityId;
+        EntitySyncStateMap::iterator entityStateIter = state->entities.find(entityId);
+        EntityPtr entity = (scene && entityStateIter != state->entities.end()) ? scene->GetEntity(entityId) : EntityPtr();
+        kNet::DataSerializer ds(ctx.latestAttrsBuffer, 16 * 1024);
+
+        while (i < unsettled.size() && unsettled[i].entityId == entityId)
+        {
+            const component_id_t compId = unsettled[i].compId;
+            ComponentPtr comp = entity ? entity->GetComponentById(compId) : ComponentPtr();
+            ComponentSyncState *compState = 0;
+            if (comp)
+            {
+                ComponentSyncStateMap::iterator compStateIter = entityStateIter->second.components.find(compId);
+                if (compStateIter != entityStateIter->second.components.end())
+                    compState = &compStateIter->second;
+            }
+
+            ctx.latestAttributes.clear();
+            for(; i < unsettled.size() && unsettled[i].entityId == entityId && unsettled[i].compId == compId; ++i)
+            {
+                const u8 attrIndex = unsettled[i].attrIndex;
+                if (!compState || std::binary_search(sent.begin(), sent.end(), unsettled[i]))
+                    continue;
+                if (compState->dirtyAttributes[attrIndex >> 3] & (1 << (attrIndex & 7)))
+                    deferred.push_back(unsettled[i]);
+                else if (attrIndex < comp->Attributes().size() && comp->Attributes()[attrIndex])
+                    ctx.latestAttributes.push_back(attrIndex);
+            }
+            if (ctx.latestAttributes.empty())
+                continue;
+
+            if (!ds.BytesFilled())
+            {
+                ds.AddVLE<kNet::VLE8_16_32>(sceneId);
+                ds.AddVLE<kNet::VLE8_16_32>(entityId & UniqueIdGenerator::LAST_REPLICATED_ID);
+                ds.Add<u32>(state->latestAttributeSequence);
+            }
+            WriteLatestAttributes(ds, comp.get(), compId, ctx.latestAttributes, ctx);
+        }
+
+        if (ds.BytesFilled())
+            ctx.Send(user, cEditLatestAttributesMessage, true, true, ds);
+    }
+
+    // Both lists are sorted and disjoint.
+    std::vector<LatestAttributeKey> nextUnsettled(sent.size() + deferred.size());
+    std::merge(sent.begin(), sent.end(), deferred.begin(), deferred.end(), nextUnsettled.begin());
+    state->unsettledLatestAttributes.swap(nextUnsettled);
 }
 
 SyncManager::SyncManager(TundraLogicModule* owner) :
@@ -209,7 +869,26 @@ SyncManager::SyncManager(TundraLogicModule* owner) :
     componentTypeSender_(0),
     prioUpdateAcc_(0.0),
     interestManagementEnabled_(false),
-    priorityUpdatePeriod_(1.f)
+    priorityUpdatePeriod_(1.f),
+    priorityNearRadius_(100.f),
+    viewConeAngle_(60.f),
+    syncThreadCount_(0),
+    syncThreadPool_(new QThreadPool(this)),
+    attributeDeltasEnabled_(true),
+    syncBatchSize_(1400),
+    compressionThreshold_(1024),
+    sceneSnapshotsEnabled_(true),
+    sceneSnapshotDirty_(true),
+    sceneSnapshotSequence_(0),
+    adaptiveUpdateRateEnabled_(true),
+    maxUpdatePeriod_(0.5f),
+    deadReckoningThreshold_(0.f),
+    progressiveJoinQuota_(0),
+    syncStateCompactDistance_(0.f),
+    changeSourceConnectionId_(0),
+    statisticsEnabled_(false),
+    sessionResumeTime_(30.f),
+    structureChanges_(0)
 {
     QStringList imArg = framework_->CommandLineParameters("--interestManagement");
     if (!imArg.empty())
@@ -218,13 +897,93 @@ SyncManager::SyncManager(TundraLogicModule* owner) :
     if (framework_->HasCommandLineParameter("--noclientphysics"))
         noClientPhysicsHandoff_ = true;
 
+    if (framework_->HasCommandLineParameter("--noAttributeDeltas"))
+        attributeDeltasEnabled_ = false;
+
+    if (framework_->HasCommandLineParameter("--noSceneSnapshots"))
+        sceneSnapshotsEnabled_ = false;
+
+    if (framework_->HasCommandLineParameter("--noAdaptiveUpdateRate"))
+        adaptiveUpdateRateEnabled_ = false;
+
+    if (framework_->HasCommandLineParameter("--syncStatistics"))
+        statisticsEnabled_ = true;
+
+    // The traffic metrics are read from the statistics.
+    MetricsRegistry *metrics = framework_->Metrics();
+    if (metrics->IsEnabled())
+    {
+        statisticsEnabled_ = true;
+        metrics->Describe("tundra_sync_bytes_total", MetricsRegistry::Counter, "Bytes of the scene sync messages sent to and received from each connection.");
+        metrics->Describe("tundra_sync_messages_total", MetricsRegistry::Counter, "Number of the scene sync messages sent to and received from each connection.");
+        connect(metrics, SIGNAL(Collect()), SLOT(CollectMetrics()));
+    }
+
     GetClientExtrapolationTime();
 
+    QStringList captureArg = framework_->CommandLineParameters("--syncCapture");
+    if (!captureArg.empty())
+        StartTraceCapture(captureArg.last());
+
+    QStringList replayArg = framework_->CommandLineParameters("--syncReplay");
+    if (!replayArg.empty())
+        replayTraceFile_ = replayArg.last();
+
+    QStringList syncBatchSizeArg = framework_->CommandLineParameters("--syncBatchSize");
+    if (!syncBatchSizeArg.empty())
+        SetSyncBatchSize(syncBatchSizeArg.last().toInt());
+
+    QStringList deadReckoningArg = framework_->CommandLineParameters("--syncDeadReckoningThreshold");
+    if (!deadReckoningArg.empty())
+        SetDeadReckoningThreshold(deadReckoningArg.last().toFloat());
+
+    QStringList progressiveJoinArg = framework_->CommandLineParameters("--syncProgressiveJoin");
+    if (!progressiveJoinArg.empty())
+        SetProgressiveJoinQuota(progressiveJoinArg.last().toInt());
+
+    QStringList compactDistanceArg = framework_->CommandLineParameters("--syncStateCompactDistance");
+    if (!compactDistanceArg.empty())
+        SetSyncStateCompactDistance(compactDistanceArg.last().toFloat());
+
+    QStringList sessionResumeArg = framework_->CommandLineParameters("--syncSessionResumeTime");
+    if (!sessionResumeArg.empty())
+        SetSessionResumeTime(sessionResumeArg.last().toFloat());
+
+    QStringList idempotentActionsArg = framework_->CommandLineParameters("--syncIdempotentActions");
+    if (!idempotentActionsArg.empty())
+        SetIdempotentActions(idempotentActionsArg.last().split(',', QString::SkipEmptyParts));
+
+    QStringList compressionThresholdArg = framework_->CommandLineParameters("--syncCompressionThreshold");
+    if (!compressionThresholdArg.empty())
+        SetCompressionThreshold(compressionThresholdArg.last().toInt());
+
+    QStringList syncThreadsArg = framework_->CommandLineParameters("--syncThreads");
+    if (!syncThreadsArg.empty())
+    {
+        bool ok = false;
+        int numThreads = syncThreadsArg.last().toInt(&ok);
+        SetSyncThreadCount(ok ? numThreads : QThread::idealThreadCount());
+    }
+
+    // Syntax: '--syncBandwidthLimit bytesPerSecond' for all connection types, or '--syncBandwidthLimit type:bytesPerSecond'.
+    foreach(const QString &limit, framework_->CommandLineParameters("--syncBandwidthLimit"))
+    {
+        const int sep = limit.indexOf(':');
+        bool ok = false;
+        const float bytesPerSecond = limit.mid(sep + 1).toFloat(&ok);
+        if (ok)
+            SetBandwidthLimit(sep >= 0 ? limit.left(sep) : QString(), bytesPerSecond);
+        else
+            LogWarning("SyncManager: Invalid --syncBandwidthLimit value " + limit);
+    }
+
     // Connect to network messages from the server
     serverConnection_ = owner_->GetClient()->ServerUserConnection();
     connect(serverConnection_.get(), SIGNAL(NetworkMessageReceived(UserConnection*, kNet::packet_id_t, kNet::message_id_t, const char *, size_t)),
         this, SLOT(HandleNetworkMessage(UserConnection*, kNet::packet_id_t, kNet::message_id_t, const char *, size_t)));
 
+    connect(owner_->GetServer().get(), SIGNAL(UserDisconnected(u32, UserConnection*)), this, SLOT(OnUserDisconnected(u32, UserConnection*)));
+
     // Connect to SceneAPI's PlaceholderComponentTypeRegistered signal
     connect(framework_->Scene(), SIGNAL(PlaceholderComponentTypeRegistered(u32, const QString&, AttributeChange::Type)),
         this, SLOT(OnPlaceholderComponentTypeRegistered(u32, const QString&, AttributeChange::Type)));
@@ -232,6 +991,12 @@ SyncManager::SyncManager(TundraLogicModule* owner) :
 
 SyncManager::~SyncManager()
 {
+    ScenePtr scene = scene_.lock();
+    if (scene)
+        scene->RemoveAttributeChangeListener(this);
+    syncThreadPool_->waitForDone();
+    for(size_t i = 0; i < workerContexts_.size(); ++i)
+        delete workerContexts_[i];
 }
 
 void SyncManager::SetPriorityUpdatePeriod(float period)
@@ -241,6 +1006,76 @@ void SyncManager::SetPriorityUpdatePeriod(float period)
         priorityUpdatePeriod_ = updatePeriod_;
 }
 
+void SyncManager::SetPriorityNearRadius(float radius)
+{
+    priorityNearRadius_ = std::max(radius, 0.f);
+    // Use cells of half the near radius, so that a near query touches a small, fixed number of cells.
+    spatialIndex_.SetCellSize(priorityNearRadius_ * 0.5f);
+}
+
+void SyncManager::SetBandwidthLimit(const QString &connectionType, float bytesPerSecond)
+{
+    bandwidthLimits_[connectionType.toLower()] = std::max(bytesPerSecond, 0.f);
+}
+
+float SyncManager::BandwidthLimit(const QString &connectionType) const
+{
+    std::map<QString, float>::const_iterator it = bandwidthLimits_.find(connectionType.toLower());
+    if (it == bandwidthLimits_.end())
+        it = bandwidthLimits_.find("");
+    return it != bandwidthLimits_.end() ? it->second : 0.f;
+}
+
+void SyncManager::SetSyncThreadCount(int count)
+{
+    syncThreadCount_ = std::max(count, 0);
+    if (syncThreadCount_ > 0)
+        syncThreadPool_->setMaxThreadCount(syncThreadCount_);
+}
+
+void SyncManager::UpdateConnectionUpdatePeriod(UserConnection *user)
+{
+    SceneSyncState *state = user->syncState.get();
+    const float maxPeriod = std::max(maxUpdatePeriod_, updatePeriod_);
+    if (!adaptiveUpdateRateEnabled_)
+    {
+        state->updatePeriod = updatePeriod_;
+        return;
+    }
+
+    // Sending more often than the client can acknowledge only grows the queues, so send at most every half round trip.
+    // Lost packets must be resent on the reliable channel, which delays everything queued after them, so back off with loss as well.
+    float target = std::max(updatePeriod_, 0.5f * user->RoundTripTime());
+    target *= 1.f + 4.f * std::min(user->PacketLossRate(), 0.5f);
+
+    float period = state->updatePeriod > 0.f ? state->updatePeriod : updatePeriod_;
+    // While messages pile up in the outbound queue, back off multiplicatively. Otherwise ease towards the target.
+    if (user->NumOutboundMessagesPending() > cMaxOutboundMessagesPending)
+        period = std::max(period * 1.5f, target);
+    else
+        period += (target - period) * 0.25f;
+    state->updatePeriod = Clamp(period, updatePeriod_, maxPeriod);
+}
+
+void SyncManager::SetMaxUpdatePeriod(float period)
+{
+    maxUpdatePeriod_ = std::max(period, 0.f);
+}
+
+void SyncManager::SetEntityDeadReckoningThreshold(entity_id_t id, float meters)
+{
+    if (meters < 0.f)
+        entityDeadReckoningThresholds_.erase(id);
+    else
+        entityDeadReckoningThresholds_[id] = meters;
+}
+
+float SyncManager::EntityDeadReckoningThreshold(entity_id_t id) const
+{
+    std::map<entity_id_t, float>::const_iterator it = entityDeadReckoningThresholds_.find(id);
+    return it != entityDeadReckoningThresholds_.end() ? it->second : deadReckoningThreshold_;
+}
+
 void SyncManager::SetUpdatePeriod(float period)
 {
     // Allow max 100fps
@@ -260,26 +1095,276 @@ void SyncManager::GetClientExtrapolationTime()
         float newExtrapTime = extrapTimeParam.first().toFloat(&ok);
         if (ok && newExtrapTime >= 0.0f)
         {
-            // First update period is always interpolation, and extrapolation time is in addition to that
-            maxLinExtrapTime_ = 1.0f + newExtrapTime / 1000.0f / updatePeriod_;
+            // First update period is always interpolation, and extrapolation time is in addition to that
+            maxLinExtrapTime_ = 1.0f + newExtrapTime / 1000.0f / updatePeriod_;
+        }
+    }
+}
+
+SceneSyncState* SyncManager::SceneState(u32 connectionId) const
+{
+    if (!owner_->IsServer())
+        return 0;
+    return SceneState(owner_->GetServer()->GetUserConnection(connectionId));
+}
+
+SceneSyncState* SyncManager::SceneState(const UserConnectionPtr &connection) const
+{
+    if (!owner_->IsServer())
+        return 0;
+    if (!connection)
+        return 0;
+    return connection->syncState.get();
+}
+
+QVariantList SyncManager::ComponentStatistics() const
+{
+    QVariantList list = statistics_.Components();
+    for(int i = 0; i < list.size(); ++i)
+    {
+        QVariantMap entry = list[i].toMap();
+        entry["typeName"] = framework_->Scene()->ComponentTypeNameForTypeId(entry["typeId"].toUInt());
+        list[i] = entry;
+    }
+    return list;
+}
+
+QVariantList SyncManager::AttributeStatistics() const
+{
+    QVariantList list = statistics_.Attributes();
+    for(int i = 0; i < list.size(); ++i)
+    {
+        QVariantMap entry = list[i].toMap();
+        entry["typeName"] = framework_->Scene()->ComponentTypeNameForTypeId(entry["typeId"].toUInt());
+        list[i] = entry;
+    }
+    return list;
+}
+
+QVariantList SyncManager::SyncStateMemoryStatistics() const
+{
+    std::vector<const SceneSyncState *> states;
+    if (owner_->IsServer())
+    {
+        UserConnectionList& users = owner_->GetServer()->UserConnections();
+        for(UserConnectionList::iterator i = users.begin(); i != users.end(); ++i)
+            if ((*i)->syncState)
+                states.push_back((*i)->syncState.get());
+    }
+    else if (serverConnection_ && serverConnection_->syncState)
+        states.push_back(serverConnection_->syncState.get());
+
+    ScenePtr scene = scene_.lock();
+    std::map<u32, std::pair<uint, qulonglong> > components; // Count and bytes by component type ID
+    uint numEntities = 0;
+    qulonglong entityBytes = 0;
+    for(size_t s = 0; s < states.size(); ++s)
+    {
+        // Approximate a hash node as two pointers and the value
+        for(EntitySyncStateMap::const_iterator i = states[s]->entities.begin(); i != states[s]->entities.end(); ++i)
+        {
+            ++numEntities;
+            entityBytes += 2 * sizeof(void *) + sizeof(EntitySyncStateMap::value_type) + i->second.dirtyQueue.capacity() * sizeof(component_id_t);
+            EntityPtr entity = scene ? scene->EntityById(i->first) : EntityPtr();
+            for(ComponentSyncStateMap::const_iterator j = i->second.components.begin(); j != i->second.components.end(); ++j)
+            {
+                ComponentPtr component = entity ? entity->ComponentById(j->first) : ComponentPtr();
+                std::pair<uint, qulonglong> &entry = components[component ? component->TypeId() : 0];
+                ++entry.first;
+                entry.second += sizeof(ComponentSyncStateMap::value_type);
+            }
+        }
+        for(CompactEntitySyncStateMap::const_iterator i = states[s]->compactEntities.begin(); i != states[s]->compactEntities.end(); ++i)
+        {
+            ++numEntities;
+            entityBytes += 2 * sizeof(void *) + sizeof(CompactEntitySyncStateMap::value_type) + i->second.capacity() * sizeof(component_id_t);
+        }
+    }
+
+    QVariantList list;
+    QVariantMap entities;
+    entities["typeName"] = "Entity";
+    entities["count"] = numEntities;
+    entities["bytes"] = entityBytes;
+    list << entities;
+    for(std::map<u32, std::pair<uint, qulonglong> >::const_iterator i = components.begin(); i != components.end(); ++i)
+    {
+        QVariantMap entry;
+        entry["typeName"] = i->first ? framework_->Scene()->ComponentTypeNameForTypeId(i->first) : QString();
+        entry["count"] = i->second.first;
+        entry["bytes"] = i->second.second;
+        list << entry;
+    }
+    return list;
+}
+
+bool SyncManager::StartTraceCapture(const QString &filename)
+{
+    StopTraceCapture();
+    shared_ptr<SyncTrace> trace = MAKE_SHARED(SyncTrace);
+    if (!trace->OpenForWriting(filename))
+    {
+        LogError("SyncManager::StartTraceCapture: Failed to create trace file " + filename + ".");
+        return false;
+    }
+    traceCapture_ = trace;
+    if (owner_->IsServer())
+        foreach(const UserConnectionPtr &user, owner_->GetServer()->AuthenticatedUsers())
+            if (user->syncState)
+                traceCapture_->WriteUserConnected(user.get());
+    LogInfo("SyncManager: Capturing received network messages to " + filename + ".");
+    return true;
+}
+
+void SyncManager::StopTraceCapture()
+{
+    if (!traceCapture_)
+        return;
+    LogInfo("SyncManager: Stopped capturing network messages to " + traceCapture_->FileName() + ".");
+    traceCapture_->Close();
+    traceCapture_.reset();
+}
+
+bool SyncManager::IsCapturingTrace() const
+{
+    return traceCapture_.get() != 0;
+}
+
+void SyncManager::CaptureNetworkMessage(UserConnection* user, kNet::packet_id_t packetId, kNet::message_id_t messageId, const char* data, size_t numBytes)
+{
+    if (traceCapture_ && user)
+        traceCapture_->WriteMessage(user->ConnectionId(), packetId, messageId, data, numBytes);
+}
+
+void SyncManager::OnUserDisconnected(u32 connectionId, UserConnection * /*user*/)
+{
+    if (traceCapture_)
+        traceCapture_->WriteUserDisconnected(connectionId);
+}
+
+void SyncManager::CollectMetrics()
+{
+    // The statistics keep the counters of the closed connections, so a server leaves them out of the metrics.
+    std::set<u32> connected;
+    const bool isServer = owner_->IsServer();
+    if (isServer)
+    {
+        const UserConnectionList &users = owner_->GetServer()->UserConnections();
+        for(UserConnectionList::const_iterator iter = users.begin(); iter != users.end(); ++iter)
+            connected.insert((*iter)->ConnectionId());
+    }
+
+    // Sent bytes, received bytes, sent messages and received messages of each connection.
+    std::map<u32, std::vector<double> > traffic;
+    const QVariantList messages = statistics_.Messages();
+    foreach(const QVariant &entry, messages)
+    {
+        const QVariantMap map = entry.toMap();
+        const u32 connectionId = map["connectionId"].toUInt();
+        if (isServer && connected.find(connectionId) == connected.end())
+            continue;
+        std::vector<double> &totals = traffic[connectionId];
+        totals.resize(4, 0.0);
+        totals[0] += map["sentBytes"].toDouble();
+        totals[1] += map["receivedBytes"].toDouble();
+        totals[2] += map["sentMessages"].toDouble();
+        totals[3] += map["receivedMessages"].toDouble();
+    }
+
+    MetricsRegistry *metrics = framework_->Metrics();
+    metrics->Clear("tundra_sync_bytes_total");
+    metrics->Clear("tundra_sync_messages_total");
+    for(std::map<u32, std::vector<double> >::const_iterator iter = traffic.begin(); iter != traffic.end(); ++iter)
+    {
+        const QString connection = MetricsRegistry::Label("connection", QString::number(iter->first));
+        metrics->Set("tundra_sync_bytes_total", iter->second[0], connection + ",direction=\"sent\"");
+        metrics->Set("tundra_sync_bytes_total", iter->second[1], connection + ",direction=\"received\"");
+        metrics->Set("tundra_sync_messages_total", iter->second[2], connection + ",direction=\"sent\"");
+        metrics->Set("tundra_sync_messages_total", iter->second[3], connection + ",direction=\"received\"");
+    }
+}
+
+QVariantMap SyncManager::ReplayTrace(const QString &filename)
+{
+    PROFILE(SyncManager_ReplayTrace);
+
+    QVariantMap results;
+    if (!owner_->IsServer() || scene_.expired())
+    {
+        LogError("SyncManager::ReplayTrace: Replaying a trace requires a running server with a scene.");
+        return results;
+    }
+    SyncTrace trace;
+    if (!trace.OpenForReading(filename))
+    {
+        LogError("SyncManager::ReplayTrace: Failed to open trace file " + filename + ".");
+        return results;
+    }
+
+    std::map<kNet::message_id_t, ReplayHandlerTime> handlerTimes;
+    std::map<u32, UserConnectionPtr> users;
+    uint numMessages = 0;
+    uint numSkipped = 0;
+    double traceSeconds = 0.0;
+
+    const kNet::tick_t replayStart = kNet::Clock::Tick();
+    SyncTrace::Record record;
+    while(trace.ReadRecord(record))
+    {
+        traceSeconds = record.time;
+        if (record.type == SyncTrace::UserConnectedRecord)
+        {
+            UserConnectionPtr user = MAKE_SHARED(SyncTraceUserConnection);
+            user->userID = record.connectionId;
+            user->protocolVersion = (NetworkProtocolVersion)record.protocolVersion;
+            user->properties = record.properties;
+            user->properties["authenticated"] = true;
+            users[record.connectionId] = user;
+            NewUserConnected(user);
+        }
+        else if (record.type == SyncTrace::UserDisconnectedRecord)
+            users.erase(record.connectionId);
+        else
+        {
+            std::map<u32, UserConnectionPtr>::const_iterator it = users.find(record.connectionId);
+            if (it == users.end())
+            {
+                ++numSkipped;
+                continue;
+            }
+            const kNet::tick_t start = kNet::Clock::Tick();
+            HandleNetworkMessage(it->second.get(), record.packetId, record.messageId, record.data.constData(), record.data.size());
+            ReplayHandlerTime &time = handlerTimes[record.messageId];
+            ++time.count;
+            time.ticks += kNet::Clock::Tick() - start;
+            ++numMessages;
         }
     }
-}
+    const double replaySeconds = kNet::Clock::SecondsSinceD(replayStart);
 
-SceneSyncState* SyncManager::SceneState(u32 connectionId) const
-{
-    if (!owner_->IsServer())
-        return 0;
-    return SceneState(owner_->GetServer()->GetUserConnection(connectionId));
-}
+    LogInfo(QString("SyncManager: Replayed %1 messages of trace %2 in %3 seconds, the trace spans %4 seconds.")
+        .arg(numMessages).arg(filename).arg(replaySeconds, 0, 'f', 3).arg(traceSeconds, 0, 'f', 3));
+    if (numSkipped > 0)
+        LogWarning("SyncManager::ReplayTrace: Skipped " + QString::number(numSkipped) + " messages of users not connected in the trace.");
 
-SceneSyncState* SyncManager::SceneState(const UserConnectionPtr &connection) const
-{
-    if (!owner_->IsServer())
-        return 0;
-    if (!connection)
-        return 0;
-    return connection->syncState.get();
+    QVariantList handlers;
+    for(std::map<kNet::message_id_t, ReplayHandlerTime>::const_iterator it = handlerTimes.begin(); it != handlerTimes.end(); ++it)
+    {
+        const double seconds = (double)it->second.ticks / (double)kNet::Clock::TicksPerSec();
+        LogInfo(QString("* Message %1: %2 handled in %3 ms, %4 us per message").arg(it->first).arg(it->second.count)
+            .arg(seconds * 1000.0, 0, 'f', 2).arg(seconds * 1e6 / it->second.count, 0, 'f', 2));
+        QVariantMap entry;
+        entry["messageId"] = (uint)it->first;
+        entry["count"] = it->second.count;
+        entry["seconds"] = seconds;
+        handlers.push_back(entry);
+    }
+
+    results["messages"] = numMessages;
+    results["seconds"] = replaySeconds;
+    results["traceSeconds"] = traceSeconds;
+    results["handlers"] = handlers;
+    return results;
 }
 
 void SyncManager::RegisterToScene(ScenePtr scene)
@@ -289,12 +1374,20 @@ void SyncManager::RegisterToScene(ScenePtr scene)
     if (previous)
     {
         disconnect(previous.get(), 0, this, 0);
+        previous->RemoveAttributeChangeListener(this);
     }
     
     serverConnection_->syncState->Clear();
     serverConnection_->syncState->SetParentScene(SceneWeakPtr(scene));
     scene_.reset();
     componentTypesFromServer_.clear();
+    spatialIndex_.Clear();
+    meshBounds_.clear();
+    sceneSnapshot_.clear();
+    sceneSnapshotEntities_.clear();
+    sceneSnapshotDirty_ = true;
+    attributeChangeLog_.Clear();
+    suspendedSessions_.clear();
     
     if (!scene)
     {
@@ -305,8 +1398,8 @@ void SyncManager::RegisterToScene(ScenePtr scene)
     scene_ = scene;
     Scene* sceneptr = scene.get();
     
-    connect(sceneptr, SIGNAL( AttributeChanged(IComponent*, IAttribute*, AttributeChange::Type) ),
-        SLOT( OnAttributeChanged(IComponent*, IAttribute*, AttributeChange::Type) ));
+    // Every attribute change in the scene passes through OnAttributeChanged, so it is called directly instead of as a slot.
+    sceneptr->AddAttributeChangeListener(this);
     connect(sceneptr, SIGNAL( AttributeAdded(IComponent*, IAttribute*, AttributeChange::Type) ),
         SLOT( OnAttributeAdded(IComponent*, IAttribute*, AttributeChange::Type) ));
     connect(sceneptr, SIGNAL( AttributeRemoved(IComponent*, IAttribute*, AttributeChange::Type) ),
@@ -319,6 +1412,10 @@ void SyncManager::RegisterToScene(ScenePtr scene)
         SLOT( OnEntityCreated(Entity*, AttributeChange::Type) ));
     connect(sceneptr, SIGNAL( EntityRemoved(Entity*, AttributeChange::Type) ),
         SLOT( OnEntityRemoved(Entity*, AttributeChange::Type) ));
+    connect(sceneptr, SIGNAL( EntitiesCreated(const EntityList &, AttributeChange::Type) ),
+        SLOT( OnEntitiesCreated(const EntityList &, AttributeChange::Type) ));
+    connect(sceneptr, SIGNAL( EntitiesRemoved(const EntityList &, AttributeChange::Type) ),
+        SLOT( OnEntitiesRemoved(const EntityList &, AttributeChange::Type) ));
     connect(sceneptr, SIGNAL( ActionTriggered(Entity *, const QString &, const QStringList &, EntityAction::ExecTypeField) ),
         SLOT( OnActionTriggered(Entity *, const QString &, const QStringList &, EntityAction::ExecTypeField)));
     connect(sceneptr, SIGNAL( EntityTemporaryStateToggled(Entity *, AttributeChange::Type) ), SLOT( OnEntityPropertiesChanged(Entity *, AttributeChange::Type) ));
@@ -330,6 +1427,10 @@ void SyncManager::HandleNetworkMessage(UserConnection* user, kNet::packet_id_t p
     if (!user || scene_.expired())
         return;
 
+    // Batches and compressed messages are recorded as the messages they consist of.
+    if (statisticsEnabled_ && messageId != cSceneSyncBatchMessage && messageId != cCompressedMessage)
+        statistics_.AddMessage(ReplicationStatistics::Received, user->ConnectionId(), messageId, numBytes);
+
     try
     {
         switch(messageId)
@@ -349,6 +1450,9 @@ void SyncManager::HandleNetworkMessage(UserConnection* user, kNet::packet_id_t p
         case cEditAttributesMessage:
             HandleEditAttributes(user, data, numBytes);
             break;
+        case cEditLatestAttributesMessage:
+            HandleEditLatestAttributes(user, data, numBytes);
+            break;
         case cRemoveAttributesMessage:
             HandleRemoveAttributes(user, data, numBytes);
             break;
@@ -373,12 +1477,24 @@ void SyncManager::HandleNetworkMessage(UserConnection* user, kNet::packet_id_t p
         case cSetEntityParentMessage:
             HandleSetEntityParent(user, data, numBytes);
             break;
+        case cSceneSyncBatchMessage:
+            HandleSceneSyncBatch(user, packetId, data, numBytes);
+            break;
+        case cSceneSnapshotMessage:
+            HandleSceneSnapshot(user, packetId, data, numBytes);
+            break;
+        case cCompressedMessage:
+            HandleCompressedMessage(user, packetId, data, numBytes);
+            break;
         case cEntityActionMessage:
             {
                 MsgEntityAction msg(data, numBytes);
                 HandleEntityAction(user, msg);
             }
             break;
+        case cEntityActionBatchMessage:
+            HandleEntityActionBatch(user, data, numBytes);
+            break;
         case cRegisterComponentTypeMessage:
             HandleRegisterComponentType(user, data, numBytes);
             break;
@@ -408,26 +1524,149 @@ void SyncManager::NewUserConnected(const UserConnectionPtr &user)
     // Connect to network messages from this user
     connect(user.get(), SIGNAL(NetworkMessageReceived(UserConnection*, kNet::packet_id_t, kNet::message_id_t, const char *, size_t)), 
         this, SLOT(HandleNetworkMessage(UserConnection*, kNet::packet_id_t, kNet::message_id_t, const char *, size_t)));
+    connect(user.get(), SIGNAL(NetworkMessageReceived(UserConnection*, kNet::packet_id_t, kNet::message_id_t, const char *, size_t)), 
+        this, SLOT(CaptureNetworkMessage(UserConnection*, kNet::packet_id_t, kNet::message_id_t, const char *, size_t)));
+    if (traceCapture_)
+        traceCapture_->WriteUserConnected(user.get());
+
+    if (owner_->IsServer() && ResumeUserSession(user))
+        return;
 
     // Mark all entities in the sync state as new so we will send them
     user->syncState = MAKE_SHARED(SceneSyncState, user->ConnectionId(), owner_->IsServer());
     user->syncState->SetParentScene(scene_);
+    user->syncState->SetBandwidthLimit(BandwidthLimit(user->ConnectionType()));
+    // The entities are sent in full, so the attribute edits recorded so far are not needed.
+    user->syncState->attributeChangeVersion = attributeChangeLog_.Version();
+    if (owner_->IsServer() && sessionResumeTime_ > 0.f && user->ProtocolVersion() >= ProtocolSessionResume)
+        user->syncState->resumeToken = QUuid::createUuid().toString();
 
     if (owner_->IsServer())
         emit SceneStateCreated(user.get(), user->syncState.get());
 
+    // A progressively joining user is sent the entities in SyncManager::ProcessProgressiveJoin.
+    const bool progressiveJoin = owner_->IsServer() && progressiveJoinQuota_ > 0;
     for(Scene::iterator iter = scene->begin(); iter != scene->end(); ++iter)
     {
         EntityPtr entity = iter->second;
         if (entity->IsLocal())
             continue;
+        if (progressiveJoin)
+        {
+            user->syncState->joinQueue.push_back(std::make_pair(0, entity->Id()));
+            user->syncState->joinQueuedEntities.insert(entity->Id());
+            if (interestManagementEnabled_)
+                UpdateSpatialIndex(entity.get());
+            continue;
+        }
         user->syncState->MarkEntityDirty(entity->Id());
         if (interestManagementEnabled_)
         {
+            UpdateSpatialIndex(entity.get());
             // MarkEntityDirty() above has created the EntitySyncState.
             ComputePriorityForEntitySyncState(user->syncState.get(), user->syncState->entities[entity->Id()], entity.get());
         }
     }
+
+    // Send the scene in one compressed transfer instead of streaming the CreateEntity messages, if the user supports it.
+    if (owner_->IsServer())
+        SendSceneSnapshot(user.get());
+}
+
+void SyncManager::SuspendUserSession(UserConnection *user)
+{
+    if (!owner_->IsServer() || !user || !user->syncState || user->syncState->resumeToken.isEmpty() || sessionResumeTime_ <= 0.f)
+        return;
+    // Nothing has been received from the last checkpoints on, or none has been sent yet.
+    if (user->syncState->checkpoints.empty())
+        return;
+
+    SuspendedSession session;
+    session.state = user->syncState;
+    session.timeLeft = sessionResumeTime_;
+    session.structureChanges = structureChanges_;
+    // The actions of the session are not delivered later.
+    session.state->queuedActions.clear();
+    suspendedSessions_[session.state->resumeToken] = session;
+}
+
+bool SyncManager::ResumeUserSession(const UserConnectionPtr &user)
+{
+    const QString token = user->properties["resumeToken"].toString();
+    if (token.isEmpty())
+        return false;
+    SuspendedSessionMap::iterator iter = suspendedSessions_.find(token);
+    if (iter == suspendedSessions_.end())
+        return false;
+    SuspendedSession session = iter->second;
+    suspendedSessions_.erase(iter);
+
+    shared_ptr<SceneSyncState> state = session.state;
+    const u32 received = user->properties["resumeCheckpoint"].toUInt();
+    std::deque<SyncCheckpoint>::const_iterator checkpoint = state->checkpoints.begin();
+    while(checkpoint != state->checkpoints.end() && checkpoint->number != received)
+        ++checkpoint;
+    if (checkpoint == state->checkpoints.end() || checkpoint->structureChanges != session.structureChanges)
+    {
+        LogInfo("SyncManager: Cannot resume the session of user " + QString::number(user->ConnectionId()) + ", sending the whole scene.");
+        return false;
+    }
+
+    // The attribute edits sent after the checkpoint may have been lost with the connection, so they are sent again.
+    // The client forgets its baselines and interned action names on resuming, as they may have been updated by lost messages.
+    state->attributeChangeVersion = checkpoint->attributeChangeVersion;
+    state->checkpoints.clear();
+    state->checkpointAcc = 0.f;
+    state->baselines.Clear();
+    state->sentActionNames.clear();
+    state->latestAttributesSent.clear();
+    state->updatePeriod = 0.f;
+    state->updateAcc = 0.f;
+    state->SetUserConnectionID(user->ConnectionId());
+    state->SetBandwidthLimit(BandwidthLimit(user->ConnectionType()));
+    user->syncState = state;
+
+    LogInfo("SyncManager: Resumed the session of user " + QString::number(user->ConnectionId()) + ".");
+    return true;
+}
+
+void SyncManager::SendSyncCheckpoint(UserConnection *user)
+{
+    SceneSyncState *state = user->syncState.get();
+    if (state->resumeToken.isEmpty())
+        return;
+    state->checkpointAcc += updatePeriod_;
+    if (state->checkpointAcc < cSyncCheckpointInterval)
+        return;
+    // A checkpoint covers everything marked to the sync state so far. Also, if the connection is not keeping up, the
+    // client would probably not receive it, and would be left to resume from one of the checkpoints already sent.
+    if (!state->dirtyQueue.Empty() || !state->joinQueue.empty() || user->NumOutboundMessagesPending() > 0)
+        return;
+    if (!state->checkpoints.empty() && state->checkpoints.back().attributeChangeVersion == state->attributeChangeVersion &&
+        state->checkpoints.back().structureChanges == structureChanges_)
+        return; // Nothing new since the previous one.
+    state->checkpointAcc = 0.f;
+
+    state->checkpoints.push_back(SyncCheckpoint(++state->lastCheckpoint, state->attributeChangeVersion, structureChanges_));
+    if (state->checkpoints.size() > cMaxSyncCheckpoints)
+        state->checkpoints.pop_front();
+
+    kNet::DataSerializer ds(8);
+    ds.AddVLE<kNet::VLE8_16_32>(state->lastCheckpoint);
+    user->Send(cSyncCheckpointMessage, ds.GetData(), ds.BytesFilled(), true, true);
+}
+
+void SyncManager::ExpireSuspendedSessions(float elapsed)
+{
+    SuspendedSessionMap::iterator iter = suspendedSessions_.begin();
+    while(iter != suspendedSessions_.end())
+    {
+        iter->second.timeLeft -= elapsed;
+        if (iter->second.timeLeft <= 0.f)
+            suspendedSessions_.erase(iter++);
+        else
+            ++iter;
+    }
 }
 
 void SyncManager::OnAttributeChanged(IComponent* comp, IAttribute* attr, AttributeChange::Type change)
@@ -435,6 +1674,7 @@ void SyncManager::OnAttributeChanged(IComponent* comp, IAttribute* attr, Attribu
     assert(comp && attr);
     if (!comp || !attr)
         return;
+    sceneSnapshotDirty_ = true;
 
     bool isServer = owner_->IsServer();
     
@@ -450,6 +1690,15 @@ void SyncManager::OnAttributeChanged(IComponent* comp, IAttribute* attr, Attribu
         }
     }
     
+    // Server: keep the interest management spatial index up to date with placeable movement.
+    // The Transform of an EC_Placeable is the first attribute in the component.
+    if (isServer && interestManagementEnabled_ && attr->Index() == 0 && comp->TypeId() == EC_Placeable::TypeIdStatic())
+        UpdateSpatialIndex(comp->ParentEntity());
+
+    // Any serialized payload of this component is now stale.
+    if (isServer && !attrUpdateCache_.Empty() && comp->ParentEntity())
+        attrUpdateCache_.Invalidate(comp->ParentEntity()->Id(), comp->Id());
+
     // Is this change even supposed to go to the network?
     if (change != AttributeChange::Replicate || comp->IsLocal())
         return;
@@ -460,14 +1709,9 @@ void SyncManager::OnAttributeChanged(IComponent* comp, IAttribute* attr, Attribu
     
     if (isServer)
     {
-        // For each client connected to this server, mark this attribute dirty, so it will be updated to the
-        // clients on the next network sync iteration.
-        UserConnectionList& users = owner_->GetServer()->UserConnections();
-        for(UserConnectionList::iterator i = users.begin(); i != users.end(); ++i)
-        {
-            if ((*i)->syncState)
-                (*i)->syncState->MarkAttributeDirty(entity->Id(), comp->Id(), attr->Index());
-        }
+        // Record the change once. It is marked dirty to each client's sync state when the client's next update
+        // is assembled, so the cost of a change does not grow with the number of clients.
+        attributeChangeLog_.Record(entity->Id(), comp->Id(), attr->Index(), changeSourceConnectionId_);
     }
     else
     {
@@ -482,6 +1726,7 @@ void SyncManager::OnAttributeAdded(IComponent* comp, IAttribute* attr, Attribute
     assert(comp && attr);
     if (!comp || !attr)
         return;
+    sceneSnapshotDirty_ = true;
 
     bool isServer = owner_->IsServer();
     
@@ -496,9 +1741,12 @@ void SyncManager::OnAttributeAdded(IComponent* comp, IAttribute* attr, Attribute
     
     if (isServer)
     {
+        ++structureChanges_;
         UserConnectionList& users = owner_->GetServer()->UserConnections();
         for(UserConnectionList::iterator i = users.begin(); i != users.end(); ++i)
             if ((*i)->syncState) (*i)->syncState->MarkAttributeCreated(entity->Id(), comp->Id(), attr->Index());
+        for(SuspendedSessionMap::iterator i = suspendedSessions_.begin(); i != suspendedSessions_.end(); ++i)
+            i->second.state->MarkAttributeCreated(entity->Id(), comp->Id(), attr->Index());
     }
     else
     {
@@ -511,6 +1759,7 @@ void SyncManager::OnAttributeRemoved(IComponent* comp, IAttribute* attr, Attribu
     assert(comp && attr);
     if (!comp || !attr)
         return;
+    sceneSnapshotDirty_ = true;
 
     bool isServer = owner_->IsServer();
     
@@ -525,9 +1774,13 @@ void SyncManager::OnAttributeRemoved(IComponent* comp, IAttribute* attr, Attribu
     
     if (isServer)
     {
+        attributeChangeLog_.Forget(entity->Id(), comp->Id(), attr->Index());
+        ++structureChanges_;
         UserConnectionList& users = owner_->GetServer()->UserConnections();
         for(UserConnectionList::iterator i = users.begin(); i != users.end(); ++i)
             if ((*i)->syncState) (*i)->syncState->MarkAttributeRemoved(entity->Id(), comp->Id(), attr->Index());
+        for(SuspendedSessionMap::iterator i = suspendedSessions_.begin(); i != suspendedSessions_.end(); ++i)
+            i->second.state->MarkAttributeRemoved(entity->Id(), comp->Id(), attr->Index());
     }
     else
     {
@@ -540,6 +1793,7 @@ void SyncManager::OnComponentAdded(Entity* entity, IComponent* comp, AttributeCh
     assert(entity && comp);
     if (!entity || !comp)
         return;
+    sceneSnapshotDirty_ = true;
 
     if ((change != AttributeChange::Replicate) || (comp->IsLocal()))
         return;
@@ -548,9 +1802,15 @@ void SyncManager::OnComponentAdded(Entity* entity, IComponent* comp, AttributeCh
     
     if (owner_->IsServer())
     {
+        if (interestManagementEnabled_ && comp->TypeId() == EC_Placeable::TypeIdStatic())
+            UpdateSpatialIndex(entity);
+
+        ++structureChanges_;
         UserConnectionList& users = owner_->GetServer()->UserConnections();
         for(UserConnectionList::iterator i = users.begin(); i != users.end(); ++i)
             if ((*i)->syncState) (*i)->syncState->MarkComponentDirty(entity->Id(), comp->Id());
+        for(SuspendedSessionMap::iterator i = suspendedSessions_.begin(); i != suspendedSessions_.end(); ++i)
+            i->second.state->MarkComponentDirty(entity->Id(), comp->Id());
     }
     else
     {
@@ -563,6 +1823,7 @@ void SyncManager::OnComponentRemoved(Entity* entity, IComponent* comp, Attribute
     assert(entity && comp);
     if (!entity || !comp)
         return;
+    sceneSnapshotDirty_ = true;
     if ((change != AttributeChange::Replicate) || (comp->IsLocal()))
         return;
     if (entity->IsLocal())
@@ -570,9 +1831,16 @@ void SyncManager::OnComponentRemoved(Entity* entity, IComponent* comp, Attribute
     
     if (owner_->IsServer())
     {
+        if (comp->TypeId() == EC_Placeable::TypeIdStatic())
+            spatialIndex_.Remove(entity->Id());
+        attributeChangeLog_.ForgetComponent(entity->Id(), comp->Id());
+
+        ++structureChanges_;
         UserConnectionList& users = owner_->GetServer()->UserConnections();
         for(UserConnectionList::iterator i = users.begin(); i != users.end(); ++i)
             if ((*i)->syncState) (*i)->syncState->MarkComponentRemoved(entity->Id(), comp->Id());
+        for(SuspendedSessionMap::iterator i = suspendedSessions_.begin(); i != suspendedSessions_.end(); ++i)
+            i->second.state->MarkComponentRemoved(entity->Id(), comp->Id());
     }
     else
     {
@@ -585,11 +1853,15 @@ void SyncManager::OnEntityCreated(Entity* entity, AttributeChange::Type change)
     assert(entity);
     if (!entity)
         return;
+    sceneSnapshotDirty_ = true;
     if ((change != AttributeChange::Replicate) || (entity->IsLocal()))
         return;
 
     if (owner_->IsServer())
     {
+        ++structureChanges_;
+        for(SuspendedSessionMap::iterator i = suspendedSessions_.begin(); i != suspendedSessions_.end(); ++i)
+            i->second.state->MarkEntityDirty(entity->Id());
         UserConnectionList& users = owner_->GetServer()->UserConnections();
         for(UserConnectionList::iterator i = users.begin(); i != users.end(); ++i)
         {
@@ -615,6 +1887,7 @@ void SyncManager::OnEntityRemoved(Entity* entity, AttributeChange::Type change)
     assert(entity);
     if (!entity)
         return;
+    sceneSnapshotDirty_ = true;
     if (change != AttributeChange::Replicate)
         return;
     if (entity->IsLocal())
@@ -622,9 +1895,16 @@ void SyncManager::OnEntityRemoved(Entity* entity, AttributeChange::Type change)
     
     if (owner_->IsServer())
     {
+        spatialIndex_.Remove(entity->Id());
+        entityDeadReckoningThresholds_.erase(entity->Id());
+        attributeChangeLog_.ForgetEntity(entity->Id());
+
+        ++structureChanges_;
         UserConnectionList& users = owner_->GetServer()->UserConnections();
         for(UserConnectionList::iterator i = users.begin(); i != users.end(); ++i)
             if ((*i)->syncState) (*i)->syncState->MarkEntityRemoved(entity->Id());
+        for(SuspendedSessionMap::iterator i = suspendedSessions_.begin(); i != suspendedSessions_.end(); ++i)
+            i->second.state->MarkEntityRemoved(entity->Id());
     }
     else
     {
@@ -632,6 +1912,18 @@ void SyncManager::OnEntityRemoved(Entity* entity, AttributeChange::Type change)
     }
 }
 
+void SyncManager::OnEntitiesCreated(const EntityList &entities, AttributeChange::Type change)
+{
+    for(EntityList::const_iterator it = entities.begin(); it != entities.end(); ++it)
+        OnEntityCreated(it->get(), change);
+}
+
+void SyncManager::OnEntitiesRemoved(const EntityList &entities, AttributeChange::Type change)
+{
+    for(EntityList::const_iterator it = entities.begin(); it != entities.end(); ++it)
+        OnEntityRemoved(it->get(), change);
+}
+
 void SyncManager::OnActionTriggered(Entity *entity, const QString &action, const QStringList &params, EntityAction::ExecTypeField type)
 {
     // If we are the server and the local script on this machine has requested a script to be executed on the server, it
@@ -640,6 +1932,12 @@ void SyncManager::OnActionTriggered(Entity *entity, const QString &action, const
     if (isServer && (type & EntityAction::Server) != 0)
         entity->Exec(EntityAction::Local, action, params);
 
+    // Most of the actions are local only, so do not craft a message for them.
+    const bool sendToServer = !isServer && (type & (EntityAction::Server | EntityAction::Peers)) != 0 && owner_->GetClient()->GetConnection();
+    const bool sendToPeers = isServer && (type & EntityAction::Peers) != 0;
+    if (!sendToServer && !sendToPeers)
+        return;
+
     // Craft EntityAction message.
     MsgEntityAction msg;
     msg.entityId = entity->Id();
@@ -651,22 +1949,22 @@ void SyncManager::OnActionTriggered(Entity *entity, const QString &action, const
         msg.parameters.push_back(p);
     }
 
-    if (!isServer && ((type & EntityAction::Server) != 0 || (type & EntityAction::Peers) != 0) && owner_->GetClient()->GetConnection())
+    if (sendToServer)
     {
         // send without Local flag
         msg.executionType = (u8)(type & ~EntityAction::Local);
         owner_->GetClient()->GetConnection()->Send(msg);
     }
 
-    if (isServer && (type & EntityAction::Peers) != 0)
+    if (sendToPeers)
     {
         msg.executionType = (u8)EntityAction::Local; // Propagate as local actions.
-        // On server, queue the actions and send after entity sync
-        /// \todo Making copy is inefficient, consider storing pointers
+        // On server, queue the actions and send after entity sync. All users share the same message.
+        shared_ptr<const MsgEntityAction> queued = MAKE_SHARED(MsgEntityAction, msg);
         foreach(UserConnectionPtr c, owner_->GetServer()->UserConnections())
         {
             if (c->properties["authenticated"].toBool() == true)
-                c->syncState->queuedActions.push_back(msg);
+                c->syncState->queuedActions.push_back(queued);
         }
     }
 }
@@ -700,17 +1998,21 @@ void SyncManager::OnEntityPropertiesChanged(Entity* entity, AttributeChange::Typ
     assert(entity);
     if (!entity)
         return;
+    sceneSnapshotDirty_ = true;
     if ((change != AttributeChange::Replicate) || (entity->IsLocal()))
         return;
 
     if (owner_->IsServer())
     {
+        ++structureChanges_;
         UserConnectionList& users = owner_->GetServer()->UserConnections();
         for(UserConnectionList::iterator i = users.begin(); i != users.end(); ++i)
         {
             if ((*i)->syncState)
                 (*i)->syncState->MarkEntityDirty(entity->Id(), true);
         }
+        for(SuspendedSessionMap::iterator i = suspendedSessions_.begin(); i != suspendedSessions_.end(); ++i)
+            i->second.state->MarkEntityDirty(entity->Id(), true);
     }
     else
     {
@@ -723,6 +2025,7 @@ void SyncManager::OnEntityParentChanged(Entity* entity, Entity* newParent, Attri
     assert(entity);
     if (!entity)
         return;
+    sceneSnapshotDirty_ = true;
     if ((change != AttributeChange::Replicate) || (entity->IsLocal()))
         return;
     if (newParent && newParent->IsLocal())
@@ -733,12 +2036,15 @@ void SyncManager::OnEntityParentChanged(Entity* entity, Entity* newParent, Attri
 
     if (owner_->IsServer())
     {
+        ++structureChanges_;
         UserConnectionList& users = owner_->GetServer()->UserConnections();
         for(UserConnectionList::iterator i = users.begin(); i != users.end(); ++i)
         {
             if ((*i)->syncState)
                 (*i)->syncState->MarkEntityDirty(entity->Id(), false, true);
         }
+        for(SuspendedSessionMap::iterator i = suspendedSessions_.begin(); i != suspendedSessions_.end(); ++i)
+            i->second.state->MarkEntityDirty(entity->Id(), false, true);
     }
     else
     {
@@ -781,6 +2087,11 @@ void SyncManager::ReplicateComponentType(u32 typeId, UserConnection* connection)
         ds.AddString(attrDesc.name.toStdString());
     }
 
+    // Compress once for all the users
+    std::vector<char> compressed;
+    if (compressionThreshold_ > 0 && ds.BytesFilled() >= (size_t)compressionThreshold_)
+        SyncAssemblyContext::Compress(cRegisterComponentTypeMessage, ds.GetData(), ds.BytesFilled(), compressed);
+
     if (!connection)
     {
         if (owner_->IsServer())
@@ -789,19 +2100,29 @@ void SyncManager::ReplicateComponentType(u32 typeId, UserConnection* connection)
             for(UserConnectionList::iterator i = users.begin(); i != users.end(); ++i)
             {
                 if ((*i)->ProtocolVersion() >= ProtocolCustomComponents && (*i).get() != componentTypeSender_)
-                    (*i)->Send(cRegisterComponentTypeMessage, true, true, ds);
+                    SendComponentType((*i).get(), ds, compressed);
             }
         }   
         else if (serverConnection_ && serverConnection_->ProtocolVersion() >= ProtocolCustomComponents)
-            serverConnection_->Send(cRegisterComponentTypeMessage, true, true, ds);
+            SendComponentType(serverConnection_.get(), ds, compressed);
     }
     else
     {
         if (connection->ProtocolVersion() >= ProtocolCustomComponents)
-            connection->Send(cRegisterComponentTypeMessage, true, true, ds);
+            SendComponentType(connection, ds, compressed);
     }
 }
 
+void SyncManager::SendComponentType(UserConnection* user, kNet::DataSerializer &ds, const std::vector<char> &compressed)
+{
+    if (!compressed.empty() && user->ProtocolVersion() >= ProtocolCompressedMessages)
+        user->Send(cCompressedMessage, &compressed[0], compressed.size(), true, true);
+    else
+        user->Send(cRegisterComponentTypeMessage, true, true, ds);
+    if (statisticsEnabled_)
+        statistics_.AddMessage(ReplicationStatistics::Sent, user->ConnectionId(), cRegisterComponentTypeMessage, ds.BytesFilled());
+}
+
 /// Interpolates from (pos0, vel0) to (pos1, vel1) with a C1 curve (continuous in position and velocity)
 float3 HermiteInterpolate(const float3 &pos0, const float3 &vel0, const float3 &pos1, const float3 &vel1, float t)
 {
@@ -828,6 +2149,34 @@ float3 HermiteDerivative(const float3 &pos0, const float3 &vel0, const float3 &p
     return h1 * pos0 + h2 * pos1 + h3 * vel0 + h4 * vel1;
 }
 
+/// Predicts the client-side position and velocity of a rigid body, as InterpolateRigidBodies moves it after receiving the last update.
+/** @param interpTime Time since the client received the last update, in update periods.
+    @note After maxLinExtrapTime the client hands the body off to its own physics, which is not modeled: the prediction keeps extrapolating linearly. */
+void PredictClientRigidBody(const EntitySyncState &ess, float interpTime, float interpPeriod, bool isNewtonian, float maxLinExtrapTime, float3 &pos, float3 &vel)
+{
+    if (interpTime < 1.0f)
+    {
+        if (isNewtonian)
+        {
+            pos = HermiteInterpolate(ess.predictionStartPos, ess.predictionStartVel * interpPeriod, ess.transform.pos, ess.linearVelocity * interpPeriod, interpTime);
+            vel = HermiteDerivative(ess.predictionStartPos, ess.predictionStartVel * interpPeriod, ess.transform.pos, ess.linearVelocity * interpPeriod, interpTime);
+        }
+        else
+        {
+            pos = HermiteInterpolate(ess.predictionStartPos, float3::zero, ess.transform.pos, float3::zero, interpTime);
+            vel = float3::zero;
+        }
+    }
+    else
+    {
+        if (isNewtonian && maxLinExtrapTime > 1.0f)
+            pos = ess.transform.pos + ess.linearVelocity * (interpTime - 1.f) * interpPeriod;
+        else
+            pos = ess.transform.pos;
+        vel = isNewtonian ? ess.linearVelocity : float3::zero;
+    }
+}
+
 void SyncManager::InterpolateRigidBodies(f64 frametime, SceneSyncState* state)
 {
     ScenePtr scene = scene_.lock();
@@ -948,6 +2297,16 @@ void SyncManager::Update(f64 frametime)
     if (!owner_->IsServer())
         InterpolateRigidBodies(frametime, serverConnection_->syncState.get());
 
+    // Replay the trace given on the command line as soon as the server scene exists, then exit.
+    if (!replayTraceFile_.isEmpty() && owner_->IsServer() && !scene_.expired())
+    {
+        const QString filename = replayTraceFile_;
+        replayTraceFile_.clear();
+        ReplayTrace(filename);
+        framework_->Exit();
+        return;
+    }
+
     // Check if it is yet time to perform a network update tick.
     updateAcc_ += (float)frametime;
     prioUpdateAcc_ += (float)frametime;
@@ -964,33 +2323,100 @@ void SyncManager::Update(f64 frametime)
     if (owner_->IsServer())
     {
         // If we are server, process all authenticated users
+        // Serialized attribute payloads are shared by all users only within this tick.
+        attrUpdateCache_.Clear();
+
+        // Priorities are recomputed for every user on the same tick.
+        const bool updatePriorities = interestManagementEnabled_ && prioUpdateAcc_ >= priorityUpdatePeriod_;
+        if (updatePriorities)
+            prioUpdateAcc_ = fmod(prioUpdateAcc_, priorityUpdatePeriod_);
+
+        UpdatePhysicsObservers(scene.get());
+
+        if (!suspendedSessions_.empty())
+            ExpireSuspendedSessions(updatePeriod_);
 
-        // Then send out changes to other attributes via the generic sync mechanism.
         UserConnectionList& users = owner_->GetServer()->UserConnections();
+        const bool parallel = syncThreadCount_ > 0 && users.size() > 1;
+        std::vector<UserConnection*> syncUsers;
         for(UserConnectionList::iterator i = users.begin(); i != users.end(); ++i)
             if ((*i)->syncState)
             {
+                SceneSyncState *state = (*i)->syncState.get();
+                state->bandwidthBudget.Refill(updatePeriod_);
+
+                if (!state->joinQueue.empty())
+                    ProcessProgressiveJoin((*i).get());
+
+                if (syncStateCompactDistance_ > 0.f)
+                    CompactSyncState(state, scene.get());
+
+                if (updatePriorities)
+                    ComputePrioritiesForEntitySyncStates(state);
+
+                // Slow connections are sent to less often, so that their changes are coalesced instead of queued up.
+                UpdateConnectionUpdatePeriod((*i).get());
+                state->updateAcc += updatePeriod_;
+                if (state->updateAcc + 1e-4f < state->updatePeriod)
+                    continue;
+                state->updateAcc = fmod(state->updateAcc, state->updatePeriod);
+
+                // Mark the attribute edits recorded since the user's previous update dirty.
+                attributeChangeLog_.MarkDirty(state, state->attributeChangeVersion, (*i)->ConnectionId());
+                state->attributeChangeVersion = attributeChangeLog_.Version();
+
                 // First sort the dirty queue according to priority if IM enabled
                 if (interestManagementEnabled_)
                 {
-                    if (prioUpdateAcc_ >= priorityUpdatePeriod_)
-                    {
-                        prioUpdateAcc_ = fmod(prioUpdateAcc_, priorityUpdatePeriod_);
-                        ComputePrioritiesForEntitySyncStates((*i)->syncState.get());
-                    }
                     PROFILE(SyncManager_Update_SortDirtyQueue);
-                    (*i)->syncState->dirtyQueue.sort();
+                    state->dirtyQueue.SortByPriority();
+                }
+
+                if (parallel)
+                {
+                    // Component type registrations may touch the SceneAPI, so they are sent before the parallel phase.
+                    SendPlaceholderComponentTypes((*i).get());
+                    syncUsers.push_back((*i).get());
+                    continue;
                 }
 
                 // First send out all changes to rigid bodies. Supported on desktop (kNet) clients and web clients
                 // with sufficiently high protocol version. After processing this function, the bits related to 
                 // rigid body states have been cleared, so the generic sync will not double-replicate the rigid body
                 // positions and velocities.
-                if (dynamic_pointer_cast<KNetUserConnection>(*i) || (*i)->protocolVersion >= ProtocolWebClientRigidBodyMessage)
+                if (SupportsRigidBodyMessage((*i).get()))
                     ReplicateRigidBodyChanges((*i).get());
                 // Then send out changes to other attributes via the generic sync mechanism.
                 ProcessSyncState((*i).get());
             }
+
+        if (!syncUsers.empty())
+            ProcessSyncStatesParallel(syncUsers);
+
+        // Send out the messages connections coalesce per tick.
+        for(UserConnectionList::iterator i = users.begin(); i != users.end(); ++i)
+        {
+            if ((*i)->syncState)
+                SendSyncCheckpoint((*i).get());
+            (*i)->Flush();
+        }
+
+        // Drop the attribute edits every user has caught up to. A session may be resumed from its oldest checkpoint,
+        // after which the edits since the checkpoint are sent again.
+        u32 maxChangeLag = 0;
+        for(UserConnectionList::iterator i = users.begin(); i != users.end(); ++i)
+            if ((*i)->syncState)
+            {
+                const SceneSyncState *state = (*i)->syncState.get();
+                maxChangeLag = std::max(maxChangeLag, attributeChangeLog_.Version() - state->attributeChangeVersion);
+                if (!state->checkpoints.empty())
+                    maxChangeLag = std::max(maxChangeLag, attributeChangeLog_.Version() - state->checkpoints.front().attributeChangeVersion);
+            }
+        for(SuspendedSessionMap::const_iterator i = suspendedSessions_.begin(); i != suspendedSessions_.end(); ++i)
+            maxChangeLag = std::max(maxChangeLag, attributeChangeLog_.Version() - i->second.state->checkpoints.front().attributeChangeVersion);
+        attributeChangeLog_.Trim(attributeChangeLog_.Version() - maxChangeLag);
+
+        attrUpdateCache_.Clear();
     }
     else
     {
@@ -1009,10 +2435,44 @@ void SyncManager::Update(f64 frametime)
     }
 }
 
+void SyncManager::ProcessSyncStatesParallel(const std::vector<UserConnection*> &users)
+{
+    PROFILE(SyncManager_ProcessSyncStatesParallel);
+
+    const size_t numTasks = std::min((size_t)syncThreadCount_, users.size());
+    while(workerContexts_.size() < numTasks)
+        workerContexts_.push_back(new SyncAssemblyContext(true));
+
+    // Assembly phase: the workers only read the scene and write to their own users' sync states,
+    // so the main thread must not touch either until all workers are done.
+    attrUpdateCache_.SetThreadSafe(true);
+    statistics_.SetThreadSafe(true);
+    for(size_t t = 0; t < numTasks; ++t)
+    {
+        SyncAssemblyTask *task = new SyncAssemblyTask(this, workerContexts_[t]);
+        for(size_t i = t; i < users.size(); i += numTasks)
+            task->users.push_back(users[i]);
+        syncThreadPool_->start(task); // The pool deletes the task when done.
+    }
+    syncThreadPool_->waitForDone();
+    attrUpdateCache_.SetThreadSafe(false);
+    statistics_.SetThreadSafe(false);
+
+    // Serial phase: each user's messages were queued by a single worker, so flushing the contexts keeps the per-user message order.
+    for(size_t t = 0; t < numTasks; ++t)
+        workerContexts_[t]->Flush();
+    for(size_t i = 0; i < users.size(); ++i)
+        SendQueuedActions(users[i]);
+}
+
 void SyncManager::ReplicateRigidBodyChanges(UserConnection* user)
 {
     PROFILE(SyncManager_ReplicateRigidBodyChanges);
-    
+    AssembleRigidBodyChanges(user, serialContext_);
+}
+
+void SyncManager::AssembleRigidBodyChanges(UserConnection* user, SyncAssemblyContext &ctx)
+{
     ScenePtr scene = scene_.lock();
     if (!scene)
         return;
@@ -1021,18 +2481,20 @@ void SyncManager::ReplicateRigidBodyChanges(UserConnection* user)
     kNet::DataSerializer ds(maxMessageSizeBytes);
     bool msgReliable = false;
     SceneSyncState* state = user->syncState.get();
+    const size_t bytesSentBefore = ctx.NumBytesSent();
+    ctx.SetStatistics(statisticsEnabled_ ? &statistics_ : 0);
 
-    for(std::list<EntitySyncState*>::iterator iter = state->dirtyQueue.begin(); iter != state->dirtyQueue.end(); ++iter)
+    for(EntitySyncState *iter = state->dirtyQueue.Front(); iter; iter = EntitySyncQueue::Next(iter))
     {
         const int maxRigidBodyMessageSizeBits = 350; // An update for a single rigid body can take at most this many bits. (conservative bound)
         // If we filled up this message, send it out and start crafting anothero one.
         if (maxMessageSizeBytes * 8 - (int)ds.BitsFilled() <= maxRigidBodyMessageSizeBits)
         {
-            user->Send(cRigidBodyUpdateMessage, msgReliable, true, ds);
+            ctx.Send(user, cRigidBodyUpdateMessage, msgReliable, true, ds);
             ds = kNet::DataSerializer(maxMessageSizeBytes);
             msgReliable = false;
         }
-        EntitySyncState &ess = **iter;
+        EntitySyncState &ess = *iter;
 
         if (ess.isNew || ess.removed)
             continue; // Newly created and removed entities are handled through the traditional sync mechanism.
@@ -1042,7 +2504,7 @@ void SyncManager::ReplicateRigidBodyChanges(UserConnection* user)
         if (!placeable.get())
             continue;
 
-        std::map<component_id_t, ComponentSyncState>::iterator placeableComp = ess.components.find(placeable->Id());
+        ComponentSyncStateMap::iterator placeableComp = ess.components.find(placeable->Id());
 
         bool transformDirty = false;
         if (placeableComp != ess.components.end())
@@ -1060,7 +2522,7 @@ void SyncManager::ReplicateRigidBodyChanges(UserConnection* user)
         shared_ptr<EC_RigidBody> rigidBody = e->GetComponent<EC_RigidBody>();
         if (rigidBody)
         {
-            std::map<component_id_t, ComponentSyncState>::iterator rigidBodyComp = ess.components.find(rigidBody->Id());
+            ComponentSyncStateMap::iterator rigidBodyComp = ess.components.find(rigidBody->Id());
             if (rigidBodyComp != ess.components.end())
             {
                 ComponentSyncState &rss = rigidBodyComp->second;
@@ -1099,16 +2561,34 @@ void SyncManager::ReplicateRigidBodyChanges(UserConnection* user)
         if (interestManagementEnabled_ && timeSinceLastSend < ess.ComputePrioritizedUpdateInterval(updatePeriod_))
             continue;
 
-        const float3 predictedClientSidePosition = ess.transform.pos + timeSinceLastSend * ess.linearVelocity;
         const Transform &t = placeable->transform.Get();
-        float error = t.pos.DistanceSq(predictedClientSidePosition);
-        UNREFERENCED_PARAM(error)
-        // TEST: To have the server estimate how far the client has simulated, use this.
-//        bool posChanged = transformDirty && (timeSinceLastSend > 0.2f || t.pos.DistanceSq(/*ess.transform.pos*/ predictedClientSidePosition) > 5e-5f);
         bool posChanged = transformDirty && t.pos.DistanceSq(ess.transform.pos) > 1e-3f;
         bool rotChanged = transformDirty && (t.rot.DistanceSq(ess.transform.rot) > 1e-1f);
         bool scaleChanged = transformDirty && (t.scale.DistanceSq(ess.transform.scale) > 1e-3f);
 
+        // Dead reckoning: predict where the client shows the body now, and send the position only if it is off by more than the threshold.
+        const float deadReckoningThreshold = EntityDeadReckoningThreshold(ess.id);
+        float3 predictedPos = t.pos;
+        float3 predictedVel = float3::zero;
+        if (deadReckoningThreshold > 0.f)
+        {
+            // The client starts interpolating when it receives the update, half a round trip after it was sent.
+            const float interpTime = std::max(timeSinceLastSend - 0.5f * user->RoundTripTime(), 0.f) / updatePeriod_;
+            const bool isNewtonian = rigidBody && rigidBody->mass.Get() > 0;
+            PredictClientRigidBody(ess, interpTime, updatePeriod_, isNewtonian, maxLinExtrapTime_, predictedPos, predictedVel);
+            posChanged = t.pos.DistanceSq(predictedPos) > deadReckoningThreshold * deadReckoningThreshold;
+            // Velocity changes alone are not sent: the client extrapolates with the last sent velocity until the prediction error grows.
+            // Entering rest (msgReliable) is the exception.
+            if (!posChanged && !msgReliable)
+                velocityDirty = false;
+            // Every update restarts the client's interpolation towards the last sent position, so other changes are sent with the current position.
+            if (velocityDirty || angularVelocityDirty || rotChanged || scaleChanged)
+                posChanged = true;
+            // Velocity changes may have been held back on earlier ticks: send the current velocity with the position.
+            if (posChanged && rigidBody && rigidBody->linearVelocity.Get().DistanceSq(ess.linearVelocity) >= 1e-2f)
+                velocityDirty = true;
+        }
+
         // Detect whether to send compact or full states for each variable.
         int posSendType = DetectPosSendType(posChanged, t.pos);
         int rotSendType;
@@ -1137,7 +2617,6 @@ void SyncManager::ReplicateRigidBodyChanges(UserConnection* user)
             continue;
 
         size_t bitIdx = ds.BitsFilled();
-        UNREFERENCED_PARAM(bitIdx)
         ds.AddVLE<kNet::VLE8_16_32>(ess.id); // Sends max. 32 bits.
 
         ds.AddArithmeticEncoded(8, posSendType, 3, rotSendType, 4, scaleSendType, 3, velSendType, 3, angVelSendType, 2); // Sends fixed 8 bits.
@@ -1179,12 +2658,16 @@ void SyncManager::ReplicateRigidBodyChanges(UserConnection* user)
                 angle = 2.f * 3.141592654f - angle;
             }
              // Sends at most 31 bits.
-            u32 quantizedAngle = ds.AddQuantizedFloat(0, 3.141592654f, 10, angle);
+            const u32 quantizedAngle = QuantizeRange(angle, 0.f, 3.141592654f, 10);
+            ds.AppendBits(quantizedAngle, 10);
             if (quantizedAngle != 0)
                 ds.AddNormalizedVector3D(axis.x, axis.y, axis.z, 11, 10);
 
             ess.angularVelocity = angVel;
         }
+        // The client starts interpolating from where it shows the body when the update arrives.
+        ess.predictionStartPos = predictedPos;
+        ess.predictionStartVel = predictedVel;
         if (posSendType != 0)
             ess.transform.pos = t.pos;
         if (rotSendType != 0)
@@ -1195,11 +2678,48 @@ void SyncManager::ReplicateRigidBodyChanges(UserConnection* user)
 //        std::cout << "pos: " << posSendType << ", rot: " << rotSendType << ", scale: " << scaleSendType << ", vel: " << velSendType << ", angvel: " << angVelSendType << std::endl;
 
         size_t bitsEnd = ds.BitsFilled();
-        UNREFERENCED_PARAM(bitsEnd)
+        if (ctx.Statistics())
+            ctx.Statistics()->AddComponent(ReplicationStatistics::Sent, placeable->TypeId(), (bitsEnd - bitIdx + 7) / 8);
         ess.lastNetworkSendTime = kNet::Clock::Tick();
     }
     if (ds.BytesFilled() > 0)
-        user->Send(cRigidBodyUpdateMessage, msgReliable, true, ds);
+        ctx.Send(user, cRigidBodyUpdateMessage, msgReliable, true, ds);
+
+    // Rigid body updates are small and unreliable, so they are always sent, but they use up the budget of the generic sync.
+    state->bandwidthBudget.Consume(ctx.NumBytesSent() - bytesSentBefore);
+}
+
+void SyncManager::SetLocallyPredicted(Entity *entity, bool enable)
+{
+    if (!entity || owner_->IsServer())
+        return;
+    ScenePtr scene = scene_.lock();
+    PhysicsWorldPtr world = scene ? scene->GetWorld<PhysicsWorld>() : PhysicsWorldPtr();
+    shared_ptr<EC_RigidBody> rigidBody = entity->GetComponent<EC_RigidBody>();
+    if (!world || !rigidBody)
+    {
+        LogWarning("SyncManager::SetLocallyPredicted: entity " + QString::number(entity->Id()) + " has no EC_RigidBody in a physics world.");
+        return;
+    }
+
+    if (enable)
+    {
+        world->SetDeterministic(true);
+        predictedEntities_.insert(entity->Id());
+        // The local physics drives the body from now on, not the interpolation
+        std::map<entity_id_t, RigidBodyInterpolationState>::iterator iter = serverConnection_->syncState->entityInterpolations.find(entity->Id());
+        if (iter != serverConnection_->syncState->entityInterpolations.end())
+            iter->second.interpolatorActive = false;
+    }
+    else
+        predictedEntities_.erase(entity->Id());
+    world->SetPredicted(rigidBody.get(), enable);
+    rigidBody->SetClientExtrapolating(enable);
+}
+
+bool SyncManager::IsLocallyPredicted(Entity *entity) const
+{
+    return entity && predictedEntities_.find(entity->Id()) != predictedEntities_.end();
 }
 
 void SyncManager::HandleRigidBodyChanges(UserConnection* source, kNet::packet_id_t packetId, const char* data, size_t numBytes)
@@ -1208,6 +2728,9 @@ void SyncManager::HandleRigidBodyChanges(UserConnection* source, kNet::packet_id
     if (!scene)
         return;
 
+    // Server states of the predicted bodies, which were simulated roughly a round trip ago locally
+    std::vector<PhysicsBodyCorrection> corrections;
+
     kNet::DataDeserializer dd(data, numBytes);
     while(dd.BitsLeft() >= 9)
     {
@@ -1253,11 +2776,11 @@ void SyncManager::HandleRigidBodyChanges(UserConnection* source, kNet::packet_id
 
         if (angVelSendType == 1)
         {
-            // Read the quantized float manually, without a call to ReadQuantizedFloat, to be able to compare the quantized bit pattern.
+            // Read the quantized angle manually, to be able to compare the quantized bit pattern.
             u32 quantizedAngle = dd.ReadBits(10);
             if (quantizedAngle != 0)
             {
-                float angle = quantizedAngle * 3.141592654f / (float)((1 << 10) - 1);
+                float angle = DequantizeRange(quantizedAngle, 0.f, 3.141592654f, 10);
                 float3 axis;
                 dd.ReadNormalizedVector3D(11, 10, axis.x, axis.y, axis.z);
                 Quat q(axis, angle);
@@ -1321,6 +2844,18 @@ void SyncManager::HandleRigidBodyChanges(UserConnection* source, kNet::packet_id
                 const bool isNewtonian = rigidBody && rigidBody->mass.Get() > 0;
                 if (!isNewtonian)
                     interp.interpStart.vel = interp.interpEnd.vel = float3::zero;
+
+                if (rigidBody && predictedEntities_.find(entityID) != predictedEntities_.end())
+                {
+                    interp.interpolatorActive = false;
+                    PhysicsBodyCorrection correction;
+                    correction.body = rigidBody.get();
+                    correction.state.position = interp.interpEnd.pos;
+                    correction.state.orientation = interp.interpEnd.rot;
+                    correction.state.linearVelocity = interp.interpEnd.vel;
+                    correction.state.angularVelocity = interp.interpEnd.angVel;
+                    corrections.push_back(correction);
+                }
             }
             else
             {
@@ -1338,10 +2873,28 @@ void SyncManager::HandleRigidBodyChanges(UserConnection* source, kNet::packet_id
                 interp.interpTime = 0.f;
                 interp.lastReceivedPacketCounter = packetId;
                 interp.interpolatorActive = true;
+                if (rigidBody && predictedEntities_.find(entityID) != predictedEntities_.end())
+                {
+                    interp.interpolatorActive = false;
+                    PhysicsBodyCorrection correction;
+                    correction.body = rigidBody.get();
+                    correction.state.position = t.pos;
+                    correction.state.orientation = t.Orientation();
+                    correction.state.linearVelocity = newLinearVel;
+                    correction.state.angularVelocity = newAngVel;
+                    corrections.push_back(correction);
+                }
                 serverConnection_->syncState->entityInterpolations[entityID] = interp;
             }
         }
     }
+
+    if (!corrections.empty())
+    {
+        PhysicsWorldPtr world = scene->GetWorld<PhysicsWorld>();
+        if (world && world->PhysicsUpdatePeriod() > 0.f)
+            world->CorrectPrediction(corrections, (int)(source->RoundTripTime() / world->PhysicsUpdatePeriod() + 0.5f));
+    }
 }
 
 void SyncManager::HandleEditEntityProperties(UserConnection* source, const char* data, size_t numBytes)
@@ -1384,7 +2937,7 @@ void SyncManager::HandleEditEntityProperties(UserConnection* source, const char*
     entity->SetTemporary(newTemporary, change);
     
     // Remove the properties dirty bit from sender's syncstate so that we do not echo the change back
-    state->entities[entityID].hasPropertyChanges = false;
+    state->EntityState(entityID).hasPropertyChanges = false;
 }
 
 void SyncManager::HandleSetEntityParent(UserConnection* source, const char* data, size_t numBytes)
@@ -1458,7 +3011,7 @@ void SyncManager::HandleSetEntityParent(UserConnection* source, const char* data
     entity->SetParent(parentEntity, change);
     
     // Remove the properties dirty bit from sender's syncstate so that we do not echo the change back
-    state->entities[entityID].hasParentChange = false;
+    state->EntityState(entityID).hasParentChange = false;
 }
 
 void SyncManager::HandleRegisterComponentType(UserConnection* source, const char* data, size_t numBytes)
@@ -1507,17 +3060,19 @@ void SyncManager::HandleRegisterComponentType(UserConnection* source, const char
 void SyncManager::ProcessSyncState(UserConnection* user)
 {
     PROFILE(SyncManager_ProcessSyncState);
-    
-    unsigned sceneId = 0; ///\todo Replace with proper scene ID once multiscene support is in place.
-    
-    ScenePtr scene = scene_.lock();
-    int numMessagesSent = 0; /**< @todo debug variable, can be removed (or enable only in debug build?) */
-    const bool isServer = owner_->IsServer();
-    SceneSyncState* state = user->syncState.get();
-    
+
+    SendPlaceholderComponentTypes(user);
+    AssembleSyncState(user, serialContext_);
+    SendQueuedActions(user);
+}
+
+void SyncManager::SendPlaceholderComponentTypes(UserConnection* user)
+{
     // Send knowledge of registered placeholder components to the remote peer
+    SceneSyncState* state = user->syncState.get();
     if (user->ProtocolVersion() >= ProtocolCustomComponents && state->NeedSendPlaceholderComponents())
     {
+        const bool isServer = owner_->IsServer();
         SceneAPI* sceneAPI = framework_->Scene();
         const SceneAPI::PlaceholderComponentTypeMap& descs = sceneAPI->GetPlaceholderComponentTypes();
         for (SceneAPI::PlaceholderComponentTypeMap::const_iterator i = descs.begin(); i != descs.end(); ++i)
@@ -1527,30 +3082,136 @@ void SyncManager::ProcessSyncState(UserConnection* user)
         }
         state->MarkPlaceholderComponentsSent();
     }
+}
+
+void SyncManager::SetIdempotentActions(const QStringList &names)
+{
+    idempotentActions_.clear();
+    foreach(const QString &name, names)
+        idempotentActions_.insert(StringToBuffer(name.trimmed().toStdString()));
+}
+
+QStringList SyncManager::IdempotentActions() const
+{
+    QStringList names;
+    for(std::set<std::vector<s8> >::const_iterator i = idempotentActions_.begin(); i != idempotentActions_.end(); ++i)
+        names << BufferToString(*i).c_str();
+    return names;
+}
+
+void SyncManager::SendQueuedActions(UserConnection* user)
+{
+    // Send queued entity actions after scene sync
+    SceneSyncState* state = user->syncState.get();
+    if (state->queuedActions.empty())
+        return;
+
+    // Coalesce the identical idempotent actions, keeping the first of each.
+    std::vector<const MsgEntityAction*> actions;
+    actions.reserve(state->queuedActions.size());
+    std::set<const MsgEntityAction*, EntityActionLess> coalesced;
+    for(size_t i = 0; i < state->queuedActions.size(); ++i)
+    {
+        const MsgEntityAction *action = state->queuedActions[i].get();
+        if (!idempotentActions_.empty() && idempotentActions_.find(action->name) != idempotentActions_.end() && !coalesced.insert(action).second)
+            continue;
+        actions.push_back(action);
+    }
+
+    if (user->ProtocolVersion() < ProtocolEntityActionBatch || actions.size() == 1)
+    {
+        for(size_t i = 0; i < actions.size(); ++i)
+            user->Send(*actions[i]);
+        state->queuedActions.clear();
+        return;
+    }
+
+    // Pack the actions to one EntityActionBatch message. An action name is sent once per connection and referred to by
+    // its ID afterwards. An ID above the ones the client already knows is followed by the name it introduces.
+    size_t size = 5;
+    for(size_t i = 0; i < actions.size(); ++i)
+        size += actions[i]->Size() + 8;
+    std::vector<char> buffer(size);
+    kNet::DataSerializer ds(&buffer[0], buffer.size());
+    ds.AddVLE<kNet::VLE8_16_32>((u32)actions.size());
+    for(size_t i = 0; i < actions.size(); ++i)
+    {
+        const MsgEntityAction &action = *actions[i];
+        ds.Add<u32>(action.entityId);
+
+        std::map<std::vector<s8>, u32>::const_iterator nameIter = state->sentActionNames.find(action.name);
+        if (nameIter != state->sentActionNames.end())
+            ds.AddVLE<kNet::VLE8_16_32>(nameIter->second);
+        else
+        {
+            // ID 0 carries the name inline once the connection's name table is full.
+            u32 nameId = 0;
+            if (state->sentActionNames.size() < cMaxInternedActionNames)
+            {
+                nameId = (u32)state->sentActionNames.size() + 1;
+                state->sentActionNames[action.name] = nameId;
+            }
+            ds.AddVLE<kNet::VLE8_16_32>(nameId);
+            ds.Add<u8>((u8)action.name.size());
+            if (action.name.size() > 0)
+                ds.AddArray<s8>(&action.name[0], (u32)action.name.size());
+        }
+
+        ds.Add<u8>((u8)action.parameters.size());
+        for(size_t j = 0; j < action.parameters.size(); ++j)
+            action.parameters[j].SerializeTo(ds);
+    }
+    user->Send(cEntityActionBatchMessage, true, true, ds);
+    state->queuedActions.clear();
+}
+
+void SyncManager::AssembleSyncState(UserConnection* user, SyncAssemblyContext &ctx)
+{
+    unsigned sceneId = 0; ///\todo Replace with proper scene ID once multiscene support is in place.
+    
+    ScenePtr scene = scene_.lock();
+    int numMessagesSent = 0; /**< @todo debug variable, can be removed (or enable only in debug build?) */
+    const bool isServer = owner_->IsServer();
+    SceneSyncState* state = user->syncState.get();
 
     // Interest management sync priorization performed only on the server
     const bool serverImEnabled = (isServer && interestManagementEnabled_);
 
-    // Process the state's dirty entity queue.
-    std::list<EntitySyncState*>::iterator it = state->dirtyQueue.begin();
-    while(it != state->dirtyQueue.end())
+    // Pack the reliable messages to SceneSyncBatch messages, if the user supports them (server only)
+    ctx.SetMaxBatchSize(isServer ? (size_t)syncBatchSize_ : 0);
+    ctx.SetStatistics(statisticsEnabled_ ? &statistics_ : 0);
+    ctx.SetCompressionThreshold((size_t)compressionThreshold_);
+
+    // Edits of latest-value-only attributes are sent unreliably, stamped with the number of the tick (server only)
+    const bool latestValues = isServer && user->ProtocolVersion() >= ProtocolLatestValueAttributes;
+    if (latestValues)
+    {
+        ++state->latestAttributeSequence;
+        state->latestAttributesSent.clear();
+    }
+
+    // Process the state's dirty entity queue, until the connection's bandwidth budget for this tick runs out.
+    // The rest of the queue is deferred to the following ticks.
+    const size_t bytesSentBefore = ctx.NumBytesSent();
+    EntitySyncState *it = state->dirtyQueue.Front();
+    while(it && state->bandwidthBudget.HasBudget(ctx.NumBytesSent() - bytesSentBefore))
     {
-        EntitySyncState& entityState = **it;
+        EntitySyncState& entityState = *it;
+        EntitySyncState *next = EntitySyncQueue::Next(it);
         // See if we need to sync yet.
         float timeSinceLastSend = kNet::Clock::SecondsSinceF(entityState.lastNetworkSendTime);
         if (serverImEnabled && timeSinceLastSend < entityState.ComputePrioritizedUpdateInterval(updatePeriod_))
         {
-            ++it;
+            it = next;
             continue;
         }
 
-        entityState.isInQueue = false;
         EntityPtr entity = scene->GetEntity(entityState.id);
         bool removeState = false;
         if (!entity)
         {
             if (!entityState.removed)
-                LogWarning("Entity " + QString::number(entityState.id) + " has gone missing from the scene without the remove properly signalled. Removing from replication state");
+                ctx.Warning("Entity " + QString::number(entityState.id) + " has gone missing from the scene without the remove properly signalled. Removing from replication state");
             entityState.isNew = false;
             removeState = true;
         }
@@ -1559,7 +3220,8 @@ void SyncManager::ProcessSyncState(UserConnection* user)
             // Make sure we don't send data for local entities, or unacked entities after the create
             if (entity->IsLocal() || (!entityState.isNew && entity->IsUnacked()))
             {
-                it = state->dirtyQueue.erase(it);
+                state->dirtyQueue.Erase(it);
+                it = next;
                 continue;
             }
         }
@@ -1568,68 +3230,40 @@ void SyncManager::ProcessSyncState(UserConnection* user)
         if (entityState.removed)
         {
             // If we have both new & removed flags on the entity, it will probably result in buggy behaviour
+            state->dirtyQueue.Erase(it);
             if (entityState.isNew)
             {
-                LogWarning("Entity " + QString::number(entityState.id) + " queued for both deletion and creation. Buggy behaviour will possibly result!");
+                ctx.Warning("Entity " + QString::number(entityState.id) + " queued for both deletion and creation. Buggy behaviour will possibly result!");
                 // The delete has been processed. Do not remember it anymore, but requeue the state for creation
                 entityState.removed = false;
                 removeState = false;
-                state->dirtyQueue.push_back(&entityState);
-                entityState.isInQueue = true;
+                state->dirtyQueue.PushBack(&entityState);
+                if (!next)
+                    next = &entityState; // Was the last in the queue, so process the creation on this round still.
             }
             else
-                removeState = true;
-            
-            kNet::DataSerializer ds(removeEntityBuffer_, 1024);
-            ds.AddVLE<kNet::VLE8_16_32>(sceneId);
-            ds.AddVLE<kNet::VLE8_16_32>(entityState.id & UniqueIdGenerator::LAST_REPLICATED_ID);
-            user->Send(cRemoveEntityMessage, true, true, ds);
-            ++numMessagesSent;
-            it = state->dirtyQueue.erase(it);
-        }
-        // New entity
-        else if (entityState.isNew)
-        {
-            kNet::DataSerializer ds(createEntityBuffer_, 64 * 1024);
-            
-            // Entity identification and temporary flag
-            ds.AddVLE<kNet::VLE8_16_32>(sceneId);
-            ds.AddVLE<kNet::VLE8_16_32>(entityState.id & UniqueIdGenerator::LAST_REPLICATED_ID);
-            // Do not write the temporary flag as a bit to not desync the byte alignment at this point, as a lot of data potentially follows
-            ds.Add<u8>(entity->IsTemporary() ? 1 : 0);
-            // If hierarchic scene is supported, send parent entity ID or 0 if unparented. Note that this is a full 32bit ID to handle the unacked range if necessary
-            if (user->ProtocolVersion() >= ProtocolHierarchicScene)
-            {
-                if (entity->Parent() && entity->Parent()->IsLocal())
-                    LogWarning("Replicated entity " + QString::number(entityState.id) + " is parented to a local entity, can not replicate parenting properly over the network");
-
-                ds.Add<u32>(entity->Parent() ? entity->Parent()->Id() : 0);
-            }
-            
-            const Entity::ComponentMap& components = entity->Components();
-            // Count the amount of replicated components
-            uint numReplicatedComponents = 0;
-            for (Entity::ComponentMap::const_iterator i = components.begin(); i != components.end(); ++i)
-            {
-                if (i->second->IsReplicated())
-                    ++numReplicatedComponents;
-            }
-            ds.AddVLE<kNet::VLE8_16_32>(numReplicatedComponents);
-            
-            // Serialize each replicated component
-            for (Entity::ComponentMap::const_iterator i = components.begin(); i != components.end(); ++i)
-            {
-                ComponentPtr comp = i->second;
-                if (!comp->IsReplicated())
-                    continue;
-                WriteComponentFullUpdate(ds, comp);
-                // Mark the component undirty in the receiver's syncstate
-                state->MarkComponentProcessed(entity->Id(), comp->Id());
-            }
+                removeState = true;
+            
+            kNet::DataSerializer ds(ctx.removeEntityBuffer, 1024);
+            ds.AddVLE<kNet::VLE8_16_32>(sceneId);
+            ds.AddVLE<kNet::VLE8_16_32>(entityState.id & UniqueIdGenerator::LAST_REPLICATED_ID);
+            ctx.Send(user, cRemoveEntityMessage, true, true, ds);
+            // The client drops its baselines when it receives the removal.
+            state->baselines.RemoveEntity(entityState.id);
+            ++numMessagesSent;
+        }
+        // New entity
+        else if (entityState.isNew)
+        {
+            kNet::DataSerializer ds(ctx.createEntityBuffer, 64 * 1024);
+            WriteCreateEntity(ds, sceneId, entity.get(), user->ProtocolVersion() >= ProtocolHierarchicScene,
+                user->ProtocolVersion() >= ProtocolPrototypeEntities ? state : 0, ctx);
+            // Mark the components undirty in the receiver's syncstate
+            MarkReplicatedComponentsProcessed(state, entity.get());
             
-            user->Send(cCreateEntityMessage, true, true, ds);
+            ctx.Send(user, cCreateEntityMessage, true, true, ds);
             ++numMessagesSent;
-            it = state->dirtyQueue.erase(it);
+            state->dirtyQueue.Erase(it);
             // The create has been processed fully. Clear dirty flags.
             state->MarkEntityProcessed(entity->Id());
         }
@@ -1638,16 +3272,19 @@ void SyncManager::ProcessSyncState(UserConnection* user)
             if (!entityState.dirtyQueue.empty())
             {
                 // Components or attributes have been added, changed, or removed. Prepare the dataserializers
-                kNet::DataSerializer removeCompsDs(removeCompsBuffer_, 1024);
-                kNet::DataSerializer removeAttrsDs(removeAttrsBuffer_, 1024);
-                kNet::DataSerializer createCompsDs(createCompsBuffer_, 64 * 1024);
-                kNet::DataSerializer createAttrsDs(createAttrsBuffer_, 16 * 1024);
-                kNet::DataSerializer editAttrsDs(editAttrsBuffer_, 64 * 1024);
+                kNet::DataSerializer removeCompsDs(ctx.removeCompsBuffer, 1024);
+                kNet::DataSerializer removeAttrsDs(ctx.removeAttrsBuffer, 1024);
+                kNet::DataSerializer createCompsDs(ctx.createCompsBuffer, 64 * 1024);
+                kNet::DataSerializer createAttrsDs(ctx.createAttrsBuffer, 16 * 1024);
+                kNet::DataSerializer editAttrsDs(ctx.editAttrsBuffer, 64 * 1024);
+                kNet::DataSerializer latestAttrsDs(ctx.latestAttrsBuffer, 16 * 1024);
                 
-                while (!entityState.dirtyQueue.empty())
+                for (size_t dirtyIndex = 0; dirtyIndex < entityState.dirtyQueue.size(); ++dirtyIndex)
                 {
-                    ComponentSyncState& compState = *entityState.dirtyQueue.front();
-                    entityState.dirtyQueue.pop_front();
+                    ComponentSyncStateMap::iterator compStateIter = entityState.components.find(entityState.dirtyQueue[dirtyIndex]);
+                    if (compStateIter == entityState.components.end())
+                        continue;
+                    ComponentSyncState& compState = compStateIter->second;
                     compState.isInQueue = false;
                     
                     ComponentPtr comp = entity->GetComponentById(compState.id);
@@ -1655,7 +3292,7 @@ void SyncManager::ProcessSyncState(UserConnection* user)
                     if (!comp)
                     {
                         if (!compState.removed)
-                            LogWarning("Component " + QString::number(compState.id) + " of " + entity->ToString() + " has gone missing from the scene without the remove properly signalled. Removing from client replication state->");
+                            ctx.Warning("Component " + QString::number(compState.id) + " of " + entity->ToString() + " has gone missing from the scene without the remove properly signalled. Removing from client replication state->");
                         compState.isNew = false;
                         removeCompState = true;
                     }
@@ -1679,6 +3316,7 @@ void SyncManager::ProcessSyncState(UserConnection* user)
                         }
                         // Then add component ID
                         removeCompsDs.AddVLE<kNet::VLE8_16_32>(compState.id & UniqueIdGenerator::LAST_REPLICATED_ID);
+                        state->baselines.RemoveComponent(entityState.id, compState.id);
                     }
                     // New component
                     else if (compState.isNew)
@@ -1690,7 +3328,7 @@ void SyncManager::ProcessSyncState(UserConnection* user)
                             createCompsDs.AddVLE<kNet::VLE8_16_32>(entityState.id & UniqueIdGenerator::LAST_REPLICATED_ID);
                         }
                         // Then add the component data
-                        WriteComponentFullUpdate(createCompsDs, comp);
+                        WriteComponentFullUpdate(createCompsDs, comp, ctx);
                         // Mark the component undirty in the receiver's syncstate
                         state->MarkComponentProcessed(entity->Id(), comp->Id());
                     }
@@ -1699,19 +3337,28 @@ void SyncManager::ProcessSyncState(UserConnection* user)
                     {
                         const AttributeVector& attrs = comp->Attributes();
                         
-                        for (std::map<u8, bool>::iterator i = compState.newAndRemovedAttributes.begin(); i != compState.newAndRemovedAttributes.end(); ++i)
+                        for (unsigned attrIndex = 0; compState.hasNewOrRemovedAttributes && attrIndex < 256; ++attrIndex)
                         {
-                            u8 attrIndex = i->first;
+                            // Skip whole bytes with no pending creations or removals.
+                            if ((attrIndex & 7) == 0 && !compState.createdAttributes[attrIndex >> 3] && !compState.removedAttributes[attrIndex >> 3])
+                            {
+                                attrIndex += 7;
+                                continue;
+                            }
+                            const bool created = compState.IsAttributeCreated((u8)attrIndex);
+                            if (!created && !compState.IsAttributeRemoved((u8)attrIndex))
+                                continue;
+
                             // Clear the corresponding dirty flags, so that we don't redundantly send attribute edited data.
                             compState.dirtyAttributes[attrIndex >> 3] &= ~(1 << (attrIndex & 7));
                             
-                            if (i->second)
+                            if (created)
                             {
                                 // Create attribute. Make sure it exists and is dynamic.
                                 if (attrIndex >= attrs.size() || !attrs[attrIndex])
-                                    LogError("CreateAttribute for nonexisting attribute index " + QString::number(attrIndex) + " was queued for component " + comp->TypeName() + " in " + entity->ToString() + ". Discarding.");
+                                    ctx.Error("CreateAttribute for nonexisting attribute index " + QString::number(attrIndex) + " was queued for component " + comp->TypeName() + " in " + entity->ToString() + ". Discarding.");
                                 else if (!attrs[attrIndex]->IsDynamic())
-                                    LogError("CreateAttribute for a static attribute index " + QString::number(attrIndex) + " was queued for component " + comp->TypeName() + " in " + entity->ToString() + ". Discarding.");
+                                    ctx.Error("CreateAttribute for a static attribute index " + QString::number(attrIndex) + " was queued for component " + comp->TypeName() + " in " + entity->ToString() + ". Discarding.");
                                 else
                                 {
                                     // If first attribute, write the entity ID first
@@ -1742,10 +3389,11 @@ void SyncManager::ProcessSyncState(UserConnection* user)
                                 removeAttrsDs.Add<u8>(attrIndex);
                             }
                         }
-                        compState.newAndRemovedAttributes.clear();
+                        compState.ClearNewAndRemovedAttributes();
                         
                         // Now, if remaining dirty bits exist, they must be sent in the edit attributes message. These are the majority of our network data.
-                        changedAttributes_.clear();
+                        ctx.changedAttributes.clear();
+                        ctx.latestAttributes.clear();
                         unsigned numBytes = ((unsigned)attrs.size() + 7) >> 3;
                         for (unsigned i = 0; i < numBytes; ++i)
                         {
@@ -1758,21 +3406,30 @@ void SyncManager::ProcessSyncState(UserConnection* user)
                                     {
                                         u8 attrIndex = i * 8 + j;
                                         if (attrIndex < attrs.size() && attrs[attrIndex])
-                                            changedAttributes_.push_back(attrIndex);
+                                        {
+                                            if (latestValues && IsLatestValueOnly(attrs[attrIndex]))
+                                            {
+                                                // Sent in the EditLatestAttributes message, so keep it out of the EditAttributes bitmask.
+                                                ctx.latestAttributes.push_back(attrIndex);
+                                                compState.dirtyAttributes[i] &= ~(1 << j);
+                                            }
+                                            else
+                                                ctx.changedAttributes.push_back(attrIndex);
+                                        }
                                         else
-                                            LogError("Attribute change for a nonexisting attribute index " + QString::number(attrIndex) + " was queued for component " + comp->TypeName() + " in " + entity->ToString() + ". Discarding.");
+                                            ctx.Error("Attribute change for a nonexisting attribute index " + QString::number(attrIndex) + " was queued for component " + comp->TypeName() + " in " + entity->ToString() + ". Discarding.");
                                     }
                                 }
                             }
                         }
-                        if (changedAttributes_.size())
+                        if (ctx.changedAttributes.size())
                         {
                             /// Hack for web clients that don't support ReplicateRigidBodyChanges()
                             /// Don't send out minuscule pos/rot/scale changes as it spams the network.
                             bool sendChanges = true;
                             if (dynamic_cast<KNetUserConnection*>(user) == 0 && user->protocolVersion < ProtocolWebClientRigidBodyMessage)
                             {
-                                if (comp->TypeId() == EC_Placeable::TypeIdStatic() && changedAttributes_.size() == 1 && changedAttributes_[0] == 0)
+                                if (comp->TypeId() == EC_Placeable::TypeIdStatic() && ctx.changedAttributes.size() == 1 && ctx.changedAttributes[0] == 0)
                                 {
                                     // EC_Placeable::Transform is the only change!
                                     EC_Placeable *placeable = dynamic_cast<EC_Placeable*>(comp.get());
@@ -1803,79 +3460,133 @@ void SyncManager::ProcessSyncState(UserConnection* user)
                                     editAttrsDs.AddVLE<kNet::VLE8_16_32>(entityState.id & UniqueIdGenerator::LAST_REPLICATED_ID);
                                 }
                                 editAttrsDs.AddVLE<kNet::VLE8_16_32>(compState.id & UniqueIdGenerator::LAST_REPLICATED_ID);
-                            
-                                // Create a nested dataserializer for the actual attribute data, so we can skip components
-                                kNet::DataSerializer attrDataDs(attrDataBuffer_, 16 * 1024);
-                            
-                                // There are changed attributes. Check if it is more optimal to send attribute indices, or the whole bitmask
-                                unsigned bitsMethod1 = (unsigned)changedAttributes_.size() * 8 + 8;
-                                unsigned bitsMethod2 = (unsigned)attrs.size();
-                                // Method 1: indices
-                                if (bitsMethod1 <= bitsMethod2)
+
+                                // On the server, other users with the same dirty attributes can share the serialized data,
+                                // unless it is delta-encoded against this user's baselines.
+                                const bool deltaFormat = isServer && user->ProtocolVersion() >= ProtocolAttributeDeltas;
+                                const bool quantize = deltaFormat && user->ProtocolVersion() >= ProtocolAttributeQuantization;
+                                const bool useDeltas = deltaFormat && attributeDeltasEnabled_;
+                                // While recording statistics, serialize for each user so that the attribute values can be measured.
+                                ReplicationStatistics *stats = ctx.Statistics();
+                                const bool useCache = isServer && !useDeltas && !stats;
+                                const u8 cacheFormat = quantize ? 2 : (deltaFormat ? 1 : 0);
+                                const std::vector<u8> *cached = useCache ? attrUpdateCache_.Find(entityState.id, compState.id, compState.dirtyAttributes, numBytes, cacheFormat) : 0;
+                                if (!cached)
                                 {
-                                    attrDataDs.Add<kNet::bit>(0);
-                                    attrDataDs.Add<u8>((u8)changedAttributes_.size());
-                                    for (unsigned i = 0; i < changedAttributes_.size(); ++i)
+                                    // Create a nested dataserializer for the actual attribute data, so we can skip components
+                                    kNet::DataSerializer attrDataDs(ctx.attrDataBuffer, 16 * 1024);
+                                
+                                    // There are changed attributes. Check if it is more optimal to send attribute indices, or the whole bitmask
+                                    unsigned bitsMethod1 = (unsigned)ctx.changedAttributes.size() * 8 + 8;
+                                    unsigned bitsMethod2 = (unsigned)attrs.size();
+                                    // Method 1: indices
+                                    if (bitsMethod1 <= bitsMethod2)
                                     {
-                                        attrDataDs.Add<u8>(changedAttributes_[i]);
-                                        attrs[changedAttributes_[i]]->ToBinary(attrDataDs);
+                                        attrDataDs.Add<kNet::bit>(0);
+                                        attrDataDs.Add<u8>((u8)ctx.changedAttributes.size());
+                                        for (unsigned i = 0; i < ctx.changedAttributes.size(); ++i)
+                                        {
+                                            const u8 attrIndex = ctx.changedAttributes[i];
+                                            attrDataDs.Add<u8>(attrIndex);
+                                            const size_t bitsBefore = attrDataDs.BitsFilled();
+                                            WriteAttributeValue(attrDataDs, attrs[attrIndex], attrIndex, state, entityState.id, compState.id, deltaFormat, quantize, useDeltas, ctx);
+                                            if (stats)
+                                                stats->AddAttribute(ReplicationStatistics::Sent, comp->TypeId(), attrIndex, attrDataDs.BitsFilled() - bitsBefore);
+                                        }
                                     }
-                                }
-                                // Method 2: bitmask
-                                else
-                                {
-                                    attrDataDs.Add<kNet::bit>(1);
-                                    for (unsigned i = 0; i < attrs.size(); ++i)
+                                    // Method 2: bitmask
+                                    else
                                     {
-                                        if (compState.dirtyAttributes[i >> 3] & (1 << (i & 7)))
+                                        attrDataDs.Add<kNet::bit>(1);
+                                        for (unsigned i = 0; i < attrs.size(); ++i)
                                         {
-                                            attrDataDs.Add<kNet::bit>(1);
-                                            attrs[i]->ToBinary(attrDataDs);
+                                            if (compState.dirtyAttributes[i >> 3] & (1 << (i & 7)))
+                                            {
+                                                attrDataDs.Add<kNet::bit>(1);
+                                                const size_t bitsBefore = attrDataDs.BitsFilled();
+                                                WriteAttributeValue(attrDataDs, attrs[i], (u8)i, state, entityState.id, compState.id, deltaFormat, quantize, useDeltas, ctx);
+                                                if (stats)
+                                                    stats->AddAttribute(ReplicationStatistics::Sent, comp->TypeId(), (u8)i, attrDataDs.BitsFilled() - bitsBefore);
+                                            }
+                                            else
+                                                attrDataDs.Add<kNet::bit>(0);
                                         }
-                                        else
-                                            attrDataDs.Add<kNet::bit>(0);
+                                    }
+
+                                    if (useCache)
+                                        cached = &attrUpdateCache_.Insert(entityState.id, compState.id, compState.dirtyAttributes, numBytes, ctx.attrDataBuffer, attrDataDs.BytesFilled(), cacheFormat);
+                                    else
+                                    {
+                                        if (stats)
+                                            stats->AddComponent(ReplicationStatistics::Sent, comp->TypeId(), attrDataDs.BytesFilled());
+                                        // Add the attribute data array to the main serializer
+                                        editAttrsDs.AddVLE<kNet::VLE8_16_32>((u32)attrDataDs.BytesFilled());
+                                        editAttrsDs.AddArray<u8>((unsigned char*)ctx.attrDataBuffer, (u32)attrDataDs.BytesFilled());
                                     }
                                 }
-                            
-                                // Add the attribute data array to the main serializer
-                                editAttrsDs.AddVLE<kNet::VLE8_16_32>((u32)attrDataDs.BytesFilled());
-                                editAttrsDs.AddArray<u8>((unsigned char*)attrDataBuffer_, (u32)attrDataDs.BytesFilled());
+
+                                if (cached)
+                                {
+                                    // Add the attribute data array to the main serializer
+                                    editAttrsDs.AddVLE<kNet::VLE8_16_32>((u32)cached->size());
+                                    if (!cached->empty())
+                                        editAttrsDs.AddArray<u8>(&(*cached)[0], (u32)cached->size());
+                                }
                             }
 
                             // Now zero out all remaining dirty bits
                             for (unsigned i = 0; i < numBytes; ++i)
                                 compState.dirtyAttributes[i] = 0;
                         }
+                        if (ctx.latestAttributes.size())
+                        {
+                            // If first component for which latest values are sent, write the entity ID and the sequence number first
+                            if (!latestAttrsDs.BytesFilled())
+                            {
+                                latestAttrsDs.AddVLE<kNet::VLE8_16_32>(sceneId);
+                                latestAttrsDs.AddVLE<kNet::VLE8_16_32>(entityState.id & UniqueIdGenerator::LAST_REPLICATED_ID);
+                                latestAttrsDs.Add<u32>(state->latestAttributeSequence);
+                            }
+                            WriteLatestAttributes(latestAttrsDs, comp.get(), compState.id, ctx.latestAttributes, ctx);
+                            for (size_t i = 0; i < ctx.latestAttributes.size(); ++i)
+                                state->latestAttributesSent.push_back(LatestAttributeKey(entityState.id, compState.id, ctx.latestAttributes[i]));
+                        }
                     }
                     
                     if (removeCompState)
-                        entityState.components.erase(compState.id);
+                        entityState.components.erase(compStateIter);
                 }
+                entityState.dirtyQueue.clear();
                 
                 // Send the messages which have data
                 if (removeCompsDs.BytesFilled())
                 {
-                    user->Send(cRemoveComponentsMessage, true, true, removeCompsDs);
+                    ctx.Send(user, cRemoveComponentsMessage, true, true, removeCompsDs);
                     ++numMessagesSent;
                 }
                 if (removeAttrsDs.BytesFilled())
                 {
-                    user->Send(cRemoveAttributesMessage, true, true, removeAttrsDs);
+                    ctx.Send(user, cRemoveAttributesMessage, true, true, removeAttrsDs);
                     ++numMessagesSent;
                 }
                 if (createCompsDs.BytesFilled())
                 {
-                    user->Send(cCreateComponentsMessage, true, true, createCompsDs);
+                    ctx.Send(user, cCreateComponentsMessage, true, true, createCompsDs);
                     ++numMessagesSent;
                 }
                 if (createAttrsDs.BytesFilled())
                 {
-                    user->Send(cCreateAttributesMessage, true, true, createAttrsDs);
+                    ctx.Send(user, cCreateAttributesMessage, true, true, createAttrsDs);
                     ++numMessagesSent;
                 }
                 if (editAttrsDs.BytesFilled())
                 {
-                    user->Send(cEditAttributesMessage, true, true, editAttrsDs);
+                    ctx.Send(user, cEditAttributesMessage, true, true, editAttrsDs);
+                    ++numMessagesSent;
+                }
+                if (latestAttrsDs.BytesFilled())
+                {
+                    ctx.Send(user, cEditLatestAttributesMessage, false, false, latestAttrsDs);
                     ++numMessagesSent;
                 }
             }
@@ -1883,41 +3594,39 @@ void SyncManager::ProcessSyncState(UserConnection* user)
             // Check if entity has other property changes (temporary flag)
             if (entityState.hasPropertyChanges)
             {
-                kNet::DataSerializer editPropertiesDs(editAttrsBuffer_, 1024);
+                kNet::DataSerializer editPropertiesDs(ctx.editAttrsBuffer, 1024);
                 editPropertiesDs.AddVLE<kNet::VLE8_16_32>(sceneId);
                 editPropertiesDs.AddVLE<kNet::VLE8_16_32>(entityState.id & UniqueIdGenerator::LAST_REPLICATED_ID);
                 editPropertiesDs.Add<u8>(entity->IsTemporary() ? 1 : 0);
-                user->Send(cEditEntityPropertiesMessage, true, true, editPropertiesDs);
+                ctx.Send(user, cEditEntityPropertiesMessage, true, true, editPropertiesDs);
                 ++numMessagesSent;
             }
             if (entityState.hasParentChange && user->ProtocolVersion() >= ProtocolHierarchicScene)
             {
                 EntityPtr parent = entity->Parent();
-                kNet::DataSerializer editParentDs(editAttrsBuffer_, 1024);
+                kNet::DataSerializer editParentDs(ctx.editAttrsBuffer, 1024);
                 editParentDs.AddVLE<kNet::VLE8_16_32>(sceneId);
                 editParentDs.Add<u32>(entityState.id);
                 editParentDs.Add<u32>(parent ? parent->Id() : 0);
-                user->Send(cSetEntityParentMessage, true, true, editParentDs);
+                ctx.Send(user, cSetEntityParentMessage, true, true, editParentDs);
                 ++numMessagesSent;
             }
 
-            it = state->dirtyQueue.erase(it);
+            state->dirtyQueue.Erase(it);
             // The entity has been processed fully. Clear dirty flags.
             state->MarkEntityProcessed(entity->Id());
         }
+        else
+            state->dirtyQueue.Erase(it); // Entity gone missing without the remove signalled
         
         if (removeState)
-            state->entities.erase(entityState.id);
-    }
-
-    // Send queued entity actions after scene sync
-    if (state->queuedActions.size())
-    {
-        for (size_t i = 0; i < state->queuedActions.size(); ++i)
-            user->Send(state->queuedActions[i]);
-
-        state->queuedActions.clear();
+            state->RemoveEntityState(entityState.id);
+        it = next;
     }
+    if (latestValues)
+        SettleLatestAttributes(user, scene.get(), ctx);
+    state->bandwidthBudget.Consume(ctx.NumBytesSent() - bytesSentBefore);
+    ctx.FlushBatch();
 
     //if (numMessagesSent)
     //    std::cout << "Sent " << numMessagesSent << " scenesync messages" << std::endl;
@@ -2002,11 +3711,14 @@ void SyncManager::HandleCreateEntity(UserConnection* source, const char* data, s
     std::vector<std::pair<component_id_t, component_id_t> > componentIdRewrites;
 
     entity_id_t parentEntityID = 0;
+    EntityPtr prototype;
 
     try
     {    
-        // Read the temporary flag
-        bool temporary = ds.Read<u8>() != 0;
+        // Read the temporary flag, and whether the prototype entity ID follows
+        const u8 flags = ds.Read<u8>();
+        const bool prototypes = source->ProtocolVersion() >= ProtocolPrototypeEntities;
+        bool temporary = prototypes ? (flags & 1) != 0 : flags != 0;
         entity->SetTemporary(temporary);
 
         // In hierarchic scene protocol, read the parent entity ID
@@ -2033,10 +3745,23 @@ void SyncManager::HandleCreateEntity(UserConnection* source, const char* data, s
             }
         }
 
+        // In prototype entities protocol, read the prototype entity ID of an instance
+        const bool instance = prototypes && (flags & 2) != 0;
+        if (instance)
+        {
+            entity_id_t prototypeEntityID = ds.Read<u32>();
+            prototype = scene->EntityById(prototypeEntityID);
+            if (prototype)
+                entity->SetPrototype(prototype);
+            else
+                LogWarning("Prototype entity id " + QString::number(prototypeEntityID) + " not found from scene when handling CreateEntity message");
+        }
+
         // Read the components
         unsigned numComponents = ds.ReadVLE<kNet::VLE8_16_32>();
         for(uint i = 0; i < numComponents; ++i)
         {
+            const bool inherit = instance && ds.Read<u8>() != 0;
             component_id_t compID = ds.ReadVLE<kNet::VLE8_16_32>();
             component_id_t senderCompID = compID;
             // If we are server, rewrite the ID
@@ -2047,6 +3772,8 @@ void SyncManager::HandleCreateEntity(UserConnection* source, const char* data, s
             unsigned attrDataSize = ds.ReadVLE<kNet::VLE8_16_32>();
             ds.ReadArray<u8>((u8*)&attrDataBuffer_[0], attrDataSize);
             kNet::DataDeserializer attrDs(attrDataBuffer_, attrDataSize);
+            if (statisticsEnabled_)
+                statistics_.AddComponent(ReplicationStatistics::Received, typeID, attrDataSize);
             
             // If client gets a component that already exists, destroy it forcibly
             if (!isServer && entity->GetComponentById(compID))
@@ -2070,9 +3797,41 @@ void SyncManager::HandleCreateEntity(UserConnection* source, const char* data, s
             // Create the component to the sender's syncstate, then mark it processed (undirty)
             state->MarkComponentProcessed(entityID, compID);
             
-            // Fill static attributes
             unsigned numStaticAttrs = comp->NumStaticAttributes();
             const AttributeVector& attrs = comp->Attributes();
+            if (inherit)
+            {
+                // Take the inherited attributes from the prototype's component, then read the overridden ones
+                ComponentPtr prototypeComp = prototype ? prototype->Component(typeID, name) : ComponentPtr();
+                if (prototypeComp)
+                    comp->CopyAttributesFrom(prototypeComp.get(), AttributeChange::Disconnected);
+                else
+                    LogWarning("Prototype component " + comp->TypeName() + " not found for " + entity->ToString() + " while handling CreateEntity message.");
+
+                const uint numSentAttrs = attrDs.Read<u8>();
+                std::vector<u8> overridden((numSentAttrs + 7) / 8);
+                for (size_t j = 0; j < overridden.size(); ++j)
+                    overridden[j] = attrDs.Read<u8>();
+                for (uint j = 0; j < numSentAttrs; ++j)
+                {
+                    if ((overridden[j >> 3] & (1 << (j & 7))) == 0)
+                        continue;
+                    // The values of unknown attributes can not be skipped, so stop at a version mismatch
+                    if (j >= numStaticAttrs)
+                    {
+                        if (mismatchingComponentTypes.find(comp->TypeId()) == mismatchingComponentTypes.end())
+                        {
+                            mismatchingComponentTypes.insert(comp->TypeId());
+                            LogWarning("Extra static attribute data in component " + comp->TypeName() + " (version mismatch).");
+                        }
+                        break;
+                    }
+                    attrs[j]->FromBinary(attrDs, AttributeChange::Disconnected);
+                }
+                continue;
+            }
+
+            // Fill static attributes
             for (uint i = 0; i < numStaticAttrs; ++i)
             {
                 // Allow component version mismatches (adding more attributes to the end of static attributes list), break if no more data present.
@@ -2203,6 +3962,8 @@ void SyncManager::HandleCreateComponents(UserConnection* source, const char* dat
             unsigned attrDataSize = ds.ReadVLE<kNet::VLE8_16_32>();
             ds.ReadArray<u8>((u8*)&attrDataBuffer_[0], attrDataSize);
             kNet::DataDeserializer attrDs(attrDataBuffer_, attrDataSize);
+            if (statisticsEnabled_)
+                statistics_.AddComponent(ReplicationStatistics::Received, typeID, attrDataSize);
             
             // If client gets a component that already exists, destroy it forcibly
             if (!isServer && entity->GetComponentById(compID))
@@ -2327,6 +4088,14 @@ void SyncManager::HandleRemoveEntity(UserConnection* source, const char* data, s
     if (!ValidateAction(source, cRemoveEntityMessage, entityID))
         return;
 
+    // The server dropped its attribute baselines for the entity when sending the removal.
+    if (!isServer)
+    {
+        state->baselines.RemoveEntity(entityID);
+        state->latestAttributeSequences.erase(state->latestAttributeSequences.lower_bound(LatestAttributeKey(entityID)),
+            state->latestAttributeSequences.lower_bound(LatestAttributeKey(entityID + 1)));
+    }
+
     EntityPtr entity = scene->GetEntity(entityID);
 
     if (entity && !scene->AllowModifyEntity(source, entity.get()))
@@ -2340,8 +4109,7 @@ void SyncManager::HandleRemoveEntity(UserConnection* source, const char* data, s
     
     scene->RemoveEntity(entityID, change);
     // Delete from the sender's syncstate so that we don't echo the delete back needlessly
-    state->RemoveFromQueue(entityID); // Be sure to erase from dirty queue so that we don't invoke UDB
-    state->entities.erase(entityID);
+    state->RemoveEntityState(entityID); // Erases from the dirty queue too, so that we don't invoke UDB
 }
 
 void SyncManager::HandleRemoveComponents(UserConnection* source, const char* data, size_t numBytes)
@@ -2382,6 +4150,8 @@ void SyncManager::HandleRemoveComponents(UserConnection* source, const char* dat
     while (ds.BitsLeft() >= 8)
     {
         component_id_t compID = ds.ReadVLE<kNet::VLE8_16_32>();
+        if (!isServer)
+            state->baselines.RemoveComponent(entityID, compID);
         ComponentPtr comp = entity->GetComponentById(compID);
         if (!comp)
         {
@@ -2477,18 +4247,21 @@ void SyncManager::HandleCreateAttributes(UserConnection* source, const char* dat
         }
         
         // Remove the corresponding add command from the sender's syncstate, so that the attribute add is not echoed back
-        state->entities[entityID].components[compID].newAndRemovedAttributes.erase(attrIndex);
+        state->EntityState(entityID).components[compID].ClearAttributeCreatedOrRemoved(attrIndex);
     }
     
     // Signal attribute changes after creating and reading all
+    // The server records the changes as received from the sender, so that they are not echoed back.
+    changeSourceConnectionId_ = isServer ? source->ConnectionId() : 0;
     for (unsigned i = 0; i < addedAttrs.size(); ++i)
     {
         IComponent* owner = addedAttrs[i]->Owner();
         u8 attrIndex = addedAttrs[i]->Index();
         owner->EmitAttributeChanged(addedAttrs[i], change);
         // Remove the dirty bit from sender's syncstate so that we do not echo the change back
-        state->entities[entityID].components[owner->Id()].dirtyAttributes[attrIndex >> 3] &= ~(1 << (attrIndex & 7));
+        state->EntityState(entityID).components[owner->Id()].dirtyAttributes[attrIndex >> 3] &= ~(1 << (attrIndex & 7));
     }
+    changeSourceConnectionId_ = 0;
 }
 
 void SyncManager::HandleRemoveAttributes(UserConnection* source, const char* data, size_t numBytes)
@@ -2540,8 +4313,88 @@ void SyncManager::HandleRemoveAttributes(UserConnection* source, const char* dat
         
         comp->RemoveAttribute(attrIndex, change);
         // Remove the corresponding remove command from the sender's syncstate, so that the attribute remove is not echoed back
-        state->entities[entityID].components[compID].newAndRemovedAttributes.erase(attrIndex);
+        state->EntityState(entityID).components[compID].ClearAttributeCreatedOrRemoved(attrIndex);
+    }
+}
+
+void SyncManager::HandleSceneSyncBatch(UserConnection* source, kNet::packet_id_t packetId, const char* data, size_t numBytes)
+{
+    if (owner_->IsServer())
+    {
+        LogWarning("SyncManager::HandleSceneSyncBatch: Received SceneSyncBatch message from client " + QString::number(source->ConnectionId()) + ", ignoring.");
+        return;
+    }
+
+    kNet::DataDeserializer ds(data, numBytes);
+    while(ds.BytesLeft() > 0)
+    {
+        const kNet::message_id_t messageId = ds.ReadVLE<kNet::VLE8_16_32>();
+        const u32 messageSize = ds.ReadVLE<kNet::VLE8_16_32>();
+        if (!SyncAssemblyContext::IsBatchable(messageId) || messageSize > ds.BytesLeft())
+        {
+            LogError("SyncManager::HandleSceneSyncBatch: Malformed SceneSyncBatch message, message " + QString::number(messageId) +
+                " size " + QString::number(messageSize) + ", " + QString::number(ds.BytesLeft()) + " bytes left.");
+            return;
+        }
+        // Batched messages are handled exactly like they would have been received separately, in order.
+        HandleNetworkMessage(source, packetId, messageId, data + ds.BytePos(), messageSize);
+        ds.SkipBytes(messageSize);
+    }
+}
+
+void SyncManager::HandleCompressedMessage(UserConnection* source, kNet::packet_id_t packetId, const char* data, size_t numBytes)
+{
+    kNet::DataDeserializer ds(data, numBytes);
+    const kNet::message_id_t messageId = ds.ReadVLE<kNet::VLE8_16_32>();
+    if (!SyncAssemblyContext::IsCompressible(messageId))
+    {
+        LogError("SyncManager::HandleCompressedMessage: Message " + QString::number(messageId) + " from connection " +
+            QString::number(source->ConnectionId()) + " can not be compressed, ignoring.");
+        return;
+    }
+
+    // qCompress prefixes the data with the uncompressed size as a big-endian u32. Check it before qUncompress allocates the buffer.
+    const uchar *compressed = (const uchar*)data + ds.BytePos();
+    const size_t compressedSize = ds.BytesLeft();
+    const u32 uncompressedSize = compressedSize >= 4 ? ((u32)compressed[0] << 24) | ((u32)compressed[1] << 16) | ((u32)compressed[2] << 8) | (u32)compressed[3] : 0;
+    if (uncompressedSize == 0 || uncompressedSize > cMaxUncompressedMessageSize)
+    {
+        LogError("SyncManager::HandleCompressedMessage: Invalid size " + QString::number(uncompressedSize) + " of compressed message " +
+            QString::number(messageId) + " from connection " + QString::number(source->ConnectionId()) + ", ignoring.");
+        return;
+    }
+
+    const QByteArray message = qUncompress(compressed, (int)compressedSize);
+    if (message.size() != (int)uncompressedSize)
+    {
+        LogError("SyncManager::HandleCompressedMessage: Failed to decompress message " + QString::number(messageId) +
+            " from connection " + QString::number(source->ConnectionId()) + ", ignoring.");
+        return;
+    }
+    HandleNetworkMessage(source, packetId, messageId, message.constData(), message.size());
+}
+
+void SyncManager::HandleSceneSnapshot(UserConnection* source, kNet::packet_id_t packetId, const char* data, size_t numBytes)
+{
+    if (owner_->IsServer())
+    {
+        LogWarning("SyncManager::HandleSceneSnapshot: Received SceneSnapshot message from client " + QString::number(source->ConnectionId()) + ", ignoring.");
+        return;
     }
+
+    kNet::DataDeserializer ds(data, numBytes);
+    /*unsigned sceneId =*/ ds.ReadVLE<kNet::VLE8_16_32>(); ///\todo Dummy ID. Lookup scene once multiscene is properly supported
+    const u32 sequence = ds.Read<u32>();
+    QByteArray snapshot = qUncompress((const uchar*)data + ds.BytePos(), (int)ds.BytesLeft());
+    if (snapshot.isEmpty() && ds.BytesLeft() > 4)
+    {
+        LogError("SyncManager::HandleSceneSnapshot: Failed to decompress scene snapshot " + QString::number(sequence) + ".");
+        return;
+    }
+
+    LogDebug("SyncManager: Received scene snapshot " + QString::number(sequence) + ", " + QString::number(snapshot.size()) + " bytes.");
+    // The scenesync messages that follow on the ordered channel are changes made after the snapshot was taken.
+    HandleSceneSyncBatch(source, packetId, snapshot.constData(), snapshot.size());
 }
 
 void SyncManager::HandleEditAttributes(UserConnection* source, const char* data, size_t numBytes)
@@ -2581,7 +4434,7 @@ void SyncManager::HandleEditAttributes(UserConnection* source, const char* data,
     
     // Record the update time for calculating the update interval
     float updateInterval = updatePeriod_; // Default update interval if state not found or interval not measured yet
-    std::map<entity_id_t, EntitySyncState>::iterator it = state->entities.find(entityID);
+    EntitySyncStateMap::iterator it = state->entities.find(entityID);
     if (it != state->entities.end())
     {
         it->second.RefreshAvgUpdateInterval();
@@ -2591,6 +4444,10 @@ void SyncManager::HandleEditAttributes(UserConnection* source, const char* data,
     // Add a fudge factor in case there is jitter in packet receipt or the server is too taxed
     updateInterval *= 1.25f;
 
+    // Attribute values from the server may be delta-encoded against the baselines, and quantized according to the attribute metadata.
+    const bool deltaFormat = !isServer && source->ProtocolVersion() >= ProtocolAttributeDeltas;
+    const bool quantize = deltaFormat && source->ProtocolVersion() >= ProtocolAttributeQuantization;
+
     std::vector<IAttribute*> changedAttrs;
     while (ds.BitsLeft() >= 8)
     {
@@ -2606,6 +4463,8 @@ void SyncManager::HandleEditAttributes(UserConnection* source, const char* data,
             continue;
         }
         const AttributeVector& attributes = comp->Attributes();
+        if (statisticsEnabled_)
+            statistics_.AddComponent(ReplicationStatistics::Received, comp->TypeId(), attrDataSize);
 
         int indexingMethod = attrDs.Read<kNet::bit>();
         if (!indexingMethod)
@@ -2627,18 +4486,26 @@ void SyncManager::HandleEditAttributes(UserConnection* source, const char* data,
                     break;
                 }
                 
+                const u32 bitsLeftBefore = attrDs.BitsLeft();
                 bool interpolate = (!isServer && attr->Metadata() && attr->Metadata()->interpolation == AttributeMetadata::Interpolate);
                 if (!interpolate)
                 {
-                    attr->FromBinary(attrDs, AttributeChange::Disconnected);
+                    if (!ReadAttributeValue(attrDs, attr, attrIndex, state, entityID, compID, deltaFormat, quantize))
+                        break;
                     changedAttrs.push_back(attr);
                 }
                 else
                 {
                     IAttribute* endValue = attr->Clone();
-                    endValue->FromBinary(attrDs, AttributeChange::Disconnected);
+                    if (!ReadAttributeValue(attrDs, endValue, attrIndex, state, entityID, compID, deltaFormat, quantize))
+                    {
+                        delete endValue;
+                        break;
+                    }
                     scene->StartAttributeInterpolation(attr, endValue, updateInterval);
                 }
+                if (statisticsEnabled_)
+                    statistics_.AddAttribute(ReplicationStatistics::Received, comp->TypeId(), attrIndex, bitsLeftBefore - attrDs.BitsLeft());
             }
         }
         else
@@ -2659,31 +4526,145 @@ void SyncManager::HandleEditAttributes(UserConnection* source, const char* data,
                         LogWarning("Nonexistent attribute in EditAttributes message, skipping to next component");
                         break;
                     }
+                    const u32 bitsLeftBefore = attrDs.BitsLeft();
                     bool interpolate = (!isServer && attr->Metadata() && attr->Metadata()->interpolation == AttributeMetadata::Interpolate);
                     if (!interpolate)
                     {
-                        attr->FromBinary(attrDs, AttributeChange::Disconnected);
+                        if (!ReadAttributeValue(attrDs, attr, (u8)i, state, entityID, compID, deltaFormat, quantize))
+                            break;
                         changedAttrs.push_back(attr);
                     }
                     else
                     {
                         IAttribute* endValue = attr->Clone();
-                        endValue->FromBinary(attrDs, AttributeChange::Disconnected);
+                        if (!ReadAttributeValue(attrDs, endValue, (u8)i, state, entityID, compID, deltaFormat, quantize))
+                        {
+                            delete endValue;
+                            break;
+                        }
                         scene->StartAttributeInterpolation(attr, endValue, updateInterval);
                     }
+                    if (statisticsEnabled_)
+                        statistics_.AddAttribute(ReplicationStatistics::Received, comp->TypeId(), (u8)i, bitsLeftBefore - attrDs.BitsLeft());
                 }
             }
         }
     }
     
     // Signal attribute changes after reading all
+    // The server records the changes as received from the sender, so that they are not echoed back.
+    changeSourceConnectionId_ = isServer ? source->ConnectionId() : 0;
     for (unsigned i = 0; i < changedAttrs.size(); ++i)
     {
         IComponent* owner = changedAttrs[i]->Owner();
         u8 attrIndex = changedAttrs[i]->Index();
         owner->EmitAttributeChanged(changedAttrs[i], change);
         // Remove the dirty bit from sender's syncstate so that we do not echo the change back
-        state->entities[entityID].components[owner->Id()].dirtyAttributes[attrIndex >> 3] &= ~(1 << (attrIndex & 7));
+        state->EntityState(entityID).components[owner->Id()].dirtyAttributes[attrIndex >> 3] &= ~(1 << (attrIndex & 7));
+    }
+    changeSourceConnectionId_ = 0;
+}
+
+void SyncManager::HandleEditLatestAttributes(UserConnection* source, const char* data, size_t numBytes)
+{
+    assert(source);
+    if (owner_->IsServer())
+    {
+        LogWarning("SyncManager::HandleEditLatestAttributes: Received EditLatestAttributes message from client " + QString::number(source->ConnectionId()) + ", ignoring.");
+        return;
+    }
+    // Get matching syncstate for reflecting the changes
+    SceneSyncState* state = source->syncState.get();
+    ScenePtr scene = GetRegisteredScene();
+    if (!scene || !state)
+    {
+        LogWarning("Null scene or sync state, disregarding EditLatestAttributes message");
+        return;
+    }
+
+    kNet::DataDeserializer ds(data, numBytes);
+    unsigned sceneID = ds.ReadVLE<kNet::VLE8_16_32>(); ///\todo Dummy ID. Lookup scene once multiscene is properly supported
+    UNREFERENCED_PARAM(sceneID)
+    entity_id_t entityID = ds.ReadVLE<kNet::VLE8_16_32>();
+    const u32 sequence = ds.Read<u32>();
+
+    // The message is unreliable, so it may arrive before the entity is created or after it is removed. Both are harmless,
+    // as the creation carries the current values.
+    EntityPtr entity = scene->GetEntity(entityID);
+    if (!entity)
+        return;
+
+    // Record the update time for calculating the update interval
+    float updateInterval = updatePeriod_;
+    EntitySyncStateMap::iterator it = state->entities.find(entityID);
+    if (it != state->entities.end())
+    {
+        it->second.RefreshAvgUpdateInterval();
+        if (it->second.avgUpdateInterval > 0.0f)
+            updateInterval = it->second.avgUpdateInterval;
+    }
+    updateInterval *= 1.25f;
+
+    std::vector<IAttribute*> changedAttrs;
+    while (ds.BitsLeft() >= 8)
+    {
+        component_id_t compID = ds.ReadVLE<kNet::VLE8_16_32>();
+        unsigned attrDataSize = ds.ReadVLE<kNet::VLE8_16_32>();
+        ds.ReadArray<u8>((u8*)&attrDataBuffer_[0], attrDataSize);
+        kNet::DataDeserializer attrDs(attrDataBuffer_, attrDataSize);
+
+        ComponentPtr comp = entity->GetComponentById(compID);
+        if (!comp)
+            continue; // The component may not be created yet
+        const AttributeVector& attributes = comp->Attributes();
+        if (statisticsEnabled_)
+            statistics_.AddComponent(ReplicationStatistics::Received, comp->TypeId(), attrDataSize);
+
+        u8 numChangedAttrs = attrDs.Read<u8>();
+        for (unsigned i = 0; i < numChangedAttrs; ++i)
+        {
+            u8 attrIndex = attrDs.Read<u8>();
+            IAttribute* attr = attrIndex < attributes.size() ? attributes[attrIndex] : 0;
+            if (!attr)
+            {
+                LogWarning("Nonexistent attribute in EditLatestAttributes message, skipping to next component");
+                break;
+            }
+
+            // Apply the value only if it is newer than the last applied one, as the messages may arrive out of order.
+            const u32 bitsLeftBefore = attrDs.BitsLeft();
+            std::map<LatestAttributeKey, u32>::iterator seqIter = state->latestAttributeSequences.find(LatestAttributeKey(entityID, compID, attrIndex));
+            const bool stale = seqIter != state->latestAttributeSequences.end() && (s32)(sequence - seqIter->second) <= 0;
+            bool interpolate = (attr->Metadata() && attr->Metadata()->interpolation == AttributeMetadata::Interpolate);
+            IAttribute* target = (stale || interpolate) ? attr->Clone() : attr;
+            if (AttributeQuantizer::IsQuantized(target))
+                AttributeQuantizer::Read(attrDs, target);
+            else
+                target->FromBinary(attrDs, AttributeChange::Disconnected);
+            if (statisticsEnabled_)
+                statistics_.AddAttribute(ReplicationStatistics::Received, comp->TypeId(), attrIndex, bitsLeftBefore - attrDs.BitsLeft());
+
+            if (stale)
+            {
+                delete target;
+                continue;
+            }
+            state->latestAttributeSequences[LatestAttributeKey(entityID, compID, attrIndex)] = sequence;
+            if (interpolate)
+                scene->StartAttributeInterpolation(attr, target, updateInterval);
+            else
+                changedAttrs.push_back(attr);
+        }
+    }
+
+    // Signal attribute changes after reading all
+    for (unsigned i = 0; i < changedAttrs.size(); ++i)
+    {
+        IComponent* owner = changedAttrs[i]->Owner();
+        u8 attrIndex = changedAttrs[i]->Index();
+        owner->EmitAttributeChanged(changedAttrs[i], AttributeChange::LocalOnly);
+        // Remove the dirty bit from the syncstate so that we do not echo the change back
+        state->EntityState(entityID).components[owner->Id()].dirtyAttributes[attrIndex >> 3] &= ~(1 << (attrIndex & 7));
     }
 }
 
@@ -2736,9 +4717,11 @@ void SyncManager::HandleCreateEntityReply(UserConnection* source, const char* da
         //std::cout << "CreateEntityReply, component " << senderCompID << " -> " << compID << std::endl;
         
         entity->ChangeComponentId(senderCompID, compID);
-        entityState.components[compID] = entityState.components[senderCompID]; // Copy the sync state to the new ID
-        entityState.components[compID].id = compID; // Must remember to change ID manually
+        // Copy the sync state to the new ID. Take a copy first, as inserting may relocate the existing component states.
+        ComponentSyncState compState = entityState.components[senderCompID];
+        compState.id = compID; // Must remember to change ID manually
         entityState.components.erase(senderCompID);
+        entityState.components[compID] = compState;
         
         // Send notification
         IComponent* comp = entity->GetComponentById(compID).get();
@@ -2748,7 +4731,7 @@ void SyncManager::HandleCreateEntityReply(UserConnection* source, const char* da
     // Send notification
     scene->EmitEntityAcked(entity.get(), senderEntityID);
     
-    for (std::map<component_id_t, ComponentSyncState>::iterator i = entityState.components.begin(); i != entityState.components.end(); ++i)
+    for (ComponentSyncStateMap::iterator i = entityState.components.begin(); i != entityState.components.end(); ++i)
     {
         // Now mark every component dirty so they will be inspected for changes on the next update
         state->MarkComponentDirty(entityID, i->first);
@@ -2796,23 +4779,25 @@ void SyncManager::HandleCreateComponentsReply(UserConnection* source, const char
         //std::cout << "CreateComponentReply, component " << senderCompID << " -> " << compID << std::endl;
         
         entity->ChangeComponentId(senderCompID, compID);
-        entityState.components[compID] = entityState.components[senderCompID]; // Copy the sync state to the new ID
-        entityState.components[compID].id = compID; // Must remember to change ID manually
+        // Copy the sync state to the new ID. Take a copy first, as inserting may relocate the existing component states.
+        ComponentSyncState compState = entityState.components[senderCompID];
+        compState.id = compID; // Must remember to change ID manually
         entityState.components.erase(senderCompID);
+        entityState.components[compID] = compState;
         
         // Send notification
         IComponent* comp = entity->GetComponentById(compID).get();
         scene->EmitComponentAcked(comp, senderCompID);
     }
     
-    for (std::map<component_id_t, ComponentSyncState>::iterator i = entityState.components.begin(); i != entityState.components.end(); ++i)
+    for (ComponentSyncStateMap::iterator i = entityState.components.begin(); i != entityState.components.end(); ++i)
     {
         // Now mark every component dirty so they will be inspected for changes on the next update
         state->MarkComponentDirty(entityID, i->first);
     }
 }
 
-void SyncManager::HandleEntityAction(UserConnection* source, MsgEntityAction& msg)
+void SyncManager::HandleEntityAction(UserConnection* source, MsgEntityAction& msg, u32 actionId)
 {
     ScenePtr scene = GetRegisteredScene();
     if (!scene)
@@ -2834,10 +4819,14 @@ void SyncManager::HandleEntityAction(UserConnection* source, MsgEntityAction& ms
     if (isServer) // Set the user who sent the action, so it can be queried
         server->SetActionSender(source->shared_from_this());
     
-    QString action = BufferToString(msg.name).c_str();
+    // The action name is looked up once per name ID on the connections that intern the names, otherwise on each message.
+    // The names are only looked up here, so that the names received from network do not add to the interned names.
+    if (actionId == 0)
+        actionId = EntityAction::FindId(ActionStringFromBuffer(msg.name));
     QStringList params;
+    params.reserve((int)msg.parameters.size());
     for(uint i = 0; i < msg.parameters.size(); ++i)
-        params << BufferToString(msg.parameters[i].parameter).c_str();
+        params << ActionStringFromBuffer(msg.parameters[i].parameter);
 
     EntityAction::ExecTypeField type = (EntityAction::ExecTypeField)(msg.executionType);
 
@@ -2845,7 +4834,11 @@ void SyncManager::HandleEntityAction(UserConnection* source, MsgEntityAction& ms
 
     if ((type & EntityAction::Local) != 0 || (isServer && (type & EntityAction::Server) != 0))
     {
-        entity->Exec(EntityAction::Local, action, params); // Execute the action locally, so that it doesn't immediately propagate back to network for sending.
+        // Execute the action locally, so that it doesn't immediately propagate back to network for sending.
+        if (actionId != 0)
+            entity->Exec(EntityAction::Local, actionId, params);
+        else
+            entity->Exec(EntityAction::Local, ActionStringFromBuffer(msg.name), params);
         handled = true;
     }
 
@@ -2853,18 +4846,66 @@ void SyncManager::HandleEntityAction(UserConnection* source, MsgEntityAction& ms
     if (isServer && (type & EntityAction::Peers) != 0)
     {
         msg.executionType = (u8)EntityAction::Local;
+        shared_ptr<const MsgEntityAction> queued = MAKE_SHARED(MsgEntityAction, msg);
         foreach(UserConnectionPtr userConn, owner_->GetServer()->UserConnections())
             if (userConn.get() != source) // The EC action will not be sent to the machine that originated the request to send an action to all peers.
-                userConn->syncState->queuedActions.push_back(msg);
+                userConn->syncState->queuedActions.push_back(queued);
         handled = true;
     }
     
     if (!handled)
-        LogWarning("SyncManager: Received MsgEntityAction message \"" + action + "\", but it went unhandled because of its type=" + QString::number(type));
+        LogWarning("SyncManager: Received MsgEntityAction message \"" + ActionStringFromBuffer(msg.name) + "\", but it went unhandled because of its type=" + QString::number(type));
 
     server->SetActionSender(UserConnectionPtr()); // Clear the action sender after action handling
 }
 
+void SyncManager::HandleEntityActionBatch(UserConnection* source, const char* data, size_t numBytes)
+{
+    if (owner_->IsServer())
+    {
+        LogWarning("SyncManager: Ignoring EntityActionBatch message from client " + QString::number(source->ConnectionId()) + ", the message is sent by the server only.");
+        return;
+    }
+
+    SceneSyncState *state = source->syncState.get();
+    kNet::DataDeserializer dd(data, numBytes);
+    const uint numActions = dd.ReadVLE<kNet::VLE8_16_32>();
+    for(uint i = 0; i < numActions; ++i)
+    {
+        MsgEntityAction msg;
+        msg.entityId = dd.Read<u32>();
+        msg.executionType = (u8)EntityAction::Local;
+
+        const u32 nameId = dd.ReadVLE<kNet::VLE8_16_32>();
+        EntityAction::ActionId actionId = 0;
+        if (nameId == 0 || nameId > state->receivedActionNames.size())
+        {
+            msg.name.resize(dd.Read<u8>());
+            if (msg.name.size() > 0)
+                dd.ReadArray<s8>(&msg.name[0], msg.name.size());
+            if (nameId == state->receivedActionNames.size() + 1)
+            {
+                actionId = EntityAction::FindId(ActionStringFromBuffer(msg.name));
+                state->receivedActionNames.push_back(msg.name);
+                state->receivedActionIds.push_back(actionId);
+            }
+            else if (nameId != 0)
+                LogWarning("SyncManager::HandleEntityActionBatch: Action name ID " + QString::number(nameId) + " out of sequence.");
+        }
+        else
+        {
+            msg.name = state->receivedActionNames[nameId - 1];
+            actionId = state->receivedActionIds[nameId - 1];
+        }
+
+        msg.parameters.resize(dd.Read<u8>());
+        for(size_t j = 0; j < msg.parameters.size(); ++j)
+            msg.parameters[j].DeserializeFrom(dd);
+
+        HandleEntityAction(source, msg, actionId);
+    }
+}
+
 void SyncManager::SendObserverPosition(UserConnection *connection, SceneSyncState *senderState)
 {
     EC_Placeable *placeable = !observer_.expired() ? observer_.lock()->Component<EC_Placeable>().get() : 0;
@@ -2899,7 +4940,7 @@ void SyncManager::SendObserverPosition(UserConnection *connection, SceneSyncStat
     }
 }
 
-void SyncManager::ComputePriorityForEntitySyncState(SceneSyncState *sceneState, EntitySyncState &entityState, Entity *entity) const
+void SyncManager::ComputePriorityForEntitySyncState(SceneSyncState *sceneState, EntitySyncState &entityState, Entity *entity)
 {
     if (!sceneState)
         return;
@@ -2914,6 +4955,12 @@ void SyncManager::ComputePriorityForEntitySyncState(SceneSyncState *sceneState,
     shared_ptr<EC_Mesh> mesh = entity->Component<EC_Mesh>();
     shared_ptr<EC_RigidBody> rigidBody = entity->Component<EC_RigidBody>();
 
+    // Refresh the spatial index while we are at it: this also catches world position changes due to parent movement.
+    if (placeable)
+        spatialIndex_.Update(entity->Id(), placeable->WorldPosition());
+    else
+        spatialIndex_.Remove(entity->Id());
+
     /// @todo sound sources
 /*
     shared_ptr<EC_Sound> sound = entity->Component<EC_Sound>();
@@ -2954,21 +5001,29 @@ void SyncManager::ComputePriorityForEntitySyncState(SceneSyncState *sceneState,
         OBB worldObb;
         if (framework_->IsHeadless())
         {
-            // On headless mode, force mesh asset load in order to be able to inspect its AABB.
-            if (!mesh->MeshAsset() && !mesh->meshRef.Get().ref.trimmed().isEmpty())
+            // EC_Mesh::WorldOBB not usable in headless mode (no Ogre::Entity available), so read the bounds
+            // from the header of the mesh data instead, without loading the mesh to Ogre.
+            const QString meshRef = mesh->meshRef.Get().ref.trimmed();
+            AABB localBounds;
+            localBounds.SetNegativeInfinity();
+            if (!meshRef.isEmpty() && !MeshBoundsForRef(meshRef, localBounds))
+                return; // compute the priority next time when the mesh data is available
+            if (localBounds.IsFinite())
+                worldObb = OBB(localBounds);
+            else
             {
-                mesh->ForceMeshLoad();
-                return; // compute the priority next time when mesh asset is available
+                // Not an Ogre binary mesh, e.g. a mesh imported with Open Asset Import: force mesh asset load in order to be able to inspect its AABB.
+                if (!mesh->MeshAsset() && !meshRef.isEmpty())
+                {
+                    mesh->ForceMeshLoad();
+                    return; // compute the priority next time when mesh asset is available
+                }
+                Ogre::MeshPtr ogreMesh = mesh->MeshAsset() ? mesh->MeshAsset()->ogreMesh : Ogre::MeshPtr();
+                if (ogreMesh.isNull())
+                    LogWarning("SyncManager::ComputePriorityForEntitySyncState: " + entity->ToString().toStdString() + " has null Ogre mesh " + mesh->GetMeshName());
+                worldObb = !ogreMesh.isNull() ? AABB(ogreMesh->getBounds()) : OBB();
             }
-            // EC_Mesh::WorldOBB not usable in headless mode (no Ogre::Entity available),
-            // so we must dig the bounding volume information from OgreMeshAsset (Ogre::Mesh) instead.
-            /// @todo For some meshes (f.ex. floor of the Avatar scene) there seems to be significant disperancy
-            // between the OBB values when running as headless or not. Investigate.
-            Ogre::MeshPtr ogreMesh = mesh->MeshAsset() ? mesh->MeshAsset()->ogreMesh : Ogre::MeshPtr();
-            if (ogreMesh.isNull())
-                LogWarning("SyncManager::ComputePriorityForEntitySyncState: " + entity->ToString().toStdString() + " has null Ogre mesh " + mesh->GetMeshName());
-            worldObb = !ogreMesh.isNull() ? AABB(ogreMesh->getBounds()) : OBB();
-            worldObb.Transform(placeable->LocalToWorld());
+            worldObb.Transform(placeable->LocalToWorld() * mesh->nodeTransformation.Get().ToFloat3x4());
         }
         else
             worldObb = mesh->WorldOBB();
@@ -2984,15 +5039,133 @@ void SyncManager::ComputePriorityForEntitySyncState(SceneSyncState *sceneState,
     /// @todo Hardcoded relevancy of 10 for entities with RigidBody component and 1 for others for now.
     /// @todo Movement of non-physical entities is too jerky.
     entityState.relevancy = rigidBody /*entity->Component("EC_Avatar")*/ ? 10.f : 1.f;
+    // Entities outside the observer's view cone are less relevant.
+    if (placeable && viewConeAngle_ < 180.f && sceneState->observerForward.IsFinite())
+        entityState.relevancy *= ViewConeRelevancy(sceneState->observerPos, sceneState->observerForward, Cos(DegToRad(viewConeAngle_)), placeable->WorldPosition());
     LogDebug(QString("%1 P %2 R %3 P*R %4 syncRate %5").arg(entity->ToString()).arg(
         entityState.priority).arg(entityState.relevancy).arg(entityState.FinalPriority()).arg(entityState.ComputePrioritizedUpdateInterval(updatePeriod_)));
 }
 
-void SyncManager::ComputePrioritiesForEntitySyncStates(SceneSyncState *sceneState) const
+void SyncManager::ComputePrioritiesForEntitySyncStates(SceneSyncState *sceneState)
 {
     PROFILE(SyncManager_ComputePrioritiesForEntitySyncStates);
-    for(std::map<entity_id_t, EntitySyncState>::iterator it = sceneState->entities.begin(); it != sceneState->entities.end(); ++it)
-        ComputePriorityForEntitySyncState(sceneState, it->second, 0);
+    if (!sceneState || sceneState->entities.empty())
+        return;
+
+    typedef EntitySyncStateMap::iterator EntityStateIter;
+
+    // Until observer information has been received and the spatial index populated, visit every entity.
+    if (!sceneState->observerPos.IsFinite() || spatialIndex_.Size() == 0)
+    {
+        for(EntityStateIter it = sceneState->entities.begin(); it != sceneState->entities.end(); ++it)
+            ComputePriorityForEntitySyncState(sceneState, it->second, 0);
+        return;
+    }
+
+    // Entities near the observer are re-prioritised on every priority tick.
+    nearEntities_.clear();
+    spatialIndex_.EntitiesNear(sceneState->observerPos, priorityNearRadius_, nearEntities_);
+    for(size_t i = 0; i < nearEntities_.size(); ++i)
+    {
+        EntityStateIter it = sceneState->entities.find(nearEntities_[i]);
+        if (it != sceneState->entities.end())
+            ComputePriorityForEntitySyncState(sceneState, it->second, 0);
+    }
+
+    // The priority of far entities changes slowly, so they are refreshed in coarse buckets:
+    // on each tick only a slice of the sync state's hash buckets, continuing from where the previous tick stopped.
+    EntitySyncStateMap &entities = sceneState->entities;
+    const size_t cNumFarBuckets = 8;
+    const size_t numBuckets = entities.bucket_count();
+    const size_t sliceSize = std::max<size_t>(entities.size() / cNumFarBuckets, 1);
+    size_t bucket = sceneState->priorityRefreshCursor % numBuckets;
+    size_t numVisited = 0;
+    for(size_t n = 0; n < numBuckets && numVisited < sliceSize; ++n)
+    {
+        for(EntitySyncStateMap::local_iterator it = entities.begin(bucket); it != entities.end(bucket); ++it, ++numVisited)
+            ComputePriorityForEntitySyncState(sceneState, it->second, 0);
+        bucket = (bucket + 1) % numBuckets;
+    }
+    sceneState->priorityRefreshCursor = bucket;
+}
+
+const EntitySpatialGrid *SyncManager::SpatialIndex(const Scene *scene) const
+{
+    if (!scene || !interestManagementEnabled_ || !owner_->IsServer() || scene_.lock().get() != scene)
+        return 0;
+    return &spatialIndex_;
+}
+
+void SyncManager::UpdateSpatialIndex(Entity *entity)
+{
+    if (!entity || entity->IsLocal())
+        return;
+    EC_Placeable *placeable = entity->Component<EC_Placeable>().get();
+    if (placeable)
+        spatialIndex_.Update(entity->Id(), placeable->WorldPosition());
+    else
+        spatialIndex_.Remove(entity->Id());
+}
+
+bool SyncManager::MeshBoundsForRef(const QString &ref, AABB &bounds)
+{
+    AssetAPI *assetAPI = framework_->Asset();
+    const QString resolved = assetAPI->ResolveAssetRef("", ref);
+    QHash<QString, AABB>::const_iterator it = meshBounds_.find(resolved);
+    if (it != meshBounds_.end())
+    {
+        bounds = *it;
+        return true;
+    }
+    if (pendingMeshBounds_.contains(resolved))
+        return false;
+
+    if (OgreMeshBounds::Find(assetAPI, resolved, bounds))
+    {
+        meshBounds_[resolved] = bounds;
+        return true;
+    }
+    // An asset of the ref that is loaded without its data on the disk, e.g. from memory, is not replaced with a binary asset.
+    // The priority then falls back to its Ogre mesh.
+    AssetTransferPtr transfer = !assetAPI->GetAsset(resolved) ? assetAPI->RequestAsset(resolved, "Binary") : AssetTransferPtr();
+    if (!transfer)
+    {
+        bounds.SetNegativeInfinity();
+        meshBounds_[resolved] = bounds;
+        return true;
+    }
+    pendingMeshBounds_.insert(resolved);
+    connect(transfer.get(), SIGNAL(Succeeded(AssetPtr)), SLOT(OnMeshDataLoaded(AssetPtr)), Qt::UniqueConnection);
+    connect(transfer.get(), SIGNAL(Failed(IAssetTransfer*, QString)), SLOT(OnMeshDataFailed(IAssetTransfer*, QString)), Qt::UniqueConnection);
+    return false;
+}
+
+void SyncManager::OnMeshDataLoaded(AssetPtr asset)
+{
+    const QString ref = asset->Name();
+    pendingMeshBounds_.remove(ref);
+
+    // Read from the asset cache if the data was downloaded, so that the bounds are kept in its content index for the later runs.
+    AABB bounds;
+    AssetCache *cache = framework_->Asset()->Cache();
+    BinaryAsset *binary = dynamic_cast<BinaryAsset *>(asset.get());
+    if (!(cache && cache->MeshBounds(ref, bounds)) &&
+        !(binary && !binary->data.empty() && OgreMeshBounds::Read(&binary->data[0], binary->data.size(), bounds)))
+        bounds.SetNegativeInfinity();
+    meshBounds_[ref] = bounds;
+
+    // Only the bounds were needed. Forget the binary asset so that it does not take the place of a mesh asset of the same ref.
+    if (binary)
+        framework_->Asset()->ForgetAsset(asset, false);
+}
+
+void SyncManager::OnMeshDataFailed(IAssetTransfer *transfer, QString /*reason*/)
+{
+    const QString ref = transfer->SourceUrl();
+    pendingMeshBounds_.remove(ref);
+    AABB bounds;
+    bounds.SetNegativeInfinity();
+    meshBounds_[ref] = bounds;
 }
 
 void SyncManager::HandleObserverPosition(UserConnection* source, const char* data, size_t numBytes)
@@ -3017,7 +5190,11 @@ void SyncManager::HandleObserverPosition(UserConnection* source, const char* dat
     if (posSendType)
         syncState->observerPos = pos;
     if (rotSendType)
+    {
         syncState->observerRot = RadToDeg(rot.ToEulerZYX());
+        if (scene_.lock())
+            syncState->observerForward = (rot * scene_.lock()->ForwardVector()).Normalized();
+    }
 }
 
 }
@@ -6,16 +6,32 @@
 #include "TundraProtocolModuleApi.h"
 
 #include "SyncState.h"
+#include "EntitySpatialGrid.h"
+#include "AttributeUpdateCache.h"
+#include "AttributeChangeLog.h"
+#include "ReplicationStatistics.h"
+#include "SyncAssemblyContext.h"
 #include "SceneFwd.h"
 #include "AttributeChangeType.h"
 #include "EntityAction.h"
+#include "AttributeChangeListener.h"
+#include "AssetFwd.h"
+#include "Geometry/AABB.h"
 
 #include <kNetFwd.h>
 #include <kNet/Types.h>
 
 #include <QObject>
+#include <QByteArray>
+#include <QStringList>
+#include <QHash>
+#include <QSet>
+
+#include <set>
 
 class Framework;
+class QThreadPool;
+class SyncTrace;
 
 namespace TundraLogic
 {
@@ -24,13 +40,28 @@ namespace TundraLogic
 
     Alternatively, SyncManager and SceneSyncState can be used to implement prioritization logic on how and when
     a sync state is filled per client connection. */
-class TUNDRAPROTOCOL_MODULE_API SyncManager : public QObject
+class TUNDRAPROTOCOL_MODULE_API SyncManager : public QObject, public IAttributeChangeListener
 {
     Q_OBJECT
     Q_PROPERTY(float updatePeriod READ GetUpdatePeriod WRITE SetUpdatePeriod) /**< @copydoc updatePeriod_ */
     Q_PROPERTY(bool interestManagementEnabled READ IsInterestManagementEnabled WRITE SetInterestManagementEnabled) /**< @copydoc interestManagementEnabled */
     Q_PROPERTY(EntityPtr observer READ Observer WRITE SetObserver) /**< @copydoc observer */
     Q_PROPERTY(float priorityUpdatePeriod READ PriorityUpdatePeriod WRITE SetPriorityUpdatePeriod) /**< @copydoc priorityUpdatePeriod_ */
+    Q_PROPERTY(float priorityNearRadius READ PriorityNearRadius WRITE SetPriorityNearRadius) /**< @copydoc priorityNearRadius_ */
+    Q_PROPERTY(float viewConeAngle READ ViewConeAngle WRITE SetViewConeAngle) /**< @copydoc viewConeAngle_ */
+    Q_PROPERTY(int syncThreadCount READ SyncThreadCount WRITE SetSyncThreadCount) /**< @copydoc syncThreadCount_ */
+    Q_PROPERTY(bool attributeDeltasEnabled READ AttributeDeltasEnabled WRITE SetAttributeDeltasEnabled) /**< @copydoc attributeDeltasEnabled_ */
+    Q_PROPERTY(int syncBatchSize READ SyncBatchSize WRITE SetSyncBatchSize) /**< @copydoc syncBatchSize_ */
+    Q_PROPERTY(int compressionThreshold READ CompressionThreshold WRITE SetCompressionThreshold) /**< @copydoc compressionThreshold_ */
+    Q_PROPERTY(bool sceneSnapshotsEnabled READ SceneSnapshotsEnabled WRITE SetSceneSnapshotsEnabled) /**< @copydoc sceneSnapshotsEnabled_ */
+    Q_PROPERTY(bool adaptiveUpdateRateEnabled READ AdaptiveUpdateRateEnabled WRITE SetAdaptiveUpdateRateEnabled) /**< @copydoc adaptiveUpdateRateEnabled_ */
+    Q_PROPERTY(float maxUpdatePeriod READ MaxUpdatePeriod WRITE SetMaxUpdatePeriod) /**< @copydoc maxUpdatePeriod_ */
+    Q_PROPERTY(float deadReckoningThreshold READ DeadReckoningThreshold WRITE SetDeadReckoningThreshold) /**< @copydoc deadReckoningThreshold_ */
+    Q_PROPERTY(int progressiveJoinQuota READ ProgressiveJoinQuota WRITE SetProgressiveJoinQuota) /**< @copydoc progressiveJoinQuota_ */
+    Q_PROPERTY(float syncStateCompactDistance READ SyncStateCompactDistance WRITE SetSyncStateCompactDistance) /**< @copydoc syncStateCompactDistance_ */
+    Q_PROPERTY(QStringList idempotentActions READ IdempotentActions WRITE SetIdempotentActions) /**< @copydoc idempotentActions_ */
+    Q_PROPERTY(bool statisticsEnabled READ StatisticsEnabled WRITE SetStatisticsEnabled) /**< @copydoc statisticsEnabled_ */
+    Q_PROPERTY(float sessionResumeTime READ SessionResumeTime WRITE SetSessionResumeTime) /**< @copydoc sessionResumeTime_ */
 
 public:
     explicit SyncManager(TundraLogicModule* owner);
@@ -43,13 +74,24 @@ public:
     void Update(f64 frametime);
     
     /// Create new replication state for user and dirty it (server operation only)
+    /** If the user logs in with the resume token of a suspended session, the session's sync state is resumed instead,
+        and only the changes since the last sync checkpoint the client received are sent. SceneStateCreated is not
+        emitted for a resumed state. */
     void NewUserConnected(const UserConnectionPtr &user);
 
+    /// Keeps the sync state of a disconnecting user for sessionResumeTime_ seconds, so that the client can resume it (server operation only).
+    void SuspendUserSession(UserConnection *user);
+
     /// Enables or disables the interest management. @remark Interest management
     void SetInterestManagementEnabled(bool enabled) { interestManagementEnabled_ = enabled; }
     /// Returns is the interest management enabled. @remark Interest management
     bool IsInterestManagementEnabled() const { return interestManagementEnabled_; }
 
+    /// Returns the spatial index of the replicated entities of the scene, or null if the index is not maintained for it. @remark Interest management
+    /** The index is maintained on the server while the interest management is enabled. It contains only the replicated
+        entities, by the world positions of their placeables, and is as conservative as EntitySpatialGrid::EntitiesNear. */
+    const EntitySpatialGrid *SpatialIndex(const Scene *scene) const;
+
     /// Sets the client's observer entity. @remark Interest management
     /** @note The entity needs to have Placeable component present in order to be usable. */
     void SetObserver(const EntityPtr &entity) { observer_ = entity; }
@@ -61,6 +103,85 @@ public:
     /// Returns priority update period. @copydoc priorityUpdatePeriod_ @remark Interest management
     float PriorityUpdatePeriod() const { return priorityUpdatePeriod_; }
 
+    /// Sets the radius around the observer inside which priorities are recomputed on every priority tick. @copydoc priorityNearRadius_ @remark Interest management
+    void SetPriorityNearRadius(float radius);
+    /// Returns the near priority radius. @copydoc priorityNearRadius_ @remark Interest management
+    float PriorityNearRadius() const { return priorityNearRadius_; }
+
+    /// Sets the half angle in degrees of the observer's view cone, 180 disables the view cone. @copydoc viewConeAngle_ @remark Interest management
+    void SetViewConeAngle(float degrees) { viewConeAngle_ = Clamp(degrees, 0.f, 180.f); }
+    /// Returns the half angle in degrees of the observer's view cone. @copydoc viewConeAngle_ @remark Interest management
+    float ViewConeAngle() const { return viewConeAngle_; }
+
+    /// Sets the number of worker threads used to assemble sync messages for the user connections (server only). @copydoc syncThreadCount_
+    void SetSyncThreadCount(int count);
+    /// Returns the number of sync worker threads. @copydoc syncThreadCount_
+    int SyncThreadCount() const { return syncThreadCount_; }
+
+    /// Enables or disables delta-encoding of attribute edits sent to clients (server only). @copydoc attributeDeltasEnabled_
+    void SetAttributeDeltasEnabled(bool enabled) { attributeDeltasEnabled_ = enabled; }
+    /// Returns whether attribute edits are delta-encoded. @copydoc attributeDeltasEnabled_
+    bool AttributeDeltasEnabled() const { return attributeDeltasEnabled_; }
+
+    /// Sets the largest SceneSyncBatch message size in bytes, 0 disables batching (server only). @copydoc syncBatchSize_
+    void SetSyncBatchSize(int numBytes) { syncBatchSize_ = numBytes > 0 ? numBytes : 0; }
+    /// Returns the largest SceneSyncBatch message size in bytes. @copydoc syncBatchSize_
+    int SyncBatchSize() const { return syncBatchSize_; }
+
+    /// Sets the message size in bytes from which scenesync and component type messages are sent compressed, 0 disables compression. @copydoc compressionThreshold_
+    void SetCompressionThreshold(int numBytes) { compressionThreshold_ = numBytes > 0 ? numBytes : 0; }
+    /// Returns the message size in bytes from which messages are sent compressed. @copydoc compressionThreshold_
+    int CompressionThreshold() const { return compressionThreshold_; }
+
+    /// Enables or disables sending the scene to joining clients as a compressed snapshot (server only). @copydoc sceneSnapshotsEnabled_
+    void SetSceneSnapshotsEnabled(bool enabled) { sceneSnapshotsEnabled_ = enabled; }
+    /// Returns whether joining clients receive the scene as a snapshot. @copydoc sceneSnapshotsEnabled_
+    bool SceneSnapshotsEnabled() const { return sceneSnapshotsEnabled_; }
+
+    /// Enables or disables adapting each connection's update period to its round-trip time, loss and queue length (server only). @copydoc adaptiveUpdateRateEnabled_
+    void SetAdaptiveUpdateRateEnabled(bool enabled) { adaptiveUpdateRateEnabled_ = enabled; }
+    /// Returns whether the connections' update periods are adapted. @copydoc adaptiveUpdateRateEnabled_
+    bool AdaptiveUpdateRateEnabled() const { return adaptiveUpdateRateEnabled_; }
+
+    /// Sets the longest update period an adapted connection can get, in seconds. @copydoc maxUpdatePeriod_
+    void SetMaxUpdatePeriod(float period);
+    /// Returns the longest adapted update period in seconds. @copydoc maxUpdatePeriod_
+    float MaxUpdatePeriod() const { return maxUpdatePeriod_; }
+
+    /// Sets the default predicted client-side position error in meters above which rigid body updates are sent, 0 disables dead reckoning (server only). @copydoc deadReckoningThreshold_
+    void SetDeadReckoningThreshold(float meters) { deadReckoningThreshold_ = std::max(meters, 0.f); }
+    /// Returns the default dead reckoning error threshold in meters. @copydoc deadReckoningThreshold_
+    float DeadReckoningThreshold() const { return deadReckoningThreshold_; }
+
+    /// Sets the number of entities sent per network update tick to each joining user, 0 disables progressive joins (server only). @copydoc progressiveJoinQuota_
+    /** @note Applies to users connecting afterwards. */
+    void SetProgressiveJoinQuota(int numEntities) { progressiveJoinQuota_ = numEntities > 0 ? numEntities : 0; }
+    /// Returns the number of entities sent per network update tick to each joining user. @copydoc progressiveJoinQuota_
+    int ProgressiveJoinQuota() const { return progressiveJoinQuota_; }
+
+    /// Sets the distance from a user's observer beyond which idle entities' sync states are compacted, 0 disables compaction (server only). @copydoc syncStateCompactDistance_
+    void SetSyncStateCompactDistance(float distance) { syncStateCompactDistance_ = std::max(distance, 0.f); }
+    /// Returns the sync state compaction distance. @copydoc syncStateCompactDistance_
+    float SyncStateCompactDistance() const { return syncStateCompactDistance_; }
+
+    /// Sets the names of the entity actions whose identical queued copies are coalesced to one per network update tick (server only). @copydoc idempotentActions_
+    void SetIdempotentActions(const QStringList &names);
+    /// Returns the names of the coalesced entity actions. @copydoc idempotentActions_
+    QStringList IdempotentActions() const;
+
+    /// Enables or disables recording the replication statistics. @copydoc statisticsEnabled_
+    void SetStatisticsEnabled(bool enabled) { statisticsEnabled_ = enabled; }
+    /// Returns whether the replication statistics are recorded. @copydoc statisticsEnabled_
+    bool StatisticsEnabled() const { return statisticsEnabled_; }
+
+    /// Returns the replication statistics.
+    const ReplicationStatistics &Statistics() const { return statistics_; }
+
+    /// Sets the time in seconds the sync state of a disconnected user is kept for resuming the session, 0 disables resuming (server only). @copydoc sessionResumeTime_
+    void SetSessionResumeTime(float seconds) { sessionResumeTime_ = std::max(seconds, 0.f); }
+    /// Returns the time in seconds the sync state of a disconnected user is kept. @copydoc sessionResumeTime_
+    float SessionResumeTime() const { return sessionResumeTime_; }
+
 public slots:
     /// Set update period (seconds), 0.01 at fastest.
     void SetUpdatePeriod(float period);
@@ -68,10 +189,70 @@ public slots:
     /// Get update period
     float GetUpdatePeriod() const { return updatePeriod_; }
 
+    /// Sets the default sync data rate limit for new user connections of a connection type (server only).
+    /** @param connectionType UserConnection::ConnectionType(), f.ex. "knet" or "websocket". Empty sets the limit for types without their own limit.
+        @param bytesPerSecond Rate limit, 0 for unlimited.
+        @note Applies to connections made afterwards. Use SceneSyncState::SetBandwidthLimit to change the limit of an existing connection. */
+    void SetBandwidthLimit(const QString &connectionType, float bytesPerSecond);
+
+    /// Returns the default sync data rate limit of a connection type in bytes per second, 0 if unlimited.
+    float BandwidthLimit(const QString &connectionType) const;
+
     // DEPRECATED
     SceneSyncState* SceneState(u32 connectionId) const;/**< @deprecated Use UserConnection::syncState property from script @note This slot is only usable when running as server, otherwise will return null ptr. */
     SceneSyncState* SceneState(const UserConnectionPtr &connection) const; /**< @deprecated Use UserConnection::syncState property from script @overload*/
 
+    /// Returns the replication statistics per component type, see ReplicationStatistics::Components. Each entry also has the typeName.
+    QVariantList ComponentStatistics() const;
+
+    /// Returns the replication statistics per component type attribute, see ReplicationStatistics::Attributes. Each entry also has the typeName.
+    QVariantList AttributeStatistics() const;
+
+    /// Returns the approximate memory usage of the sync states of all the connections, aggregated by component type.
+    /** Each entry is a map of typeName, count (number of component sync states) and bytes. The entry with the typeName
+        "Entity" has the entity sync states, including the compacted ones, and their dirty queues. */
+    QVariantList SyncStateMemoryStatistics() const;
+
+    /// Returns the replication statistics per connection and message type, see ReplicationStatistics::Messages.
+    QVariantList MessageStatistics() const { return statistics_.Messages(); }
+
+    /// Clears the replication statistics.
+    void ResetStatistics() { statistics_.Reset(); }
+
+    /// Sets the dead reckoning error threshold of an entity in meters, overriding deadReckoningThreshold (server only).
+    /** 0 disables dead reckoning for the entity, a negative value removes the override. */
+    void SetEntityDeadReckoningThreshold(entity_id_t id, float meters);
+
+    /// Returns the dead reckoning error threshold of an entity in meters.
+    float EntityDeadReckoningThreshold(entity_id_t id) const;
+
+    /// Sets whether the rigid body of an entity is predicted by the local physics, e.g. one controlled by the user (client only).
+    /** A predicted body is simulated locally instead of interpolated between the server updates. The physics world is put
+        to the deterministic mode and keeps a history of the body, so that when an update from the server disagrees with
+        the prediction of roughly a round trip ago, the body is rolled back to the server state and resimulated, see
+        PhysicsWorld::CorrectPrediction. The entity needs an EC_RigidBody. */
+    void SetLocallyPredicted(Entity *entity, bool enable);
+
+    /// Returns whether the rigid body of an entity is predicted by the local physics.
+    bool IsLocallyPredicted(Entity *entity) const;
+
+    /// Starts capturing the network messages received from the users to a trace file, see SyncTrace (server only).
+    /** The users already connected are recorded first. For a deterministic replay, start the capture with the server
+        using --syncCapture. @return False if the file could not be created. */
+    bool StartTraceCapture(const QString &filename);
+
+    /// Stops the trace capture and closes the trace file.
+    void StopTraceCapture();
+
+    /// Returns whether the received network messages are captured to a trace file.
+    bool IsCapturingTrace() const;
+
+    /// Feeds a captured trace to the message handlers as fast as possible and reports the time spent in them (server only).
+    /** The captured users are replayed as SyncTraceUserConnections, which discard the messages sent to them.
+        @return The results: the number of messages, the replay and trace durations in seconds, and the handler
+        time per message type, or an empty map if the trace could not be replayed. */
+    QVariantMap ReplayTrace(const QString &filename);
+
 signals:
     /// This signal is emitted when a new user connects and a new SceneSyncState is created for the connection.
     /// @note See signals of the SceneSyncState object to build prioritization logic how the sync state is filled.
@@ -82,8 +263,14 @@ private slots:
     /// Network message received from an user connection
     void HandleNetworkMessage(UserConnection* user, kNet::packet_id_t packetId, kNet::message_id_t messageId, const char* data, size_t numBytes);
 
-    /// Trigger EC sync because of component attributes changing
-    void OnAttributeChanged(IComponent* comp, IAttribute* attr, AttributeChange::Type change);
+    /// Records a network message received from an user connection to the trace capture, if capturing.
+    void CaptureNetworkMessage(UserConnection* user, kNet::packet_id_t packetId, kNet::message_id_t messageId, const char* data, size_t numBytes);
+
+    /// Records a user disconnection to the trace capture, if capturing.
+    void OnUserDisconnected(u32 connectionId, UserConnection *user);
+
+    /// Sets the metrics of the scene sync traffic of each connection, see MetricsRegistry::Collect.
+    void CollectMetrics();
 
     /// Trigger EC sync because of component attribute added
     void OnAttributeAdded(IComponent* comp, IAttribute* attr, AttributeChange::Type change);
@@ -103,6 +290,18 @@ private slots:
     /// Trigger sync of entity removal
     void OnEntityRemoved(Entity* entity, AttributeChange::Type change);
 
+    /// Trigger sync of the creation of entities created with Scene::CreateEntities
+    void OnEntitiesCreated(const EntityList &entities, AttributeChange::Type change);
+
+    /// Reads the bounds of mesh data requested by MeshBoundsForRef. @remark Interest management
+    void OnMeshDataLoaded(AssetPtr asset);
+
+    /// Marks the mesh data requested by MeshBoundsForRef as having no bounds. @remark Interest management
+    void OnMeshDataFailed(IAssetTransfer *transfer, QString reason);
+
+    /// Trigger sync of the removal of entities removed with Scene::RemoveEntities
+    void OnEntitiesRemoved(const EntityList &entities, AttributeChange::Type change);
+
     /// Trigger sync of entity action.
     void OnActionTriggered(Entity *entity, const QString &action, const QStringList &params, EntityAction::ExecTypeField type);
 
@@ -119,18 +318,83 @@ private slots:
     void OnPlaceholderComponentTypeRegistered(u32 typeId, const QString& typeName, AttributeChange::Type change);
 
 private:
+    friend class SyncAssemblyTask;
+
+    /// Trigger EC sync because of component attributes changing. Registered to the scene as an attribute change listener.
+    void OnAttributeChanged(IComponent* comp, IAttribute* attr, AttributeChange::Type change);
+
+    /// Craft a CreateEntity message of the entity and its replicated components.
+    /** @param hierarchic Whether the receiver supports ProtocolHierarchicScene, in which the parent entity ID is included.
+        @param prototypeState Sync state of a receiver that supports ProtocolPrototypeEntities, or null. If the receiver has the
+            prototype of the entity, the components the entity shares with the prototype are written as overrides of the prototype's. */
+    void WriteCreateEntity(kNet::DataSerializer& ds, unsigned sceneId, Entity *entity, bool hierarchic, SceneSyncState *prototypeState, SyncAssemblyContext &ctx);
+    /// Returns whether the receiver of the sync state has the current attribute values of the component, i.e. it has been created and is not dirty.
+    static bool HasSyncedComponent(SceneSyncState *state, entity_id_t entityId, component_id_t compId);
+    /// Marks the replicated components of the entity processed (created and undirty) in the sync state.
+    void MarkReplicatedComponentsProcessed(SceneSyncState *state, Entity *entity);
+    /// Adapts the user's update period, SceneSyncState::updatePeriod, to the connection quality (server only).
+    void UpdateConnectionUpdatePeriod(UserConnection *user);
+    /// Rebuilds the cached scene snapshot from the current replicated scene (server only).
+    void BuildSceneSnapshot();
+    /// Sends the scene snapshot to a newly connected user, rebuilding it first if the scene has changed (server only).
+    /** @return False if the user does not support snapshots or its sync state is filtered, in which case the entities are streamed as usual. */
+    bool SendSceneSnapshot(UserConnection *user);
+    /// Sends the next entities of a progressively joining user's join queue, at most progressiveJoinQuota_ per call (server only).
+    void ProcessProgressiveJoin(UserConnection *user);
+    /// Sorts the join queue to distance rings around the user's current observer position, farthest first (server only).
+    void SortJoinQueue(SceneSyncState *state, Scene *scene);
+    /// Compacts the sync states of the idle, distant entities in the next slice of the user's sync state (server only).
+    void CompactSyncState(SceneSyncState *state, Scene *scene);
+    /// Gives the observer positions of the users to the physics LOD of the scene, if enabled (server only).
+    void UpdatePhysicsObservers(Scene *scene);
+    /// Resumes the suspended session whose resume token the user logged in with, if the client has the state of one of its checkpoints (server only).
+    /** @return False if the session could not be resumed, in which case the user is sent the whole scene. */
+    bool ResumeUserSession(const UserConnectionPtr &user);
+    /// Sends the user a sync checkpoint, if all the changes marked to its sync state have been sent since the previous one (server only).
+    void SendSyncCheckpoint(UserConnection *user);
+    /// Drops the suspended sessions that have not been resumed in time (server only).
+    void ExpireSuspendedSessions(float elapsed);
     /// Craft a component full update, with all static and dynamic attributes.
-    void WriteComponentFullUpdate(kNet::DataSerializer& ds, ComponentPtr comp);
+    void WriteComponentFullUpdate(kNet::DataSerializer& ds, ComponentPtr comp, SyncAssemblyContext &ctx);
+    /// Craft a component update of an instance's component that only has the static attributes overridden from the prototype component, see Entity::Prototype.
+    /** The attribute data starts with the number of static attributes and a bitfield of the overridden ones, followed by their values. */
+    void WriteComponentOverrides(kNet::DataSerializer& ds, IComponent *comp, IComponent *prototypeComp, SyncAssemblyContext &ctx);
+    /// Writes an attribute value to an EditAttributes message, as a delta to the connection's baseline if possible.
+    /** @param deltaFormat Whether the connection uses the ProtocolAttributeDeltas format, in which each value is preceded by a delta flag bit.
+        @param quantize Whether the connection supports ProtocolAttributeQuantization, in which values are quantized according to their AttributeMetadata hints.
+        @param useDeltas Whether deltas may be written, or only full values. */
+    void WriteAttributeValue(kNet::DataSerializer& ds, IAttribute *attr, u8 attrIndex, SceneSyncState *state, entity_id_t entityId, component_id_t compId,
+        bool deltaFormat, bool quantize, bool useDeltas, SyncAssemblyContext &ctx);
+    /// Reads an attribute value written by WriteAttributeValue from an EditAttributes message, and updates the connection's baseline.
+    /** @param deltaFormat Whether the connection uses the ProtocolAttributeDeltas format.
+        @param quantize Whether the connection uses the ProtocolAttributeQuantization format.
+        @return False if the value could not be reconstructed. */
+    bool ReadAttributeValue(kNet::DataDeserializer& ds, IAttribute *target, u8 attrIndex, SceneSyncState *state, entity_id_t entityId, component_id_t compId, bool deltaFormat, bool quantize);
+    /// Writes the current values of latest-value-only attributes of a component to an EditLatestAttributes message.
+    void WriteLatestAttributes(kNet::DataSerializer& ds, IComponent *comp, component_id_t compId, const std::vector<u8> &attrIndices, SyncAssemblyContext &ctx);
+    /// Sends reliably the final values of the latest-value-only attributes that were sent unreliably but did not change on this tick (server only).
+    void SettleLatestAttributes(UserConnection *user, Scene *scene, SyncAssemblyContext &ctx);
     /// Handle entity action message.
-    void HandleEntityAction(UserConnection* source, MsgEntityAction& msg);
+    /** @param actionId Interned id of the action name (EntityAction::ActionId) if known, 0 to intern the name of the message. */
+    void HandleEntityAction(UserConnection* source, MsgEntityAction& msg, u32 actionId = 0);
+    /// Handle entity action batch message: handles each action in order (client only).
+    void HandleEntityActionBatch(UserConnection* source, const char* data, size_t numBytes);
     /// Handle create entity message.
     void HandleCreateEntity(UserConnection* source, const char* data, size_t numBytes);
     /// Handle create components message.
     void HandleCreateComponents(UserConnection* source, const char* data, size_t numBytes);
     /// Handle create attributes message.
     void HandleCreateAttributes(UserConnection* source, const char* data, size_t numBytes);
+    /// Handle scene snapshot message: decompresses the snapshot and handles its CreateEntity messages.
+    void HandleSceneSnapshot(UserConnection* source, kNet::packet_id_t packetId, const char* data, size_t numBytes);
+    /// Handle scene sync batch message: handles each packed message in order.
+    void HandleSceneSyncBatch(UserConnection* source, kNet::packet_id_t packetId, const char* data, size_t numBytes);
+    /// Handle compressed message: decompresses the message and handles it.
+    void HandleCompressedMessage(UserConnection* source, kNet::packet_id_t packetId, const char* data, size_t numBytes);
     /// Handle edit attributes message.
     void HandleEditAttributes(UserConnection* source, const char* data, size_t numBytes);
+    /// Handle edit latest attributes message (client only).
+    void HandleEditLatestAttributes(UserConnection* source, const char* data, size_t numBytes);
     /// Handle remove attributes message.
     void HandleRemoveAttributes(UserConnection* source, const char* data, size_t numBytes);
     /// Handle remove components message.
@@ -151,10 +415,14 @@ private:
     void HandleRigidBodyChanges(UserConnection* source, kNet::packet_id_t packetId, const char* data, size_t numBytes);
     
     void ReplicateRigidBodyChanges(UserConnection* user);
+    /// Crafts the rigid body update messages for the user. Safe to call from a sync worker thread.
+    void AssembleRigidBodyChanges(UserConnection* user, SyncAssemblyContext &ctx);
 
     void InterpolateRigidBodies(f64 frametime, SceneSyncState* state);
 
     void ReplicateComponentType(u32 typeId, UserConnection* connection = 0);
+    /// Sends a RegisterComponentType message to the user, or its compressed form if given and supported by the user.
+    void SendComponentType(UserConnection* user, kNet::DataSerializer &ds, const std::vector<char> &compressed);
 
     /// Read client extrapolation time parameter from command line and match it to the current sync period.
     void GetClientExtrapolationTime();
@@ -162,6 +430,17 @@ private:
     /// Process one user connection's sync state for changes in the scene. Note that on the client the server is a "virtual" user
     /** @param user User connection to process */
     void ProcessSyncState(UserConnection* user);
+    /// Crafts the scene sync messages for the user's dirty entities. Safe to call from a sync worker thread.
+    /** Reads the scene and modifies only the user's own sync state. Messages and log output go through @c ctx. */
+    void AssembleSyncState(UserConnection* user, SyncAssemblyContext &ctx);
+    /// Sends knowledge of registered placeholder component types to the user, if not yet sent.
+    void SendPlaceholderComponentTypes(UserConnection* user);
+    /// Sends the entity actions queued to the user's sync state.
+    /** Identical actions of the idempotentActions_ names are sent once. The rest go in one EntityActionBatch message to
+        peers that support it, and as one EntityAction message each to others. */
+    void SendQueuedActions(UserConnection* user);
+    /// Assembles the sync messages of the users on the sync worker threads, then sends them on the calling (main) thread.
+    void ProcessSyncStatesParallel(const std::vector<UserConnection*> &users);
     
     /// Validate the scene manipulation action. If returns false, it is ignored
     /** @param source Where the action came from
@@ -177,9 +456,15 @@ private:
     void SendObserverPosition(UserConnection* connection, SceneSyncState *senderState);
     /// (Re)computes priority for entity. @remark Interest management
     /** @param entity Entity pointer, if available, otherwise retrieved from Scene by ID. */
-    void ComputePriorityForEntitySyncState(SceneSyncState *sceneState, EntitySyncState &entityState, Entity *entity) const;
-    /// (Re)computes priorities for all entities in the scene. @remark Interest management
-    void ComputePrioritiesForEntitySyncStates(SceneSyncState *sceneState) const;
+    void ComputePriorityForEntitySyncState(SceneSyncState *sceneState, EntitySyncState &entityState, Entity *entity);
+    /// (Re)computes priorities for the entities near the observer, and for a slice of the farther ones. @remark Interest management
+    void ComputePrioritiesForEntitySyncStates(SceneSyncState *sceneState);
+    /// Updates or removes the entity's position in the spatial index. @remark Interest management
+    void UpdateSpatialIndex(Entity *entity);
+    /// Returns the bounds of the mesh of the ref in its own space, read from the mesh data without Ogre, for the headless server.
+    /** Returns false if the bounds are not known yet, in which case the data is requested as a binary asset. If the data is not
+        an Ogre binary mesh, the bounds are set to an empty box and true is returned. @remark Interest management */
+    bool MeshBoundsForRef(const QString &ref, AABB &bounds);
 
     /// Owning module
     TundraLogicModule* owner_;
@@ -203,16 +488,138 @@ private:
     /// "User" representing the server connection (client only)
     UserConnectionPtr serverConnection_;
     
-    /// Fixed buffers for crafting messages
+    /// Fixed buffers for crafting reply messages and reading attribute data
     char createEntityBuffer_[64 * 1024];
-    char createCompsBuffer_[64 * 1024];
-    char editAttrsBuffer_[64 * 1024];
-    char createAttrsBuffer_[16 * 1024];
     char attrDataBuffer_[16 * 1024];
-    char removeCompsBuffer_[1024];
-    char removeEntityBuffer_[1024];
-    char removeAttrsBuffer_[1024];
-    std::vector<u8> changedAttributes_;
+    char attrValueBuffer_[16 * 1024];
+    std::vector<u8> attrValue_;
+
+    /// Buffers for crafting sync messages on the main thread.
+    SyncAssemblyContext serialContext_;
+    /// Number of worker threads used to assemble sync messages for the user connections (default 0).
+    /** With 0, all users are processed serially on the main thread. Otherwise the per-user message assembly, which only
+        reads the scene, runs on a thread pool, followed by a short serial phase that sends the messages. */
+    int syncThreadCount_;
+    /// Thread pool for the sync message assembly.
+    QThreadPool *syncThreadPool_;
+    /// Per-worker buffers and pending messages, one for each concurrently running assembly task.
+    std::vector<SyncAssemblyContext*> workerContexts_;
+
+    /// Default sync data rate limits in bytes per second for new connections, by connection type. Empty type is the fallback.
+    std::map<QString, float> bandwidthLimits_;
+
+    /// Are attribute edits sent as deltas to the last value each client received (default true).
+    /** Applies only to clients with ProtocolAttributeDeltas or newer. Can be disabled with --noAttributeDeltas. */
+    bool attributeDeltasEnabled_;
+
+    /// Largest size in bytes of the SceneSyncBatch messages the reliable scenesync messages to a client are packed to (default 1400).
+    /** Packing the per-entity messages of a tick saves the per-message overhead of the transport. Applies only to clients
+        with ProtocolSceneSyncBatch or newer. 0 disables batching. Can be set with --syncBatchSize. */
+    int syncBatchSize_;
+
+    /// Size in bytes from which reliable scenesync and component type messages are sent zlib-compressed (default 1024).
+    /** Mostly affects the initial scene transfer, where full component creations of f.ex. EC_DynamicComponent and EC_Script
+        and long string attributes are large and compress well. Applies only to peers with ProtocolCompressedMessages or newer,
+        and only when compressing makes the message smaller. 0 disables compression. Can be set with --syncCompressionThreshold. */
+    int compressionThreshold_;
+
+    /// Is the scene sent to joining clients as one compressed snapshot, instead of streaming the entities (default true).
+    /** The snapshot is built once and reused for all joining clients until the scene changes. Applies only to clients with
+        ProtocolSceneSnapshot or newer, and only when the client's sync state accepts all the entities. Can be disabled with --noSceneSnapshots. */
+    bool sceneSnapshotsEnabled_;
+    /// Has the scene changed since the snapshot was built. Set by all scene change handlers, whether the change is replicated or not.
+    bool sceneSnapshotDirty_;
+    /// Sequence number of the current snapshot, incremented on each rebuild.
+    u32 sceneSnapshotSequence_;
+    /// The SceneSnapshot message data.
+    QByteArray sceneSnapshot_;
+    /// IDs of the entities in the snapshot, in the order they were serialized.
+    std::vector<entity_id_t> sceneSnapshotEntities_;
+
+    /// Is each connection's update period adapted to its round-trip time, packet loss and outbound queue length (default true).
+    /** A connection is sent to at most every half round trip, less often with packet loss, and backed off while its outbound
+        queue grows. The changes in between are coalesced in its sync state. The update period is the lower bound.
+        Connection types without the statistics, see UserConnection::RoundTripTime, use the update period. Can be disabled with --noAdaptiveUpdateRate. */
+    bool adaptiveUpdateRateEnabled_;
+    /// Longest adapted update period in seconds (default 0.5).
+    float maxUpdatePeriod_;
+
+    /// Predicted client-side position error in meters above which a rigid body update is sent (default 0, disabled).
+    /** The server predicts where each client shows a moving rigid body with the same Hermite interpolation and linear
+        extrapolation as InterpolateRigidBodies, and sends the position and velocity only when the prediction is off by
+        more than the threshold. When disabled, changes are sent whenever they exceed small fixed tolerances.
+        Can be set with --syncDeadReckoningThreshold, and per entity with SetEntityDeadReckoningThreshold. */
+    float deadReckoningThreshold_;
+    /// Per-entity overrides of deadReckoningThreshold_.
+    std::map<entity_id_t, float> entityDeadReckoningThresholds_;
+
+    /// Number of entities sent per network update tick to each joining user (default 0, progressive joins disabled).
+    /** When enabled, a joining user is not sent the whole scene at once. The entities are queued, and sent nearest first
+        once the client's first ObserverPosition has arrived, or after a short wait if it does not send one. The queue is
+        processed in distance rings: when a ring is done, the rest are re-sorted around the observer's current position.
+        Entities without EC_Placeable are sent first, and the parents of an entity before it. Changes to queued entities
+        are not synced, as the whole entity is sent when it is taken from the queue. Disables the scene snapshot, as the
+        user's sync state does not contain the whole scene. Can be set with --syncProgressiveJoin. */
+    int progressiveJoinQuota_;
+
+    /// Distance from a user's observer beyond which the sync states of idle entities are compacted (default 0, disabled).
+    /** A full EntitySyncState per user and entity costs hundreds of bytes. A clean entity that has not changed for a while
+        and is farther than this distance, or any such entity while the user's observer position is unknown, is reduced to
+        the IDs of its components, and expanded back when it changes. The sync states are visited in slices over a few
+        network update ticks, like the far entity priorities. Can be set with --syncStateCompactDistance. */
+    float syncStateCompactDistance_;
+    /// IDs of the entities to compact, reused by CompactSyncState.
+    std::vector<entity_id_t> compactionCandidates_;
+
+    /// Names of the entity actions that are idempotent, i.e. executing one twice has the same effect as executing it once (default none).
+    /** Of the identical actions of these names, with the same entity and parameters, queued to a user during one network
+        update tick, only the first is sent. Suits f.ex. state refresh actions that scripts trigger every frame.
+        Can be set with --syncIdempotentActions <name,name,...>. */
+    std::set<std::vector<s8> > idempotentActions_;
+
+    /// Serialized attribute payloads of the current network tick, reused by all user connections (server only).
+    AttributeUpdateCache attrUpdateCache_;
+
+    /// Replicated attribute edits not yet marked to every user's sync state (server only).
+    /** OnAttributeChanged records an edit once, instead of marking it to the sync state of every user. */
+    AttributeChangeLog attributeChangeLog_;
+    /// Connection whose received attribute edits are being signalled, so that they are not echoed back to it, or 0 (server only).
+    u32 changeSourceConnectionId_;
+
+    /// Are the sent and received messages, component updates and attribute values counted to statistics_ (default false).
+    /** The attribute update cache is not used while recording, so that the attribute values of each message can be measured.
+        Can be enabled with --syncStatistics. */
+    bool statisticsEnabled_;
+    /// Replication traffic per connection and message type, per component type and per attribute.
+    ReplicationStatistics statistics_;
+
+    /// Time in seconds the sync state of a disconnected user is kept for resuming the session (default 30, 0 disables).
+    /** A client that supports ProtocolSessionResume gets a resume token in the login reply, and is sent sync checkpoints
+        at most twice a second, when all the changes marked to its sync state have been sent. When the client reconnects after
+        a dropped connection, it logs in with the token and the number of the last checkpoint it received. If the session
+        has not expired, the changes since the disconnection have been marked to its sync state, and the attribute edits since
+        the checkpoint are marked again, so that only those are sent instead of the whole scene. If entities, components or
+        attributes were created or removed, or entity properties or parents changed, between the checkpoint and the
+        disconnection, the scene is sent in full, as it is not known which of them the client received.
+        Can be set with --syncSessionResumeTime. */
+    float sessionResumeTime_;
+    /// Sync state of a disconnected user, kept for resuming the session (server only).
+    struct SuspendedSession
+    {
+        shared_ptr<SceneSyncState> state;
+        float timeLeft; ///< Seconds until the session expires.
+        u32 structureChanges; ///< Value of structureChanges_ at the disconnection.
+    };
+    typedef std::map<QString, SuspendedSession> SuspendedSessionMap;
+    /// Suspended sessions by resume token (server only). The changes to the scene structure are marked to their sync states.
+    SuspendedSessionMap suspendedSessions_;
+    /// Count of the replicated entity, component and attribute creations and removals and entity property and parent changes, for the sync checkpoints (server only).
+    u32 structureChanges_;
+
+    /// Trace file the received network messages are captured to, or null if not capturing. Can be started with --syncCapture.
+    shared_ptr<SyncTrace> traceCapture_;
+    /// Trace file to replay once the server scene exists, after which the application exits. Set with --syncReplay.
+    QString replayTraceFile_;
 
     /// The sender of a component type. Used to avoid sending component description back to sender
     UserConnection* componentTypeSender_;
@@ -220,6 +627,9 @@ private:
     /// Set of custom component type id's that were received from the server, to avoid echoing them back in ProcessSyncState
     std::set<u32> componentTypesFromServer_;
 
+    /// Entities whose rigid bodies are predicted by the local physics (client only)
+    std::set<entity_id_t> predictedEntities_;
+
     /// Priority update period in seconds.
     /** On client this means the observer position's send period. On server this means priority recomputation period.
         @remark Interest management */
@@ -233,6 +643,25 @@ private:
     /// If interestManagementEnabled_ is true, on client this entity's position information is sent to the server.
     /** @remark Interest management */
     EntityWeakPtr observer_;
+    /// Radius in world units around the observer inside which entity priorities are recomputed on every priority tick (default 100).
+    /** Entities farther away are refreshed in coarse buckets, a slice of the sync state per tick.
+        @remark Interest management */
+    float priorityNearRadius_;
+    /// Half angle in degrees of the observer's view cone (default 60).
+    /** The relevancy of entities outside the cone decreases with the angle from the observer's view direction, down to a tenth
+        directly behind the observer, which lengthens their update interval. Entities close to the observer are always treated as
+        inside the cone, as they can come to view with a small turn. 180 disables the view cone.
+        @remark Interest management */
+    float viewConeAngle_;
+    /// Server-side spatial index of replicated entity world positions, shared by all user connections. @remark Interest management
+    EntitySpatialGrid spatialIndex_;
+    /// Scratch buffer for spatial index query results. @remark Interest management
+    std::vector<entity_id_t> nearEntities_;
+    /// Bounds of the meshes in their own space on the headless server, by resolved ref. Empty for data that is not an Ogre binary mesh.
+    /** @remark Interest management */
+    QHash<QString, AABB> meshBounds_;
+    /// Resolved refs of the mesh data being requested for their bounds. @remark Interest management
+    QSet<QString> pendingMeshBounds_;
 };
 
 }
@@ -18,13 +18,67 @@ typedef EntityIdList::iterator PendingIter;
 const float EntitySyncState::MinUpdateRate = 5.f;
 //const float EntitySyncState::MaxUpdateRate = 0.005f;
 
+namespace
+{
+bool EntitySyncStatePtrGreater(const EntitySyncState *lhs, const EntitySyncState *rhs)
+{
+    return *rhs < *lhs;
+}
+}
+
+void EntitySyncQueue::Clear()
+{
+    EntitySyncState *state = head_;
+    while(state)
+    {
+        EntitySyncState *next = state->queueHook.next;
+        state->queueHook.prev = state->queueHook.next = 0;
+        state->queueHook.linked = false;
+        state = next;
+    }
+    head_ = tail_ = 0;
+    size_ = 0;
+}
+
+void EntitySyncQueue::SortByPriority()
+{
+    if (size_ < 2)
+        return;
+
+    std::vector<EntitySyncState*> states;
+    states.reserve(size_);
+    for(EntitySyncState *state = head_; state; state = state->queueHook.next)
+        states.push_back(state);
+    std::stable_sort(states.begin(), states.end(), EntitySyncStatePtrGreater);
+
+    // Relink in sorted order.
+    for(size_t i = 0; i < states.size(); ++i)
+    {
+        states[i]->queueHook.prev = (i > 0 ? states[i-1] : 0);
+        states[i]->queueHook.next = (i + 1 < states.size() ? states[i+1] : 0);
+    }
+    head_ = states.front();
+    tail_ = states.back();
+}
+
 SceneSyncState::SceneSyncState(u32 userConnectionID, bool isServer) :
     userConnectionID_(userConnectionID),
     changeRequest_(userConnectionID),
     isServer_(isServer),
     placeholderComponentsSent_(false),
     observerPos(float3::nan),
-    observerRot(float3::nan)
+    observerRot(float3::nan),
+    observerForward(float3::nan),
+    priorityRefreshCursor(0),
+    compactionCursor(0),
+    attributeChangeVersion(0),
+    updatePeriod(0.f),
+    updateAcc(0.f),
+    joinQueueSorted(false),
+    joinWaitTime(0.f),
+    latestAttributeSequence(0),
+    lastCheckpoint(0),
+    checkpointAcc(0.f)
 {
 }
 
@@ -84,8 +138,7 @@ void SceneSyncState::MarkEntityPending(entity_id_t id)
 
     // If user does not have the entity in the first place, do nothing.
     // Its going to be asked to be added to the state via the permission signals later.
-    std::map<entity_id_t, EntitySyncState>::iterator i = entities.find(id);
-    if (i == entities.end())
+    if (!HasEntityState(id))
         return;
 
     MarkEntityRemoved(id);  // Remove from current sync state (removes entity from client)
@@ -136,50 +189,141 @@ void SceneSyncState::SetParentScene(SceneWeakPtr scene)
 
 void SceneSyncState::Clear()
 {
-    dirtyQueue.clear();
+    dirtyQueue.Clear();
     entities.clear();
+    compactEntities.clear();
     pendingEntities_.clear();
+    joinQueue.clear();
+    joinQueuedEntities.clear();
+    latestAttributesSent.clear();
+    unsettledLatestAttributes.clear();
+    latestAttributeSequences.clear();
+    queuedActions.clear();
+    sentActionNames.clear();
+    receivedActionNames.clear();
     changeRequest_.Reset();
     scene_.reset();
     placeholderComponentsSent_ = false;
+    priorityRefreshCursor = 0;
+    compactionCursor = 0;
+    updatePeriod = 0.f;
+    updateAcc = 0.f;
+    baselines.Clear();
+    checkpoints.clear();
+    checkpointAcc = 0.f;
+}
+
+void SceneSyncState::SetUserConnectionID(u32 userConnectionID)
+{
+    userConnectionID_ = userConnectionID;
+    changeRequest_.SetConnectionID(userConnectionID);
 }
 
 void SceneSyncState::RemoveFromQueue(entity_id_t id)
 {
-    std::map<entity_id_t, EntitySyncState>::iterator i = entities.find(id);
+    EntitySyncStateMap::iterator i = entities.find(id);
     if (i != entities.end())
     {
-        if (i->second.isInQueue)
+        if (i->second.IsInQueue())
         {
-            for (std::list<EntitySyncState*>::iterator j = dirtyQueue.begin(); j != dirtyQueue.end(); ++j)
-            {
-                if ((*j) == &i->second)
-                {
-                    dirtyQueue.erase(j);
-                    break;
-                }
-            }
-            i->second.isInQueue = false;
-            for (std::map<component_id_t, ComponentSyncState>::iterator j = i->second.components.begin(); j != i->second.components.end(); ++j)
+            dirtyQueue.Erase(&i->second);
+            for (ComponentSyncStateMap::iterator j = i->second.components.begin(); j != i->second.components.end(); ++j)
                 j->second.isInQueue = false;
             i->second.dirtyQueue.clear();
         }
     }
 }
 
-void SceneSyncState::MarkEntityProcessed(entity_id_t id)
+void SceneSyncState::RemoveEntityState(entity_id_t id)
+{
+    EntitySyncStateMap::iterator i = entities.find(id);
+    if (i != entities.end())
+    {
+        dirtyQueue.Erase(&i->second);
+        entities.erase(i);
+    }
+    compactEntities.erase(id);
+}
+
+bool SceneSyncState::HasEntityState(entity_id_t id) const
+{
+    return entities.find(id) != entities.end() || compactEntities.find(id) != compactEntities.end();
+}
+
+EntitySyncState &SceneSyncState::EntityState(entity_id_t id)
+{
+    EntitySyncState *expanded = ExpandEntityState(id);
+    if (expanded)
+        return *expanded;
+    EntitySyncState& entityState = entities[id]; // Creates new
+    entityState.id = id;
+    return entityState;
+}
+
+EntitySyncState *SceneSyncState::ExpandEntityState(entity_id_t id)
 {
+    EntitySyncStateMap::iterator i = entities.find(id);
+    if (i != entities.end())
+        return &i->second;
+    CompactEntitySyncStateMap::iterator c = compactEntities.find(id);
+    if (c == compactEntities.end())
+        return 0;
+
+    // The client has the entity and its components, and nothing is pending.
     EntitySyncState& entityState = entities[id];
-    if (!entityState.id)
-        entityState.id = id;
+    entityState.id = id;
+    entityState.isNew = false;
+    const std::vector<component_id_t> &compIds = c->second;
+    for (size_t j = 0; j < compIds.size(); ++j)
+    {
+        ComponentSyncState& compState = entityState.components[compIds[j]];
+        compState.id = compIds[j];
+        compState.isNew = false;
+    }
+    compactEntities.erase(c);
+    return &entityState;
+}
+
+bool SceneSyncState::CompactEntityState(entity_id_t id)
+{
+    EntitySyncStateMap::iterator i = entities.find(id);
+    if (i == entities.end())
+        return false;
+    const EntitySyncState &entityState = i->second;
+    if (entityState.IsInQueue() || entityState.isNew || entityState.removed || !entityState.dirtyQueue.empty() ||
+        entityState.hasPropertyChanges || entityState.hasParentChange)
+        return false;
+
+    // The reliable resend of an unsettled latest-value-only attribute needs the full state.
+    std::vector<LatestAttributeKey>::const_iterator latest = std::lower_bound(unsettledLatestAttributes.begin(),
+        unsettledLatestAttributes.end(), LatestAttributeKey(id));
+    if (latest != unsettledLatestAttributes.end() && latest->entityId == id)
+        return false;
+
+    std::vector<component_id_t> compIds;
+    compIds.reserve(entityState.components.size());
+    for (ComponentSyncStateMap::const_iterator j = entityState.components.begin(); j != entityState.components.end(); ++j)
+    {
+        const ComponentSyncState &compState = j->second;
+        if (compState.isNew || compState.removed || compState.isInQueue || compState.hasNewOrRemovedAttributes || compState.HasDirtyAttributes())
+            return false;
+        compIds.push_back(j->first);
+    }
+
+    compactEntities[id].swap(compIds);
+    entities.erase(i);
+    return true;
+}
+
+void SceneSyncState::MarkEntityProcessed(entity_id_t id)
+{
+    EntitySyncState& entityState = EntityState(id);
     entityState.DirtyProcessed();
 }
 
 void SceneSyncState::MarkComponentProcessed(entity_id_t id, component_id_t compId)
 {
-    EntitySyncState& entityState = entities[id];
-    if (!entityState.id)
-        entityState.id = id;
+    EntitySyncState& entityState = EntityState(id);
     ComponentSyncState& compState = entityState.components[compId];
     if (!compState.id)
         compState.id = compId;
@@ -195,14 +339,9 @@ void SceneSyncState::MarkEntityDirty(entity_id_t id, bool hasPropertyChanges, bo
     if (isServer_ && !ShouldMarkAsDirty(id))
         return;
 
-    EntitySyncState& entityState = entities[id]; // Creates new if did not exist
-    if (!entityState.id)
-        entityState.id = id;
-    if (!entityState.isInQueue)
-    {
-        dirtyQueue.push_back(&entityState);
-        entityState.isInQueue = true;
-    }
+    EntitySyncState& entityState = EntityState(id); // Creates new if did not exist
+    entityState.idleCompactionVisits = 0;
+    dirtyQueue.PushBack(&entityState);
     if (hasPropertyChanges)
         entityState.hasPropertyChanges = true;
     if (hasParentChange)
@@ -213,26 +352,24 @@ void SceneSyncState::MarkEntityRemoved(entity_id_t id)
 {
     /// @remark Enables a 'pending' logic in SyncManager, with which a script can throttle the sending of entities to clients.
     if (isServer_)
+    {
         RemovePendingEntity(id);
+        joinQueuedEntities.erase(id);
+    }
 
     // If user did not have the entity in the first place, do nothing
-    std::map<entity_id_t, EntitySyncState>::iterator i = entities.find(id);
-    if (i == entities.end())
+    if (!ExpandEntityState(id))
         return;
+    EntitySyncStateMap::iterator i = entities.find(id);
     // If entity is marked new, it was not sent yet and can be simply removed from the sync state
     if (i->second.isNew)
     {
-        RemoveFromQueue(id);
-        entities.erase(id);
+        RemoveEntityState(id);
         return;
     }
     // Else mark as removed and queue the update
     i->second.removed = true;
-    if (!i->second.isInQueue)
-    {
-        dirtyQueue.push_back(&i->second);
-        i->second.isInQueue = true;
-    }
+    dirtyQueue.PushBack(&i->second);
 }
 
 void SceneSyncState::MarkComponentDirty(entity_id_t id, component_id_t compId)
@@ -241,26 +378,24 @@ void SceneSyncState::MarkComponentDirty(entity_id_t id, component_id_t compId)
         return;
 
     MarkEntityDirty(id);
-    EntitySyncState& entityState = entities[id]; // Creates new if did not exist
-    if (!entityState.id)
-        entityState.id = id;
+    EntitySyncState& entityState = EntityState(id); // Creates new if did not exist
     entityState.MarkComponentDirty(compId);
 }
 
 void SceneSyncState::MarkComponentRemoved(entity_id_t id, component_id_t compId)
 {
     // If user did not have the entity or component in the first place, do nothing
-    std::map<entity_id_t, EntitySyncState>::iterator i = entities.find(id);
-    if (i == entities.end())
+    EntitySyncState *entityState = ExpandEntityState(id);
+    if (!entityState)
         return;
     MarkEntityDirty(id);
-    i->second.MarkComponentRemoved(compId);
+    entityState->MarkComponentRemoved(compId);
 }
 
 void SceneSyncState::MarkAttributeDirty(entity_id_t id, component_id_t compId, u8 attrIndex)
 {
     MarkEntityDirty(id);
-    EntitySyncState& entityState = entities[id];
+    EntitySyncState& entityState = EntityState(id);
     entityState.MarkComponentDirty(compId);
     ComponentSyncState& compState = entityState.components[compId];
     compState.MarkAttributeDirty(attrIndex);
@@ -269,7 +404,7 @@ void SceneSyncState::MarkAttributeDirty(entity_id_t id, component_id_t compId, u
 void SceneSyncState::MarkAttributeCreated(entity_id_t id, component_id_t compId, u8 attrIndex)
 {
     MarkEntityDirty(id);
-    EntitySyncState& entityState = entities[id];
+    EntitySyncState& entityState = EntityState(id);
     entityState.MarkComponentDirty(compId);
     ComponentSyncState& compState = entityState.components[compId];
     compState.MarkAttributeCreated(attrIndex);
@@ -278,7 +413,7 @@ void SceneSyncState::MarkAttributeCreated(entity_id_t id, component_id_t compId,
 void SceneSyncState::MarkAttributeRemoved(entity_id_t id, component_id_t compId, u8 attrIndex)
 {
     MarkEntityDirty(id);
-    EntitySyncState& entityState = entities[id];
+    EntitySyncState& entityState = EntityState(id);
     entityState.MarkComponentDirty(compId);
     ComponentSyncState& compState = entityState.components[compId];
     compState.MarkAttributeRemoved(attrIndex);
@@ -298,9 +433,12 @@ bool SceneSyncState::ShouldMarkAsDirty(entity_id_t id)
     // Only request if this entity does not have a sync state yet.
     // Otherwise this id will spam the signal handler on every change if
     // the addition to sync state was accepted.
-    std::map<entity_id_t, EntitySyncState>::iterator i = entities.find(id);
-    if (i == entities.end())
+    if (!HasEntityState(id))
     {
+        // Not sent to a progressively joining user yet. The whole entity is sent when it is taken from the join queue.
+        if (joinQueuedEntities.find(id) != joinQueuedEntities.end())
+            return false;
+
         PROFILE(SyncState_Emit_AboutToDirtyEntity);
         
         // Scene or entity null, do not process yet.
@@ -317,6 +455,13 @@ bool SceneSyncState::ShouldMarkAsDirty(entity_id_t id)
     return true;
 }
 
+void SceneSyncState::SetBandwidthLimit(float bytesPerSecond, float burstBytes)
+{
+    bandwidthBudget.bytesPerSecond = std::max(bytesPerSecond, 0.f);
+    bandwidthBudget.burstBytes = (burstBytes > 0.f ? burstBytes : bandwidthBudget.bytesPerSecond);
+    bandwidthBudget.tokens = std::min(bandwidthBudget.tokens, bandwidthBudget.burstBytes);
+}
+
 void SceneSyncState::RemovePendingEntity(entity_id_t id)
 {
     // This assumes that the id has not been added multiple times to our vector.
@@ -385,13 +530,8 @@ void SceneSyncState::AddPendingEntity(entity_id_t id)
 
 EntitySyncState& SceneSyncState::MarkEntityDirtySilent(entity_id_t id)
 {
-    EntitySyncState& entityState = entities[id]; // Creates new if did not exist
-    if (!entityState.id)
-        entityState.id = id;
-    if (!entityState.isInQueue)
-    {
-        dirtyQueue.push_back(&entityState);
-        entityState.isInQueue = true;
-    }
+    EntitySyncState& entityState = EntityState(id); // Creates new if did not exist
+    entityState.idleCompactionVisits = 0;
+    dirtyQueue.PushBack(&entityState);
     return entityState;
 }
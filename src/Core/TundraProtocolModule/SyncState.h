@@ -9,10 +9,15 @@
 #include "Transform.h"
 #include "Math/float3.h"
 #include "MsgEntityAction.h"
+#include "VectorMap.h"
+#include "AttributeBaselineStore.h"
 
 #include <QObject>
 #include <QVariant>
 
+#include <algorithm>
+#include <cstring>
+#include <deque>
 #include <list>
 #include <map>
 #include <set>
@@ -28,41 +33,103 @@ struct ComponentSyncState
         removed(false),
         isNew(true),
         isInQueue(false),
+        hasNewOrRemovedAttributes(false),
         id(0)
     {
-        for (unsigned i = 0; i < 32; ++i)
-            dirtyAttributes[i] = 0;
+        ClearBits(dirtyAttributes);
+        ClearBits(createdAttributes);
+        ClearBits(removedAttributes);
     }
     
     void MarkAttributeDirty(u8 attrIndex)
     {
-        dirtyAttributes[attrIndex >> 3] |= (1 << (attrIndex & 7));
+        SetBit(dirtyAttributes, attrIndex);
     }
     
     void MarkAttributeCreated(u8 attrIndex)
     {
-        newAndRemovedAttributes[attrIndex] = true;
+        SetBit(createdAttributes, attrIndex);
+        ClearBit(removedAttributes, attrIndex);
+        hasNewOrRemovedAttributes = true;
     }
     
     void MarkAttributeRemoved(u8 attrIndex)
     {
-        newAndRemovedAttributes[attrIndex] = false;
+        SetBit(removedAttributes, attrIndex);
+        ClearBit(createdAttributes, attrIndex);
+        hasNewOrRemovedAttributes = true;
+    }
+
+    /// Returns whether creation of the dynamic attribute is pending.
+    bool IsAttributeCreated(u8 attrIndex) const { return TestBit(createdAttributes, attrIndex); }
+    /// Returns whether removal of the dynamic attribute is pending.
+    bool IsAttributeRemoved(u8 attrIndex) const { return TestBit(removedAttributes, attrIndex); }
+    /// Returns whether any attribute is dirty.
+    bool HasDirtyAttributes() const
+    {
+        for (size_t i = 0; i < 32; ++i)
+            if (dirtyAttributes[i])
+                return true;
+        return false;
+    }
+
+    /// Forgets a pending creation or removal of the dynamic attribute.
+    void ClearAttributeCreatedOrRemoved(u8 attrIndex)
+    {
+        ClearBit(createdAttributes, attrIndex);
+        ClearBit(removedAttributes, attrIndex);
+    }
+
+    /// Forgets all pending creations and removals of dynamic attributes.
+    void ClearNewAndRemovedAttributes()
+    {
+        if (!hasNewOrRemovedAttributes)
+            return;
+        ClearBits(createdAttributes);
+        ClearBits(removedAttributes);
+        hasNewOrRemovedAttributes = false;
     }
     
     void DirtyProcessed()
     {
-        for (unsigned i = 0; i < 32; ++i)
-            dirtyAttributes[i] = 0;
-        newAndRemovedAttributes.clear();
+        ClearBits(dirtyAttributes);
+        ClearNewAndRemovedAttributes();
         isNew = false;
     }
     
     u8 dirtyAttributes[32]; ///< Dirty attributes bitfield. A maximum of 256 attributes are supported.
-    std::map<u8, bool> newAndRemovedAttributes; ///< Dynamic attributes by index that have been removed or created since last update. True = create, false = delete
+    u8 createdAttributes[32]; ///< Dynamic attributes that have been created since last update, as a bitfield.
+    u8 removedAttributes[32]; ///< Dynamic attributes that have been removed since last update, as a bitfield.
     component_id_t id; ///< Component ID. Duplicated here intentionally to allow recognizing the component without the parent map.
     bool removed; ///< The component has been removed since last update
     bool isNew; ///< The client does not have the component and it must be serialized in full
     bool isInQueue; ///< The component is already in the entity's dirty queue
+    bool hasNewOrRemovedAttributes; ///< Any bit may be set in createdAttributes or removedAttributes. Allows skipping the bitfields for the common case.
+
+private:
+    static void SetBit(u8 *bits, u8 index) { bits[index >> 3] |= (u8)(1 << (index & 7)); }
+    static void ClearBit(u8 *bits, u8 index) { bits[index >> 3] &= (u8)~(1 << (index & 7)); }
+    static bool TestBit(const u8 *bits, u8 index) { return (bits[index >> 3] & (1 << (index & 7))) != 0; }
+    static void ClearBits(u8 *bits) { memset(bits, 0, 32); }
+};
+
+/// Component sync states of an entity, stored contiguously and sorted by component ID.
+typedef VectorMap<component_id_t, ComponentSyncState> ComponentSyncStateMap;
+
+struct EntitySyncState;
+
+/// Links of an EntitySyncState in the scene's intrusive dirty queue.
+/** Copying an EntitySyncState never copies its queue membership: a copy starts out unlinked, and assigning
+    to a queued state leaves it queued. @sa EntitySyncQueue */
+struct EntitySyncQueueHook
+{
+    EntitySyncQueueHook() : prev(0), next(0), linked(false) {}
+    EntitySyncQueueHook(const EntitySyncQueueHook &) : prev(0), next(0), linked(false) {}
+    EntitySyncQueueHook &operator =(const EntitySyncQueueHook &) { return *this; }
+
+    EntitySyncState *prev;
+    EntitySyncState *next;
+    bool linked;
 };
 
 /// Entity's per-user network sync state
@@ -72,31 +139,31 @@ struct EntitySyncState
     EntitySyncState() :
         removed(false),
         isNew(true),
-        isInQueue(false),
         hasPropertyChanges(false),
         hasParentChange(false),
         id(0),
         avgUpdateInterval(0.0f),
+        linearVelocity(float3::zero),
+        angularVelocity(float3::zero),
+        lastNetworkSendTime(0),
+        predictionStartPos(float3::zero),
+        predictionStartVel(float3::zero),
         priority(-1.f),
-        relevancy(-1.f)
+        relevancy(-1.f),
+        idleCompactionVisits(0)
     {
     }
     
     void RemoveFromQueue(component_id_t id)
     {
-        std::map<component_id_t, ComponentSyncState>::iterator i = components.find(id);
+        ComponentSyncStateMap::iterator i = components.find(id);
         if (i != components.end())
         {
             if (i->second.isInQueue)
             {
-                for (std::list<ComponentSyncState*>::iterator j = dirtyQueue.begin(); j != dirtyQueue.end(); ++j)
-                {
-                    if ((*j) == &i->second)
-                    {
-                        dirtyQueue.erase(j);
-                        break;
-                    }
-                }
+                std::vector<component_id_t>::iterator j = std::find(dirtyQueue.begin(), dirtyQueue.end(), id);
+                if (j != dirtyQueue.end())
+                    dirtyQueue.erase(j);
                 i->second.isInQueue = false;
             }
         }
@@ -109,7 +176,7 @@ struct EntitySyncState
             compState.id = id;
         if (!compState.isInQueue)
         {
-            dirtyQueue.push_back(&compState);
+            dirtyQueue.push_back(id);
             compState.isInQueue = true;
         }
     }
@@ -117,7 +184,7 @@ struct EntitySyncState
     void MarkComponentRemoved(component_id_t id)
     {
         // If user did not have the component in the first place, do nothing
-        std::map<component_id_t, ComponentSyncState>::iterator i = components.find(id);
+        ComponentSyncStateMap::iterator i = components.find(id);
         if (i == components.end())
             return;
         // If component is marked new, it was not sent yet and can be simply removed from the sync state
@@ -131,14 +198,14 @@ struct EntitySyncState
         i->second.removed = true;
         if (!i->second.isInQueue)
         {
-            dirtyQueue.push_back(&i->second);
+            dirtyQueue.push_back(id);
             i->second.isInQueue = true;
         }
     }
     
     void DirtyProcessed()
     {
-        for (std::map<component_id_t, ComponentSyncState>::iterator i = components.begin(); i != components.end(); ++i)
+        for (ComponentSyncStateMap::iterator i = components.begin(); i != components.end(); ++i)
         {
             i->second.DirtyProcessed();
             i->second.isInQueue = false;
@@ -160,6 +227,9 @@ struct EntitySyncState
             avgUpdateInterval = 0.5 * time + 0.5 * avgUpdateInterval;
     }
 
+    /// Returns whether the entity is in the scene's dirty queue.
+    bool IsInQueue() const { return queueHook.linked; }
+
     /// Compares EntitySyncStates by FinalPriority().
     /*  @remark Interest management */
     bool operator < (const EntitySyncState &rhs) const
@@ -179,12 +249,12 @@ struct EntitySyncState
     static const float MinUpdateRate; ///< 5 (in seconds)
 //    static const float MaxUpdateRate; ///< 0.005 (in seconds)
 
-    std::list<ComponentSyncState*> dirtyQueue; ///< Dirty components
-    std::map<component_id_t, ComponentSyncState> components; ///< Component syncstates
+    std::vector<component_id_t> dirtyQueue; ///< Dirty components, by ID
+    ComponentSyncStateMap components; ///< Component syncstates
+    EntitySyncQueueHook queueHook; ///< Links to the neighbouring entities in the scene's dirty queue
     entity_id_t id; ///< Entity ID. Duplicated here intentionally to allow recognizing the entity without the parent map.
     bool removed; ///< The entity has been removed since last update
     bool isNew; ///< The client does not have the entity and it must be serialized in full
-    bool isInQueue; ///< The entity is already in the scene's dirty queue
     bool hasPropertyChanges; ///< The entity has changes into its other properties, such as temporary flag
     bool hasParentChange; ///> The entity's parent has changed
 
@@ -197,6 +267,9 @@ struct EntitySyncState
     float3 linearVelocity;
     float3 angularVelocity;
     kNet::tick_t lastNetworkSendTime; /**< @note Shared usage by rigid body optimization and interest management. */
+    /// Predicted client-side position and velocity of the rigid body when the last rigid body update was sent, from which the client interpolates. Used by dead reckoning.
+    float3 predictionStartPos;
+    float3 predictionStartVel;
 
     /// Priority = size / distance for visible entities, inf for non-visible.
     /** Larger number means larger importancy. If this value has not been yet calculated it's < 0.
@@ -210,6 +283,102 @@ struct EntitySyncState
         Used to determinate the prioritized update interval of the entity together with priority.
         @remark Interest management */
     float relevancy;
+
+    /// Number of consecutive sync state compaction passes that have found the entity clean (server only). @sa SceneSyncState::CompactEntityState
+    u8 idleCompactionVisits;
+};
+
+/// Intrusive FIFO queue of dirty EntitySyncStates.
+/** Links are stored in the queued states themselves (EntitySyncState::queueHook), so queueing and unqueueing
+    never allocate, and removing an arbitrary entity from the queue is O(1). A state can be in the queue only once.
+    @note The queue does not own the states: a state must be removed from the queue before it is destroyed. */
+class TUNDRAPROTOCOL_MODULE_API EntitySyncQueue
+{
+public:
+    EntitySyncQueue() : head_(0), tail_(0), size_(0) {}
+
+    /// Returns the first state in the queue, or null if the queue is empty.
+    EntitySyncState *Front() const { return head_; }
+    /// Returns the state following @c state in the queue, or null if @c state is the last one.
+    static EntitySyncState *Next(const EntitySyncState *state) { return state->queueHook.next; }
+
+    bool Empty() const { return head_ == 0; }
+    size_t Size() const { return size_; }
+
+    /// Appends the state to the end of the queue. Does nothing if the state is already queued.
+    void PushBack(EntitySyncState *state)
+    {
+        EntitySyncQueueHook &hook = state->queueHook;
+        if (hook.linked)
+            return;
+        hook.prev = tail_;
+        hook.next = 0;
+        hook.linked = true;
+        if (tail_)
+            tail_->queueHook.next = state;
+        else
+            head_ = state;
+        tail_ = state;
+        ++size_;
+    }
+
+    /// Removes the state from the queue. Does nothing if the state is not queued.
+    void Erase(EntitySyncState *state)
+    {
+        EntitySyncQueueHook &hook = state->queueHook;
+        if (!hook.linked)
+            return;
+        if (hook.prev)
+            hook.prev->queueHook.next = hook.next;
+        else
+            head_ = hook.next;
+        if (hook.next)
+            hook.next->queueHook.prev = hook.prev;
+        else
+            tail_ = hook.prev;
+        hook.prev = hook.next = 0;
+        hook.linked = false;
+        --size_;
+    }
+
+    /// Unlinks all states from the queue.
+    void Clear();
+
+    /// Stable-sorts the queue in descending order of EntitySyncState::FinalPriority(), so that the most important changes are sent first. @remark Interest management
+    void SortByPriority();
+
+private:
+    EntitySyncState *head_;
+    EntitySyncState *tail_;
+    size_t size_;
+};
+
+/// Entity sync states of a scene, by entity ID.
+typedef unordered_map<entity_id_t, EntitySyncState> EntitySyncStateMap;
+
+/// Compacted sync states of clean entities: the sorted IDs of the components the client has, by entity ID.
+typedef unordered_map<entity_id_t, std::vector<component_id_t> > CompactEntitySyncStateMap;
+
+/// Token bucket limiting the rate of scene sync data sent to a user connection.
+/** The bucket is refilled on each network update tick. SyncManager stops processing the connection's dirty queue
+    for the tick once the bucket is empty, leaving the rest of the changes for the following ticks. The last entity
+    processed may overdraw the bucket, which is then paid back before anything more is sent. */
+struct SyncBandwidthBudget
+{
+    SyncBandwidthBudget() : bytesPerSecond(0.f), burstBytes(0.f), tokens(0.f) {}
+
+    float bytesPerSecond; ///< Refill rate in bytes per second, 0 for unlimited.
+    float burstBytes; ///< Capacity of the bucket in bytes.
+    float tokens; ///< Bytes currently available, negative if overdrawn.
+
+    /// Returns whether the rate is limited.
+    bool IsLimited() const { return bytesPerSecond > 0.f; }
+    /// Adds the tokens accumulated over the time period.
+    void Refill(float seconds) { if (IsLimited()) tokens = std::min(tokens + bytesPerSecond * seconds, burstBytes); }
+    /// Returns whether more data can be sent, given that @c bytesSpent bytes have not been consumed yet.
+    bool HasBudget(size_t bytesSpent) const { return !IsLimited() || (float)bytesSpent < tokens; }
+    /// Consumes tokens for sent data.
+    void Consume(size_t bytes) { if (IsLimited()) tokens -= (float)bytes; }
 };
 
 struct RigidBodyInterpolationState
@@ -237,6 +406,45 @@ struct RigidBodyInterpolationState
     kNet::packet_id_t lastReceivedPacketCounter;
 };
 
+/// Identifies an attribute of a replicated component, for tracking latest-value-only attributes. @sa AttributeMetadata::latestValueOnly
+struct LatestAttributeKey
+{
+    LatestAttributeKey(entity_id_t entityId_ = 0, component_id_t compId_ = 0, u8 attrIndex_ = 0) :
+        entityId(entityId_),
+        compId(compId_),
+        attrIndex(attrIndex_)
+    {
+    }
+
+    bool operator <(const LatestAttributeKey &rhs) const
+    {
+        if (entityId != rhs.entityId)
+            return entityId < rhs.entityId;
+        if (compId != rhs.compId)
+            return compId < rhs.compId;
+        return attrIndex < rhs.attrIndex;
+    }
+
+    entity_id_t entityId;
+    component_id_t compId;
+    u8 attrIndex;
+};
+
+/// Scene state of a connection at a sync checkpoint sent to it. @sa SyncManager::SetSessionResumeTime
+struct SyncCheckpoint
+{
+    SyncCheckpoint(u32 number_ = 0, u32 attributeChangeVersion_ = 0, u32 structureChanges_ = 0) :
+        number(number_),
+        attributeChangeVersion(attributeChangeVersion_),
+        structureChanges(structureChanges_)
+    {
+    }
+
+    u32 number; ///< Number of the checkpoint, from 1 up on each connection.
+    u32 attributeChangeVersion; ///< Version of the attribute change log the attribute edits had been sent up to.
+    u32 structureChanges; ///< SyncManager's count of the changes to the replicated scene structure, which had all been sent.
+};
+
 /// State change request to permit/deny changes.
 class TUNDRAPROTOCOL_MODULE_API StateChangeRequest : public QObject
 {
@@ -276,6 +484,7 @@ public:
     bool Accepted() const { return accepted_; }
     bool Rejected() const { return !accepted_; }
     u32 ConnectionID()const { return connectionID_; }
+    void SetConnectionID(u32 connectionID) { connectionID_ = connectionID; }
     entity_id_t EntityId() const { return entityId_; }
     Entity* GetEntity() const { return entity_; }
     void SetEntity(Entity* entity) { entity_ = entity; }
@@ -303,16 +512,32 @@ public:
     virtual ~SceneSyncState();
 
     /// Dirty entities pending processing
-    std::list<EntitySyncState*> dirtyQueue; 
+    EntitySyncQueue dirtyQueue;
 
     /// Entity sync states
-    std::map<entity_id_t, EntitySyncState> entities; 
+    /** @note The states are referred to by dirtyQueue, so this must remain a node-based container with stable element addresses. */
+    EntitySyncStateMap entities;
+
+    /// Sync states of clean entities compacted to the IDs of their components (server only).
+    /** An entity the client has is either in entities or here. A compacted state is expanded back to a full one when
+        the entity changes. @sa CompactEntityState, ExpandEntityState */
+    CompactEntitySyncStateMap compactEntities;
+    /// Index of the entities hash bucket from which the next slice of sync states is considered for compaction (server only).
+    size_t compactionCursor;
 
     /// Entity interpolations
     std::map<entity_id_t, RigidBodyInterpolationState> entityInterpolations;
 
     /// Queued EntityAction messages. These will be sent to the user on the next network update tick.
-    std::vector<MsgEntityAction> queuedActions;
+    /** The same message is shared by the states of all the users it is queued to. */
+    std::vector<shared_ptr<const MsgEntityAction> > queuedActions;
+
+    /// IDs of the entity action names interned on the connection for EntityActionBatch messages, from 1 up (server only).
+    std::map<std::vector<s8>, u32> sentActionNames;
+    /// Entity action names interned on the connection by EntityActionBatch messages, the name of ID n at index n - 1 (client only).
+    std::vector<std::vector<s8> > receivedActionNames;
+    /// Interned ids (EntityAction::ActionId) of receivedActionNames, at the same indices, 0 if not interned when received (client only).
+    std::vector<u32> receivedActionIds;
 
     /// Last sent (client) or received (server) observer position in world coordinates.
     /** If !IsFinite() ObserverPosition message has not been been received from the client. */
@@ -320,6 +545,58 @@ public:
     /// Last sent (client) or received (server) observer orientation in world coordinates, Euler ZYX in degrees.
     /** If !IsFinite() ObserverPosition message has not been been received from the client. */
     float3 observerRot;
+    /// Unit view direction of the observer in world coordinates, derived from observerRot (server only).
+    /** If !IsFinite() ObserverPosition message has not been been received from the client. @remark Interest management */
+    float3 observerForward;
+
+    /// Index of the entities hash bucket from which the next slice of far entity priorities is refreshed. @remark Interest management
+    size_t priorityRefreshCursor;
+
+    /// Last attribute values sent (server) or received (client) in EditAttributes messages, used for delta-encoding.
+    AttributeBaselineStore baselines;
+
+    /// Version of SyncManager's attribute change log up to which the attribute edits have been marked dirty to this state (server only).
+    u32 attributeChangeVersion;
+
+    /// Byte budget for the sync data sent to this connection (server only).
+    SyncBandwidthBudget bandwidthBudget;
+
+    /// Current send interval of this connection in seconds, adapted by SyncManager to the connection quality (server only).
+    /** Changes made between the sends accumulate in the sync state and are sent together. 0 until the first network update. */
+    float updatePeriod;
+    /// Time accumulated towards the next send to this connection (server only).
+    float updateAcc;
+
+    /// Entities not yet sent to a progressively joining user, as (distance ring, entity ID) pairs (server only).
+    /** Sorted farthest first, so that the nearest entity is at the back. Changes to the queued entities are not synced until
+        SyncManager takes them from the queue. @sa SyncManager::SetProgressiveJoinQuota */
+    std::vector<std::pair<int, entity_id_t> > joinQueue;
+    /// IDs of the entities in joinQueue (server only).
+    std::set<entity_id_t> joinQueuedEntities;
+    /// Has joinQueue been sorted to distance rings around the observer (server only).
+    bool joinQueueSorted;
+    /// Time in seconds the progressive join has waited for the first observer position (server only).
+    float joinWaitTime;
+
+    /// Sequence number of the current network update tick's EditLatestAttributes messages (server only).
+    u32 latestAttributeSequence;
+    /// Latest-value-only attributes sent unreliably on the current tick (server only).
+    std::vector<LatestAttributeKey> latestAttributesSent;
+    /// Latest-value-only attributes whose last value was sent unreliably, sorted (server only).
+    /** When such an attribute stops changing, its value is sent once more reliably, see SyncManager::SettleLatestAttributes. */
+    std::vector<LatestAttributeKey> unsettledLatestAttributes;
+    /// Sequence number of the last applied EditLatestAttributes value of each attribute (client only).
+    std::map<LatestAttributeKey, u32> latestAttributeSequences;
+
+    /// Token with which the client can resume this sync state after a dropped connection, or empty if it cannot (server only).
+    /** @sa SyncManager::SetSessionResumeTime */
+    QString resumeToken;
+    /// Sync checkpoints sent to the connection that it may be the last to have received, oldest first (server only).
+    std::deque<SyncCheckpoint> checkpoints;
+    /// Number of the last sync checkpoint sent to the connection (server only).
+    u32 lastCheckpoint;
+    /// Time accumulated towards the next sync checkpoint (server only).
+    float checkpointAcc;
 
 signals:
     /// This signal is emitted when an entity is being added to the client sync state.
@@ -360,11 +637,38 @@ public slots:
     /// @remark Enables a 'pending' logic in SyncManager, with which a script can throttle the sending of entities to clients.
     bool HasPendingEntity(entity_id_t id) const;
 
+    /// Limits the rate of scene sync data sent to this connection. 0 removes the limit.
+    /** @param bytesPerSecond Sustained rate.
+        @param burstBytes Largest amount sent on a single tick after idling, by default one second's worth. */
+    void SetBandwidthLimit(float bytesPerSecond, float burstBytes = 0.f);
+
+    /// Returns the sync data rate limit in bytes per second, 0 if unlimited.
+    float BandwidthLimit() const { return bandwidthBudget.bytesPerSecond; }
+
 public:
     void SetParentScene(SceneWeakPtr scene);
     void Clear();
+
+    /// Sets the ID of the connection the sync state belongs to, when a session is resumed on a new connection.
+    void SetUserConnectionID(u32 userConnectionID);
     
     void RemoveFromQueue(entity_id_t id);
+    /// Removes the entity from the dirty queue and erases its sync state.
+    void RemoveEntityState(entity_id_t id);
+
+    /// Returns whether the entity has a full or compacted sync state.
+    bool HasEntityState(entity_id_t id) const;
+    /// Returns the number of full and compacted entity sync states.
+    size_t NumEntityStates() const { return entities.size() + compactEntities.size(); }
+    /// Returns the full sync state of the entity, expanding a compacted one, or creating a new one if it has none.
+    EntitySyncState &EntityState(entity_id_t id);
+    /// Expands a compacted entity sync state back to a full one.
+    /** @return The full state, or null if the entity has no sync state. */
+    EntitySyncState *ExpandEntityState(entity_id_t id);
+    /// Replaces the full sync state of a clean entity with the IDs of its components.
+    /** The rigid body and interest management fields of the state are discarded. @return False if the state is not clean,
+        or has latest-value-only attributes not settled yet, and was kept. */
+    bool CompactEntityState(entity_id_t id);
 
     void MarkEntityProcessed(entity_id_t id);
     void MarkComponentProcessed(entity_id_t id, component_id_t compId);
@@ -0,0 +1,124 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#include "StableHeaders.h"
+#include "SyncTrace.h"
+
+#include <kNet/Clock.h>
+
+#include "MemoryLeakCheck.h"
+
+namespace
+{
+const quint32 cTraceMagic = 0x54535452; // "TSTR"
+const quint32 cTraceVersion = 1;
+}
+
+SyncTrace::SyncTrace() :
+    startTime_(0)
+{
+}
+
+bool SyncTrace::OpenForWriting(const QString &filename)
+{
+    Close();
+    file_.setFileName(filename);
+    if (!file_.open(QIODevice::WriteOnly | QIODevice::Truncate))
+        return false;
+    stream_.setDevice(&file_);
+    stream_.setVersion(QDataStream::Qt_4_6);
+    stream_ << cTraceMagic << cTraceVersion;
+    startTime_ = kNet::Clock::Tick();
+    return stream_.status() == QDataStream::Ok;
+}
+
+bool SyncTrace::OpenForReading(const QString &filename)
+{
+    Close();
+    file_.setFileName(filename);
+    if (!file_.open(QIODevice::ReadOnly))
+        return false;
+    stream_.setDevice(&file_);
+    stream_.setVersion(QDataStream::Qt_4_6);
+    quint32 magic = 0, version = 0;
+    stream_ >> magic >> version;
+    if (magic != cTraceMagic || version != cTraceVersion)
+    {
+        Close();
+        return false;
+    }
+    return true;
+}
+
+void SyncTrace::Close()
+{
+    stream_.setDevice(0);
+    file_.close();
+}
+
+void SyncTrace::BeginRecord(RecordType type)
+{
+    stream_ << (quint8)type << (double)kNet::Clock::SecondsSinceD(startTime_);
+}
+
+void SyncTrace::WriteUserConnected(const UserConnection *user)
+{
+    if (!IsOpen())
+        return;
+    BeginRecord(UserConnectedRecord);
+    stream_ << (quint32)user->ConnectionId() << (quint32)user->ProtocolVersion() << user->properties;
+}
+
+void SyncTrace::WriteUserDisconnected(u32 connectionId)
+{
+    if (!IsOpen())
+        return;
+    BeginRecord(UserDisconnectedRecord);
+    stream_ << (quint32)connectionId;
+}
+
+void SyncTrace::WriteMessage(u32 connectionId, kNet::packet_id_t packetId, kNet::message_id_t messageId, const char *data, size_t numBytes)
+{
+    if (!IsOpen())
+        return;
+    BeginRecord(MessageRecord);
+    stream_ << (quint32)connectionId << (quint32)packetId << (quint32)messageId;
+    stream_.writeBytes(data, (uint)numBytes);
+}
+
+bool SyncTrace::ReadRecord(Record &record)
+{
+    if (!IsOpen() || stream_.atEnd())
+        return false;
+
+    quint8 type = 0;
+    double time = 0.0;
+    quint32 connectionId = 0;
+    stream_ >> type >> time >> connectionId;
+    record = Record();
+    record.type = (RecordType)type;
+    record.time = time;
+    record.connectionId = connectionId;
+    switch(type)
+    {
+    case UserConnectedRecord:
+    {
+        quint32 protocolVersion = 0;
+        stream_ >> protocolVersion >> record.properties;
+        record.protocolVersion = protocolVersion;
+        break;
+    }
+    case UserDisconnectedRecord:
+        break;
+    case MessageRecord:
+    {
+        quint32 packetId = 0, messageId = 0;
+        stream_ >> packetId >> messageId >> record.data;
+        record.packetId = packetId;
+        record.messageId = messageId;
+        break;
+    }
+    default:
+        return false;
+    }
+    return stream_.status() == QDataStream::Ok;
+}
@@ -0,0 +1,89 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#pragma once
+
+#include "TundraProtocolModuleApi.h"
+#include "TundraProtocolModuleFwd.h"
+#include "UserConnection.h"
+
+#include "CoreTypes.h"
+
+#include <kNet/Types.h>
+
+#include <QByteArray>
+#include <QDataStream>
+#include <QFile>
+#include <QString>
+
+/// Trace file of the network messages received by SyncManager, for replaying them to benchmark the message handlers.
+/** A trace records the users that connect and disconnect, and every network message received from them, with the time
+    since the capture started. SyncManager::ReplayTrace feeds a trace to the handlers of a server as fast as possible.
+    As server-side entity and component IDs are allocated in order, replaying against the scene the capture was started
+    with reproduces the captured session deterministically. */
+class TUNDRAPROTOCOL_MODULE_API SyncTrace
+{
+public:
+    /// Type of a trace record.
+    enum RecordType
+    {
+        UserConnectedRecord = 0,
+        UserDisconnectedRecord = 1,
+        MessageRecord = 2
+    };
+
+    /// A trace record. The fields that do not apply to the record type are left default.
+    struct Record
+    {
+        Record() : type(MessageRecord), time(0.0), connectionId(0), protocolVersion(ProtocolOriginal), packetId(0), messageId(0) {}
+
+        RecordType type;
+        double time; ///< Seconds since the capture started.
+        u32 connectionId;
+        u32 protocolVersion; ///< Protocol version of a connected user.
+        LoginPropertyMap properties; ///< Login properties of a connected user.
+        kNet::packet_id_t packetId;
+        kNet::message_id_t messageId;
+        QByteArray data; ///< Message data.
+    };
+
+    SyncTrace();
+
+    /// Creates the trace file for capturing, truncating an existing file. Starts the capture clock.
+    bool OpenForWriting(const QString &filename);
+    /// Opens a trace file for replaying. Fails if the file is not a trace of a supported version.
+    bool OpenForReading(const QString &filename);
+    /// Closes the trace file.
+    void Close();
+    /// Returns whether a trace file is open.
+    bool IsOpen() const { return file_.isOpen(); }
+    /// Returns the trace file name.
+    QString FileName() const { return file_.fileName(); }
+
+    /// Records a user connection.
+    void WriteUserConnected(const UserConnection *user);
+    /// Records a user disconnection.
+    void WriteUserDisconnected(u32 connectionId);
+    /// Records a network message received from a connection.
+    void WriteMessage(u32 connectionId, kNet::packet_id_t packetId, kNet::message_id_t messageId, const char *data, size_t numBytes);
+
+    /// Reads the next record. Returns false at the end of the trace, or if the trace is truncated.
+    bool ReadRecord(Record &record);
+
+private:
+    /// Writes the record type and time of a new record.
+    void BeginRecord(RecordType type);
+
+    QFile file_;
+    QDataStream stream_;
+    kNet::tick_t startTime_; ///< Capture start time.
+};
+
+/// User connection of a replayed trace. Discards the messages sent to it.
+class TUNDRAPROTOCOL_MODULE_API SyncTraceUserConnection : public UserConnection
+{
+public:
+    virtual QString ConnectionType() const { return "trace"; }
+    virtual void Send(kNet::message_id_t /*id*/, const char* /*data*/, size_t /*numBytes*/, bool /*reliable*/, bool /*inOrder*/, unsigned long /*priority*/ = 100, unsigned long /*contentID*/ = 0) {}
+    virtual void Disconnect() {}
+    virtual void Close() {}
+};
@@ -8,9 +8,11 @@
 #include "Server.h"
 #include "OgreSceneImporter.h"
 #include "SyncManager.h"
+#include "ZoneManager.h"
 #include "KristalliProtocolModule.h"
 
 #include "Profiler.h"
+#include "FrameAPI.h"
 #include "SceneAPI.h"
 #include "AssetAPI.h"
 #include "IAssetTransfer.h"
@@ -112,10 +114,12 @@ void TundraLogicModule::Initialize()
     client_ = MAKE_SHARED(Client, this);
     server_ = MAKE_SHARED(Server, this);
     syncManager_ = MAKE_SHARED(SyncManager, this); // Syncmanager expects client & server to exist
+    zoneManager_ = MAKE_SHARED(ZoneManager, this); // Zonemanager expects server to exist
 
     framework_->RegisterDynamicObject("client", client_.get());
     framework_->RegisterDynamicObject("server", server_.get());
     framework_->RegisterDynamicObject("syncmanager", syncManager_.get());
+    framework_->RegisterDynamicObject("zonemanager", zoneManager_.get());
 
     framework_->Console()->RegisterCommand("startServer", "Starts a server. Usage: startServer(port,protocol)",
         server_.get(), SLOT(Start(unsigned short,QString)));
@@ -146,6 +150,10 @@ void TundraLogicModule::Initialize()
         "Usage: importMesh(filename, pos = 0 0 0, rot = 0 0 0, scale = 1 1 1, inspectForMaterialsAndSkeleton=true)",
         this, SLOT(ImportMesh(QString, const float3 &, const float3 &, const float3 &, bool)), SLOT(ImportMesh(QString)));
 
+    framework_->Console()->RegisterCommand("memoryStats",
+        "Prints the approximate memory usage of the active scene by component type, and of its largest entities. Usage: memoryStats(maxEntities=10)",
+        this, SLOT(PrintMemoryStatistics(int)), SLOT(PrintMemoryStatistics()));
+
     // Take a pointer to KristalliProtocolModule so that we don't have to take/check it every time
     kristalliModule_ = framework_->GetModule<KristalliProtocolModule>();
     if (!kristalliModule_)
@@ -158,6 +166,7 @@ void TundraLogicModule::Initialize()
 void TundraLogicModule::Uninitialize()
 {
     kristalliModule_ = 0;
+    zoneManager_.reset();
     syncManager_.reset();
     client_.reset();
     server_.reset();
@@ -171,6 +180,12 @@ void TundraLogicModule::Update(f64 frametime)
         client_->Update(frametime);
     if (server_)
         server_->Update(frametime);
+    // Keep the main loop from idling while there is someone to sync the scene with.
+    if ((server_ && !server_->UserConnections().empty()) || (client_ && client_->IsConnected()))
+        framework_->Frame()->KeepAwake();
+    // Exchange border entities and handoffs with the neighbouring zone servers, before the changes are synced
+    if (zoneManager_)
+        zoneManager_->Update(frametime);
     // Run scene sync
     if (syncManager_)
         syncManager_->Update(frametime);
@@ -322,6 +337,51 @@ void TundraLogicModule::StartupSceneTransferFailed(IAssetTransfer *transfer, QSt
     LogError("Failed to load startup scene from " + transfer->SourceUrl() + " reason: " + reason);
 }
 
+void TundraLogicModule::PrintMemoryStatistics(int maxEntities)
+{
+    Scene *scene = GetFramework()->Scene()->MainCameraScene();
+    if (!scene)
+    {
+        LogError("TundraLogicModule::PrintMemoryStatistics: No active scene found!");
+        return;
+    }
+
+    QMap<QString, QVariantMap> syncStates;
+    foreach(const QVariant &v, syncManager_->SyncStateMemoryStatistics())
+    {
+        const QVariantMap entry = v.toMap();
+        syncStates[entry["typeName"].toString()] = entry;
+    }
+
+    qulonglong totalBytes = 0;
+    qulonglong totalAssetBytes = 0;
+    qulonglong totalSyncBytes = syncStates["Entity"]["bytes"].toULongLong();
+    LogInfo(QString("%1 %2 %3 %4 %5 %6 %7").arg("Component type", -32).arg("Count", 8).arg("KB", 10).arg("Attr KB", 10)
+        .arg("DynProp KB", 10).arg("Sync KB", 10).arg("Assets KB", 10));
+    foreach(const QVariant &v, scene->ComponentMemoryStatistics())
+    {
+        const QVariantMap entry = v.toMap();
+        const qulonglong syncBytes = syncStates[entry["typeName"].toString()]["bytes"].toULongLong();
+        totalBytes += entry["bytes"].toULongLong();
+        totalAssetBytes += entry["assetBytes"].toULongLong();
+        totalSyncBytes += syncBytes;
+        LogInfo(QString("%1 %2 %3 %4 %5 %6 %7").arg(entry["typeName"].toString(), -32).arg(entry["count"].toUInt(), 8)
+            .arg(entry["bytes"].toULongLong() / 1024, 10).arg(entry["attributeBytes"].toULongLong() / 1024, 10)
+            .arg(entry["dynamicPropertyBytes"].toULongLong() / 1024, 10).arg(syncBytes / 1024, 10)
+            .arg(entry["assetBytes"].toULongLong() / 1024, 10));
+    }
+    LogInfo(QString("Total: components %1 KB, entity and component sync states %2 KB, referenced assets %3 KB (counted once per component type).")
+        .arg(totalBytes / 1024).arg(totalSyncBytes / 1024).arg(totalAssetBytes / 1024));
+
+    LogInfo(QString("%1 %2 %3 %4").arg("Largest entities", -32).arg("Id", 8).arg("Components", 10).arg("Bytes", 10));
+    foreach(const QVariant &v, scene->EntityMemoryStatistics(maxEntities))
+    {
+        const QVariantMap entry = v.toMap();
+        LogInfo(QString("%1 %2 %3 %4").arg(entry["name"].toString(), -32).arg(entry["id"].toUInt(), 8)
+            .arg(entry["components"].toUInt(), 10).arg(entry["bytes"].toULongLong(), 10));
+    }
+}
+
 bool TundraLogicModule::SaveScene(QString filename, bool asBinary, bool saveTemporaryEntities, bool saveLocalEntities)
 {
     Scene *scene = GetFramework()->Scene()->MainCameraScene();
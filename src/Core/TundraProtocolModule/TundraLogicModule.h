@@ -42,6 +42,9 @@ public:
     /// Returns server
     const shared_ptr<Server>& GetServer() const { return server_; }
 
+    /// Returns zone manager
+    const shared_ptr<ZoneManager>& GetZoneManager() const { return zoneManager_; }
+
 public slots:
     /// Saves scene to an XML file
     /** @param asBinary If true, saves as .tbin. Otherwise saves as .txml.
@@ -76,6 +79,12 @@ public slots:
     bool ImportMesh(QString filename, const float3 &pos = float3(0.f,0.f,0.f), const float3 &rot = float3(0.f,0.f,0.f),
         const float3 &scale = float3(1.f,1.f,1.f), bool inspectForMaterialsAndSkeleton = true);
 
+    /// Prints the approximate memory usage of the active scene by component type, and of its largest entities.
+    /** The component types include the memory of their sync states, see Scene::ComponentMemoryStatistics and
+        SyncManager::SyncStateMemoryStatistics.
+        @param maxEntities Number of the largest entities printed. */
+    void PrintMemoryStatistics(int maxEntities = 10);
+
 private slots:
     /// Reads possible client/server startup parameters and reacts to them upon application startup.
     void ReadStartupParameters();
@@ -92,6 +101,7 @@ private:
     shared_ptr<SyncManager> syncManager_; ///< Sync manager
     shared_ptr<Client> client_; ///< Client
     shared_ptr<Server> server_; ///< Server
+    shared_ptr<ZoneManager> zoneManager_; ///< Zone manager
     KristalliProtocolModule *kristalliModule_; ///< KristalliProtocolModule pointer
 };
 
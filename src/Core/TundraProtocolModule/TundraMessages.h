@@ -39,6 +39,41 @@ const unsigned long cRegisterComponentTypeMessage = 123;
 // Entity parenting
 const unsigned long cSetEntityParentMessage = 124;
 
+// Scenesync batching
+const unsigned long cSceneSyncBatchMessage = 125; // Server->client only. Packs several reliable scenesync messages into one.
+
+// Scene snapshot for joining clients
+const unsigned long cSceneSnapshotMessage = 126; // Server->client only. Compressed CreateEntity messages of the whole replicated scene.
+
+// Compression of large messages
+const unsigned long cCompressedMessage = 127; // Both directions. A compressed scenesync or component type message.
+
+// Latest-value-only attribute edits
+const unsigned long cEditLatestAttributesMessage = 128; // Server->client only. Sent unreliably, except for the final value of an attribute.
+
+// Zone sharding
+const unsigned long cZoneRedirectMessage = 129; // Server->client only. Tells the client to reconnect to the server of a neighbouring zone.
+const unsigned long cZoneHelloMessage = 130; // Zone links only. Identifies the zone of the server that opened the link.
+const unsigned long cZoneMirrorMessage = 131; // Zone links only. Full state of a border entity, mirrored read-only to the neighbour.
+const unsigned long cZoneUnmirrorMessage = 132; // Zone links only. Removes mirrored entities that left the border band.
+const unsigned long cZoneHandoffMessage = 133; // Zone links only. Full state of an entity whose authority moves to the neighbour.
+
+// Entity action batching
+const unsigned long cEntityActionBatchMessage = 134; // Server->client only. The entity actions queued to the client on one tick, with interned action names.
+
+// Asset prefetching
+const unsigned long cAssetManifestMessage = 135; // Server->client only. The assets requested during the server session, for the joining client to prefetch.
+
+// Remote profiling, see DebugStatsModule's RemoteProfiler
+const unsigned long cProfilerSubscribeMessage = 136; // Client->server only. Starts or stops the streaming of profiler snapshots to the client.
+const unsigned long cProfilerSnapshotMessage = 137; // Server->client only. The profiling blocks and statistics of the server since the previous snapshot.
+
+// Session resume
+const unsigned long cSyncCheckpointMessage = 138; // Server->client only. Marks the scene state sent before it, the client sends the last number back when resuming its session.
+
+// Login admission
+const unsigned long cLoginQueueMessage = 139; // Server->client only. Position of the authenticated client in the queue for admission to the scene, and the length of the queue.
+
 // In case of network message structs are regenerated and descriptions get deleted., saving their descriptions here.
 // MsgAssetDeleted: Network message informing that asset has been deleted from storage.
 // MsgAssetDiscovery: Network message informing that new asset has been discovered in storage.
@@ -20,6 +20,8 @@ namespace TundraLogic
     class Client;
     class Server;
     class SyncManager;
+    class SyncAssemblyContext;
+    class ZoneManager;
 }
 
 using TundraLogic::TundraLogicModule;
@@ -88,6 +88,22 @@ void KNetUserConnection::Send(kNet::message_id_t id, const char* data, size_t nu
     connection->EndAndQueueMessage(msg);
 }
 
+float KNetUserConnection::RoundTripTime() const
+{
+    // kNet reports the round-trip time in milliseconds.
+    return connection ? connection->RoundTripTime() * 0.001f : 0.f;
+}
+
+float KNetUserConnection::PacketLossRate() const
+{
+    return connection ? connection->PacketLossRate() : 0.f;
+}
+
+size_t KNetUserConnection::NumOutboundMessagesPending() const
+{
+    return connection ? connection->NumOutboundMessagesPending() : 0;
+}
+
 void KNetUserConnection::Disconnect()
 {
     if (connection)
@@ -20,11 +20,24 @@ enum NetworkProtocolVersion
     ProtocolOriginal = 0x1,         // Original
     ProtocolCustomComponents = 0x2, // Adds support for transmitting new static-structured component types without actual C++ implementation, using EC_PlaceholderComponent
     ProtocolHierarchicScene = 0x3,  // Adds support for hierarchic scene, ie. entities having child entities
-    ProtocolWebClientRigidBodyMessage = 0x4 // WebSocket client that supports the rigid body optimization message
+    ProtocolWebClientRigidBodyMessage = 0x4, // WebSocket client that supports the rigid body optimization message
+    ProtocolAttributeDeltas = 0x5,  // Adds delta-encoding of attribute values against per-connection baselines in server's EditAttributes messages
+    ProtocolSceneSyncBatch = 0x6,   // Adds the SceneSyncBatch message, which packs the server's reliable scenesync messages of many entities to one
+    ProtocolSceneSnapshot = 0x7,    // Adds the SceneSnapshot message, with which the server sends the initial scene state to a joining client in one compressed transfer
+    ProtocolAttributeQuantization = 0x8, // Adds quantization of the server's EditAttributes values according to the AttributeMetadata quantization hints
+    ProtocolCompressedMessages = 0x9, // Adds the CompressedMessage message, which carries a large scenesync or component type message compressed
+    ProtocolWebSocketCoalescedFrames = 0xA, // WebSocket client that receives the messages of one server tick coalesced to one frame of length-prefixed messages
+    ProtocolLatestValueAttributes = 0xB, // Adds the EditLatestAttributes message, which carries the server's edits of latest-value-only attributes unreliably
+    ProtocolZoneRedirect = 0xC, // Adds the ZoneRedirect message, with which a zone sharded server tells a client to reconnect to the server of a neighbouring zone
+    ProtocolEntityActionBatch = 0xD, // Adds the EntityActionBatch message, which packs the server's queued entity actions of a tick to one, with interned action names
+    ProtocolPrototypeEntities = 0xE, // Adds the prototype entity ID to CreateEntity, with the instance's components sent as overrides of the prototype's components
+    ProtocolAssetManifest = 0xF, // Adds the AssetManifest message, with which the server tells a joining client the assets to prefetch
+    ProtocolSessionResume = 0x10, // Adds the resume token to LoginReply and the SyncCheckpoint message, with which a reconnecting client resumes its sync state
+    ProtocolLoginQueue = 0x11 // Adds the LoginQueue message, with which the server tells an authenticated client its position in the queue for admission to the scene
 };
 
 /// Highest supported protocol version in the build. Update this when a new protocol version is added
-const NetworkProtocolVersion cHighestSupportedProtocolVersion = ProtocolWebClientRigidBodyMessage;
+const NetworkProtocolVersion cHighestSupportedProtocolVersion = ProtocolLoginQueue;
 
 /// Represents a client connection on the server side. Subclassed by networking implementations.
 class TUNDRAPROTOCOL_MODULE_API UserConnection : public QObject, public enable_shared_from_this<UserConnection>
@@ -66,6 +79,9 @@ public:
     /// Queue a network message to be sent to the client. All implementations may not use the reliable, inOrder, priority and contentID parameters.
     virtual void Send(kNet::message_id_t id, const char* data, size_t numBytes, bool reliable, bool inOrder, unsigned long priority = 100, unsigned long contentID = 0) = 0;
 
+    /// Sends the messages the implementation has queued for coalescing, if any. SyncManager calls this at the end of each network update tick.
+    virtual void Flush() {}
+
     /// Queue a network message to be sent to the client, with the data to be sent in a DataSerializer. All implementations may not use the reliable, inOrder, priority and contentID parameters.
     void Send(kNet::message_id_t id, bool reliable, bool inOrder, kNet::DataSerializer& ds, unsigned long priority = 100, unsigned long contentID = 0);
 
@@ -77,6 +93,16 @@ public:
         Send(SerializableMessage::messageID, data.reliable, data.inOrder, ds);
     }
 
+    /// Returns the estimated round-trip time of the connection in seconds, or 0 if not known.
+    /** Used by SyncManager to adapt the connection's update rate. Networking implementations should override this if they can estimate it. */
+    virtual float RoundTripTime() const { return 0.f; }
+
+    /// Returns the estimated packet loss rate of the connection in the range [0, 1], or 0 if not known.
+    virtual float PacketLossRate() const { return 0.f; }
+
+    /// Returns the number of messages queued for sending but not yet sent, or 0 if not known.
+    virtual size_t NumOutboundMessagesPending() const { return 0; }
+
     /// Trigger a network message signal. Called by the networking implementation.
     void EmitNetworkMessageReceived(kNet::packet_id_t packetId, kNet::message_id_t messageId, const char* data, size_t numBytes);
 
@@ -134,6 +160,15 @@ public:
     /// Queue a network message to be sent to the client. 
     virtual void Send(kNet::message_id_t id, const char* data, size_t numBytes, bool reliable, bool inOrder, unsigned long priority = 100, unsigned long contentID = 0);
 
+    /// Returns the round-trip time estimate of the message connection in seconds.
+    virtual float RoundTripTime() const;
+
+    /// Returns the packet loss rate estimate of the message connection.
+    virtual float PacketLossRate() const;
+
+    /// Returns the number of messages in the message connection's outbound queue.
+    virtual size_t NumOutboundMessagesPending() const;
+
 public slots:
     /// Starts a benign disconnect procedure (one which waits for the peer acknowledge procedure).
     virtual void Disconnect();
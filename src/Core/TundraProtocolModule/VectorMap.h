@@ -0,0 +1,88 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#pragma once
+
+#include <algorithm>
+#include <functional>
+#include <utility>
+#include <vector>
+
+/// Associative container stored as a sorted contiguous vector of key-value pairs.
+/** Offers a subset of the std::map interface (find, operator[], erase, iteration in key order), but keeps
+    the elements in one allocation for cache-friendly lookups and iteration. Best suited for small maps
+    that are read far more often than modified, such as the per-entity component sync states.
+    @note Unlike std::map, insertion and erasure invalidate iterators and references to the elements. */
+template <typename Key, typename Value, typename Compare = std::less<Key> >
+class VectorMap
+{
+public:
+    typedef Key key_type;
+    typedef Value mapped_type;
+    typedef std::pair<Key, Value> value_type;
+    typedef std::vector<value_type> container_type;
+    typedef typename container_type::iterator iterator;
+    typedef typename container_type::const_iterator const_iterator;
+    typedef typename container_type::size_type size_type;
+
+    iterator begin() { return elements_.begin(); }
+    iterator end() { return elements_.end(); }
+    const_iterator begin() const { return elements_.begin(); }
+    const_iterator end() const { return elements_.end(); }
+
+    size_type size() const { return elements_.size(); }
+    bool empty() const { return elements_.empty(); }
+    void clear() { elements_.clear(); }
+    void reserve(size_type n) { elements_.reserve(n); }
+
+    iterator find(const Key &key)
+    {
+        iterator it = LowerBound(key);
+        return (it != elements_.end() && !compare_(key, it->first)) ? it : elements_.end();
+    }
+
+    const_iterator find(const Key &key) const
+    {
+        const_iterator it = LowerBound(key);
+        return (it != elements_.end() && !compare_(key, it->first)) ? it : elements_.end();
+    }
+
+    size_type count(const Key &key) const { return find(key) != end() ? 1 : 0; }
+
+    /// Returns the value for the key, inserting a default-constructed value if it did not exist.
+    Value &operator[](const Key &key)
+    {
+        iterator it = LowerBound(key);
+        if (it == elements_.end() || compare_(key, it->first))
+            it = elements_.insert(it, value_type(key, Value()));
+        return it->second;
+    }
+
+    /// Erases the element with the key. Returns the number of elements erased.
+    size_type erase(const Key &key)
+    {
+        iterator it = find(key);
+        if (it == elements_.end())
+            return 0;
+        elements_.erase(it);
+        return 1;
+    }
+
+    /// Erases the element at the position. Returns iterator to the element following the erased one.
+    iterator erase(iterator pos) { return elements_.erase(pos); }
+
+    void swap(VectorMap &rhs) { elements_.swap(rhs.elements_); }
+
+private:
+    struct KeyLess
+    {
+        explicit KeyLess(const Compare &c) : compare(c) {}
+        bool operator()(const value_type &lhs, const Key &rhs) const { return compare(lhs.first, rhs); }
+        Compare compare;
+    };
+
+    iterator LowerBound(const Key &key) { return std::lower_bound(elements_.begin(), elements_.end(), key, KeyLess(compare_)); }
+    const_iterator LowerBound(const Key &key) const { return std::lower_bound(elements_.begin(), elements_.end(), key, KeyLess(compare_)); }
+
+    container_type elements_;
+    Compare compare_;
+};
@@ -0,0 +1,712 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#include "StableHeaders.h"
+#include "DebugOperatorNew.h"
+
+#include "ZoneManager.h"
+#include "TundraLogicModule.h"
+#include "Server.h"
+#include "TundraMessages.h"
+#include "UserConnection.h"
+#include "SyncState.h"
+#include "Framework.h"
+#include "SceneAPI.h"
+#include "Scene/Scene.h"
+#include "Entity.h"
+#include "IComponent.h"
+#include "ChangeRequest.h"
+#include "EC_Placeable.h"
+#include "LoggingFunctions.h"
+#include "Profiler.h"
+
+#include <kNet.h>
+
+#include <cstring>
+
+#include "MemoryLeakCheck.h"
+
+namespace
+{
+const unsigned short cDefaultZonePort = 2445;
+const float cMirrorInterval = 0.1f; ///< Seconds between mirror passes.
+const float cReconnectInterval = 5.f; ///< Seconds between attempts to open a zone link.
+/// Distance an owned entity must be clear of the zone before it is handed off, so that it does not bounce between zones at the boundary.
+const float cHandoffHysteresis = 1.f;
+/// Upper bound of the serialized size of a component, as in Entity::SerializeToBinary.
+const int cMaxComponentBytes = 64 * 1024;
+
+u64 MakeKey(u8 zoneId, entity_id_t id)
+{
+    return ((u64)zoneId << 32) | (u64)id;
+}
+
+void SendOnLink(kNet::MessageConnection *connection, kNet::message_id_t id, const char *data, size_t numBytes)
+{
+    kNet::NetworkMessage *msg = connection->StartNewMessage(id, numBytes);
+    if (numBytes)
+        memcpy(msg->data, data, numBytes);
+    msg->reliable = true;
+    msg->inOrder = true;
+    connection->EndAndQueueMessage(msg);
+}
+}
+
+namespace TundraLogic
+{
+
+ZoneManager::ZoneManager(TundraLogicModule* owner) :
+    owner_(owner),
+    framework_(owner->GetFramework()),
+    enabled_(false),
+    linkPort_(cDefaultZonePort),
+    borderDistance_(20.f),
+    linkServer_(0),
+    applyingRemote_(false),
+    mirrorAcc_(0.f)
+{
+    ReadConfiguration();
+
+    Server *server = owner_->GetServer().get();
+    connect(server, SIGNAL(ServerStarted()), SLOT(OnServerStarted()));
+    connect(server, SIGNAL(ServerStopped()), SLOT(OnServerStopped()));
+    connect(server, SIGNAL(UserDisconnected(u32, UserConnection*)), SLOT(OnUserDisconnected(u32, UserConnection*)));
+}
+
+ZoneManager::~ZoneManager()
+{
+    OnServerStopped();
+}
+
+bool ZoneManager::ParseBounds(const QStringList &values, int index, Zone &zone)
+{
+    if (values.size() < index + 4)
+        return false;
+    bool ok[4];
+    zone.minX = values[index].toFloat(&ok[0]);
+    zone.minZ = values[index + 1].toFloat(&ok[1]);
+    zone.maxX = values[index + 2].toFloat(&ok[2]);
+    zone.maxZ = values[index + 3].toFloat(&ok[3]);
+    return ok[0] && ok[1] && ok[2] && ok[3] && zone.minX < zone.maxX && zone.minZ < zone.maxZ;
+}
+
+void ZoneManager::ReadConfiguration()
+{
+    QStringList zoneArg = framework_->CommandLineParameters("--zone");
+    if (zoneArg.empty())
+        return;
+
+    QStringList values = zoneArg.last().split(',');
+    bool ok = false;
+    int id = values.first().toInt(&ok);
+    if (!ok || id < 0 || id > 255 || values.size() != 5 || !ParseBounds(values, 1, zone_))
+    {
+        LogError("ZoneManager: --zone must be given as id,minX,minZ,maxX,maxZ. Zone sharding disabled.");
+        return;
+    }
+    zone_.id = (u8)id;
+
+    QStringList portArg = framework_->CommandLineParameters("--zonePort");
+    if (!portArg.empty())
+    {
+        unsigned short port = portArg.last().toUShort(&ok);
+        if (ok && port)
+            linkPort_ = port;
+        else
+            LogError("ZoneManager: --zonePort is not a valid port, using " + QString::number(linkPort_) + ".");
+    }
+    QStringList borderArg = framework_->CommandLineParameters("--zoneBorder");
+    if (!borderArg.empty())
+        SetBorderDistance(borderArg.last().toFloat());
+
+    foreach(const QString &neighbourArg, framework_->CommandLineParameters("--zoneNeighbour"))
+    {
+        values = neighbourArg.split(',');
+        Neighbour neighbour;
+        id = values.first().toInt(&ok);
+        QStringList address = values.size() > 1 ? values[1].split(':') : QStringList();
+        if (ok && address.size() == 2)
+            neighbour.port = address[1].toUShort(&ok);
+        else
+            ok = false;
+        if (!ok || id < 0 || id > 255 || id == zone_.id || values.size() != 6 || !ParseBounds(values, 2, neighbour.zone))
+        {
+            LogError("ZoneManager: Ignoring malformed --zoneNeighbour " + neighbourArg + ", expected id,host:port,minX,minZ,maxX,maxZ.");
+            continue;
+        }
+        neighbour.zone.id = (u8)id;
+        neighbour.address = address[0].toStdString();
+        neighbours_.push_back(neighbour);
+    }
+
+    enabled_ = true;
+}
+
+void ZoneManager::OnServerStarted()
+{
+    if (!enabled_)
+        return;
+    ScenePtr scene = framework_->Scene()->SceneByName("TundraServer");
+    if (!scene)
+        return;
+
+    scene_ = scene;
+    Scene *sceneptr = scene.get();
+    connect(sceneptr, SIGNAL(AboutToModifyEntity(ChangeRequest*, UserConnection*, Entity*)),
+        SLOT(OnAboutToModifyEntity(ChangeRequest*, UserConnection*, Entity*)));
+    sceneptr->AddAttributeChangeListener(this);
+    connect(sceneptr, SIGNAL(ComponentAdded(Entity*, IComponent*, AttributeChange::Type)),
+        SLOT(OnComponentChanged(Entity*, IComponent*, AttributeChange::Type)));
+    connect(sceneptr, SIGNAL(ComponentRemoved(Entity*, IComponent*, AttributeChange::Type)),
+        SLOT(OnComponentChanged(Entity*, IComponent*, AttributeChange::Type)));
+    connect(sceneptr, SIGNAL(EntityRemoved(Entity*, AttributeChange::Type)),
+        SLOT(OnEntityRemoved(Entity*, AttributeChange::Type)));
+    connect(sceneptr, SIGNAL(EntitiesRemoved(const EntityList &, AttributeChange::Type)),
+        SLOT(OnEntitiesRemoved(const EntityList &, AttributeChange::Type)));
+
+    linkServer_ = network_.StartServer(linkPort_, kNet::SocketOverTCP, this, true);
+    if (linkServer_)
+        LogInfo(QString("ZoneManager: Zone %1 accepting zone links in port %2.").arg(zone_.id).arg(linkPort_));
+    else
+        LogError("ZoneManager: Failed to accept zone links in port " + QString::number(linkPort_) + ".");
+}
+
+void ZoneManager::OnServerStopped()
+{
+    for(size_t i = 0; i < neighbours_.size(); ++i)
+    {
+        Neighbour &neighbour = neighbours_[i];
+        if (neighbour.connection)
+            neighbour.connection->Disconnect(0);
+        neighbour.connection = 0;
+    }
+    if (linkServer_)
+    {
+        network_.StopServer();
+        linkServer_ = 0;
+    }
+    ScenePtr scene = scene_.lock();
+    if (scene)
+    {
+        disconnect(scene.get(), 0, this, 0);
+        scene->RemoveAttributeChangeListener(this);
+    }
+    scene_.reset();
+    Clear();
+}
+
+void ZoneManager::Clear()
+{
+    for(size_t i = 0; i < neighbours_.size(); ++i)
+    {
+        Neighbour &neighbour = neighbours_[i];
+        neighbour.clientPort = 0;
+        neighbour.helloSent = false;
+        neighbour.reconnectWait = 0.f;
+        neighbour.mirrored.clear();
+        neighbour.pendingUnmirrors.clear();
+    }
+    inboundZones_.clear();
+    entityStates_.clear();
+    keyEntities_.clear();
+    dirtyEntities_.clear();
+    redirectedUsers_.clear();
+    mirrorAcc_ = 0.f;
+}
+
+void ZoneManager::Update(f64 frametime)
+{
+    if (!enabled_ || !linkServer_)
+        return;
+
+    PROFILE(ZoneManager_Update);
+
+    // Pulls the inbound messages of the neighbours' zone links and calls HandleMessage for each of them.
+    linkServer_->Process();
+    UpdateLinks((float)frametime);
+
+    ScenePtr scene = scene_.lock();
+    if (!scene)
+        return;
+    mirrorAcc_ += (float)frametime;
+    if (mirrorAcc_ < cMirrorInterval)
+        return;
+    mirrorAcc_ = 0.f;
+
+    MirrorPass(scene.get());
+    RedirectUsers();
+}
+
+void ZoneManager::UpdateLinks(float frametime)
+{
+    for(size_t i = 0; i < neighbours_.size(); ++i)
+    {
+        Neighbour &neighbour = neighbours_[i];
+        if (neighbour.connection)
+        {
+            neighbour.connection->Process();
+            if (neighbour.connection->GetConnectionState() == kNet::ConnectionClosed)
+            {
+                LogWarning(QString("ZoneManager: Zone link to zone %1 closed.").arg(neighbour.zone.id));
+                neighbour.connection = 0;
+                neighbour.helloSent = false;
+                // The neighbour drops the mirrors of this zone with the link, so all are resent on reconnect.
+                neighbour.mirrored.clear();
+                neighbour.pendingUnmirrors.clear();
+            }
+        }
+
+        if (!neighbour.connection)
+        {
+            neighbour.reconnectWait -= frametime;
+            if (neighbour.reconnectWait > 0.f)
+                continue;
+            neighbour.reconnectWait = cReconnectInterval;
+            neighbour.connection = network_.Connect(neighbour.address.c_str(), neighbour.port, kNet::SocketOverTCP, this);
+            if (!neighbour.connection)
+                continue;
+            if (neighbour.connection->GetSocket())
+                neighbour.connection->GetSocket()->SetNaglesAlgorithmEnabled(false);
+        }
+
+        if (!neighbour.helloSent && neighbour.connection->GetConnectionState() == kNet::ConnectionOK)
+        {
+            char buffer[16];
+            kNet::DataSerializer ds(buffer, sizeof(buffer));
+            ds.Add<u8>(zone_.id);
+            ds.Add<u16>((u16)owner_->GetServer()->Port());
+            SendOnLink(neighbour.connection.ptr(), cZoneHelloMessage, ds.GetData(), ds.BytesFilled());
+            neighbour.helloSent = true;
+            LogInfo(QString("ZoneManager: Zone link to zone %1 established.").arg(neighbour.zone.id));
+        }
+    }
+}
+
+void ZoneManager::MirrorPass(Scene *scene)
+{
+    for(Scene::iterator it = scene->begin(); it != scene->end(); ++it)
+    {
+        Entity *entity = it->second.get();
+        const entity_id_t id = entity->Id();
+        if (IsMirror(id))
+            continue;
+        float3 pos;
+        const bool sharded = ShardedPosition(entity, pos);
+        const bool dirty = dirtyEntities_.find(id) != dirtyEntities_.end();
+
+        for(size_t i = 0; i < neighbours_.size(); ++i)
+        {
+            Neighbour &neighbour = neighbours_[i];
+            if (!neighbour.helloSent)
+                continue;
+            std::set<entity_id_t>::iterator mirrored = neighbour.mirrored.find(id);
+            if (sharded && neighbour.zone.Contains(pos, borderDistance_))
+            {
+                if (mirrored == neighbour.mirrored.end() || dirty)
+                {
+                    SendEntity(neighbour, cZoneMirrorMessage, entity);
+                    neighbour.mirrored.insert(id);
+                }
+            }
+            else if (mirrored != neighbour.mirrored.end())
+            {
+                neighbour.pendingUnmirrors.push_back(KeyOf(id));
+                neighbour.mirrored.erase(mirrored);
+            }
+        }
+
+        if (!sharded || zone_.Contains(pos, cHandoffHysteresis))
+            continue;
+        for(size_t i = 0; i < neighbours_.size(); ++i)
+        {
+            Neighbour &neighbour = neighbours_[i];
+            if (!neighbour.helloSent || !neighbour.zone.Contains(pos))
+                continue;
+
+            SendEntity(neighbour, cZoneHandoffMessage, entity);
+            // The entity stays in this scene as a mirror of the new owner, which mirrors it back while it is near.
+            const u64 key = KeyOf(id);
+            EntityZoneState &state = entityStates_[id];
+            state.key = key;
+            state.owner = neighbour.zone.id;
+            keyEntities_[key] = id;
+            for(size_t j = 0; j < neighbours_.size(); ++j)
+                if (neighbours_[j].mirrored.erase(id) && j != i)
+                    neighbours_[j].pendingUnmirrors.push_back(key);
+            LogDebug(QString("ZoneManager: Handed off entity %1 to zone %2.").arg(id).arg(neighbour.zone.id));
+            break;
+        }
+    }
+    dirtyEntities_.clear();
+
+    for(size_t i = 0; i < neighbours_.size(); ++i)
+    {
+        Neighbour &neighbour = neighbours_[i];
+        if (!neighbour.helloSent || neighbour.pendingUnmirrors.empty())
+            continue;
+        std::vector<char> buffer(5 + neighbour.pendingUnmirrors.size() * 5);
+        kNet::DataSerializer ds(&buffer[0], buffer.size());
+        ds.AddVLE<kNet::VLE8_16_32>((u32)neighbour.pendingUnmirrors.size());
+        for(size_t j = 0; j < neighbour.pendingUnmirrors.size(); ++j)
+        {
+            ds.Add<u8>((u8)(neighbour.pendingUnmirrors[j] >> 32));
+            ds.Add<u32>((u32)neighbour.pendingUnmirrors[j]);
+        }
+        SendOnLink(neighbour.connection.ptr(), cZoneUnmirrorMessage, ds.GetData(), ds.BytesFilled());
+        neighbour.pendingUnmirrors.clear();
+    }
+}
+
+void ZoneManager::RedirectUsers()
+{
+    UserConnectionList users = owner_->GetServer()->AuthenticatedUsers();
+    for(UserConnectionList::const_iterator it = users.begin(); it != users.end(); ++it)
+    {
+        UserConnection *user = it->get();
+        if (!user->syncState || user->ProtocolVersion() < ProtocolZoneRedirect)
+            continue;
+        if (redirectedUsers_.find(user->ConnectionId()) != redirectedUsers_.end())
+            continue;
+        // Redirect only once the observer is past the border band, beyond which this server has nothing to show it.
+        const float3 &pos = user->syncState->observerPos;
+        if (!pos.IsFinite() || zone_.Contains(pos, borderDistance_))
+            continue;
+
+        for(size_t i = 0; i < neighbours_.size(); ++i)
+        {
+            const Neighbour &neighbour = neighbours_[i];
+            if (!neighbour.clientPort || !neighbour.zone.Contains(pos))
+                continue;
+            std::vector<char> buffer(neighbour.address.size() + 16);
+            kNet::DataSerializer ds(&buffer[0], buffer.size());
+            ds.AddString(neighbour.address);
+            ds.Add<u16>(neighbour.clientPort);
+            user->Send(cZoneRedirectMessage, ds.GetData(), ds.BytesFilled(), true, true);
+            redirectedUsers_.insert(user->ConnectionId());
+            LogInfo(QString("ZoneManager: Redirected user %1 to zone %2.").arg(user->ConnectionId()).arg(neighbour.zone.id));
+            break;
+        }
+    }
+}
+
+bool ZoneManager::ShardedPosition(Entity *entity, float3 &pos) const
+{
+    // Child entities follow their parent, so only root-level entities are sharded.
+    if (!entity->IsReplicated() || entity->Parent())
+        return false;
+    shared_ptr<EC_Placeable> placeable = entity->Component<EC_Placeable>();
+    if (!placeable)
+        return false;
+    pos = placeable->WorldPosition();
+    return pos.IsFinite();
+}
+
+bool ZoneManager::IsMirror(entity_id_t id) const
+{
+    std::map<entity_id_t, EntityZoneState>::const_iterator it = entityStates_.find(id);
+    return it != entityStates_.end() && it->second.owner >= 0;
+}
+
+u64 ZoneManager::KeyOf(entity_id_t id) const
+{
+    std::map<entity_id_t, EntityZoneState>::const_iterator it = entityStates_.find(id);
+    return it != entityStates_.end() ? it->second.key : MakeKey(zone_.id, id);
+}
+
+EntityPtr ZoneManager::EntityOfKey(Scene *scene, u64 key) const
+{
+    std::map<u64, entity_id_t>::const_iterator it = keyEntities_.find(key);
+    if (it != keyEntities_.end())
+        return scene->EntityById(it->second);
+    // An entity created in this zone that has not been on the zone links has its own ID as the key.
+    const entity_id_t id = (entity_id_t)key;
+    if ((u8)(key >> 32) == zone_.id && entityStates_.find(id) == entityStates_.end())
+        return scene->EntityById(id);
+    return EntityPtr();
+}
+
+ZoneManager::Neighbour *ZoneManager::NeighbourOfZone(int zoneId)
+{
+    for(size_t i = 0; i < neighbours_.size(); ++i)
+        if (neighbours_[i].zone.id == zoneId)
+            return &neighbours_[i];
+    return 0;
+}
+
+QByteArray ZoneManager::SerializeEntity(Entity *entity) const
+{
+    std::vector<ComponentPtr> components;
+    std::vector<QByteArray> componentData;
+    size_t size = 16;
+    const Entity::ComponentMap &allComponents = entity->Components();
+    for(Entity::ComponentMap::const_iterator it = allComponents.begin(); it != allComponents.end(); ++it)
+    {
+        if (!it->second->IsReplicated())
+            continue;
+        QByteArray bytes;
+        bytes.resize(cMaxComponentBytes);
+        kNet::DataSerializer compDs(bytes.data(), bytes.size());
+        it->second->SerializeToBinary(compDs);
+        bytes.resize((int)compDs.BytesFilled());
+        components.push_back(it->second);
+        componentData.push_back(bytes);
+        size += 16 + it->second->Name().toStdString().size() + bytes.size();
+    }
+
+    QByteArray data;
+    data.resize((int)size);
+    kNet::DataSerializer ds(data.data(), data.size());
+    const u64 key = KeyOf(entity->Id());
+    ds.Add<u8>((u8)(key >> 32));
+    ds.Add<u32>((u32)key);
+    ds.AddVLE<kNet::VLE8_16_32>((u32)components.size());
+    for(size_t i = 0; i < components.size(); ++i)
+    {
+        ds.Add<u32>(components[i]->TypeId());
+        ds.AddString(components[i]->Name().toStdString());
+        ds.Add<u32>((u32)componentData[i].size());
+        ds.AddArray<u8>((const u8*)componentData[i].data(), componentData[i].size());
+    }
+    data.resize((int)ds.BytesFilled());
+    return data;
+}
+
+void ZoneManager::SendEntity(Neighbour &neighbour, kNet::message_id_t messageId, Entity *entity)
+{
+    QByteArray data = SerializeEntity(entity);
+    SendOnLink(neighbour.connection.ptr(), messageId, data.data(), data.size());
+}
+
+EntityPtr ZoneManager::ReadEntity(Scene *scene, const char *data, size_t numBytes, int ownerZone)
+{
+    kNet::DataDeserializer dd(data, numBytes);
+    const u8 keyZone = dd.Read<u8>();
+    const u64 key = MakeKey(keyZone, dd.Read<u32>());
+
+    EntityPtr entity = EntityOfKey(scene, key);
+    // A mirror of an entity this server owns is stale, e.g. sent before the handoff of the entity here was received.
+    if (entity && ownerZone >= 0 && !IsMirror(entity->Id()))
+        return EntityPtr();
+    if (!entity)
+    {
+        entity = scene->CreateEntity(0, QStringList(), AttributeChange::Replicate, true, true, false);
+        if (!entity)
+        {
+            LogError("ZoneManager::ReadEntity: Failed to create entity.");
+            return entity;
+        }
+    }
+    EntityZoneState &state = entityStates_[entity->Id()];
+    state.key = key;
+    state.owner = ownerZone;
+    keyEntities_[key] = entity->Id();
+
+    applyingRemote_ = true;
+    std::set<IComponent*> received;
+    const uint numComponents = dd.ReadVLE<kNet::VLE8_16_32>();
+    for(uint i = 0; i < numComponents; ++i)
+    {
+        const u32 typeId = dd.Read<u32>();
+        const QString name = QString::fromStdString(dd.ReadString());
+        const u32 size = dd.Read<u32>();
+        if (size > dd.BytesLeft())
+        {
+            LogError("ZoneManager::ReadEntity: Truncated data of entity " + QString::number(entity->Id()) + ".");
+            break;
+        }
+        ComponentPtr comp = entity->GetOrCreateComponent(typeId, name, AttributeChange::Replicate);
+        if (comp)
+        {
+            kNet::DataDeserializer compDd(data + dd.BytePos(), size);
+            comp->DeserializeFromBinary(compDd, AttributeChange::Replicate);
+            received.insert(comp.get());
+        }
+        else
+            LogWarning("ZoneManager::ReadEntity: Unknown component type " + QString::number(typeId) + ".");
+        dd.SkipBytes(size);
+    }
+
+    // Remove the components the owner has removed.
+    std::vector<component_id_t> removed;
+    const Entity::ComponentMap &components = entity->Components();
+    for(Entity::ComponentMap::const_iterator it = components.begin(); it != components.end(); ++it)
+        if (it->second->IsReplicated() && received.find(it->second.get()) == received.end())
+            removed.push_back(it->first);
+    for(size_t i = 0; i < removed.size(); ++i)
+        entity->RemoveComponentById(removed[i], AttributeChange::Replicate);
+    applyingRemote_ = false;
+
+    return entity;
+}
+
+void ZoneManager::RemoveMirrors(int ownerZone)
+{
+    ScenePtr scene = scene_.lock();
+    if (!scene)
+        return;
+    std::vector<entity_id_t> mirrors;
+    for(std::map<entity_id_t, EntityZoneState>::const_iterator it = entityStates_.begin(); it != entityStates_.end(); ++it)
+        if (it->second.owner == ownerZone)
+            mirrors.push_back(it->first);
+    // OnEntityRemoved forgets the zone states of the mirrors.
+    for(size_t i = 0; i < mirrors.size(); ++i)
+        scene->RemoveEntity(mirrors[i], AttributeChange::Replicate);
+}
+
+void ZoneManager::NewConnectionEstablished(kNet::MessageConnection *source)
+{
+    source->RegisterInboundMessageHandler(this);
+    if (source->GetSocket())
+        source->GetSocket()->SetNaglesAlgorithmEnabled(false);
+}
+
+void ZoneManager::ClientDisconnected(kNet::MessageConnection *source)
+{
+    std::map<kNet::MessageConnection*, int>::iterator it = inboundZones_.find(source);
+    if (it == inboundZones_.end())
+        return;
+    const int zoneId = it->second;
+    inboundZones_.erase(it);
+    LogWarning(QString("ZoneManager: Zone link from zone %1 closed, removing its mirrors.").arg(zoneId));
+    Neighbour *neighbour = NeighbourOfZone(zoneId);
+    if (neighbour)
+        neighbour->clientPort = 0;
+    RemoveMirrors(zoneId);
+}
+
+void ZoneManager::HandleMessage(kNet::MessageConnection *source, kNet::packet_id_t /*packetId*/, kNet::message_id_t messageId, const char *data, size_t numBytes)
+{
+    if (messageId == cZoneHelloMessage)
+    {
+        HandleHello(source, data, numBytes);
+        return;
+    }
+
+    std::map<kNet::MessageConnection*, int>::const_iterator it = inboundZones_.find(source);
+    if (it == inboundZones_.end())
+    {
+        LogWarning("ZoneManager: Dropping message " + QString::number(messageId) + " from an unidentified zone link.");
+        return;
+    }
+
+    switch(messageId)
+    {
+    case cZoneMirrorMessage:
+        HandleMirror(it->second, data, numBytes);
+        break;
+    case cZoneUnmirrorMessage:
+        HandleUnmirror(it->second, data, numBytes);
+        break;
+    case cZoneHandoffMessage:
+        HandleHandoff(it->second, data, numBytes);
+        break;
+    default:
+        LogWarning("ZoneManager: Unknown zone link message " + QString::number(messageId) + ".");
+        break;
+    }
+}
+
+void ZoneManager::HandleHello(kNet::MessageConnection *source, const char *data, size_t numBytes)
+{
+    kNet::DataDeserializer dd(data, numBytes);
+    const u8 zoneId = dd.Read<u8>();
+    const u16 clientPort = dd.Read<u16>();
+    Neighbour *neighbour = NeighbourOfZone(zoneId);
+    if (!neighbour)
+    {
+        LogWarning(QString("ZoneManager: Refusing zone link from zone %1, which is not a neighbour.").arg(zoneId));
+        source->Disconnect(0);
+        return;
+    }
+    inboundZones_[source] = zoneId;
+    neighbour->clientPort = clientPort;
+    LogInfo(QString("ZoneManager: Zone link from zone %1 established.").arg(zoneId));
+}
+
+void ZoneManager::HandleMirror(int senderZone, const char *data, size_t numBytes)
+{
+    ScenePtr scene = scene_.lock();
+    if (scene)
+        ReadEntity(scene.get(), data, numBytes, senderZone);
+}
+
+void ZoneManager::HandleUnmirror(int senderZone, const char *data, size_t numBytes)
+{
+    ScenePtr scene = scene_.lock();
+    if (!scene)
+        return;
+    kNet::DataDeserializer dd(data, numBytes);
+    const uint numKeys = dd.ReadVLE<kNet::VLE8_16_32>();
+    for(uint i = 0; i < numKeys; ++i)
+    {
+        const u8 keyZone = dd.Read<u8>();
+        EntityPtr entity = EntityOfKey(scene.get(), MakeKey(keyZone, dd.Read<u32>()));
+        // The mirror may already have been taken over by, or handed off to, another zone.
+        if (!entity)
+            continue;
+        std::map<entity_id_t, EntityZoneState>::const_iterator it = entityStates_.find(entity->Id());
+        if (it != entityStates_.end() && it->second.owner == senderZone)
+            scene->RemoveEntity(entity->Id(), AttributeChange::Replicate);
+    }
+}
+
+void ZoneManager::HandleHandoff(int senderZone, const char *data, size_t numBytes)
+{
+    ScenePtr scene = scene_.lock();
+    if (!scene)
+        return;
+    EntityPtr entity = ReadEntity(scene.get(), data, numBytes, -1);
+    if (entity)
+        LogDebug(QString("ZoneManager: Took over entity %1 from zone %2.").arg(entity->Id()).arg(senderZone));
+}
+
+void ZoneManager::OnUserDisconnected(u32 connectionID, UserConnection* /*connection*/)
+{
+    redirectedUsers_.erase(connectionID);
+}
+
+void ZoneManager::OnAboutToModifyEntity(ChangeRequest *req, UserConnection* /*user*/, Entity *entity)
+{
+    if (entity && IsMirror(entity->Id()))
+        req->Deny();
+}
+
+void ZoneManager::OnAttributeChanged(IComponent *comp, IAttribute* /*attr*/, AttributeChange::Type change)
+{
+    if (applyingRemote_ || change == AttributeChange::LocalOnly || change == AttributeChange::Disconnected || !comp->IsReplicated())
+        return;
+    Entity *entity = comp->ParentEntity();
+    if (entity && entity->IsReplicated() && !IsMirror(entity->Id()))
+        dirtyEntities_.insert(entity->Id());
+}
+
+void ZoneManager::OnComponentChanged(Entity *entity, IComponent *comp, AttributeChange::Type change)
+{
+    if (applyingRemote_ || change == AttributeChange::LocalOnly || change == AttributeChange::Disconnected || !comp->IsReplicated())
+        return;
+    if (entity->IsReplicated() && !IsMirror(entity->Id()))
+        dirtyEntities_.insert(entity->Id());
+}
+
+void ZoneManager::OnEntitiesRemoved(const EntityList &entities, AttributeChange::Type change)
+{
+    for(EntityList::const_iterator it = entities.begin(); it != entities.end(); ++it)
+        OnEntityRemoved(it->get(), change);
+}
+
+void ZoneManager::OnEntityRemoved(Entity *entity, AttributeChange::Type /*change*/)
+{
+    const entity_id_t id = entity->Id();
+    const u64 key = KeyOf(id);
+    for(size_t i = 0; i < neighbours_.size(); ++i)
+        if (neighbours_[i].mirrored.erase(id))
+            neighbours_[i].pendingUnmirrors.push_back(key);
+    std::map<entity_id_t, EntityZoneState>::iterator it = entityStates_.find(id);
+    if (it != entityStates_.end())
+    {
+        keyEntities_.erase(it->second.key);
+        entityStates_.erase(it);
+    }
+    dirtyEntities_.erase(id);
+}
+
+}
@@ -0,0 +1,204 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#pragma once
+
+#include "TundraProtocolModuleApi.h"
+#include "TundraProtocolModuleFwd.h"
+#include "SceneFwd.h"
+#include "AttributeChangeType.h"
+#include "AttributeChangeListener.h"
+#include "Math/float3.h"
+
+#include <kNet/IMessageHandler.h>
+#include <kNet/INetworkServerListener.h>
+#include <kNet/Network.h>
+
+#include <QObject>
+#include <QByteArray>
+#include <QStringList>
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+class IAttribute;
+class ChangeRequest;
+
+namespace TundraLogic
+{
+
+/// Splits one logical scene between several server processes, each of which owns a rectangular zone of it.
+/** Every server of the sharded scene owns the root-level replicated entities whose EC_Placeable is inside its zone on
+    the XZ plane, and is linked to the servers of the neighbouring zones with TCP connections of its own kNet network.
+    The zone links carry three kinds of traffic:
+    <ul>
+    <li>Border mirroring: the owned entities within the border distance of a neighbouring zone are mirrored to the
+        neighbour, which replicates them to its own clients as read-only entities. Client edits to mirrored entities are
+        denied. A mirror is resent whenever its entity changes, and removed when the entity leaves the border band.
+    <li>Entity handoff: when an owned entity moves out of the zone into a neighbouring one, its full state is sent to
+        the neighbour, which takes over its authority. The entity stays in the scene of the original owner, as a mirror.
+    <li>Client redirect: a client whose observer crosses the border band into a neighbouring zone is told to reconnect
+        to the server of that zone, see Client::ZoneRedirected.
+    </ul>
+
+    As the servers allocate entity IDs independently, an entity is identified on the zone links by the ID of the zone
+    it was created in and its ID there, and each server maps these keys to its local entity IDs.
+
+    Zone sharding is enabled on a server with the following command line parameters:
+    <ul>
+    <li>--zone <id,minX,minZ,maxX,maxZ>: ID (0-255, unique in the sharded scene) and bounds of this server's zone.
+    <li>--zonePort <port>: Port of the zone links of this server, 2445 by default.
+    <li>--zoneNeighbour <id,host:port,minX,minZ,maxX,maxZ>: A neighbouring zone and the address of its zone links.
+        Can be given many times. The host must be reachable by the clients too, as they are redirected to it.
+    <li>--zoneBorder <distance>: Width of the border band mirrored to the neighbours, 20 by default.
+    </ul> */
+class TUNDRAPROTOCOL_MODULE_API ZoneManager : public QObject, public kNet::IMessageHandler, public kNet::INetworkServerListener, public IAttributeChangeListener
+{
+    Q_OBJECT
+    Q_PROPERTY(bool enabled READ IsEnabled)
+    Q_PROPERTY(int zoneId READ ZoneId)
+    Q_PROPERTY(float borderDistance READ BorderDistance WRITE SetBorderDistance)
+
+public:
+    explicit ZoneManager(TundraLogicModule* owner);
+    ~ZoneManager();
+
+    /// Processes the zone links, and mirrors, hands off and redirects as needed.
+    void Update(f64 frametime);
+
+    /// Returns whether zone sharding was configured on the command line.
+    bool IsEnabled() const { return enabled_; }
+
+    /// Returns the ID of this server's zone.
+    int ZoneId() const { return zone_.id; }
+
+    /// Sets the width of the border band mirrored to the neighbours.
+    void SetBorderDistance(float distance) { borderDistance_ = distance; }
+    float BorderDistance() const { return borderDistance_; }
+
+    /// Returns whether the entity is a read-only mirror of an entity owned by a neighbouring zone.
+    bool IsMirror(entity_id_t id) const;
+
+    /// Invoked by the Network library for each message received on a zone link.
+    void HandleMessage(kNet::MessageConnection *source, kNet::packet_id_t packetId, kNet::message_id_t messageId, const char *data, size_t numBytes);
+    /// Invoked by the Network library when a neighbour opens a zone link to this server.
+    void NewConnectionEstablished(kNet::MessageConnection *source);
+    /// Invoked by the Network library when a zone link opened by a neighbour is closed.
+    void ClientDisconnected(kNet::MessageConnection *source);
+
+private slots:
+    void OnServerStarted();
+    void OnServerStopped();
+    void OnUserDisconnected(u32 connectionID, UserConnection *connection);
+    void OnAboutToModifyEntity(ChangeRequest *req, UserConnection *user, Entity *entity);
+    void OnComponentChanged(Entity *entity, IComponent *comp, AttributeChange::Type change);
+    void OnEntityRemoved(Entity *entity, AttributeChange::Type change);
+    void OnEntitiesRemoved(const EntityList &entities, AttributeChange::Type change);
+
+private:
+    /// Marks the entity of a replicated component dirty. Registered to the scene as an attribute change listener.
+    void OnAttributeChanged(IComponent *comp, IAttribute *attr, AttributeChange::Type change);
+
+    /// A zone of the sharded scene.
+    struct Zone
+    {
+        Zone() : id(0), minX(0.f), minZ(0.f), maxX(0.f), maxZ(0.f) {}
+
+        /// Returns whether the position is inside the zone grown by the margin on each side.
+        bool Contains(const float3 &pos, float margin = 0.f) const
+        {
+            return pos.x >= minX - margin && pos.x < maxX + margin && pos.z >= minZ - margin && pos.z < maxZ + margin;
+        }
+
+        u8 id;
+        float minX;
+        float minZ;
+        float maxX;
+        float maxZ;
+    };
+
+    /// A neighbouring zone and the zone link to its server.
+    struct Neighbour
+    {
+        Neighbour() : port(0), clientPort(0), helloSent(false), reconnectWait(0.f) {}
+
+        Zone zone;
+        std::string address;
+        unsigned short port; ///< Port of the neighbour's zone links.
+        unsigned short clientPort; ///< Port of the neighbour's clients, 0 until its Hello has arrived.
+        Ptr(kNet::MessageConnection) connection; ///< Zone link opened by this server, on which it sends to the neighbour.
+        bool helloSent;
+        float reconnectWait; ///< Time left until the next attempt to open the zone link.
+        std::set<entity_id_t> mirrored; ///< Owned entities mirrored to the neighbour.
+        std::vector<u64> pendingUnmirrors; ///< Keys of mirrored entities that were removed since the last mirror pass.
+    };
+
+    /// Zone state of an entity that has been on the zone links.
+    struct EntityZoneState
+    {
+        EntityZoneState() : key(0), owner(-1) {}
+
+        u64 key; ///< Origin zone ID in the high and origin entity ID in the low 32 bits.
+        int owner; ///< ID of the zone owning the entity, or -1 if this server owns it.
+    };
+
+    /// Parses a "minX,minZ,maxX,maxZ" list starting at the index. Returns false if malformed.
+    static bool ParseBounds(const QStringList &values, int index, Zone &zone);
+    /// Reads the zone configuration from the command line.
+    void ReadConfiguration();
+
+    /// Opens the zone links to the neighbours that do not have one, and sends the Hello of the new links.
+    void UpdateLinks(float frametime);
+    /// Sends the changed border entities to the neighbours, and hands off the entities that have left the zone.
+    void MirrorPass(Scene *scene);
+    /// Redirects the clients whose observer has entered a neighbouring zone.
+    void RedirectUsers();
+
+    /// Returns the position the entity is sharded by, or false if it is not sharded.
+    bool ShardedPosition(Entity *entity, float3 &pos) const;
+    /// Returns the zone link key of a local entity.
+    u64 KeyOf(entity_id_t id) const;
+    /// Returns the local entity of a zone link key, or null if there is none.
+    EntityPtr EntityOfKey(Scene *scene, u64 key) const;
+    /// Returns the neighbour of a zone ID, or null if not a neighbour.
+    Neighbour *NeighbourOfZone(int zoneId);
+
+    /// Returns the key and the replicated components of the entity, serialized for a Mirror or Handoff message.
+    QByteArray SerializeEntity(Entity *entity) const;
+    /// Sends the entity over the zone link of the neighbour, as a Mirror or Handoff message.
+    void SendEntity(Neighbour &neighbour, kNet::message_id_t messageId, Entity *entity);
+    /// Creates or updates the local copy of an entity from a Mirror or Handoff message.
+    /** @param ownerZone ID of the zone owning the entity, or -1 if the entity is handed off to this server.
+        @return The entity, or null if the message was ignored or failed. */
+    EntityPtr ReadEntity(Scene *scene, const char *data, size_t numBytes, int ownerZone);
+    /// Removes the mirrors owned by the zone from the scene.
+    void RemoveMirrors(int ownerZone);
+    /// Forgets the zone state of all entities and neighbours.
+    void Clear();
+
+    void HandleHello(kNet::MessageConnection *source, const char *data, size_t numBytes);
+    void HandleMirror(int senderZone, const char *data, size_t numBytes);
+    void HandleUnmirror(int senderZone, const char *data, size_t numBytes);
+    void HandleHandoff(int senderZone, const char *data, size_t numBytes);
+
+    TundraLogicModule* owner_;
+    Framework* framework_;
+    SceneWeakPtr scene_;
+    bool enabled_;
+    Zone zone_; ///< Zone of this server.
+    unsigned short linkPort_; ///< Port of this server's zone links.
+    float borderDistance_;
+    std::vector<Neighbour> neighbours_;
+    kNet::Network network_; ///< Network of the zone links.
+    kNet::NetworkServer *linkServer_; ///< Server accepting the neighbours' zone links.
+    std::map<kNet::MessageConnection*, int> inboundZones_; ///< Zone IDs of the zone links opened by the neighbours, known after their Hello.
+    std::map<entity_id_t, EntityZoneState> entityStates_; ///< Zone states of the entities that have been on the zone links.
+    std::map<u64, entity_id_t> keyEntities_; ///< Local IDs of the entities that have been on the zone links.
+    std::set<entity_id_t> dirtyEntities_; ///< Owned entities changed since the last mirror pass.
+    std::set<u32> redirectedUsers_; ///< Connection IDs of the users already told to reconnect to a neighbour.
+    bool applyingRemote_; ///< Whether an entity from a zone link is being applied, so that its changes do not mark it dirty.
+    float mirrorAcc_; ///< Time accumulated towards the next mirror pass.
+};
+
+}
@@ -9,6 +9,7 @@
 #include "DebugOperatorNew.h"
 
 #include "EC_HoveringText.h"
+#include "HoveringTextBatch.h"
 #include "Renderer.h"
 #include "EC_Placeable.h"
 #include "Entity.h"
@@ -21,6 +22,7 @@
 #include "OgreMaterialUtils.h"
 #include "AssetAPI.h"
 #include "TextureAsset.h"
+#include "Math/MathFunc.h"
 
 #include <Ogre.h>
 #include <QFile>
@@ -30,6 +32,12 @@
 
 #include "MemoryLeakCheck.h"
 
+namespace
+{
+/// The material the shared glyph atlas matches in appearance.
+const QString cDefaultMaterial = "local://HoveringText.material";
+}
+
 EC_HoveringText::EC_HoveringText(Scene* scene) :
     IComponent(scene),
     font_(QFont("Arial", 100)),
@@ -54,7 +62,8 @@ EC_HoveringText::EC_HoveringText(Scene* scene) :
     INIT_ATTRIBUTE_VALUE(texHeight, "Texture Height", 256),
     INIT_ATTRIBUTE_VALUE(cornerRadius, "Corner Radius", float2(20.0, 20.0)),
     INIT_ATTRIBUTE_VALUE(enableMipmapping, "Enable Mipmapping", true),
-    INIT_ATTRIBUTE_VALUE(material, "Material", AssetReference("local://HoveringText.material", ""))
+    INIT_ATTRIBUTE_VALUE(material, "Material", AssetReference(cDefaultMaterial, "")),
+    INIT_ATTRIBUTE_VALUE(batched, "Batched", true)
 {
     if (scene)
         world_ = scene->GetWorld<OgreWorld>();
@@ -75,6 +84,12 @@ void EC_HoveringText::Destroy()
     if (!ViewEnabled())
         return;
 
+    if (batch_)
+    {
+        batch_->RemoveLabel(this);
+        batch_.reset();
+    }
+
     if (!world_.expired())
     {
         Ogre::SceneManager* sceneMgr = world_.lock()->OgreSceneManager();
@@ -143,6 +158,11 @@ void EC_HoveringText::Show()
     if (!ViewEnabled())
         return;
 
+    if (batch_)
+    {
+        batch_->SetLabelVisible(this, true);
+        return;
+    }
     if (billboardSet_)
         billboardSet_->setVisible(true);
 }
@@ -152,6 +172,11 @@ void EC_HoveringText::Hide()
     if (!ViewEnabled())
         return;
 
+    if (batch_)
+    {
+        batch_->SetLabelVisible(this, false);
+        return;
+    }
     if (billboardSet_)
         billboardSet_->setVisible(false);
 }
@@ -184,6 +209,8 @@ bool EC_HoveringText::IsVisible() const
     if (!ViewEnabled())
         return false;
 
+    if (batch_)
+        return batch_->IsLabelVisible(this);
     if (billboardSet_)
         return billboardSet_->isVisible();
     else
@@ -196,6 +223,11 @@ void EC_HoveringText::ShowMessage(const QString &text)
         return;
     if (world_.expired())
         return;
+    if (batch_)
+    {
+        UpdateBatchedLabel(true);
+        return;
+    }
     
     OgreWorldPtr world = world_.lock();
     Ogre::SceneManager *scene = world->OgreSceneManager();
@@ -243,6 +275,11 @@ void EC_HoveringText::Redraw()
     if (!ViewEnabled())
         return;
 
+    if (batch_)
+    {
+        UpdateBatchedLabel(true);
+        return;
+    }
     if (world_.expired() || !billboardSet_ || !billboard_ || materialName_.empty())
         return;
 
@@ -314,6 +351,30 @@ void EC_HoveringText::Redraw()
 
 void EC_HoveringText::AttributesChanged()
 {
+    // Changes to the following attributes require a (expensive) repaint of the texture on the CPU side.
+    bool repaint = text.ValueChanged() || font.ValueChanged() || fontSize.ValueChanged() || fontColor.ValueChanged()
+        || backgroundColor.ValueChanged() || borderColor.ValueChanged() || borderThickness.ValueChanged() || usingGrad.ValueChanged()
+        || gradStart.ValueChanged() || gradEnd.ValueChanged() || texWidth.ValueChanged() || texHeight.ValueChanged()
+        || cornerRadius.ValueChanged() || enableMipmapping.ValueChanged();
+
+    // Changes to the following attributes do not alter the texture contents, and don't require a repaint:
+    // position, overlayAlpha, width, height.
+
+    // Move between the shared glyph atlas and a texture of our own when the appearance allows.
+    const bool useBatch = UseBatch();
+    if (useBatch && !batch_)
+    {
+        Destroy();
+        batch_ = HoveringTextBatch::ForScene(ParentScene());
+        repaint = true;
+    }
+    else if (!useBatch && batch_)
+    {
+        Destroy();
+        materialAsset.HandleAssetRefChange(&material);
+        repaint = true;
+    }
+
     if (font.ValueChanged() || fontSize.ValueChanged())
     {
         SetFont(QFont(font.Get(), fontSize.Get()));
@@ -337,6 +398,12 @@ void EC_HoveringText::AttributesChanged()
         colEnd.setRgbF(col.r, col.g, col.b);
         SetBackgroundGradient(colStart, colEnd);
     }
+    if (batch_)
+    {
+        // The glyph quads are placed and colored when built for the frame, so only a change of the text needs a layout.
+        UpdateBatchedLabel(repaint);
+        return;
+    }
     if (overlayAlpha.ValueChanged())
         SetOverlayAlpha(overlayAlpha.Get());
     if (width.ValueChanged() || height.ValueChanged())
@@ -362,15 +429,6 @@ void EC_HoveringText::AttributesChanged()
             materialAsset.HandleAssetRefChange(&material);
     }
 
-    // Changes to the following attributes require a (expensive) repaint of the texture on the CPU side.
-    bool repaint = text.ValueChanged() || font.ValueChanged() || fontSize.ValueChanged() || fontColor.ValueChanged()
-        || backgroundColor.ValueChanged() || borderColor.ValueChanged() || borderThickness.ValueChanged() || usingGrad.ValueChanged()
-        || gradStart.ValueChanged() || gradEnd.ValueChanged() || texWidth.ValueChanged() || texHeight.ValueChanged()
-        || cornerRadius.ValueChanged() || enableMipmapping.ValueChanged();
-
-    // Changes to the following attributes do not alter the texture contents, and don't require a repaint:
-    // position, overlayAlpha, width, height.
-
     // Repaint the new text with new appearance.
     if (repaint)
         ShowMessage(text.Get());
@@ -386,6 +444,10 @@ void EC_HoveringText::OnMaterialAssetLoaded(AssetPtr asset)
         return;
     }
 
+    // The shared glyph atlas has a material of its own.
+    if (batch_)
+        return;
+
     // Make a clone of the material we loaded, since the same material may be used by some other entities in the scene,
     // and this EC_HoveringText must customize the material to show its own texture on it.
     RecreateMaterial();
@@ -438,3 +500,39 @@ void EC_HoveringText::DeleteMaterial()
         materialName_ = "";
     }
 }
+
+bool EC_HoveringText::UseBatch() const
+{
+    if (!batched.Get() || !ViewEnabled() || world_.expired())
+        return false;
+
+    // The atlas draws plain text on a rectangular background, like the default material does on the texture.
+    const float2 corners = cornerRadius.Get();
+    return !usingGrad.Get() && (borderColor.Get().a <= 0.f || borderThickness.Get() <= 0.f) &&
+        (backgroundColor.Get().a <= 0.f || (corners.x <= 0.f && corners.y <= 0.f)) &&
+        material.Get().ref == cDefaultMaterial;
+}
+
+void EC_HoveringText::UpdateBatchedLabel(bool show)
+{
+    Entity *entity = ParentEntity();
+    if (!batch_ || !entity)
+        return;
+
+    HoveringTextBatch::Label label;
+    label.placeable = entity->GetComponent<EC_Placeable>();
+    label.position = position.Get();
+    label.text = text.Get();
+    label.font = font_;
+    const float alpha = Clamp(overlayAlpha.Get(), 0.f, 1.f);
+    label.color = textColor_;
+    label.color.setAlphaF(textColor_.alphaF() * alpha);
+    const Color background = backgroundColor.Get();
+    label.background.setRgbF(background.r, background.g, background.b, Clamp(background.a, 0.f, 1.f) * alpha);
+    label.width = width.Get();
+    label.height = height.Get();
+    label.texWidth = (int)texWidth.Get();
+    label.texHeight = (int)texHeight.Get();
+    label.visible = show || batch_->IsLabelVisible(this);
+    batch_->SetLabel(this, label);
+}
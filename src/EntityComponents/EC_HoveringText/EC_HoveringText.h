@@ -19,6 +19,8 @@
 #include <QColor>
 #include <QLinearGradient>
 
+class HoveringTextBatch;
+
 /// Shows a hovering text attached to an entity.
 /** <table class="header">
     <tr>
@@ -66,6 +68,8 @@
     <din> @copydoc enableMipmapping </div>
     <li>AssetReference: material
     <din> @copydoc material </div>
+    <li>bool: batched
+    <din> @copydoc batched </div>
     </ul>
 
     <b>Exposes the following scriptable functions:</b>
@@ -182,6 +186,13 @@ public:
     Q_PROPERTY(AssetReference material READ getmaterial WRITE setmaterial);
     DEFINE_QPROPERTY_ATTRIBUTE(AssetReference, material);
 
+    /// Do we want to draw the text from the glyph atlas shared by the hovering texts of the scene.
+    /** Used only when the text has no gradient, no border, no rounded background and the default material, otherwise
+        the text is drawn to a texture of its own. Changing the text is then cheap, and distant texts are drawn with
+        glyphs of lower resolution, or not at all when too small to read. */
+    Q_PROPERTY(bool batched READ getbatched WRITE setbatched);
+    DEFINE_QPROPERTY_ATTRIBUTE(bool, batched);
+
     /// Clears the 3D subsystem resources for this object.
     void Destroy();
 
@@ -226,7 +237,8 @@ public slots:
     void SetBillboardSize(float width, float height);
 
     /// Gets the name of the material that this component has created for displaying the text.
-    /** Useful for using this just to create the material, and using e.g. a mesh to display it. */
+    /** Useful for using this just to create the material, and using e.g. a mesh to display it.
+        @note Empty when the text is drawn from the shared glyph atlas, see batched. */
     QString GetMaterialName() const { return QString::fromStdString(materialName_); }
 
 private slots:
@@ -249,6 +261,13 @@ private:
     /// Recreates the internal cloned material from the currently specified material asset reference (that is assumed to be loaded already).
     void RecreateMaterial();
 
+    /// Returns whether the text is to be drawn from the shared glyph atlas.
+    bool UseBatch() const;
+
+    /// Updates the text in the shared glyph atlas batch from the attributes.
+    /** @param show Whether to show the text, otherwise its visibility is kept. */
+    void UpdateBatchedLabel(bool show);
+
     /// Ogre world pointer.
     OgreWorldWeakPtr world_;
     
@@ -278,4 +297,7 @@ private:
     TextureAssetPtr texture_;
 
     AssetRefListener materialAsset;
+
+    /// The glyph atlas batch of the scene, if the text is drawn from it.
+    shared_ptr<HoveringTextBatch> batch_;
 };
@@ -0,0 +1,455 @@
+/**
+    For conditions of distribution and use, see copyright notice in LICENSE
+
+    @file   HoveringTextBatch.cpp
+    @brief  Draws the hovering texts of a scene from a shared glyph atlas. */
+
+#define MATH_OGRE_INTEROP
+
+#include "DebugOperatorNew.h"
+
+#include "HoveringTextBatch.h"
+#include "EC_HoveringText.h"
+#include "EC_Placeable.h"
+#include "OgreWorld.h"
+#include "Renderer.h"
+#include "ScreenSize.h"
+#include "TextureAsset.h"
+#include "Scene/Scene.h"
+#include "Framework.h"
+#include "AssetAPI.h"
+#include "LoggingFunctions.h"
+#include "Profiler.h"
+
+#include <Ogre.h>
+
+#include <QPainter>
+#include <QFontMetricsF>
+#include <QStringList>
+
+#include <algorithm>
+#include <cmath>
+
+#include "MemoryLeakCheck.h"
+
+namespace
+{
+/// Width and height of the glyph atlas in pixels.
+const int cAtlasSize = 1024;
+/// Pixels of padding around each glyph in the atlas, so that the filtering does not bleed from the neighbours.
+const int cGlyphPadding = 2;
+/// Size of the white block at the corner of the atlas, used for the background rectangles.
+const int cWhiteBlockSize = 4;
+/// Pixel sizes the glyphs are kept in, from the smallest.
+const int cGlyphSizes[] = { 16, 32, 64 };
+const int cNumGlyphSizes = sizeof(cGlyphSizes) / sizeof(cGlyphSizes[0]);
+/// Height in pixels of a line on the screen below which the text is too small to read, and is not drawn.
+const float cMinScreenLineHeight = 3.f;
+/// The paint device the texts are laid out for, as QPainter does on the textures of EC_HoveringText.
+const QImage &LayoutDevice()
+{
+    static QImage device(1, 1, QImage::Format_ARGB32);
+    return device;
+}
+}
+
+HoveringTextBatch::HoveringTextBatch(Scene *scene, const OgreWorldPtr &world) :
+    scene_(scene),
+    world_(world),
+    sceneManager_(world->OgreSceneManager()),
+    shelfX_(0),
+    shelfY_(0),
+    shelfHeight_(0),
+    atlasCleared_(false),
+    billboardSet_(0)
+{
+    atlas_ = QImage(cAtlasSize, cAtlasSize, QImage::Format_ARGB32);
+    ClearAtlas();
+    sceneManager_->addListener(this);
+}
+
+HoveringTextBatch::~HoveringTextBatch()
+{
+    if (scene_)
+        scene_->setProperty(PropertyName(), QVariant());
+
+    // The billboard set and the listener go with the scene manager if the world is already destroyed.
+    if (!world_.expired())
+    {
+        sceneManager_->removeListener(this);
+        if (billboardSet_)
+        {
+            try
+            {
+                sceneManager_->destroyBillboardSet(billboardSet_);
+            }
+            catch(const Ogre::Exception &e)
+            {
+                LogError("HoveringTextBatch: Failed to destroy the billboard set: " + std::string(e.what()));
+            }
+        }
+    }
+    billboardSet_ = 0;
+    if (!materialName_.empty())
+    {
+        try
+        {
+            Ogre::MaterialManager::getSingleton().remove(materialName_);
+        }
+        catch(...)
+        {
+        }
+    }
+    if (texture_ && scene_)
+        scene_->GetFramework()->Asset()->ForgetAsset(texture_, false);
+}
+
+shared_ptr<HoveringTextBatch> HoveringTextBatch::ForScene(Scene *scene)
+{
+    if (!scene)
+        return shared_ptr<HoveringTextBatch>();
+    shared_ptr<HoveringTextBatch> batch = scene->Subsystem<HoveringTextBatch>();
+    if (batch)
+        return batch;
+    OgreWorldPtr world = scene->Subsystem<OgreWorld>();
+    if (!world)
+        return batch;
+    batch = MAKE_SHARED(HoveringTextBatch, scene, world);
+    scene->setProperty(PropertyName(), QVariant::fromValue<QObject*>(batch.get()));
+    return batch;
+}
+
+void HoveringTextBatch::SetLabel(EC_HoveringText *owner, const Label &label)
+{
+    LabelState &state = labels_[owner];
+    const bool relayout = state.glyphs.empty() || state.label.text != label.text || state.label.font != label.font ||
+        state.label.texWidth != label.texWidth || state.label.texHeight != label.texHeight;
+    state.label = label;
+    if (relayout)
+        Layout(state);
+}
+
+void HoveringTextBatch::RemoveLabel(EC_HoveringText *owner)
+{
+    labels_.remove(owner);
+}
+
+void HoveringTextBatch::SetLabelVisible(EC_HoveringText *owner, bool visible)
+{
+    QMap<EC_HoveringText*, LabelState>::iterator it = labels_.find(owner);
+    if (it != labels_.end())
+        it->label.visible = visible;
+}
+
+bool HoveringTextBatch::IsLabelVisible(EC_HoveringText *owner) const
+{
+    QMap<EC_HoveringText*, LabelState>::const_iterator it = labels_.find(owner);
+    return it != labels_.end() && it->label.visible && !it->label.text.isEmpty();
+}
+
+void HoveringTextBatch::Layout(LabelState &state)
+{
+    state.glyphs.clear();
+    QFontMetricsF metrics(state.label.font, const_cast<QImage *>(&LayoutDevice()));
+    state.lineHeight = (float)metrics.height();
+
+    // Break the lines at the line feeds and between the words, as Qt::TextWordWrap does.
+    const float areaWidth = (float)state.label.texWidth;
+    QString text = state.label.text;
+    text.replace("\\n", "\n");
+    std::vector<QString> lines;
+    QStringList paragraphs = text.split('\n');
+    foreach(const QString &paragraph, paragraphs)
+    {
+        QStringList words = paragraph.split(' ');
+        QString line;
+        foreach(const QString &word, words)
+        {
+            QString candidate = line.isEmpty() ? word : line + " " + word;
+            if (!line.isEmpty() && metrics.width(candidate) > areaWidth)
+            {
+                lines.push_back(line);
+                line = word;
+            }
+            else
+                line = candidate;
+        }
+        lines.push_back(line);
+    }
+
+    // Center the block of lines in the text area, and each line in it.
+    const float lineSpacing = (float)metrics.lineSpacing();
+    const float blockHeight = lines.size() * lineSpacing - (float)metrics.leading();
+    float y = ((float)state.label.texHeight - blockHeight) * 0.5f;
+    state.bounds = QRectF();
+    for(size_t i = 0; i < lines.size(); ++i, y += lineSpacing)
+    {
+        const float lineWidth = (float)metrics.width(lines[i]);
+        float x = (areaWidth - lineWidth) * 0.5f;
+        state.bounds |= QRectF(x, y, lineWidth, state.lineHeight);
+        for(int c = 0; c < lines[i].length(); ++c)
+        {
+            const QChar ch = lines[i][c];
+            if (!ch.isSpace())
+            {
+                LaidGlyph glyph;
+                glyph.ch = ch.unicode();
+                glyph.x = x;
+                glyph.y = y;
+                state.glyphs.push_back(glyph);
+            }
+            x += (float)metrics.width(ch);
+        }
+    }
+}
+
+int HoveringTextBatch::GlyphSize(float screenLineHeight)
+{
+    // A line is about 1.2 times the pixel size of the font.
+    for(int i = 0; i < cNumGlyphSizes; ++i)
+        if (cGlyphSizes[i] * 1.2f >= screenLineHeight)
+            return cGlyphSizes[i];
+    return cGlyphSizes[cNumGlyphSizes - 1];
+}
+
+HoveringTextBatch::AtlasFont &HoveringTextBatch::FontInSize(const QFont &font, int size)
+{
+    const QString key = font.key() + "/" + QString::number(size);
+    QMap<QString, AtlasFont>::iterator it = fonts_.find(key);
+    if (it != fonts_.end())
+        return *it;
+
+    AtlasFont atlasFont;
+    atlasFont.font = font;
+    atlasFont.font.setPixelSize(size);
+    QFontMetricsF metrics(atlasFont.font, &atlas_);
+    atlasFont.lineHeight = (float)metrics.height();
+    atlasFont.ascent = (float)metrics.ascent();
+    return *fonts_.insert(key, atlasFont);
+}
+
+const HoveringTextBatch::AtlasGlyph *HoveringTextBatch::Glyph(AtlasFont &font, ushort ch)
+{
+    QHash<ushort, AtlasGlyph>::const_iterator it = font.glyphs.find(ch);
+    if (it != font.glyphs.end())
+        return &*it;
+
+    QFontMetricsF metrics(font.font, &atlas_);
+    const int width = (int)std::ceil(metrics.width(QChar(ch))) + 2 * cGlyphPadding;
+    const int height = (int)std::ceil(font.lineHeight) + 2 * cGlyphPadding;
+    if (width > cAtlasSize || height > cAtlasSize)
+        return 0;
+
+    // Shelf packing: the glyphs are placed in rows, and a new row is started when the current one is full.
+    if (shelfX_ + width > cAtlasSize)
+    {
+        shelfX_ = 0;
+        shelfY_ += shelfHeight_;
+        shelfHeight_ = 0;
+    }
+    if (shelfY_ + height > cAtlasSize)
+    {
+        // The atlas is full. Start over, and let the texts that are drawn look their glyphs up again.
+        ClearAtlas();
+        atlasCleared_ = true;
+        return 0;
+    }
+
+    AtlasGlyph glyph;
+    glyph.rect = QRect(shelfX_, shelfY_, width, height);
+    shelfX_ += width;
+    shelfHeight_ = std::max(shelfHeight_, height);
+    {
+        QPainter painter(&atlas_);
+        painter.setFont(font.font);
+        painter.setPen(Qt::white);
+        painter.drawText(QPointF(glyph.rect.x() + cGlyphPadding, glyph.rect.y() + cGlyphPadding + font.ascent), QString(QChar(ch)));
+    }
+    atlasDirty_ |= glyph.rect;
+    return &*font.glyphs.insert(ch, glyph);
+}
+
+void HoveringTextBatch::ClearAtlas()
+{
+    // Transparent white, so that the filtering at the edges of the glyphs does not darken them.
+    atlas_.fill(0x00ffffff);
+    {
+        QPainter painter(&atlas_);
+        painter.fillRect(0, 0, cWhiteBlockSize, cWhiteBlockSize, Qt::white);
+    }
+    for(QMap<QString, AtlasFont>::iterator it = fonts_.begin(); it != fonts_.end(); ++it)
+        it->glyphs.clear();
+    shelfX_ = cWhiteBlockSize;
+    shelfY_ = 0;
+    shelfHeight_ = cWhiteBlockSize;
+    atlasDirty_ = atlas_.rect();
+}
+
+bool HoveringTextBatch::CreateResources()
+{
+    if (billboardSet_)
+        return true;
+    if (!scene_)
+        return false;
+
+    Framework *framework = scene_->GetFramework();
+    OgreWorldPtr world = world_.lock();
+    if (!world)
+        return false;
+    try
+    {
+        if (!texture_)
+        {
+            QString name = framework->Asset()->GenerateUniqueAssetName("tex", "HoveringTextBatch_");
+            texture_ = dynamic_pointer_cast<TextureAsset>(framework->Asset()->CreateNewAsset("Texture", name));
+            if (!texture_)
+            {
+                LogError("HoveringTextBatch: Failed to create the glyph atlas texture " + name);
+                return false;
+            }
+            texture_->SetContents(cAtlasSize, cAtlasSize, atlas_.bits(), atlas_.byteCount(), Ogre::PF_A8R8G8B8, false, true, false);
+            atlasDirty_ = QRect();
+        }
+
+        materialName_ = world->Renderer()->GetUniqueObjectName("HoveringTextBatch_material");
+        Ogre::MaterialPtr material = Ogre::MaterialManager::getSingleton().create(materialName_,
+            Ogre::ResourceGroupManager::DEFAULT_RESOURCE_GROUP_NAME);
+        Ogre::Pass *pass = material->getTechnique(0)->getPass(0);
+        pass->setSceneBlending(Ogre::SBT_TRANSPARENT_ALPHA);
+        pass->setLightingEnabled(false);
+        pass->setDepthWriteEnabled(false);
+        Ogre::TextureUnitState *tus = pass->createTextureUnitState(texture_->ogreTexture->getName());
+        tus->setTextureAddressingMode(Ogre::TextureUnitState::TAM_CLAMP);
+        tus->setTextureFiltering(Ogre::TFO_BILINEAR);
+
+        billboardSet_ = sceneManager_->createBillboardSet(world->GetUniqueObjectName("HoveringTextBatch"), 256);
+        billboardSet_->setAutoextend(true);
+        billboardSet_->setMaterialName(materialName_);
+        billboardSet_->setCastShadows(false);
+        billboardSet_->setSortingEnabled(false);
+        billboardSet_->setBillboardsInWorldSpace(true);
+        sceneManager_->getRootSceneNode()->attachObject(billboardSet_);
+    }
+    catch(const Ogre::Exception &e)
+    {
+        LogError("HoveringTextBatch: Failed to create the glyph atlas resources: " + std::string(e.what()));
+        return false;
+    }
+    return true;
+}
+
+void HoveringTextBatch::preFindVisibleObjects(Ogre::SceneManager * /*source*/, Ogre::SceneManager::IlluminationRenderStage irs, Ogre::Viewport *v)
+{
+    if (irs != Ogre::SceneManager::IRS_NONE || !v || !v->getCamera())
+        return;
+    Build(v->getCamera());
+}
+
+void HoveringTextBatch::Build(Ogre::Camera *camera)
+{
+    if (labels_.isEmpty())
+    {
+        if (billboardSet_)
+            billboardSet_->setVisible(false);
+        return;
+    }
+    if (!CreateResources())
+        return;
+
+    PROFILE(HoveringTextBatch_Build);
+    const Ogre::Vector3 eye = camera->getDerivedPosition();
+    const Ogre::Vector3 right = camera->getDerivedRight();
+    const Ogre::Vector3 up = camera->getDerivedUp();
+    const float texelU = 1.f / cAtlasSize;
+
+    // If the atlas gets full while building, it is cleared and the build is started over once with only the glyphs in view.
+    for(int attempt = 0; attempt < 2; ++attempt)
+    {
+        atlasCleared_ = false;
+        billboardSet_->clear();
+        Ogre::AxisAlignedBox bounds;
+        for(QMap<EC_HoveringText*, LabelState>::iterator it = labels_.begin(); it != labels_.end() && !atlasCleared_; ++it)
+        {
+            const LabelState &state = *it;
+            const Label &label = state.label;
+            EC_Placeable *placeable = dynamic_cast<EC_Placeable *>(label.placeable.lock().get());
+            Ogre::SceneNode *node = placeable ? placeable->GetSceneNode() : 0;
+            if (!label.visible || state.glyphs.empty() || !node || !node->isInSceneGraph() || label.texWidth <= 0 || label.texHeight <= 0)
+                continue;
+
+            const Ogre::Vector3 scale = node->_getDerivedScale();
+            const float areaWidth = label.width * scale.x;
+            const float areaHeight = label.height * scale.y;
+            const Ogre::Vector3 anchor = node->_getFullTransform() * Ogre::Vector3(label.position);
+            const float radius = std::max(areaWidth, areaHeight);
+            if (!camera->isVisible(Ogre::Sphere(anchor, radius)))
+                continue;
+
+            // Pick the glyph size by the height of the lines on the screen, and skip the texts too small to read.
+            const float unitsPerPixel = areaHeight / label.texHeight; // World units per pixel of the layout.
+            const float distance = std::max(eye.distance(anchor), camera->getNearClipDistance());
+            const float screenLineHeight = OgreRenderer::ScreenSizeInPixels(camera, state.lineHeight * unitsPerPixel, distance);
+            if (screenLineHeight < cMinScreenLineHeight)
+                continue;
+            AtlasFont &font = FontInSize(label.font, GlyphSize(screenLineHeight));
+            const float glyphScale = state.lineHeight / font.lineHeight; // Pixels of the layout per pixel of the atlas.
+
+            // Maps a point in the pixels of the layout to the world, the area being centered at the anchor.
+            const float unitsPerPixelX = areaWidth / label.texWidth;
+            const float halfWidth = label.texWidth * 0.5f;
+            const float halfHeight = label.texHeight * 0.5f;
+
+            if (label.background.alpha() > 0)
+            {
+                const QRectF &rect = state.bounds;
+                Ogre::Billboard *quad = billboardSet_->createBillboard(anchor +
+                    right * ((float)rect.center().x() - halfWidth) * unitsPerPixelX + up * (halfHeight - (float)rect.center().y()) * unitsPerPixel);
+                quad->setDimensions((float)rect.width() * unitsPerPixelX, (float)rect.height() * unitsPerPixel);
+                quad->setTexcoordRect(texelU, texelU, (cWhiteBlockSize - 1) * texelU, (cWhiteBlockSize - 1) * texelU);
+                quad->setColour(Ogre::ColourValue(label.background.redF(), label.background.greenF(), label.background.blueF(), label.background.alphaF()));
+            }
+
+            const Ogre::ColourValue colour(label.color.redF(), label.color.greenF(), label.color.blueF(), label.color.alphaF());
+            for(size_t i = 0; i < state.glyphs.size(); ++i)
+            {
+                const LaidGlyph &laid = state.glyphs[i];
+                const AtlasGlyph *glyph = Glyph(font, laid.ch);
+                if (atlasCleared_)
+                    break;
+                if (!glyph)
+                    continue;
+                const float w = glyph->rect.width() * glyphScale;
+                const float h = glyph->rect.height() * glyphScale;
+                const float cx = laid.x - cGlyphPadding * glyphScale + w * 0.5f;
+                const float cy = laid.y - cGlyphPadding * glyphScale + h * 0.5f;
+                // The glyphs outside the text area are clipped, as on the textures.
+                if (cx < 0.f || cx > label.texWidth || cy < 0.f || cy > label.texHeight)
+                    continue;
+
+                Ogre::Billboard *quad = billboardSet_->createBillboard(anchor + right * (cx - halfWidth) * unitsPerPixelX + up * (halfHeight - cy) * unitsPerPixel);
+                quad->setDimensions(w * unitsPerPixelX, h * unitsPerPixel);
+                quad->setTexcoordRect(glyph->rect.left() * texelU, glyph->rect.top() * texelU,
+                    (glyph->rect.right() + 1) * texelU, (glyph->rect.bottom() + 1) * texelU);
+                quad->setColour(colour);
+            }
+            bounds.merge(anchor - Ogre::Vector3(radius));
+            bounds.merge(anchor + Ogre::Vector3(radius));
+        }
+        if (atlasCleared_)
+            continue;
+
+        billboardSet_->setVisible(billboardSet_->getNumBillboards() > 0);
+        if (!bounds.isNull())
+            billboardSet_->setBounds(bounds, bounds.getHalfSize().length());
+        break;
+    }
+    UploadAtlas();
+}
+
+void HoveringTextBatch::UploadAtlas()
+{
+    if (atlasDirty_.isEmpty() || !texture_)
+        return;
+    texture_->SetContentsRect(atlasDirty_, atlas_.bits(), atlas_.bytesPerLine(), Ogre::PF_A8R8G8B8);
+    atlasDirty_ = QRect();
+}
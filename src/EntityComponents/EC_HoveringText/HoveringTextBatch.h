@@ -0,0 +1,154 @@
+/**
+    For conditions of distribution and use, see copyright notice in LICENSE
+
+    @file   HoveringTextBatch.h
+    @brief  Draws the hovering texts of a scene from a shared glyph atlas. */
+
+#pragma once
+
+#include "CoreTypes.h"
+#include "SceneFwd.h"
+#include "OgreModuleFwd.h"
+#include "AssetFwd.h"
+#include "Math/float3.h"
+
+#include <QObject>
+#include <QPointer>
+#include <QFont>
+#include <QColor>
+#include <QImage>
+#include <QRect>
+#include <QMap>
+#include <QHash>
+#include <QString>
+
+#include <OgreSceneManager.h>
+
+#include <vector>
+
+class EC_HoveringText;
+
+/// Draws the hovering texts of a scene as camera-facing glyph quads from a shared glyph atlas, in a single billboard set.
+/** Used by EC_HoveringText when its batched attribute is set and its appearance can be drawn from the atlas. Instead of
+    a texture of its own that is repainted and uploaded on every change, each text is laid out once into glyphs, and
+    changing the text only lays it out again. The glyphs are painted to the atlas with QPainter when first used, and only
+    the changed rectangles of the atlas are uploaded.
+
+    The glyphs are kept in the atlas in a few pixel sizes, and each text is drawn with the smallest size that is not
+    smaller than the text on the screen, so distant texts use glyphs of lower resolution. Texts too small to read are
+    not drawn. The quads are built just before the scene is rendered from each camera, so that they face it.
+
+    Shared by the hovering texts of a scene, and kept as a subsystem of the scene while any of them uses it. */
+class HoveringTextBatch : public QObject, public enable_shared_from_this<HoveringTextBatch>, public Ogre::SceneManager::Listener
+{
+    Q_OBJECT
+
+public:
+    HoveringTextBatch(Scene *scene, const OgreWorldPtr &world);
+    ~HoveringTextBatch();
+
+    static const char* PropertyName() { return "hoveringTextBatch"; }
+
+    /// Returns the batch of the scene, creating it if it does not exist yet. Returns null if the scene has no OgreWorld.
+    static shared_ptr<HoveringTextBatch> ForScene(Scene *scene);
+
+    /// Appearance and placement of a hovering text.
+    struct Label
+    {
+        Label() : width(1.f), height(1.f), texWidth(256), texHeight(256), visible(true) {}
+
+        ComponentWeakPtr placeable; ///< EC_Placeable the text is attached to.
+        float3 position; ///< Position relative to the placeable.
+        QString text;
+        QFont font;
+        QColor color; ///< Color of the text, including the overlay alpha.
+        QColor background; ///< Color of the rectangle behind the text, transparent for none.
+        float width; ///< Width of the text area in the local space of the placeable.
+        float height; ///< Height of the text area in the local space of the placeable.
+        int texWidth; ///< Width of the text area in the pixels of the layout, which the font size is relative to.
+        int texHeight; ///< Height of the text area in the pixels of the layout, which the font size is relative to.
+        bool visible;
+    };
+
+    /// Adds or updates the text of the component. The text is laid out again only if its text, font or area size changed.
+    void SetLabel(EC_HoveringText *owner, const Label &label);
+
+    /// Removes the text of the component.
+    void RemoveLabel(EC_HoveringText *owner);
+
+    /// Shows or hides the text of the component.
+    void SetLabelVisible(EC_HoveringText *owner, bool visible);
+
+    /// Returns whether the text of the component is added and visible.
+    bool IsLabelVisible(EC_HoveringText *owner) const;
+
+    /// Ogre::SceneManager::Listener override. Builds the glyph quads facing the camera of the viewport.
+    void preFindVisibleObjects(Ogre::SceneManager *source, Ogre::SceneManager::IlluminationRenderStage irs, Ogre::Viewport *v);
+
+private:
+    /// A glyph placed in the layout of a text, in the pixels of the layout.
+    struct LaidGlyph
+    {
+        ushort ch;
+        float x; ///< Left edge of the glyph advance.
+        float y; ///< Top of the line.
+    };
+
+    struct LabelState
+    {
+        Label label;
+        std::vector<LaidGlyph> glyphs;
+        float lineHeight; ///< Height of a line in the pixels of the layout.
+        QRectF bounds; ///< Bounds of the laid out text in the pixels of the layout.
+    };
+
+    /// A glyph in the atlas.
+    struct AtlasGlyph
+    {
+        QRect rect; ///< Rectangle of the glyph in the atlas, including the padding.
+    };
+
+    /// A font in one of the glyph sizes of the atlas.
+    struct AtlasFont
+    {
+        QFont font;
+        float lineHeight;
+        float ascent;
+        QHash<ushort, AtlasGlyph> glyphs;
+    };
+
+    /// Lays out the text of the label into glyphs, centered and word wrapped in the text area as QPainter::drawText does.
+    void Layout(LabelState &state);
+    /// Returns the glyph size of the atlas for text whose lines are the given height on the screen.
+    static int GlyphSize(float screenLineHeight);
+    /// Returns the atlas font of the font in the glyph size.
+    AtlasFont &FontInSize(const QFont &font, int size);
+    /// Returns the glyph in the atlas, painting it if it is not there yet. Returns null if the atlas is full.
+    const AtlasGlyph *Glyph(AtlasFont &font, ushort ch);
+    /// Clears the atlas, leaving only the white block used for the backgrounds.
+    void ClearAtlas();
+    /// Creates the atlas texture, the material and the billboard set, if not created yet. Returns false if they could not be created.
+    bool CreateResources();
+    /// Builds the quads of the visible texts facing the camera.
+    void Build(Ogre::Camera *camera);
+    /// Uploads the changed rectangle of the atlas.
+    void UploadAtlas();
+
+    QPointer<Scene> scene_;
+    OgreWorldWeakPtr world_;
+    Ogre::SceneManager *sceneManager_;
+    QMap<EC_HoveringText*, LabelState> labels_;
+    QMap<QString, AtlasFont> fonts_;
+
+    QImage atlas_;
+    QRect atlasDirty_;
+    int shelfX_;
+    int shelfY_;
+    int shelfHeight_;
+    /// Whether the atlas got full and was cleared during the build, so that the glyphs of the build must be looked up again.
+    bool atlasCleared_;
+
+    TextureAssetPtr texture_;
+    std::string materialName_;
+    Ogre::BillboardSet *billboardSet_;
+};
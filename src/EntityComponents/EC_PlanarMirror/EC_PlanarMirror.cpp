@@ -50,6 +50,9 @@ EC_PlanarMirror::~EC_PlanarMirror()
     Ogre::SceneManager *mngr = renderer_->GetActiveOgreWorld()->OgreSceneManager();
     if(tex_unit_state_)
         tex_unit_state_->setProjectiveTexturing(false);
+    shared_ptr<EC_RttTarget> target = target_.lock();
+    if (target && mirror_plane_entity_)
+        target->RemoveDisplaySurface(mirror_plane_entity_);
     if(mngr)
     {
         if(mirror_plane_entity_)
@@ -149,6 +152,8 @@ void EC_PlanarMirror::Initialize()
     CreatePlane();
     placeable->GetSceneNode()->attachObject(mirror_plane_entity_);
     placeable->GetSceneNode()->attachObject(mirror_plane_);
+    target->AddDisplaySurface(mirror_plane_entity_);
+    target_ = entity->GetComponent<EC_RttTarget>();
 
     mirror_cam_->enableCustomNearClipPlane(mirror_plane_);
     mirror_cam_->enableReflection(mirror_plane_);
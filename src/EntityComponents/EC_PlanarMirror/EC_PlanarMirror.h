@@ -11,6 +11,8 @@
 
 #include <OgreTexture.h>
 
+class EC_RttTarget;
+
 /// Creates a planar mirror texture (and optionally a plane showing it).
 /** <table class="header">
     <tr>
@@ -38,6 +40,9 @@
 
     Does not emit any actions.
 
+    The mirror plane is added as a display surface of the RttTarget, so that its updateInterval, onlyWhenVisible
+    and scaleByCoverage attributes apply to the mirror.
+
     <b>Depends on components @ref EC_Camera "Camera", @ref EC_Placeable "Placeable" and @ref EC_RttTarget "RttTarget".</b>
     </table> */
 class EC_PlanarMirror : public IComponent
@@ -78,4 +83,6 @@ private:
     Ogre::Material* mat_;
     Ogre::Entity* mirror_plane_entity_;
     Ogre::MovablePlane* mirror_plane_;
+    /// The render target the mirror plane is registered to as a display surface.
+    weak_ptr<EC_RttTarget> target_;
 };
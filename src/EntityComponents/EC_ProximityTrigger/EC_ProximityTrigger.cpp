@@ -11,20 +11,247 @@
 #include "Entity.h"
 
 #include "EC_Placeable.h"
+#include "SpatialWorld.h"
 #include "LoggingFunctions.h"
 #include "FrameAPI.h"
+#include "UpdateScheduler.h"
+#include "Math/MathFunc.h"
+
+#include <algorithm>
+#include <cmath>
+#include <map>
+
+/// Evaluates all the triggers that are updated every frame together, in one UpdateScheduler job.
+/** The other triggers of a scene are gathered once per frame for all its triggers. For the triggers with a threshold, the
+    gathered triggers are hashed into a grid whose cell size is the threshold rounded up to a power of two, so that a trigger
+    is compared only against the triggers in its own and the neighbouring cells. Triggers with similar thresholds share a grid. */
+class EC_ProximityTrigger::Evaluator : public IUpdateJob
+{
+public:
+    explicit Evaluator(Framework *fw) : framework(fw), registered(false) {}
+    ~Evaluator() { SetRegistered(false); }
+
+    /// Returns the evaluator of the framework, creating it if there is none.
+    static shared_ptr<Evaluator> Acquire(Framework *fw)
+    {
+        shared_ptr<Evaluator> evaluator = instance.lock();
+        if (!evaluator || evaluator->framework != fw)
+        {
+            evaluator = MAKE_SHARED(Evaluator, fw);
+            instance = evaluator;
+        }
+        return evaluator;
+    }
+
+    void Add(EC_ProximityTrigger *trigger)
+    {
+        if (std::find(triggers.begin(), triggers.end(), trigger) == triggers.end())
+            triggers.push_back(trigger);
+        SetRegistered(true);
+    }
+
+    void Remove(EC_ProximityTrigger *trigger)
+    {
+        triggers.erase(std::remove(triggers.begin(), triggers.end(), trigger), triggers.end());
+        if (triggers.empty())
+            SetRegistered(false);
+    }
+
+    /// Gathers the positions of the active triggers and of all the triggers in their scenes.
+    void Prepare(float /*frameTime*/)
+    {
+        groups.clear();
+        sources.clear();
+        std::map<Scene*, size_t> groupOfScene;
+        for(size_t i = 0; i < triggers.size(); ++i)
+        {
+            EC_ProximityTrigger *trigger = triggers[i];
+            trigger->hits_.clear();
+            Entity *entity = trigger->ParentEntity();
+            Scene *scene = entity ? entity->ParentScene() : 0;
+            EC_Placeable *placeable = entity ? entity->Component<EC_Placeable>().get() : 0;
+            if (!trigger->active.Get() || !scene || !placeable)
+                continue;
+
+            std::map<Scene*, size_t>::iterator groupIter = groupOfScene.find(scene);
+            if (groupIter == groupOfScene.end())
+            {
+                groupIter = groupOfScene.insert(std::make_pair(scene, groups.size())).first;
+                groups.push_back(std::vector<Target>());
+                EntityList others = scene->EntitiesWithComponent<EC_ProximityTrigger>();
+                for(EntityList::iterator e = others.begin(); e != others.end(); ++e)
+                {
+                    EC_Placeable *otherPlaceable = (*e)->Component<EC_Placeable>().get();
+                    if (otherPlaceable)
+                        groups.back().push_back(Target(*e, otherPlaceable->WorldPosition()));
+                }
+            }
+
+            Source source;
+            source.trigger = trigger;
+            source.component = trigger->shared_from_this();
+            source.entity = entity;
+            source.position = placeable->WorldPosition();
+            source.threshold = trigger->thresholdDistance.Get();
+            source.group = groupIter->second;
+            sources.push_back(source);
+        }
+    }
+
+    /// Calculates the distances of the gathered triggers.
+    void Run(float /*frameTime*/)
+    {
+        // The grids of each scene, by the cell size.
+        std::vector<std::map<float, Grid> > grids(groups.size());
+        for(size_t i = 0; i < sources.size(); ++i)
+        {
+            const Source &source = sources[i];
+            const std::vector<Target> &targets = groups[source.group];
+            std::vector<std::pair<EntityWeakPtr, float> > &hits = source.trigger->hits_;
+            if (source.threshold <= 0.0f)
+            {
+                for(size_t t = 0; t < targets.size(); ++t)
+                    if (targets[t].entity != source.entity)
+                        hits.push_back(std::make_pair(targets[t].weak, source.position.Distance(targets[t].position)));
+                continue;
+            }
+
+            const float cellSize = CellSize(source.threshold);
+            Grid &grid = grids[source.group][cellSize];
+            if (grid.empty())
+            {
+                grid.reserve(targets.size());
+                for(size_t t = 0; t < targets.size(); ++t)
+                {
+                    int x, y, z;
+                    Cell(targets[t].position, cellSize, x, y, z);
+                    grid.push_back(std::make_pair(CellKey(x, y, z), t));
+                }
+                std::sort(grid.begin(), grid.end());
+            }
+
+            int x, y, z;
+            Cell(source.position, cellSize, x, y, z);
+            for(int dx = -1; dx <= 1; ++dx)
+                for(int dy = -1; dy <= 1; ++dy)
+                    for(int dz = -1; dz <= 1; ++dz)
+                    {
+                        const std::pair<u64, size_t> first(CellKey(x + dx, y + dy, z + dz), 0);
+                        for(Grid::const_iterator cell = std::lower_bound(grid.begin(), grid.end(), first);
+                            cell != grid.end() && cell->first == first.first; ++cell)
+                        {
+                            const Target &target = targets[cell->second];
+                            if (target.entity == source.entity)
+                                continue;
+                            float distance = source.position.Distance(target.position);
+                            if (distance <= source.threshold)
+                                hits.push_back(std::make_pair(target.weak, distance));
+                        }
+                    }
+        }
+    }
+
+    /// Emits the trigger signals.
+    void Finish(float frameTime)
+    {
+        // The signal handlers may remove triggers, so take the gathered ones first.
+        std::vector<Source> finished;
+        finished.swap(sources);
+        groups.clear();
+        for(size_t i = 0; i < finished.size(); ++i)
+        {
+            ComponentPtr component = finished[i].component.lock();
+            if (component)
+                finished[i].trigger->Finish(frameTime);
+        }
+    }
+
+    Framework *framework;
+
+private:
+    struct Target
+    {
+        Target(const EntityPtr &entity_, const float3 &position_) : weak(entity_), entity(entity_.get()), position(position_) {}
+        EntityWeakPtr weak;
+        Entity *entity;
+        float3 position;
+    };
+
+    struct Source
+    {
+        EC_ProximityTrigger *trigger;
+        ComponentWeakPtr component; ///< The trigger, for checking in Finish whether it still exists.
+        Entity *entity;
+        float3 position;
+        float threshold;
+        size_t group; ///< Index of the targets of the scene of the trigger.
+    };
+
+    /// Cell keys and target indices, sorted by the cell key.
+    typedef std::vector<std::pair<u64, size_t> > Grid;
+
+    /// Returns the threshold rounded up to a power of two.
+    static float CellSize(float threshold)
+    {
+        int exponent = 0;
+        float mantissa = std::frexp(threshold, &exponent);
+        return (mantissa == 0.5f ? threshold : std::ldexp(1.0f, exponent));
+    }
+
+    static void Cell(const float3 &position, float cellSize, int &x, int &y, int &z)
+    {
+        // Positions this far out share the outermost cells, which only costs extra distance checks.
+        const float cMaxCell = (float)(1 << 20);
+        x = (int)Clamp(std::floor(position.x / cellSize), -cMaxCell, cMaxCell - 1.0f);
+        y = (int)Clamp(std::floor(position.y / cellSize), -cMaxCell, cMaxCell - 1.0f);
+        z = (int)Clamp(std::floor(position.z / cellSize), -cMaxCell, cMaxCell - 1.0f);
+    }
+
+    /// Packs the cell coordinates to 21 bits each. Out of range ones wrap around, which only costs extra distance checks.
+    static u64 CellKey(int x, int y, int z)
+    {
+        const u64 cMask = (1 << 21) - 1;
+        return (((u64)(x + (1 << 20)) & cMask) << 42) | (((u64)(y + (1 << 20)) & cMask) << 21) | ((u64)(z + (1 << 20)) & cMask);
+    }
+
+    void SetRegistered(bool enable)
+    {
+        if (enable == registered)
+            return;
+        registered = enable;
+        UpdateScheduler *scheduler = framework->Frame()->Scheduler();
+        if (enable)
+        {
+            // Run only reads what Prepare gathered, and writes the hits of the triggers, which the other jobs do not read
+            scheduler->AddJob(this, "EC_ProximityTrigger", std::vector<u32>(), std::vector<u32>());
+        }
+        else
+            scheduler->RemoveJob(this);
+    }
+
+    static weak_ptr<Evaluator> instance;
+
+    std::vector<EC_ProximityTrigger*> triggers;
+    std::vector<std::vector<Target> > groups; ///< The triggers of each scene, gathered in Prepare.
+    std::vector<Source> sources; ///< The active triggers, gathered in Prepare.
+    bool registered;
+};
+
+weak_ptr<EC_ProximityTrigger::Evaluator> EC_ProximityTrigger::Evaluator::instance;
 
 EC_ProximityTrigger::EC_ProximityTrigger(Scene *scene) :
     IComponent(scene),
     INIT_ATTRIBUTE_VALUE(active, "Is active", true),
     INIT_ATTRIBUTE_VALUE(thresholdDistance, "Threshold distance", 0.0f),
-    INIT_ATTRIBUTE_VALUE(interval, "Trigger signal interval", 0.0f)
+    INIT_ATTRIBUTE_VALUE(interval, "Trigger signal interval", 0.0f),
+    threshold_(0.0f)
 {
     SetUpdateMode();
 }
 
 EC_ProximityTrigger::~EC_ProximityTrigger()
 {
+    SetEvaluated(false);
 }
 
 void EC_ProximityTrigger::AttributesChanged()
@@ -33,11 +260,20 @@ void EC_ProximityTrigger::AttributesChanged()
         SetUpdateMode();
 }
 
-void EC_ProximityTrigger::Update(float /*timeStep*/)
+void EC_ProximityTrigger::Update(float timeStep)
+{
+    Prepare(timeStep);
+    Run(timeStep);
+    Finish(timeStep);
+}
+
+void EC_ProximityTrigger::Prepare(float /*timeStep*/)
 {
+    candidates_.clear();
+    hits_.clear();
     if (!active.Get())
         return;
-    float threshold = thresholdDistance.Get();
+    threshold_ = thresholdDistance.Get();
     
     Entity* entity = ParentEntity();
     if (!entity)
@@ -49,29 +285,61 @@ void EC_ProximityTrigger::Update(float /*timeStep*/)
     if (!placeable)
         return;
 
-    float3 pos = placeable->WorldPosition();
+    // The world transforms of the placeables are cached lazily, and may come from Ogre, so read them here in the main thread
+    position_ = placeable->WorldPosition();
+
+    // With a threshold, only the triggers within it need to be considered, so query the spatial world for them
+    EntityList otherTriggers;
+    SpatialWorldPtr spatialWorld = scene->Subsystem<SpatialWorld>();
+    if (threshold_ > 0.0f && spatialWorld)
+    {
+        EntityList nearby = spatialWorld->EntitiesInSphere(position_, threshold_);
+        for(EntityList::iterator i = nearby.begin(); i != nearby.end(); ++i)
+            if ((*i)->Component<EC_ProximityTrigger>())
+                otherTriggers.push_back(*i);
+    }
+    else
+        otherTriggers = scene->EntitiesWithComponent<EC_ProximityTrigger>();
 
-    EntityList otherTriggers = scene->EntitiesWithComponent<EC_ProximityTrigger>();
     for(EntityList::iterator i = otherTriggers.begin(); i != otherTriggers.end(); ++i)
     {
         Entity* otherEntity = (*i).get();
         if (otherEntity != entity)
         {
             EC_Placeable* otherPlaceable = otherEntity->Component<EC_Placeable>().get();
-            if (!otherPlaceable)
-                continue;
-
-            float3 offset = pos - otherPlaceable->WorldPosition();
-            float distance = offset.Length();
-            if (threshold <= 0.0f || distance <= threshold)
-            {
-                emit Triggered(otherEntity, distance);
-                emit triggered(otherEntity, distance);
-            }
+            if (otherPlaceable)
+                candidates_.push_back(std::make_pair(EntityWeakPtr(*i), otherPlaceable->WorldPosition()));
         }
     }
 }
 
+void EC_ProximityTrigger::Run(float /*timeStep*/)
+{
+    for(size_t i = 0; i < candidates_.size(); ++i)
+    {
+        float3 offset = position_ - candidates_[i].second;
+        float distance = offset.Length();
+        if (threshold_ <= 0.0f || distance <= threshold_)
+            hits_.push_back(std::make_pair(candidates_[i].first, distance));
+    }
+}
+
+void EC_ProximityTrigger::Finish(float /*timeStep*/)
+{
+    candidates_.clear();
+    // Take the hits first, as the signal handlers may remove this component
+    std::vector<std::pair<EntityWeakPtr, float> > hits;
+    hits.swap(hits_);
+    for(size_t i = 0; i < hits.size(); ++i)
+    {
+        EntityPtr otherEntity = hits[i].first.lock();
+        if (!otherEntity)
+            continue;
+        emit Triggered(otherEntity.get(), hits[i].second);
+        emit triggered(otherEntity.get(), hits[i].second);
+    }
+}
+
 void EC_ProximityTrigger::SetUpdateMode()
 {
     FrameAPI* frame = framework->Frame();
@@ -80,16 +348,32 @@ void EC_ProximityTrigger::SetUpdateMode()
     if (intervalSec <= 0.0f)
     {
         // Update every frame
-        connect(frame, SIGNAL(Updated(float)), this, SLOT(Update(float)), Qt::UniqueConnection);
+        SetEvaluated(true);
     }
     else
     {
         // Update periodically
-        disconnect(frame, SIGNAL(Updated(float)), this, SLOT(Update(float)));
+        SetEvaluated(false);
         frame->DelayedExecute(intervalSec, this, SLOT(PeriodicUpdate()));
     }
 }
 
+void EC_ProximityTrigger::SetEvaluated(bool evaluated)
+{
+    if (evaluated == (evaluator_.get() != 0))
+        return;
+    if (evaluated)
+    {
+        evaluator_ = Evaluator::Acquire(framework);
+        evaluator_->Add(this);
+    }
+    else
+    {
+        evaluator_->Remove(this);
+        evaluator_.reset();
+    }
+}
+
 void EC_ProximityTrigger::PeriodicUpdate()
 {
     // Set up the next periodic update
@@ -7,6 +7,10 @@
 #pragma once
 
 #include "IComponent.h"
+#include "Math/float3.h"
+
+#include <vector>
+#include <utility>
 
 /// Reports distance, each frame, of other entities that also have this same component.
 /** <table class="header">
@@ -15,6 +19,8 @@
     <h2>ProximityTrigger</h2>
     Reports distance, each frame, of other entities that also have this same component.
     The entities also need to have EC_Placeable component so that distance can be calculated.
+    When the signal is sent every frame, the distances of all the triggers are calculated together in one UpdateScheduler job,
+    which may run in a worker thread, and a trigger with a threshold is compared only against the triggers near it.
 
     <b>Attributes</b>:
     <ul>
@@ -79,11 +85,31 @@ signals:
     void triggered(Entity* otherEntity, float distance); /**< @deprecated Use Triggered instead. @todo Remove. */
 
 private:
+    /// Evaluates the triggers that are updated every frame.
+    class Evaluator;
+    friend class Evaluator;
+
     /// Attribute has been updated
     void AttributesChanged();
+
+    /// Gathers the positions of the other triggers.
+    void Prepare(float timeStep);
+    /// Calculates the distances of the gathered triggers.
+    void Run(float timeStep);
+    /// Emits the trigger signals of the calculated hits.
+    void Finish(float timeStep);
+
+    /// Adds this trigger to or removes it from the evaluator of the triggers updated every frame.
+    void SetEvaluated(bool evaluated);
+
+    float3 position_; ///< World position of this entity, gathered in Prepare.
+    float threshold_; ///< Threshold distance, gathered in Prepare.
+    std::vector<std::pair<EntityWeakPtr, float3> > candidates_; ///< The other triggers and their world positions, gathered in Prepare.
+    std::vector<std::pair<EntityWeakPtr, float> > hits_; ///< The triggers within the threshold and their distances, calculated in Run or by the evaluator.
+    shared_ptr<Evaluator> evaluator_; ///< The evaluator, if this trigger is updated every frame.
     
 private slots:
-    /// Check for other triggers and emit signals
+    /// Check for other triggers and emit signals in the main thread.
     void Update(float timeStep);
 
     /// Periodic update. Set up the next periodic update, then check triggers
@@ -98,3 +98,8 @@ bool ScriptAsset::IsLoaded() const
 {
     return !scriptContent.isEmpty();
 }
+
+size_t ScriptAsset::MemoryUsage() const
+{
+    return scriptContent.size() * sizeof(QChar);
+}
@@ -35,6 +35,9 @@ public:
 
     bool IsLoaded() const;
 
+    /// Returns the size of the script content. IAsset override.
+    size_t MemoryUsage() const;
+
 private:
     /// Unload script asset
     virtual void DoUnload();
@@ -1,6 +1,10 @@
 /** main.cpp
     @brief Provides a command-line utility for mass-processing texture files into .dds file format.
 
+    With --bake, processes all the textures of a local asset storage directory into DXT-compressed .dds files with
+    mipmaps, to the _baked subdirectory of the storage, and writes a manifest of them there. LocalAssetProvider
+    then loads the baked files in place of the source textures, as long as the sources have not changed since.
+
     To build, check the property sheets of the TextureTool project in the Property Manager tab.
     There are three property sheets:
     - NVTT: Not yet used. This is for programmatically accessing http://developer.nvidia.com/object/texture_tools.html ,
@@ -18,6 +22,7 @@
 #include <sstream>
 #include <cassert>
 #include <string>
+#include <fstream>
 #include <exception>
 
 /// Comment this out if you do not want to have J2K support, and want to avoid building a dependency to it.
@@ -541,14 +546,10 @@ int CountMaxMipSize(int w, int h)
     return mipLevels;
 }
 
-/// Opens the given filename, runs it through a few processing steps, and saves it as .dds file with the same base name.
-/// \todo alphaChoose offers one method for mass-filtering from a set of input files which files to process, but perhaps
-/// something more flexible was better, like a command line flag '--onlyifformat==D3DFMT_A8R8G8B8'?
-/// alphaChoose: If true, only processes the file if it has alpha channel. (These are intended to be later saved as DXT5)
-///              If false, only processes the file if it does not have an alpha channel. (These are to be later saved as DXT1)
-void ConvertFileToDDS(std::string filename, LPDIRECT3DDEVICE9 device, bool alphaChoose, int maxTexSize, int alphaTestCutoff)
+/// Opens the given image file with J2K or D3DX, depending on the file type.
+/// @return False if the file could not be opened, or the image came out empty.
+bool LoadImageFile(const std::string &filename, RawImage &imageData, LPDIRECT3DDEVICE9 device)
 {
-    RawImage imageData;
 #ifdef J2K_DECODE_SUPPORT
     ///\bug Comparisons in tolower.
     if (filename.find(".Texture") != string::npos || // We assume that a file with ending .Texture is a J2K texture
@@ -577,8 +578,21 @@ void ConvertFileToDDS(std::string filename, LPDIRECT3DDEVICE9 device, bool alpha
     if (imageData.width == 0 || imageData.height == 0)
     {
         cout << "Failed opening file \"" << filename << "\". Image width or height came out 0!" << endl;
-        return;
+        return false;
     }
+    return true;
+}
+
+/// Opens the given filename, runs it through a few processing steps, and saves it as .dds file with the same base name.
+/// \todo alphaChoose offers one method for mass-filtering from a set of input files which files to process, but perhaps
+/// something more flexible was better, like a command line flag '--onlyifformat==D3DFMT_A8R8G8B8'?
+/// alphaChoose: If true, only processes the file if it has alpha channel. (These are intended to be later saved as DXT5)
+///              If false, only processes the file if it does not have an alpha channel. (These are to be later saved as DXT1)
+void ConvertFileToDDS(std::string filename, LPDIRECT3DDEVICE9 device, bool alphaChoose, int maxTexSize, int alphaTestCutoff)
+{
+    RawImage imageData;
+    if (!LoadImageFile(filename, imageData, device))
+        return;
 
     // PROCESSING STEP #1: Remove alpha channel that is not needed.
     if (imageData.numColorPlanes == 4 && imageData.HasRedundantAlphaChannel())
@@ -649,6 +663,179 @@ void ConvertFileToDDS(std::string filename, LPDIRECT3DDEVICE9 device, bool alpha
     texture->Release();
 }
 
+/// Name of the subdirectory of a storage the baked files and the manifest are written to. Keep in sync with LocalAssetStorage.
+const char * const cBakedDirName = "_baked";
+const char * const cBakedManifestName = "manifest.txt";
+
+/// A texture file of a storage to bake.
+struct BakeSource
+{
+    std::string relativePath; ///< Path relative to the storage directory, with '/' separators.
+    unsigned __int64 size;
+    FILETIME lastWriteTime;
+};
+
+/// @return True if the filename has the suffix of a texture format that is worth baking.
+bool IsBakeableTexture(const std::string &filename)
+{
+    const char * const suffixes[] = { ".png", ".jpg", ".jpeg", ".bmp", ".tga" };
+    std::string lower = filename;
+    for(size_t i = 0; i < lower.length(); ++i)
+        lower[i] = (char)tolower(lower[i]);
+    for(size_t i = 0; i < sizeof(suffixes) / sizeof(suffixes[0]); ++i)
+    {
+        size_t len = strlen(suffixes[i]);
+        if (lower.length() > len && lower.compare(lower.length() - len, len, suffixes[i]) == 0)
+            return true;
+    }
+    return false;
+}
+
+/// Recursively finds the texture files of a storage directory, skipping the baked subdirectory.
+/// @param root The storage directory, with a trailing slash.
+/// @param relativeDir The directory to search relative to root, empty or with a trailing slash.
+void FindBakeSources(const std::string &root, const std::string &relativeDir, std::vector<BakeSource> &sources)
+{
+    WIN32_FIND_DATAA findData;
+    HANDLE find = FindFirstFileA((root + relativeDir + "*").c_str(), &findData);
+    if (find == INVALID_HANDLE_VALUE)
+        return;
+    do
+    {
+        std::string name = findData.cFileName;
+        if (name == "." || name == ".." || name == cBakedDirName || name == ".git" || name == ".svn" || name == ".hg")
+            continue;
+        if ((findData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0)
+            FindBakeSources(root, relativeDir + name + "/", sources);
+        else if (IsBakeableTexture(name))
+        {
+            BakeSource source;
+            source.relativePath = relativeDir + name;
+            source.size = ((unsigned __int64)findData.nFileSizeHigh << 32) | findData.nFileSizeLow;
+            source.lastWriteTime = findData.ftLastWriteTime;
+            sources.push_back(source);
+        }
+    } while(FindNextFileA(find, &findData));
+    FindClose(find);
+}
+
+/// Creates the directories of the given file path that do not exist.
+void CreateDirectoriesForFile(const std::string &filename)
+{
+    for(size_t i = filename.find_first_of("/\\", 3); i != string::npos; i = filename.find_first_of("/\\", i + 1))
+        CreateDirectoryA(filename.substr(0, i).c_str(), NULL); // Fails harmlessly for the directories that exist.
+}
+
+/// Loads a texture and saves it as a DXT1 (no alpha) or DXT5 (alpha) .dds with mipmaps, halved to at most maxTexSize first.
+/// @return False if the texture could not be loaded or saved.
+bool BakeTexture(const std::string &sourceFile, const std::string &outFile, LPDIRECT3DDEVICE9 device, int maxTexSize, int alphaTestCutoff)
+{
+    RawImage imageData;
+    if (!LoadImageFile(sourceFile, imageData, device))
+        return false;
+
+    if (imageData.numColorPlanes == 4 && imageData.HasRedundantAlphaChannel())
+        ARGB8888ToRGB888(imageData);
+    while(imageData.width > maxTexSize || imageData.height > maxTexSize)
+        HalveTextureSize(imageData);
+
+    // The format of the raw data is determined by the number of color planes, see RawImage::numColorPlanes.
+    D3DFORMAT sourceFormat;
+    switch(imageData.numColorPlanes)
+    {
+    case 4: sourceFormat = D3DFMT_A8R8G8B8; break;
+    case 3: sourceFormat = D3DFMT_R8G8B8; break;
+    case 2: sourceFormat = D3DFMT_A8L8; break;
+    default: sourceFormat = D3DFMT_L8; break;
+    }
+    const D3DFORMAT outFormat = imageData.HasAlphaChannel() ? D3DFMT_DXT5 : D3DFMT_DXT1;
+
+    /// @bug See ConvertFileToDDS: the 2x2 and 1x1 levels get corrupted in DXT conversion, so leave them out.
+    const int maxMipLevels = max(1, CountMaxMipSize(imageData.width, imageData.height) - 2);
+    LPDIRECT3DTEXTURE9 texture = 0;
+    try
+    {
+        WIN32TRY(D3DXCreateTexture(device, imageData.width, imageData.height, maxMipLevels, 0, outFormat, D3DPOOL_SYSTEMMEM, &texture),
+            (string("Failed to create texture object for baking \"") + sourceFile + "\"!").c_str());
+        for(int level = 0; level < maxMipLevels; ++level)
+        {
+            LPDIRECT3DSURFACE9 surface = 0;
+            WIN32TRY(texture->GetSurfaceLevel(level, &surface), "Failed to get texture surface level!");
+            RECT sourceRect = { 0, 0, imageData.width, imageData.height };
+            // D3DX compresses the data to the DXT format of the surface.
+            HRESULT loadResult = D3DXLoadSurfaceFromMemory(surface, NULL, NULL, &imageData.data[0], sourceFormat,
+                imageData.width * imageData.numColorPlanes, NULL, &sourceRect, D3DX_FILTER_NONE, 0);
+            surface->Release();
+            WIN32TRY(loadResult, "Failed to compress texture surface level!");
+
+            if (alphaTestCutoff < -1)
+                HalveTextureSizeBiased(imageData);
+            else if (alphaTestCutoff >= 0)
+                HalveTextureSizeForAlphaTest(imageData, alphaTestCutoff);
+            else
+                HalveTextureSize(imageData);
+        }
+        CreateDirectoriesForFile(outFile);
+        WIN32TRY(D3DXSaveTextureToFileA(outFile.c_str(), D3DXIFF_DDS, texture, 0), (string("Failed to save \"") + outFile + "\"!").c_str());
+    }
+    catch(const std::exception &)
+    {
+        if (texture)
+            texture->Release();
+        return false;
+    }
+    texture->Release();
+    return true;
+}
+
+/// Bakes all the textures of a local asset storage directory, and writes the manifest of the baked files.
+/// Textures whose baked file is newer than the source are not baked again.
+/// @return The number of textures that could not be baked.
+int BakeStorage(std::string storageDir, LPDIRECT3DDEVICE9 device, int maxTexSize, int alphaTestCutoff)
+{
+    for(size_t i = 0; i < storageDir.length(); ++i)
+        if (storageDir[i] == '\\')
+            storageDir[i] = '/';
+    if (!storageDir.empty() && storageDir[storageDir.length()-1] != '/')
+        storageDir += '/';
+    const std::string bakedDir = storageDir + cBakedDirName + "/";
+
+    std::vector<BakeSource> sources;
+    FindBakeSources(storageDir, "", sources);
+    cout << "Baking " << sources.size() << " textures of \"" << storageDir << "\" to \"" << bakedDir << "\"." << endl;
+
+    int numFailed = 0;
+    std::stringstream manifest;
+    manifest << "TundraBakedAssets 1" << endl;
+    for(size_t i = 0; i < sources.size(); ++i)
+    {
+        const BakeSource &source = sources[i];
+        const std::string bakedPath = source.relativePath + ".dds";
+        WIN32_FILE_ATTRIBUTE_DATA bakedInfo;
+        bool upToDate = GetFileAttributesExA((bakedDir + bakedPath).c_str(), GetFileExInfoStandard, &bakedInfo) != 0 &&
+            CompareFileTime(&bakedInfo.ftLastWriteTime, &source.lastWriteTime) > 0;
+        if (!upToDate && !BakeTexture(storageDir + source.relativePath, bakedDir + bakedPath, device, maxTexSize, alphaTestCutoff))
+        {
+            cout << "Failed to bake \"" << source.relativePath << "\"." << endl;
+            ++numFailed;
+            continue;
+        }
+        // Source path relative to the storage, its size when baked, and the baked file relative to the baked directory.
+        manifest << source.relativePath << "\t" << source.size << "\t" << bakedPath << endl;
+    }
+
+    CreateDirectoriesForFile(bakedDir + cBakedManifestName);
+    std::ofstream manifestFile((bakedDir + cBakedManifestName).c_str(), ios::out | ios::trunc);
+    manifestFile << manifest.str();
+    if (!manifestFile)
+    {
+        cout << "Failed to write \"" << bakedDir << cBakedManifestName << "\"!" << endl;
+        ++numFailed;
+    }
+    cout << "Baked " << (sources.size() - numFailed) << " textures, " << numFailed << " failed." << endl;
+    return numFailed;
+}
+
 // Taken from http://msdn.microsoft.com/en-us/library/ms633575(VS.85).aspx
 BOOL InitApplication(HINSTANCE hinstance)
 { 
@@ -764,6 +951,9 @@ int main(int argc, char **argv)
     {
         cout << "This tool converts the given input file from any file format to .dds. The surface format of the .dds is chosen to match the original input file." << endl;
         cout << "Usage: " << argv[0] << " inputFilename [--hasalpha] [--maxtexsize pow2number]" << endl;
+        cout << "   or: " << argv[0] << " --bake storageDirectory [--maxtexsize pow2number]" << endl;
+        cout << "--bake: Converts all the textures of the asset storage directory to DXT1/DXT5-compressed .dds files with mipmaps, " <<
+            "to the " << cBakedDirName << " subdirectory of the storage, which Tundra then loads in place of the source textures." << endl;
         cout << "--hasalpha: If specified, the input file will be converted only if it has an alpha channel." << endl;
         cout << "If NOT specified, the input file will be converted only it it DOES NOT contain an alpha channel." << endl;
         cout << "--maxtexsize: If a value is specified, the input file will be shrunk (retaining aspect ratio) so its width and height are smaller or equal to the given limit." << endl;
@@ -778,8 +968,21 @@ int main(int argc, char **argv)
     int alphaCutoff  = ParseParameter(argc, argv, "--alphatest", true, -1);
 
     LPDIRECT3DDEVICE9 device = InitD3DDevice(d3d9);
-    ConvertFileToDDS(argv[1], device, alphaChoose, maxTexSize, alphaCutoff);
+    int result = 0;
+    if (!strcmp(argv[1], "--bake"))
+    {
+        if (argc < 3)
+        {
+            cout << "--bake requires the storage directory to bake!" << endl;
+            result = 1;
+        }
+        else
+            result = (BakeStorage(argv[2], device, maxTexSize, alphaCutoff) == 0) ? 0 : 1;
+    }
+    else
+        ConvertFileToDDS(argv[1], device, alphaChoose, maxTexSize, alphaCutoff);
 
     device->Release();
     d3d9->Release();
+    return result;
 }